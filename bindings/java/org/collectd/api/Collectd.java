@@ -175,6 +175,15 @@ public class Collectd
   native public static int registerWrite (String name,
       CollectdWriteInterface object);
 
+  /**
+   * Java representation of collectd/src/plugin.h:plugin_register_write_batch
+   *
+   * @return Zero when successful, non-zero otherwise.
+   * @see CollectdWriteBatchInterface
+   */
+  native public static int registerWriteBatch (String name,
+      CollectdWriteBatchInterface object);
+
   /**
    * Java representation of collectd/src/plugin.h:plugin_register_flush
    *
@@ -1,6 +1,6 @@
 /**
- * collectd - src/utils_crc32.h
- * Copyright (C) 2014       Pierre-Yves Ritschard
+ * collectd - bindings/java/org/collectd/api/CollectdWriteBatchInterface.java
+ * Copyright (C) 2016       collectd contributors
  *
  * Permission is hereby granted, free of charge, to any person obtaining a
  * copy of this software and associated documentation files (the "Software"),
@@ -19,14 +19,17 @@
  * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
  * DEALINGS IN THE SOFTWARE.
- *
- * Authors:
- *   Pierre-Yves Ritschard <pyr at spootnik.org>
  */
 
-#ifndef UTILS_CRC32_H
-#define UTILS_CRC32_H 1
-
-uint32_t               crc32_buffer(const unsigned char *, size_t);
+package org.collectd.api;
 
-#endif
+/**
+ * Interface for objects implementing a write method which receives many
+ * value lists at once.
+ *
+ * @see Collectd#registerWriteBatch
+ */
+public interface CollectdWriteBatchInterface
+{
+	public int write (ValueList[] vls);
+}
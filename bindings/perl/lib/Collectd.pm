@@ -263,6 +263,58 @@ sub plugin_call_all {
 	return 1;
 }
 
+# Collectd::plugin_call_write_batch (batch).
+#
+# batch:
+#   reference to an array of [ $type, $ds, $vl ] triples, each of which is
+#   passed to the write callbacks like the arguments of plugin_call_all.
+#
+# The list of write callbacks is looked up only once per batch.
+sub plugin_call_write_batch {
+	my $batch = shift;
+
+	my %plugins;
+	my $interval;
+
+	our $cb_name = undef;
+
+	{
+		lock %{$plugins[TYPE_WRITE]};
+		%plugins = %{$plugins[TYPE_WRITE]};
+	}
+
+	$interval = plugin_get_interval ();
+
+	foreach my $plugin (keys %plugins) {
+		my $p = $plugins{$plugin};
+
+		my $failed = 0;
+
+		if ($p->{'wait_left'} > 0) {
+			$p->{'wait_left'} -= $interval;
+		}
+
+		next if ($p->{'wait_left'} > 0);
+
+		$cb_name = $p->{'cb_name'};
+
+		foreach my $args (@$batch) {
+			next if (call_by_name (@$args));
+
+			my $err = $@ ? $@ : "callback returned false";
+			ERROR ("Execution of callback \"$cb_name\" failed: $err");
+			WARNING ("${plugin}->write() failed with status 0.");
+			$failed = 1;
+		}
+
+		if (! $failed) {
+			$p->{'wait_left'} = 0;
+			$p->{'wait_time'} = $interval;
+		}
+	}
+	return 1;
+}
+
 # Collectd::plugin_register (type, name, data).
 #
 # type:
@@ -0,0 +1,105 @@
+#!/usr/bin/env python
+# vim: sts=4 sw=4 et
+
+# Prints segment files written by collectd's write_binlog plugin.
+#
+# Usage: binlog_dump.py [-s] FILE [FILE ...]
+#
+# Every value list is printed as one line, in the format of the csv plugin:
+#   <identifier> <epoch>,<value>[,<value>...]
+# With "-s", only the series defined in each segment are printed.
+#
+# Segment layout (see src/write_binlog.c):
+#   header (64 bytes): magic "CDBINLOG", uint32 byte order (0x01020304),
+#     uint32 version, uint64 start time, uint64 bytes used, 32 reserved bytes
+#   records, each a multiple of 8 bytes, starting with
+#     uint32 series id, uint16 type, uint16 size
+#   type 2 (series): uint64 interval, uint32 identifier hash,
+#     uint16 number of values, uint16 identifier size, one uint8 data source
+#     type per value, the NUL terminated identifier, padding
+#   type 1 (values): uint64 time, one 64 bit value per data source
+# Times are cdtime_t, i.e. seconds * 2^30.
+
+import struct
+import sys
+
+MAGIC = b'CDBINLOG'
+HEADER_SIZE = 64
+RECORD_VALUES = 1
+RECORD_SERIES = 2
+
+# DS_TYPE_COUNTER, DS_TYPE_GAUGE, DS_TYPE_DERIVE, DS_TYPE_ABSOLUTE
+VALUE_FORMATS = ['Q', 'd', 'q', 'Q']
+
+
+def cdtime_to_double(t):
+    return t / 1073741824.0
+
+
+def dump(path, series_only):
+    f = open(path, 'rb')
+    data = f.read()
+    f.close()
+
+    if len(data) < HEADER_SIZE or data[0:8] != MAGIC:
+        raise ValueError('%s: not a binlog segment' % path)
+
+    if struct.unpack('<I', data[8:12])[0] == 0x01020304:
+        bo = '<'
+    elif struct.unpack('>I', data[8:12])[0] == 0x01020304:
+        bo = '>'
+    else:
+        raise ValueError('%s: unknown byte order' % path)
+
+    (version, start, used) = struct.unpack(bo + 'IQQ', data[12:32])
+    if version != 1:
+        raise ValueError('%s: unsupported version %d' % (path, version))
+    used = min(used, len(data))
+
+    series = {}
+    offset = HEADER_SIZE
+    while offset + 8 <= used:
+        (sid, rtype, size) = struct.unpack(bo + 'IHH', data[offset:offset + 8])
+        if size < 8 or offset + size > used:
+            break
+        body = data[offset + 8:offset + size]
+
+        if rtype == RECORD_SERIES:
+            (interval, ihash, num, isize) = struct.unpack(bo + 'QIHH',
+                                                           body[0:16])
+            types = struct.unpack('%dB' % num, body[16:16 + num])
+            name = body[16 + num:16 + num + isize - 1].decode('utf-8',
+                                                               'replace')
+            series[sid] = (name, types)
+            if series_only:
+                print('%d %s interval=%.3f types=%s' % (
+                    sid, name, cdtime_to_double(interval),
+                    ','.join([str(t) for t in types])))
+        elif rtype == RECORD_VALUES and not series_only:
+            if sid not in series:
+                raise ValueError('%s: undefined series %d at offset %d'
+                                 % (path, sid, offset))
+            (name, types) = series[sid]
+            fmt = bo + 'Q' + ''.join([VALUE_FORMATS[t] for t in types])
+            values = struct.unpack(fmt, body[0:8 * (1 + len(types))])
+            print('%s %.3f,%s' % (name, cdtime_to_double(values[0]),
+                                  ','.join([repr(v) for v in values[1:]])))
+
+        offset += size
+
+
+def main(argv):
+    series_only = False
+    if len(argv) > 1 and argv[1] == '-s':
+        series_only = True
+        argv = argv[0:1] + argv[2:]
+    if len(argv) < 2:
+        sys.stderr.write('Usage: %s [-s] FILE [FILE ...]\n' % argv[0])
+        return 1
+    for path in argv[1:]:
+        dump(path, series_only)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
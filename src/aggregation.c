@@ -39,6 +39,11 @@
 #define AGG_MATCHES_ALL(str) (strcmp ("/.*/", str) == 0)
 #define AGG_FUNC_PLACEHOLDER "%{aggregation}"
 
+/* Number of partial aggregates per instance. Each write thread updates "its"
+ * partial aggregate, so that write threads don't contend for the same lock.
+ * agg_instance_read() merges the partial aggregates. */
+#define AGG_PARTIALS_NUM 16
+
 struct aggregation_s /* {{{ */
 {
   identifier_t ident;
@@ -60,14 +65,9 @@ struct aggregation_s /* {{{ */
 }; /* }}} */
 typedef struct aggregation_s aggregation_t;
 
-struct agg_instance_s;
-typedef struct agg_instance_s agg_instance_t;
-struct agg_instance_s /* {{{ */
+struct agg_partial_s /* {{{ */
 {
   pthread_mutex_t lock;
-  identifier_t ident;
-
-  int ds_type;
 
   derive_t num;
   gauge_t sum;
@@ -75,6 +75,20 @@ struct agg_instance_s /* {{{ */
 
   gauge_t min;
   gauge_t max;
+}; /* }}} */
+typedef struct agg_partial_s agg_partial_t;
+
+struct agg_instance_s;
+typedef struct agg_instance_s agg_instance_t;
+struct agg_instance_s /* {{{ */
+{
+  /* Protects the state_* members. */
+  pthread_mutex_t lock;
+  identifier_t ident;
+
+  int ds_type;
+
+  agg_partial_t partials[AGG_PARTIALS_NUM];
 
   rate_to_value_state_t *state_num;
   rate_to_value_state_t *state_sum;
@@ -91,6 +105,11 @@ static lookup_t *lookup = NULL;
 static pthread_mutex_t agg_instance_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static agg_instance_t *agg_instance_list_head = NULL;
 
+/* Index of the partial aggregate used by the calling thread, plus one. */
+static pthread_key_t agg_partial_key;
+static pthread_mutex_t agg_partial_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t agg_partial_next = 0;
+
 static _Bool agg_is_regex (char const *str) /* {{{ */
 {
   size_t len;
@@ -108,6 +127,34 @@ static _Bool agg_is_regex (char const *str) /* {{{ */
     return (0);
 } /* }}} _Bool agg_is_regex */
 
+/* Returns the index of the partial aggregate the calling thread updates.
+ * Threads are assigned round-robin on their first call. */
+static size_t agg_partial_index (void) /* {{{ */
+{
+  uintptr_t idx;
+
+  idx = (uintptr_t) pthread_getspecific (agg_partial_key);
+  if (idx != 0)
+    return ((size_t) (idx - 1));
+
+  pthread_mutex_lock (&agg_partial_lock);
+  idx = (uintptr_t) (agg_partial_next % AGG_PARTIALS_NUM);
+  agg_partial_next++;
+  pthread_mutex_unlock (&agg_partial_lock);
+
+  pthread_setspecific (agg_partial_key, (void *) (idx + 1));
+  return ((size_t) idx);
+} /* }}} size_t agg_partial_index */
+
+static void agg_partial_reset (agg_partial_t *p) /* {{{ */
+{
+  p->num = 0;
+  p->sum = 0.0;
+  p->squares_sum = 0.0;
+  p->min = NAN;
+  p->max = NAN;
+} /* }}} void agg_partial_reset */
+
 static void agg_destroy (aggregation_t *agg) /* {{{ */
 {
   sfree (agg);
@@ -116,6 +163,8 @@ static void agg_destroy (aggregation_t *agg) /* {{{ */
 /* Frees all dynamically allocated memory within the instance. */
 static void agg_instance_destroy (agg_instance_t *inst) /* {{{ */
 {
+  size_t i;
+
   if (inst == NULL)
     return;
 
@@ -133,6 +182,9 @@ static void agg_instance_destroy (agg_instance_t *inst) /* {{{ */
   }
   pthread_mutex_unlock (&agg_instance_list_lock);
 
+  for (i = 0; i < AGG_PARTIALS_NUM; i++)
+    pthread_mutex_destroy (&inst->partials[i].lock);
+
   sfree (inst->state_num);
   sfree (inst->state_sum);
   sfree (inst->state_average);
@@ -142,8 +194,6 @@ static void agg_instance_destroy (agg_instance_t *inst) /* {{{ */
 
   memset (inst, 0, sizeof (*inst));
   inst->ds_type = -1;
-  inst->min = NAN;
-  inst->max = NAN;
 } /* }}} void agg_instance_destroy */
 
 static int agg_instance_create_name (agg_instance_t *inst, /* {{{ */
@@ -237,6 +287,7 @@ static agg_instance_t *agg_instance_create (data_set_t const *ds, /* {{{ */
     value_list_t const *vl, aggregation_t *agg)
 {
   agg_instance_t *inst;
+  size_t i;
 
   DEBUG ("aggregation plugin: Creating new instance.");
 
@@ -252,8 +303,11 @@ static agg_instance_t *agg_instance_create (data_set_t const *ds, /* {{{ */
 
   agg_instance_create_name (inst, vl, agg);
 
-  inst->min = NAN;
-  inst->max = NAN;
+  for (i = 0; i < AGG_PARTIALS_NUM; i++)
+  {
+    pthread_mutex_init (&inst->partials[i].lock, /* attr = */ NULL);
+    agg_partial_reset (&inst->partials[i]);
+  }
 
 #define INIT_STATE(field) do { \
   inst->state_ ## field = NULL; \
@@ -292,6 +346,7 @@ static agg_instance_t *agg_instance_create (data_set_t const *ds, /* {{{ */
 static int agg_instance_update (agg_instance_t *inst, /* {{{ */
     data_set_t const *ds, value_list_t const *vl)
 {
+  agg_partial_t *p;
   gauge_t *rate;
 
   if (ds->ds_num != 1)
@@ -318,18 +373,21 @@ static int agg_instance_update (agg_instance_t *inst, /* {{{ */
     return (0);
   }
 
-  pthread_mutex_lock (&inst->lock);
+  /* The lock is only contended while agg_read() merges this partial
+   * aggregate or if there are more write threads than partial aggregates. */
+  p = &inst->partials[agg_partial_index ()];
+  pthread_mutex_lock (&p->lock);
 
-  inst->num++;
-  inst->sum += rate[0];
-  inst->squares_sum += (rate[0] * rate[0]);
+  p->num++;
+  p->sum += rate[0];
+  p->squares_sum += (rate[0] * rate[0]);
 
-  if (isnan (inst->min) || (inst->min > rate[0]))
-    inst->min = rate[0];
-  if (isnan (inst->max) || (inst->max < rate[0]))
-    inst->max = rate[0];
+  if (isnan (p->min) || (p->min > rate[0]))
+    p->min = rate[0];
+  if (isnan (p->max) || (p->max < rate[0]))
+    p->max = rate[0];
 
-  pthread_mutex_unlock (&inst->lock);
+  pthread_mutex_unlock (&p->lock);
 
   sfree (rate);
   return (0);
@@ -377,6 +435,12 @@ static int agg_instance_read_func (agg_instance_t *inst, /* {{{ */
 static int agg_instance_read (agg_instance_t *inst, cdtime_t t) /* {{{ */
 {
   value_list_t vl = VALUE_LIST_INIT;
+  derive_t num = 0;
+  gauge_t sum = 0.0;
+  gauge_t squares_sum = 0.0;
+  gauge_t min = NAN;
+  gauge_t max = NAN;
+  size_t i;
 
   /* Pre-set all the fields in the value list that will not change per
    * aggregation type (sum, average, ...). The struct will be re-used and must
@@ -406,29 +470,42 @@ static int agg_instance_read (agg_instance_t *inst, cdtime_t t) /* {{{ */
   } \
 } while (0)
 
+  /* Merge and reset the partial aggregates. */
+  for (i = 0; i < AGG_PARTIALS_NUM; i++)
+  {
+    agg_partial_t *p = &inst->partials[i];
+
+    pthread_mutex_lock (&p->lock);
+    if (p->num > 0)
+    {
+      num += p->num;
+      sum += p->sum;
+      squares_sum += p->squares_sum;
+      if (isnan (min) || (min > p->min))
+        min = p->min;
+      if (isnan (max) || (max < p->max))
+        max = p->max;
+    }
+    agg_partial_reset (p);
+    pthread_mutex_unlock (&p->lock);
+  }
+
   pthread_mutex_lock (&inst->lock);
 
-  READ_FUNC (num, (gauge_t) inst->num);
+  READ_FUNC (num, (gauge_t) num);
 
   /* All other aggregations are only defined when there have been any values
    * at all. */
-  if (inst->num > 0)
+  if (num > 0)
   {
-    READ_FUNC (sum, inst->sum);
-    READ_FUNC (average, (inst->sum / ((gauge_t) inst->num)));
-    READ_FUNC (min, inst->min);
-    READ_FUNC (max, inst->max);
-    READ_FUNC (stddev, sqrt((((gauge_t) inst->num) * inst->squares_sum)
-          - (inst->sum * inst->sum)) / ((gauge_t) inst->num));
+    READ_FUNC (sum, sum);
+    READ_FUNC (average, (sum / ((gauge_t) num)));
+    READ_FUNC (min, min);
+    READ_FUNC (max, max);
+    READ_FUNC (stddev, sqrt((((gauge_t) num) * squares_sum)
+          - (sum * sum)) / ((gauge_t) num));
   }
 
-  /* Reset internal state. */
-  inst->num = 0;
-  inst->sum = 0.0;
-  inst->squares_sum = 0.0;
-  inst->min = NAN;
-  inst->max = NAN;
-
   pthread_mutex_unlock (&inst->lock);
 
   meta_data_destroy (vl.meta);
@@ -780,6 +857,8 @@ static int agg_write (data_set_t const *ds, value_list_t const *vl, /* {{{ */
 
 void module_register (void)
 {
+  pthread_key_create (&agg_partial_key, /* destructor = */ NULL);
+
   plugin_register_complex_config ("aggregation", agg_config);
   plugin_register_read ("aggregation", agg_read);
   plugin_register_write ("aggregation", agg_write, /* user_data = */ NULL);
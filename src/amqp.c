@@ -30,6 +30,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_cmd_putval.h"
+#include "utils_format_binary.h"
 #include "utils_format_json.h"
 #include "utils_format_graphite.h"
 
@@ -60,9 +61,23 @@ int amqp_socket_close(amqp_socket_t *);
 #define CAMQP_FORMAT_COMMAND    1
 #define CAMQP_FORMAT_JSON       2
 #define CAMQP_FORMAT_GRAPHITE   3
+#define CAMQP_FORMAT_BINARY     4
 
 #define CAMQP_CHANNEL 1
 
+/* Publisher confirms need amqp_confirm_select() to enable them and
+ * amqp_simple_wait_frame_noblock() to handle them without blocking. */
+#if HAVE_AMQP_CONFIRM_SELECT && HAVE_AMQP_SIMPLE_WAIT_FRAME_NOBLOCK
+# define CAMQP_HAVE_CONFIRMS 1
+#else
+# define CAMQP_HAVE_CONFIRMS 0
+#endif
+
+/* Number of unconfirmed messages after which publishing waits for confirms,
+ * and how long it waits (in seconds) before giving up on the connection. */
+#define CAMQP_CONFIRMS_MAX     1024
+#define CAMQP_CONFIRMS_TIMEOUT 10
+
 /*
  * Data types
  */
@@ -82,6 +97,7 @@ struct camqp_config_s
 
     /* Number of seconds to wait before connection is retried */
     int     connection_retry_delay;
+    time_t  last_connect_time;
 
     /* publish only */
     uint8_t delivery_mode;
@@ -92,12 +108,27 @@ struct camqp_config_s
     char    *postfix;
     char    escape_char;
     unsigned int graphite_flags;
+    graphite_cache_t *graphite_cache;
+    /* publish & json format only */
+    format_json_cache_t *json_cache;
+    /* Maximum number of value lists sent in one message. */
+    size_t  batch_size;
+    /* Delivery tag of the last message published and of the last message
+     * confirmed by the broker, if publisher confirms are enabled. */
+    _Bool   publisher_confirms;
+    uint64_t confirms_published;
+    uint64_t confirms_acked;
 
     /* subscribe only */
     char   *exchange_type;
     char   *queue;
     _Bool   queue_durable;
     _Bool   queue_auto_delete;
+    /* If non-zero, deliveries are acknowledged and the broker sends at most
+     * this many unacknowledged deliveries to each consumer thread. */
+    uint16_t prefetch_count;
+    int     unacked;
+    int     consumer_threads;
 
     amqp_connection_state_t connection;
     pthread_mutex_t lock;
@@ -129,6 +160,14 @@ static void camqp_close_connection (camqp_config_t *conf) /* {{{ */
     if ((conf == NULL) || (conf->connection == NULL))
         return;
 
+    if (conf->confirms_published > conf->confirms_acked)
+        WARNING ("amqp plugin: Closing the connection \"%s\" with %"PRIu64
+                " unconfirmed messages, which may have been lost.",
+                conf->name, conf->confirms_published - conf->confirms_acked);
+    conf->confirms_published = 0;
+    conf->confirms_acked = 0;
+    conf->unacked = 0;
+
     sockfd = amqp_get_sockfd (conf->connection);
     amqp_channel_close (conf->connection, CAMQP_CHANNEL, AMQP_REPLY_SUCCESS);
     amqp_connection_close (conf->connection, AMQP_REPLY_SUCCESS);
@@ -157,11 +196,56 @@ static void camqp_config_free (void *ptr) /* {{{ */
     sfree (conf->routing_key);
     sfree (conf->prefix);
     sfree (conf->postfix);
-
+    graphite_cache_destroy (conf->graphite_cache);
+    format_json_cache_destroy (conf->json_cache);
 
     sfree (conf);
 } /* }}} void camqp_config_free */
 
+/* Copies the configuration of a Subscribe block for another consumer thread,
+ * which uses its own connection. */
+static camqp_config_t *camqp_config_copy (camqp_config_t const *src) /* {{{ */
+{
+    camqp_config_t *dst;
+    _Bool failed = 0;
+
+    dst = malloc (sizeof (*dst));
+    if (dst == NULL)
+        return (NULL);
+    memcpy (dst, src, sizeof (*dst));
+
+    dst->connection = NULL;
+    dst->graphite_cache = NULL;
+    dst->json_cache = NULL;
+    pthread_mutex_init (&dst->lock, /* attr = */ NULL);
+
+#define CAMQP_COPY_STRING(f) do { \
+    dst->f = NULL; \
+    if ((src->f != NULL) && ((dst->f = strdup (src->f)) == NULL)) \
+        failed = 1; \
+} while (0)
+    CAMQP_COPY_STRING (name);
+    CAMQP_COPY_STRING (host);
+    CAMQP_COPY_STRING (vhost);
+    CAMQP_COPY_STRING (user);
+    CAMQP_COPY_STRING (password);
+    CAMQP_COPY_STRING (exchange);
+    CAMQP_COPY_STRING (exchange_type);
+    CAMQP_COPY_STRING (queue);
+    CAMQP_COPY_STRING (routing_key);
+    CAMQP_COPY_STRING (prefix);
+    CAMQP_COPY_STRING (postfix);
+#undef CAMQP_COPY_STRING
+
+    if (failed)
+    {
+        camqp_config_free (dst);
+        return (NULL);
+    }
+
+    return (dst);
+} /* }}} camqp_config_t *camqp_config_copy */
+
 static char *camqp_bytes_cstring (amqp_bytes_t *in) /* {{{ */
 {
     char *ret;
@@ -389,12 +473,31 @@ static int camqp_setup_queue (camqp_config_t *conf) /* {{{ */
                 conf->queue, conf->exchange);
     } /* if (conf->exchange != NULL) */
 
+    if (conf->prefetch_count > 0)
+    {
+        amqp_basic_qos_ok_t *qos_ret;
+
+        qos_ret = amqp_basic_qos (conf->connection,
+                /* channel        = */ CAMQP_CHANNEL,
+                /* prefetch_size  = */ 0,
+                /* prefetch_count = */ conf->prefetch_count,
+                /* global         = */ 0);
+        if ((qos_ret == NULL) && camqp_is_error (conf))
+        {
+            char errbuf[1024];
+            ERROR ("amqp plugin: amqp_basic_qos failed: %s",
+                    camqp_strerror (conf, errbuf, sizeof (errbuf)));
+            camqp_close_connection (conf);
+            return (-1);
+        }
+    }
+
     cm_ret = amqp_basic_consume (conf->connection,
             /* channel      = */ CAMQP_CHANNEL,
             /* queue        = */ amqp_cstring_bytes (conf->queue),
             /* consumer_tag = */ AMQP_EMPTY_BYTES,
             /* no_local     = */ 0,
-            /* no_ack       = */ 1,
+            /* no_ack       = */ (conf->prefetch_count == 0),
             /* exclusive    = */ 0,
             /* arguments    = */ AMQP_EMPTY_TABLE
         );
@@ -412,8 +515,6 @@ static int camqp_setup_queue (camqp_config_t *conf) /* {{{ */
 
 static int camqp_connect (camqp_config_t *conf) /* {{{ */
 {
-    static time_t last_connect_time = 0;
-
     amqp_rpc_reply_t reply;
     int status;
 #ifdef HAVE_AMQP_TCP_SOCKET
@@ -426,7 +527,7 @@ static int camqp_connect (camqp_config_t *conf) /* {{{ */
         return (0);
 
     time_t now = time(NULL);
-    if (now < (last_connect_time + conf->connection_retry_delay))
+    if (now < (conf->last_connect_time + conf->connection_retry_delay))
     {
         DEBUG("amqp plugin: skipping connection retry, "
             "ConnectionRetryDelay: %d", conf->connection_retry_delay);
@@ -435,7 +536,7 @@ static int camqp_connect (camqp_config_t *conf) /* {{{ */
     else
     {
         DEBUG ("amqp plugin: retrying connection");
-        last_connect_time = now;
+        conf->last_connect_time = now;
     }
 
     conf->connection = amqp_new_connection ();
@@ -522,6 +623,23 @@ static int camqp_connect (camqp_config_t *conf) /* {{{ */
     if (status != 0)
         return (status);
 
+#if CAMQP_HAVE_CONFIRMS
+    if (conf->publish && conf->publisher_confirms)
+    {
+        amqp_confirm_select_ok_t *cs_ret;
+
+        cs_ret = amqp_confirm_select (conf->connection, CAMQP_CHANNEL);
+        if ((cs_ret == NULL) && camqp_is_error (conf))
+        {
+            char errbuf[1024];
+            ERROR ("amqp plugin: amqp_confirm_select failed: %s",
+                    camqp_strerror (conf, errbuf, sizeof (errbuf)));
+            camqp_close_connection (conf);
+            return (-1);
+        }
+    }
+#endif
+
     if (!conf->publish)
         return (camqp_setup_queue (conf));
     return (0);
@@ -555,16 +673,84 @@ static int camqp_shutdown (void) /* {{{ */
 /*
  * Subscribing code
  */
+/* Dispatches a body of several PUTVAL lines, as sent by publishers with a
+ * "BatchSize" greater than one. Failed lines are reported in one message. */
+static int camqp_handle_putval_lines (char *body) /* {{{ */
+{
+    putval_batch_t batch = PUTVAL_BATCH_INIT;
+    char command[] = "BATCH NOREPLY";
+    char end[] = "END";
+    char *line;
+    char *saveptr = NULL;
+    int status;
+
+    status = handle_putval_batch (stderr, command, &batch);
+    if (status != 0)
+        return (status);
+
+    for (line = strtok_r (body, "\r\n", &saveptr);
+            (line != NULL) && batch.active;
+            line = strtok_r (NULL, "\r\n", &saveptr))
+        handle_putval_batch (stderr, line, &batch);
+
+    /* The body may end the batch itself with an "END" line. */
+    if (!batch.active)
+        return (0);
+    return (handle_putval_batch (stderr, end, &batch));
+} /* }}} int camqp_handle_putval_lines */
+
+static int camqp_dispatch_body (char *body, /* {{{ */
+        const char *content_type)
+{
+    int status;
+
+    if (strcasecmp ("text/collectd", content_type) == 0)
+    {
+        char *end = strchr (body, '\n');
+
+        if ((end != NULL) && (end[strspn (end, "\r\n")] != 0))
+            return (camqp_handle_putval_lines (body));
+
+        status = handle_putval (stderr, body);
+        if (status != 0)
+            ERROR ("amqp plugin: handle_putval failed with status %i.",
+                    status);
+        return (status);
+    }
+    else if (strcasecmp ("application/json", content_type) == 0)
+    {
+        ERROR ("amqp plugin: camqp_read_body: Parsing JSON data has not "
+                "been implemented yet. FIXME!");
+        return (0);
+    }
+    else
+    {
+        ERROR ("amqp plugin: camqp_read_body: Unknown content type \"%s\".",
+                content_type);
+        return (EINVAL);
+    }
+
+    /* not reached */
+    return (0);
+} /* }}} int camqp_dispatch_body */
+
 static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         size_t body_size, const char *content_type)
 {
-    char body[body_size + 1];
+    char *body;
     char *body_ptr;
     size_t received;
     amqp_frame_t frame;
     int status;
 
-    memset (body, 0, sizeof (body));
+    /* Batched bodies may be much larger than a single value list, so the
+     * body isn't kept on the stack. */
+    body = calloc (1, body_size + 1);
+    if (body == NULL)
+    {
+        ERROR ("amqp plugin: calloc failed.");
+        return (ENOMEM);
+    }
     body_ptr = &body[0];
     received = 0;
 
@@ -578,6 +764,7 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
             ERROR ("amqp plugin: amqp_simple_wait_frame failed: %s",
                     sstrerror (status, errbuf, sizeof (errbuf)));
             camqp_close_connection (conf);
+            sfree (body);
             return (status);
         }
 
@@ -585,12 +772,14 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         {
             NOTICE ("amqp plugin: Unexpected frame type: %#"PRIx8,
                     frame.frame_type);
+            sfree (body);
             return (-1);
         }
 
         if ((body_size - received) < frame.payload.body_fragment.len)
         {
             WARNING ("amqp plugin: Body is larger than indicated by header.");
+            sfree (body);
             return (-1);
         }
 
@@ -600,29 +789,9 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         received += frame.payload.body_fragment.len;
     } /* while (received < body_size) */
 
-    if (strcasecmp ("text/collectd", content_type) == 0)
-    {
-        status = handle_putval (stderr, body);
-        if (status != 0)
-            ERROR ("amqp plugin: handle_putval failed with status %i.",
-                    status);
-        return (status);
-    }
-    else if (strcasecmp ("application/json", content_type) == 0)
-    {
-        ERROR ("amqp plugin: camqp_read_body: Parsing JSON data has not "
-                "been implemented yet. FIXME!");
-        return (0);
-    }
-    else
-    {
-        ERROR ("amqp plugin: camqp_read_body: Unknown content type \"%s\".",
-                content_type);
-        return (EINVAL);
-    }
-
-    /* not reached */
-    return (0);
+    status = camqp_dispatch_body (body, content_type);
+    sfree (body);
+    return (status);
 } /* }}} int camqp_read_body */
 
 static int camqp_read_header (camqp_config_t *conf) /* {{{ */
@@ -666,6 +835,35 @@ static int camqp_read_header (camqp_config_t *conf) /* {{{ */
     return (status);
 } /* }}} int camqp_read_header */
 
+/* Acknowledges all deliveries up to and including "delivery_tag" once half of
+ * the prefetch window is used or no more deliveries are buffered, i.e. before
+ * the thread would block waiting for the broker. */
+static void camqp_ack (camqp_config_t *conf, uint64_t delivery_tag) /* {{{ */
+{
+    int status;
+
+    /* Unacknowledged deliveries are redelivered after reconnecting. */
+    if (conf->connection == NULL)
+        return;
+
+    conf->unacked++;
+    if ((conf->unacked < (conf->prefetch_count + 1) / 2)
+            && (amqp_data_in_buffer (conf->connection)
+                || amqp_frames_enqueued (conf->connection)))
+        return;
+
+    status = amqp_basic_ack (conf->connection, CAMQP_CHANNEL,
+            delivery_tag, /* multiple = */ 1);
+    if (status != 0)
+    {
+        ERROR ("amqp plugin: amqp_basic_ack failed with status %i.", status);
+        camqp_close_connection (conf);
+        return;
+    }
+
+    conf->unacked = 0;
+} /* }}} void camqp_ack */
+
 static void *camqp_subscribe_thread (void *user_data) /* {{{ */
 {
     camqp_config_t *conf = user_data;
@@ -676,6 +874,7 @@ static void *camqp_subscribe_thread (void *user_data) /* {{{ */
     while (subscriber_threads_running)
     {
         amqp_frame_t frame;
+        uint64_t delivery_tag;
 
         status = camqp_connect (conf);
         if (status != 0)
@@ -716,9 +915,17 @@ static void *camqp_subscribe_thread (void *user_data) /* {{{ */
             continue;
         }
 
+        delivery_tag = ((amqp_basic_deliver_t *)
+                frame.payload.method.decoded)->delivery_tag;
+
         camqp_read_header (conf);
 
-        amqp_maybe_release_buffers (conf->connection);
+        if (conf->prefetch_count > 0)
+            camqp_ack (conf, delivery_tag);
+
+        /* camqp_read_header() closes the connection upon failure. */
+        if (conf->connection != NULL)
+            amqp_maybe_release_buffers (conf->connection);
     } /* while (subscriber_threads_running) */
 
     camqp_config_free (conf);
@@ -762,11 +969,101 @@ static int camqp_subscribe_init (camqp_config_t *conf) /* {{{ */
 /*
  * Publishing code
  */
+#if CAMQP_HAVE_CONFIRMS
+/* Handles the confirms the broker has sent so far without blocking. Once
+ * CAMQP_CONFIRMS_MAX messages are unconfirmed, waits for confirms, so that a
+ * slow broker slows down the writer instead of messages piling up.
+ * XXX: You must hold "conf->lock" when calling this function! */
+static int camqp_handle_confirms (camqp_config_t *conf) /* {{{ */
+{
+    while (conf->connection != NULL)
+    {
+        struct timeval tv = { 0, 0 };
+        amqp_frame_t frame;
+        uint64_t delivery_tag;
+        _Bool block;
+        int status;
+
+        block = (conf->confirms_published - conf->confirms_acked)
+            >= CAMQP_CONFIRMS_MAX;
+        if (block)
+            tv.tv_sec = CAMQP_CONFIRMS_TIMEOUT;
+
+        status = amqp_simple_wait_frame_noblock (conf->connection,
+                &frame, &tv);
+        if (status == AMQP_STATUS_TIMEOUT)
+        {
+            if (!block)
+                break;
+
+            ERROR ("amqp plugin: The broker has not confirmed %"PRIu64
+                    " messages within %i seconds.",
+                    conf->confirms_published - conf->confirms_acked,
+                    CAMQP_CONFIRMS_TIMEOUT);
+            camqp_close_connection (conf);
+            return (ETIMEDOUT);
+        }
+        else if (status != AMQP_STATUS_OK)
+        {
+            ERROR ("amqp plugin: amqp_simple_wait_frame_noblock failed "
+                    "with status %i.", status);
+            camqp_close_connection (conf);
+            return (-1);
+        }
+
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+            continue;
+
+        if (frame.payload.method.id == AMQP_BASIC_ACK_METHOD)
+        {
+            amqp_basic_ack_t *m = frame.payload.method.decoded;
+            delivery_tag = m->delivery_tag;
+        }
+        else if (frame.payload.method.id == AMQP_BASIC_NACK_METHOD)
+        {
+            amqp_basic_nack_t *m = frame.payload.method.decoded;
+            delivery_tag = m->delivery_tag;
+            WARNING ("amqp plugin: The broker did not accept %"PRIu64
+                    " messages published by \"%s\".",
+                    (m->multiple && (delivery_tag > conf->confirms_acked))
+                    ? delivery_tag - conf->confirms_acked : 1,
+                    conf->name);
+        }
+        else if ((frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD)
+                || (frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD))
+        {
+            ERROR ("amqp plugin: The broker closed the connection \"%s\".",
+                    conf->name);
+            camqp_close_connection (conf);
+            return (-1);
+        }
+        else
+        {
+            DEBUG ("amqp plugin: Unexpected method id: %#"PRIx32,
+                    frame.payload.method.id);
+            continue;
+        }
+
+        /* The broker confirms messages in the order they were published, so
+         * the last delivery tag tells how many are still unconfirmed. */
+        if (delivery_tag > conf->confirms_acked)
+            conf->confirms_acked = delivery_tag;
+    }
+
+    if (conf->connection == NULL)
+        return (-1);
+
+    amqp_maybe_release_buffers (conf->connection);
+    return (0);
+} /* }}} int camqp_handle_confirms */
+#endif /* CAMQP_HAVE_CONFIRMS */
+
 /* XXX: You must hold "conf->lock" when calling this function! */
 static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
-        const char *buffer, const char *routing_key)
+        const char *buffer, size_t buffer_len, const char *routing_key)
 {
     amqp_basic_properties_t props;
+    amqp_bytes_t body;
     int status;
 
     status = camqp_connect (conf);
@@ -783,11 +1080,16 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
         props.content_type = amqp_cstring_bytes("application/json");
     else if (conf->format == CAMQP_FORMAT_GRAPHITE)
         props.content_type = amqp_cstring_bytes("text/graphite");
+    else if (conf->format == CAMQP_FORMAT_BINARY)
+        props.content_type = amqp_cstring_bytes("application/octet-stream");
     else
         assert (23 == 42);
     props.delivery_mode = conf->delivery_mode;
     props.app_id = amqp_cstring_bytes("collectd");
 
+    body.len = buffer_len;
+    body.bytes = (void *) buffer;
+
     status = amqp_basic_publish(conf->connection,
                 /* channel = */ 1,
                 amqp_cstring_bytes(CONF(conf, exchange)),
@@ -795,23 +1097,61 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
                 /* mandatory = */ 0,
                 /* immediate = */ 0,
                 &props,
-                amqp_cstring_bytes(buffer));
+                body);
     if (status != 0)
     {
         ERROR ("amqp plugin: amqp_basic_publish failed with status %i.",
                 status);
         camqp_close_connection (conf);
+        return (status);
+    }
+
+#if CAMQP_HAVE_CONFIRMS
+    if (conf->publisher_confirms)
+    {
+        /* Delivery tags are counted per channel, starting with one. */
+        conf->confirms_published++;
+        status = camqp_handle_confirms (conf);
     }
+#endif
 
     return (status);
 } /* }}} int camqp_write_locked */
 
+static void camqp_routing_key (camqp_config_t const *conf, /* {{{ */
+        value_list_t const *vl, char *routing_key, size_t routing_key_size)
+{
+    size_t i;
+
+    if (conf->routing_key != NULL)
+    {
+        sstrncpy (routing_key, conf->routing_key, routing_key_size);
+        return;
+    }
+
+    ssnprintf (routing_key, routing_key_size, "collectd/%s/%s/%s/%s/%s",
+            vl->host,
+            vl->plugin, vl->plugin_instance,
+            vl->type, vl->type_instance);
+
+    /* Switch slashes (the only character forbidden by collectd) and dots
+     * (the separation character used by AMQP). */
+    for (i = 0; routing_key[i] != 0; i++)
+    {
+        if (routing_key[i] == '.')
+            routing_key[i] = '/';
+        else if (routing_key[i] == '/')
+            routing_key[i] = '.';
+    }
+} /* }}} void camqp_routing_key */
+
 static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         user_data_t *user_data)
 {
     camqp_config_t *conf = user_data->data;
     char routing_key[6 * DATA_MAX_NAME_LEN];
     char buffer[8192];
+    size_t buffer_len;
     int status;
 
     if ((ds == NULL) || (vl == NULL) || (conf == NULL))
@@ -819,28 +1159,7 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
 
     memset (buffer, 0, sizeof (buffer));
 
-    if (conf->routing_key != NULL)
-    {
-        sstrncpy (routing_key, conf->routing_key, sizeof (routing_key));
-    }
-    else
-    {
-        size_t i;
-        ssnprintf (routing_key, sizeof (routing_key), "collectd/%s/%s/%s/%s/%s",
-                vl->host,
-                vl->plugin, vl->plugin_instance,
-                vl->type, vl->type_instance);
-
-        /* Switch slashes (the only character forbidden by collectd) and dots
-         * (the separation character used by AMQP). */
-        for (i = 0; routing_key[i] != 0; i++)
-        {
-            if (routing_key[i] == '.')
-                routing_key[i] = '/';
-            else if (routing_key[i] == '/')
-                routing_key[i] = '.';
-        }
-    }
+    camqp_routing_key (conf, vl, routing_key, sizeof (routing_key));
 
     if (conf->format == CAMQP_FORMAT_COMMAND)
     {
@@ -858,12 +1177,15 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         size_t bfill = 0;
 
         format_json_initialize (buffer, &bfill, &bfree);
-        format_json_value_list (buffer, &bfill, &bfree, ds, vl, conf->store_rates);
+        format_json_value_list_cached (conf->json_cache,
+                buffer, &bfill, &bfree, ds, vl, conf->store_rates,
+                /* ret_needed = */ NULL);
         format_json_finalize (buffer, &bfill, &bfree);
     }
     else if (conf->format == CAMQP_FORMAT_GRAPHITE)
     {
-        status = format_graphite (buffer, sizeof (buffer), ds, vl,
+        status = format_graphite_cached (conf->graphite_cache,
+                    buffer, sizeof (buffer), ds, vl,
                     conf->prefix, conf->postfix, conf->escape_char,
                     conf->graphite_flags);
         if (status != 0)
@@ -873,19 +1195,260 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
             return (status);
         }
     }
+    else if (conf->format == CAMQP_FORMAT_BINARY)
+    {
+        format_binary_state_t state;
+        size_t bfree = sizeof (buffer);
+        size_t bfill = 0;
+
+        format_binary_initialize (&state);
+        status = format_binary_value_list (&state, buffer, &bfill, &bfree,
+                ds, vl, conf->store_rates);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: format_binary_value_list failed with "
+                    "status %i.", status);
+            return (status);
+        }
+        buffer_len = bfill;
+    }
     else
     {
         ERROR ("amqp plugin: Invalid format (%i).", conf->format);
         return (-1);
     }
 
+    if (conf->format != CAMQP_FORMAT_BINARY)
+        buffer_len = strlen (buffer);
+
     pthread_mutex_lock (&conf->lock);
-    status = camqp_write_locked (conf, buffer, routing_key);
+    status = camqp_write_locked (conf, buffer, buffer_len, routing_key);
     pthread_mutex_unlock (&conf->lock);
 
     return (status);
 } /* }}} int camqp_write */
 
+/* The body of a message with several value lists. It is null-terminated,
+ * except with the "Binary" format. */
+struct camqp_buffer_s
+{
+    char  *data;
+    size_t size;
+    size_t fill;
+    /* The parts already written to the message by format_binary. */
+    format_binary_state_t binary_state;
+};
+typedef struct camqp_buffer_s camqp_buffer_t;
+
+/* Makes room for "len" more bytes, including the terminating null byte. */
+static int camqp_buffer_reserve (camqp_buffer_t *b, size_t len) /* {{{ */
+{
+    size_t size;
+    char *tmp;
+
+    if ((b->size - b->fill) >= len)
+        return (0);
+
+    size = (b->size > 0) ? b->size : 8192;
+    while ((size - b->fill) < len)
+        size *= 2;
+
+    tmp = realloc (b->data, size);
+    if (tmp == NULL)
+        return (ENOMEM);
+
+    b->data = tmp;
+    b->size = size;
+    return (0);
+} /* }}} int camqp_buffer_reserve */
+
+/* Appends one value list to the message. With the "Command" format, the
+ * PUTVAL lines are separated by newlines, so that a message with a single
+ * value list is the same as the message camqp_write() would send. */
+static int camqp_buffer_append (camqp_config_t *conf, /* {{{ */
+        camqp_buffer_t *b, const data_set_t *ds, const value_list_t *vl)
+{
+    char line[8192];
+    size_t len;
+    int status;
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        size_t bfree = b->size - b->fill;
+        size_t needed = 0;
+
+        status = format_json_value_list_cached (conf->json_cache,
+                b->data, &b->fill, &bfree, ds, vl, conf->store_rates,
+                &needed);
+        if ((status == -ENOMEM) && (needed > 0)
+                && (camqp_buffer_reserve (b, needed) == 0))
+        {
+            bfree = b->size - b->fill;
+            status = format_json_value_list_cached (conf->json_cache,
+                    b->data, &b->fill, &bfree, ds, vl, conf->store_rates,
+                    /* ret_needed = */ NULL);
+        }
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: format_json_value_list failed with "
+                    "status %i.", status);
+            return (status);
+        }
+        return (0);
+    }
+
+    if (conf->format == CAMQP_FORMAT_BINARY)
+    {
+        size_t bfree = b->size - b->fill;
+
+        status = format_binary_value_list (&b->binary_state,
+                b->data, &b->fill, &bfree, ds, vl, conf->store_rates);
+        /* Grows the buffer until the value list fits. */
+        while ((status == -ENOMEM)
+                && (camqp_buffer_reserve (b, bfree + 1) == 0))
+        {
+            bfree = b->size - b->fill;
+            status = format_binary_value_list (&b->binary_state,
+                    b->data, &b->fill, &bfree, ds, vl, conf->store_rates);
+        }
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: format_binary_value_list failed with "
+                    "status %i.", status);
+            return (status);
+        }
+        return (0);
+    }
+
+    if (conf->format == CAMQP_FORMAT_COMMAND)
+    {
+        status = create_putval (line, sizeof (line), ds, vl);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: create_putval failed with status %i.",
+                    status);
+            return (status);
+        }
+    }
+    else if (conf->format == CAMQP_FORMAT_GRAPHITE)
+    {
+        status = format_graphite_cached (conf->graphite_cache,
+                    line, sizeof (line), ds, vl,
+                    conf->prefix, conf->postfix, conf->escape_char,
+                    conf->graphite_flags);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: format_graphite failed with status %i.",
+                    status);
+            return (status);
+        }
+    }
+    else
+    {
+        ERROR ("amqp plugin: Invalid format (%i).", conf->format);
+        return (-1);
+    }
+
+    len = strlen (line);
+    if (camqp_buffer_reserve (b, len + 2) != 0)
+    {
+        ERROR ("amqp plugin: realloc failed.");
+        return (ENOMEM);
+    }
+
+    if ((conf->format == CAMQP_FORMAT_COMMAND) && (b->fill > 0))
+        b->data[b->fill++] = '\n';
+    memcpy (b->data + b->fill, line, len);
+    b->fill += len;
+    b->data[b->fill] = 0;
+
+    return (0);
+} /* }}} int camqp_buffer_append */
+
+/* Sends up to "BatchSize" consecutive value lists with the same routing key
+ * in one message: PUTVAL lines, a JSON array, Graphite lines or the parts of
+ * the binary protocol. */
+static int camqp_write_batch (const write_batch_entry_t *entries, /* {{{ */
+        size_t entries_num, user_data_t *user_data)
+{
+    camqp_config_t *conf;
+    camqp_buffer_t b;
+    char routing_key[6 * DATA_MAX_NAME_LEN];
+    char next_key[6 * DATA_MAX_NAME_LEN];
+    size_t i;
+    int failed = 0;
+
+    if ((entries == NULL) || (user_data == NULL) || (user_data->data == NULL))
+        return (EINVAL);
+    conf = user_data->data;
+
+    memset (&b, 0, sizeof (b));
+    if (camqp_buffer_reserve (&b, 8192) != 0)
+    {
+        ERROR ("amqp plugin: malloc failed.");
+        return (ENOMEM);
+    }
+
+    i = 0;
+    while (i < entries_num)
+    {
+        size_t values_num = 0;
+        size_t n;
+        int status;
+
+        camqp_routing_key (conf, entries[i].vl,
+                routing_key, sizeof (routing_key));
+
+        b.fill = 0;
+        b.data[0] = 0;
+        if (conf->format == CAMQP_FORMAT_JSON)
+        {
+            size_t bfree = b.size;
+            format_json_initialize (b.data, &b.fill, &bfree);
+        }
+        else if (conf->format == CAMQP_FORMAT_BINARY)
+            format_binary_initialize (&b.binary_state);
+
+        for (n = 0; (n < conf->batch_size) && (i < entries_num); n++, i++)
+        {
+            if ((n > 0) && (conf->routing_key == NULL))
+            {
+                camqp_routing_key (conf, entries[i].vl,
+                        next_key, sizeof (next_key));
+                if (strcmp (routing_key, next_key) != 0)
+                    break;
+            }
+
+            status = camqp_buffer_append (conf, &b,
+                    entries[i].ds, entries[i].vl);
+            if (status == 0)
+                values_num++;
+            else
+                failed++;
+        }
+
+        if (values_num == 0)
+            continue;
+
+        if (conf->format == CAMQP_FORMAT_JSON)
+        {
+            size_t bfree = b.size - b.fill;
+            format_json_finalize (b.data, &b.fill, &bfree);
+        }
+
+        pthread_mutex_lock (&conf->lock);
+        status = camqp_write_locked (conf, b.data,
+                (conf->format == CAMQP_FORMAT_BINARY)
+                ? b.fill : strlen (b.data), routing_key);
+        pthread_mutex_unlock (&conf->lock);
+        if (status != 0)
+            failed += (int) values_num;
+    } /* while (i < entries_num) */
+
+    sfree (b.data);
+    return ((failed == 0) ? 0 : -1);
+} /* }}} int camqp_write_batch */
+
 /*
  * Config handling
  */
@@ -907,6 +1470,8 @@ static int camqp_config_set_format (oconfig_item_t *ci, /* {{{ */
         conf->format = CAMQP_FORMAT_JSON;
     else if (strcasecmp ("Graphite", string) == 0)
         conf->format = CAMQP_FORMAT_GRAPHITE;
+    else if (strcasecmp ("Binary", string) == 0)
+        conf->format = CAMQP_FORMAT_BINARY;
     else
     {
         WARNING ("amqp plugin: Invalid format string: %s",
@@ -953,11 +1518,15 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
     conf->prefix = NULL;
     conf->postfix = NULL;
     conf->escape_char = '_';
+    conf->batch_size = 1;
+    conf->publisher_confirms = 0;
     /* subscribe only */
     conf->exchange_type = NULL;
     conf->queue = NULL;
     conf->queue_durable = 0;
     conf->queue_auto_delete = 1;
+    conf->prefetch_count = 0;
+    conf->consumer_threads = 1;
     /* general */
     conf->connection = NULL;
     pthread_mutex_init (&conf->lock, /* attr = */ NULL);
@@ -1043,6 +1612,55 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
             conf->escape_char = tmp_buff[0];
             sfree (tmp_buff);
         }
+        else if ((strcasecmp ("BatchSize", child->key) == 0) && publish)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < 1))
+            {
+                ERROR ("amqp plugin: The \"BatchSize\" option must be "
+                        "at least 1.");
+                status = -1;
+            }
+            else if (status == 0)
+                conf->batch_size = (size_t) tmp;
+        }
+        else if ((strcasecmp ("PublisherConfirms", child->key) == 0) && publish)
+        {
+            status = cf_util_get_boolean (child, &conf->publisher_confirms);
+#if !CAMQP_HAVE_CONFIRMS
+            if (conf->publisher_confirms)
+            {
+                WARNING ("amqp plugin: This version of librabbitmq does not "
+                        "support publisher confirms. The \"PublisherConfirms\" "
+                        "option will be ignored.");
+                conf->publisher_confirms = 0;
+            }
+#endif
+        }
+        else if ((strcasecmp ("PrefetchCount", child->key) == 0) && !publish)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && ((tmp < 0) || (tmp > 65535)))
+            {
+                ERROR ("amqp plugin: The \"PrefetchCount\" option must be "
+                        "in the range [0-65535].");
+                status = -1;
+            }
+            else if (status == 0)
+                conf->prefetch_count = (uint16_t) tmp;
+        }
+        else if ((strcasecmp ("ConsumerThreads", child->key) == 0) && !publish)
+        {
+            status = cf_util_get_int (child, &conf->consumer_threads);
+            if ((status == 0) && (conf->consumer_threads < 1))
+            {
+                ERROR ("amqp plugin: The \"ConsumerThreads\" option must be "
+                        "at least 1.");
+                status = -1;
+            }
+        }
         else if (strcasecmp ("ConnectionRetryDelay", child->key) == 0)
             status = cf_util_get_int (child, &conf->connection_retry_delay);
         else
@@ -1065,6 +1683,15 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
     }
 
+    /* Without a named queue, each connection would get a queue of its own
+     * and every consumer thread would receive all values. */
+    if ((status == 0) && (conf->consumer_threads > 1) && (conf->queue == NULL))
+    {
+        WARNING ("amqp plugin: The option \"ConsumerThreads\" requires the "
+                "\"Queue\" option. Only one consumer thread will be used.");
+        conf->consumer_threads = 1;
+    }
+
     if (status != 0)
     {
         camqp_config_free (conf);
@@ -1084,7 +1711,18 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
         ssnprintf (cbname, sizeof (cbname), "amqp/%s", conf->name);
 
-        status = plugin_register_write (cbname, camqp_write, &ud);
+        /* Without a cache, the metric paths and JSON identifiers are
+         * formatted for every value. */
+        if (conf->format == CAMQP_FORMAT_GRAPHITE)
+            conf->graphite_cache = graphite_cache_create (GRAPHITE_CACHE_SIZE);
+        else if (conf->format == CAMQP_FORMAT_JSON)
+            conf->json_cache = format_json_cache_create (FORMAT_JSON_CACHE_SIZE);
+
+        if (conf->batch_size > 1)
+            status = plugin_register_write_batch (cbname,
+                    camqp_write_batch, &ud);
+        else
+            status = plugin_register_write (cbname, camqp_write, &ud);
         if (status != 0)
         {
             camqp_config_free (conf);
@@ -1093,12 +1731,31 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
     }
     else
     {
+        /* Each consumer thread has its own connection to the broker, which
+         * distributes the deliveries of the queue between them. */
+        for (i = 1; i < conf->consumer_threads; i++)
+        {
+            camqp_config_t *copy = camqp_config_copy (conf);
+            if (copy == NULL)
+            {
+                ERROR ("amqp plugin: camqp_config_copy failed.");
+                camqp_config_free (conf);
+                return (ENOMEM);
+            }
+
+            /* camqp_subscribe_init() frees "copy" upon failure. */
+            status = camqp_subscribe_init (copy);
+            if (status != 0)
+            {
+                camqp_config_free (conf);
+                return (status);
+            }
+        }
+
+        /* camqp_subscribe_init() frees "conf" upon failure. */
         status = camqp_subscribe_init (conf);
         if (status != 0)
-        {
-            camqp_config_free (conf);
             return (status);
-        }
     }
 
     return (0);
@@ -28,6 +28,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl_multi.h"
 
 #include <curl/curl.h>
 
@@ -56,12 +57,14 @@ struct apache_s
 	size_t apache_buffer_fill;
 	int timeout;
 	CURL *curl;
+	ucm_transfer_t transfer;
 }; /* apache_s */
 
 typedef struct apache_s apache_t;
 
 /* TODO: Remove this prototype */
 static int apache_read_host (user_data_t *user_data);
+static void apache_curl_done (ucm_transfer_t *t, CURLcode status);
 
 static void apache_free (apache_t *st)
 {
@@ -78,6 +81,7 @@ static void apache_free (apache_t *st)
 	sfree (st->server);
 	sfree (st->apache_buffer);
 	if (st->curl) {
+		ucm_cancel (&st->transfer);
 		curl_easy_cleanup(st->curl);
 		st->curl = NULL;
 	}
@@ -385,6 +389,10 @@ static int init_host (apache_t *st) /* {{{ */
 		curl_easy_setopt (st->curl, CURLOPT_TIMEOUT_MS, (long) CDTIME_T_TO_MS(plugin_get_interval()));
 #endif
 
+	st->transfer.curl = st->curl;
+	st->transfer.done = apache_curl_done;
+	st->transfer.user_data = st;
+
 	return (0);
 } /* }}} int init_host */
 
@@ -516,7 +524,8 @@ static void submit_scoreboard (char *buf, apache_t *st)
 	}
 }
 
-static int apache_read_host (user_data_t *user_data) /* {{{ */
+/* Called by the transfer thread once the status page has been fetched. */
+static void apache_curl_done (ucm_transfer_t *t, CURLcode curl_status) /* {{{ */
 {
 	char *ptr;
 	char *saveptr;
@@ -525,32 +534,19 @@ static int apache_read_host (user_data_t *user_data) /* {{{ */
 	char *fields[4];
 	int   fields_num;
 
-	apache_t *st;
-
-	st = user_data->data;
+	apache_t *st = t->user_data;
 
 	int status;
 
 	char *content_type;
 	static const char *text_plain = "text/plain";
 
-	assert (st->url != NULL);
-	/* (Assured by `config_add') */
-
-	if (st->curl == NULL)
-	{
-		status = init_host (st);
-		if (status != 0)
-			return (-1);
-	}
-	assert (st->curl != NULL);
-
-	st->apache_buffer_fill = 0;
-	if (curl_easy_perform (st->curl) != CURLE_OK)
+	if (curl_status != CURLE_OK)
 	{
 		ERROR ("apache: curl_easy_perform failed: %s",
 				st->apache_curl_error);
-		return (-1);
+		st->apache_buffer_fill = 0;
+		return;
 	}
 
 	/* fallback - server_type to apache if not set at this time */
@@ -571,6 +567,10 @@ static int apache_read_host (user_data_t *user_data) /* {{{ */
 			text_plain, content_type);
 	}
 
+	/* Nothing has been received. */
+	if (st->apache_buffer_fill == 0)
+		return;
+
 	ptr = st->apache_buffer;
 	saveptr = NULL;
 	while ((line = strtok_r (ptr, "\n\r", &saveptr)) != NULL)
@@ -599,6 +599,45 @@ static int apache_read_host (user_data_t *user_data) /* {{{ */
 	}
 
 	st->apache_buffer_fill = 0;
+} /* }}} void apache_curl_done */
+
+/* Starts the request. The values are dispatched by apache_curl_done() once
+ * the page has arrived, so the requests of all instances run concurrently
+ * and slow servers don't block a read thread. */
+static int apache_read_host (user_data_t *user_data) /* {{{ */
+{
+	apache_t *st;
+
+	st = user_data->data;
+
+	int status;
+
+	assert (st->url != NULL);
+	/* (Assured by `config_add') */
+
+	if (st->curl == NULL)
+	{
+		status = init_host (st);
+		if (status != 0)
+			return (-1);
+	}
+	assert (st->curl != NULL);
+
+	if (ucm_busy (&st->transfer))
+	{
+		WARNING ("apache plugin: The previous request of %s has not "
+				"finished yet. Skipping this interval.", st->url);
+		return (-1);
+	}
+
+	st->apache_buffer_fill = 0;
+	status = ucm_submit (&st->transfer);
+	if (status != 0)
+	{
+		ERROR ("apache plugin: Starting the request of %s failed.",
+				st->url);
+		return (-1);
+	}
 
 	return (0);
 } /* }}} int apache_read_host */
@@ -611,10 +650,18 @@ static int apache_init (void) /* {{{ */
 	return (0);
 } /* }}} int apache_init */
 
+static int apache_shutdown (void) /* {{{ */
+{
+	/* The read callbacks, and with them all transfers, are gone already. */
+	ucm_shutdown ();
+	return (0);
+} /* }}} int apache_shutdown */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("apache", config);
 	plugin_register_init ("apache", apache_init);
+	plugin_register_shutdown ("apache", apache_shutdown);
 } /* void module_register */
 
 /* vim: set sw=8 noet fdm=marker : */
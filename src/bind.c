@@ -48,6 +48,7 @@
 
 #include <curl/curl.h>
 #include <libxml/parser.h>
+#include <libxml/SAX2.h>
 #include <libxml/xpath.h>
 
 #ifndef BIND_DEFAULT_URL
@@ -98,6 +99,40 @@ struct list_info_ptr_s
 };
 typedef struct list_info_ptr_s list_info_ptr_t;
 
+/*
+ * The document is parsed as it arrives, with a SAX handler which builds the
+ * tree like the default one but leaves out the elements none of the XPath
+ * expressions below look at, e.g. <socketmgr>, <taskmgr>, the memory contexts
+ * and views and zones which have not been configured. Large servers report
+ * many thousands of zones, so this keeps the tree small.
+ */
+#define BIND_PARSE_MAX_DEPTH 16
+
+/* Classes of the elements the pruning depends on. */
+enum bind_element_e
+{
+  BIND_EL_OTHER,
+  BIND_EL_ISC,
+  BIND_EL_BIND,
+  BIND_EL_STATISTICS,
+  BIND_EL_MEMORY,
+  BIND_EL_VIEWS,
+  BIND_EL_VIEW,
+  BIND_EL_ZONES
+};
+
+struct bind_parse_s
+{
+  /* Number of open elements, including pruned ones. */
+  int depth;
+  /* Depth of the pruned element we're in, zero if none. */
+  int skip_depth;
+  enum bind_element_e elements[BIND_PARSE_MAX_DEPTH];
+  /* The configured view we're in, NULL if not known. */
+  cb_view_t *view;
+};
+typedef struct bind_parse_s bind_parse_t;
+
 /* FIXME: Enabled by default for backwards compatibility. */
 /* TODO: Remove time parsing code. */
 static _Bool config_parse_time = 1;
@@ -116,10 +151,10 @@ static size_t     views_num = 0;
 
 static CURL *curl = NULL;
 
-static char  *bind_buffer = NULL;
-static size_t bind_buffer_size = 0;
-static size_t bind_buffer_fill = 0;
-static char   bind_curl_error[CURL_ERROR_SIZE];
+static xmlSAXHandler    bind_sax_handler;
+static xmlParserCtxtPtr bind_parser = NULL;
+static bind_parse_t     bind_parse_state;
+static char             bind_curl_error[CURL_ERROR_SIZE];
 
 /* Translation table for the `nsstats' values. */
 static const translation_info_t nsstats_translation_table[] = /* {{{ */
@@ -272,31 +307,242 @@ static void submit (time_t ts, const char *plugin_instance, /* {{{ */
   plugin_dispatch_values(&vl);
 } /* }}} void submit */
 
+/* Copies the value of the attribute `name' of a SAX2 start tag to `buffer'.
+ * Returns zero on success, ENOENT if there's no such attribute and ERANGE if
+ * the value does not fit. */
+static int bind_sax_get_attr (const xmlChar **attributes, /* {{{ */
+    int nb_attributes, const char *name, char *buffer, size_t buffer_size)
+{
+  int i;
+
+  /* Each attribute is given by localname, prefix, URI, value and end. */
+  for (i = 0; i < nb_attributes; i++)
+  {
+    const xmlChar **attr = attributes + (5 * i);
+    size_t len;
+
+    if (xmlStrcmp (attr[0], BAD_CAST name) != 0)
+      continue;
+
+    len = (size_t) (attr[4] - attr[3]);
+    if (len >= buffer_size)
+      return (ERANGE);
+
+    memcpy (buffer, attr[3], len);
+    buffer[len] = 0;
+    return (0);
+  }
+
+  return (ENOENT);
+} /* }}} int bind_sax_get_attr */
+
+/* Returns the class of a new element or -1 if it is to be left out. */
+static int bind_sax_classify (bind_parse_t *state, /* {{{ */
+    const xmlChar *localname, const xmlChar **attributes, int nb_attributes)
+{
+  const char *name = (const char *) localname;
+  enum bind_element_e parent;
+  char buffer[512];
+  size_t i;
+
+  if (state->depth == 0)
+  {
+    if (strcmp ("statistics", name) == 0)
+      return (BIND_EL_STATISTICS);
+    else if (strcmp ("isc", name) == 0)
+      return (BIND_EL_ISC);
+    return (BIND_EL_OTHER);
+  }
+
+  if (state->depth > BIND_PARSE_MAX_DEPTH)
+    return (BIND_EL_OTHER);
+  parent = state->elements[state->depth - 1];
+
+  switch (parent)
+  {
+    case BIND_EL_ISC:
+      return ((strcmp ("bind", name) == 0) ? BIND_EL_BIND : BIND_EL_OTHER);
+
+    case BIND_EL_BIND:
+      return ((strcmp ("statistics", name) == 0)
+          ? BIND_EL_STATISTICS : BIND_EL_OTHER);
+
+    case BIND_EL_STATISTICS:
+      if (strcmp ("server", name) == 0)
+        return (BIND_EL_OTHER);
+      else if ((strcmp ("memory", name) == 0) && (global_memory_stats != 0))
+        return (BIND_EL_MEMORY);
+      else if ((strcmp ("views", name) == 0) && (views_num > 0))
+        return (BIND_EL_VIEWS);
+      return (-1);
+
+    case BIND_EL_MEMORY:
+      return ((strcmp ("summary", name) == 0) ? BIND_EL_OTHER : -1);
+
+    case BIND_EL_VIEWS:
+      if (strcmp ("view", name) != 0)
+        return (BIND_EL_OTHER);
+
+      /* Only version 3 has the name in an attribute. In older versions it
+       * is a child element, so the view is kept. */
+      state->view = NULL;
+      if (bind_sax_get_attr (attributes, nb_attributes, "name",
+            buffer, sizeof (buffer)) != 0)
+        return (BIND_EL_VIEW);
+
+      for (i = 0; i < views_num; i++)
+        if (strcasecmp (buffer, views[i].name) == 0)
+          break;
+      if (i >= views_num)
+        return (-1);
+
+      state->view = views + i;
+      return (BIND_EL_VIEW);
+
+    case BIND_EL_VIEW:
+      if (strcmp ("zones", name) != 0)
+        return (BIND_EL_OTHER);
+      if ((state->view != NULL) && (state->view->zones_num == 0))
+        return (-1);
+      return (BIND_EL_ZONES);
+
+    case BIND_EL_ZONES:
+    {
+      size_t len;
+
+      if ((strcmp ("zone", name) != 0) || (state->view == NULL))
+        return (BIND_EL_OTHER);
+
+      /* Version 3 zones are named "name/rdataclass". */
+      if (bind_sax_get_attr (attributes, nb_attributes, "name",
+            buffer, sizeof (buffer) - 1) != 0)
+        return (BIND_EL_OTHER);
+      len = strlen (buffer);
+      buffer[len] = '/';
+      if (bind_sax_get_attr (attributes, nb_attributes, "rdataclass",
+            buffer + len + 1, sizeof (buffer) - (len + 1)) != 0)
+        return (BIND_EL_OTHER);
+
+      for (i = 0; i < state->view->zones_num; i++)
+        if (strcasecmp (buffer, state->view->zones[i]) == 0)
+          return (BIND_EL_OTHER);
+      return (-1);
+    }
+
+    default:
+      return (BIND_EL_OTHER);
+  }
+} /* }}} int bind_sax_classify */
+
+static void bind_sax_start_element (void *ctx, /* {{{ */
+    const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI,
+    int nb_namespaces, const xmlChar **namespaces,
+    int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+  bind_parse_t *state = ((xmlParserCtxtPtr) ctx)->_private;
+  int class;
+
+  if (state->skip_depth > 0)
+  {
+    state->depth++;
+    return;
+  }
+
+  class = bind_sax_classify (state, localname, attributes, nb_attributes);
+  if (class < 0)
+  {
+    state->depth++;
+    state->skip_depth = state->depth;
+    return;
+  }
+
+  if (state->depth < BIND_PARSE_MAX_DEPTH)
+    state->elements[state->depth] = (enum bind_element_e) class;
+  state->depth++;
+
+  xmlSAX2StartElementNs (ctx, localname, prefix, URI,
+      nb_namespaces, namespaces, nb_attributes, nb_defaulted, attributes);
+} /* }}} void bind_sax_start_element */
+
+static void bind_sax_end_element (void *ctx, /* {{{ */
+    const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI)
+{
+  bind_parse_t *state = ((xmlParserCtxtPtr) ctx)->_private;
+
+  if (state->skip_depth > 0)
+  {
+    if (state->depth == state->skip_depth)
+      state->skip_depth = 0;
+    state->depth--;
+    return;
+  }
+
+  state->depth--;
+  xmlSAX2EndElementNs (ctx, localname, prefix, URI);
+} /* }}} void bind_sax_end_element */
+
+static void bind_sax_characters (void *ctx, /* {{{ */
+    const xmlChar *ch, int len)
+{
+  bind_parse_t *state = ((xmlParserCtxtPtr) ctx)->_private;
+
+  if (state->skip_depth == 0)
+    xmlSAX2Characters (ctx, ch, len);
+} /* }}} void bind_sax_characters */
+
+static void bind_sax_cdata_block (void *ctx, /* {{{ */
+    const xmlChar *value, int len)
+{
+  bind_parse_t *state = ((xmlParserCtxtPtr) ctx)->_private;
+
+  if (state->skip_depth == 0)
+    xmlSAX2CDataBlock (ctx, value, len);
+} /* }}} void bind_sax_cdata_block */
+
+static void bind_parser_free (void) /* {{{ */
+{
+  if (bind_parser == NULL)
+    return;
+
+  if (bind_parser->myDoc != NULL)
+    xmlFreeDoc (bind_parser->myDoc);
+  xmlFreeParserCtxt (bind_parser);
+  bind_parser = NULL;
+} /* }}} void bind_parser_free */
+
+/* Feeds the received data to the parser, so the document is never held as
+ * text. */
 static size_t bind_curl_callback (void *buf, size_t size, /* {{{ */
     size_t nmemb, void __attribute__((unused)) *stream)
 {
   size_t len = size * nmemb;
+  int status;
 
   if (len <= 0)
     return (len);
 
-  if ((bind_buffer_fill + len) >= bind_buffer_size)
+  if (bind_parser == NULL)
   {
-    char *temp;
-
-    temp = realloc(bind_buffer, bind_buffer_fill + len + 1);
-    if (temp == NULL)
+    bind_parser = xmlCreatePushParserCtxt (&bind_sax_handler,
+        /* user_data = */ NULL, /* chunk = */ NULL, /* size = */ 0,
+        (url != NULL) ? url : BIND_DEFAULT_URL);
+    if (bind_parser == NULL)
     {
-      ERROR ("bind plugin: realloc failed.");
+      ERROR ("bind plugin: xmlCreatePushParserCtxt failed.");
       return (0);
     }
-    bind_buffer = temp;
-    bind_buffer_size = bind_buffer_fill + len + 1;
+
+    memset (&bind_parse_state, 0, sizeof (bind_parse_state));
+    bind_parser->_private = &bind_parse_state;
   }
 
-  memcpy (bind_buffer + bind_buffer_fill, (char *) buf, len);
-  bind_buffer_fill += len;
-  bind_buffer[bind_buffer_fill] = 0;
+  status = xmlParseChunk (bind_parser, buf, (int) len, /* terminate = */ 0);
+  if (status != 0)
+  {
+    ERROR ("bind plugin: Parsing the statistics failed with status %i.",
+        status);
+    return (0);
+  }
 
   return (len);
 } /* }}} size_t bind_curl_callback */
@@ -1435,21 +1681,14 @@ static int bind_xml_stats (int version, xmlDoc *doc, /* {{{ */
   return 0;
 } /* }}} int bind_xml_stats */
 
-static int bind_xml (const char *data) /* {{{ */
+/* Handles the parsed document and frees it. */
+static int bind_xml (xmlDoc *doc) /* {{{ */
 {
-  xmlDoc *doc = NULL;
   xmlXPathContext *xpathCtx = NULL;
   xmlXPathObject *xpathObj = NULL;
   int ret = -1;
   int i;
 
-  doc = xmlParseMemory (data, strlen (data));
-  if (doc == NULL)
-  {
-    ERROR ("bind plugin: xmlParseMemory failed.");
-    return (-1);
-  }
-
   xpathCtx = xmlXPathNewContext (doc);
   if (xpathCtx == NULL)
   {
@@ -1749,6 +1988,15 @@ static int bind_init (void) /* {{{ */
     return (-1);
   }
 
+  xmlInitParser ();
+  xmlSAXVersion (&bind_sax_handler, /* version = */ 2);
+  bind_sax_handler.startElementNs = bind_sax_start_element;
+  bind_sax_handler.endElementNs = bind_sax_end_element;
+  bind_sax_handler.characters = bind_sax_characters;
+  bind_sax_handler.ignorableWhitespace = bind_sax_characters;
+  bind_sax_handler.cdataBlock = bind_sax_cdata_block;
+  bind_sax_handler.comment = NULL;
+
   curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
   curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, bind_curl_callback);
   curl_easy_setopt (curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
@@ -1767,6 +2015,7 @@ static int bind_init (void) /* {{{ */
 
 static int bind_read (void) /* {{{ */
 {
+  xmlDoc *doc;
   int status;
 
   if (curl == NULL)
@@ -1775,15 +2024,34 @@ static int bind_read (void) /* {{{ */
     return (-1);
   }
 
-  bind_buffer_fill = 0;
+  bind_parser_free ();
   if (curl_easy_perform (curl) != CURLE_OK)
   {
     ERROR ("bind plugin: curl_easy_perform failed: %s",
         bind_curl_error);
+    bind_parser_free ();
+    return (-1);
+  }
+
+  if (bind_parser == NULL)
+  {
+    ERROR ("bind plugin: The server sent an empty document.");
     return (-1);
   }
 
-  status = bind_xml (bind_buffer);
+  xmlParseChunk (bind_parser, NULL, 0, /* terminate = */ 1);
+  if (!bind_parser->wellFormed || (bind_parser->myDoc == NULL))
+  {
+    ERROR ("bind plugin: Parsing the statistics failed.");
+    bind_parser_free ();
+    return (-1);
+  }
+
+  doc = bind_parser->myDoc;
+  bind_parser->myDoc = NULL;
+  bind_parser_free ();
+
+  status = bind_xml (doc);
   if (status != 0)
     return (-1);
   else
@@ -1792,6 +2060,8 @@ static int bind_read (void) /* {{{ */
 
 static int bind_shutdown (void) /* {{{ */
 {
+  bind_parser_free ();
+
   if (curl != NULL)
   {
     curl_easy_cleanup (curl);
@@ -29,6 +29,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_avltree.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
@@ -74,6 +75,9 @@
 /** Maximum path length for a UNIX domain socket on this system */
 #define UNIX_DOMAIN_SOCK_PATH_MAX (sizeof(((struct sockaddr_un*)0)->sun_path))
 
+/** Size of the chunks in which JSON is read and parsed */
+#define CEPH_READ_CHUNK_SIZE 16384
+
 /** Yajl callback returns */
 #define CEPH_CB_CONTINUE 1
 #define CEPH_CB_ABORT 0
@@ -116,14 +120,16 @@ struct ceph_daemon
     uint32_t *ds_types;
     /** Track ds names to match with types */
     char **ds_names;
+    /** Maps the counter keys of the schema to their index in ds_names */
+    c_avl_tree_t *ds_index;
+    /** The schema has to be (re-)read before the next data request */
+    _Bool need_schema;
 
     /**
      * Keep track of last data for latency values so we can calculate rate
-     * since last poll.
+     * since last poll. Indexed like ds_names.
      */
-    struct last_data **last_poll_data;
-    /** index of last poll data */
-    int last_idx;
+    struct last_data *last_data;
 };
 
 /******* JSON parsing *******/
@@ -174,15 +180,8 @@ struct values_tmp
     struct ceph_daemon *d;
     /** track avgcount across counters for avgcount/sum latency pairs */
     uint64_t avgcount;
-    /** current index of counters - used to get type of counter */
-    int index;
     /** do we already have an avgcount for latency pair */
     int avgcount_exists;
-    /**
-     * similar to index, but current index of latency type counters -
-     * used to get last poll data of counter
-     */
-    int latency_index;
     /**
      * values list - maintain across counters since
      * host/plugin/plugin instance are always the same
@@ -196,9 +195,9 @@ struct values_tmp
  */
 struct last_data
 {
-    char ds_name[DATA_MAX_NAME_LEN];
     double last_sum;
     uint64_t last_count;
+    _Bool valid;
 };
 
 /******* network I/O *******/
@@ -227,6 +226,9 @@ struct cconn
     /** Request type */
     uint32_t request_type;
 
+    /** Request the data once the schema has been read */
+    _Bool then_data;
+
     /** The connection state */
     enum cstate_t state;
 
@@ -239,11 +241,14 @@ struct cconn
     /** Length of the JSON to read */
     uint32_t json_len;
 
-    /** Buffer containing JSON data */
-    unsigned char *json;
+    /** Parser of the JSON, which is fed as it is read */
+    yajl_handle hand;
 
     /** Keep data important to yajl processing */
     struct yajl_struct yajl;
+
+    /** Values being built while parsing a data request */
+    struct values_tmp vtmp;
 };
 
 static int ceph_cb_null(void *ctx)
@@ -325,6 +330,11 @@ ceph_cb_number(void *ctx, const char *number_val, yajl_len_t number_len)
         status = state->handler(state->handler_arg, buffer, key);
     }
 
+    /* The counter is not in the schema. It has been marked to be read
+     * again, skip the counter until then. */
+    if (status == RETRY_AVGCOUNT)
+        return CEPH_CB_CONTINUE;
+
     if (status != 0)
     {
         ERROR("ceph plugin: JSON handler failed with status %d.", status);
@@ -429,22 +439,38 @@ static void ceph_daemons_print(void)
     }
 }
 
-static void ceph_daemon_free(struct ceph_daemon *d)
+/** Forgets the schema of a daemon, so that it can be read again */
+static void ceph_daemon_clear_schema(struct ceph_daemon *d)
 {
-    int i = 0;
-    for(; i < d->last_idx; i++)
+    int i;
+
+    if(d->ds_index != NULL)
     {
-        sfree(d->last_poll_data[i]);
+        void *key;
+        void *value;
+
+        while(c_avl_pick(d->ds_index, &key, &value) == 0)
+        {
+            sfree(key);
+        }
+        c_avl_destroy(d->ds_index);
+        d->ds_index = NULL;
     }
-    sfree(d->last_poll_data);
-    d->last_poll_data = NULL;
-    d->last_idx = 0;
+
     for(i = 0; i < d->ds_num; i++)
     {
         sfree(d->ds_names[i]);
     }
     sfree(d->ds_types);
     sfree(d->ds_names);
+    sfree(d->last_data);
+    d->ds_num = 0;
+    d->need_schema = 1;
+}
+
+static void ceph_daemon_free(struct ceph_daemon *d)
+{
+    ceph_daemon_clear_schema(d);
     sfree(d);
 }
 
@@ -557,6 +583,16 @@ static size_t count_parts (char const *key)
     return parts_num;
 }
 
+/**
+ * Remove "type" if this is for schema: strips the ".type" suffix in place iff
+ * the key has more than two parts.
+ */
+static void strip_type_suffix (char *key)
+{
+    if ((count_parts (key) > 2) && has_suffix (key, ".type"))
+        key[strlen (key) - strlen (".type")] = 0;
+}
+
 /**
  * Parse key to remove "type" if this is for schema and initiate compaction
  */
@@ -567,19 +603,8 @@ static int parse_keys (char *buffer, size_t buffer_size, const char *key_str)
     if (buffer == NULL || buffer_size == 0 || key_str == NULL || strlen (key_str) == 0)
         return EINVAL;
 
-    if ((count_parts (key_str) > 2) && has_suffix (key_str, ".type"))
-    {
-        /* strip ".type" suffix iff the key has more than two parts. */
-        size_t sz = strlen (key_str) - strlen (".type") + 1;
-
-        if (sz > sizeof (tmp))
-            sz = sizeof (tmp);
-        sstrncpy (tmp, key_str, sz);
-    }
-    else
-    {
-        sstrncpy (tmp, key_str, sizeof (tmp));
-    }
+    sstrncpy (tmp, key_str, sizeof (tmp));
+    strip_type_suffix (tmp);
 
     return compact_ds_name (buffer, buffer_size, tmp);
 }
@@ -593,8 +618,11 @@ static int ceph_daemon_add_ds_entry(struct ceph_daemon *d, const char *name,
 {
     uint32_t type;
     char ds_name[DATA_MAX_NAME_LEN];
+    char key[2 * DATA_MAX_NAME_LEN];
+    char *key_copy;
     memset(ds_name, 0, sizeof(ds_name));
 
+
     if(convert_special_metrics)
     {
         /**
@@ -635,10 +663,27 @@ static int ceph_daemon_add_ds_entry(struct ceph_daemon *d, const char *name,
 
     if (parse_keys(ds_name, sizeof (ds_name), name))
     {
+        sfree(d->ds_names[d->ds_num]);
         return 1;
     }
-
     sstrncpy(d->ds_names[d->ds_num], ds_name, DATA_MAX_NAME_LEN -1);
+
+    /* The data keys are looked up as they are, without compacting them. */
+    sstrncpy(key, name, sizeof(key));
+    strip_type_suffix(key);
+    key_copy = strdup(key);
+    if(key_copy == NULL)
+    {
+        sfree(d->ds_names[d->ds_num]);
+        return -ENOMEM;
+    }
+    if(c_avl_insert(d->ds_index, key_copy,
+                (void *) (uintptr_t) d->ds_num) != 0)
+    {
+        /* duplicate key: the first entry wins */
+        sfree(key_copy);
+    }
+
     d->ds_num = (d->ds_num + 1);
 
     return 0;
@@ -688,6 +733,7 @@ static int cc_add_daemon_config(oconfig_item_t *ci)
     struct ceph_daemon *nd, cd;
     struct ceph_daemon **tmp;
     memset(&cd, 0, sizeof(struct ceph_daemon));
+    cd.need_schema = 1;
 
     if((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
     {
@@ -839,135 +885,26 @@ node_handler_define_schema(void *arg, const char *val, const char *key)
     return ceph_daemon_add_ds_entry(d, key, pc_type);
 }
 
-/**
- * Latency counter does not yet have an entry in last poll data - add it.
- */
-static int add_last(struct ceph_daemon *d, const char *ds_n, double cur_sum,
-        uint64_t cur_count)
-{
-    d->last_poll_data[d->last_idx] = malloc(sizeof (*d->last_poll_data[d->last_idx]));
-    if(!d->last_poll_data[d->last_idx])
-    {
-        return -ENOMEM;
-    }
-    sstrncpy(d->last_poll_data[d->last_idx]->ds_name,ds_n,
-            sizeof(d->last_poll_data[d->last_idx]->ds_name));
-    d->last_poll_data[d->last_idx]->last_sum = cur_sum;
-    d->last_poll_data[d->last_idx]->last_count = cur_count;
-    d->last_idx = (d->last_idx + 1);
-    return 0;
-}
-
-/**
- * Update latency counter or add new entry if it doesn't exist
- */
-static int update_last(struct ceph_daemon *d, const char *ds_n, int index,
-        double cur_sum, uint64_t cur_count)
-{
-    if((d->last_idx > index) && (strcmp(d->last_poll_data[index]->ds_name, ds_n) == 0))
-    {
-        d->last_poll_data[index]->last_sum = cur_sum;
-        d->last_poll_data[index]->last_count = cur_count;
-        return 0;
-    }
-
-    if(!d->last_poll_data)
-    {
-        d->last_poll_data = malloc(sizeof (*d->last_poll_data));
-        if(!d->last_poll_data)
-        {
-            return -ENOMEM;
-        }
-    }
-    else
-    {
-        struct last_data **tmp_last = realloc(d->last_poll_data,
-                ((d->last_idx+1) * sizeof(struct last_data *)));
-        if(!tmp_last)
-        {
-            return -ENOMEM;
-        }
-        d->last_poll_data = tmp_last;
-    }
-    return add_last(d, ds_n, cur_sum, cur_count);
-}
-
-/**
- * If using index guess failed (shouldn't happen, but possible if counters
- * get rearranged), resort to searching for counter name
- */
-static int backup_search_for_last_avg(struct ceph_daemon *d, const char *ds_n)
-{
-    int i = 0;
-    for(; i < d->last_idx; i++)
-    {
-        if(strcmp(d->last_poll_data[i]->ds_name, ds_n) == 0)
-        {
-            return i;
-        }
-    }
-    return -1;
-}
-
 /**
  * Calculate average b/t current data and last poll data
  * if last poll data exists
  */
-static double get_last_avg(struct ceph_daemon *d, const char *ds_n, int index,
+static double get_last_avg(struct ceph_daemon *d, int index,
         double cur_sum, uint64_t cur_count)
 {
-    double result = -1.1, sum_delt = 0.0;
-    uint64_t count_delt = 0;
-    int tmp_index = 0;
-    if(d->last_idx > index)
-    {
-        if(strcmp(d->last_poll_data[index]->ds_name, ds_n) == 0)
-        {
-            tmp_index = index;
-        }
-        //test previous index
-        else if((index > 0) && (strcmp(d->last_poll_data[index-1]->ds_name, ds_n) == 0))
-        {
-            tmp_index = (index - 1);
-        }
-        else
-        {
-            tmp_index = backup_search_for_last_avg(d, ds_n);
-        }
-
-        if((tmp_index > -1) && (cur_count > d->last_poll_data[tmp_index]->last_count))
-        {
-            sum_delt = (cur_sum - d->last_poll_data[tmp_index]->last_sum);
-            count_delt = (cur_count - d->last_poll_data[tmp_index]->last_count);
-            result = (sum_delt / count_delt);
-        }
-    }
+    struct last_data *last = d->last_data + index;
+    double result = NAN;
 
-    if(result == -1.1)
+    if(last->valid && (cur_count > last->last_count))
     {
-        result = NAN;
+        result = (cur_sum - last->last_sum)
+            / (cur_count - last->last_count);
     }
-    if(update_last(d, ds_n, tmp_index, cur_sum, cur_count) == -ENOMEM)
-    {
-        return -ENOMEM;
-    }
-    return result;
-}
 
-/**
- * If using index guess failed, resort to searching for counter name
- */
-static uint32_t backup_search_for_type(struct ceph_daemon *d, char *ds_name)
-{
-    int idx = 0;
-    for(; idx < d->ds_num; idx++)
-    {
-        if(strcmp(d->ds_names[idx], ds_name) == 0)
-        {
-            return d->ds_types[idx];
-        }
-    }
-    return DSET_TYPE_UNFOUND;
+    last->last_sum = cur_sum;
+    last->last_count = cur_count;
+    last->valid = 1;
+    return result;
 }
 
 /**
@@ -979,45 +916,28 @@ static int node_handler_fetch_data(void *arg, const char *val, const char *key)
     double tmp_d;
     uint64_t tmp_u;
     struct values_tmp *vtmp = (struct values_tmp*) arg;
-    uint32_t type = DSET_TYPE_UNFOUND;
-    int index = vtmp->index;
-
-    char ds_name[DATA_MAX_NAME_LEN];
-    memset(ds_name, 0, sizeof(ds_name));
-
-    if (parse_keys (ds_name, sizeof (ds_name), key))
-    {
-        return 1;
-    }
-
-    if(index >= vtmp->d->ds_num)
-    {
-        //don't overflow bounds of array
-        index = (vtmp->d->ds_num - 1);
-    }
+    struct ceph_daemon *d = vtmp->d;
+    uint32_t type;
+    char tmp_key[2 * DATA_MAX_NAME_LEN];
+    void *value;
+    int index;
 
-    /**
-     * counters should remain in same order we parsed schema... we maintain the
-     * index variable to keep track of current point in list of counters. first
-     * use index to guess point in array for retrieving type. if that doesn't
-     * work, use the old way to get the counter type
-     */
-    if(strcmp(ds_name, vtmp->d->ds_names[index]) == 0)
-    {
-        //found match
-        type = vtmp->d->ds_types[index];
-    }
-    else if((index > 0) && (strcmp(ds_name, vtmp->d->ds_names[index-1]) == 0))
-    {
-        //try previous key
-        type = vtmp->d->ds_types[index-1];
-    }
+    sstrncpy(tmp_key, key, sizeof(tmp_key));
+    strip_type_suffix(tmp_key);
 
-    if(type == DSET_TYPE_UNFOUND)
+    if(c_avl_get(d->ds_index, tmp_key, &value) != 0)
     {
-        //couldn't find right type by guessing, check the old way
-        type = backup_search_for_type(vtmp->d, ds_name);
+        /* Unknown to the schema: the daemon may have been upgraded. */
+        if(!d->need_schema)
+        {
+            DEBUG("ceph plugin: %s: counter %s is not in the schema, "
+                    "reading the schema again.", d->name, tmp_key);
+            d->need_schema = 1;
+        }
+        return RETRY_AVGCOUNT;
     }
+    index = (int) (uintptr_t) value;
+    type = d->ds_types[index];
 
     switch(type)
     {
@@ -1047,16 +967,11 @@ static int node_handler_fetch_data(void *arg, const char *val, const char *key)
                 }
                 else
                 {
-                    result = get_last_avg(vtmp->d, ds_name, vtmp->latency_index, sum, vtmp->avgcount);
-                    if(result == -ENOMEM)
-                    {
-                        return -ENOMEM;
-                    }
+                    result = get_last_avg(d, index, sum, vtmp->avgcount);
                 }
 
                 uv.gauge = result;
                 vtmp->avgcount_exists = -1;
-                vtmp->latency_index = (vtmp->latency_index + 1);
             }
             break;
         case DSET_BYTES:
@@ -1069,16 +984,17 @@ static int node_handler_fetch_data(void *arg, const char *val, const char *key)
             break;
         case DSET_TYPE_UNFOUND:
         default:
-            ERROR("ceph plugin: ds %s was not properly initialized.", ds_name);
+            ERROR("ceph plugin: ds %s was not properly initialized.",
+                    d->ds_names[index]);
             return -1;
     }
 
     sstrncpy(vtmp->vlist.type, ceph_dset_types[type], sizeof(vtmp->vlist.type));
-    sstrncpy(vtmp->vlist.type_instance, ds_name, sizeof(vtmp->vlist.type_instance));
+    sstrncpy(vtmp->vlist.type_instance, d->ds_names[index],
+            sizeof(vtmp->vlist.type_instance));
     vtmp->vlist.values = &uv;
     vtmp->vlist.values_len = 1;
 
-    vtmp->index = (vtmp->index + 1);
     plugin_dispatch_values(&vtmp->vlist);
 
     return 0;
@@ -1128,7 +1044,6 @@ static int cconn_connect(struct cconn *io)
     io->state = CSTATE_WRITE_REQUEST;
     io->amt = 0;
     io->json_len = 0;
-    io->json = NULL;
     return 0;
 }
 
@@ -1143,40 +1058,29 @@ static void cconn_close(struct cconn *io)
     io->asok = -1;
     io->amt = 0;
     io->json_len = 0;
-    sfree(io->json);
-    io->json = NULL;
-}
 
-/* Process incoming JSON counter data */
-static int
-cconn_process_data(struct cconn *io, yajl_struct *yajl, yajl_handle hand)
-{
-    int ret;
-    struct values_tmp *vtmp = calloc(1, sizeof(struct values_tmp) * 1);
-    if(!vtmp)
+    if(io->hand != NULL)
     {
-        return -ENOMEM;
-    }
+        size_t i;
 
-    vtmp->vlist = (value_list_t)VALUE_LIST_INIT;
-    sstrncpy(vtmp->vlist.host, hostname_g, sizeof(vtmp->vlist.host));
-    sstrncpy(vtmp->vlist.plugin, "ceph", sizeof(vtmp->vlist.plugin));
-    sstrncpy(vtmp->vlist.plugin_instance, io->d->name, sizeof(vtmp->vlist.plugin_instance));
-
-    vtmp->d = io->d;
-    vtmp->avgcount_exists = -1;
-    vtmp->latency_index = 0;
-    vtmp->index = 0;
-    yajl->handler_arg = vtmp;
-    ret = traverse_json(io->json, io->json_len, hand);
-    sfree(vtmp);
-    return ret;
+        yajl_free(io->hand);
+        io->hand = NULL;
+
+        /* free the keys left over from an aborted parse */
+        sfree(io->yajl.key);
+        for(i = 0; i < io->yajl.depth; i++)
+        {
+            sfree(io->yajl.stack[i]);
+        }
+        io->yajl.depth = 0;
+    }
 }
 
 /**
- * Initiate JSON parsing and print error if one occurs
+ * Prepare parsing the JSON of a reply, which is fed to the parser as it is
+ * read
  */
-static int cconn_process_json(struct cconn *io)
+static int cconn_start_json(struct cconn *io)
 {
     if((io->request_type != ASOK_REQ_DATA) &&
             (io->request_type != ASOK_REQ_SCHEMA))
@@ -1184,11 +1088,7 @@ static int cconn_process_json(struct cconn *io)
         return -EDOM;
     }
 
-    int result = 1;
-    yajl_handle hand;
-    yajl_status status;
-
-    hand = yajl_alloc(&callbacks,
+    io->hand = yajl_alloc(&callbacks,
 #if HAVE_YAJL_V2
       /* alloc funcs = */ NULL,
 #else
@@ -1196,56 +1096,84 @@ static int cconn_process_json(struct cconn *io)
 #endif
       /* context = */ (void *)(&io->yajl));
 
-    if(!hand)
+    if(!io->hand)
     {
         ERROR ("ceph plugin: yajl_alloc failed.");
-        return ENOMEM;
+        return -ENOMEM;
     }
 
-    io->yajl.depth = 0;
+    memset(&io->yajl, 0, sizeof(io->yajl));
 
     switch(io->request_type)
     {
         case ASOK_REQ_DATA:
+            memset(&io->vtmp, 0, sizeof(io->vtmp));
+            io->vtmp.vlist = (value_list_t)VALUE_LIST_INIT;
+            sstrncpy(io->vtmp.vlist.host, hostname_g,
+                    sizeof(io->vtmp.vlist.host));
+            sstrncpy(io->vtmp.vlist.plugin, "ceph",
+                    sizeof(io->vtmp.vlist.plugin));
+            sstrncpy(io->vtmp.vlist.plugin_instance, io->d->name,
+                    sizeof(io->vtmp.vlist.plugin_instance));
+            io->vtmp.d = io->d;
+            io->vtmp.avgcount_exists = -1;
+
             io->yajl.handler = node_handler_fetch_data;
-            result = cconn_process_data(io, &io->yajl, hand);
+            io->yajl.handler_arg = &io->vtmp;
             break;
         case ASOK_REQ_SCHEMA:
-            //init daemon specific variables
-            io->d->ds_num = 0;
-            io->d->last_idx = 0;
-            io->d->last_poll_data = NULL;
+            ceph_daemon_clear_schema(io->d);
+            io->d->ds_index = c_avl_create(
+                    (int (*) (const void *, const void *)) strcmp);
+            if(io->d->ds_index == NULL)
+            {
+                ERROR ("ceph plugin: c_avl_create failed.");
+                return -ENOMEM;
+            }
+
             io->yajl.handler = node_handler_define_schema;
             io->yajl.handler_arg = io->d;
-            result = traverse_json(io->json, io->json_len, hand);
             break;
     }
 
-    if(result)
-    {
-        goto done;
-    }
+    return 0;
+}
+
+/**
+ * Complete parsing the JSON and print error if one occurs
+ */
+static int cconn_finish_json(struct cconn *io)
+{
+    yajl_status status;
 
 #if HAVE_YAJL_V2
-    status = yajl_complete_parse(hand);
+    status = yajl_complete_parse(io->hand);
 #else
-    status = yajl_parse_complete(hand);
+    status = yajl_parse_complete(io->hand);
 #endif
 
     if (status != yajl_status_ok)
     {
-      unsigned char *errmsg = yajl_get_error (hand, /* verbose = */ 0,
+      unsigned char *errmsg = yajl_get_error (io->hand, /* verbose = */ 0,
           /* jsonText = */ NULL, /* jsonTextLen = */ 0);
       ERROR ("ceph plugin: yajl_parse_complete failed: %s",
           (char *) errmsg);
-      yajl_free_error (hand, errmsg);
-      yajl_free (hand);
+      yajl_free_error (io->hand, errmsg);
       return 1;
     }
 
-    done:
-    yajl_free (hand);
-    return result;
+    if(io->request_type == ASOK_REQ_SCHEMA)
+    {
+        io->d->last_data = calloc(io->d->ds_num > 0 ? io->d->ds_num : 1,
+                sizeof(*io->d->last_data));
+        if(io->d->last_data == NULL)
+        {
+            return -ENOMEM;
+        }
+        io->d->need_schema = 0;
+    }
+
+    return 0;
 }
 
 static int cconn_validate_revents(struct cconn *io, int revents)
@@ -1358,35 +1286,58 @@ static int cconn_handle_event(struct cconn *io)
                 io->json_len = ntohl(io->json_len);
                 io->amt = 0;
                 io->state = CSTATE_READ_JSON;
-                io->json = calloc(1, io->json_len + 1);
-                if(!io->json)
+                ret = cconn_start_json(io);
+                if(ret)
                 {
-                    ERROR("ceph plugin: error callocing io->json");
-                    return -ENOMEM;
+                    return ret;
                 }
             }
             return 0;
         }
         case CSTATE_READ_JSON:
         {
-            RETRY_ON_EINTR(ret,
-                   read(io->asok, io->json + io->amt, io->json_len - io->amt));
+            unsigned char buffer[CEPH_READ_CHUNK_SIZE];
+            size_t len = io->json_len - io->amt;
+
+            if(len > sizeof(buffer))
+            {
+                len = sizeof(buffer);
+            }
+            RETRY_ON_EINTR(ret, read(io->asok, buffer, len));
             DEBUG("ceph plugin: cconn_handle_event(name=%s,state=%d,ret=%d)",
                     io->d->name, io->state, ret);
             if(ret < 0)
             {
                 return ret;
             }
+            else if(ret == 0)
+            {
+                return -EPIPE;
+            }
             io->amt += ret;
+
+            /* Parse while the other daemons are still sending. */
+            if(traverse_json(buffer, (uint32_t) ret, io->hand))
+            {
+                return 1;
+            }
+
             if(io->amt >= io->json_len)
             {
-                ret = cconn_process_json(io);
+                ret = cconn_finish_json(io);
                 if(ret)
                 {
                     return ret;
                 }
                 cconn_close(io);
-                io->request_type = ASOK_REQ_NONE;
+                if((io->request_type == ASOK_REQ_SCHEMA) && io->then_data)
+                {
+                    io->request_type = ASOK_REQ_DATA;
+                }
+                else
+                {
+                    io->request_type = ASOK_REQ_NONE;
+                }
             }
             return 0;
         }
@@ -1405,6 +1356,14 @@ static int cconn_prepare(struct cconn *io, struct pollfd* fds)
         /* The request has already been serviced. */
         return 0;
     }
+    else if((io->request_type == ASOK_REQ_DATA) && io->d->need_schema
+            && (io->state == CSTATE_UNCONNECTED))
+    {
+        /* The schema could not be read before or is outdated: read it
+         * first, then the data. */
+        io->request_type = ASOK_REQ_SCHEMA;
+        io->then_data = 1;
+    }
     else if((io->request_type == ASOK_REQ_DATA) && (io->d->ds_num == 0))
     {
         /* If there are no counters to report on, don't bother
@@ -1474,6 +1433,7 @@ static int cconn_main_loop(uint32_t request_type)
         io_array[i].d = g_daemons[i];
         io_array[i].request_type = request_type;
         io_array[i].state = CSTATE_UNCONNECTED;
+        io_array[i].asok = -1;
     }
 
     /** Calculate the time at which we should give up */
@@ -177,10 +177,46 @@ DEF_TEST(parse_keys)
   return 0;
 }
 
+DEF_TEST(ds_index)
+{
+  struct ceph_daemon d;
+  void *value;
+
+  memset (&d, 0, sizeof (d));
+  d.ds_index = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  CHECK_NOT_NULL (d.ds_index);
+
+  CHECK_ZERO (ceph_daemon_add_ds_entry (&d, "WBThrottle.bytes_dirtied.type", 2));
+  CHECK_ZERO (ceph_daemon_add_ds_entry (&d, "filestore.example_latency.type", 5));
+  CHECK_ZERO (ceph_daemon_add_ds_entry (&d, "aa.type", 10));
+  EXPECT_EQ_INT (3, d.ds_num);
+
+  /* data keys are looked up without the ".type" suffix of the schema */
+  CHECK_ZERO (c_avl_get (d.ds_index, "WBThrottle.bytes_dirtied", &value));
+  EXPECT_EQ_INT (0, (int) (uintptr_t) value);
+  EXPECT_EQ_STR ("WBThrottle.bytesDirtied", d.ds_names[0]);
+
+  CHECK_ZERO (c_avl_get (d.ds_index, "filestore.example_latency", &value));
+  EXPECT_EQ_INT (1, (int) (uintptr_t) value);
+  EXPECT_EQ_INT (DSET_LATENCY, d.ds_types[1]);
+
+  CHECK_ZERO (c_avl_get (d.ds_index, "aa.type", &value));
+  EXPECT_EQ_INT (DSET_RATE, d.ds_types[2]);
+
+  OK (c_avl_get (d.ds_index, "filestore.unknown", &value) != 0);
+
+  ceph_daemon_clear_schema (&d);
+  EXPECT_EQ_INT (0, d.ds_num);
+  OK (d.ds_index == NULL);
+
+  return 0;
+}
+
 int main (void)
 {
   RUN_TEST(traverse_json);
   RUN_TEST(parse_keys);
+  RUN_TEST(ds_index);
 
   END_TEST;
 }
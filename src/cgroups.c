@@ -28,6 +28,20 @@
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
 
+#include <dirent.h>
+#include <fcntl.h>
+
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
+/* Initial size of the buffer the stat files are read into. */
+#define CG_BUFFER_SIZE 4096
+
 static char const *config_keys[] =
 {
 	"CGroup",
@@ -37,72 +51,528 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *il_cgroup = NULL;
 
+/*
+ * The cgroups are tracked as a tree of two levels below the mount point, as
+ * in "/sys/fs/cgroup/cpuacct/system/foo.service". The cgroups of the second
+ * level are reported. The directories of the mount point and of the first
+ * level are kept open and watched with inotify, so that a directory is only
+ * read again when cgroups have been created or removed in it. The stat files
+ * of a cgroup are opened relative to its parent directory, so the number of
+ * open files doesn't grow with the number of cgroups.
+ */
+typedef struct cg_node_s cg_node_t;
+struct cg_node_s
+{
+	char *name;
+
+	/* Only for directories: the mount point and the first level. */
+	int dir_fd;
+	int wd;
+	_Bool dirty;
+	cg_node_t *children;
+
+	_Bool ignored;
+	cg_node_t *next;
+};
+
+static char     *cg_root_path = NULL;
+static cg_node_t *cg_root = NULL;
+/* True for the unified hierarchy of cgroup v2. */
+static _Bool     cg_unified = 0;
+static int       cg_inotify_fd = -1;
+
+static char     *cg_buffer = NULL;
+static size_t    cg_buffer_size = 0;
+
 __attribute__ ((nonnull(1)))
 __attribute__ ((nonnull(2)))
-static void cgroups_submit_one (char const *plugin_instance,
-		char const *type_instance, value_t value)
+__attribute__ ((nonnull(3)))
+static void cgroups_submit (char const *plugin_instance,
+		char const *type, char const *type_instance,
+		value_t *values, size_t values_len)
 {
 	value_list_t vl = VALUE_LIST_INIT;
 
-	vl.values = &value;
-	vl.values_len = 1;
+	vl.values = values;
+	vl.values_len = values_len;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "cgroups", sizeof (vl.plugin));
 	sstrncpy (vl.plugin_instance, plugin_instance,
 			sizeof (vl.plugin_instance));
-	sstrncpy (vl.type, "cpu", sizeof (vl.type));
+	sstrncpy (vl.type, type, sizeof (vl.type));
 	sstrncpy (vl.type_instance, type_instance,
 			sizeof (vl.type_instance));
 
 	plugin_dispatch_values (&vl);
+} /* void cgroups_submit */
+
+static void cgroups_submit_one (char const *plugin_instance,
+		char const *type_instance, value_t value)
+{
+	cgroups_submit (plugin_instance, "cpu", type_instance, &value, 1);
 } /* void cgroups_submit_one */
 
 /*
- * This callback reads the user/system CPU time for each cgroup.
+ * Tree handling
  */
-static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
-    void *user_data)
+static void cg_node_free (cg_node_t *n) /* {{{ */
+{
+	while (n != NULL)
+	{
+		cg_node_t *next = n->next;
+
+		cg_node_free (n->children);
+#if HAVE_SYS_INOTIFY_H
+		if ((n->wd >= 0) && (cg_inotify_fd >= 0))
+			inotify_rm_watch (cg_inotify_fd, n->wd);
+#endif
+		if (n->dir_fd >= 0)
+			close (n->dir_fd);
+		sfree (n->name);
+		sfree (n);
+
+		n = next;
+	}
+} /* }}} void cg_node_free */
+
+static cg_node_t *cg_node_create (char const *name) /* {{{ */
+{
+	cg_node_t *n;
+
+	n = calloc (1, sizeof (*n));
+	if (n == NULL)
+		return (NULL);
+
+	n->name = strdup (name);
+	if (n->name == NULL)
+	{
+		sfree (n);
+		return (NULL);
+	}
+	n->dir_fd = -1;
+	n->wd = -1;
+	n->dirty = 1;
+
+	return (n);
+} /* }}} cg_node_t *cg_node_create */
+
+/* Opens the directory `path' and starts watching it. */
+static int cg_node_open_dir (cg_node_t *n, int parent_fd, /* {{{ */
+		char const *path)
+{
+	n->dir_fd = openat (parent_fd, path,
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (n->dir_fd < 0)
+		return (errno);
+
+#if HAVE_SYS_INOTIFY_H
+	if (cg_inotify_fd >= 0)
+	{
+		char full_path[PATH_MAX];
+
+		if (path[0] == '/')
+			sstrncpy (full_path, path, sizeof (full_path));
+		else
+			ssnprintf (full_path, sizeof (full_path), "%s/%s",
+					cg_root_path, path);
+
+		n->wd = inotify_add_watch (cg_inotify_fd, full_path,
+				IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+				| IN_DELETE_SELF | IN_ONLYDIR);
+		if (n->wd < 0)
+		{
+			char errbuf[1024];
+			WARNING ("cgroups plugin: inotify_add_watch (\"%s\") failed: "
+					"%s. The directory will be read every interval.",
+					full_path, sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+#endif
+
+	return (0);
+} /* }}} int cg_node_open_dir */
+
+/* Reads the directory of `dir' again and updates its children. With
+ * `leaves' set, the children are the reported cgroups, otherwise they are
+ * directories which are opened and watched themselves. */
+static int cg_node_scan (cg_node_t *dir, _Bool leaves) /* {{{ */
+{
+	cg_node_t *old_children = dir->children;
+	cg_node_t *new_children = NULL;
+	struct dirent *ent;
+	DIR *dh;
+	int fd;
+
+	/* A directory stream of its own, so that the cached descriptor can be
+	 * used concurrently with openat(2). */
+	fd = openat (dir->dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return (errno);
+	dh = fdopendir (fd);
+	if (dh == NULL)
+	{
+		int status = errno;
+		close (fd);
+		return (status);
+	}
+
+	while ((ent = readdir (dh)) != NULL)
+	{
+		cg_node_t *n;
+		cg_node_t **prev;
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		/* We are only interested in directories, so skip everything
+		 * else. */
+		if (ent->d_type == DT_UNKNOWN)
+		{
+			struct stat statbuf;
+
+			if (fstatat (dir->dir_fd, ent->d_name, &statbuf,
+						AT_SYMLINK_NOFOLLOW) != 0)
+				continue;
+			if (!S_ISDIR (statbuf.st_mode))
+				continue;
+		}
+		else if (ent->d_type != DT_DIR)
+			continue;
+
+		/* Keep known cgroups, with their open directories. */
+		for (prev = &old_children; *prev != NULL; prev = &(*prev)->next)
+			if (strcmp ((*prev)->name, ent->d_name) == 0)
+				break;
+
+		n = *prev;
+		if (n != NULL)
+		{
+			*prev = n->next;
+		}
+		else
+		{
+			n = cg_node_create (ent->d_name);
+			if (n == NULL)
+				continue;
+
+			if (leaves)
+			{
+				n->ignored = ignorelist_match (il_cgroup, n->name)
+					? 1 : 0;
+			}
+			else if (cg_node_open_dir (n, dir->dir_fd, n->name) != 0)
+			{
+				cg_node_free (n);
+				continue;
+			}
+		}
+
+		n->next = new_children;
+		new_children = n;
+	}
+
+	closedir (dh);
+
+	/* Whatever is left has been removed. */
+	cg_node_free (old_children);
+	dir->children = new_children;
+	dir->dirty = 0;
+
+	return (0);
+} /* }}} int cg_node_scan */
+
+#if HAVE_SYS_INOTIFY_H
+static void cg_mark_all_dirty (void) /* {{{ */
+{
+	cg_node_t *n;
+
+	cg_root->dirty = 1;
+	for (n = cg_root->children; n != NULL; n = n->next)
+		n->dirty = 1;
+} /* }}} void cg_mark_all_dirty */
+
+/* Drains the inotify descriptor and marks the directories which changed.
+ * Returns non-zero if the mount point itself has gone away. */
+static int cg_handle_events (void) /* {{{ */
+{
+	char buffer[4096]
+		__attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	int root_gone = 0;
+
+	while (42)
+	{
+		ssize_t len;
+		char *ptr;
+
+		len = read (cg_inotify_fd, buffer, sizeof (buffer));
+		if ((len < 0) && (errno == EINTR))
+			continue;
+		if (len <= 0)
+			break;
+
+		for (ptr = buffer; ptr < buffer + len; )
+		{
+			struct inotify_event *ev = (void *) ptr;
+			cg_node_t *n;
+
+			ptr += sizeof (*ev) + ev->len;
+
+			if (ev->mask & IN_Q_OVERFLOW)
+			{
+				cg_mark_all_dirty ();
+				continue;
+			}
+
+			if (ev->wd == cg_root->wd)
+			{
+				if (ev->mask & (IN_DELETE_SELF | IN_IGNORED | IN_UNMOUNT))
+					root_gone = 1;
+				cg_root->dirty = 1;
+				continue;
+			}
+
+			for (n = cg_root->children; n != NULL; n = n->next)
+				if (n->wd == ev->wd)
+					break;
+			if (n == NULL)
+				continue;
+
+			/* The watch of a removed directory is gone, the directory
+			 * itself is dropped when its parent is read again. */
+			if (ev->mask & IN_IGNORED)
+			{
+				n->wd = -1;
+				cg_root->dirty = 1;
+			}
+			n->dirty = 1;
+		}
+	}
+
+	return (root_gone);
+} /* }}} int cg_handle_events */
+#endif /* HAVE_SYS_INOTIFY_H */
+
+static void cg_tree_destroy (void) /* {{{ */
+{
+	cg_node_free (cg_root);
+	cg_root = NULL;
+	sfree (cg_root_path);
+
+#if HAVE_SYS_INOTIFY_H
+	if (cg_inotify_fd >= 0)
+		close (cg_inotify_fd);
+	cg_inotify_fd = -1;
+#endif
+} /* }}} void cg_tree_destroy */
+
+/* Finds the hierarchy to read: the cpuacct controller of cgroup v1 or, if
+ * there is none, the unified hierarchy of cgroup v2. */
+static int cg_tree_create (void) /* {{{ */
 {
-	char abs_path[PATH_MAX];
-	struct stat statbuf;
-	char buf[1024];
+	cu_mount_t *mnt_list = NULL;
+	cu_mount_t *mnt_ptr;
+	char const *dir = NULL;
+	_Bool unified = 0;
 	int status;
 
-	FILE *fh;
+	if (cu_mount_getlist (&mnt_list) == NULL)
+	{
+		ERROR ("cgroups plugin: cu_mount_getlist failed.");
+		return (-1);
+	}
 
-	if (ignorelist_match (il_cgroup, cgroup_name))
-		return (0);
+	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+	{
+		/* It doesn't make sense to check other cpuacct mount-points
+		 * (if any), they contain the same data. */
+		if ((strcmp (mnt_ptr->type, "cgroup") == 0)
+				&& cu_mount_checkoption (mnt_ptr->options,
+					"cpuacct", /* full = */ 1))
+		{
+			dir = mnt_ptr->dir;
+			unified = 0;
+			break;
+		}
+
+		if ((dir == NULL) && (strcmp (mnt_ptr->type, "cgroup2") == 0))
+		{
+			dir = mnt_ptr->dir;
+			unified = 1;
+		}
+	}
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, cgroup_name);
+	if (dir == NULL)
+	{
+		cu_mount_freelist (mnt_list);
+		WARNING ("cgroups plugin: Unable to find cgroup "
+				"mount-point with the \"cpuacct\" option.");
+		return (-1);
+	}
 
-	status = lstat (abs_path, &statbuf);
+	cg_root_path = strdup (dir);
+	cu_mount_freelist (mnt_list);
+	if (cg_root_path == NULL)
+		return (-1);
+	cg_unified = unified;
+
+#if HAVE_SYS_INOTIFY_H
+	cg_inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+	if (cg_inotify_fd < 0)
+	{
+		char errbuf[1024];
+		WARNING ("cgroups plugin: inotify_init1 failed: %s. All "
+				"directories will be read every interval.",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+#endif
+
+	cg_root = cg_node_create ("");
+	if (cg_root == NULL)
+	{
+		cg_tree_destroy ();
+		return (-1);
+	}
+
+	status = cg_node_open_dir (cg_root, AT_FDCWD, cg_root_path);
 	if (status != 0)
 	{
-		ERROR ("cgroups plugin: stat (\"%s\") failed.",
-				abs_path);
+		char errbuf[1024];
+		ERROR ("cgroups plugin: open (\"%s\") failed: %s", cg_root_path,
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		cg_tree_destroy ();
 		return (-1);
 	}
 
-	/* We are only interested in directories, so skip everything else. */
-	if (!S_ISDIR (statbuf.st_mode))
-		return (0);
+	return (0);
+} /* }}} int cg_tree_create */
+
+/*
+ * Reading the stat files
+ */
 
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s/cpuacct.stat",
-			dirname, cgroup_name);
-	fh = fopen (abs_path, "r");
-	if (fh == NULL)
+/* Reads `<cgroup>/<file>' relative to `dir_fd' into cg_buffer. */
+static ssize_t cg_read_file (int dir_fd, char const *cgroup, /* {{{ */
+		char const *file)
+{
+	char path[PATH_MAX];
+	size_t fill = 0;
+	int fd;
+
+	ssnprintf (path, sizeof (path), "%s/%s", cgroup, file);
+	fd = openat (dir_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	if (cg_buffer == NULL)
+	{
+		cg_buffer = malloc (CG_BUFFER_SIZE);
+		if (cg_buffer == NULL)
+		{
+			close (fd);
+			errno = ENOMEM;
+			return (-1);
+		}
+		cg_buffer_size = CG_BUFFER_SIZE;
+	}
+
+	while (42)
+	{
+		ssize_t status;
+
+		/* Keep one byte for the terminating null byte. */
+		if (fill + 1 >= cg_buffer_size)
+		{
+			char *tmp = realloc (cg_buffer, 2 * cg_buffer_size);
+			if (tmp == NULL)
+			{
+				close (fd);
+				errno = ENOMEM;
+				return (-1);
+			}
+			cg_buffer = tmp;
+			cg_buffer_size *= 2;
+		}
+
+		status = pread (fd, cg_buffer + fill,
+				cg_buffer_size - fill - 1, (off_t) fill);
+		if ((status < 0) && (errno == EINTR))
+			continue;
+		else if (status < 0)
+		{
+			int status_errno = errno;
+			close (fd);
+			errno = status_errno;
+			return (-1);
+		}
+		else if (status == 0)
+			break;
+
+		fill += (size_t) status;
+	}
+
+	close (fd);
+	cg_buffer[fill] = 0;
+	return ((ssize_t) fill);
+} /* }}} ssize_t cg_read_file */
+
+/* Returns the next line of cg_buffer, split into fields. */
+static int cg_next_line (char **ptr, char **fields, /* {{{ */
+		size_t fields_num)
+{
+	char *line;
+	char *end;
+
+	while (**ptr != 0)
+	{
+		int numfields;
+
+		line = *ptr;
+		end = strchr (line, '\n');
+		if (end != NULL)
+		{
+			*end = 0;
+			*ptr = end + 1;
+		}
+		else
+			*ptr = line + strlen (line);
+
+		numfields = strsplit (line, fields, fields_num);
+		if (numfields > 0)
+			return (numfields);
+	}
+
+	return (0);
+} /* }}} int cg_next_line */
+
+/*
+ * Reads the user/system CPU time of a cgroup of the cpuacct controller.
+ */
+static void read_cpuacct_stat (cg_node_t *parent, cg_node_t *cg) /* {{{ */
+{
+	char *fields[8];
+	char *ptr;
+	int numfields;
+
+	if (cg_read_file (parent->dir_fd, cg->name, "cpuacct.stat") < 0)
 	{
 		char errbuf[1024];
-		ERROR ("cgroups plugin: fopen (\"%s\") failed: %s",
-				abs_path,
+
+		/* Removed since the directory was read. */
+		if (errno == ENOENT)
+		{
+			parent->dirty = 1;
+			return;
+		}
+		ERROR ("cgroups plugin: Reading \"%s/%s/%s/cpuacct.stat\" "
+				"failed: %s", cg_root_path, parent->name, cg->name,
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		return;
 	}
 
-	while (fgets (buf, sizeof (buf), fh) != NULL)
+	ptr = cg_buffer;
+	while ((numfields = cg_next_line (&ptr, fields,
+					STATIC_ARRAY_SIZE (fields))) > 0)
 	{
-		char *fields[8];
-		int numfields = 0;
 		char *key;
 		size_t key_len;
 		value_t value;
@@ -117,8 +587,6 @@ static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
 		 *   user 12345
 		 *   system 23456
 		 */
-		strstripnewline (buf);
-		numfields = strsplit (buf, fields, STATIC_ARRAY_SIZE (fields));
 		if (numfields != 2)
 			continue;
 
@@ -131,48 +599,134 @@ static int read_cpuacct_procs (const char *dirname, char const *cgroup_name,
 		if (key[key_len - 1] == ':')
 			key[key_len - 1] = 0;
 
-		status = parse_value (fields[1], &value, DS_TYPE_DERIVE);
-		if (status != 0)
+		if (parse_value (fields[1], &value, DS_TYPE_DERIVE) != 0)
 			continue;
 
-		cgroups_submit_one (cgroup_name, key, value);
+		cgroups_submit_one (cg->name, key, value);
 	}
-
-	fclose (fh);
-	return (0);
-} /* int read_cpuacct_procs */
+} /* }}} void read_cpuacct_stat */
 
 /*
- * Gets called for every file/folder in /sys/fs/cgroup/cpu,cpuacct (or
- * wherever cpuacct is mounted on the system). Calls walk_directory with the
- * read_cpuacct_procs callback on every folder it finds, such as "system".
+ * Reads "cpu.stat", "memory.stat" and "io.stat" of a cgroup of the unified
+ * hierarchy. The CPU times are converted to the USER_HZ ticks of
+ * "cpuacct.stat", so that both hierarchies report the same values.
  */
-static int read_cpuacct_root (const char *dirname, const char *filename,
-		void *user_data)
+static void read_unified_stat (cg_node_t *parent, cg_node_t *cg) /* {{{ */
 {
-	char abs_path[PATH_MAX];
-	struct stat statbuf;
-	int status;
-
-	ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, filename);
+	static char const *memory_keys[] =
+	{
+		"anon", "file", "kernel_stack", "slab", "sock", "shmem"
+	};
+	char *fields[32];
+	char *ptr;
+	int numfields;
+	size_t i;
+
+	if (cg_read_file (parent->dir_fd, cg->name, "cpu.stat") < 0)
+	{
+		if (errno == ENOENT)
+			parent->dirty = 1;
+		return;
+	}
 
-	status = lstat (abs_path, &statbuf);
-	if (status != 0)
+	ptr = cg_buffer;
+	while ((numfields = cg_next_line (&ptr, fields,
+					STATIC_ARRAY_SIZE (fields))) > 0)
 	{
-		ERROR ("cgroups plugin: stat (%s) failed.", abs_path);
-		return (-1);
+		char const *key;
+		value_t value;
+		derive_t usec;
+
+		if (numfields != 2)
+			continue;
+
+		if (strcmp ("user_usec", fields[0]) == 0)
+			key = "user";
+		else if (strcmp ("system_usec", fields[0]) == 0)
+			key = "system";
+		else
+			continue;
+
+		if (strtoderive (fields[1], &usec) != 0)
+			continue;
+
+		value.derive = usec * (derive_t) sysconf (_SC_CLK_TCK) / 1000000;
+		cgroups_submit_one (cg->name, key, value);
 	}
 
-	if (S_ISDIR (statbuf.st_mode))
+	/* The memory and io controllers may not be enabled for this cgroup. */
+	if (cg_read_file (parent->dir_fd, cg->name, "memory.stat") >= 0)
 	{
-		status = walk_directory (abs_path, read_cpuacct_procs,
-				/* user_data = */ NULL,
-				/* include_hidden = */ 0);
-		return (status);
+		ptr = cg_buffer;
+		while ((numfields = cg_next_line (&ptr, fields,
+						STATIC_ARRAY_SIZE (fields))) > 0)
+		{
+			value_t value;
+
+			if (numfields != 2)
+				continue;
+
+			for (i = 0; i < STATIC_ARRAY_SIZE (memory_keys); i++)
+				if (strcmp (memory_keys[i], fields[0]) == 0)
+					break;
+			if (i >= STATIC_ARRAY_SIZE (memory_keys))
+				continue;
+
+			if (parse_value (fields[1], &value, DS_TYPE_GAUGE) != 0)
+				continue;
+
+			cgroups_submit (cg->name, "memory", fields[0], &value, 1);
+		}
 	}
 
-	return (0);
-}
+	if (cg_read_file (parent->dir_fd, cg->name, "io.stat") >= 0)
+	{
+		derive_t rbytes = 0, wbytes = 0, rios = 0, wios = 0;
+		value_t values[2];
+
+		/* Expected format, one line per device:
+		 *
+		 *   8:0 rbytes=1459200 wbytes=314773504 rios=192 wios=353 ...
+		 */
+		ptr = cg_buffer;
+		while ((numfields = cg_next_line (&ptr, fields,
+						STATIC_ARRAY_SIZE (fields))) > 0)
+		{
+			int j;
+
+			for (j = 1; j < numfields; j++)
+			{
+				char *val = strchr (fields[j], '=');
+				derive_t tmp;
+
+				if (val == NULL)
+					continue;
+				*val = 0;
+				val++;
+
+				if (strtoderive (val, &tmp) != 0)
+					continue;
+
+				if (strcmp ("rbytes", fields[j]) == 0)
+					rbytes += tmp;
+				else if (strcmp ("wbytes", fields[j]) == 0)
+					wbytes += tmp;
+				else if (strcmp ("rios", fields[j]) == 0)
+					rios += tmp;
+				else if (strcmp ("wios", fields[j]) == 0)
+					wios += tmp;
+			}
+		}
+
+		values[0].derive = rbytes;
+		values[1].derive = wbytes;
+		cgroups_submit (cg->name, "disk_octets", "", values, 2);
+
+		values[0].derive = rios;
+		values[1].derive = wios;
+		cgroups_submit (cg->name, "disk_ops", "", values, 2);
+	}
+} /* }}} void read_unified_stat */
 
 static int cgroups_init (void)
 {
@@ -206,51 +760,79 @@ static int cgroups_config (const char *key, const char *value)
 
 static int cgroups_read (void)
 {
-	cu_mount_t *mnt_list;
-	cu_mount_t *mnt_ptr;
-	_Bool cgroup_found = 0;
+	cg_node_t *dir;
+	int status;
 
-	mnt_list = NULL;
-	if (cu_mount_getlist (&mnt_list) == NULL)
+	if (cg_root == NULL)
 	{
-		ERROR ("cgroups plugin: cu_mount_getlist failed.");
-		return (-1);
+		if (cg_tree_create () != 0)
+			return (-1);
 	}
 
-	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+#if HAVE_SYS_INOTIFY_H
+	if ((cg_inotify_fd >= 0) && (cg_handle_events () != 0))
 	{
-		/* Find the cgroup mountpoint which contains the cpuacct
-		 * controller. */
-		if ((strcmp(mnt_ptr->type, "cgroup") != 0)
-				|| !cu_mount_checkoption(mnt_ptr->options,
-					"cpuacct", /* full = */ 1))
-			continue;
-
-		walk_directory (mnt_ptr->dir, read_cpuacct_root,
-				/* user_data = */ NULL,
-				/* include_hidden = */ 0);
-		cgroup_found = 1;
-		/* It doesn't make sense to check other cpuacct mount-points
-		 * (if any), they contain the same data. */
-		break;
+		/* The hierarchy has been unmounted, look for it again. */
+		cg_tree_destroy ();
+		if (cg_tree_create () != 0)
+			return (-1);
 	}
+#endif
 
-	cu_mount_freelist (mnt_list);
+	/* Without a watch, a directory has to be read every time. */
+	if (cg_root->dirty || (cg_root->wd < 0))
+	{
+		status = cg_node_scan (cg_root, /* leaves = */ 0);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("cgroups plugin: Reading the directory \"%s\" failed: "
+					"%s", cg_root_path,
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			cg_tree_destroy ();
+			return (-1);
+		}
+	}
 
-	if (!cgroup_found)
+	for (dir = cg_root->children; dir != NULL; dir = dir->next)
 	{
-		WARNING ("cgroups plugin: Unable to find cgroup "
-				"mount-point with the \"cpuacct\" option.");
-		return (-1);
+		cg_node_t *cg;
+
+		if (dir->dirty || (dir->wd < 0))
+			cg_node_scan (dir, /* leaves = */ 1);
+
+		for (cg = dir->children; cg != NULL; cg = cg->next)
+		{
+			if (cg->ignored)
+				continue;
+
+			if (cg_unified)
+				read_unified_stat (dir, cg);
+			else
+				read_cpuacct_stat (dir, cg);
+		}
 	}
 
 	return (0);
 } /* int cgroup_read */
 
+static int cgroups_shutdown (void)
+{
+	cg_tree_destroy ();
+	sfree (cg_buffer);
+	cg_buffer_size = 0;
+
+	ignorelist_free (il_cgroup);
+	il_cgroup = NULL;
+
+	return (0);
+} /* int cgroups_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("cgroups", cgroups_config,
 			config_keys, config_keys_num);
 	plugin_register_init ("cgroups", cgroups_init);
 	plugin_register_read ("cgroups", cgroups_read);
+	plugin_register_shutdown ("cgroups", cgroups_shutdown);
 } /* void module_register */
@@ -97,6 +97,7 @@ extern int optind, opterr, optopt;
 static char *socket_file_g = NULL;
 static char *value_string_g = NULL;
 static char *hostname_g = NULL;
+static char *bulk_file_g = NULL;
 
 static range_t range_critical_g;
 static range_t range_warning_g;
@@ -249,9 +250,14 @@ __attribute__((noreturn))
 static void usage (const char *name)
 {
 	fprintf (stderr, "Usage: %s <-s socket> <-n value_spec> <-H hostname> [options]\n"
+			"       %s <-s socket> <-b file> [options]\n"
 			"\n"
 			"Valid options are:\n"
 			"  -s <socket>    Path to collectd's UNIX-socket.\n"
+			"  -b <file>      Read one check per line from <file> (`-' for STDIN) and\n"
+			"                 print one result line per check. Each line takes the\n"
+			"                 options -n, -H, -d, -g, -c, -w and -m; options given on\n"
+			"                 the command line are the defaults.\n"
 			"  -n <v_spec>    Value specification to get from collectd.\n"
 			"                 Format: `plugin-instance/type-instance'\n"
 			"  -d <ds>        Select the DS to examine. May be repeated to examine multiple\n"
@@ -271,7 +277,7 @@ static void usage (const char *name)
 			"  sum:           Apply the ranges to the sum of all DSes.\n"
 			"  percentage:    Apply the ranges to the ratio (in percent) of the first value\n"
 			"                 and the sum of all values."
-			"\n", name);
+			"\n", name, name);
 	exit (1);
 } /* void usage */
 
@@ -573,9 +579,48 @@ static int do_check_con_percentage (size_t values_num,
 	printf ("%s: %lf percent |", status_str, percentage);
 	for (i = 0; i < values_num; i++)
 		printf (" %s=%lf;;;;", values_names[i], values[i]);
+	printf ("\n");
 	return (status_code);
 } /* int do_check_con_percentage */
 
+/* Checks the values of one identifier against the current settings. Takes
+ * ownership of "values" and "values_names". */
+static int do_check_values (size_t values_num, /* {{{ */
+		gauge_t *values, char **values_names)
+{
+	size_t i;
+	int status;
+
+	status = filter_ds (&values_num, &values, &values_names);
+	if (status != RET_OKAY)
+	{
+		free (values);
+		if (values_names != NULL)
+			for (i = 0; i < values_num; i++)
+				free (values_names[i]);
+		free (values_names);
+		return (status);
+	}
+
+	status = RET_UNKNOWN;
+	if (consolitation_g == CON_NONE)
+		status =  do_check_con_none (values_num, values, values_names);
+	else if (consolitation_g == CON_AVERAGE)
+		status =  do_check_con_average (values_num, values, values_names);
+	else if (consolitation_g == CON_SUM)
+		status = do_check_con_sum (values_num, values, values_names);
+	else if (consolitation_g == CON_PERCENTAGE)
+		status = do_check_con_percentage (values_num, values, values_names);
+
+	free (values);
+	if (values_names != NULL)
+		for (i = 0; i < values_num; i++)
+			free (values_names[i]);
+	free (values_names);
+
+	return (status);
+} /* }}} int do_check_values */
+
 static int do_check (lcc_connection_t *connection)
 {
 	gauge_t *values;
@@ -583,7 +628,6 @@ static int do_check (lcc_connection_t *connection)
 	size_t   values_num;
 	char ident_str[1024];
 	lcc_identifier_t ident;
-	size_t i;
 	int status;
 
 	snprintf (ident_str, sizeof (ident_str), "%s/%s",
@@ -612,28 +656,397 @@ static int do_check (lcc_connection_t *connection)
 
 	LCC_DESTROY (connection);
 
-	status = filter_ds (&values_num, &values, &values_names);
-	if (status != RET_OKAY)
-		return (status);
+	return (do_check_values (values_num, values, values_names));
+} /* int do_check */
 
-	status = RET_UNKNOWN;
-	if (consolitation_g == CON_NONE)
-		status =  do_check_con_none (values_num, values, values_names);
-	else if (consolitation_g == CON_AVERAGE)
-		status =  do_check_con_average (values_num, values, values_names);
-	else if (consolitation_g == CON_SUM)
-		status = do_check_con_sum (values_num, values, values_names);
-	else if (consolitation_g == CON_PERCENTAGE)
-		status = do_check_con_percentage (values_num, values, values_names);
+/*
+ * Bulk mode
+ *
+ * Each line read with "-b" is one check, given with the same options as on
+ * the command line. All values are fetched with one pipelined GETVAL session
+ * and each check prints one line, prefixed with its identifier and a tab.
+ */
+struct check_s
+{
+	char *ident_str;
+
+	range_t range_critical;
+	range_t range_warning;
+	int consolitation;
+	_Bool nan_is_error;
+	char **match_ds;
+	size_t match_ds_num;
+	_Bool match_ds_owned;
+};
+typedef struct check_s check_t;
 
-	free (values);
-	if (values_names != NULL)
-		for (i = 0; i < values_num; i++)
-			free (values_names[i]);
-	free (values_names);
+static int parse_option (int c, char *arg, const char *name);
 
-	return (status);
-} /* int do_check */
+/* Applies the settings of "ck" to the globals used by the check functions. */
+static void check_load (const check_t *ck) /* {{{ */
+{
+	range_critical_g = ck->range_critical;
+	range_warning_g  = ck->range_warning;
+	consolitation_g  = ck->consolitation;
+	nan_is_error_g   = ck->nan_is_error;
+	match_ds_g       = ck->match_ds;
+	match_ds_num_g   = ck->match_ds_num;
+} /* }}} void check_load */
+
+static void check_save (check_t *ck) /* {{{ */
+{
+	ck->range_critical = range_critical_g;
+	ck->range_warning  = range_warning_g;
+	ck->consolitation  = consolitation_g;
+	ck->nan_is_error   = nan_is_error_g;
+	ck->match_ds       = match_ds_g;
+	ck->match_ds_num   = match_ds_num_g;
+} /* }}} void check_save */
+
+static void check_free (check_t *ck) /* {{{ */
+{
+	size_t i;
+
+	free (ck->ident_str);
+	if (ck->match_ds_owned)
+	{
+		for (i = 0; i < ck->match_ds_num; i++)
+			free (ck->match_ds[i]);
+		free (ck->match_ds);
+	}
+} /* }}} void check_free */
+
+/* Parses one line of options into "ck", starting from the defaults. Returns
+ * zero on success, one for empty lines and comments and -1 on error. */
+static int check_parse (check_t *ck, const check_t *defaults, /* {{{ */
+		char *line)
+{
+	char *fields[64];
+	size_t fields_num = 0;
+	char *saveptr = NULL;
+	char *ptr;
+	char ident_str[1024];
+	size_t i;
+
+	memset (ck, 0, sizeof (*ck));
+
+	for (ptr = line; fields_num < 64; ptr = NULL)
+	{
+		fields[fields_num] = strtok_r (ptr, " \t\r\n", &saveptr);
+		if (fields[fields_num] == NULL)
+			break;
+		fields_num++;
+	}
+	if ((fields_num == 0) || (fields[0][0] == '#'))
+		return (1);
+
+	check_load (defaults);
+	hostname_g = NULL;
+	value_string_g = NULL;
+	/* "-d" on the line replaces the default data sources. */
+	match_ds_g = NULL;
+	match_ds_num_g = 0;
+
+	for (i = 0; i < fields_num; i++)
+	{
+		char *arg = NULL;
+		int c;
+
+		if ((fields[i][0] != '-') || (fields[i][1] == 0)
+				|| (fields[i][2] != 0)
+				|| (strchr ("ncwHgdm", fields[i][1]) == NULL))
+		{
+			printf ("ERROR: Unexpected argument `%s'.\n", fields[i]);
+			goto failure;
+		}
+		c = fields[i][1];
+
+		if (c != 'm')
+		{
+			if ((i + 1) >= fields_num)
+			{
+				printf ("ERROR: Option `%s' needs an argument.\n",
+						fields[i]);
+				goto failure;
+			}
+			arg = fields[++i];
+		}
+
+		if (parse_option (c, arg, NULL) != 0)
+			goto failure;
+	}
+
+	if ((hostname_g == NULL) || (value_string_g == NULL))
+	{
+		printf ("ERROR: Each check needs the -H and -n options.\n");
+		goto failure;
+	}
+
+	snprintf (ident_str, sizeof (ident_str), "%s/%s",
+			hostname_g, value_string_g);
+	ident_str[sizeof (ident_str) - 1] = 0;
+	ck->ident_str = cn_strdup (ident_str);
+	if (ck->ident_str == NULL)
+		goto failure;
+
+	if (match_ds_g == NULL)
+	{
+		match_ds_g = defaults->match_ds;
+		match_ds_num_g = defaults->match_ds_num;
+	}
+	else
+		ck->match_ds_owned = 1;
+
+	check_save (ck);
+	return (0);
+
+failure:
+	/* Only the data sources given on this line belong to the check. */
+	ck->match_ds = match_ds_g;
+	ck->match_ds_num = match_ds_num_g;
+	ck->match_ds_owned = 1;
+	return (-1);
+} /* }}} int check_parse */
+
+static int do_bulk (lcc_connection_t *connection, const char *file) /* {{{ */
+{
+	FILE *fh;
+	char line[4096];
+	check_t defaults;
+	check_t *checks = NULL;
+	size_t checks_num = 0;
+	lcc_identifier_t *idents;
+	lcc_getval_result_t *results;
+	int *ident_status;
+	int worst = RET_OKAY;
+	size_t report_num;
+	size_t i;
+
+	if (strcmp ("-", file) == 0)
+		fh = stdin;
+	else
+		fh = fopen (file, "r");
+	if (fh == NULL)
+	{
+		printf ("UNKNOWN: Opening `%s' failed: %s\n", file, strerror (errno));
+		LCC_DESTROY (connection);
+		return (RET_UNKNOWN);
+	}
+
+	memset (&defaults, 0, sizeof (defaults));
+	check_save (&defaults);
+
+	while (fgets (line, sizeof (line), fh) != NULL)
+	{
+		check_t ck;
+		check_t *tmp;
+		int status;
+
+		status = check_parse (&ck, &defaults, line);
+		if (status > 0)
+			continue;
+		if (status < 0)
+		{
+			check_free (&ck);
+			worst = RET_UNKNOWN;
+			continue;
+		}
+
+		tmp = (check_t *) realloc (checks, (checks_num + 1) * sizeof (*checks));
+		if (tmp == NULL)
+		{
+			fprintf (stderr, "realloc failed: %s\n", strerror (errno));
+			check_free (&ck);
+			worst = RET_UNKNOWN;
+			break;
+		}
+		checks = tmp;
+		checks[checks_num] = ck;
+		checks_num++;
+	}
+
+	if (fh != stdin)
+		fclose (fh);
+	report_num = checks_num;
+
+	idents = (lcc_identifier_t *) calloc (checks_num + 1, sizeof (*idents));
+	results = (lcc_getval_result_t *) calloc (checks_num + 1, sizeof (*results));
+	ident_status = (int *) calloc (checks_num + 1, sizeof (*ident_status));
+	if ((idents == NULL) || (results == NULL) || (ident_status == NULL))
+	{
+		fprintf (stderr, "calloc failed: %s\n", strerror (errno));
+		report_num = 0;
+		worst = RET_UNKNOWN;
+	}
+
+	/* Checks with invalid identifiers get an empty slot, which is never
+	 * sent. */
+	for (i = 0; i < report_num; i++)
+		ident_status[i] = lcc_string_to_identifier (connection, idents + i,
+				checks[i].ident_str);
+
+	if (report_num > 0)
+	{
+		lcc_identifier_t *valid;
+		size_t valid_num = 0;
+
+		valid = (lcc_identifier_t *) calloc (report_num, sizeof (*valid));
+		if (valid == NULL)
+		{
+			fprintf (stderr, "calloc failed: %s\n", strerror (errno));
+			report_num = 0;
+			worst = RET_UNKNOWN;
+		}
+		else
+		{
+			for (i = 0; i < report_num; i++)
+				if (ident_status[i] == 0)
+					valid[valid_num++] = idents[i];
+
+			if ((valid_num > 0)
+					&& (lcc_getval_multi (connection, valid, valid_num, results) != 0))
+			{
+				printf ("UNKNOWN: Retrieving values from the daemon failed: %s.\n",
+						lcc_strerror (connection));
+				lcc_getval_results_free (results, valid_num);
+				report_num = 0;
+				worst = RET_UNKNOWN;
+			}
+			free (valid);
+		}
+	}
+
+	LCC_DESTROY (connection);
+
+	/* Results are stored in order of the valid identifiers. */
+	{
+		size_t r = 0;
+
+		for (i = 0; i < report_num; i++)
+		{
+			int status;
+
+			printf ("%s\t", checks[i].ident_str);
+			if (ident_status[i] != 0)
+			{
+				printf ("ERROR: Creating an identifier failed.\n");
+				status = RET_CRITICAL;
+			}
+			else if (results[r].status != 0)
+			{
+				printf ("ERROR: Retrieving values from the daemon failed.\n");
+				status = RET_CRITICAL;
+				r++;
+			}
+			else
+			{
+				check_load (checks + i);
+				status = do_check_values (results[r].values_num,
+						results[r].values, results[r].values_names);
+				/* do_check_values() took ownership. */
+				results[r].values = NULL;
+				results[r].values_names = NULL;
+				results[r].values_num = 0;
+				r++;
+			}
+
+			if (status > worst)
+				worst = status;
+		}
+		lcc_getval_results_free (results, r);
+	}
+
+	check_load (&defaults);
+	for (i = 0; i < checks_num; i++)
+		check_free (checks + i);
+	free (checks);
+	free (idents);
+	free (results);
+	free (ident_status);
+
+	return (worst);
+} /* }}} int do_bulk */
+
+/* Handles one command line option. Returns non-zero if it is invalid; on the
+ * command line ("name" is set), usage() is called instead. */
+static int parse_option (int c, char *arg, const char *name) /* {{{ */
+{
+	switch (c)
+	{
+		case 'c':
+			parse_range (arg, &range_critical_g);
+			break;
+		case 'w':
+			parse_range (arg, &range_warning_g);
+			break;
+		case 's':
+			socket_file_g = arg;
+			break;
+		case 'n':
+			value_string_g = arg;
+			break;
+		case 'H':
+			hostname_g = arg;
+			break;
+		case 'b':
+			bulk_file_g = arg;
+			break;
+		case 'g':
+			if (strcasecmp (arg, "none") == 0)
+				consolitation_g = CON_NONE;
+			else if (strcasecmp (arg, "average") == 0)
+				consolitation_g = CON_AVERAGE;
+			else if (strcasecmp (arg, "sum") == 0)
+				consolitation_g = CON_SUM;
+			else if (strcasecmp (arg, "percentage") == 0)
+				consolitation_g = CON_PERCENTAGE;
+			else
+			{
+				if (name == NULL)
+				{
+					printf ("ERROR: Unknown consolidation function `%s'.\n",
+							arg);
+					return (-1);
+				}
+				fprintf (stderr, "Unknown consolidation function `%s'.\n",
+						arg);
+				usage (name);
+			}
+			break;
+		case 'd':
+		{
+			char **tmp;
+			tmp = (char **) realloc (match_ds_g,
+					(match_ds_num_g + 1)
+					* sizeof (char *));
+			if (tmp == NULL)
+			{
+				fprintf (stderr, "realloc failed: %s\n",
+						strerror (errno));
+				return (-1);
+			}
+			match_ds_g = tmp;
+			match_ds_g[match_ds_num_g] = cn_strdup (arg);
+			if (match_ds_g[match_ds_num_g] == NULL)
+			{
+				fprintf (stderr, "cn_strdup failed: %s\n",
+						strerror (errno));
+				return (-1);
+			}
+			match_ds_num_g++;
+			break;
+		}
+		case 'm':
+			nan_is_error_g = 1;
+			break;
+		default:
+			if (name == NULL)
+				return (-1);
+			usage (name);
+	} /* switch (c) */
+
+	return (0);
+} /* }}} int parse_option */
 
 int main (int argc, char **argv)
 {
@@ -654,76 +1067,18 @@ int main (int argc, char **argv)
 	{
 		int c;
 
-		c = getopt (argc, argv, "w:c:s:n:H:g:d:hm");
+		c = getopt (argc, argv, "w:c:s:n:H:g:d:hmb:");
 		if (c < 0)
 			break;
 
-		switch (c)
-		{
-			case 'c':
-				parse_range (optarg, &range_critical_g);
-				break;
-			case 'w':
-				parse_range (optarg, &range_warning_g);
-				break;
-			case 's':
-				socket_file_g = optarg;
-				break;
-			case 'n':
-				value_string_g = optarg;
-				break;
-			case 'H':
-				hostname_g = optarg;
-				break;
-			case 'g':
-				if (strcasecmp (optarg, "none") == 0)
-					consolitation_g = CON_NONE;
-				else if (strcasecmp (optarg, "average") == 0)
-					consolitation_g = CON_AVERAGE;
-				else if (strcasecmp (optarg, "sum") == 0)
-					consolitation_g = CON_SUM;
-				else if (strcasecmp (optarg, "percentage") == 0)
-					consolitation_g = CON_PERCENTAGE;
-				else
-				{
-					fprintf (stderr, "Unknown consolidation function `%s'.\n",
-							optarg);
-					usage (argv[0]);
-				}
-				break;
-			case 'd':
-			{
-				char **tmp;
-				tmp = (char **) realloc (match_ds_g,
-						(match_ds_num_g + 1)
-						* sizeof (char *));
-				if (tmp == NULL)
-				{
-					fprintf (stderr, "realloc failed: %s\n",
-							strerror (errno));
-					return (RET_UNKNOWN);
-				}
-				match_ds_g = tmp;
-				match_ds_g[match_ds_num_g] = cn_strdup (optarg);
-				if (match_ds_g[match_ds_num_g] == NULL)
-				{
-					fprintf (stderr, "cn_strdup failed: %s\n",
-							strerror (errno));
-					return (RET_UNKNOWN);
-				}
-				match_ds_num_g++;
-				break;
-			}
-			case 'm':
-				nan_is_error_g = 1;
-				break;
-			default:
-				usage (argv[0]);
-		} /* switch (c) */
+		if (parse_option (c, optarg, argv[0]) != 0)
+			return (RET_UNKNOWN);
 	}
 
-	if ((socket_file_g == NULL) || (value_string_g == NULL)
-			|| ((hostname_g == NULL) && (strcasecmp (value_string_g, "LIST"))))
+	if ((socket_file_g == NULL)
+			|| ((bulk_file_g == NULL) && (value_string_g == NULL))
+			|| ((bulk_file_g == NULL) && (hostname_g == NULL)
+				&& (strcasecmp (value_string_g, "LIST"))))
 	{
 		fprintf (stderr, "Missing required arguments.\n");
 		usage (argv[0]);
@@ -741,6 +1096,9 @@ int main (int argc, char **argv)
 		return (RET_CRITICAL);
 	}
 
+	if (bulk_file_g != NULL)
+		return (do_bulk (connection, bulk_file_g));
+
 	if (0 == strcasecmp (value_string_g, "LIST"))
 		return (do_listval (connection));
 
@@ -39,8 +39,15 @@
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
 
 #include "utils_heap.h"
 
@@ -50,20 +57,102 @@
 
 #define DEF_NUM_HOSTS    1000
 #define DEF_NUM_PLUGINS    20
+#define DEF_NUM_PLUGIN_INSTANCES 1
 #define DEF_NUM_VALUES 100000
 #define DEF_INTERVAL       10.0
+#define DEF_SOCK LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
+#define DEF_STATSD_ADDR "localhost"
+#define DEF_STATSD_PORT "8125"
+
+#define TRANSPORT_NETWORK  0
+#define TRANSPORT_UNIXSOCK 1
+#define TRANSPORT_STATSD   2
+
+/* Size of the statsd datagrams; fits into an Ethernet frame. */
+#define STATSD_PACKET_SIZE 1452
+
+/* Latency samples kept for the percentiles. Later samples are dropped. */
+#define LATENCIES_MAX 1000000
 
 static int conf_num_hosts = DEF_NUM_HOSTS;
 static int conf_num_plugins = DEF_NUM_PLUGINS;
+static int conf_num_plugin_instances = DEF_NUM_PLUGIN_INSTANCES;
 static int conf_num_values = DEF_NUM_VALUES;
 static double conf_interval = DEF_INTERVAL;
-static const char *conf_destination = NET_DEFAULT_V6_ADDR;
-static const char *conf_service = NET_DEFAULT_PORT;
-
-static lcc_network_t *net;
+static double conf_duration = 0.0;
+static const char *conf_destination = NULL;
+static const char *conf_service = NULL;
+static const char *conf_socket = "unix:"DEF_SOCK;
+static const char *conf_sink_port = NULL;
+static int conf_transport = TRANSPORT_NETWORK;
+static _Bool conf_mixed_types = 0;
+static _Bool conf_read_stats = 0;
+/* Recordings of the write_record plugin to send instead of generated
+ * values, and the speed relative to the recording; zero means flat out. */
+static const char **conf_replay_files = NULL;
+static size_t conf_replay_files_num = 0;
+static double conf_replay_speed = 1.0;
+
+/* Types of the generated value lists. With -m, the types are picked in
+ * proportion to their weight, otherwise half are gauges and half derives. */
+struct tg_type_s
+{
+  const char *type;
+  size_t values_num;
+  int values_type;
+  int weight;
+};
+typedef struct tg_type_s tg_type_t;
+
+static tg_type_t tg_types[] =
+{
+  { "gauge",     1, LCC_TYPE_GAUGE,  40 },
+  { "derive",    1, LCC_TYPE_DERIVE, 30 },
+  { "if_octets", 2, LCC_TYPE_DERIVE, 20 },
+  { "load",      3, LCC_TYPE_GAUGE,  10 }
+};
+#define TG_TYPES_SIMPLE 2
+
+#define STATIC_ARRAY_SIZE(a) (sizeof (a) / sizeof (*(a)))
+
+static lcc_network_t *net = NULL;
+static lcc_connection_t *unixsock = NULL;
+
+static int statsd_fd = -1;
+static char statsd_buffer[STATSD_PACKET_SIZE];
+static size_t statsd_buffer_fill = 0;
+
+/* Statistics for the final report. */
+static double time_start;
+/* Value lists are scheduled with the monotonic dtime() but sent with wall
+ * clock times. */
+static double time_offset;
+static double time_end;
+static long values_lists_sent = 0;
+static long values_sent = 0;
+static long send_errors = 0;
+static long probes_sent = 0;
+static long packets_replayed = 0;
+
+/* The sink receives the network packets the daemon forwards and measures the
+ * latency of the probe values, which hold the time they were sent at. */
+static int sink_fd = -1;
+static pthread_t sink_thread;
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+static double *latencies = NULL;
+static size_t latencies_num = 0;
+static long probes_received = 0;
+static double sink_last_probe = 0.0;
+static _Bool sink_loop = 1;
 
 static c_heap_t *values_heap = NULL;
 
+/* Values due at the same time are sent with one call. The copies share the
+ * values of the value lists in "batch_ptrs". */
+static lcc_value_list_t *batch = NULL;
+static lcc_value_list_t **batch_ptrs = NULL;
+static size_t batch_num = 0;
+
 static struct sigaction sigint_action;
 static struct sigaction sigterm_action;
 
@@ -81,18 +170,35 @@ static void exit_usage (int exit_status) /* {{{ */
       "    -n <number>    Number of value lists. (Default: %i)\n"
       "    -H <number>    Number of hosts to emulate. (Default: %i)\n"
       "    -p <number>    Number of plugins to emulate. (Default: %i)\n"
+      "    -P <number>    Number of instances of each plugin. (Default: %i)\n"
+      "    -m             Mix gauge, derive, if_octets and load values.\n"
       "    -i <seconds>   Interval of each value in seconds. (Default: %.3f)\n"
-      "    -d <dest>      Destination address of the network packets.\n"
-      "                   (Default: %s)\n"
-      "    -D <port>      Destination port of the network packets.\n"
+      "    -r <seconds>   Stop after this many seconds. (Default: never)\n"
+      "    -t <transport> Send values via \"network\", \"unixsock\" or\n"
+      "                   \"statsd\". (Default: network)\n"
+      "    -d <dest>      Destination address of the network or statsd\n"
+      "                   packets. (Default: %s or %s)\n"
+      "    -D <port>      Destination port of the network or statsd\n"
+      "                   packets. (Default: %s or %s)\n"
+      "    -s <socket>    Path to the UNIX socket of the daemon.\n"
       "                   (Default: %s)\n"
+      "    -l <port>      Receive the values forwarded by the daemon on\n"
+      "                   this port and report the latency.\n"
+      "    -S             Report the values dropped by the daemon, read\n"
+      "                   from the UNIX socket.\n"
+      "    -R <file>      Send the packets recorded by the write_record\n"
+      "                   plugin instead of generated values. May be given\n"
+      "                   several times. Only with the network transport.\n"
+      "    -x <factor>    Replay this many times faster than recorded, zero\n"
+      "                   meaning as fast as possible. (Default: 1)\n"
       "    -h             Print usage information (this output).\n"
       "\n"
       "Copyright (C) 2010-2012  Florian Forster\n"
       "Licensed under the MIT license.\n",
       DEF_NUM_VALUES, DEF_NUM_HOSTS, DEF_NUM_PLUGINS,
-      DEF_INTERVAL,
-      NET_DEFAULT_V6_ADDR, NET_DEFAULT_PORT);
+      DEF_NUM_PLUGIN_INSTANCES, DEF_INTERVAL,
+      NET_DEFAULT_V6_ADDR, DEF_STATSD_ADDR,
+      NET_DEFAULT_PORT, DEF_STATSD_PORT, DEF_SOCK);
   exit (exit_status);
 } /* }}} void exit_usage */
 
@@ -124,6 +230,18 @@ static double dtime (void) /* {{{ */
 } /* }}} double dtime */
 #endif
 
+/* Wall clock time, which the probe values carry from the generator to the
+ * sink. */
+static double wtime (void) /* {{{ */
+{
+  struct timeval tv = { 0 };
+
+  if (gettimeofday (&tv, /* timezone = */ NULL) != 0)
+    perror ("gettimeofday");
+
+  return ((double) tv.tv_sec) + (((double) tv.tv_usec) / 1e6);
+} /* }}} double wtime */
+
 static int compare_time (const void *v0, const void *v1) /* {{{ */
 {
   const lcc_value_list_t *vl0 = v0;
@@ -151,10 +269,37 @@ static int get_boundet_random (int min, int max) /* {{{ */
   return (min + ((int) (((double) range) * ((double) random ()) / (((double) RAND_MAX) + 1.0))));
 } /* }}} int get_boundet_random */
 
+static tg_type_t *pick_type (void) /* {{{ */
+{
+  int weights = 0;
+  int r;
+  size_t i;
+
+  if (!conf_mixed_types)
+    return (&tg_types[get_boundet_random (0, TG_TYPES_SIMPLE)]);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (tg_types); i++)
+    weights += tg_types[i].weight;
+
+  r = get_boundet_random (0, weights);
+  for (i = 0; i < STATIC_ARRAY_SIZE (tg_types); i++)
+  {
+    if (r < tg_types[i].weight)
+      break;
+    r -= tg_types[i].weight;
+  }
+
+  return (&tg_types[i]);
+} /* }}} tg_type_t *pick_type */
+
 static lcc_value_list_t *create_value_list (void) /* {{{ */
 {
   lcc_value_list_t *vl;
+  tg_type_t *type;
   int host_num;
+  size_t i;
+
+  type = pick_type ();
 
   vl = calloc (1, sizeof (*vl));
   if (vl == NULL)
@@ -163,7 +308,7 @@ static lcc_value_list_t *create_value_list (void) /* {{{ */
     return (NULL);
   }
 
-  vl->values = calloc (/* nmemb = */ 1, sizeof (*vl->values));
+  vl->values = calloc (type->values_num, sizeof (*vl->values));
   if (vl->values == NULL)
   {
     fprintf (stderr, "calloc failed.\n");
@@ -171,7 +316,7 @@ static lcc_value_list_t *create_value_list (void) /* {{{ */
     return (NULL);
   }
 
-  vl->values_types = calloc (/* nmemb = */ 1, sizeof (*vl->values_types));
+  vl->values_types = calloc (type->values_num, sizeof (*vl->values_types));
   if (vl->values_types == NULL)
   {
     fprintf (stderr, "calloc failed.\n");
@@ -180,7 +325,9 @@ static lcc_value_list_t *create_value_list (void) /* {{{ */
     return (NULL);
   }
 
-  vl->values_len = 1;
+  vl->values_len = type->values_num;
+  for (i = 0; i < vl->values_len; i++)
+    vl->values_types[i] = type->values_type;
 
   host_num = get_boundet_random (0, conf_num_hosts);
 
@@ -188,18 +335,15 @@ static lcc_value_list_t *create_value_list (void) /* {{{ */
   vl->time = 1.0 + dtime ()
     + (host_num % (1 + (int) vl->interval));
 
-  if (get_boundet_random (0, 2) == 0)
-    vl->values_types[0] = LCC_TYPE_GAUGE;
-  else
-    vl->values_types[0] = LCC_TYPE_DERIVE;
-
   snprintf (vl->identifier.host, sizeof (vl->identifier.host),
       "host%04i", host_num);
   snprintf (vl->identifier.plugin, sizeof (vl->identifier.plugin),
       "plugin%03i", get_boundet_random (0, conf_num_plugins));
-  strncpy (vl->identifier.type,
-      (vl->values_types[0] == LCC_TYPE_GAUGE) ? "gauge" : "derive",
-      sizeof (vl->identifier.type));
+  if (conf_num_plugin_instances > 1)
+    snprintf (vl->identifier.plugin_instance,
+        sizeof (vl->identifier.plugin_instance),
+        "%i", get_boundet_random (0, conf_num_plugin_instances));
+  strncpy (vl->identifier.type, type->type, sizeof (vl->identifier.type));
   vl->identifier.type[sizeof (vl->identifier.type) - 1] = 0;
   snprintf (vl->identifier.type_instance, sizeof (vl->identifier.type_instance),
       "ti%li", random ());
@@ -217,24 +361,713 @@ static void destroy_value_list (lcc_value_list_t *vl) /* {{{ */
   free (vl);
 } /* }}} void destroy_value_list */
 
-static int send_value (lcc_value_list_t *vl) /* {{{ */
+static int statsd_flush (void) /* {{{ */
 {
-  int status;
+  ssize_t status;
+
+  if (statsd_buffer_fill == 0)
+    return (0);
+
+  status = send (statsd_fd, statsd_buffer, statsd_buffer_fill, /* flags = */ 0);
+  statsd_buffer_fill = 0;
+  if (status < 0)
+  {
+    send_errors++;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int statsd_flush */
+
+/* Appends one metric line to the current datagram, sending it first if the
+ * line doesn't fit anymore. */
+static int statsd_add (const char *line) /* {{{ */
+{
+  size_t len = strlen (line);
+
+  if (statsd_buffer_fill + len + 1 > sizeof (statsd_buffer))
+    statsd_flush ();
+  if (len + 1 > sizeof (statsd_buffer))
+    return (-1);
+
+  if (statsd_buffer_fill > 0)
+    statsd_buffer[statsd_buffer_fill++] = '\n';
+  memcpy (statsd_buffer + statsd_buffer_fill, line, len);
+  statsd_buffer_fill += len;
+
+  return (0);
+} /* }}} int statsd_add */
+
+/* Sends a value list which holds the current time, so that the sink can
+ * measure how long the value took through the daemon. */
+static void send_probe (void) /* {{{ */
+{
+  lcc_value_list_t vl = LCC_VALUE_LIST_INIT;
+  value_t value;
+  int value_type = LCC_TYPE_GAUGE;
+  int status = 0;
+
+  value.gauge = wtime ();
+
+  vl.values = &value;
+  vl.values_types = &value_type;
+  vl.values_len = 1;
+  vl.time = value.gauge;
+  vl.interval = conf_interval;
+  strncpy (vl.identifier.host, "collectd-tg", sizeof (vl.identifier.host));
+  strncpy (vl.identifier.plugin, "tg", sizeof (vl.identifier.plugin));
+  strncpy (vl.identifier.type, "gauge", sizeof (vl.identifier.type));
+  strncpy (vl.identifier.type_instance, "latency",
+      sizeof (vl.identifier.type_instance));
+
+  if (conf_transport == TRANSPORT_NETWORK)
+  {
+    status = lcc_network_values_send (net, &vl);
+    if (status == 0)
+      status = lcc_network_flush (net);
+  }
+  else if (conf_transport == TRANSPORT_UNIXSOCK)
+    status = lcc_putval_bulk (unixsock, &vl, 1, LCC_PUTVAL_NOREPLY);
+  else
+  {
+    char line[64];
+
+    snprintf (line, sizeof (line), "tg_latency:%.6f|g", value.gauge);
+    statsd_add (line);
+    status = statsd_flush ();
+  }
+
+  if (status != 0)
+    send_errors++;
+  else
+    probes_sent++;
+} /* }}} void send_probe */
+
+static int send_batch (void) /* {{{ */
+{
+  size_t i;
+  int status = 0;
 
-  if (vl->values_types[0] == LCC_TYPE_GAUGE)
-    vl->values[0].gauge = 100.0 * ((gauge_t) random ()) / (((gauge_t) RAND_MAX) + 1.0);
+  if (batch_num == 0)
+    return (0);
+
+  if (conf_transport == TRANSPORT_NETWORK)
+  {
+    status = lcc_network_values_send_bulk (net, batch, batch_num);
+    if (status != 0)
+      fprintf (stderr, "lcc_network_values_send_bulk failed with status %i.\n",
+          status);
+  }
+  else if (conf_transport == TRANSPORT_UNIXSOCK)
+  {
+    status = lcc_putval_bulk (unixsock, batch, batch_num, LCC_PUTVAL_NOREPLY);
+    if (status != 0)
+      fprintf (stderr, "lcc_putval_bulk failed: %s\n",
+          lcc_strerror (unixsock));
+  }
   else
-    vl->values[0].derive += (derive_t) get_boundet_random (0, 100);
+    statsd_flush ();
 
-  status = lcc_network_values_send (net, vl);
   if (status != 0)
-    fprintf (stderr, "lcc_network_values_send failed with status %i.\n", status);
+    send_errors++;
+
+  for (i = 0; i < batch_num; i++)
+  {
+    lcc_value_list_t *vl = batch_ptrs[i];
+
+    vl->time += vl->interval;
+    c_heap_insert (values_heap, vl);
+  }
+  batch_num = 0;
+
+  if (sink_fd >= 0)
+    send_probe ();
+
+  return (0);
+} /* }}} int send_batch */
+
+/* statsd has no identifiers and no data sets: each value becomes a metric
+ * named after the identifier, gauges are sent as gauges and derives as
+ * counters. */
+static void send_value_statsd (lcc_value_list_t *vl, /* {{{ */
+    derive_t const *increments)
+{
+  char name[256];
+  char line[512];
+  size_t i;
+
+  if (vl->identifier.plugin_instance[0] != 0)
+    snprintf (name, sizeof (name), "%s.%s.%s.%s", vl->identifier.host,
+        vl->identifier.plugin, vl->identifier.plugin_instance,
+        vl->identifier.type_instance);
+  else
+    snprintf (name, sizeof (name), "%s.%s.%s", vl->identifier.host,
+        vl->identifier.plugin, vl->identifier.type_instance);
+
+  for (i = 0; i < vl->values_len; i++)
+  {
+    char suffix[24] = "";
+
+    if (vl->values_len > 1)
+      snprintf (suffix, sizeof (suffix), ".%zu", i);
+
+    if (vl->values_types[i] == LCC_TYPE_GAUGE)
+      snprintf (line, sizeof (line), "%s%s:%g|g", name, suffix,
+          vl->values[i].gauge);
+    else
+      snprintf (line, sizeof (line), "%s%s:%"PRIu64"|c", name, suffix,
+          increments[i]);
+    statsd_add (line);
+  }
+} /* }}} void send_value_statsd */
+
+/* Each value list is in the heap or in the batch, so the batch can't hold
+ * more than "conf_num_values" entries. */
+static int send_value (lcc_value_list_t *vl) /* {{{ */
+{
+  derive_t increments[vl->values_len];
+  size_t i;
+
+  for (i = 0; i < vl->values_len; i++)
+  {
+    if (vl->values_types[i] == LCC_TYPE_GAUGE)
+      vl->values[i].gauge = 100.0 * ((gauge_t) random ()) / (((gauge_t) RAND_MAX) + 1.0);
+    else
+    {
+      increments[i] = (derive_t) get_boundet_random (0, 100);
+      vl->values[i].derive += increments[i];
+    }
+  }
+
+  if (conf_transport == TRANSPORT_STATSD)
+    send_value_statsd (vl, increments);
+
+  batch[batch_num] = *vl;
+  batch[batch_num].time += time_offset;
+  batch_ptrs[batch_num] = vl;
+  batch_num++;
 
-  vl->time += vl->interval;
+  values_lists_sent++;
+  values_sent += (long) vl->values_len;
 
   return (0);
 } /* }}} int send_value */
 
+/* Copies the string of a network part, which is null-terminated on the
+ * wire. */
+static void sink_copy_string (char *dest, size_t dest_size, /* {{{ */
+    const char *part, size_t part_size)
+{
+  size_t len = part_size - 4;
+
+  if (len >= dest_size)
+    len = dest_size - 1;
+  memcpy (dest, part + 4, len);
+  dest[len] = 0;
+} /* }}} void sink_copy_string */
+
+/* Gauges are sent in x86 byte order. */
+static double sink_gauge (const uint8_t *buffer) /* {{{ */
+{
+  uint64_t tmp = 0;
+  double d;
+  int i;
+
+  for (i = 7; i >= 0; i--)
+    tmp = (tmp << 8) | buffer[i];
+  memcpy (&d, &tmp, sizeof (d));
+
+  return (d);
+} /* }}} double sink_gauge */
+
+static void sink_add_latency (double sent, double now) /* {{{ */
+{
+  pthread_mutex_lock (&sink_lock);
+
+  /* statsd dispatches the last gauge again when it hasn't been updated. */
+  if (sent == sink_last_probe)
+  {
+    pthread_mutex_unlock (&sink_lock);
+    return;
+  }
+  sink_last_probe = sent;
+  probes_received++;
+
+  if (latencies_num < LATENCIES_MAX)
+    latencies[latencies_num++] = now - sent;
+
+  pthread_mutex_unlock (&sink_lock);
+} /* }}} void sink_add_latency */
+
+/* Walks the parts of an unsigned, unencrypted network packet and looks for
+ * probe values. Probes sent via statsd arrive as "statsd/gauge-tg_latency". */
+static void sink_handle_packet (const char *buffer, size_t buffer_size, /* {{{ */
+    double now)
+{
+  char plugin[LCC_NAME_LEN] = "";
+  char type[LCC_NAME_LEN] = "";
+  char type_instance[LCC_NAME_LEN] = "";
+
+  while (buffer_size >= 4)
+  {
+    uint16_t part_type;
+    uint16_t part_size;
+
+    memcpy (&part_type, buffer, sizeof (part_type));
+    memcpy (&part_size, buffer + 2, sizeof (part_size));
+    part_type = ntohs (part_type);
+    part_size = ntohs (part_size);
+
+    if ((part_size < 4) || (part_size > buffer_size))
+      break;
+
+    if (part_type == 0x0002)
+      sink_copy_string (plugin, sizeof (plugin), buffer, part_size);
+    else if (part_type == 0x0004)
+      sink_copy_string (type, sizeof (type), buffer, part_size);
+    else if (part_type == 0x0005)
+      sink_copy_string (type_instance, sizeof (type_instance),
+          buffer, part_size);
+    else if ((part_type == 0x0006)
+        && (strcmp (type, "gauge") == 0)
+        && (((strcmp (plugin, "tg") == 0)
+            && (strcmp (type_instance, "latency") == 0))
+          || (strcmp (type_instance, "tg_latency") == 0)))
+    {
+      uint16_t values_num;
+
+      memcpy (&values_num, buffer + 4, sizeof (values_num));
+      values_num = ntohs (values_num);
+
+      if ((values_num == 1) && (part_size >= 6 + 9)
+          && (buffer[6] == LCC_TYPE_GAUGE))
+        sink_add_latency (sink_gauge ((const uint8_t *) buffer + 7), now);
+    }
+
+    buffer += part_size;
+    buffer_size -= part_size;
+  }
+} /* }}} void sink_handle_packet */
+
+static void *sink_thread_main (void __attribute__((unused)) *arg) /* {{{ */
+{
+  char buffer[65536];
+
+  while (sink_loop)
+  {
+    struct pollfd pfd = { sink_fd, POLLIN, 0 };
+    ssize_t status;
+
+    status = poll (&pfd, 1, /* timeout = */ 100);
+    if (status <= 0)
+      continue;
+
+    status = recv (sink_fd, buffer, sizeof (buffer), /* flags = */ 0);
+    if (status <= 0)
+      continue;
+
+    sink_handle_packet (buffer, (size_t) status, wtime ());
+  }
+
+  return (NULL);
+} /* }}} void *sink_thread_main */
+
+static int sink_start (void) /* {{{ */
+{
+  struct addrinfo ai_hints = { 0 };
+  struct addrinfo *ai_list;
+  struct addrinfo *ai;
+  int bufsize = 16 * 1024 * 1024;
+  int status;
+
+  latencies = calloc (LATENCIES_MAX, sizeof (*latencies));
+  if (latencies == NULL)
+  {
+    fprintf (stderr, "calloc failed.\n");
+    return (-1);
+  }
+
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_DGRAM;
+  ai_hints.ai_flags = AI_PASSIVE;
+
+  status = getaddrinfo (NULL, conf_sink_port, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    fprintf (stderr, "getaddrinfo (%s) failed: %s\n", conf_sink_port,
+        gai_strerror (status));
+    return (-1);
+  }
+
+  /* Prefer IPv6, which also receives IPv4 packets on most systems. */
+  for (ai = ai_list; ai != NULL; ai = ai->ai_next)
+    if (ai->ai_family == AF_INET6)
+      break;
+  if (ai == NULL)
+    ai = ai_list;
+
+  sink_fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (sink_fd < 0)
+  {
+    perror ("socket");
+    freeaddrinfo (ai_list);
+    return (-1);
+  }
+
+  if (ai->ai_family == AF_INET6)
+  {
+    int off = 0;
+    setsockopt (sink_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof (off));
+  }
+
+  /* The daemon forwards all values, not only the probes. */
+  setsockopt (sink_fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof (bufsize));
+
+  status = bind (sink_fd, ai->ai_addr, ai->ai_addrlen);
+  freeaddrinfo (ai_list);
+  if (status != 0)
+  {
+    perror ("bind");
+    close (sink_fd);
+    sink_fd = -1;
+    return (-1);
+  }
+
+  status = pthread_create (&sink_thread, /* attr = */ NULL,
+      sink_thread_main, /* arg = */ NULL);
+  if (status != 0)
+  {
+    fprintf (stderr, "pthread_create failed: %s\n", strerror (status));
+    close (sink_fd);
+    sink_fd = -1;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int sink_start */
+
+/* Opens a UDP socket connected to the destination, used for statsd and for
+ * replaying recordings. */
+static int udp_open (int *ret_fd) /* {{{ */
+{
+  struct addrinfo ai_hints = { 0 };
+  struct addrinfo *ai_list;
+  struct addrinfo *ai;
+  int fd = -1;
+  int status;
+
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_DGRAM;
+
+  status = getaddrinfo (conf_destination, conf_service, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    fprintf (stderr, "getaddrinfo (%s, %s) failed: %s\n",
+        conf_destination, conf_service, gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai = ai_list; ai != NULL; ai = ai->ai_next)
+  {
+    fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+
+    close (fd);
+    fd = -1;
+  }
+  freeaddrinfo (ai_list);
+
+  if (fd < 0)
+  {
+    fprintf (stderr, "Unable to connect to %s:%s.\n",
+        conf_destination, conf_service);
+    return (-1);
+  }
+
+  *ret_fd = fd;
+  return (0);
+} /* }}} int udp_open */
+
+/* Adds "shift" to the times of a packet recorded by write_record and counts
+ * its value lists. The packets are neither signed nor encrypted. */
+static void replay_rewrite_packet (char *buffer, size_t buffer_size, /* {{{ */
+    uint64_t shift)
+{
+  while (buffer_size >= 4)
+  {
+    uint16_t part_type;
+    uint16_t part_size;
+
+    memcpy (&part_type, buffer, sizeof (part_type));
+    memcpy (&part_size, buffer + 2, sizeof (part_size));
+    part_type = ntohs (part_type);
+    part_size = ntohs (part_size);
+
+    if ((part_size < 4) || (part_size > buffer_size))
+      break;
+
+    /* TIME_HR and TIME, high resolution and in seconds */
+    if (((part_type == 0x0008) || (part_type == 0x0001)) && (part_size == 12))
+    {
+      uint64_t t = 0;
+      int i;
+
+      for (i = 0; i < 8; i++)
+        t = (t << 8) | (uint8_t) buffer[4 + i];
+      t += (part_type == 0x0008) ? shift : (shift >> 30);
+      for (i = 7; i >= 0; i--)
+      {
+        buffer[4 + i] = (char) (t & 0xff);
+        t >>= 8;
+      }
+    }
+    else if ((part_type == 0x0006) && (part_size >= 6))
+    {
+      uint16_t values_num;
+
+      memcpy (&values_num, buffer + 4, sizeof (values_num));
+      values_lists_sent++;
+      values_sent += (long) ntohs (values_num);
+    }
+
+    buffer += part_size;
+    buffer_size -= part_size;
+  }
+} /* }}} void replay_rewrite_packet */
+
+/* Sends the packets of one recording. The first packet of the first file
+ * sets "*rec_start", the recorded time which corresponds to "time_start".
+ * The values are shifted to the current time, keeping their spacing. */
+static int replay_file (const char *file, int fd, /* {{{ */
+    uint64_t *rec_start, uint64_t *shift)
+{
+  char header[16];
+  FILE *fh;
+
+  fh = fopen (file, "r");
+  if (fh == NULL)
+  {
+    fprintf (stderr, "Opening %s failed: %s\n", file, strerror (errno));
+    return (-1);
+  }
+
+  if ((fread (header, sizeof (header), 1, fh) != 1)
+      || (memcmp (header, "CDRECORD", 8) != 0))
+  {
+    fprintf (stderr, "%s is not a recording of the write_record plugin.\n",
+        file);
+    fclose (fh);
+    return (-1);
+  }
+
+  while (loop)
+  {
+    uint8_t frame[16];
+    char buffer[65536];
+    uint64_t rec_time = 0;
+    uint32_t size = 0;
+    int i;
+
+    if (fread (frame, sizeof (frame), 1, fh) != 1)
+      break;
+    for (i = 0; i < 8; i++)
+      rec_time = (rec_time << 8) | frame[i];
+    for (i = 8; i < 12; i++)
+      size = (size << 8) | frame[i];
+
+    if ((size > sizeof (buffer)) || (fread (buffer, size, 1, fh) != 1))
+    {
+      fprintf (stderr, "%s is truncated.\n", file);
+      break;
+    }
+
+    if (*rec_start == 0)
+    {
+      *rec_start = rec_time;
+      *shift = (uint64_t) (wtime () * 1073741824.0) - rec_time;
+    }
+
+    if ((conf_replay_speed > 0.0) && (rec_time > *rec_start))
+    {
+      double due = time_start + ((double) (rec_time - *rec_start))
+        / 1073741824.0 / conf_replay_speed;
+      double now = dtime ();
+
+      while (loop && (now < due))
+      {
+        double wait = due - now;
+        struct timespec ts;
+
+        if (wait > 0.1)
+          wait = 0.1;
+        ts.tv_sec = (time_t) wait;
+        ts.tv_nsec = (long) (1e9 * (wait - (double) ts.tv_sec));
+        nanosleep (&ts, /* remaining = */ NULL);
+        now = dtime ();
+      }
+    }
+
+    if ((conf_duration > 0.0) && ((dtime () - time_start) >= conf_duration))
+      loop = 0;
+    if (!loop)
+      break;
+
+    replay_rewrite_packet (buffer, size, *shift);
+    if (send (fd, buffer, size, /* flags = */ 0) < 0)
+      send_errors++;
+    else
+      packets_replayed++;
+  }
+
+  fclose (fh);
+  return (0);
+} /* }}} int replay_file */
+
+static int replay (void) /* {{{ */
+{
+  uint64_t rec_start = 0;
+  uint64_t shift = 0;
+  int fd = -1;
+  size_t i;
+
+  if (udp_open (&fd) != 0)
+    return (-1);
+
+  time_start = dtime ();
+  for (i = 0; loop && (i < conf_replay_files_num); i++)
+    replay_file (conf_replay_files[i], fd, &rec_start, &shift);
+  time_end = dtime ();
+
+  close (fd);
+  return (0);
+} /* }}} int replay */
+
+static int compare_double (const void *v0, const void *v1) /* {{{ */
+{
+  double d0 = *((const double *) v0);
+  double d1 = *((const double *) v1);
+
+  if (d0 < d1)
+    return (-1);
+  else if (d0 > d1)
+    return (1);
+  else
+    return (0);
+} /* }}} int compare_double */
+
+static double percentile (double p) /* {{{ */
+{
+  return (latencies[(size_t) (p * ((double) (latencies_num - 1)))]);
+} /* }}} double percentile */
+
+/* Prints the rates of the "dropped" counters the daemon reports about
+ * itself, see the CollectInternalStats option. */
+static void report_dropped (void) /* {{{ */
+{
+  lcc_connection_t *c = NULL;
+  lcc_identifier_t *idents = NULL;
+  size_t idents_num = 0;
+  int found = 0;
+  size_t i;
+
+  if (lcc_connect (conf_socket, &c) != 0)
+  {
+    fprintf (stderr, "Unable to connect to %s.\n", conf_socket);
+    return;
+  }
+
+  if (lcc_listval (c, &idents, &idents_num) != 0)
+  {
+    fprintf (stderr, "LISTVAL failed: %s\n", lcc_strerror (c));
+    LCC_DESTROY (c);
+    return;
+  }
+
+  for (i = 0; i < idents_num; i++)
+  {
+    char name[6 * LCC_NAME_LEN];
+    gauge_t *values = NULL;
+    char **values_names = NULL;
+    size_t values_num = 0;
+    size_t j;
+
+    if ((strcmp (idents[i].plugin, "collectd") != 0)
+        || (strstr (idents[i].type_instance, "dropped") == NULL))
+      continue;
+
+    if (lcc_getval (c, idents + i, &values_num, &values, &values_names) != 0)
+      continue;
+
+    lcc_identifier_to_string (c, name, sizeof (name), idents + i);
+    printf ("  %s: %.1f values/s\n", name,
+        (values_num > 0) ? values[0] : NAN);
+    found++;
+
+    for (j = 0; j < values_num; j++)
+      free (values_names[j]);
+    free (values_names);
+    free (values);
+  }
+
+  if (found == 0)
+    printf ("  No drop counters found. Is CollectInternalStats enabled?\n");
+
+  free (idents);
+  LCC_DESTROY (c);
+} /* }}} void report_dropped */
+
+static void report (void) /* {{{ */
+{
+  double elapsed = time_end - time_start;
+
+  if (elapsed <= 0.0)
+    elapsed = 1.0;
+
+  printf ("\n");
+  printf ("Sent %li value lists (%li values) in %.1f seconds.\n",
+      values_lists_sent, values_sent, elapsed);
+  if (conf_replay_files_num > 0)
+    printf ("Throughput: %.1f value lists/s (%.1f values/s), "
+        "%li packets replayed.\n",
+        ((double) values_lists_sent) / elapsed,
+        ((double) values_sent) / elapsed, packets_replayed);
+  else
+    printf ("Throughput: %.1f value lists/s (%.1f values/s), "
+        "configured rate %.1f value lists/s.\n",
+        ((double) values_lists_sent) / elapsed,
+        ((double) values_sent) / elapsed,
+        ((double) conf_num_values) / conf_interval);
+  if (send_errors > 0)
+    printf ("Send errors: %li\n", send_errors);
+
+  if (sink_fd >= 0)
+  {
+    pthread_mutex_lock (&sink_lock);
+    printf ("Probes: %li sent, %li received.\n",
+        probes_sent, probes_received);
+    if (latencies_num > 0)
+    {
+      qsort (latencies, latencies_num, sizeof (*latencies), compare_double);
+      printf ("Latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+          "p99.9 %.3f ms, max %.3f ms\n",
+          1000.0 * percentile (0.5), 1000.0 * percentile (0.9),
+          1000.0 * percentile (0.99), 1000.0 * percentile (0.999),
+          1000.0 * latencies[latencies_num - 1]);
+    }
+    pthread_mutex_unlock (&sink_lock);
+  }
+
+  if (conf_read_stats)
+  {
+    printf ("Dropped by the daemon:\n");
+    report_dropped ();
+  }
+} /* }}} void report */
+
 static int get_integer_opt (const char *str, int *ret_value) /* {{{ */
 {
   char *endptr;
@@ -297,7 +1130,7 @@ static int read_options (int argc, char **argv) /* {{{ */
 {
   int opt;
 
-  while ((opt = getopt (argc, argv, "n:H:p:i:d:D:h")) != -1)
+  while ((opt = getopt (argc, argv, "n:H:p:P:mi:r:t:d:D:s:l:SR:x:h")) != -1)
   {
     switch (opt)
     {
@@ -313,10 +1146,36 @@ static int read_options (int argc, char **argv) /* {{{ */
         get_integer_opt (optarg, &conf_num_plugins);
         break;
 
+      case 'P':
+        get_integer_opt (optarg, &conf_num_plugin_instances);
+        break;
+
+      case 'm':
+        conf_mixed_types = 1;
+        break;
+
       case 'i':
         get_double_opt (optarg, &conf_interval);
         break;
 
+      case 'r':
+        get_double_opt (optarg, &conf_duration);
+        break;
+
+      case 't':
+        if (strcasecmp ("network", optarg) == 0)
+          conf_transport = TRANSPORT_NETWORK;
+        else if (strcasecmp ("unixsock", optarg) == 0)
+          conf_transport = TRANSPORT_UNIXSOCK;
+        else if (strcasecmp ("statsd", optarg) == 0)
+          conf_transport = TRANSPORT_STATSD;
+        else
+        {
+          fprintf (stderr, "Unknown transport: \"%s\"\n", optarg);
+          exit_usage (EXIT_FAILURE);
+        }
+        break;
+
       case 'd':
         conf_destination = optarg;
         break;
@@ -325,6 +1184,36 @@ static int read_options (int argc, char **argv) /* {{{ */
         conf_service = optarg;
         break;
 
+      case 's':
+        conf_socket = optarg;
+        break;
+
+      case 'l':
+        conf_sink_port = optarg;
+        break;
+
+      case 'S':
+        conf_read_stats = 1;
+        break;
+
+      case 'R':
+        {
+          const char **tmp = realloc (conf_replay_files,
+              (conf_replay_files_num + 1) * sizeof (*conf_replay_files));
+          if (tmp == NULL)
+          {
+            fprintf (stderr, "realloc failed.\n");
+            exit (EXIT_FAILURE);
+          }
+          conf_replay_files = tmp;
+          conf_replay_files[conf_replay_files_num++] = optarg;
+        }
+        break;
+
+      case 'x':
+        get_double_opt (optarg, &conf_replay_speed);
+        break;
+
       case 'h':
         exit_usage (EXIT_SUCCESS);
 
@@ -333,6 +1222,29 @@ static int read_options (int argc, char **argv) /* {{{ */
     } /* switch (opt) */
   } /* while (getopt) */
 
+  if ((conf_num_values < 1) || (conf_num_hosts < 1) || (conf_num_plugins < 1)
+      || (conf_num_plugin_instances < 1) || (conf_interval <= 0.0))
+  {
+    fprintf (stderr, "The number of value lists, hosts, plugins and plugin "
+        "instances and the interval must be positive.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if ((conf_replay_files_num > 0) && ((conf_transport != TRANSPORT_NETWORK)
+        || (conf_sink_port != NULL) || (conf_replay_speed < 0.0)))
+  {
+    fprintf (stderr, "Recordings are replayed with the network transport, "
+        "without -l and with a speed of zero or more.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (conf_destination == NULL)
+    conf_destination = (conf_transport == TRANSPORT_STATSD)
+      ? DEF_STATSD_ADDR : NET_DEFAULT_V6_ADDR;
+  if (conf_service == NULL)
+    conf_service = (conf_transport == TRANSPORT_STATSD)
+      ? DEF_STATSD_PORT : NET_DEFAULT_PORT;
+
   return (0);
 } /* }}} int read_options */
 
@@ -340,7 +1252,6 @@ int main (int argc, char **argv) /* {{{ */
 {
   int i;
   double last_time;
-  int values_sent = 0;
 
   read_options (argc, argv);
 
@@ -351,6 +1262,17 @@ int main (int argc, char **argv) /* {{{ */
   sigaction (SIGTERM, &sigterm_action, /* old = */ NULL);
 
 
+  time_offset = wtime () - dtime ();
+
+  if (conf_replay_files_num > 0)
+  {
+    if (replay () != 0)
+      exit (EXIT_FAILURE);
+    report ();
+    free (conf_replay_files);
+    exit (EXIT_SUCCESS);
+  }
+
   values_heap = c_heap_create (compare_time);
   if (values_heap == NULL)
   {
@@ -358,8 +1280,20 @@ int main (int argc, char **argv) /* {{{ */
     exit (EXIT_FAILURE);
   }
 
-  net = lcc_network_create ();
-  if (net == NULL)
+  if (conf_transport == TRANSPORT_UNIXSOCK)
+  {
+    if (lcc_connect (conf_socket, &unixsock) != 0)
+    {
+      fprintf (stderr, "Unable to connect to %s.\n", conf_socket);
+      exit (EXIT_FAILURE);
+    }
+  }
+  else if (conf_transport == TRANSPORT_STATSD)
+  {
+    if (udp_open (&statsd_fd) != 0)
+      exit (EXIT_FAILURE);
+  }
+  else if ((net = lcc_network_create ()) == NULL)
   {
     fprintf (stderr, "lcc_network_create failed.\n");
     exit (EXIT_FAILURE);
@@ -376,6 +1310,8 @@ int main (int argc, char **argv) /* {{{ */
     }
 
     lcc_server_set_ttl (srv, 42);
+    /* Don't keep values in partially filled packets for long. */
+    lcc_network_set_linger (net, 1.0);
 #if 0
     lcc_server_set_security_level (srv, ENCRYPT,
         "admin", "password1");
@@ -399,47 +1335,96 @@ int main (int argc, char **argv) /* {{{ */
   }
   fprintf (stdout, "done\n");
 
+  batch = calloc ((size_t) conf_num_values, sizeof (*batch));
+  batch_ptrs = calloc ((size_t) conf_num_values, sizeof (*batch_ptrs));
+  if ((batch == NULL) || (batch_ptrs == NULL))
+  {
+    fprintf (stderr, "calloc failed.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if ((conf_sink_port != NULL) && (sink_start () != 0))
+    exit (EXIT_FAILURE);
+
+  time_start = dtime ();
   last_time = 0;
   while (loop)
   {
     lcc_value_list_t *vl = c_heap_get_root (values_heap);
 
-    if (vl == NULL)
+    /* All value lists may be due and waiting in the batch when sending can't
+     * keep up. */
+    if ((vl == NULL) && (batch_num > 0))
+    {
+      send_batch ();
+      continue;
+    }
+    else if (vl == NULL)
+      break;
+
+    if ((conf_duration > 0.0) && ((dtime () - time_start) >= conf_duration))
+    {
+      c_heap_insert (values_heap, vl);
       break;
+    }
 
     if (vl->time != last_time)
     {
-      printf ("%i values have been sent.\n", values_sent);
+      printf ("%li value lists have been sent.\n", values_lists_sent);
 
       /* Check if we need to sleep */
       double now = dtime ();
 
+      /* Send the values which are due so far. */
+      if (now < vl->time)
+        send_batch ();
+
       while (now < vl->time)
       {
         /* 1 / 100 second */
         struct timespec ts = { 0, 10000000 };
 
-        ts.tv_sec = (time_t) now;
-        ts.tv_nsec = (long) ((now - ((double) ts.tv_sec)) * 1e9);
-
         nanosleep (&ts, /* remaining = */ NULL);
         now = dtime ();
 
-        if (!loop)
+        if (!loop || ((conf_duration > 0.0)
+              && ((now - time_start) >= conf_duration)))
           break;
       }
       last_time = vl->time;
     }
 
     send_value (vl);
-    values_sent++;
-
-    c_heap_insert (values_heap, vl);
   }
+  send_batch ();
+  time_end = dtime ();
 
   fprintf (stdout, "Shutting down.\n");
   fflush (stdout);
 
+  if (sink_fd >= 0)
+  {
+    /* Give the last probes a few seconds to arrive. */
+    for (i = 0; i < 300; i++)
+    {
+      struct timespec ts = { 0, 10000000 };
+      _Bool done;
+
+      pthread_mutex_lock (&sink_lock);
+      done = (probes_received >= probes_sent);
+      pthread_mutex_unlock (&sink_lock);
+      if (done)
+        break;
+
+      nanosleep (&ts, /* remaining = */ NULL);
+    }
+
+    sink_loop = 0;
+    pthread_join (sink_thread, /* retval = */ NULL);
+  }
+
+  report ();
+
   while (42)
   {
     lcc_value_list_t *vl = c_heap_get_root (values_heap);
@@ -448,8 +1433,19 @@ int main (int argc, char **argv) /* {{{ */
     destroy_value_list (vl);
   }
   c_heap_destroy (values_heap);
-
-  lcc_network_destroy (net);
+  free (batch);
+  free (batch_ptrs);
+
+  if (sink_fd >= 0)
+    close (sink_fd);
+  free (latencies);
+
+  if (statsd_fd >= 0)
+    close (statsd_fd);
+  if (unixsock != NULL)
+    LCC_DESTROY (unixsock);
+  if (net != NULL)
+    lcc_network_destroy (net);
   exit (EXIT_SUCCESS);
   return (0);
 } /* }}} int main */
@@ -87,7 +87,7 @@ static void exit_usage (const char *name, int status) {
 
       " * getval <identifier>\n"
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
-      " * listval\n"
+      " * listval [<filter>]\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
 
       "\nIdentifiers:\n\n"
@@ -354,8 +354,8 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
 
   assert (strcasecmp (argv[0], "listval") == 0);
 
-  if (argc != 1) {
-    fprintf (stderr, "ERROR: listval: Does not accept any arguments.\n");
+  if (argc > 2) {
+    fprintf (stderr, "ERROR: listval: Too many arguments.\n");
     return (-1);
   }
 
@@ -367,7 +367,8 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
     return (s); \
   } while (0)
 
-  status = lcc_listval (c, &ret_ident, &ret_ident_num);
+  status = lcc_listval_filter (c, (argc == 2) ? argv[1] : NULL,
+      &ret_ident, &ret_ident_num);
   if (status != 0) {
     fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
     BAIL_OUT (status);
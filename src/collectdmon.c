@@ -69,6 +69,11 @@ static int restart = 0;
 static const char *pidfile      = NULL;
 static pid_t       collectd_pid = 0;
 
+/* With a handover socket, a restart starts the new instance while the
+ * previous one, `previous_pid', is still running. */
+static const char *handover     = NULL;
+static pid_t       previous_pid = 0;
+
 __attribute__((noreturn))
 static void exit_usage (const char *name)
 {
@@ -78,6 +83,8 @@ static void exit_usage (const char *name)
 			"  -h         Display this help and exit.\n"
 			"  -c <path>  Path to the collectd binary.\n"
 			"  -P <file>  PID-file.\n"
+			"  -H <path>  Restart without a gap, handing over the sockets\n"
+			"             through the socket <path>.\n"
 
 			"\nFor <collectd options> see collectd.conf(5).\n"
 
@@ -205,6 +212,9 @@ static int collectd_start (char **argv)
 
 static int collectd_stop (void)
 {
+	if ((0 != previous_pid) && (0 != kill (previous_pid, SIGTERM)))
+		syslog (LOG_ERR, "Error: kill() failed: %s", strerror (errno));
+
 	if (0 == collectd_pid)
 		return 0;
 
@@ -245,6 +255,77 @@ static void log_status (int status)
 	return;
 } /* log_status */
 
+/* Starts a new instance, which takes over from the running one and tells it
+ * to shut down once it is initialized. */
+static int collectd_handover (char **argv)
+{
+	if (0 != previous_pid) {
+		syslog (LOG_WARNING, "Warning: restart of collectd already "
+				"in progress");
+		return 0;
+	}
+
+	syslog (LOG_INFO, "Info: restarting collectd, handing over from PID %i",
+			(int)collectd_pid);
+
+	previous_pid = collectd_pid;
+	if (0 != collectd_start (argv)) {
+		collectd_pid = previous_pid;
+		previous_pid = 0;
+		return -1;
+	}
+	return 0;
+} /* collectd_handover */
+
+/* Waits until the current instance exits. Returns -1 if waitpid() fails. */
+static int collectd_wait (char **argv, int *status)
+{
+	while (42) {
+		pid_t pid = waitpid (-1, status, 0);
+
+		if (0 > pid) {
+			if (EINTR != errno)
+				return -1;
+
+			if (0 != loop)
+				collectd_stop ();
+			else if ((0 != restart) && (NULL != handover)) {
+				restart = 0;
+				collectd_handover (argv);
+			}
+			else if (0 != restart)
+				collectd_stop ();
+			continue;
+		}
+
+		if ((0 != previous_pid) && (pid == previous_pid)) {
+			log_status (*status);
+			if (0 == loop)
+				syslog (LOG_INFO, "Info: collectd (PID %i) took over",
+						(int)collectd_pid);
+			previous_pid = 0;
+			continue;
+		}
+
+		if (pid != collectd_pid)
+			continue;
+
+		/* The new instance exited, the previous one is still running. */
+		if (0 != previous_pid) {
+			if (0 == loop) {
+				log_status (*status);
+				syslog (LOG_WARNING, "Warning: restarting collectd failed, "
+						"keeping PID %i", (int)previous_pid);
+			}
+			collectd_pid = previous_pid;
+			previous_pid = 0;
+			continue;
+		}
+
+		return 0;
+	}
+} /* collectd_wait */
+
 static void check_respawn (void)
 {
 	time_t t = time (NULL);
@@ -282,7 +363,7 @@ int main (int argc, char **argv)
 
 	/* parse command line options */
 	while (42) {
-		int c = getopt (argc, argv, "hc:P:");
+		int c = getopt (argc, argv, "hc:P:H:");
 
 		if (-1 == c)
 			break;
@@ -294,6 +375,9 @@ int main (int argc, char **argv)
 			case 'P':
 				pidfile = optarg;
 				break;
+			case 'H':
+				handover = optarg;
+				break;
 			case 'h':
 			default:
 				exit_usage (argv[0]);
@@ -305,7 +389,8 @@ int main (int argc, char **argv)
 			break;
 
 	/* i < argc => -f already present */
-	collectd_argc = 1 + argc - optind + ((i < argc) ? 0 : 1);
+	collectd_argc = 1 + argc - optind + ((i < argc) ? 0 : 1)
+		+ ((NULL != handover) ? 2 : 0);
 	collectd_argv = (char **)calloc (collectd_argc + 1, sizeof (char *));
 
 	if (NULL == collectd_argv) {
@@ -321,6 +406,11 @@ int main (int argc, char **argv)
 	for (i = optind; i < argc; ++i)
 		collectd_argv[i - optind + 1] = argv[i];
 
+	if (NULL != handover) {
+		collectd_argv[argc - optind + 1] = "-H";
+		collectd_argv[argc - optind + 2] = (char *)handover;
+	}
+
 	collectd_argv[collectd_argc] = NULL;
 
 	openlog ("collectdmon", LOG_CONS | LOG_PID, LOG_DAEMON);
@@ -364,10 +454,10 @@ int main (int argc, char **argv)
 		}
 
 		assert (0 < collectd_pid);
-		while ((collectd_pid != waitpid (collectd_pid, &status, 0))
-				&& (EINTR == errno))
-			if ((0 != loop) || (0 != restart))
-				collectd_stop ();
+		if (0 != collectd_wait (collectd_argv, &status)) {
+			syslog (LOG_ERR, "Error: waitpid() failed: %s", strerror (errno));
+			break;
+		}
 
 		collectd_pid = 0;
 
@@ -29,6 +29,19 @@
 # error "No applicable input method."
 #endif
 
+/* The statistics are fetched over ctnetlink if libmnl is available. */
+#if HAVE_LIBMNL && HAVE_LINUX_NETFILTER_NFNETLINK_CONNTRACK_H
+# define COLLECT_NETLINK 1
+# include <arpa/inet.h>
+# include <asm/types.h>
+# include <linux/netlink.h>
+# include <linux/netfilter/nfnetlink.h>
+# include <linux/netfilter/nfnetlink_conntrack.h>
+# include <libmnl/libmnl.h>
+#else
+# define COLLECT_NETLINK 0
+#endif
+
 #define CONNTRACK_FILE "/proc/sys/net/netfilter/nf_conntrack_count"
 #define CONNTRACK_MAX_FILE "/proc/sys/net/netfilter/nf_conntrack_max"
 #define CONNTRACK_FILE_OLD "/proc/sys/net/ipv4/netfilter/ip_conntrack_count"
@@ -36,7 +49,8 @@
 
 static const char *config_keys[] =
 {
-	"OldFiles"
+	"OldFiles",
+	"ReportStatistics"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 /*
@@ -44,11 +58,46 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 */
 
 static int old_files = 0;
+static _Bool report_statistics = 0;
+
+#if COLLECT_NETLINK
+/* Netfilter socket used for the statistics. NULL if it could not be opened,
+ * in which case the files in /proc are read. */
+static struct mnl_socket *nl = NULL;
+
+/* The per-CPU counters of the connection tracking, summed over all CPUs. */
+static struct
+{
+	int attr;
+	char const *name;
+} stats_fields[] =
+{
+	{ CTA_STATS_FOUND,          "found" },
+	{ CTA_STATS_INVALID,        "invalid" },
+	{ CTA_STATS_INSERT,         "insert" },
+	{ CTA_STATS_INSERT_FAILED,  "insert_failed" },
+	{ CTA_STATS_DROP,           "drop" },
+	{ CTA_STATS_EARLY_DROP,     "early_drop" },
+	{ CTA_STATS_ERROR,          "error" },
+	{ CTA_STATS_SEARCH_RESTART, "search_restart" }
+};
+static derive_t stats_values[STATIC_ARRAY_SIZE (stats_fields)];
+
+typedef struct
+{
+	uint32_t entries;
+	uint32_t max_entries;
+	_Bool have_entries;
+	_Bool have_max_entries;
+} ct_global_t;
+#endif /* COLLECT_NETLINK */
 
 static int conntrack_config(const char *key, const char *value)
 {
     if (strcmp(key, "OldFiles") == 0)
         old_files = 1;
+    else if (strcasecmp(key, "ReportStatistics") == 0)
+        report_statistics = IS_TRUE(value) ? 1 : 0;
 
     return 0;
 }
@@ -70,6 +119,176 @@ static void conntrack_submit (const char *type, const char *type_instance,
 	plugin_dispatch_values (&vl);
 } /* static void conntrack_submit */
 
+#if COLLECT_NETLINK
+static int conntrack_init (void) /* {{{ */
+{
+	/* The old files belong to kernels without ctnetlink statistics. */
+	if (old_files)
+		return (0);
+
+	nl = mnl_socket_open (NETLINK_NETFILTER);
+	if (nl == NULL)
+	{
+		char errbuf[1024];
+		WARNING ("conntrack plugin: mnl_socket_open failed: %s. "
+				"Reading /proc instead.",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (0);
+	}
+
+	if (mnl_socket_bind (nl, 0, MNL_SOCKET_AUTOPID) < 0)
+	{
+		char errbuf[1024];
+		WARNING ("conntrack plugin: mnl_socket_bind failed: %s. "
+				"Reading /proc instead.",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		mnl_socket_close (nl);
+		nl = NULL;
+	}
+
+	return (0);
+} /* }}} int conntrack_init */
+
+static int conntrack_shutdown (void) /* {{{ */
+{
+	if (nl != NULL)
+		mnl_socket_close (nl);
+	nl = NULL;
+
+	return (0);
+} /* }}} int conntrack_shutdown */
+
+/* Sends a ctnetlink request and runs `cb' on every message of the reply. */
+static int ct_request (uint8_t msg_type, _Bool dump, /* {{{ */
+		mnl_cb_t cb, void *data)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	struct nfgenmsg *nfh;
+	unsigned int seq;
+	unsigned int portid;
+	int ret;
+
+	portid = mnl_socket_get_portid (nl);
+
+	nlh = mnl_nlmsg_put_header (buf);
+	nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | msg_type;
+	/* The acknowledgement ends the reply to a request other than a
+	 * dump, like NLMSG_DONE ends a dump. */
+	nlh->nlmsg_flags = NLM_F_REQUEST | (dump ? NLM_F_DUMP : NLM_F_ACK);
+	nlh->nlmsg_seq = seq = (unsigned int) time (NULL);
+	nfh = mnl_nlmsg_put_extra_header (nlh, sizeof (*nfh));
+	nfh->nfgen_family = AF_UNSPEC;
+	nfh->version = NFNETLINK_V0;
+	nfh->res_id = 0;
+
+	if (mnl_socket_sendto (nl, nlh, nlh->nlmsg_len) < 0)
+		return (-1);
+
+	ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
+	while (ret > 0)
+	{
+		ret = mnl_cb_run (buf, ret, seq, portid, cb, data);
+		if (ret <= MNL_CB_STOP)
+			break;
+		ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
+	}
+
+	return ((ret < 0) ? -1 : 0);
+} /* }}} int ct_request */
+
+/* Handles the reply to IPCTNL_MSG_CT_GET_STATS. */
+static int ct_global_cb (const struct nlmsghdr *nlh, void *data) /* {{{ */
+{
+	ct_global_t *g = data;
+	struct nlattr *attr;
+
+	mnl_attr_for_each (attr, nlh, sizeof (struct nfgenmsg))
+	{
+		if (mnl_attr_validate (attr, MNL_TYPE_U32) < 0)
+			continue;
+
+		switch (mnl_attr_get_type (attr))
+		{
+			case CTA_STATS_GLOBAL_ENTRIES:
+				g->entries = ntohl (mnl_attr_get_u32 (attr));
+				g->have_entries = 1;
+				break;
+			case CTA_STATS_GLOBAL_MAX_ENTRIES:
+				g->max_entries = ntohl (mnl_attr_get_u32 (attr));
+				g->have_max_entries = 1;
+				break;
+		}
+	}
+
+	return (MNL_CB_OK);
+} /* }}} int ct_global_cb */
+
+/* Handles one message of the IPCTNL_MSG_CT_GET_STATS_CPU dump, which has one
+ * message per CPU. */
+static int ct_cpu_cb (const struct nlmsghdr *nlh, /* {{{ */
+		void *data __attribute__((unused)))
+{
+	struct nlattr *attr;
+
+	mnl_attr_for_each (attr, nlh, sizeof (struct nfgenmsg))
+	{
+		int type = mnl_attr_get_type (attr);
+		size_t i;
+
+		if (mnl_attr_validate (attr, MNL_TYPE_U32) < 0)
+			continue;
+
+		for (i = 0; i < STATIC_ARRAY_SIZE (stats_fields); i++)
+		{
+			if (stats_fields[i].attr != type)
+				continue;
+			stats_values[i] += (derive_t) ntohl (mnl_attr_get_u32 (attr));
+			break;
+		}
+	}
+
+	return (MNL_CB_OK);
+} /* }}} int ct_cpu_cb */
+
+/* Reads the number of entries, and the maximum on kernels which report it,
+ * in one request, and the per-CPU counters in one dump if enabled. Returns
+ * non-zero if the number of entries could not be read. */
+static int conntrack_read_netlink (ct_global_t *g) /* {{{ */
+{
+	memset (g, 0, sizeof (*g));
+	if ((ct_request (IPCTNL_MSG_CT_GET_STATS, /* dump = */ 0,
+					ct_global_cb, g) != 0)
+			|| !g->have_entries)
+		return (-1);
+
+	if (report_statistics)
+	{
+		memset (stats_values, 0, sizeof (stats_values));
+		if (ct_request (IPCTNL_MSG_CT_GET_STATS_CPU, /* dump = */ 1,
+					ct_cpu_cb, NULL) == 0)
+		{
+			size_t i;
+
+			for (i = 0; i < STATIC_ARRAY_SIZE (stats_fields); i++)
+			{
+				value_t v;
+				v.derive = stats_values[i];
+				conntrack_submit ("operations", stats_fields[i].name, v);
+			}
+		}
+		else
+		{
+			char errbuf[1024];
+			ERROR ("conntrack plugin: Dumping the statistics failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+
+	return (0);
+} /* }}} int conntrack_read_netlink */
+#endif /* COLLECT_NETLINK */
+
 static int conntrack_read (void)
 {
 	value_t conntrack, conntrack_max, conntrack_pct;
@@ -77,6 +296,26 @@ static int conntrack_read (void)
 	char buffer[64];
 	size_t buffer_len;
 
+#if COLLECT_NETLINK
+	ct_global_t g;
+
+	if ((nl != NULL) && (conntrack_read_netlink (&g) == 0))
+	{
+		conntrack.gauge = (gauge_t) g.entries;
+		conntrack_submit ("conntrack", NULL, conntrack);
+
+		if (g.have_max_entries)
+		{
+			conntrack_max.gauge = (gauge_t) g.max_entries;
+			conntrack_submit ("conntrack", "max", conntrack_max);
+			conntrack_pct.gauge = (conntrack.gauge / conntrack_max.gauge) * 100;
+			conntrack_submit ("percent", "used", conntrack_pct);
+			return (0);
+		}
+		goto read_max;
+	}
+#endif
+
 	fh = fopen (old_files?CONNTRACK_FILE_OLD:CONNTRACK_FILE, "r");
 	if (fh == NULL)
 		return (-1);
@@ -102,6 +341,9 @@ static int conntrack_read (void)
 
 	conntrack_submit ("conntrack", NULL, conntrack);
 
+#if COLLECT_NETLINK
+read_max:
+#endif
 	fh = fopen (old_files?CONNTRACK_MAX_FILE_OLD:CONNTRACK_MAX_FILE, "r");
 	if (fh == NULL)
 		return (-1);
@@ -137,5 +379,9 @@ void module_register (void)
 {
     plugin_register_config ("conntrack", conntrack_config,
                             config_keys, config_keys_num);
+#if COLLECT_NETLINK
+	plugin_register_init ("conntrack", conntrack_init);
+	plugin_register_shutdown ("conntrack", conntrack_shutdown);
+#endif
 	plugin_register_read ("conntrack", conntrack_read);
 } /* void module_register */
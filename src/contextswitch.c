@@ -24,6 +24,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #ifdef HAVE_SYS_SYSCTL_H
 # include <sys/sysctl.h>
@@ -83,21 +84,22 @@ static int cs_read (void)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
+	procfs_snapshot_t *snap;
+	size_t offset = 0;
 	char buffer[64];
 	int numfields;
 	char *fields[3];
 	derive_t result = 0;
 	int status = -2;
 
-	fh = fopen ("/proc/stat", "r");
-	if (fh == NULL) {
-		ERROR ("contextswitch plugin: unable to open /proc/stat: %s",
+	snap = procfs_snapshot_get ("/proc/stat");
+	if (snap == NULL) {
+		ERROR ("contextswitch plugin: unable to read /proc/stat: %s",
 				sstrerror (errno, buffer, sizeof (buffer)));
 		return (-1);
 	}
 
-	while (fgets(buffer, sizeof(buffer), fh) != NULL)
+	while (procfs_getline (snap, &offset, buffer, sizeof (buffer)) != NULL)
 	{
 		char *endptr;
 
@@ -122,7 +124,7 @@ static int cs_read (void)
 		status = 0;
 		break;
 	}
-	fclose(fh);
+	procfs_snapshot_put (snap);
 
 	if (status == -2)
 		ERROR ("contextswitch plugin: Unable to find context switch value.");
@@ -30,6 +30,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #ifdef HAVE_MACH_KERN_RETURN_H
 # include <mach/kern_return.h>
@@ -173,17 +174,29 @@ static int pnumcpu;
 	(sum) += (val);         \
 } while (0)
 
-struct cpu_state_s
-{
-	value_to_rate_state_t conv;
-	gauge_t rate;
-	_Bool has_value;
-};
-typedef struct cpu_state_s cpu_state_t;
-
-static cpu_state_t *cpu_states = NULL;
+/* The state of all CPUs is kept in parallel arrays, indexed by
+ * cpu_num * COLLECTD_CPU_STATE_MAX + state. cpu_stage() only stores the raw
+ * values; cpu_compute_rates() then computes all rates in one pass over
+ * contiguous memory, which the compiler can vectorize. */
+static derive_t *cpu_values = NULL;
+static cdtime_t *cpu_times = NULL;
+static derive_t *cpu_last_values = NULL;
+/* Zero if there is no previous value. */
+static cdtime_t *cpu_last_times = NULL;
+static gauge_t  *cpu_rates = NULL;
+/* Set by cpu_stage() for the values read in the current iteration. */
+static _Bool    *cpu_staged = NULL;
+/* Set if the rate is valid, i.e. the value has been read twice. */
+static _Bool    *cpu_has_value = NULL;
 static size_t cpu_states_num = 0; /* #cpu_states allocated */
 
+/* Value lists are collected and dispatched in batches of one type. */
+#define CPU_BATCH_SIZE 64
+static value_list_t cpu_batch[CPU_BATCH_SIZE];
+static value_t cpu_batch_values[CPU_BATCH_SIZE];
+static size_t cpu_batch_num = 0;
+static const char *cpu_batch_type = NULL;
+
 /* Highest CPU number in the current iteration. Used by the dispatch logic to
  * determine how many CPUs there were. Reset to 0 by cpu_reset(). */
 static size_t global_cpu_num = 0;
@@ -318,27 +331,45 @@ static int init (void)
 	return (0);
 } /* int init */
 
+/* Dispatches the collected value lists. */
+static void cpu_batch_flush (void) /* {{{ */
+{
+	if (cpu_batch_num == 0)
+		return;
+
+	plugin_dispatch_values_bulk (plugin_get_ds (cpu_batch_type),
+			cpu_batch, cpu_batch_num);
+	cpu_batch_num = 0;
+} /* }}} void cpu_batch_flush */
+
 static void submit_value (int cpu_num, int cpu_state, const char *type, value_t value)
 {
-	value_t values[1];
-	value_list_t vl = VALUE_LIST_INIT;
+	value_list_t *vl;
 
-	memcpy(&values[0], &value, sizeof(value));
+	if ((cpu_batch_num >= CPU_BATCH_SIZE)
+			|| ((cpu_batch_num > 0) && (strcmp (cpu_batch_type, type) != 0)))
+		cpu_batch_flush ();
+	cpu_batch_type = type;
 
-	vl.values = values;
-	vl.values_len = 1;
+	vl = &cpu_batch[cpu_batch_num];
+	memset (vl, 0, sizeof (*vl));
 
-	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
-	sstrncpy (vl.plugin, "cpu", sizeof (vl.plugin));
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	sstrncpy (vl.type_instance, cpu_state_names[cpu_state],
-			sizeof (vl.type_instance));
+	cpu_batch_values[cpu_batch_num] = value;
+	vl->values = &cpu_batch_values[cpu_batch_num];
+	vl->values_len = 1;
+	vl->interval = plugin_get_interval ();
+
+	sstrncpy (vl->host, hostname_g, sizeof (vl->host));
+	sstrncpy (vl->plugin, "cpu", sizeof (vl->plugin));
+	sstrncpy (vl->type, type, sizeof (vl->type));
+	sstrncpy (vl->type_instance, cpu_state_names[cpu_state],
+			sizeof (vl->type_instance));
 
 	if (cpu_num >= 0) {
-		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+		ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance),
 				"%i", cpu_num);
 	}
-	plugin_dispatch_values (&vl);
+	cpu_batch_num++;
 }
 
 static void submit_percent(int cpu_num, int cpu_state, gauge_t percent)
@@ -363,11 +394,29 @@ static void submit_derive(int cpu_num, int cpu_state, derive_t derive)
 	submit_value (cpu_num, cpu_state, "cpu", value);
 }
 
+/* Grows "*array" from "old_num" to "new_num" elements of "size" bytes and
+ * zeroes the new elements. */
+static int cpu_array_grow (void **array, size_t size, /* {{{ */
+		size_t old_num, size_t new_num)
+{
+	char *tmp;
+
+	tmp = realloc (*array, new_num * size);
+	if (tmp == NULL)
+		return (ENOMEM);
+
+	memset (tmp + (old_num * size), 0, (new_num - old_num) * size);
+	*array = tmp;
+	return (0);
+} /* }}} int cpu_array_grow */
+
+#define CPU_ARRAY_GROW(array, old_num, new_num) \
+	cpu_array_grow ((void **) &(array), sizeof (*(array)), (old_num), (new_num))
+
 /* Takes the zero-index number of a CPU and makes sure that the module-global
- * cpu_states buffer is large enough. Returne ENOMEM on erorr. */
+ * state arrays are large enough. Returne ENOMEM on erorr. */
 static int cpu_states_alloc (size_t cpu_num) /* {{{ */
 {
-	cpu_state_t *tmp;
 	size_t sz;
 
 	sz = (((size_t) cpu_num) + 1) * COLLECTD_CPU_STATE_MAX;
@@ -377,29 +426,62 @@ static int cpu_states_alloc (size_t cpu_num) /* {{{ */
 	if (cpu_states_num >= sz)
 		return 0;
 
-	tmp = realloc (cpu_states, sz * sizeof (*cpu_states));
-	if (tmp == NULL)
+	/* cpu_states_num is only updated once all arrays have been grown, so a
+	 * failure leaves the state consistent. */
+	if ((CPU_ARRAY_GROW (cpu_values, cpu_states_num, sz) != 0)
+			|| (CPU_ARRAY_GROW (cpu_times, cpu_states_num, sz) != 0)
+			|| (CPU_ARRAY_GROW (cpu_last_values, cpu_states_num, sz) != 0)
+			|| (CPU_ARRAY_GROW (cpu_last_times, cpu_states_num, sz) != 0)
+			|| (CPU_ARRAY_GROW (cpu_rates, cpu_states_num, sz) != 0)
+			|| (CPU_ARRAY_GROW (cpu_staged, cpu_states_num, sz) != 0)
+			|| (CPU_ARRAY_GROW (cpu_has_value, cpu_states_num, sz) != 0))
 	{
 		ERROR ("cpu plugin: realloc failed.");
 		return (ENOMEM);
 	}
-	cpu_states = tmp;
-	tmp = cpu_states + cpu_states_num;
 
-	memset (tmp, 0, (sz - cpu_states_num) * sizeof (*cpu_states));
 	cpu_states_num = sz;
 	return 0;
 } /* }}} cpu_states_alloc */
 
-static cpu_state_t *get_cpu_state (size_t cpu_num, size_t state) /* {{{ */
+static size_t cpu_state_index (size_t cpu_num, size_t state) /* {{{ */
+{
+	return ((cpu_num * COLLECTD_CPU_STATE_MAX) + state);
+} /* }}} size_t cpu_state_index */
+
+/* Computes the rates of all values staged in this iteration and remembers
+ * the values for the next one. A rate is only valid if the value has been
+ * read before and the time has increased since. */
+static void cpu_compute_rates (void) /* {{{ */
 {
-	size_t index = ((cpu_num * COLLECTD_CPU_STATE_MAX) + state);
+	size_t num = global_cpu_num * COLLECTD_CPU_STATE_MAX;
+	size_t i;
+
+	assert (num <= cpu_states_num);
+
+	/* No branches in this loop, so it can be vectorized. The division is
+	 * done for invalid values, too, and its result is discarded. */
+	for (i = 0; i < num; i++)
+	{
+		gauge_t diff = (gauge_t) (cpu_values[i] - cpu_last_values[i]);
+		gauge_t interval = CDTIME_T_TO_DOUBLE (cpu_times[i] - cpu_last_times[i]);
+		_Bool valid = cpu_staged[i]
+			& (cpu_last_times[i] != 0)
+			& (cpu_times[i] > cpu_last_times[i]);
+
+		cpu_rates[i] = valid ? (diff / interval) : NAN;
+		cpu_has_value[i] = valid;
+	}
 
-	if (index >= cpu_states_num)
-		return (NULL);
+	for (i = 0; i < num; i++)
+	{
+		if (!cpu_staged[i])
+			continue;
 
-	return (&cpu_states[index]);
-} /* }}} cpu_state_t *get_cpu_state */
+		cpu_last_values[i] = cpu_values[i];
+		cpu_last_times[i] = cpu_times[i];
+	}
+} /* }}} void cpu_compute_rates */
 
 /* Populates the per-CPU COLLECTD_CPU_STATE_ACTIVE rate and the global rate_by_state
  * array. */
@@ -413,24 +495,25 @@ static void aggregate (gauge_t *sum_by_state) /* {{{ */
 
 	for (cpu_num = 0; cpu_num < global_cpu_num; cpu_num++)
 	{
-		cpu_state_t *this_cpu_states = get_cpu_state (cpu_num, 0);
+		size_t base = cpu_state_index (cpu_num, 0);
+		size_t active = base + COLLECTD_CPU_STATE_ACTIVE;
 
-		this_cpu_states[COLLECTD_CPU_STATE_ACTIVE].rate = NAN;
+		cpu_rates[active] = NAN;
 
 		for (state = 0; state < COLLECTD_CPU_STATE_ACTIVE; state++)
 		{
-			if (!this_cpu_states[state].has_value)
+			if (!cpu_has_value[base + state])
 				continue;
 
-			RATE_ADD (sum_by_state[state], this_cpu_states[state].rate);
+			RATE_ADD (sum_by_state[state], cpu_rates[base + state]);
 			if (state != COLLECTD_CPU_STATE_IDLE)
-				RATE_ADD (this_cpu_states[COLLECTD_CPU_STATE_ACTIVE].rate, this_cpu_states[state].rate);
+				RATE_ADD (cpu_rates[active], cpu_rates[base + state]);
 		}
 
-		if (!isnan (this_cpu_states[COLLECTD_CPU_STATE_ACTIVE].rate))
-			this_cpu_states[COLLECTD_CPU_STATE_ACTIVE].has_value = 1;
+		if (!isnan (cpu_rates[active]))
+			cpu_has_value[active] = 1;
 
-		RATE_ADD (sum_by_state[COLLECTD_CPU_STATE_ACTIVE], this_cpu_states[COLLECTD_CPU_STATE_ACTIVE].rate);
+		RATE_ADD (sum_by_state[COLLECTD_CPU_STATE_ACTIVE], cpu_rates[active]);
 	}
 } /* }}} void aggregate */
 
@@ -466,10 +549,11 @@ static void cpu_commit_one (int cpu_num, /* {{{ */
  * each iteration / after each call to cpu_commit(). */
 static void cpu_reset (void) /* {{{ */
 {
-	size_t i;
-
-	for (i = 0; i < cpu_states_num; i++)
-		cpu_states[i].has_value = 0;
+	if (cpu_states_num > 0)
+	{
+		memset (cpu_staged, 0, cpu_states_num * sizeof (*cpu_staged));
+		memset (cpu_has_value, 0, cpu_states_num * sizeof (*cpu_has_value));
+	}
 
 	global_cpu_num = 0;
 } /* }}} void cpu_reset */
@@ -485,12 +569,12 @@ static void cpu_commit_without_aggregation (void) /* {{{ */
 
 		for (cpu_num = 0; cpu_num < global_cpu_num; cpu_num++)
 		{
-			cpu_state_t *s = get_cpu_state (cpu_num, state);
+			size_t i = cpu_state_index (cpu_num, (size_t) state);
 
-			if (!s->has_value)
+			if (!cpu_has_value[i])
 				continue;
 
-			submit_derive ((int) cpu_num, (int) state, s->conv.last_value.derive);
+			submit_derive ((int) cpu_num, (int) state, cpu_values[i]);
 		}
 	}
 } /* }}} void cpu_commit_without_aggregation */
@@ -503,9 +587,15 @@ static void cpu_commit (void) /* {{{ */
 	};
 	size_t cpu_num;
 
+	if (global_cpu_num == 0)
+		return;
+
+	cpu_compute_rates ();
+
 	if (report_by_state && report_by_cpu && !report_percent)
 	{
 		cpu_commit_without_aggregation ();
+		cpu_batch_flush ();
 		return;
 	}
 
@@ -514,23 +604,25 @@ static void cpu_commit (void) /* {{{ */
 	if (!report_by_cpu)
 	{
 		cpu_commit_one (-1, global_rates);
+		cpu_batch_flush ();
 		return;
 	}
 
 	for (cpu_num = 0; cpu_num < global_cpu_num; cpu_num++)
 	{
-		cpu_state_t *this_cpu_states = get_cpu_state (cpu_num, 0);
+		size_t base = cpu_state_index (cpu_num, 0);
 		gauge_t local_rates[COLLECTD_CPU_STATE_MAX] = {
 			NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN
 		};
 		size_t state;
 
 		for (state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
-			if (this_cpu_states[state].has_value)
-				local_rates[state] = this_cpu_states[state].rate;
+			if (cpu_has_value[base + state])
+				local_rates[state] = cpu_rates[base + state];
 
 		cpu_commit_one ((int) cpu_num, local_rates);
 	}
+	cpu_batch_flush ();
 } /* }}} void cpu_commit */
 
 /* Adds a derive value to the internal state. This should be used by each read
@@ -539,9 +631,7 @@ static void cpu_commit (void) /* {{{ */
 static int cpu_stage (size_t cpu_num, size_t state, derive_t d, cdtime_t now) /* {{{ */
 {
 	int status;
-	cpu_state_t *s;
-	gauge_t rate = NAN;
-	value_t val = {.derive = d};
+	size_t i;
 
 	if (state >= COLLECTD_CPU_STATE_ACTIVE)
 		return (EINVAL);
@@ -553,14 +643,10 @@ static int cpu_stage (size_t cpu_num, size_t state, derive_t d, cdtime_t now) /*
 	if (global_cpu_num <= cpu_num)
 		global_cpu_num = cpu_num + 1;
 
-	s = get_cpu_state (cpu_num, state);
-
-	status = value_to_rate (&rate, val, DS_TYPE_DERIVE, now, &s->conv);
-	if (status != 0)
-		return (status);
-
-	s->rate = rate;
-	s->has_value = 1;
+	i = cpu_state_index (cpu_num, state);
+	cpu_values[i] = d;
+	cpu_times[i] = now;
+	cpu_staged[i] = 1;
 	return (0);
 } /* }}} int cpu_stage */
 
@@ -607,21 +693,23 @@ static int cpu_read (void)
 
 #elif defined(KERNEL_LINUX) /* {{{ */
 	int cpu;
-	FILE *fh;
+	procfs_snapshot_t *snap;
+	size_t offset = 0;
 	char buf[1024];
 
 	char *fields[9];
 	int numfields;
 
-	if ((fh = fopen ("/proc/stat", "r")) == NULL)
+	/* Shared with the contextswitch and processes plugins. */
+	if ((snap = procfs_snapshot_get ("/proc/stat")) == NULL)
 	{
 		char errbuf[1024];
-		ERROR ("cpu plugin: fopen (/proc/stat) failed: %s",
+		ERROR ("cpu plugin: Reading /proc/stat failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buf, 1024, fh) != NULL)
+	while (procfs_getline (snap, &offset, buf, sizeof (buf)) != NULL)
 	{
 		if (strncmp (buf, "cpu", 3))
 			continue;
@@ -649,7 +737,7 @@ static int cpu_read (void)
 				cpu_stage (cpu, COLLECTD_CPU_STATE_STEAL, (derive_t) atoll(fields[8]), now);
 		}
 	}
-	fclose (fh);
+	procfs_snapshot_put (snap);
 /* }}} #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT) /* {{{ */
@@ -161,6 +161,27 @@ static inline PyObject *cpy_string_to_unicode_or_bytes(const char *buf) {
 
 void cpy_log_exception(const char *context);
 
+/* collectd.dispatch_many(), see pyvalues.c. */
+PyObject *cpy_dispatch_many(PyObject *self, PyObject *args);
+
+/* Worker processes, see pyworker.c. In a worker, cpy_dispatch_values(),
+ * cpy_dispatch_notification() and cpy_log() send their data to the collectd
+ * process; otherwise they call the respective plugin_* function. */
+typedef void (*cpy_worker_init_t)(void);
+typedef int (*cpy_worker_read_t)(size_t index);
+
+int cpy_workers_start(size_t workers_num, cpy_worker_init_t init, cpy_worker_read_t read);
+void cpy_workers_stop(void);
+/* Runs the read callback "index" in worker number "worker" and dispatches
+ * what it sends back. The worker is restarted if it doesn't finish within
+ * "timeout". */
+int cpy_workers_read(size_t worker, size_t index, cdtime_t timeout);
+
+_Bool cpy_in_worker(void);
+int cpy_dispatch_values(const data_set_t *ds, value_list_t *vl);
+int cpy_dispatch_notification(notification_t *n);
+void cpy_log(int severity, const char *format, ...);
+
 /* Python object declarations. */
 
 typedef struct {
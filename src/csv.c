@@ -24,15 +24,37 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
 
+#include <pthread.h>
+
+/*
+ * Private types
+ */
+/* A file kept open between writes. The entries form a list ordered by the
+ * time of the last write, most recent first. */
+struct csv_file_s
+{
+	char *filename;
+	FILE *fh;
+	cdtime_t last_write;
+	_Bool dirty;
+
+	struct csv_file_s *prev;
+	struct csv_file_s *next;
+};
+typedef struct csv_file_s csv_file_t;
+
 /*
  * Private variables
  */
 static const char *config_keys[] =
 {
 	"DataDir",
-	"StoreRates"
+	"StoreRates",
+	"MaxOpenFiles",
+	"FlushTimeout"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -40,6 +62,17 @@ static char *datadir   = NULL;
 static int store_rates = 0;
 static int use_stdio   = 0;
 
+/* If "max_open_files" is greater than zero, up to that many files are kept
+ * open and written through stdio's buffers. All of the following is protected
+ * by "files_lock". */
+static int max_open_files = 0;
+static cdtime_t flush_timeout = 0;
+static c_avl_tree_t *files = NULL;
+static int files_num = 0;
+static csv_file_t *files_head = NULL;
+static csv_file_t *files_tail = NULL;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int value_list_to_string (char *buffer, int buffer_len,
 		const data_set_t *ds, const value_list_t *vl)
 {
@@ -52,8 +85,8 @@ static int value_list_to_string (char *buffer, int buffer_len,
 
 	memset (buffer, '\0', buffer_len);
 
-	status = ssnprintf (buffer, buffer_len, "%.3f",
-			CDTIME_T_TO_DOUBLE (vl->time));
+	status = format_fixed (buffer, buffer_len,
+			CDTIME_T_TO_DOUBLE (vl->time), 3);
 	if ((status < 1) || (status >= buffer_len))
 		return (-1);
 	offset = status;
@@ -69,10 +102,18 @@ static int value_list_to_string (char *buffer, int buffer_len,
 			return (-1);
 		}
 
+		if ((offset + 1) >= buffer_len)
+		{
+			sfree (rates);
+			return (-1);
+		}
+		buffer[offset++] = ',';
+
+		/* "%lf" */
 		if (ds->ds[i].type == DS_TYPE_GAUGE)
 		{
-			status = ssnprintf (buffer + offset, buffer_len - offset,
-					",%lf", vl->values[i].gauge);
+			status = format_fixed (buffer + offset, buffer_len - offset,
+					vl->values[i].gauge, 6);
 		}
 		else if (store_rates != 0)
 		{
@@ -84,29 +125,26 @@ static int value_list_to_string (char *buffer, int buffer_len,
 						"uc_get_rate failed.");
 				return (-1);
 			}
-			status = ssnprintf (buffer + offset,
+			status = format_fixed (buffer + offset,
 					buffer_len - offset,
-					",%lf", rates[i]);
+					rates[i], 6);
 		}
 		else if (ds->ds[i].type == DS_TYPE_COUNTER)
 		{
-			status = ssnprintf (buffer + offset,
+			status = format_uint64 (buffer + offset,
 					buffer_len - offset,
-					",%llu",
-					vl->values[i].counter);
+					(uint64_t) vl->values[i].counter);
 		}
 		else if (ds->ds[i].type == DS_TYPE_DERIVE)
 		{
-			status = ssnprintf (buffer + offset,
+			status = format_int64 (buffer + offset,
 					buffer_len - offset,
-					",%"PRIi64,
 					vl->values[i].derive);
 		}
 		else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
 		{
-			status = ssnprintf (buffer + offset,
+			status = format_uint64 (buffer + offset,
 					buffer_len - offset,
-					",%"PRIu64,
 					vl->values[i].absolute);
 		}
 
@@ -254,6 +292,26 @@ static int csv_config (const char *key, const char *value)
 		else
 			store_rates = 0;
 	}
+	else if (strcasecmp ("MaxOpenFiles", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 0)
+		{
+			ERROR ("csv plugin: MaxOpenFiles must not be negative.");
+			return (1);
+		}
+		max_open_files = tmp;
+	}
+	else if (strcasecmp ("FlushTimeout", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			ERROR ("csv plugin: FlushTimeout must be greater than zero.");
+			return (1);
+		}
+		flush_timeout = DOUBLE_TO_CDTIME_T (tmp);
+	}
 	else
 	{
 		return (-1);
@@ -261,15 +319,216 @@ static int csv_config (const char *key, const char *value)
 	return (0);
 } /* int csv_config */
 
+/* Opens "filename" for appending, creating it if necessary, and locks it. */
+static FILE *csv_open (const char *filename, const data_set_t *ds) /* {{{ */
+{
+	struct stat  statbuf;
+	FILE        *csv;
+	int          csv_fd;
+	struct flock fl;
+	int          status;
+
+	if (stat (filename, &statbuf) == -1)
+	{
+		if (errno == ENOENT)
+		{
+			if (csv_create_file (filename, ds))
+				return (NULL);
+		}
+		else
+		{
+			char errbuf[1024];
+			ERROR ("stat(%s) failed: %s", filename,
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			return (NULL);
+		}
+	}
+	else if (!S_ISREG (statbuf.st_mode))
+	{
+		ERROR ("stat(%s): Not a regular file!",
+				filename);
+		return (NULL);
+	}
+
+	csv = fopen (filename, "a");
+	if (csv == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: fopen (%s) failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (NULL);
+	}
+	csv_fd = fileno (csv);
+
+	memset (&fl, '\0', sizeof (fl));
+	fl.l_start  = 0;
+	fl.l_len    = 0; /* till end of file */
+	fl.l_pid    = getpid ();
+	fl.l_type   = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	status = fcntl (csv_fd, F_SETLK, &fl);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: flock (%s) failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		fclose (csv);
+		return (NULL);
+	}
+
+	return (csv);
+} /* }}} FILE *csv_open */
+
+/* XXX: You must hold "files_lock" when calling this function! */
+static void csv_file_unlink (csv_file_t *f) /* {{{ */
+{
+	if (f->prev != NULL)
+		f->prev->next = f->next;
+	else
+		files_head = f->next;
+
+	if (f->next != NULL)
+		f->next->prev = f->prev;
+	else
+		files_tail = f->prev;
+
+	f->prev = f->next = NULL;
+} /* }}} void csv_file_unlink */
+
+/* Writes the buffered lines and closes the file. The lock is released
+ * implicitly. XXX: You must hold "files_lock" when calling this function! */
+static void csv_file_close (csv_file_t *f) /* {{{ */
+{
+	csv_file_unlink (f);
+	c_avl_remove (files, f->filename, NULL, NULL);
+	files_num--;
+
+	if (fclose (f->fh) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: Writing to %s failed: %s", f->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+
+	sfree (f->filename);
+	sfree (f);
+} /* }}} void csv_file_close */
+
+/* Returns the open file for "filename", opening it and closing the least
+ * recently written file if there are too many open files.
+ * XXX: You must hold "files_lock" when calling this function! */
+static csv_file_t *csv_file_get (const char *filename, /* {{{ */
+		const data_set_t *ds)
+{
+	csv_file_t *f = NULL;
+
+	if (c_avl_get (files, filename, (void *) &f) == 0)
+	{
+		/* Move to the front of the list. */
+		if (f != files_head)
+		{
+			csv_file_unlink (f);
+			f->next = files_head;
+			files_head->prev = f;
+			files_head = f;
+		}
+		return (f);
+	}
+
+	while ((files_num >= max_open_files) && (files_tail != NULL))
+		csv_file_close (files_tail);
+
+	f = calloc (1, sizeof (*f));
+	if (f == NULL)
+		return (NULL);
+
+	f->filename = strdup (filename);
+	if (f->filename == NULL)
+	{
+		sfree (f);
+		return (NULL);
+	}
+
+	f->fh = csv_open (filename, ds);
+	if (f->fh == NULL)
+	{
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+
+	if (c_avl_insert (files, f->filename, f) != 0)
+	{
+		fclose (f->fh);
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+	files_num++;
+
+	f->next = files_head;
+	if (files_head != NULL)
+		files_head->prev = f;
+	files_head = f;
+	if (files_tail == NULL)
+		files_tail = f;
+
+	return (f);
+} /* }}} csv_file_t *csv_file_get */
+
+/* Writes all buffered lines. Files not written to within the last two
+ * "flush_timeout" periods are closed, so that files of past days don't stay
+ * open. */
+static int csv_flush_files (_Bool close_all) /* {{{ */
+{
+	cdtime_t now = cdtime ();
+	csv_file_t *f;
+	csv_file_t *next;
+
+	pthread_mutex_lock (&files_lock);
+	for (f = files_head; f != NULL; f = next)
+	{
+		next = f->next;
+
+		if (close_all || ((now - f->last_write) >= 2 * flush_timeout))
+		{
+			csv_file_close (f);
+			continue;
+		}
+
+		if (f->dirty && (fflush (f->fh) != 0))
+		{
+			char errbuf[1024];
+			ERROR ("csv plugin: Writing to %s failed: %s", f->filename,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+		f->dirty = 0;
+	}
+	pthread_mutex_unlock (&files_lock);
+
+	return (0);
+} /* }}} int csv_flush_files */
+
+static int csv_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
+		__attribute__((unused)) const char *identifier,
+		__attribute__((unused)) user_data_t *user_data)
+{
+	return (csv_flush_files (/* close_all = */ 0));
+} /* }}} int csv_flush */
+
+static int csv_flush_timeout (__attribute__((unused)) user_data_t *ud) /* {{{ */
+{
+	return (csv_flush_files (/* close_all = */ 0));
+} /* }}} int csv_flush_timeout */
+
 static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	struct stat  statbuf;
 	char         filename[512];
 	char         values[4096];
 	FILE        *csv;
-	int          csv_fd;
-	struct flock fl;
 	int          status;
 
 	if (0 != strcmp (ds->type, vl->type)) {
@@ -309,55 +568,30 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		return (0);
 	}
 
-	if (stat (filename, &statbuf) == -1)
+	pthread_mutex_lock (&files_lock);
+	if (files != NULL)
 	{
-		if (errno == ENOENT)
-		{
-			if (csv_create_file (filename, ds))
-				return (-1);
-		}
-		else
+		csv_file_t *f;
+
+		f = csv_file_get (filename, ds);
+		if (f == NULL)
 		{
-			char errbuf[1024];
-			ERROR ("stat(%s) failed: %s", filename,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
+			pthread_mutex_unlock (&files_lock);
 			return (-1);
 		}
-	}
-	else if (!S_ISREG (statbuf.st_mode))
-	{
-		ERROR ("stat(%s): Not a regular file!",
-				filename);
-		return (-1);
-	}
 
-	csv = fopen (filename, "a");
-	if (csv == NULL)
-	{
-		char errbuf[1024];
-		ERROR ("csv plugin: fopen (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
-	}
-	csv_fd = fileno (csv);
+		fprintf (f->fh, "%s\n", values);
+		f->last_write = cdtime ();
+		f->dirty = 1;
+		pthread_mutex_unlock (&files_lock);
 
-	memset (&fl, '\0', sizeof (fl));
-	fl.l_start  = 0;
-	fl.l_len    = 0; /* till end of file */
-	fl.l_pid    = getpid ();
-	fl.l_type   = F_WRLCK;
-	fl.l_whence = SEEK_SET;
+		return (0);
+	}
+	pthread_mutex_unlock (&files_lock);
 
-	status = fcntl (csv_fd, F_SETLK, &fl);
-	if (status != 0)
-	{
-		char errbuf[1024];
-		ERROR ("csv plugin: flock (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (csv);
+	csv = csv_open (filename, ds);
+	if (csv == NULL)
 		return (-1);
-	}
 
 	fprintf (csv, "%s\n", values);
 
@@ -368,9 +602,48 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 	return (0);
 } /* int csv_write */
 
+static int csv_init (void) /* {{{ */
+{
+	if ((max_open_files <= 0) || use_stdio || (files != NULL))
+		return (0);
+
+	if (flush_timeout == 0)
+		flush_timeout = plugin_get_interval ();
+
+	files = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	if (files == NULL)
+	{
+		ERROR ("csv plugin: c_avl_create failed.");
+		return (-1);
+	}
+
+	plugin_register_complex_read (/* group = */ NULL, "csv",
+			csv_flush_timeout, flush_timeout, /* user data = */ NULL);
+	plugin_register_flush ("csv", csv_flush, /* user_data = */ NULL);
+
+	return (0);
+} /* }}} int csv_init */
+
+static int csv_shutdown (void) /* {{{ */
+{
+	if (files == NULL)
+		return (0);
+
+	csv_flush_files (/* close_all = */ 1);
+
+	pthread_mutex_lock (&files_lock);
+	c_avl_destroy (files);
+	files = NULL;
+	pthread_mutex_unlock (&files_lock);
+
+	return (0);
+} /* }}} int csv_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("csv", csv_config,
 			config_keys, config_keys_num);
+	plugin_register_init ("csv", csv_init);
 	plugin_register_write ("csv", csv_write, /* user_data = */ NULL);
+	plugin_register_shutdown ("csv", csv_shutdown);
 } /* void module_register */
@@ -25,6 +25,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl_multi.h"
 #include "utils_match.h"
 #include "utils_time.h"
 
@@ -73,6 +74,7 @@ struct web_page_s /* {{{ */
   char *buffer;
   size_t buffer_size;
   size_t buffer_fill;
+  ucm_transfer_t transfer;
 
   web_match_t *matches;
 
@@ -82,12 +84,13 @@ struct web_page_s /* {{{ */
 /*
  * Global variables;
  */
-/* static CURLM *curl = NULL; */
 static web_page_t *pages_g = NULL;
 
 /*
  * Private functions
  */
+static void cc_page_done (ucm_transfer_t *t, CURLcode status);
+
 static size_t cc_curl_callback (void *buf, /* {{{ */
     size_t size, size_t nmemb, void *user_data)
 {
@@ -144,7 +147,10 @@ static void cc_web_page_free (web_page_t *wp) /* {{{ */
     return;
 
   if (wp->curl != NULL)
+  {
+    ucm_cancel (&wp->transfer);
     curl_easy_cleanup (wp->curl);
+  }
   wp->curl = NULL;
 
   sfree (wp->instance);
@@ -423,6 +429,10 @@ static int cc_page_init_curl (web_page_t *wp) /* {{{ */
     curl_easy_setopt (wp->curl, CURLOPT_TIMEOUT_MS, (long) CDTIME_T_TO_MS(plugin_get_interval()));
 #endif
 
+  wp->transfer.curl = wp->curl;
+  wp->transfer.done = cc_page_done;
+  wp->transfer.user_data = wp;
+
   return (0);
 } /* }}} int cc_page_init_curl */
 
@@ -655,26 +665,29 @@ static void cc_submit_response_time (const web_page_t *wp, /* {{{ */
   plugin_dispatch_values (&vl);
 } /* }}} void cc_submit_response_time */
 
-static int cc_read_page (web_page_t *wp) /* {{{ */
+/* Called by the transfer thread once the page has been fetched. */
+static void cc_page_done (ucm_transfer_t *t, CURLcode result) /* {{{ */
 {
+  web_page_t *wp = t->user_data;
   web_match_t *wm;
   int status;
-  cdtime_t start = 0;
-
-  if (wp->response_time)
-    start = cdtime ();
 
-  wp->buffer_fill = 0;
-  status = curl_easy_perform (wp->curl);
-  if (status != CURLE_OK)
+  if (result != CURLE_OK)
   {
     ERROR ("curl plugin: curl_easy_perform failed with status %i: %s",
-        status, wp->curl_errbuf);
-    return (-1);
+        (int) result, wp->curl_errbuf);
+    return;
   }
 
   if (wp->response_time)
-    cc_submit_response_time (wp, cdtime() - start);
+  {
+    double total_time = 0.0;
+
+    /* Includes name resolution and connecting, like the whole
+     * curl_easy_perform() call used to. */
+    curl_easy_getinfo (wp->curl, CURLINFO_TOTAL_TIME, &total_time);
+    cc_submit_response_time (wp, DOUBLE_TO_CDTIME_T (total_time));
+  }
 
   if(wp->response_code)
   {
@@ -709,10 +722,33 @@ static int cc_read_page (web_page_t *wp) /* {{{ */
     cc_submit (wp, wm, mv);
     match_value_reset (mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
+} /* }}} void cc_page_done */
+
+static int cc_read_page (web_page_t *wp) /* {{{ */
+{
+  int status;
+
+  if (ucm_busy (&wp->transfer))
+  {
+    WARNING ("curl plugin: The previous request of page \"%s\" has not "
+        "finished yet. Skipping this interval.", wp->instance);
+    return (-1);
+  }
+
+  wp->buffer_fill = 0;
+  status = ucm_submit (&wp->transfer);
+  if (status != 0)
+  {
+    ERROR ("curl plugin: Starting the request of page \"%s\" failed.",
+        wp->instance);
+    return (-1);
+  }
 
   return (0);
 } /* }}} int cc_read_page */
 
+/* Starts the requests of all pages, which are then fetched concurrently. The
+ * values are dispatched by cc_page_done() as the requests finish. */
 static int cc_read (void) /* {{{ */
 {
   web_page_t *wp;
@@ -725,6 +761,7 @@ static int cc_read (void) /* {{{ */
 
 static int cc_shutdown (void) /* {{{ */
 {
+  ucm_shutdown ();
   cc_web_page_free (pages_g);
   pages_g = NULL;
 
@@ -25,8 +25,8 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-#include "utils_avltree.h"
 #include "utils_complain.h"
+#include "utils_curl_multi.h"
 
 #include <sys/types.h>
 #include <sys/un.h>
@@ -43,22 +43,53 @@
 #endif
 
 #define CJ_DEFAULT_HOST "localhost"
-#define CJ_KEY_MAGIC 0x43484b59UL /* CHKY */
-#define CJ_IS_KEY(key) ((key)->magic == CJ_KEY_MAGIC)
 #define CJ_ANY "*"
+#define CJ_TREE_BUCKETS_MIN 8
 #define COUCH_MIN(x,y) ((x) < (y) ? (x) : (y))
 
 struct cj_key_s;
 typedef struct cj_key_s cj_key_t;
 struct cj_key_s /* {{{ */
 {
-  unsigned long magic;
   char *path;
   char *type;
   char *instance;
 };
 /* }}} */
 
+/* The configured keys are stored in a trie that matches the structure of the
+ * JSON document, example:
+ *   "httpd/requests/count",
+ *   "httpd/requests/current" ->
+ *   { "httpd": { "requests": { "count": $key, "current": $key } } }
+ * The children of a node are kept in a hash table, the "*" child is kept
+ * separately so that it doesn't need to be looked up. Each entry holds either
+ * a key or a subtree. */
+struct cj_tree_s;
+typedef struct cj_tree_s cj_tree_t;
+struct cj_tree_entry_s;
+typedef struct cj_tree_entry_s cj_tree_entry_t;
+
+struct cj_tree_entry_s /* {{{ */
+{
+  char *name;
+  size_t name_len;
+  uint32_t hash;
+  cj_key_t *key;
+  cj_tree_t *tree;
+  cj_tree_entry_t *next;
+};
+/* }}} */
+
+struct cj_tree_s /* {{{ */
+{
+  cj_tree_entry_t **buckets;
+  size_t buckets_num;
+  size_t entries_num;
+  cj_tree_entry_t *any;
+};
+/* }}} */
+
 struct cj_s /* {{{ */
 {
   char *instance;
@@ -81,16 +112,18 @@ struct cj_s /* {{{ */
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
+  ucm_transfer_t transfer;
 
   yajl_handle yajl;
-  c_avl_tree_t *tree;
+  cj_tree_t *tree;
   cj_key_t *key;
   int depth;
+  /* Nesting level within a container that no configured key can match, or
+   * zero. Such containers are skipped without looking at their contents. */
+  int skip;
   struct {
-    union {
-      c_avl_tree_t *tree;
-      cj_key_t *key;
-    };
+    cj_tree_t *tree;
+    cj_key_t *key;
     _Bool in_array;
     int index;
     char name[DATA_MAX_NAME_LEN];
@@ -106,6 +139,53 @@ typedef unsigned int yajl_len_t;
 
 static int cj_read (user_data_t *ud);
 static void cj_submit (cj_t *db, cj_key_t *key, value_t *value);
+static void cj_curl_done (ucm_transfer_t *t, CURLcode status);
+
+/* 32 bit FNV-1a */
+static uint32_t cj_hash (char const *name, size_t name_len) /* {{{ */
+{
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < name_len; i++)
+  {
+    hash ^= (uint32_t) (unsigned char) name[i];
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} uint32_t cj_hash */
+
+static cj_tree_entry_t *cj_tree_get (cj_tree_t *tree, /* {{{ */
+    char const *name, size_t name_len, uint32_t hash)
+{
+  cj_tree_entry_t *e;
+
+  if (tree->buckets_num == 0)
+    return (NULL);
+
+  for (e = tree->buckets[hash & (tree->buckets_num - 1)]; e != NULL;
+      e = e->next)
+    if ((e->hash == hash) && (e->name_len == name_len)
+        && (memcmp (e->name, name, name_len) == 0))
+      return (e);
+
+  return (NULL);
+} /* }}} cj_tree_entry_t *cj_tree_get */
+
+/* Returns the child of "tree" matching "name", falling back to the "*"
+ * child. */
+static cj_tree_entry_t *cj_tree_lookup (cj_tree_t *tree, /* {{{ */
+    char const *name, size_t name_len)
+{
+  cj_tree_entry_t *e;
+
+  e = cj_tree_get (tree, name, name_len, cj_hash (name, name_len));
+  if (e != NULL)
+    return (e);
+
+  return (tree->any);
+} /* }}} cj_tree_entry_t *cj_tree_lookup */
 
 static size_t cj_curl_callback (void *buf, /* {{{ */
     size_t size, size_t nmemb, void *user_data)
@@ -178,7 +258,7 @@ static void cj_cb_inc_array_index (void *ctx, _Bool update_key)
 {
   cj_t *db = (cj_t *)ctx;
 
-  if (!db->state[db->depth].in_array)
+  if (db->skip || !db->state[db->depth].in_array)
     return;
 
   db->state[db->depth].index++;
@@ -220,24 +300,23 @@ static int cj_cb_number (void *ctx,
   int type;
   int status;
 
+  if (db->skip)
+    return (CJ_CB_CONTINUE);
+
   /* Create a null-terminated version of the string. */
   memcpy (buffer, number, number_len);
   buffer[sizeof (buffer) - 1] = 0;
 
-  if ((key == NULL) || !CJ_IS_KEY (key)) {
-    if (key != NULL && !db->state[db->depth].in_array/*can be inhomogeneous*/)
-      NOTICE ("curl_json plugin: Found \"%s\", but the configuration expects"
-              " a map.", buffer);
-    cj_cb_inc_array_index (ctx, /* update_key = */ 1);
-    key = db->state[db->depth].key;
-    if (key == NULL) {
-      return (CJ_CB_CONTINUE);
-    }
-  }
-  else
-  {
-    cj_cb_inc_array_index (ctx, /* update_key = */ 1);
-  }
+  if ((key == NULL) && (db->state[db->depth].tree != NULL)
+      && !db->state[db->depth].in_array/*can be inhomogeneous*/)
+    NOTICE ("curl_json plugin: Found \"%s\", but the configuration expects"
+            " a map.", buffer);
+
+  /* Within arrays, this looks up the key of the element's index. */
+  cj_cb_inc_array_index (ctx, /* update_key = */ 1);
+  key = db->state[db->depth].key;
+  if (key == NULL)
+    return (CJ_CB_CONTINUE);
 
   type = cj_get_type (key);
   status = parse_value (buffer, &vt, type);
@@ -252,19 +331,35 @@ static int cj_cb_number (void *ctx,
 } /* int cj_cb_number */
 
 /* Queries the key-tree of the parent context for "in_name" and, if found,
- * updates the "key" field of the current context. Otherwise, "key" is set to
- * NULL. */
+ * updates the "key" or "tree" field of the current context. Otherwise, both
+ * are set to NULL. */
 static int cj_cb_map_key (void *ctx,
     unsigned char const *in_name, yajl_len_t in_name_len)
 {
   cj_t *db = (cj_t *)ctx;
-  c_avl_tree_t *tree;
+  cj_tree_t *tree;
+  cj_tree_entry_t *e;
+
+  if (db->skip)
+    return (CJ_CB_CONTINUE);
 
   tree = db->state[db->depth-1].tree;
+  if (tree == NULL)
+    return (CJ_CB_CONTINUE);
+
+  e = cj_tree_lookup (tree, (char const *) in_name, (size_t) in_name_len);
+  if (e == NULL)
+  {
+    db->state[db->depth].key = NULL;
+    db->state[db->depth].tree = NULL;
+    return (CJ_CB_CONTINUE);
+  }
+
+  db->state[db->depth].key = e->key;
+  db->state[db->depth].tree = e->tree;
 
-  if (tree != NULL)
+  /* The name is only needed to build the type instance of matching keys. */
   {
-    cj_key_t *value = NULL;
     char *name;
     size_t name_len;
 
@@ -274,24 +369,6 @@ static int cj_cb_map_key (void *ctx,
         sizeof (db->state[db->depth].name) - 1);
     memcpy (name, in_name, name_len);
     name[name_len] = 0;
-
-    if (c_avl_get (tree, name, (void *) &value) == 0) {
-      if (CJ_IS_KEY((cj_key_t*)value)) {
-        db->state[db->depth].key = value;
-      }
-      else {
-        db->state[db->depth].tree = (c_avl_tree_t*) value;
-      }
-    }
-    else if (c_avl_get (tree, CJ_ANY, (void *) &value) == 0)
-      if (CJ_IS_KEY((cj_key_t*)value)) {
-        db->state[db->depth].key = value;
-      }
-      else {
-        db->state[db->depth].tree = (c_avl_tree_t*) value;
-      }
-    else
-      db->state[db->depth].key = NULL;
   }
 
   return (CJ_CB_CONTINUE);
@@ -313,6 +390,11 @@ static int cj_cb_start (void *ctx)
            db->url ? db->url : db->sock);
     return (CJ_CB_ABORT);
   }
+
+  /* No configured key can match below this container. */
+  if (db->state[db->depth-1].tree == NULL)
+    db->skip = 1;
+
   return (CJ_CB_CONTINUE);
 }
 
@@ -320,24 +402,43 @@ static int cj_cb_end (void *ctx)
 {
   cj_t *db = (cj_t *)ctx;
   db->state[db->depth].tree = NULL;
+  db->state[db->depth].key = NULL;
   --db->depth;
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_start_map (void *ctx)
 {
+  cj_t *db = (cj_t *)ctx;
+  if (db->skip)
+  {
+    db->skip++;
+    return (CJ_CB_CONTINUE);
+  }
   cj_cb_inc_array_index (ctx, /* update_key = */ 1);
   return cj_cb_start (ctx);
 }
 
 static int cj_cb_end_map (void *ctx)
 {
+  cj_t *db = (cj_t *)ctx;
+  if (db->skip > 1)
+  {
+    db->skip--;
+    return (CJ_CB_CONTINUE);
+  }
+  db->skip = 0;
   return cj_cb_end (ctx);
 }
 
 static int cj_cb_start_array (void * ctx)
 {
   cj_t *db = (cj_t *)ctx;
+  if (db->skip)
+  {
+    db->skip++;
+    return (CJ_CB_CONTINUE);
+  }
   cj_cb_inc_array_index (ctx, /* update_key = */ 1);
   if (db->depth+1 < YAJL_MAX_DEPTH) {
     db->state[db->depth+1].in_array = 1;
@@ -349,6 +450,12 @@ static int cj_cb_start_array (void * ctx)
 static int cj_cb_end_array (void * ctx)
 {
   cj_t *db = (cj_t *)ctx;
+  if (db->skip > 1)
+  {
+    db->skip--;
+    return (CJ_CB_CONTINUE);
+  }
+  db->skip = 0;
   db->state[db->depth].in_array = 0;
   return cj_cb_end (ctx);
 }
@@ -381,24 +488,40 @@ static void cj_key_free (cj_key_t *key) /* {{{ */
   sfree (key);
 } /* }}} void cj_key_free */
 
-static void cj_tree_free (c_avl_tree_t *tree) /* {{{ */
+static void cj_tree_free (cj_tree_t *tree);
+
+static void cj_tree_entry_free (cj_tree_entry_t *e) /* {{{ */
 {
-  char *name;
-  void *value;
+  if (e == NULL)
+    return;
 
-  while (c_avl_pick (tree, (void *) &name, (void *) &value) == 0)
-  {
-    cj_key_t *key = (cj_key_t *)value;
+  cj_key_free (e->key);
+  cj_tree_free (e->tree);
+  sfree (e->name);
+  sfree (e);
+} /* }}} void cj_tree_entry_free */
 
-    if (CJ_IS_KEY(key))
-      cj_key_free (key);
-    else
-      cj_tree_free ((c_avl_tree_t *)value);
+static void cj_tree_free (cj_tree_t *tree) /* {{{ */
+{
+  size_t i;
+
+  if (tree == NULL)
+    return;
 
-    sfree (name);
+  for (i = 0; i < tree->buckets_num; i++)
+  {
+    cj_tree_entry_t *e = tree->buckets[i];
+    while (e != NULL)
+    {
+      cj_tree_entry_t *next = e->next;
+      cj_tree_entry_free (e);
+      e = next;
+    }
   }
+  sfree (tree->buckets);
+  cj_tree_entry_free (tree->any);
 
-  c_avl_destroy (tree);
+  sfree (tree);
 } /* }}} void cj_tree_free */
 
 static void cj_free (void *arg) /* {{{ */
@@ -413,11 +536,18 @@ static void cj_free (void *arg) /* {{{ */
     return;
 
   if (db->curl != NULL)
+  {
+    ucm_cancel (&db->transfer);
     curl_easy_cleanup (db->curl);
+  }
   db->curl = NULL;
 
-  if (db->tree != NULL)
-    cj_tree_free (db->tree);
+  /* Left over if a transfer was cancelled. */
+  if (db->yajl != NULL)
+    yajl_free (db->yajl);
+  db->yajl = NULL;
+
+  cj_tree_free (db->tree);
   db->tree = NULL;
 
   sfree (db->instance);
@@ -438,10 +568,99 @@ static void cj_free (void *arg) /* {{{ */
 
 /* Configuration handling functions {{{ */
 
-static c_avl_tree_t *cj_avl_create(void)
+/* Doubles the number of buckets of "tree" once it holds as many entries as
+ * it has buckets, so that chains stay short. */
+static int cj_tree_grow (cj_tree_t *tree) /* {{{ */
 {
-  return c_avl_create ((int (*) (const void *, const void *)) strcmp);
-}
+  cj_tree_entry_t **buckets;
+  size_t buckets_num;
+  size_t i;
+
+  if (tree->entries_num < tree->buckets_num)
+    return (0);
+
+  buckets_num = (tree->buckets_num > 0)
+    ? 2 * tree->buckets_num : CJ_TREE_BUCKETS_MIN;
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+    return (ENOMEM);
+
+  for (i = 0; i < tree->buckets_num; i++)
+  {
+    cj_tree_entry_t *e = tree->buckets[i];
+    while (e != NULL)
+    {
+      cj_tree_entry_t *next = e->next;
+      size_t index = e->hash & (buckets_num - 1);
+
+      e->next = buckets[index];
+      buckets[index] = e;
+      e = next;
+    }
+  }
+
+  sfree (tree->buckets);
+  tree->buckets = buckets;
+  tree->buckets_num = buckets_num;
+  return (0);
+} /* }}} int cj_tree_grow */
+
+/* Returns the child "name" of "tree", creating an empty entry if it doesn't
+ * exist yet. */
+static cj_tree_entry_t *cj_tree_child (cj_tree_t *tree, /* {{{ */
+    char const *name, size_t name_len)
+{
+  cj_tree_entry_t *e;
+  uint32_t hash;
+  size_t index;
+
+  if ((name_len == strlen (CJ_ANY)) && (strncmp (name, CJ_ANY, name_len) == 0))
+  {
+    if (tree->any == NULL)
+    {
+      tree->any = calloc (1, sizeof (*tree->any));
+      if (tree->any == NULL)
+        return (NULL);
+      tree->any->name = strdup (CJ_ANY);
+      tree->any->name_len = name_len;
+      if (tree->any->name == NULL)
+      {
+        sfree (tree->any);
+        return (NULL);
+      }
+    }
+    return (tree->any);
+  }
+
+  hash = cj_hash (name, name_len);
+  e = cj_tree_get (tree, name, name_len, hash);
+  if (e != NULL)
+    return (e);
+
+  if (cj_tree_grow (tree) != 0)
+    return (NULL);
+
+  e = calloc (1, sizeof (*e));
+  if (e == NULL)
+    return (NULL);
+  e->name = malloc (name_len + 1);
+  if (e->name == NULL)
+  {
+    sfree (e);
+    return (NULL);
+  }
+  memcpy (e->name, name, name_len);
+  e->name[name_len] = 0;
+  e->name_len = name_len;
+  e->hash = hash;
+
+  index = hash & (tree->buckets_num - 1);
+  e->next = tree->buckets[index];
+  tree->buckets[index] = e;
+  tree->entries_num++;
+
+  return (e);
+} /* }}} cj_tree_entry_t *cj_tree_child */
 
 static int cj_config_append_string (const char *name, struct curl_slist **dest, /* {{{ */
     oconfig_item_t *ci)
@@ -483,7 +702,6 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     ERROR ("curl_json plugin: calloc failed.");
     return (-1);
   }
-  key->magic = CJ_KEY_MAGIC;
 
   if (strcasecmp ("Key", ci->key) == 0)
   {
@@ -534,17 +752,23 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     return (-1);
   }
 
-  /* store path in a tree that will match the json map structure, example:
-   * "httpd/requests/count",
-   * "httpd/requests/current" ->
-   * { "httpd": { "requests": { "count": $key, "current": $key } } }
-   */
+  /* store path in a tree that will match the json map structure, see
+   * cj_tree_t. */
   char *ptr;
   char *name;
-  c_avl_tree_t *tree;
+  cj_tree_t *tree;
+  cj_tree_entry_t *e;
 
   if (db->tree == NULL)
-    db->tree = cj_avl_create();
+  {
+    db->tree = calloc (1, sizeof (*db->tree));
+    if (db->tree == NULL)
+    {
+      ERROR ("curl_json plugin: calloc failed.");
+      cj_key_free (key);
+      return (-1);
+    }
+  }
 
   tree = db->tree;
   ptr = key->path;
@@ -554,24 +778,40 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
   name = ptr;
   while ((ptr = strchr (name, '/')) != NULL)
   {
-    char ent[PATH_MAX];
-    c_avl_tree_t *value;
     size_t len;
 
     len = ptr - name;
     if (len == 0)
       break;
 
-    len = COUCH_MIN(len, sizeof (ent)-1);
-    sstrncpy (ent, name, len+1);
+    e = cj_tree_child (tree, name, len);
+    if (e == NULL)
+    {
+      ERROR ("curl_json plugin: calloc failed.");
+      cj_key_free (key);
+      return (-1);
+    }
+
+    if (e->key != NULL)
+    {
+      ERROR ("curl_json plugin: The key \"%s\" conflicts with the key \"%s\".",
+          key->path, e->key->path);
+      cj_key_free (key);
+      return (-1);
+    }
 
-    if (c_avl_get (tree, ent, (void *) &value) != 0)
+    if (e->tree == NULL)
     {
-      value = cj_avl_create ();
-      c_avl_insert (tree, strdup (ent), value);
+      e->tree = calloc (1, sizeof (*e->tree));
+      if (e->tree == NULL)
+      {
+        ERROR ("curl_json plugin: calloc failed.");
+        cj_key_free (key);
+        return (-1);
+      }
     }
 
-    tree = value;
+    tree = e->tree;
     name = ptr + 1;
   }
 
@@ -582,7 +822,23 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     return (-1);
   }
 
-  c_avl_insert (tree, strdup (name), key);
+  e = cj_tree_child (tree, name, strlen (name));
+  if (e == NULL)
+  {
+    ERROR ("curl_json plugin: calloc failed.");
+    cj_key_free (key);
+    return (-1);
+  }
+
+  if ((e->key != NULL) || (e->tree != NULL))
+  {
+    ERROR ("curl_json plugin: The key \"%s\" conflicts with another key.",
+        key->path);
+    cj_key_free (key);
+    return (-1);
+  }
+
+  e->key = key;
   return (status);
 } /* }}} int cj_config_add_key */
 
@@ -652,6 +908,10 @@ static int cj_init_curl (cj_t *db) /* {{{ */
     curl_easy_setopt (db->curl, CURLOPT_TIMEOUT_MS, (long) CDTIME_T_TO_MS(plugin_get_interval()));
 #endif
 
+  db->transfer.curl = db->curl;
+  db->transfer.done = cj_curl_done;
+  db->transfer.user_data = db;
+
   return (0);
 } /* }}} int cj_init_curl */
 
@@ -897,18 +1157,17 @@ static int cj_sock_perform (cj_t *db) /* {{{ */
 } /* }}} int cj_sock_perform */
 
 
-static int cj_curl_perform(cj_t *db) /* {{{ */
+/* Checks the outcome of a transfer. */
+static int cj_curl_check (cj_t *db, CURLcode status) /* {{{ */
 {
-  int status;
   long rc;
   char *url;
   url = db->url;
 
-  status = curl_easy_perform (db->curl);
   if (status != CURLE_OK)
   {
     ERROR ("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
-           status, db->curl_errbuf, url);
+           (int) status, db->curl_errbuf, url);
     return (-1);
   }
 
@@ -923,12 +1182,16 @@ static int cj_curl_perform(cj_t *db) /* {{{ */
     return (-1);
   }
   return (0);
-} /* }}} int cj_curl_perform */
+} /* }}} int cj_curl_check */
 
-static int cj_perform (cj_t *db) /* {{{ */
+/* Resets the parser state and allocates a parser for the next document. */
+static int cj_parse_begin (cj_t *db) /* {{{ */
 {
-  int status;
-  yajl_handle yprev = db->yajl;
+  db->depth = 0;
+  db->skip = 0;
+  memset (&db->state, 0, sizeof(db->state));
+  db->state[db->depth].tree = db->tree;
+  db->key = NULL;
 
   db->yajl = yajl_alloc (&ycallbacks,
 #if HAVE_YAJL_V2
@@ -940,48 +1203,56 @@ static int cj_perform (cj_t *db) /* {{{ */
   if (db->yajl == NULL)
   {
     ERROR ("curl_json plugin: yajl_alloc failed.");
-    db->yajl = yprev;
     return (-1);
   }
 
-  if (db->url)
-    status = cj_curl_perform (db);
-  else
-    status = cj_sock_perform (db);
-  if (status < 0)
-  {
-    yajl_free (db->yajl);
-    db->yajl = yprev;
-    return (-1);
-  }
+  return (0);
+} /* }}} int cj_parse_begin */
 
+/* Completes parsing if `status', the result of fetching the document, is
+ * zero, and frees the parser. */
+static int cj_parse_end (cj_t *db, int status) /* {{{ */
+{
+  if (status == 0)
+  {
 #if HAVE_YAJL_V2
     status = yajl_complete_parse(db->yajl);
 #else
     status = yajl_parse_complete(db->yajl);
 #endif
-  if (status != yajl_status_ok)
-  {
-    unsigned char *errmsg;
+    if (status != yajl_status_ok)
+    {
+      unsigned char *errmsg;
 
-    errmsg = yajl_get_error (db->yajl, /* verbose = */ 0,
-        /* jsonText = */ NULL, /* jsonTextLen = */ 0);
-    ERROR ("curl_json plugin: yajl_parse_complete failed: %s",
-        (char *) errmsg);
-    yajl_free_error (db->yajl, errmsg);
-    yajl_free (db->yajl);
-    db->yajl = yprev;
-    return (-1);
+      errmsg = yajl_get_error (db->yajl, /* verbose = */ 0,
+          /* jsonText = */ NULL, /* jsonTextLen = */ 0);
+      ERROR ("curl_json plugin: yajl_parse_complete failed: %s",
+          (char *) errmsg);
+      yajl_free_error (db->yajl, errmsg);
+      status = -1;
+    }
+    else
+      status = 0;
   }
 
   yajl_free (db->yajl);
-  db->yajl = yprev;
-  return (0);
-} /* }}} int cj_perform */
+  db->yajl = NULL;
+  return (status);
+} /* }}} int cj_parse_end */
+
+/* Called by the transfer thread once the document has been fetched. It has
+ * been parsed by cj_curl_callback() as it arrived. */
+static void cj_curl_done (ucm_transfer_t *t, CURLcode status) /* {{{ */
+{
+  cj_t *db = t->user_data;
+
+  cj_parse_end (db, cj_curl_check (db, status));
+} /* }}} void cj_curl_done */
 
 static int cj_read (user_data_t *ud) /* {{{ */
 {
   cj_t *db;
+  int status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -991,12 +1262,35 @@ static int cj_read (user_data_t *ud) /* {{{ */
 
   db = (cj_t *) ud->data;
 
-  db->depth = 0;
-  memset (&db->state, 0, sizeof(db->state));
-  db->state[db->depth].tree = db->tree;
-  db->key = NULL;
+  if (db->url == NULL)
+  {
+    if (cj_parse_begin (db) != 0)
+      return (-1);
+    return (cj_parse_end (db, cj_sock_perform (db)));
+  }
+
+  /* URLs are fetched by the transfer thread, so slow servers don't block a
+   * read thread. The values are dispatched from cj_curl_callback() and
+   * cj_curl_done(). */
+  if (ucm_busy (&db->transfer))
+  {
+    WARNING ("curl_json plugin: The previous request of %s has not finished "
+        "yet. Skipping this interval.", db->url);
+    return (-1);
+  }
 
-  return cj_perform (db);
+  if (cj_parse_begin (db) != 0)
+    return (-1);
+
+  status = ucm_submit (&db->transfer);
+  if (status != 0)
+  {
+    ERROR ("curl_json plugin: Starting the request of %s failed.", db->url);
+    cj_parse_end (db, -1);
+    return (-1);
+  }
+
+  return (0);
 } /* }}} int cj_read */
 
 static int cj_init (void) /* {{{ */
@@ -1007,10 +1301,18 @@ static int cj_init (void) /* {{{ */
   return (0);
 } /* }}} int cj_init */
 
+static int cj_shutdown (void) /* {{{ */
+{
+  /* The read callbacks, and with them all transfers, are gone already. */
+  ucm_shutdown ();
+  return (0);
+} /* }}} int cj_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("curl_json", cj_config);
   plugin_register_init ("curl_json", cj_init);
+  plugin_register_shutdown ("curl_json", cj_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -23,6 +23,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl_multi.h"
 #include "utils_llist.h"
 
 #include <libxml/parser.h>
@@ -89,9 +90,8 @@ struct cx_s /* {{{ */
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
-  char *buffer;
-  size_t buffer_size;
-  size_t buffer_fill;
+  xmlParserCtxtPtr parser;
+  ucm_transfer_t transfer;
 
   llist_t *list; /* list of xpath blocks */
 };
@@ -100,11 +100,25 @@ typedef struct cx_s cx_t; /* }}} */
 /*
  * Private functions
  */
+static void cx_parser_free (cx_t *db) /* {{{ */
+{
+  if (db->parser == NULL)
+    return;
+
+  if (db->parser->myDoc != NULL)
+    xmlFreeDoc (db->parser->myDoc);
+  xmlFreeParserCtxt (db->parser);
+  db->parser = NULL;
+} /* }}} void cx_parser_free */
+
+/* Feeds the received data to the parser, so the document is never held as
+ * text. */
 static size_t cx_curl_callback (void *buf, /* {{{ */
     size_t size, size_t nmemb, void *user_data)
 {
   size_t len = size * nmemb;
   cx_t *db;
+  int status;
 
   db = user_data;
   if (db == NULL)
@@ -117,24 +131,24 @@ static size_t cx_curl_callback (void *buf, /* {{{ */
    if (len <= 0)
     return (len);
 
-  if ((db->buffer_fill + len) >= db->buffer_size)
+  if (db->parser == NULL)
   {
-    char *temp;
-
-    temp = (char *) realloc (db->buffer,
-                    db->buffer_fill + len + 1);
-    if (temp == NULL)
+    db->parser = xmlCreatePushParserCtxt (/* sax = */ NULL,
+        /* user_data = */ NULL, /* chunk = */ NULL, /* size = */ 0, db->url);
+    if (db->parser == NULL)
     {
-      ERROR ("curl_xml plugin: realloc failed.");
+      ERROR ("curl_xml plugin: xmlCreatePushParserCtxt failed.");
       return (0);
     }
-    db->buffer = temp;
-    db->buffer_size = db->buffer_fill + len + 1;
   }
 
-  memcpy (db->buffer + db->buffer_fill, (char *) buf, len);
-  db->buffer_fill += len;
-  db->buffer[db->buffer_fill] = 0;
+  status = xmlParseChunk (db->parser, buf, (int) len, /* terminate = */ 0);
+  if (status != 0)
+  {
+    ERROR ("curl_xml plugin: Failed to parse the xml document (%s): "
+        "status %i", db->url, status);
+    return (0);
+  }
 
   return (len);
 } /* }}} size_t cx_curl_callback */
@@ -186,13 +200,16 @@ static void cx_free (void *arg) /* {{{ */
     return;
 
   if (db->curl != NULL)
+  {
+    ucm_cancel (&db->transfer);
     curl_easy_cleanup (db->curl);
+  }
   db->curl = NULL;
 
   if (db->list != NULL)
     cx_list_free (db->list);
 
-  sfree (db->buffer);
+  cx_parser_free (db);
   sfree (db->instance);
   sfree (db->host);
 
@@ -569,21 +586,13 @@ static int cx_handle_parsed_xml(xmlDocPtr doc, /* {{{ */
   return status;
 } /* }}} cx_handle_parsed_xml */
 
-static int cx_parse_stats_xml(xmlChar* xml, cx_t *db) /* {{{ */
+/* Handles the parsed document and frees it. */
+static int cx_parse_stats_xml(xmlDocPtr doc, cx_t *db) /* {{{ */
 {
   int status;
-  xmlDocPtr doc;
   xmlXPathContextPtr xpath_ctx;
   size_t i;
 
-  /* Load the XML */
-  doc = xmlParseDoc(xml);
-  if (doc == NULL)
-  {
-    ERROR ("curl_xml plugin: Failed to parse the xml document  - %s", xml);
-    return (-1);
-  }
-
   xpath_ctx = xmlXPathNewContext(doc);
   if(xpath_ctx == NULL)
   {
@@ -615,45 +624,62 @@ static int cx_parse_stats_xml(xmlChar* xml, cx_t *db) /* {{{ */
   return status;
 } /* }}} cx_parse_stats_xml */
 
-static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
+/* Called by the transfer thread once the document has been fetched. */
+static void cx_curl_done (ucm_transfer_t *t, CURLcode status) /* {{{ */
 {
-  int status;
+  cx_t *db = t->user_data;
+  xmlDocPtr doc;
   long rc;
-  char *ptr;
   char *url;
   url = db->url;
 
-  db->buffer_fill = 0;
-  status = curl_easy_perform (curl);
   if (status != CURLE_OK)
   {
     ERROR ("curl_xml plugin: curl_easy_perform failed with status %i: %s (%s)",
-           status, db->curl_errbuf, url);
-    return (-1);
+           (int) status, db->curl_errbuf, url);
+    cx_parser_free (db);
+    return;
   }
 
-  curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
-  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &rc);
+  curl_easy_getinfo(db->curl, CURLINFO_EFFECTIVE_URL, &url);
+  curl_easy_getinfo(db->curl, CURLINFO_RESPONSE_CODE, &rc);
 
   /* The response code is zero if a non-HTTP transport was used. */
   if ((rc != 0) && (rc != 200))
   {
     ERROR ("curl_xml plugin: curl_easy_perform failed with response code %ld (%s)",
            rc, url);
-    return (-1);
+    cx_parser_free (db);
+    return;
   }
 
-  ptr = db->buffer;
+  if (db->parser == NULL)
+  {
+    ERROR ("curl_xml plugin: The server sent an empty document (%s).", url);
+    return;
+  }
+
+  xmlParseChunk (db->parser, NULL, 0, /* terminate = */ 1);
+  if (!db->parser->wellFormed || (db->parser->myDoc == NULL))
+  {
+    ERROR ("curl_xml plugin: Failed to parse the xml document (%s).", url);
+    cx_parser_free (db);
+    return;
+  }
 
-  status = cx_parse_stats_xml(BAD_CAST ptr, db);
-  db->buffer_fill = 0;
+  doc = db->parser->myDoc;
+  db->parser->myDoc = NULL;
+  cx_parser_free (db);
 
-  return status;
-} /* }}} int cx_curl_perform */
+  cx_parse_stats_xml(doc, db);
+} /* }}} void cx_curl_done */
 
+/* Starts the request. The values are dispatched by cx_curl_done() once the
+ * document has arrived, so slow servers don't block a read thread. */
 static int cx_read (user_data_t *ud) /* {{{ */
 {
   cx_t *db;
+  int status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -663,7 +689,22 @@ static int cx_read (user_data_t *ud) /* {{{ */
 
   db = (cx_t *) ud->data;
 
-  return cx_curl_perform (db, db->curl);
+  if (ucm_busy (&db->transfer))
+  {
+    WARNING ("curl_xml plugin: The previous request of %s has not finished "
+        "yet. Skipping this interval.", db->url);
+    return (-1);
+  }
+
+  cx_parser_free (db);
+  status = ucm_submit (&db->transfer);
+  if (status != 0)
+  {
+    ERROR ("curl_xml plugin: Starting the request of %s failed.", db->url);
+    return (-1);
+  }
+
+  return (0);
 } /* }}} int cx_read */
 
 /* Configuration handling functions {{{ */
@@ -908,6 +949,10 @@ static int cx_init_curl (cx_t *db) /* {{{ */
     curl_easy_setopt (db->curl, CURLOPT_TIMEOUT_MS, (long) CDTIME_T_TO_MS(plugin_get_interval()));
 #endif
 
+  db->transfer.curl = db->curl;
+  db->transfer.done = cx_curl_done;
+  db->transfer.user_data = db;
+
   return (0);
 } /* }}} int cx_init_curl */
 
@@ -1079,13 +1124,23 @@ static int cx_init (void) /* {{{ */
   /* Call this while collectd is still single-threaded to avoid
    * initialization issues in libgcrypt. */
   curl_global_init (CURL_GLOBAL_SSL);
+  /* The documents are parsed by the transfer thread. */
+  xmlInitParser ();
   return (0);
 } /* }}} int cx_init */
 
+static int cx_shutdown (void) /* {{{ */
+{
+  /* The read callbacks, and with them all transfers, are gone already. */
+  ucm_shutdown ();
+  return (0);
+} /* }}} int cx_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("curl_xml", cx_config);
   plugin_register_init ("curl_xml", cx_init);
+  plugin_register_shutdown ("curl_xml", cx_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -30,6 +30,7 @@
 
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_handover.h"
 
 #include <sys/types.h>
 #include <sys/un.h>
@@ -61,6 +62,9 @@ kstat_ctl_t *kc;
 #endif /* HAVE_LIBKSTAT */
 
 static int loop = 0;
+static volatile sig_atomic_t reload = 0;
+
+static const char *configfile = CONFIGFILE;
 
 static void *do_flush (void __attribute__((unused)) *arg)
 {
@@ -83,6 +87,11 @@ static void sig_term_handler (int __attribute__((unused)) signal)
 	loop++;
 }
 
+static void sig_hup_handler (int __attribute__((unused)) signal)
+{
+	reload = 1;
+}
+
 static void sig_usr1_handler (int __attribute__((unused)) signal)
 {
 	pthread_t      thread;
@@ -282,6 +291,9 @@ static void exit_usage (int status)
 			"    -T              Test plugin read and exit.\n"
 			"    -P <file>       PID-file.\n"
 			"                    Default: "PIDFILE"\n"
+			"    -H <socket>     Take over the listening sockets of the instance\n"
+			"                    running with the same <socket> and listen on\n"
+			"                    it for the next one.\n"
 #if COLLECT_DAEMON
 			"    -f              Don't fork to the background.\n"
 #endif
@@ -338,6 +350,20 @@ static int do_init (void)
 } /* int do_init () */
 
 
+/* Reloads the configuration if a SIGHUP has been received. Returns true if
+ * it did. The signal may be delivered to any thread, so the flag is polled
+ * rather than relying on it interrupting the main thread's sleep. */
+static _Bool do_reload (void)
+{
+	if (reload == 0)
+		return (0);
+
+	reload = 0;
+	INFO ("Reloading the configuration from %s.", configfile);
+	cf_reload (configfile);
+	return (1);
+} /* _Bool do_reload */
+
 static int do_loop (void)
 {
 	cdtime_t interval = cf_get_default_interval ();
@@ -350,6 +376,8 @@ static int do_loop (void)
 		struct timespec ts_wait = { 0, 0 };
 		cdtime_t now;
 
+		do_reload ();
+
 #if HAVE_LIBKSTAT
 		update_kstat ();
 #endif
@@ -380,7 +408,22 @@ static int do_loop (void)
 							sizeof (errbuf)));
 				return (-1);
 			}
+
+			if (do_reload ())
+			{
+				/* Don't sleep longer than the rest of the
+				 * interval because of the reload. */
+				now = cdtime ();
+				if (now >= (wait_until - interval))
+					break;
+				CDTIME_T_TO_TIMESPEC (wait_until - interval - now,
+						&ts_wait);
+			}
 		}
+
+		/* A SIGHUP received while reading or by another thread doesn't
+		 * interrupt the sleep. */
+		do_reload ();
 	} /* while (loop == 0) */
 
 	return (0);
@@ -518,8 +561,9 @@ int main (int argc, char **argv)
 	struct sigaction sig_int_action;
 	struct sigaction sig_term_action;
 	struct sigaction sig_usr1_action;
+	struct sigaction sig_hup_action;
 	struct sigaction sig_pipe_action;
-	const char *configfile = CONFIGFILE;
+	const char *handover_path = NULL;
 	int test_config  = 0;
 	int test_readall = 0;
 	const char *basedir;
@@ -535,7 +579,7 @@ int main (int argc, char **argv)
 	{
 		int c;
 
-		c = getopt (argc, argv, "htTC:"
+		c = getopt (argc, argv, "htTC:H:"
 #if COLLECT_DAEMON
 				"fP:"
 #endif
@@ -549,6 +593,9 @@ int main (int argc, char **argv)
 			case 'C':
 				configfile = optarg;
 				break;
+			case 'H':
+				handover_path = optarg;
+				break;
 			case 't':
 				test_config = 1;
 				break;
@@ -581,6 +628,13 @@ int main (int argc, char **argv)
 
 	plugin_init_ctx ();
 
+	/*
+	 * Receive the sockets of the running instance, if any, before the
+	 * plugins are configured and open them.
+	 */
+	if ((handover_path != NULL) && !test_config && !test_readall)
+		handover_receive (handover_path);
+
 	/*
 	 * Read options from the config file, the environment and the command
 	 * line (in that order, with later options overwriting previous ones in
@@ -726,6 +780,15 @@ int main (int argc, char **argv)
 		return (1);
 	}
 
+	memset (&sig_hup_action, '\0', sizeof (sig_hup_action));
+	sig_hup_action.sa_handler = sig_hup_handler;
+	if (0 != sigaction (SIGHUP, &sig_hup_action, NULL)) {
+		char errbuf[1024];
+		ERROR ("Error: Failed to install a signal handler for signal HUP: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (1);
+	}
+
 	/*
 	 * run the actual loops
 	 */
@@ -738,6 +801,9 @@ int main (int argc, char **argv)
 	}
 	else
 	{
+		if (handover_path != NULL)
+			handover_listen (handover_path);
+
 		INFO ("Initialization complete, entering read-loop.");
 		do_loop ();
 	}
@@ -746,9 +812,11 @@ int main (int argc, char **argv)
 	INFO ("Exiting normally.");
 
 	do_shutdown ();
+	handover_shutdown ();
 
 #if COLLECT_DAEMON
-	if (daemonize)
+	/* After a handover, the PID-file belongs to the new instance. */
+	if (daemonize && !handover_done ())
 		pidfile_remove ();
 #endif /* COLLECT_DAEMON */
 
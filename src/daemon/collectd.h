@@ -309,6 +309,8 @@ typedef int _Bool;
 
 #ifndef GAUGE_FORMAT
 # define GAUGE_FORMAT "%.15g"
+/* format_gauge() can only replace printf() for the default format. */
+# define GAUGE_FORMAT_DEFAULT 1
 #endif
 
 /* Type for time as used by "utils_time.h" */
@@ -50,6 +50,10 @@
 
 #include <poll.h>
 
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 #if HAVE_NETINET_IN_H
 # include <netinet/in.h>
 #endif
@@ -502,6 +506,79 @@ size_t strstripnewline (char *buffer)
 	return (buffer_len);
 } /* size_t strstripnewline */
 
+static _Bool strscan_match (unsigned char c, /* {{{ */
+    const char *reject, int flags)
+{
+  if ((c == 0) || (strchr (reject, (int) c) != NULL))
+    return (1);
+  if ((flags & STRSCAN_CONTROL) && (c < 0x20))
+    return (1);
+  if ((flags & STRSCAN_HIGH) && (c >= 0x80))
+    return (1);
+  return (0);
+} /* }}} _Bool strscan_match */
+
+#if defined(__SSE2__)
+/* The loads are aligned, so they never cross into another page, but may read
+ * beyond the end of the string and its allocation. */
+__attribute__((no_sanitize_address))
+static size_t strscan_sse2 (const char *str, /* {{{ */
+    const char *reject, int flags)
+{
+  const __m128i *ptr = (const __m128i *) (((uintptr_t) str) & ~((uintptr_t) 15));
+  unsigned int skip = (unsigned int) (((uintptr_t) str) & 15);
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i control = _mm_set1_epi8 (0x1f);
+  __m128i reject_v[4];
+  size_t reject_num;
+  unsigned int mask;
+  size_t i;
+
+  reject_num = strlen (reject);
+  for (i = 0; i < reject_num; i++)
+    reject_v[i] = _mm_set1_epi8 (reject[i]);
+
+  /* Ignore the bytes before the start of the string in the first block. */
+  mask = 0xffffU << skip;
+  while (42)
+  {
+    __m128i v = _mm_load_si128 (ptr);
+    __m128i hit = _mm_cmpeq_epi8 (v, zero);
+    unsigned int bits;
+
+    for (i = 0; i < reject_num; i++)
+      hit = _mm_or_si128 (hit, _mm_cmpeq_epi8 (v, reject_v[i]));
+    if (flags & STRSCAN_CONTROL) /* v <= 0x1f, unsigned */
+      hit = _mm_or_si128 (hit,
+          _mm_cmpeq_epi8 (_mm_min_epu8 (v, control), v));
+    if (flags & STRSCAN_HIGH)
+      hit = _mm_or_si128 (hit, _mm_cmplt_epi8 (v, zero));
+
+    bits = ((unsigned int) _mm_movemask_epi8 (hit)) & mask;
+    if (bits != 0)
+      return ((size_t) ((((const char *) ptr) - str) + __builtin_ctz (bits)));
+
+    mask = 0xffffU;
+    ptr++;
+  }
+} /* }}} size_t strscan_sse2 */
+#endif /* __SSE2__ */
+
+size_t strscan (const char *str, const char *reject, int flags) /* {{{ */
+{
+  size_t i;
+
+#if defined(__SSE2__)
+  if (strlen (reject) <= 4)
+    return (strscan_sse2 (str, reject, flags));
+#endif
+
+  for (i = 0; !strscan_match ((unsigned char) str[i], reject, flags); i++)
+    /* do nothing */;
+
+  return (i);
+} /* }}} size_t strscan */
+
 int escape_slashes (char *buffer, size_t buffer_size)
 {
 	size_t buffer_len;
@@ -953,6 +1030,262 @@ int format_name (char *ret, int ret_len,
   return (0);
 } /* int format_name */
 
+/* Exactly representable powers of ten. */
+static double const format_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define FORMAT_POW10_MAX 22
+
+/* Copies the "len" characters in "str" to "buffer" and returns "len", like
+ * snprintf() does. */
+static int format_copy (char *buffer, size_t buffer_size, /* {{{ */
+		char const *str, size_t len)
+{
+	if (buffer_size > 0)
+	{
+		size_t copy_len = (len < buffer_size) ? len : (buffer_size - 1);
+
+		memcpy (buffer, str, copy_len);
+		buffer[copy_len] = 0;
+	}
+
+	return ((int) len);
+} /* }}} int format_copy */
+
+/* Writes the decimal digits of "value" so that they end just before "end" and
+ * returns a pointer to the first digit. */
+static char *format_digits (char *end, uint64_t value) /* {{{ */
+{
+	do
+	{
+		*(--end) = (char) ('0' + (value % 10));
+		value /= 10;
+	} while (value != 0);
+
+	return (end);
+} /* }}} char *format_digits */
+
+int format_uint64 (char *buffer, size_t buffer_size, uint64_t value) /* {{{ */
+{
+	char tmp[32];
+	char *ptr = format_digits (tmp + sizeof (tmp), value);
+
+	return (format_copy (buffer, buffer_size, ptr,
+				(size_t) ((tmp + sizeof (tmp)) - ptr)));
+} /* }}} int format_uint64 */
+
+int format_int64 (char *buffer, size_t buffer_size, int64_t value) /* {{{ */
+{
+	char tmp[32];
+	char *ptr;
+
+	/* Negate as unsigned, INT64_MIN has no positive counterpart. */
+	if (value < 0)
+	{
+		ptr = format_digits (tmp + sizeof (tmp), 0 - (uint64_t) value);
+		*(--ptr) = '-';
+	}
+	else
+		ptr = format_digits (tmp + sizeof (tmp), (uint64_t) value);
+
+	return (format_copy (buffer, buffer_size, ptr,
+				(size_t) ((tmp + sizeof (tmp)) - ptr)));
+} /* }}} int format_int64 */
+
+/* Scales "value" by 10^-k, with a single correctly rounded operation. */
+static double format_scale (double value, int k) /* {{{ */
+{
+	if (k >= 0)
+		return (value / format_pow10[k]);
+	return (value * format_pow10[-k]);
+} /* }}} double format_scale */
+
+/* Rounds value * 10^-k, which must be below 2^50, to the nearest integer.
+ * "scaled" is the result of format_scale() and thus within 1/16 of the exact
+ * product or quotient. If that is too close to a tie, the sign of the
+ * exact difference to the tie decides, which fma() computes with a single
+ * rounding. Returns false for exact ties, which are left to printf. */
+static _Bool format_round (double value, int k, /* {{{ */
+		double scaled, uint64_t *ret)
+{
+	double tie;
+	double diff;
+
+	if (fabs ((scaled - floor (scaled)) - 0.5) >= 0.07)
+	{
+		*ret = (uint64_t) (scaled + 0.5);
+		return (1);
+	}
+
+	tie = floor (scaled) + 0.5;
+	if (k >= 0)
+		diff = fma (-tie, format_pow10[k], value);
+	else
+		diff = fma (value, format_pow10[-k], -tie);
+
+	if (diff == 0.0)
+		return (0);
+
+	*ret = ((uint64_t) floor (scaled)) + ((diff > 0.0) ? 1 : 0);
+	return (1);
+} /* }}} _Bool format_round */
+
+/* The number of digits of "%.15g". */
+#define FORMAT_GAUGE_PRECISION 15
+
+int format_gauge (char *buffer, size_t buffer_size, gauge_t value) /* {{{ */
+{
+#ifdef GAUGE_FORMAT_DEFAULT
+	char tmp[64];
+	char digits[FORMAT_GAUGE_PRECISION];
+	char *ptr = tmp;
+	double abs_value;
+	double scaled = 0.0;
+	uint64_t d;
+	int exp2;
+	int exp10;
+	int k = 0;
+	int last;
+	int i;
+
+	if (value == 0.0)
+		return (format_copy (buffer, buffer_size,
+					signbit (value) ? "-0" : "0",
+					signbit (value) ? 2 : 1));
+
+	abs_value = fabs (value);
+	/* Restricts the exponent to the exactly representable powers of ten and
+	 * excludes infinity and NaN. */
+	if (!(abs_value >= 1e-8) || !(abs_value < 1e36))
+		return (ssnprintf (buffer, buffer_size, GAUGE_FORMAT, value));
+
+	/* Scale the value to [1e14, 1e15), i.e. 15 digits before the decimal
+	 * point. The exponent is estimated from the binary exponent,
+	 * 78913 / 2^18 being log10(2), and may be off by one. */
+	frexp (abs_value, &exp2);
+	exp10 = ((exp2 - 1) * 78913) >> 18;
+	for (i = 0; i < 3; i++)
+	{
+		k = exp10 - (FORMAT_GAUGE_PRECISION - 1);
+		if ((k > FORMAT_POW10_MAX) || (k < -FORMAT_POW10_MAX))
+			break;
+
+		scaled = format_scale (abs_value, k);
+		if (scaled < 1e14)
+			exp10--;
+		else if (scaled >= 1e15)
+			exp10++;
+		else
+			break;
+	}
+
+	if ((scaled < 1e14) || (scaled >= 1e15)
+			|| !format_round (abs_value, k, scaled, &d))
+		return (ssnprintf (buffer, buffer_size, GAUGE_FORMAT, value));
+
+	/* Rounding up 999999999999999.5 adds a digit. */
+	if (d >= 1000000000000000ULL)
+	{
+		d /= 10;
+		exp10++;
+	}
+
+	for (i = FORMAT_GAUGE_PRECISION - 1; i >= 0; i--)
+	{
+		digits[i] = (char) ('0' + (d % 10));
+		d /= 10;
+	}
+
+	/* "%g" drops trailing zeros. */
+	for (last = FORMAT_GAUGE_PRECISION - 1; last > 0; last--)
+		if (digits[last] != '0')
+			break;
+
+	if (value < 0.0)
+		*(ptr++) = '-';
+
+	if ((exp10 < -4) || (exp10 >= FORMAT_GAUGE_PRECISION))
+	{
+		/* Exponential notation: d.dddde+XX */
+		*(ptr++) = digits[0];
+		if (last > 0)
+		{
+			*(ptr++) = '.';
+			memcpy (ptr, digits + 1, (size_t) last);
+			ptr += last;
+		}
+		*(ptr++) = 'e';
+		*(ptr++) = (exp10 < 0) ? '-' : '+';
+		if (exp10 < 0)
+			exp10 = -exp10;
+		*(ptr++) = (char) ('0' + (exp10 / 10));
+		*(ptr++) = (char) ('0' + (exp10 % 10));
+	}
+	else if (exp10 >= 0)
+	{
+		/* ddd.ddd */
+		memcpy (ptr, digits, (size_t) (exp10 + 1));
+		ptr += exp10 + 1;
+		if (last > exp10)
+		{
+			*(ptr++) = '.';
+			memcpy (ptr, digits + exp10 + 1, (size_t) (last - exp10));
+			ptr += last - exp10;
+		}
+	}
+	else
+	{
+		/* 0.000ddd */
+		*(ptr++) = '0';
+		*(ptr++) = '.';
+		for (i = exp10; i < -1; i++)
+			*(ptr++) = '0';
+		memcpy (ptr, digits, (size_t) (last + 1));
+		ptr += last + 1;
+	}
+
+	return (format_copy (buffer, buffer_size, tmp, (size_t) (ptr - tmp)));
+#else
+	return (ssnprintf (buffer, buffer_size, GAUGE_FORMAT, value));
+#endif
+} /* }}} int format_gauge */
+
+int format_fixed (char *buffer, size_t buffer_size, /* {{{ */
+		double value, int precision)
+{
+	char tmp[64];
+	char *end = tmp + sizeof (tmp);
+	char *ptr = end;
+	double scaled;
+	uint64_t d;
+	int i;
+
+	/* Infinity, NaN and values that don't fit into format_round() are left
+	 * to printf. */
+	if ((precision < 0) || (precision > 9))
+		return (ssnprintf (buffer, buffer_size, "%.*f", precision, value));
+	scaled = format_scale (fabs (value), -precision);
+	if (!(scaled < 1e15)
+			|| !format_round (fabs (value), -precision, scaled, &d))
+		return (ssnprintf (buffer, buffer_size, "%.*f", precision, value));
+
+	for (i = 0; i < precision; i++)
+	{
+		*(--ptr) = (char) ('0' + (d % 10));
+		d /= 10;
+	}
+	if (precision > 0)
+		*(--ptr) = '.';
+	ptr = format_digits (ptr, d);
+
+	/* printf prints the sign of negative values that round to zero, too. */
+	if (signbit (value))
+		*(--ptr) = '-';
+
+	return (format_copy (buffer, buffer_size, ptr, (size_t) (end - ptr)));
+} /* }}} int format_fixed */
+
 int format_values (char *ret, size_t ret_len, /* {{{ */
 		const data_set_t *ds, const value_list_t *vl,
 		_Bool store_rates)
@@ -960,64 +1293,79 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
         size_t offset = 0;
         int status;
         size_t i;
-        gauge_t *rates = NULL;
+        gauge_t const *rates = NULL;
+        gauge_t *rates_copy = NULL;
 
         assert (0 == strcmp (ds->type, vl->type));
 
         memset (ret, 0, ret_len);
 
-#define BUFFER_ADD(...) do { \
-        status = ssnprintf (ret + offset, ret_len - offset, \
+#define BUFFER_ADD_FUNC(func, ...) do { \
+        status = func (ret + offset, ret_len - offset, \
                         __VA_ARGS__); \
         if (status < 1) \
         { \
-                sfree (rates); \
+                sfree (rates_copy); \
                 return (-1); \
         } \
         else if (((size_t) status) >= (ret_len - offset)) \
         { \
-                sfree (rates); \
+                sfree (rates_copy); \
                 return (-1); \
         } \
         else \
                 offset += ((size_t) status); \
 } while (0)
+#define BUFFER_ADD_CHAR(c) do { \
+        if ((offset + 1) >= ret_len) \
+        { \
+                sfree (rates_copy); \
+                return (-1); \
+        } \
+        ret[offset++] = (c); \
+} while (0)
 
-        BUFFER_ADD ("%.3f", CDTIME_T_TO_DOUBLE (vl->time));
+        BUFFER_ADD_FUNC (format_fixed, CDTIME_T_TO_DOUBLE (vl->time), 3);
 
         for (i = 0; i < ds->ds_num; i++)
         {
+                BUFFER_ADD_CHAR (':');
+
                 if (ds->ds[i].type == DS_TYPE_GAUGE)
-                        BUFFER_ADD (":"GAUGE_FORMAT, vl->values[i].gauge);
+                        BUFFER_ADD_FUNC (format_gauge, vl->values[i].gauge);
                 else if (store_rates)
                 {
                         if (rates == NULL)
-                                rates = uc_get_rate (ds, vl);
+                                rates = uc_get_rate_dispatched (ds, vl);
+                        if (rates == NULL)
+                                rates = rates_copy = uc_get_rate (ds, vl);
                         if (rates == NULL)
                         {
                                 WARNING ("format_values: uc_get_rate failed.");
                                 return (-1);
                         }
-                        BUFFER_ADD (":"GAUGE_FORMAT, rates[i]);
+                        BUFFER_ADD_FUNC (format_gauge, rates[i]);
                 }
                 else if (ds->ds[i].type == DS_TYPE_COUNTER)
-                        BUFFER_ADD (":%llu", vl->values[i].counter);
+                        BUFFER_ADD_FUNC (format_uint64,
+                                        (uint64_t) vl->values[i].counter);
                 else if (ds->ds[i].type == DS_TYPE_DERIVE)
-                        BUFFER_ADD (":%"PRIi64, vl->values[i].derive);
+                        BUFFER_ADD_FUNC (format_int64, vl->values[i].derive);
                 else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-                        BUFFER_ADD (":%"PRIu64, vl->values[i].absolute);
+                        BUFFER_ADD_FUNC (format_uint64, vl->values[i].absolute);
                 else
                 {
                         ERROR ("format_values: Unknown data source type: %i",
                                         ds->ds[i].type);
-                        sfree (rates);
+                        sfree (rates_copy);
                         return (-1);
                 }
         } /* for ds->ds_num */
 
-#undef BUFFER_ADD
+#undef BUFFER_ADD_CHAR
+#undef BUFFER_ADD_FUNC
 
-        sfree (rates);
+        sfree (rates_copy);
         return (0);
 } /* }}} int format_values */
 
@@ -1067,80 +1415,188 @@ int parse_identifier (char *str, char **ret_host,
 	return (0);
 } /* int parse_identifier */
 
+/* Copies the "len" characters at "src" to "dest", failing instead of
+ * truncating them. */
+static int parse_identifier_field (char *dest, size_t dest_size, /* {{{ */
+		const char *src, size_t len)
+{
+	if (len >= dest_size)
+		return (ENAMETOOLONG);
+
+	memcpy (dest, src, len);
+	dest[len] = 0;
+	return (0);
+} /* }}} int parse_identifier_field */
+
+/* Splits "str" like parse_identifier() does, but copies the fields straight
+ * into "vl" instead of modifying a copy of "str". */
 int parse_identifier_vl (const char *str, value_list_t *vl) /* {{{ */
 {
-	char str_copy[6 * DATA_MAX_NAME_LEN];
-	char *host = NULL;
-	char *plugin = NULL;
-	char *plugin_instance = NULL;
-	char *type = NULL;
-	char *type_instance = NULL;
+	const char *plugin;
+	const char *plugin_end;
+	const char *plugin_instance;
+	const char *type;
+	const char *type_instance;
 	int status;
 
 	if ((str == NULL) || (vl == NULL))
 		return (EINVAL);
 
-	sstrncpy (str_copy, str, sizeof (str_copy));
+	plugin = strchr (str, '/');
+	if (plugin == NULL)
+		return (-1);
+	plugin++;
 
-	status = parse_identifier (str_copy, &host,
-			&plugin, &plugin_instance,
-			&type, &type_instance);
-	if (status != 0)
-		return (status);
-
-	sstrncpy (vl->host, host, sizeof (vl->host));
-	sstrncpy (vl->plugin, plugin, sizeof (vl->plugin));
-	sstrncpy (vl->plugin_instance,
-			(plugin_instance != NULL) ? plugin_instance : "",
-			sizeof (vl->plugin_instance));
-	sstrncpy (vl->type, type, sizeof (vl->type));
-	sstrncpy (vl->type_instance,
-			(type_instance != NULL) ? type_instance : "",
-			sizeof (vl->type_instance));
+	plugin_end = strchr (plugin, '/');
+	if (plugin_end == NULL)
+		return (-1);
+	type = plugin_end + 1;
 
-	return (0);
+	plugin_instance = memchr (plugin, '-', (size_t) (plugin_end - plugin));
+	if (plugin_instance == NULL)
+		plugin_instance = plugin_end;
+
+	type_instance = strchr (type, '-');
+	if (type_instance == NULL)
+		type_instance = type + strlen (type);
+
+	status = parse_identifier_field (vl->host, sizeof (vl->host),
+			str, (size_t) (plugin - 1 - str));
+	if (status == 0)
+		status = parse_identifier_field (vl->plugin, sizeof (vl->plugin),
+				plugin, (size_t) (plugin_instance - plugin));
+	if ((status == 0) && (plugin_instance < plugin_end))
+		status = parse_identifier_field (vl->plugin_instance,
+				sizeof (vl->plugin_instance), plugin_instance + 1,
+				(size_t) (plugin_end - plugin_instance - 1));
+	else if (status == 0)
+		vl->plugin_instance[0] = 0;
+	if (status == 0)
+		status = parse_identifier_field (vl->type, sizeof (vl->type),
+				type, (size_t) (type_instance - type));
+	if ((status == 0) && (*type_instance != 0))
+		status = parse_identifier_field (vl->type_instance,
+				sizeof (vl->type_instance), type_instance + 1,
+				strlen (type_instance + 1));
+	else if (status == 0)
+		vl->type_instance[0] = 0;
+
+	return (status);
 } /* }}} int parse_identifier_vl */
 
-int parse_value (const char *value_orig, value_t *ret_value, int ds_type)
+/* Parses the plain decimal integers "[+-]digits" with up to 18 digits, which
+ * can't overflow. Returns non-zero for everything else, e.g. hexadecimal and
+ * octal numbers, which are left to strtoull(3) and strtoll(3). */
+static int parse_integer_fast (const char *str, char **endptr, /* {{{ */
+		uint64_t *ret_value, _Bool *ret_negative)
 {
-  char *value;
-  char *endptr = NULL;
-  size_t value_len;
+	const char *ptr = str;
+	uint64_t value = 0;
+	size_t digits;
 
-  if (value_orig == NULL)
-    return (EINVAL);
+	*ret_negative = 0;
+	if ((*ptr == '-') || (*ptr == '+'))
+	{
+		*ret_negative = (*ptr == '-');
+		ptr++;
+	}
 
-  value = strdup (value_orig);
-  if (value == NULL)
-    return (ENOMEM);
-  value_len = strlen (value);
+	/* Leading zeros select the octal or hexadecimal base. */
+	if ((ptr[0] == '0') && (ptr[1] != 0) && !isspace ((int) ptr[1]))
+		return (-1);
 
-  while ((value_len > 0) && isspace ((int) value[value_len - 1]))
-  {
-    value[value_len - 1] = 0;
-    value_len--;
-  }
+	for (digits = 0; (ptr[digits] >= '0') && (ptr[digits] <= '9'); digits++)
+		value = 10 * value + (uint64_t) (ptr[digits] - '0');
+	if ((digits == 0) || (digits > 18))
+		return (-1);
+
+	*endptr = (char *) (ptr + digits);
+	*ret_value = value;
+	return (0);
+} /* }}} int parse_integer_fast */
+
+/* Parses "[+-]digits[.digits]" if the digits fit into the mantissa of a
+ * double and the number of decimals into the table of exact powers of ten.
+ * One division of two exact values is rounded correctly, so the result is
+ * the same as that of strtod(3). Returns non-zero for everything else,
+ * including exponents, "nan" and "inf". */
+static int parse_double_fast (const char *str, char **endptr, /* {{{ */
+		double *ret_value)
+{
+	const char *ptr = str;
+	_Bool negative = 0;
+	uint64_t mantissa = 0;
+	size_t digits = 0;
+	size_t decimals = 0;
+	double value;
+
+	if ((*ptr == '-') || (*ptr == '+'))
+	{
+		negative = (*ptr == '-');
+		ptr++;
+	}
+
+	for (; (*ptr >= '0') && (*ptr <= '9'); ptr++, digits++)
+		mantissa = 10 * mantissa + (uint64_t) (*ptr - '0');
+	if (*ptr == '.')
+	{
+		for (ptr++; (*ptr >= '0') && (*ptr <= '9'); ptr++, decimals++)
+			mantissa = 10 * mantissa + (uint64_t) (*ptr - '0');
+		digits += decimals;
+	}
+
+	if ((digits == 0) || (digits > 15) || (decimals > FORMAT_POW10_MAX)
+			|| (*ptr == 'e') || (*ptr == 'E')
+			|| (*ptr == 'x') || (*ptr == 'X'))
+		return (-1);
+
+	value = ((double) mantissa) / format_pow10[decimals];
+	*endptr = (char *) ptr;
+	*ret_value = negative ? -value : value;
+	return (0);
+} /* }}} int parse_double_fast */
+
+int parse_value (const char *value, value_t *ret_value, int ds_type)
+{
+  char *endptr = NULL;
+  uint64_t integer;
+  _Bool negative;
+  double gauge;
+
+  if (value == NULL)
+    return (EINVAL);
 
   switch (ds_type)
   {
     case DS_TYPE_COUNTER:
-      ret_value->counter = (counter_t) strtoull (value, &endptr, 0);
+      if (parse_integer_fast (value, &endptr, &integer, &negative) == 0)
+        ret_value->counter = (counter_t) (negative ? -integer : integer);
+      else
+        ret_value->counter = (counter_t) strtoull (value, &endptr, 0);
       break;
 
     case DS_TYPE_GAUGE:
-      ret_value->gauge = (gauge_t) strtod (value, &endptr);
+      if (parse_double_fast (value, &endptr, &gauge) == 0)
+        ret_value->gauge = (gauge_t) gauge;
+      else
+        ret_value->gauge = (gauge_t) strtod (value, &endptr);
       break;
 
     case DS_TYPE_DERIVE:
-      ret_value->derive = (derive_t) strtoll (value, &endptr, 0);
+      if (parse_integer_fast (value, &endptr, &integer, &negative) == 0)
+        ret_value->derive = negative ? -((derive_t) integer) : (derive_t) integer;
+      else
+        ret_value->derive = (derive_t) strtoll (value, &endptr, 0);
       break;
 
     case DS_TYPE_ABSOLUTE:
-      ret_value->absolute = (absolute_t) strtoull (value, &endptr, 0);
+      if (parse_integer_fast (value, &endptr, &integer, &negative) == 0)
+        ret_value->absolute = (absolute_t) (negative ? -integer : integer);
+      else
+        ret_value->absolute = (absolute_t) strtoull (value, &endptr, 0);
       break;
 
     default:
-      sfree (value);
       ERROR ("parse_value: Invalid data source type: %i.", ds_type);
       return -1;
   }
@@ -1148,57 +1604,66 @@ int parse_value (const char *value_orig, value_t *ret_value, int ds_type)
   if (value == endptr) {
     ERROR ("parse_value: Failed to parse string as %s: %s.",
         DS_TYPE_TO_STRING (ds_type), value);
-    sfree (value);
     return -1;
   }
-  else if ((NULL != endptr) && ('\0' != *endptr))
+
+  /* Trailing white space is ignored silently. */
+  while ((endptr != NULL) && isspace ((int) *endptr))
+    endptr++;
+  if ((NULL != endptr) && ('\0' != *endptr))
     INFO ("parse_value: Ignoring trailing garbage \"%s\" after %s value. "
         "Input string was \"%s\".",
-        endptr, DS_TYPE_TO_STRING (ds_type), value_orig);
+        endptr, DS_TYPE_TO_STRING (ds_type), value);
 
-  sfree (value);
   return 0;
 } /* int parse_value */
 
+/* Splits "buffer" at colons in place, skipping empty fields like strtok(3)
+ * does. */
 int parse_values (char *buffer, value_list_t *vl, const data_set_t *ds)
 {
 	size_t i;
-	char *dummy;
 	char *ptr;
-	char *saveptr;
+	char *next;
 
 	if ((buffer == NULL) || (vl == NULL) || (ds == NULL))
 		return EINVAL;
 
 	i = 0;
-	dummy = buffer;
-	saveptr = NULL;
 	vl->time = 0;
-	while ((ptr = strtok_r (dummy, ":", &saveptr)) != NULL)
+	for (ptr = buffer; ptr != NULL; ptr = next)
 	{
-		dummy = NULL;
-
-		if (i >= vl->values_len)
+		next = strchr (ptr, ':');
+		if (next != NULL)
 		{
-			/* Make sure i is invalid. */
-			i = 0;
-			break;
+			*next = 0;
+			next++;
 		}
 
+		if (*ptr == 0)
+			continue;
+
+		if (i >= vl->values_len)
+			return (-1);
+
 		if (vl->time == 0)
 		{
-			if (strcmp ("N", ptr) == 0)
+			if ((ptr[0] == 'N') && (ptr[1] == 0))
 				vl->time = cdtime ();
 			else
 			{
 				char *endptr = NULL;
 				double tmp;
 
-				errno = 0;
-				tmp = strtod (ptr, &endptr);
-				if ((errno != 0)                    /* Overflow */
-						|| (endptr == ptr)  /* Invalid string */
-						|| (endptr == NULL) /* This should not happen */
+				if (parse_double_fast (ptr, &endptr, &tmp) != 0)
+				{
+					errno = 0;
+					tmp = strtod (ptr, &endptr);
+					if ((errno != 0)            /* Overflow */
+							|| (endptr == NULL)) /* This should not happen */
+						return (-1);
+				}
+				if ((endptr == ptr)  /* Invalid string */
 						|| (*endptr != 0))  /* Trailing chars */
 					return (-1);
 
@@ -1208,15 +1673,16 @@ int parse_values (char *buffer, value_list_t *vl, const data_set_t *ds)
 			continue;
 		}
 
-		if ((strcmp ("U", ptr) == 0) && (ds->ds[i].type == DS_TYPE_GAUGE))
+		if ((ptr[0] == 'U') && (ptr[1] == 0)
+				&& (ds->ds[i].type == DS_TYPE_GAUGE))
 			vl->values[i].gauge = NAN;
 		else if (0 != parse_value (ptr, &vl->values[i], ds->ds[i].type))
 			return -1;
 
 		i++;
-	} /* while (strtok_r) */
+	}
 
-	if ((ptr != NULL) || (i == 0))
+	if (i == 0)
 		return (-1);
 	return (0);
 } /* int parse_values */
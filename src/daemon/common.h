@@ -256,6 +256,23 @@ int strunescape (char *buf, size_t buf_len);
 __attribute__((nonnull (1)))
 size_t strstripnewline (char *buffer);
 
+#define STRSCAN_CONTROL 0x01 /* bytes below 0x20 */
+#define STRSCAN_HIGH    0x02 /* bytes 0x80 and above */
+
+/*
+ * NAME
+ *   strscan
+ *
+ * DESCRIPTION
+ *   Returns the number of bytes at the beginning of `str' which are neither
+ *   one of the (at most four) bytes in `reject' nor in one of the classes
+ *   selected by `flags'. Like strcspn(3), but compares 16 bytes at a time
+ *   where SSE2 is available, so escaping functions can find out quickly that
+ *   there is nothing to escape and copy long runs at once.
+ */
+__attribute__((nonnull (1, 2)))
+size_t strscan (const char *str, const char *reject, int flags);
+
 /*
  * NAME
  *   timeval_cmp
@@ -314,6 +331,31 @@ int format_name (char *ret, int ret_len,
 #define FORMAT_VL(ret, ret_len, vl) \
 	format_name (ret, ret_len, (vl)->host, (vl)->plugin, (vl)->plugin_instance, \
 			(vl)->type, (vl)->type_instance)
+
+/*
+ * NAME
+ *   format_gauge
+ *   format_fixed
+ *   format_int64
+ *   format_uint64
+ *
+ * DESCRIPTION
+ *   Format numbers exactly like snprintf (3) with GAUGE_FORMAT, "%.*f",
+ *   PRIi64 and PRIu64, but several times faster. The decimal point is always
+ *   a dot, regardless of the locale. The rare values which need the exact
+ *   decimal arithmetic of printf to be rounded correctly are passed on to
+ *   snprintf. format_fixed supports a precision of up to 9 digits.
+ *
+ * RETURN VALUE
+ *   Like snprintf: the length of the formatted number. If this is not less
+ *   than `buffer_size', the output was truncated.
+ */
+int format_gauge (char *buffer, size_t buffer_size, gauge_t value);
+int format_fixed (char *buffer, size_t buffer_size, double value,
+		int precision);
+int format_int64 (char *buffer, size_t buffer_size, int64_t value);
+int format_uint64 (char *buffer, size_t buffer_size, uint64_t value);
+
 int format_values (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl,
 		_Bool store_rates);
@@ -321,6 +363,8 @@ int format_values (char *ret, size_t ret_len,
 int parse_identifier (char *str, char **ret_host,
 		char **ret_plugin, char **ret_plugin_instance,
 		char **ret_type, char **ret_type_instance);
+/* Like parse_identifier(), but copies the fields into "vl" without modifying
+ * "str". Returns ENAMETOOLONG if a field doesn't fit into "vl". */
 int parse_identifier_vl (const char *str, value_list_t *vl);
 int parse_value (const char *value, value_t *ret_value, int ds_type);
 int parse_values (char *buffer, value_list_t *vl, const data_set_t *ds);
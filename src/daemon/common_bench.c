@@ -0,0 +1,178 @@
+/**
+ * collectd - src/daemon/common_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+
+/*
+ * Compares format_gauge(), format_fixed() and format_int64() with the
+ * snprintf() calls they replace, using typical gauge values, and times
+ * parse_identifier_vl() and parse_values() on the identifiers and values of
+ * PUTVAL lines.
+ *
+ * Usage: bench_common [values]
+ */
+
+#include "collectd.h"
+#include "common.h"
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t values_num = 1000000;
+  double *values;
+  char buffer[64];
+  size_t len_printf;
+  size_t len_fast;
+  double start;
+  double t_printf;
+  double t_fast;
+  int status = 0;
+  size_t i;
+
+  if (argc > 1)
+    values_num = (size_t) atoi (argv[1]);
+  if (values_num < 1)
+  {
+    fprintf (stderr, "Usage: %s [values]\n", argv[0]);
+    return (1);
+  }
+
+  values = calloc (values_num, sizeof (*values));
+  if (values == NULL)
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+
+  /* Load averages, percentages, byte rates and temperatures. */
+  for (i = 0; i < values_num; i++)
+  {
+    switch (i % 4)
+    {
+      case 0: values[i] = ((double) (i % 1000)) / 100.0; break;
+      case 1: values[i] = 100.0 * ((double) (i % 997)) / 997.0; break;
+      case 2: values[i] = ((double) (i * 7919 % 1000003)) * 1024.0 / 3.0; break;
+      default: values[i] = ((double) (i % 800)) / 10.0 - 20.0; break;
+    }
+  }
+
+#define BENCH(name, slow, fast) do { \
+  len_printf = len_fast = 0; \
+  start = now (); \
+  for (i = 0; i < values_num; i++) \
+    len_printf += (size_t) slow; \
+  t_printf = now () - start; \
+  start = now (); \
+  for (i = 0; i < values_num; i++) \
+    len_fast += (size_t) fast; \
+  t_fast = now () - start; \
+  printf ("%-14s snprintf %6.1f ns, fast %6.1f ns\n", name, \
+      1e9 * t_printf / (double) values_num, \
+      1e9 * t_fast / (double) values_num); \
+  if (len_printf != len_fast) \
+    status = 1; \
+} while (0)
+
+  BENCH ("GAUGE_FORMAT",
+      snprintf (buffer, sizeof (buffer), GAUGE_FORMAT, values[i]),
+      format_gauge (buffer, sizeof (buffer), values[i]));
+  BENCH ("%f",
+      snprintf (buffer, sizeof (buffer), "%f", values[i]),
+      format_fixed (buffer, sizeof (buffer), values[i], 6));
+  BENCH ("PRIi64",
+      snprintf (buffer, sizeof (buffer), "%"PRIi64, (int64_t) values[i]),
+      format_int64 (buffer, sizeof (buffer), (int64_t) values[i]));
+
+#undef BENCH
+
+  /* The identifier and values of "PUTVAL" lines, as written by the exec and
+   * unixsock plugins. */
+  {
+    data_source_t dsrc[2] = {
+      { "rx", DS_TYPE_DERIVE, 0.0, NAN },
+      { "tx", DS_TYPE_DERIVE, 0.0, NAN },
+    };
+    data_set_t ds_derive = { "if_octets", 2, dsrc };
+    data_source_t gsrc = { "value", DS_TYPE_GAUGE, 0.0, NAN };
+    data_set_t ds_gauge = { "gauge", 1, &gsrc };
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t vl_values[2];
+    char ident[6 * DATA_MAX_NAME_LEN];
+    char line[128];
+    double t_ident;
+    double t_values;
+
+    vl.values = vl_values;
+
+    t_ident = t_values = 0.0;
+    for (i = 0; i < values_num; i++)
+    {
+      data_set_t *ds = (i % 2) ? &ds_derive : &ds_gauge;
+
+      if (i % 2)
+      {
+        snprintf (ident, sizeof (ident),
+            "host%zu.example.com/interface-eth%zu/if_octets",
+            i % 1000, i % 4);
+        snprintf (line, sizeof (line), "1466000000.%03zu:%zu:%zu",
+            i % 1000, i * 7919, i * 104729);
+      }
+      else
+      {
+        snprintf (ident, sizeof (ident),
+            "host%zu.example.com/exec-app/gauge-latency_%zu",
+            i % 1000, i % 16);
+        snprintf (line, sizeof (line), "N:%g", values[i]);
+      }
+
+      start = now ();
+      if (parse_identifier_vl (ident, &vl) != 0)
+        status = 1;
+      t_ident += now () - start;
+
+      vl.values_len = ds->ds_num;
+      start = now ();
+      if (parse_values (line, &vl, ds) != 0)
+        status = 1;
+      t_values += now () - start;
+    }
+
+    /* The clock is read for each call, which is included in the times. */
+    printf ("%-14s %6.1f ns\n", "identifier",
+        1e9 * t_ident / (double) values_num);
+    printf ("%-14s %6.1f ns\n", "values",
+        1e9 * t_values / (double) values_num);
+  }
+
+  sfree (values);
+
+  return (status);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
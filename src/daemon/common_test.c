@@ -27,6 +27,8 @@
 #include "common.h"
 #include "testing.h"
 
+#include <sys/mman.h>
+
 #if HAVE_LIBKSTAT
 kstat_ctl_t *kc;
 #endif /* HAVE_LIBKSTAT */
@@ -244,6 +246,58 @@ DEF_TEST(escape_string)
   return 0;
 }
 
+DEF_TEST(strscan)
+{
+  char buffer[64];
+  char *page;
+  long page_size = sysconf (_SC_PAGESIZE);
+  size_t i;
+
+  EXPECT_EQ_UINT64 (0, strscan ("", "/", 0));
+  EXPECT_EQ_UINT64 (11, strscan ("host.domain", "/", 0));
+  EXPECT_EQ_UINT64 (4, strscan ("host.domain", "./", 0));
+  EXPECT_EQ_UINT64 (3, strscan ("foo\tbar", "", STRSCAN_CONTROL));
+  EXPECT_EQ_UINT64 (2, strscan ("ab\xc3\xa4", "", STRSCAN_HIGH));
+  EXPECT_EQ_UINT64 (4, strscan ("ab\xc3\xa4", "", STRSCAN_CONTROL));
+
+  /* Every position and alignment, before and after 16 byte boundaries. */
+  for (i = 0; i < 20; i++)
+  {
+    size_t offset;
+
+    for (offset = 0; offset < 16; offset++)
+    {
+      memset (buffer, 'x', sizeof (buffer));
+      buffer[sizeof (buffer) - 1] = 0;
+      buffer[offset + i] = '"';
+      EXPECT_EQ_UINT64 (i, strscan (buffer + offset, "\\\"", 0));
+      buffer[offset + i] = 0x1b;
+      EXPECT_EQ_UINT64 (i, strscan (buffer + offset, "\\\"", STRSCAN_CONTROL));
+      /* Without a match, the terminating null byte is found. */
+      buffer[offset + i] = 'x';
+      EXPECT_EQ_UINT64 (sizeof (buffer) - 1 - offset,
+          strscan (buffer + offset, "\\\"", STRSCAN_CONTROL));
+    }
+  }
+
+  /* A string ending right before an inaccessible page. */
+  page = mmap (NULL, 2 * page_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  OK (page != MAP_FAILED);
+  OK (mprotect (page + page_size, page_size, PROT_NONE) == 0);
+  for (i = 1; i < 20; i++)
+  {
+    char *str = page + page_size - i;
+
+    memset (str, 'a', i - 1);
+    str[i - 1] = 0;
+    EXPECT_EQ_UINT64 (i - 1, strscan (str, "/", STRSCAN_CONTROL));
+  }
+  munmap (page, 2 * page_size);
+
+  return 0;
+}
+
 DEF_TEST(strunescape)
 {
   char buffer[16];
@@ -300,6 +354,9 @@ DEF_TEST(parse_values)
     {"N:42.0:23",        -1,  NAN},
     {"N:U",               0,  NAN},
     {"T:42.0",           -1,  NAN},
+    {"1435044576.5::42",  0, 42.0},
+    {"1435044576:",      -1,  NAN},
+    {"1435044576x:42",   -1,  NAN},
   };
 
   size_t i;
@@ -342,6 +399,82 @@ DEF_TEST(parse_values)
   return (0);
 }
 
+DEF_TEST(parse_identifier_vl)
+{
+  struct {
+    char const *str;
+    int status;
+    char const *fields[5];
+  } cases[] = {
+    {"example.com/cpu-0/cpu-idle", 0,
+      {"example.com", "cpu", "0", "cpu", "idle"}},
+    {"example.com/load/load", 0,
+      {"example.com", "load", "", "load", ""}},
+    {"example.com/exec-a-b/gauge-c-d", 0,
+      {"example.com", "exec", "a-b", "gauge", "c-d"}},
+    {"example.com/df-/mnt/df_complex-free", 0,
+      {"example.com", "df", "", "mnt/df_complex", "free"}},
+    {"/plugin/type", 0, {"", "plugin", "", "type", ""}},
+    {"example.com/load", -1, {NULL}},
+    {"example.com", -1, {NULL}},
+    {"example.com/"
+      "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+      "/load", ENAMETOOLONG, {NULL}},
+  };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+  {
+    value_list_t vl = VALUE_LIST_INIT;
+
+    EXPECT_EQ_INT (cases[i].status, parse_identifier_vl (cases[i].str, &vl));
+    if (cases[i].status != 0)
+      continue;
+
+    EXPECT_EQ_STR (cases[i].fields[0], vl.host);
+    EXPECT_EQ_STR (cases[i].fields[1], vl.plugin);
+    EXPECT_EQ_STR (cases[i].fields[2], vl.plugin_instance);
+    EXPECT_EQ_STR (cases[i].fields[3], vl.type);
+    EXPECT_EQ_STR (cases[i].fields[4], vl.type_instance);
+  }
+
+  return (0);
+}
+
+/* The fast paths must give the same results as strtod() and strtoll(). */
+DEF_TEST(parse_value)
+{
+  char const *gauges[] = {
+    "0", "-0", "42", "12.3", "-0.1", "0.30000000000000004", "123456.789012345",
+    "1e3", ".5", "5.", "+7.25", "nan", "-inf", "0x10", "3.14 ", " 2.5",
+    "99999999999999999999", "1.23456789012345678",
+  };
+  char const *derives[] = {
+    "0", "-1", "42", "+42", "010", "0x1F", "123456789012345678",
+    "-9223372036854775808", "9223372036854775807", "7 ", "12.5",
+  };
+  value_t v;
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (gauges); i++)
+  {
+    CHECK_ZERO (parse_value (gauges[i], &v, DS_TYPE_GAUGE));
+    EXPECT_EQ_DOUBLE (strtod (gauges[i], NULL), v.gauge);
+  }
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (derives); i++)
+  {
+    CHECK_ZERO (parse_value (derives[i], &v, DS_TYPE_DERIVE));
+    EXPECT_EQ_UINT64 ((uint64_t) strtoll (derives[i], NULL, 0),
+        (uint64_t) v.derive);
+  }
+
+  EXPECT_EQ_INT (-1, parse_value ("abc", &v, DS_TYPE_GAUGE));
+  EXPECT_EQ_INT (-1, parse_value ("", &v, DS_TYPE_DERIVE));
+
+  return (0);
+}
+
 DEF_TEST(value_to_rate)
 {
   struct {
@@ -380,6 +513,108 @@ DEF_TEST(value_to_rate)
   return 0;
 }
 
+DEF_TEST(format_gauge)
+{
+  struct {
+    gauge_t value;
+    char *want;
+  } cases[] = {
+    {0.0,                  "0"},
+    {-0.0,                 "-0"},
+    {1.0,                  "1"},
+    {-42.0,                "-42"},
+    {0.1,                  "0.1"},
+    {0.1 + 0.2,            "0.3"},
+    {1.0 / 3.0,            "0.333333333333333"},
+    {123456.789,           "123456.789"},
+    {0.0001234,            "0.0001234"},
+    {0.00001234,           "1.234e-05"},
+    {1e15,                 "1e+15"},
+    {999999999999999.0,    "999999999999999"},
+    {9999999999999999.0,   "1e+16"},
+    {1.5e-300,             "1.5e-300"},
+    {1e300,                "1e+300"},
+    {NAN,                  "nan"},
+    {INFINITY,             "inf"},
+    {-INFINITY,            "-inf"},
+  };
+  uint64_t state = 88172645463325252ULL;
+  int mismatches = 0;
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++) {
+    char buffer[64];
+
+    format_gauge (buffer, sizeof (buffer), cases[i].value);
+    EXPECT_EQ_STR (cases[i].want, buffer);
+  }
+
+  /* Compare with printf for random bit patterns and decimal fractions,
+   * including many values near a rounding tie. */
+  for (i = 0; i < 100000; i++) {
+    char want[64];
+    char got[64];
+    double value;
+    uint64_t bits;
+    int precision;
+
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    bits = state;
+
+    if (i % 3 == 0)
+      memcpy (&value, &bits, sizeof (value));
+    else if (i % 3 == 1)
+      value = ((double) (int64_t) (bits % 2000000001ULL) - 1e9) / 100.0;
+    else
+      value = ((double) (bits % 1000000) + 0.5) / pow (10, (int) (bits >> 60));
+
+    snprintf (want, sizeof (want), GAUGE_FORMAT, value);
+    format_gauge (got, sizeof (got), value);
+    if (strcmp (want, got) != 0) {
+      printf ("# format_gauge (%.17g) = \"%s\", want \"%s\"\n",
+          value, got, want);
+      mismatches++;
+    }
+
+    precision = (int) (bits >> 61);
+    snprintf (want, sizeof (want), "%.*f", precision, value);
+    format_fixed (got, sizeof (got), value, precision);
+    if (strcmp (want, got) != 0) {
+      printf ("# format_fixed (%.17g, %d) = \"%s\", want \"%s\"\n",
+          value, precision, got, want);
+      mismatches++;
+    }
+  }
+  EXPECT_EQ_INT (0, mismatches);
+
+  return 0;
+}
+
+DEF_TEST(format_integers)
+{
+  char buffer[32];
+  char small[4];
+
+  EXPECT_EQ_INT (1, format_uint64 (buffer, sizeof (buffer), 0));
+  EXPECT_EQ_STR ("0", buffer);
+  EXPECT_EQ_INT (20, format_uint64 (buffer, sizeof (buffer), UINT64_MAX));
+  EXPECT_EQ_STR ("18446744073709551615", buffer);
+  EXPECT_EQ_INT (2, format_int64 (buffer, sizeof (buffer), -1));
+  EXPECT_EQ_STR ("-1", buffer);
+  EXPECT_EQ_INT (20, format_int64 (buffer, sizeof (buffer), INT64_MIN));
+  EXPECT_EQ_STR ("-9223372036854775808", buffer);
+
+  /* Truncated like snprintf. */
+  EXPECT_EQ_INT (5, format_int64 (small, sizeof (small), 12345));
+  EXPECT_EQ_STR ("123", small);
+  EXPECT_EQ_INT (7, format_gauge (small, sizeof (small), 3.14159));
+  EXPECT_EQ_STR ("3.1", small);
+
+  return 0;
+}
+
 int main (void)
 {
   RUN_TEST(sstrncpy);
@@ -389,9 +624,14 @@ int main (void)
   RUN_TEST(strjoin);
   RUN_TEST(escape_slashes);
   RUN_TEST(escape_string);
+  RUN_TEST(strscan);
   RUN_TEST(strunescape);
+  RUN_TEST(parse_identifier_vl);
+  RUN_TEST(parse_value);
   RUN_TEST(parse_values);
   RUN_TEST(value_to_rate);
+  RUN_TEST(format_gauge);
+  RUN_TEST(format_integers);
 
   END_TEST;
 }
@@ -34,6 +34,7 @@
 #include "configfile.h"
 #include "types_list.h"
 #include "filter_chain.h"
+#include "utils_rollup.h"
 
 #if HAVE_WORDEXP_H
 # include <wordexp.h>
@@ -66,6 +67,7 @@ typedef struct cf_complex_callback_s
 {
 	char *type;
 	int (*callback) (oconfig_item_t *);
+	int (*reload) (oconfig_item_t *);
 	plugin_ctx_t ctx;
 	struct cf_complex_callback_s *next;
 } cf_complex_callback_t;
@@ -97,6 +99,19 @@ static int dispatch_block_plugin (oconfig_item_t *ci);
 static cf_callback_t *first_callback = NULL;
 static cf_complex_callback_t *complex_callback_head = NULL;
 
+/* The configuration currently in effect, compared to the new one by
+ * cf_reload(). */
+static oconfig_item_t *cf_current_config = NULL;
+
+/* Global options applied together with the <Chain> blocks by cf_reload(). */
+static const char *cf_chain_options[] =
+{
+	"PreCacheChain",
+	"PostCacheChain",
+	"FilterChainCacheSize"
+};
+static int cf_chain_options_num = STATIC_ARRAY_SIZE (cf_chain_options);
+
 static cf_value_map_t cf_value_map[] =
 {
 	{"TypesDB",    dispatch_value_typesdb},
@@ -114,15 +129,35 @@ static cf_global_option_t cf_global_options[] =
 	{"FQDNLookup",  NULL, "true"},
 	{"Interval",    NULL, NULL},
 	{"ReadThreads", NULL, "5"},
+	{"ReadThreadsCPUs", NULL, NULL},
+	{"InitThreads", NULL, "1"},
+	{"InitTimeout", NULL, "60"},
+	{"LogQueueLength", NULL, "0"},
+	{"NotificationQueueLength", NULL, "0"},
 	{"WriteThreads", NULL, "5"},
+	{"WriteThreadsCPUs", NULL, NULL},
+	{"WriteQueueByIdentifier", NULL, "false"},
+	{"PluginThreadsCPUs", NULL, NULL},
 	{"WriteQueueLimitHigh", NULL, NULL},
 	{"WriteQueueLimitLow", NULL, NULL},
+	{"WriteBatchSize", NULL, "64"},
+	{"SeriesLimit", NULL, "0"},
+	{"PluginMemoryLimit", NULL, "0"},
 	{"Timeout",     NULL, "2"},
+	{"CacheFile",   NULL, NULL},
+	{"CacheSharedMemory", NULL, NULL},
+	{"CacheSharedMemorySlots", NULL, NULL},
+	{"CompressHistory", NULL, "false"},
 	{"AutoLoadPlugin", NULL, "false"},
 	{"CollectInternalStats", NULL, "false"},
+	{"WriteDelayWarning", NULL, "0"},
+	{"ReadPhaseSpread", NULL, "false"},
+	{"ReadBackoff", NULL, "false"},
 	{"PreCacheChain",  NULL, "PreCache"},
 	{"PostCacheChain", NULL, "PostCache"},
-	{"MaxReadInterval", NULL, "86400"}
+	{"FilterChainCacheSize", NULL, "0"},
+	{"MaxReadInterval", NULL, "86400"},
+	{"TypesDBCache", NULL, NULL}
 };
 static int cf_global_options_num = STATIC_ARRAY_SIZE (cf_global_options);
 
@@ -267,6 +302,88 @@ static int dispatch_value_plugindir (oconfig_item_t *ci)
 	return (0);
 }
 
+static int cf_get_write_queue_policy (oconfig_item_t const *ci, /* {{{ */
+		int *ret_policy)
+{
+	char buffer[32];
+	int status;
+
+	status = cf_util_get_string_buffer (ci, buffer, sizeof (buffer));
+	if (status != 0)
+		return (status);
+
+	if (strcasecmp ("DropNewest", buffer) == 0)
+		*ret_policy = PLUGIN_WRITE_QUEUE_DROP_NEWEST;
+	else if (strcasecmp ("DropOldest", buffer) == 0)
+		*ret_policy = PLUGIN_WRITE_QUEUE_DROP_OLDEST;
+	else if (strcasecmp ("Block", buffer) == 0)
+		*ret_policy = PLUGIN_WRITE_QUEUE_BLOCK;
+	else
+	{
+		ERROR ("The %s option must be one of \"DropNewest\", "
+				"\"DropOldest\" and \"Block\", got \"%s\".",
+				ci->key, buffer);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int cf_get_write_queue_policy */
+
+static int cf_get_read_priority (oconfig_item_t const *ci, /* {{{ */
+		int *ret_priority)
+{
+	char buffer[32];
+	int status;
+
+	status = cf_util_get_string_buffer (ci, buffer, sizeof (buffer));
+	if (status != 0)
+		return (status);
+
+	if (strcasecmp ("Normal", buffer) == 0)
+		*ret_priority = PLUGIN_READ_PRIORITY_NORMAL;
+	else if (strcasecmp ("Low", buffer) == 0)
+		*ret_priority = PLUGIN_READ_PRIORITY_LOW;
+	else if (strcasecmp ("High", buffer) == 0)
+		*ret_priority = PLUGIN_READ_PRIORITY_HIGH;
+	else
+	{
+		ERROR ("The %s option must be one of \"Low\", \"Normal\" "
+				"and \"High\", got \"%s\".", ci->key, buffer);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int cf_get_read_priority */
+
+static int cf_get_write_rollup (oconfig_item_t const *ci, /* {{{ */
+		int *ret_function)
+{
+	char buffer[32];
+	int status;
+
+	status = cf_util_get_string_buffer (ci, buffer, sizeof (buffer));
+	if (status != 0)
+		return (status);
+
+	if (strcasecmp ("Average", buffer) == 0)
+		*ret_function = ROLLUP_AVERAGE;
+	else if (strcasecmp ("Minimum", buffer) == 0)
+		*ret_function = ROLLUP_MINIMUM;
+	else if (strcasecmp ("Maximum", buffer) == 0)
+		*ret_function = ROLLUP_MAXIMUM;
+	else if (strcasecmp ("Last", buffer) == 0)
+		*ret_function = ROLLUP_LAST;
+	else
+	{
+		ERROR ("The %s option must be one of \"Average\", "
+				"\"Minimum\", \"Maximum\" and \"Last\", "
+				"got \"%s\".", ci->key, buffer);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int cf_get_write_rollup */
+
 static int dispatch_loadplugin (oconfig_item_t *ci)
 {
 	int i;
@@ -292,6 +409,8 @@ static int dispatch_loadplugin (oconfig_item_t *ci)
 	ctx.interval = cf_get_default_interval ();
 	ctx.flush_interval = 0;
 	ctx.flush_timeout = 0;
+	ctx.write_queue_limit_low = -1;
+	ctx.write_queue_policy = PLUGIN_WRITE_QUEUE_DROP_NEWEST;
 
 	for (i = 0; i < ci->children_num; ++i)
 	{
@@ -305,6 +424,25 @@ static int dispatch_loadplugin (oconfig_item_t *ci)
 			cf_util_get_cdtime (child, &ctx.flush_interval);
 		else if (strcasecmp ("FlushTimeout", child->key) == 0)
 			cf_util_get_cdtime (child, &ctx.flush_timeout);
+		else if (strcasecmp ("ReadThreads", child->key) == 0)
+			cf_util_get_int (child, &ctx.read_threads);
+		else if (strcasecmp ("ReadPriority", child->key) == 0)
+			cf_get_read_priority (child, &ctx.read_priority);
+		else if (strcasecmp ("DispatchPriority", child->key) == 0)
+			cf_get_read_priority (child, &ctx.dispatch_priority);
+		else if (strcasecmp ("WriteThreads", child->key) == 0)
+			cf_util_get_int (child, &ctx.write_threads);
+		else if (strcasecmp ("WriteQueueLimitHigh", child->key) == 0)
+			cf_util_get_int (child, &ctx.write_queue_limit_high);
+		else if (strcasecmp ("WriteQueueLimitLow", child->key) == 0)
+			cf_util_get_int (child, &ctx.write_queue_limit_low);
+		else if (strcasecmp ("WriteQueuePolicy", child->key) == 0)
+			cf_get_write_queue_policy (child,
+					&ctx.write_queue_policy);
+		else if (strcasecmp ("WriteResolution", child->key) == 0)
+			cf_util_get_cdtime (child, &ctx.write_resolution);
+		else if (strcasecmp ("WriteRollup", child->key) == 0)
+			cf_get_write_rollup (child, &ctx.write_rollup);
 		else {
 			WARNING("Ignoring unknown LoadPlugin option \"%s\" "
 					"for plugin \"%s\"",
@@ -474,87 +612,6 @@ static int dispatch_block (oconfig_item_t *ci)
 	return (0);
 }
 
-static int cf_ci_replace_child (oconfig_item_t *dst, oconfig_item_t *src,
-		int offset)
-{
-	oconfig_item_t *temp;
-	int i;
-
-	assert (offset >= 0);
-	assert (dst->children_num > offset);
-
-	/* Free the memory used by the replaced child. Usually that's the
-	 * `Include "blah"' statement. */
-	temp = dst->children + offset;
-	for (i = 0; i < temp->values_num; i++)
-	{
-		if (temp->values[i].type == OCONFIG_TYPE_STRING)
-		{
-			sfree (temp->values[i].value.string);
-		}
-	}
-	sfree (temp->values);
-	temp = NULL;
-
-	/* If (src->children_num == 0) the array size is decreased. If offset
-	 * is _not_ the last element, (offset < (dst->children_num - 1)), then
-	 * we need to move the trailing elements before resizing the array. */
-	if ((src->children_num == 0) && (offset < (dst->children_num - 1)))
-	{
-		int nmemb = dst->children_num - (offset + 1);
-		memmove (dst->children + offset, dst->children + offset + 1,
-				sizeof (oconfig_item_t) * nmemb);
-	}
-
-	/* Resize the memory containing the children to be big enough to hold
-	 * all children. */
-	if (dst->children_num + src->children_num - 1 == 0)
-	{
-		dst->children_num = 0;
-		return (0);
-	}
-
-	temp = (oconfig_item_t *) realloc (dst->children,
-			sizeof (oconfig_item_t)
-			* (dst->children_num + src->children_num - 1));
-	if (temp == NULL)
-	{
-		ERROR ("configfile: realloc failed.");
-		return (-1);
-	}
-	dst->children = temp;
-
-	/* If there are children behind the include statement, and they have
-	 * not yet been moved because (src->children_num == 0), then move them
-	 * to the end of the list, so that the new children have room before
-	 * them. */
-	if ((src->children_num > 0)
-			&& ((dst->children_num - (offset + 1)) > 0))
-	{
-		int nmemb = dst->children_num - (offset + 1);
-		int old_offset = offset + 1;
-		int new_offset = offset + src->children_num;
-
-		memmove (dst->children + new_offset,
-				dst->children + old_offset,
-				sizeof (oconfig_item_t) * nmemb);
-	}
-
-	/* Last but not least: If there are new children, copy them to the
-	 * memory reserved for them. */
-	if (src->children_num > 0)
-	{
-		memcpy (dst->children + offset,
-				src->children,
-				sizeof (oconfig_item_t) * src->children_num);
-	}
-
-	/* Update the number of children. */
-	dst->children_num += (src->children_num - 1);
-
-	return (0);
-} /* int cf_ci_replace_child */
-
 static int cf_ci_append_children (oconfig_item_t *dst, oconfig_item_t *src)
 {
 	oconfig_item_t *temp;
@@ -585,28 +642,52 @@ static int cf_ci_append_children (oconfig_item_t *dst, oconfig_item_t *src)
 static oconfig_item_t *cf_read_generic (const char *path,
 		const char *pattern, int depth);
 
+/* Replaces the `Include' statements of `root' with the children of the included
+ * files. The list of children is copied once, instead of moving the trailing
+ * children for every `Include'. */
 static int cf_include_all (oconfig_item_t *root, int depth)
 {
+	oconfig_item_t *children;
+	int children_num = 0;
+	int children_alloc;
+	int status = 0;
 	int i;
 
+	for (i = 0; i < root->children_num; i++)
+		if (strcasecmp (root->children[i].key, "Include") == 0)
+			break;
+	if (i >= root->children_num)
+		return (0);
+
+	/* Room for all children without includes. */
+	children_alloc = root->children_num;
+	children = malloc (sizeof (*children) * children_alloc);
+	if (children == NULL)
+	{
+		ERROR ("configfile: malloc failed.");
+		return (-1);
+	}
+
 	for (i = 0; i < root->children_num; i++)
 	{
-		oconfig_item_t *new;
-		oconfig_item_t *old;
+		oconfig_item_t *old = root->children + i;
+		oconfig_item_t *new = NULL;
 
 		char *pattern = NULL;
 
 		int j;
 
-		if (strcasecmp (root->children[i].key, "Include") != 0)
+		if ((status != 0) || (strcasecmp (old->key, "Include") != 0))
+		{
+			children[children_num++] = *old;
 			continue;
-
-		old = root->children + i;
+		}
 
 		if ((old->values_num != 1)
 				|| (old->values[0].type != OCONFIG_TYPE_STRING))
 		{
 			ERROR ("configfile: `Include' needs exactly one string argument.");
+			children[children_num++] = *old;
 			continue;
 		}
 
@@ -625,23 +706,59 @@ static int cf_include_all (oconfig_item_t *root, int depth)
 		sfree (pattern);
 
 		if (new == NULL)
-			return (-1);
+		{
+			status = -1;
+			children[children_num++] = *old;
+			continue;
+		}
 
-		/* Now replace the i'th child in `root' with `new'. */
-		if (cf_ci_replace_child (root, new, i) < 0) {
-			sfree (new->values);
-			sfree (new);
-			return (-1);
+		/* The `Include' statement itself is dropped, the children of the
+		 * remaining statements must still fit. */
+		if (children_num + new->children_num + (root->children_num - i - 1)
+				> children_alloc)
+		{
+			int alloc = children_num + new->children_num
+				+ (root->children_num - i - 1);
+			oconfig_item_t *tmp;
+
+			if (alloc < 2 * children_alloc)
+				alloc = 2 * children_alloc;
+
+			tmp = realloc (children, sizeof (*children) * alloc);
+			if (tmp == NULL)
+			{
+				ERROR ("configfile: realloc failed.");
+				oconfig_free (new);
+				status = -1;
+				children[children_num++] = *old;
+				continue;
+			}
+			children = tmp;
+			children_alloc = alloc;
 		}
 
-		/* ... and go back to the new i'th child. */
-		--i;
+		if (new->children_num > 0)
+			memcpy (children + children_num, new->children,
+					sizeof (*children) * new->children_num);
+		children_num += new->children_num;
+
+		/* Free the memory used by the `Include' statement. */
+		for (j = 0; j < old->values_num; j++)
+			if (old->values[j].type == OCONFIG_TYPE_STRING)
+				sfree (old->values[j].value.string);
+		sfree (old->values);
+		sfree (old->key);
 
 		sfree (new->values);
+		sfree (new->children);
 		sfree (new);
 	} /* for (i = 0; i < root->children_num; i++) */
 
-	return (0);
+	sfree (root->children);
+	root->children = children;
+	root->children_num = children_num;
+
+	return (status);
 } /* int cf_include_all */
 
 static oconfig_item_t *cf_read_file (const char *file,
@@ -924,6 +1041,289 @@ static oconfig_item_t *cf_read_generic (const char *path,
 } /* oconfig_item_t *cf_read_generic */
 #endif /* !HAVE_WORDEXP_H */
 
+/*
+ * Configuration reload
+ *
+ * cf_reload() splits the top level items into three classes: the filter
+ * chains and their options, the <Plugin> blocks of each plugin and everything
+ * else. Only classes that differ from the current configuration are applied.
+ */
+#define CF_RELOAD_OTHER  0
+#define CF_RELOAD_CHAIN  1
+#define CF_RELOAD_PLUGIN 2
+
+static _Bool cf_value_equal (const oconfig_value_t *a, /* {{{ */
+		const oconfig_value_t *b)
+{
+	if (a->type != b->type)
+		return (0);
+
+	if (a->type == OCONFIG_TYPE_STRING)
+		return (strcmp (a->value.string, b->value.string) == 0);
+	else if (a->type == OCONFIG_TYPE_NUMBER)
+		return (a->value.number == b->value.number);
+	else if (a->type == OCONFIG_TYPE_BOOLEAN)
+		return (a->value.boolean == b->value.boolean);
+
+	return (0);
+} /* }}} _Bool cf_value_equal */
+
+static _Bool cf_ci_equal (const oconfig_item_t *a, /* {{{ */
+		const oconfig_item_t *b)
+{
+	int i;
+
+	if ((strcasecmp (a->key, b->key) != 0)
+			|| (a->values_num != b->values_num)
+			|| (a->children_num != b->children_num))
+		return (0);
+
+	for (i = 0; i < a->values_num; i++)
+		if (!cf_value_equal (a->values + i, b->values + i))
+			return (0);
+
+	for (i = 0; i < a->children_num; i++)
+		if (!cf_ci_equal (a->children + i, b->children + i))
+			return (0);
+
+	return (1);
+} /* }}} _Bool cf_ci_equal */
+
+static int cf_reload_class (const oconfig_item_t *ci) /* {{{ */
+{
+	int i;
+
+	if (strcasecmp ("Chain", ci->key) == 0)
+		return (CF_RELOAD_CHAIN);
+
+	for (i = 0; i < cf_chain_options_num; i++)
+		if (strcasecmp (cf_chain_options[i], ci->key) == 0)
+			return (CF_RELOAD_CHAIN);
+
+	if ((strcasecmp ("Plugin", ci->key) == 0)
+			&& (ci->children != NULL)
+			&& (ci->values_num >= 1)
+			&& (ci->values[0].type == OCONFIG_TYPE_STRING))
+		return (CF_RELOAD_PLUGIN);
+
+	return (CF_RELOAD_OTHER);
+} /* }}} int cf_reload_class */
+
+/* Returns true if "ci" is of class "class" and, for <Plugin> blocks, belongs to
+ * the plugin "name". */
+static _Bool cf_reload_match (const oconfig_item_t *ci, /* {{{ */
+		int class, const char *name)
+{
+	if (cf_reload_class (ci) != class)
+		return (0);
+	if (class != CF_RELOAD_PLUGIN)
+		return (1);
+	return (strcasecmp (ci->values[0].value.string, name) == 0);
+} /* }}} _Bool cf_reload_match */
+
+/* Compares the matching items of "a" and "b", in order. */
+static _Bool cf_reload_changed (const oconfig_item_t *a, /* {{{ */
+		const oconfig_item_t *b, int class, const char *name)
+{
+	int i = 0;
+	int j = 0;
+
+	while (1)
+	{
+		while ((i < a->children_num)
+				&& !cf_reload_match (a->children + i, class, name))
+			i++;
+		while ((j < b->children_num)
+				&& !cf_reload_match (b->children + j, class, name))
+			j++;
+
+		if ((i >= a->children_num) || (j >= b->children_num))
+			break;
+
+		if (!cf_ci_equal (a->children + i, b->children + j))
+			return (1);
+		i++;
+		j++;
+	}
+
+	return ((i < a->children_num) || (j < b->children_num));
+} /* }}} _Bool cf_reload_changed */
+
+static int cf_reload_chains (const oconfig_item_t *conf) /* {{{ */
+{
+	const oconfig_item_t **chains;
+	size_t chains_num = 0;
+	char *saved[STATIC_ARRAY_SIZE (cf_chain_options)];
+	int status;
+	int i;
+
+	chains = calloc ((size_t) conf->children_num, sizeof (*chains));
+	if (chains == NULL)
+	{
+		ERROR ("cf_reload_chains: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < cf_chain_options_num; i++)
+	{
+		const char *value = global_option_get (cf_chain_options[i]);
+		saved[i] = (value != NULL) ? strdup (value) : NULL;
+		global_option_set (cf_chain_options[i], NULL);
+	}
+
+	for (i = 0; i < conf->children_num; i++)
+	{
+		oconfig_item_t *ci = conf->children + i;
+
+		if (cf_reload_class (ci) != CF_RELOAD_CHAIN)
+			continue;
+
+		if (strcasecmp ("Chain", ci->key) == 0)
+			chains[chains_num++] = ci;
+		else
+			dispatch_global_option (ci);
+	}
+
+	status = fc_reload (chains, chains_num);
+	if (status != 0)
+	{
+		for (i = 0; i < cf_chain_options_num; i++)
+			global_option_set (cf_chain_options[i], saved[i]);
+	}
+
+	for (i = 0; i < cf_chain_options_num; i++)
+		sfree (saved[i]);
+	sfree (chains);
+
+	return (status);
+} /* }}} int cf_reload_chains */
+
+/* Passes all <Plugin "name"> blocks of "conf", merged into one, to the reload
+ * callback of the plugin. Returns a positive value if the plugin has no such
+ * callback. */
+static int cf_reload_plugin (const oconfig_item_t *conf, /* {{{ */
+		const char *name)
+{
+	cf_complex_callback_t *cb;
+	oconfig_item_t merged;
+	oconfig_value_t value;
+	plugin_ctx_t old_ctx;
+	int status;
+	int i;
+
+	for (cb = complex_callback_head; cb != NULL; cb = cb->next)
+		if (strcasecmp (name, cb->type) == 0)
+			break;
+
+	if ((cb == NULL) || (cb->reload == NULL))
+		return (1);
+
+	memset (&value, 0, sizeof (value));
+	value.type = OCONFIG_TYPE_STRING;
+	value.value.string = (char *) name;
+
+	memset (&merged, 0, sizeof (merged));
+	merged.key = "Plugin";
+	merged.values = &value;
+	merged.values_num = 1;
+
+	for (i = 0; i < conf->children_num; i++)
+		if (cf_reload_match (conf->children + i, CF_RELOAD_PLUGIN, name))
+			merged.children_num += conf->children[i].children_num;
+
+	if (merged.children_num > 0)
+	{
+		merged.children = calloc ((size_t) merged.children_num,
+				sizeof (*merged.children));
+		if (merged.children == NULL)
+		{
+			ERROR ("cf_reload_plugin: calloc failed.");
+			return (-1);
+		}
+
+		merged.children_num = 0;
+		for (i = 0; i < conf->children_num; i++)
+		{
+			oconfig_item_t *ci = conf->children + i;
+
+			if (!cf_reload_match (ci, CF_RELOAD_PLUGIN, name))
+				continue;
+
+			/* Shallow copies: the items still belong to "conf". */
+			memcpy (merged.children + merged.children_num, ci->children,
+					ci->children_num * sizeof (*ci->children));
+			merged.children_num += ci->children_num;
+		}
+	}
+
+	old_ctx = plugin_set_ctx (cb->ctx);
+	status = cb->reload (&merged);
+	plugin_set_ctx (old_ctx);
+
+	sfree (merged.children);
+
+	return ((status == 0) ? 0 : -1);
+} /* }}} int cf_reload_plugin */
+
+/* Applies the changed <Plugin> blocks of "name", unless they have been handled
+ * already because the plugin also appears earlier in "conf" or "old". */
+static int cf_reload_plugins (const oconfig_item_t *conf, /* {{{ */
+		const oconfig_item_t *old)
+{
+	const oconfig_item_t *trees[] = { conf, old };
+	int failed = 0;
+	int t;
+	int i;
+
+	for (t = 0; t < 2; t++)
+	{
+		for (i = 0; i < trees[t]->children_num; i++)
+		{
+			oconfig_item_t *ci = trees[t]->children + i;
+			const char *name;
+			_Bool seen = 0;
+			int k;
+			int status;
+
+			if (cf_reload_class (ci) != CF_RELOAD_PLUGIN)
+				continue;
+			name = ci->values[0].value.string;
+
+			for (k = 0; (k <= t) && !seen; k++)
+			{
+				int j;
+				int end = (k == t) ? i : trees[k]->children_num;
+
+				for (j = 0; (j < end) && !seen; j++)
+					seen = cf_reload_match (trees[k]->children + j,
+							CF_RELOAD_PLUGIN, name);
+			}
+			if (seen)
+				continue;
+
+			if (!cf_reload_changed (old, conf, CF_RELOAD_PLUGIN, name))
+				continue;
+
+			status = cf_reload_plugin (conf, name);
+			if (status == 0)
+				INFO ("cf_reload: Applied the new configuration of the "
+						"\"%s\" plugin.", name);
+			else if (status > 0)
+				WARNING ("cf_reload: The configuration of the \"%s\" "
+						"plugin changed. Restart the daemon to apply it.",
+						name);
+			else
+				ERROR ("cf_reload: Applying the new configuration of the "
+						"\"%s\" plugin failed.", name);
+
+			if (status != 0)
+				failed++;
+		}
+	}
+
+	return (failed);
+} /* }}} int cf_reload_plugins */
+
 /*
  * Public functions
  */
@@ -990,6 +1390,23 @@ long global_option_get_long (const char *option, long default_value)
 	return (value);
 } /* char *global_option_get_long */
 
+long global_option_get_long_in_range (const char *option, long default_value,
+		long min, long max)
+{
+	long value;
+
+	assert (min <= max);
+	value = global_option_get_long (option, default_value);
+	if ((value < min) || (value > max))
+	{
+		ERROR ("Value %ld of global option %s not in range [%ld, %ld].",
+				value, option, min, max);
+		return (default_value);
+	}
+
+	return (value);
+} /* long global_option_get_long_in_range */
+
 cdtime_t global_option_get_time (const char *name, cdtime_t def) /* {{{ */
 {
 	char const *optstr;
@@ -1094,6 +1511,7 @@ int cf_register_complex (const char *type, int (*callback) (oconfig_item_t *))
 	}
 
 	new->callback = callback;
+	new->reload = NULL;
 	new->next = NULL;
 
 	new->ctx = plugin_get_ctx ();
@@ -1113,6 +1531,23 @@ int cf_register_complex (const char *type, int (*callback) (oconfig_item_t *))
 	return (0);
 } /* int cf_register_complex */
 
+int cf_register_complex_reload (const char *type,
+		int (*callback) (oconfig_item_t *))
+{
+	cf_complex_callback_t *cb;
+
+	for (cb = complex_callback_head; cb != NULL; cb = cb->next)
+	{
+		if (strcasecmp (type, cb->type) == 0)
+		{
+			cb->reload = callback;
+			return (0);
+		}
+	}
+
+	return (-ENOENT);
+} /* int cf_register_complex_reload */
+
 int cf_read (const char *filename)
 {
 	oconfig_item_t *conf;
@@ -1139,7 +1574,10 @@ int cf_read (const char *filename)
 			dispatch_block (conf->children + i);
 	}
 
-	oconfig_free (conf);
+	/* Kept for cf_reload(). */
+	if (cf_current_config != NULL)
+		oconfig_free (cf_current_config);
+	cf_current_config = conf;
 
 	/* Read the default types.db if no `TypesDB' option was given. */
 	if (cf_default_typesdb)
@@ -1148,6 +1586,63 @@ int cf_read (const char *filename)
 	return (0);
 } /* int cf_read */
 
+int cf_reload (const char *filename)
+{
+	oconfig_item_t *conf;
+	oconfig_item_t *old = cf_current_config;
+	int failed = 0;
+
+	if (old == NULL)
+		return (-1);
+
+	conf = cf_read_generic (filename, /* pattern = */ NULL, /* depth = */ 0);
+	if (conf == NULL)
+	{
+		ERROR ("cf_reload: Unable to read config file %s. "
+				"Keeping the current configuration.", filename);
+		return (-1);
+	}
+	else if (conf->children_num == 0)
+	{
+		ERROR ("cf_reload: Configuration file %s is empty. "
+				"Keeping the current configuration.", filename);
+		oconfig_free (conf);
+		return (-1);
+	}
+
+	if (cf_reload_changed (old, conf, CF_RELOAD_OTHER, NULL))
+	{
+		WARNING ("cf_reload: Global options, TypesDB, PluginDir or "
+				"LoadPlugin statements changed. Restart the daemon "
+				"to apply them.");
+		failed++;
+	}
+
+	if (cf_reload_changed (old, conf, CF_RELOAD_CHAIN, NULL))
+	{
+		if (cf_reload_chains (conf) == 0)
+			INFO ("cf_reload: Applied the new filter chains.");
+		else
+			failed++;
+	}
+
+	failed += cf_reload_plugins (conf, old);
+
+	/* Changes that have not been applied are reported again by the next
+	 * reload. Applied ones are applied again, which is harmless. */
+	if (failed != 0)
+	{
+		oconfig_free (conf);
+		return (-1);
+	}
+
+	cf_current_config = conf;
+	oconfig_free (old);
+
+	INFO ("cf_reload: Configuration reloaded from %s.", filename);
+	return (0);
+} /* int cf_reload */
+
 /* Assures the config option is a string, duplicates it and returns the copy in
  * "ret_string". If necessary "*ret_string" is freed first. Returns zero upon
  * success. */
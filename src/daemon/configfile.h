@@ -72,6 +72,12 @@ void cf_register (const char *type,
 
 int cf_register_complex (const char *type, int (*callback) (oconfig_item_t *));
 
+/* Sets the reload callback of the complex config callback "type", see
+ * plugin_register_complex_reload(). Returns -ENOENT if "type" has no complex
+ * config callback. */
+int cf_register_complex_reload (const char *type,
+		int (*callback) (oconfig_item_t *));
+
 /*
  * DESCRIPTION
  *  `cf_read' reads the config file `filename' and dispatches the read
@@ -89,6 +95,25 @@ int cf_register_complex (const char *type, int (*callback) (oconfig_item_t *));
  */
 int cf_read (const char *filename);
 
+/*
+ * DESCRIPTION
+ *  `cf_reload' reads `filename' again and compares it to the configuration
+ *  read by `cf_read' or the last successful `cf_reload'. Changed <Chain>
+ *  blocks, together with the `PreCacheChain', `PostCacheChain' and
+ *  `FilterChainCacheSize' options, replace the current filter chains.
+ *  Changed <Plugin> blocks are passed to the plugin's reload callback, see
+ *  `plugin_register_complex_reload'. The value cache, write queues and
+ *  plugins without changes are not touched.
+ *
+ *  Other changes, e.g. to global options or `LoadPlugin' statements, and
+ *  changes of plugins without a reload callback are logged and require a
+ *  restart.
+ *
+ * RETURN VALUE
+ *  Returns zero if all changes have been applied and non-zero otherwise.
+ */
+int cf_reload (const char *filename);
+
 int global_option_set (const char *option, const char *value);
 const char *global_option_get (const char *option);
 long global_option_get_long (const char *option, long default_value);
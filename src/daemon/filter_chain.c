@@ -30,6 +30,22 @@
 #include "utils_complain.h"
 #include "common.h"
 #include "filter_chain.h"
+#include "utils_intern.h"
+#include "utils_probe.h"
+
+#include <pthread.h>
+
+/* The memo of a chain is split into this many independently locked shards. */
+#define FC_MEMO_SHARDS 16
+
+/* Only this many matches per chain are memoized, so that a pass through a
+ * chain can keep a copy of the results on the stack. */
+#define FC_MEMO_MATCHES_MAX 256
+
+/* Values of the memoized results. */
+#define FC_MEMO_UNKNOWN    0
+#define FC_MEMO_NO_MATCH   1
+#define FC_MEMO_MATCHES    2
 
 /*
  * Data types
@@ -43,9 +59,32 @@ struct fc_match_s
   char name[DATA_MAX_NAME_LEN];
   match_proc_t proc;
   void *user_data;
+  /* Index into the chain's memoized results, or -1. */
+  int memo_index;
   fc_match_t *next;
 }; /* }}} */
 
+/* Memoized results of the identifier-only matches of one chain for one
+ * identifier. */
+struct fc_memo_entry_s;
+typedef struct fc_memo_entry_s fc_memo_entry_t; /* {{{ */
+struct fc_memo_entry_s
+{
+  fc_memo_entry_t *next;
+  identifier_t id;
+  unsigned char results[];
+}; /* }}} */
+
+struct fc_memo_shard_s;
+typedef struct fc_memo_shard_s fc_memo_shard_t; /* {{{ */
+struct fc_memo_shard_s
+{
+  pthread_mutex_t lock;
+  fc_memo_entry_t **buckets;
+  size_t buckets_num;
+  size_t entries_num;
+}; /* }}} */
+
 /* List of targets, used in fc_rule_t and for the global `target_list_head'
  * variable. */
 struct fc_target_s;
@@ -76,6 +115,10 @@ struct fc_chain_s /* {{{ */
   fc_rule_t   *rules;
   fc_target_t *targets;
   fc_chain_t  *next;
+
+  /* Memoized match results, NULL if disabled. See fc_chain_compile(). */
+  fc_memo_shard_t *memo;
+  size_t memo_matches_num;
 }; /* }}} */
 
 /* Writer configuration. */
@@ -87,6 +130,24 @@ struct fc_writer_s
   c_complain_t complaint;
 }; /* }}} */
 
+/* Identifier fields hashed by the built-in target `shard'. */
+#define FC_SHARD_HOST            0x01
+#define FC_SHARD_PLUGIN          0x02
+#define FC_SHARD_PLUGIN_INSTANCE 0x04
+#define FC_SHARD_TYPE            0x08
+#define FC_SHARD_TYPE_INSTANCE   0x10
+#define FC_SHARD_ALL             0x1f
+
+/* Configuration of the built-in target `shard'. */
+struct fc_shard_s;
+typedef struct fc_shard_s fc_shard_t; /* {{{ */
+struct fc_shard_s
+{
+  fc_writer_t *writers;
+  size_t writers_num;
+  int fields;
+}; /* }}} */
+
 /*
  * Global variables
  */
@@ -94,6 +155,11 @@ static fc_match_t  *match_list_head;
 static fc_target_t *target_list_head;
 static fc_chain_t  *chain_list_head;
 
+/* Maximum number of identifiers memoized per chain, zero if disabled. Set by
+ * fc_init(). */
+static size_t memo_entries_max = 0;
+static _Bool  memo_initialized = 0;
+
 /*
  * Private functions
  */
@@ -117,6 +183,48 @@ static void fc_free_matches (fc_match_t *m) /* {{{ */
   free (m);
 } /* }}} void fc_free_matches */
 
+static void fc_memo_entry_free (fc_memo_entry_t *e) /* {{{ */
+{
+  while (e != NULL)
+  {
+    fc_memo_entry_t *next = e->next;
+
+    identifier_destroy (&e->id);
+    free (e);
+
+    e = next;
+  }
+} /* }}} void fc_memo_entry_free */
+
+/* Removes all entries from "shard". The caller must hold the shard's lock. */
+static void fc_memo_shard_clear (fc_memo_shard_t *shard) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < shard->buckets_num; i++)
+  {
+    fc_memo_entry_free (shard->buckets[i]);
+    shard->buckets[i] = NULL;
+  }
+  shard->entries_num = 0;
+} /* }}} void fc_memo_shard_clear */
+
+static void fc_memo_free (fc_memo_shard_t *memo) /* {{{ */
+{
+  size_t i;
+
+  if (memo == NULL)
+    return;
+
+  for (i = 0; i < FC_MEMO_SHARDS; i++)
+  {
+    fc_memo_shard_clear (memo + i);
+    free (memo[i].buckets);
+    pthread_mutex_destroy (&memo[i].lock);
+  }
+  free (memo);
+} /* }}} void fc_memo_free */
+
 static void fc_free_targets (fc_target_t *t) /* {{{ */
 {
   if (t == NULL)
@@ -158,6 +266,7 @@ static void fc_free_chains (fc_chain_t *c) /* {{{ */
 
   fc_free_rules (c->rules);
   fc_free_targets (c->targets);
+  fc_memo_free (c->memo);
 
   if (c->next != NULL)
     fc_free_chains (c->next);
@@ -165,6 +274,165 @@ static void fc_free_chains (fc_chain_t *c) /* {{{ */
   free (c);
 } /* }}} void fc_free_chains */
 
+static void fc_free_chains_deferred (void *arg) /* {{{ */
+{
+  fc_free_chains (arg);
+} /* }}} void fc_free_chains_deferred */
+
+/* Assigns memo indices to the identifier-only matches of "chain" and
+ * (re-)creates its memo. Previously memoized results are discarded. */
+static int fc_chain_compile (fc_chain_t *chain) /* {{{ */
+{
+  fc_memo_shard_t *memo;
+  fc_rule_t *rule;
+  fc_match_t *match;
+  size_t matches_num = 0;
+  size_t entries_max;
+  size_t buckets_num;
+  size_t i;
+
+  fc_memo_free (chain->memo);
+  chain->memo = NULL;
+  chain->memo_matches_num = 0;
+
+  for (rule = chain->rules; rule != NULL; rule = rule->next)
+  {
+    for (match = rule->matches; match != NULL; match = match->next)
+    {
+      match->memo_index = -1;
+
+      if ((memo_entries_max == 0)
+          || ((match->proc.flags & FC_MATCH_IDENTIFIER_ONLY) == 0)
+          || (matches_num >= FC_MEMO_MATCHES_MAX))
+        continue;
+
+      match->memo_index = (int) matches_num;
+      matches_num++;
+    }
+  }
+
+  if (matches_num == 0)
+    return (0);
+
+  entries_max = memo_entries_max / FC_MEMO_SHARDS;
+  if (entries_max < 1)
+    entries_max = 1;
+  buckets_num = 16;
+  while (buckets_num < entries_max)
+    buckets_num *= 2;
+
+  memo = calloc (FC_MEMO_SHARDS, sizeof (*memo));
+  if (memo != NULL)
+  {
+    for (i = 0; i < FC_MEMO_SHARDS; i++)
+      pthread_mutex_init (&memo[i].lock, /* attr = */ NULL);
+
+    for (i = 0; i < FC_MEMO_SHARDS; i++)
+    {
+      memo[i].buckets = calloc (buckets_num, sizeof (*memo[i].buckets));
+      if (memo[i].buckets == NULL)
+        break;
+      memo[i].buckets_num = buckets_num;
+    }
+
+    if (i < FC_MEMO_SHARDS)
+    {
+      fc_memo_free (memo);
+      memo = NULL;
+    }
+  }
+
+  if (memo == NULL)
+  {
+    ERROR ("Filter subsystem: fc_chain_compile: calloc failed. "
+        "Results of chain `%s' will not be cached.", chain->name);
+    for (rule = chain->rules; rule != NULL; rule = rule->next)
+      for (match = rule->matches; match != NULL; match = match->next)
+        match->memo_index = -1;
+    return (ENOMEM);
+  }
+
+  chain->memo = memo;
+  chain->memo_matches_num = matches_num;
+  return (0);
+} /* }}} int fc_chain_compile */
+
+static fc_memo_shard_t *fc_memo_shard (fc_chain_t *chain, /* {{{ */
+    uint32_t hash, fc_memo_entry_t ***bucket)
+{
+  fc_memo_shard_t *shard = chain->memo + (hash % FC_MEMO_SHARDS);
+
+  *bucket = shard->buckets
+    + ((hash / FC_MEMO_SHARDS) & (shard->buckets_num - 1));
+  return (shard);
+} /* }}} fc_memo_shard_t *fc_memo_shard */
+
+/* Copies the memoized results for the identifier of "vl" to "results". All
+ * results are FC_MEMO_UNKNOWN if the identifier has not been seen before. */
+static void fc_memo_load (fc_chain_t *chain, /* {{{ */
+    value_list_t const *vl, uint32_t hash, unsigned char *results)
+{
+  fc_memo_shard_t *shard;
+  fc_memo_entry_t **bucket;
+  fc_memo_entry_t *e;
+
+  shard = fc_memo_shard (chain, hash, &bucket);
+
+  pthread_mutex_lock (&shard->lock);
+  for (e = *bucket; e != NULL; e = e->next)
+  {
+    if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+    {
+      memcpy (results, e->results, chain->memo_matches_num);
+      pthread_mutex_unlock (&shard->lock);
+      return;
+    }
+  }
+  pthread_mutex_unlock (&shard->lock);
+
+  memset (results, FC_MEMO_UNKNOWN, chain->memo_matches_num);
+} /* }}} void fc_memo_load */
+
+/* Memoizes "results" for the identifier of "vl". If the shard is full, all of
+ * its entries are dropped first, so that the memo stays bounded. */
+static void fc_memo_store (fc_chain_t *chain, /* {{{ */
+    value_list_t const *vl, uint32_t hash, unsigned char const *results)
+{
+  fc_memo_shard_t *shard;
+  fc_memo_entry_t **bucket;
+  fc_memo_entry_t *e;
+  size_t entries_max;
+
+  shard = fc_memo_shard (chain, hash, &bucket);
+
+  pthread_mutex_lock (&shard->lock);
+  for (e = *bucket; e != NULL; e = e->next)
+    if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+      break;
+
+  if (e == NULL)
+  {
+    entries_max = memo_entries_max / FC_MEMO_SHARDS;
+    if (shard->entries_num >= ((entries_max > 0) ? entries_max : 1))
+      fc_memo_shard_clear (shard);
+
+    e = malloc (sizeof (*e) + chain->memo_matches_num);
+    if ((e == NULL) || (identifier_create (&e->id, vl) != 0))
+    {
+      pthread_mutex_unlock (&shard->lock);
+      sfree (e);
+      return;
+    }
+
+    e->next = *bucket;
+    *bucket = e;
+    shard->entries_num++;
+  }
+
+  memcpy (e->results, results, chain->memo_matches_num);
+  pthread_mutex_unlock (&shard->lock);
+} /* }}} void fc_memo_store */
+
 static char *fc_strdup (const char *orig) /* {{{ */
 {
   size_t sz;
@@ -245,6 +513,7 @@ static int fc_config_add_match (fc_match_t **matches_head, /* {{{ */
   sstrncpy (m->name, ptr->name, sizeof (m->name));
   memcpy (&m->proc, &ptr->proc, sizeof (m->proc));
   m->user_data = NULL;
+  m->memo_index = -1;
   m->next = NULL;
 
   if (m->proc.create != NULL)
@@ -442,7 +711,25 @@ static int fc_config_add_rule (fc_chain_t *chain, /* {{{ */
   return (0);
 } /* }}} int fc_config_add_rule */
 
-static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
+static fc_chain_t *fc_chain_find (fc_chain_t *head, /* {{{ */
+    const char *chain_name)
+{
+  fc_chain_t *chain;
+
+  if (chain_name == NULL)
+    return (NULL);
+
+  for (chain = head; chain != NULL; chain = chain->next)
+    if (strcasecmp (chain_name, chain->name) == 0)
+      return (chain);
+
+  return (NULL);
+} /* }}} fc_chain_t *fc_chain_find */
+
+/* Adds the chain configured by "ci" to the list "*head" or merges it with the
+ * chain of the same name. */
+static int fc_config_add_chain (fc_chain_t **head, /* {{{ */
+    const oconfig_item_t *ci)
 {
   fc_chain_t *chain = NULL;
   int status = 0;
@@ -457,9 +744,9 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
     return (-1);
   }
 
-  if (chain_list_head != NULL)
+  if (*head != NULL)
   {
-    if ((chain = fc_chain_get_by_name (ci->values[0].value.string)) != NULL)
+    if ((chain = fc_chain_find (*head, ci->values[0].value.string)) != NULL)
       new_chain = 0;
   }
 
@@ -499,14 +786,18 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
     return (-1);
   }
 
-  if (chain_list_head != NULL)
+  /* Results memoized for the old rules are no longer valid. */
+  if (memo_initialized)
+    fc_chain_compile (chain);
+
+  if (*head != NULL)
   {
     if (!new_chain)
       return (0);
 
     fc_chain_t *ptr;
 
-    ptr = chain_list_head;
+    ptr = *head;
     while (ptr->next != NULL)
       ptr = ptr->next;
 
@@ -514,7 +805,7 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
   }
   else
   {
-    chain_list_head = chain;
+    *head = chain;
   }
 
   return (0);
@@ -770,6 +1061,243 @@ static int fc_bit_write_invoke (const data_set_t *ds, /* {{{ */
   return (FC_TARGET_CONTINUE);
 } /* }}} int fc_bit_write_invoke */
 
+static int fc_bit_shard_destroy (void **user_data) /* {{{ */
+{
+  fc_shard_t *shard;
+  size_t i;
+
+  if ((user_data == NULL) || (*user_data == NULL))
+    return (0);
+
+  shard = *user_data;
+  for (i = 0; i < shard->writers_num; i++)
+    free (shard->writers[i].plugin);
+  free (shard->writers);
+  free (shard);
+  *user_data = NULL;
+
+  return (0);
+} /* }}} int fc_bit_shard_destroy */
+
+static int fc_bit_shard_config_fields (fc_shard_t *shard, /* {{{ */
+    const oconfig_item_t *ci)
+{
+  int i;
+
+  shard->fields = 0;
+  for (i = 0; i < ci->values_num; i++)
+  {
+    const char *field;
+
+    if (ci->values[i].type != OCONFIG_TYPE_STRING)
+    {
+      ERROR ("Filter subsystem: Built-in target `shard': "
+          "The `HashBy' option accepts only string arguments.");
+      return (-1);
+    }
+    field = ci->values[i].value.string;
+
+    if (strcasecmp ("Host", field) == 0)
+      shard->fields |= FC_SHARD_HOST;
+    else if (strcasecmp ("Plugin", field) == 0)
+      shard->fields |= FC_SHARD_PLUGIN;
+    else if (strcasecmp ("PluginInstance", field) == 0)
+      shard->fields |= FC_SHARD_PLUGIN_INSTANCE;
+    else if (strcasecmp ("Type", field) == 0)
+      shard->fields |= FC_SHARD_TYPE;
+    else if (strcasecmp ("TypeInstance", field) == 0)
+      shard->fields |= FC_SHARD_TYPE_INSTANCE;
+    else
+    {
+      ERROR ("Filter subsystem: Built-in target `shard': "
+          "Unknown field `%s' in the `HashBy' option.", field);
+      return (-1);
+    }
+  }
+
+  if (shard->fields == 0)
+  {
+    ERROR ("Filter subsystem: Built-in target `shard': "
+        "The `HashBy' option requires at least one argument.");
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int fc_bit_shard_config_fields */
+
+static int fc_bit_shard_create (const oconfig_item_t *ci, /* {{{ */
+    void **user_data)
+{
+  fc_shard_t *shard;
+  int status = 0;
+  int i;
+
+  shard = calloc (1, sizeof (*shard));
+  if (shard == NULL)
+  {
+    ERROR ("fc_bit_shard_create: calloc failed.");
+    return (-ENOMEM);
+  }
+  shard->fields = FC_SHARD_ALL;
+
+  for (i = 0; (i < ci->children_num) && (status == 0); i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+    int j;
+
+    if (strcasecmp ("HashBy", child->key) == 0)
+    {
+      status = fc_bit_shard_config_fields (shard, child);
+      continue;
+    }
+    else if (strcasecmp ("Plugin", child->key) != 0)
+    {
+      ERROR ("Filter subsystem: The built-in target `shard' does not "
+          "support the configuration option `%s'.",
+          child->key);
+      status = -1;
+      continue;
+    }
+
+    for (j = 0; j < child->values_num; j++)
+    {
+      fc_writer_t *temp;
+
+      if (child->values[j].type != OCONFIG_TYPE_STRING)
+      {
+        ERROR ("Filter subsystem: Built-in target `shard': "
+            "The `Plugin' option accepts only string arguments.");
+        status = -1;
+        break;
+      }
+
+      temp = realloc (shard->writers,
+          (shard->writers_num + 1) * sizeof (*shard->writers));
+      if (temp == NULL)
+      {
+        ERROR ("fc_bit_shard_create: realloc failed.");
+        status = -ENOMEM;
+        break;
+      }
+      shard->writers = temp;
+
+      temp = shard->writers + shard->writers_num;
+      temp->plugin = fc_strdup (child->values[j].value.string);
+      if (temp->plugin == NULL)
+      {
+        ERROR ("fc_bit_shard_create: fc_strdup failed.");
+        status = -ENOMEM;
+        break;
+      }
+      C_COMPLAIN_INIT (&temp->complaint);
+      shard->writers_num++;
+    } /* for (j = 0; j < child->values_num; j++) */
+  } /* for (i = 0; i < ci->children_num; i++) */
+
+  if ((status == 0) && (shard->writers_num == 0))
+  {
+    ERROR ("Filter subsystem: Built-in target `shard': "
+        "At least one `Plugin' option is required.");
+    status = -1;
+  }
+
+  if (status != 0)
+  {
+    fc_bit_shard_destroy ((void *) &shard);
+    return (status);
+  }
+
+  *user_data = shard;
+  return (0);
+} /* }}} int fc_bit_shard_create */
+
+/* FNV-1a over the selected fields, each including its terminating null
+ * byte, followed by the finalizer of MurmurHash3 to mix the upper bits. */
+static uint32_t fc_bit_shard_hash (const value_list_t *vl, /* {{{ */
+    int fields)
+{
+  const char *field[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (field); i++)
+  {
+    const unsigned char *ptr = (const unsigned char *) field[i];
+
+    if ((fields & (1 << i)) == 0)
+      continue;
+
+    do
+    {
+      hash ^= (uint32_t) *ptr;
+      hash *= 16777619U;
+    } while (*(ptr++) != 0);
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35U;
+  hash ^= hash >> 16;
+
+  return (hash);
+} /* }}} uint32_t fc_bit_shard_hash */
+
+/* Maps `key' to one of `buckets_num' buckets with the "jump consistent hash"
+ * by Lamping and Veach: when a bucket is added, only 1/n of the keys move,
+ * all of them to the new bucket. */
+static size_t fc_bit_shard_bucket (uint64_t key, size_t buckets_num) /* {{{ */
+{
+  int64_t b = -1;
+  int64_t j = 0;
+
+  while (j < (int64_t) buckets_num)
+  {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = (int64_t) (((double) (b + 1))
+        * (((double) (1LL << 31)) / ((double) ((key >> 33) + 1))));
+  }
+
+  return ((size_t) b);
+} /* }}} size_t fc_bit_shard_bucket */
+
+static int fc_bit_shard_invoke (const data_set_t *ds, /* {{{ */
+    value_list_t *vl, notification_meta_t __attribute__((unused)) **meta,
+    void **user_data)
+{
+  fc_shard_t *shard;
+  fc_writer_t *w;
+  int status;
+
+  if ((user_data == NULL) || (*user_data == NULL))
+    return (-EINVAL);
+  shard = *user_data;
+
+  w = shard->writers + fc_bit_shard_bucket (
+      (uint64_t) fc_bit_shard_hash (vl, shard->fields), shard->writers_num);
+
+  status = plugin_write (w->plugin, ds, vl);
+  if (status != 0)
+  {
+    c_complain (LOG_INFO, &w->complaint,
+        "Filter subsystem: Built-in target `shard': Dispatching value to "
+        "the `%s' plugin failed with status %i.",
+        w->plugin, status);
+
+    plugin_log_available_writers ();
+  }
+  else
+  {
+    c_release (LOG_INFO, &w->complaint,
+        "Filter subsystem: Built-in target `shard': Plugin `%s' is back "
+        "to normal operation. `write' succeeded.", w->plugin);
+  }
+
+  return (FC_TARGET_CONTINUE);
+} /* }}} int fc_bit_shard_invoke */
+
 static int fc_init_once (void) /* {{{ */
 {
   static int done = 0;
@@ -802,6 +1330,12 @@ static int fc_init_once (void) /* {{{ */
   tproc.invoke  = fc_bit_write_invoke;
   fc_register_target ("write", tproc);
 
+  memset (&tproc, 0, sizeof (tproc));
+  tproc.create  = fc_bit_shard_create;
+  tproc.destroy = fc_bit_shard_destroy;
+  tproc.invoke  = fc_bit_shard_invoke;
+  fc_register_target ("shard", tproc);
+
   done++;
   return (0);
 } /* }}} int fc_init_once */
@@ -875,30 +1409,30 @@ int fc_register_target (const char *name, target_proc_t proc) /* {{{ */
 
 fc_chain_t *fc_chain_get_by_name (const char *chain_name) /* {{{ */
 {
-  fc_chain_t *chain;
-
-  if (chain_name == NULL)
-    return (NULL);
-
-  for (chain = chain_list_head; chain != NULL; chain = chain->next)
-    if (strcasecmp (chain_name, chain->name) == 0)
-      return (chain);
-
-  return (NULL);
+  return (fc_chain_find (chain_list_head, chain_name));
 } /* }}} int fc_chain_get_by_name */
 
-int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
+static int fc_process_rules (const data_set_t *ds, value_list_t *vl, /* {{{ */
     fc_chain_t *chain)
 {
   fc_rule_t *rule;
   fc_target_t *target;
   int status = FC_TARGET_CONTINUE;
+  unsigned char memo_results[FC_MEMO_MATCHES_MAX];
+  uint32_t memo_hash = 0;
+  _Bool memo_dirty = 0;
 
   if (chain == NULL)
     return (-1);
 
   DEBUG ("fc_process_chain (chain = %s);", chain->name);
 
+  if (chain->memo != NULL)
+  {
+    memo_hash = identifier_hash_vl (vl);
+    fc_memo_load (chain, vl, memo_hash, memo_results);
+  }
+
   for (rule = chain->rules; rule != NULL; rule = rule->next)
   {
     fc_match_t *match;
@@ -913,9 +1447,29 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
     /* N. B.: rule->matches may be NULL. */
     for (match = rule->matches; match != NULL; match = match->next)
     {
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status = (*match->proc.match) (ds, vl, /* meta = */ NULL,
-          &match->user_data);
+      int memo_index = (chain->memo != NULL) ? match->memo_index : -1;
+
+      if ((memo_index >= 0)
+          && (memo_results[memo_index] != FC_MEMO_UNKNOWN))
+      {
+        status = (memo_results[memo_index] == FC_MEMO_MATCHES)
+          ? FC_MATCH_MATCHES : FC_MATCH_NO_MATCH;
+      }
+      else
+      {
+        /* FIXME: Pass the meta-data to match targets here (when implemented). */
+        status = (*match->proc.match) (ds, vl, /* meta = */ NULL,
+            &match->user_data);
+
+        /* Errors are not memoized. */
+        if ((memo_index >= 0) && (status >= 0))
+        {
+          memo_results[memo_index] = (status == FC_MATCH_MATCHES)
+            ? FC_MEMO_MATCHES : FC_MEMO_NO_MATCH;
+          memo_dirty = 1;
+        }
+      }
+
       if (status < 0)
       {
         WARNING ("fc_process_chain (%s): A match failed.", chain->name);
@@ -938,6 +1492,15 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
           chain->name, rule->name);
     }
 
+    /* Targets may change the identifier, so save the results for the
+     * current identifier now and load the ones for the (possibly) new
+     * identifier afterwards. */
+    if (memo_dirty)
+    {
+      fc_memo_store (chain, vl, memo_hash, memo_results);
+      memo_dirty = 0;
+    }
+
     for (target = rule->targets; target != NULL; target = target->next)
     {
       /* If we get here, all matches have matched the value. Execute the
@@ -964,6 +1527,12 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
       }
     }
 
+    if (chain->memo != NULL)
+    {
+      memo_hash = identifier_hash_vl (vl);
+      fc_memo_load (chain, vl, memo_hash, memo_results);
+    }
+
     if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN))
     {
       if (rule->name[0] != 0)
@@ -977,6 +1546,9 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
     }
   } /* for (rule) */
 
+  if (memo_dirty)
+    fc_memo_store (chain, vl, memo_hash, memo_results);
+
   if ((status == FC_TARGET_STOP) || (status == FC_TARGET_RETURN))
     return (status);
 
@@ -1028,6 +1600,18 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
       chain->name);
 
   return (FC_TARGET_CONTINUE);
+} /* }}} int fc_process_rules */
+
+int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
+    fc_chain_t *chain)
+{
+  int status;
+
+  status = fc_process_rules (ds, vl, chain);
+  PROBE4 (chain_verdict, (chain != NULL) ? chain->name : NULL,
+      vl->plugin, vl->type, status);
+
+  return (status);
 } /* }}} int fc_process_chain */
 
 /* Iterate over all rules in the chain and execute all targets for which all
@@ -1039,6 +1623,32 @@ int fc_default_action (const data_set_t *ds, value_list_t *vl) /* {{{ */
         /* meta = */ NULL, /* user_data = */ NULL));
 } /* }}} int fc_default_action */
 
+static void fc_init_memo_size (void) /* {{{ */
+{
+  long size;
+
+  size = global_option_get_long ("FilterChainCacheSize", /* default = */ 0);
+  if (size < 0)
+  {
+    ERROR ("FilterChainCacheSize must be positive or zero.");
+    size = 0;
+  }
+  memo_entries_max = (size_t) size;
+} /* }}} void fc_init_memo_size */
+
+int fc_init (void) /* {{{ */
+{
+  fc_chain_t *chain;
+
+  fc_init_memo_size ();
+  memo_initialized = 1;
+
+  for (chain = chain_list_head; chain != NULL; chain = chain->next)
+    fc_chain_compile (chain);
+
+  return (0);
+} /* }}} int fc_init */
+
 int fc_configure (const oconfig_item_t *ci) /* {{{ */
 {
   fc_init_once ();
@@ -1047,7 +1657,7 @@ int fc_configure (const oconfig_item_t *ci) /* {{{ */
     return (-EINVAL);
 
   if (strcasecmp ("Chain", ci->key) == 0)
-    return (fc_config_add_chain (ci));
+    return (fc_config_add_chain (&chain_list_head, ci));
 
   WARNING ("Filter subsystem: Unknown top level config option `%s'.",
       ci->key);
@@ -1055,4 +1665,43 @@ int fc_configure (const oconfig_item_t *ci) /* {{{ */
   return (-1);
 } /* }}} int fc_configure */
 
+int fc_reload (const oconfig_item_t * const *ci, size_t ci_num) /* {{{ */
+{
+  fc_chain_t *head = NULL;
+  fc_chain_t *chain;
+  fc_chain_t *last;
+  size_t i;
+
+  fc_init_once ();
+
+  for (i = 0; i < ci_num; i++)
+  {
+    if (fc_config_add_chain (&head, ci[i]) != 0)
+    {
+      ERROR ("Filter subsystem: Configuring chain #%zu failed; keeping the "
+          "current chains.", i);
+      fc_free_chains (head);
+      return (-1);
+    }
+  }
+
+  fc_init_memo_size ();
+  if (memo_initialized)
+    for (chain = head; chain != NULL; chain = chain->next)
+      fc_chain_compile (chain);
+
+  /* Concurrent lookups see either the complete old or the complete new list.
+   * "jump" targets look up their chain by name, so values passing through an
+   * old chain continue in the new one. */
+  last = chain_list_head;
+  chain_list_head = head;
+  plugin_reload_chains ();
+
+  /* Values may still be passing through the old chains. */
+  if (last != NULL)
+    plugin_write_defer_free (fc_free_chains_deferred, last);
+
+  return (0);
+} /* }}} int fc_reload */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
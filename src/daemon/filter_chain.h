@@ -37,6 +37,11 @@
 #define FC_TARGET_STOP     1
 #define FC_TARGET_RETURN   2
 
+/* The result of the match only depends on the identifier of the value list,
+ * i.e. host, plugin, plugin instance, type and type instance. Such results
+ * may be memoized per identifier, see fc_init(). */
+#define FC_MATCH_IDENTIFIER_ONLY 0x0001
+
 /*
  * Match functions
  */
@@ -46,6 +51,8 @@ struct match_proc_s
   int (*destroy) (void **user_data);
   int (*match) (const data_set_t *ds, const value_list_t *vl,
       notification_meta_t **meta, void **user_data);
+  /* Bitwise or of FC_MATCH_* flags. */
+  int flags;
 };
 typedef struct match_proc_s match_proc_t;
 
@@ -97,10 +104,28 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl,
 
 int fc_default_action (const data_set_t *ds, value_list_t *vl);
 
+/*
+ * Prepares all chains for processing. If the "FilterChainCacheSize" option is
+ * set, the results of matches flagged with FC_MATCH_IDENTIFIER_ONLY are
+ * memoized for up to that many identifiers per chain. Must be called after
+ * the configuration has been read and before values are dispatched.
+ */
+int fc_init (void);
+
 /*
  * Shortcut for global configuration
  */
 int fc_configure (const oconfig_item_t *ci);
 
+/*
+ * Replaces all chains with the ones configured by the "ci_num" <Chain> blocks
+ * in "ci" and updates the "PreCacheChain" and "PostCacheChain" of the daemon.
+ * If any block is invalid, the current chains are kept and an error is
+ * returned. The previous chains are freed once the write threads are done
+ * with the values they are handling, so pointers returned by
+ * fc_chain_get_by_name() must not be kept beyond dispatching one value.
+ */
+int fc_reload (const oconfig_item_t * const *ci, size_t ci_num);
+
 #endif /* FILTER_CHAIN_H */
 /* vim: set sw=2 sts=2 et : */
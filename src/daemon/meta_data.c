@@ -27,6 +27,7 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "meta_data.h"
+#include "utils_intern.h"
 
 #include <pthread.h>
 
@@ -47,15 +48,32 @@ struct meta_entry_s;
 typedef struct meta_entry_s meta_entry_t;
 struct meta_entry_s
 {
-  char         *key;
+  /* interned, see utils_intern.h */
+  char const   *key;
   meta_value_t  value;
   int           type;
-  meta_entry_t *next;
+};
+
+/* The entries of a meta_data_t are kept in a contiguous array, the "store".
+ * Clones share the store of the original; a store referenced by more than one
+ * meta_data_t is never modified; whoever wants to modify it makes a private
+ * copy first (copy on write). "refs" is protected by "lock", the entries by
+ * the lock of the (only) meta_data_t modifying them. */
+struct meta_store_s;
+typedef struct meta_store_s meta_store_t;
+struct meta_store_s
+{
+  meta_entry_t   *entries;
+  size_t          entries_num;
+  size_t          entries_size;
+
+  int             refs;
+  pthread_mutex_t lock;
 };
 
 struct meta_data_s
 {
-  meta_entry_t   *head;
+  meta_store_t   *store;
   pthread_mutex_t lock;
 };
 
@@ -80,208 +98,258 @@ static char *md_strdup (const char *orig) /* {{{ */
   return (dest);
 } /* }}} char *md_strdup */
 
-static meta_entry_t *md_entry_alloc (const char *key) /* {{{ */
+static int md_entry_init (meta_entry_t *e, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  memset (e, 0, sizeof (*e));
 
-  e = calloc (1, sizeof (*e));
-  if (e == NULL)
-  {
-    ERROR ("md_entry_alloc: calloc failed.");
-    return (NULL);
-  }
-
-  e->key = md_strdup (key);
+  e->key = intern_get (key);
   if (e->key == NULL)
   {
-    free (e);
-    ERROR ("md_entry_alloc: md_strdup failed.");
-    return (NULL);
+    ERROR ("md_entry_init: intern_get failed.");
+    return (-ENOMEM);
   }
 
-  e->type = 0;
-  e->next = NULL;
+  return (0);
+} /* }}} int md_entry_init */
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_alloc */
+static void md_entry_clear (meta_entry_t *e) /* {{{ */
+{
+  intern_put (e->key);
+  e->key = NULL;
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_clone_contents (const meta_entry_t *orig) /* {{{ */
+  if (e->type == MD_TYPE_STRING)
+    free (e->value.mv_string);
+  e->value.mv_string = NULL;
+  e->type = 0;
+} /* }}} void md_entry_clear */
+
+static int md_entry_copy (meta_entry_t *dest, /* {{{ */
+    const meta_entry_t *src)
 {
-  meta_entry_t *copy;
+  int status;
 
-  /* WARNINGS :
-   *  - we do not check that orig != NULL here. You should have done it before.
-   *  - we do not set copy->next. DO NOT FORGET TO SET copy->next IN YOUR FUNCTION
-   */
+  status = md_entry_init (dest, src->key);
+  if (status != 0)
+    return (status);
 
-  copy = md_entry_alloc (orig->key);
-  if (copy == NULL)
-    return (NULL);
-  copy->type = orig->type;
-  if (copy->type == MD_TYPE_STRING)
-    copy->value.mv_string = strdup (orig->value.mv_string);
+  dest->type = src->type;
+  if (src->type == MD_TYPE_STRING)
+  {
+    dest->value.mv_string = md_strdup (src->value.mv_string);
+    if (dest->value.mv_string == NULL)
+    {
+      md_entry_clear (dest);
+      return (-ENOMEM);
+    }
+  }
   else
-    copy->value = orig->value;
+    dest->value = src->value;
 
-  return (copy);
-} /* }}} meta_entry_t *md_entry_clone_contents */
+  return (0);
+} /* }}} int md_entry_copy */
 
-static meta_entry_t *md_entry_clone (const meta_entry_t *orig) /* {{{ */
+static meta_store_t *md_store_create (size_t size) /* {{{ */
 {
-  meta_entry_t *copy;
+  meta_store_t *s;
 
-  if (orig == NULL)
+  s = calloc (1, sizeof (*s));
+  if (s == NULL)
     return (NULL);
 
-  copy = md_entry_clone_contents(orig);
+  if (size > 0)
+  {
+    s->entries = calloc (size, sizeof (*s->entries));
+    if (s->entries == NULL)
+    {
+      free (s);
+      return (NULL);
+    }
+  }
 
-  copy->next = md_entry_clone (orig->next);
-  return (copy);
-} /* }}} meta_entry_t *md_entry_clone */
+  s->entries_size = size;
+  s->refs = 1;
+  pthread_mutex_init (&s->lock, /* attr = */ NULL);
 
-static void md_entry_free (meta_entry_t *e) /* {{{ */
-{
-  if (e == NULL)
-    return;
+  return (s);
+} /* }}} meta_store_t *md_store_create */
 
-  free (e->key);
+static void md_store_free (meta_store_t *s) /* {{{ */
+{
+  size_t i;
 
-  if (e->type == MD_TYPE_STRING)
-    free (e->value.mv_string);
+  for (i = 0; i < s->entries_num; i++)
+    md_entry_clear (&s->entries[i]);
 
-  if (e->next != NULL)
-    md_entry_free (e->next);
+  free (s->entries);
+  pthread_mutex_destroy (&s->lock);
+  free (s);
+} /* }}} void md_store_free */
 
-  free (e);
-} /* }}} void md_entry_free */
+static void md_store_ref (meta_store_t *s) /* {{{ */
+{
+  pthread_mutex_lock (&s->lock);
+  s->refs++;
+  pthread_mutex_unlock (&s->lock);
+} /* }}} void md_store_ref */
 
-static int md_entry_insert (meta_data_t *md, meta_entry_t *e) /* {{{ */
+static void md_store_unref (meta_store_t *s) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  int refs;
 
-  if ((md == NULL) || (e == NULL))
-    return (-EINVAL);
+  if (s == NULL)
+    return;
 
-  pthread_mutex_lock (&md->lock);
+  pthread_mutex_lock (&s->lock);
+  refs = --s->refs;
+  pthread_mutex_unlock (&s->lock);
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
-  {
-    if (strcasecmp (e->key, this->key) == 0)
-      break;
+  if (refs == 0)
+    md_store_free (s);
+} /* }}} void md_store_unref */
 
-    prev = this;
-    this = this->next;
-  }
+/* Returns a private copy of "orig". The caller must hold a reference to
+ * "orig". */
+static meta_store_t *md_store_copy (const meta_store_t *orig) /* {{{ */
+{
+  meta_store_t *copy;
+  size_t i;
 
-  if (this == NULL)
+  copy = md_store_create (orig->entries_num);
+  if (copy == NULL)
+    return (NULL);
+
+  for (i = 0; i < orig->entries_num; i++)
   {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else
+    if (md_entry_copy (&copy->entries[i], &orig->entries[i]) != 0)
     {
-      assert (prev != NULL);
-      prev->next = e;
+      md_store_free (copy);
+      return (NULL);
     }
-
-    e->next = NULL;
+    copy->entries_num++;
   }
-  else /* (this != NULL) */
+
+  return (copy);
+} /* }}} meta_store_t *md_store_copy */
+
+/* XXX: The lock on md must be held while calling this function!
+ * Returns a store that md may modify, copying a shared store if necessary. */
+static meta_store_t *md_store_writable (meta_data_t *md) /* {{{ */
+{
+  meta_store_t *s = md->store;
+  meta_store_t *copy;
+
+  if (s == NULL)
   {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
+    md->store = md_store_create (/* size = */ 4);
+    return (md->store);
+  }
 
-    e->next = this->next;
+  pthread_mutex_lock (&s->lock);
+  if (s->refs == 1)
+  {
+    pthread_mutex_unlock (&s->lock);
+    return (s);
   }
 
-  pthread_mutex_unlock (&md->lock);
+  copy = md_store_copy (s);
+  if (copy != NULL)
+    s->refs--;
+  pthread_mutex_unlock (&s->lock);
 
-  if (this != NULL)
+  if (copy == NULL)
   {
-    this->next = NULL;
-    md_entry_free (this);
+    ERROR ("md_store_writable: md_store_copy failed.");
+    return (NULL);
   }
 
-  return (0);
-} /* }}} int md_entry_insert */
+  md->store = copy;
+  return (copy);
+} /* }}} meta_store_t *md_store_writable */
 
-/* XXX: The lock on md must be held while calling this function! */
-static int md_entry_insert_clone (meta_data_t *md, meta_entry_t *orig) /* {{{ */
+static int md_store_index (const meta_store_t *s, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  size_t i;
 
-  /* WARNINGS :
-   *  - we do not check that md and e != NULL here. You should have done it before.
-   *  - we do not use the lock. You should have set it before.
-   */
+  if (s == NULL)
+    return (-1);
 
-  e = md_entry_clone_contents(orig);
+  /* Keys are interned, so most lookups are satisfied by the pointer
+   * comparison. Keys are case-insensitive though. */
+  for (i = 0; i < s->entries_num; i++)
+    if ((s->entries[i].key == key)
+        || (strcasecmp (key, s->entries[i].key) == 0))
+      return ((int) i);
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
-  {
-    if (strcasecmp (e->key, this->key) == 0)
-      break;
+  return (-1);
+} /* }}} int md_store_index */
 
-    prev = this;
-    this = this->next;
-  }
+/* Takes ownership of the contents of "e". */
+static int md_entry_insert (meta_data_t *md, meta_entry_t *e) /* {{{ */
+{
+  meta_store_t *s;
+  int i;
 
-  if (this == NULL)
-  {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else
-    {
-      assert (prev != NULL);
-      prev->next = e;
-    }
+  if ((md == NULL) || (e == NULL))
+    return (-EINVAL);
 
-    e->next = NULL;
-  }
-  else /* (this != NULL) */
+  pthread_mutex_lock (&md->lock);
+
+  s = md_store_writable (md);
+  if (s == NULL)
   {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
+    pthread_mutex_unlock (&md->lock);
+    md_entry_clear (e);
+    return (-ENOMEM);
+  }
 
-    e->next = this->next;
+  i = md_store_index (s, e->key);
+  if (i >= 0)
+  {
+    /* Replace the existing entry, including the spelling of its key. */
+    md_entry_clear (&s->entries[i]);
+    s->entries[i] = *e;
+    pthread_mutex_unlock (&md->lock);
+    return (0);
   }
 
-  if (this != NULL)
+  if (s->entries_num >= s->entries_size)
   {
-    this->next = NULL;
-    md_entry_free (this);
+    size_t new_size = (s->entries_size > 0) ? 2 * s->entries_size : 4;
+    meta_entry_t *tmp;
+
+    tmp = realloc (s->entries, new_size * sizeof (*s->entries));
+    if (tmp == NULL)
+    {
+      pthread_mutex_unlock (&md->lock);
+      ERROR ("md_entry_insert: realloc failed.");
+      md_entry_clear (e);
+      return (-ENOMEM);
+    }
+    s->entries = tmp;
+    s->entries_size = new_size;
   }
 
+  s->entries[s->entries_num] = *e;
+  s->entries_num++;
+
+  pthread_mutex_unlock (&md->lock);
   return (0);
-} /* }}} int md_entry_insert_clone */
+} /* }}} int md_entry_insert */
 
 /* XXX: The lock on md must be held while calling this function! */
 static meta_entry_t *md_entry_lookup (meta_data_t *md, /* {{{ */
     const char *key)
 {
-  meta_entry_t *e;
+  int i;
 
   if ((md == NULL) || (key == NULL))
     return (NULL);
 
-  for (e = md->head; e != NULL; e = e->next)
-    if (strcasecmp (key, e->key) == 0)
-      break;
+  i = md_store_index (md->store, key);
+  if (i < 0)
+    return (NULL);
 
-  return (e);
+  return (&md->store->entries[i]);
 } /* }}} meta_entry_t *md_entry_lookup */
 
 /*
@@ -303,6 +371,8 @@ meta_data_t *meta_data_create (void) /* {{{ */
   return (md);
 } /* }}} meta_data_t *meta_data_create */
 
+/* Clones share the entries of the original until either of them is
+ * modified, so cloning is cheap. */
 meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
 {
   meta_data_t *copy;
@@ -315,7 +385,9 @@ meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
     return (NULL);
 
   pthread_mutex_lock (&orig->lock);
-  copy->head = md_entry_clone (orig->head);
+  if (orig->store != NULL)
+    md_store_ref (orig->store);
+  copy->store = orig->store;
   pthread_mutex_unlock (&orig->lock);
 
   return (copy);
@@ -323,7 +395,9 @@ meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
 
 int meta_data_clone_merge (meta_data_t **dest, meta_data_t *orig) /* {{{ */
 {
-  meta_entry_t *e;
+  meta_store_t *s;
+  size_t i;
+  int status = 0;
 
   if (orig == NULL)
     return (0);
@@ -333,14 +407,30 @@ int meta_data_clone_merge (meta_data_t **dest, meta_data_t *orig) /* {{{ */
     return(0);
   }
 
+  /* Holding a reference keeps the entries from being modified, so they can
+   * be read without holding orig's lock. */
   pthread_mutex_lock (&orig->lock);
-  for (e=orig->head; e != NULL; e = e->next)
+  s = orig->store;
+  if (s != NULL)
+    md_store_ref (s);
+  pthread_mutex_unlock (&orig->lock);
+
+  if (s == NULL)
+    return (0);
+
+  for (i = 0; i < s->entries_num; i++)
   {
-    md_entry_insert_clone((*dest), e);
+    meta_entry_t e;
+
+    status = md_entry_copy (&e, &s->entries[i]);
+    if (status == 0)
+      status = md_entry_insert (*dest, &e);
+    if (status != 0)
+      break;
   }
-  pthread_mutex_unlock (&orig->lock);
 
-  return (0);
+  md_store_unref (s);
+  return (status);
 } /* }}} int meta_data_clone_merge */
 
 void meta_data_destroy (meta_data_t *md) /* {{{ */
@@ -348,67 +438,53 @@ void meta_data_destroy (meta_data_t *md) /* {{{ */
   if (md == NULL)
     return;
 
-  md_entry_free (md->head);
+  md_store_unref (md->store);
   pthread_mutex_destroy (&md->lock);
   free (md);
 } /* }}} void meta_data_destroy */
 
 int meta_data_exists (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int i;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
   pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return (1);
-    }
-  }
-
+  i = md_store_index (md->store, key);
   pthread_mutex_unlock (&md->lock);
-  return (0);
+
+  return ((i >= 0) ? 1 : 0);
 } /* }}} int meta_data_exists */
 
 int meta_data_type (meta_data_t *md, const char *key) /* {{{ */
 {
   meta_entry_t *e;
+  int type = 0;
 
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
   pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return e->type;
-    }
-  }
-
+  e = md_entry_lookup (md, key);
+  if (e != NULL)
+    type = e->type;
   pthread_mutex_unlock (&md->lock);
-  return 0;
+
+  return type;
 } /* }}} int meta_data_type */
 
 int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
 {
   int i = 0, count = 0;
-  meta_entry_t *e;
 
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
   pthread_mutex_lock (&md->lock);
 
-  for (e = md->head; e != NULL; e = e->next)
-    ++count;
+  if (md->store != NULL)
+    count = (int) md->store->entries_num;
 
   if (count == 0)
   {
@@ -417,8 +493,8 @@ int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
   }
 
   *toc = calloc(count, sizeof(**toc));
-  for (e = md->head; e != NULL; e = e->next)
-    (*toc)[i++] = strdup(e->key);
+  for (i = 0; i < count; i++)
+    (*toc)[i] = strdup(md->store->entries[i].key);
 
   pthread_mutex_unlock (&md->lock);
   return count;
@@ -426,41 +502,35 @@ int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
 
 int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  meta_store_t *s;
+  int i;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
   pthread_mutex_lock (&md->lock);
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
+  if (md_store_index (md->store, key) < 0)
   {
-    if (strcasecmp (key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
+    pthread_mutex_unlock (&md->lock);
+    return (-ENOENT);
   }
 
-  if (this == NULL)
+  s = md_store_writable (md);
+  if (s == NULL)
   {
     pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
+    return (-ENOMEM);
   }
 
-  if (prev == NULL)
-    md->head = this->next;
-  else
-    prev->next = this->next;
+  i = md_store_index (s, key);
+  md_entry_clear (&s->entries[i]);
+  memmove (s->entries + i, s->entries + i + 1,
+      (s->entries_num - (i + 1)) * sizeof (*s->entries));
+  s->entries_num--;
 
   pthread_mutex_unlock (&md->lock);
 
-  this->next = NULL;
-  md_entry_free (this);
-
   return (0);
 } /* }}} int meta_data_delete */
 
@@ -470,97 +540,92 @@ int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 int meta_data_add_string (meta_data_t *md, /* {{{ */
     const char *key, const char *value)
 {
-  meta_entry_t *e;
+  meta_entry_t e;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
+  if (md_entry_init (&e, key) != 0)
     return (-ENOMEM);
 
-  e->value.mv_string = md_strdup (value);
-  if (e->value.mv_string == NULL)
+  e.value.mv_string = md_strdup (value);
+  if (e.value.mv_string == NULL)
   {
     ERROR ("meta_data_add_string: md_strdup failed.");
-    md_entry_free (e);
+    md_entry_clear (&e);
     return (-ENOMEM);
   }
-  e->type = MD_TYPE_STRING;
+  e.type = MD_TYPE_STRING;
 
-  return (md_entry_insert (md, e));
+  return (md_entry_insert (md, &e));
 } /* }}} int meta_data_add_string */
 
 int meta_data_add_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t value)
 {
-  meta_entry_t *e;
+  meta_entry_t e;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
+  if (md_entry_init (&e, key) != 0)
     return (-ENOMEM);
 
-  e->value.mv_signed_int = value;
-  e->type = MD_TYPE_SIGNED_INT;
+  e.value.mv_signed_int = value;
+  e.type = MD_TYPE_SIGNED_INT;
 
-  return (md_entry_insert (md, e));
+  return (md_entry_insert (md, &e));
 } /* }}} int meta_data_add_signed_int */
 
 int meta_data_add_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t value)
 {
-  meta_entry_t *e;
+  meta_entry_t e;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
+  if (md_entry_init (&e, key) != 0)
     return (-ENOMEM);
 
-  e->value.mv_unsigned_int = value;
-  e->type = MD_TYPE_UNSIGNED_INT;
+  e.value.mv_unsigned_int = value;
+  e.type = MD_TYPE_UNSIGNED_INT;
 
-  return (md_entry_insert (md, e));
+  return (md_entry_insert (md, &e));
 } /* }}} int meta_data_add_unsigned_int */
 
 int meta_data_add_double (meta_data_t *md, /* {{{ */
     const char *key, double value)
 {
-  meta_entry_t *e;
+  meta_entry_t e;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
+  if (md_entry_init (&e, key) != 0)
     return (-ENOMEM);
 
-  e->value.mv_double = value;
-  e->type = MD_TYPE_DOUBLE;
+  e.value.mv_double = value;
+  e.type = MD_TYPE_DOUBLE;
 
-  return (md_entry_insert (md, e));
+  return (md_entry_insert (md, &e));
 } /* }}} int meta_data_add_double */
 
 int meta_data_add_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool value)
 {
-  meta_entry_t *e;
+  meta_entry_t e;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
+  if (md_entry_init (&e, key) != 0)
     return (-ENOMEM);
 
-  e->value.mv_boolean = value;
-  e->type = MD_TYPE_BOOLEAN;
+  e.value.mv_boolean = value;
+  e.type = MD_TYPE_BOOLEAN;
 
-  return (md_entry_insert (md, e));
+  return (md_entry_insert (md, &e));
 } /* }}} int meta_data_add_boolean */
 
 /*
@@ -109,9 +109,68 @@ DEF_TEST(base)
   return 0;
 }
 
+DEF_TEST(clone)
+{
+  meta_data_t *orig;
+  meta_data_t *copy;
+  meta_data_t *merged = NULL;
+  char **toc = NULL;
+  char *s;
+  int64_t si;
+  int i;
+
+  CHECK_NOT_NULL (orig = meta_data_create ());
+  CHECK_ZERO (meta_data_add_string (orig, "string", "foobar"));
+  CHECK_ZERO (meta_data_add_signed_int (orig, "signed_int", 42));
+
+  /* Modifying the clone leaves the original alone and vice versa. */
+  CHECK_NOT_NULL (copy = meta_data_clone (orig));
+  CHECK_ZERO (meta_data_add_string (copy, "string", "barqux"));
+  CHECK_ZERO (meta_data_delete (copy, "signed_int"));
+  CHECK_ZERO (meta_data_add_signed_int (orig, "SIGNED_INT", 23));
+
+  CHECK_ZERO (meta_data_get_string (orig, "string", &s));
+  EXPECT_EQ_STR ("foobar", s);
+  sfree (s);
+  CHECK_ZERO (meta_data_get_signed_int (orig, "signed_int", &si));
+  EXPECT_EQ_INT (23, (int) si);
+
+  CHECK_ZERO (meta_data_get_string (copy, "string", &s));
+  EXPECT_EQ_STR ("barqux", s);
+  sfree (s);
+  OK (meta_data_exists (copy, "signed_int") == 0);
+
+  /* Merging keeps existing keys of the destination unless overwritten. */
+  CHECK_ZERO (meta_data_add_boolean (copy, "boolean", 1));
+  CHECK_ZERO (meta_data_clone_merge (&merged, copy));
+  CHECK_ZERO (meta_data_clone_merge (&merged, orig));
+  EXPECT_EQ_INT (3, meta_data_toc (merged, &toc));
+  EXPECT_EQ_STR ("string", toc[0]);
+  EXPECT_EQ_STR ("boolean", toc[1]);
+  EXPECT_EQ_STR ("SIGNED_INT", toc[2]);
+  for (i = 0; i < 3; i++)
+    sfree (toc[i]);
+  sfree (toc);
+
+  CHECK_ZERO (meta_data_get_string (merged, "string", &s));
+  EXPECT_EQ_STR ("foobar", s);
+  sfree (s);
+
+  meta_data_destroy (orig);
+  meta_data_destroy (copy);
+
+  /* The merged copy outlives its sources. */
+  CHECK_ZERO (meta_data_get_signed_int (merged, "signed_int", &si));
+  EXPECT_EQ_INT (23, (int) si);
+  meta_data_destroy (merged);
+
+  return 0;
+}
+
 int main (void)
 {
   RUN_TEST(base);
+  RUN_TEST(clone);
 
   END_TEST;
 }
@@ -25,32 +25,96 @@
  *   Sebastian Harl <sh at tokkee.org>
  **/
 
+#define _GNU_SOURCE /* For pthread_setaffinity_np(3) */
+
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
 #include "filter_chain.h"
 #include "utils_avltree.h"
+#include "utils_btree.h"
 #include "utils_cache.h"
+#include "utils_cache_shm.h"
 #include "utils_complain.h"
 #include "utils_llist.h"
 #include "utils_heap.h"
 #include "utils_time.h"
 #include "utils_random.h"
+#include "utils_rollup.h"
+#include "utils_series_limit.h"
+#include "utils_intern.h"
+#include "utils_latency.h"
+#include "utils_procfs.h"
+#include "utils_probe.h"
+#include "types_list.h"
 
 #include <ltdl.h>
 
 /*
  * Private structures
  */
+struct writer_queue_s;
+typedef struct writer_queue_s writer_queue_t;
+
+struct notification_queue_s;
+typedef struct notification_queue_s notification_queue_t;
+struct flush_queue_s;
+typedef struct flush_queue_s flush_queue_t;
+
 struct callback_func_s
 {
 	void *cf_callback;
 	user_data_t cf_udata;
 	plugin_ctx_t cf_ctx;
+	/* Name the callback was registered with, NULL for read callbacks. */
+	char *cf_name;
+	/* Only used by write callbacks with their own queue. */
+	writer_queue_t *cf_queue;
+	/* Only used by notification callbacks with "NotificationQueueLength". */
+	notification_queue_t *cf_notification_queue;
+	/* Only used by flush callbacks, created by the first flush. */
+	flush_queue_t *cf_flush_queue;
+	/* Only used by write callbacks with a "WriteResolution". */
+	rollup_t *cf_rollup;
+
+	/* Call statistics, only collected with "CollectInternalStats". The
+	 * latency counter is reset each time it is reported. */
+	pthread_mutex_t cf_stats_lock;
+	latency_counter_t *cf_latency;
+	derive_t cf_calls;
+	/* Only used by write callbacks: the time from collecting values to
+	 * passing them to the writer, and the values that took longer than
+	 * "WriteDelayWarning". "cf_late_state" is set while the writer is
+	 * late. Protected by cf_stats_lock. */
+	latency_counter_t *cf_age;
+	derive_t cf_late;
+	_Bool cf_late_state;
 };
 typedef struct callback_func_s callback_func_t;
 
+/* Copy of a latency counter, taken by plugin_latency_stats_get(). */
+struct latency_stats_s
+{
+	size_t num;
+	cdtime_t min;
+	cdtime_t avg;
+	cdtime_t max;
+	cdtime_t p50;
+	cdtime_t p99;
+};
+typedef struct latency_stats_s latency_stats_t;
+
+/* Copy of a callback's statistics, taken by plugin_callback_stats_get(). */
+struct callback_stats_s
+{
+	derive_t calls;
+	latency_stats_t latency;
+	latency_stats_t age;
+	derive_t late;
+};
+typedef struct callback_stats_s callback_stats_t;
+
 #define RF_SIMPLE  0
 #define RF_COMPLEX 1
 #define RF_REMOVE  65535
@@ -68,16 +132,287 @@ struct read_func_s
 	cdtime_t rf_interval;
 	cdtime_t rf_effective_interval;
 	cdtime_t rf_next_read;
+
+	/* Position in "read_heap", while the function is waiting there. */
+	c_iheap_handle_t rf_heap_handle;
+
+	/* Next read function in the same run queue. */
+	struct read_func_s *rf_queue_next;
+
+	/* Statistics of the last run: how late the callback was started and how
+	 * long it took, and the number of runs that took longer than the
+	 * interval. */
+	cdtime_t rf_lag;
+	cdtime_t rf_duration;
+	derive_t rf_overruns;
+
+	/* The interval raised by plugin_read_backoff(), at least rf_interval.
+	 * Only used by the read thread running the function. */
+	cdtime_t rf_backoff_interval;
+
+	/* The pool running this function, see plugin_read_pool_get(). */
+	struct read_pool_s *rf_pool;
 };
 typedef struct read_func_s read_func_t;
 
+struct read_pool_s;
+typedef struct read_pool_s read_pool_t;
+
+/* Read functions that are due are moved from "read_heap" to the run queue of
+ * one of the read threads by the scheduler thread. A read thread only takes
+ * functions from other run queues of its pool when its own is empty. */
+struct read_queue_s
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	read_func_t    *head;
+	read_func_t    *tail;
+	long            length;
+	read_pool_t    *pool;
+	/* Start of the read callback this queue's thread is running, zero if
+	 * it is idle. Protected by the pool's "lock". */
+	cdtime_t        busy_since;
+};
+typedef struct read_queue_s read_queue_t;
+
+/* A set of read threads with one run queue each. Read functions registered
+ * in a context with "read_threads" set run in a pool of their own, shared by
+ * all functions with the same group (or name, if they have no group), so that
+ * slow plugins can't occupy the threads the other plugins rely on. All other
+ * functions run in the default pool sized by "ReadThreads". */
+struct read_pool_s
+{
+	/* NULL for the default pool. */
+	char *name;
+	int size;
+
+	pthread_t *threads;
+	read_queue_t *queues;
+	int threads_num;
+
+	/* Used by the scheduler only, while holding "read_lock". */
+	size_t next_queue;
+
+	/* Time spent in read callbacks and the number of runs. Callbacks that
+	 * are still running are accounted up to the last report. Protected by
+	 * "lock". */
+	pthread_mutex_t lock;
+	cdtime_t busy;
+	derive_t runs;
+
+	/* Values at the last report, used by plugin_read_pool_statistics()
+	 * only. */
+	cdtime_t busy_reported;
+	cdtime_t time_reported;
+
+	read_pool_t *next;
+};
+
 struct write_queue_s;
 typedef struct write_queue_s write_queue_t;
+/* Number of values stored inside a write queue element. Value lists with up
+ * to this many values are queued with a single allocation, which is usually
+ * taken from a write queue shard's pool of recycled elements. */
+#define WRITE_QUEUE_INLINE_VALUES 4
+
+/* Maximum number of recycled elements kept per write queue shard. */
+#define WRITE_QUEUE_POOL_MAX 1024
+
+/* Type instances and values of an element queued by
+ * plugin_dispatch_values_vec(). They are stored in the same allocation. */
+struct write_queue_vec_s
+{
+	size_t num;
+	value_t *values;
+	char **type_instances;
+};
+typedef struct write_queue_vec_s write_queue_vec_t;
+
 struct write_queue_s
 {
-	value_list_t *vl;
+	value_list_t vl;
+	/* Data set of "vl" if it is already known, NULL otherwise. */
+	const data_set_t *ds;
 	plugin_ctx_t ctx;
 	write_queue_t *next;
+	/* If not NULL, "vl" is a template which is dispatched once for each of
+	 * these values. */
+	write_queue_vec_t *vec;
+	/* When the element was queued, zero unless statistics are collected. */
+	cdtime_t enqueued;
+
+	value_t values[WRITE_QUEUE_INLINE_VALUES];
+};
+
+/* Per thread state of threads dispatching values. "spare" is a recycled queue
+ * element taken from a shard's pool and used for the next enqueued value
+ * list. */
+struct write_queue_thread_s
+{
+	size_t next;
+	write_queue_t *spare;
+};
+typedef struct write_queue_thread_s write_queue_thread_t;
+
+/* The write queue is split into one shard per write thread. Each write thread
+ * owns one shard and only takes values from other shards if its own is empty.
+ * Callers of plugin_dispatch_values() rotate over the shards, so concurrent
+ * producers and consumers rarely contend for the same lock. With
+ * "WriteQueueByIdentifier", the shard is chosen by the identifier's cache
+ * shard instead and threads don't take values from other shards, so the
+ * values of an identifier are written by one thread, in order. */
+struct write_queue_shard_s
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	write_queue_t  *head;
+	write_queue_t  *tail;
+	/* Values of plugins with a "DispatchPriority" of "High". They are taken
+	 * before the ones above. "length" counts both lanes. */
+	write_queue_t  *urgent_head;
+	write_queue_t  *urgent_tail;
+	long            length;
+
+	write_queue_t  *pool;
+	size_t          pool_num;
+	derive_t        pool_hits;
+	derive_t        pool_misses;
+
+	/* Time the elements spent in the queue, see write_queue_t.enqueued. */
+	latency_counter_t *wait;
+
+	/* "write_epoch" when the thread of this shard started its current
+	 * batch, zero while it is idle. See plugin_write_defer_free(). */
+	volatile unsigned long epoch;
+};
+typedef struct write_queue_shard_s write_queue_shard_t;
+
+/* A structure passed to plugin_write_defer_free(). It is freed once no write
+ * thread is handling a batch it started before "epoch" was incremented. */
+struct write_retired_s
+{
+	void (*free_func) (void *);
+	void *data;
+	unsigned long epoch;
+	struct write_retired_s *next;
+};
+typedef struct write_retired_s write_retired_t;
+
+/* Value lists handed to a batch writer while a write thread handles one batch
+ * of queued value lists. */
+struct write_batch_writer_s
+{
+	callback_func_t *cf;
+	write_batch_entry_t *entries;
+	size_t entries_num;
+};
+typedef struct write_batch_writer_s write_batch_writer_t;
+
+/* Per write thread state. "values" holds copies of all value lists passed to
+ * batch writers; they are freed after the batch writers have been called. */
+struct write_batch_s
+{
+	size_t size;
+	_Bool flushing;
+
+	value_list_t **values;
+	size_t values_num;
+
+	write_batch_writer_t *writers;
+	size_t writers_num;
+};
+typedef struct write_batch_s write_batch_t;
+
+/* Per write thread state for updating the cache of all elements taken from
+ * the write queue in one go, see plugin_write_cache_batch_dispatch(). "ds"
+ * holds the data set of each element in "items" if the cache has already
+ * been updated for it, NULL otherwise. "update_ds" and "update_vl" are the
+ * arguments of uc_update_batch(). */
+struct write_cache_batch_s
+{
+	size_t size;
+	size_t num;
+	write_queue_t **items;
+	const data_set_t **ds;
+	const data_set_t **update_ds;
+	const value_list_t **update_vl;
+};
+typedef struct write_cache_batch_s write_cache_batch_t;
+
+/* Queue of a single writer. Writers configured with their own "WriteThreads"
+ * or "WriteQueueLimitHigh" in the <LoadPlugin> block are not called by the
+ * write threads directly. Instead, plugin_write() appends a copy of the value
+ * list to the writer's queue, and the writer's own threads call it. This way a
+ * slow writer can't stall the other writers, and its queue limits and drop
+ * policy apply to it alone. */
+struct writer_queue_s
+{
+	char *name;
+	callback_func_t *cf;
+	_Bool batch;
+
+	pthread_mutex_t lock;
+	/* Signalled when values are added. */
+	pthread_cond_t  cond;
+	/* Signalled when producers blocked by the "Block" policy may continue. */
+	pthread_cond_t  space;
+	write_queue_t  *head;
+	write_queue_t  *tail;
+	long            length;
+
+	write_queue_t  *pool;
+	size_t          pool_num;
+
+	long            limit_high;
+	long            limit_low;
+	int             policy;
+	/* Set by "DropNewest" when the high limit is reached, cleared when the
+	 * queue has shrunk to the low limit. */
+	_Bool           overflow;
+	size_t          waiters;
+	derive_t        dropped;
+	cdtime_t        last_message;
+	/* Time the elements spent in the queue, see write_queue_t.enqueued. */
+	latency_counter_t *wait;
+
+	_Bool           loop;
+	pthread_t      *threads;
+	size_t          threads_num;
+};
+
+/* A notification waiting in the queue of a notification callback. "ctx" is
+ * the context of the plugin that dispatched it. */
+struct notification_queue_entry_s
+{
+	notification_t n;
+	plugin_ctx_t ctx;
+	struct notification_queue_entry_s *next;
+};
+typedef struct notification_queue_entry_s notification_queue_entry_t;
+
+/* Queue of a single notification callback, see "NotificationQueueLength".
+ * plugin_dispatch_notification() appends a copy of the notification and the
+ * callback's own thread calls it, so slow callbacks, e.g. sending mail, don't
+ * stall the read and write threads. A notification that is identical to the
+ * last queued one is counted as "coalesced" instead of being queued again. */
+struct notification_queue_s
+{
+	char *name;
+	callback_func_t *cf;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	notification_queue_entry_t *head;
+	notification_queue_entry_t *tail;
+	long            length;
+	long            limit;
+	derive_t        dropped;
+	derive_t        coalesced;
+	cdtime_t        last_message;
+
+	_Bool           loop;
+	_Bool           running;
+	pthread_t       thread;
 };
 
 struct flush_callback_s {
@@ -86,6 +421,55 @@ struct flush_callback_s {
 };
 typedef struct flush_callback_s flush_callback_t;
 
+/* See plugin_flush_request_create(). Protected by "flush_lock". */
+struct plugin_flush_request_s
+{
+	/* Queued flushes which haven't returned yet, plus one until the creator
+	 * waits for or releases the request. */
+	size_t pending;
+	/* Queued flushes plus one for the creator. */
+	size_t refs;
+	int success;
+	int error;
+	cdtime_t deadline;
+	plugin_flush_done_cb done;
+	void *arg;
+};
+
+/* A flush waiting in the queue of a flush callback. Identical flushes share
+ * one entry and are answered by the same call of the callback. */
+struct flush_queue_entry_s
+{
+	cdtime_t timeout;
+	char *identifier;
+	plugin_flush_request_t **requests;
+	size_t requests_num;
+	struct flush_queue_entry_s *next;
+};
+typedef struct flush_queue_entry_s flush_queue_entry_t;
+
+/* Queue of a single flush callback. Flushes are handed to the callback's own
+ * thread, so that a writer taking minutes to flush its files holds up neither
+ * the other writers nor the thread asking for the flush, e.g. the read
+ * scheduler or a unixsock client. */
+struct flush_queue_s
+{
+	char *name;
+	callback_func_t *cf;
+
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	flush_queue_entry_t *head;
+	flush_queue_entry_t *tail;
+	long            length;
+	derive_t        coalesced;
+	derive_t        expired;
+
+	_Bool           loop;
+	_Bool           running;
+	pthread_t       thread;
+};
+
 /*
  * Private variables
  */
@@ -93,39 +477,108 @@ static c_avl_tree_t *plugins_loaded = NULL;
 
 static llist_t *list_init;
 static llist_t *list_write;
+static llist_t *list_write_batch;
 static llist_t *list_flush;
 static llist_t *list_missing;
 static llist_t *list_shutdown;
+static llist_t *list_memory;
 static llist_t *list_log;
 static llist_t *list_notification;
 
+/* Serializes changes to the callback lists above, which init callbacks may
+ * make concurrently if "InitThreads" is greater than one. The lists are read
+ * without holding this lock. */
+static pthread_mutex_t callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* An init callback run by plugin_init_all(). */
+struct init_job_s
+{
+	llentry_t *le;
+	int status;
+	cdtime_t start; /* zero until the callback has been started */
+	cdtime_t duration;
+	_Bool done;
+	_Bool warned;
+};
+typedef struct init_job_s init_job_t;
+
+/* The init callbacks of one round, shared by plugin_init_all() and the init
+ * threads and protected by "init_lock". */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  init_cond = PTHREAD_COND_INITIALIZER;
+static init_job_t     *init_jobs = NULL;
+static size_t          init_jobs_num = 0;
+static size_t          init_jobs_next = 0;
+static size_t          init_jobs_done = 0;
+
+/* A message waiting for the log thread, see "LogQueueLength". */
+struct log_record_s
+{
+	int level;
+	char msg[1024];
+};
+typedef struct log_record_s log_record_t;
+
+/* A ring of "log_queue_size" records, protected by "log_lock". The queue
+ * only exists while the log thread is running. */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  log_cond = PTHREAD_COND_INITIALIZER;
+static log_record_t   *log_queue = NULL;
+static size_t          log_queue_size = 0;
+static size_t          log_queue_head = 0;
+static size_t          log_queue_num = 0;
+static uint64_t        log_dropped = 0;
+static _Bool           log_thread_loop = 0;
+static pthread_t       log_thread_id;
+
 static fc_chain_t *pre_cache_chain = NULL;
 static fc_chain_t *post_cache_chain = NULL;
 
-static c_avl_tree_t *data_sets;
+static c_btree_t *data_sets;
 
 static char *plugindir = NULL;
 
 #ifndef DEFAULT_MAX_READ_INTERVAL
 # define DEFAULT_MAX_READ_INTERVAL TIME_T_TO_CDTIME_T (86400)
 #endif
-static c_heap_t       *read_heap = NULL;
+static c_iheap_t      *read_heap = NULL;
 static llist_t        *read_list;
 static int             read_loop = 1;
 static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  read_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t      *read_threads = NULL;
-static int             read_threads_num = 0;
+static read_pool_t     read_pool_default = { .lock = PTHREAD_MUTEX_INITIALIZER };
+/* Dedicated pools, protected by "read_lock". */
+static read_pool_t    *read_pools = NULL;
+static _Bool           read_threads_started = 0;
+static pthread_t       read_scheduler;
+/* Time the scheduler sleeps until, zero if it is not sleeping. Protected by
+ * "read_lock". */
+static cdtime_t        read_scheduler_wakeup = 0;
 static cdtime_t        max_read_interval = DEFAULT_MAX_READ_INTERVAL;
-
-static write_queue_t  *write_queue_head;
-static write_queue_t  *write_queue_tail;
-static long            write_queue_length = 0;
+/* If set, callbacks are started at a fixed, per-callback offset within their
+ * interval rather than all at the same time. */
+static _Bool           read_phase_spread = 0;
+/* If set, the intervals of read callbacks are raised while the host is
+ * overloaded, see plugin_read_backoff(). */
+static _Bool           read_backoff = 0;
+
+static write_queue_shard_t *write_queues = NULL;
+static size_t          write_queues_num = 0;
+static pthread_mutex_t write_queues_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t   write_queue_key;
 static _Bool           write_loop = 1;
-static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  write_cond = PTHREAD_COND_INITIALIZER;
 static pthread_t      *write_threads = NULL;
 static size_t          write_threads_num = 0;
+static size_t          write_batch_size = 1;
+/* If set, the values of one identifier always go to the same shard. */
+static _Bool           write_queue_by_identifier = 0;
+static pthread_key_t   write_batch_key;
+/* Incremented by plugin_write_defer_free(). Both are protected by
+ * write_retired_lock. */
+static volatile unsigned long write_epoch = 1;
+static write_retired_t * volatile write_retired = NULL;
+static pthread_mutex_t write_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Bool           write_batch_key_initialized = 0;
 
 static pthread_key_t   plugin_ctx_key;
 static _Bool           plugin_ctx_key_initialized = 0;
@@ -133,13 +586,35 @@ static _Bool           plugin_ctx_key_initialized = 0;
 static long            write_limit_high = 0;
 static long            write_limit_low = 0;
 
+/* Only set with "SeriesLimit" or "PluginMemoryLimit". */
+static series_limit_t *series_limit = NULL;
+
+/* Memory each plugin may use before its new series are dropped, zero if
+ * unlimited. Set with "PluginMemoryLimit". */
+static size_t          plugin_memory_limit = 0;
+
+/* Protects "stats_values_dropped". */
+static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
 static derive_t        stats_values_dropped = 0;
 static _Bool           record_statistics = 0;
 
+/* Values reaching a writer more than this fraction of their interval after
+ * they were collected are late, see "WriteDelayWarning". Zero if disabled. */
+static double          write_delay_warning = 0.0;
+
 /*
  * Static functions
  */
-static int plugin_dispatch_values_internal (value_list_t *vl);
+static int plugin_dispatch_values_internal (const data_set_t *ds,
+		value_list_t *vl, _Bool cached);
+static void plugin_dispatch_values_vec_internal (write_queue_t *q);
+static const data_set_t *plugin_find_data_set (const char *type);
+static void plugin_value_list_escape (value_list_t *vl);
+static void plugin_writer_queue_destroy (writer_queue_t *wq);
+static void plugin_notification_queue_destroy (notification_queue_t *nq);
+static void plugin_flush_queue_destroy (flush_queue_t *fq);
+static int plugin_writer_call (callback_func_t *cf, _Bool batch,
+		const data_set_t *ds, const value_list_t *vl);
 
 static const char *plugin_get_dir (void)
 {
@@ -149,809 +624,4258 @@ static const char *plugin_get_dir (void)
 		return (plugindir);
 }
 
-static void plugin_update_internal_statistics (void) { /* {{{ */
-	derive_t copy_write_queue_length;
+/* Returns the number of value lists in all write queue shards. The shards'
+ * lengths are read without locking, so the result is only approximate while
+ * values are being enqueued and dequeued. */
+static long plugin_write_queue_length (void) /* {{{ */
+{
+	long length = 0;
+	size_t i;
+
+	for (i = 0; i < write_queues_num; i++)
+		length += write_queues[i].length;
+
+	return (length);
+} /* }}} long plugin_write_queue_length */
+
+/* Sums up the pool statistics of all write queue shards. Like
+ * plugin_write_queue_length(), this reads the counters without locking. */
+static void plugin_write_queue_pool_stats (derive_t *hits, /* {{{ */
+		derive_t *misses)
+{
+	size_t i;
+
+	*hits = 0;
+	*misses = 0;
+	for (i = 0; i < write_queues_num; i++)
+	{
+		*hits += write_queues[i].pool_hits;
+		*misses += write_queues[i].pool_misses;
+	}
+} /* }}} void plugin_write_queue_pool_stats */
+
+/* Copies "lc" to "stats" and resets it. The caller must hold the lock
+ * protecting "lc", which may be NULL. */
+static void plugin_latency_stats_get (latency_counter_t *lc, /* {{{ */
+		latency_stats_t *stats)
+{
+	memset (stats, 0, sizeof (*stats));
+	if (lc == NULL)
+		return;
+
+	stats->num = latency_counter_get_num (lc);
+	stats->min = latency_counter_get_min (lc);
+	stats->avg = latency_counter_get_average (lc);
+	stats->max = latency_counter_get_max (lc);
+	stats->p50 = latency_counter_get_percentile (lc, 50.0);
+	stats->p99 = latency_counter_get_percentile (lc, 99.0);
+	latency_counter_reset (lc);
+} /* }}} void plugin_latency_stats_get */
+
+/* Dispatches "stats" with the type "type" and the type instances
+ * "<prefix>_min", "<prefix>_avg", ..., or "min", "avg", ... if "prefix" is
+ * NULL. The host, plugin and plugin instance are taken from "vl". Nothing
+ * is dispatched if no events were counted. */
+static void plugin_latency_stats_dispatch (value_list_t *vl, /* {{{ */
+		char const *type, char const *prefix,
+		latency_stats_t const *stats)
+{
+	struct {
+		char const *name;
+		cdtime_t value;
+	} latencies[] = {
+		{ "min", stats->min },
+		{ "avg", stats->avg },
+		{ "max", stats->max },
+		{ "p50", stats->p50 },
+		{ "p99", stats->p99 },
+	};
+	size_t i;
+
+	if (stats->num == 0)
+		return;
+
+	sstrncpy (vl->type, type, sizeof (vl->type));
+	for (i = 0; i < STATIC_ARRAY_SIZE (latencies); i++)
+	{
+		vl->values[0].gauge = CDTIME_T_TO_DOUBLE (latencies[i].value);
+		if (prefix == NULL)
+			sstrncpy (vl->type_instance, latencies[i].name,
+					sizeof (vl->type_instance));
+		else
+			ssnprintf (vl->type_instance, sizeof (vl->type_instance),
+					"%s_%s", prefix, latencies[i].name);
+		plugin_dispatch_values (vl);
+	}
+} /* }}} void plugin_latency_stats_dispatch */
+
+/* Copies the time values spent in the write queue shards to "stats". The
+ * shards' counters are merged one shard lock at a time and reset. */
+static void plugin_write_queue_wait_stats (latency_stats_t *stats) /* {{{ */
+{
+	latency_counter_t *sum;
+	size_t i;
+
+	memset (stats, 0, sizeof (*stats));
+
+	sum = latency_counter_create ();
+	if (sum == NULL)
+		return;
+
+	for (i = 0; i < write_queues_num; i++)
+	{
+		write_queue_shard_t *shard = &write_queues[i];
+
+		pthread_mutex_lock (&shard->lock);
+		if (shard->wait != NULL)
+		{
+			(void) latency_counter_merge (sum, shard->wait);
+			latency_counter_reset (shard->wait);
+		}
+		pthread_mutex_unlock (&shard->lock);
+	}
+
+	plugin_latency_stats_get (sum, stats);
+	latency_counter_destroy (sum);
+} /* }}} void plugin_write_queue_wait_stats */
+
+static void plugin_writer_queue_foreach (void (*func) (writer_queue_t *));
+
+/* Dispatches the length and number of dropped values of a writer's queue as
+ * "collectd/write_queue-<writer>/...". */
+static void plugin_writer_queue_statistics (writer_queue_t *wq) /* {{{ */
+{
 	value_list_t vl = VALUE_LIST_INIT;
-	value_t values[2];
+	value_t values[1];
+	long length;
+	derive_t dropped;
+	latency_stats_t wait;
 
-	copy_write_queue_length = write_queue_length;
+	pthread_mutex_lock (&wq->lock);
+	length = wq->length;
+	dropped = wq->dropped;
+	plugin_latency_stats_get (wq->wait, &wait);
+	pthread_mutex_unlock (&wq->lock);
 
-	/* Initialize `vl' */
 	vl.values = values;
-	vl.values_len = 2;
+	vl.values_len = 1;
 	vl.time = 0;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+	ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+			"write_queue-%s", wq->name);
 
-	vl.type_instance[0] = 0;
-	vl.values_len = 1;
-
-	/* Write queue */
-	sstrncpy (vl.plugin_instance, "write_queue",
-			sizeof (vl.plugin_instance));
-
-	/* Write queue : queue length */
-	vl.values[0].gauge = (gauge_t) copy_write_queue_length;
+	vl.values[0].gauge = (gauge_t) length;
 	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
-	vl.type_instance[0] = 0;
 	plugin_dispatch_values (&vl);
 
-	/* Write queue : Values dropped (queue length > low limit) */
-	vl.values[0].derive = (derive_t) stats_values_dropped;
+	vl.values[0].derive = dropped;
 	sstrncpy (vl.type, "derive", sizeof (vl.type));
 	sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
 	plugin_dispatch_values (&vl);
 
-	/* Cache */
-	sstrncpy (vl.plugin_instance, "cache",
-			sizeof (vl.plugin_instance));
+	/* Time the values spent in the queue */
+	plugin_latency_stats_dispatch (&vl, "delay", "wait", &wait);
+} /* }}} void plugin_writer_queue_statistics */
 
-	/* Cache : Nb entry in cache tree */
-	vl.values[0].gauge = (gauge_t) uc_get_size();
-	sstrncpy (vl.type, "cache_size", sizeof (vl.type));
-	vl.type_instance[0] = 0;
+/* Dispatches the length of a notification callback's queue and the number of
+ * dropped and coalesced notifications as
+ * "collectd/notification_queue-<callback>/...". */
+static void plugin_notification_queue_statistics ( /* {{{ */
+		notification_queue_t *nq)
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	long length;
+	derive_t dropped;
+	derive_t coalesced;
+
+	pthread_mutex_lock (&nq->lock);
+	length = nq->length;
+	dropped = nq->dropped;
+	coalesced = nq->coalesced;
+	pthread_mutex_unlock (&nq->lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+	ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+			"notification_queue-%s", nq->name);
+
+	vl.values[0].gauge = (gauge_t) length;
+	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
 	plugin_dispatch_values (&vl);
 
-	return;
-} /* }}} void plugin_update_internal_statistics */
+	vl.values[0].derive = dropped;
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
 
-static void destroy_callback (callback_func_t *cf) /* {{{ */
+	vl.values[0].derive = coalesced;
+	sstrncpy (vl.type_instance, "coalesced", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+} /* }}} void plugin_notification_queue_statistics */
+
+/* Dispatches the length of a flush callback's queue, the number of coalesced
+ * flushes and the number of flushes skipped because their deadline had passed
+ * as "collectd/flush_queue-<callback>/...". The latency of the flushes is
+ * reported with the other callback statistics. */
+static void plugin_flush_queue_statistics (flush_queue_t *fq) /* {{{ */
 {
-	if (cf == NULL)
-		return;
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	long length;
+	derive_t coalesced;
+	derive_t expired;
 
-	if ((cf->cf_udata.data != NULL) && (cf->cf_udata.free_func != NULL))
-	{
-		cf->cf_udata.free_func (cf->cf_udata.data);
-		cf->cf_udata.data = NULL;
-		cf->cf_udata.free_func = NULL;
-	}
-	sfree (cf);
-} /* }}} void destroy_callback */
+	pthread_mutex_lock (&fq->lock);
+	length = fq->length;
+	coalesced = fq->coalesced;
+	expired = fq->expired;
+	pthread_mutex_unlock (&fq->lock);
 
-static void destroy_all_callbacks (llist_t **list) /* {{{ */
-{
-	llentry_t *le;
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+	ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+			"flush_queue-%s", fq->name);
 
-	if (*list == NULL)
-		return;
+	vl.values[0].gauge = (gauge_t) length;
+	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+	plugin_dispatch_values (&vl);
 
-	le = llist_head (*list);
-	while (le != NULL)
-	{
-		llentry_t *le_next;
+	vl.values[0].derive = coalesced;
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "coalesced", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
 
-		le_next = le->next;
+	vl.values[0].derive = expired;
+	sstrncpy (vl.type_instance, "expired", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+} /* }}} void plugin_flush_queue_statistics */
 
-		sfree (le->key);
-		destroy_callback (le->value);
-		le->value = NULL;
+/* Dispatches the number of series, the number of new series and the number of
+ * dropped values of a plugin as "collectd/series_limit-<plugin>/...". */
+static void plugin_series_limit_statistics (char const *plugin, /* {{{ */
+		size_t series_num, derive_t series_new, derive_t dropped,
+		__attribute__((unused)) void *arg)
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
 
-		le = le_next;
-	}
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+	ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+			"series_limit-%s", plugin);
 
-	llist_destroy (*list);
-	*list = NULL;
-} /* }}} void destroy_all_callbacks */
+	vl.values[0].gauge = (gauge_t) series_num;
+	sstrncpy (vl.type, "count", sizeof (vl.type));
+	plugin_dispatch_values (&vl);
 
-static void destroy_read_heap (void) /* {{{ */
+	vl.values[0].derive = series_new;
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "new", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = dropped;
+	sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+} /* }}} void plugin_series_limit_statistics */
+
+static void plugin_callback_stats_init (callback_func_t *cf) /* {{{ */
 {
-	if (read_heap == NULL)
-		return;
+	pthread_mutex_init (&cf->cf_stats_lock, /* attr = */ NULL);
+	cf->cf_latency = NULL;
+	cf->cf_calls = 0;
+	cf->cf_age = NULL;
+	cf->cf_late = 0;
+	cf->cf_late_state = 0;
+} /* }}} void plugin_callback_stats_init */
+
+/* Returns the time to pass to plugin_callback_done(), or zero if statistics
+ * are not collected. */
+static cdtime_t plugin_callback_start (void) /* {{{ */
+{
+	if (!record_statistics)
+		return (0);
+	return (cdtime ());
+} /* }}} cdtime_t plugin_callback_start */
 
-	while (42)
-	{
-		read_func_t *rf;
+/* Accounts one call of "cf" that was started at "start". */
+static void plugin_callback_done (callback_func_t *cf, /* {{{ */
+		cdtime_t start)
+{
+	cdtime_t now;
 
-		rf = c_heap_get_root (read_heap);
-		if (rf == NULL)
-			break;
-		sfree (rf->rf_name);
-		destroy_callback ((callback_func_t *) rf);
-	}
+	if (start == 0)
+		return;
 
-	c_heap_destroy (read_heap);
-	read_heap = NULL;
-} /* }}} void destroy_read_heap */
+	now = cdtime ();
+
+	pthread_mutex_lock (&cf->cf_stats_lock);
+	if (cf->cf_latency == NULL)
+		cf->cf_latency = latency_counter_create ();
+	if (cf->cf_latency != NULL)
+		latency_counter_add (cf->cf_latency,
+				(now > start) ? (now - start) : 0);
+	cf->cf_calls++;
+	pthread_mutex_unlock (&cf->cf_stats_lock);
+} /* }}} void plugin_callback_done */
+
+/* Adds the time "q" spent in a queue to "*wait", which is created on first
+ * use. The caller must hold the lock protecting "*wait". */
+static void plugin_queue_wait_add (latency_counter_t **wait, /* {{{ */
+		write_queue_t const *q, cdtime_t now)
+{
+	if (q->enqueued == 0)
+		return;
 
-static int register_callback (llist_t **list, /* {{{ */
-		const char *name, callback_func_t *cf)
+	if (*wait == NULL)
+		*wait = latency_counter_create ();
+	if (*wait != NULL)
+		latency_counter_add (*wait,
+				(now > q->enqueued) ? (now - q->enqueued) : 0);
+} /* }}} void plugin_queue_wait_add */
+
+/* Sends a notification when the writer "name" starts ("late" is true) or
+ * stops being late, see "WriteDelayWarning". */
+static void plugin_writer_late_notify (char const *name, /* {{{ */
+		value_list_t const *vl, cdtime_t age, cdtime_t limit, _Bool late)
 {
-	llentry_t *le;
-	char *key;
+	notification_t n;
+
+	memset (&n, 0, sizeof (n));
+	n.severity = late ? NOTIF_WARNING : NOTIF_OKAY;
+	n.time = cdtime ();
+	sstrncpy (n.host, hostname_g, sizeof (n.host));
+	sstrncpy (n.plugin, "collectd", sizeof (n.plugin));
+	ssnprintf (n.plugin_instance, sizeof (n.plugin_instance),
+			"write-%s", name);
+	sstrncpy (n.type, "delay", sizeof (n.type));
+
+	if (late)
+		ssnprintf (n.message, sizeof (n.message),
+				"Values reach the \"%s\" writer %.3f seconds after they "
+				"were collected, more than the limit of %.3f seconds "
+				"(e.g. %s/%s).", name, CDTIME_T_TO_DOUBLE (age),
+				CDTIME_T_TO_DOUBLE (limit), vl->plugin, vl->type);
+	else
+		ssnprintf (n.message, sizeof (n.message),
+				"Values reach the \"%s\" writer in time again, %.3f "
+				"seconds after they were collected.",
+				name, CDTIME_T_TO_DOUBLE (age));
+
+	plugin_dispatch_notification (&n);
+} /* }}} void plugin_writer_late_notify */
+
+/* Accounts the time between collecting the "entries_num" values in
+ * "entries" and passing them to the writer "cf" at "now". With
+ * "WriteDelayWarning", values older than that fraction of their interval
+ * are counted as late and a notification is sent when the writer starts
+ * being late. It is considered in time again once a value arrives within
+ * half the limit, so a writer close to the limit doesn't flap. */
+static void plugin_writer_age (callback_func_t *cf, /* {{{ */
+		write_batch_entry_t const *entries, size_t entries_num,
+		cdtime_t now)
+{
+	value_list_t const *late_vl = NULL;
+	cdtime_t late_age = 0;
+	cdtime_t late_limit = 0;
+	_Bool was_late;
+	_Bool is_late;
+	size_t i;
 
-	if (*list == NULL)
+	pthread_mutex_lock (&cf->cf_stats_lock);
+	was_late = cf->cf_late_state;
+	for (i = 0; i < entries_num; i++)
 	{
-		*list = llist_create ();
-		if (*list == NULL)
+		value_list_t const *vl = entries[i].vl;
+		cdtime_t age = (now > vl->time) ? (now - vl->time) : 0;
+		cdtime_t limit = 0;
+
+		if (record_statistics)
+		{
+			if (cf->cf_age == NULL)
+				cf->cf_age = latency_counter_create ();
+			if (cf->cf_age != NULL)
+				latency_counter_add (cf->cf_age, age);
+		}
+
+		if ((write_delay_warning <= 0.0) || (vl->interval == 0))
+			continue;
+
+		limit = DOUBLE_TO_CDTIME_T (write_delay_warning
+				* CDTIME_T_TO_DOUBLE (vl->interval));
+		if (age > limit)
+		{
+			cf->cf_late++;
+			if (!cf->cf_late_state)
+			{
+				cf->cf_late_state = 1;
+				late_vl = vl;
+				late_age = age;
+				late_limit = limit;
+			}
+		}
+		else if (cf->cf_late_state && (age <= limit / 2))
+		{
+			cf->cf_late_state = 0;
+			late_vl = vl;
+			late_age = age;
+			late_limit = limit;
+		}
+	}
+	is_late = cf->cf_late_state;
+	pthread_mutex_unlock (&cf->cf_stats_lock);
+
+	/* Only the last change within the batch is reported. */
+	if ((is_late != was_late) && (late_vl != NULL))
+		plugin_writer_late_notify (cf->cf_name, late_vl,
+				late_age, late_limit, is_late);
+} /* }}} void plugin_writer_age */
+
+/* Copies the statistics of "cf" to "stats" and starts a new latency
+ * measurement period. */
+static void plugin_callback_stats_get (callback_func_t *cf, /* {{{ */
+		callback_stats_t *stats)
+{
+	memset (stats, 0, sizeof (*stats));
+
+	pthread_mutex_lock (&cf->cf_stats_lock);
+	stats->calls = cf->cf_calls;
+	plugin_latency_stats_get (cf->cf_latency, &stats->latency);
+	plugin_latency_stats_get (cf->cf_age, &stats->age);
+	stats->late = cf->cf_late;
+	pthread_mutex_unlock (&cf->cf_stats_lock);
+} /* }}} void plugin_callback_stats_get */
+
+/* Dispatches "stats" as "collectd/<kind>-<name>/...". The latency is only
+ * reported if the callback was called since the last report; the number
+ * of late values only for writers and with "WriteDelayWarning". */
+static void plugin_callback_stats_dispatch (char const *kind, /* {{{ */
+		char const *name, callback_stats_t const *stats)
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+	ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+			"%s-%s", kind, name);
+
+	vl.values[0].derive = stats->calls;
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "calls", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	plugin_latency_stats_dispatch (&vl, "duration", NULL, &stats->latency);
+
+	/* Writer : time from collecting the values to writing them */
+	plugin_latency_stats_dispatch (&vl, "delay", "age", &stats->age);
+
+	if ((write_delay_warning > 0.0) && (strcmp ("write", kind) == 0))
+	{
+		vl.values[0].derive = stats->late;
+		sstrncpy (vl.type, "derive", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "late", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+	}
+} /* }}} void plugin_callback_stats_dispatch */
+
+/* Dispatches the call statistics of all callbacks in "list". */
+static void plugin_callback_list_statistics (llist_t *list, /* {{{ */
+		char const *kind)
+{
+	llentry_t *le;
+
+	if (list == NULL)
+		return;
+
+	for (le = llist_head (list); le != NULL; le = le->next)
+	{
+		callback_stats_t stats;
+
+		plugin_callback_stats_get (le->value, &stats);
+		plugin_callback_stats_dispatch (kind, le->key, &stats);
+	}
+} /* }}} void plugin_callback_list_statistics */
+
+/* Dispatches the scheduling statistics of all read callbacks as
+ * "collectd/read-<name>/...". The numbers are copied while holding
+ * "read_lock" and dispatched after releasing it. */
+static void plugin_read_statistics (void) /* {{{ */
+{
+	struct {
+		char name[DATA_MAX_NAME_LEN];
+		cdtime_t lag;
+		cdtime_t duration;
+		cdtime_t interval;
+		derive_t overruns;
+		callback_stats_t calls;
+	} *stats;
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	llentry_t *le;
+	size_t stats_num;
+	size_t i;
+
+	pthread_mutex_lock (&read_lock);
+	stats_num = (read_list != NULL) ? (size_t) llist_size (read_list) : 0;
+	if (stats_num == 0)
+	{
+		pthread_mutex_unlock (&read_lock);
+		return;
+	}
+
+	stats = calloc (stats_num, sizeof (*stats));
+	if (stats == NULL)
+	{
+		pthread_mutex_unlock (&read_lock);
+		ERROR ("plugin_read_statistics: calloc failed.");
+		return;
+	}
+
+	for (le = llist_head (read_list), i = 0;
+			(le != NULL) && (i < stats_num);
+			le = le->next, i++)
+	{
+		read_func_t *rf = le->value;
+
+		sstrncpy (stats[i].name, rf->rf_name, sizeof (stats[i].name));
+		stats[i].lag = rf->rf_lag;
+		stats[i].duration = rf->rf_duration;
+		stats[i].interval = rf->rf_effective_interval;
+		stats[i].overruns = rf->rf_overruns;
+		plugin_callback_stats_get (&rf->rf_super, &stats[i].calls);
+	}
+	stats_num = i;
+	pthread_mutex_unlock (&read_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+
+	for (i = 0; i < stats_num; i++)
+	{
+		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+				"read-%s", stats[i].name);
+
+		/* Read callback : time spent in the last run */
+		vl.values[0].gauge = CDTIME_T_TO_DOUBLE (stats[i].duration);
+		sstrncpy (vl.type, "duration", sizeof (vl.type));
+		vl.type_instance[0] = 0;
+		plugin_dispatch_values (&vl);
+
+		/* Read callback : how late the last run was started */
+		vl.values[0].gauge = CDTIME_T_TO_DOUBLE (stats[i].lag);
+		sstrncpy (vl.type, "delay", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "lag", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+
+		/* Read callback : interval after backing off failures or load */
+		vl.values[0].gauge = CDTIME_T_TO_DOUBLE (stats[i].interval);
+		sstrncpy (vl.type, "duration", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "interval", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+
+		/* Read callback : runs that took longer than the interval */
+		vl.values[0].derive = stats[i].overruns;
+		sstrncpy (vl.type, "derive", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "overruns", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+
+		plugin_callback_stats_dispatch ("read", stats[i].name,
+				&stats[i].calls);
+	}
+
+	sfree (stats);
+} /* }}} void plugin_read_statistics */
+
+/* Copies the statistics of "pool" to "stats". The caller must hold
+ * "read_lock". */
+static void plugin_read_pool_stats_get (read_pool_t *pool, /* {{{ */
+		cdtime_t now, char *name, size_t name_size, int *threads,
+		long *queued, gauge_t *busy_percent, derive_t *runs)
+{
+	cdtime_t busy;
+	cdtime_t elapsed;
+	int i;
+
+	sstrncpy (name, (pool->name != NULL) ? pool->name : "default",
+			name_size);
+	*threads = pool->threads_num;
+
+	/* Like plugin_write_queue_length(), this is only approximate. */
+	*queued = 0;
+	for (i = 0; i < pool->threads_num; i++)
+		*queued += pool->queues[i].length;
+
+	pthread_mutex_lock (&pool->lock);
+	/* Account the callbacks still running up to now. */
+	for (i = 0; i < pool->threads_num; i++)
+	{
+		read_queue_t *rq = pool->queues + i;
+
+		if ((rq->busy_since == 0) || (rq->busy_since >= now))
+			continue;
+		pool->busy += now - rq->busy_since;
+		rq->busy_since = now;
+	}
+	busy = pool->busy;
+	*runs = pool->runs;
+	pthread_mutex_unlock (&pool->lock);
+
+	/* The share of the pool's thread time spent in read callbacks since
+	 * the last report. */
+	*busy_percent = NAN;
+	elapsed = now - pool->time_reported;
+	if ((pool->time_reported != 0) && (elapsed > 0)
+			&& (pool->threads_num > 0))
+		*busy_percent = 100.0 * CDTIME_T_TO_DOUBLE (busy - pool->busy_reported)
+			/ (CDTIME_T_TO_DOUBLE (elapsed) * (double) pool->threads_num);
+	pool->busy_reported = busy;
+	pool->time_reported = now;
+} /* }}} void plugin_read_pool_stats_get */
+
+/* Dispatches the size, run queue length, utilization and number of runs of
+ * each read thread pool as "collectd/read_pool-<name>/...". */
+static void plugin_read_pool_statistics (void) /* {{{ */
+{
+	struct {
+		char name[DATA_MAX_NAME_LEN];
+		int threads;
+		long queued;
+		gauge_t busy;
+		derive_t runs;
+	} *stats;
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	read_pool_t *pool;
+	cdtime_t now = cdtime ();
+	size_t stats_num = 1;
+	size_t i;
+
+	pthread_mutex_lock (&read_lock);
+	if (read_pool_default.threads == NULL)
+	{
+		pthread_mutex_unlock (&read_lock);
+		return;
+	}
+
+	for (pool = read_pools; pool != NULL; pool = pool->next)
+		stats_num++;
+
+	stats = calloc (stats_num, sizeof (*stats));
+	if (stats == NULL)
+	{
+		pthread_mutex_unlock (&read_lock);
+		ERROR ("plugin_read_pool_statistics: calloc failed.");
+		return;
+	}
+
+	pool = &read_pool_default;
+	for (i = 0; (i < stats_num) && (pool != NULL); i++)
+	{
+		plugin_read_pool_stats_get (pool, now,
+				stats[i].name, sizeof (stats[i].name),
+				&stats[i].threads, &stats[i].queued,
+				&stats[i].busy, &stats[i].runs);
+		pool = (pool == &read_pool_default) ? read_pools : pool->next;
+	}
+	stats_num = i;
+	pthread_mutex_unlock (&read_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+
+	for (i = 0; i < stats_num; i++)
+	{
+		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+				"read_pool-%s", stats[i].name);
+
+		/* Read pool : number of threads */
+		vl.values[0].gauge = (gauge_t) stats[i].threads;
+		sstrncpy (vl.type, "threads", sizeof (vl.type));
+		vl.type_instance[0] = 0;
+		plugin_dispatch_values (&vl);
+
+		/* Read pool : functions due, but not started yet */
+		vl.values[0].gauge = (gauge_t) stats[i].queued;
+		sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+		plugin_dispatch_values (&vl);
+
+		/* Read pool : share of the time spent in read callbacks */
+		if (!isnan (stats[i].busy))
+		{
+			vl.values[0].gauge = stats[i].busy;
+			sstrncpy (vl.type, "percent", sizeof (vl.type));
+			sstrncpy (vl.type_instance, "busy",
+					sizeof (vl.type_instance));
+			plugin_dispatch_values (&vl);
+		}
+
+		/* Read pool : number of read callbacks run */
+		vl.values[0].derive = stats[i].runs;
+		sstrncpy (vl.type, "derive", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "runs", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+	}
+
+	sfree (stats);
+} /* }}} void plugin_read_pool_statistics */
+
+static void plugin_update_internal_statistics (void) { /* {{{ */
+	derive_t copy_write_queue_length;
+	derive_t pool_hits;
+	derive_t pool_misses;
+	latency_stats_t wait;
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[2];
+
+	copy_write_queue_length = plugin_write_queue_length ();
+
+	/* Initialize `vl' */
+	vl.values = values;
+	vl.values_len = 2;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+
+	vl.type_instance[0] = 0;
+	vl.values_len = 1;
+
+	/* Write queue */
+	sstrncpy (vl.plugin_instance, "write_queue",
+			sizeof (vl.plugin_instance));
+
+	/* Write queue : queue length */
+	vl.values[0].gauge = (gauge_t) copy_write_queue_length;
+	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+	vl.type_instance[0] = 0;
+	plugin_dispatch_values (&vl);
+
+	/* Write queue : Values dropped (queue length > low limit) */
+	vl.values[0].derive = (derive_t) stats_values_dropped;
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	/* Write queue : Elements taken from / not found in the pool */
+	plugin_write_queue_pool_stats (&pool_hits, &pool_misses);
+	vl.values[0].derive = pool_hits;
+	sstrncpy (vl.type_instance, "pool_hits", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].derive = pool_misses;
+	sstrncpy (vl.type_instance, "pool_misses", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	/* Write queue : time the values spent in the queue */
+	plugin_write_queue_wait_stats (&wait);
+	plugin_latency_stats_dispatch (&vl, "delay", "wait", &wait);
+
+	/* Write queues of individual writers */
+	plugin_writer_queue_foreach (plugin_writer_queue_statistics);
+
+	/* Queues of notification callbacks */
+	if (list_notification != NULL)
+	{
+		llentry_t *le;
+
+		for (le = llist_head (list_notification); le != NULL; le = le->next)
+		{
+			callback_func_t *cf = le->value;
+
+			if (cf->cf_notification_queue != NULL)
+				plugin_notification_queue_statistics (
+						cf->cf_notification_queue);
+		}
+	}
+
+	/* Queues of flush callbacks */
+	if (list_flush != NULL)
+	{
+		llentry_t *le;
+
+		for (le = llist_head (list_flush); le != NULL; le = le->next)
+		{
+			callback_func_t *cf = le->value;
+
+			if (cf->cf_flush_queue != NULL)
+				plugin_flush_queue_statistics (cf->cf_flush_queue);
+		}
+	}
+
+	/* Series limits */
+	if (series_limit != NULL)
+		series_limit_stats (series_limit,
+				plugin_series_limit_statistics, /* arg = */ NULL);
+
+	/* Read callbacks */
+	plugin_read_statistics ();
+	plugin_read_pool_statistics ();
+
+	/* Init, write, flush and notification callbacks */
+	plugin_callback_list_statistics (list_init, "init");
+	plugin_callback_list_statistics (list_write, "write");
+	plugin_callback_list_statistics (list_write_batch, "write");
+	plugin_callback_list_statistics (list_flush, "flush");
+	plugin_callback_list_statistics (list_notification, "notification");
+
+	/* Cache */
+	sstrncpy (vl.plugin_instance, "cache",
+			sizeof (vl.plugin_instance));
+
+	/* Cache : Nb entry in cache tree */
+	vl.values[0].gauge = (gauge_t) uc_get_size();
+	sstrncpy (vl.type, "cache_size", sizeof (vl.type));
+	vl.type_instance[0] = 0;
+	plugin_dispatch_values (&vl);
+
+	return;
+} /* }}} void plugin_update_internal_statistics */
+
+/* Memory used by the structures holding a plugin's values, see
+ * plugin_memory_update(). */
+struct plugin_memory_s
+{
+	char name[DATA_MAX_NAME_LEN];
+	size_t cache_entries;
+	size_t cache;
+	size_t write_queue;
+	size_t plugin;
+	_Bool has_plugin;
+};
+typedef struct plugin_memory_s plugin_memory_t;
+
+static plugin_memory_t *plugin_memory_get (c_avl_tree_t *tree, /* {{{ */
+		char const *name)
+{
+	plugin_memory_t *m = NULL;
+
+	if (c_avl_get (tree, name, (void *) &m) == 0)
+		return (m);
+
+	m = calloc (1, sizeof (*m));
+	if (m == NULL)
+		return (NULL);
+	sstrncpy (m->name, name, sizeof (m->name));
+	if (c_avl_insert (tree, m->name, m) != 0)
+	{
+		sfree (m);
+		return (NULL);
+	}
+
+	return (m);
+} /* }}} plugin_memory_t *plugin_memory_get */
+
+static void plugin_memory_cache (char const *plugin, /* {{{ */
+		size_t entries_num, size_t bytes, void *arg)
+{
+	plugin_memory_t *m = plugin_memory_get (arg, plugin);
+
+	if (m == NULL)
+		return;
+	m->cache_entries += entries_num;
+	m->cache += bytes;
+} /* }}} void plugin_memory_cache */
+
+/* Returns the memory used by a queued value list. */
+static size_t write_queue_memory (write_queue_t const *q) /* {{{ */
+{
+	size_t bytes = sizeof (*q);
+	size_t i;
+
+	if (q->vl.values != q->values)
+		bytes += q->vl.values_len * sizeof (*q->vl.values);
+
+	if (q->vec != NULL)
+	{
+		bytes += sizeof (*q->vec) + q->vec->num
+			* (sizeof (*q->vec->values) + sizeof (*q->vec->type_instances));
+		for (i = 0; i < q->vec->num; i++)
+			bytes += strlen (q->vec->type_instances[i]) + 1;
+	}
+
+	return (bytes);
+} /* }}} size_t write_queue_memory */
+
+/* Accounts the value lists of a write queue to the plugins which dispatched
+ * them. The caller must hold the lock of the queue. */
+static void plugin_memory_queue (c_avl_tree_t *tree, /* {{{ */
+		write_queue_t const *head)
+{
+	plugin_memory_t *last = NULL;
+	write_queue_t const *q;
+
+	/* Value lists of one plugin tend to be queued together. */
+	for (q = head; q != NULL; q = q->next)
+	{
+		if ((last == NULL) || (strcmp (last->name, q->vl.plugin) != 0))
+			last = plugin_memory_get (tree, q->vl.plugin);
+		if (last == NULL)
+			return;
+		last->write_queue += write_queue_memory (q);
+	}
+} /* }}} void plugin_memory_queue */
+
+static void plugin_memory_submit (plugin_memory_t const *m) /* {{{ */
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = 0;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+	ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+			"memory-%s", m->name);
+
+	vl.values[0].gauge = (gauge_t) m->cache_entries;
+	sstrncpy (vl.type, "cache_size", sizeof (vl.type));
+	plugin_dispatch_values (&vl);
+
+	sstrncpy (vl.type, "memory", sizeof (vl.type));
+	vl.values[0].gauge = (gauge_t) m->cache;
+	sstrncpy (vl.type_instance, "cache", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	vl.values[0].gauge = (gauge_t) m->write_queue;
+	sstrncpy (vl.type_instance, "write_queue", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	if (m->has_plugin)
+	{
+		vl.values[0].gauge = (gauge_t) m->plugin;
+		sstrncpy (vl.type_instance, "plugin", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+	}
+} /* }}} void plugin_memory_submit */
+
+/* Estimates the memory used on behalf of each plugin: its entries in the value
+ * cache, its value lists waiting in the write queues and what its "memory"
+ * callback reports. The estimates are dispatched as internal statistics, and
+ * plugins above "PluginMemoryLimit" are frozen by the series limit until they
+ * are below 90% of the limit again. */
+static void plugin_memory_update (void) /* {{{ */
+{
+	c_avl_tree_t *tree;
+	llentry_t *le;
+	plugin_memory_t *m;
+	char *name;
+	size_t i;
+
+	tree = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	if (tree == NULL)
+		return;
+
+	uc_memory_stats (plugin_memory_cache, tree);
+
+	for (i = 0; i < write_queues_num; i++)
+	{
+		pthread_mutex_lock (&write_queues[i].lock);
+		plugin_memory_queue (tree, write_queues[i].head);
+		plugin_memory_queue (tree, write_queues[i].urgent_head);
+		pthread_mutex_unlock (&write_queues[i].lock);
+	}
+
+	for (le = (list_write != NULL) ? llist_head (list_write) : NULL;
+			le != NULL; le = le->next)
+	{
+		writer_queue_t *wq = ((callback_func_t *) le->value)->cf_queue;
+
+		if (wq == NULL)
+			continue;
+		pthread_mutex_lock (&wq->lock);
+		plugin_memory_queue (tree, wq->head);
+		pthread_mutex_unlock (&wq->lock);
+	}
+
+	for (le = (list_write_batch != NULL) ? llist_head (list_write_batch)
+			: NULL; le != NULL; le = le->next)
+	{
+		writer_queue_t *wq = ((callback_func_t *) le->value)->cf_queue;
+
+		if (wq == NULL)
+			continue;
+		pthread_mutex_lock (&wq->lock);
+		plugin_memory_queue (tree, wq->head);
+		pthread_mutex_unlock (&wq->lock);
+	}
+
+	for (le = (list_memory != NULL) ? llist_head (list_memory) : NULL;
+			le != NULL; le = le->next)
+	{
+		callback_func_t *cf = le->value;
+		plugin_memory_cb callback = cf->cf_callback;
+		plugin_ctx_t old_ctx;
+		size_t bytes = 0;
+		int status;
+
+		old_ctx = plugin_set_ctx (cf->cf_ctx);
+		status = (*callback) (&bytes);
+		plugin_set_ctx (old_ctx);
+
+		if ((status != 0) || ((m = plugin_memory_get (tree, le->key)) == NULL))
+			continue;
+		m->plugin += bytes;
+		m->has_plugin = 1;
+	}
+
+	while (c_avl_pick (tree, (void *) &name, (void *) &m) == 0)
+	{
+		size_t total = m->cache + m->write_queue + m->plugin;
+
+		if (record_statistics)
+			plugin_memory_submit (m);
+
+		if ((plugin_memory_limit > 0) && (series_limit != NULL))
+		{
+			if (total > plugin_memory_limit)
+				series_limit_freeze (series_limit, m->name, 1);
+			else if (total < plugin_memory_limit / 10 * 9)
+				series_limit_freeze (series_limit, m->name, 0);
+		}
+
+		sfree (m);
+	}
+	c_avl_destroy (tree);
+} /* }}} void plugin_memory_update */
+
+static void destroy_callback (callback_func_t *cf) /* {{{ */
+{
+	if (cf == NULL)
+		return;
+
+	/* Stop the writer's threads before its user data goes away. */
+	if (cf->cf_queue != NULL)
+	{
+		plugin_writer_queue_destroy (cf->cf_queue);
+		cf->cf_queue = NULL;
+	}
+	if (cf->cf_notification_queue != NULL)
+	{
+		plugin_notification_queue_destroy (cf->cf_notification_queue);
+		cf->cf_notification_queue = NULL;
+	}
+	if (cf->cf_flush_queue != NULL)
+	{
+		plugin_flush_queue_destroy (cf->cf_flush_queue);
+		cf->cf_flush_queue = NULL;
+	}
+	rollup_destroy (cf->cf_rollup);
+	cf->cf_rollup = NULL;
+
+	if ((cf->cf_udata.data != NULL) && (cf->cf_udata.free_func != NULL))
+	{
+		cf->cf_udata.free_func (cf->cf_udata.data);
+		cf->cf_udata.data = NULL;
+		cf->cf_udata.free_func = NULL;
+	}
+
+	latency_counter_destroy (cf->cf_latency);
+	latency_counter_destroy (cf->cf_age);
+	pthread_mutex_destroy (&cf->cf_stats_lock);
+	sfree (cf->cf_name);
+	sfree (cf);
+} /* }}} void destroy_callback */
+
+static void destroy_all_callbacks (llist_t **list) /* {{{ */
+{
+	llentry_t *le;
+
+	if (*list == NULL)
+		return;
+
+	le = llist_head (*list);
+	while (le != NULL)
+	{
+		llentry_t *le_next;
+
+		le_next = le->next;
+
+		sfree (le->key);
+		destroy_callback (le->value);
+		le->value = NULL;
+
+		le = le_next;
+	}
+
+	llist_destroy (*list);
+	*list = NULL;
+} /* }}} void destroy_all_callbacks */
+
+static void destroy_read_heap (void) /* {{{ */
+{
+	while (read_pools != NULL)
+	{
+		read_pool_t *pool = read_pools;
+
+		read_pools = pool->next;
+		pthread_mutex_destroy (&pool->lock);
+		sfree (pool->name);
+		sfree (pool);
+	}
+
+	if (read_heap == NULL)
+		return;
+
+	while (42)
+	{
+		read_func_t *rf;
+
+		rf = c_iheap_get_root (read_heap, NULL);
+		if (rf == NULL)
+			break;
+		sfree (rf->rf_name);
+		destroy_callback ((callback_func_t *) rf);
+	}
+
+	c_iheap_destroy (read_heap);
+	read_heap = NULL;
+} /* }}} void destroy_read_heap */
+
+static int register_callback (llist_t **list, /* {{{ */
+		const char *name, callback_func_t *cf)
+{
+	llentry_t *le;
+	callback_func_t *old_cf;
+	char *key;
+
+	key = strdup (name);
+	if (cf->cf_name == NULL)
+		cf->cf_name = strdup (name);
+	if ((key == NULL) || (cf->cf_name == NULL))
+	{
+		ERROR ("plugin: register_callback: strdup failed.");
+		sfree (key);
+		destroy_callback (cf);
+		return (-1);
+	}
+
+	pthread_mutex_lock (&callbacks_lock);
+
+	if (*list == NULL)
+	{
+		*list = llist_create_indexed ();
+		if (*list == NULL)
+		{
+			pthread_mutex_unlock (&callbacks_lock);
+			ERROR ("plugin: register_callback: "
+					"llist_create_indexed failed.");
+			sfree (key);
+			destroy_callback (cf);
+			return (-1);
+		}
+	}
+
+	le = llist_search (*list, name);
+	if (le == NULL)
+	{
+		le = llentry_create (key, cf);
+		if (le == NULL)
+		{
+			pthread_mutex_unlock (&callbacks_lock);
+			ERROR ("plugin: register_callback: "
+					"llentry_create failed.");
+			sfree (key);
+			destroy_callback (cf);
+			return (-1);
+		}
+
+		llist_append (*list, le);
+		pthread_mutex_unlock (&callbacks_lock);
+		return (0);
+	}
+
+	old_cf = le->value;
+	le->value = cf;
+	pthread_mutex_unlock (&callbacks_lock);
+
+	WARNING ("plugin: register_callback: "
+			"a callback named `%s' already exists - "
+			"overwriting the old entry!", name);
+
+	destroy_callback (old_cf);
+	sfree (key);
+
+	return (0);
+} /* }}} int register_callback */
+
+static void log_list_callbacks (llist_t **list, /* {{{ */
+				const char *comment)
+{
+	char *str;
+	int len;
+	llentry_t *le;
+	int i;
+	int n;
+	char **keys;
+
+	n = llist_size(*list);
+	if (n == 0)
+	{
+		INFO("%s [none]", comment);
+		return;
+	}
+
+	keys = calloc(n, sizeof(char*));
+
+	if (keys == NULL)
+	{
+		ERROR("%s: failed to allocate memory for list of callbacks",
+		      comment);
+
+		return;
+	}
+
+	for (le = llist_head (*list), i = 0, len = 0;
+	     le != NULL;
+	     le = le->next, i++)
+	{
+		keys[i] = le->key;
+		len += strlen(le->key) + 6;
+	}
+	str = malloc(len + 10);
+	if (str == NULL)
+	{
+		ERROR("%s: failed to allocate memory for list of callbacks",
+		      comment);
+	}
+	else
+	{
+		*str = '\0';
+		strjoin(str, len, keys, n, "', '");
+		INFO("%s ['%s']", comment, str);
+		sfree (str);
+	}
+	sfree (keys);
+} /* }}} void log_list_callbacks */
+
+static callback_func_t *create_callback (void *callback, /* {{{ */
+		user_data_t *ud)
+{
+	callback_func_t *cf;
+
+	cf = calloc (1, sizeof (*cf));
+	if (cf == NULL)
+	{
+		ERROR ("plugin: create_callback: calloc failed.");
+		return (NULL);
+	}
+
+	cf->cf_callback = callback;
+	if (ud == NULL)
+	{
+		cf->cf_udata.data = NULL;
+		cf->cf_udata.free_func = NULL;
+	}
+	else
+	{
+		cf->cf_udata = *ud;
+	}
+
+	cf->cf_ctx = plugin_get_ctx ();
+	plugin_callback_stats_init (cf);
+
+	return (cf);
+} /* }}} callback_func_t *create_callback */
+
+static int create_register_callback (llist_t **list, /* {{{ */
+		const char *name, void *callback, user_data_t *ud)
+{
+	callback_func_t *cf;
+
+	cf = create_callback (callback, ud);
+	if (cf == NULL)
+		return (-1);
+
+	return (register_callback (list, name, cf));
+} /* }}} int create_register_callback */
+
+static int plugin_unregister (llist_t *list, const char *name) /* {{{ */
+{
+	llentry_t *e;
+
+	if (list == NULL)
+		return (-1);
+
+	pthread_mutex_lock (&callbacks_lock);
+	e = llist_search (list, name);
+	if (e == NULL)
+	{
+		pthread_mutex_unlock (&callbacks_lock);
+		return (-1);
+	}
+
+	llist_remove (list, e);
+	pthread_mutex_unlock (&callbacks_lock);
+
+	sfree (e->key);
+	destroy_callback (e->value);
+
+	llentry_destroy (e);
+
+	return (0);
+} /* }}} int plugin_unregister */
+
+/*
+ * (Try to) load the shared object `file'. Won't complain if it isn't a shared
+ * object, but it will bitch about a shared object not having a
+ * ``module_register'' symbol..
+ */
+static int plugin_load_file (char *file, uint32_t flags)
+{
+	lt_dlhandle dlh;
+	void (*reg_handle) (void);
+
+	lt_dlinit ();
+	lt_dlerror (); /* clear errors */
+
+#if LIBTOOL_VERSION == 2
+	if (flags & PLUGIN_FLAGS_GLOBAL) {
+		lt_dladvise advise;
+		lt_dladvise_init(&advise);
+		lt_dladvise_global(&advise);
+		dlh = lt_dlopenadvise(file, advise);
+		lt_dladvise_destroy(&advise);
+	} else {
+		dlh = lt_dlopen (file);
+	}
+#else /* if LIBTOOL_VERSION == 1 */
+	if (flags & PLUGIN_FLAGS_GLOBAL)
+		WARNING ("plugin_load_file: The global flag is not supported, "
+				"libtool 2 is required for this.");
+	dlh = lt_dlopen (file);
+#endif
+
+	if (dlh == NULL)
+	{
+		char errbuf[1024] = "";
+
+		ssnprintf (errbuf, sizeof (errbuf),
+				"lt_dlopen (\"%s\") failed: %s. "
+				"The most common cause for this problem is "
+				"missing dependencies. Use ldd(1) to check "
+				"the dependencies of the plugin "
+				"/ shared object.",
+				file, lt_dlerror ());
+
+		ERROR ("%s", errbuf);
+		/* Make sure this is printed to STDERR in any case, but also
+		 * make sure it's printed only once. */
+		if (list_log != NULL)
+			fprintf (stderr, "ERROR: %s\n", errbuf);
+
+		return (1);
+	}
+
+	if ((reg_handle = (void (*) (void)) lt_dlsym (dlh, "module_register")) == NULL)
+	{
+		WARNING ("Couldn't find symbol \"module_register\" in \"%s\": %s\n",
+				file, lt_dlerror ());
+		lt_dlclose (dlh);
+		return (-1);
+	}
+
+	(*reg_handle) ();
+
+	return (0);
+}
+
+/* Returns the first time at or after "now" at which "rf" should be read. With
+ * "ReadPhaseSpread" enabled, this is the next multiple of the interval plus an
+ * offset derived from the host and callback name, so that callbacks sharing an
+ * interval are spread evenly across it and keep their offset across restarts.
+ * Otherwise, this is "now". */
+static cdtime_t plugin_read_phase (read_func_t const *rf, cdtime_t now) /* {{{ */
+{
+	char name[2 * DATA_MAX_NAME_LEN];
+	cdtime_t interval = rf->rf_interval;
+	cdtime_t offset;
+	cdtime_t next;
+
+	if (!read_phase_spread || (interval == 0))
+		return (now);
+
+	ssnprintf (name, sizeof (name), "%s/%s", hostname_g, rf->rf_name);
+	offset = (cdtime_t) (((double) identifier_hash_name (name))
+			/ 4294967296.0 * (double) interval);
+	if (offset >= interval)
+		offset = 0;
+
+	next = now - (now % interval) + offset;
+	if (next < now)
+		next += interval;
+
+	return (next);
+} /* }}} cdtime_t plugin_read_phase */
+
+/* Moves all read functions in the heap to the start of their phase. Used when
+ * "ReadPhaseSpread" is enabled after callbacks have already been registered.
+ * Must not be called while the read threads are running. */
+static void plugin_read_phase_all (void) /* {{{ */
+{
+	read_func_t *list = NULL;
+	read_func_t *rf;
+	cdtime_t now = cdtime ();
+
+	pthread_mutex_lock (&read_lock);
+	if (read_heap == NULL)
+	{
+		pthread_mutex_unlock (&read_lock);
+		return;
+	}
+
+	/* The run queue pointer isn't used before the read threads start. */
+	while ((rf = c_iheap_get_root (read_heap, NULL)) != NULL)
+	{
+		rf->rf_queue_next = list;
+		list = rf;
+	}
+
+	while (list != NULL)
+	{
+		rf = list;
+		list = rf->rf_queue_next;
+		rf->rf_queue_next = NULL;
+
+		if (rf->rf_type != RF_REMOVE)
+			rf->rf_next_read = plugin_read_phase (rf, now);
+		c_iheap_insert (read_heap, &rf->rf_heap_handle,
+				rf->rf_next_read, rf);
+	}
+	pthread_mutex_unlock (&read_lock);
+} /* }}} void plugin_read_phase_all */
+
+static void plugin_read_queue_push (read_queue_t *rq, /* {{{ */
+		read_func_t *rf)
+{
+	rf->rf_queue_next = NULL;
+
+	pthread_mutex_lock (&rq->lock);
+	if (rq->tail == NULL)
+		rq->head = rf;
+	else
+		rq->tail->rf_queue_next = rf;
+	rq->tail = rf;
+	rq->length++;
+	pthread_cond_signal (&rq->cond);
+	pthread_mutex_unlock (&rq->lock);
+} /* }}} void plugin_read_queue_push */
+
+/* Removes the first read function from "rq". The caller must hold the queue's
+ * lock. */
+static read_func_t *plugin_read_queue_pop (read_queue_t *rq) /* {{{ */
+{
+	read_func_t *rf = rq->head;
+
+	if (rf == NULL)
+		return (NULL);
+
+	rq->head = rf->rf_queue_next;
+	if (rq->head == NULL)
+		rq->tail = NULL;
+	rq->length--;
+	rf->rf_queue_next = NULL;
+
+	return (rf);
+} /* }}} read_func_t *plugin_read_queue_pop */
+
+/* Takes one read function from any run queue of the same pool other than
+ * "own". Queues that are currently locked by somebody else are skipped. */
+static read_func_t *plugin_read_queue_steal (read_queue_t *own) /* {{{ */
+{
+	read_pool_t *pool = own->pool;
+	size_t offset = (size_t) (own - pool->queues);
+	int i;
+
+	for (i = 1; i < pool->threads_num; i++)
+	{
+		read_queue_t *rq;
+		read_func_t *rf;
+
+		rq = &pool->queues[(offset + (size_t) i) % (size_t) pool->threads_num];
+		if (rq->head == NULL)
+			continue;
+
+		if (pthread_mutex_trylock (&rq->lock) != 0)
+			continue;
+
+		rf = plugin_read_queue_pop (rq);
+		pthread_mutex_unlock (&rq->lock);
+
+		if (rf != NULL)
+			return (rf);
+	}
+
+	return (NULL);
+} /* }}} read_func_t *plugin_read_queue_steal */
+
+/* Returns the next read function to run from "own" or from one of the other
+ * run queues. Blocks until a function is available or the read threads are
+ * stopped. */
+static read_func_t *plugin_read_queue_next (read_queue_t *own) /* {{{ */
+{
+	read_func_t *rf;
+
+	pthread_mutex_lock (&own->lock);
+	rf = plugin_read_queue_pop (own);
+	while ((read_loop != 0) && (rf == NULL))
+	{
+		pthread_mutex_unlock (&own->lock);
+		rf = plugin_read_queue_steal (own);
+		pthread_mutex_lock (&own->lock);
+
+		if (rf != NULL)
+			break;
+
+		/* Check the own queue again while holding the lock, so we
+		 * don't miss a signal that was sent while stealing. */
+		rf = plugin_read_queue_pop (own);
+		if ((rf != NULL) || (read_loop == 0))
+			break;
+
+		pthread_cond_wait (&own->cond, &own->lock);
+		rf = plugin_read_queue_pop (own);
+	}
+	pthread_mutex_unlock (&own->lock);
+
+	return (rf);
+} /* }}} read_func_t *plugin_read_queue_next */
+
+/* Puts "rf" back into the heap and wakes up the scheduler if "rf" is due
+ * before the time it is sleeping until. Functions that were unregistered
+ * while they were running are free'd instead. */
+static void plugin_read_reschedule (read_func_t *rf) /* {{{ */
+{
+	pthread_mutex_lock (&read_lock);
+	if (rf->rf_type == RF_REMOVE)
+	{
+		pthread_mutex_unlock (&read_lock);
+		DEBUG ("plugin_read_reschedule: Destroying the `%s' "
+				"callback.", rf->rf_name);
+		sfree (rf->rf_name);
+		destroy_callback ((callback_func_t *) rf);
+		return;
+	}
+
+	c_iheap_insert (read_heap, &rf->rf_heap_handle, rf->rf_next_read, rf);
+	if ((read_scheduler_wakeup != 0)
+			&& (rf->rf_next_read < read_scheduler_wakeup))
+		pthread_cond_signal (&read_cond);
+	pthread_mutex_unlock (&read_lock);
+} /* }}} void plugin_read_reschedule */
+
+/* The scheduler sleeps until the first read function in "read_heap" is due.
+ * It then moves all read functions that are due to the read threads' run
+ * queues in one go, so the read threads never touch the heap or "read_lock"
+ * while waiting for work. */
+static void *plugin_read_scheduler (void __attribute__((unused)) *args) /* {{{ */
+{
+	pthread_mutex_lock (&read_lock);
+	while (read_loop != 0)
+	{
+		read_func_t *rf;
+		read_pool_t *pool;
+		cdtime_t now;
+
+		rf = c_iheap_peek (read_heap, NULL);
+		if (rf == NULL)
+		{
+			read_scheduler_wakeup = (cdtime_t) UINT64_MAX;
+			pthread_cond_wait (&read_cond, &read_lock);
+			read_scheduler_wakeup = 0;
+			continue;
+		}
+
+		/* The entry has been marked for deletion. The linked list
+		 * entry has already been removed by `plugin_unregister_read',
+		 * which removes functions waiting in the heap right away, so
+		 * this is only a safety net. All we have to do here is free
+		 * the `read_func_t' and continue. */
+		if (rf->rf_type == RF_REMOVE)
+		{
+			c_iheap_remove (read_heap, &rf->rf_heap_handle);
+			DEBUG ("plugin_read_scheduler: Destroying the `%s' "
+					"callback.", rf->rf_name);
+			sfree (rf->rf_name);
+			destroy_callback ((callback_func_t *) rf);
+			continue;
+		}
+
+		if (rf->rf_interval == 0)
+		{
+			/* this should not happen, because the interval is set
+			 * for each plugin when loading it
+			 * XXX: issue a warning? */
+			rf->rf_interval = plugin_get_interval ();
+			rf->rf_effective_interval = rf->rf_interval;
+			rf->rf_backoff_interval = rf->rf_interval;
+
+			rf->rf_next_read = cdtime ();
+			c_iheap_update (read_heap, &rf->rf_heap_handle,
+					rf->rf_next_read);
+			continue;
+		}
+
+		now = cdtime ();
+		if (rf->rf_next_read > now)
+		{
+			struct timespec ts = { 0 };
+
+			/* Not due yet: sleep until it is, or until an earlier
+			 * function is inserted. Spurious wakeups are handled
+			 * by re-checking the heap. */
+			read_scheduler_wakeup = rf->rf_next_read;
+			CDTIME_T_TO_TIMESPEC (rf->rf_next_read, &ts);
+			pthread_cond_timedwait (&read_cond, &read_lock, &ts);
+			read_scheduler_wakeup = 0;
+			continue;
+		}
+
+		/* Hand out all functions due now, spreading them evenly over
+		 * the run queues of their pool. Functions whose pool failed to
+		 * start run in the default pool. */
+		pool = rf->rf_pool;
+		if ((pool == NULL) || (pool->threads_num == 0))
+			pool = &read_pool_default;
+
+		c_iheap_remove (read_heap, &rf->rf_heap_handle);
+		plugin_read_queue_push (&pool->queues[pool->next_queue], rf);
+		pool->next_queue = (pool->next_queue + 1)
+			% (size_t) pool->threads_num;
+	} /* while (read_loop) */
+	pthread_mutex_unlock (&read_lock);
+
+	pthread_exit (NULL);
+	return ((void *) 0);
+} /* }}} void *plugin_read_scheduler */
+
+/* Returns true if the write queue is long enough for values of callbacks
+ * with "priority" to be backed off: above "WriteQueueLimitLow", where values
+ * start being dropped, for low priority and at "WriteQueueLimitHigh" for
+ * normal priority callbacks. */
+static _Bool plugin_read_backoff_queue (int priority) /* {{{ */
+{
+	long length;
+
+	if (write_limit_high == 0)
+		return (0);
+
+	length = plugin_write_queue_length ();
+	if (priority == PLUGIN_READ_PRIORITY_LOW)
+		return (length > write_limit_low);
+	return (length >= write_limit_high);
+} /* }}} _Bool plugin_read_backoff_queue */
+
+/* With "ReadBackoff", doubles the interval of "rf", up to "MaxReadInterval",
+ * when its last run took "elapsed", longer than the interval, or when the
+ * write queue is backed up (see plugin_read_backoff_queue()). Callbacks with
+ * a high "ReadPriority" are never backed off. Once the overload is gone, the
+ * interval recovers by halving the difference to the configured interval
+ * after each run, so that the load doesn't return all at once. */
+static void plugin_read_backoff (read_func_t *rf, cdtime_t elapsed) /* {{{ */
+{
+	int priority = rf->rf_ctx.read_priority;
+	cdtime_t old = rf->rf_backoff_interval;
+
+	if (priority == PLUGIN_READ_PRIORITY_HIGH)
+		rf->rf_backoff_interval = rf->rf_interval;
+	else if ((elapsed > rf->rf_backoff_interval)
+			|| plugin_read_backoff_queue (priority))
+	{
+		rf->rf_backoff_interval *= 2;
+		if (rf->rf_backoff_interval > max_read_interval)
+			rf->rf_backoff_interval = max_read_interval;
+		if (rf->rf_backoff_interval < rf->rf_interval)
+			rf->rf_backoff_interval = rf->rf_interval;
+	}
+	else if (rf->rf_backoff_interval > rf->rf_interval)
+	{
+		cdtime_t excess = rf->rf_backoff_interval - rf->rf_interval;
+
+		/* Snap back once the difference is a millisecond or less. */
+		excess = (excess > MS_TO_CDTIME_T (1)) ? excess / 2 : 0;
+		rf->rf_backoff_interval = rf->rf_interval + excess;
+	}
+
+	if ((old == rf->rf_interval) && (rf->rf_backoff_interval > old))
+		NOTICE ("plugin: The host is overloaded. Reading `%s' every "
+				"%.3f seconds instead of every %.3f seconds.",
+				rf->rf_name,
+				CDTIME_T_TO_DOUBLE (rf->rf_backoff_interval),
+				CDTIME_T_TO_DOUBLE (rf->rf_interval));
+	else if ((old > rf->rf_interval)
+			&& (rf->rf_backoff_interval == rf->rf_interval))
+		INFO ("plugin: Reading `%s' at its interval of %.3f seconds "
+				"again.", rf->rf_name,
+				CDTIME_T_TO_DOUBLE (rf->rf_interval));
+
+	/* The interval may be even longer after a failure. */
+	if (rf->rf_backoff_interval > rf->rf_effective_interval)
+		rf->rf_effective_interval = rf->rf_backoff_interval;
+} /* }}} void plugin_read_backoff */
+
+static void *plugin_read_thread (void *args)
+{
+	read_queue_t *own = args;
+
+	while (read_loop != 0)
+	{
+		read_func_t *rf;
+		plugin_ctx_t old_ctx;
+		cdtime_t start;
+		cdtime_t now;
+		cdtime_t elapsed;
+		int status;
+		int rf_type;
+
+		rf = plugin_read_queue_next (own);
+		if (rf == NULL)
+			continue;
+
+		/* Must hold `read_lock' when accessing `rf->rf_type'. */
+		pthread_mutex_lock (&read_lock);
+		rf_type = rf->rf_type;
+		pthread_mutex_unlock (&read_lock);
+
+		/* Check if we're supposed to stop.. This may have interrupted
+		 * the sleep, too. */
+		if (read_loop == 0)
+		{
+			/* Insert `rf' again, so it can be free'd correctly */
+			plugin_read_reschedule (rf);
+			break;
+		}
+
+		/* The entry has been marked for deletion after it was handed
+		 * to us. */
+		if (rf_type == RF_REMOVE)
+		{
+			DEBUG ("plugin_read_thread: Destroying the `%s' "
+					"callback.", rf->rf_name);
+			sfree (rf->rf_name);
+			destroy_callback ((callback_func_t *) rf);
+			rf = NULL;
+			continue;
+		}
+
+		DEBUG ("plugin_read_thread: Handling `%s'.", rf->rf_name);
+
+		start = cdtime ();
+		rf->rf_lag = (start > rf->rf_next_read)
+			? (start - rf->rf_next_read) : 0;
+
+		old_ctx = plugin_set_ctx (rf->rf_ctx);
+
+		pthread_mutex_lock (&own->pool->lock);
+		own->busy_since = start;
+		pthread_mutex_unlock (&own->pool->lock);
+
+		PROBE1 (read_begin, rf->rf_name);
+		if (rf_type == RF_SIMPLE)
+		{
+			int (*callback) (void);
+
+			callback = rf->rf_callback;
+			status = (*callback) ();
+		}
+		else
+		{
+			plugin_read_cb callback;
+
+			assert (rf_type == RF_COMPLEX);
+
+			callback = rf->rf_callback;
+			status = (*callback) (&rf->rf_udata);
+		}
+		PROBE2 (read_end, rf->rf_name, status);
+
+		plugin_set_ctx (old_ctx);
+
+		/* If the function signals failure, we will increase the
+		 * intervals in which it will be called. */
+		if (status != 0)
+		{
+			rf->rf_effective_interval *= 2;
+			if (rf->rf_effective_interval > max_read_interval)
+				rf->rf_effective_interval = max_read_interval;
+
+			NOTICE ("read-function of plugin `%s' failed. "
+					"Will suspend it for %.3f seconds.",
+					rf->rf_name,
+					CDTIME_T_TO_DOUBLE (rf->rf_effective_interval));
+		}
+		else
+		{
+			/* Success: Restore the interval, if it was changed. */
+			rf->rf_effective_interval = rf->rf_interval;
+		}
+
+		/* update the ``next read due'' field */
+		now = cdtime ();
+
+		/* calculate the time spent in the read function */
+		elapsed = (now - start);
+		rf->rf_duration = elapsed;
+		plugin_callback_done (&rf->rf_super,
+				record_statistics ? start : 0);
+
+		pthread_mutex_lock (&own->pool->lock);
+		if (now > own->busy_since)
+			own->pool->busy += now - own->busy_since;
+		own->busy_since = 0;
+		own->pool->runs++;
+		pthread_mutex_unlock (&own->pool->lock);
+
+		if (elapsed > rf->rf_effective_interval)
+		{
+			rf->rf_overruns++;
+			WARNING ("plugin_read_thread: read-function of the `%s' plugin took %.3f "
+				"seconds, which is above its read interval (%.3f seconds). You might "
+				"want to adjust the `Interval' or `ReadThreads' settings.",
+				rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed),
+				CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
+		}
+
+		DEBUG ("plugin_read_thread: read-function of the `%s' plugin took "
+				"%.6f seconds.",
+				rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed));
+
+		DEBUG ("plugin_read_thread: Effective interval of the "
+				"`%s' plugin is %.3f seconds.",
+				rf->rf_name,
+				CDTIME_T_TO_DOUBLE (rf->rf_effective_interval));
+
+		if (read_backoff)
+			plugin_read_backoff (rf, elapsed);
+
+		/* Calculate the next (absolute) time at which this function
+		 * should be called. */
+		rf->rf_next_read += rf->rf_effective_interval;
+
+		/* Check, if `rf_next_read' is in the past. */
+		if (rf->rf_next_read < now)
+		{
+			/* `rf_next_read' is in the past. Insert `now' (or the
+			 * next start of the phase) so this value doesn't trail
+			 * off into the past too much. */
+			rf->rf_next_read = plugin_read_phase (rf, now);
+		}
+
+		DEBUG ("plugin_read_thread: Next read of the `%s' plugin at %.3f.",
+				rf->rf_name,
+				CDTIME_T_TO_DOUBLE (rf->rf_next_read));
+
+		/* Re-insert this read function into the heap again. */
+		plugin_read_reschedule (rf);
+	} /* while (read_loop) */
+
+	pthread_exit (NULL);
+	return ((void *) 0);
+} /* void *plugin_read_thread */
+
+#if HAVE_PTHREAD_SETAFFINITY_NP
+/* Parses a list of CPUs such as "0-7,16-23". */
+static int plugin_cpu_set_parse (char const *str, cpu_set_t *ret) /* {{{ */
+{
+	char const *ptr = str;
+
+	CPU_ZERO (ret);
+	while (*ptr != 0)
+	{
+		unsigned long first;
+		unsigned long last;
+		char *end = NULL;
+
+		errno = 0;
+		first = strtoul (ptr, &end, 10);
+		if ((errno != 0) || (end == ptr))
+			return (EINVAL);
+
+		last = first;
+		if (*end == '-')
+		{
+			ptr = end + 1;
+			last = strtoul (ptr, &end, 10);
+			if ((errno != 0) || (end == ptr))
+				return (EINVAL);
+		}
+		if ((last < first) || (last >= CPU_SETSIZE))
+			return (EINVAL);
+
+		for (; first <= last; first++)
+			CPU_SET ((int) first, ret);
+
+		ptr = end;
+		while ((*ptr == ',') || isspace ((int) *ptr))
+			ptr++;
+	}
+
+	return ((CPU_COUNT (ret) > 0) ? 0 : EINVAL);
+} /* }}} int plugin_cpu_set_parse */
+
+/* Restricts "threads" to the CPUs listed in the global option "option", if it
+ * is set. */
+static void plugin_threads_pin (char const *option, /* {{{ */
+		pthread_t *threads, size_t threads_num)
+{
+	char const *str = global_option_get (option);
+	cpu_set_t cpus;
+	size_t i;
+
+	if ((str == NULL) || (str[0] == 0) || (threads_num == 0))
+		return;
+
+	if (plugin_cpu_set_parse (str, &cpus) != 0)
+	{
+		ERROR ("plugin: %s: Invalid list of CPUs: \"%s\".", option, str);
+		return;
+	}
+
+	for (i = 0; i < threads_num; i++)
+	{
+		int status = pthread_setaffinity_np (threads[i], sizeof (cpus),
+				&cpus);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			WARNING ("plugin: %s: pthread_setaffinity_np failed "
+					"with status %i (%s).", option, status,
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			return;
+		}
+	}
+} /* }}} void plugin_threads_pin */
+#else
+static void plugin_threads_pin (char const *option, /* {{{ */
+		__attribute__((unused)) pthread_t *threads,
+		__attribute__((unused)) size_t threads_num)
+{
+	char const *str = global_option_get (option);
+
+	if ((str != NULL) && (str[0] != 0))
+		WARNING ("plugin: %s is not supported on this system.", option);
+} /* }}} void plugin_threads_pin */
+#endif
+
+/* Starts "pool->size" threads for "pool". The caller must hold "read_lock"
+ * unless the scheduler isn't running yet. */
+static int plugin_read_pool_start (read_pool_t *pool) /* {{{ */
+{
+	int i;
+
+	if (pool->threads != NULL)
+		return (0);
+
+	pool->threads = calloc ((size_t) pool->size, sizeof (*pool->threads));
+	pool->queues = calloc ((size_t) pool->size, sizeof (*pool->queues));
+	if ((pool->threads == NULL) || (pool->queues == NULL))
+	{
+		ERROR ("plugin: plugin_read_pool_start: calloc failed.");
+		sfree (pool->threads);
+		sfree (pool->queues);
+		return (ENOMEM);
+	}
+
+	for (i = 0; i < pool->size; i++)
+	{
+		pthread_mutex_init (&pool->queues[i].lock, /* attr = */ NULL);
+		pthread_cond_init (&pool->queues[i].cond, /* attr = */ NULL);
+		pool->queues[i].pool = pool;
+	}
+
+	pool->threads_num = 0;
+	pool->next_queue = 0;
+	for (i = 0; i < pool->size; i++)
+	{
+		if (pthread_create (pool->threads + pool->threads_num, NULL,
+					plugin_read_thread,
+					&pool->queues[pool->threads_num]) == 0)
+		{
+			pool->threads_num++;
+		}
+		else
+		{
+			ERROR ("plugin: plugin_read_pool_start: "
+					"pthread_create failed.");
+			break;
+		}
+	} /* for (i) */
+	plugin_threads_pin ("ReadThreadsCPUs",
+			pool->threads, (size_t) pool->threads_num);
+
+	if (pool->name != NULL)
+		INFO ("plugin: Started %i read thread%s for \"%s\".",
+				pool->threads_num,
+				(pool->threads_num == 1) ? "" : "s", pool->name);
+
+	return ((pool->threads_num > 0) ? 0 : -1);
+} /* }}} int plugin_read_pool_start */
+
+/* Waits for the threads of "pool" and moves the functions still waiting in
+ * its run queues back to the heap, so they are free'd with it. "read_loop"
+ * must be zero. */
+static void plugin_read_pool_stop (read_pool_t *pool) /* {{{ */
+{
+	int i;
+
+	if (pool->threads == NULL)
+		return;
+
+	for (i = 0; i < pool->threads_num; i++)
+	{
+		pthread_mutex_lock (&pool->queues[i].lock);
+		pthread_cond_broadcast (&pool->queues[i].cond);
+		pthread_mutex_unlock (&pool->queues[i].lock);
+	}
+
+	for (i = 0; i < pool->threads_num; i++)
+	{
+		if (pthread_join (pool->threads[i], NULL) != 0)
+		{
+			ERROR ("plugin: stop_read_threads: pthread_join failed.");
+		}
+		pool->threads[i] = (pthread_t) 0;
+	}
+
+	pthread_mutex_lock (&read_lock);
+	for (i = 0; i < pool->size; i++)
+	{
+		read_func_t *rf;
+
+		while ((rf = plugin_read_queue_pop (&pool->queues[i])) != NULL)
+			c_iheap_insert (read_heap, &rf->rf_heap_handle,
+					rf->rf_next_read, rf);
+
+		pthread_mutex_destroy (&pool->queues[i].lock);
+		pthread_cond_destroy (&pool->queues[i].cond);
+	}
+
+	sfree (pool->threads);
+	sfree (pool->queues);
+	pool->threads_num = 0;
+	pthread_mutex_unlock (&read_lock);
+} /* }}} void plugin_read_pool_stop */
+
+/* Returns the pool "rf" runs in, creating it if its context asks for one.
+ * Dedicated pools created after the read threads have been started are
+ * started right away. The caller must hold "read_lock". */
+static read_pool_t *plugin_read_pool_get (read_func_t const *rf) /* {{{ */
+{
+	char const *name;
+	read_pool_t *pool;
+
+	if (rf->rf_ctx.read_threads <= 0)
+		return (&read_pool_default);
+
+	name = (rf->rf_group[0] != 0) ? rf->rf_group : rf->rf_name;
+	for (pool = read_pools; pool != NULL; pool = pool->next)
+		if (strcmp (name, pool->name) == 0)
+			return (pool);
+
+	pool = calloc (1, sizeof (*pool));
+	if (pool == NULL)
+	{
+		ERROR ("plugin_read_pool_get: calloc failed.");
+		return (&read_pool_default);
+	}
+
+	pool->name = strdup (name);
+	if (pool->name == NULL)
+	{
+		ERROR ("plugin_read_pool_get: strdup failed.");
+		sfree (pool);
+		return (&read_pool_default);
+	}
+	pool->size = rf->rf_ctx.read_threads;
+	pthread_mutex_init (&pool->lock, /* attr = */ NULL);
+
+	pool->next = read_pools;
+	read_pools = pool;
+
+	if (read_threads_started)
+		(void) plugin_read_pool_start (pool);
+
+	return (pool);
+} /* }}} read_pool_t *plugin_read_pool_get */
+
+static void start_read_threads (int num)
+{
+	read_pool_t *pool;
+
+	if (read_threads_started)
+		return;
+
+	read_pool_default.size = num;
+	if (plugin_read_pool_start (&read_pool_default) != 0)
+		return;
+
+	pthread_mutex_lock (&read_lock);
+	for (pool = read_pools; pool != NULL; pool = pool->next)
+		(void) plugin_read_pool_start (pool);
+	read_threads_started = 1;
+	pthread_mutex_unlock (&read_lock);
+
+	/* The scheduler distributes work over the threads that are running. */
+	if (pthread_create (&read_scheduler, NULL,
+				plugin_read_scheduler, NULL) != 0)
+	{
+		ERROR ("plugin: start_read_threads: pthread_create failed.");
+		read_threads_started = 0;
+	}
+} /* void start_read_threads */
+
+static void stop_read_threads (void)
+{
+	read_pool_t *pool;
+	_Bool scheduler_running = read_threads_started;
+
+	if (read_pool_default.threads == NULL)
+		return;
+
+	INFO ("collectd: Stopping %i read threads.",
+			read_pool_default.threads_num);
+
+	pthread_mutex_lock (&read_lock);
+	read_loop = 0;
+	read_threads_started = 0;
+	DEBUG ("plugin: stop_read_threads: Signalling `read_cond'");
+	pthread_cond_broadcast (&read_cond);
+	pthread_mutex_unlock (&read_lock);
+
+	if (scheduler_running)
+	{
+		if (pthread_join (read_scheduler, NULL) != 0)
+			ERROR ("plugin: stop_read_threads: pthread_join failed.");
+	}
+
+	/* No new pools are started once "read_loop" is zero. */
+	plugin_read_pool_stop (&read_pool_default);
+	for (pool = read_pools; pool != NULL; pool = pool->next)
+		plugin_read_pool_stop (pool);
+} /* void stop_read_threads */
+
+/* Frees the values and meta data of "vl", but not "vl" itself. Values stored
+ * in "inline_values" are not freed. */
+static void plugin_value_list_clear (value_list_t *vl, /* {{{ */
+		value_t const *inline_values)
+{
+	meta_data_destroy (vl->meta);
+	vl->meta = NULL;
+
+	if (vl->values != inline_values)
+		sfree (vl->values);
+	vl->values = NULL;
+} /* }}} void plugin_value_list_clear */
+
+static void plugin_value_list_free (value_list_t *vl) /* {{{ */
+{
+	if (vl == NULL)
+		return;
+
+	plugin_value_list_clear (vl, /* inline_values = */ NULL);
+	sfree (vl);
+} /* }}} void plugin_value_list_free */
+
+/* Copies "vl_orig" to "vl". The values are stored in "inline_values" if they
+ * fit, otherwise they are allocated. */
+static int plugin_value_list_copy (value_list_t *vl, /* {{{ */
+		value_list_t const *vl_orig,
+		value_t *inline_values, size_t inline_values_num)
+{
+	memcpy (vl, vl_orig, sizeof (*vl));
+	vl->meta = NULL;
+
+	if (vl_orig->values_len <= inline_values_num)
+		vl->values = inline_values;
+	else
+		vl->values = calloc (vl_orig->values_len, sizeof (*vl->values));
+	if (vl->values == NULL)
+		return (ENOMEM);
+	memcpy (vl->values, vl_orig->values,
+			vl_orig->values_len * sizeof (*vl->values));
+
+	vl->meta = meta_data_clone (vl_orig->meta);
+	if ((vl_orig->meta != NULL) && (vl->meta == NULL))
+	{
+		plugin_value_list_clear (vl, inline_values);
+		return (ENOMEM);
+	}
+
+	if (vl->time == 0)
+		vl->time = cdtime ();
+
+	/* Fill in the interval from the thread context, if it is zero. */
+	if (vl->interval == 0)
+	{
+		plugin_ctx_t ctx = plugin_get_ctx ();
+
+		if (ctx.interval != 0)
+			vl->interval = ctx.interval;
+		else
+		{
+			char name[6 * DATA_MAX_NAME_LEN];
+			FORMAT_VL (name, sizeof (name), vl);
+			ERROR ("plugin_value_list_clone: Unable to determine "
+					"interval from context for "
+					"value list \"%s\". "
+					"This indicates a broken plugin. "
+					"Please report this problem to the "
+					"collectd mailing list or at "
+					"<http://collectd.org/bugs/>.", name);
+			vl->interval = cf_get_default_interval ();
+		}
+	}
+
+	return (0);
+} /* }}} int plugin_value_list_copy */
+
+static value_list_t *plugin_value_list_clone (value_list_t const *vl_orig) /* {{{ */
+{
+	value_list_t *vl;
+
+	if (vl_orig == NULL)
+		return (NULL);
+
+	vl = malloc (sizeof (*vl));
+	if (vl == NULL)
+		return (NULL);
+
+	if (plugin_value_list_copy (vl, vl_orig,
+				/* inline_values = */ NULL,
+				/* inline_values_num = */ 0) != 0)
+	{
+		sfree (vl);
+		return (NULL);
+	}
+
+	return (vl);
+} /* }}} value_list_t *plugin_value_list_clone */
+
+/* Frees a write queue element including the value list it holds. */
+static void plugin_write_queue_free (write_queue_t *q) /* {{{ */
+{
+	while (q != NULL)
+	{
+		write_queue_t *next = q->next;
+
+		plugin_value_list_clear (&q->vl, q->values);
+		sfree (q->vec);
+		sfree (q);
+
+		q = next;
+	}
+} /* }}} void plugin_write_queue_free */
+
+static void write_queue_thread_destroy (void *arg) /* {{{ */
+{
+	write_queue_thread_t *wt = arg;
+
+	if (wt == NULL)
+		return;
+
+	sfree (wt->spare);
+	sfree (wt);
+} /* }}} void write_queue_thread_destroy */
+
+static int plugin_write_queues_init (void) /* {{{ */
+{
+	long num;
+	size_t i;
+	int status;
+
+	pthread_mutex_lock (&write_queues_lock);
+
+	if (write_queues != NULL)
+	{
+		pthread_mutex_unlock (&write_queues_lock);
+		return (0);
+	}
+
+	num = global_option_get_long ("WriteThreads", /* default = */ 5);
+	if (num < 1)
+	{
+		ERROR ("WriteThreads must be positive.");
+		num = 5;
+	}
+
+	status = pthread_key_create (&write_queue_key,
+			write_queue_thread_destroy);
+	if (status != 0)
+	{
+		pthread_mutex_unlock (&write_queues_lock);
+		ERROR ("plugin_write_queues_init: pthread_key_create failed "
+				"with status %i.", status);
+		return (status);
+	}
+
+	write_queues = calloc ((size_t) num, sizeof (*write_queues));
+	if (write_queues == NULL)
+	{
+		pthread_key_delete (write_queue_key);
+		pthread_mutex_unlock (&write_queues_lock);
+		ERROR ("plugin_write_queues_init: calloc failed.");
+		return (ENOMEM);
+	}
+
+	for (i = 0; i < (size_t) num; i++)
+	{
+		pthread_mutex_init (&write_queues[i].lock, /* attr = */ NULL);
+		pthread_cond_init (&write_queues[i].cond, /* attr = */ NULL);
+		write_queues[i].head = NULL;
+		write_queues[i].tail = NULL;
+		write_queues[i].urgent_head = NULL;
+		write_queues[i].urgent_tail = NULL;
+		write_queues[i].length = 0;
+		write_queues[i].pool = NULL;
+		write_queues[i].pool_num = 0;
+		write_queues[i].wait = NULL;
+	}
+	write_queues_num = (size_t) num;
+
+	pthread_mutex_unlock (&write_queues_lock);
+	return (0);
+} /* }}} int plugin_write_queues_init */
+
+/* Returns the calling thread's state, creating it if necessary. Each thread
+ * walks over all shards in turn, starting at a different shard, so that
+ * values spread evenly without a shared counter. Returns NULL if no memory
+ * is available. */
+static write_queue_thread_t *plugin_write_queue_thread (void) /* {{{ */
+{
+	static size_t next_start = 0;
+	write_queue_thread_t *wt;
+
+	wt = pthread_getspecific (write_queue_key);
+	if (wt != NULL)
+		return (wt);
+
+	wt = malloc (sizeof (*wt));
+	if (wt == NULL)
+		return (NULL);
+	wt->spare = NULL;
+
+	pthread_mutex_lock (&write_queues_lock);
+	wt->next = next_start;
+	next_start++;
+	pthread_mutex_unlock (&write_queues_lock);
+
+	pthread_setspecific (write_queue_key, wt);
+	return (wt);
+} /* }}} write_queue_thread_t *plugin_write_queue_thread */
+
+/* Number of values held by a write queue element, as counted by the queue
+ * length. */
+static long plugin_write_queue_weight (write_queue_t const *q) /* {{{ */
+{
+	return ((q->vec != NULL) ? (long) q->vec->num : 1);
+} /* }}} long plugin_write_queue_weight */
+
+/* Appends the list from "head" to "tail" to the lane of "shard" selected by
+ * the dispatch priority of "head". The caller must hold the shard's lock. */
+static void plugin_write_queue_append (write_queue_shard_t *shard, /* {{{ */
+		write_queue_t *head, write_queue_t *tail, long weight)
+{
+	write_queue_t **lane_head = &shard->head;
+	write_queue_t **lane_tail = &shard->tail;
+
+	if (head->ctx.dispatch_priority == PLUGIN_READ_PRIORITY_HIGH)
+	{
+		lane_head = &shard->urgent_head;
+		lane_tail = &shard->urgent_tail;
+	}
+
+	if (*lane_tail == NULL)
+		*lane_head = head;
+	else
+		(*lane_tail)->next = head;
+	*lane_tail = tail;
+	shard->length += weight;
+} /* }}} void plugin_write_queue_append */
+
+/* Returns the shard of "vl" for "WriteQueueByIdentifier". All identifiers of
+ * one cache shard go to the same write queue shard, so each write thread
+ * updates its own subset of the cache. */
+static write_queue_shard_t *plugin_write_queue_by_identifier ( /* {{{ */
+		value_list_t const *vl)
+{
+	size_t index = uc_shard_index (identifier_hash_vl (vl));
+
+	return (&write_queues[index % write_queues_num]);
+} /* }}} write_queue_shard_t *plugin_write_queue_by_identifier */
+
+/* Appends a copy of "vl" to one of the write queue shards. If "vec" is not
+ * NULL, the element takes ownership of it, also on failure. */
+static int plugin_write_enqueue (const data_set_t *ds, /* {{{ */
+		value_list_t const *vl, write_queue_vec_t *vec)
+{
+	write_queue_thread_t *wt;
+	write_queue_t *q;
+	write_queue_shard_t *shard;
+	_Bool pool_hit = 0;
+	int status;
+
+	if (write_queues == NULL)
+	{
+		status = plugin_write_queues_init ();
+		if (status != 0)
+		{
+			sfree (vec);
+			return (status);
+		}
+	}
+
+	wt = plugin_write_queue_thread ();
+	if ((wt != NULL) && (wt->spare != NULL))
+	{
+		q = wt->spare;
+		wt->spare = NULL;
+		pool_hit = 1;
+	}
+	else
+	{
+		q = malloc (sizeof (*q));
+		if (q == NULL)
+		{
+			sfree (vec);
+			return (ENOMEM);
+		}
+	}
+	q->next = NULL;
+	q->ds = ds;
+	q->vec = vec;
+
+	status = plugin_value_list_copy (&q->vl, vl,
+			q->values, STATIC_ARRAY_SIZE (q->values));
+	if (status != 0)
+	{
+		sfree (q->vec);
+		sfree (q);
+		return (status);
+	}
+
+	/* Store context of caller (read plugin); otherwise, it would not be
+	 * available to the write plugins when actually dispatching the
+	 * value-list later on. */
+	q->ctx = plugin_get_ctx ();
+
+	if (write_queue_by_identifier)
+		shard = plugin_write_queue_by_identifier (vl);
+	else if (wt != NULL)
+	{
+		wt->next = (wt->next + 1) % write_queues_num;
+		shard = &write_queues[wt->next];
+	}
+	else
+		shard = &write_queues[0];
+
+	q->enqueued = record_statistics ? cdtime () : 0;
+
+	pthread_mutex_lock (&shard->lock);
+
+	plugin_write_queue_append (shard, q, q, plugin_write_queue_weight (q));
+	PROBE3 (write_enqueue, q, (size_t) (shard - write_queues),
+			shard->length);
+
+	if (pool_hit)
+		shard->pool_hits++;
+	else
+		shard->pool_misses++;
+
+	/* Take a recycled element for the next value list while
+	 * holding the lock anyway. */
+	if ((wt != NULL) && (shard->pool != NULL))
+	{
+		wt->spare = shard->pool;
+		shard->pool = wt->spare->next;
+		shard->pool_num--;
+	}
+
+	pthread_cond_signal (&shard->cond);
+	pthread_mutex_unlock (&shard->lock);
+
+	return (0);
+} /* }}} int plugin_write_enqueue */
+
+/* Like plugin_write_enqueue() for "vl_num" value lists. The elements are
+ * prepared outside of the lock and appended to one shard at once. */
+static int plugin_write_enqueue_bulk (const data_set_t *ds, /* {{{ */
+		value_list_t const *vl, size_t vl_num)
+{
+	write_queue_thread_t *wt;
+	write_queue_t *head = NULL;
+	write_queue_t *tail = NULL;
+	write_queue_t *pooled = NULL;
+	write_queue_shard_t *shard;
+	size_t pool_hits = 0;
+	size_t num = 0;
+	size_t i;
+	cdtime_t enqueued;
+	int status = 0;
+
+	if (vl_num == 0)
+		return (0);
+
+	if (write_queues == NULL)
+	{
+		status = plugin_write_queues_init ();
+		if (status != 0)
+			return (status);
+	}
+
+	/* The value lists may belong to different shards. */
+	if (write_queue_by_identifier)
+	{
+		for (i = 0; (i < vl_num) && (status == 0); i++)
+			status = plugin_write_enqueue (ds, vl + i, /* vec = */ NULL);
+		return (status);
+	}
+
+	wt = plugin_write_queue_thread ();
+	if (wt != NULL)
+	{
+		wt->next = (wt->next + 1) % write_queues_num;
+		shard = &write_queues[wt->next];
+
+		if (wt->spare != NULL)
+		{
+			pooled = wt->spare;
+			pooled->next = NULL;
+			wt->spare = NULL;
+		}
+	}
+	else
+		shard = &write_queues[0];
+
+	/* Take the recycled elements needed for the batch in one go. */
+	if (vl_num > 1)
+	{
+		size_t wanted = (pooled != NULL) ? vl_num - 1 : vl_num;
+
+		pthread_mutex_lock (&shard->lock);
+		while ((wanted > 0) && (shard->pool != NULL))
+		{
+			write_queue_t *q = shard->pool;
+
+			shard->pool = q->next;
+			shard->pool_num--;
+			q->next = pooled;
+			pooled = q;
+			wanted--;
+		}
+		pthread_mutex_unlock (&shard->lock);
+	}
+
+	/* One timestamp for all elements, they are appended at once. */
+	enqueued = record_statistics ? cdtime () : 0;
+
+	for (i = 0; i < vl_num; i++)
+	{
+		write_queue_t *q;
+
+		if (pooled != NULL)
+		{
+			q = pooled;
+			pooled = q->next;
+			pool_hits++;
+		}
+		else
+		{
+			q = malloc (sizeof (*q));
+			if (q == NULL)
+			{
+				status = ENOMEM;
+				break;
+			}
+		}
+		q->next = NULL;
+		q->ds = ds;
+		q->vec = NULL;
+
+		status = plugin_value_list_copy (&q->vl, vl + i,
+				q->values, STATIC_ARRAY_SIZE (q->values));
+		if (status != 0)
+		{
+			sfree (q);
+			break;
+		}
+		q->ctx = plugin_get_ctx ();
+		q->enqueued = enqueued;
+
+		if (tail == NULL)
+			head = q;
+		else
+			tail->next = q;
+		tail = q;
+		num++;
+	}
+
+	/* Elements left over after an error. */
+	while (pooled != NULL)
+	{
+		write_queue_t *next = pooled->next;
+		sfree (pooled);
+		pooled = next;
+	}
+
+	if (num == 0)
+		return (status);
+
+	pthread_mutex_lock (&shard->lock);
+
+	/* All elements have the same context. */
+	plugin_write_queue_append (shard, head, tail, (long) num);
+#if HAVE_SYS_SDT_H
+	{
+		write_queue_t *q;
+		for (q = head; q != NULL; q = q->next)
+			PROBE3 (write_enqueue, q, (size_t) (shard - write_queues),
+					shard->length);
+	}
+#endif
+
+	shard->pool_hits += (derive_t) pool_hits;
+	shard->pool_misses += (derive_t) (num - pool_hits);
+
+	if ((wt != NULL) && (shard->pool != NULL))
+	{
+		wt->spare = shard->pool;
+		shard->pool = wt->spare->next;
+		shard->pool_num--;
+	}
+
+	/* Several write threads may steal from this shard. */
+	if (num > 1)
+		pthread_cond_broadcast (&shard->cond);
+	else
+		pthread_cond_signal (&shard->cond);
+	pthread_mutex_unlock (&shard->lock);
+
+	return (status);
+} /* }}} int plugin_write_enqueue_bulk */
+
+/* Moves the elements in "done" to the pool of "shard". Elements that don't fit
+ * into the pool are left in "done" and must be freed by the caller. The
+ * caller must hold the shard's lock. */
+static void plugin_write_queue_recycle (write_queue_shard_t *shard, /* {{{ */
+		write_queue_t **done)
+{
+	while ((*done != NULL) && (shard->pool_num < WRITE_QUEUE_POOL_MAX))
+	{
+		write_queue_t *q = *done;
+
+		*done = q->next;
+		q->next = shard->pool;
+		shard->pool = q;
+		shard->pool_num++;
+	}
+} /* }}} void plugin_write_queue_recycle */
+
+/* Releases the value list held by "q" and puts "q" on the "done" list, so it
+ * can be recycled with the next call to plugin_write_dequeue(). */
+static void plugin_write_queue_release (write_queue_t *q, /* {{{ */
+		write_queue_t **done)
+{
+	plugin_value_list_clear (&q->vl, q->values);
+	sfree (q->vec);
+
+	q->next = *done;
+	*done = q;
+} /* }}} void plugin_write_queue_release */
+
+/* Removes the first element from "shard", taking high priority values
+ * first. The caller must hold the shard's lock. */
+static write_queue_t *plugin_write_queue_pop (write_queue_shard_t *shard) /* {{{ */
+{
+	write_queue_t *q;
+
+	if (shard->urgent_head != NULL)
+	{
+		q = shard->urgent_head;
+		shard->urgent_head = q->next;
+		if (shard->urgent_head == NULL)
+			shard->urgent_tail = NULL;
+	}
+	else
+	{
+		q = shard->head;
+		if (q == NULL)
+			return (NULL);
+
+		shard->head = q->next;
+		if (shard->head == NULL)
+			shard->tail = NULL;
+	}
+
+	shard->length -= plugin_write_queue_weight (q);
+	if ((shard->head == NULL) && (shard->urgent_head == NULL))
+		assert (0 == shard->length);
+	PROBE3 (write_dequeue, q, (size_t) (shard - write_queues),
+			shard->length);
+
+	if (q->enqueued != 0)
+		plugin_queue_wait_add (&shard->wait, q, cdtime ());
+
+	return (q);
+} /* }}} write_queue_t *plugin_write_queue_pop */
+
+/* Takes one element from any shard other than "own". Shards that are
+ * currently locked by somebody else are skipped. */
+static write_queue_t *plugin_write_queue_steal (write_queue_shard_t *own) /* {{{ */
+{
+	size_t offset;
+	size_t i;
+
+	offset = (size_t) (own - write_queues);
+	for (i = 1; i < write_queues_num; i++)
+	{
+		write_queue_shard_t *shard;
+		write_queue_t *q;
+
+		shard = &write_queues[(offset + i) % write_queues_num];
+		if ((shard->head == NULL) && (shard->urgent_head == NULL))
+			continue;
+
+		if (pthread_mutex_trylock (&shard->lock) != 0)
+			continue;
+
+		q = plugin_write_queue_pop (shard);
+		pthread_mutex_unlock (&shard->lock);
+
+		if (q != NULL)
+			return (q);
+	}
+
+	return (NULL);
+} /* }}} write_queue_t *plugin_write_queue_steal */
+
+/* Returns the next element from "own" or, if "own" is empty and
+ * "WriteQueueByIdentifier" is off, from one of the other shards. Blocks
+ * until an element is available or the write threads are stopped.
+ * Elements in "done" are recycled into the pool of "own". */
+static write_queue_t *plugin_write_dequeue (write_queue_shard_t *own, /* {{{ */
+		write_queue_t **done)
+{
+	write_queue_t *q;
+
+	pthread_mutex_lock (&own->lock);
+
+	plugin_write_queue_recycle (own, done);
+
+	q = plugin_write_queue_pop (own);
+	while (write_loop && (q == NULL) && write_queue_by_identifier)
+	{
+		/* Taking values from other shards would break the order. */
+		pthread_cond_wait (&own->cond, &own->lock);
+		q = plugin_write_queue_pop (own);
+	}
+	while (write_loop && (q == NULL))
+	{
+		/* Our own shard is empty. Help out with the other shards
+		 * before going to sleep. */
+		pthread_mutex_unlock (&own->lock);
+		q = plugin_write_queue_steal (own);
+		pthread_mutex_lock (&own->lock);
+
+		if (q != NULL)
+			break;
+
+		/* Check the own shard again while holding the lock, so we
+		 * don't miss a signal that was sent while stealing. */
+		q = plugin_write_queue_pop (own);
+		if ((q != NULL) || !write_loop)
+			break;
+
+		pthread_cond_wait (&own->cond, &own->lock);
+		q = plugin_write_queue_pop (own);
+	}
+
+	pthread_mutex_unlock (&own->lock);
+
+	/* The pool is full. */
+	plugin_write_queue_free (*done);
+	*done = NULL;
+
+	/* Restore the context of the dispatching thread. */
+	if (q != NULL)
+		(void) plugin_set_ctx (q->ctx);
+
+	return (q);
+} /* }}} write_queue_t *plugin_write_dequeue */
+
+/* Like plugin_write_dequeue() but returns NULL instead of blocking if the
+ * shard is empty. */
+static write_queue_t *plugin_write_dequeue_nowait (write_queue_shard_t *own, /* {{{ */
+		write_queue_t **done)
+{
+	write_queue_t *q;
+
+	pthread_mutex_lock (&own->lock);
+	plugin_write_queue_recycle (own, done);
+	q = plugin_write_queue_pop (own);
+	pthread_mutex_unlock (&own->lock);
+
+	plugin_write_queue_free (*done);
+	*done = NULL;
+
+	if (q != NULL)
+		(void) plugin_set_ctx (q->ctx);
+
+	return (q);
+} /* }}} write_queue_t *plugin_write_dequeue_nowait */
+
+static void plugin_write_batch_destroy (write_batch_t *batch) /* {{{ */
+{
+	size_t i;
+
+	if (batch == NULL)
+		return;
+
+	for (i = 0; i < batch->values_num; i++)
+		plugin_value_list_free (batch->values[i]);
+	sfree (batch->values);
+
+	for (i = 0; i < batch->writers_num; i++)
+		sfree (batch->writers[i].entries);
+	sfree (batch->writers);
+
+	sfree (batch);
+} /* }}} void plugin_write_batch_destroy */
+
+static void plugin_write_cache_batch_destroy ( /* {{{ */
+		write_cache_batch_t *cb)
+{
+	if (cb == NULL)
+		return;
+
+	sfree (cb->items);
+	sfree (cb->ds);
+	sfree (cb->update_ds);
+	sfree (cb->update_vl);
+	sfree (cb);
+} /* }}} void plugin_write_cache_batch_destroy */
+
+static write_cache_batch_t *plugin_write_cache_batch_create ( /* {{{ */
+		size_t size)
+{
+	write_cache_batch_t *cb;
+
+	cb = calloc (1, sizeof (*cb));
+	if (cb == NULL)
+		return (NULL);
+
+	cb->size = size;
+	cb->items = calloc (size, sizeof (*cb->items));
+	cb->ds = calloc (size, sizeof (*cb->ds));
+	cb->update_ds = calloc (size, sizeof (*cb->update_ds));
+	cb->update_vl = calloc (size, sizeof (*cb->update_vl));
+	if ((cb->items == NULL) || (cb->ds == NULL)
+			|| (cb->update_ds == NULL) || (cb->update_vl == NULL))
+	{
+		plugin_write_cache_batch_destroy (cb);
+		return (NULL);
+	}
+
+	return (cb);
+} /* }}} write_cache_batch_t *plugin_write_cache_batch_create */
+
+/* Returns the data set of "q" if its value list can be passed to
+ * uc_update_batch(), NULL if plugin_dispatch_values_internal() should check
+ * and report it. */
+static const data_set_t *plugin_write_cache_ds (write_queue_t *q) /* {{{ */
+{
+	const data_set_t *ds = q->ds;
+
+	if ((q->vec != NULL) || (q->vl.type[0] == 0)
+			|| (q->vl.values == NULL) || (q->vl.values_len < 1))
+		return (NULL);
+
+	if (ds == NULL)
+		ds = plugin_find_data_set (q->vl.type);
+	if ((ds == NULL) || (ds->ds_num != q->vl.values_len))
+		return (NULL);
+
+	return (ds);
+} /* }}} const data_set_t *plugin_write_cache_ds */
+
+/* Updates the cache for all elements in "cb" with one call of
+ * uc_update_batch(), which locks each cache shard only once, then dispatches
+ * the elements in order and moves them to "done". The pre-cache chain may
+ * change or drop value lists before they reach the cache, so with a
+ * pre-cache chain each value list is handled on its own. */
+static void plugin_write_cache_batch_dispatch ( /* {{{ */
+		write_cache_batch_t *cb, write_queue_t **done)
+{
+	size_t update_num = 0;
+	size_t i;
+
+	for (i = 0; i < cb->num; i++)
+	{
+		write_queue_t *q = cb->items[i];
+
+		cb->ds[i] = NULL;
+		if (pre_cache_chain != NULL)
+			continue;
+
+		cb->ds[i] = plugin_write_cache_ds (q);
+		if (cb->ds[i] == NULL)
+			continue;
+
+		/* Changes the identifier, so it has to happen before the
+		 * cache is updated. */
+		plugin_value_list_escape (&q->vl);
+
+		cb->update_ds[update_num] = cb->ds[i];
+		cb->update_vl[update_num] = &q->vl;
+		update_num++;
+	}
+
+	if (update_num > 0)
+		(void) uc_update_batch (cb->update_ds, cb->update_vl, update_num);
+
+	for (i = 0; i < cb->num; i++)
+	{
+		write_queue_t *q = cb->items[i];
+
+		if (q->vec != NULL)
+			plugin_dispatch_values_vec_internal (q);
+		else if (cb->ds[i] != NULL)
+			plugin_dispatch_values_internal (cb->ds[i], &q->vl,
+					/* cached = */ 1);
+		else
+			plugin_dispatch_values_internal (q->ds, &q->vl,
+					/* cached = */ 0);
+
+		plugin_write_queue_release (q, done);
+		cb->items[i] = NULL;
+	}
+	cb->num = 0;
+} /* }}} void plugin_write_cache_batch_dispatch */
+
+static write_batch_t *plugin_write_batch_create (size_t size) /* {{{ */
+{
+	write_batch_t *batch;
+
+	batch = calloc (1, sizeof (*batch));
+	if (batch == NULL)
+		return (NULL);
+
+	batch->size = size;
+	batch->values = calloc (size, sizeof (*batch->values));
+	if (batch->values == NULL)
+	{
+		sfree (batch);
+		return (NULL);
+	}
+
+	return (batch);
+} /* }}} write_batch_t *plugin_write_batch_create */
+
+/* Calls all batch writers with the value lists collected so far and frees
+ * the copies of the value lists afterwards. */
+static void plugin_write_batch_flush (write_batch_t *batch) /* {{{ */
+{
+	size_t i;
+
+	if ((batch == NULL) || (batch->values_num == 0))
+		return;
+
+	/* Batch writers calling plugin_write() must not add to the batch
+	 * currently being flushed. */
+	batch->flushing = 1;
+
+	for (i = 0; i < batch->writers_num; i++)
+	{
+		write_batch_writer_t *w = batch->writers + i;
+		plugin_write_batch_cb callback;
+		cdtime_t start;
+		int status;
+
+		if (w->entries_num == 0)
+			continue;
+
+		/* Like plugin_write(), errors are not reported here. Writers
+		 * are expected to log problems themselves. */
+		callback = w->cf->cf_callback;
+		if (record_statistics || (write_delay_warning > 0.0))
+			plugin_writer_age (w->cf, w->entries, w->entries_num,
+					cdtime ());
+		start = plugin_callback_start ();
+		PROBE2 (write_begin, w->cf->cf_name, w->entries_num);
+		status = (*callback) (w->entries, w->entries_num,
+				&w->cf->cf_udata);
+		PROBE2 (write_end, w->cf->cf_name, status);
+		plugin_callback_done (w->cf, start);
+
+		w->entries_num = 0;
+	}
+
+	for (i = 0; i < batch->values_num; i++)
+	{
+		plugin_value_list_free (batch->values[i]);
+		batch->values[i] = NULL;
+	}
+	batch->values_num = 0;
+
+	batch->flushing = 0;
+} /* }}} void plugin_write_batch_flush */
+
+static write_batch_writer_t *plugin_write_batch_writer (write_batch_t *batch, /* {{{ */
+		callback_func_t *cf)
+{
+	write_batch_writer_t *tmp;
+	write_batch_writer_t *w;
+	size_t i;
+
+	for (i = 0; i < batch->writers_num; i++)
+		if (batch->writers[i].cf == cf)
+			return (batch->writers + i);
+
+	tmp = realloc (batch->writers,
+			(batch->writers_num + 1) * sizeof (*batch->writers));
+	if (tmp == NULL)
+		return (NULL);
+	batch->writers = tmp;
+
+	w = batch->writers + batch->writers_num;
+	w->cf = cf;
+	w->entries_num = 0;
+	/* A writer receives each value list at most once, so it never receives
+	 * more than "batch->size" entries. */
+	w->entries = calloc (batch->size, sizeof (*w->entries));
+	if (w->entries == NULL)
+		return (NULL);
+
+	batch->writers_num++;
+	return (w);
+} /* }}} write_batch_writer_t *plugin_write_batch_writer */
+
+/* Passes ds/vl to a batch writer. If the calling thread is a write thread,
+ * "vl" is copied to the thread's batch (once per plugin_write() call, shared
+ * via "vl_copy") and the writer is called when the batch is flushed.
+ * Otherwise the writer is called immediately with a single entry. */
+static int plugin_write_batch_call (callback_func_t *cf, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl,
+		value_list_t **vl_copy)
+{
+	write_batch_t *batch = NULL;
+	write_batch_writer_t *w;
+
+	if (write_batch_key_initialized)
+		batch = pthread_getspecific (write_batch_key);
+
+	/* Data sets not owned by the daemon, e.g. ones created by the perl
+	 * plugin on the stack, may not live until the batch is flushed. */
+	if ((batch != NULL) && (*vl_copy == NULL)
+			&& (!batch->flushing) && (plugin_get_ds (vl->type) == ds))
+	{
+		if (batch->values_num >= batch->size)
+			plugin_write_batch_flush (batch);
+
+		*vl_copy = plugin_value_list_clone (vl);
+		if (*vl_copy != NULL)
+			batch->values[batch->values_num++] = *vl_copy;
+	}
+
+	if ((batch != NULL) && (*vl_copy != NULL))
+	{
+		w = plugin_write_batch_writer (batch, cf);
+		if (w != NULL)
 		{
-			ERROR ("plugin: register_callback: "
-					"llist_create failed.");
-			destroy_callback (cf);
-			return (-1);
+			w->entries[w->entries_num].ds = ds;
+			w->entries[w->entries_num].vl = *vl_copy;
+			w->entries_num++;
+			return (0);
 		}
 	}
 
-	key = strdup (name);
-	if (key == NULL)
+	/* Not in a write thread or out of memory: call the writer directly. */
+	return (plugin_writer_call (cf, /* batch = */ 1, ds, vl));
+} /* }}} int plugin_write_batch_call */
+
+/* Calls the writer "cf" directly, bypassing its queue. */
+static int plugin_writer_call (callback_func_t *cf, _Bool batch, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	write_batch_entry_t entry = { ds, vl };
+	cdtime_t start;
+	int status;
+
+	if (record_statistics || (write_delay_warning > 0.0))
+		plugin_writer_age (cf, &entry, 1, cdtime ());
+
+	start = plugin_callback_start ();
+	PROBE2 (write_begin, cf->cf_name, 1);
+	if (batch)
 	{
-		ERROR ("plugin: register_callback: strdup failed.");
-		destroy_callback (cf);
-		return (-1);
+		plugin_write_batch_cb callback = cf->cf_callback;
+
+		status = (*callback) (&entry, 1, &cf->cf_udata);
 	}
+	else
+	{
+		plugin_write_cb callback = cf->cf_callback;
 
-	le = llist_search (*list, name);
-	if (le == NULL)
+		status = (*callback) (ds, vl, &cf->cf_udata);
+	}
+	PROBE2 (write_end, cf->cf_name, status);
+
+	plugin_callback_done (cf, start);
+	return (status);
+} /* }}} int plugin_writer_call */
+
+/* Removes up to "max" elements from the head of "wq". The caller must hold the
+ * queue's lock. */
+static write_queue_t *plugin_writer_queue_pop (writer_queue_t *wq, /* {{{ */
+		size_t max, size_t *ret_num)
+{
+	write_queue_t *head = wq->head;
+	write_queue_t *last = NULL;
+	size_t num = 0;
+
+	while ((num < max) && (wq->head != NULL))
 	{
-		le = llentry_create (key, cf);
-		if (le == NULL)
+		last = wq->head;
+		wq->head = last->next;
+		num++;
+	}
+
+	if (last != NULL)
+		last->next = NULL;
+	if (wq->head == NULL)
+		wq->tail = NULL;
+	wq->length -= (long) num;
+
+	/* Wake up producers waiting for space. */
+	if ((wq->waiters > 0) && (wq->length <= wq->limit_low))
+		pthread_cond_broadcast (&wq->space);
+
+	*ret_num = num;
+	return ((num > 0) ? head : NULL);
+} /* }}} write_queue_t *plugin_writer_queue_pop */
+
+/* Moves the elements in "done" to the pool of "wq" and returns the ones that
+ * didn't fit. The caller must hold the queue's lock. */
+static write_queue_t *plugin_writer_queue_recycle (writer_queue_t *wq, /* {{{ */
+		write_queue_t *done)
+{
+	while ((done != NULL) && (wq->pool_num < WRITE_QUEUE_POOL_MAX))
+	{
+		write_queue_t *q = done;
+
+		done = q->next;
+		q->next = wq->pool;
+		wq->pool = q;
+		wq->pool_num++;
+	}
+
+	return (done);
+} /* }}} write_queue_t *plugin_writer_queue_recycle */
+
+static void *plugin_writer_queue_thread (void *args) /* {{{ */
+{
+	writer_queue_t *wq = args;
+	write_batch_entry_t *entries = NULL;
+	write_queue_t *done = NULL;
+	size_t max = 1;
+
+	if (wq->batch)
+	{
+		/* If this fails, the writer is called for each value list. */
+		entries = calloc (write_batch_size, sizeof (*entries));
+		if (entries != NULL)
+			max = write_batch_size;
+	}
+
+	while (42)
+	{
+		write_queue_t *head;
+		write_queue_t *q;
+		size_t num = 0;
+		size_t i;
+
+		pthread_mutex_lock (&wq->lock);
+		done = plugin_writer_queue_recycle (wq, done);
+		while (wq->loop && (wq->head == NULL))
+			pthread_cond_wait (&wq->cond, &wq->lock);
+		head = NULL;
+		if (wq->loop)
+			head = plugin_writer_queue_pop (wq, max, &num);
+		if ((head != NULL) && (head->enqueued != 0))
 		{
-			ERROR ("plugin: register_callback: "
-					"llentry_create failed.");
-			sfree (key);
-			destroy_callback (cf);
-			return (-1);
+			cdtime_t now = cdtime ();
+
+			for (q = head; q != NULL; q = q->next)
+				plugin_queue_wait_add (&wq->wait, q, now);
 		}
+		pthread_mutex_unlock (&wq->lock);
 
-		llist_append (*list, le);
+		/* The pool is full. */
+		plugin_write_queue_free (done);
+		done = NULL;
+
+		if (head == NULL)
+			break;
+
+		/* Like the write threads, call the writer with the context of
+		 * the plugin that dispatched the values. */
+		(void) plugin_set_ctx (head->ctx);
+
+		i = 0;
+		for (q = head; q != NULL; q = q->next)
+		{
+			/* Checked by plugin_writer_queue_enqueue(). */
+			const data_set_t *ds = q->ds;
+
+			if (entries == NULL)
+			{
+				(void) plugin_writer_call (wq->cf, wq->batch,
+						ds, &q->vl);
+				continue;
+			}
+
+			entries[i].ds = ds;
+			entries[i].vl = &q->vl;
+			i++;
+		}
+
+		if ((entries != NULL) && (i > 0))
+		{
+			plugin_write_batch_cb callback = wq->cf->cf_callback;
+			cdtime_t start = plugin_callback_start ();
+			int status;
+
+			if (record_statistics || (write_delay_warning > 0.0))
+				plugin_writer_age (wq->cf, entries, i, cdtime ());
+
+			/* Like plugin_write(), errors are not reported
+			 * here. */
+			PROBE2 (write_begin, wq->cf->cf_name, i);
+			status = (*callback) (entries, i, &wq->cf->cf_udata);
+			PROBE2 (write_end, wq->cf->cf_name, status);
+			plugin_callback_done (wq->cf, start);
+		}
+
+		while (head != NULL)
+		{
+			q = head;
+			head = q->next;
+			plugin_write_queue_release (q, &done);
+		}
+	}
+
+	plugin_write_queue_free (done);
+	sfree (entries);
+
+	pthread_exit (NULL);
+	return ((void *) 0);
+} /* }}} void *plugin_writer_queue_thread */
+
+/* Appends a copy of "vl" to the queue of "cf", applying the queue's limits
+ * and drop policy. */
+static int plugin_writer_queue_enqueue (callback_func_t *cf, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	writer_queue_t *wq = cf->cf_queue;
+	write_queue_t *q;
+	_Bool complain = 0;
+	int status;
+
+	/* Data sets not owned by the daemon, e.g. ones created by the perl
+	 * plugin on the stack, may not live until the writer is called. */
+	if (plugin_get_ds (vl->type) != ds)
+		return (plugin_writer_call (cf, wq->batch, ds, vl));
+
+	pthread_mutex_lock (&wq->lock);
+
+	/* The writer's threads have been stopped. */
+	if (!wq->loop)
+	{
+		pthread_mutex_unlock (&wq->lock);
+		return (plugin_writer_call (cf, wq->batch, ds, vl));
+	}
+
+	if ((wq->limit_high > 0) && (wq->length >= wq->limit_high))
+	{
+		if (wq->policy == PLUGIN_WRITE_QUEUE_DROP_NEWEST)
+			wq->overflow = 1;
+		else if (wq->policy == PLUGIN_WRITE_QUEUE_DROP_OLDEST)
+		{
+			size_t num = 0;
+
+			q = plugin_writer_queue_pop (wq, 1, &num);
+			if (q != NULL)
+			{
+				plugin_value_list_clear (&q->vl, q->values);
+				plugin_write_queue_free (
+						plugin_writer_queue_recycle (wq, q));
+				wq->dropped++;
+				complain = 1;
+			}
+		}
+		else /* if (wq->policy == PLUGIN_WRITE_QUEUE_BLOCK) */
+		{
+			wq->waiters++;
+			while (wq->loop && (wq->length > wq->limit_low))
+				pthread_cond_wait (&wq->space, &wq->lock);
+			wq->waiters--;
+
+			if (!wq->loop)
+			{
+				pthread_mutex_unlock (&wq->lock);
+				return (plugin_writer_call (cf, wq->batch,
+							ds, vl));
+			}
+		}
+	}
+
+	if (wq->overflow)
+	{
+		if (wq->length <= wq->limit_low)
+			wq->overflow = 0;
+		else
+		{
+			wq->dropped++;
+			complain = 1;
+		}
+	}
+
+	if (complain)
+	{
+		cdtime_t now = cdtime ();
+
+		if ((now - wq->last_message) > TIME_T_TO_CDTIME_T (1))
+			wq->last_message = now;
+		else
+			complain = 0;
+	}
+
+	if (wq->overflow)
+	{
+		pthread_mutex_unlock (&wq->lock);
+		if (complain)
+			ERROR ("plugin_write: Write queue of \"%s\" is full. "
+					"Dropping new values.", wq->name);
+		return (0);
+	}
+
+	q = wq->pool;
+	if (q != NULL)
+	{
+		wq->pool = q->next;
+		wq->pool_num--;
 	}
 	else
 	{
-		callback_func_t *old_cf;
+		q = malloc (sizeof (*q));
+		if (q == NULL)
+		{
+			pthread_mutex_unlock (&wq->lock);
+			return (ENOMEM);
+		}
+	}
+	q->next = NULL;
+	q->ds = ds;
+	q->vec = NULL;
+
+	status = plugin_value_list_copy (&q->vl, vl,
+			q->values, STATIC_ARRAY_SIZE (q->values));
+	if (status != 0)
+	{
+		pthread_mutex_unlock (&wq->lock);
+		sfree (q);
+		return (status);
+	}
+	q->ctx = plugin_get_ctx ();
+	q->enqueued = record_statistics ? cdtime () : 0;
 
-		old_cf = le->value;
-		le->value = cf;
+	if (wq->tail == NULL)
+		wq->head = q;
+	else
+		wq->tail->next = q;
+	wq->tail = q;
+	wq->length++;
 
-		WARNING ("plugin: register_callback: "
-				"a callback named `%s' already exists - "
-				"overwriting the old entry!", name);
+	pthread_cond_signal (&wq->cond);
+	pthread_mutex_unlock (&wq->lock);
 
-		destroy_callback (old_cf);
-		sfree (key);
-	}
+	if (complain)
+		ERROR ("plugin_write: Write queue of \"%s\" is full. "
+				"Dropping old values.", wq->name);
 
 	return (0);
-} /* }}} int register_callback */
+} /* }}} int plugin_writer_queue_enqueue */
 
-static void log_list_callbacks (llist_t **list, /* {{{ */
-				const char *comment)
+/* Stops the threads of "wq" and frees the values left in the queue. Values
+ * written to the writer afterwards are passed to it directly. */
+static void plugin_writer_queue_stop (writer_queue_t *wq) /* {{{ */
 {
-	char *str;
-	int len;
-	llentry_t *le;
-	int i;
-	int n;
-	char **keys;
+	size_t num;
+	size_t i;
 
-	n = llist_size(*list);
-	if (n == 0)
+	pthread_mutex_lock (&wq->lock);
+	wq->loop = 0;
+	pthread_cond_broadcast (&wq->cond);
+	pthread_cond_broadcast (&wq->space);
+	pthread_mutex_unlock (&wq->lock);
+
+	for (i = 0; i < wq->threads_num; i++)
 	{
-		INFO("%s [none]", comment);
-		return;
+		if (pthread_join (wq->threads[i], NULL) != 0)
+			ERROR ("plugin: plugin_writer_queue_stop: "
+					"pthread_join failed.");
 	}
-
-	keys = calloc(n, sizeof(char*));
-
-	if (keys == NULL)
+	sfree (wq->threads);
+	wq->threads_num = 0;
+
+	pthread_mutex_lock (&wq->lock);
+	num = (size_t) wq->length;
+	plugin_write_queue_free (wq->head);
+	wq->head = NULL;
+	wq->tail = NULL;
+	wq->length = 0;
+
+	plugin_write_queue_free (wq->pool);
+	wq->pool = NULL;
+	wq->pool_num = 0;
+	pthread_mutex_unlock (&wq->lock);
+
+	if (num > 0)
 	{
-		ERROR("%s: failed to allocate memory for list of callbacks",
-		      comment);
+		WARNING ("plugin: %zu value list%s left in the write queue "
+				"of \"%s\" after shutting down its threads.",
+				num, (num == 1) ? " was" : "s were", wq->name);
+	}
+} /* }}} void plugin_writer_queue_stop */
 
+static void plugin_writer_queue_destroy (writer_queue_t *wq) /* {{{ */
+{
+	if (wq == NULL)
 		return;
-	}
 
-	for (le = llist_head (*list), i = 0, len = 0;
-	     le != NULL;
-	     le = le->next, i++)
+	plugin_writer_queue_stop (wq);
+
+	pthread_mutex_destroy (&wq->lock);
+	pthread_cond_destroy (&wq->cond);
+	pthread_cond_destroy (&wq->space);
+	latency_counter_destroy (wq->wait);
+	sfree (wq->name);
+	sfree (wq);
+} /* }}} void plugin_writer_queue_destroy */
+
+/* Creates the queue of the writer "cf", using the settings from the writer's
+ * context. The queue's threads are started by plugin_writer_queue_start(). */
+static writer_queue_t *plugin_writer_queue_create (const char *name, /* {{{ */
+		callback_func_t *cf, _Bool batch)
+{
+	writer_queue_t *wq;
+	plugin_ctx_t ctx = cf->cf_ctx;
+
+	wq = calloc (1, sizeof (*wq));
+	if (wq == NULL)
+		return (NULL);
+
+	wq->name = strdup (name);
+	if (wq->name == NULL)
 	{
-		keys[i] = le->key;
-		len += strlen(le->key) + 6;
+		sfree (wq);
+		return (NULL);
 	}
-	str = malloc(len + 10);
-	if (str == NULL)
+	wq->cf = cf;
+	wq->batch = batch;
+
+	pthread_mutex_init (&wq->lock, /* attr = */ NULL);
+	pthread_cond_init (&wq->cond, /* attr = */ NULL);
+	pthread_cond_init (&wq->space, /* attr = */ NULL);
+
+	wq->limit_high = 0;
+	if (ctx.write_queue_limit_high > 0)
+		wq->limit_high = (long) ctx.write_queue_limit_high;
+
+	if (ctx.write_queue_limit_low < 0)
+		wq->limit_low = wq->limit_high / 2;
+	else if (ctx.write_queue_limit_low > wq->limit_high)
 	{
-		ERROR("%s: failed to allocate memory for list of callbacks",
-		      comment);
+		ERROR ("plugin: %s: WriteQueueLimitLow must not be larger than "
+				"WriteQueueLimitHigh.", name);
+		wq->limit_low = wq->limit_high;
 	}
 	else
+		wq->limit_low = (long) ctx.write_queue_limit_low;
+
+	wq->policy = ctx.write_queue_policy;
+
+	return (wq);
+} /* }}} writer_queue_t *plugin_writer_queue_create */
+
+static void plugin_writer_queue_start (writer_queue_t *wq) /* {{{ */
+{
+	size_t threads_num;
+	size_t i;
+
+	if (wq->threads != NULL)
+		return;
+
+	threads_num = 1;
+	if (wq->cf->cf_ctx.write_threads > 0)
+		threads_num = (size_t) wq->cf->cf_ctx.write_threads;
+
+	wq->threads = calloc (threads_num, sizeof (*wq->threads));
+	if (wq->threads == NULL)
 	{
-		*str = '\0';
-		strjoin(str, len, keys, n, "', '");
-		INFO("%s ['%s']", comment, str);
-		sfree (str);
+		ERROR ("plugin: plugin_writer_queue_start: calloc failed.");
+		return;
 	}
-	sfree (keys);
-} /* }}} void log_list_callbacks */
 
-static int create_register_callback (llist_t **list, /* {{{ */
-		const char *name, void *callback, user_data_t *ud)
-{
-	callback_func_t *cf;
+	pthread_mutex_lock (&wq->lock);
+	wq->loop = 1;
+	pthread_mutex_unlock (&wq->lock);
 
-	cf = calloc (1, sizeof (*cf));
-	if (cf == NULL)
+	for (i = 0; i < threads_num; i++)
 	{
-		ERROR ("plugin: create_register_callback: calloc failed.");
-		return (-1);
+		int status;
+
+		status = pthread_create (wq->threads + wq->threads_num,
+				/* attr = */ NULL,
+				plugin_writer_queue_thread,
+				/* arg = */ wq);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("plugin: plugin_writer_queue_start: "
+					"pthread_create failed with status %i (%s).",
+					status,
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		wq->threads_num++;
 	}
+	plugin_threads_pin ("WriteThreadsCPUs", wq->threads, wq->threads_num);
 
-	cf->cf_callback = callback;
-	if (ud == NULL)
+	/* Without threads, values are passed to the writer directly. */
+	if (wq->threads_num == 0)
 	{
-		cf->cf_udata.data = NULL;
-		cf->cf_udata.free_func = NULL;
+		pthread_mutex_lock (&wq->lock);
+		wq->loop = 0;
+		pthread_mutex_unlock (&wq->lock);
+		sfree (wq->threads);
 	}
-	else
+} /* }}} void plugin_writer_queue_start */
+
+/* Calls "func" for the queue of each writer that has one. */
+static void plugin_writer_queue_foreach ( /* {{{ */
+		void (*func) (writer_queue_t *))
+{
+	llist_t *lists[] = { list_write, list_write_batch };
+	size_t i;
+
+	for (i = 0; i < STATIC_ARRAY_SIZE (lists); i++)
 	{
-		cf->cf_udata = *ud;
+		llentry_t *le;
+
+		if (lists[i] == NULL)
+			continue;
+
+		for (le = llist_head (lists[i]); le != NULL; le = le->next)
+		{
+			callback_func_t *cf = le->value;
+
+			if (cf->cf_queue != NULL)
+				(*func) (cf->cf_queue);
+		}
 	}
+} /* }}} void plugin_writer_queue_foreach */
 
-	cf->cf_ctx = plugin_get_ctx ();
+/* Number of notifications each notification callback may queue, zero if
+ * notification callbacks are called by the threads dispatching them. Set by
+ * plugin_init_all(). */
+static long notification_queue_length = 0;
 
-	return (register_callback (list, name, cf));
-} /* }}} int create_register_callback */
+static void plugin_notification_queue_free ( /* {{{ */
+		notification_queue_entry_t *e)
+{
+	while (e != NULL)
+	{
+		notification_queue_entry_t *next = e->next;
 
-static int plugin_unregister (llist_t *list, const char *name) /* {{{ */
+		if (e->n.meta != NULL)
+			plugin_notification_meta_free (e->n.meta);
+		sfree (e);
+		e = next;
+	}
+} /* }}} void plugin_notification_queue_free */
+
+/* Returns true if "a" and "b" only differ in their time and meta data. */
+static _Bool plugin_notification_equal (const notification_t *a, /* {{{ */
+		const notification_t *b)
 {
-	llentry_t *e;
+	return ((a->severity == b->severity)
+			&& (strcmp (a->message, b->message) == 0)
+			&& (strcmp (a->host, b->host) == 0)
+			&& (strcmp (a->plugin, b->plugin) == 0)
+			&& (strcmp (a->plugin_instance, b->plugin_instance) == 0)
+			&& (strcmp (a->type, b->type) == 0)
+			&& (strcmp (a->type_instance, b->type_instance) == 0));
+} /* }}} _Bool plugin_notification_equal */
+
+static void *plugin_notification_queue_thread (void *args) /* {{{ */
+{
+	notification_queue_t *nq = args;
 
-	if (list == NULL)
-		return (-1);
+	pthread_mutex_lock (&nq->lock);
+	while (42)
+	{
+		notification_queue_entry_t *e;
+		plugin_notification_cb callback;
+		cdtime_t start;
+		int status;
 
-	e = llist_search (list, name);
-	if (e == NULL)
-		return (-1);
+		while (nq->loop && (nq->head == NULL))
+			pthread_cond_wait (&nq->cond, &nq->lock);
 
-	llist_remove (list, e);
+		/* Queued notifications are still delivered when shutting
+		 * down. */
+		e = nq->head;
+		if (e == NULL)
+			break;
 
-	sfree (e->key);
-	destroy_callback (e->value);
+		nq->head = e->next;
+		if (nq->head == NULL)
+			nq->tail = NULL;
+		nq->length--;
+		pthread_mutex_unlock (&nq->lock);
+
+		plugin_set_ctx (e->ctx);
+		callback = nq->cf->cf_callback;
+		start = plugin_callback_start ();
+		status = (*callback) (&e->n, &nq->cf->cf_udata);
+		plugin_callback_done (nq->cf, start);
+		if (status != 0)
+		{
+			WARNING ("plugin_dispatch_notification: Notification "
+					"callback %s returned %i.",
+					nq->name, status);
+		}
 
-	llentry_destroy (e);
+		e->next = NULL;
+		plugin_notification_queue_free (e);
 
-	return (0);
-} /* }}} int plugin_unregister */
+		pthread_mutex_lock (&nq->lock);
+	}
+	pthread_mutex_unlock (&nq->lock);
 
-/*
- * (Try to) load the shared object `file'. Won't complain if it isn't a shared
- * object, but it will bitch about a shared object not having a
- * ``module_register'' symbol..
- */
-static int plugin_load_file (char *file, uint32_t flags)
-{
-	lt_dlhandle dlh;
-	void (*reg_handle) (void);
+	return ((void *) 0);
+} /* }}} void *plugin_notification_queue_thread */
 
-	lt_dlinit ();
-	lt_dlerror (); /* clear errors */
+/* Appends a copy of "n" to the queue. Returns zero if the notification has
+ * been queued, coalesced or dropped, and non-zero if the caller has to call
+ * the callback itself. */
+static int plugin_notification_queue_enqueue ( /* {{{ */
+		notification_queue_t *nq, const notification_t *n)
+{
+	notification_queue_entry_t *e;
 
-#if LIBTOOL_VERSION == 2
-	if (flags & PLUGIN_FLAGS_GLOBAL) {
-		lt_dladvise advise;
-		lt_dladvise_init(&advise);
-		lt_dladvise_global(&advise);
-		dlh = lt_dlopenadvise(file, advise);
-		lt_dladvise_destroy(&advise);
-	} else {
-		dlh = lt_dlopen (file);
+	pthread_mutex_lock (&nq->lock);
+	if (!nq->loop)
+	{
+		pthread_mutex_unlock (&nq->lock);
+		return (-1);
 	}
-#else /* if LIBTOOL_VERSION == 1 */
-	if (flags & PLUGIN_FLAGS_GLOBAL)
-		WARNING ("plugin_load_file: The global flag is not supported, "
-				"libtool 2 is required for this.");
-	dlh = lt_dlopen (file);
-#endif
 
-	if (dlh == NULL)
+	if ((nq->tail != NULL) && plugin_notification_equal (&nq->tail->n, n))
 	{
-		char errbuf[1024] = "";
+		nq->coalesced++;
+		pthread_mutex_unlock (&nq->lock);
+		return (0);
+	}
 
-		ssnprintf (errbuf, sizeof (errbuf),
-				"lt_dlopen (\"%s\") failed: %s. "
-				"The most common cause for this problem is "
-				"missing dependencies. Use ldd(1) to check "
-				"the dependencies of the plugin "
-				"/ shared object.",
-				file, lt_dlerror ());
+	if (nq->length >= nq->limit)
+	{
+		cdtime_t now = cdtime ();
+		_Bool complain = 0;
 
-		ERROR ("%s", errbuf);
-		/* Make sure this is printed to STDERR in any case, but also
-		 * make sure it's printed only once. */
-		if (list_log != NULL)
-			fprintf (stderr, "ERROR: %s\n", errbuf);
+		nq->dropped++;
+		if ((now - nq->last_message) >= TIME_T_TO_CDTIME_T (10))
+		{
+			nq->last_message = now;
+			complain = 1;
+		}
+		pthread_mutex_unlock (&nq->lock);
 
-		return (1);
+		if (complain)
+			WARNING ("plugin_dispatch_notification: The queue of the "
+					"notification callback \"%s\" is full. Dropping "
+					"notifications.", nq->name);
+		return (0);
 	}
+	pthread_mutex_unlock (&nq->lock);
 
-	if ((reg_handle = (void (*) (void)) lt_dlsym (dlh, "module_register")) == NULL)
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (-1);
+	memcpy (&e->n, n, sizeof (e->n));
+	e->n.meta = NULL;
+	if ((n->meta != NULL) && (plugin_notification_meta_copy (&e->n, n) != 0))
 	{
-		WARNING ("Couldn't find symbol \"module_register\" in \"%s\": %s\n",
-				file, lt_dlerror ());
-		lt_dlclose (dlh);
+		plugin_notification_queue_free (e);
 		return (-1);
 	}
+	e->ctx = plugin_get_ctx ();
 
-	(*reg_handle) ();
+	pthread_mutex_lock (&nq->lock);
+	if (nq->tail == NULL)
+		nq->head = e;
+	else
+		nq->tail->next = e;
+	nq->tail = e;
+	nq->length++;
+	pthread_cond_signal (&nq->cond);
+	pthread_mutex_unlock (&nq->lock);
 
 	return (0);
-}
+} /* }}} int plugin_notification_queue_enqueue */
 
-static void *plugin_read_thread (void __attribute__((unused)) *args)
+/* Creates the queue of the notification callback "cf" and starts its
+ * thread. */
+static notification_queue_t *plugin_notification_queue_create ( /* {{{ */
+		const char *name, callback_func_t *cf, long limit)
 {
-	while (read_loop != 0)
-	{
-		read_func_t *rf;
-		plugin_ctx_t old_ctx;
-		cdtime_t start;
-		cdtime_t now;
-		cdtime_t elapsed;
-		int status;
-		int rf_type;
-		int rc;
-
-		/* Get the read function that needs to be read next.
-		 * We don't need to hold "read_lock" for the heap, but we need
-		 * to call c_heap_get_root() and pthread_cond_wait() in the
-		 * same protected block. */
-		pthread_mutex_lock (&read_lock);
-		rf = c_heap_get_root (read_heap);
-		if (rf == NULL)
-		{
-			pthread_cond_wait (&read_cond, &read_lock);
-                        pthread_mutex_unlock (&read_lock);
-			continue;
-		}
-		pthread_mutex_unlock (&read_lock);
-
-		if (rf->rf_interval == 0)
-		{
-			/* this should not happen, because the interval is set
-			 * for each plugin when loading it
-			 * XXX: issue a warning? */
-			rf->rf_interval = plugin_get_interval ();
-			rf->rf_effective_interval = rf->rf_interval;
-
-			rf->rf_next_read = cdtime ();
-		}
+	notification_queue_t *nq;
+	int status;
 
-		/* sleep until this entry is due,
-		 * using pthread_cond_timedwait */
-		pthread_mutex_lock (&read_lock);
-		/* In pthread_cond_timedwait, spurious wakeups are possible
-		 * (and really happen, at least on NetBSD with > 1 CPU), thus
-		 * we need to re-evaluate the condition every time
-		 * pthread_cond_timedwait returns. */
-		rc = 0;
-		while ((read_loop != 0)
-				&& (cdtime () < rf->rf_next_read)
-				&& rc == 0)
-		{
-			struct timespec ts = { 0 };
+	nq = calloc (1, sizeof (*nq));
+	if (nq == NULL)
+		return (NULL);
 
-			CDTIME_T_TO_TIMESPEC (rf->rf_next_read, &ts);
+	nq->name = strdup (name);
+	if (nq->name == NULL)
+	{
+		sfree (nq);
+		return (NULL);
+	}
+	nq->cf = cf;
+	nq->limit = limit;
 
-			rc = pthread_cond_timedwait (&read_cond, &read_lock,
-				&ts);
-		}
+	pthread_mutex_init (&nq->lock, /* attr = */ NULL);
+	pthread_cond_init (&nq->cond, /* attr = */ NULL);
+	nq->loop = 1;
 
-		/* Must hold `read_lock' when accessing `rf->rf_type'. */
-		rf_type = rf->rf_type;
-		pthread_mutex_unlock (&read_lock);
+	status = pthread_create (&nq->thread, /* attr = */ NULL,
+			plugin_notification_queue_thread, /* arg = */ nq);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("plugin: plugin_notification_queue_create: "
+				"pthread_create failed with status %i (%s).",
+				status, sstrerror (status, errbuf, sizeof (errbuf)));
+		nq->loop = 0;
+		plugin_notification_queue_destroy (nq);
+		return (NULL);
+	}
+	nq->running = 1;
 
-		/* Check if we're supposed to stop.. This may have interrupted
-		 * the sleep, too. */
-		if (read_loop == 0)
-		{
-			/* Insert `rf' again, so it can be free'd correctly */
-			c_heap_insert (read_heap, rf);
-			break;
-		}
+	return (nq);
+} /* }}} notification_queue_t *plugin_notification_queue_create */
 
-		/* The entry has been marked for deletion. The linked list
-		 * entry has already been removed by `plugin_unregister_read'.
-		 * All we have to do here is free the `read_func_t' and
-		 * continue. */
-		if (rf_type == RF_REMOVE)
-		{
-			DEBUG ("plugin_read_thread: Destroying the `%s' "
-					"callback.", rf->rf_name);
-			sfree (rf->rf_name);
-			destroy_callback ((callback_func_t *) rf);
-			rf = NULL;
-			continue;
-		}
+/* Delivers the queued notifications and stops the queue's thread. Afterwards
+ * the callback is called by the threads dispatching notifications again. */
+static void plugin_notification_queue_stop ( /* {{{ */
+		notification_queue_t *nq)
+{
+	pthread_mutex_lock (&nq->lock);
+	nq->loop = 0;
+	pthread_cond_broadcast (&nq->cond);
+	pthread_mutex_unlock (&nq->lock);
+
+	if (nq->running && (pthread_join (nq->thread, NULL) != 0))
+		ERROR ("plugin: plugin_notification_queue_stop: "
+				"pthread_join failed.");
+	nq->running = 0;
+} /* }}} void plugin_notification_queue_stop */
+
+static void plugin_notification_queue_destroy ( /* {{{ */
+		notification_queue_t *nq)
+{
+	if (nq == NULL)
+		return;
 
-		DEBUG ("plugin_read_thread: Handling `%s'.", rf->rf_name);
+	plugin_notification_queue_stop (nq);
 
-		start = cdtime ();
+	plugin_notification_queue_free (nq->head);
+	pthread_mutex_destroy (&nq->lock);
+	pthread_cond_destroy (&nq->cond);
+	sfree (nq->name);
+	sfree (nq);
+} /* }}} void plugin_notification_queue_destroy */
 
-		old_ctx = plugin_set_ctx (rf->rf_ctx);
+/* Creates the queue of each notification callback that doesn't have one. */
+static void plugin_notification_queues_start (void) /* {{{ */
+{
+	llentry_t *le;
 
-		if (rf_type == RF_SIMPLE)
-		{
-			int (*callback) (void);
+	if ((notification_queue_length <= 0) || (list_notification == NULL))
+		return;
 
-			callback = rf->rf_callback;
-			status = (*callback) ();
-		}
-		else
-		{
-			plugin_read_cb callback;
+	for (le = llist_head (list_notification); le != NULL; le = le->next)
+	{
+		callback_func_t *cf = le->value;
 
-			assert (rf_type == RF_COMPLEX);
+		if (cf->cf_notification_queue != NULL)
+			continue;
 
-			callback = rf->rf_callback;
-			status = (*callback) (&rf->rf_udata);
-		}
+		cf->cf_notification_queue = plugin_notification_queue_create (
+				le->key, cf, notification_queue_length);
+		if (cf->cf_notification_queue == NULL)
+			ERROR ("plugin: Creating the notification queue of `%s' "
+					"failed.", le->key);
+	}
+} /* }}} void plugin_notification_queues_start */
 
-		plugin_set_ctx (old_ctx);
+static void plugin_notification_queues_stop (void) /* {{{ */
+{
+	llentry_t *le;
 
-		/* If the function signals failure, we will increase the
-		 * intervals in which it will be called. */
-		if (status != 0)
-		{
-			rf->rf_effective_interval *= 2;
-			if (rf->rf_effective_interval > max_read_interval)
-				rf->rf_effective_interval = max_read_interval;
+	if (list_notification == NULL)
+		return;
 
-			NOTICE ("read-function of plugin `%s' failed. "
-					"Will suspend it for %.3f seconds.",
-					rf->rf_name,
-					CDTIME_T_TO_DOUBLE (rf->rf_effective_interval));
-		}
-		else
-		{
-			/* Success: Restore the interval, if it was changed. */
-			rf->rf_effective_interval = rf->rf_interval;
-		}
+	for (le = llist_head (list_notification); le != NULL; le = le->next)
+	{
+		callback_func_t *cf = le->value;
 
-		/* update the ``next read due'' field */
-		now = cdtime ();
+		if (cf->cf_notification_queue != NULL)
+			plugin_notification_queue_stop (cf->cf_notification_queue);
+	}
+} /* }}} void plugin_notification_queues_stop */
 
-		/* calculate the time spent in the read function */
-		elapsed = (now - start);
+/* Frees the retired structures that no write thread may still be using. */
+static void plugin_write_retired_free (void) /* {{{ */
+{
+	write_retired_t **prev;
+	unsigned long oldest = ULONG_MAX;
+	size_t i;
 
-		if (elapsed > rf->rf_effective_interval)
-			WARNING ("plugin_read_thread: read-function of the `%s' plugin took %.3f "
-				"seconds, which is above its read interval (%.3f seconds). You might "
-				"want to adjust the `Interval' or `ReadThreads' settings.",
-				rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed),
-				CDTIME_T_TO_DOUBLE(rf->rf_effective_interval));
+	pthread_mutex_lock (&write_retired_lock);
 
-		DEBUG ("plugin_read_thread: read-function of the `%s' plugin took "
-				"%.6f seconds.",
-				rf->rf_name, CDTIME_T_TO_DOUBLE(elapsed));
+	/* Pairs with the barrier in plugin_write_epoch_enter(): a thread whose
+	 * epoch isn't seen here sees the pointers published before the
+	 * structures were retired. */
+	__sync_synchronize ();
+	for (i = 0; i < write_queues_num; i++)
+	{
+		unsigned long epoch = write_queues[i].epoch;
 
-		DEBUG ("plugin_read_thread: Effective interval of the "
-				"`%s' plugin is %.3f seconds.",
-				rf->rf_name,
-				CDTIME_T_TO_DOUBLE (rf->rf_effective_interval));
+		if ((epoch != 0) && (epoch < oldest))
+			oldest = epoch;
+	}
 
-		/* Calculate the next (absolute) time at which this function
-		 * should be called. */
-		rf->rf_next_read += rf->rf_effective_interval;
+	prev = (write_retired_t **) &write_retired;
+	while (*prev != NULL)
+	{
+		write_retired_t *r = *prev;
 
-		/* Check, if `rf_next_read' is in the past. */
-		if (rf->rf_next_read < now)
+		if (r->epoch >= oldest)
 		{
-			/* `rf_next_read' is in the past. Insert `now'
-			 * so this value doesn't trail off into the
-			 * past too much. */
-			rf->rf_next_read = now;
+			prev = &r->next;
+			continue;
 		}
 
-		DEBUG ("plugin_read_thread: Next read of the `%s' plugin at %.3f.",
-				rf->rf_name,
-				CDTIME_T_TO_DOUBLE (rf->rf_next_read));
+		*prev = r->next;
+		r->free_func (r->data);
+		sfree (r);
+	}
 
-		/* Re-insert this read function into the heap again. */
-		c_heap_insert (read_heap, rf);
-	} /* while (read_loop) */
+	pthread_mutex_unlock (&write_retired_lock);
+} /* }}} void plugin_write_retired_free */
 
-	pthread_exit (NULL);
-	return ((void *) 0);
-} /* void *plugin_read_thread */
+static void plugin_write_epoch_enter (write_queue_shard_t *own) /* {{{ */
+{
+	own->epoch = write_epoch;
+	__sync_synchronize ();
+} /* }}} void plugin_write_epoch_enter */
 
-static void start_read_threads (int num)
+static void plugin_write_epoch_leave (write_queue_shard_t *own) /* {{{ */
 {
-	int i;
+	__sync_synchronize ();
+	own->epoch = 0;
 
-	if (read_threads != NULL)
-		return;
+	if (write_retired != NULL)
+		plugin_write_retired_free ();
+} /* }}} void plugin_write_epoch_leave */
+
+void plugin_write_defer_free (void (*free_func) (void *), /* {{{ */
+		void *data)
+{
+	write_retired_t *r;
 
-	read_threads = (pthread_t *) calloc (num, sizeof (pthread_t));
-	if (read_threads == NULL)
+	r = calloc (1, sizeof (*r));
+	if (r == NULL)
 	{
-		ERROR ("plugin: start_read_threads: calloc failed.");
+		/* Freeing it now could crash a write thread. */
+		ERROR ("plugin_write_defer_free: calloc failed.");
 		return;
 	}
+	r->free_func = free_func;
+	r->data = data;
+
+	pthread_mutex_lock (&write_retired_lock);
+	/* Threads seeing the new epoch must see the new pointers, too. */
+	__sync_synchronize ();
+	r->epoch = write_epoch;
+	write_epoch++;
+	r->next = write_retired;
+	write_retired = r;
+	pthread_mutex_unlock (&write_retired_lock);
+
+	/* Idle write threads never get to free it. */
+	plugin_write_retired_free ();
+} /* }}} void plugin_write_defer_free */
+
+static void *plugin_write_thread (void *args) /* {{{ */
+{
+	write_queue_shard_t *own = args;
+	write_queue_t *done = NULL;
+	write_batch_t *batch;
+	write_cache_batch_t *cache_batch;
 
-	read_threads_num = 0;
-	for (i = 0; i < num; i++)
+	/* If this fails, batch writers are called for each value list. */
+	batch = plugin_write_batch_create (write_batch_size);
+	pthread_setspecific (write_batch_key, batch);
+
+	/* If this fails, the cache is updated for each value list. */
+	cache_batch = plugin_write_cache_batch_create (write_batch_size);
+
+	while (write_loop)
 	{
-		if (pthread_create (read_threads + read_threads_num, NULL,
-					plugin_read_thread, NULL) == 0)
-		{
-			read_threads_num++;
-		}
-		else
-		{
-			ERROR ("plugin: start_read_threads: pthread_create failed.");
-			return;
-		}
-	} /* for (i) */
-} /* void start_read_threads */
+		write_queue_t *q = plugin_write_dequeue (own, &done);
+		size_t num = 0;
 
-static void stop_read_threads (void)
-{
-	int i;
+		plugin_write_epoch_enter (own);
 
-	if (read_threads == NULL)
-		return;
+		while (q != NULL)
+		{
+			if (cache_batch != NULL)
+				cache_batch->items[cache_batch->num++] = q;
+			else
+			{
+				if (q->vec != NULL)
+					plugin_dispatch_values_vec_internal (q);
+				else
+					plugin_dispatch_values_internal (q->ds,
+							&q->vl, /* cached = */ 0);
 
-	INFO ("collectd: Stopping %i read threads.", read_threads_num);
+				plugin_write_queue_release (q, &done);
+			}
 
-	pthread_mutex_lock (&read_lock);
-	read_loop = 0;
-	DEBUG ("plugin: stop_read_threads: Signalling `read_cond'");
-	pthread_cond_broadcast (&read_cond);
-	pthread_mutex_unlock (&read_lock);
+			num++;
+			if (num >= write_batch_size)
+				break;
 
-	for (i = 0; i < read_threads_num; i++)
-	{
-		if (pthread_join (read_threads[i], NULL) != 0)
-		{
-			ERROR ("plugin: stop_read_threads: pthread_join failed.");
+			q = plugin_write_dequeue_nowait (own, &done);
 		}
-		read_threads[i] = (pthread_t) 0;
+
+		if (cache_batch != NULL)
+			plugin_write_cache_batch_dispatch (cache_batch, &done);
+		plugin_write_batch_flush (batch);
+
+		plugin_write_epoch_leave (own);
 	}
-	sfree (read_threads);
-	read_threads_num = 0;
-} /* void stop_read_threads */
 
-static void plugin_value_list_free (value_list_t *vl) /* {{{ */
-{
-	if (vl == NULL)
-		return;
+	plugin_write_queue_free (done);
 
-	meta_data_destroy (vl->meta);
-	sfree (vl->values);
-	sfree (vl);
-} /* }}} void plugin_value_list_free */
+	plugin_write_cache_batch_destroy (cache_batch);
+	pthread_setspecific (write_batch_key, NULL);
+	plugin_write_batch_destroy (batch);
 
-static value_list_t *plugin_value_list_clone (value_list_t const *vl_orig) /* {{{ */
+	pthread_exit (NULL);
+	return ((void *) 0);
+} /* }}} void *plugin_write_thread */
+
+static void start_write_threads (size_t num) /* {{{ */
 {
-	value_list_t *vl;
+	size_t i;
 
-	if (vl_orig == NULL)
-		return (NULL);
+	if (write_threads != NULL)
+		return;
 
-	vl = malloc (sizeof (*vl));
-	if (vl == NULL)
-		return (NULL);
-	memcpy (vl, vl_orig, sizeof (*vl));
+	assert (num <= write_queues_num);
 
-	vl->values = calloc (vl_orig->values_len, sizeof (*vl->values));
-	if (vl->values == NULL)
+	if (!write_batch_key_initialized)
 	{
-		plugin_value_list_free (vl);
-		return (NULL);
+		if (pthread_key_create (&write_batch_key, NULL) != 0)
+		{
+			ERROR ("plugin: start_write_threads: "
+					"pthread_key_create failed.");
+			return;
+		}
+		write_batch_key_initialized = 1;
 	}
-	memcpy (vl->values, vl_orig->values,
-			vl_orig->values_len * sizeof (*vl->values));
 
-	vl->meta = meta_data_clone (vl->meta);
-	if ((vl_orig->meta != NULL) && (vl->meta == NULL))
+	write_threads = (pthread_t *) calloc (num, sizeof (pthread_t));
+	if (write_threads == NULL)
 	{
-		plugin_value_list_free (vl);
-		return (NULL);
+		ERROR ("plugin: start_write_threads: calloc failed.");
+		return;
 	}
 
-	if (vl->time == 0)
-		vl->time = cdtime ();
-
-	/* Fill in the interval from the thread context, if it is zero. */
-	if (vl->interval == 0)
+	write_threads_num = 0;
+	for (i = 0; i < num; i++)
 	{
-		plugin_ctx_t ctx = plugin_get_ctx ();
+		int status;
 
-		if (ctx.interval != 0)
-			vl->interval = ctx.interval;
-		else
+		status = pthread_create (write_threads + write_threads_num,
+				/* attr = */ NULL,
+				plugin_write_thread,
+				/* arg = */ &write_queues[i]);
+		if (status != 0)
 		{
-			char name[6 * DATA_MAX_NAME_LEN];
-			FORMAT_VL (name, sizeof (name), vl);
-			ERROR ("plugin_value_list_clone: Unable to determine "
-					"interval from context for "
-					"value list \"%s\". "
-					"This indicates a broken plugin. "
-					"Please report this problem to the "
-					"collectd mailing list or at "
-					"<http://collectd.org/bugs/>.", name);
-			vl->interval = cf_get_default_interval ();
+			char errbuf[1024];
+			ERROR ("plugin: start_write_threads: pthread_create failed "
+					"with status %i (%s).", status,
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			return;
 		}
-	}
 
-	return (vl);
-} /* }}} value_list_t *plugin_value_list_clone */
+		write_threads_num++;
+	} /* for (i) */
+	plugin_threads_pin ("WriteThreadsCPUs",
+			write_threads, write_threads_num);
 
-static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
+	plugin_writer_queue_foreach (plugin_writer_queue_start);
+} /* }}} void start_write_threads */
+
+static void stop_write_threads (void) /* {{{ */
 {
 	write_queue_t *q;
+	size_t i;
+	size_t j;
 
-	q = malloc (sizeof (*q));
-	if (q == NULL)
-		return (ENOMEM);
-	q->next = NULL;
+	if (write_threads == NULL)
+		return;
 
-	q->vl = plugin_value_list_clone (vl);
-	if (q->vl == NULL)
+	INFO ("collectd: Stopping %zu write threads.", write_threads_num);
+
+	write_loop = 0;
+	DEBUG ("plugin: stop_write_threads: Signalling write queues");
+	for (j = 0; j < write_queues_num; j++)
 	{
-		sfree (q);
-		return (ENOMEM);
+		pthread_mutex_lock (&write_queues[j].lock);
+		pthread_cond_broadcast (&write_queues[j].cond);
+		pthread_mutex_unlock (&write_queues[j].lock);
 	}
 
-	/* Store context of caller (read plugin); otherwise, it would not be
-	 * available to the write plugins when actually dispatching the
-	 * value-list later on. */
-	q->ctx = plugin_get_ctx ();
+	for (i = 0; i < write_threads_num; i++)
+	{
+		if (pthread_join (write_threads[i], NULL) != 0)
+		{
+			ERROR ("plugin: stop_write_threads: pthread_join failed.");
+		}
+		write_threads[i] = (pthread_t) 0;
+	}
+	sfree (write_threads);
+	write_threads_num = 0;
 
-	pthread_mutex_lock (&write_lock);
+	/* Writers with their own queue are only fed by the write threads. */
+	plugin_writer_queue_foreach (plugin_writer_queue_stop);
 
-	if (write_queue_tail == NULL)
+	i = 0;
+	for (j = 0; j < write_queues_num; j++)
 	{
-		write_queue_head = q;
-		write_queue_tail = q;
-		write_queue_length = 1;
+		write_queue_shard_t *shard = &write_queues[j];
+
+		pthread_mutex_lock (&shard->lock);
+		for (q = shard->head; q != NULL; q = q->next)
+			i++;
+		for (q = shard->urgent_head; q != NULL; q = q->next)
+			i++;
+		plugin_write_queue_free (shard->head);
+		plugin_write_queue_free (shard->urgent_head);
+		shard->head = NULL;
+		shard->tail = NULL;
+		shard->urgent_head = NULL;
+		shard->urgent_tail = NULL;
+		shard->length = 0;
+
+		plugin_write_queue_free (shard->pool);
+		shard->pool = NULL;
+		shard->pool_num = 0;
+
+		latency_counter_destroy (shard->wait);
+		shard->wait = NULL;
+		pthread_mutex_unlock (&shard->lock);
 	}
-	else
+
+	if (i > 0)
 	{
-		write_queue_tail->next = q;
-		write_queue_tail = q;
-		write_queue_length += 1;
+		WARNING ("plugin: %zu value list%s left after shutting down "
+				"the write threads.",
+				i, (i == 1) ? " was" : "s were");
 	}
+} /* }}} void stop_write_threads */
 
-	pthread_cond_signal (&write_cond);
-	pthread_mutex_unlock (&write_lock);
+/* Passes a formatted message to all log callbacks. */
+static void plugin_log_dispatch (int level, const char *msg) /* {{{ */
+{
+	llentry_t *le;
 
-	return (0);
-} /* }}} int plugin_write_enqueue */
+	le = llist_head (list_log);
+	while (le != NULL)
+	{
+		callback_func_t *cf;
+		plugin_log_cb callback;
 
-static value_list_t *plugin_write_dequeue (void) /* {{{ */
-{
-	write_queue_t *q;
-	value_list_t *vl;
+		cf = le->value;
+		callback = cf->cf_callback;
 
-	pthread_mutex_lock (&write_lock);
+		/* do not switch plugin context; rather keep the context
+		 * (interval) information of the calling plugin */
 
-	while (write_loop && (write_queue_head == NULL))
-		pthread_cond_wait (&write_cond, &write_lock);
+		(*callback) (level, msg, &cf->cf_udata);
 
-	if (write_queue_head == NULL)
-	{
-		pthread_mutex_unlock (&write_lock);
-		return (NULL);
+		le = le->next;
 	}
+} /* }}} void plugin_log_dispatch */
 
-	q = write_queue_head;
-	write_queue_head = q->next;
-	write_queue_length -= 1;
-	if (write_queue_head == NULL) {
-		write_queue_tail = NULL;
-		assert(0 == write_queue_length);
-		}
+/* Calls the log callbacks for queued messages. Messages dropped because the
+ * queue was full are summarized once the queue has drained, or once per
+ * second if it doesn't. */
+static void *plugin_log_thread (void __attribute__((unused)) *args) /* {{{ */
+{
+	cdtime_t summary_time = 0;
+
+	pthread_mutex_lock (&log_lock);
+	while (42)
+	{
+		log_record_t record;
+		cdtime_t now;
+
+		while (log_thread_loop && (log_queue_num == 0) && (log_dropped == 0))
+			pthread_cond_wait (&log_cond, &log_lock);
 
-	pthread_mutex_unlock (&write_lock);
+		if ((log_queue_num == 0) && (log_dropped == 0))
+			break; /* shutting down and drained */
+
+		now = cdtime ();
+		if ((log_dropped > 0) && ((log_queue_num == 0)
+					|| (now - summary_time >= TIME_T_TO_CDTIME_T (1))))
+		{
+			uint64_t dropped = log_dropped;
 
-	(void) plugin_set_ctx (q->ctx);
+			log_dropped = 0;
+			summary_time = now;
+			pthread_mutex_unlock (&log_lock);
 
-	vl = q->vl;
-	sfree (q);
-	return (vl);
-} /* }}} value_list_t *plugin_write_dequeue */
+			ssnprintf (record.msg, sizeof (record.msg), "plugin_log: "
+					"Dropped %"PRIu64" log messages because the log "
+					"queue was full.", dropped);
+			plugin_log_dispatch (LOG_WARNING, record.msg);
 
-static void *plugin_write_thread (void __attribute__((unused)) *args) /* {{{ */
-{
-	while (write_loop)
-	{
-		value_list_t *vl = plugin_write_dequeue ();
-		if (vl == NULL)
+			pthread_mutex_lock (&log_lock);
 			continue;
+		}
 
-		plugin_dispatch_values_internal (vl);
+		record.level = log_queue[log_queue_head].level;
+		sstrncpy (record.msg, log_queue[log_queue_head].msg,
+				sizeof (record.msg));
+		log_queue_head = (log_queue_head + 1) % log_queue_size;
+		log_queue_num--;
+		pthread_mutex_unlock (&log_lock);
 
-		plugin_value_list_free (vl);
+		plugin_log_dispatch (record.level, record.msg);
+
+		pthread_mutex_lock (&log_lock);
 	}
+	pthread_mutex_unlock (&log_lock);
 
-	pthread_exit (NULL);
 	return ((void *) 0);
-} /* }}} void *plugin_write_thread */
+} /* }}} void *plugin_log_thread */
 
-static void start_write_threads (size_t num) /* {{{ */
+static void start_log_thread (size_t queue_size) /* {{{ */
 {
-	size_t i;
+	int status;
 
-	if (write_threads != NULL)
+	pthread_mutex_lock (&log_lock);
+	if (log_queue != NULL)
+	{
+		pthread_mutex_unlock (&log_lock);
 		return;
+	}
 
-	write_threads = (pthread_t *) calloc (num, sizeof (pthread_t));
-	if (write_threads == NULL)
+	log_queue = calloc (queue_size, sizeof (*log_queue));
+	if (log_queue == NULL)
 	{
-		ERROR ("plugin: start_write_threads: calloc failed.");
+		pthread_mutex_unlock (&log_lock);
+		ERROR ("plugin: start_log_thread: calloc failed.");
 		return;
 	}
-
-	write_threads_num = 0;
-	for (i = 0; i < num; i++)
+	log_queue_size = queue_size;
+	log_queue_head = 0;
+	log_queue_num = 0;
+	log_dropped = 0;
+	log_thread_loop = 1;
+
+	status = pthread_create (&log_thread_id, /* attr = */ NULL,
+			plugin_log_thread, /* arg = */ NULL);
+	if (status != 0)
 	{
-		int status;
-
-		status = pthread_create (write_threads + write_threads_num,
-				/* attr = */ NULL,
-				plugin_write_thread,
-				/* arg = */ NULL);
-		if (status != 0)
-		{
-			char errbuf[1024];
-			ERROR ("plugin: start_write_threads: pthread_create failed "
-					"with status %i (%s).", status,
-					sstrerror (status, errbuf, sizeof (errbuf)));
-			return;
-		}
-
-		write_threads_num++;
-	} /* for (i) */
-} /* }}} void start_write_threads */
+		char errbuf[1024];
 
-static void stop_write_threads (void) /* {{{ */
-{
-	write_queue_t *q;
-	size_t i;
+		sfree (log_queue);
+		log_thread_loop = 0;
+		pthread_mutex_unlock (&log_lock);
 
-	if (write_threads == NULL)
+		ERROR ("plugin: start_log_thread: pthread_create failed "
+				"with status %i (%s).", status,
+				sstrerror (status, errbuf, sizeof (errbuf)));
 		return;
+	}
+	pthread_mutex_unlock (&log_lock);
+} /* }}} void start_log_thread */
 
-	INFO ("collectd: Stopping %zu write threads.", write_threads_num);
-
-	pthread_mutex_lock (&write_lock);
-	write_loop = 0;
-	DEBUG ("plugin: stop_write_threads: Signalling `write_cond'");
-	pthread_cond_broadcast (&write_cond);
-	pthread_mutex_unlock (&write_lock);
+/* Waits until the log thread has handled all queued messages. Messages
+ * logged afterwards are passed to the log callbacks right away. */
+static void stop_log_thread (void) /* {{{ */
+{
+	log_record_t *queue;
 
-	for (i = 0; i < write_threads_num; i++)
+	pthread_mutex_lock (&log_lock);
+	if (log_queue == NULL)
 	{
-		if (pthread_join (write_threads[i], NULL) != 0)
-		{
-			ERROR ("plugin: stop_write_threads: pthread_join failed.");
-		}
-		write_threads[i] = (pthread_t) 0;
+		pthread_mutex_unlock (&log_lock);
+		return;
 	}
-	sfree (write_threads);
-	write_threads_num = 0;
+	log_thread_loop = 0;
+	pthread_cond_broadcast (&log_cond);
+	pthread_mutex_unlock (&log_lock);
 
-	pthread_mutex_lock (&write_lock);
-	i = 0;
-	for (q = write_queue_head; q != NULL; )
-	{
-		write_queue_t *q1 = q;
-		plugin_value_list_free (q->vl);
-		q = q->next;
-		sfree (q1);
-		i++;
-	}
-	write_queue_head = NULL;
-	write_queue_tail = NULL;
-	write_queue_length = 0;
-	pthread_mutex_unlock (&write_lock);
+	pthread_join (log_thread_id, NULL);
 
-	if (i > 0)
-	{
-		WARNING ("plugin: %zu value list%s left after shutting down "
-				"the write threads.",
-				i, (i == 1) ? " was" : "s were");
-	}
-} /* }}} void stop_write_threads */
+	pthread_mutex_lock (&log_lock);
+	queue = log_queue;
+	log_queue = NULL;
+	log_queue_num = 0;
+	pthread_mutex_unlock (&log_lock);
+
+	sfree (queue);
+} /* }}} void stop_log_thread */
 
 /*
  * Public functions
@@ -1142,6 +5066,12 @@ int plugin_register_complex_config (const char *type,
 	return (cf_register_complex (type, callback));
 } /* int plugin_register_complex_config */
 
+int plugin_register_complex_reload (const char *type,
+		int (*callback) (oconfig_item_t *))
+{
+	return (cf_register_complex_reload (type, callback));
+} /* int plugin_register_complex_reload */
+
 int plugin_register_init (const char *name,
 		int (*callback) (void))
 {
@@ -1149,22 +5079,6 @@ int plugin_register_init (const char *name,
 				/* user_data = */ NULL));
 } /* plugin_register_init */
 
-static int plugin_compare_read_func (const void *arg0, const void *arg1)
-{
-	const read_func_t *rf0;
-	const read_func_t *rf1;
-
-	rf0 = arg0;
-	rf1 = arg1;
-
-	if (rf0->rf_next_read < rf1->rf_next_read)
-		return (-1);
-	else if (rf0->rf_next_read > rf1->rf_next_read)
-		return (1);
-	else
-		return (0);
-} /* int plugin_compare_read_func */
-
 /* Add a read function to both, the heap and a linked list. The linked list if
  * used to look-up read functions, especially for the remove function. The heap
  * is used to determine which plugin to read next. */
@@ -1173,14 +5087,15 @@ static int plugin_insert_read (read_func_t *rf)
 	int status;
 	llentry_t *le;
 
-	rf->rf_next_read = cdtime ();
+	rf->rf_next_read = plugin_read_phase (rf, cdtime ());
 	rf->rf_effective_interval = rf->rf_interval;
+	rf->rf_backoff_interval = rf->rf_interval;
 
 	pthread_mutex_lock (&read_lock);
 
 	if (read_list == NULL)
 	{
-		read_list = llist_create ();
+		read_list = llist_create_indexed ();
 		if (read_list == NULL)
 		{
 			pthread_mutex_unlock (&read_lock);
@@ -1191,11 +5106,11 @@ static int plugin_insert_read (read_func_t *rf)
 
 	if (read_heap == NULL)
 	{
-		read_heap = c_heap_create (plugin_compare_read_func);
+		read_heap = c_iheap_create ();
 		if (read_heap == NULL)
 		{
 			pthread_mutex_unlock (&read_lock);
-			ERROR ("plugin_insert_read: c_heap_create failed.");
+			ERROR ("plugin_insert_read: c_iheap_create failed.");
 			return (-1);
 		}
 	}
@@ -1219,11 +5134,14 @@ static int plugin_insert_read (read_func_t *rf)
 		return (-1);
 	}
 
-	status = c_heap_insert (read_heap, rf);
+	rf->rf_pool = plugin_read_pool_get (rf);
+
+	status = c_iheap_insert (read_heap, &rf->rf_heap_handle,
+			rf->rf_next_read, rf);
 	if (status != 0)
 	{
 		pthread_mutex_unlock (&read_lock);
-		ERROR ("plugin_insert_read: c_heap_insert failed.");
+		ERROR ("plugin_insert_read: c_iheap_insert failed.");
 		llentry_destroy (le);
 		return (-1);
 	}
@@ -1254,6 +5172,7 @@ int plugin_register_read (const char *name,
 	rf->rf_udata.data = NULL;
 	rf->rf_udata.free_func = NULL;
 	rf->rf_ctx = plugin_get_ctx ();
+	plugin_callback_stats_init (&rf->rf_super);
 	rf->rf_group[0] = '\0';
 	rf->rf_name = strdup (name);
 	rf->rf_type = RF_SIMPLE;
@@ -1304,6 +5223,7 @@ int plugin_register_complex_read (const char *group, const char *name,
 	}
 
 	rf->rf_ctx = plugin_get_ctx ();
+	plugin_callback_stats_init (&rf->rf_super);
 
 	status = plugin_insert_read (rf);
 	if (status != 0) {
@@ -1314,18 +5234,84 @@ int plugin_register_complex_read (const char *group, const char *name,
 	return (status);
 } /* int plugin_register_complex_read */
 
+/* Like create_register_callback(), but creates the writer's own queue if its
+ * context asks for one. */
+static int create_register_write_callback (llist_t **list, /* {{{ */
+		const char *name, void *callback, user_data_t *ud,
+		_Bool batch)
+{
+	callback_func_t *cf;
+
+	cf = create_callback (callback, ud);
+	if (cf == NULL)
+		return (-1);
+
+	if ((cf->cf_ctx.write_threads > 0)
+			|| (cf->cf_ctx.write_queue_limit_high > 0))
+	{
+		cf->cf_queue = plugin_writer_queue_create (name, cf, batch);
+		if (cf->cf_queue == NULL)
+		{
+			ERROR ("plugin: Creating the write queue of `%s' failed.",
+					name);
+			destroy_callback (cf);
+			return (-1);
+		}
+
+		/* Writers registered before the write threads are started
+		 * are started with them. */
+		if (write_threads != NULL)
+			plugin_writer_queue_start (cf->cf_queue);
+	}
+
+	if (cf->cf_ctx.write_resolution > 0)
+	{
+		cf->cf_rollup = rollup_create (cf->cf_ctx.write_resolution,
+				cf->cf_ctx.write_rollup);
+		if (cf->cf_rollup == NULL)
+		{
+			ERROR ("plugin: Creating the rollup of `%s' failed.",
+					name);
+			destroy_callback (cf);
+			return (-1);
+		}
+	}
+
+	return (register_callback (list, name, cf));
+} /* }}} int create_register_write_callback */
+
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *ud)
 {
-	return (create_register_callback (&list_write, name,
-				(void *) callback, ud));
+	return (create_register_write_callback (&list_write, name,
+				(void *) callback, ud, /* batch = */ 0));
 } /* int plugin_register_write */
 
+int plugin_register_write_batch (const char *name,
+		plugin_write_batch_cb callback, user_data_t *ud)
+{
+	return (create_register_write_callback (&list_write_batch, name,
+				(void *) callback, ud, /* batch = */ 1));
+} /* int plugin_register_write_batch */
+
+/* Hands the periodic flush to the callback's thread without waiting, so a
+ * slow flush doesn't occupy a read thread. */
 static int plugin_flush_timeout_callback (user_data_t *ud)
 {
 	flush_callback_t *cb = ud->data;
+	plugin_flush_request_t *req;
+	int status;
+
+	req = plugin_flush_request_create (/* deadline = */ 0,
+			/* done = */ NULL, /* arg = */ NULL);
+	if (req == NULL)
+		return (ENOMEM);
+
+	status = plugin_flush_request_add (req, cb->name, cb->timeout,
+			/* identifier = */ NULL);
+	plugin_flush_request_release (req);
 
-	return plugin_flush (cb->name, cb->timeout, /* identifier = */ NULL);
+	return (status);
 } /* static int plugin_flush_callback */
 
 static void plugin_flush_timeout_callback_free (void *data)
@@ -1435,6 +5421,13 @@ int plugin_register_shutdown (const char *name,
 				(void *) callback, /* user_data = */ NULL));
 } /* int plugin_register_shutdown */
 
+int plugin_register_memory (const char *name,
+		plugin_memory_cb callback)
+{
+	return (create_register_callback (&list_memory, name,
+				(void *) callback, /* user_data = */ NULL));
+} /* int plugin_register_memory */
+
 static void plugin_free_data_sets (void)
 {
 	void *key;
@@ -1443,7 +5436,7 @@ static void plugin_free_data_sets (void)
 	if (data_sets == NULL)
 		return;
 
-	while (c_avl_pick (data_sets, &key, &value) == 0)
+	while (c_btree_pick (data_sets, &key, &value) == 0)
 	{
 		data_set_t *ds = value;
 		/* key is a pointer to ds->type */
@@ -1452,24 +5445,51 @@ static void plugin_free_data_sets (void)
 		sfree (ds);
 	}
 
-	c_avl_destroy (data_sets);
+	c_btree_destroy (data_sets);
 	data_sets = NULL;
+
+	types_list_free ();
 } /* void plugin_free_data_sets */
 
+/* Data sets are either registered or part of a compiled types database, see
+ * types_list.h. */
+static _Bool plugin_have_data_sets (void)
+{
+	return ((data_sets != NULL) || (types_list_cached_num () > 0));
+} /* _Bool plugin_have_data_sets */
+
+static const data_set_t *plugin_find_data_set (const char *type)
+{
+	const data_set_t *ds;
+	data_set_t *ds_found = NULL;
+
+	ds = types_list_get (type);
+	if (ds != NULL)
+		return (ds);
+
+	if ((data_sets == NULL)
+			|| (c_btree_get (data_sets, type, (void *) &ds_found) != 0))
+		return (NULL);
+
+	return (ds_found);
+} /* const data_set_t *plugin_find_data_set */
+
 int plugin_register_data_set (const data_set_t *ds)
 {
 	data_set_t *ds_copy;
 	size_t i;
 
-	if ((data_sets != NULL)
-			&& (c_avl_get (data_sets, ds->type, NULL) == 0))
+	if (((data_sets != NULL)
+				&& (c_btree_get (data_sets, ds->type, NULL) == 0))
+			|| (types_list_get (ds->type) != NULL))
 	{
 		NOTICE ("Replacing DS `%s' with another version.", ds->type);
 		plugin_unregister_data_set (ds->type);
 	}
-	else if (data_sets == NULL)
+
+	if (data_sets == NULL)
 	{
-		data_sets = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+		data_sets = c_btree_create_string ();
 		if (data_sets == NULL)
 			return (-1);
 	}
@@ -1490,7 +5510,7 @@ int plugin_register_data_set (const data_set_t *ds)
 	for (i = 0; i < ds->ds_num; i++)
 		memcpy (ds_copy->ds + i, ds->ds + i, sizeof (data_source_t));
 
-	return (c_avl_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy));
+	return (c_btree_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy));
 } /* int plugin_register_data_set */
 
 int plugin_register_log (const char *name,
@@ -1503,9 +5523,18 @@ int plugin_register_log (const char *name,
 int plugin_register_notification (const char *name,
 		plugin_notification_cb callback, user_data_t *ud)
 {
-	return (create_register_callback (&list_notification, name,
-				(void *) callback, ud));
-} /* int plugin_register_log */
+	int status;
+
+	status = create_register_callback (&list_notification, name,
+			(void *) callback, ud);
+
+	/* Callbacks registered after plugin_init_all() get their queue
+	 * right away. */
+	if ((status == 0) && (notification_queue_length > 0))
+		plugin_notification_queues_start ();
+
+	return (status);
+} /* int plugin_register_notification */
 
 int plugin_unregister_config (const char *name)
 {
@@ -1524,6 +5553,22 @@ int plugin_unregister_init (const char *name)
 	return (plugin_unregister (list_init, name));
 }
 
+/* Removes "rf" after its list entry has been removed. A function waiting in
+ * the heap is free'd right away; one that has been handed to a read thread
+ * is marked and free'd by that thread. The caller must hold "read_lock". */
+static void plugin_read_remove (read_func_t *rf) /* {{{ */
+{
+	if (C_IHEAP_CONTAINS (&rf->rf_heap_handle))
+	{
+		c_iheap_remove (read_heap, &rf->rf_heap_handle);
+		sfree (rf->rf_name);
+		destroy_callback ((callback_func_t *) rf);
+		return;
+	}
+
+	rf->rf_type = RF_REMOVE;
+} /* }}} void plugin_read_remove */
+
 int plugin_unregister_read (const char *name) /* {{{ */
 {
 	llentry_t *le;
@@ -1553,13 +5598,13 @@ int plugin_unregister_read (const char *name) /* {{{ */
 
 	rf = le->value;
 	assert (rf != NULL);
-	rf->rf_type = RF_REMOVE;
+	plugin_read_remove (rf);
 
 	pthread_mutex_unlock (&read_lock);
 
 	llentry_destroy (le);
 
-	DEBUG ("plugin_unregister_read: Marked `%s' for removal.", name);
+	DEBUG ("plugin_unregister_read: Removed `%s'.", name);
 
 	return (0);
 } /* }}} int plugin_unregister_read */
@@ -1567,6 +5612,9 @@ int plugin_unregister_read (const char *name) /* {{{ */
 void plugin_log_available_writers (void)
 {
 	log_list_callbacks (&list_write, "Available write targets:");
+	if (list_write_batch != NULL)
+		log_list_callbacks (&list_write_batch,
+				"Available batch write targets:");
 }
 
 static int compare_read_func_group (llentry_t *e, void *ud) /* {{{ */
@@ -1607,15 +5655,15 @@ int plugin_unregister_read_group (const char *group) /* {{{ */
 
 		llist_remove (read_list, le);
 
+		DEBUG ("plugin_unregister_read_group: "
+				"Removing `%s' (group `%s').",
+				((read_func_t *) le->value)->rf_name, group);
+
 		rf = le->value;
 		assert (rf != NULL);
-		rf->rf_type = RF_REMOVE;
+		plugin_read_remove (rf);
 
 		llentry_destroy (le);
-
-		DEBUG ("plugin_unregister_read_group: "
-				"Marked `%s' (group `%s') for removal.",
-				rf->rf_name, group);
 	}
 
 	pthread_mutex_unlock (&read_lock);
@@ -1632,7 +5680,10 @@ int plugin_unregister_read_group (const char *group) /* {{{ */
 
 int plugin_unregister_write (const char *name)
 {
-	return (plugin_unregister (list_write, name));
+	if (plugin_unregister (list_write, name) == 0)
+		return (0);
+
+	return (plugin_unregister (list_write_batch, name));
 }
 
 int plugin_unregister_flush (const char *name)
@@ -1664,15 +5715,23 @@ int plugin_unregister_shutdown (const char *name)
 	return (plugin_unregister (list_shutdown, name));
 }
 
+int plugin_unregister_memory (const char *name)
+{
+	return (plugin_unregister (list_memory, name));
+}
+
 int plugin_unregister_data_set (const char *name)
 {
 	data_set_t *ds;
+	int status;
+
+	status = types_list_remove (name);
 
 	if (data_sets == NULL)
-		return (-1);
+		return (status);
 
-	if (c_avl_remove (data_sets, name, NULL, (void *) &ds) != 0)
-		return (-1);
+	if (c_btree_remove (data_sets, name, NULL, (void *) &ds) != 0)
+		return (status);
 
 	sfree (ds->ds);
 	sfree (ds);
@@ -1690,23 +5749,272 @@ int plugin_unregister_notification (const char *name)
 	return (plugin_unregister (list_notification, name));
 }
 
+static int plugin_init_callback (callback_func_t *cf) /* {{{ */
+{
+	plugin_init_cb callback;
+	plugin_ctx_t old_ctx;
+	cdtime_t start;
+	int status;
+
+	old_ctx = plugin_set_ctx (cf->cf_ctx);
+	callback = cf->cf_callback;
+
+	start = plugin_callback_start ();
+	status = (*callback) ();
+	plugin_callback_done (cf, start);
+
+	plugin_set_ctx (old_ctx);
+	return (status);
+} /* }}} int plugin_init_callback */
+
+/* Runs init callbacks of the current round until none are left. */
+static void *plugin_init_thread (void __attribute__((unused)) *args) /* {{{ */
+{
+	pthread_mutex_lock (&init_lock);
+	while (init_jobs_next < init_jobs_num)
+	{
+		init_job_t *job = &init_jobs[init_jobs_next];
+		cdtime_t end;
+		int status;
+
+		init_jobs_next++;
+		job->start = cdtime ();
+		pthread_mutex_unlock (&init_lock);
+
+		status = plugin_init_callback (job->le->value);
+		end = cdtime ();
+
+		pthread_mutex_lock (&init_lock);
+		job->status = status;
+		job->duration = (end > job->start) ? (end - job->start) : 0;
+		job->done = 1;
+		init_jobs_done++;
+		pthread_cond_broadcast (&init_cond);
+	}
+	pthread_mutex_unlock (&init_lock);
+
+	return ((void *) 0);
+} /* }}} void *plugin_init_thread */
+
+/* Waits for the init threads to finish all callbacks of the current round,
+ * warning about each callback still running after "timeout". The caller must
+ * hold "init_lock". */
+static void plugin_init_wait (cdtime_t timeout) /* {{{ */
+{
+	while (init_jobs_done < init_jobs_num)
+	{
+		cdtime_t deadline = 0;
+		cdtime_t now;
+		size_t i;
+
+		for (i = 0; (timeout > 0) && (i < init_jobs_next); i++)
+		{
+			init_job_t *job = &init_jobs[i];
+
+			if (job->done || job->warned)
+				continue;
+			if ((deadline == 0) || (job->start + timeout < deadline))
+				deadline = job->start + timeout;
+		}
+
+		if (deadline == 0)
+		{
+			pthread_cond_wait (&init_cond, &init_lock);
+			continue;
+		}
+		else
+		{
+			struct timespec ts = { 0 };
+
+			CDTIME_T_TO_TIMESPEC (deadline, &ts);
+			pthread_cond_timedwait (&init_cond, &init_lock, &ts);
+		}
+
+		now = cdtime ();
+		for (i = 0; i < init_jobs_next; i++)
+		{
+			init_job_t *job = &init_jobs[i];
+
+			if (job->done || job->warned
+					|| (job->start + timeout > now))
+				continue;
+
+			WARNING ("plugin_init_all: The init callback of `%s' "
+					"is still running after %.3f seconds.",
+					job->le->key, CDTIME_T_TO_DOUBLE (now - job->start));
+			job->warned = 1;
+		}
+	}
+} /* }}} void plugin_init_wait */
+
+/* Calls the init callbacks from "first" to the end of "list_init", on up to
+ * "threads_num" threads. Returns the last entry that was handled; callbacks
+ * registered by the init callbacks are appended after it. */
+static llentry_t *plugin_init_round (llentry_t *first, /* {{{ */
+		size_t threads_num, cdtime_t timeout)
+{
+	pthread_t *threads = NULL;
+	size_t threads_started = 0;
+	llentry_t *le;
+	size_t jobs_num = 0;
+	size_t i;
+
+	for (le = first; le != NULL; le = le->next)
+		jobs_num++;
+
+	pthread_mutex_lock (&init_lock);
+	init_jobs = calloc (jobs_num, sizeof (*init_jobs));
+	if (init_jobs == NULL)
+	{
+		pthread_mutex_unlock (&init_lock);
+		ERROR ("plugin_init_all: calloc failed.");
+		return (NULL);
+	}
+	for (le = first, i = 0; i < jobs_num; le = le->next, i++)
+		init_jobs[i].le = le;
+	init_jobs_num = jobs_num;
+	init_jobs_next = 0;
+	init_jobs_done = 0;
+	pthread_mutex_unlock (&init_lock);
+
+	if (threads_num > jobs_num)
+		threads_num = jobs_num;
+	if (threads_num > 1)
+		threads = calloc (threads_num, sizeof (*threads));
+
+	for (i = 0; (threads != NULL) && (i < threads_num); i++)
+	{
+		if (pthread_create (&threads[i], NULL,
+					plugin_init_thread, NULL) != 0)
+		{
+			ERROR ("plugin_init_all: pthread_create failed.");
+			break;
+		}
+		threads_started++;
+	}
+
+	/* Without threads, the callbacks are run right here, one after the
+	 * other. */
+	if (threads_started == 0)
+		plugin_init_thread (NULL);
+
+	pthread_mutex_lock (&init_lock);
+	plugin_init_wait (timeout);
+	pthread_mutex_unlock (&init_lock);
+
+	for (i = 0; i < threads_started; i++)
+		pthread_join (threads[i], NULL);
+	sfree (threads);
+
+	/* Handle the results in the order the callbacks were registered in. */
+	for (i = 0; i < init_jobs_num; i++)
+	{
+		init_job_t *job = &init_jobs[i];
+
+		DEBUG ("plugin_init_all: Initialization of `%s' took %.3f "
+				"seconds.", job->le->key,
+				CDTIME_T_TO_DOUBLE (job->duration));
+
+		if ((timeout > 0) && !job->warned && (job->duration > timeout))
+			WARNING ("plugin_init_all: The init callback of `%s' "
+					"took %.3f seconds.", job->le->key,
+					CDTIME_T_TO_DOUBLE (job->duration));
+
+		if (job->status != 0)
+		{
+			ERROR ("Initialization of plugin `%s' "
+					"failed with status %i. "
+					"Plugin will be unloaded.",
+					job->le->key, job->status);
+			/* Plugins that register read callbacks from the init
+			 * callback should take care of appropriate error
+			 * handling themselves. */
+			/* FIXME: Unload _all_ functions */
+			plugin_unregister_read (job->le->key);
+		}
+	}
+
+	le = init_jobs[init_jobs_num - 1].le;
+
+	pthread_mutex_lock (&init_lock);
+	sfree (init_jobs);
+	init_jobs_num = 0;
+	init_jobs_next = 0;
+	init_jobs_done = 0;
+	pthread_mutex_unlock (&init_lock);
+
+	return (le);
+} /* }}} llentry_t *plugin_init_round */
+
+void plugin_reload_chains (void) /* {{{ */
+{
+	const char *chain_name;
+
+	chain_name = global_option_get ("PreCacheChain");
+	pre_cache_chain = fc_chain_get_by_name (chain_name);
+
+	chain_name = global_option_get ("PostCacheChain");
+	post_cache_chain = fc_chain_get_by_name (chain_name);
+} /* }}} void plugin_reload_chains */
+
 void plugin_init_all (void)
 {
-	char const *chain_name;
+	char const *cache_file;
+	char const *delay_warning;
 	llentry_t *le;
+	long batch_size;
+	long series_limit_size;
+	long memory_limit;
+	long init_threads;
+	long log_queue_length;
+	cdtime_t init_timeout;
+	cdtime_t init_start;
 	int status;
 
 	/* Init the value cache */
+	uc_set_history_compression (IS_TRUE (global_option_get ("CompressHistory")));
 	uc_init ();
 
-	if (IS_TRUE (global_option_get ("CollectInternalStats")))
-		record_statistics = 1;
+	/* Open the shared memory table before restoring the cache, so that the
+	 * restored entries are published, too. */
+	cache_file = global_option_get ("CacheSharedMemory");
+	if ((cache_file != NULL) && (cache_file[0] != 0))
+		uc_shm_open (cache_file, (size_t) global_option_get_long_in_range (
+					"CacheSharedMemorySlots", UC_SHM_SLOTS_DEFAULT,
+					1, 16777216));
+
+	cache_file = global_option_get ("CacheFile");
+	if ((cache_file != NULL) && (cache_file[0] != 0))
+		uc_restore (cache_file);
+
+	if (IS_TRUE (global_option_get ("CollectInternalStats")))
+		record_statistics = 1;
+
+	delay_warning = global_option_get ("WriteDelayWarning");
+	if (delay_warning != NULL)
+	{
+		write_delay_warning = atof (delay_warning);
+		if (write_delay_warning < 0.0)
+		{
+			WARNING ("plugin_init_all: WriteDelayWarning must not be "
+					"negative. Disabling it.");
+			write_delay_warning = 0.0;
+		}
+	}
+
+	/* Callbacks registered from module_register() have already been
+	 * scheduled; move them to their phase, too. */
+	if (IS_TRUE (global_option_get ("ReadPhaseSpread")))
+	{
+		read_phase_spread = 1;
+		plugin_read_phase_all ();
+	}
 
-	chain_name = global_option_get ("PreCacheChain");
-	pre_cache_chain = fc_chain_get_by_name (chain_name);
+	if (IS_TRUE (global_option_get ("ReadBackoff")))
+		read_backoff = 1;
 
-	chain_name = global_option_get ("PostCacheChain");
-	post_cache_chain = fc_chain_get_by_name (chain_name);
+	fc_init ();
+	plugin_reload_chains ();
 
 	write_limit_high = global_option_get_long ("WriteQueueLimitHigh",
 			/* default = */ 0);
@@ -1730,48 +6038,99 @@ void plugin_init_all (void)
 		write_limit_low = write_limit_high;
 	}
 
-	write_threads_num = global_option_get_long ("WriteThreads",
-			/* default = */ 5);
-	if (write_threads_num < 1)
+	series_limit_size = global_option_get_long ("SeriesLimit",
+			/* default = */ 0);
+	if (series_limit_size < 0)
 	{
-		ERROR ("WriteThreads must be positive.");
-		write_threads_num = 5;
+		ERROR ("SeriesLimit must be positive or zero.");
+		series_limit_size = 0;
+	}
+	memory_limit = global_option_get_long ("PluginMemoryLimit",
+			/* default = */ 0);
+	if (memory_limit < 0)
+	{
+		ERROR ("PluginMemoryLimit must be positive or zero.");
+		memory_limit = 0;
+	}
+	plugin_memory_limit = (size_t) memory_limit;
+
+	/* The memory limit freezes plugins by means of the series limit, which
+	 * then only tracks the series if "SeriesLimit" isn't set. */
+	if (((series_limit_size > 0) || (memory_limit > 0))
+			&& (series_limit == NULL))
+	{
+		series_limit = series_limit_create ((size_t) series_limit_size);
+		if (series_limit == NULL)
+			ERROR ("plugin_init_all: series_limit_create failed.");
 	}
 
+	/* One write queue shard is created for each write thread. */
+	status = plugin_write_queues_init ();
+	if (status != 0)
+		return;
+	write_threads_num = write_queues_num;
+	write_queue_by_identifier =
+		IS_TRUE (global_option_get ("WriteQueueByIdentifier"));
+
+	batch_size = global_option_get_long ("WriteBatchSize",
+			/* default = */ 64);
+	if (batch_size < 1)
+	{
+		ERROR ("WriteBatchSize must be positive.");
+		batch_size = 64;
+	}
+	write_batch_size = (size_t) batch_size;
+
+	log_queue_length = global_option_get_long ("LogQueueLength",
+			/* default = */ 0);
+	if (log_queue_length < 0)
+	{
+		ERROR ("LogQueueLength must be positive or zero.");
+		log_queue_length = 0;
+	}
+	if ((log_queue_length > 0) && (list_log != NULL))
+		start_log_thread ((size_t) log_queue_length);
+
+	notification_queue_length = global_option_get_long (
+			"NotificationQueueLength", /* default = */ 0);
+	if (notification_queue_length < 0)
+	{
+		ERROR ("NotificationQueueLength must be positive or zero.");
+		notification_queue_length = 0;
+	}
+	plugin_notification_queues_start ();
+
 	if ((list_init == NULL) && (read_heap == NULL))
 		return;
 
+	init_threads = global_option_get_long ("InitThreads",
+			/* default = */ 1);
+	if (init_threads < 1)
+	{
+		ERROR ("InitThreads must be positive.");
+		init_threads = 1;
+	}
+	init_timeout = global_option_get_time ("InitTimeout",
+			/* default = */ TIME_T_TO_CDTIME_T (60));
+
 	/* Calling all init callbacks before checking if read callbacks
 	 * are available allows the init callbacks to register the read
-	 * callback. */
+	 * callback. Init callbacks registered by init callbacks are called
+	 * in another round. */
+	init_start = cdtime ();
 	le = llist_head (list_init);
 	while (le != NULL)
 	{
-		callback_func_t *cf;
-		plugin_init_cb callback;
-		plugin_ctx_t old_ctx;
-
-		cf = le->value;
-		old_ctx = plugin_set_ctx (cf->cf_ctx);
-		callback = cf->cf_callback;
-		status = (*callback) ();
-		plugin_set_ctx (old_ctx);
-
-		if (status != 0)
-		{
-			ERROR ("Initialization of plugin `%s' "
-					"failed with status %i. "
-					"Plugin will be unloaded.",
-					le->key, status);
-			/* Plugins that register read callbacks from the init
-			 * callback should take care of appropriate error
-			 * handling themselves. */
-			/* FIXME: Unload _all_ functions */
-			plugin_unregister_read (le->key);
-		}
+		llentry_t *last;
 
-		le = le->next;
+		last = plugin_init_round (le, (size_t) init_threads,
+				init_timeout);
+		if (last == NULL)
+			break;
+		le = last->next;
 	}
+	INFO ("plugin_init_all: Initialized plugins in %.3f seconds.",
+			CDTIME_T_TO_DOUBLE (cdtime () - init_start));
 
 	start_write_threads ((size_t) write_threads_num);
 
@@ -1794,9 +6153,21 @@ void plugin_init_all (void)
 /* TODO: Rename this function. */
 void plugin_read_all (void)
 {
+	plugin_ctx_t ctx = plugin_get_ctx ();
+	plugin_ctx_t old_ctx;
+
+	/* collectd's own metrics are needed most when the daemon is
+	 * overloaded. */
+	ctx.dispatch_priority = PLUGIN_READ_PRIORITY_HIGH;
+	old_ctx = plugin_set_ctx (ctx);
+
 	if(record_statistics) {
 		plugin_update_internal_statistics ();
 	}
+	if (record_statistics || (plugin_memory_limit > 0))
+		plugin_memory_update ();
+
+	plugin_set_ctx (old_ctx);
 	uc_check_timeout ();
 
 	return;
@@ -1819,12 +6190,13 @@ int plugin_read_all_once (void)
 		read_func_t *rf;
 		plugin_ctx_t old_ctx;
 
-		rf = c_heap_get_root (read_heap);
+		rf = c_iheap_get_root (read_heap, NULL);
 		if (rf == NULL)
 			break;
 
 		old_ctx = plugin_set_ctx (rf->rf_ctx);
 
+		PROBE1 (read_begin, rf->rf_name);
 		if (rf->rf_type == RF_SIMPLE)
 		{
 			int (*callback) (void);
@@ -1839,6 +6211,7 @@ int plugin_read_all_once (void)
 			callback = rf->rf_callback;
 			status = (*callback) (&rf->rf_udata);
 		}
+		PROBE2 (read_end, rf->rf_name, status);
 
 		plugin_set_ctx (old_ctx);
 
@@ -1853,127 +6226,623 @@ int plugin_read_all_once (void)
 		destroy_callback ((void *) rf);
 	}
 
-	return (return_status);
-} /* int plugin_read_all_once */
+	return (return_status);
+} /* int plugin_read_all_once */
+
+/* Passes ds/vl to the writer "cf": to its queue, if it has one, or to the
+ * writer itself. "vl_copy" is shared by the batch writers of one
+ * plugin_write() call, see plugin_write_batch_call(). */
+static int plugin_writer_deliver (callback_func_t *cf, _Bool batch, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl,
+		value_list_t **vl_copy)
+{
+	if (cf->cf_queue != NULL)
+		return (plugin_writer_queue_enqueue (cf, ds, vl));
+	if (batch)
+		return (plugin_write_batch_call (cf, ds, vl, vl_copy));
+	return (plugin_writer_call (cf, /* batch = */ 0, ds, vl));
+} /* }}} int plugin_writer_deliver */
+
+struct writer_rollup_arg_s
+{
+	callback_func_t *cf;
+	_Bool batch;
+	const value_list_t *vl;
+	value_list_t **vl_copy;
+};
+typedef struct writer_rollup_arg_s writer_rollup_arg_t;
+
+static int plugin_writer_rollup_emit (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl, void *arg)
+{
+	writer_rollup_arg_t *a = arg;
+	value_list_t *vl_copy = NULL;
+
+	/* Value lists passed through unchanged may share the caller's copy. */
+	if (vl == a->vl)
+		return (plugin_writer_deliver (a->cf, a->batch, ds, vl,
+					a->vl_copy));
+	return (plugin_writer_deliver (a->cf, a->batch, ds, vl, &vl_copy));
+} /* }}} int plugin_writer_rollup_emit */
+
+/* Like plugin_writer_deliver(), but reduces the values to the writer's
+ * resolution first. */
+static int plugin_writer_dispatch (callback_func_t *cf, _Bool batch, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl,
+		value_list_t **vl_copy)
+{
+	writer_rollup_arg_t arg = { cf, batch, vl, vl_copy };
+
+	/* The rollup keeps "ds" around; data sets not owned by the daemon, e.g.
+	 * ones created by the perl plugin on the stack, are passed through. */
+	if ((cf->cf_rollup == NULL) || (plugin_get_ds (vl->type) != ds))
+		return (plugin_writer_deliver (cf, batch, ds, vl, vl_copy));
+
+	return (rollup_add (cf->cf_rollup, ds, vl,
+				plugin_writer_rollup_emit, &arg));
+} /* }}} int plugin_writer_dispatch */
+
+/* Looks up the write callback of "plugin". The name is matched
+ * case-insensitively, so the exact match from the list's index is only tried
+ * first. */
+static llentry_t *plugin_search_write (llist_t *list, /* {{{ */
+    const char *plugin)
+{
+  llentry_t *le;
+
+  le = llist_search (list, plugin);
+  if (le != NULL)
+    return (le);
+
+  for (le = llist_head (list); le != NULL; le = le->next)
+    if (strcasecmp (plugin, le->key) == 0)
+      break;
+
+  return (le);
+} /* }}} llentry_t *plugin_search_write */
+
+int plugin_write (const char *plugin, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+  llentry_t *le;
+  int status;
+
+  if (vl == NULL)
+    return (EINVAL);
+
+  if ((list_write == NULL) && (list_write_batch == NULL))
+    return (ENOENT);
+
+  if (ds == NULL)
+  {
+    ds = plugin_get_ds (vl->type);
+    if (ds == NULL)
+    {
+      ERROR ("plugin_write: Unable to lookup type `%s'.", vl->type);
+      return (ENOENT);
+    }
+  }
+
+  if (plugin == NULL)
+  {
+    value_list_t *vl_copy = NULL;
+    int success = 0;
+    int failure = 0;
+
+    le = llist_head (list_write);
+    while (le != NULL)
+    {
+      callback_func_t *cf = le->value;
+
+      /* do not switch plugin context; rather keep the context (interval)
+       * information of the calling read plugin */
+
+      DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
+      status = plugin_writer_dispatch (cf, /* batch = */ 0, ds, vl,
+          &vl_copy);
+      if (status != 0)
+        failure++;
+      else
+        success++;
+
+      le = le->next;
+    }
+
+    le = llist_head (list_write_batch);
+    while (le != NULL)
+    {
+      callback_func_t *cf = le->value;
+
+      DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
+      status = plugin_writer_dispatch (cf, /* batch = */ 1, ds, vl,
+          &vl_copy);
+      if (status != 0)
+        failure++;
+      else
+        success++;
+
+      le = le->next;
+    }
+
+    if ((success == 0) && (failure != 0))
+      status = -1;
+    else
+      status = 0;
+  }
+  else /* plugin != NULL */
+  {
+    callback_func_t *cf;
+
+    le = plugin_search_write (list_write, plugin);
+    if (le == NULL)
+    {
+      value_list_t *vl_copy = NULL;
+
+      le = plugin_search_write (list_write_batch, plugin);
+      if (le == NULL)
+        return (ENOENT);
+
+      cf = le->value;
+      DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
+      return (plugin_writer_dispatch (cf, /* batch = */ 1, ds, vl,
+            &vl_copy));
+    }
+
+    cf = le->value;
+
+    /* do not switch plugin context; rather keep the context (interval)
+     * information of the calling read plugin */
+
+    DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
+    status = plugin_writer_dispatch (cf, /* batch = */ 0, ds, vl,
+        /* vl_copy = */ NULL);
+  }
+
+  return (status);
+} /* }}} int plugin_write */
+
+static int plugin_flush_callback (callback_func_t *cf, /* {{{ */
+    cdtime_t timeout, const char *identifier)
+{
+  plugin_flush_cb callback;
+  plugin_ctx_t old_ctx;
+  cdtime_t start;
+  int status;
+
+  old_ctx = plugin_set_ctx (cf->cf_ctx);
+  callback = cf->cf_callback;
+
+  start = plugin_callback_start ();
+  status = (*callback) (timeout, identifier, &cf->cf_udata);
+  plugin_callback_done (cf, start);
+
+  plugin_set_ctx (old_ctx);
+  return (status);
+} /* }}} int plugin_flush_callback */
+
+/* Serializes the requests' counters and the creation of flush queues. Waiters
+ * are woken up with "flush_cond" whenever a flush returns. */
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  flush_cond = PTHREAD_COND_INITIALIZER;
+
+static void plugin_flush_request_unref ( /* {{{ */
+    plugin_flush_request_t *req)
+{
+  _Bool last;
+
+  pthread_mutex_lock (&flush_lock);
+  req->refs--;
+  last = (req->refs == 0);
+  pthread_mutex_unlock (&flush_lock);
+
+  if (last)
+    sfree (req);
+} /* }}} void plugin_flush_request_unref */
+
+/* Accounts one returned or skipped flush of "req", or the creator's share if
+ * "status" is less than zero, and calls the "done" callback if it was the
+ * last one. Doesn't release the caller's reference. */
+static void plugin_flush_request_finish ( /* {{{ */
+    plugin_flush_request_t *req, int status)
+{
+  _Bool finished;
+  int success;
+  int error;
+
+  pthread_mutex_lock (&flush_lock);
+  if (status == 0)
+    req->success++;
+  else if (status > 0)
+    req->error++;
+  req->pending--;
+  finished = (req->pending == 0);
+  success = req->success;
+  error = req->error;
+  pthread_cond_broadcast (&flush_cond);
+  pthread_mutex_unlock (&flush_lock);
+
+  if (finished && (req->done != NULL))
+    (*req->done) (success, error, req->arg);
+} /* }}} void plugin_flush_request_finish */
+
+static void plugin_flush_queue_entry_free ( /* {{{ */
+    flush_queue_entry_t *e)
+{
+  if (e == NULL)
+    return;
+
+  sfree (e->identifier);
+  sfree (e->requests);
+  sfree (e);
+} /* }}} void plugin_flush_queue_entry_free */
+
+/* Answers all requests of "e" with "status" and frees it. */
+static void plugin_flush_queue_entry_finish ( /* {{{ */
+    flush_queue_entry_t *e, int status)
+{
+  size_t i;
+
+  for (i = 0; i < e->requests_num; i++)
+  {
+    plugin_flush_request_finish (e->requests[i], status);
+    plugin_flush_request_unref (e->requests[i]);
+  }
+  plugin_flush_queue_entry_free (e);
+} /* }}} void plugin_flush_queue_entry_finish */
+
+/* Returns true if the deadlines of all requests of "e" have passed. */
+static _Bool plugin_flush_queue_entry_expired ( /* {{{ */
+    flush_queue_entry_t const *e, cdtime_t now)
+{
+  size_t i;
+
+  for (i = 0; i < e->requests_num; i++)
+    if ((e->requests[i]->deadline == 0) || (e->requests[i]->deadline > now))
+      return (0);
+
+  return (1);
+} /* }}} _Bool plugin_flush_queue_entry_expired */
+
+static void *plugin_flush_queue_thread (void *args) /* {{{ */
+{
+  flush_queue_t *fq = args;
+
+  pthread_mutex_lock (&fq->lock);
+  while (42)
+  {
+    flush_queue_entry_t *e;
+    _Bool expired;
+    int status;
+
+    while (fq->loop && (fq->head == NULL))
+      pthread_cond_wait (&fq->cond, &fq->lock);
+
+    /* Flushes still queued are cancelled by plugin_flush_queue_destroy(). */
+    if (!fq->loop)
+      break;
+
+    e = fq->head;
+    fq->head = e->next;
+    if (fq->head == NULL)
+      fq->tail = NULL;
+    fq->length--;
+
+    expired = plugin_flush_queue_entry_expired (e, cdtime ());
+    if (expired)
+      fq->expired++;
+    pthread_mutex_unlock (&fq->lock);
+
+    if (expired)
+      status = ETIMEDOUT;
+    else
+      status = plugin_flush_callback (fq->cf, e->timeout, e->identifier);
+    if (status < 0)
+      status = -status;
+
+    plugin_flush_queue_entry_finish (e, status);
+
+    pthread_mutex_lock (&fq->lock);
+  }
+  pthread_mutex_unlock (&fq->lock);
+
+  return ((void *) 0);
+} /* }}} void *plugin_flush_queue_thread */
+
+/* Returns the queue of the flush callback "cf", creating it and starting its
+ * thread on first use. Returns NULL if the thread could not be started. */
+static flush_queue_t *plugin_flush_queue_get (const char *name, /* {{{ */
+    callback_func_t *cf)
+{
+  flush_queue_t *fq;
+  int status;
+
+  pthread_mutex_lock (&flush_lock);
+  if (cf->cf_flush_queue != NULL)
+  {
+    fq = cf->cf_flush_queue;
+    pthread_mutex_unlock (&flush_lock);
+    return (fq);
+  }
+
+  fq = calloc (1, sizeof (*fq));
+  if (fq == NULL)
+  {
+    pthread_mutex_unlock (&flush_lock);
+    return (NULL);
+  }
+
+  fq->name = strdup (name);
+  if (fq->name == NULL)
+  {
+    pthread_mutex_unlock (&flush_lock);
+    sfree (fq);
+    return (NULL);
+  }
+  fq->cf = cf;
+
+  pthread_mutex_init (&fq->lock, /* attr = */ NULL);
+  pthread_cond_init (&fq->cond, /* attr = */ NULL);
+  fq->loop = 1;
+
+  status = pthread_create (&fq->thread, /* attr = */ NULL,
+      plugin_flush_queue_thread, /* arg = */ fq);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    pthread_mutex_unlock (&flush_lock);
+    ERROR ("plugin: plugin_flush_queue_get: "
+        "pthread_create failed with status %i (%s).",
+        status, sstrerror (status, errbuf, sizeof (errbuf)));
+    fq->loop = 0;
+    plugin_flush_queue_destroy (fq);
+    return (NULL);
+  }
+  fq->running = 1;
+
+  cf->cf_flush_queue = fq;
+  pthread_mutex_unlock (&flush_lock);
+
+  return (fq);
+} /* }}} flush_queue_t *plugin_flush_queue_get */
+
+/* Stops the queue's thread and cancels the flushes still queued. */
+static void plugin_flush_queue_destroy (flush_queue_t *fq) /* {{{ */
+{
+  flush_queue_entry_t *e;
+
+  if (fq == NULL)
+    return;
+
+  pthread_mutex_lock (&fq->lock);
+  fq->loop = 0;
+  pthread_cond_broadcast (&fq->cond);
+  pthread_mutex_unlock (&fq->lock);
+
+  if (fq->running && (pthread_join (fq->thread, NULL) != 0))
+    ERROR ("plugin: plugin_flush_queue_destroy: pthread_join failed.");
+  fq->running = 0;
+
+  while ((e = fq->head) != NULL)
+  {
+    fq->head = e->next;
+    plugin_flush_queue_entry_finish (e, ECANCELED);
+  }
+
+  pthread_mutex_destroy (&fq->lock);
+  pthread_cond_destroy (&fq->cond);
+  sfree (fq->name);
+  sfree (fq);
+} /* }}} void plugin_flush_queue_destroy */
+
+/* Queues a flush for "req", sharing the entry of an identical flush that
+ * hasn't started yet. */
+static int plugin_flush_queue_enqueue (flush_queue_t *fq, /* {{{ */
+    plugin_flush_request_t *req, cdtime_t timeout, const char *identifier)
+{
+  flush_queue_entry_t *e;
+  plugin_flush_request_t **tmp;
+
+  pthread_mutex_lock (&fq->lock);
+  if (!fq->loop)
+  {
+    pthread_mutex_unlock (&fq->lock);
+    return (ECANCELED);
+  }
+
+  for (e = fq->head; e != NULL; e = e->next)
+  {
+    if (e->timeout != timeout)
+      continue;
+    if ((e->identifier == NULL) != (identifier == NULL))
+      continue;
+    if ((identifier == NULL) || (strcmp (e->identifier, identifier) == 0))
+      break;
+  }
+
+  if (e == NULL)
+  {
+    e = calloc (1, sizeof (*e));
+    if (e == NULL)
+    {
+      pthread_mutex_unlock (&fq->lock);
+      return (ENOMEM);
+    }
+    e->timeout = timeout;
+    if ((identifier != NULL)
+        && ((e->identifier = strdup (identifier)) == NULL))
+    {
+      pthread_mutex_unlock (&fq->lock);
+      plugin_flush_queue_entry_free (e);
+      return (ENOMEM);
+    }
+
+    if (fq->tail == NULL)
+      fq->head = e;
+    else
+      fq->tail->next = e;
+    fq->tail = e;
+    fq->length++;
+  }
+  else
+  {
+    fq->coalesced++;
+  }
+
+  tmp = realloc (e->requests, (e->requests_num + 1) * sizeof (*tmp));
+  if (tmp == NULL)
+  {
+    /* A new entry stays queued without requests; the flush is harmless. */
+    pthread_mutex_unlock (&fq->lock);
+    return (ENOMEM);
+  }
+  e->requests = tmp;
+  e->requests[e->requests_num] = req;
+  e->requests_num++;
+
+  pthread_mutex_lock (&flush_lock);
+  req->pending++;
+  req->refs++;
+  pthread_mutex_unlock (&flush_lock);
+
+  pthread_cond_signal (&fq->cond);
+  pthread_mutex_unlock (&fq->lock);
+
+  return (0);
+} /* }}} int plugin_flush_queue_enqueue */
+
+plugin_flush_request_t *plugin_flush_request_create ( /* {{{ */
+    cdtime_t deadline, plugin_flush_done_cb done, void *arg)
+{
+  plugin_flush_request_t *req;
+
+  req = calloc (1, sizeof (*req));
+  if (req == NULL)
+    return (NULL);
+
+  req->pending = 1;
+  req->refs = 1;
+  req->deadline = deadline;
+  req->done = done;
+  req->arg = arg;
+
+  return (req);
+} /* }}} plugin_flush_request_t *plugin_flush_request_create */
+
+/* Queues the flush of one callback. If its thread can't be started, the
+ * callback is called right away. */
+static void plugin_flush_request_add_one ( /* {{{ */
+    plugin_flush_request_t *req, llentry_t *le,
+    cdtime_t timeout, const char *identifier)
+{
+  flush_queue_t *fq;
+  int status;
+
+  fq = plugin_flush_queue_get (le->key, le->value);
+  if ((fq != NULL)
+      && (plugin_flush_queue_enqueue (fq, req, timeout, identifier) == 0))
+    return;
 
-int plugin_write (const char *plugin, /* {{{ */
-		const data_set_t *ds, const value_list_t *vl)
+  status = plugin_flush_callback (le->value, timeout, identifier);
+
+  pthread_mutex_lock (&flush_lock);
+  if (status == 0)
+    req->success++;
+  else
+    req->error++;
+  pthread_mutex_unlock (&flush_lock);
+} /* }}} void plugin_flush_request_add_one */
+
+int plugin_flush_request_add (plugin_flush_request_t *req, /* {{{ */
+    const char *plugin, cdtime_t timeout, const char *identifier)
 {
   llentry_t *le;
-  int status;
 
-  if (vl == NULL)
+  if (req == NULL)
     return (EINVAL);
 
-  if (list_write == NULL)
-    return (ENOENT);
+  if (list_flush == NULL)
+    return (0);
 
-  if (ds == NULL)
+  /* Names are unique within the list, so there is at most one match. */
+  if (plugin != NULL)
   {
-    ds = plugin_get_ds (vl->type);
-    if (ds == NULL)
-    {
-      ERROR ("plugin_write: Unable to lookup type `%s'.", vl->type);
-      return (ENOENT);
-    }
+    le = llist_search (list_flush, plugin);
+    if (le != NULL)
+      plugin_flush_request_add_one (req, le, timeout, identifier);
+    return (0);
   }
 
-  if (plugin == NULL)
-  {
-    int success = 0;
-    int failure = 0;
+  for (le = llist_head (list_flush); le != NULL; le = le->next)
+    plugin_flush_request_add_one (req, le, timeout, identifier);
 
-    le = llist_head (list_write);
-    while (le != NULL)
-    {
-      callback_func_t *cf = le->value;
-      plugin_write_cb callback;
+  return (0);
+} /* }}} int plugin_flush_request_add */
 
-      /* do not switch plugin context; rather keep the context (interval)
-       * information of the calling read plugin */
+int plugin_flush_request_wait (plugin_flush_request_t *req, /* {{{ */
+    int *ret_success, int *ret_error)
+{
+  struct timespec ts;
+  int status = 0;
 
-      DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
-      callback = cf->cf_callback;
-      status = (*callback) (ds, vl, &cf->cf_udata);
-      if (status != 0)
-        failure++;
-      else
-        success++;
+  if (req == NULL)
+    return (EINVAL);
 
-      le = le->next;
-    }
+  plugin_flush_request_finish (req, /* status = */ -1);
 
-    if ((success == 0) && (failure != 0))
-      status = -1;
-    else
-      status = 0;
-  }
-  else /* plugin != NULL */
+  CDTIME_T_TO_TIMESPEC (req->deadline, &ts);
+  pthread_mutex_lock (&flush_lock);
+  while (req->pending > 0)
   {
-    callback_func_t *cf;
-    plugin_write_cb callback;
-
-    le = llist_head (list_write);
-    while (le != NULL)
-    {
-      if (strcasecmp (plugin, le->key) == 0)
-        break;
-
-      le = le->next;
-    }
-
-    if (le == NULL)
-      return (ENOENT);
+    if (req->deadline == 0)
+      pthread_cond_wait (&flush_cond, &flush_lock);
+    else if (pthread_cond_timedwait (&flush_cond, &flush_lock, &ts)
+        == ETIMEDOUT)
+      break;
+  }
 
-    cf = le->value;
+  if (req->pending > 0)
+    status = ETIMEDOUT;
+  if (ret_success != NULL)
+    *ret_success = req->success;
+  if (ret_error != NULL)
+    *ret_error = req->error + (int) req->pending;
+  pthread_mutex_unlock (&flush_lock);
 
-    /* do not switch plugin context; rather keep the context (interval)
-     * information of the calling read plugin */
+  plugin_flush_request_unref (req);
+  return (status);
+} /* }}} int plugin_flush_request_wait */
 
-    DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
-    callback = cf->cf_callback;
-    status = (*callback) (ds, vl, &cf->cf_udata);
-  }
+void plugin_flush_request_release (plugin_flush_request_t *req) /* {{{ */
+{
+  if (req == NULL)
+    return;
 
-  return (status);
-} /* }}} int plugin_write */
+  plugin_flush_request_finish (req, /* status = */ -1);
+  plugin_flush_request_unref (req);
+} /* }}} void plugin_flush_request_release */
 
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier)
 {
-  llentry_t *le;
+  plugin_flush_request_t *req;
 
   if (list_flush == NULL)
     return (0);
 
-  le = llist_head (list_flush);
-  while (le != NULL)
-  {
-    callback_func_t *cf;
-    plugin_flush_cb callback;
-    plugin_ctx_t old_ctx;
-
-    if ((plugin != NULL)
-        && (strcmp (plugin, le->key) != 0))
-    {
-      le = le->next;
-      continue;
-    }
-
-    cf = le->value;
-    old_ctx = plugin_set_ctx (cf->cf_ctx);
-    callback = cf->cf_callback;
-
-    (*callback) (timeout, identifier, &cf->cf_udata);
+  req = plugin_flush_request_create (/* deadline = */ 0,
+      /* done = */ NULL, /* arg = */ NULL);
+  if (req == NULL)
+    return (ENOMEM);
 
-    plugin_set_ctx (old_ctx);
+  plugin_flush_request_add (req, plugin, timeout, identifier);
+  plugin_flush_request_wait (req, /* ret_success = */ NULL,
+      /* ret_error = */ NULL);
 
-    le = le->next;
-  }
   return (0);
 } /* int plugin_flush */
 
 void plugin_shutdown_all (void)
 {
+	char const *cache_file;
 	llentry_t *le;
 
 	stop_read_threads ();
@@ -1991,6 +6860,11 @@ void plugin_shutdown_all (void)
 			/* timeout = */ 0,
 			/* identifier = */ NULL);
 
+	/* Deliver queued notifications while the callbacks still work. Later
+	 * notifications are passed to the callbacks directly. */
+	notification_queue_length = 0;
+	plugin_notification_queues_stop ();
+
 	le = NULL;
 	if (list_shutdown != NULL)
 		le = llist_head (list_shutdown);
@@ -2018,6 +6892,18 @@ void plugin_shutdown_all (void)
 
 	stop_write_threads ();
 
+	/* All values have been dispatched and are in the cache now. */
+	cache_file = global_option_get ("CacheFile");
+	if ((cache_file != NULL) && (cache_file[0] != 0))
+		uc_persist (cache_file);
+	uc_shm_close ();
+
+	/* The read and write threads have stopped, nothing dispatches values
+	 * anymore. */
+	series_limit_destroy (series_limit);
+	series_limit = NULL;
+	procfs_destroy ();
+
 	/* Write plugins which use the `user_data' pointer usually need the
 	 * same data available to the flush callback. If this is the case, set
 	 * the free_function to NULL when registering the flush callback and to
@@ -2026,9 +6912,13 @@ void plugin_shutdown_all (void)
 	destroy_all_callbacks (&list_flush);
 	destroy_all_callbacks (&list_missing);
 	destroy_all_callbacks (&list_write);
+	destroy_all_callbacks (&list_write_batch);
 
 	destroy_all_callbacks (&list_notification);
 	destroy_all_callbacks (&list_shutdown);
+	destroy_all_callbacks (&list_memory);
+
+	stop_log_thread ();
 	destroy_all_callbacks (&list_log);
 
 	plugin_free_loaded ();
@@ -2076,7 +6966,29 @@ int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
   return (0);
 } /* int }}} plugin_dispatch_missing */
 
-static int plugin_dispatch_values_internal (value_list_t *vl)
+/* Replaces slashes in the identifier of "vl", see escape_slashes(). Most
+ * identifiers don't contain any, so a field is only rewritten if it
+ * does. */
+static void plugin_value_list_escape (value_list_t *vl) /* {{{ */
+{
+	if (strchr (vl->host, '/') != NULL)
+		escape_slashes (vl->host, sizeof (vl->host));
+	if (strchr (vl->plugin, '/') != NULL)
+		escape_slashes (vl->plugin, sizeof (vl->plugin));
+	if (strchr (vl->plugin_instance, '/') != NULL)
+		escape_slashes (vl->plugin_instance, sizeof (vl->plugin_instance));
+	if (strchr (vl->type, '/') != NULL)
+		escape_slashes (vl->type, sizeof (vl->type));
+	if (strchr (vl->type_instance, '/') != NULL)
+		escape_slashes (vl->type_instance, sizeof (vl->type_instance));
+} /* }}} void plugin_value_list_escape */
+
+/* Dispatches "vl" to the cache and the write plugins. If "ds" is NULL, the
+ * data set is looked up by the type of "vl". If "cached" is true, the cache
+ * has already been updated by plugin_write_cache_batch_dispatch(), which
+ * only happens without a pre-cache chain. */
+static int plugin_dispatch_values_internal (const data_set_t *ds,
+		value_list_t *vl, _Bool cached)
 {
 	int status;
 	static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
@@ -2084,8 +6996,6 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	value_t *saved_values;
 	int      saved_values_len;
 
-	data_set_t *ds;
-
 	int free_meta_data = 0;
 
 	if ((vl == NULL) || (vl->type[0] == 0)
@@ -2102,29 +7012,33 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	if (vl->meta == NULL)
 		free_meta_data = 1;
 
-	if (list_write == NULL)
+	if ((list_write == NULL) && (list_write_batch == NULL))
 		c_complain_once (LOG_WARNING, &no_write_complaint,
 				"plugin_dispatch_values: No write callback has been "
 				"registered. Please load at least one output plugin, "
 				"if you want the collected data to be stored.");
 
-	if (data_sets == NULL)
+	if (ds == NULL)
 	{
-		ERROR ("plugin_dispatch_values: No data sets registered. "
-				"Could the types database be read? Check "
-				"your `TypesDB' setting!");
-		return (-1);
-	}
+		if (!plugin_have_data_sets ())
+		{
+			ERROR ("plugin_dispatch_values: No data sets registered. "
+					"Could the types database be read? Check "
+					"your `TypesDB' setting!");
+			return (-1);
+		}
 
-	if (c_avl_get (data_sets, vl->type, (void *) &ds) != 0)
-	{
-		char ident[6 * DATA_MAX_NAME_LEN];
+		ds = plugin_find_data_set (vl->type);
+		if (ds == NULL)
+		{
+			char ident[6 * DATA_MAX_NAME_LEN];
 
-		FORMAT_VL (ident, sizeof (ident), vl);
-		INFO ("plugin_dispatch_values: Dataset not found: %s "
-				"(from \"%s\"), check your types.db!",
-				vl->type, ident);
-		return (-1);
+			FORMAT_VL (ident, sizeof (ident), vl);
+			INFO ("plugin_dispatch_values: Dataset not found: %s "
+					"(from \"%s\"), check your types.db!",
+					vl->type, ident);
+			return (-1);
+		}
 	}
 
 	/* Assured by plugin_value_list_clone(). The time is determined at
@@ -2143,11 +7057,10 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 			vl->type, vl->type_instance);
 
 #if COLLECT_DEBUG
+	/* The data set has either been looked up by type or has been passed
+	 * to plugin_dispatch_values_ds(), so a mismatch is a programming
+	 * error. */
 	assert (0 == strcmp (ds->type, vl->type));
-#else
-	if (0 != strcmp (ds->type, vl->type))
-		WARNING ("plugin_dispatch_values: (ds->type = %s) != (vl->type = %s)",
-				ds->type, vl->type);
 #endif
 
 #if COLLECT_DEBUG
@@ -2163,11 +7076,7 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	}
 #endif
 
-	escape_slashes (vl->host, sizeof (vl->host));
-	escape_slashes (vl->plugin, sizeof (vl->plugin));
-	escape_slashes (vl->plugin_instance, sizeof (vl->plugin_instance));
-	escape_slashes (vl->type, sizeof (vl->type));
-	escape_slashes (vl->type_instance, sizeof (vl->type_instance));
+	plugin_value_list_escape (vl);
 
 	/* Copy the values. This way, we can assure `targets' that they get
 	 * dynamically allocated values, which they can free and replace if
@@ -2219,7 +7128,8 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	}
 
 	/* Update the value cache */
-	uc_update (ds, vl);
+	if (!cached)
+		uc_update (ds, vl);
 
 	if (post_cache_chain != NULL)
 	{
@@ -2235,6 +7145,8 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	else
 		fc_default_action (ds, vl);
 
+	uc_update_done (vl);
+
 	/* Restore the state of the value_list so that plugins don't get
 	 * confused.. */
 	if (saved_values != NULL)
@@ -2253,28 +7165,71 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	return (0);
 } /* int plugin_dispatch_values_internal */
 
-static double get_drop_probability (void) /* {{{ */
+/* Dispatches each value of an element queued by plugin_dispatch_values_vec()
+ * as a value list of its own, starting from the template each time. */
+static void plugin_dispatch_values_vec_internal (write_queue_t *q) /* {{{ */
+{
+	size_t i;
+
+	for (i = 0; i < q->vec->num; i++)
+	{
+		value_list_t vl;
+
+		memcpy (&vl, &q->vl, sizeof (vl));
+		vl.values = q->vec->values + i;
+		vl.values_len = 1;
+		sstrncpy (vl.type_instance, q->vec->type_instances[i],
+				sizeof (vl.type_instance));
+
+		/* Targets may modify the meta data. */
+		vl.meta = NULL;
+		if (q->vl.meta != NULL)
+		{
+			vl.meta = meta_data_clone (q->vl.meta);
+			if (vl.meta == NULL)
+			{
+				ERROR ("plugin_dispatch_values_vec: "
+						"meta_data_clone failed.");
+				continue;
+			}
+		}
+
+		plugin_dispatch_values_internal (q->ds, &vl, /* cached = */ 0);
+		meta_data_destroy (vl.meta);
+	}
+} /* }}} void plugin_dispatch_values_vec_internal */
+
+/* Returns the probability of dropping a value of "priority", one of the
+ * PLUGIN_READ_PRIORITY_* constants: between "WriteQueueLimitLow" and
+ * "WriteQueueLimitHigh", it increases linearly for normal priority values and
+ * twice as fast for low priority ones. High priority values are only dropped
+ * once the queue is full. */
+static double get_drop_probability (int priority) /* {{{ */
 {
 	long pos;
 	long size;
 	long wql;
 
-	pthread_mutex_lock (&write_lock);
-	wql = write_queue_length;
-	pthread_mutex_unlock (&write_lock);
+	wql = plugin_write_queue_length ();
 
-	if (wql < write_limit_low)
-		return (0.0);
 	if (wql >= write_limit_high)
 		return (1.0);
+	if ((wql < write_limit_low) || (priority == PLUGIN_READ_PRIORITY_HIGH))
+		return (0.0);
 
 	pos = 1 + wql - write_limit_low;
 	size = 1 + write_limit_high - write_limit_low;
+	if (priority == PLUGIN_READ_PRIORITY_LOW)
+	{
+		size = (size + 1) / 2;
+		if (pos >= size)
+			return (1.0);
+	}
 
 	return (((double) pos) / ((double) size));
 } /* }}} double get_drop_probability */
 
-static _Bool check_drop_value (void) /* {{{ */
+static _Bool check_drop_value (int priority) /* {{{ */
 {
 	static cdtime_t last_message_time = 0;
 	static pthread_mutex_t last_message_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -2286,7 +7241,7 @@ static _Bool check_drop_value (void) /* {{{ */
 	if (write_limit_high == 0)
 		return (0);
 
-	p = get_drop_probability ();
+	p = get_drop_probability (priority);
 	if (p == 0.0)
 		return (0);
 
@@ -2316,12 +7271,31 @@ static _Bool check_drop_value (void) /* {{{ */
 		return (0);
 } /* }}} _Bool check_drop_value */
 
-int plugin_dispatch_values (value_list_t const *vl)
+/* Returns true if "vl" exceeds the series limit of its plugin. */
+static _Bool check_series_limit (value_list_t const *vl) /* {{{ */
+{
+	cdtime_t interval;
+
+	if (series_limit == NULL)
+		return (0);
+
+	/* Forget series once the cache would have expired them. */
+	interval = (vl->interval > 0) ? vl->interval : plugin_get_interval ();
+	return (!series_limit_check (series_limit, vl,
+				(cdtime_t) timeout_g * interval, cdtime ()));
+} /* }}} _Bool check_series_limit */
+
+int plugin_dispatch_values_ds (const data_set_t *ds, /* {{{ */
+		value_list_t const *vl)
 {
 	int status;
-	static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	if (check_drop_value ()) {
+	/* Counted by the series limit itself. */
+	if (check_series_limit (vl))
+		return (0);
+
+	if (check_drop_value (plugin_get_ctx ().dispatch_priority)) {
+		PROBE2 (value_dropped, vl->plugin, vl->type);
 		if(record_statistics) {
 			pthread_mutex_lock(&statistics_lock);
 			stats_values_dropped++;
@@ -2330,7 +7304,7 @@ int plugin_dispatch_values (value_list_t const *vl)
 		return (0);
 	}
 
-	status = plugin_write_enqueue (vl);
+	status = plugin_write_enqueue (ds, vl, /* vec = */ NULL);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -2341,13 +7315,194 @@ int plugin_dispatch_values (value_list_t const *vl)
 	}
 
 	return (0);
+} /* }}} int plugin_dispatch_values_ds */
+
+int plugin_dispatch_values_bulk (const data_set_t *ds, /* {{{ */
+		value_list_t const *vl, size_t vl_num)
+{
+	value_list_t const **accepted;
+	size_t accepted_num = 0;
+	size_t dropped = 0;
+	size_t i;
+	int priority;
+	int status = 0;
+
+	if ((vl == NULL) || (vl_num == 0))
+		return (0);
+
+	priority = plugin_get_ctx ().dispatch_priority;
+
+	/* Value lists passing the series limit and the drop check are contiguous
+	 * most of the time, so they are enqueued in runs. */
+	accepted = malloc (vl_num * sizeof (*accepted));
+	if (accepted == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < vl_num; i++)
+	{
+		if (check_series_limit (vl + i))
+			continue;
+		if (check_drop_value (priority))
+		{
+			PROBE2 (value_dropped, vl[i].plugin, vl[i].type);
+			dropped++;
+			continue;
+		}
+		accepted[accepted_num++] = vl + i;
+	}
+
+	if ((dropped > 0) && record_statistics)
+	{
+		pthread_mutex_lock (&statistics_lock);
+		stats_values_dropped += (derive_t) dropped;
+		pthread_mutex_unlock (&statistics_lock);
+	}
+
+	i = 0;
+	while ((i < accepted_num) && (status == 0))
+	{
+		size_t run = 1;
+
+		while (((i + run) < accepted_num)
+				&& (accepted[i + run] == accepted[i] + run))
+			run++;
+
+		status = plugin_write_enqueue_bulk (ds, accepted[i], run);
+		i += run;
+	}
+	sfree (accepted);
+
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("plugin_dispatch_values_bulk: plugin_write_enqueue_bulk "
+				"failed with status %i (%s).", status,
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return (status);
+	}
+
+	return (0);
+} /* }}} int plugin_dispatch_values_bulk */
+
+int plugin_dispatch_values (value_list_t const *vl)
+{
+	return (plugin_dispatch_values_ds (/* ds = */ NULL, vl));
 }
 
+int plugin_dispatch_values_vec (const data_set_t *ds, /* {{{ */
+		value_list_t const *template,
+		plugin_value_vec_t const *values, size_t values_num)
+{
+	write_queue_vec_t *vec;
+	value_list_t vl;
+	_Bool *accepted;
+	size_t accepted_num = 0;
+	size_t names_size = 0;
+	size_t dropped = 0;
+	char *names;
+	size_t i;
+	int priority;
+	int status;
+
+	if ((template == NULL) || (template->values_len != 1)
+			|| ((values == NULL) && (values_num > 0)))
+		return (EINVAL);
+	if (values_num == 0)
+		return (0);
+
+	accepted = calloc (values_num, sizeof (*accepted));
+	if (accepted == NULL)
+		return (ENOMEM);
+
+	/* The series limit and the drop check apply to each value. */
+	priority = plugin_get_ctx ().dispatch_priority;
+	memcpy (&vl, template, sizeof (vl));
+	for (i = 0; i < values_num; i++)
+	{
+		sstrncpy (vl.type_instance, values[i].type_instance,
+				sizeof (vl.type_instance));
+		if (check_series_limit (&vl))
+			continue;
+		if (check_drop_value (priority))
+		{
+			PROBE2 (value_dropped, vl.plugin, vl.type);
+			dropped++;
+			continue;
+		}
+
+		accepted[i] = 1;
+		accepted_num++;
+		names_size += strlen (vl.type_instance) + 1;
+	}
+
+	if ((dropped > 0) && record_statistics)
+	{
+		pthread_mutex_lock (&statistics_lock);
+		stats_values_dropped += (derive_t) dropped;
+		pthread_mutex_unlock (&statistics_lock);
+	}
+
+	if (accepted_num == 0)
+	{
+		sfree (accepted);
+		return (0);
+	}
+
+	vec = malloc (sizeof (*vec)
+			+ accepted_num * (sizeof (*vec->values)
+				+ sizeof (*vec->type_instances))
+			+ names_size);
+	if (vec == NULL)
+	{
+		sfree (accepted);
+		return (ENOMEM);
+	}
+	vec->num = 0;
+	vec->values = (value_t *) (vec + 1);
+	vec->type_instances = (char **) (vec->values + accepted_num);
+	names = (char *) (vec->type_instances + accepted_num);
+
+	for (i = 0; i < values_num; i++)
+	{
+		size_t len;
+
+		if (!accepted[i])
+			continue;
+
+		sstrncpy (vl.type_instance, values[i].type_instance,
+				sizeof (vl.type_instance));
+		len = strlen (vl.type_instance) + 1;
+		memcpy (names, vl.type_instance, len);
+
+		vec->values[vec->num] = values[i].value;
+		vec->type_instances[vec->num] = names;
+		vec->num++;
+		names += len;
+	}
+	sfree (accepted);
+
+	status = plugin_write_enqueue (ds, template, vec);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("plugin_dispatch_values_vec: plugin_write_enqueue failed "
+				"with status %i (%s).", status,
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return (status);
+	}
+
+	return (0);
+} /* }}} int plugin_dispatch_values_vec */
+
 __attribute__((sentinel))
 int plugin_dispatch_multivalue (value_list_t const *template, /* {{{ */
 		_Bool store_percentage, int store_type, ...)
 {
-	value_list_t *vl;
+	value_list_t vl;
+	const data_set_t *ds;
+	plugin_value_vec_t *values = NULL;
+	size_t values_num = 0;
+	size_t values_size = 0;
 	int failed = 0;
 	gauge_t sum = 0.0;
 	va_list ap;
@@ -2374,53 +7529,77 @@ int plugin_dispatch_multivalue (value_list_t const *template, /* {{{ */
 	}
 
 
-	vl = plugin_value_list_clone (template);
-	/* plugin_value_list_clone makes sure vl->time is set to non-zero. */
+	memcpy (&vl, template, sizeof (vl));
 	if (store_percentage)
-		sstrncpy (vl->type, "percent", sizeof (vl->type));
+		sstrncpy (vl.type, "percent", sizeof (vl.type));
+
+	/* All values share the same type, so it is only looked up once. If it
+	 * isn't found, the lookup is repeated (and reported) when the value
+	 * is dispatched. */
+	ds = plugin_have_data_sets () ? plugin_get_ds (vl.type) : NULL;
 
 	va_start (ap, store_type);
 	while (42)
 	{
+		plugin_value_vec_t *v;
 		char const *name;
-		int status;
 
-		/* Set the type instance. */
 		name = va_arg (ap, char const *);
 		if (name == NULL)
 			break;
-		sstrncpy (vl->type_instance, name, sizeof (vl->type_instance));
+
+		if (values_num >= values_size)
+		{
+			size_t new_size = (values_size > 0) ? 2 * values_size : 8;
+			plugin_value_vec_t *tmp;
+
+			tmp = realloc (values, new_size * sizeof (*values));
+			if (tmp == NULL)
+			{
+				ERROR ("plugin_dispatch_multivalue: realloc failed.");
+				sfree (values);
+				va_end (ap);
+				return (-1);
+			}
+			values = tmp;
+			values_size = new_size;
+		}
+		v = values + values_num;
+		v->type_instance = name;
 
 		/* Set the value. */
 		switch (store_type)
 		{
 		case DS_TYPE_GAUGE:
-			vl->values[0].gauge = va_arg (ap, gauge_t);
+			v->value.gauge = va_arg (ap, gauge_t);
 			if (store_percentage)
-				vl->values[0].gauge *= sum ? (100.0 / sum) : 0;
+				v->value.gauge *= sum ? (100.0 / sum) : 0;
 			break;
 		case DS_TYPE_ABSOLUTE:
-			vl->values[0].absolute = va_arg (ap, absolute_t);
+			v->value.absolute = va_arg (ap, absolute_t);
 			break;
 		case DS_TYPE_COUNTER:
-			vl->values[0].counter  = va_arg (ap, counter_t);
+			v->value.counter  = va_arg (ap, counter_t);
 			break;
 		case DS_TYPE_DERIVE:
-			vl->values[0].derive   = va_arg (ap, derive_t);
+			v->value.derive   = va_arg (ap, derive_t);
 			break;
 		default:
 			ERROR ("plugin_dispatch_multivalue: given store_type is incorrect.");
 			failed++;
+			continue;
 		}
 
-
-		status = plugin_write_enqueue (vl);
-		if (status != 0)
-			failed++;
+		values_num++;
 	}
 	va_end (ap);
 
-	plugin_value_list_free (vl);
+	/* All values are queued at once, which also gives them the same time
+	 * stamp. */
+	if (plugin_dispatch_values_vec (ds, &vl, values, values_num) != 0)
+		failed += (int) values_num;
+
+	sfree (values);
 	return (failed);
 } /* }}} int plugin_dispatch_multivalue */
 
@@ -2443,14 +7622,25 @@ int plugin_dispatch_notification (const notification_t *notif)
 	{
 		callback_func_t *cf;
 		plugin_notification_cb callback;
+		cdtime_t start;
 		int status;
 
 		/* do not switch plugin context; rather keep the context
 		 * (interval) information of the calling plugin */
 
 		cf = le->value;
+		if ((cf->cf_notification_queue != NULL)
+				&& (plugin_notification_queue_enqueue (
+						cf->cf_notification_queue, notif) == 0))
+		{
+			le = le->next;
+			continue;
+		}
+
 		callback = cf->cf_callback;
+		start = plugin_callback_start ();
 		status = (*callback) (notif, &cf->cf_udata);
+		plugin_callback_done (cf, start);
 		if (status != 0)
 		{
 			WARNING ("plugin_dispatch_notification: Notification "
@@ -2468,7 +7658,6 @@ void plugin_log (int level, const char *format, ...)
 {
 	char msg[1024];
 	va_list ap;
-	llentry_t *le;
 
 #if !COLLECT_DEBUG
 	if (level >= LOG_DEBUG)
@@ -2486,22 +7675,29 @@ void plugin_log (int level, const char *format, ...)
 		return;
 	}
 
-	le = llist_head (list_log);
-	while (le != NULL)
+	pthread_mutex_lock (&log_lock);
+	if ((log_queue != NULL) && log_thread_loop)
 	{
-		callback_func_t *cf;
-		plugin_log_cb callback;
-
-		cf = le->value;
-		callback = cf->cf_callback;
-
-		/* do not switch plugin context; rather keep the context
-		 * (interval) information of the calling plugin */
-
-		(*callback) (level, msg, &cf->cf_udata);
+		if (log_queue_num < log_queue_size)
+		{
+			log_record_t *r = log_queue + ((log_queue_head + log_queue_num)
+					% log_queue_size);
 
-		le = le->next;
+			r->level = level;
+			sstrncpy (r->msg, msg, sizeof (r->msg));
+			log_queue_num++;
+			pthread_cond_signal (&log_cond);
+		}
+		else
+		{
+			log_dropped++;
+		}
+		pthread_mutex_unlock (&log_lock);
+		return;
 	}
+	pthread_mutex_unlock (&log_lock);
+
+	plugin_log_dispatch (level, msg);
 } /* void plugin_log */
 
 int parse_log_severity (const char *severity)
@@ -2544,15 +7740,16 @@ int parse_notif_severity (const char *severity)
 
 const data_set_t *plugin_get_ds (const char *name)
 {
-	data_set_t *ds;
+	const data_set_t *ds;
 
-	if (data_sets == NULL)
+	if (!plugin_have_data_sets ())
 	{
 		ERROR ("plugin_get_ds: No data sets are defined yet.");
 		return (NULL);
 	}
 
-	if (c_avl_get (data_sets, name, (void *) &ds) != 0)
+	ds = plugin_find_data_set (name);
+	if (ds == NULL)
 	{
 		DEBUG ("No such dataset registered: %s", name);
 		return (NULL);
@@ -2832,11 +8029,15 @@ static void *plugin_thread_start (void *arg)
 
 	void *(*start_routine) (void *) = plugin_thread->start_routine;
 	void *plugin_arg = plugin_thread->arg;
+	pthread_t self;
 
 	plugin_set_ctx (plugin_thread->ctx);
 
 	sfree (plugin_thread);
 
+	self = pthread_self ();
+	plugin_threads_pin ("PluginThreadsCPUs", &self, 1);
+
 	return start_routine (plugin_arg);
 } /* void *plugin_thread_start */
 
@@ -174,11 +174,58 @@ struct user_data_s
 };
 typedef struct user_data_s user_data_t;
 
+/* A single element of the array passed to batch write callbacks. Both
+ * pointers are valid only for the duration of the callback. */
+struct write_batch_entry_s
+{
+	const data_set_t   *ds;
+	const value_list_t *vl;
+};
+typedef struct write_batch_entry_s write_batch_entry_t;
+
+/* Policies applied when a writer's own write queue is full. */
+#define PLUGIN_WRITE_QUEUE_DROP_NEWEST 0
+#define PLUGIN_WRITE_QUEUE_DROP_OLDEST 1
+#define PLUGIN_WRITE_QUEUE_BLOCK       2
+
+/* Read priorities, see "ReadBackoff". */
+#define PLUGIN_READ_PRIORITY_NORMAL 0
+#define PLUGIN_READ_PRIORITY_LOW    1
+#define PLUGIN_READ_PRIORITY_HIGH   2
+
 struct plugin_ctx_s
 {
 	cdtime_t interval;
 	cdtime_t flush_interval;
 	cdtime_t flush_timeout;
+
+	/* If write_threads or write_queue_limit_high is non-zero, write
+	 * callbacks registered in this context get their own queue, served by
+	 * write_threads threads. A write_queue_limit_low of less than zero
+	 * means "half of write_queue_limit_high". */
+	int write_threads;
+	int write_queue_limit_high;
+	int write_queue_limit_low;
+	int write_queue_policy;
+
+	/* If non-zero, values are reduced to this resolution with the
+	 * write_rollup function (one of the ROLLUP_* constants) before write
+	 * callbacks registered in this context see them. */
+	cdtime_t write_resolution;
+	int write_rollup;
+
+	/* If non-zero, read callbacks registered in this context run in a
+	 * pool of read_threads threads of their own, shared by all callbacks
+	 * of the same group. */
+	int read_threads;
+
+	/* One of the PLUGIN_READ_PRIORITY_* constants. */
+	int read_priority;
+
+	/* One of the PLUGIN_READ_PRIORITY_* constants. Values dispatched with a
+	 * high priority are written first and dropped last from the global
+	 * write queue, values with a low priority are dropped first. */
+	int dispatch_priority;
 };
 typedef struct plugin_ctx_s plugin_ctx_t;
 
@@ -189,6 +236,8 @@ typedef int (*plugin_init_cb) (void);
 typedef int (*plugin_read_cb) (user_data_t *);
 typedef int (*plugin_write_cb) (const data_set_t *, const value_list_t *,
 		user_data_t *);
+typedef int (*plugin_write_batch_cb) (const write_batch_entry_t *entries,
+		size_t entries_num, user_data_t *);
 typedef int (*plugin_flush_cb) (cdtime_t timeout, const char *identifier,
 		user_data_t *);
 /* "missing" callback. Returns less than zero on failure, zero if other
@@ -198,6 +247,9 @@ typedef int (*plugin_missing_cb) (const value_list_t *, user_data_t *);
 typedef void (*plugin_log_cb) (int severity, const char *message,
 		user_data_t *);
 typedef int (*plugin_shutdown_cb) (void);
+/* "memory" callback. Stores an estimate of the memory used by the plugin's own
+ * data structures, in bytes, in "ret_bytes". Returns zero on success. */
+typedef int (*plugin_memory_cb) (size_t *ret_bytes);
 typedef int (*plugin_notification_cb) (const notification_t *,
 		user_data_t *);
 
@@ -245,6 +297,16 @@ void plugin_read_all (void);
 int plugin_read_all_once (void);
 void plugin_shutdown_all (void);
 
+/* Looks up the "PreCacheChain" and "PostCacheChain" again, e.g. after
+ * fc_reload(). */
+void plugin_reload_chains (void);
+
+/* Calls "free_func" with "data" once every write thread has finished the
+ * value lists it is handling at the time of the call. This is used for
+ * structures that values may still be passing through, such as the chains
+ * replaced by fc_reload(). */
+void plugin_write_defer_free (void (*free_func) (void *), void *data);
+
 /*
  * NAME
  *  plugin_write
@@ -275,8 +337,54 @@ void plugin_shutdown_all (void);
 int plugin_write (const char *plugin,
     const data_set_t *ds, const value_list_t *vl);
 
+/*
+ * NAME
+ *  plugin_flush
+ *
+ * DESCRIPTION
+ *  Calls the flush callback of `plugin', or of all plugins if `plugin' is NULL,
+ *  and waits until they have returned. Each flush callback is called by its
+ *  own thread, so the callbacks run concurrently; see the flush requests below
+ *  for waiting with a deadline.
+ */
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier);
 
+/*
+ * Flush requests hand flushes to the threads of the flush callbacks. A request
+ * collects any number of flushes added with plugin_flush_request_add() and is
+ * finished with either plugin_flush_request_wait() or
+ * plugin_flush_request_release(), exactly once.
+ *
+ * Flushes which haven't started when the request's deadline passes are
+ * skipped and count as errors. Flushes without a waiter are coalesced with
+ * identical ones already queued for the same callback, so periodic flushes of
+ * a slow writer don't pile up.
+ */
+struct plugin_flush_request_s;
+typedef struct plugin_flush_request_s plugin_flush_request_t;
+
+/* Called once all flushes of a request have returned or have been skipped,
+ * from the thread of the callback returning last, or from
+ * plugin_flush_request_wait() or plugin_flush_request_release() if all of
+ * them returned before. */
+typedef void (*plugin_flush_done_cb) (int success, int error, void *arg);
+
+/* Creates a request. `deadline' is an absolute time, zero meaning no deadline.
+ * `done' may be NULL. */
+plugin_flush_request_t *plugin_flush_request_create (cdtime_t deadline,
+		plugin_flush_done_cb done, void *arg);
+/* Queues a flush of `plugin', or of all plugins if `plugin' is NULL. */
+int plugin_flush_request_add (plugin_flush_request_t *req,
+		const char *plugin, cdtime_t timeout, const char *identifier);
+/* Waits until all flushes have returned or the deadline has passed, stores
+ * the number of flushes that succeeded and failed, including those not done
+ * by the deadline, and releases the request. Returns ETIMEDOUT if flushes
+ * were still pending at the deadline. */
+int plugin_flush_request_wait (plugin_flush_request_t *req,
+		int *ret_success, int *ret_error);
+/* Releases the request without waiting. */
+void plugin_flush_request_release (plugin_flush_request_t *req);
+
 /*
  * The `plugin_register_*' functions are used to make `config', `init',
  * `read', `write' and `shutdown' functions known to the plugin
@@ -287,6 +395,14 @@ int plugin_register_config (const char *name,
 		const char **keys, int keys_num);
 int plugin_register_complex_config (const char *type,
 		int (*callback) (oconfig_item_t *));
+/* Registers a callback that applies a changed <Plugin "type"> block while the
+ * daemon is running, see cf_reload(). It receives all blocks of the plugin
+ * merged into one; a removed configuration is passed as an empty block. If
+ * the callback fails, the plugin should keep its current configuration.
+ * Plugins without such a callback need a restart for changes to take effect.
+ * Must be called after plugin_register_complex_config(). */
+int plugin_register_complex_reload (const char *type,
+		int (*callback) (oconfig_item_t *));
 int plugin_register_init (const char *name,
 		plugin_init_cb callback);
 int plugin_register_read (const char *name,
@@ -299,12 +415,24 @@ int plugin_register_complex_read (const char *group, const char *name,
 		user_data_t *user_data);
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *user_data);
+/* Batch write callbacks are called by the write threads with all value lists
+ * that have been dispatched to them while handling up to "WriteBatchSize"
+ * queued value lists at once. When called outside of a write thread, for
+ * example via "plugin_write", the callback may receive a single entry only. A
+ * batch writer is unregistered with "plugin_unregister_write". */
+int plugin_register_write_batch (const char *name,
+		plugin_write_batch_cb callback, user_data_t *user_data);
 int plugin_register_flush (const char *name,
 		plugin_flush_cb callback, user_data_t *user_data);
 int plugin_register_missing (const char *name,
 		plugin_missing_cb callback, user_data_t *user_data);
 int plugin_register_shutdown (const char *name,
 		plugin_shutdown_cb callback);
+/* Memory callbacks are called once per interval if internal statistics are
+ * collected or "PluginMemoryLimit" is set. The reported memory is attributed to
+ * the plugin called "name". */
+int plugin_register_memory (const char *name,
+		plugin_memory_cb callback);
 int plugin_register_data_set (const data_set_t *ds);
 int plugin_register_log (const char *name,
 		plugin_log_cb callback, user_data_t *user_data);
@@ -320,6 +448,7 @@ int plugin_unregister_write (const char *name);
 int plugin_unregister_flush (const char *name);
 int plugin_unregister_missing (const char *name);
 int plugin_unregister_shutdown (const char *name);
+int plugin_unregister_memory (const char *name);
 int plugin_unregister_data_set (const char *name);
 int plugin_unregister_log (const char *name);
 int plugin_unregister_notification (const char *name);
@@ -352,6 +481,78 @@ void plugin_log_available_writers (void);
  */
 int plugin_dispatch_values (value_list_t const *vl);
 
+/*
+ * NAME
+ *  plugin_dispatch_values_ds
+ *
+ * DESCRIPTION
+ *  Like `plugin_dispatch_values', but uses the data-set definition `ds'
+ *  instead of looking it up by `vl->type' for each value list. Plugins
+ *  dispatching the same types over and over can look up `ds' once with
+ *  `plugin_get_ds', for example in their init callback, and pass it here.
+ *
+ * ARGUMENTS
+ *  `ds'        Data-set definition of `vl->type', as returned by
+ *              `plugin_get_ds'. If NULL, the data-set is looked up.
+ *  `vl'        Value list of the values that have been read by a `read'
+ *              function.
+ */
+int plugin_dispatch_values_ds (const data_set_t *ds, value_list_t const *vl);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_bulk
+ *
+ * DESCRIPTION
+ *  Like `plugin_dispatch_values_ds', but dispatches `vl_num' value lists of
+ *  the same type at once. The value lists are appended to the write queue
+ *  with a single lock operation, which is cheaper for plugins reporting many
+ *  similar metrics in one read callback.
+ *
+ * ARGUMENTS
+ *  `ds'        Data-set definition of the type of all value lists, as
+ *              returned by `plugin_get_ds'. If NULL, the data-set is looked
+ *              up for each value list.
+ *  `vl'        Array of `vl_num' value lists.
+ *
+ * RETURN VALUE
+ *  Zero if all value lists have been queued or an errno value otherwise.
+ */
+int plugin_dispatch_values_bulk (const data_set_t *ds,
+		value_list_t const *vl, size_t vl_num);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_vec
+ *
+ * DESCRIPTION
+ *  Dispatches `values_num' values which only differ in their type instance
+ *  from `template', which must have exactly one value. The values are queued
+ *  as one element of the write queue and all get the time stamp of
+ *  `template', or the same current time if it is zero. They are dispatched
+ *  to the cache and the write plugins as separate value lists.
+ *
+ * ARGUMENTS
+ *  `ds'        Data-set definition of `template->type', as returned by
+ *              `plugin_get_ds'. If NULL, the data-set is looked up.
+ *  `template'  Value list with the common part of the identifier; the type
+ *              instance and the value are ignored.
+ *  `values'    Array of `values_num' type instances and values.
+ *
+ * RETURN VALUE
+ *  Zero if the values have been queued or an errno value otherwise.
+ */
+struct plugin_value_vec_s
+{
+	char const *type_instance;
+	value_t     value;
+};
+typedef struct plugin_value_vec_s plugin_value_vec_t;
+
+int plugin_dispatch_values_vec (const data_set_t *ds,
+		value_list_t const *template,
+		plugin_value_vec_t const *values, size_t values_num);
+
 /*
  * NAME
  *  plugin_dispatch_multivalue
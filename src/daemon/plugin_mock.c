@@ -52,11 +52,21 @@ int plugin_register_shutdown (const char *name, int (*callback) (void))
   return ENOTSUP;
 }
 
+int plugin_register_memory (const char *name, plugin_memory_cb callback)
+{
+  return ENOTSUP;
+}
+
 int plugin_dispatch_values (value_list_t const *vl)
 {
   return ENOTSUP;
 }
 
+int plugin_dispatch_values_ds (const data_set_t *ds, value_list_t const *vl)
+{
+  return ENOTSUP;
+}
+
 void plugin_log (int level, char const *format, ...)
 {
   char buffer[1024];
@@ -31,6 +31,8 @@
 #include "configfile.h"
 #include "types_list.h"
 
+#include <sys/mman.h>
+
 static int parse_ds (data_source_t *dsrc, char *buf, size_t buf_len)
 {
   char *dummy;
@@ -97,7 +99,9 @@ static int parse_ds (data_source_t *dsrc, char *buf, size_t buf_len)
   return (0);
 } /* int parse_ds */
 
-static void parse_line (char *buf)
+/* Returns the data set defined by "buf", which the caller has to free, or
+ * NULL. */
+static data_set_t *parse_line (char *buf)
 {
   char  *fields[64];
   size_t fields_num;
@@ -106,15 +110,15 @@ static void parse_line (char *buf)
 
   fields_num = strsplit (buf, fields, 64);
   if (fields_num < 2)
-    return;
+    return (NULL);
 
   /* Ignore lines which begin with a hash sign. */
   if (fields[0][0] == '#')
-    return;
+    return (NULL);
 
   ds = calloc (1, sizeof (*ds));
   if (ds == NULL)
-    return;
+    return (NULL);
 
   sstrncpy (ds->type, fields[0], sizeof (ds->type));
 
@@ -123,7 +127,7 @@ static void parse_line (char *buf)
   if (ds->ds == NULL)
   {
     sfree (ds);
-    return;
+    return (NULL);
   }
 
   for (i = 0; i < ds->ds_num; i++)
@@ -133,19 +137,28 @@ static void parse_line (char *buf)
 	  "of data set %s", i, ds->type);
       sfree (ds->ds);
       sfree (ds);
-      return;
+      return (NULL);
     }
 
-  plugin_register_data_set (ds);
+  return (ds);
+} /* data_set_t *parse_line */
+
+static void free_data_set (data_set_t *ds)
+{
+  if (ds == NULL)
+    return;
 
   sfree (ds->ds);
   sfree (ds);
-} /* void parse_line */
+} /* void free_data_set */
 
-static void parse_file (FILE *fh)
+/* Registers the data sets read from "fh". If "sets" is not NULL, the data sets
+ * are also returned in "sets" and "sets_num" instead of being freed. */
+static void parse_file (FILE *fh, data_set_t ***sets, size_t *sets_num)
 {
   char buf[4096];
   size_t buf_len;
+  data_set_t *ds;
 
   while (fgets (buf, sizeof (buf), fh) != NULL)
   {
@@ -173,17 +186,633 @@ static void parse_file (FILE *fh)
     if (buf_len == 0)
       continue;
 
-    parse_line (buf);
+    ds = parse_line (buf);
+    if (ds == NULL)
+      continue;
+
+    plugin_register_data_set (ds);
+
+    if (sets != NULL)
+    {
+      data_set_t **tmp;
+
+      tmp = realloc (*sets, (*sets_num + 1) * sizeof (*tmp));
+      if (tmp != NULL)
+      {
+	*sets = tmp;
+	(*sets)[*sets_num] = ds;
+	(*sets_num)++;
+	continue;
+      }
+    }
+
+    free_data_set (ds);
   } /* while (fgets) */
 } /* void parse_file */
 
+/*
+ * Compiled types databases
+ *
+ * With the "TypesDBCache" option, each types file that is parsed is also
+ * written to a binary image in that directory. When the file is read again and
+ * its size, modification time and inode still match the ones recorded in the
+ * image, the image is mapped instead of parsing the file. The data sets of an
+ * image are found with a perfect hash ("hash and displace"): the bucket of a
+ * name selects a displacement, which together with the name selects the only
+ * slot the name can be stored in.
+ *
+ * The images contain structures as laid out by the compiler and are only
+ * meant to be read by the same build of the daemon.
+ */
+#define TYPES_CACHE_MAGIC "CDTYPES"
+#define TYPES_CACHE_VERSION 1
+#define TYPES_CACHE_EMPTY UINT32_MAX
+/* Keys per bucket, on average. */
+#define TYPES_CACHE_BUCKET_SIZE 4
+/* Displacements tried per bucket before giving up. */
+#define TYPES_CACHE_MAX_DISPLACEMENT 1000000
+
+struct types_cache_header_s
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t set_size;
+  uint32_t source_size;
+  uint32_t path_len;
+  uint64_t file_size;
+  uint64_t file_ino;
+  int64_t file_mtime;
+  uint32_t sets_num;
+  uint32_t sources_num;
+  uint32_t buckets_num;
+  uint32_t slots_num;
+  /* Followed by the path of the types file (padded to a multiple of eight
+   * bytes), "sets_num" sets, "sources_num" data sources, "buckets_num"
+   * displacements and "slots_num" slots. */
+};
+typedef struct types_cache_header_s types_cache_header_t;
+
+struct types_cache_set_s
+{
+  data_set_t ds;
+  uint64_t sources_index;
+  /* Set once the data set has been replaced or unregistered. */
+  uint32_t shadowed;
+  uint32_t pad;
+};
+typedef struct types_cache_set_s types_cache_set_t;
+
+struct types_cache_s
+{
+  void *map;
+  size_t map_size;
+  types_cache_header_t *header;
+  types_cache_set_t *sets;
+  uint32_t *displacements;
+  uint32_t *slots;
+};
+typedef struct types_cache_s types_cache_t;
+
+static types_cache_t *types_caches = NULL;
+static size_t types_caches_num = 0;
+
+/* 32 bit FNV-1a, followed by the MurmurHash3 finalizer so that different
+ * seeds yield unrelated hashes. */
+static uint32_t types_cache_hash (const char *str, uint32_t seed)
+{
+  uint32_t hash = 2166136261U ^ seed;
+  const unsigned char *ptr;
+
+  for (ptr = (const unsigned char *) str; *ptr != 0; ptr++)
+  {
+    hash ^= (uint32_t) *ptr;
+    hash *= 16777619U;
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35U;
+  hash ^= hash >> 16;
+
+  return (hash);
+} /* uint32_t types_cache_hash */
+
+static size_t types_cache_path_size (size_t path_len)
+{
+  return ((path_len + 8) & ~((size_t) 7));
+} /* size_t types_cache_path_size */
+
+/* Returns the size of an image with the given numbers of elements. */
+static size_t types_cache_image_size (const types_cache_header_t *h)
+{
+  return (sizeof (*h)
+      + types_cache_path_size (h->path_len)
+      + ((size_t) h->sets_num) * sizeof (types_cache_set_t)
+      + ((size_t) h->sources_num) * sizeof (data_source_t)
+      + ((size_t) h->buckets_num) * sizeof (uint32_t)
+      + ((size_t) h->slots_num) * sizeof (uint32_t));
+} /* size_t types_cache_image_size */
+
+static types_cache_set_t *types_cache_find (types_cache_t *c,
+    const char *type)
+{
+  types_cache_header_t *h = c->header;
+  uint32_t bucket;
+  uint32_t slot;
+  uint32_t idx;
+
+  if (h->sets_num == 0)
+    return (NULL);
+
+  bucket = types_cache_hash (type, 0) % h->buckets_num;
+  slot = types_cache_hash (type, c->displacements[bucket]) % h->slots_num;
+  idx = c->slots[slot];
+  if (idx == TYPES_CACHE_EMPTY)
+    return (NULL);
+
+  if (strcmp (c->sets[idx].ds.type, type) != 0)
+    return (NULL);
+
+  return (&c->sets[idx]);
+} /* types_cache_set_t *types_cache_find */
+
+/* Builds the name of the image of "file" in the "TypesDBCache" directory. */
+static int types_cache_file_name (char *buffer, size_t buffer_size,
+    const char *dir, const char *file)
+{
+  size_t len;
+  char *ptr;
+  int status;
+
+  while (file[0] == '/')
+    file++;
+
+  status = ssnprintf (buffer, buffer_size, "%s/", dir);
+  if ((status < 0) || ((size_t) status >= buffer_size))
+    return (-1);
+  len = (size_t) status;
+
+  status = ssnprintf (buffer + len, buffer_size - len, "%s.cache", file);
+  if ((status < 0) || ((size_t) status >= buffer_size - len))
+    return (-1);
+
+  for (ptr = buffer + len; *ptr != 0; ptr++)
+    if (*ptr == '/')
+      *ptr = '_';
+
+  return (0);
+} /* int types_cache_file_name */
+
+/* Maps the image "cache_file" if it is valid and was compiled from "file" as
+ * described by "st". */
+static int types_cache_load (const char *cache_file, const char *file,
+    const struct stat *st)
+{
+  types_cache_t c = { 0 };
+  types_cache_t *tmp;
+  types_cache_header_t *h;
+  data_source_t *sources;
+  struct stat cache_st;
+  char *ptr;
+  size_t path_len = strlen (file);
+  size_t i;
+  int fd;
+
+  fd = open (cache_file, O_RDONLY);
+  if (fd < 0)
+    return (-1);
+
+  if ((fstat (fd, &cache_st) != 0)
+      || (cache_st.st_size < (off_t) sizeof (*h)))
+  {
+    close (fd);
+    return (-1);
+  }
+
+  c.map_size = (size_t) cache_st.st_size;
+  /* Private and writable, to set the data source pointers and to mark data
+   * sets as shadowed. The file itself is never changed. */
+  c.map = mmap (NULL, c.map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (c.map == MAP_FAILED)
+    return (-1);
+
+  h = c.header = c.map;
+  if ((memcmp (h->magic, TYPES_CACHE_MAGIC, sizeof (TYPES_CACHE_MAGIC)) != 0)
+      || (h->version != TYPES_CACHE_VERSION)
+      || (h->set_size != sizeof (types_cache_set_t))
+      || (h->source_size != sizeof (data_source_t))
+      || (h->file_size != (uint64_t) st->st_size)
+      || (h->file_ino != (uint64_t) st->st_ino)
+      || (h->file_mtime != (int64_t) st->st_mtime)
+      || (h->path_len != path_len)
+      || (h->buckets_num == 0) || (h->slots_num < h->sets_num)
+      || (types_cache_image_size (h) != c.map_size))
+  {
+    munmap (c.map, c.map_size);
+    return (-1);
+  }
+
+  ptr = (char *) (h + 1);
+  if (memcmp (ptr, file, path_len) != 0)
+  {
+    munmap (c.map, c.map_size);
+    return (-1);
+  }
+  ptr += types_cache_path_size (path_len);
+
+  c.sets = (types_cache_set_t *) ptr;
+  ptr += h->sets_num * sizeof (*c.sets);
+  sources = (data_source_t *) ptr;
+  ptr += h->sources_num * sizeof (*sources);
+  c.displacements = (uint32_t *) ptr;
+  ptr += h->buckets_num * sizeof (*c.displacements);
+  c.slots = (uint32_t *) ptr;
+
+  for (i = 0; i < h->slots_num; i++)
+    if ((c.slots[i] != TYPES_CACHE_EMPTY) && (c.slots[i] >= h->sets_num))
+      break;
+  if (i < h->slots_num)
+  {
+    munmap (c.map, c.map_size);
+    return (-1);
+  }
+
+  for (i = 0; i < h->sources_num; i++)
+    if (memchr (sources[i].name, 0, sizeof (sources[i].name)) == NULL)
+      break;
+  if (i < h->sources_num)
+  {
+    munmap (c.map, c.map_size);
+    return (-1);
+  }
+
+  for (i = 0; i < h->sets_num; i++)
+  {
+    types_cache_set_t *s = &c.sets[i];
+
+    if ((memchr (s->ds.type, 0, sizeof (s->ds.type)) == NULL)
+	|| (s->ds.ds_num == 0) || (s->sources_index > h->sources_num)
+	|| (s->ds.ds_num > h->sources_num - s->sources_index))
+      break;
+
+    s->ds.ds = sources + s->sources_index;
+    s->shadowed = 0;
+  }
+  if (i < h->sets_num)
+  {
+    munmap (c.map, c.map_size);
+    return (-1);
+  }
+
+  tmp = realloc (types_caches, (types_caches_num + 1) * sizeof (*tmp));
+  if (tmp == NULL)
+  {
+    munmap (c.map, c.map_size);
+    return (-1);
+  }
+  types_caches = tmp;
+
+  /* Data sets of later files replace those of earlier files. */
+  for (i = 0; i < h->sets_num; i++)
+    plugin_unregister_data_set (c.sets[i].ds.type);
+
+  types_caches[types_caches_num] = c;
+  types_caches_num++;
+
+  return (0);
+} /* int types_cache_load */
+
+static int types_cache_compare_sets (const void *a, const void *b)
+{
+  const data_set_t *ds_a = *((data_set_t * const *) a);
+  const data_set_t *ds_b = *((data_set_t * const *) b);
+  int status;
+
+  status = strcmp (ds_a->type, ds_b->type);
+  if (status != 0)
+    return (status);
+
+  /* Keeps the order of equal names, see types_cache_write(). */
+  return ((ds_a < ds_b) ? -1 : (ds_a > ds_b));
+} /* int types_cache_compare_sets */
+
+/* Assigns each data set to a slot. Buckets with more names are placed first,
+ * while most slots are still free. Returns zero on success. */
+static int types_cache_build (data_set_t **sets, size_t sets_num,
+    uint32_t *displacements, size_t buckets_num,
+    uint32_t *slots, size_t slots_num)
+{
+  uint32_t *bucket_of;
+  size_t *order;
+  size_t *first;
+  size_t *positions;
+  size_t max_size = 0;
+  size_t size;
+  size_t i;
+  int status = 0;
+
+  bucket_of = calloc (sets_num, sizeof (*bucket_of));
+  order = calloc (sets_num, sizeof (*order));
+  first = calloc (buckets_num + 1, sizeof (*first));
+  positions = calloc (sets_num, sizeof (*positions));
+  if ((bucket_of == NULL) || (order == NULL) || (first == NULL)
+      || (positions == NULL))
+  {
+    sfree (bucket_of);
+    sfree (order);
+    sfree (first);
+    sfree (positions);
+    return (ENOMEM);
+  }
+
+  /* Sort the names by bucket. */
+  for (i = 0; i < sets_num; i++)
+  {
+    bucket_of[i] = types_cache_hash (sets[i]->type, 0) % buckets_num;
+    first[bucket_of[i] + 1]++;
+  }
+  for (i = 0; i < buckets_num; i++)
+  {
+    if (first[i + 1] > max_size)
+      max_size = first[i + 1];
+    first[i + 1] += first[i];
+  }
+  for (i = 0; i < sets_num; i++)
+    order[first[bucket_of[i]] + (positions[bucket_of[i]]++)] = i;
+
+  for (i = 0; i < slots_num; i++)
+    slots[i] = TYPES_CACHE_EMPTY;
+
+  for (size = max_size; (size > 0) && (status == 0); size--)
+  {
+    size_t b;
+
+    for (b = 0; (b < buckets_num) && (status == 0); b++)
+    {
+      size_t *keys = order + first[b];
+      uint32_t d;
+
+      if (first[b + 1] - first[b] != size)
+	continue;
+
+      for (d = 1; d <= TYPES_CACHE_MAX_DISPLACEMENT; d++)
+      {
+	size_t j;
+	size_t k;
+
+	for (j = 0; j < size; j++)
+	{
+	  positions[j] = types_cache_hash (sets[keys[j]]->type, d)
+	    % slots_num;
+	  if (slots[positions[j]] != TYPES_CACHE_EMPTY)
+	    break;
+	  for (k = 0; k < j; k++)
+	    if (positions[k] == positions[j])
+	      break;
+	  if (k < j)
+	    break;
+	}
+	if (j < size)
+	  continue;
+
+	for (j = 0; j < size; j++)
+	  slots[positions[j]] = (uint32_t) keys[j];
+	displacements[b] = d;
+	break;
+      }
+
+      if (d > TYPES_CACHE_MAX_DISPLACEMENT)
+	status = -1;
+    }
+  }
+
+  sfree (bucket_of);
+  sfree (order);
+  sfree (first);
+  sfree (positions);
+  return (status);
+} /* int types_cache_build */
+
+/* Writes the image of "file", whose data sets are "sets" in the order they
+ * were read, to "cache_file". Failures are only reported. */
+static void types_cache_write (const char *cache_file, const char *file,
+    const struct stat *st, data_set_t **sets, size_t sets_num)
+{
+  types_cache_header_t h = { { 0 } };
+  data_set_t **unique;
+  uint32_t *displacements;
+  uint32_t *slots;
+  char tmp_file[PATH_MAX];
+  char pad[8] = { 0 };
+  size_t unique_num = 0;
+  size_t sources_index;
+  size_t buckets_num;
+  size_t slots_num;
+  size_t i;
+  FILE *fh;
+  int fd;
+  int status;
+
+  if ((sets_num == 0) || (sets_num >= TYPES_CACHE_EMPTY / 2))
+    return;
+
+  /* Only the last definition of a type counts, as with
+   * plugin_register_data_set(). The sort is stable because the pointers
+   * are in the order the sets were read. */
+  unique = calloc (sets_num, sizeof (*unique));
+  if (unique == NULL)
+    return;
+  memcpy (unique, sets, sets_num * sizeof (*unique));
+  qsort (unique, sets_num, sizeof (*unique), types_cache_compare_sets);
+  for (i = 0; i < sets_num; i++)
+  {
+    if ((i + 1 < sets_num)
+	&& (strcmp (unique[i]->type, unique[i + 1]->type) == 0))
+      continue;
+    unique[unique_num++] = unique[i];
+  }
+
+  buckets_num = (unique_num + TYPES_CACHE_BUCKET_SIZE - 1)
+    / TYPES_CACHE_BUCKET_SIZE;
+  slots_num = unique_num + (unique_num / 4) + 1;
+  displacements = calloc (buckets_num, sizeof (*displacements));
+  slots = calloc (slots_num, sizeof (*slots));
+  if ((displacements == NULL) || (slots == NULL)
+      || (types_cache_build (unique, unique_num, displacements, buckets_num,
+	  slots, slots_num) != 0))
+  {
+    WARNING ("types_list: Compiling `%s' failed.", file);
+    sfree (unique);
+    sfree (displacements);
+    sfree (slots);
+    return;
+  }
+
+  memcpy (h.magic, TYPES_CACHE_MAGIC, sizeof (TYPES_CACHE_MAGIC));
+  h.version = TYPES_CACHE_VERSION;
+  h.set_size = sizeof (types_cache_set_t);
+  h.source_size = sizeof (data_source_t);
+  h.path_len = (uint32_t) strlen (file);
+  h.file_size = (uint64_t) st->st_size;
+  h.file_ino = (uint64_t) st->st_ino;
+  h.file_mtime = (int64_t) st->st_mtime;
+  h.sets_num = (uint32_t) unique_num;
+  h.buckets_num = (uint32_t) buckets_num;
+  h.slots_num = (uint32_t) slots_num;
+  for (i = 0; i < unique_num; i++)
+    h.sources_num += (uint32_t) unique[i]->ds_num;
+
+  /* Write to a temporary file and rename it, so that readers never see a
+   * partial image. */
+  ssnprintf (tmp_file, sizeof (tmp_file), "%s.XXXXXX", cache_file);
+  fd = mkstemp (tmp_file);
+  fh = (fd < 0) ? NULL : fdopen (fd, "w");
+  if (fh == NULL)
+  {
+    char errbuf[1024];
+    WARNING ("types_list: Creating `%s' failed: %s", tmp_file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    if (fd >= 0)
+    {
+      close (fd);
+      unlink (tmp_file);
+    }
+    sfree (unique);
+    sfree (displacements);
+    sfree (slots);
+    return;
+  }
+
+  status = (fwrite (&h, sizeof (h), 1, fh) != 1);
+  status |= (fwrite (file, 1, h.path_len, fh) != h.path_len);
+  status |= (fwrite (pad, 1, types_cache_path_size (h.path_len) - h.path_len,
+	fh) != types_cache_path_size (h.path_len) - h.path_len);
+
+  sources_index = 0;
+  for (i = 0; (i < unique_num) && (status == 0); i++)
+  {
+    types_cache_set_t s;
+
+    memset (&s, 0, sizeof (s));
+    sstrncpy (s.ds.type, unique[i]->type, sizeof (s.ds.type));
+    s.ds.ds_num = unique[i]->ds_num;
+    s.ds.ds = NULL;
+    s.sources_index = (uint64_t) sources_index;
+    sources_index += unique[i]->ds_num;
+
+    status |= (fwrite (&s, sizeof (s), 1, fh) != 1);
+  }
+  for (i = 0; (i < unique_num) && (status == 0); i++)
+    status |= (fwrite (unique[i]->ds, sizeof (*unique[i]->ds),
+	  unique[i]->ds_num, fh) != unique[i]->ds_num);
+  if (status == 0)
+    status |= (fwrite (displacements, sizeof (*displacements), buckets_num,
+	  fh) != buckets_num);
+  if (status == 0)
+    status |= (fwrite (slots, sizeof (*slots), slots_num, fh) != slots_num);
+
+  if (fclose (fh) != 0)
+    status = 1;
+
+  if ((status != 0) || (rename (tmp_file, cache_file) != 0))
+  {
+    char errbuf[1024];
+    WARNING ("types_list: Writing `%s' failed: %s", cache_file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    unlink (tmp_file);
+  }
+  else
+  {
+    DEBUG ("types_list: Compiled `%s' to `%s'.", file, cache_file);
+  }
+
+  sfree (unique);
+  sfree (displacements);
+  sfree (slots);
+} /* void types_cache_write */
+
+const data_set_t *types_list_get (const char *type)
+{
+  size_t i;
+
+  /* Later files take precedence, but the data sets of earlier images are
+   * shadowed when replaced, so the order only matters for speed. */
+  for (i = types_caches_num; i > 0; i--)
+  {
+    types_cache_set_t *s = types_cache_find (&types_caches[i - 1], type);
+
+    if ((s != NULL) && !s->shadowed)
+      return (&s->ds);
+  }
+
+  return (NULL);
+} /* const data_set_t *types_list_get */
+
+int types_list_remove (const char *type)
+{
+  size_t i;
+  int status = -1;
+
+  for (i = 0; i < types_caches_num; i++)
+  {
+    types_cache_set_t *s = types_cache_find (&types_caches[i], type);
+
+    if ((s != NULL) && !s->shadowed)
+    {
+      s->shadowed = 1;
+      status = 0;
+    }
+  }
+
+  return (status);
+} /* int types_list_remove */
+
+size_t types_list_cached_num (void)
+{
+  return (types_caches_num);
+} /* size_t types_list_cached_num */
+
+void types_list_free (void)
+{
+  size_t i;
+
+  for (i = 0; i < types_caches_num; i++)
+    munmap (types_caches[i].map, types_caches[i].map_size);
+
+  sfree (types_caches);
+  types_caches_num = 0;
+} /* void types_list_free */
+
 int read_types_list (const char *file)
 {
   FILE *fh;
+  const char *cache_dir;
+  char cache_file[PATH_MAX];
+  struct stat st;
+  data_set_t **sets = NULL;
+  size_t sets_num = 0;
+  _Bool use_cache = 0;
+  size_t i;
 
   if (file == NULL)
     return (-1);
 
+  cache_dir = global_option_get ("TypesDBCache");
+  if ((cache_dir != NULL) && (cache_dir[0] != 0)
+      && (stat (file, &st) == 0)
+      && (types_cache_file_name (cache_file, sizeof (cache_file),
+	  cache_dir, file) == 0))
+  {
+    if (types_cache_load (cache_file, file, &st) == 0)
+    {
+      DEBUG ("Done loading `%s' from `%s'", file, cache_file);
+      return (0);
+    }
+    use_cache = 1;
+  }
+
   fh = fopen (file, "r");
   if (fh == NULL)
   {
@@ -195,13 +824,22 @@ int read_types_list (const char *file)
     return (-1);
   }
 
-  parse_file (fh);
+  parse_file (fh, use_cache ? &sets : NULL, &sets_num);
 
   fclose (fh);
   fh = NULL;
 
   DEBUG ("Done parsing `%s'", file);
 
+  if (use_cache)
+  {
+    types_cache_write (cache_file, file, &st, sets, sets_num);
+
+    for (i = 0; i < sets_num; i++)
+      free_data_set (sets[i]);
+    sfree (sets);
+  }
+
   return (0);
 } /* int read_types_list */
 
@@ -27,6 +27,26 @@
 #ifndef TYPES_LIST_H
 #define TYPES_LIST_H 1
 
+#include "plugin.h"
+
+/* Reads the data sets defined in "file" and registers them. With the
+ * "TypesDBCache" option, the file is compiled to an image in that directory,
+ * which is mapped instead of parsing the file as long as the file is
+ * unchanged. Data sets of mapped images are not registered with
+ * plugin_register_data_set(), use types_list_get() to find them. */
 int read_types_list (const char *file);
 
+/* Returns the data set "type" from the mapped images or NULL. */
+const data_set_t *types_list_get (const char *type);
+
+/* Hides the data set "type" of the mapped images, e.g. because it is being
+ * replaced. Returns zero if such a data set was found. */
+int types_list_remove (const char *type);
+
+/* Returns the number of mapped images. */
+size_t types_list_cached_num (void);
+
+/* Unmaps all images. */
+void types_list_free (void);
+
 #endif /* TYPES_LIST_H */
@@ -0,0 +1,781 @@
+/**
+ * collectd - src/daemon/utils_btree.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "utils_btree.h"
+
+/* Maximum number of keys in a node. Nodes other than the root hold at least
+ * half as many. */
+#define BT_ORDER 32
+#define BT_MIN (BT_ORDER / 2)
+
+/* More than enough for 2^31 entries with half-full nodes. */
+#define BT_MAX_DEPTH 16
+
+typedef struct bt_key_s
+{
+  /* The first eight bytes of string keys, big endian, zero-padded. */
+  uint64_t prefix;
+  void *key;
+} bt_key_t;
+
+struct bt_node_s;
+typedef struct bt_node_s bt_node_t;
+struct bt_node_s
+{
+  _Bool is_leaf;
+  int n;
+  /* In inner nodes, keys[i] is the smallest key below children[i + 1]. */
+  bt_key_t keys[BT_ORDER];
+  union
+  {
+    struct
+    {
+      void *values[BT_ORDER];
+      bt_node_t *prev;
+      bt_node_t *next;
+    } leaf;
+    bt_node_t *children[BT_ORDER + 1];
+  } u;
+};
+
+typedef struct bt_path_s
+{
+  bt_node_t *node;
+  int index;
+} bt_path_t;
+
+struct c_btree_s
+{
+  bt_node_t *root;
+  /* NULL for string keys. */
+  int (*compare) (const void *, const void *);
+  int size;
+};
+
+struct c_btree_iterator_s
+{
+  c_btree_t *tree;
+  bt_node_t *node;
+  int index;
+};
+
+/*
+ * Private functions
+ */
+static uint64_t bt_prefix (const char *s) /* {{{ */
+{
+  uint64_t prefix = 0;
+  int i;
+
+  for (i = 0; i < 8; i++)
+  {
+    prefix <<= 8;
+    if (*s != 0)
+    {
+      prefix |= (uint64_t) ((unsigned char) *s);
+      s++;
+    }
+  }
+
+  return (prefix);
+} /* }}} uint64_t bt_prefix */
+
+static void bt_key_init (const c_btree_t *t, bt_key_t *k, /* {{{ */
+    const void *key)
+{
+  k->key = (void *) key;
+  k->prefix = (t->compare == NULL) ? bt_prefix (key) : 0;
+} /* }}} void bt_key_init */
+
+static int bt_compare (const c_btree_t *t, /* {{{ */
+    const bt_key_t *a, const bt_key_t *b)
+{
+  if (t->compare != NULL)
+    return (t->compare (a->key, b->key));
+
+  if (a->prefix != b->prefix)
+    return ((a->prefix < b->prefix) ? -1 : 1);
+
+  /* A zero last byte means both strings end within the prefix. */
+  if ((a->prefix & 0xff) == 0)
+    return (0);
+
+  return (strcmp (((const char *) a->key) + 8, ((const char *) b->key) + 8));
+} /* }}} int bt_compare */
+
+/* Returns the index of the first key in `n' not less than `k' and sets
+ * `found' if that key is equal to `k'. */
+static int bt_lower_bound (const c_btree_t *t, const bt_node_t *n, /* {{{ */
+    const bt_key_t *k, _Bool *found)
+{
+  int lo = 0;
+  int hi = n->n;
+
+  *found = 0;
+  while (lo < hi)
+  {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = bt_compare (t, &n->keys[mid], k);
+
+    if (cmp < 0)
+      lo = mid + 1;
+    else if (cmp > 0)
+      hi = mid;
+    else
+    {
+      *found = 1;
+      return (mid);
+    }
+  }
+
+  return (lo);
+} /* }}} int bt_lower_bound */
+
+/* Returns the index of the child of the inner node `n' which covers `k'. */
+static int bt_child_index (const c_btree_t *t, const bt_node_t *n, /* {{{ */
+    const bt_key_t *k)
+{
+  _Bool found;
+  int idx;
+
+  idx = bt_lower_bound (t, n, k, &found);
+  return (found ? (idx + 1) : idx);
+} /* }}} int bt_child_index */
+
+static bt_node_t *bt_node_new (_Bool is_leaf) /* {{{ */
+{
+  bt_node_t *n;
+
+  n = calloc (1, sizeof (*n));
+  if (n == NULL)
+    return (NULL);
+  n->is_leaf = is_leaf;
+
+  return (n);
+} /* }}} bt_node_t *bt_node_new */
+
+static void bt_node_free (bt_node_t *n) /* {{{ */
+{
+  int i;
+
+  if (n == NULL)
+    return;
+
+  if (!n->is_leaf)
+    for (i = 0; i <= n->n; i++)
+      bt_node_free (n->u.children[i]);
+  free (n);
+} /* }}} void bt_node_free */
+
+static bt_node_t *bt_first_leaf (bt_node_t *n) /* {{{ */
+{
+  while ((n != NULL) && !n->is_leaf)
+    n = n->u.children[0];
+  return (n);
+} /* }}} bt_node_t *bt_first_leaf */
+
+static bt_node_t *bt_last_leaf (bt_node_t *n) /* {{{ */
+{
+  while ((n != NULL) && !n->is_leaf)
+    n = n->u.children[n->n];
+  return (n);
+} /* }}} bt_node_t *bt_last_leaf */
+
+static void bt_leaf_insert_at (bt_node_t *n, int idx, /* {{{ */
+    const bt_key_t *k, void *value)
+{
+  memmove (&n->keys[idx + 1], &n->keys[idx],
+      sizeof (n->keys[0]) * (size_t) (n->n - idx));
+  memmove (&n->u.leaf.values[idx + 1], &n->u.leaf.values[idx],
+      sizeof (n->u.leaf.values[0]) * (size_t) (n->n - idx));
+  n->keys[idx] = *k;
+  n->u.leaf.values[idx] = value;
+  n->n++;
+} /* }}} void bt_leaf_insert_at */
+
+static void bt_leaf_remove_at (bt_node_t *n, int idx) /* {{{ */
+{
+  memmove (&n->keys[idx], &n->keys[idx + 1],
+      sizeof (n->keys[0]) * (size_t) (n->n - idx - 1));
+  memmove (&n->u.leaf.values[idx], &n->u.leaf.values[idx + 1],
+      sizeof (n->u.leaf.values[0]) * (size_t) (n->n - idx - 1));
+  n->n--;
+} /* }}} void bt_leaf_remove_at */
+
+/* Inserts `k' at `idx' and `child' to the right of it. */
+static void bt_inner_insert_at (bt_node_t *n, int idx, /* {{{ */
+    const bt_key_t *k, bt_node_t *child)
+{
+  memmove (&n->keys[idx + 1], &n->keys[idx],
+      sizeof (n->keys[0]) * (size_t) (n->n - idx));
+  memmove (&n->u.children[idx + 2], &n->u.children[idx + 1],
+      sizeof (n->u.children[0]) * (size_t) (n->n - idx));
+  n->keys[idx] = *k;
+  n->u.children[idx + 1] = child;
+  n->n++;
+} /* }}} void bt_inner_insert_at */
+
+/* Removes the key at `idx' and the child to the right of it. */
+static void bt_inner_remove_at (bt_node_t *n, int idx) /* {{{ */
+{
+  memmove (&n->keys[idx], &n->keys[idx + 1],
+      sizeof (n->keys[0]) * (size_t) (n->n - idx - 1));
+  memmove (&n->u.children[idx + 1], &n->u.children[idx + 2],
+      sizeof (n->u.children[0]) * (size_t) (n->n - idx - 1));
+  n->n--;
+} /* }}} void bt_inner_remove_at */
+
+/* Inserts into the full leaf `n', moving the upper half to `right'. The
+ * smallest key of `right' is returned in `up'. */
+static void bt_leaf_split (bt_node_t *n, int idx, /* {{{ */
+    const bt_key_t *k, void *value, bt_node_t *right, bt_key_t *up)
+{
+  bt_key_t keys[BT_ORDER + 1];
+  void *values[BT_ORDER + 1];
+  int left_num = (BT_ORDER + 1) / 2;
+  int right_num = BT_ORDER + 1 - left_num;
+
+  memcpy (keys, n->keys, sizeof (keys[0]) * (size_t) idx);
+  memcpy (values, n->u.leaf.values, sizeof (values[0]) * (size_t) idx);
+  keys[idx] = *k;
+  values[idx] = value;
+  memcpy (&keys[idx + 1], &n->keys[idx],
+      sizeof (keys[0]) * (size_t) (BT_ORDER - idx));
+  memcpy (&values[idx + 1], &n->u.leaf.values[idx],
+      sizeof (values[0]) * (size_t) (BT_ORDER - idx));
+
+  memcpy (n->keys, keys, sizeof (keys[0]) * (size_t) left_num);
+  memcpy (n->u.leaf.values, values, sizeof (values[0]) * (size_t) left_num);
+  n->n = left_num;
+
+  memcpy (right->keys, &keys[left_num], sizeof (keys[0]) * (size_t) right_num);
+  memcpy (right->u.leaf.values, &values[left_num],
+      sizeof (values[0]) * (size_t) right_num);
+  right->n = right_num;
+
+  right->u.leaf.prev = n;
+  right->u.leaf.next = n->u.leaf.next;
+  if (n->u.leaf.next != NULL)
+    n->u.leaf.next->u.leaf.prev = right;
+  n->u.leaf.next = right;
+
+  *up = right->keys[0];
+} /* }}} void bt_leaf_split */
+
+/* Inserts into the full inner node `n', moving the upper half to `right'. The
+ * middle key moves up and is returned in `up'. */
+static void bt_inner_split (bt_node_t *n, int idx, /* {{{ */
+    const bt_key_t *k, bt_node_t *child, bt_node_t *right, bt_key_t *up)
+{
+  bt_key_t keys[BT_ORDER + 1];
+  bt_node_t *children[BT_ORDER + 2];
+  int left_num = BT_ORDER / 2;
+  int right_num = BT_ORDER - left_num;
+
+  memcpy (keys, n->keys, sizeof (keys[0]) * (size_t) idx);
+  keys[idx] = *k;
+  memcpy (&keys[idx + 1], &n->keys[idx],
+      sizeof (keys[0]) * (size_t) (BT_ORDER - idx));
+
+  memcpy (children, n->u.children, sizeof (children[0]) * (size_t) (idx + 1));
+  children[idx + 1] = child;
+  memcpy (&children[idx + 2], &n->u.children[idx + 1],
+      sizeof (children[0]) * (size_t) (BT_ORDER - idx));
+
+  memcpy (n->keys, keys, sizeof (keys[0]) * (size_t) left_num);
+  memcpy (n->u.children, children,
+      sizeof (children[0]) * (size_t) (left_num + 1));
+  n->n = left_num;
+
+  *up = keys[left_num];
+
+  memcpy (right->keys, &keys[left_num + 1],
+      sizeof (keys[0]) * (size_t) right_num);
+  memcpy (right->u.children, &children[left_num + 1],
+      sizeof (children[0]) * (size_t) (right_num + 1));
+  right->n = right_num;
+} /* }}} void bt_inner_split */
+
+/* Refills the node at `path[depth]', which has fewer than BT_MIN keys, from a
+ * sibling or merges it with one. Returns true if a sibling was merged, so that
+ * the parent lost a key. */
+static _Bool bt_rebalance (bt_path_t *path, int depth) /* {{{ */
+{
+  bt_node_t *parent = path[depth - 1].node;
+  int idx = path[depth - 1].index;
+  bt_node_t *n = parent->u.children[idx];
+  bt_node_t *left = (idx > 0) ? parent->u.children[idx - 1] : NULL;
+  bt_node_t *right = (idx < parent->n) ? parent->u.children[idx + 1] : NULL;
+
+  if (n->is_leaf)
+  {
+    if ((left != NULL) && (left->n > BT_MIN))
+    {
+      bt_leaf_insert_at (n, 0, &left->keys[left->n - 1],
+          left->u.leaf.values[left->n - 1]);
+      left->n--;
+      parent->keys[idx - 1] = n->keys[0];
+      return (0);
+    }
+    if ((right != NULL) && (right->n > BT_MIN))
+    {
+      bt_leaf_insert_at (n, n->n, &right->keys[0], right->u.leaf.values[0]);
+      bt_leaf_remove_at (right, 0);
+      parent->keys[idx] = right->keys[0];
+      return (0);
+    }
+
+    /* Merge the right one of the two into the left one. */
+    if (left == NULL)
+    {
+      left = n;
+      n = right;
+      idx++;
+    }
+    memcpy (&left->keys[left->n], n->keys, sizeof (n->keys[0]) * (size_t) n->n);
+    memcpy (&left->u.leaf.values[left->n], n->u.leaf.values,
+        sizeof (n->u.leaf.values[0]) * (size_t) n->n);
+    left->n += n->n;
+    left->u.leaf.next = n->u.leaf.next;
+    if (n->u.leaf.next != NULL)
+      n->u.leaf.next->u.leaf.prev = left;
+    bt_inner_remove_at (parent, idx - 1);
+    free (n);
+    return (1);
+  }
+
+  if ((left != NULL) && (left->n > BT_MIN))
+  {
+    memmove (&n->keys[1], &n->keys[0], sizeof (n->keys[0]) * (size_t) n->n);
+    memmove (&n->u.children[1], &n->u.children[0],
+        sizeof (n->u.children[0]) * (size_t) (n->n + 1));
+    n->keys[0] = parent->keys[idx - 1];
+    n->u.children[0] = left->u.children[left->n];
+    n->n++;
+    parent->keys[idx - 1] = left->keys[left->n - 1];
+    left->n--;
+    return (0);
+  }
+  if ((right != NULL) && (right->n > BT_MIN))
+  {
+    n->keys[n->n] = parent->keys[idx];
+    n->u.children[n->n + 1] = right->u.children[0];
+    n->n++;
+    parent->keys[idx] = right->keys[0];
+    memmove (&right->keys[0], &right->keys[1],
+        sizeof (right->keys[0]) * (size_t) (right->n - 1));
+    memmove (&right->u.children[0], &right->u.children[1],
+        sizeof (right->u.children[0]) * (size_t) right->n);
+    right->n--;
+    return (0);
+  }
+
+  if (left == NULL)
+  {
+    left = n;
+    n = right;
+    idx++;
+  }
+  left->keys[left->n] = parent->keys[idx - 1];
+  memcpy (&left->keys[left->n + 1], n->keys,
+      sizeof (n->keys[0]) * (size_t) n->n);
+  memcpy (&left->u.children[left->n + 1], n->u.children,
+      sizeof (n->u.children[0]) * (size_t) (n->n + 1));
+  left->n += n->n + 1;
+  bt_inner_remove_at (parent, idx - 1);
+  free (n);
+  return (1);
+} /* }}} _Bool bt_rebalance */
+
+/* Inner nodes may still point to the key which has just been removed from its
+ * leaf. Such keys are on the path to it and are replaced by the smallest key
+ * of the subtree to their right. */
+static void bt_replace_separator (c_btree_t *t, const bt_key_t *k) /* {{{ */
+{
+  bt_node_t *n = t->root;
+
+  while ((n != NULL) && !n->is_leaf)
+  {
+    _Bool found;
+    int idx;
+
+    idx = bt_lower_bound (t, n, k, &found);
+    if (found)
+    {
+      n->keys[idx] = bt_first_leaf (n->u.children[idx + 1])->keys[0];
+      idx++;
+    }
+    n = n->u.children[idx];
+  }
+} /* }}} void bt_replace_separator */
+
+/*
+ * Public functions
+ */
+c_btree_t *c_btree_create (int (*compare) (const void *, const void *)) /* {{{ */
+{
+  c_btree_t *t;
+
+  if (compare == NULL)
+    return (NULL);
+
+  t = calloc (1, sizeof (*t));
+  if (t == NULL)
+    return (NULL);
+  t->compare = compare;
+
+  return (t);
+} /* }}} c_btree_t *c_btree_create */
+
+c_btree_t *c_btree_create_string (void) /* {{{ */
+{
+  return (calloc (1, sizeof (c_btree_t)));
+} /* }}} c_btree_t *c_btree_create_string */
+
+void c_btree_destroy (c_btree_t *t) /* {{{ */
+{
+  if (t == NULL)
+    return;
+
+  bt_node_free (t->root);
+  free (t);
+} /* }}} void c_btree_destroy */
+
+int c_btree_insert (c_btree_t *t, void *key, void *value) /* {{{ */
+{
+  bt_path_t path[BT_MAX_DEPTH];
+  bt_node_t *spare[BT_MAX_DEPTH + 1];
+  int spare_num = 1;
+  int depth = 0;
+  bt_node_t *n;
+  bt_node_t *up_node;
+  bt_key_t up_key;
+  bt_key_t k;
+  _Bool found;
+  int idx;
+  int i;
+
+  if ((t == NULL) || (key == NULL))
+    return (-1);
+
+  bt_key_init (t, &k, key);
+
+  if (t->root == NULL)
+  {
+    t->root = bt_node_new (/* is_leaf = */ 1);
+    if (t->root == NULL)
+      return (-1);
+  }
+
+  n = t->root;
+  while (!n->is_leaf)
+  {
+    if (depth >= BT_MAX_DEPTH)
+      return (-1);
+    idx = bt_child_index (t, n, &k);
+    path[depth].node = n;
+    path[depth].index = idx;
+    depth++;
+    n = n->u.children[idx];
+  }
+
+  idx = bt_lower_bound (t, n, &k, &found);
+  if (found)
+    return (1);
+
+  if (n->n < BT_ORDER)
+  {
+    bt_leaf_insert_at (n, idx, &k, value);
+    t->size++;
+    return (0);
+  }
+
+  /* Allocate all nodes the splits need up front, so that a failed
+   * allocation leaves the tree untouched. */
+  for (i = depth - 1; i >= 0; i--)
+  {
+    if (path[i].node->n < BT_ORDER)
+      break;
+    spare_num++;
+  }
+  if (i < 0)
+    spare_num++; /* new root */
+  for (i = 0; i < spare_num; i++)
+  {
+    spare[i] = bt_node_new (/* is_leaf = */ i == 0);
+    if (spare[i] == NULL)
+    {
+      while (i > 0)
+        free (spare[--i]);
+      return (-1);
+    }
+  }
+
+  up_node = spare[0];
+  bt_leaf_split (n, idx, &k, value, up_node, &up_key);
+  i = 1;
+
+  while (up_node != NULL)
+  {
+    bt_node_t *parent;
+
+    if (depth == 0)
+    {
+      bt_node_t *root = spare[i++];
+
+      root->n = 1;
+      root->keys[0] = up_key;
+      root->u.children[0] = t->root;
+      root->u.children[1] = up_node;
+      t->root = root;
+      break;
+    }
+
+    depth--;
+    parent = path[depth].node;
+    idx = path[depth].index;
+
+    if (parent->n < BT_ORDER)
+    {
+      bt_inner_insert_at (parent, idx, &up_key, up_node);
+      break;
+    }
+
+    bt_inner_split (parent, idx, &up_key, up_node, spare[i], &up_key);
+    up_node = spare[i++];
+  }
+  assert (i == spare_num);
+
+  t->size++;
+  return (0);
+} /* }}} int c_btree_insert */
+
+int c_btree_remove (c_btree_t *t, const void *key, /* {{{ */
+    void **rkey, void **rvalue)
+{
+  bt_path_t path[BT_MAX_DEPTH + 1];
+  int depth = 0;
+  bt_node_t *n;
+  bt_key_t k;
+  _Bool found;
+  int idx;
+
+  if ((t == NULL) || (key == NULL) || (t->root == NULL))
+    return (-1);
+
+  bt_key_init (t, &k, key);
+
+  n = t->root;
+  while (!n->is_leaf)
+  {
+    if (depth >= BT_MAX_DEPTH)
+      return (-1);
+    idx = bt_child_index (t, n, &k);
+    path[depth].node = n;
+    path[depth].index = idx;
+    depth++;
+    n = n->u.children[idx];
+  }
+
+  idx = bt_lower_bound (t, n, &k, &found);
+  if (!found)
+    return (-1);
+
+  /* Keep the stored key: `key' may be the very pointer the caller is going to
+   * free, and is needed to find the separators to replace. */
+  k = n->keys[idx];
+  if (rkey != NULL)
+    *rkey = n->keys[idx].key;
+  if (rvalue != NULL)
+    *rvalue = n->u.leaf.values[idx];
+
+  bt_leaf_remove_at (n, idx);
+  t->size--;
+
+  while ((depth > 0) && (n->n < BT_MIN))
+  {
+    if (!bt_rebalance (path, depth))
+      break;
+    depth--;
+    n = path[depth].node;
+  }
+
+  if (t->root->n == 0)
+  {
+    bt_node_t *root = t->root;
+
+    t->root = root->is_leaf ? NULL : root->u.children[0];
+    free (root);
+  }
+
+  bt_replace_separator (t, &k);
+
+  return (0);
+} /* }}} int c_btree_remove */
+
+int c_btree_get (c_btree_t *t, const void *key, void **value) /* {{{ */
+{
+  bt_node_t *n;
+  bt_key_t k;
+  _Bool found;
+  int idx;
+
+  if ((t == NULL) || (key == NULL) || (t->root == NULL))
+    return (-1);
+
+  bt_key_init (t, &k, key);
+
+  n = t->root;
+  while (!n->is_leaf)
+    n = n->u.children[bt_child_index (t, n, &k)];
+
+  idx = bt_lower_bound (t, n, &k, &found);
+  if (!found)
+    return (-1);
+
+  if (value != NULL)
+    *value = n->u.leaf.values[idx];
+
+  return (0);
+} /* }}} int c_btree_get */
+
+int c_btree_pick (c_btree_t *t, void **key, void **value) /* {{{ */
+{
+  bt_node_t *n;
+
+  if ((t == NULL) || (key == NULL) || (value == NULL) || (t->root == NULL))
+    return (-1);
+
+  /* Taking the largest entry moves as few entries as possible. */
+  n = bt_last_leaf (t->root);
+  return (c_btree_remove (t, n->keys[n->n - 1].key, key, value));
+} /* }}} int c_btree_pick */
+
+c_btree_iterator_t *c_btree_get_iterator (c_btree_t *t) /* {{{ */
+{
+  c_btree_iterator_t *iter;
+
+  if (t == NULL)
+    return (NULL);
+
+  iter = calloc (1, sizeof (*iter));
+  if (iter == NULL)
+    return (NULL);
+  iter->tree = t;
+
+  return (iter);
+} /* }}} c_btree_iterator_t *c_btree_get_iterator */
+
+int c_btree_iterator_next (c_btree_iterator_t *iter, /* {{{ */
+    void **key, void **value)
+{
+  bt_node_t *n;
+  int idx;
+
+  if ((iter == NULL) || (key == NULL) || (value == NULL))
+    return (-1);
+
+  if (iter->node == NULL)
+  {
+    n = bt_first_leaf (iter->tree->root);
+    idx = 0;
+  }
+  else
+  {
+    n = iter->node;
+    idx = iter->index + 1;
+  }
+
+  while ((n != NULL) && (idx >= n->n))
+  {
+    n = n->u.leaf.next;
+    idx = 0;
+  }
+  if (n == NULL)
+    return (-1);
+
+  iter->node = n;
+  iter->index = idx;
+  *key = n->keys[idx].key;
+  *value = n->u.leaf.values[idx];
+
+  return (0);
+} /* }}} int c_btree_iterator_next */
+
+int c_btree_iterator_prev (c_btree_iterator_t *iter, /* {{{ */
+    void **key, void **value)
+{
+  bt_node_t *n;
+  int idx;
+
+  if ((iter == NULL) || (key == NULL) || (value == NULL))
+    return (-1);
+
+  if (iter->node == NULL)
+  {
+    n = bt_last_leaf (iter->tree->root);
+    idx = (n != NULL) ? (n->n - 1) : -1;
+  }
+  else
+  {
+    n = iter->node;
+    idx = iter->index - 1;
+  }
+
+  while ((n != NULL) && (idx < 0))
+  {
+    n = n->u.leaf.prev;
+    if (n != NULL)
+      idx = n->n - 1;
+  }
+  if (n == NULL)
+    return (-1);
+
+  iter->node = n;
+  iter->index = idx;
+  *key = n->keys[idx].key;
+  *value = n->u.leaf.values[idx];
+
+  return (0);
+} /* }}} int c_btree_iterator_prev */
+
+void c_btree_iterator_destroy (c_btree_iterator_t *iter) /* {{{ */
+{
+  free (iter);
+} /* }}} void c_btree_iterator_destroy */
+
+int c_btree_size (c_btree_t *t) /* {{{ */
+{
+  if (t == NULL)
+    return (0);
+  return (t->size);
+} /* }}} int c_btree_size */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,101 @@
+/**
+ * collectd - src/daemon/utils_btree.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_BTREE_H
+#define UTILS_BTREE_H 1
+
+/*
+ * An ordered map with the same interface as the AVL tree in utils_avltree.h.
+ * It is a B+tree: each node holds up to 32 keys in one array, so a lookup
+ * touches a few nodes instead of one node per level of a binary tree, and the
+ * leaves are linked for iteration. Trees created with c_btree_create_string()
+ * keep the first eight bytes of each key next to the key pointer and only
+ * dereference keys whose prefixes are equal.
+ *
+ * As with the AVL tree, keys are stored by pointer and not copied, and
+ * iterators become invalid when the tree is modified.
+ */
+struct c_btree_s;
+typedef struct c_btree_s c_btree_t;
+
+struct c_btree_iterator_s;
+typedef struct c_btree_iterator_s c_btree_iterator_t;
+
+/*
+ * NAME
+ *   c_btree_create
+ *
+ * DESCRIPTION
+ *   Allocates a new tree ordered by `compare', which behaves like the compare
+ *   function passed to c_avl_create().
+ *
+ * RETURN VALUE
+ *   A c_btree_t-pointer upon success or NULL upon failure.
+ */
+c_btree_t *c_btree_create (int (*compare) (const void *, const void *));
+
+/*
+ * NAME
+ *   c_btree_create_string
+ *
+ * DESCRIPTION
+ *   Allocates a new tree whose keys are null-terminated strings, ordered as
+ *   by strcmp(3). This is faster than passing strcmp() to c_btree_create().
+ *
+ * RETURN VALUE
+ *   A c_btree_t-pointer upon success or NULL upon failure.
+ */
+c_btree_t *c_btree_create_string (void);
+
+/* Frees the tree. Stored keys and values are not freed. */
+void c_btree_destroy (c_btree_t *t);
+
+/* Stores `value' under `key'. Returns zero upon success, greater than zero if
+ * the key is already stored in the tree and less than zero upon failure. */
+int c_btree_insert (c_btree_t *t, void *key, void *value);
+
+/* Removes `key' from the tree and returns the stored key and value in `rkey'
+ * and `rvalue', which may be NULL. Returns non-zero if the key isn't found. */
+int c_btree_remove (c_btree_t *t, const void *key, void **rkey, void **rvalue);
+
+/* Returns the value stored under `key' in `value', which may be NULL. Returns
+ * non-zero if the key isn't found. */
+int c_btree_get (c_btree_t *t, const void *key, void **value);
+
+/* Removes an arbitrary entry and returns its key and value, for freeing all
+ * entries one at a time. Returns non-zero if the tree is empty. */
+int c_btree_pick (c_btree_t *t, void **key, void **value);
+
+/* The iterator returns the entries in ascending order with
+ * c_btree_iterator_next() and in descending order with
+ * c_btree_iterator_prev(), starting with the smallest and largest entry,
+ * respectively. */
+c_btree_iterator_t *c_btree_get_iterator (c_btree_t *t);
+int c_btree_iterator_next (c_btree_iterator_t *iter, void **key, void **value);
+int c_btree_iterator_prev (c_btree_iterator_t *iter, void **key, void **value);
+void c_btree_iterator_destroy (c_btree_iterator_t *iter);
+
+/* Returns the number of entries in the tree, 0 if the tree is NULL. */
+int c_btree_size (c_btree_t *t);
+
+#endif /* UTILS_BTREE_H */
@@ -0,0 +1,195 @@
+/**
+ * collectd - src/daemon/utils_btree_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Compares the AVL tree with the B+tree, with strcmp() and with string keys,
+ * inserting, looking up and iterating over identifier-like keys in random
+ * order.
+ *
+ * Usage: bench_utils_btree [keys]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils_avltree.h"
+#include "utils_btree.h"
+
+typedef int (*compare_t) (const void *, const void *);
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+static void report (const char *name, const char *op, /* {{{ */
+    double start, size_t keys_num)
+{
+  printf ("%-14s %-8s %7.1f ns\n", name, op,
+      1e9 * (now () - start) / (double) keys_num);
+} /* }}} void report */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t keys_num = 1000000;
+  char **keys;
+  size_t found;
+  int status = 0;
+  size_t i;
+  int pass;
+
+  if (argc > 1)
+    keys_num = (size_t) atoi (argv[1]);
+  if (keys_num < 1)
+  {
+    fprintf (stderr, "Usage: %s [keys]\n", argv[0]);
+    return (1);
+  }
+
+  keys = calloc (keys_num, sizeof (*keys));
+  if (keys == NULL)
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+
+  srand (42);
+  for (i = 0; i < keys_num; i++)
+  {
+    char buffer[128];
+    size_t j = (size_t) rand () % (i + 1);
+
+    snprintf (buffer, sizeof (buffer),
+        "host%zu.example.com/interface-eth%zu/if_octets-%zu",
+        i % 1000, (i / 1000) % 16, i / 16000);
+    keys[i] = strdup (buffer);
+    if (keys[i] == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      return (1);
+    }
+
+    /* Shuffle while generating. */
+    if (j != i)
+    {
+      char *tmp = keys[i];
+      keys[i] = keys[j];
+      keys[j] = tmp;
+    }
+  }
+
+  for (pass = 0; pass < 3; pass++)
+  {
+    const char *names[] = { "avltree", "btree", "btree string" };
+    c_avl_tree_t *avl = NULL;
+    c_btree_t *bt = NULL;
+    void *key;
+    void *value;
+    double start;
+
+    if (pass == 0)
+      avl = c_avl_create ((compare_t) strcmp);
+    else if (pass == 1)
+      bt = c_btree_create ((compare_t) strcmp);
+    else
+      bt = c_btree_create_string ();
+    if ((avl == NULL) && (bt == NULL))
+    {
+      fprintf (stderr, "Creating the tree failed.\n");
+      return (1);
+    }
+
+    start = now ();
+    for (i = 0; i < keys_num; i++)
+    {
+      if (avl != NULL)
+        c_avl_insert (avl, keys[i], keys[i]);
+      else
+        c_btree_insert (bt, keys[i], keys[i]);
+    }
+    report (names[pass], "insert", start, keys_num);
+
+    found = 0;
+    start = now ();
+    for (i = keys_num; i > 0; i--)
+    {
+      if (avl != NULL)
+        found += (c_avl_get (avl, keys[i - 1], &value) == 0);
+      else
+        found += (c_btree_get (bt, keys[i - 1], &value) == 0);
+    }
+    report (names[pass], "get", start, keys_num);
+    if (found != keys_num)
+      status = 1;
+
+    found = 0;
+    start = now ();
+    if (avl != NULL)
+    {
+      c_avl_iterator_t *iter = c_avl_get_iterator (avl);
+      while (c_avl_iterator_next (iter, &key, &value) == 0)
+        found++;
+      c_avl_iterator_destroy (iter);
+    }
+    else
+    {
+      c_btree_iterator_t *iter = c_btree_get_iterator (bt);
+      while (c_btree_iterator_next (iter, &key, &value) == 0)
+        found++;
+      c_btree_iterator_destroy (iter);
+    }
+    report (names[pass], "iterate", start, keys_num);
+    if (found != keys_num)
+      status = 1;
+
+    start = now ();
+    if (avl != NULL)
+    {
+      while (c_avl_pick (avl, &key, &value) == 0)
+        /* do nothing */;
+      c_avl_destroy (avl);
+    }
+    else
+    {
+      while (c_btree_pick (bt, &key, &value) == 0)
+        /* do nothing */;
+      c_btree_destroy (bt);
+    }
+    report (names[pass], "pick", start, keys_num);
+  }
+
+  for (i = 0; i < keys_num; i++)
+    free (keys[i]);
+  free (keys);
+
+  return (status);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
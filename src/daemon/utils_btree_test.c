@@ -0,0 +1,254 @@
+/**
+ * collectd - src/daemon/utils_btree_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "common.h" /* STATIC_ARRAY_SIZE */
+#include "collectd.h"
+#include "testing.h"
+#include "utils_btree.h"
+
+static int compare_callback (void const *v0, void const *v1)
+{
+  assert (v0 != NULL);
+  assert (v1 != NULL);
+
+  return (strcmp (v0, v1));
+}
+
+static int compare_strings (void const *a, void const *b)
+{
+  return (strcmp (*((char * const *) a), *((char * const *) b)));
+}
+
+DEF_TEST(success)
+{
+  struct {
+    char *key;
+    char *value;
+  } cases[] = {
+    {"Eeph7chu", "vai1reiV"},
+    {"igh3Paiz", "teegh1Ee"},
+    {"caip6Uu8", "ooteQu8n"},
+    {"Aech6vah", "AijeeT0l"},
+    {"Xah0et2L", "gah8Taep"},
+    {"BocaeB8n", "oGaig8io"},
+    {"thai8AhM", "ohjeFo3f"},
+    {"ohth6ieC", "hoo8ieWo"},
+    {"aej7Woow", "phahuC2s"},
+    {"Hai8ier2", "Yie6eimi"},
+    {"phuXi3Li", "JaiF7ieb"},
+    {"Shaig5ef", "aihi5Zai"},
+    {"voh6Aith", "Oozaeto0"},
+    {"zaiP5kie", "seep5veM"},
+    {"pae7ba7D", "chie8Ojo"},
+    {"Gou2ril3", "ouVoo0ha"},
+    {"lo3Thee3", "ahDu4Zuj"},
+    {"Rah8kohv", "ieShoc7E"},
+    {"ieN5engi", "Aevou1ah"},
+    {"ooTe4OhP", "aingai5Y"},
+  };
+  int pass;
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    c_btree_t *t;
+    size_t i;
+
+    if (pass == 0)
+      CHECK_NOT_NULL (t = c_btree_create (compare_callback));
+    else
+      CHECK_NOT_NULL (t = c_btree_create_string ());
+
+    /* insert */
+    for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+    {
+      char *key;
+      char *value;
+
+      CHECK_NOT_NULL (key = strdup (cases[i].key));
+      CHECK_NOT_NULL (value = strdup (cases[i].value));
+
+      CHECK_ZERO (c_btree_insert (t, key, value));
+      EXPECT_EQ_INT ((int) (i + 1), c_btree_size (t));
+    }
+
+    /* Key already exists. */
+    for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+      EXPECT_EQ_INT (1, c_btree_insert (t, cases[i].key, cases[i].value));
+
+    /* get */
+    for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+    {
+      char *value_ret = NULL;
+
+      CHECK_ZERO (c_btree_get (t, cases[i].key, (void *) &value_ret));
+      EXPECT_EQ_STR (cases[i].value, value_ret);
+    }
+
+    /* remove half */
+    for (i = 0; i < STATIC_ARRAY_SIZE (cases) / 2; i++)
+    {
+      char *key = NULL;
+      char *value = NULL;
+
+      int expected_size = (int) (STATIC_ARRAY_SIZE (cases) - (i + 1));
+
+      CHECK_ZERO (c_btree_remove (t, cases[i].key,
+            (void *) &key, (void *) &value));
+
+      EXPECT_EQ_STR (cases[i].key, key);
+      EXPECT_EQ_STR (cases[i].value, value);
+
+      free (key);
+      free (value);
+
+      EXPECT_EQ_INT (expected_size, c_btree_size (t));
+    }
+
+    /* pick the other half */
+    for (i = STATIC_ARRAY_SIZE (cases) / 2; i < STATIC_ARRAY_SIZE (cases); i++)
+    {
+      char *key = NULL;
+      char *value = NULL;
+
+      int expected_size = (int) (STATIC_ARRAY_SIZE (cases) - (i + 1));
+
+      EXPECT_EQ_INT (expected_size + 1, c_btree_size (t));
+      EXPECT_EQ_INT (0, c_btree_pick (t, (void *) &key, (void *) &value));
+
+      free (key);
+      free (value);
+
+      EXPECT_EQ_INT (expected_size, c_btree_size (t));
+    }
+
+    EXPECT_EQ_INT (-1, c_btree_get (t, cases[0].key, NULL));
+    c_btree_destroy (t);
+  }
+
+  return (0);
+}
+
+/* Inserts and removes enough keys for several levels of inner nodes, freeing
+ * removed keys right away, and compares the order with a sorted array. The
+ * checks within the loops are counted instead of printed. */
+DEF_TEST(many)
+{
+  size_t keys_num = 10000;
+  char **keys;
+  c_btree_t *t;
+  c_btree_iterator_t *iter;
+  void *key;
+  void *value;
+  int errors;
+  size_t i;
+
+  CHECK_NOT_NULL (keys = calloc (keys_num, sizeof (*keys)));
+  CHECK_NOT_NULL (t = c_btree_create_string ());
+
+  errors = 0;
+  for (i = 0; i < keys_num; i++)
+  {
+    char buffer[64];
+
+    /* Share long prefixes, like identifiers do. */
+    snprintf (buffer, sizeof (buffer), "host%zu/cpu-%zu/cpu-%s",
+        (i * 7919) % 13, (i * 104729) % keys_num, (i % 2) ? "user" : "idle");
+    CHECK_NOT_NULL (keys[i] = strdup (buffer));
+    if (c_btree_insert (t, keys[i], keys[i]) != 0)
+      errors++;
+  }
+  EXPECT_EQ_INT (0, errors);
+  EXPECT_EQ_INT ((int) keys_num, c_btree_size (t));
+
+  /* Remove every other key, in insertion order, looking it up by a copy. */
+  for (i = 0; i < keys_num; i += 2)
+  {
+    char *rkey = NULL;
+    char *lookup;
+
+    CHECK_NOT_NULL (lookup = strdup (keys[i]));
+    if ((c_btree_remove (t, lookup, (void *) &rkey, NULL) != 0)
+        || (rkey != keys[i]))
+      errors++;
+    free (lookup);
+    free (keys[i]);
+    keys[i] = NULL;
+  }
+  EXPECT_EQ_INT (0, errors);
+  EXPECT_EQ_INT ((int) (keys_num / 2), c_btree_size (t));
+
+  for (i = 0; i < keys_num / 2; i++)
+    keys[i] = keys[2 * i + 1];
+  keys_num /= 2;
+  qsort (keys, keys_num, sizeof (*keys), compare_strings);
+
+  for (i = 0; i < keys_num; i++)
+    if ((c_btree_get (t, keys[i], &value) != 0) || (value != keys[i]))
+      errors++;
+  EXPECT_EQ_INT (0, errors);
+
+  CHECK_NOT_NULL (iter = c_btree_get_iterator (t));
+  for (i = 0; i < keys_num; i++)
+    if ((c_btree_iterator_next (iter, &key, &value) != 0) || (key != keys[i]))
+      errors++;
+  EXPECT_EQ_INT (0, errors);
+  EXPECT_EQ_INT (-1, c_btree_iterator_next (iter, &key, &value));
+  c_btree_iterator_destroy (iter);
+
+  CHECK_NOT_NULL (iter = c_btree_get_iterator (t));
+  for (i = keys_num; i > 0; i--)
+    if ((c_btree_iterator_prev (iter, &key, &value) != 0)
+        || (key != keys[i - 1]))
+      errors++;
+  EXPECT_EQ_INT (0, errors);
+  EXPECT_EQ_INT (-1, c_btree_iterator_prev (iter, &key, &value));
+  c_btree_iterator_destroy (iter);
+
+  for (i = 0; i < keys_num; i++)
+  {
+    if (c_btree_pick (t, &key, &value) != 0)
+    {
+      errors++;
+      break;
+    }
+    free (key);
+  }
+  EXPECT_EQ_INT (0, errors);
+  EXPECT_EQ_INT (0, c_btree_size (t));
+  EXPECT_EQ_INT (-1, c_btree_pick (t, &key, &value));
+
+  c_btree_destroy (t);
+  free (keys);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(success);
+  RUN_TEST(many);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
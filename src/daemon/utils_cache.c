@@ -27,16 +27,38 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
-#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_cache_shm.h"
+#include "utils_intern.h"
+#include "utils_history.h"
+#include "utils_probe.h"
 #include "meta_data.h"
 
 #include <assert.h>
 #include <pthread.h>
 
-typedef struct cache_entry_s
+#if HAVE_FNMATCH_H
+# include <fnmatch.h>
+#endif
+
+/* Number of independently locked shards. Must be a power of two. */
+#define CACHE_SHARDS_NUM 64
+#define CACHE_BUCKETS_INITIAL 64
+/* Number of value lists uc_update_batch() sorts by shard in one go. */
+#define CACHE_BATCH_CHUNK 64
+/* Number of slots of each shard's timing wheel. Must be a power of two. */
+#define CACHE_WHEEL_SIZE 256
+/* Resolution of the timing wheel: each slot covers 2^30 ticks, i.e. a little
+ * more than one second. */
+#define CACHE_WHEEL_TICK(t) ((uint64_t) ((t) >> 30))
+
+struct cache_entry_s;
+typedef struct cache_entry_s cache_entry_t;
+struct cache_entry_s
 {
-	char name[6 * DATA_MAX_NAME_LEN];
+	/* The interned identifier is the key of the entry. Its strings are shared
+	 * with all other entries and its hash selects shard and bucket. */
+	identifier_t id;
 	size_t     values_num;
 	gauge_t   *values_gauge;
 	value_t   *values_raw;
@@ -52,32 +74,280 @@ typedef struct cache_entry_s
 	int state;
 	int hits;
 
-	/*
-	 * +-----+-----+-----+-----+-----+-----+-----+-----+-----+----
-	 * !  0  !  1  !  2  !  3  !  4  !  5  !  6  !  7  !  8  ! ...
-	 * +-----+-----+-----+-----+-----+-----+-----+-----+-----+----
-	 * ! ds0 ! ds1 ! ds2 ! ds0 ! ds1 ! ds2 ! ds0 ! ds1 ! ds2 ! ...
-	 * +-----+-----+-----+-----+-----+-----+-----+-----+-----+----
-	 * !      t = 0      !      t = 1      !      t = 2      ! ...
-	 * +-----------------+-----------------+-----------------+----
-	 */
-	gauge_t *history;
-	size_t   history_index; /* points to the next position to write to. */
-	size_t   history_length;
+	/* Rates of the last updates, allocated when history is first requested.
+	 * See utils_history.h. */
+	history_t *history;
 
 	meta_data_t *meta;
-} cache_entry_t;
 
-static c_avl_tree_t   *cache_tree = NULL;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+	/* Next entry in the same hash bucket. */
+	cache_entry_t *next;
+
+	/* Time at which the entry times out, i.e.
+	 * last_update + (timeout_g * interval), and the doubly linked list of
+	 * entries sharing the same slot of the shard's timing wheel. */
+	cdtime_t       deadline;
+	cache_entry_t *wheel_prev;
+	cache_entry_t *wheel_next;
+
+	/* Slot in the shared memory table or -1, see utils_cache_shm.h. */
+	long shm_slot;
+};
 
-static int cache_compare (const cache_entry_t *a, const cache_entry_t *b)
+/* The cache is split into CACHE_SHARDS_NUM shards, each of which is a chained
+ * hash table with its own lock. The lower bits of the identifier hash select
+ * the shard, the remaining bits select the bucket within the shard. This way
+ * updates of different identifiers rarely contend for the same lock.
+ *
+ * Each shard also keeps a hashed timing wheel of its entries, indexed by
+ * deadline, so that uc_check_timeout() only has to look at the slots that
+ * became due since the last check instead of at every entry. Entries with a
+ * deadline more than CACHE_WHEEL_SIZE ticks away simply stay in their slot
+ * for another round. */
+struct cache_shard_s
 {
-#if COLLECT_DEBUG
-  assert ((a != NULL) && (b != NULL));
-#endif
-  return (strcmp (a->name, b->name));
-} /* int cache_compare */
+	pthread_mutex_t lock;
+	cache_entry_t **buckets;
+	size_t          buckets_num;
+	size_t          entries_num;
+
+	cache_entry_t  *wheel[CACHE_WHEEL_SIZE];
+	/* Last tick processed by uc_check_timeout(). */
+	uint64_t        wheel_tick;
+};
+typedef struct cache_shard_s cache_shard_t;
+
+/* The rates of one value list, see cache_rates_t. */
+struct cache_rates_entry_s
+{
+	const value_list_t *vl;
+	uint32_t        hash;
+	cdtime_t        time;
+	size_t          values_num;
+	gauge_t        *values;
+	size_t          values_size;
+};
+typedef struct cache_rates_entry_s cache_rates_entry_t;
+
+/* The rates computed by the last uc_update() or uc_update_batch() of a
+ * thread, so that write callbacks called while the value lists are
+ * dispatched don't have to look them up again. Each entry is only valid
+ * until uc_update_done() is called for its value list. The entries and
+ * their arrays are kept for the next update. */
+struct cache_rates_s
+{
+	cache_rates_entry_t *entries;
+	size_t          entries_num;
+	size_t          entries_size;
+	/* Entry found by the last uc_get_rate_dispatched(). */
+	size_t          last;
+};
+typedef struct cache_rates_s cache_rates_t;
+
+static cache_shard_t cache_shards[CACHE_SHARDS_NUM];
+static _Bool         cache_initialized = 0;
+/* Whether new histories are compressed, see uc_set_history_compression(). */
+static _Bool         history_compressed = 0;
+
+static pthread_key_t  cache_rates_key;
+static pthread_once_t cache_rates_once = PTHREAD_ONCE_INIT;
+static _Bool          cache_rates_key_ok = 0;
+
+static cache_shard_t *cache_shard (uint32_t hash) /* {{{ */
+{
+  return (&cache_shards[hash & (CACHE_SHARDS_NUM - 1)]);
+} /* }}} cache_shard_t *cache_shard */
+
+size_t uc_shard_index (uint32_t hash) /* {{{ */
+{
+  return ((size_t) (hash & (CACHE_SHARDS_NUM - 1)));
+} /* }}} size_t uc_shard_index */
+
+static size_t cache_bucket (cache_shard_t const *shard, uint32_t hash) /* {{{ */
+{
+  return ((hash / CACHE_SHARDS_NUM) & (shard->buckets_num - 1));
+} /* }}} size_t cache_bucket */
+
+/* Looks up the entry for `vl'. The shard lock must be held. */
+static cache_entry_t *cache_find_vl (cache_shard_t *shard, /* {{{ */
+    uint32_t hash, const value_list_t *vl)
+{
+  cache_entry_t *ce;
+
+  if (shard->buckets_num == 0)
+    return (NULL);
+
+  for (ce = shard->buckets[cache_bucket (shard, hash)];
+      ce != NULL; ce = ce->next)
+    if ((ce->id.hash == hash) && identifier_equal_vl (&ce->id, vl))
+      return (ce);
+
+  return (NULL);
+} /* }}} cache_entry_t *cache_find_vl */
+
+/* Looks up the entry with the formatted identifier `name'. The name is only
+ * formatted and compared if the hashes match. The shard lock must be held. */
+static cache_entry_t *cache_find_name (cache_shard_t *shard, /* {{{ */
+    uint32_t hash, const char *name)
+{
+  cache_entry_t *ce;
+
+  if (shard->buckets_num == 0)
+    return (NULL);
+
+  for (ce = shard->buckets[cache_bucket (shard, hash)];
+      ce != NULL; ce = ce->next)
+  {
+    char ce_name[6 * DATA_MAX_NAME_LEN];
+
+    if (ce->id.hash != hash)
+      continue;
+
+    if (FORMAT_ID (ce_name, sizeof (ce_name), &ce->id) != 0)
+      continue;
+
+    if (strcmp (ce_name, name) == 0)
+      return (ce);
+  }
+
+  return (NULL);
+} /* }}} cache_entry_t *cache_find_name */
+
+/* Links `ce' into the wheel slot of its deadline. The shard lock must be
+ * held. */
+static void cache_wheel_link (cache_shard_t *shard, /* {{{ */
+    cache_entry_t *ce)
+{
+  size_t slot = CACHE_WHEEL_TICK (ce->deadline) & (CACHE_WHEEL_SIZE - 1);
+
+  ce->wheel_prev = NULL;
+  ce->wheel_next = shard->wheel[slot];
+  if (ce->wheel_next != NULL)
+    ce->wheel_next->wheel_prev = ce;
+  shard->wheel[slot] = ce;
+} /* }}} void cache_wheel_link */
+
+static void cache_wheel_unlink (cache_shard_t *shard, /* {{{ */
+    cache_entry_t *ce)
+{
+  size_t slot = CACHE_WHEEL_TICK (ce->deadline) & (CACHE_WHEEL_SIZE - 1);
+
+  if (ce->wheel_prev != NULL)
+    ce->wheel_prev->wheel_next = ce->wheel_next;
+  else if (shard->wheel[slot] == ce)
+    shard->wheel[slot] = ce->wheel_next;
+
+  if (ce->wheel_next != NULL)
+    ce->wheel_next->wheel_prev = ce->wheel_prev;
+
+  ce->wheel_prev = NULL;
+  ce->wheel_next = NULL;
+} /* }}} void cache_wheel_unlink */
+
+/* Recomputes the deadline of `ce' after `last_update' or `interval' changed
+ * and moves it to the matching wheel slot. The shard lock must be held. */
+static void cache_wheel_schedule (cache_shard_t *shard, /* {{{ */
+    cache_entry_t *ce)
+{
+  cdtime_t deadline = ce->last_update + (ce->interval * timeout_g);
+
+  /* Most updates stay within the same slot.. */
+  if ((CACHE_WHEEL_TICK (deadline) & (CACHE_WHEEL_SIZE - 1))
+      == (CACHE_WHEEL_TICK (ce->deadline) & (CACHE_WHEEL_SIZE - 1)))
+  {
+    ce->deadline = deadline;
+    return;
+  }
+
+  cache_wheel_unlink (shard, ce);
+  ce->deadline = deadline;
+  cache_wheel_link (shard, ce);
+} /* }}} void cache_wheel_schedule */
+
+/* Doubles the number of buckets of a shard. The shard lock must be held. */
+static int cache_shard_grow (cache_shard_t *shard) /* {{{ */
+{
+  cache_entry_t **buckets;
+  cache_entry_t **old_buckets;
+  size_t old_num;
+  size_t i;
+
+  old_buckets = shard->buckets;
+  old_num = shard->buckets_num;
+
+  shard->buckets_num = (old_num == 0) ? CACHE_BUCKETS_INITIAL : 2 * old_num;
+  buckets = calloc (shard->buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+  {
+    shard->buckets_num = old_num;
+    return (ENOMEM);
+  }
+  shard->buckets = buckets;
+
+  for (i = 0; i < old_num; i++)
+  {
+    cache_entry_t *ce = old_buckets[i];
+
+    while (ce != NULL)
+    {
+      cache_entry_t *next = ce->next;
+      size_t idx = cache_bucket (shard, ce->id.hash);
+
+      ce->next = buckets[idx];
+      buckets[idx] = ce;
+
+      ce = next;
+    }
+  }
+
+  sfree (old_buckets);
+  return (0);
+} /* }}} int cache_shard_grow */
+
+/* Adds an entry to a shard. The shard lock must be held. */
+static int cache_shard_insert (cache_shard_t *shard, /* {{{ */
+    cache_entry_t *ce)
+{
+  size_t idx;
+
+  if (shard->entries_num >= shard->buckets_num)
+  {
+    /* If growing fails, keep using the current (longer) chains. */
+    if ((cache_shard_grow (shard) != 0) && (shard->buckets_num == 0))
+      return (ENOMEM);
+  }
+
+  idx = cache_bucket (shard, ce->id.hash);
+  ce->next = shard->buckets[idx];
+  shard->buckets[idx] = ce;
+  shard->entries_num++;
+
+  ce->deadline = ce->last_update + (ce->interval * timeout_g);
+  cache_wheel_link (shard, ce);
+
+  return (0);
+} /* }}} int cache_shard_insert */
+
+/* Removes an entry from a shard without freeing it. The shard lock must be
+ * held. */
+static void cache_shard_remove (cache_shard_t *shard, /* {{{ */
+    cache_entry_t *ce)
+{
+  cache_entry_t **prev;
+
+  for (prev = &shard->buckets[cache_bucket (shard, ce->id.hash)];
+      *prev != NULL; prev = &(*prev)->next)
+  {
+    if (*prev == ce)
+    {
+      *prev = ce->next;
+      ce->next = NULL;
+      shard->entries_num--;
+      cache_wheel_unlink (shard, ce);
+      return;
+    }
+  }
+} /* }}} void cache_shard_remove */
 
 static cache_entry_t *cache_alloc (size_t values_num)
 {
@@ -103,8 +373,8 @@ static cache_entry_t *cache_alloc (size_t values_num)
   }
 
   ce->history = NULL;
-  ce->history_length = 0;
   ce->meta = NULL;
+  ce->shm_slot = -1;
 
   return (ce);
 } /* cache_entry_t *cache_alloc */
@@ -114,9 +384,11 @@ static void cache_free (cache_entry_t *ce)
   if (ce == NULL)
     return;
 
+  uc_shm_remove (ce->shm_slot);
   sfree (ce->values_gauge);
   sfree (ce->values_raw);
-  sfree (ce->history);
+  history_destroy (ce->history);
+  identifier_destroy (&ce->id);
   if (ce->meta != NULL)
   {
     meta_data_destroy (ce->meta);
@@ -140,31 +412,27 @@ static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
   }
 } /* void uc_check_range */
 
-static int uc_insert (const data_set_t *ds, const value_list_t *vl,
-    const char *key)
+static int uc_insert (cache_shard_t *shard, const data_set_t *ds,
+    const value_list_t *vl)
 {
-  char *key_copy;
   cache_entry_t *ce;
   size_t i;
 
-  /* `cache_lock' has been locked by `uc_update' */
-
-  key_copy = strdup (key);
-  if (key_copy == NULL)
-  {
-    ERROR ("uc_insert: strdup failed.");
-    return (-1);
-  }
+  /* The shard lock has been locked by `uc_update' */
 
   ce = cache_alloc (ds->ds_num);
   if (ce == NULL)
   {
-    sfree (key_copy);
     ERROR ("uc_insert: cache_alloc (%zu) failed.", ds->ds_num);
     return (-1);
   }
 
-  sstrncpy (ce->name, key, sizeof (ce->name));
+  if (identifier_create (&ce->id, vl) != 0)
+  {
+    cache_free (ce);
+    ERROR ("uc_insert: identifier_create failed.");
+    return (-1);
+  }
 
   for (i = 0; i < ds->ds_num; i++)
   {
@@ -197,7 +465,6 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
 	/* This shouldn't happen. */
 	ERROR ("uc_insert: Don't know how to handle data source type %i.",
 	    ds->ds[i].type);
-	sfree (key_copy);
 	cache_free (ce);
 	return (-1);
     } /* switch (ds->ds[i].type) */
@@ -207,698 +474,1787 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
   uc_check_range (ds, ce);
 
   ce->last_time = vl->time;
-  ce->last_update = cdtime ();
+  ce->last_update = cdtime_coarse ();
   ce->interval = vl->interval;
   ce->state = STATE_OKAY;
 
-  if (c_avl_insert (cache_tree, key_copy, ce) != 0)
+  if (cache_shard_insert (shard, ce) != 0)
   {
-    sfree (key_copy);
-    ERROR ("uc_insert: c_avl_insert failed.");
+    cache_free (ce);
+    ERROR ("uc_insert: cache_shard_insert failed.");
     return (-1);
   }
 
-  DEBUG ("uc_insert: Added %s to the cache.", key);
+  if (uc_shm_enabled ())
+  {
+    ce->shm_slot = uc_shm_insert (vl, ce->id.hash);
+    uc_shm_update (ce->shm_slot, ce->last_time, ce->interval,
+	ce->values_gauge, ce->values_num);
+  }
+
+  DEBUG ("uc_insert: Added %s/%s/%s to the cache.",
+      vl->host, vl->plugin, vl->type);
   return (0);
 } /* int uc_insert */
 
-int uc_init (void)
+static void cache_rates_free (void *arg) /* {{{ */
 {
-  if (cache_tree == NULL)
-    cache_tree = c_avl_create ((int (*) (const void *, const void *))
-	cache_compare);
+  cache_rates_t *cr = arg;
 
-  return (0);
-} /* int uc_init */
+  size_t i;
 
-int uc_check_timeout (void)
-{
-  cdtime_t now;
-  cache_entry_t *ce;
+  if (cr == NULL)
+    return;
 
-  char **keys = NULL;
-  cdtime_t *keys_time = NULL;
-  cdtime_t *keys_interval = NULL;
-  int keys_len = 0;
+  for (i = 0; i < cr->entries_size; i++)
+    sfree (cr->entries[i].values);
+  sfree (cr->entries);
+  sfree (cr);
+} /* }}} void cache_rates_free */
 
-  char *key;
-  c_avl_iterator_t *iter;
+static void cache_rates_key_create (void) /* {{{ */
+{
+  if (pthread_key_create (&cache_rates_key, cache_rates_free) == 0)
+    cache_rates_key_ok = 1;
+  else
+    ERROR ("utils_cache: pthread_key_create failed.");
+} /* }}} void cache_rates_key_create */
 
-  int status;
-  int i;
+/* Returns the rates record of the calling thread, allocating it if `create'
+ * is true. Returns NULL if there is none. */
+static cache_rates_t *cache_rates_get (_Bool create) /* {{{ */
+{
+  cache_rates_t *cr;
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_once (&cache_rates_once, cache_rates_key_create);
+  if (!cache_rates_key_ok)
+    return (NULL);
 
-  now = cdtime ();
+  cr = pthread_getspecific (cache_rates_key);
+  if ((cr != NULL) || !create)
+    return (cr);
 
-  /* Build a list of entries to be flushed */
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) == 0)
+  cr = calloc (1, sizeof (*cr));
+  if (cr == NULL)
+    return (NULL);
+  if (pthread_setspecific (cache_rates_key, cr) != 0)
   {
-    char **tmp;
-    cdtime_t *tmp_time;
+    sfree (cr);
+    return (NULL);
+  }
+  return (cr);
+} /* }}} cache_rates_t *cache_rates_get */
 
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
+/* Forgets the rates in `cr' and makes room for `num' value lists. Returns
+ * the first entry or NULL if `cr' is NULL or out of memory. */
+static cache_rates_entry_t *cache_rates_reset (cache_rates_t *cr, /* {{{ */
+    size_t num)
+{
+  size_t i;
 
-    /* If entry has not been updated, add to `keys' array */
-    tmp = (char **) realloc ((void *) keys,
-	(keys_len + 1) * sizeof (char *));
-    if (tmp == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys = tmp;
+  if (cr == NULL)
+    return (NULL);
 
-    tmp_time = realloc (keys_time, (keys_len + 1) * sizeof (*keys_time));
-    if (tmp_time == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_time = tmp_time;
+  if (cr->entries_size < num)
+  {
+    cache_rates_entry_t *tmp;
 
-    tmp_time = realloc (keys_interval, (keys_len + 1) * sizeof (*keys_interval));
-    if (tmp_time == NULL)
+    tmp = realloc (cr->entries, num * sizeof (*tmp));
+    if (tmp == NULL)
     {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
+      cr->entries_num = 0;
+      return (NULL);
     }
-    keys_interval = tmp_time;
+    memset (tmp + cr->entries_size, 0,
+	(num - cr->entries_size) * sizeof (*tmp));
+    cr->entries = tmp;
+    cr->entries_size = num;
+  }
 
-    keys[keys_len] = strdup (key);
-    if (keys[keys_len] == NULL)
-    {
-      ERROR ("uc_check_timeout: strdup failed.");
-      continue;
-    }
-    keys_time[keys_len] = ce->last_time;
-    keys_interval[keys_len] = ce->interval;
+  for (i = 0; i < num; i++)
+    cr->entries[i].vl = NULL;
+  cr->entries_num = num;
+  cr->last = 0;
 
-    keys_len++;
-  } /* while (c_avl_iterator_next) */
+  return (cr->entries);
+} /* }}} cache_rates_entry_t *cache_rates_reset */
 
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+/* Remembers the rates of `ce' for `vl'. The shard lock must be held. */
+static void cache_rates_set (cache_rates_entry_t *cre, /* {{{ */
+    cache_entry_t *ce, uint32_t hash, const value_list_t *vl)
+{
+  if ((cre == NULL) || (ce == NULL) || (ce->state == STATE_MISSING))
+    return;
 
-  if (keys_len == 0)
+  if (cre->values_size < ce->values_num)
   {
-    /* realloc() may have been called for these. */
-    sfree (keys);
-    sfree (keys_time);
-    sfree (keys_interval);
-    return (0);
+    gauge_t *tmp = realloc (cre->values, ce->values_num * sizeof (*tmp));
+    if (tmp == NULL)
+      return;
+    cre->values = tmp;
+    cre->values_size = ce->values_num;
   }
+  memcpy (cre->values, ce->values_gauge, ce->values_num * sizeof (gauge_t));
 
-  /* Call the "missing" callback for each value. Do this before removing the
-   * value from the cache, so that callbacks can still access the data stored,
-   * including plugin specific meta data, rates, history, …. This must be done
-   * without holding the lock, otherwise we will run into a deadlock if a
-   * plugin calls the cache interface. */
-  for (i = 0; i < keys_len; i++)
-  {
-    value_list_t vl = VALUE_LIST_INIT;
+  cre->vl = vl;
+  cre->hash = hash;
+  cre->time = vl->time;
+  cre->values_num = ce->values_num;
+} /* }}} void cache_rates_set */
 
-    vl.values = NULL;
-    vl.values_len = 0;
-    vl.meta = NULL;
+/* Returns the entry of `cr' remembering `vl', or NULL. */
+static cache_rates_entry_t *cache_rates_find (cache_rates_t *cr, /* {{{ */
+    const value_list_t *vl)
+{
+  size_t i;
 
-    status = parse_identifier_vl (keys[i], &vl);
-    if (status != 0)
+  if ((cr == NULL) || (vl == NULL))
+    return (NULL);
+
+  /* Value lists are usually dispatched in the order they were updated, so
+   * start looking at the one after the last match. */
+  for (i = 0; i < cr->entries_num; i++)
+  {
+    size_t idx = (cr->last + i) % cr->entries_num;
+
+    if (cr->entries[idx].vl == vl)
     {
-      ERROR ("uc_check_timeout: parse_identifier_vl (\"%s\") failed.", keys[i]);
-      continue;
+      cr->last = idx;
+      return (cr->entries + idx);
     }
+  }
 
-    vl.time = keys_time[i];
-    vl.interval = keys_interval[i];
+  return (NULL);
+} /* }}} cache_rates_entry_t *cache_rates_find */
 
-    plugin_dispatch_missing (&vl);
-  } /* for (i = 0; i < keys_len; i++) */
+void uc_set_history_compression (_Bool compressed) /* {{{ */
+{
+  history_compressed = compressed;
+} /* }}} void uc_set_history_compression */
 
-  /* Now actually remove all the values from the cache. We don't re-evaluate
-   * the timestamp again, so in theory it is possible we remove a value after
-   * it is updated here. */
-  pthread_mutex_lock (&cache_lock);
-  for (i = 0; i < keys_len; i++)
+int uc_init (void)
+{
+  size_t i;
+
+  if (cache_initialized)
+    return (0);
+
+  for (i = 0; i < CACHE_SHARDS_NUM; i++)
   {
-    key = NULL;
-    ce = NULL;
+    memset (&cache_shards[i], 0, sizeof (cache_shards[i]));
+    pthread_mutex_init (&cache_shards[i].lock, /* attr = */ NULL);
+  }
+  cache_initialized = 1;
 
-    status = c_avl_remove (cache_tree, keys[i],
-	(void *) &key, (void *) &ce);
-    if (status != 0)
-    {
-      ERROR ("uc_check_timeout: c_avl_remove (\"%s\") failed.", keys[i]);
-      sfree (keys[i]);
-      continue;
-    }
+  return (0);
+} /* int uc_init */
 
-    sfree (keys[i]);
-    sfree (key);
-    cache_free (ce);
-  } /* for (i = 0; i < keys_len; i++) */
-  pthread_mutex_unlock (&cache_lock);
+/*
+ * Cache file
+ *
+ * The file starts with a cache_file_header_t, followed by one record per
+ * entry: a cache_file_entry_t, the five identifier fields without
+ * terminating null bytes, "values_num" raw values and "values_num" rates.
+ * Numbers are stored in host byte order; the file is only meant to be read
+ * by the same build on the same host.
+ */
+#define CACHE_FILE_MAGIC "CDCACHE"
+#define CACHE_FILE_VERSION 1
+#define CACHE_FILE_VALUES_MAX 1024
+
+struct cache_file_header_s
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+};
+typedef struct cache_file_header_s cache_file_header_t;
+
+struct cache_file_entry_s
+{
+	uint16_t field_len[5];
+	uint16_t values_num;
+	int32_t  state;
+	int32_t  hits;
+	uint64_t last_time;
+	uint64_t last_update;
+	uint64_t interval;
+};
+typedef struct cache_file_entry_s cache_file_entry_t;
+
+/* Writes one entry to the cache file. The shard lock must be held. */
+static int cache_file_write_entry (FILE *fh, cache_entry_t const *ce) /* {{{ */
+{
+  char const *fields[] = { ce->id.host, ce->id.plugin, ce->id.plugin_instance,
+    ce->id.type, ce->id.type_instance };
+  cache_file_entry_t fe;
+  size_t i;
 
-  sfree (keys);
-  sfree (keys_time);
-  sfree (keys_interval);
+  memset (&fe, 0, sizeof (fe));
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+    fe.field_len[i] = (uint16_t) strlen (fields[i]);
+  fe.values_num = (uint16_t) ce->values_num;
+  fe.state = (int32_t) ce->state;
+  fe.hits = (int32_t) ce->hits;
+  fe.last_time = (uint64_t) ce->last_time;
+  fe.last_update = (uint64_t) ce->last_update;
+  fe.interval = (uint64_t) ce->interval;
+
+  if (fwrite (&fe, sizeof (fe), 1, fh) != 1)
+    return (-1);
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+    if ((fe.field_len[i] > 0)
+	&& (fwrite (fields[i], fe.field_len[i], 1, fh) != 1))
+      return (-1);
+  if (fwrite (ce->values_raw, sizeof (*ce->values_raw), ce->values_num, fh)
+      != ce->values_num)
+    return (-1);
+  if (fwrite (ce->values_gauge, sizeof (*ce->values_gauge), ce->values_num,
+	fh) != ce->values_num)
+    return (-1);
 
   return (0);
-} /* int uc_check_timeout */
+} /* }}} int cache_file_write_entry */
 
-int uc_update (const data_set_t *ds, const value_list_t *vl)
+int uc_persist (const char *file) /* {{{ */
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
-  int status;
+  char tmp_file[4096];
+  cache_file_header_t header;
+  FILE *fh;
+  size_t entries_num = 0;
+  int status = 0;
   size_t i;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (file == NULL)
+    return (EINVAL);
+
+  status = ssnprintf (tmp_file, sizeof (tmp_file), "%s.tmp", file);
+  if ((status < 0) || ((size_t) status >= sizeof (tmp_file)))
   {
-    ERROR ("uc_update: FORMAT_VL failed.");
-    return (-1);
+    ERROR ("uc_persist: File name \"%s\" is too long.", file);
+    return (ENAMETOOLONG);
+  }
+  status = 0;
+  fh = fopen (tmp_file, "w");
+  if (fh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("uc_persist: fopen (%s) failed: %s", tmp_file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (errno);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, CACHE_FILE_MAGIC, sizeof (CACHE_FILE_MAGIC));
+  header.version = CACHE_FILE_VERSION;
+  header.entry_size = (uint32_t) sizeof (cache_file_entry_t);
+  if (fwrite (&header, sizeof (header), 1, fh) != 1)
+    status = -1;
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0) /* entry does not yet exist */
+  for (i = 0; (i < CACHE_SHARDS_NUM) && (status == 0); i++)
   {
-    status = uc_insert (ds, vl, name);
-    pthread_mutex_unlock (&cache_lock);
-    return (status);
+    cache_shard_t *shard = &cache_shards[i];
+    size_t j;
+
+    pthread_mutex_lock (&shard->lock);
+    for (j = 0; (j < shard->buckets_num) && (status == 0); j++)
+    {
+      cache_entry_t *ce;
+
+      for (ce = shard->buckets[j]; ce != NULL; ce = ce->next)
+      {
+	if ((ce->state == STATE_MISSING)
+	    || (ce->values_num > CACHE_FILE_VALUES_MAX))
+	  continue;
+
+	status = cache_file_write_entry (fh, ce);
+	if (status != 0)
+	  break;
+	entries_num++;
+      }
+    }
+    pthread_mutex_unlock (&shard->lock);
   }
 
-  assert (ce != NULL);
-  assert (ce->values_num == ds->ds_num);
+  if (fclose (fh) != 0)
+    status = -1;
 
-  if (ce->last_time >= vl->time)
+  if (status != 0)
   {
-    pthread_mutex_unlock (&cache_lock);
-    NOTICE ("uc_update: Value too old: name = %s; value time = %.3f; "
-	"last cache update = %.3f;",
-	name,
-	CDTIME_T_TO_DOUBLE (vl->time),
-	CDTIME_T_TO_DOUBLE (ce->last_time));
-    return (-1);
+    ERROR ("uc_persist: Writing \"%s\" failed.", tmp_file);
+    unlink (tmp_file);
+    return (status);
   }
 
-  for (i = 0; i < ds->ds_num; i++)
+  if (rename (tmp_file, file) != 0)
   {
-    switch (ds->ds[i].type)
-    {
-      case DS_TYPE_COUNTER:
-	{
-	  counter_t diff = counter_diff (ce->values_raw[i].counter, vl->values[i].counter);
-	  ce->values_gauge[i] = ((double) diff)
-	    / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
-	  ce->values_raw[i].counter = vl->values[i].counter;
-	}
-	break;
+    char errbuf[1024];
+    ERROR ("uc_persist: rename (%s, %s) failed: %s", tmp_file, file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    unlink (tmp_file);
+    return (-1);
+  }
 
-      case DS_TYPE_GAUGE:
-	ce->values_raw[i].gauge = vl->values[i].gauge;
-	ce->values_gauge[i] = vl->values[i].gauge;
-	break;
+  INFO ("uc_persist: Wrote %zu entries to \"%s\".", entries_num, file);
+  return (0);
+} /* }}} int uc_persist */
+
+/* Reads one entry from the cache file. Returns zero on success, a negative
+ * value at the end of the file and a positive value if the file is
+ * corrupt. */
+static int cache_file_read_entry (FILE *fh, /* {{{ */
+    cache_file_entry_t *fe, value_list_t *vl,
+    value_t *values_raw, gauge_t *values_gauge)
+{
+  char *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  size_t i;
 
-      case DS_TYPE_DERIVE:
-	{
-	  derive_t diff = vl->values[i].derive - ce->values_raw[i].derive;
+  if (fread (fe, sizeof (*fe), 1, fh) != 1)
+    return (feof (fh) ? -1 : 1);
 
-	  ce->values_gauge[i] = ((double) diff)
-	    / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
-	  ce->values_raw[i].derive = vl->values[i].derive;
-	}
-	break;
+  if ((fe->values_num == 0) || (fe->values_num > CACHE_FILE_VALUES_MAX))
+    return (1);
 
-      case DS_TYPE_ABSOLUTE:
-	ce->values_gauge[i] = ((double) vl->values[i].absolute)
-	  / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
-	ce->values_raw[i].absolute = vl->values[i].absolute;
-	break;
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+  {
+    if (fe->field_len[i] >= DATA_MAX_NAME_LEN)
+      return (1);
+    if ((fe->field_len[i] > 0)
+	&& (fread (fields[i], fe->field_len[i], 1, fh) != 1))
+      return (1);
+    fields[i][fe->field_len[i]] = 0;
+  }
 
-      default:
-	/* This shouldn't happen. */
-	pthread_mutex_unlock (&cache_lock);
-	ERROR ("uc_update: Don't know how to handle data source type %i.",
-	    ds->ds[i].type);
-	return (-1);
-    } /* switch (ds->ds[i].type) */
+  if (fread (values_raw, sizeof (*values_raw), fe->values_num, fh)
+      != fe->values_num)
+    return (1);
+  if (fread (values_gauge, sizeof (*values_gauge), fe->values_num, fh)
+      != fe->values_num)
+    return (1);
 
-    DEBUG ("uc_update: %s: ds[%zu] = %lf", name, i, ce->values_gauge[i]);
-  } /* for (i) */
+  return (0);
+} /* }}} int cache_file_read_entry */
 
-  /* Update the history if it exists. */
-  if (ce->history != NULL)
-  {
-    assert (ce->history_index < ce->history_length);
-    for (i = 0; i < ce->values_num; i++)
-    {
-      size_t hist_idx = (ce->values_num * ce->history_index) + i;
-      ce->history[hist_idx] = ce->values_gauge[i];
-    }
+int uc_restore (const char *file) /* {{{ */
+{
+  cache_file_header_t header;
+  value_t values_raw[CACHE_FILE_VALUES_MAX];
+  gauge_t values_gauge[CACHE_FILE_VALUES_MAX];
+  FILE *fh;
+  cdtime_t now;
+  size_t restored = 0;
+  size_t expired = 0;
+  int status = 0;
 
-    assert (ce->history_length > 0);
-    ce->history_index = (ce->history_index + 1) % ce->history_length;
-  }
+  if (file == NULL)
+    return (EINVAL);
+
+  fh = fopen (file, "r");
+  if (fh == NULL)
+  {
+    char errbuf[1024];
+
+    /* There is no cache file before the first shutdown. */
+    if (errno == ENOENT)
+      return (0);
+
+    ERROR ("uc_restore: fopen (%s) failed: %s", file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (errno);
+  }
+
+  if ((fread (&header, sizeof (header), 1, fh) != 1)
+      || (memcmp (header.magic, CACHE_FILE_MAGIC,
+	  sizeof (CACHE_FILE_MAGIC)) != 0)
+      || (header.version != CACHE_FILE_VERSION)
+      || (header.entry_size != sizeof (cache_file_entry_t)))
+  {
+    ERROR ("uc_restore: \"%s\" is not a cache file written by this "
+	"version of collectd. Ignoring it.", file);
+    fclose (fh);
+    return (-1);
+  }
+
+  now = cdtime_coarse ();
+  while (42)
+  {
+    cache_file_entry_t fe;
+    value_list_t vl = VALUE_LIST_INIT;
+    cache_shard_t *shard;
+    cache_entry_t *ce;
+    uint32_t hash;
+
+    status = cache_file_read_entry (fh, &fe, &vl, values_raw, values_gauge);
+    if (status != 0)
+      break;
+
+    /* Discard entries which would have timed out by now. */
+    if ((fe.last_update + (fe.interval * timeout_g)) < now)
+    {
+      expired++;
+      continue;
+    }
+
+    ce = cache_alloc (fe.values_num);
+    if (ce == NULL)
+    {
+      status = ENOMEM;
+      break;
+    }
+    if (identifier_create (&ce->id, &vl) != 0)
+    {
+      cache_free (ce);
+      status = ENOMEM;
+      break;
+    }
+    memcpy (ce->values_raw, values_raw, fe.values_num * sizeof (*values_raw));
+    memcpy (ce->values_gauge, values_gauge,
+	fe.values_num * sizeof (*values_gauge));
+    ce->last_time = (cdtime_t) fe.last_time;
+    ce->last_update = (cdtime_t) fe.last_update;
+    ce->interval = (cdtime_t) fe.interval;
+    ce->state = (int) fe.state;
+    ce->hits = (int) fe.hits;
+
+    hash = ce->id.hash;
+    shard = cache_shard (hash);
+
+    pthread_mutex_lock (&shard->lock);
+    if ((cache_find_vl (shard, hash, &vl) != NULL)
+	|| (cache_shard_insert (shard, ce) != 0))
+    {
+      pthread_mutex_unlock (&shard->lock);
+      cache_free (ce);
+      continue;
+    }
+    if (uc_shm_enabled ())
+    {
+      vl.values_len = ce->values_num;
+      ce->shm_slot = uc_shm_insert (&vl, hash);
+      uc_shm_update (ce->shm_slot, ce->last_time, ce->interval,
+	  ce->values_gauge, ce->values_num);
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    restored++;
+  }
+
+  fclose (fh);
+
+  if (status > 0)
+    ERROR ("uc_restore: \"%s\" is corrupt or could not be read completely.",
+	file);
+
+  INFO ("uc_restore: Restored %zu entries from \"%s\", discarded %zu "
+      "expired entries.", restored, file, expired);
+  return ((status > 0) ? status : 0);
+} /* }}} int uc_restore */
+
+int uc_check_timeout (void)
+{
+  cdtime_t now;
+
+  value_list_t *expired = NULL;
+  size_t expired_num = 0;
+  size_t expired_size = 0;
+
+  size_t i;
+
+  /* The deadlines are based on coarse last_update times. */
+  now = cdtime_coarse ();
+
+  /* Build a list of entries to be flushed. Only one shard is locked at a
+   * time, so concurrent updates of other shards are not blocked. Only the
+   * wheel slots that became due since the last run are visited. */
+  for (i = 0; i < CACHE_SHARDS_NUM; i++)
+  {
+    cache_shard_t *shard = &cache_shards[i];
+    uint64_t now_tick = CACHE_WHEEL_TICK (now);
+    uint64_t tick;
+    uint64_t first_tick;
+
+    pthread_mutex_lock (&shard->lock);
+
+    /* The current slot is visited again next time, since it may still hold
+     * entries that become due later during this tick. */
+    first_tick = shard->wheel_tick;
+    if ((now_tick - first_tick) >= CACHE_WHEEL_SIZE)
+      first_tick = now_tick - (CACHE_WHEEL_SIZE - 1);
+
+    for (tick = first_tick; tick <= now_tick; tick++)
+    {
+      cache_entry_t *ce;
+
+      for (ce = shard->wheel[tick & (CACHE_WHEEL_SIZE - 1)];
+	  ce != NULL; ce = ce->wheel_next)
+      {
+	value_list_t *vl;
+
+	/* If the entry is fresh enough, continue. This also skips entries
+	 * which are due in a later round of the wheel. */
+	if (ce->deadline > now)
+	  continue;
+
+	if (expired_num >= expired_size)
+	{
+	  size_t new_size = (expired_size == 0) ? 16 : 2 * expired_size;
+	  value_list_t *tmp;
+
+	  tmp = realloc (expired, new_size * sizeof (*expired));
+	  if (tmp == NULL)
+	  {
+	    ERROR ("uc_check_timeout: realloc failed.");
+	    continue;
+	  }
+	  expired = tmp;
+	  expired_size = new_size;
+	}
+
+	vl = &expired[expired_num];
+	memset (vl, 0, sizeof (*vl));
+	identifier_to_vl (&ce->id, vl);
+	vl->time = ce->last_time;
+	vl->interval = ce->interval;
+
+	expired_num++;
+      }
+    }
+
+    shard->wheel_tick = now_tick;
+    pthread_mutex_unlock (&shard->lock);
+  } /* for (i = 0; i < CACHE_SHARDS_NUM; i++) */
+
+  if (expired_num == 0)
+  {
+    /* realloc() may have been called. */
+    sfree (expired);
+    return (0);
+  }
+
+  /* Call the "missing" callback for each value. Do this before removing the
+   * value from the cache, so that callbacks can still access the data stored,
+   * including plugin specific meta data, rates, history, …. This must be done
+   * without holding the lock, otherwise we will run into a deadlock if a
+   * plugin calls the cache interface. */
+  for (i = 0; i < expired_num; i++)
+    plugin_dispatch_missing (&expired[i]);
+
+  /* Now actually remove all the values from the cache. We don't re-evaluate
+   * the timestamp again, so in theory it is possible we remove a value after
+   * it is updated here. */
+  for (i = 0; i < expired_num; i++)
+  {
+    uint32_t hash = identifier_hash_vl (&expired[i]);
+    cache_shard_t *shard = cache_shard (hash);
+    cache_entry_t *ce;
+
+    pthread_mutex_lock (&shard->lock);
+    ce = cache_find_vl (shard, hash, &expired[i]);
+    if (ce != NULL)
+      cache_shard_remove (shard, ce);
+    pthread_mutex_unlock (&shard->lock);
+
+    if (ce == NULL)
+    {
+      ERROR ("uc_check_timeout: Entry %s/%s/%s vanished from the cache.",
+	  expired[i].host, expired[i].plugin, expired[i].type);
+      continue;
+    }
+
+    cache_free (ce);
+  } /* for (i = 0; i < expired_num; i++) */
+
+  sfree (expired);
+
+  return (0);
+} /* int uc_check_timeout */
+
+/* Updates the entry of `vl' in `shard', creating it if necessary, and
+ * remembers the new rates in `cre'. The shard lock must be held. Returns
+ * ERANGE and the time of the entry in `ret_last_time' if `vl' is not newer
+ * than the entry. `ret_created' is set if a new entry was created. */
+static int uc_update_locked (cache_shard_t *shard, uint32_t hash, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl,
+    cache_rates_entry_t *cre, _Bool *ret_created, cdtime_t *ret_last_time)
+{
+  cache_entry_t *ce;
+  int status;
+  size_t i;
+
+  *ret_created = 0;
+
+  ce = cache_find_vl (shard, hash, vl);
+
+  /* Entries restored by uc_restore() may predate a change of the data set. */
+  if ((ce != NULL) && (ce->values_num != ds->ds_num))
+  {
+    cache_shard_remove (shard, ce);
+    cache_free (ce);
+    ce = NULL;
+  }
+
+  if (ce == NULL) /* entry does not yet exist */
+  {
+    *ret_created = 1;
+    status = uc_insert (shard, ds, vl);
+    if (status == 0)
+      cache_rates_set (cre, cache_find_vl (shard, hash, vl), hash, vl);
+    return (status);
+  }
+
+  if (ce->last_time >= vl->time)
+  {
+    *ret_last_time = ce->last_time;
+    return (ERANGE);
+  }
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    switch (ds->ds[i].type)
+    {
+      case DS_TYPE_COUNTER:
+	{
+	  counter_t diff = counter_diff (ce->values_raw[i].counter, vl->values[i].counter);
+	  ce->values_gauge[i] = ((double) diff)
+	    / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
+	  ce->values_raw[i].counter = vl->values[i].counter;
+	}
+	break;
+
+      case DS_TYPE_GAUGE:
+	ce->values_raw[i].gauge = vl->values[i].gauge;
+	ce->values_gauge[i] = vl->values[i].gauge;
+	break;
+
+      case DS_TYPE_DERIVE:
+	{
+	  derive_t diff = vl->values[i].derive - ce->values_raw[i].derive;
+
+	  ce->values_gauge[i] = ((double) diff)
+	    / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
+	  ce->values_raw[i].derive = vl->values[i].derive;
+	}
+	break;
+
+      case DS_TYPE_ABSOLUTE:
+	ce->values_gauge[i] = ((double) vl->values[i].absolute)
+	  / (CDTIME_T_TO_DOUBLE (vl->time - ce->last_time));
+	ce->values_raw[i].absolute = vl->values[i].absolute;
+	break;
+
+      default:
+	/* This shouldn't happen. */
+	ERROR ("uc_update: Don't know how to handle data source type %i.",
+	    ds->ds[i].type);
+	return (-1);
+    } /* switch (ds->ds[i].type) */
+
+    DEBUG ("uc_update: %s/%s/%s: ds[%zu] = %lf",
+	vl->host, vl->plugin, vl->type, i, ce->values_gauge[i]);
+  } /* for (i) */
+
+  /* Update the history if it exists. */
+  if (ce->history != NULL)
+    history_append (ce->history, ce->values_gauge);
 
   /* Prune invalid gauge data */
   uc_check_range (ds, ce);
 
   ce->last_time = vl->time;
-  ce->last_update = cdtime ();
+  ce->last_update = cdtime_coarse ();
   ce->interval = vl->interval;
+  cache_wheel_schedule (shard, ce);
 
-  pthread_mutex_unlock (&cache_lock);
+  uc_shm_update (ce->shm_slot, ce->last_time, ce->interval,
+      ce->values_gauge, ce->values_num);
+
+  cache_rates_set (cre, ce, hash, vl);
 
   return (0);
+} /* }}} int uc_update_locked */
+
+static void uc_update_too_old (const value_list_t *vl, /* {{{ */
+    cdtime_t last_time)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+
+  FORMAT_VL (name, sizeof (name), vl);
+  NOTICE ("uc_update: Value too old: name = %s; value time = %.3f; "
+      "last cache update = %.3f;",
+      name,
+      CDTIME_T_TO_DOUBLE (vl->time),
+      CDTIME_T_TO_DOUBLE (last_time));
+} /* }}} void uc_update_too_old */
+
+int uc_update (const data_set_t *ds, const value_list_t *vl)
+{
+  uint32_t hash;
+  cache_shard_t *shard;
+  cache_rates_entry_t *cre;
+  cdtime_t last_time = 0;
+  _Bool created = 0;
+  int status;
+
+  cre = cache_rates_reset (cache_rates_get (/* create = */ 1), 1);
+
+  hash = identifier_hash_vl (vl);
+  shard = cache_shard (hash);
+
+  pthread_mutex_lock (&shard->lock);
+  status = uc_update_locked (shard, hash, ds, vl, cre, &created, &last_time);
+  pthread_mutex_unlock (&shard->lock);
+
+  if (status == ERANGE)
+  {
+    uc_update_too_old (vl, last_time);
+    return (-1);
+  }
+
+  PROBE3 (cache_update, vl->plugin, vl->type, created);
+  return (status);
 } /* int uc_update */
 
-int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num)
+/* Updates "num" value lists of one chunk of uc_update_batch(). */
+static int uc_update_chunk (const data_set_t * const *ds, /* {{{ */
+    const value_list_t * const *vl, size_t num, cache_rates_entry_t *cre)
+{
+  uint32_t hash[CACHE_BATCH_CHUNK];
+  cdtime_t last_time[CACHE_BATCH_CHUNK];
+  int status[CACHE_BATCH_CHUNK];
+  _Bool created[CACHE_BATCH_CHUNK];
+  /* Indices of the value lists, grouped by shard. */
+  uint8_t order[CACHE_BATCH_CHUNK];
+  size_t start[CACHE_SHARDS_NUM + 1];
+  size_t i;
+  size_t j;
+  int ret = 0;
+
+  assert (num <= CACHE_BATCH_CHUNK);
+
+  memset (start, 0, sizeof (start));
+  for (i = 0; i < num; i++)
+  {
+    hash[i] = identifier_hash_vl (vl[i]);
+    start[uc_shard_index (hash[i]) + 1]++;
+  }
+  for (j = 1; j <= CACHE_SHARDS_NUM; j++)
+    start[j] += start[j - 1];
+
+  /* Stable, so updates of the same identifier keep their order. "start"
+   * ends up pointing to the end of each group. */
+  for (i = 0; i < num; i++)
+    order[start[uc_shard_index (hash[i])]++] = (uint8_t) i;
+
+  for (i = 0; i < num; )
+  {
+    size_t shard_idx = uc_shard_index (hash[order[i]]);
+    cache_shard_t *shard = &cache_shards[shard_idx];
+
+    pthread_mutex_lock (&shard->lock);
+    for (; i < start[shard_idx]; i++)
+    {
+      size_t k = order[i];
+
+      status[k] = uc_update_locked (shard, hash[k], ds[k], vl[k],
+	  (cre != NULL) ? cre + k : NULL, &created[k], &last_time[k]);
+    }
+    pthread_mutex_unlock (&shard->lock);
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    if (status[i] == ERANGE)
+      uc_update_too_old (vl[i], last_time[i]);
+    else
+      PROBE3 (cache_update, vl[i]->plugin, vl[i]->type, created[i]);
+
+    if (status[i] != 0)
+      ret = -1;
+  }
+
+  return (ret);
+} /* }}} int uc_update_chunk */
+
+int uc_update_batch (const data_set_t * const *ds, /* {{{ */
+    const value_list_t * const *vl, size_t num)
+{
+  cache_rates_entry_t *cre;
+  size_t offset;
+  int ret = 0;
+
+  cre = cache_rates_reset (cache_rates_get (/* create = */ 1), num);
+
+  for (offset = 0; offset < num; offset += CACHE_BATCH_CHUNK)
+  {
+    size_t chunk = num - offset;
+
+    if (chunk > CACHE_BATCH_CHUNK)
+      chunk = CACHE_BATCH_CHUNK;
+
+    if (uc_update_chunk (ds + offset, vl + offset, chunk,
+	  (cre != NULL) ? cre + offset : NULL) != 0)
+      ret = -1;
+  }
+
+  return (ret);
+} /* }}} int uc_update_batch */
+
+void uc_update_done (const value_list_t *vl) /* {{{ */
+{
+  cache_rates_entry_t *cre;
+
+  /* Only forget our own rates: a nested dispatch may have replaced them. */
+  cre = cache_rates_find (cache_rates_get (/* create = */ 0), vl);
+  if (cre != NULL)
+    cre->vl = NULL;
+} /* }}} void uc_update_done */
+
+const gauge_t *uc_get_rate_dispatched (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
+{
+  cache_rates_entry_t *cre;
+
+  cre = cache_rates_find (cache_rates_get (/* create = */ 0), vl);
+  if (cre == NULL)
+    return (NULL);
+
+  /* Filter chain targets may have changed the value list since. */
+  if ((cre->time != vl->time)
+      || (cre->values_num != ds->ds_num)
+      || (cre->hash != identifier_hash_vl (vl)))
+    return (NULL);
+
+  return (cre->values);
+} /* }}} const gauge_t *uc_get_rate_dispatched */
+
+/* Copies the current rates of `ce'. The shard lock must be held. */
+static int uc_copy_rate (cache_entry_t *ce, /* {{{ */
+    gauge_t **ret_values, size_t *ret_values_num)
+{
+  gauge_t *ret;
+
+  /* remove missing values from getval */
+  if (ce->state == STATE_MISSING)
+    return (-1);
+
+  ret = malloc (ce->values_num * sizeof (*ret));
+  if (ret == NULL)
+  {
+    ERROR ("utils_cache: uc_copy_rate: malloc failed.");
+    return (-1);
+  }
+  memcpy (ret, ce->values_gauge, ce->values_num * sizeof (gauge_t));
+
+  *ret_values = ret;
+  *ret_values_num = ce->values_num;
+  return (0);
+} /* }}} int uc_copy_rate */
+
+int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num)
+{
+  uint32_t hash;
+  cache_shard_t *shard;
+  cache_entry_t *ce = NULL;
+  int status = 0;
+
+  hash = identifier_hash_name (name);
+  shard = cache_shard (hash);
+
+  pthread_mutex_lock (&shard->lock);
+
+  ce = cache_find_name (shard, hash, name);
+  if (ce != NULL)
+    status = uc_copy_rate (ce, ret_values, ret_values_num);
+  else
+  {
+    DEBUG ("utils_cache: uc_get_rate_by_name: No such value: %s", name);
+    status = -1;
+  }
+
+  pthread_mutex_unlock (&shard->lock);
+
+  return (status);
+} /* gauge_t *uc_get_rate_by_name */
+
+gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
+{
+  uint32_t hash;
+  cache_shard_t *shard;
+  cache_entry_t *ce;
+  gauge_t *ret = NULL;
+  size_t ret_num = 0;
+  int status = -1;
+  const gauge_t *rates;
+
+  rates = uc_get_rate_dispatched (ds, vl);
+  if (rates != NULL)
+  {
+    ret = malloc (ds->ds_num * sizeof (*ret));
+    if (ret == NULL)
+    {
+      ERROR ("utils_cache: uc_get_rate: malloc failed.");
+      return (NULL);
+    }
+    memcpy (ret, rates, ds->ds_num * sizeof (*ret));
+    return (ret);
+  }
+
+  hash = identifier_hash_vl (vl);
+  shard = cache_shard (hash);
+
+  pthread_mutex_lock (&shard->lock);
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce != NULL)
+    status = uc_copy_rate (ce, &ret, &ret_num);
+  pthread_mutex_unlock (&shard->lock);
+
+  if (status != 0)
+    return (NULL);
+
+  /* This is important - the caller has no other way of knowing how many
+   * values are returned. */
+  if (ret_num != (size_t) ds->ds_num)
+  {
+    ERROR ("utils_cache: uc_get_rate: ds[%s] has %zu values, "
+	"but the cache contains %zu.",
+	ds->type, ds->ds_num, ret_num);
+    sfree (ret);
+    return (NULL);
+  }
+
+  return (ret);
+} /* gauge_t *uc_get_rate */
+
+size_t uc_get_size (void) {
+  size_t size_arrays = 0;
+  size_t i;
+
+  for (i = 0; i < CACHE_SHARDS_NUM; i++)
+  {
+    pthread_mutex_lock (&cache_shards[i].lock);
+    size_arrays += cache_shards[i].entries_num;
+    pthread_mutex_unlock (&cache_shards[i].lock);
+  }
+
+  return (size_arrays);
+}
+
+struct uc_memory_s
+{
+  char name[DATA_MAX_NAME_LEN];
+  /* Interned "plugin" string of the entries, only valid while the lock of
+   * the shard being walked is held. */
+  char const *plugin;
+  size_t entries_num;
+  size_t bytes;
+};
+typedef struct uc_memory_s uc_memory_t;
+
+/* Returns the statistics of "plugin" in "stats", adding them if necessary.
+ * Most entries of a shard belong to a few plugins, so the interned pointer is
+ * compared first and a linear search suffices. */
+static uc_memory_t *uc_memory_get (uc_memory_t **stats, /* {{{ */
+    size_t *stats_num, char const *plugin)
+{
+  uc_memory_t *tmp;
+  size_t i;
+
+  for (i = 0; i < *stats_num; i++)
+    if ((*stats)[i].plugin == plugin)
+      return (*stats + i);
+
+  for (i = 0; i < *stats_num; i++)
+  {
+    if (strcmp ((*stats)[i].name, plugin) == 0)
+    {
+      (*stats)[i].plugin = plugin;
+      return (*stats + i);
+    }
+  }
+
+  tmp = realloc (*stats, (*stats_num + 1) * sizeof (**stats));
+  if (tmp == NULL)
+    return (NULL);
+  *stats = tmp;
+
+  tmp = *stats + *stats_num;
+  memset (tmp, 0, sizeof (*tmp));
+  sstrncpy (tmp->name, plugin, sizeof (tmp->name));
+  tmp->plugin = plugin;
+  (*stats_num)++;
+
+  return (tmp);
+} /* }}} uc_memory_t *uc_memory_get */
+
+int uc_memory_stats (uc_memory_cb callback, void *arg) /* {{{ */
+{
+  uc_memory_t *stats = NULL;
+  size_t stats_num = 0;
+  size_t i;
+
+  if (callback == NULL)
+    return (EINVAL);
+
+  for (i = 0; i < CACHE_SHARDS_NUM; i++)
+  {
+    cache_shard_t *shard = &cache_shards[i];
+    uc_memory_t *last = NULL;
+    size_t j;
+
+    pthread_mutex_lock (&shard->lock);
+    for (j = 0; j < shard->buckets_num; j++)
+    {
+      cache_entry_t *ce;
+
+      for (ce = shard->buckets[j]; ce != NULL; ce = ce->next)
+      {
+        if ((last == NULL) || (last->plugin != ce->id.plugin))
+          last = uc_memory_get (&stats, &stats_num, ce->id.plugin);
+        if (last == NULL)
+        {
+          pthread_mutex_unlock (&shard->lock);
+          sfree (stats);
+          return (ENOMEM);
+        }
+
+        last->entries_num++;
+        last->bytes += sizeof (*ce) + ce->values_num
+          * (sizeof (*ce->values_gauge) + sizeof (*ce->values_raw))
+          + history_memory (ce->history);
+      }
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    /* The interned strings may be freed once the lock is released. */
+    for (j = 0; j < stats_num; j++)
+      stats[j].plugin = NULL;
+  }
+
+  for (i = 0; i < stats_num; i++)
+    (*callback) (stats[i].name, stats[i].entries_num, stats[i].bytes, arg);
+  sfree (stats);
+
+  return (0);
+} /* }}} int uc_memory_stats */
+
+/* An iterator takes a snapshot of one shard at a time, so that each shard
+ * lock is only held while that shard's entries are copied. Names and values
+ * are stored in two arenas, which are reused for every shard. */
+struct uc_iter_entry_s
+{
+  size_t   name_offset;
+  size_t   values_offset;
+  size_t   values_num;
+  cdtime_t time;
+  cdtime_t interval;
+};
+typedef struct uc_iter_entry_s uc_iter_entry_t;
+
+struct uc_iter_s
+{
+  char  *prefix;
+  size_t prefix_len;
+  /* Shell pattern the whole name has to match, see uc_get_iterator_glob().
+   * "prefix" is its literal beginning. */
+  char  *pattern;
+
+  /* Next shard to take a snapshot of. */
+  size_t shard;
+
+  uc_iter_entry_t *entries;
+  size_t           entries_num;
+  size_t           entries_size;
+  /* Index of the current entry plus one; zero before the first entry of a
+   * snapshot has been returned. */
+  size_t           current;
+
+  char   *names;
+  size_t  names_len;
+  size_t  names_size;
+
+  gauge_t *values;
+  size_t   values_len;
+  size_t   values_size;
+};
+
+/* Makes room for "num" more elements of "elem_size" bytes in an arena. */
+static int uc_iter_reserve (void **arena, size_t *size, /* {{{ */
+    size_t len, size_t num, size_t elem_size)
+{
+  size_t new_size;
+  void *tmp;
+
+  if ((len + num) <= *size)
+    return (0);
+
+  new_size = (*size > 0) ? *size : 64;
+  while (new_size < (len + num))
+    new_size *= 2;
+
+  tmp = realloc (*arena, new_size * elem_size);
+  if (tmp == NULL)
+    return (ENOMEM);
+
+  *arena = tmp;
+  *size = new_size;
+  return (0);
+} /* }}} int uc_iter_reserve */
+
+/* Returns true if the identifier of "ce" may start with the iterator's
+ * prefix. Compares the host first, so that iterating over the values of one
+ * host doesn't have to format every identifier. */
+static _Bool uc_iter_host_matches (uc_iter_t const *iter, /* {{{ */
+    cache_entry_t const *ce)
+{
+  size_t host_len;
+
+  if (iter->prefix == NULL)
+    return (1);
+
+  host_len = strlen (ce->id.host);
+  if (iter->prefix_len <= host_len)
+    return (strncmp (iter->prefix, ce->id.host, iter->prefix_len) == 0);
+
+  return ((strncmp (iter->prefix, ce->id.host, host_len) == 0)
+      && (iter->prefix[host_len] == '/'));
+} /* }}} _Bool uc_iter_host_matches */
+
+/* Copies all non-missing entries of one shard matching the prefix. */
+static int uc_iter_snapshot (uc_iter_t *iter, /* {{{ */
+    cache_shard_t *shard)
+{
+  int status = 0;
+  size_t i;
+
+  pthread_mutex_lock (&shard->lock);
+
+  status = uc_iter_reserve ((void *) &iter->entries, &iter->entries_size,
+      0, shard->entries_num, sizeof (*iter->entries));
+
+  for (i = 0; (i < shard->buckets_num) && (status == 0); i++)
+  {
+    cache_entry_t *ce;
+
+    for (ce = shard->buckets[i]; ce != NULL; ce = ce->next)
+    {
+      char name[6 * DATA_MAX_NAME_LEN];
+      uc_iter_entry_t *e;
+      size_t name_len;
+
+      /* remove missing values when list values */
+      if (ce->state == STATE_MISSING)
+	continue;
+
+      if (!uc_iter_host_matches (iter, ce))
+	continue;
+
+      if (FORMAT_ID (name, sizeof (name), &ce->id) != 0)
+	continue;
+
+      if ((iter->prefix != NULL)
+	  && (strncmp (iter->prefix, name, iter->prefix_len) != 0))
+	continue;
+
+#if HAVE_FNMATCH_H
+      if ((iter->pattern != NULL)
+	  && (fnmatch (iter->pattern, name, /* flags = */ 0) != 0))
+	continue;
+#endif
+
+      name_len = strlen (name) + 1;
+      status = uc_iter_reserve ((void *) &iter->names, &iter->names_size,
+	  iter->names_len, name_len, sizeof (*iter->names));
+      if (status == 0)
+	status = uc_iter_reserve ((void *) &iter->values, &iter->values_size,
+	    iter->values_len, ce->values_num, sizeof (*iter->values));
+      if (status != 0)
+	break;
+
+      assert (iter->entries_num < iter->entries_size);
+      e = &iter->entries[iter->entries_num];
+      e->name_offset = iter->names_len;
+      e->values_offset = iter->values_len;
+      e->values_num = ce->values_num;
+      e->time = ce->last_time;
+      e->interval = ce->interval;
+
+      memcpy (iter->names + iter->names_len, name, name_len);
+      iter->names_len += name_len;
+      memcpy (iter->values + iter->values_len, ce->values_gauge,
+	  ce->values_num * sizeof (*iter->values));
+      iter->values_len += ce->values_num;
+
+      iter->entries_num++;
+    }
+  }
+
+  pthread_mutex_unlock (&shard->lock);
+
+  if (status != 0)
+    ERROR ("uc_iter_snapshot: Allocating memory failed.");
+  return (status);
+} /* }}} int uc_iter_snapshot */
+
+uc_iter_t *uc_get_iterator (const char *prefix) /* {{{ */
 {
-  gauge_t *ret = NULL;
-  size_t ret_num = 0;
-  cache_entry_t *ce = NULL;
-  int status = 0;
+  uc_iter_t *iter;
 
-  pthread_mutex_lock (&cache_lock);
+  iter = calloc (1, sizeof (*iter));
+  if (iter == NULL)
+    return (NULL);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  if ((prefix != NULL) && (prefix[0] != 0))
   {
-    assert (ce != NULL);
-
-    /* remove missing values from getval */
-    if (ce->state == STATE_MISSING)
-    {
-      status = -1;
-    }
-    else
+    iter->prefix = strdup (prefix);
+    if (iter->prefix == NULL)
     {
-      ret_num = ce->values_num;
-      ret = malloc (ret_num * sizeof (*ret));
-      if (ret == NULL)
-      {
-        ERROR ("utils_cache: uc_get_rate_by_name: malloc failed.");
-        status = -1;
-      }
-      else
-      {
-        memcpy (ret, ce->values_gauge, ret_num * sizeof (gauge_t));
-      }
+      sfree (iter);
+      return (NULL);
     }
+    iter->prefix_len = strlen (prefix);
   }
-  else
+
+  return (iter);
+} /* }}} uc_iter_t *uc_get_iterator */
+
+uc_iter_t *uc_get_iterator_glob (const char *pattern) /* {{{ */
+{
+  uc_iter_t *iter;
+  size_t literal_len;
+
+  if ((pattern == NULL) || (pattern[0] == 0))
+    return (uc_get_iterator (NULL));
+
+  /* The part before the first wildcard is used as prefix, so that entries of
+   * other hosts are skipped before their names are formatted. */
+  literal_len = strcspn (pattern, "*?[\\");
+  if (pattern[literal_len] == 0)
+    return (uc_get_iterator (pattern));
+
+#if !HAVE_FNMATCH_H
+  ERROR ("uc_get_iterator_glob: Cannot match \"%s\": "
+      "fnmatch() is not available.", pattern);
+  return (NULL);
+#else
+  iter = uc_get_iterator (NULL);
+  if (iter == NULL)
+    return (NULL);
+
+  iter->pattern = strdup (pattern);
+  if (iter->pattern == NULL)
   {
-    DEBUG ("utils_cache: uc_get_rate_by_name: No such value: %s", name);
-    status = -1;
+    uc_iterator_destroy (iter);
+    return (NULL);
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  if (literal_len == 0)
+    return (iter);
 
-  if (status == 0)
+  iter->prefix = malloc (literal_len + 1);
+  if (iter->prefix == NULL)
   {
-    *ret_values = ret;
-    *ret_values_num = ret_num;
+    uc_iterator_destroy (iter);
+    return (NULL);
   }
+  sstrncpy (iter->prefix, pattern, literal_len + 1);
+  iter->prefix_len = literal_len;
 
-  return (status);
-} /* gauge_t *uc_get_rate_by_name */
+  return (iter);
+#endif
+} /* }}} uc_iter_t *uc_get_iterator_glob */
 
-gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
+int uc_iterator_next (uc_iter_t *iter, char **ret_name) /* {{{ */
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  gauge_t *ret = NULL;
-  size_t ret_num = 0;
-  int status;
+  if ((iter == NULL) || (ret_name == NULL))
+    return (-1);
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  while (iter->current >= iter->entries_num)
   {
-    ERROR ("utils_cache: uc_get_rate: FORMAT_VL failed.");
-    return (NULL);
+    iter->entries_num = 0;
+    iter->names_len = 0;
+    iter->values_len = 0;
+    iter->current = 0;
+
+    if (iter->shard >= CACHE_SHARDS_NUM)
+      return (-1);
+
+    if (uc_iter_snapshot (iter, &cache_shards[iter->shard]) != 0)
+    {
+      iter->entries_num = 0;
+      return (-1);
+    }
+    iter->shard++;
   }
 
-  status = uc_get_rate_by_name (name, &ret, &ret_num);
-  if (status != 0)
-    return (NULL);
+  *ret_name = iter->names + iter->entries[iter->current].name_offset;
+  iter->current++;
+  return (0);
+} /* }}} int uc_iterator_next */
 
-  /* This is important - the caller has no other way of knowing how many
-   * values are returned. */
-  if (ret_num != (size_t) ds->ds_num)
-  {
-    ERROR ("utils_cache: uc_get_rate: ds[%s] has %zu values, "
-	"but uc_get_rate_by_name returned %zu.",
-	ds->type, ds->ds_num, ret_num);
-    sfree (ret);
+void uc_iterator_destroy (uc_iter_t *iter) /* {{{ */
+{
+  if (iter == NULL)
+    return;
+
+  sfree (iter->prefix);
+  sfree (iter->pattern);
+  sfree (iter->entries);
+  sfree (iter->names);
+  sfree (iter->values);
+  sfree (iter);
+} /* }}} void uc_iterator_destroy */
+
+static uc_iter_entry_t *uc_iter_current (uc_iter_t *iter) /* {{{ */
+{
+  if ((iter == NULL) || (iter->current == 0)
+      || (iter->current > iter->entries_num))
     return (NULL);
-  }
 
-  return (ret);
-} /* gauge_t *uc_get_rate */
+  return (&iter->entries[iter->current - 1]);
+} /* }}} uc_iter_entry_t *uc_iter_current */
 
-size_t uc_get_size (void) {
-  size_t size_arrays = 0;
+int uc_iterator_get_time (uc_iter_t *iter, cdtime_t *ret_time) /* {{{ */
+{
+  uc_iter_entry_t *e = uc_iter_current (iter);
 
-  pthread_mutex_lock (&cache_lock);
-  size_arrays = (size_t) c_avl_size (cache_tree);
-  pthread_mutex_unlock (&cache_lock);
+  if ((e == NULL) || (ret_time == NULL))
+    return (-1);
 
-  return (size_arrays);
-}
+  *ret_time = e->time;
+  return (0);
+} /* }}} int uc_iterator_get_time */
 
-int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
+int uc_iterator_get_interval (uc_iter_t *iter, /* {{{ */
+    cdtime_t *ret_interval)
+{
+  uc_iter_entry_t *e = uc_iter_current (iter);
+
+  if ((e == NULL) || (ret_interval == NULL))
+    return (-1);
+
+  *ret_interval = e->interval;
+  return (0);
+} /* }}} int uc_iterator_get_interval */
+
+int uc_iterator_get_values (uc_iter_t *iter, /* {{{ */
+    gauge_t **ret_values, size_t *ret_num)
+{
+  uc_iter_entry_t *e = uc_iter_current (iter);
+
+  if ((e == NULL) || (ret_values == NULL) || (ret_num == NULL))
+    return (-1);
+
+  *ret_values = iter->values + e->values_offset;
+  *ret_num = e->values_num;
+  return (0);
+} /* }}} int uc_iterator_get_values */
+
+struct uc_name_s
+{
+  char *name;
+  cdtime_t time;
+};
+typedef struct uc_name_s uc_name_t;
+
+static int uc_name_compare (const void *a, const void *b) /* {{{ */
+{
+  return (strcmp (((const uc_name_t *) a)->name,
+	((const uc_name_t *) b)->name));
+} /* }}} int uc_name_compare */
+
+int uc_get_names_prefix (const char *prefix, /* {{{ */
+    char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
 {
-  c_avl_iterator_t *iter;
-  char *key;
-  cache_entry_t *value;
+  uc_iter_t *iter;
+  uc_name_t *list = NULL;
+  size_t list_num = 0;
+  size_t list_size = 0;
+  char *name;
 
   char **names = NULL;
   cdtime_t *times = NULL;
-  size_t number = 0;
-  size_t size_arrays = 0;
 
   int status = 0;
+  size_t i;
 
   if ((ret_names == NULL) || (ret_number == NULL))
     return (-1);
 
-  pthread_mutex_lock (&cache_lock);
+  iter = uc_get_iterator (prefix);
+  if (iter == NULL)
+    return (-1);
 
-  size_arrays = (size_t) c_avl_size (cache_tree);
-  if (size_arrays < 1)
+  while (uc_iterator_next (iter, &name) == 0)
   {
-    /* Handle the "no values" case here, to avoid the error message when
-     * calloc() returns NULL. */
-    pthread_mutex_unlock (&cache_lock);
-    return (0);
-  }
+    status = uc_iter_reserve ((void *) &list, &list_size, list_num, 1,
+	sizeof (*list));
+    if (status != 0)
+      break;
 
-  names = calloc (size_arrays, sizeof (*names));
-  times = calloc (size_arrays, sizeof (*times));
-  if ((names == NULL) || (times == NULL))
-  {
-    ERROR ("uc_get_names: calloc failed.");
-    sfree (names);
-    sfree (times);
-    pthread_mutex_unlock (&cache_lock);
-    return (ENOMEM);
+    list[list_num].name = strdup (name);
+    if (list[list_num].name == NULL)
+    {
+      status = ENOMEM;
+      break;
+    }
+    uc_iterator_get_time (iter, &list[list_num].time);
+    list_num++;
   }
+  /* uc_iterator_next () also fails if it couldn't take a snapshot. */
+  if ((status == 0) && (iter->shard < CACHE_SHARDS_NUM))
+    status = ENOMEM;
+  uc_iterator_destroy (iter);
 
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &value) == 0)
+  if ((status == 0) && (list_num > 0))
   {
-    /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
-      continue;
-
-    /* c_avl_size does not return a number smaller than the number of elements
-     * returned by c_avl_iterator_next. */
-    assert (number < size_arrays);
-
-    if (ret_times != NULL)
-      times[number] = value->last_time;
-
-    names[number] = strdup (key);
-    if (names[number] == NULL)
+    names = calloc (list_num, sizeof (*names));
+    times = calloc (list_num, sizeof (*times));
+    if ((names == NULL) || (times == NULL))
     {
-      status = -1;
-      break;
+      ERROR ("uc_get_names: calloc failed.");
+      sfree (names);
+      sfree (times);
+      status = ENOMEM;
     }
-
-    number++;
-  } /* while (c_avl_iterator_next) */
-
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+  }
 
   if (status != 0)
   {
-    size_t i;
-
-    for (i = 0; i < number; i++)
-    {
-      sfree (names[i]);
-    }
-    sfree (names);
-    sfree (times);
+    for (i = 0; i < list_num; i++)
+      sfree (list[i].name);
+    sfree (list);
 
     return (-1);
   }
 
+  if (list_num == 0)
+  {
+    /* Handle the "no values" case here, to avoid the error message when
+     * calloc() returns NULL. */
+    sfree (list);
+    *ret_number = 0;
+    return (0);
+  }
+
+  /* Hash order is arbitrary; return the names sorted like the AVL tree we
+   * used to keep them in did. */
+  qsort (list, list_num, sizeof (*list), uc_name_compare);
+  for (i = 0; i < list_num; i++)
+  {
+    names[i] = list[i].name;
+    times[i] = list[i].time;
+  }
+  sfree (list);
+
   *ret_names = names;
   if (ret_times != NULL)
     *ret_times = times;
   else
     sfree (times);
-  *ret_number = number;
+  *ret_number = list_num;
 
   return (0);
+} /* }}} int uc_get_names_prefix */
+
+int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
+{
+  return (uc_get_names_prefix (NULL, ret_names, ret_times, ret_number));
 } /* int uc_get_names */
 
 int uc_get_state (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("uc_get_state: FORMAT_VL failed.");
-    return (STATE_ERROR);
-  }
-
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
-  {
-    assert (ce != NULL);
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce != NULL)
     ret = ce->state;
-  }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (ret);
 } /* int uc_get_state */
 
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("uc_get_state: FORMAT_VL failed.");
-    return (STATE_ERROR);
-  }
-
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->state;
     ce->state = state;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (ret);
 } /* int uc_set_state */
 
-int uc_get_history_by_name (const char *name,
+/* Copies the history of `ce' to `ret_history', creating or growing the
+ * history if needed. The shard lock must be held. */
+static int uc_copy_history (cache_entry_t *ce, /* {{{ */
     gauge_t *ret_history, size_t num_steps, size_t num_ds)
 {
-  cache_entry_t *ce = NULL;
-  size_t i;
-  int status = 0;
-
-  pthread_mutex_lock (&cache_lock);
-
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0)
-  {
-    pthread_mutex_unlock (&cache_lock);
-    return (-ENOENT);
-  }
+  int status;
 
   if (((size_t) ce->values_num) != num_ds)
-  {
-    pthread_mutex_unlock (&cache_lock);
     return (-EINVAL);
-  }
+  if (num_steps == 0)
+    return (0);
 
-  /* Check if there are enough values available. If not, increase the buffer
-   * size. */
-  if (ce->history_length < num_steps)
+  /* Check if there are enough values available. If not, increase the
+   * history's size. */
+  if (ce->history == NULL)
   {
-    gauge_t *tmp;
-
-    tmp = realloc (ce->history, sizeof (*ce->history)
-	* num_steps * ce->values_num);
-    if (tmp == NULL)
-    {
-      pthread_mutex_unlock (&cache_lock);
+    ce->history = history_create (num_ds, num_steps, history_compressed);
+    if (ce->history == NULL)
       return (-ENOMEM);
-    }
-
-    for (i = ce->history_length * ce->values_num;
-	i < (num_steps * ce->values_num);
-	i++)
-      tmp[i] = NAN;
+  }
+  else if (history_length (ce->history) < num_steps)
+  {
+    status = history_resize (ce->history, num_steps);
+    if (status != 0)
+      return (-status);
+  }
 
-    ce->history = tmp;
-    ce->history_length = num_steps;
-  } /* if (ce->history_length < num_steps) */
+  status = history_get (ce->history, ret_history, num_steps);
+  if (status != 0)
+    return (-status);
 
-  /* Copy the values to the output buffer. */
-  for (i = 0; i < num_steps; i++)
-  {
-    size_t src_index;
-    size_t dst_index;
+  return (0);
+} /* }}} int uc_copy_history */
 
-    if (i < ce->history_index)
-      src_index = ce->history_index - (i + 1);
-    else
-      src_index = ce->history_length + ce->history_index - (i + 1);
-    src_index = src_index * num_ds;
+int uc_get_history_by_name (const char *name,
+    gauge_t *ret_history, size_t num_steps, size_t num_ds)
+{
+  uint32_t hash = identifier_hash_name (name);
+  cache_shard_t *shard = cache_shard (hash);
+  cache_entry_t *ce = NULL;
+  int status;
 
-    dst_index = i * num_ds;
+  pthread_mutex_lock (&shard->lock);
 
-    memcpy (ret_history + dst_index, ce->history + src_index,
-	sizeof (*ret_history) * num_ds);
-  }
+  ce = cache_find_name (shard, hash, name);
+  if (ce == NULL)
+    status = -ENOENT;
+  else
+    status = uc_copy_history (ce, ret_history, num_steps, num_ds);
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
-  return (0);
+  return (status);
 } /* int uc_get_history_by_name */
 
 int uc_get_history (const data_set_t *ds, const value_list_t *vl,
     gauge_t *ret_history, size_t num_steps, size_t num_ds)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
+  cache_entry_t *ce = NULL;
+  int status;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("utils_cache: uc_get_history: FORMAT_VL failed.");
-    return (-1);
-  }
+  pthread_mutex_lock (&shard->lock);
 
-  return (uc_get_history_by_name (name, ret_history, num_steps, num_ds));
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce == NULL)
+    status = -ENOENT;
+  else
+    status = uc_copy_history (ce, ret_history, num_steps, num_ds);
+
+  pthread_mutex_unlock (&shard->lock);
+
+  return (status);
 } /* int uc_get_history */
 
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("uc_get_state: FORMAT_VL failed.");
-    return (STATE_ERROR);
-  }
-
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
-  {
-    assert (ce != NULL);
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce != NULL)
     ret = ce->hits;
-  }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (ret);
 } /* int uc_get_hits */
 
 int uc_set_hits (const data_set_t *ds, const value_list_t *vl, int hits)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("uc_get_state: FORMAT_VL failed.");
-    return (STATE_ERROR);
-  }
-
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->hits;
     ce->hits = hits;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (ret);
 } /* int uc_set_hits */
 
 int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("uc_get_state: FORMAT_VL failed.");
-    return (STATE_ERROR);
-  }
-
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->hits;
     ce->hits = ret + step;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (ret);
 } /* int uc_inc_hits */
 
 /*
- * Meta data interface
+ * Entry handle interface
  */
-/* XXX: This function will acquire `cache_lock' but will not free it! */
-static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
+uc_entry_t *uc_acquire (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
   cache_entry_t *ce = NULL;
-  int status;
 
-  status = FORMAT_VL (name, sizeof (name), vl);
-  if (status != 0)
+  pthread_mutex_lock (&shard->lock);
+
+  ce = cache_find_vl (shard, hash, vl);
+  if ((ce == NULL) || ((ds != NULL) && (ce->values_num != ds->ds_num)))
   {
-    ERROR ("utils_cache: uc_get_meta: FORMAT_VL failed.");
+    pthread_mutex_unlock (&shard->lock);
     return (NULL);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  /* The shard lock is released by uc_release(). */
+  return (ce);
+} /* }}} uc_entry_t *uc_acquire */
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0)
+void uc_release (uc_entry_t *ce) /* {{{ */
+{
+  if (ce == NULL)
+    return;
+
+  pthread_mutex_unlock (&cache_shard (ce->id.hash)->lock);
+} /* }}} void uc_release */
+
+meta_data_t *uc_entry_meta (uc_entry_t *ce) /* {{{ */
+{
+  if (ce == NULL)
+    return (NULL);
+
+  if (ce->meta == NULL)
+    ce->meta = meta_data_create ();
+
+  return (ce->meta);
+} /* }}} meta_data_t *uc_entry_meta */
+
+const gauge_t *uc_entry_rates (uc_entry_t *ce) /* {{{ */
+{
+  if ((ce == NULL) || (ce->state == STATE_MISSING))
+    return (NULL);
+
+  return (ce->values_gauge);
+} /* }}} const gauge_t *uc_entry_rates */
+
+int uc_entry_get_state (uc_entry_t *ce) /* {{{ */
+{
+  if (ce == NULL)
+    return (STATE_ERROR);
+
+  return (ce->state);
+} /* }}} int uc_entry_get_state */
+
+int uc_entry_set_state (uc_entry_t *ce, int state) /* {{{ */
+{
+  int ret;
+
+  if (ce == NULL)
+    return (-1);
+
+  ret = ce->state;
+  ce->state = state;
+  return (ret);
+} /* }}} int uc_entry_set_state */
+
+int uc_entry_get_hits (uc_entry_t *ce) /* {{{ */
+{
+  if (ce == NULL)
+    return (STATE_ERROR);
+
+  return (ce->hits);
+} /* }}} int uc_entry_get_hits */
+
+int uc_entry_set_hits (uc_entry_t *ce, int hits) /* {{{ */
+{
+  int ret;
+
+  if (ce == NULL)
+    return (-1);
+
+  ret = ce->hits;
+  ce->hits = hits;
+  return (ret);
+} /* }}} int uc_entry_set_hits */
+
+/*
+ * Meta data interface
+ */
+/* XXX: This function will acquire the shard lock but will not free it! The
+ * lock to release is returned in `ret_lock'. */
+static meta_data_t *uc_get_meta (const value_list_t *vl, /* {{{ */
+    pthread_mutex_t **ret_lock)
+{
+  uint32_t hash = identifier_hash_vl (vl);
+  cache_shard_t *shard = cache_shard (hash);
+  cache_entry_t *ce = NULL;
+
+  pthread_mutex_lock (&shard->lock);
+
+  ce = cache_find_vl (shard, hash, vl);
+  if (ce == NULL)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (NULL);
   }
-  assert (ce != NULL);
 
   if (ce->meta == NULL)
     ce->meta = meta_data_create ();
 
   if (ce->meta == NULL)
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&shard->lock);
+  else
+    *ret_lock = &shard->lock;
 
   return (ce->meta);
 } /* }}} meta_data_t *uc_get_meta */
@@ -907,11 +2263,12 @@ static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
  * shorter.. */
 #define UC_WRAP(wrap_function) { \
   meta_data_t *meta; \
+  pthread_mutex_t *lock = NULL; \
   int status; \
-  meta = uc_get_meta (vl); \
+  meta = uc_get_meta (vl, &lock); \
   if (meta == NULL) return (-1); \
   status = wrap_function (meta, key); \
-  pthread_mutex_unlock (&cache_lock); \
+  pthread_mutex_unlock (lock); \
   return (status); \
 }
 int uc_meta_data_exists (const value_list_t *vl, const char *key)
@@ -925,11 +2282,12 @@ int uc_meta_data_delete (const value_list_t *vl, const char *key)
  * two argumetns. */
 #define UC_WRAP(wrap_function) { \
   meta_data_t *meta; \
+  pthread_mutex_t *lock = NULL; \
   int status; \
-  meta = uc_get_meta (vl); \
+  meta = uc_get_meta (vl, &lock); \
   if (meta == NULL) return (-1); \
   status = wrap_function (meta, key, value); \
-  pthread_mutex_unlock (&cache_lock); \
+  pthread_mutex_unlock (lock); \
   return (status); \
 }
 int uc_meta_data_add_string (const value_list_t *vl,
@@ -35,13 +35,62 @@
 #define STATE_MISSING 15
 
 int uc_init (void);
+
+/* Whether histories requested with uc_get_history() are kept compressed.
+ * Only applies to histories created afterwards. Disabled by default. */
+void uc_set_history_compression (_Bool compressed);
+
+/* Write all entries of the cache to "file" and read them back, e.g. across
+ * a restart. Entries that would have timed out in the meantime are not
+ * restored. A missing file is not an error for uc_restore(). */
+int uc_persist (const char *file);
+int uc_restore (const char *file);
+
 int uc_check_timeout (void);
 int uc_update (const data_set_t *ds, const value_list_t *vl);
+/* Like calling uc_update() for each of the "num" value lists in "vl", with
+ * the data sets in "ds", but locks each cache shard only once per chunk of
+ * value lists. Updates of the same identifier are applied in order. The rates
+ * of all value lists are available from uc_get_rate_dispatched() until
+ * uc_update_done() is called for them. Returns zero if all value lists were
+ * updated, -1 otherwise. */
+int uc_update_batch (const data_set_t * const *ds,
+    const value_list_t * const *vl, size_t num);
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num);
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
 
+/* uc_update() keeps a copy of the rates it computed for the calling thread.
+ * While the value list is dispatched, i.e. from filter chain targets and
+ * write callbacks called by the same thread, uc_get_rate_dispatched() returns
+ * them without locking the cache or allocating memory. It returns NULL for
+ * other value lists, from write callbacks with their own queue or batch and
+ * after uc_update_done(); use uc_get_rate() then. The returned array must not
+ * be freed or used after the callback returns. */
+const gauge_t *uc_get_rate_dispatched (const data_set_t *ds,
+    const value_list_t *vl);
+/* Forgets the rates kept by uc_update() for `vl'. */
+void uc_update_done (const value_list_t *vl);
+
 size_t uc_get_size (void);
+
+/* Returns the index of the cache shard holding the entry with the identifier
+ * hash "hash", see identifier_hash_vl(). Entries of different shards never
+ * share a lock. */
+size_t uc_shard_index (uint32_t hash);
+
+/* Calls `callback' with the number of entries of each plugin, i.e. each value
+ * of the "plugin" field, and an estimate of the memory they use: the entries,
+ * their values, rates and histories. Meta data and the interned identifier
+ * strings, which are shared between entries, are not included. The shards are
+ * walked one at a time and `callback' runs without locks, so it may dispatch
+ * values. */
+typedef void (*uc_memory_cb) (char const *plugin, size_t entries_num,
+    size_t bytes, void *arg);
+int uc_memory_stats (uc_memory_cb callback, void *arg);
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
+/* Like uc_get_names(), but only returns the names starting with "prefix". */
+int uc_get_names_prefix (const char *prefix,
+    char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
 int uc_get_state (const data_set_t *ds, const value_list_t *vl);
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state);
@@ -54,6 +103,70 @@ int uc_get_history (const data_set_t *ds, const value_list_t *vl,
 int uc_get_history_by_name (const char *name,
     gauge_t *ret_history, size_t num_steps, size_t num_ds);
 
+/*
+ * Iterator interface
+ *
+ * Iterates over the names of all values in the cache that are not missing and
+ * start with "prefix", which may be NULL. The cache is not locked as a whole;
+ * entries are copied one shard at a time, so an iteration may not reflect
+ * updates that happen while it is in progress. The order is unspecified.
+ *
+ * The name returned by uc_iterator_next() and the values returned by
+ * uc_iterator_get_values() belong to the iterator and are valid until the
+ * next call of uc_iterator_next() or uc_iterator_destroy().
+ * uc_iterator_next() returns zero on success and non-zero at the end of the
+ * cache or on failure.
+ */
+struct uc_iter_s;
+typedef struct uc_iter_s uc_iter_t;
+
+uc_iter_t *uc_get_iterator (const char *prefix);
+/* Like uc_get_iterator(), but only returns the names matching the shell
+ * pattern "pattern", see fnmatch(3). Wildcards also match slashes. A pattern
+ * without wildcards is treated as a prefix. */
+uc_iter_t *uc_get_iterator_glob (const char *pattern);
+int uc_iterator_next (uc_iter_t *iter, char **ret_name);
+void uc_iterator_destroy (uc_iter_t *iter);
+
+/* Return the time, interval and rates of the entry returned last by
+ * uc_iterator_next(). */
+int uc_iterator_get_time (uc_iter_t *iter, cdtime_t *ret_time);
+int uc_iterator_get_interval (uc_iter_t *iter, cdtime_t *ret_interval);
+int uc_iterator_get_values (uc_iter_t *iter,
+    gauge_t **ret_values, size_t *ret_num);
+
+/*
+ * Entry handle interface
+ *
+ * uc_acquire() looks up the cache entry of `vl' once and locks it, so that a
+ * target or match can read and update several meta data entries without a
+ * lookup each. It returns NULL if there is no such entry or if its number of
+ * values doesn't match `ds', which may be NULL. The lock is shared with other
+ * entries, so release the handle with uc_release() right away and don't call
+ * any other uc_* function while holding it.
+ */
+struct cache_entry_s;
+typedef struct cache_entry_s uc_entry_t;
+
+uc_entry_t *uc_acquire (const data_set_t *ds, const value_list_t *vl);
+void uc_release (uc_entry_t *e);
+
+/* Returns the meta data of the entry, creating it if necessary. It belongs to
+ * the entry and may only be used until uc_release(). Returns NULL if `e' is
+ * NULL or upon failure. */
+meta_data_t *uc_entry_meta (uc_entry_t *e);
+
+/* Return the rates of the entry, or NULL if it is missing. They belong to the
+ * entry and may only be used until uc_release(). */
+const gauge_t *uc_entry_rates (uc_entry_t *e);
+
+/* Like uc_get_state(), uc_set_state(), uc_get_hits() and uc_set_hits(), but
+ * without a lookup each. The setters return the previous value. */
+int uc_entry_get_state (uc_entry_t *e);
+int uc_entry_set_state (uc_entry_t *e, int state);
+int uc_entry_get_hits (uc_entry_t *e);
+int uc_entry_set_hits (uc_entry_t *e, int hits);
+
 /*
  * Meta data interface
  */
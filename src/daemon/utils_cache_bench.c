@@ -0,0 +1,172 @@
+/**
+ * collectd - src/daemon/utils_cache_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Measures uc_update() and uc_get_rate() with a cache holding a given number
+ * of identifiers, e.g. 10000, 1000000 or 10000000. Each round updates every
+ * identifier once, in the same order, like one interval of a busy server.
+ * The time it takes to fill in the identifiers is measured separately and
+ * subtracted.
+ *
+ * Usage: bench_utils_cache [identifiers [rounds]]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_cache.h"
+
+#include <sys/resource.h>
+
+int timeout_g = 2;
+
+int plugin_dispatch_missing (const value_list_t *vl)
+{
+  return (0);
+}
+
+static data_source_t derive_dsrc[] = {{"value", DS_TYPE_DERIVE, 0, NAN}};
+static data_set_t derive_ds = {"derive", 1, derive_dsrc};
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+static void report (const char *op, double elapsed, size_t ops_num) /* {{{ */
+{
+  printf ("%-14s %7.1f ns %12.0f ops/s\n", op,
+      1e9 * elapsed / (double) ops_num, (double) ops_num / elapsed);
+} /* }}} void report */
+
+/* One thousand interfaces of each host, like the interface plugin of a
+ * router would report them. */
+static void set_identifier (value_list_t *vl, size_t i) /* {{{ */
+{
+  ssnprintf (vl->host, sizeof (vl->host), "host%zu.example.com", i / 1000);
+  ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance),
+      "eth%zu", i % 1000);
+} /* }}} void set_identifier */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t idents_num = 10000;
+  size_t rounds = 10;
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+  struct rusage usage;
+  double start;
+  double baseline;
+  double elapsed;
+  int status = 0;
+  size_t i;
+  size_t r;
+
+  if (argc > 1)
+    idents_num = (size_t) atoi (argv[1]);
+  if (argc > 2)
+    rounds = (size_t) atoi (argv[2]);
+  if ((argc > 3) || (idents_num < 1) || (rounds < 1))
+  {
+    fprintf (stderr, "Usage: %s [identifiers [rounds]]\n", argv[0]);
+    return (1);
+  }
+
+  if (uc_init () != 0)
+  {
+    fprintf (stderr, "uc_init failed.\n");
+    return (1);
+  }
+
+  vl.values = values;
+  vl.values_len = 1;
+  vl.interval = TIME_T_TO_CDTIME_T (10);
+  sstrncpy (vl.plugin, "interface", sizeof (vl.plugin));
+  sstrncpy (vl.type, "derive", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "octets", sizeof (vl.type_instance));
+
+  start = now ();
+  for (i = 0; i < idents_num; i++)
+    set_identifier (&vl, i);
+  baseline = now () - start;
+
+  /* The first round creates the cache entries. */
+  vl.time = TIME_T_TO_CDTIME_T (1000);
+  start = now ();
+  for (i = 0; i < idents_num; i++)
+  {
+    set_identifier (&vl, i);
+    values[0].derive = (derive_t) i;
+    if (uc_update (&derive_ds, &vl) != 0)
+      status = 1;
+  }
+  report ("insert", now () - start - baseline, idents_num);
+
+  elapsed = 0.0;
+  for (r = 1; r <= rounds; r++)
+  {
+    vl.time = TIME_T_TO_CDTIME_T (1000 + 10 * r);
+    start = now ();
+    for (i = 0; i < idents_num; i++)
+    {
+      set_identifier (&vl, i);
+      values[0].derive = (derive_t) (i + 1000 * r);
+      if (uc_update (&derive_ds, &vl) != 0)
+        status = 1;
+    }
+    elapsed += now () - start - baseline;
+  }
+  report ("update", elapsed, rounds * idents_num);
+
+  elapsed = 0.0;
+  for (r = 0; r < rounds; r++)
+  {
+    start = now ();
+    for (i = 0; i < idents_num; i++)
+    {
+      gauge_t *rate;
+
+      set_identifier (&vl, i);
+      rate = uc_get_rate (&derive_ds, &vl);
+      if ((rate == NULL) || (rate[0] != 100.0))
+        status = 1;
+      sfree (rate);
+    }
+    elapsed += now () - start - baseline;
+  }
+  report ("get_rate", elapsed, rounds * idents_num);
+
+  if (uc_get_size () != idents_num)
+    status = 1;
+
+  /* ru_maxrss is in kilobytes on Linux and the BSDs. */
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    printf ("%-14s %7.1f bytes per identifier\n", "max RSS",
+        1024.0 * (double) usage.ru_maxrss / (double) idents_num);
+
+  return (status);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
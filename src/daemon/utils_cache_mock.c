@@ -31,3 +31,14 @@ gauge_t *uc_get_rate (__attribute((unused)) data_set_t const *ds,
 {
   return (NULL);
 }
+
+gauge_t const *uc_get_rate_dispatched (
+    __attribute((unused)) data_set_t const *ds,
+    __attribute((unused)) value_list_t const *vl)
+{
+  return (NULL);
+}
+
+void uc_update_done (__attribute((unused)) value_list_t const *vl)
+{
+}
@@ -0,0 +1,292 @@
+/**
+ * collectd - src/daemon/utils_cache_shm.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_cache_shm.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* The sequence locks need the stores to the slots to become visible in
+ * order. There are no atomics in the tree; GCC's and clang's full memory
+ * barrier builtin is enough here. */
+#define UC_SHM_BARRIER() __sync_synchronize ()
+
+/* Protects the mapping and the allocation of slots. Updates of existing
+ * slots don't take it, see uc_shm_update(). */
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *shm_file = NULL;
+static void *shm_map = NULL;
+static size_t shm_map_size = 0;
+static uc_shm_header_t *shm_header = NULL;
+static uc_shm_slot_t *shm_slots = NULL;
+static size_t shm_slots_num = 0;
+static size_t shm_used_num = 0;
+static _Bool shm_enabled = 0;
+
+static void uc_shm_write_begin (uc_shm_slot_t *slot) /* {{{ */
+{
+  slot->seq++;
+  UC_SHM_BARRIER ();
+} /* }}} void uc_shm_write_begin */
+
+static void uc_shm_write_end (uc_shm_slot_t *slot) /* {{{ */
+{
+  UC_SHM_BARRIER ();
+  slot->seq++;
+} /* }}} void uc_shm_write_end */
+
+int uc_shm_open (char const *file, size_t slots_num) /* {{{ */
+{
+  char tmp_file[PATH_MAX];
+  size_t size;
+  void *map;
+  int fd;
+
+  if (file == NULL)
+    return (EINVAL);
+
+  pthread_mutex_lock (&shm_lock);
+  if (shm_map != NULL)
+  {
+    pthread_mutex_unlock (&shm_lock);
+    return (EEXIST);
+  }
+
+  /* The slot is the hash modulo the table size, i.e. its lower bits. */
+  shm_slots_num = 1;
+  while (shm_slots_num < slots_num)
+    shm_slots_num *= 2;
+
+  size = sizeof (uc_shm_header_t) + shm_slots_num * sizeof (uc_shm_slot_t);
+
+  ssnprintf (tmp_file, sizeof (tmp_file), "%s.tmp", file);
+  fd = open (tmp_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    pthread_mutex_unlock (&shm_lock);
+    ERROR ("uc_shm_open: open (%s) failed: %s", tmp_file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (ftruncate (fd, (off_t) size) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("uc_shm_open: ftruncate (%s) failed: %s", tmp_file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    unlink (tmp_file);
+    pthread_mutex_unlock (&shm_lock);
+    return (-1);
+  }
+
+  map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+  {
+    char errbuf[1024];
+    ERROR ("uc_shm_open: mmap (%s) failed: %s", tmp_file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    unlink (tmp_file);
+    pthread_mutex_unlock (&shm_lock);
+    return (-1);
+  }
+
+  /* ftruncate() zeroed the file, so all slots are empty. */
+  shm_header = map;
+  memcpy (shm_header->magic, UC_SHM_MAGIC, sizeof (UC_SHM_MAGIC));
+  shm_header->version = UC_SHM_VERSION;
+  shm_header->slots_num = (uint32_t) shm_slots_num;
+  shm_header->slot_size = (uint32_t) sizeof (uc_shm_slot_t);
+  shm_header->values_max = UC_SHM_VALUES_MAX;
+  shm_header->name_size = UC_SHM_NAME_SIZE;
+  shm_header->created = (uint64_t) cdtime ();
+  shm_header->active = 1;
+
+  if (rename (tmp_file, file) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("uc_shm_open: rename (%s, %s) failed: %s", tmp_file, file,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    munmap (map, size);
+    unlink (tmp_file);
+    shm_header = NULL;
+    pthread_mutex_unlock (&shm_lock);
+    return (-1);
+  }
+
+  shm_file = strdup (file);
+  shm_map = map;
+  shm_map_size = size;
+  shm_slots = (uc_shm_slot_t *) (shm_header + 1);
+  shm_used_num = 0;
+  shm_enabled = 1;
+  pthread_mutex_unlock (&shm_lock);
+
+  INFO ("uc_shm_open: Publishing up to %zu values in \"%s\".",
+      (3 * shm_slots_num) / 4, file);
+  return (0);
+} /* }}} int uc_shm_open */
+
+void uc_shm_close (void) /* {{{ */
+{
+  pthread_mutex_lock (&shm_lock);
+  if (shm_map == NULL)
+  {
+    pthread_mutex_unlock (&shm_lock);
+    return;
+  }
+
+  shm_header->active = 0;
+  UC_SHM_BARRIER ();
+  munmap (shm_map, shm_map_size);
+  if (shm_file != NULL)
+    unlink (shm_file);
+
+  sfree (shm_file);
+  shm_map = NULL;
+  shm_map_size = 0;
+  shm_header = NULL;
+  shm_slots = NULL;
+  shm_slots_num = 0;
+  shm_used_num = 0;
+  shm_enabled = 0;
+  pthread_mutex_unlock (&shm_lock);
+} /* }}} void uc_shm_close */
+
+_Bool uc_shm_enabled (void) /* {{{ */
+{
+  /* Only changed before the read and write threads start and after they
+   * have stopped. Called for every cache update, so don't lock. */
+  return (shm_enabled);
+} /* }}} _Bool uc_shm_enabled */
+
+long uc_shm_insert (value_list_t const *vl, uint32_t hash) /* {{{ */
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  uc_shm_slot_t *slot;
+  size_t index;
+  size_t i;
+
+  if ((vl->values_len > UC_SHM_VALUES_MAX)
+      || (FORMAT_VL (name, sizeof (name), vl) != 0)
+      || (strlen (name) >= UC_SHM_NAME_SIZE))
+    return (-1);
+
+  pthread_mutex_lock (&shm_lock);
+  /* Keep the probe sequences short. */
+  if ((shm_map == NULL) || (shm_used_num >= (3 * shm_slots_num) / 4))
+  {
+    pthread_mutex_unlock (&shm_lock);
+    return (-1);
+  }
+
+  /* There is at least one free slot, see above. */
+  index = hash & (shm_slots_num - 1);
+  slot = shm_slots + index;
+  for (i = 0; (i < shm_slots_num) && (slot->state == UC_SHM_SLOT_USED); i++)
+  {
+    index = (index + 1) & (shm_slots_num - 1);
+    slot = shm_slots + index;
+  }
+
+  uc_shm_write_begin (slot);
+  slot->state = UC_SHM_SLOT_USED;
+  slot->hash = hash;
+  slot->values_num = 0;
+  slot->time = 0;
+  slot->interval = 0;
+  sstrncpy (slot->name, name, sizeof (slot->name));
+  uc_shm_write_end (slot);
+
+  shm_used_num++;
+  pthread_mutex_unlock (&shm_lock);
+
+  return ((long) index);
+} /* }}} long uc_shm_insert */
+
+void uc_shm_update (long index, cdtime_t time, cdtime_t interval, /* {{{ */
+    gauge_t const *values, size_t values_num)
+{
+  uc_shm_slot_t *slot;
+  size_t i;
+
+  /* The mapping is only removed by uc_shm_close () after the write threads
+   * have stopped, so it is safe to access the slot without "shm_lock". */
+  if ((index < 0) || (shm_slots == NULL) || (values_num > UC_SHM_VALUES_MAX))
+    return;
+  slot = shm_slots + index;
+
+  uc_shm_write_begin (slot);
+  slot->time = (uint64_t) time;
+  slot->interval = (uint64_t) interval;
+  slot->values_num = (uint32_t) values_num;
+  for (i = 0; i < values_num; i++)
+    slot->values[i] = values[i];
+  uc_shm_write_end (slot);
+} /* }}} void uc_shm_update */
+
+void uc_shm_remove (long slot_index) /* {{{ */
+{
+  uc_shm_slot_t *slot;
+  size_t index;
+
+  if (slot_index < 0)
+    return;
+
+  pthread_mutex_lock (&shm_lock);
+  if (shm_slots == NULL)
+  {
+    pthread_mutex_unlock (&shm_lock);
+    return;
+  }
+  index = (size_t) slot_index;
+
+  slot = shm_slots + index;
+  uc_shm_write_begin (slot);
+  slot->state = UC_SHM_SLOT_REMOVED;
+  slot->values_num = 0;
+  slot->name[0] = 0;
+  uc_shm_write_end (slot);
+
+  /* Tombstones at the end of a probe sequence are not needed, turn them back
+   * into empty slots so that lookups of missing identifiers stay short. */
+  while ((slot->state == UC_SHM_SLOT_REMOVED)
+      && (shm_slots[(index + 1) & (shm_slots_num - 1)].state
+        == UC_SHM_SLOT_EMPTY))
+  {
+    uc_shm_write_begin (slot);
+    slot->state = UC_SHM_SLOT_EMPTY;
+    uc_shm_write_end (slot);
+
+    index = (index + shm_slots_num - 1) & (shm_slots_num - 1);
+    slot = shm_slots + index;
+  }
+
+  shm_used_num--;
+  pthread_mutex_unlock (&shm_lock);
+} /* }}} void uc_shm_remove */
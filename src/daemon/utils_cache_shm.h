@@ -0,0 +1,120 @@
+/**
+ * collectd - src/daemon/utils_cache_shm.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_CACHE_SHM_H
+#define UTILS_CACHE_SHM_H 1
+
+#include "plugin.h"
+
+/*
+ * Publishes the rates in the value cache in a memory mapped file, so that
+ * local programs can read them without talking to the daemon. See
+ * lcc_shm_open(3) in libcollectdclient for the reader.
+ *
+ * The file starts with a uc_shm_header_t, followed by "slots_num" slots of
+ * an open addressing hash table. The slot of an identifier is found by
+ * probing linearly from (identifier_hash_name (identifier) % slots_num) until
+ * the identifier or an empty slot is found. Removed entries leave a
+ * tombstone so that probing continues.
+ *
+ * Each slot is protected by a sequence lock: the daemon increments "seq"
+ * before and after changing the slot, so it is odd while a change is in
+ * progress. Readers copy the slot and retry if "seq" was odd or changed in
+ * the meantime. Readers never block the daemon.
+ *
+ * The layout must match src/libcollectdclient/shm.c. All numbers are in host
+ * byte order.
+ */
+#define UC_SHM_MAGIC "CDSHMVC"
+#define UC_SHM_VERSION 1
+#define UC_SHM_VALUES_MAX 16
+#define UC_SHM_NAME_SIZE 256
+#define UC_SHM_SLOTS_DEFAULT 16384
+
+#define UC_SHM_SLOT_EMPTY   0
+#define UC_SHM_SLOT_USED    1
+#define UC_SHM_SLOT_REMOVED 2
+
+struct uc_shm_header_s
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t slots_num;
+  uint32_t slot_size;
+  uint32_t values_max;
+  uint32_t name_size;
+  /* Cleared when the daemon shuts down. Readers should reopen the file. */
+  volatile uint32_t active;
+  uint64_t created; /* cdtime_t */
+  uint8_t reserved[24];
+};
+typedef struct uc_shm_header_s uc_shm_header_t;
+
+struct uc_shm_slot_s
+{
+  volatile uint32_t seq;
+  uint32_t state;
+  uint32_t hash;
+  uint32_t values_num;
+  uint64_t time;     /* cdtime_t */
+  uint64_t interval; /* cdtime_t */
+  double values[UC_SHM_VALUES_MAX];
+  char name[UC_SHM_NAME_SIZE];
+};
+typedef struct uc_shm_slot_s uc_shm_slot_t;
+
+/* Creates "file" with "slots_num" slots and maps it. "slots_num" is rounded
+ * up to a power of two. The file is created under a temporary name and
+ * renamed into place, so readers never see a partial header. */
+int uc_shm_open (char const *file, size_t slots_num);
+
+/* Marks the file inactive, unmaps and removes it. */
+void uc_shm_close (void);
+
+_Bool uc_shm_enabled (void);
+
+/*
+ * NAME
+ *   uc_shm_insert
+ *
+ * DESCRIPTION
+ *   Allocates a slot for the identifier of `vl', whose identifier_hash_vl()
+ *   is `hash'. Identifiers longer than UC_SHM_NAME_SIZE - 1 bytes, value
+ *   lists with more than UC_SHM_VALUES_MAX values and identifiers arriving
+ *   after the table is three quarters full are not published.
+ *
+ * RETURN VALUE
+ *   The slot index or -1. The cache doesn't retry failed insertions, so such
+ *   a value is published once it has timed out and is added again.
+ */
+long uc_shm_insert (value_list_t const *vl, uint32_t hash);
+
+/* Publishes new rates. Only one thread may update a given slot at a time;
+ * the cache guarantees this by holding the entry's shard lock. */
+void uc_shm_update (long slot, cdtime_t time, cdtime_t interval,
+    gauge_t const *values, size_t values_num);
+
+/* Frees a slot returned by uc_shm_insert(). */
+void uc_shm_remove (long slot);
+
+#endif /* UTILS_CACHE_SHM_H */
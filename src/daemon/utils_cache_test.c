@@ -0,0 +1,589 @@
+/**
+ * collectd - src/daemon/utils_cache_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "common.h"
+#include "collectd.h"
+#include "testing.h"
+#include "utils_cache.h"
+#include "utils_cache_shm.h"
+#include "utils_intern.h"
+
+#include <sys/mman.h>
+
+/* provided by utils_time.c when built with MOCK_TIME */
+extern cdtime_t cdtime_mock;
+
+int timeout_g = 2;
+
+static int missing_num = 0;
+
+int plugin_dispatch_missing (const value_list_t *vl)
+{
+  missing_num++;
+  return (0);
+}
+
+static data_source_t derive_dsrc[] = {{"value", DS_TYPE_DERIVE, 0, NAN}};
+static data_set_t derive_ds = {"derive", 1, derive_dsrc};
+
+static void make_vl (value_list_t *vl, value_t *values, /* {{{ */
+    char const *plugin_instance, char const *type_instance)
+{
+  memset (vl, 0, sizeof (*vl));
+  vl->values = values;
+  vl->values_len = 1;
+  vl->interval = TIME_T_TO_CDTIME_T (10);
+  sstrncpy (vl->host, "example.com", sizeof (vl->host));
+  sstrncpy (vl->plugin, "test", sizeof (vl->plugin));
+  sstrncpy (vl->plugin_instance, plugin_instance,
+      sizeof (vl->plugin_instance));
+  sstrncpy (vl->type, "derive", sizeof (vl->type));
+  sstrncpy (vl->type_instance, type_instance, sizeof (vl->type_instance));
+} /* }}} void make_vl */
+
+DEF_TEST(update)
+{
+  value_t values[1];
+  value_list_t vl;
+  gauge_t *rate;
+  gauge_t history[2];
+  size_t rate_num = 0;
+  int64_t si = 0;
+
+  make_vl (&vl, values, "", "rate");
+
+  OK (uc_get_rate (&derive_ds, &vl) == NULL);
+
+  values[0].derive = 100;
+  vl.time = TIME_T_TO_CDTIME_T (1000);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  EXPECT_EQ_INT (1, (int) uc_get_size ());
+
+  /* The first value doesn't have a rate yet. */
+  CHECK_NOT_NULL (rate = uc_get_rate (&derive_ds, &vl));
+  OK (isnan (rate[0]));
+  sfree (rate);
+
+  values[0].derive = 200;
+  vl.time = TIME_T_TO_CDTIME_T (1010);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  EXPECT_EQ_INT (1, (int) uc_get_size ());
+
+  CHECK_NOT_NULL (rate = uc_get_rate (&derive_ds, &vl));
+  EXPECT_EQ_DOUBLE (10.0, rate[0]);
+  sfree (rate);
+
+  CHECK_ZERO (uc_get_rate_by_name ("example.com/test/derive-rate",
+	&rate, &rate_num));
+  EXPECT_EQ_INT (1, (int) rate_num);
+  EXPECT_EQ_DOUBLE (10.0, rate[0]);
+  sfree (rate);
+  OK (uc_get_rate_by_name ("example.com/test/derive-nope",
+	&rate, &rate_num) != 0);
+
+  /* Values with old timestamps are rejected. */
+  OK (uc_update (&derive_ds, &vl) != 0);
+
+  /* State, hits and meta data are kept per entry. */
+  EXPECT_EQ_INT (STATE_OKAY, uc_set_state (&derive_ds, &vl, STATE_WARNING));
+  EXPECT_EQ_INT (STATE_WARNING, uc_get_state (&derive_ds, &vl));
+  EXPECT_EQ_INT (0, uc_inc_hits (&derive_ds, &vl, 2));
+  EXPECT_EQ_INT (2, uc_set_hits (&derive_ds, &vl, 5));
+  EXPECT_EQ_INT (5, uc_get_hits (&derive_ds, &vl));
+
+  CHECK_ZERO (uc_meta_data_add_signed_int (&vl, "key", -42));
+  CHECK_ZERO (uc_meta_data_get_signed_int (&vl, "key", &si));
+  EXPECT_EQ_INT (-42, (int) si);
+
+  /* The history starts empty and is filled by subsequent updates. */
+  CHECK_ZERO (uc_get_history (&derive_ds, &vl, history, 2, 1));
+  OK (isnan (history[0]));
+  values[0].derive = 400;
+  vl.time = TIME_T_TO_CDTIME_T (1020);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  CHECK_ZERO (uc_get_history_by_name ("example.com/test/derive-rate",
+	history, 2, 1));
+  EXPECT_EQ_DOUBLE (20.0, history[0]);
+  OK (isnan (history[1]));
+  EXPECT_EQ_INT (-ENOENT, uc_get_history_by_name ("example.com/test/derive",
+	history, 2, 1));
+
+  return (0);
+}
+
+/* The rates of the value list last passed to uc_update() are returned without
+ * a lookup until uc_update_done() or until the value list changes. */
+DEF_TEST(rate_dispatched)
+{
+  value_t values[1];
+  value_list_t vl;
+  value_list_t other;
+  gauge_t const *rate;
+
+  make_vl (&vl, values, "dispatched", "rate");
+  make_vl (&other, values, "dispatched", "rate");
+
+  values[0].derive = 100;
+  vl.time = TIME_T_TO_CDTIME_T (1000);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  OK ((rate = uc_get_rate_dispatched (&derive_ds, &vl)) != NULL);
+  OK (isnan (rate[0]));
+  uc_update_done (&vl);
+  OK (uc_get_rate_dispatched (&derive_ds, &vl) == NULL);
+
+  values[0].derive = 300;
+  vl.time = TIME_T_TO_CDTIME_T (1010);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  OK ((rate = uc_get_rate_dispatched (&derive_ds, &vl)) != NULL);
+  EXPECT_EQ_DOUBLE (20.0, rate[0]);
+
+  /* Only the very value list is recognized, unmodified. */
+  other.time = vl.time;
+  OK (uc_get_rate_dispatched (&derive_ds, &other) == NULL);
+  uc_update_done (&other);
+  OK (uc_get_rate_dispatched (&derive_ds, &vl) != NULL);
+  sstrncpy (vl.type_instance, "renamed", sizeof (vl.type_instance));
+  OK (uc_get_rate_dispatched (&derive_ds, &vl) == NULL);
+  sstrncpy (vl.type_instance, "rate", sizeof (vl.type_instance));
+
+  /* A rejected update forgets the previous rates. */
+  OK (uc_update (&derive_ds, &vl) != 0);
+  OK (uc_get_rate_dispatched (&derive_ds, &vl) == NULL);
+
+  return (0);
+}
+
+/* uc_update_batch() applies updates of the same identifier in order and
+ * keeps the rates of every value list in the batch. */
+DEF_TEST(update_batch)
+{
+  enum { NUM = 100 };
+  value_t values[NUM][1];
+  value_list_t vls[NUM];
+  data_set_t const *ds[NUM];
+  value_list_t const *vl[NUM];
+  gauge_t const *rate;
+  gauge_t *r;
+  char name[DATA_MAX_NAME_LEN];
+  size_t i;
+
+  /* More value lists than fit into one chunk, the first two of each
+   * identifier in the same batch. */
+  for (i = 0; i < NUM; i++)
+  {
+    ssnprintf (name, sizeof (name), "%zu", i % (NUM / 2));
+    make_vl (vls + i, values[i], "batch", name);
+    values[i][0].derive = (i < NUM / 2) ? 100 : 200;
+    vls[i].time = TIME_T_TO_CDTIME_T ((i < NUM / 2) ? 1000 : 1010);
+    ds[i] = &derive_ds;
+    vl[i] = vls + i;
+  }
+
+  CHECK_ZERO (uc_update_batch (ds, vl, NUM));
+
+  for (i = 0; i < NUM; i++)
+  {
+    OK ((rate = uc_get_rate_dispatched (&derive_ds, vl[i])) != NULL);
+    if (i < NUM / 2)
+      OK (isnan (rate[0]));
+    else
+      EXPECT_EQ_DOUBLE (10.0, rate[0]);
+    uc_update_done (vl[i]);
+    OK (uc_get_rate_dispatched (&derive_ds, vl[i]) == NULL);
+  }
+
+  CHECK_NOT_NULL (r = uc_get_rate (&derive_ds, vl[NUM - 1]));
+  EXPECT_EQ_DOUBLE (10.0, r[0]);
+  sfree (r);
+
+  /* Old values are rejected without affecting the rest of the batch. */
+  values[0][0].derive = 500;
+  vls[0].time = TIME_T_TO_CDTIME_T (1020);
+  OK (uc_update_batch (ds, vl, 2) != 0);
+  OK ((rate = uc_get_rate_dispatched (&derive_ds, vl[0])) != NULL);
+  EXPECT_EQ_DOUBLE (30.0, rate[0]);
+  OK (uc_get_rate_dispatched (&derive_ds, vl[1]) == NULL);
+
+  return (0);
+}
+
+DEF_TEST(entry_handle)
+{
+  value_t values[1];
+  value_list_t vl;
+  data_source_t gauge_dsrc[] = {
+    {"rx", DS_TYPE_GAUGE, 0, NAN},
+    {"tx", DS_TYPE_GAUGE, 0, NAN}
+  };
+  data_set_t gauge_ds = {"gauge", STATIC_ARRAY_SIZE (gauge_dsrc), gauge_dsrc};
+  uc_entry_t *e;
+  meta_data_t *meta;
+  uint64_t u = 0;
+
+  make_vl (&vl, values, "handle", "meta");
+  OK (uc_acquire (&derive_ds, &vl) == NULL);
+  OK (uc_entry_meta (NULL) == NULL);
+  uc_release (NULL);
+
+  values[0].derive = 1;
+  vl.time = TIME_T_TO_CDTIME_T (1000);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+
+  /* The number of values must match the data set. */
+  OK (uc_acquire (&gauge_ds, &vl) == NULL);
+
+  CHECK_NOT_NULL (e = uc_acquire (&derive_ds, &vl));
+  CHECK_NOT_NULL (meta = uc_entry_meta (e));
+  OK (uc_entry_meta (e) == meta);
+  CHECK_ZERO (meta_data_add_unsigned_int (meta, "first", 23));
+  CHECK_ZERO (meta_data_add_unsigned_int (meta, "second", 42));
+  uc_release (e);
+
+  CHECK_ZERO (uc_meta_data_get_unsigned_int (&vl, "second", &u));
+  EXPECT_EQ_INT (42, (int) u);
+  CHECK_NOT_NULL (e = uc_acquire (NULL, &vl));
+  CHECK_ZERO (meta_data_get_unsigned_int (uc_entry_meta (e), "first", &u));
+  EXPECT_EQ_INT (23, (int) u);
+
+  /* State and hits are shared with the lookup based functions. */
+  OK (uc_entry_rates (e) != NULL);
+  EXPECT_EQ_INT (STATE_OKAY, uc_entry_set_state (e, STATE_WARNING));
+  EXPECT_EQ_INT (0, uc_entry_set_hits (e, 3));
+  uc_release (e);
+
+  EXPECT_EQ_INT (STATE_WARNING, uc_get_state (&derive_ds, &vl));
+  EXPECT_EQ_INT (3, uc_get_hits (&derive_ds, &vl));
+  CHECK_NOT_NULL (e = uc_acquire (&derive_ds, &vl));
+  EXPECT_EQ_INT (STATE_WARNING, uc_entry_get_state (e));
+  EXPECT_EQ_INT (3, uc_entry_get_hits (e));
+  uc_release (e);
+
+  return (0);
+}
+
+DEF_TEST(names_and_timeout)
+{
+  value_t values[1] = {{ .derive = 0 }};
+  value_list_t vl;
+  char **names = NULL;
+  cdtime_t *times = NULL;
+  size_t names_num = 0;
+  size_t expected;
+  size_t i;
+  int j;
+
+  expected = uc_get_size ();
+
+  /* Enough entries to make every shard grow a few times. */
+  for (j = 0; j < 5000; j++)
+  {
+    char pi[DATA_MAX_NAME_LEN];
+
+    ssnprintf (pi, sizeof (pi), "%i", j);
+    make_vl (&vl, values, pi, "");
+    vl.time = TIME_T_TO_CDTIME_T (2000);
+    CHECK_ZERO (uc_update (&derive_ds, &vl));
+  }
+  expected += 5000;
+  EXPECT_EQ_INT ((int) expected, (int) uc_get_size ());
+
+  CHECK_ZERO (uc_get_names (&names, &times, &names_num));
+  EXPECT_EQ_INT ((int) expected, (int) names_num);
+  for (i = 1; i < names_num; i++)
+    OK (strcmp (names[i - 1], names[i]) < 0);
+  for (i = 0; i < names_num; i++)
+    sfree (names[i]);
+  sfree (names);
+  sfree (times);
+
+  /* Nothing has expired yet. */
+  missing_num = 0;
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (0, missing_num);
+  EXPECT_EQ_INT ((int) expected, (int) uc_get_size ());
+
+  /* Refresh half of the entries. */
+  cdtime_mock += TIME_T_TO_CDTIME_T (15);
+  for (j = 0; j < 2500; j++)
+  {
+    char pi[DATA_MAX_NAME_LEN];
+
+    ssnprintf (pi, sizeof (pi), "%i", j);
+    make_vl (&vl, values, pi, "");
+    vl.time = TIME_T_TO_CDTIME_T (2015);
+    CHECK_ZERO (uc_update (&derive_ds, &vl));
+  }
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (0, missing_num);
+
+  /* After timeout_g intervals only the refreshed entries are left. */
+  cdtime_mock += TIME_T_TO_CDTIME_T (5);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT ((int) expected - 2500, missing_num);
+  EXPECT_EQ_INT (2500, (int) uc_get_size ());
+
+  /* Nothing is reported twice. */
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT ((int) expected - 2500, missing_num);
+
+  cdtime_mock += TIME_T_TO_CDTIME_T (15);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT ((int) expected, missing_num);
+  EXPECT_EQ_INT (0, (int) uc_get_size ());
+
+  names_num = 0;
+  CHECK_ZERO (uc_get_names (&names, &times, &names_num));
+  EXPECT_EQ_INT (0, (int) names_num);
+
+  return (0);
+}
+
+DEF_TEST(iterator)
+{
+  value_t values[1] = {{ .derive = 0 }};
+  value_list_t vl;
+  uc_iter_t *iter;
+  char **names = NULL;
+  size_t names_num = 0;
+  char *name;
+  size_t total;
+  size_t count;
+  size_t i;
+  int j;
+
+  for (j = 0; j < 100; j++)
+  {
+    char pi[DATA_MAX_NAME_LEN];
+
+    ssnprintf (pi, sizeof (pi), "%i", j);
+    make_vl (&vl, values, pi, "");
+    if (j % 2)
+      sstrncpy (vl.host, "example.org", sizeof (vl.host));
+    vl.time = cdtime_mock;
+    CHECK_ZERO (uc_update (&derive_ds, &vl));
+  }
+  total = uc_get_size ();
+
+  CHECK_NOT_NULL (iter = uc_get_iterator (NULL));
+  count = 0;
+  while (uc_iterator_next (iter, &name) == 0)
+  {
+    cdtime_t t = 0;
+    gauge_t *rates = NULL;
+    size_t rates_num = 0;
+
+    CHECK_ZERO (uc_iterator_get_time (iter, &t));
+    EXPECT_EQ_INT ((int) CDTIME_T_TO_TIME_T (cdtime_mock),
+	(int) CDTIME_T_TO_TIME_T (t));
+    CHECK_ZERO (uc_iterator_get_values (iter, &rates, &rates_num));
+    EXPECT_EQ_INT (1, (int) rates_num);
+    count++;
+  }
+  EXPECT_EQ_INT ((int) total, (int) count);
+  OK (uc_iterator_get_time (iter, &(cdtime_t) {0}) != 0);
+  uc_iterator_destroy (iter);
+
+  /* A host prefix only returns the values of that host. */
+  CHECK_NOT_NULL (iter = uc_get_iterator ("example.org/"));
+  count = 0;
+  while (uc_iterator_next (iter, &name) == 0)
+  {
+    OK (strncmp ("example.org/", name, strlen ("example.org/")) == 0);
+    count++;
+  }
+  EXPECT_EQ_INT (50, (int) count);
+  uc_iterator_destroy (iter);
+
+  /* Wildcards match the whole name, slashes included. */
+  CHECK_NOT_NULL (iter = uc_get_iterator_glob ("example.org/*-1?/*"));
+  count = 0;
+  while (uc_iterator_next (iter, &name) == 0)
+  {
+    OK (strncmp ("example.org/", name, strlen ("example.org/")) == 0);
+    count++;
+  }
+  /* 11, 13, ..., 19 */
+  EXPECT_EQ_INT (5, (int) count);
+  uc_iterator_destroy (iter);
+
+  CHECK_NOT_NULL (iter = uc_get_iterator_glob ("*/test-1"));
+  count = 0;
+  while (uc_iterator_next (iter, &name) == 0)
+    count++;
+  EXPECT_EQ_INT (0, (int) count);
+  uc_iterator_destroy (iter);
+
+  CHECK_ZERO (uc_get_names_prefix ("example.org/test-1", &names, NULL,
+	&names_num));
+  /* 1, 11, 13, ..., 19 */
+  EXPECT_EQ_INT (6, (int) names_num);
+  for (i = 1; i < names_num; i++)
+    OK (strcmp (names[i - 1], names[i]) < 0);
+  for (i = 0; i < names_num; i++)
+    sfree (names[i]);
+  sfree (names);
+
+  return (0);
+}
+
+DEF_TEST(persist)
+{
+  char file[] = "/tmp/utils_cache_test.XXXXXX";
+  value_t values[1];
+  value_list_t vl;
+  gauge_t *rate;
+  cdtime_t start;
+  int fd;
+
+  /* Start with an empty cache. */
+  cdtime_mock += TIME_T_TO_CDTIME_T (100);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (0, (int) uc_get_size ());
+  start = cdtime_mock;
+
+  CHECK_ZERO (uc_restore ("/tmp/utils_cache_test.does-not-exist"));
+
+  make_vl (&vl, values, "", "persist");
+  values[0].derive = 100;
+  vl.time = start;
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  EXPECT_EQ_INT (0, uc_set_hits (&derive_ds, &vl, 7));
+
+  fd = mkstemp (file);
+  OK (fd >= 0);
+  close (fd);
+  CHECK_ZERO (uc_persist (file));
+
+  cdtime_mock += TIME_T_TO_CDTIME_T (25);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (0, (int) uc_get_size ());
+
+  /* With a longer timeout, the entry is still current and comes back, so
+   * the first update after restoring it yields a rate. */
+  timeout_g = 10;
+  CHECK_ZERO (uc_restore (file));
+  timeout_g = 2;
+  EXPECT_EQ_INT (1, (int) uc_get_size ());
+  EXPECT_EQ_INT (7, uc_get_hits (&derive_ds, &vl));
+
+  values[0].derive = 400;
+  vl.time = start + TIME_T_TO_CDTIME_T (30);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  CHECK_NOT_NULL (rate = uc_get_rate (&derive_ds, &vl));
+  EXPECT_EQ_DOUBLE (10.0, rate[0]);
+  sfree (rate);
+
+  /* Entries which have timed out in the meantime are discarded. */
+  cdtime_mock += TIME_T_TO_CDTIME_T (100);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (0, (int) uc_get_size ());
+  CHECK_ZERO (uc_restore (file));
+  EXPECT_EQ_INT (0, (int) uc_get_size ());
+
+  unlink (file);
+  return (0);
+}
+
+DEF_TEST(shared_memory)
+{
+  char file[] = "/tmp/utils_cache_test.XXXXXX";
+  value_t values[1];
+  value_list_t vl;
+  uc_shm_header_t *header;
+  uc_shm_slot_t *slot;
+  struct stat statbuf;
+  void *map;
+  size_t i;
+  int fd;
+
+  cdtime_mock += TIME_T_TO_CDTIME_T (100);
+  CHECK_ZERO (uc_check_timeout ());
+
+  fd = mkstemp (file);
+  OK (fd >= 0);
+  close (fd);
+  CHECK_ZERO (uc_shm_open (file, 5));
+
+  make_vl (&vl, values, "", "shm");
+  values[0].derive = 100;
+  vl.time = cdtime_mock;
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+  values[0].derive = 200;
+  vl.time = cdtime_mock + TIME_T_TO_CDTIME_T (10);
+  CHECK_ZERO (uc_update (&derive_ds, &vl));
+
+  fd = open (file, O_RDONLY);
+  OK (fd >= 0);
+  CHECK_ZERO (fstat (fd, &statbuf));
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  OK (map != MAP_FAILED);
+
+  /* The table size is rounded up to a power of two. */
+  header = map;
+  EXPECT_EQ_STR (UC_SHM_MAGIC, header->magic);
+  EXPECT_EQ_INT (8, (int) header->slots_num);
+  EXPECT_EQ_INT (1, (int) header->active);
+
+  slot = (uc_shm_slot_t *) (header + 1);
+  slot += identifier_hash_name ("example.com/test/derive-shm") % 8;
+  EXPECT_EQ_INT (UC_SHM_SLOT_USED, (int) slot->state);
+  EXPECT_EQ_STR ("example.com/test/derive-shm", slot->name);
+  EXPECT_EQ_INT (0, (int) (slot->seq % 2));
+  EXPECT_EQ_INT (1, (int) slot->values_num);
+  EXPECT_EQ_DOUBLE (10.0, slot->values[0]);
+  EXPECT_EQ_UINT64 ((uint64_t) vl.time, slot->time);
+
+  /* Entries which time out are removed from the table. */
+  cdtime_mock += TIME_T_TO_CDTIME_T (100);
+  CHECK_ZERO (uc_check_timeout ());
+  slot = (uc_shm_slot_t *) (header + 1);
+  for (i = 0; i < 8; i++)
+    EXPECT_EQ_INT (UC_SHM_SLOT_EMPTY, (int) slot[i].state);
+
+  uc_shm_close ();
+  EXPECT_EQ_INT (0, (int) header->active);
+  munmap (map, (size_t) statbuf.st_size);
+  OK (access (file, F_OK) != 0);
+
+  return (0);
+}
+
+int main (void)
+{
+  cdtime_mock = TIME_T_TO_CDTIME_T (2000);
+  uc_init ();
+
+  RUN_TEST(update);
+  RUN_TEST(rate_dispatched);
+  RUN_TEST(update_batch);
+  RUN_TEST(entry_handle);
+  RUN_TEST(names_and_timeout);
+  RUN_TEST(iterator);
+  RUN_TEST(persist);
+  RUN_TEST(shared_memory);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,678 @@
+/**
+ * collectd - src/daemon/utils_handover.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_cache.h"
+#include "utils_handover.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Every socket is sent as a record of this size holding its key, with the
+ * descriptor attached. A record with an empty key ends the list. */
+#define HANDOVER_KEY_LEN 256
+
+/* How often, in milliseconds, the handover thread checks whether the daemon
+ * is shutting down. */
+#define HANDOVER_POLL_TIMEOUT 1000
+
+typedef struct handover_socket_s handover_socket_t;
+struct handover_socket_s
+{
+  char key[HANDOVER_KEY_LEN];
+  int fd;
+  handover_socket_t *next;
+};
+
+/* Protects the socket lists and the flags below. */
+static pthread_mutex_t handover_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Sockets registered by the plugins of this instance. */
+static handover_socket_t *handover_registered = NULL;
+/* Sockets received from the previous instance and not taken yet. */
+static handover_socket_t *handover_received = NULL;
+static _Bool handover_stopping = 0;
+static _Bool handover_handed_over = 0;
+
+/* Connection to the previous instance, open until handover_listen(). */
+static int handover_peer_fd = -1;
+
+static int handover_listen_fd = -1;
+static char *handover_listen_path = NULL;
+static pthread_t handover_thread_id;
+static _Bool handover_thread_running = 0;
+
+static int handover_key (char *buffer, size_t buffer_size, /* {{{ */
+    const char *owner, const struct addrinfo *ai, size_t index)
+{
+  char host[256];
+  char service[32];
+  int status;
+
+  status = getnameinfo (ai->ai_addr, ai->ai_addrlen,
+      host, sizeof (host), service, sizeof (service),
+      NI_NUMERICHOST | NI_NUMERICSERV);
+  if (status != 0)
+  {
+    ERROR ("handover: getnameinfo failed: %s", gai_strerror (status));
+    return (-1);
+  }
+
+  status = ssnprintf (buffer, buffer_size, "%s/%s/[%s]:%s/%zu", owner,
+      (ai->ai_socktype == SOCK_STREAM) ? "stream" : "dgram",
+      host, service, index);
+  if ((status < 0) || ((size_t) status >= buffer_size))
+  {
+    ERROR ("handover: The key of a socket of \"%s\" is too long.", owner);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int handover_key */
+
+static void handover_list_free (handover_socket_t *list, /* {{{ */
+    _Bool close_fd)
+{
+  while (list != NULL)
+  {
+    handover_socket_t *next = list->next;
+
+    if (close_fd)
+      close (list->fd);
+    sfree (list);
+    list = next;
+  }
+} /* }}} void handover_list_free */
+
+/* Sends `key' and, unless `sock' is negative, the descriptor `sock'. */
+static int handover_send (int fd, const char *key, int sock) /* {{{ */
+{
+  char buffer[HANDOVER_KEY_LEN];
+  union
+  {
+    struct cmsghdr header;
+    char data[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  ssize_t status;
+
+  memset (buffer, 0, sizeof (buffer));
+  sstrncpy (buffer, key, sizeof (buffer));
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof (buffer);
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (sock >= 0)
+  {
+    struct cmsghdr *cm;
+
+    memset (&control, 0, sizeof (control));
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof (control.data);
+
+    cm = CMSG_FIRSTHDR (&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN (sizeof (int));
+    memcpy (CMSG_DATA (cm), &sock, sizeof (int));
+  }
+
+  do
+    status = sendmsg (fd, &msg, 0);
+  while ((status < 0) && (errno == EINTR));
+
+  if (status != (ssize_t) sizeof (buffer))
+  {
+    char errbuf[1024];
+    ERROR ("handover: sendmsg failed: %s",
+        (status < 0) ? sstrerror (errno, errbuf, sizeof (errbuf))
+        : "short write");
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int handover_send */
+
+/* Receives one record. `*ret_sock' is -1 if no descriptor was attached. */
+static int handover_recv (int fd, char *key, int *ret_sock) /* {{{ */
+{
+  union
+  {
+    struct cmsghdr header;
+    char data[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  size_t received;
+  ssize_t status;
+
+  *ret_sock = -1;
+
+  iov.iov_base = key;
+  iov.iov_len = HANDOVER_KEY_LEN;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data;
+  msg.msg_controllen = sizeof (control.data);
+
+  do
+    status = recvmsg (fd, &msg, 0);
+  while ((status < 0) && (errno == EINTR));
+
+  if (status <= 0)
+  {
+    char errbuf[1024];
+    ERROR ("handover: recvmsg failed: %s",
+        (status < 0) ? sstrerror (errno, errbuf, sizeof (errbuf))
+        : "connection closed");
+    return (-1);
+  }
+
+  for (cm = CMSG_FIRSTHDR (&msg); cm != NULL; cm = CMSG_NXTHDR (&msg, cm))
+  {
+    if ((cm->cmsg_level != SOL_SOCKET) || (cm->cmsg_type != SCM_RIGHTS)
+        || (cm->cmsg_len < CMSG_LEN (sizeof (int))))
+      continue;
+
+    if (*ret_sock >= 0)
+      close (*ret_sock);
+    memcpy (ret_sock, CMSG_DATA (cm), sizeof (int));
+  }
+
+  if ((msg.msg_flags & MSG_CTRUNC) != 0)
+  {
+    ERROR ("handover: The control data of a socket was truncated.");
+    if (*ret_sock >= 0)
+      close (*ret_sock);
+    *ret_sock = -1;
+    return (-1);
+  }
+
+  /* The descriptor arrives with the first part of a record, the rest may
+   * follow in further reads. */
+  received = (size_t) status;
+  while (received < HANDOVER_KEY_LEN)
+  {
+    status = read (fd, key + received, HANDOVER_KEY_LEN - received);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if (status <= 0)
+    {
+      ERROR ("handover: Reading a socket record failed.");
+      if (*ret_sock >= 0)
+        close (*ret_sock);
+      *ret_sock = -1;
+      return (-1);
+    }
+    received += (size_t) status;
+  }
+
+  key[HANDOVER_KEY_LEN - 1] = 0;
+  return (0);
+} /* }}} int handover_recv */
+
+static int handover_address (struct sockaddr_un *sa, /* {{{ */
+    const char *path)
+{
+  memset (sa, 0, sizeof (*sa));
+  sa->sun_family = AF_UNIX;
+
+  if (strlen (path) >= sizeof (sa->sun_path))
+  {
+    ERROR ("handover: The path \"%s\" is too long.", path);
+    return (ENAMETOOLONG);
+  }
+  sstrncpy (sa->sun_path, path, sizeof (sa->sun_path));
+
+  return (0);
+} /* }}} int handover_address */
+
+int handover_receive (const char *path) /* {{{ */
+{
+  struct sockaddr_un sa;
+  handover_socket_t *list = NULL;
+  size_t sockets_num = 0;
+  int status;
+  int fd;
+
+  if (path == NULL)
+    return (EINVAL);
+
+  status = handover_address (&sa, path);
+  if (status != 0)
+    return (status);
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    status = errno;
+    ERROR ("handover: socket failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+
+  if (connect (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+  {
+    char errbuf[1024];
+
+    status = errno;
+    close (fd);
+
+    /* Nobody there: this is the first instance. */
+    if ((status == ENOENT) || (status == ECONNREFUSED))
+      return (ENOENT);
+
+    ERROR ("handover: connect (%s) failed: %s", path,
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+
+  while (42)
+  {
+    handover_socket_t *hs;
+    char key[HANDOVER_KEY_LEN];
+    int sock;
+
+    status = handover_recv (fd, key, &sock);
+    if (status != 0)
+      break;
+
+    if (key[0] == 0)
+    {
+      if (sock >= 0)
+        close (sock);
+      break;
+    }
+
+    if (sock < 0)
+    {
+      WARNING ("handover: No descriptor was received for \"%s\".", key);
+      continue;
+    }
+
+    hs = calloc (1, sizeof (*hs));
+    if (hs == NULL)
+    {
+      ERROR ("handover: calloc failed.");
+      close (sock);
+      continue;
+    }
+    sstrncpy (hs->key, key, sizeof (hs->key));
+    hs->fd = sock;
+    hs->next = list;
+    list = hs;
+    sockets_num++;
+  }
+
+  if (status != 0)
+  {
+    ERROR ("handover: Receiving the sockets from the running instance "
+        "failed. Starting without them.");
+    handover_list_free (list, /* close_fd = */ 1);
+    close (fd);
+    return (status);
+  }
+
+  pthread_mutex_lock (&handover_lock);
+  handover_received = list;
+  pthread_mutex_unlock (&handover_lock);
+  handover_peer_fd = fd;
+
+  INFO ("handover: Received %zu socket%s from the running instance.",
+      sockets_num, (sockets_num == 1) ? "" : "s");
+  return (0);
+} /* }}} int handover_receive */
+
+static _Bool handover_is_stopping (void) /* {{{ */
+{
+  _Bool stopping;
+
+  pthread_mutex_lock (&handover_lock);
+  stopping = handover_stopping;
+  pthread_mutex_unlock (&handover_lock);
+
+  return (stopping);
+} /* }}} _Bool handover_is_stopping */
+
+/* Hands the sockets over to the new instance connected to `fd' and waits
+ * until it is initialized. */
+static void handover_serve (int fd) /* {{{ */
+{
+  const char *cache_file;
+  handover_socket_t *hs;
+  char done = 0;
+  int status = 0;
+
+  INFO ("handover: A new instance connected, handing over the sockets.");
+
+  /* Written before the sockets are sent, so the new instance finds it when
+   * it initializes the cache. */
+  cache_file = global_option_get ("CacheFile");
+  if ((cache_file != NULL) && (cache_file[0] != 0))
+    uc_persist (cache_file);
+
+  pthread_mutex_lock (&handover_lock);
+  for (hs = handover_registered; (hs != NULL) && (status == 0); hs = hs->next)
+    status = handover_send (fd, hs->key, hs->fd);
+  pthread_mutex_unlock (&handover_lock);
+
+  if (status == 0)
+    status = handover_send (fd, "", -1);
+  if (status != 0)
+  {
+    ERROR ("handover: Sending the sockets to the new instance failed.");
+    return;
+  }
+
+  /* The new instance sends one byte once it is initialized and closes the
+   * connection without it if it fails. */
+  status = 0;
+  while (!handover_is_stopping ())
+  {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    status = poll (&pfd, 1, HANDOVER_POLL_TIMEOUT);
+    if (status == 0)
+      continue;
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if (status > 0)
+      status = (int) read (fd, &done, 1);
+    break;
+  }
+
+  if (status != 1)
+  {
+    if (!handover_is_stopping ())
+      WARNING ("handover: The new instance exited before it was "
+          "initialized. Continuing to run.");
+    return;
+  }
+
+  pthread_mutex_lock (&handover_lock);
+  handover_handed_over = 1;
+  pthread_mutex_unlock (&handover_lock);
+
+  INFO ("handover: The new instance is running, shutting down.");
+  kill (getpid (), SIGTERM);
+} /* }}} void handover_serve */
+
+static void *handover_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  while (!handover_is_stopping () && !handover_done ())
+  {
+    struct pollfd pfd = { .fd = handover_listen_fd, .events = POLLIN };
+    int status;
+    int fd;
+
+    status = poll (&pfd, 1, HANDOVER_POLL_TIMEOUT);
+    if (status <= 0)
+    {
+      if ((status < 0) && (errno != EINTR))
+      {
+        char errbuf[1024];
+        ERROR ("handover: poll failed: %s",
+            sstrerror (errno, errbuf, sizeof (errbuf)));
+        break;
+      }
+      continue;
+    }
+
+    fd = accept (handover_listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+
+    handover_serve (fd);
+    close (fd);
+  }
+
+  return (NULL);
+} /* }}} void *handover_thread */
+
+int handover_listen (const char *path) /* {{{ */
+{
+  struct sockaddr_un sa;
+  handover_socket_t *hs;
+  int status;
+
+  if (handover_peer_fd >= 0)
+  {
+    char done = 1;
+
+    if (write (handover_peer_fd, &done, 1) != 1)
+    {
+      char errbuf[1024];
+      WARNING ("handover: Telling the previous instance to shut down "
+          "failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+    close (handover_peer_fd);
+    handover_peer_fd = -1;
+  }
+
+  pthread_mutex_lock (&handover_lock);
+  for (hs = handover_received; hs != NULL; hs = hs->next)
+    NOTICE ("handover: No plugin took over the socket \"%s\", closing it.",
+        hs->key);
+  handover_list_free (handover_received, /* close_fd = */ 1);
+  handover_received = NULL;
+  pthread_mutex_unlock (&handover_lock);
+
+  if (path == NULL)
+    return (EINVAL);
+
+  status = handover_address (&sa, path);
+  if (status != 0)
+    return (status);
+
+  handover_listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (handover_listen_fd < 0)
+  {
+    char errbuf[1024];
+    status = errno;
+    ERROR ("handover: socket failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (status);
+  }
+
+  /* A running previous instance keeps its listening socket until it exits,
+   * but is no longer reachable under this name. */
+  unlink (path);
+  if ((bind (handover_listen_fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+      || (chmod (path, S_IRUSR | S_IWUSR) != 0)
+      || (listen (handover_listen_fd, /* backlog = */ 4) != 0))
+  {
+    char errbuf[1024];
+    status = errno;
+    ERROR ("handover: Listening on \"%s\" failed: %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (handover_listen_fd);
+    handover_listen_fd = -1;
+    return (status);
+  }
+
+  handover_listen_path = sstrdup (path);
+
+  status = pthread_create (&handover_thread_id, /* attr = */ NULL,
+      handover_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("handover: pthread_create failed.");
+    return (status);
+  }
+  handover_thread_running = 1;
+
+  return (0);
+} /* }}} int handover_listen */
+
+void handover_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&handover_lock);
+  handover_stopping = 1;
+  pthread_mutex_unlock (&handover_lock);
+
+  if (handover_thread_running)
+  {
+    pthread_join (handover_thread_id, /* retval = */ NULL);
+    handover_thread_running = 0;
+  }
+
+  if (handover_listen_fd >= 0)
+  {
+    close (handover_listen_fd);
+    handover_listen_fd = -1;
+    /* After a handover, the name belongs to the new instance. */
+    if ((handover_listen_path != NULL) && !handover_done ())
+      unlink (handover_listen_path);
+  }
+  sfree (handover_listen_path);
+
+  if (handover_peer_fd >= 0)
+  {
+    close (handover_peer_fd);
+    handover_peer_fd = -1;
+  }
+
+  pthread_mutex_lock (&handover_lock);
+  handover_list_free (handover_received, /* close_fd = */ 1);
+  handover_received = NULL;
+  /* The plugins close their own sockets. */
+  handover_list_free (handover_registered, /* close_fd = */ 0);
+  handover_registered = NULL;
+  pthread_mutex_unlock (&handover_lock);
+} /* }}} void handover_shutdown */
+
+_Bool handover_done (void) /* {{{ */
+{
+  _Bool done;
+
+  pthread_mutex_lock (&handover_lock);
+  done = handover_handed_over;
+  pthread_mutex_unlock (&handover_lock);
+
+  return (done);
+} /* }}} _Bool handover_done */
+
+int handover_socket_get (const char *owner, /* {{{ */
+    const struct addrinfo *ai, size_t index)
+{
+  char key[HANDOVER_KEY_LEN];
+  handover_socket_t *prev = NULL;
+  handover_socket_t *hs;
+  int fd = -1;
+
+  if ((owner == NULL) || (ai == NULL))
+    return (-1);
+
+  pthread_mutex_lock (&handover_lock);
+  if ((handover_received == NULL)
+      || (handover_key (key, sizeof (key), owner, ai, index) != 0))
+  {
+    pthread_mutex_unlock (&handover_lock);
+    return (-1);
+  }
+
+  for (hs = handover_received; hs != NULL; prev = hs, hs = hs->next)
+    if (strcmp (hs->key, key) == 0)
+      break;
+
+  if (hs != NULL)
+  {
+    if (prev == NULL)
+      handover_received = hs->next;
+    else
+      prev->next = hs->next;
+    fd = hs->fd;
+    sfree (hs);
+  }
+  pthread_mutex_unlock (&handover_lock);
+
+  if (fd >= 0)
+    INFO ("handover: Took over the socket \"%s\".", key);
+  return (fd);
+} /* }}} int handover_socket_get */
+
+int handover_socket_put (const char *owner, /* {{{ */
+    const struct addrinfo *ai, size_t index, int fd)
+{
+  handover_socket_t *hs;
+
+  if ((owner == NULL) || (ai == NULL) || (fd < 0))
+    return (EINVAL);
+
+  hs = calloc (1, sizeof (*hs));
+  if (hs == NULL)
+  {
+    ERROR ("handover: calloc failed.");
+    return (ENOMEM);
+  }
+
+  if (handover_key (hs->key, sizeof (hs->key), owner, ai, index) != 0)
+  {
+    sfree (hs);
+    return (EINVAL);
+  }
+  hs->fd = fd;
+
+  pthread_mutex_lock (&handover_lock);
+  hs->next = handover_registered;
+  handover_registered = hs;
+  pthread_mutex_unlock (&handover_lock);
+
+  return (0);
+} /* }}} int handover_socket_put */
+
+void handover_socket_forget (int fd) /* {{{ */
+{
+  handover_socket_t **hs;
+
+  pthread_mutex_lock (&handover_lock);
+  hs = &handover_registered;
+  while (*hs != NULL)
+  {
+    handover_socket_t *this = *hs;
+
+    if (this->fd != fd)
+    {
+      hs = &this->next;
+      continue;
+    }
+
+    *hs = this->next;
+    sfree (this);
+  }
+  pthread_mutex_unlock (&handover_lock);
+} /* }}} void handover_socket_forget */
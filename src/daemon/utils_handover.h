@@ -0,0 +1,98 @@
+/**
+ * collectd - src/daemon/utils_handover.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_HANDOVER_H
+#define UTILS_HANDOVER_H 1
+
+#include <netdb.h>
+
+/*
+ * Restarts without a gap: the new instance of the daemon connects to the
+ * handover socket of the running one before reading its configuration and
+ * receives the listening sockets of its plugins. The running instance writes
+ * the value cache to its "CacheFile" before, so the new instance restores it
+ * during initialization. Once the new instance is initialized, it tells the
+ * running one to shut down and takes over the handover socket.
+ *
+ * Sockets are identified by the name of the plugin, the socket type, the
+ * numeric address and an index, so a socket is only taken over if the new
+ * configuration asks for the same address.
+ */
+
+/*
+ * NAME
+ *   handover_receive
+ *
+ * DESCRIPTION
+ *   Connects to the instance listening on `path' and receives its sockets.
+ *   Must be called before the plugins are configured.
+ *
+ * RETURN VALUE
+ *   Zero if a running instance handed over its sockets, ENOENT if no instance
+ *   is listening on `path' and another errno value on failure. In the last
+ *   two cases the daemon starts as usual.
+ */
+int handover_receive (const char *path);
+
+/*
+ * NAME
+ *   handover_listen
+ *
+ * DESCRIPTION
+ *   Called once the daemon is initialized. Tells the previous instance, if
+ *   any, to shut down, closes the sockets no plugin has taken and starts
+ *   listening on `path' for the next instance.
+ */
+int handover_listen (const char *path);
+
+/* Stops listening and closes all remaining sockets. The handover socket is
+ * removed unless a new instance has taken it over. */
+void handover_shutdown (void);
+
+/* Returns true once a new instance has taken over from this one. */
+_Bool handover_done (void);
+
+/*
+ * NAME
+ *   handover_socket_get
+ *
+ * DESCRIPTION
+ *   Returns the socket the previous instance had registered for `owner', the
+ *   address and type in `ai' and `index'. The socket is already bound and,
+ *   for stream sockets, listening. Each socket is returned only once.
+ *
+ * RETURN VALUE
+ *   A file descriptor or -1 if the previous instance had no such socket, in
+ *   which case the plugin opens it as usual.
+ */
+int handover_socket_get (const char *owner, const struct addrinfo *ai,
+    size_t index);
+
+/* Registers a listening socket, so that it is handed over to the next
+ * instance. Call handover_socket_forget() before closing it. */
+int handover_socket_put (const char *owner, const struct addrinfo *ai,
+    size_t index, int fd);
+
+void handover_socket_forget (int fd);
+
+#endif /* UTILS_HANDOVER_H */
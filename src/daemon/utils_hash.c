@@ -0,0 +1,278 @@
+/**
+ * collectd - src/daemon/utils_hash.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_hash.h"
+
+#include <pthread.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define HASH_HAVE_SSE42 1
+#endif
+
+#if defined(__ARM_FEATURE_CRC32) && defined(__BYTE_ORDER__) \
+  && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+# include <arm_acle.h>
+# define HASH_HAVE_ARM_CRC32 1
+#endif
+
+#define CRC32_POLY  0xedb88320U /* reflected 0x04c11db7 */
+#define CRC32C_POLY 0x82f63b78U /* reflected 0x1edc6f41 */
+
+typedef uint32_t (*crc_func_t) (uint32_t, const unsigned char *, size_t);
+
+/* Tables for "slicing by eight": tab[k][n] is the CRC of byte n followed by k
+ * null bytes, so eight bytes are processed with eight lookups at a time. */
+static uint32_t crc32_tab[8][256];
+static uint32_t crc32c_tab[8][256];
+
+static crc_func_t crc32c_func;
+
+static pthread_once_t hash_once = PTHREAD_ONCE_INIT;
+
+static uint32_t load_le32 (const unsigned char *p) /* {{{ */
+{
+  return (((uint32_t) p[0]) | (((uint32_t) p[1]) << 8)
+      | (((uint32_t) p[2]) << 16) | (((uint32_t) p[3]) << 24));
+} /* }}} uint32_t load_le32 */
+
+static uint64_t load_le64 (const unsigned char *p) /* {{{ */
+{
+  return (((uint64_t) load_le32 (p)) | (((uint64_t) load_le32 (p + 4)) << 32));
+} /* }}} uint64_t load_le64 */
+
+static void crc_tab_init (uint32_t tab[8][256], uint32_t poly) /* {{{ */
+{
+  uint32_t n;
+  int k;
+
+  for (n = 0; n < 256; n++)
+  {
+    uint32_t crc = n;
+
+    for (k = 0; k < 8; k++)
+      crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+    tab[0][n] = crc;
+  }
+
+  for (n = 0; n < 256; n++)
+    for (k = 1; k < 8; k++)
+      tab[k][n] = (tab[k - 1][n] >> 8) ^ tab[0][tab[k - 1][n] & 0xff];
+} /* }}} void crc_tab_init */
+
+static uint32_t crc_soft (uint32_t tab[8][256], uint32_t crc, /* {{{ */
+    const unsigned char *p, size_t len)
+{
+  while (len >= 8)
+  {
+    uint32_t lo = crc ^ load_le32 (p);
+    uint32_t hi = load_le32 (p + 4);
+
+    crc = tab[7][lo & 0xff] ^ tab[6][(lo >> 8) & 0xff]
+      ^ tab[5][(lo >> 16) & 0xff] ^ tab[4][lo >> 24]
+      ^ tab[3][hi & 0xff] ^ tab[2][(hi >> 8) & 0xff]
+      ^ tab[1][(hi >> 16) & 0xff] ^ tab[0][hi >> 24];
+
+    p += 8;
+    len -= 8;
+  }
+
+  while (len > 0)
+  {
+    crc = tab[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    p++;
+    len--;
+  }
+
+  return (crc);
+} /* }}} uint32_t crc_soft */
+
+static uint32_t crc32c_soft (uint32_t crc, /* {{{ */
+    const unsigned char *p, size_t len)
+{
+  return (crc_soft (crc32c_tab, crc, p, len));
+} /* }}} uint32_t crc32c_soft */
+
+#if HASH_HAVE_SSE42
+__attribute__ ((target ("sse4.2")))
+static uint32_t crc32c_sse42 (uint32_t crc, /* {{{ */
+    const unsigned char *p, size_t len)
+{
+  uint64_t crc64 = crc;
+
+  while (len >= 8)
+  {
+    uint64_t v;
+
+    memcpy (&v, p, sizeof (v));
+    crc64 = __builtin_ia32_crc32di (crc64, v);
+    p += 8;
+    len -= 8;
+  }
+
+  crc = (uint32_t) crc64;
+  while (len > 0)
+  {
+    crc = __builtin_ia32_crc32qi (crc, *p);
+    p++;
+    len--;
+  }
+
+  return (crc);
+} /* }}} uint32_t crc32c_sse42 */
+#endif /* HASH_HAVE_SSE42 */
+
+#if HASH_HAVE_ARM_CRC32
+static uint32_t crc32_arm (uint32_t crc, /* {{{ */
+    const unsigned char *p, size_t len)
+{
+  while (len >= 8)
+  {
+    uint64_t v;
+
+    memcpy (&v, p, sizeof (v));
+    crc = __crc32d (crc, v);
+    p += 8;
+    len -= 8;
+  }
+
+  while (len > 0)
+  {
+    crc = __crc32b (crc, *p);
+    p++;
+    len--;
+  }
+
+  return (crc);
+} /* }}} uint32_t crc32_arm */
+
+static uint32_t crc32c_arm (uint32_t crc, /* {{{ */
+    const unsigned char *p, size_t len)
+{
+  while (len >= 8)
+  {
+    uint64_t v;
+
+    memcpy (&v, p, sizeof (v));
+    crc = __crc32cd (crc, v);
+    p += 8;
+    len -= 8;
+  }
+
+  while (len > 0)
+  {
+    crc = __crc32cb (crc, *p);
+    p++;
+    len--;
+  }
+
+  return (crc);
+} /* }}} uint32_t crc32c_arm */
+#endif /* HASH_HAVE_ARM_CRC32 */
+
+static void hash_init (void) /* {{{ */
+{
+  crc_tab_init (crc32_tab, CRC32_POLY);
+  crc_tab_init (crc32c_tab, CRC32C_POLY);
+
+  crc32c_func = crc32c_soft;
+#if HASH_HAVE_ARM_CRC32
+  crc32c_func = crc32c_arm;
+#elif HASH_HAVE_SSE42
+  if (__builtin_cpu_supports ("sse4.2"))
+    crc32c_func = crc32c_sse42;
+#endif
+} /* }}} void hash_init */
+
+uint32_t hash_crc32 (uint32_t crc, const void *buf, size_t len) /* {{{ */
+{
+#if HASH_HAVE_ARM_CRC32
+  return (crc32_arm (crc, buf, len));
+#else
+  pthread_once (&hash_once, hash_init);
+  return (crc_soft (crc32_tab, crc, buf, len));
+#endif
+} /* }}} uint32_t hash_crc32 */
+
+uint32_t hash_crc32c (uint32_t crc, const void *buf, size_t len) /* {{{ */
+{
+  pthread_once (&hash_once, hash_init);
+  return ((*crc32c_func) (crc, buf, len));
+} /* }}} uint32_t hash_crc32c */
+
+uint64_t hash64 (const void *buf, size_t len, uint64_t seed) /* {{{ */
+{
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const unsigned char *p = buf;
+  uint64_t h = seed ^ (((uint64_t) len) * m);
+
+  while (len >= 8)
+  {
+    uint64_t k = load_le64 (p);
+
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+
+    h ^= k;
+    h *= m;
+
+    p += 8;
+    len -= 8;
+  }
+
+  switch (len)
+  {
+    case 7: h ^= ((uint64_t) p[6]) << 48; /* fall through */
+    case 6: h ^= ((uint64_t) p[5]) << 40; /* fall through */
+    case 5: h ^= ((uint64_t) p[4]) << 32; /* fall through */
+    case 4: h ^= ((uint64_t) p[3]) << 24; /* fall through */
+    case 3: h ^= ((uint64_t) p[2]) << 16; /* fall through */
+    case 2: h ^= ((uint64_t) p[1]) << 8;  /* fall through */
+    case 1: h ^= ((uint64_t) p[0]);
+            h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+
+  return (h);
+} /* }}} uint64_t hash64 */
+
+uint64_t hash_identifier (const value_list_t *vl) /* {{{ */
+{
+  const char *field[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  uint64_t hash = 0;
+  size_t i;
+
+  /* Including the null bytes keeps "a"/"bc" and "ab"/"c" apart. */
+  for (i = 0; i < STATIC_ARRAY_SIZE (field); i++)
+    hash = hash64 (field[i], strlen (field[i]) + 1, hash);
+
+  return (hash);
+} /* }}} uint64_t hash_identifier */
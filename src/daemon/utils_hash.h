@@ -0,0 +1,60 @@
+/**
+ * collectd - src/daemon/utils_hash.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_HASH_H
+#define UTILS_HASH_H 1
+
+#include "plugin.h"
+
+/*
+ * Hash functions shared by the daemon and its plugins. The results are the
+ * same on all platforms and with or without hardware support, so they can be
+ * used to place data on other hosts.
+ */
+
+/*
+ * NAME
+ *   hash_crc32
+ *
+ * DESCRIPTION
+ *   Updates `crc' with `len' bytes of `buf', using the reflected CRC-32
+ *   polynomial of Ethernet and zlib. Neither the initial value nor the result
+ *   is inverted, so the standard checksum is
+ *   ~hash_crc32 (~0U, buf, len). Uses the CRC instructions of ARMv8 where
+ *   available.
+ */
+uint32_t hash_crc32 (uint32_t crc, const void *buf, size_t len);
+
+/* Like hash_crc32(), but with the Castagnoli polynomial of iSCSI and ext4.
+ * Uses the CRC instructions of SSE 4.2 and ARMv8 where available. */
+uint32_t hash_crc32c (uint32_t crc, const void *buf, size_t len);
+
+/* Returns a 64 bit, non-cryptographic hash of `len' bytes of `buf' (the
+ * MurmurHash64A function). Different seeds give independent hashes. */
+uint64_t hash64 (const void *buf, size_t len, uint64_t seed);
+
+/* Returns hash64() of the identifier of `vl', i.e. of its host, plugin,
+ * plugin instance, type and type instance. */
+uint64_t hash_identifier (const value_list_t *vl);
+
+#endif /* UTILS_HASH_H */
@@ -0,0 +1,165 @@
+/**
+ * collectd - src/daemon/utils_hash_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Compares the hash functions of utils_hash with the byte-at-a-time CRC-32
+ * write_kafka used before and with 32 bit FNV-1a, on identifier-like keys and
+ * on larger buffers.
+ *
+ * Usage: bench_utils_hash [iterations]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_hash.h"
+
+#include <time.h>
+
+static uint32_t crc32_table[256];
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+static uint32_t bytewise_crc32 (uint32_t crc, /* {{{ */
+    const void *buf, size_t len)
+{
+  const unsigned char *p = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    crc = crc32_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return (crc);
+} /* }}} uint32_t bytewise_crc32 */
+
+static uint32_t fnv1a (uint32_t hash, const void *buf, size_t len) /* {{{ */
+{
+  const unsigned char *p = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+  {
+    hash ^= p[i];
+    hash *= 16777619U;
+  }
+  return (hash);
+} /* }}} uint32_t fnv1a */
+
+static uint32_t crc32_wrap (uint32_t crc, const void *buf, size_t len)
+{
+  return (hash_crc32 (crc, buf, len));
+}
+
+static uint32_t crc32c_wrap (uint32_t crc, const void *buf, size_t len)
+{
+  return (hash_crc32c (crc, buf, len));
+}
+
+static uint32_t hash64_wrap (uint32_t seed, const void *buf, size_t len)
+{
+  return ((uint32_t) hash64 (buf, len, seed));
+}
+
+int main (int argc, char **argv) /* {{{ */
+{
+  struct {
+    const char *name;
+    uint32_t (*func) (uint32_t, const void *, size_t);
+  } funcs[] = {
+    { "crc32 bytewise", bytewise_crc32 },
+    { "fnv1a",          fnv1a },
+    { "hash_crc32",     crc32_wrap },
+    { "hash_crc32c",    crc32c_wrap },
+    { "hash64",         hash64_wrap },
+  };
+  size_t lengths[] = { 16, 48, 4096 };
+  size_t iterations = 10000000;
+  unsigned char *buffer;
+  uint32_t n;
+  size_t i;
+  size_t j;
+
+  if (argc > 1)
+    iterations = (size_t) atoi (argv[1]);
+  if (iterations < 1)
+  {
+    fprintf (stderr, "Usage: %s [iterations]\n", argv[0]);
+    return (1);
+  }
+
+  for (n = 0; n < 256; n++)
+  {
+    uint32_t crc = n;
+    int k;
+
+    for (k = 0; k < 8; k++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320U : crc >> 1;
+    crc32_table[n] = crc;
+  }
+
+  buffer = malloc (lengths[STATIC_ARRAY_SIZE (lengths) - 1] + 1);
+  if (buffer == NULL)
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+  for (i = 0; i <= lengths[STATIC_ARRAY_SIZE (lengths) - 1]; i++)
+    buffer[i] = (unsigned char) ('a' + (i % 26));
+
+  /* The partitions of write_kafka must not move. */
+  if (bytewise_crc32 (0, buffer, 4096) != hash_crc32 (0, buffer, 4096))
+  {
+    fprintf (stderr, "hash_crc32 differs from the bytewise CRC-32.\n");
+    return (1);
+  }
+
+  for (j = 0; j < STATIC_ARRAY_SIZE (lengths); j++)
+  {
+    size_t len = lengths[j];
+    size_t count = iterations / (1 + len / 64);
+
+    for (i = 0; i < STATIC_ARRAY_SIZE (funcs); i++)
+    {
+      volatile uint32_t sink = 0;
+      double start = now ();
+      double elapsed;
+      size_t k;
+
+      /* Start at varying offsets, as keys aren't aligned either. */
+      for (k = 0; k < count; k++)
+        sink += (*funcs[i].func) ((uint32_t) k, buffer + (k & 1), len - 1);
+
+      elapsed = now () - start;
+      printf ("%-14s %5zu bytes %8.1f ns %8.2f GB/s\n", funcs[i].name, len,
+          1e9 * elapsed / (double) count,
+          (double) (len * count) / elapsed / 1e9);
+    }
+  }
+
+  free (buffer);
+  return (0);
+} /* }}} int main */
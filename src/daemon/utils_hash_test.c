@@ -0,0 +1,113 @@
+/**
+ * collectd - src/daemon/utils_hash_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "testing.h"
+#include "utils_hash.h"
+
+/* Bit by bit, as the polynomial is defined. */
+static uint32_t crc_reference (uint32_t poly, uint32_t crc,
+    const unsigned char *p, size_t len)
+{
+  int k;
+
+  while (len-- > 0)
+  {
+    crc ^= *(p++);
+    for (k = 0; k < 8; k++)
+      crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+  }
+
+  return (crc);
+}
+
+DEF_TEST(crc32)
+{
+  unsigned char buffer[100];
+  size_t i;
+
+  /* The check values of both polynomials. */
+  EXPECT_EQ_UINT64 (0xcbf43926U, ~hash_crc32 (~0U, "123456789", 9));
+  EXPECT_EQ_UINT64 (0xe3069283U, ~hash_crc32c (~0U, "123456789", 9));
+
+  /* Not inverted, as write_kafka's partitioner has always hashed keys. */
+  EXPECT_EQ_UINT64 (0xca6598d0U, hash_crc32 (0, "abc", 3));
+  EXPECT_EQ_UINT64 (0, hash_crc32 (0, "", 0));
+
+  for (i = 0; i < sizeof (buffer); i++)
+    buffer[i] = (unsigned char) (7 * i + 3);
+
+  /* All lengths and alignments take the same result as the reference. */
+  for (i = 0; i < sizeof (buffer); i++)
+  {
+    size_t len = sizeof (buffer) - i;
+
+    EXPECT_EQ_UINT64 (crc_reference (0xedb88320U, ~0U, buffer + i, len),
+        hash_crc32 (~0U, buffer + i, len));
+    EXPECT_EQ_UINT64 (crc_reference (0x82f63b78U, ~0U, buffer + i, len),
+        hash_crc32c (~0U, buffer + i, len));
+  }
+
+  /* Updating in pieces is the same as hashing at once. */
+  EXPECT_EQ_UINT64 (hash_crc32c (0, buffer, sizeof (buffer)),
+      hash_crc32c (hash_crc32c (0, buffer, 13), buffer + 13,
+        sizeof (buffer) - 13));
+
+  return (0);
+}
+
+DEF_TEST(hash64)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+
+  /* Fixed, since the hashes may be used to place data on other hosts. */
+  EXPECT_EQ_UINT64 (0, hash64 ("", 0, 0));
+  EXPECT_EQ_UINT64 (0x071717d2d36b6b11ULL, hash64 ("a", 1, 0));
+  EXPECT_EQ_UINT64 (0x4977490251674330ULL, hash64 ("123456789", 9, 0));
+  EXPECT_EQ_UINT64 (0xd6807ae4b30e7eedULL, hash64 ("hello world!", 12, 42));
+
+  sstrncpy (vl.host, "localhost", sizeof (vl.host));
+  sstrncpy (vl.plugin, "cpu", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, "0", sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, "cpu", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "idle", sizeof (vl.type_instance));
+  EXPECT_EQ_UINT64 (0x28baa100cfa18255ULL, hash_identifier (&vl));
+
+  /* The field boundaries are part of the identifier. */
+  sstrncpy (vl.plugin_instance, "", sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, "0cpu", sizeof (vl.type));
+  OK (hash_identifier (&vl) != 0x28baa100cfa18255ULL);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(crc32);
+  RUN_TEST(hash64);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
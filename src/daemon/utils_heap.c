@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #include "utils_heap.h"
 
@@ -42,68 +43,64 @@ struct c_heap_s
   size_t list_size; /* # entries allocated */
 };
 
-enum reheap_direction
-{
-  DIR_UP,
-  DIR_DOWN
-};
+/* Both heaps are 4-ary: the children of node "i" are "4*i+1" through
+ * "4*i+4". That halves the depth of a binary heap, and the four children
+ * are next to each other in memory, so sifting down touches fewer cache
+ * lines even though it compares more entries per level. */
+#define HEAP_ARITY 4
+#define HEAP_PARENT(i) (((i) - 1) / HEAP_ARITY)
+#define HEAP_CHILD(i) ((HEAP_ARITY * (i)) + 1)
 
-static void reheap (c_heap_t *h, size_t root, enum reheap_direction dir)
+static void sift_up (c_heap_t *h, size_t index) /* {{{ */
 {
-  size_t left;
-  size_t right;
-  size_t min;
-  int status;
+  void *ptr = h->list[index];
 
-  /* Calculate the positions of the children */
-  left = (2 * root) + 1;
-  if (left >= h->list_len)
-    left = 0;
+  while (index > 0)
+  {
+    size_t parent = HEAP_PARENT (index);
 
-  right = (2 * root) + 2;
-  if (right >= h->list_len)
-    right = 0;
+    if (h->compare (h->list[parent], ptr) <= 0)
+      break;
 
-  /* Check which one of the children is smaller. */
-  if ((left == 0) && (right == 0))
-    return;
-  else if (left == 0)
-    min = right;
-  else if (right == 0)
-    min = left;
-  else
-  {
-    status = h->compare (h->list[left], h->list[right]);
-    if (status > 0)
-      min = right;
-    else
-      min = left;
+    h->list[index] = h->list[parent];
+    index = parent;
   }
 
-  status = h->compare (h->list[root], h->list[min]);
-  if (status <= 0)
-  {
-    /* We didn't need to change anything, so the rest of the tree should be
-     * okay now. */
-    return;
-  }
-  else /* if (status > 0) */
+  h->list[index] = ptr;
+} /* }}} void sift_up */
+
+static void sift_down (c_heap_t *h, size_t index) /* {{{ */
+{
+  void *ptr = h->list[index];
+
+  while (42)
   {
-    void *tmp;
+    size_t first = HEAP_CHILD (index);
+    size_t last;
+    size_t min;
+    size_t i;
 
-    tmp = h->list[root];
-    h->list[root] = h->list[min];
-    h->list[min] = tmp;
-  }
+    if (first >= h->list_len)
+      break;
 
-  if ((dir == DIR_UP) && (root == 0))
-    return;
+    last = first + HEAP_ARITY;
+    if (last > h->list_len)
+      last = h->list_len;
+
+    min = first;
+    for (i = first + 1; i < last; i++)
+      if (h->compare (h->list[i], h->list[min]) < 0)
+        min = i;
 
-  if (dir == DIR_UP)
-    reheap (h, (root - 1) / 2, dir);
-  else if (dir == DIR_DOWN)
-    reheap (h, min, dir);
-} /* void reheap */
+    if (h->compare (ptr, h->list[min]) <= 0)
+      break;
+
+    h->list[index] = h->list[min];
+    index = min;
+  }
+
+  h->list[index] = ptr;
+} /* }}} void sift_down */
 
 c_heap_t *c_heap_create (int (*compare) (const void *, const void *))
 {
@@ -172,7 +169,7 @@ int c_heap_insert (c_heap_t *h, void *ptr)
   h->list_len++;
 
   /* Reorganize the heap from bottom up. */
-  reheap (h, /* parent of this node = */ (index - 1) / 2, DIR_UP);
+  sift_up (h, index);
 
   pthread_mutex_unlock (&h->lock);
   return (0);
@@ -205,7 +202,7 @@ void *c_heap_get_root (c_heap_t *h)
     h->list[h->list_len - 1] = NULL;
     h->list_len--;
 
-    reheap (h, /* root = */ 0, DIR_DOWN);
+    sift_down (h, /* root = */ 0);
   }
 
   /* free some memory */
@@ -226,4 +223,250 @@ void *c_heap_get_root (c_heap_t *h)
   return (ret);
 } /* void *c_heap_get_root */
 
+/*
+ * Indexed heap
+ */
+struct c_iheap_entry_s
+{
+  uint64_t key;
+  c_iheap_handle_t *handle;
+};
+typedef struct c_iheap_entry_s c_iheap_entry_t;
+
+struct c_iheap_s
+{
+  c_iheap_entry_t *list;
+  size_t list_len; /* # entries used */
+  size_t list_size; /* # entries allocated */
+};
+
+/* Stores "e" at "index" and tells its handle where it is. Handles store the
+ * index plus one, so that zero means "not in a heap". */
+static void iheap_set (c_iheap_t *h, size_t index, /* {{{ */
+    c_iheap_entry_t e)
+{
+  h->list[index] = e;
+  e.handle->index = index + 1;
+} /* }}} void iheap_set */
+
+static void iheap_sift_up (c_iheap_t *h, size_t index) /* {{{ */
+{
+  c_iheap_entry_t e = h->list[index];
+
+  while (index > 0)
+  {
+    size_t parent = HEAP_PARENT (index);
+
+    if (h->list[parent].key <= e.key)
+      break;
+
+    iheap_set (h, index, h->list[parent]);
+    index = parent;
+  }
+
+  iheap_set (h, index, e);
+} /* }}} void iheap_sift_up */
+
+static void iheap_sift_down (c_iheap_t *h, size_t index) /* {{{ */
+{
+  c_iheap_entry_t e = h->list[index];
+
+  while (42)
+  {
+    size_t first = HEAP_CHILD (index);
+    size_t last;
+    size_t min;
+    size_t i;
+
+    if (first >= h->list_len)
+      break;
+
+    last = first + HEAP_ARITY;
+    if (last > h->list_len)
+      last = h->list_len;
+
+    min = first;
+    for (i = first + 1; i < last; i++)
+      if (h->list[i].key < h->list[min].key)
+        min = i;
+
+    if (e.key <= h->list[min].key)
+      break;
+
+    iheap_set (h, index, h->list[min]);
+    index = min;
+  }
+
+  iheap_set (h, index, e);
+} /* }}} void iheap_sift_down */
+
+/* Removes the entry at "index" by moving the last entry into its place. */
+static void iheap_remove_index (c_iheap_t *h, size_t index) /* {{{ */
+{
+  c_iheap_entry_t removed = h->list[index];
+
+  removed.handle->index = 0;
+
+  h->list_len--;
+  if (index == h->list_len)
+    return;
+
+  h->list[index] = h->list[h->list_len];
+  if (h->list[index].key < removed.key)
+    iheap_sift_up (h, index);
+  else
+    iheap_sift_down (h, index);
+} /* }}} void iheap_remove_index */
+
+c_iheap_t *c_iheap_create (void) /* {{{ */
+{
+  c_iheap_t *h;
+
+  h = calloc (1, sizeof (*h));
+  if (h == NULL)
+    return (NULL);
+
+  h->list = NULL;
+  h->list_len = 0;
+  h->list_size = 0;
+
+  return (h);
+} /* }}} c_iheap_t *c_iheap_create */
+
+void c_iheap_destroy (c_iheap_t *h) /* {{{ */
+{
+  size_t i;
+
+  if (h == NULL)
+    return;
+
+  for (i = 0; i < h->list_len; i++)
+    h->list[i].handle->index = 0;
+
+  free (h->list);
+  free (h);
+} /* }}} void c_iheap_destroy */
+
+int c_iheap_insert (c_iheap_t *h, c_iheap_handle_t *handle, /* {{{ */
+    uint64_t key, void *ptr)
+{
+  c_iheap_entry_t e;
+
+  if ((h == NULL) || (handle == NULL) || (ptr == NULL))
+    return (-EINVAL);
+
+  if (handle->index != 0)
+    return (EEXIST);
+
+  assert (h->list_len <= h->list_size);
+  if (h->list_len == h->list_size)
+  {
+    c_iheap_entry_t *tmp;
+    size_t new_size = (h->list_size == 0) ? 16 : 2 * h->list_size;
+
+    tmp = realloc (h->list, new_size * sizeof (*h->list));
+    if (tmp == NULL)
+      return (-ENOMEM);
+
+    h->list = tmp;
+    h->list_size = new_size;
+  }
+
+  handle->ptr = ptr;
+
+  e.key = key;
+  e.handle = handle;
+  h->list[h->list_len] = e;
+  h->list_len++;
+
+  iheap_sift_up (h, h->list_len - 1);
+  return (0);
+} /* }}} int c_iheap_insert */
+
+int c_iheap_update (c_iheap_t *h, c_iheap_handle_t *handle, /* {{{ */
+    uint64_t key)
+{
+  size_t index;
+  uint64_t old_key;
+
+  if ((h == NULL) || (handle == NULL))
+    return (-EINVAL);
+
+  if ((handle->index == 0) || (handle->index > h->list_len))
+    return (-ENOENT);
+
+  index = handle->index - 1;
+  assert (h->list[index].handle == handle);
+
+  old_key = h->list[index].key;
+  h->list[index].key = key;
+  if (key < old_key)
+    iheap_sift_up (h, index);
+  else if (key > old_key)
+    iheap_sift_down (h, index);
+
+  return (0);
+} /* }}} int c_iheap_update */
+
+int c_iheap_remove (c_iheap_t *h, c_iheap_handle_t *handle) /* {{{ */
+{
+  size_t index;
+
+  if ((h == NULL) || (handle == NULL))
+    return (-EINVAL);
+
+  if ((handle->index == 0) || (handle->index > h->list_len))
+    return (-ENOENT);
+
+  index = handle->index - 1;
+  assert (h->list[index].handle == handle);
+
+  iheap_remove_index (h, index);
+  return (0);
+} /* }}} int c_iheap_remove */
+
+void *c_iheap_peek (c_iheap_t *h, uint64_t *key) /* {{{ */
+{
+  if ((h == NULL) || (h->list_len == 0))
+    return (NULL);
+
+  if (key != NULL)
+    *key = h->list[0].key;
+  return (h->list[0].handle->ptr);
+} /* }}} void *c_iheap_peek */
+
+void *c_iheap_get_root (c_iheap_t *h, uint64_t *key) /* {{{ */
+{
+  void *ret;
+
+  ret = c_iheap_peek (h, key);
+  if (ret == NULL)
+    return (NULL);
+
+  iheap_remove_index (h, 0);
+
+  /* free some memory */
+  if ((h->list_size > 64) && (4 * h->list_len < h->list_size))
+  {
+    c_iheap_entry_t *tmp;
+
+    tmp = realloc (h->list, (h->list_size / 2) * sizeof (*h->list));
+    if (tmp != NULL)
+    {
+      h->list = tmp;
+      h->list_size /= 2;
+    }
+  }
+
+  return (ret);
+} /* }}} void *c_iheap_get_root */
+
+size_t c_iheap_size (c_iheap_t *h) /* {{{ */
+{
+  if (h == NULL)
+    return (0);
+
+  return (h->list_len);
+} /* }}} size_t c_iheap_size */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -27,6 +27,9 @@
 #ifndef UTILS_HEAP_H
 #define UTILS_HEAP_H 1
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct c_heap_s;
 typedef struct c_heap_s c_heap_t;
 
@@ -96,5 +99,74 @@ int c_heap_insert (c_heap_t *h, void *ptr);
  */
 void *c_heap_get_root (c_heap_t *h);
 
+/*
+ * An indexed heap of pointers ordered by 64-bit keys, e.g. cdtime_t values.
+ * The keys are stored in the heap's array rather than looked up through a
+ * compare callback, so sifting only touches the array. Each stored element
+ * has a handle, typically embedded in the element, through which its key
+ * can be changed and the element removed in O(log n).
+ *
+ * Unlike c_heap_t, this heap has no lock of its own: the caller has to
+ * serialize all calls that are made with the same heap.
+ */
+struct c_iheap_s;
+typedef struct c_iheap_s c_iheap_t;
+
+struct c_iheap_handle_s
+{
+  /* Private: position in the heap plus one, zero if not stored. */
+  size_t index;
+  void *ptr;
+};
+typedef struct c_iheap_handle_s c_iheap_handle_t;
+
+/* Initializes a handle which is not stored in a heap. Zeroed memory, e.g.
+ * from calloc(3), is initialized as well. */
+#define C_IHEAP_HANDLE_INIT { 0, NULL }
+
+/* Allocates a new, empty heap. Returns NULL upon failure. */
+c_iheap_t *c_iheap_create (void);
+
+/* Deallocates a heap. The handles of the stored elements are reset, the
+ * elements themselves are not freed. */
+void c_iheap_destroy (c_iheap_t *h);
+
+/*
+ * NAME
+ *   c_iheap_insert
+ *
+ * DESCRIPTION
+ *   Stores `ptr' in the heap pointed to by `h', ordered by `key'. `handle'
+ *   identifies the element in later calls and must stay valid, i.e. must not
+ *   be moved or free'd, until the element has been removed from the heap.
+ *
+ * RETURN VALUE
+ *   Zero upon success, less than zero if an error occurred and greater than
+ *   zero if `handle' is already stored in a heap.
+ */
+int c_iheap_insert (c_iheap_t *h, c_iheap_handle_t *handle,
+    uint64_t key, void *ptr);
+
+/* Changes the key of the element identified by `handle', moving it up or down
+ * the heap. Returns zero upon success and -ENOENT if the element isn't stored
+ * in `h'. */
+int c_iheap_update (c_iheap_t *h, c_iheap_handle_t *handle, uint64_t key);
+
+/* Removes the element identified by `handle' from the heap. Returns zero upon
+ * success and -ENOENT if the element isn't stored in `h'. */
+int c_iheap_remove (c_iheap_t *h, c_iheap_handle_t *handle);
+
+/* Returns the element with the smallest key and stores the key in `key',
+ * which may be NULL. c_iheap_peek() leaves the element in the heap,
+ * c_iheap_get_root() removes it. Both return NULL if the heap is empty. */
+void *c_iheap_peek (c_iheap_t *h, uint64_t *key);
+void *c_iheap_get_root (c_iheap_t *h, uint64_t *key);
+
+/* Returns true if the element identified by `handle' is stored in a heap. */
+#define C_IHEAP_CONTAINS(handle) ((handle)->index != 0)
+
+/* Returns the number of elements in the heap, zero if `h' is NULL. */
+size_t c_iheap_size (c_iheap_t *h);
+
 #endif /* UTILS_HEAP_H */
 /* vim: set sw=2 sts=2 et : */
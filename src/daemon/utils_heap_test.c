@@ -75,9 +75,138 @@ DEF_TEST(simple)
   return (0);
 }
 
+struct item_s
+{
+  uint64_t key;
+  c_iheap_handle_t handle;
+};
+typedef struct item_s item_t;
+
+DEF_TEST(indexed)
+{
+  item_t items[10];
+  c_iheap_t *h;
+  uint64_t key;
+  item_t *ret;
+  int i;
+
+  CHECK_NOT_NULL(h = c_iheap_create ());
+  for (i = 0; i < 10; i++)
+  {
+    c_iheap_handle_t init = C_IHEAP_HANDLE_INIT;
+
+    items[i].key = (uint64_t) ((7 * i) % 10);
+    items[i].handle = init;
+    CHECK_ZERO(c_iheap_insert (h, &items[i].handle, items[i].key, &items[i]));
+  }
+  EXPECT_EQ_INT(10, (int) c_iheap_size (h));
+
+  /* Already stored. */
+  OK(c_iheap_insert (h, &items[0].handle, 0, &items[0]) > 0);
+
+  /* Remove the elements with key 3 and 0 (the root). */
+  CHECK_ZERO(c_iheap_remove (h, &items[9].handle));
+  OK(!C_IHEAP_CONTAINS (&items[9].handle));
+  CHECK_ZERO(c_iheap_remove (h, &items[0].handle));
+  EXPECT_EQ_INT(-ENOENT, c_iheap_remove (h, &items[0].handle));
+
+  /* Decrease 9 to 1 and increase 1 to 20. */
+  items[7].key = 1;
+  CHECK_ZERO(c_iheap_update (h, &items[7].handle, items[7].key));
+  items[3].key = 20;
+  CHECK_ZERO(c_iheap_update (h, &items[3].handle, items[3].key));
+
+  CHECK_NOT_NULL(ret = c_iheap_peek (h, &key));
+  OK(ret == &items[7]);
+  EXPECT_EQ_INT(1, (int) key);
+
+  {
+    uint64_t expected[] = { 1, 2, 4, 5, 6, 7, 8, 20 };
+
+    for (i = 0; i < 8; i++)
+    {
+      CHECK_NOT_NULL(ret = c_iheap_get_root (h, &key));
+      EXPECT_EQ_INT((int) expected[i], (int) key);
+      EXPECT_EQ_INT((int) expected[i], (int) ret->key);
+      OK(!C_IHEAP_CONTAINS (&ret->handle));
+    }
+  }
+
+  OK(c_iheap_get_root (h, NULL) == NULL);
+  EXPECT_EQ_INT(0, (int) c_iheap_size (h));
+
+  c_iheap_destroy (h);
+  return (0);
+}
+
+/* Applies random inserts, updates and removals and checks that the elements
+ * come out in order. The checks within the loops are counted instead of
+ * printed. */
+DEF_TEST(indexed_random)
+{
+  size_t items_num = 5000;
+  item_t *items;
+  c_iheap_t *h;
+  uint64_t last = 0;
+  int errors = 0;
+  size_t i;
+
+  CHECK_NOT_NULL(items = calloc (items_num, sizeof (*items)));
+  CHECK_NOT_NULL(h = c_iheap_create ());
+
+  srand (42);
+  for (i = 0; i < items_num; i++)
+  {
+    items[i].key = (uint64_t) rand ();
+    if (c_iheap_insert (h, &items[i].handle, items[i].key, &items[i]) != 0)
+      errors++;
+  }
+
+  for (i = 0; i < items_num; i++)
+  {
+    item_t *it = &items[(size_t) rand () % items_num];
+
+    if (!C_IHEAP_CONTAINS (&it->handle))
+      continue;
+
+    if ((i % 3) == 0)
+    {
+      if (c_iheap_remove (h, &it->handle) != 0)
+        errors++;
+    }
+    else
+    {
+      it->key = (uint64_t) rand ();
+      if (c_iheap_update (h, &it->handle, it->key) != 0)
+        errors++;
+    }
+  }
+  EXPECT_EQ_INT(0, errors);
+
+  while (c_iheap_size (h) > 0)
+  {
+    uint64_t key;
+    item_t *it = c_iheap_get_root (h, &key);
+
+    if ((it == NULL) || (it->key != key) || (key < last))
+    {
+      errors++;
+      break;
+    }
+    last = key;
+  }
+  EXPECT_EQ_INT(0, errors);
+
+  c_iheap_destroy (h);
+  free (items);
+  return (0);
+}
+
 int main (void)
 {
   RUN_TEST(simple);
+  RUN_TEST(indexed);
+  RUN_TEST(indexed_random);
 
   END_TEST;
 }
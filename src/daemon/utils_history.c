@@ -0,0 +1,567 @@
+/**
+ * collectd - src/daemon/utils_history.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_history.h"
+
+/* Initial size of the buffer of an open block: enough for the first step,
+ * which takes eight bytes per value, and a few more steps. The buffer grows as
+ * needed and is shrunk to its final size when the block is sealed. */
+#define HISTORY_BLOCK_INITIAL_SIZE(values_num) ((values_num) * 16)
+
+struct history_block_s;
+typedef struct history_block_s history_block_t;
+struct history_block_s
+{
+  uint8_t *data;
+  size_t   data_size; /* allocated size in bytes */
+  size_t   bits_num;  /* number of bits written */
+  size_t   steps_num; /* number of steps encoded */
+};
+
+/* Encoder (and decoder) state of one data source. */
+struct history_state_s;
+typedef struct history_state_s history_state_t;
+struct history_state_s
+{
+  uint64_t prev;
+  int      leading;
+  int      meaningful; /* zero if no window has been written yet */
+};
+
+struct history_s
+{
+  size_t values_num;
+  size_t length;
+  _Bool  compressed;
+
+  /* Uncompressed histories. Ring buffer of "length" steps, see the layout
+   * description of cache_entry_t in utils_cache.c. */
+  gauge_t *values;
+  size_t   index; /* points to the next position to write to. */
+
+  /* Compressed histories. "blocks" is ordered from the oldest to the newest
+   * block; only the last block is open for writing. */
+  history_block_t *blocks;
+  size_t           blocks_num;
+  size_t           blocks_max;
+  history_state_t *state;
+  /* Number of steps returned by history_get(), at most "length". Older steps
+   * may still be encoded in the oldest block. */
+  size_t           steps_num;
+};
+
+/* Blocks needed to always have "length" steps in sealed blocks, plus the
+ * open block. */
+static size_t history_blocks_max (size_t length) /* {{{ */
+{
+  return (((length + HISTORY_BLOCK_STEPS - 1) / HISTORY_BLOCK_STEPS) + 1);
+} /* }}} size_t history_blocks_max */
+
+static int count_leading_zeros (uint64_t x) /* {{{ */
+{
+  int n = 0;
+
+  if (x == 0)
+    return (64);
+
+  while ((x & (((uint64_t) 1) << 63)) == 0)
+  {
+    x <<= 1;
+    n++;
+  }
+  return (n);
+} /* }}} int count_leading_zeros */
+
+static int count_trailing_zeros (uint64_t x) /* {{{ */
+{
+  int n = 0;
+
+  if (x == 0)
+    return (64);
+
+  while ((x & 1) == 0)
+  {
+    x >>= 1;
+    n++;
+  }
+  return (n);
+} /* }}} int count_trailing_zeros */
+
+static uint64_t gauge_to_bits (gauge_t g) /* {{{ */
+{
+  uint64_t u;
+  memcpy (&u, &g, sizeof (u));
+  return (u);
+} /* }}} uint64_t gauge_to_bits */
+
+static gauge_t bits_to_gauge (uint64_t u) /* {{{ */
+{
+  gauge_t g;
+  memcpy (&g, &u, sizeof (g));
+  return (g);
+} /* }}} gauge_t bits_to_gauge */
+
+/* Appends the lowest "bits_num" bits of "value" to the block, most
+ * significant bit first. */
+static int block_write (history_block_t *b, /* {{{ */
+    uint64_t value, int bits_num)
+{
+  size_t bytes_needed = (b->bits_num + ((size_t) bits_num) + 7) / 8;
+
+  if (bytes_needed > b->data_size)
+  {
+    size_t new_size = 2 * b->data_size;
+    uint8_t *tmp;
+
+    if (new_size < bytes_needed)
+      new_size = bytes_needed;
+
+    tmp = realloc (b->data, new_size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    memset (tmp + b->data_size, 0, new_size - b->data_size);
+
+    b->data = tmp;
+    b->data_size = new_size;
+  }
+
+  while (bits_num > 0)
+  {
+    size_t byte = b->bits_num / 8;
+    int free_bits = 8 - (int) (b->bits_num % 8);
+    int n = (bits_num < free_bits) ? bits_num : free_bits;
+    uint8_t chunk = (uint8_t) ((value >> (bits_num - n))
+	& ((((uint64_t) 1) << n) - 1));
+
+    b->data[byte] |= (uint8_t) (chunk << (free_bits - n));
+    b->bits_num += (size_t) n;
+    bits_num -= n;
+  }
+
+  return (0);
+} /* }}} int block_write */
+
+static uint64_t block_read (history_block_t const *b, /* {{{ */
+    size_t *pos, int bits_num)
+{
+  uint64_t value = 0;
+
+  while (bits_num > 0)
+  {
+    size_t byte = *pos / 8;
+    int avail_bits = 8 - (int) (*pos % 8);
+    int n = (bits_num < avail_bits) ? bits_num : avail_bits;
+    uint8_t chunk = (uint8_t) ((b->data[byte] >> (avail_bits - n))
+	& ((1U << n) - 1));
+
+    value = (value << n) | chunk;
+    *pos += (size_t) n;
+    bits_num -= n;
+  }
+
+  return (value);
+} /* }}} uint64_t block_read */
+
+static int block_encode (history_block_t *b, /* {{{ */
+    history_state_t *s, gauge_t g)
+{
+  uint64_t value = gauge_to_bits (g);
+  uint64_t x;
+  int leading;
+  int trailing;
+  int status;
+
+  if (b->steps_num == 0)
+  {
+    s->prev = value;
+    s->leading = 0;
+    s->meaningful = 0;
+    return (block_write (b, value, 64));
+  }
+
+  x = value ^ s->prev;
+  s->prev = value;
+  if (x == 0)
+    return (block_write (b, 0, 1));
+
+  leading = count_leading_zeros (x);
+  trailing = count_trailing_zeros (x);
+  /* The number of leading zeros is stored in five bits. */
+  if (leading > 31)
+    leading = 31;
+
+  /* Reuse the previous window if the meaningful bits fit into it. */
+  if ((s->meaningful > 0)
+      && (leading >= s->leading)
+      && (trailing >= (64 - s->leading - s->meaningful)))
+  {
+    status = block_write (b, /* "10" */ 2, 2);
+    if (status != 0)
+      return (status);
+    return (block_write (b, x >> (64 - s->leading - s->meaningful),
+	  s->meaningful));
+  }
+
+  s->leading = leading;
+  s->meaningful = 64 - leading - trailing;
+
+  status = block_write (b, /* "11" */ 3, 2);
+  if (status == 0)
+    status = block_write (b, (uint64_t) s->leading, 5);
+  /* 1 to 64 meaningful bits are stored as 0 to 63. */
+  if (status == 0)
+    status = block_write (b, (uint64_t) (s->meaningful - 1), 6);
+  if (status == 0)
+    status = block_write (b, x >> trailing, s->meaningful);
+  return (status);
+} /* }}} int block_encode */
+
+static gauge_t block_decode (history_block_t const *b, /* {{{ */
+    size_t *pos, history_state_t *s, _Bool first)
+{
+  int trailing;
+  uint64_t x;
+
+  if (first)
+  {
+    s->prev = block_read (b, pos, 64);
+    s->leading = 0;
+    s->meaningful = 0;
+    return (bits_to_gauge (s->prev));
+  }
+
+  if (block_read (b, pos, 1) == 0)
+    return (bits_to_gauge (s->prev));
+
+  if (block_read (b, pos, 1) != 0)
+  {
+    s->leading = (int) block_read (b, pos, 5);
+    s->meaningful = ((int) block_read (b, pos, 6)) + 1;
+  }
+
+  trailing = 64 - s->leading - s->meaningful;
+  x = block_read (b, pos, s->meaningful) << trailing;
+  s->prev ^= x;
+
+  return (bits_to_gauge (s->prev));
+} /* }}} gauge_t block_decode */
+
+/* Decodes all steps of block "b" to "ret", oldest step first. */
+static void block_decode_all (history_t const *h, /* {{{ */
+    history_block_t const *b, history_state_t *state, gauge_t *ret)
+{
+  size_t pos = 0;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < b->steps_num; i++)
+    for (j = 0; j < h->values_num; j++)
+      ret[(i * h->values_num) + j] = block_decode (b, &pos, state + j,
+	  /* first = */ (i == 0));
+} /* }}} void block_decode_all */
+
+static void block_seal (history_block_t *b) /* {{{ */
+{
+  size_t size = (b->bits_num + 7) / 8;
+  uint8_t *tmp;
+
+  if ((size == 0) || (size >= b->data_size))
+    return;
+
+  /* Shrinking may fail; keeping the larger buffer is fine. */
+  tmp = realloc (b->data, size);
+  if (tmp == NULL)
+    return;
+
+  b->data = tmp;
+  b->data_size = size;
+} /* }}} void block_seal */
+
+static int history_open_block (history_t *h) /* {{{ */
+{
+  history_block_t *b;
+
+  if (h->blocks_num > 0)
+    block_seal (h->blocks + (h->blocks_num - 1));
+
+  /* Drop the oldest block. */
+  if (h->blocks_num >= h->blocks_max)
+  {
+    sfree (h->blocks[0].data);
+    memmove (h->blocks, h->blocks + 1,
+	sizeof (*h->blocks) * (h->blocks_num - 1));
+    h->blocks_num--;
+  }
+
+  b = h->blocks + h->blocks_num;
+  memset (b, 0, sizeof (*b));
+  b->data_size = HISTORY_BLOCK_INITIAL_SIZE (h->values_num);
+  b->data = calloc (1, b->data_size);
+  if (b->data == NULL)
+    return (ENOMEM);
+
+  h->blocks_num++;
+  return (0);
+} /* }}} int history_open_block */
+
+history_t *history_create (size_t values_num, size_t length, /* {{{ */
+    _Bool compressed)
+{
+  history_t *h;
+  size_t i;
+
+  if ((values_num == 0) || (length == 0))
+    return (NULL);
+
+  h = calloc (1, sizeof (*h));
+  if (h == NULL)
+    return (NULL);
+
+  h->values_num = values_num;
+  h->length = length;
+  h->compressed = compressed;
+
+  if (!compressed)
+  {
+    h->values = malloc (sizeof (*h->values) * values_num * length);
+    if (h->values == NULL)
+    {
+      sfree (h);
+      return (NULL);
+    }
+    for (i = 0; i < values_num * length; i++)
+      h->values[i] = NAN;
+    return (h);
+  }
+
+  h->blocks_max = history_blocks_max (length);
+  h->blocks = calloc (h->blocks_max, sizeof (*h->blocks));
+  h->state = calloc (values_num, sizeof (*h->state));
+  if ((h->blocks == NULL) || (h->state == NULL))
+  {
+    history_destroy (h);
+    return (NULL);
+  }
+
+  return (h);
+} /* }}} history_t *history_create */
+
+void history_destroy (history_t *h) /* {{{ */
+{
+  size_t i;
+
+  if (h == NULL)
+    return;
+
+  for (i = 0; i < h->blocks_num; i++)
+    sfree (h->blocks[i].data);
+  sfree (h->blocks);
+  sfree (h->state);
+  sfree (h->values);
+  sfree (h);
+} /* }}} void history_destroy */
+
+size_t history_length (history_t const *h) /* {{{ */
+{
+  return ((h == NULL) ? 0 : h->length);
+} /* }}} size_t history_length */
+
+int history_resize (history_t *h, size_t length) /* {{{ */
+{
+  size_t i;
+
+  if (length <= h->length)
+    return (0);
+
+  if (!h->compressed)
+  {
+    gauge_t *tmp;
+    size_t old_size = h->values_num * h->length;
+    size_t head;
+    size_t grow;
+
+    tmp = realloc (h->values, sizeof (*h->values) * h->values_num * length);
+    if (tmp == NULL)
+      return (ENOMEM);
+
+    /* Insert the new steps, which are NAN, at "index" so they become the
+     * oldest steps. */
+    head = h->values_num * h->index;
+    grow = h->values_num * (length - h->length);
+    memmove (tmp + head + grow, tmp + head, sizeof (*tmp) * (old_size - head));
+    for (i = head; i < head + grow; i++)
+      tmp[i] = NAN;
+
+    h->values = tmp;
+    h->length = length;
+    return (0);
+  }
+  else
+  {
+    size_t blocks_max = history_blocks_max (length);
+    history_block_t *tmp;
+
+    tmp = realloc (h->blocks, sizeof (*h->blocks) * blocks_max);
+    if (tmp == NULL)
+      return (ENOMEM);
+
+    h->blocks = tmp;
+    h->blocks_max = blocks_max;
+    h->length = length;
+    return (0);
+  }
+} /* }}} int history_resize */
+
+int history_append (history_t *h, gauge_t const *values) /* {{{ */
+{
+  history_block_t *b;
+  size_t i;
+  int status;
+
+  if (!h->compressed)
+  {
+    memcpy (h->values + (h->values_num * h->index), values,
+	sizeof (*values) * h->values_num);
+    h->index = (h->index + 1) % h->length;
+    return (0);
+  }
+
+  if ((h->blocks_num == 0)
+      || (h->blocks[h->blocks_num - 1].steps_num >= HISTORY_BLOCK_STEPS))
+  {
+    status = history_open_block (h);
+    if (status != 0)
+      return (status);
+  }
+
+  b = h->blocks + (h->blocks_num - 1);
+  for (i = 0; i < h->values_num; i++)
+  {
+    status = block_encode (b, h->state + i, values[i]);
+    if (status != 0)
+    {
+      /* The block is unusable now: decoding relies on every value of a
+       * step being present. Start over with an empty history. */
+      ERROR ("history_append: Encoding value failed.");
+      for (i = 0; i < h->blocks_num; i++)
+	sfree (h->blocks[i].data);
+      h->blocks_num = 0;
+      h->steps_num = 0;
+      return (status);
+    }
+  }
+  b->steps_num++;
+  if (h->steps_num < h->length)
+    h->steps_num++;
+
+  return (0);
+} /* }}} int history_append */
+
+int history_get (history_t const *h, gauge_t *ret, /* {{{ */
+    size_t num_steps)
+{
+  history_state_t *state;
+  gauge_t *buffer;
+  size_t num_steps_avail;
+  size_t done = 0;
+  size_t i;
+
+  if (num_steps > h->length)
+    return (EINVAL);
+
+  if (!h->compressed)
+  {
+    for (i = 0; i < num_steps; i++)
+    {
+      size_t src_index;
+
+      if (i < h->index)
+	src_index = h->index - (i + 1);
+      else
+	src_index = h->length + h->index - (i + 1);
+
+      memcpy (ret + (i * h->values_num),
+	  h->values + (src_index * h->values_num),
+	  sizeof (*ret) * h->values_num);
+    }
+    return (0);
+  }
+
+  state = calloc (h->values_num, sizeof (*state));
+  buffer = malloc (sizeof (*buffer) * h->values_num * HISTORY_BLOCK_STEPS);
+  if ((state == NULL) || (buffer == NULL))
+  {
+    sfree (state);
+    sfree (buffer);
+    return (ENOMEM);
+  }
+
+  /* Decode from the newest block backwards until enough steps are found. */
+  if (num_steps > h->steps_num)
+    num_steps_avail = h->steps_num;
+  else
+    num_steps_avail = num_steps;
+
+  for (i = h->blocks_num; (i > 0) && (done < num_steps_avail); i--)
+  {
+    history_block_t const *b = h->blocks + (i - 1);
+    size_t step;
+
+    block_decode_all (h, b, state, buffer);
+    for (step = b->steps_num; (step > 0) && (done < num_steps_avail); step--)
+    {
+      memcpy (ret + (done * h->values_num),
+	  buffer + ((step - 1) * h->values_num),
+	  sizeof (*ret) * h->values_num);
+      done++;
+    }
+  }
+
+  for (i = done * h->values_num; i < num_steps * h->values_num; i++)
+    ret[i] = NAN;
+
+  sfree (state);
+  sfree (buffer);
+  return (0);
+} /* }}} int history_get */
+
+size_t history_memory (history_t const *h) /* {{{ */
+{
+  size_t size;
+  size_t i;
+
+  if (h == NULL)
+    return (0);
+
+  if (!h->compressed)
+    return (sizeof (*h->values) * h->values_num * h->length);
+
+  size = sizeof (*h->blocks) * h->blocks_max
+    + sizeof (*h->state) * h->values_num;
+  for (i = 0; i < h->blocks_num; i++)
+    size += h->blocks[i].data_size;
+  return (size);
+} /* }}} size_t history_memory */
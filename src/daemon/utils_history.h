@@ -0,0 +1,107 @@
+/**
+ * collectd - src/daemon/utils_history.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_HISTORY_H
+#define UTILS_HISTORY_H 1
+
+#include "plugin.h"
+
+/*
+ * A history is a ring buffer holding the last "length" steps of a value list,
+ * each step being one gauge_t per data source. It is used by the value cache
+ * to keep the rates of previous updates around.
+ *
+ * Compressed histories encode the values in blocks of HISTORY_BLOCK_STEPS
+ * steps. Within a block, each value is XOR-ed with the previous value of the
+ * same data source and only the meaningful bits are stored, as described in
+ * "Gorilla: A Fast, Scalable, In-Memory Time Series Database" (Pelkonen et
+ * al., 2015). Slowly changing values take only a few bits per step. Blocks
+ * are decoded when the history is read.
+ */
+#define HISTORY_BLOCK_STEPS 32
+
+struct history_s;
+typedef struct history_s history_t;
+
+/*
+ * NAME
+ *   history_create
+ *
+ * DESCRIPTION
+ *   Creates a history of `length' steps of `values_num' values each. All
+ *   steps are initially NAN.
+ *
+ * RETURN VALUE
+ *   The new history or NULL if memory could not be allocated.
+ */
+history_t *history_create (size_t values_num, size_t length,
+    _Bool compressed);
+void history_destroy (history_t *h);
+
+/* Returns the number of steps kept by the history. */
+size_t history_length (history_t const *h);
+
+/*
+ * NAME
+ *   history_resize
+ *
+ * DESCRIPTION
+ *   Increases the number of steps kept to `length'. Histories never shrink;
+ *   `length' values smaller than the current length are ignored.
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOMEM if memory could not be allocated.
+ */
+int history_resize (history_t *h, size_t length);
+
+/*
+ * NAME
+ *   history_append
+ *
+ * DESCRIPTION
+ *   Adds a step with `values_num' values, dropping the oldest step.
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOMEM if memory could not be allocated.
+ */
+int history_append (history_t *h, gauge_t const *values);
+
+/*
+ * NAME
+ *   history_get
+ *
+ * DESCRIPTION
+ *   Copies the last `num_steps' steps to `ret', which must have room for
+ *   `num_steps * values_num' values. The most recent step comes first. Steps
+ *   which have not been appended yet are NAN.
+ *
+ * RETURN VALUE
+ *   Zero on success, EINVAL if `num_steps' is larger than the history's
+ *   length and ENOMEM if memory could not be allocated.
+ */
+int history_get (history_t const *h, gauge_t *ret, size_t num_steps);
+
+/* Returns the number of bytes used for the history's values. */
+size_t history_memory (history_t const *h);
+
+#endif /* UTILS_HISTORY_H */
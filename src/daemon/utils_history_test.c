@@ -0,0 +1,152 @@
+/**
+ * collectd - src/daemon/utils_history_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "testing.h"
+#include "utils_history.h"
+
+#define VALUES_NUM 4
+
+/* Fills "values" with step "step" of a test series: a constant, a slowly
+ * growing counter rate, an erratic value and a value which is mostly NAN. */
+static void test_values (gauge_t *values, size_t step)
+{
+  values[0] = 42.0;
+  values[1] = 1000.0 + (double) (step / 10);
+  values[2] = ((double) ((step * 7919) % 1009)) / 3.0 - 100.0;
+  values[3] = ((step % 5) == 0) ? (double) step : NAN;
+}
+
+/* Compares the last "num_steps" steps of two histories bit by bit, so NANs
+ * compare equal. */
+static int compare_histories (history_t *a, history_t *b, size_t num_steps)
+{
+  gauge_t want[VALUES_NUM * 100];
+  gauge_t got[VALUES_NUM * 100];
+
+  if ((num_steps > 100)
+      || (history_get (a, want, num_steps) != 0)
+      || (history_get (b, got, num_steps) != 0))
+    return (-1);
+
+  return (memcmp (want, got, sizeof (*want) * VALUES_NUM * num_steps));
+}
+
+DEF_TEST(compressed)
+{
+  gauge_t values[VALUES_NUM];
+  gauge_t ret[VALUES_NUM * 3];
+  history_t *raw;
+  history_t *compressed;
+  size_t i;
+
+  CHECK_NOT_NULL (raw = history_create (VALUES_NUM, 50, /* compressed = */ 0));
+  CHECK_NOT_NULL (compressed = history_create (VALUES_NUM, 50,
+	/* compressed = */ 1));
+  EXPECT_EQ_INT (50, history_length (compressed));
+
+  /* Steps which have not been appended yet are NAN. */
+  CHECK_ZERO (history_get (compressed, ret, 3));
+  for (i = 0; i < STATIC_ARRAY_SIZE (ret); i++)
+    OK (isnan (ret[i]));
+  CHECK_ZERO (compare_histories (raw, compressed, 50));
+
+  for (i = 0; i < 300; i++)
+  {
+    test_values (values, i);
+    CHECK_ZERO (history_append (raw, values));
+    CHECK_ZERO (history_append (compressed, values));
+
+    if ((i % 13) == 0)
+      CHECK_ZERO (compare_histories (raw, compressed, 50));
+  }
+
+  /* The most recent step comes first. */
+  CHECK_ZERO (history_get (compressed, ret, 3));
+  EXPECT_EQ_DOUBLE (42.0, ret[0]);
+  EXPECT_EQ_DOUBLE (1029.0, ret[1]);
+  EXPECT_EQ_DOUBLE (1029.0, ret[VALUES_NUM + 1]);
+  OK (isnan (ret[3]));
+  EXPECT_EQ_INT (EINVAL, history_get (compressed, ret, 51));
+
+  /* Growing the history adds NAN steps at its old end. */
+  CHECK_ZERO (history_resize (raw, 80));
+  CHECK_ZERO (history_resize (compressed, 80));
+  EXPECT_EQ_INT (80, history_length (compressed));
+  CHECK_ZERO (compare_histories (raw, compressed, 50));
+  for (i = 300; i < 400; i++)
+  {
+    test_values (values, i);
+    CHECK_ZERO (history_append (raw, values));
+    CHECK_ZERO (history_append (compressed, values));
+
+    if ((i % 11) == 0)
+      CHECK_ZERO (compare_histories (raw, compressed, 80));
+  }
+  CHECK_ZERO (compare_histories (raw, compressed, 80));
+
+  /* Shrinking is ignored. */
+  CHECK_ZERO (history_resize (compressed, 10));
+  EXPECT_EQ_INT (80, history_length (compressed));
+
+  history_destroy (raw);
+  history_destroy (compressed);
+  return (0);
+}
+
+DEF_TEST(memory)
+{
+  gauge_t values[VALUES_NUM] = { 1.0, 2.0, 3.0, 4.0 };
+  history_t *raw;
+  history_t *compressed;
+  size_t i;
+
+  CHECK_NOT_NULL (raw = history_create (VALUES_NUM, 60, /* compressed = */ 0));
+  CHECK_NOT_NULL (compressed = history_create (VALUES_NUM, 60,
+	/* compressed = */ 1));
+
+  /* Constant values take one bit per value and step after the first step of
+   * each block. */
+  for (i = 0; i < 1000; i++)
+  {
+    CHECK_ZERO (history_append (raw, values));
+    CHECK_ZERO (history_append (compressed, values));
+  }
+  CHECK_ZERO (compare_histories (raw, compressed, 60));
+  OK (history_memory (compressed) * 4 < history_memory (raw));
+
+  history_destroy (raw);
+  history_destroy (compressed);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(compressed);
+  RUN_TEST(memory);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -55,45 +55,209 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#if HAVE_REGEX_H
+# include "utils_regex_set.h"
+#endif
+
+#include <pthread.h>
+
+/* Number of remembered match results after which they are all forgotten, so
+ * that lists matching ever changing names (e.g. processes) don't grow
+ * without bounds. */
+#define IGNORELIST_MEMO_MAX 4096
 
 /*
  * private prototypes
  */
-struct ignorelist_item_s
+struct ignorelist_hash_entry_s
 {
-#if HAVE_REGEX_H
-	regex_t *rmatch;	/* regular expression entry identification */
-#endif
-	char *smatch;		/* string entry identification */
-	struct ignorelist_item_s *next;
+	char *key;
+	uint32_t hash;
+	int value;
+	struct ignorelist_hash_entry_s *next;
 };
-typedef struct ignorelist_item_s ignorelist_item_t;
+typedef struct ignorelist_hash_entry_s ignorelist_hash_entry_t;
+
+/* A chained hash table with string keys. */
+struct ignorelist_hash_s
+{
+	ignorelist_hash_entry_t **buckets;
+	size_t buckets_num;	/* zero or a power of two */
+	size_t entries_num;
+};
+typedef struct ignorelist_hash_s ignorelist_hash_t;
 
 struct ignorelist_s
 {
 	int ignore;		/* ignore entries */
-	ignorelist_item_t *head;	/* pointer to the first entry */
+
+	/* exact entries */
+	ignorelist_hash_t strings;
+
+#if HAVE_REGEX_H
+	/* regex entries, pre-filtered together with a regex set */
+	regex_t **regexes;
+	size_t regexes_num;
+	regex_set_t *regex_set;
+	uint64_t *candidates;
+	_Bool regex_set_compiled;
+#endif
+
+	/* Whether an entry matched, by entry name. Protected by "lock",
+	 * as is the regex set's candidate buffer. */
+	pthread_mutex_t lock;
+	ignorelist_hash_t memo;
 };
 
 /* *** *** *** ********************************************* *** *** *** */
 /* *** *** *** *** *** ***   private functions   *** *** *** *** *** *** */
 /* *** *** *** ********************************************* *** *** *** */
 
-static inline void ignorelist_append (ignorelist_t *il, ignorelist_item_t *item)
+/* 32 bit FNV-1a */
+static uint32_t ignorelist_hash_string (const char *str)
+{
+	uint32_t hash = 2166136261U;
+	const unsigned char *ptr;
+
+	for (ptr = (const unsigned char *) str; *ptr != 0; ptr++)
+	{
+		hash ^= (uint32_t) *ptr;
+		hash *= 16777619U;
+	}
+
+	return (hash);
+} /* uint32_t ignorelist_hash_string */
+
+static ignorelist_hash_entry_t *ignorelist_hash_lookup (
+		ignorelist_hash_t *h, const char *key, uint32_t hash)
 {
-	assert ((il != NULL) && (item != NULL));
+	ignorelist_hash_entry_t *e;
+
+	if (h->buckets_num == 0)
+		return (NULL);
+
+	for (e = h->buckets[hash & (h->buckets_num - 1)]; e != NULL; e = e->next)
+		if ((e->hash == hash) && (strcmp (e->key, key) == 0))
+			return (e);
+
+	return (NULL);
+} /* ignorelist_hash_entry_t *ignorelist_hash_lookup */
+
+/* Doubles the number of buckets when there are more entries than buckets. If
+ * that fails, the buckets just get longer. */
+static void ignorelist_hash_grow (ignorelist_hash_t *h)
+{
+	ignorelist_hash_entry_t **buckets;
+	size_t buckets_num;
+	size_t i;
+
+	if (h->entries_num < h->buckets_num)
+		return;
+
+	buckets_num = (h->buckets_num == 0) ? 16 : 2 * h->buckets_num;
+	buckets = calloc (buckets_num, sizeof (*buckets));
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < h->buckets_num; i++)
+	{
+		ignorelist_hash_entry_t *e = h->buckets[i];
+
+		while (e != NULL)
+		{
+			ignorelist_hash_entry_t *next = e->next;
+			size_t idx = e->hash & (buckets_num - 1);
+
+			e->next = buckets[idx];
+			buckets[idx] = e;
+			e = next;
+		}
+	}
+
+	sfree (h->buckets);
+	h->buckets = buckets;
+	h->buckets_num = buckets_num;
+} /* void ignorelist_hash_grow */
+
+/* Stores a copy of "key". The key must not be in the table yet. */
+static int ignorelist_hash_insert (ignorelist_hash_t *h, const char *key,
+		uint32_t hash, int value)
+{
+	ignorelist_hash_entry_t *e;
+	size_t idx;
+
+	ignorelist_hash_grow (h);
+	if (h->buckets_num == 0)
+		return (ENOMEM);
+
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (ENOMEM);
+
+	e->key = strdup (key);
+	if (e->key == NULL)
+	{
+		sfree (e);
+		return (ENOMEM);
+	}
+	e->hash = hash;
+	e->value = value;
+
+	idx = hash & (h->buckets_num - 1);
+	e->next = h->buckets[idx];
+	h->buckets[idx] = e;
+	h->entries_num++;
+
+	return (0);
+} /* int ignorelist_hash_insert */
+
+static void ignorelist_hash_clear (ignorelist_hash_t *h)
+{
+	size_t i;
+
+	for (i = 0; i < h->buckets_num; i++)
+	{
+		ignorelist_hash_entry_t *e = h->buckets[i];
+
+		while (e != NULL)
+		{
+			ignorelist_hash_entry_t *next = e->next;
+
+			sfree (e->key);
+			sfree (e);
+			e = next;
+		}
+	}
 
-	item->next = il->head;
-	il->head = item;
-}
+	sfree (h->buckets);
+	h->buckets_num = 0;
+	h->entries_num = 0;
+} /* void ignorelist_hash_clear */
+
+/* Forgets all remembered match results. The caller must hold the lock. */
+static void ignorelist_memo_reset (ignorelist_t *il)
+{
+	ignorelist_hash_clear (&il->memo);
+} /* void ignorelist_memo_reset */
 
 #if HAVE_REGEX_H
 static int ignorelist_append_regex(ignorelist_t *il, const char *re_str)
 {
 	regex_t *re;
-	ignorelist_item_t *entry;
+	regex_t **tmp;
+	uint64_t *candidates;
 	int status;
 
+	if (il->regex_set == NULL)
+	{
+		il->regex_set = regex_set_create ();
+		if (il->regex_set == NULL)
+		{
+			ERROR ("ignorelist_append_regex: regex_set_create failed.");
+			return (ENOMEM);
+		}
+	}
+
 	re = calloc (1, sizeof (*re));
 	if (re == NULL)
 	{
@@ -112,72 +276,83 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *re_str)
 		return (status);
 	}
 
-	entry = calloc (1, sizeof (*entry));
-	if (entry == NULL)
+	tmp = realloc (il->regexes, (il->regexes_num + 1) * sizeof (*il->regexes));
+	candidates = calloc (REGEX_SET_WORDS (il->regexes_num + 1),
+			sizeof (*candidates));
+	if (tmp != NULL)
+		il->regexes = tmp;
+	if ((tmp == NULL) || (candidates == NULL)
+			|| (regex_set_add (il->regex_set, re_str, REG_EXTENDED)
+				!= (int) il->regexes_num))
 	{
-		ERROR ("ignorelist_append_regex: calloc failed.");
+		ERROR ("ignorelist_append_regex: Adding the regular expression "
+				"failed.");
+		sfree (candidates);
 		regfree (re);
 		sfree (re);
 		return (ENOMEM);
 	}
-	entry->rmatch = re;
 
-	ignorelist_append (il, entry);
+	il->regexes[il->regexes_num] = re;
+	il->regexes_num++;
+	sfree (il->candidates);
+	il->candidates = candidates;
+	il->regex_set_compiled = 0;
+
 	return (0);
 } /* int ignorelist_append_regex */
 #endif
 
 static int ignorelist_append_string(ignorelist_t *il, const char *entry)
 {
-	ignorelist_item_t *new;
+	uint32_t hash = ignorelist_hash_string (entry);
+
+	if (ignorelist_hash_lookup (&il->strings, entry, hash) != NULL)
+		return (0);
 
-	/* create new entry */
-	if ((new = calloc(1, sizeof (*new))) == NULL )
+	if (ignorelist_hash_insert (&il->strings, entry, hash, 1) != 0)
 	{
 		ERROR ("cannot allocate new entry");
 		return (1);
 	}
-	new->smatch = sstrdup(entry);
-
-	/* append new entry */
-	ignorelist_append (il, new);
 
 	return (0);
 } /* int ignorelist_append_string(ignorelist_t *il, const char *entry) */
 
 #if HAVE_REGEX_H
 /*
- * check list for entry regex match
+ * check regex entries for a match
  * return 1 if found
  */
-static int ignorelist_match_regex (ignorelist_item_t *item, const char *entry)
+static int ignorelist_match_regex (ignorelist_t *il, const char *entry)
 {
-	assert ((item != NULL) && (item->rmatch != NULL)
-			&& (entry != NULL) && (strlen (entry) > 0));
+	size_t i;
 
-	/* match regex */
-	if (regexec (item->rmatch, entry, 0, NULL, 0) == 0)
-		return (1);
+	if (il->regexes_num == 0)
+		return (0);
 
-	return (0);
-} /* int ignorelist_match_regex (ignorelist_item_t *item, const char *entry) */
-#endif
+	if (!il->regex_set_compiled)
+	{
+		/* On failure, all patterns are candidates. */
+		regex_set_compile (il->regex_set);
+		il->regex_set_compiled = 1;
+	}
 
-/*
- * check list for entry string match
- * return 1 if found
- */
-static int ignorelist_match_string (ignorelist_item_t *item, const char *entry)
-{
-	assert ((item != NULL) && (item->smatch != NULL)
-			&& (entry != NULL) && (strlen (entry) > 0));
+	if (regex_set_candidates (il->regex_set, entry, il->candidates) == 0)
+		return (0);
 
-	if (strcmp (entry, item->smatch) == 0)
-		return (1);
+	for (i = 0; i < il->regexes_num; i++)
+	{
+		if (!REGEX_SET_IS_CANDIDATE (il->candidates, i))
+			continue;
 
-	return (0);
-} /* int ignorelist_match_string (ignorelist_item_t *item, const char *entry) */
+		if (regexec (il->regexes[i], entry, 0, NULL, 0) == 0)
+			return (1);
+	}
 
+	return (0);
+} /* int ignorelist_match_regex (ignorelist_t *il, const char *entry) */
+#endif
 
 /* *** *** *** ******************************************** *** *** *** */
 /* *** *** *** *** *** ***   public functions   *** *** *** *** *** *** */
@@ -201,6 +376,8 @@ ignorelist_t *ignorelist_create (int invert)
 	 */
 	il->ignore = invert ? 0 : 1;
 
+	pthread_mutex_init (&il->lock, /* attr = */ NULL);
+
 	return (il);
 } /* ignorelist_t *ignorelist_create (int ignore) */
 
@@ -209,30 +386,26 @@ ignorelist_t *ignorelist_create (int invert)
  */
 void ignorelist_free (ignorelist_t *il)
 {
-	ignorelist_item_t *this;
-	ignorelist_item_t *next;
-
 	if (il == NULL)
 		return;
 
-	for (this = il->head; this != NULL; this = next)
-	{
-		next = this->next;
 #if HAVE_REGEX_H
-		if (this->rmatch != NULL)
-		{
-			regfree (this->rmatch);
-			sfree (this->rmatch);
-			this->rmatch = NULL;
-		}
-#endif
-		if (this->smatch != NULL)
+	{
+		size_t i;
+
+		for (i = 0; i < il->regexes_num; i++)
 		{
-			sfree (this->smatch);
-			this->smatch = NULL;
+			regfree (il->regexes[i]);
+			sfree (il->regexes[i]);
 		}
-		sfree (this);
+		sfree (il->regexes);
+		sfree (il->candidates);
+		regex_set_destroy (il->regex_set);
 	}
+#endif
+	ignorelist_hash_clear (&il->strings);
+	ignorelist_hash_clear (&il->memo);
+	pthread_mutex_destroy (&il->lock);
 
 	sfree (il);
 	il = NULL;
@@ -259,6 +432,7 @@ void ignorelist_set_invert (ignorelist_t *il, int invert)
 int ignorelist_add (ignorelist_t *il, const char *entry)
 {
 	size_t len;
+	int status;
 
 	if (il == NULL)
 	{
@@ -275,62 +449,90 @@ int ignorelist_add (ignorelist_t *il, const char *entry)
 		return (1);
 	}
 
+	pthread_mutex_lock (&il->lock);
+	ignorelist_memo_reset (il);
+
 #if HAVE_REGEX_H
 	/* regex string is enclosed in "/.../" */
 	if ((len > 2) && (entry[0] == '/') && entry[len - 1] == '/')
 	{
 		char *copy;
-		int status;
 
 		/* skip leading slash */
 		copy = strdup (entry + 1);
 		if (copy == NULL)
+		{
+			pthread_mutex_unlock (&il->lock);
 			return ENOMEM;
+		}
 
 		/* trim trailing slash */
 		copy[strlen (copy) - 1] = 0;
 
 		status = ignorelist_append_regex (il, copy);
 		sfree (copy);
+		pthread_mutex_unlock (&il->lock);
 		return status;
 	}
 #endif
 
-	return ignorelist_append_string(il, entry);
+	status = ignorelist_append_string(il, entry);
+	pthread_mutex_unlock (&il->lock);
+	return (status);
 } /* int ignorelist_add (ignorelist_t *il, const char *entry) */
 
 /*
  * check list for entry
  * return 1 for ignored entry
+ *
+ * Exact entries are looked up in a hash table and all regex entries are
+ * pre-filtered in one pass by a regex set. Since the same names are checked
+ * in every interval, the result for each name is remembered as well.
  */
 int ignorelist_match (ignorelist_t *il, const char *entry)
 {
-	ignorelist_item_t *traverse;
+	ignorelist_hash_entry_t *memo;
+	uint32_t hash;
+	int found;
 
 	/* if no entries, collect all */
-	if ((il == NULL) || (il->head == NULL))
+	if (il == NULL)
 		return (0);
+#if HAVE_REGEX_H
+	if ((il->strings.entries_num == 0) && (il->regexes_num == 0))
+		return (0);
+#else
+	if (il->strings.entries_num == 0)
+		return (0);
+#endif
 
 	if ((entry == NULL) || (strlen (entry) == 0))
 		return (0);
 
-	/* traverse list and check entries */
-	for (traverse = il->head; traverse != NULL; traverse = traverse->next)
+	hash = ignorelist_hash_string (entry);
+
+	pthread_mutex_lock (&il->lock);
+
+	memo = ignorelist_hash_lookup (&il->memo, entry, hash);
+	if (memo != NULL)
 	{
+		found = memo->value;
+		pthread_mutex_unlock (&il->lock);
+		return (found ? il->ignore : (1 - il->ignore));
+	}
+
+	found = (ignorelist_hash_lookup (&il->strings, entry, hash) != NULL);
 #if HAVE_REGEX_H
-		if (traverse->rmatch != NULL)
-		{
-			if (ignorelist_match_regex (traverse, entry))
-				return (il->ignore);
-		}
-		else
+	if (!found)
+		found = ignorelist_match_regex (il, entry);
 #endif
-		{
-			if (ignorelist_match_string (traverse, entry))
-				return (il->ignore);
-		}
-	} /* for traverse */
 
-	return (1 - il->ignore);
-} /* int ignorelist_match (ignorelist_t *il, const char *entry) */
+	if (il->memo.entries_num >= IGNORELIST_MEMO_MAX)
+		ignorelist_memo_reset (il);
+	/* Not remembering the result is not an error. */
+	ignorelist_hash_insert (&il->memo, entry, hash, found);
+
+	pthread_mutex_unlock (&il->lock);
 
+	return (found ? il->ignore : (1 - il->ignore));
+} /* int ignorelist_match (ignorelist_t *il, const char *entry) */
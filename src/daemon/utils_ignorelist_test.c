@@ -0,0 +1,144 @@
+/**
+ * collectd - src/daemon/utils_ignorelist_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "common.h" /* STATIC_ARRAY_SIZE */
+#include "collectd.h"
+#include "testing.h"
+#include "utils_ignorelist.h"
+
+DEF_TEST(match)
+{
+  char const *entries[] = { "eth0", "lo", "/^veth/", "/^tap[0-9]+$/",
+    "/(docker|virbr)/" };
+  struct {
+    char const *name;
+    int want_selected;
+  } cases[] = {
+    {"eth0", 1},
+    {"eth1", 0},
+    {"lo", 1},
+    {"lo0", 0},
+    {"veth1234", 1},
+    {"xveth", 0},
+    {"tap12", 1},
+    {"tap12a", 0},
+    {"docker0", 1},
+    {"virbr1", 1},
+    {"wlan0", 0},
+  };
+  int pass;
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    ignorelist_t *il;
+    size_t i;
+    int round;
+
+    /* pass 0: collect the selected entries, pass 1: ignore them */
+    CHECK_NOT_NULL (il = ignorelist_create (/* invert = */ (pass == 0)));
+    for (i = 0; i < STATIC_ARRAY_SIZE (entries); i++)
+      CHECK_ZERO (ignorelist_add (il, entries[i]));
+
+    /* The second round is answered from the remembered results. */
+    for (round = 0; round < 2; round++)
+    {
+      for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+      {
+        int want = (pass == 0) ? !cases[i].want_selected
+          : cases[i].want_selected;
+        EXPECT_EQ_INT (want, ignorelist_match (il, cases[i].name));
+      }
+    }
+
+    /* Adding an entry invalidates the remembered results. */
+    CHECK_ZERO (ignorelist_add (il, "wlan0"));
+    EXPECT_EQ_INT ((pass == 0) ? 0 : 1, ignorelist_match (il, "wlan0"));
+
+    /* So does inverting the list. */
+    ignorelist_set_invert (il, (pass != 0));
+    EXPECT_EQ_INT ((pass == 0) ? 1 : 0, ignorelist_match (il, "wlan0"));
+    EXPECT_EQ_INT ((pass == 0) ? 0 : 1, ignorelist_match (il, "wlan1"));
+
+    ignorelist_free (il);
+  }
+
+  return (0);
+}
+
+DEF_TEST(empty)
+{
+  ignorelist_t *il;
+
+  CHECK_NOT_NULL (il = ignorelist_create (/* invert = */ 1));
+  EXPECT_EQ_INT (0, ignorelist_match (il, "eth0"));
+  EXPECT_EQ_INT (0, ignorelist_match (NULL, "eth0"));
+  EXPECT_EQ_INT (0, ignorelist_match (il, ""));
+  OK (ignorelist_add (il, "") != 0);
+  OK (ignorelist_add (il, "/(/") != 0);
+  EXPECT_EQ_INT (0, ignorelist_match (il, "eth0"));
+  ignorelist_free (il);
+
+  return (0);
+}
+
+/* More names than remembered results, checked twice. */
+DEF_TEST(many)
+{
+  ignorelist_t *il;
+  int errors = 0;
+  int round;
+  int i;
+
+  CHECK_NOT_NULL (il = ignorelist_create (/* invert = */ 1));
+  CHECK_ZERO (ignorelist_add (il, "/^cpu[0-9]*7$/"));
+  CHECK_ZERO (ignorelist_add (il, "cpu10"));
+
+  for (round = 0; round < 2; round++)
+  {
+    for (i = 0; i < 10000; i++)
+    {
+      char name[32];
+      int want;
+
+      snprintf (name, sizeof (name), "cpu%d", i);
+      want = ((i % 10) == 7) || (i == 10) ? 0 : 1;
+      if (ignorelist_match (il, name) != want)
+        errors++;
+    }
+  }
+  EXPECT_EQ_INT (0, errors);
+
+  ignorelist_free (il);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(match);
+  RUN_TEST(empty);
+  RUN_TEST(many);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
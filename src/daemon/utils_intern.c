@@ -0,0 +1,288 @@
+/**
+ * collectd - src/daemon/utils_intern.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_intern.h"
+
+#include <pthread.h>
+
+#define INTERN_INITIAL_SIZE 256
+
+/* 32 bit FNV-1a */
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+struct intern_entry_s;
+typedef struct intern_entry_s intern_entry_t;
+struct intern_entry_s
+{
+  intern_entry_t *next;
+  uint32_t hash;
+  size_t refs;
+  char str[];
+};
+
+static intern_entry_t **intern_table = NULL;
+static size_t intern_table_size = 0;
+static size_t intern_num = 0;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_update (uint32_t hash, char const *str) /* {{{ */
+{
+  unsigned char const *ptr;
+
+  for (ptr = (unsigned char const *) str; *ptr != 0; ptr++)
+  {
+    hash ^= (uint32_t) *ptr;
+    hash *= FNV_PRIME;
+  }
+
+  return (hash);
+} /* }}} uint32_t hash_update */
+
+/* Doubles the size of the table. Must hold intern_lock. */
+static int intern_grow (void) /* {{{ */
+{
+  intern_entry_t **table;
+  size_t size;
+  size_t i;
+
+  size = (intern_table_size == 0) ? INTERN_INITIAL_SIZE : 2 * intern_table_size;
+  table = calloc (size, sizeof (*table));
+  if (table == NULL)
+    return (ENOMEM);
+
+  for (i = 0; i < intern_table_size; i++)
+  {
+    intern_entry_t *e = intern_table[i];
+
+    while (e != NULL)
+    {
+      intern_entry_t *next = e->next;
+      size_t idx = e->hash & (size - 1);
+
+      e->next = table[idx];
+      table[idx] = e;
+
+      e = next;
+    }
+  }
+
+  sfree (intern_table);
+  intern_table = table;
+  intern_table_size = size;
+
+  return (0);
+} /* }}} int intern_grow */
+
+char const *intern_get (char const *str) /* {{{ */
+{
+  intern_entry_t *e;
+  uint32_t hash;
+  size_t len;
+
+  if (str == NULL)
+    return (NULL);
+
+  hash = hash_update (FNV_OFFSET_BASIS, str);
+
+  pthread_mutex_lock (&intern_lock);
+
+  if (intern_num >= intern_table_size)
+  {
+    /* If growing fails, we keep using the current table (if any). */
+    if ((intern_grow () != 0) && (intern_table == NULL))
+    {
+      pthread_mutex_unlock (&intern_lock);
+      return (NULL);
+    }
+  }
+
+  for (e = intern_table[hash & (intern_table_size - 1)];
+      e != NULL; e = e->next)
+  {
+    if ((e->hash == hash) && (strcmp (e->str, str) == 0))
+    {
+      e->refs++;
+      pthread_mutex_unlock (&intern_lock);
+      return (e->str);
+    }
+  }
+
+  len = strlen (str);
+  e = malloc (sizeof (*e) + len + 1);
+  if (e == NULL)
+  {
+    pthread_mutex_unlock (&intern_lock);
+    return (NULL);
+  }
+  e->hash = hash;
+  e->refs = 1;
+  memcpy (e->str, str, len + 1);
+
+  e->next = intern_table[hash & (intern_table_size - 1)];
+  intern_table[hash & (intern_table_size - 1)] = e;
+  intern_num++;
+
+  pthread_mutex_unlock (&intern_lock);
+  return (e->str);
+} /* }}} char const *intern_get */
+
+void intern_put (char const *str) /* {{{ */
+{
+  intern_entry_t *e;
+  intern_entry_t **prev;
+
+  if (str == NULL)
+    return;
+
+  e = (intern_entry_t *) (str - offsetof (intern_entry_t, str));
+
+  pthread_mutex_lock (&intern_lock);
+
+  assert (e->refs > 0);
+  e->refs--;
+  if (e->refs > 0)
+  {
+    pthread_mutex_unlock (&intern_lock);
+    return;
+  }
+
+  for (prev = &intern_table[e->hash & (intern_table_size - 1)];
+      *prev != NULL; prev = &(*prev)->next)
+  {
+    if (*prev == e)
+    {
+      *prev = e->next;
+      break;
+    }
+  }
+  intern_num--;
+
+  pthread_mutex_unlock (&intern_lock);
+
+  sfree (e);
+} /* }}} void intern_put */
+
+size_t intern_size (void) /* {{{ */
+{
+  size_t num;
+
+  pthread_mutex_lock (&intern_lock);
+  num = intern_num;
+  pthread_mutex_unlock (&intern_lock);
+
+  return (num);
+} /* }}} size_t intern_size */
+
+uint32_t identifier_hash_name (char const *name) /* {{{ */
+{
+  return (hash_update (FNV_OFFSET_BASIS, name));
+} /* }}} uint32_t identifier_hash_name */
+
+/* Hashes the fields in the same order and with the same separators as
+ * format_name(), so the result is identical to hashing the formatted
+ * identifier. */
+uint32_t identifier_hash_vl (value_list_t const *vl) /* {{{ */
+{
+  uint32_t hash = FNV_OFFSET_BASIS;
+
+  hash = hash_update (hash, vl->host);
+  hash = hash_update (hash, "/");
+  hash = hash_update (hash, vl->plugin);
+  if (vl->plugin_instance[0] != 0)
+  {
+    hash = hash_update (hash, "-");
+    hash = hash_update (hash, vl->plugin_instance);
+  }
+  hash = hash_update (hash, "/");
+  hash = hash_update (hash, vl->type);
+  if (vl->type_instance[0] != 0)
+  {
+    hash = hash_update (hash, "-");
+    hash = hash_update (hash, vl->type_instance);
+  }
+
+  return (hash);
+} /* }}} uint32_t identifier_hash_vl */
+
+void identifier_destroy (identifier_t *id) /* {{{ */
+{
+  if (id == NULL)
+    return;
+
+  intern_put (id->host);
+  intern_put (id->plugin);
+  intern_put (id->plugin_instance);
+  intern_put (id->type);
+  intern_put (id->type_instance);
+
+  memset (id, 0, sizeof (*id));
+} /* }}} void identifier_destroy */
+
+int identifier_create (identifier_t *id, value_list_t const *vl) /* {{{ */
+{
+  memset (id, 0, sizeof (*id));
+
+  id->host            = intern_get (vl->host);
+  id->plugin          = intern_get (vl->plugin);
+  id->plugin_instance = intern_get (vl->plugin_instance);
+  id->type            = intern_get (vl->type);
+  id->type_instance   = intern_get (vl->type_instance);
+
+  if ((id->host == NULL) || (id->plugin == NULL)
+      || (id->plugin_instance == NULL) || (id->type == NULL)
+      || (id->type_instance == NULL))
+  {
+    identifier_destroy (id);
+    return (ENOMEM);
+  }
+
+  id->hash = identifier_hash_vl (vl);
+  return (0);
+} /* }}} int identifier_create */
+
+void identifier_to_vl (identifier_t const *id, value_list_t *vl) /* {{{ */
+{
+  sstrncpy (vl->host, id->host, sizeof (vl->host));
+  sstrncpy (vl->plugin, id->plugin, sizeof (vl->plugin));
+  sstrncpy (vl->plugin_instance, id->plugin_instance,
+      sizeof (vl->plugin_instance));
+  sstrncpy (vl->type, id->type, sizeof (vl->type));
+  sstrncpy (vl->type_instance, id->type_instance,
+      sizeof (vl->type_instance));
+} /* }}} void identifier_to_vl */
+
+_Bool identifier_equal_vl (identifier_t const *id, /* {{{ */
+    value_list_t const *vl)
+{
+  return ((strcmp (id->type, vl->type) == 0)
+      && (strcmp (id->type_instance, vl->type_instance) == 0)
+      && (strcmp (id->plugin, vl->plugin) == 0)
+      && (strcmp (id->plugin_instance, vl->plugin_instance) == 0)
+      && (strcmp (id->host, vl->host) == 0));
+} /* }}} _Bool identifier_equal_vl */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,130 @@
+/**
+ * collectd - src/daemon/utils_intern.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_INTERN_H
+#define UTILS_INTERN_H 1
+
+#include "plugin.h"
+
+/*
+ * NAME
+ *   intern_get
+ *
+ * DESCRIPTION
+ *   Returns the interned copy of `str'. Equal strings are only stored once and
+ *   the returned pointers of equal strings are identical, so they can be
+ *   compared by address. Each call increases the reference count of the
+ *   string, which must be released with `intern_put'.
+ *
+ * RETURN VALUE
+ *   A pointer to the interned string or NULL if `str' is NULL or memory could
+ *   not be allocated.
+ */
+char const *intern_get (char const *str);
+
+/*
+ * NAME
+ *   intern_put
+ *
+ * DESCRIPTION
+ *   Releases a reference acquired with `intern_get'. The string is freed when
+ *   the last reference is released. Passing NULL is a no-op.
+ */
+void intern_put (char const *str);
+
+/*
+ * NAME
+ *   intern_size
+ *
+ * RETURN VALUE
+ *   The number of distinct strings currently interned.
+ */
+size_t intern_size (void);
+
+/*
+ * Interned identifier.
+ *
+ * Compact representation of the five identifier fields of a value list: five
+ * pointers to interned strings plus the hash of the formatted identifier, as
+ * returned by `identifier_hash_name'. This takes 48 bytes instead of the
+ * 5 * DATA_MAX_NAME_LEN bytes used by `value_list_t'.
+ */
+struct identifier_s
+{
+	char const *host;
+	char const *plugin;
+	char const *plugin_instance;
+	char const *type;
+	char const *type_instance;
+	uint32_t hash;
+};
+typedef struct identifier_s identifier_t;
+
+/*
+ * NAME
+ *   identifier_hash_name
+ *   identifier_hash_vl
+ *
+ * DESCRIPTION
+ *   Returns the hash of an identifier, either given in its string form
+ *   ("host/plugin-instance/type-instance") or as a value list. Both functions
+ *   return the same hash for the same identifier, so values can be looked up
+ *   by name or by value list alike.
+ */
+uint32_t identifier_hash_name (char const *name);
+uint32_t identifier_hash_vl (value_list_t const *vl);
+
+/*
+ * NAME
+ *   identifier_create
+ *
+ * DESCRIPTION
+ *   Interns the identifier fields of `vl' and stores them, together with the
+ *   identifier's hash, in `id'. The references must be released with
+ *   `identifier_destroy'.
+ *
+ * RETURN VALUE
+ *   Zero upon success, ENOMEM if memory could not be allocated.
+ */
+int identifier_create (identifier_t *id, value_list_t const *vl);
+void identifier_destroy (identifier_t *id);
+
+/*
+ * NAME
+ *   identifier_to_vl
+ *
+ * DESCRIPTION
+ *   Copies the identifier fields from `id' to `vl'. Other members of `vl' are
+ *   not modified.
+ */
+void identifier_to_vl (identifier_t const *id, value_list_t *vl);
+
+/* Returns true if `id' refers to the same identifier as `vl'. */
+_Bool identifier_equal_vl (identifier_t const *id, value_list_t const *vl);
+
+/* Formats an identifier like FORMAT_VL. */
+#define FORMAT_ID(ret, ret_len, id) \
+	format_name (ret, ret_len, (id)->host, (id)->plugin, \
+			(id)->plugin_instance, (id)->type, (id)->type_instance)
+
+#endif /* UTILS_INTERN_H */
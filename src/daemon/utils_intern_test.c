@@ -0,0 +1,148 @@
+/**
+ * collectd - src/daemon/utils_intern_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+#include "testing.h"
+#include "utils_intern.h"
+
+DEF_TEST(intern)
+{
+  char buffer[64];
+  char const *a;
+  char const *b;
+  char const *c;
+  int i;
+
+  OK ((a = intern_get ("foo")) != NULL);
+  EXPECT_EQ_STR ("foo", a);
+
+  /* Equal strings share the same memory, even if the argument doesn't. */
+  sstrncpy (buffer, "foo", sizeof (buffer));
+  OK ((b = intern_get (buffer)) != NULL);
+  OK (a == b);
+  EXPECT_EQ_INT (1, intern_size ());
+
+  OK ((c = intern_get ("bar")) != NULL);
+  OK (a != c);
+  EXPECT_EQ_INT (2, intern_size ());
+
+  /* Force the table to grow a couple of times. */
+  for (i = 0; i < 1000; i++)
+  {
+    ssnprintf (buffer, sizeof (buffer), "string%i", i);
+    OK (intern_get (buffer) != NULL);
+  }
+  EXPECT_EQ_INT (1002, intern_size ());
+  EXPECT_EQ_STR ("foo", a);
+  OK (intern_get ("foo") == a);
+  intern_put (a);
+
+  for (i = 0; i < 1000; i++)
+  {
+    char const *s;
+
+    ssnprintf (buffer, sizeof (buffer), "string%i", i);
+    OK ((s = intern_get (buffer)) != NULL);
+    intern_put (s);
+    intern_put (s);
+  }
+  EXPECT_EQ_INT (2, intern_size ());
+
+  intern_put (a);
+  EXPECT_EQ_INT (2, intern_size ());
+  intern_put (b);
+  EXPECT_EQ_INT (1, intern_size ());
+  intern_put (c);
+  EXPECT_EQ_INT (0, intern_size ());
+
+  OK (intern_get (NULL) == NULL);
+  intern_put (NULL);
+
+  return (0);
+}
+
+DEF_TEST(identifier)
+{
+  struct {
+    char *host;
+    char *plugin;
+    char *plugin_instance;
+    char *type;
+    char *type_instance;
+  } cases[] = {
+    {"example.com", "cpu", "0", "cpu", "idle"},
+    {"example.com", "load", "", "load", ""},
+    {"example.com", "df", "", "df_complex", "free"},
+    {"example.com", "interface", "eth0", "if_octets", ""},
+  };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+  {
+    value_list_t vl = VALUE_LIST_STATIC;
+    value_list_t vl_copy = VALUE_LIST_STATIC;
+    char name[6 * DATA_MAX_NAME_LEN];
+    char id_name[6 * DATA_MAX_NAME_LEN];
+    identifier_t id;
+
+    sstrncpy (vl.host, cases[i].host, sizeof (vl.host));
+    sstrncpy (vl.plugin, cases[i].plugin, sizeof (vl.plugin));
+    sstrncpy (vl.plugin_instance, cases[i].plugin_instance,
+        sizeof (vl.plugin_instance));
+    sstrncpy (vl.type, cases[i].type, sizeof (vl.type));
+    sstrncpy (vl.type_instance, cases[i].type_instance,
+        sizeof (vl.type_instance));
+
+    CHECK_ZERO (FORMAT_VL (name, sizeof (name), &vl));
+    EXPECT_EQ_INT (identifier_hash_name (name), identifier_hash_vl (&vl));
+
+    CHECK_ZERO (identifier_create (&id, &vl));
+    EXPECT_EQ_INT (identifier_hash_name (name), id.hash);
+    OK (identifier_equal_vl (&id, &vl));
+
+    CHECK_ZERO (FORMAT_ID (id_name, sizeof (id_name), &id));
+    EXPECT_EQ_STR (name, id_name);
+
+    identifier_to_vl (&id, &vl_copy);
+    OK (identifier_equal_vl (&id, &vl_copy));
+
+    sstrncpy (vl_copy.type_instance, "other", sizeof (vl_copy.type_instance));
+    OK (!identifier_equal_vl (&id, &vl_copy));
+
+    identifier_destroy (&id);
+  }
+
+  EXPECT_EQ_INT (0, intern_size ());
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(intern);
+  RUN_TEST(identifier);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -26,6 +26,7 @@
 
 #include "config.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -39,8 +40,89 @@ struct llist_s
 	llentry_t *head;
 	llentry_t *tail;
 	int size;
+
+	/* Hash table of indexed lists, NULL otherwise. Each bucket lists its
+	 * entries in the same order as the list itself, so llist_search()
+	 * finds the same entry with and without the index. */
+	llentry_t **index;
+	size_t index_size; /* power of two */
 };
 
+#define LLIST_INDEX_INITIAL_SIZE 16
+
+/*
+ * Private functions
+ */
+/* 32 bit FNV-1a */
+static uint32_t llist_hash (const char *key)
+{
+	uint32_t hash = 2166136261U;
+	const unsigned char *ptr;
+
+	for (ptr = (const unsigned char *) key; *ptr != 0; ptr++)
+	{
+		hash ^= (uint32_t) *ptr;
+		hash *= 16777619U;
+	}
+
+	return (hash);
+}
+
+static llentry_t **llist_bucket (llentry_t **index, size_t index_size,
+		const char *key)
+{
+	return (&index[llist_hash (key) & (index_size - 1)]);
+}
+
+static void llist_index_append (llentry_t **index, size_t index_size,
+		llentry_t *e)
+{
+	llentry_t **pos = llist_bucket (index, index_size, e->key);
+
+	while (*pos != NULL)
+		pos = &(*pos)->index_next;
+
+	e->index_next = NULL;
+	*pos = e;
+}
+
+/* Doubles the hash table once the list has twice as many entries as there are
+ * buckets. If that fails, the old table is kept with longer buckets. */
+static void llist_index_grow (llist_t *l)
+{
+	llentry_t **index;
+	size_t index_size;
+	llentry_t *e;
+
+	if (((size_t) l->size) <= (2 * l->index_size))
+		return;
+
+	index_size = 2 * l->index_size;
+	index = calloc (index_size, sizeof (*index));
+	if (index == NULL)
+		return;
+
+	/* Re-inserting in list order keeps the buckets in list order. */
+	for (e = l->head; e != NULL; e = e->next)
+		llist_index_append (index, index_size, e);
+
+	free (l->index);
+	l->index = index;
+	l->index_size = index_size;
+}
+
+static void llist_index_remove (llist_t *l, llentry_t *e)
+{
+	llentry_t **pos = llist_bucket (l->index, l->index_size, e->key);
+
+	while ((*pos != NULL) && (*pos != e))
+		pos = &(*pos)->index_next;
+
+	if (*pos != NULL)
+		*pos = e->index_next;
+	e->index_next = NULL;
+}
+
 /*
  * Public functions
  */
@@ -55,6 +137,25 @@ llist_t *llist_create (void)
 	return (ret);
 }
 
+llist_t *llist_create_indexed (void)
+{
+	llist_t *ret;
+
+	ret = llist_create ();
+	if (ret == NULL)
+		return (NULL);
+
+	ret->index = calloc (LLIST_INDEX_INITIAL_SIZE, sizeof (*ret->index));
+	if (ret->index == NULL)
+	{
+		free (ret);
+		return (NULL);
+	}
+	ret->index_size = LLIST_INDEX_INITIAL_SIZE;
+
+	return (ret);
+}
+
 void llist_destroy (llist_t *l)
 {
 	llentry_t *e_this;
@@ -69,6 +170,7 @@ void llist_destroy (llist_t *l)
 		llentry_destroy (e_this);
 	}
 
+	free (l->index);
 	free (l);
 }
 
@@ -82,6 +184,7 @@ llentry_t *llentry_create (char *key, void *value)
 		e->key   = key;
 		e->value = value;
 		e->next  = NULL;
+		e->index_next = NULL;
 	}
 
 	return (e);
@@ -104,6 +207,12 @@ void llist_append (llist_t *l, llentry_t *e)
 	l->tail = e;
 
 	++(l->size);
+
+	if (l->index != NULL)
+	{
+		llist_index_append (l->index, l->index_size, e);
+		llist_index_grow (l);
+	}
 }
 
 void llist_prepend (llist_t *l, llentry_t *e)
@@ -115,6 +224,15 @@ void llist_prepend (llist_t *l, llentry_t *e)
 		l->tail = e;
 
 	++(l->size);
+
+	if (l->index != NULL)
+	{
+		llentry_t **pos = llist_bucket (l->index, l->index_size, e->key);
+
+		e->index_next = *pos;
+		*pos = e;
+		llist_index_grow (l);
+	}
 }
 
 void llist_remove (llist_t *l, llentry_t *e)
@@ -136,6 +254,9 @@ void llist_remove (llist_t *l, llentry_t *e)
 		l->tail = prev;
 
 	--(l->size);
+
+	if (l->index != NULL)
+		llist_index_remove (l, e);
 }
 
 int llist_size (llist_t *l)
@@ -152,7 +273,19 @@ static int llist_strcmp (llentry_t *e, void *ud)
 
 llentry_t *llist_search (llist_t *l, const char *key)
 {
-	return (llist_search_custom (l, llist_strcmp, (void *)key));
+	llentry_t *e;
+
+	if ((l == NULL) || (l->index == NULL))
+		return (llist_search_custom (l, llist_strcmp, (void *)key));
+
+	if (key == NULL)
+		return (NULL);
+
+	e = *llist_bucket (l->index, l->index_size, key);
+	while ((e != NULL) && (strcmp (e->key, key) != 0))
+		e = e->index_next;
+
+	return (e);
 }
 
 llentry_t *llist_search_custom (llist_t *l,
@@ -35,6 +35,9 @@ struct llentry_s
 	char *key;
 	void *value;
 	struct llentry_s *next;
+
+	/* Private: next entry in the same bucket of an indexed list. */
+	struct llentry_s *index_next;
 };
 typedef struct llentry_s llentry_t;
 
@@ -45,6 +48,11 @@ typedef struct llist_s llist_t;
  * Functions
  */
 llist_t *llist_create (void);
+/* Creates a list which also keeps a hash table of its keys, so that
+ * llist_search() doesn't have to walk the list. The order of the entries and
+ * all other functions behave as with llist_create(). The key of an entry must
+ * not be changed while the entry is in an indexed list. */
+llist_t *llist_create_indexed (void);
 void llist_destroy (llist_t *l);
 
 llentry_t *llentry_create (char *key, void *value);
@@ -0,0 +1,139 @@
+/**
+ * collectd - src/daemon/utils_llist_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "testing.h"
+#include "utils_llist.h"
+
+/* Runs the same operations on a plain and an indexed list, which must agree
+ * on every search result. The checks within the loops are counted instead of
+ * printed. */
+DEF_TEST(indexed)
+{
+  size_t keys_num = 1000;
+  char **keys;
+  llist_t *plain;
+  llist_t *indexed;
+  llentry_t *le;
+  llentry_t *e0;
+  int errors = 0;
+  size_t i;
+
+  CHECK_NOT_NULL (keys = calloc (keys_num, sizeof (*keys)));
+  CHECK_NOT_NULL (plain = llist_create ());
+  CHECK_NOT_NULL (indexed = llist_create_indexed ());
+
+  for (i = 0; i < keys_num; i++)
+  {
+    char buffer[32];
+
+    /* Every key twice, so searches have to find the first one. */
+    snprintf (buffer, sizeof (buffer), "key%zu", i / 2);
+    keys[i] = strdup (buffer);
+    if (keys[i] == NULL)
+    {
+      errors++;
+      break;
+    }
+
+    if ((i % 3) == 0)
+    {
+      llist_prepend (plain, llentry_create (keys[i], (void *) i));
+      llist_prepend (indexed, llentry_create (keys[i], (void *) i));
+    }
+    else
+    {
+      llist_append (plain, llentry_create (keys[i], (void *) i));
+      llist_append (indexed, llentry_create (keys[i], (void *) i));
+    }
+  }
+  EXPECT_EQ_INT (0, errors);
+  EXPECT_EQ_INT ((int) keys_num, llist_size (indexed));
+
+  for (i = 0; i < keys_num; i++)
+    if (llist_search (plain, keys[i])->value
+        != llist_search (indexed, keys[i])->value)
+      errors++;
+  EXPECT_EQ_INT (0, errors);
+
+  /* Remove the first occurrence of every third key. */
+  for (i = 0; i < keys_num; i += 3)
+  {
+    llentry_t *e;
+
+    e = llist_search (plain, keys[i]);
+    llist_remove (plain, e);
+    llentry_destroy (e);
+
+    e = llist_search (indexed, keys[i]);
+    llist_remove (indexed, e);
+    llentry_destroy (e);
+  }
+  EXPECT_EQ_INT (llist_size (plain), llist_size (indexed));
+
+  for (i = 0; i < keys_num; i++)
+  {
+    llentry_t *e1 = llist_search (indexed, keys[i]);
+
+    e0 = llist_search (plain, keys[i]);
+    if ((e0 == NULL) != (e1 == NULL))
+      errors++;
+    else if ((e0 != NULL) && (e0->value != e1->value))
+      errors++;
+  }
+  EXPECT_EQ_INT (0, errors);
+
+  /* Iteration order is unchanged by the index. */
+  e0 = llist_head (plain);
+  for (le = llist_head (indexed); le != NULL; le = le->next)
+  {
+    if ((e0 == NULL) || (e0->value != le->value))
+    {
+      errors++;
+      break;
+    }
+    e0 = e0->next;
+  }
+  EXPECT_EQ_INT (0, errors);
+  OK (e0 == NULL);
+
+  OK (llist_search (indexed, "no such key") == NULL);
+  OK (llist_search (indexed, NULL) == NULL);
+
+  llist_destroy (plain);
+  llist_destroy (indexed);
+  for (i = 0; i < keys_num; i++)
+    free (keys[i]);
+  free (keys);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(indexed);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -38,6 +38,7 @@
 struct cu_match_s
 {
   regex_t regex;
+  char *regex_str;
   regex_t excluderegex;
   int flags;
 
@@ -262,6 +263,14 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
     obj->flags |= UTILS_MATCH_FLAGS_EXCLUDE_REGEX;
   }
 
+  obj->regex_str = strdup (regex);
+  if (obj->regex_str == NULL)
+  {
+    ERROR ("utils_match: match_create_callback: strdup failed.");
+    sfree (obj);
+    return (NULL);
+  }
+
   obj->callback = callback;
   obj->user_data = user_data;
 
@@ -314,6 +323,7 @@ void match_destroy (cu_match_t *obj)
     sfree (obj->user_data);
   }
 
+  sfree (obj->regex_str);
   sfree (obj);
 } /* void match_destroy */
 
@@ -391,4 +401,11 @@ void *match_get_user_data (cu_match_t *obj)
   return (obj->user_data);
 } /* void *match_get_user_data */
 
+const char *match_get_regex (cu_match_t *obj)
+{
+  if (obj == NULL)
+    return (NULL);
+  return (obj->regex_str);
+} /* const char *match_get_regex */
+
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -170,6 +170,16 @@ int match_apply (cu_match_t *obj, const char *str);
  */
 void *match_get_user_data (cu_match_t *obj);
 
+/*
+ * NAME
+ *  match_get_regex
+ *
+ * DESCRIPTION
+ *  Returns the regular expression passed to `match_create_callback'. The
+ *  string is owned by the match object.
+ */
+const char *match_get_regex (cu_match_t *obj);
+
 #endif /* UTILS_MATCH_H */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -0,0 +1,57 @@
+/**
+ * collectd - src/daemon/utils_probe.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_PROBE_H
+#define UTILS_PROBE_H 1
+
+/*
+ * Static tracepoints of the "collectd" provider, e.g. for
+ *
+ *   bpftrace -e 'usdt:/opt/collectd/sbin/collectd:collectd:write_end
+ *     { @[str(arg0)] = count (); }'
+ *
+ * With <sys/sdt.h>, each probe is a single nop and a note in the binary
+ * until a tracer attaches to it; without it, the arguments are only
+ * referenced from dead code, which the compiler removes. Arguments must be
+ * integers or pointers. The probes are listed in collectd(1).
+ */
+#if HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define PROBE0(name) DTRACE_PROBE (collectd, name)
+# define PROBE1(name, a1) DTRACE_PROBE1 (collectd, name, a1)
+# define PROBE2(name, a1, a2) DTRACE_PROBE2 (collectd, name, a1, a2)
+# define PROBE3(name, a1, a2, a3) DTRACE_PROBE3 (collectd, name, a1, a2, a3)
+# define PROBE4(name, a1, a2, a3, a4) \
+  DTRACE_PROBE4 (collectd, name, a1, a2, a3, a4)
+#else
+# define PROBE0(name) do { } while (0)
+# define PROBE1(name, a1) do { if (0) { (void) (a1); } } while (0)
+# define PROBE2(name, a1, a2) do { if (0) { \
+  (void) (a1); (void) (a2); } } while (0)
+# define PROBE3(name, a1, a2, a3) do { if (0) { \
+  (void) (a1); (void) (a2); (void) (a3); } } while (0)
+# define PROBE4(name, a1, a2, a3, a4) do { if (0) { \
+  (void) (a1); (void) (a2); (void) (a3); (void) (a4); } } while (0)
+#endif
+
+#endif /* UTILS_PROBE_H */
@@ -0,0 +1,323 @@
+/**
+ * collectd - src/daemon/utils_procfs.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_procfs.h"
+
+#include <fcntl.h>
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
+/* Initial size of the buffer of a file. It grows until the file fits. */
+#define PROCFS_BUFFER_SIZE 4096
+
+typedef struct procfs_file_s procfs_file_t;
+struct procfs_file_s
+{
+  char *path;
+  int fd;
+
+  /* Serializes reading the file, so that plugins asking at the same time
+   * wait for one read instead of reading the file twice. */
+  pthread_mutex_t read_lock;
+
+  /* The most recent snapshot and a released one whose buffer is reused. */
+  procfs_snapshot_t *current;
+  procfs_snapshot_t *spare;
+
+  procfs_file_t *next;
+};
+
+/* Protects the list of files and the snapshot pointers and reference
+ * counters. */
+static pthread_mutex_t procfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static procfs_file_t *procfs_files = NULL;
+
+static void procfs_snapshot_free (procfs_snapshot_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  sfree (s->buffer);
+  sfree (s);
+} /* }}} void procfs_snapshot_free */
+
+/* Drops one reference. The last one keeps the snapshot as its file's spare
+ * or frees it. Must be called with procfs_lock held. */
+static void procfs_snapshot_unref (procfs_snapshot_t *s) /* {{{ */
+{
+  procfs_file_t *f = s->file;
+
+  assert (s->refcount > 0);
+  s->refcount--;
+  if (s->refcount > 0)
+    return;
+
+  if ((f != NULL) && (f->spare == NULL))
+    f->spare = s;
+  else
+    procfs_snapshot_free (s);
+} /* }}} void procfs_snapshot_unref */
+
+/* Returns the entry of `path', creating it if needed. Must be called with
+ * procfs_lock held. */
+static procfs_file_t *procfs_file_get (const char *path) /* {{{ */
+{
+  procfs_file_t *f;
+
+  for (f = procfs_files; f != NULL; f = f->next)
+    if (strcmp (f->path, path) == 0)
+      return (f);
+
+  f = calloc (1, sizeof (*f));
+  if (f == NULL)
+    return (NULL);
+
+  f->path = strdup (path);
+  if (f->path == NULL)
+  {
+    sfree (f);
+    return (NULL);
+  }
+  f->fd = -1;
+  pthread_mutex_init (&f->read_lock, /* attr = */ NULL);
+
+  f->next = procfs_files;
+  procfs_files = f;
+
+  return (f);
+} /* }}} procfs_file_t *procfs_file_get */
+
+/* Reads the whole file into `s', growing its buffer as needed. Must be called
+ * with the read lock of `f' held. */
+static int procfs_file_read (procfs_file_t *f, procfs_snapshot_t *s) /* {{{ */
+{
+  size_t fill = 0;
+
+  if (f->fd < 0)
+  {
+    f->fd = open (f->path, O_RDONLY | O_CLOEXEC);
+    if (f->fd < 0)
+      return (errno);
+  }
+
+  if (s->buffer == NULL)
+  {
+    s->buffer = malloc (PROCFS_BUFFER_SIZE);
+    if (s->buffer == NULL)
+      return (ENOMEM);
+    s->buffer_size = PROCFS_BUFFER_SIZE;
+  }
+
+  while (42)
+  {
+    ssize_t status;
+
+    /* Keep one byte for the terminating null byte. */
+    if (fill + 1 >= s->buffer_size)
+    {
+      char *tmp;
+
+      tmp = realloc (s->buffer, 2 * s->buffer_size);
+      if (tmp == NULL)
+        return (ENOMEM);
+      s->buffer = tmp;
+      s->buffer_size *= 2;
+    }
+
+    status = pread (f->fd, s->buffer + fill, s->buffer_size - fill - 1,
+        (off_t) fill);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    else if (status < 0)
+    {
+      int status_errno = errno;
+
+      /* Open it again next time, the file may have been replaced. */
+      close (f->fd);
+      f->fd = -1;
+      return (status_errno);
+    }
+    else if (status == 0)
+      break;
+
+    fill += (size_t) status;
+  }
+
+  s->buffer[fill] = 0;
+  s->data = s->buffer;
+  s->size = fill;
+  s->time = cdtime ();
+
+  return (0);
+} /* }}} int procfs_file_read */
+
+procfs_snapshot_t *procfs_snapshot_get (const char *path) /* {{{ */
+{
+  procfs_file_t *f;
+  procfs_snapshot_t *s;
+  cdtime_t max_age = plugin_get_interval () / 2;
+  int status;
+
+  if (path == NULL)
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  pthread_mutex_lock (&procfs_lock);
+  f = procfs_file_get (path);
+  pthread_mutex_unlock (&procfs_lock);
+  if (f == NULL)
+  {
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  pthread_mutex_lock (&f->read_lock);
+
+  /* Check again after waiting for the read lock: another plugin may just
+   * have read the file. */
+  pthread_mutex_lock (&procfs_lock);
+  s = f->current;
+  if ((s != NULL) && ((cdtime () - s->time) < max_age))
+  {
+    s->refcount++;
+    pthread_mutex_unlock (&procfs_lock);
+    pthread_mutex_unlock (&f->read_lock);
+    return (s);
+  }
+
+  s = f->spare;
+  f->spare = NULL;
+  pthread_mutex_unlock (&procfs_lock);
+
+  if (s == NULL)
+  {
+    s = calloc (1, sizeof (*s));
+    if (s == NULL)
+    {
+      pthread_mutex_unlock (&f->read_lock);
+      errno = ENOMEM;
+      return (NULL);
+    }
+    s->file = f;
+  }
+
+  status = procfs_file_read (f, s);
+  if (status != 0)
+  {
+    pthread_mutex_lock (&procfs_lock);
+    if (f->spare == NULL)
+      f->spare = s;
+    else
+      procfs_snapshot_free (s);
+    pthread_mutex_unlock (&procfs_lock);
+    pthread_mutex_unlock (&f->read_lock);
+    errno = status;
+    return (NULL);
+  }
+
+  /* One reference for the file and one for the caller. */
+  pthread_mutex_lock (&procfs_lock);
+  s->refcount = 2;
+  if (f->current != NULL)
+    procfs_snapshot_unref (f->current);
+  f->current = s;
+  pthread_mutex_unlock (&procfs_lock);
+
+  pthread_mutex_unlock (&f->read_lock);
+  return (s);
+} /* }}} procfs_snapshot_t *procfs_snapshot_get */
+
+void procfs_snapshot_put (procfs_snapshot_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  pthread_mutex_lock (&procfs_lock);
+  procfs_snapshot_unref (s);
+  pthread_mutex_unlock (&procfs_lock);
+} /* }}} void procfs_snapshot_put */
+
+char *procfs_getline (const procfs_snapshot_t *s, size_t *offset, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  const char *start;
+  const char *end;
+  size_t len;
+
+  if ((s == NULL) || (offset == NULL) || (buffer == NULL)
+      || (buffer_size < 2) || (*offset >= s->size))
+    return (NULL);
+
+  start = s->data + *offset;
+  len = s->size - *offset;
+  if (len > buffer_size - 1)
+    len = buffer_size - 1;
+
+  end = memchr (start, '\n', len);
+  if (end != NULL)
+    len = (size_t) (end - start) + 1;
+
+  memcpy (buffer, start, len);
+  buffer[len] = 0;
+  *offset += len;
+
+  return (buffer);
+} /* }}} char *procfs_getline */
+
+void procfs_destroy (void) /* {{{ */
+{
+  procfs_file_t *f;
+
+  pthread_mutex_lock (&procfs_lock);
+  f = procfs_files;
+  procfs_files = NULL;
+
+  while (f != NULL)
+  {
+    procfs_file_t *next = f->next;
+
+    if (f->fd >= 0)
+      close (f->fd);
+
+    /* Snapshots still held by a plugin are freed when they are released. */
+    procfs_snapshot_free (f->spare);
+    if (f->current != NULL)
+    {
+      f->current->file = NULL;
+      procfs_snapshot_unref (f->current);
+    }
+
+    pthread_mutex_destroy (&f->read_lock);
+    sfree (f->path);
+    sfree (f);
+    f = next;
+  }
+  pthread_mutex_unlock (&procfs_lock);
+} /* }}} void procfs_destroy */
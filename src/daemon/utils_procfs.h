@@ -0,0 +1,81 @@
+/**
+ * collectd - src/daemon/utils_procfs.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_PROCFS_H
+#define UTILS_PROCFS_H 1
+
+#include "utils_time.h"
+
+/*
+ * Snapshots of small files such as /proc/stat, shared between plugins. A file
+ * is kept open and read with pread(2) into a buffer which is reused once no
+ * plugin holds it anymore. A snapshot younger than half the interval of the
+ * calling plugin is handed out again instead of reading the file, so plugins
+ * running at the same interval read each file once per interval and see the
+ * same contents.
+ */
+struct procfs_file_s;
+
+struct procfs_snapshot_s
+{
+  /* The contents of the file, null-terminated. Must not be modified. */
+  const char *data;
+  size_t size;
+  /* When the file was read. */
+  cdtime_t time;
+
+  /* Private, protected by the lock of the snapshot layer. */
+  char *buffer;
+  size_t buffer_size;
+  int refcount;
+  struct procfs_file_s *file;
+};
+typedef struct procfs_snapshot_s procfs_snapshot_t;
+
+/*
+ * NAME
+ *   procfs_snapshot_get
+ *
+ * DESCRIPTION
+ *   Returns a snapshot of `path', reading the file if the current snapshot is
+ *   older than half of plugin_get_interval(). The snapshot stays valid until
+ *   it is released with procfs_snapshot_put().
+ *
+ * RETURN VALUE
+ *   The snapshot or NULL, with errno set, if the file can't be read.
+ */
+procfs_snapshot_t *procfs_snapshot_get (const char *path);
+
+void procfs_snapshot_put (procfs_snapshot_t *s);
+
+/* Copies the next line of `s', starting at `*offset', into `buffer' and
+ * advances `*offset'. Behaves like fgets(3): the newline is kept and lines
+ * longer than `buffer_size' - 1 bytes are returned in pieces. Returns NULL at
+ * the end of the snapshot. */
+char *procfs_getline (const procfs_snapshot_t *s, size_t *offset,
+    char *buffer, size_t buffer_size);
+
+/* Closes all files and frees the snapshots no plugin holds anymore. */
+void procfs_destroy (void);
+
+#endif /* UTILS_PROCFS_H */
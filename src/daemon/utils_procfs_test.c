@@ -0,0 +1,156 @@
+/**
+ * collectd - src/daemon/utils_procfs_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "testing.h"
+#include "utils_procfs.h"
+
+extern cdtime_t cdtime_mock;
+
+static int write_file (const char *path, const char *content)
+{
+  FILE *fh = fopen (path, "w");
+
+  if (fh == NULL)
+    return (-1);
+  fputs (content, fh);
+  return (fclose (fh));
+}
+
+DEF_TEST(snapshot)
+{
+  char path[] = "/tmp/utils_procfs_test.XXXXXX";
+  procfs_snapshot_t *s0;
+  procfs_snapshot_t *s1;
+  procfs_snapshot_t *s2;
+  int fd;
+
+  fd = mkstemp (path);
+  OK (fd >= 0);
+  close (fd);
+  CHECK_ZERO (write_file (path, "cpu 1 2 3\nctxt 42\n"));
+
+  CHECK_NOT_NULL (s0 = procfs_snapshot_get (path));
+  EXPECT_EQ_STR ("cpu 1 2 3\nctxt 42\n", s0->data);
+  EXPECT_EQ_UINT64 (18, s0->size);
+
+  /* Within half an interval, the file is not read again. */
+  CHECK_ZERO (write_file (path, "ctxt 43\n"));
+  cdtime_mock += TIME_T_TO_CDTIME_T (4);
+  CHECK_NOT_NULL (s1 = procfs_snapshot_get (path));
+  OK (s0 == s1);
+  procfs_snapshot_put (s1);
+
+  /* Later it is, and the old snapshot stays valid while it is held. */
+  cdtime_mock += TIME_T_TO_CDTIME_T (2);
+  CHECK_NOT_NULL (s1 = procfs_snapshot_get (path));
+  OK (s0 != s1);
+  EXPECT_EQ_STR ("ctxt 43\n", s1->data);
+  EXPECT_EQ_STR ("cpu 1 2 3\nctxt 42\n", s0->data);
+  procfs_snapshot_put (s0);
+
+  /* The buffer of the released snapshot is reused. */
+  cdtime_mock += TIME_T_TO_CDTIME_T (10);
+  CHECK_NOT_NULL (s2 = procfs_snapshot_get (path));
+  OK (s2 == s0);
+  EXPECT_EQ_STR ("ctxt 43\n", s2->data);
+  procfs_snapshot_put (s1);
+  procfs_snapshot_put (s2);
+
+  unlink (path);
+  OK (procfs_snapshot_get ("/nonexistent/utils_procfs_test") == NULL);
+  EXPECT_EQ_INT (ENOENT, errno);
+
+  procfs_destroy ();
+  return (0);
+}
+
+DEF_TEST(large_file)
+{
+  char path[] = "/tmp/utils_procfs_test.XXXXXX";
+  procfs_snapshot_t *s;
+  char *content;
+  size_t i;
+  int fd;
+
+  /* Larger than the initial buffer. */
+  content = malloc (20001);
+  CHECK_NOT_NULL (content);
+  for (i = 0; i < 20000; i++)
+    content[i] = ((i % 100) == 99) ? '\n' : (char) ('a' + (i % 26));
+  content[20000] = 0;
+
+  fd = mkstemp (path);
+  OK (fd >= 0);
+  close (fd);
+  CHECK_ZERO (write_file (path, content));
+
+  cdtime_mock += TIME_T_TO_CDTIME_T (10);
+  CHECK_NOT_NULL (s = procfs_snapshot_get (path));
+  EXPECT_EQ_UINT64 (20000, s->size);
+  EXPECT_EQ_INT (0, memcmp (content, s->data, 20001));
+
+  procfs_snapshot_put (s);
+  procfs_destroy ();
+  unlink (path);
+  free (content);
+  return (0);
+}
+
+DEF_TEST(getline)
+{
+  procfs_snapshot_t s = { 0 };
+  char buffer[8];
+  char *line;
+  size_t offset = 0;
+
+  s.data = "ab\nlong line\n\nend";
+  s.size = strlen (s.data);
+
+  CHECK_NOT_NULL (line = procfs_getline (&s, &offset, buffer, sizeof (buffer)));
+  EXPECT_EQ_STR ("ab\n", line);
+  /* Like fgets(3), long lines are returned in pieces. */
+  CHECK_NOT_NULL (line = procfs_getline (&s, &offset, buffer, sizeof (buffer)));
+  EXPECT_EQ_STR ("long li", line);
+  CHECK_NOT_NULL (line = procfs_getline (&s, &offset, buffer, sizeof (buffer)));
+  EXPECT_EQ_STR ("ne\n", line);
+  CHECK_NOT_NULL (line = procfs_getline (&s, &offset, buffer, sizeof (buffer)));
+  EXPECT_EQ_STR ("\n", line);
+  CHECK_NOT_NULL (line = procfs_getline (&s, &offset, buffer, sizeof (buffer)));
+  EXPECT_EQ_STR ("end", line);
+  OK (procfs_getline (&s, &offset, buffer, sizeof (buffer)) == NULL);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(snapshot);
+  RUN_TEST(large_file);
+  RUN_TEST(getline);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,515 @@
+/**
+ * collectd - src/daemon/utils_regex_set.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_regex_set.h"
+
+#include <regex.h>
+
+/* Longer literals are truncated. A substring of a required literal is
+ * required, too, and shorter literals keep the automaton small. */
+#define REGEX_SET_LITERAL_MAX 16
+
+struct regex_set_literal_s
+{
+  char str[REGEX_SET_LITERAL_MAX + 1];
+  size_t len;
+};
+typedef struct regex_set_literal_s regex_set_literal_t;
+
+struct regex_set_s
+{
+  regex_set_literal_t *literals;
+  size_t patterns_num;
+
+  /* Patterns without a literal. */
+  uint64_t *always;
+  size_t always_num;
+
+  /* The automaton. Input bytes are folded to lower case and mapped to one of
+   * "classes_num" classes; class zero stands for all bytes that don't occur
+   * in any literal. State zero is the start state. */
+  unsigned char classes[256];
+  size_t classes_num;
+  uint32_t *delta;      /* states_num * classes_num transitions */
+  uint32_t *dict;       /* next state with output on the suffix chain */
+  int *out;             /* first pattern whose literal ends here, or -1 */
+  int *out_next;        /* next pattern with the same literal, or -1 */
+  size_t states_num;
+};
+
+/* Skips a bracket expression starting at "re[0] == '['". Returns a pointer to
+ * the character after the closing bracket or NULL if there is none. */
+static char const *skip_bracket (char const *re) /* {{{ */
+{
+  char const *ptr = re + 1;
+
+  if (*ptr == '^')
+    ptr++;
+  /* A leading ']' is part of the list. */
+  if (*ptr == ']')
+    ptr++;
+
+  while (*ptr != 0)
+  {
+    if ((ptr[0] == '[')
+        && ((ptr[1] == ':') || (ptr[1] == '.') || (ptr[1] == '=')))
+    {
+      char delim = ptr[1];
+
+      ptr += 2;
+      while ((ptr[0] != 0) && !((ptr[0] == delim) && (ptr[1] == ']')))
+        ptr++;
+      if (ptr[0] == 0)
+        return (NULL);
+      ptr += 2;
+      continue;
+    }
+
+    if (*ptr == ']')
+      return (ptr + 1);
+    ptr++;
+  }
+
+  return (NULL);
+} /* }}} char const *skip_bracket */
+
+/* Skips a group starting at "re[0] == '('". Returns a pointer to the
+ * character after the closing parenthesis or NULL if there is none. */
+static char const *skip_group (char const *re) /* {{{ */
+{
+  char const *ptr = re + 1;
+  int depth = 1;
+
+  while (*ptr != 0)
+  {
+    if (*ptr == '\\')
+    {
+      if (ptr[1] == 0)
+        return (NULL);
+      ptr += 2;
+    }
+    else if (*ptr == '[')
+    {
+      ptr = skip_bracket (ptr);
+      if (ptr == NULL)
+        return (NULL);
+    }
+    else if (*ptr == '(')
+    {
+      depth++;
+      ptr++;
+    }
+    else if (*ptr == ')')
+    {
+      depth--;
+      ptr++;
+      if (depth == 0)
+        return (ptr);
+    }
+    else
+      ptr++;
+  }
+
+  return (NULL);
+} /* }}} char const *skip_group */
+
+/* Stores the longer one of "run" and "best" in "best". */
+static void literal_end_run (regex_set_literal_t *best, /* {{{ */
+    regex_set_literal_t *run)
+{
+  if (run->len > best->len)
+    *best = *run;
+  run->len = 0;
+  run->str[0] = 0;
+} /* }}} void literal_end_run */
+
+/* Extracts the longest (truncated) literal that every string matching the
+ * extended regular expression "re" must contain. Only a conservative subset
+ * of the syntax is analyzed: groups, bracket expressions and everything else
+ * that isn't a plain character end a literal, and top-level alternation
+ * yields no literal at all. "lit->len" is zero if no literal was found. */
+static void literal_extract (char const *re, /* {{{ */
+    regex_set_literal_t *lit)
+{
+  regex_set_literal_t run = { "", 0 };
+  char const *ptr;
+  /* Whether the previous atom is the last character of "run". */
+  _Bool prev_in_run = 0;
+
+  lit->len = 0;
+  lit->str[0] = 0;
+
+  /* Alternation outside of groups: no single literal is required. */
+  for (ptr = re; *ptr != 0; )
+  {
+    if (*ptr == '\\')
+      ptr += (ptr[1] != 0) ? 2 : 1;
+    else if (*ptr == '[')
+      ptr = skip_bracket (ptr);
+    else if (*ptr == '(')
+      ptr = skip_group (ptr);
+    else if (*ptr == '|')
+      return;
+    else
+      ptr++;
+
+    if (ptr == NULL)
+      return;
+  }
+
+  ptr = re;
+  while (*ptr != 0)
+  {
+    char c = *ptr;
+
+    if ((c == '*') || (c == '?') || (c == '{'))
+    {
+      /* The previous atom is optional or repeated an unknown number of
+       * times: it isn't required. */
+      if (prev_in_run && (run.len > 0))
+        run.str[--run.len] = 0;
+      literal_end_run (lit, &run);
+      prev_in_run = 0;
+
+      if (c == '{')
+      {
+        ptr = strchr (ptr, '}');
+        if (ptr == NULL)
+          break;
+      }
+      ptr++;
+      continue;
+    }
+    else if (c == '+')
+    {
+      /* The previous atom is required, but what follows it isn't adjacent
+       * to it. */
+      literal_end_run (lit, &run);
+      prev_in_run = 0;
+      ptr++;
+      continue;
+    }
+
+    if ((c == '\\') && (ptr[1] != 0)
+        && !isalnum ((unsigned char) ptr[1]))
+    {
+      /* Escaped special character. */
+      c = ptr[1];
+      ptr += 2;
+    }
+    else if ((c == '\\') || (c == '.') || (c == '^') || (c == '$')
+        || (c == '[') || (c == '(') || (c == ')'))
+    {
+      /* Anything but a plain character ends the literal. */
+      literal_end_run (lit, &run);
+      prev_in_run = 0;
+
+      if (c == '[')
+        ptr = skip_bracket (ptr);
+      else if (c == '(')
+        ptr = skip_group (ptr);
+      else if (c == '\\')
+        ptr += (ptr[1] != 0) ? 2 : 1;
+      else
+        ptr++;
+
+      if (ptr == NULL)
+        break;
+      continue;
+    }
+    else
+      ptr++;
+
+    if (run.len < REGEX_SET_LITERAL_MAX)
+    {
+      run.str[run.len++] = (char) tolower ((unsigned char) c);
+      run.str[run.len] = 0;
+      prev_in_run = 1;
+    }
+    else
+    {
+      /* The run is full. Keep it and start over, so that a quantifier
+       * following this character can't truncate it. */
+      literal_end_run (lit, &run);
+      run.str[run.len++] = (char) tolower ((unsigned char) c);
+      run.str[run.len] = 0;
+      prev_in_run = 1;
+    }
+  }
+
+  literal_end_run (lit, &run);
+} /* }}} void literal_extract */
+
+static void regex_set_free_automaton (regex_set_t *set) /* {{{ */
+{
+  sfree (set->delta);
+  sfree (set->dict);
+  sfree (set->out);
+  sfree (set->out_next);
+  set->states_num = 0;
+  set->classes_num = 0;
+  memset (set->classes, 0, sizeof (set->classes));
+} /* }}} void regex_set_free_automaton */
+
+regex_set_t *regex_set_create (void) /* {{{ */
+{
+  return (calloc (1, sizeof (regex_set_t)));
+} /* }}} regex_set_t *regex_set_create */
+
+void regex_set_destroy (regex_set_t *set) /* {{{ */
+{
+  if (set == NULL)
+    return;
+
+  regex_set_free_automaton (set);
+  sfree (set->literals);
+  sfree (set->always);
+  sfree (set);
+} /* }}} void regex_set_destroy */
+
+int regex_set_add (regex_set_t *set, char const *pattern, /* {{{ */
+    int cflags)
+{
+  regex_set_literal_t *tmp;
+
+  if ((set == NULL) || (pattern == NULL))
+    return (-EINVAL);
+
+  tmp = realloc (set->literals,
+      (set->patterns_num + 1) * sizeof (*set->literals));
+  if (tmp == NULL)
+    return (-ENOMEM);
+  set->literals = tmp;
+
+  /* Basic regular expressions use a different syntax; they are always
+   * checked with regexec(). */
+  if (cflags & REG_EXTENDED)
+    literal_extract (pattern, set->literals + set->patterns_num);
+  else
+    memset (set->literals + set->patterns_num, 0, sizeof (*set->literals));
+
+  set->patterns_num++;
+  return ((int) (set->patterns_num - 1));
+} /* }}} int regex_set_add */
+
+size_t regex_set_size (regex_set_t const *set) /* {{{ */
+{
+  return ((set != NULL) ? set->patterns_num : 0);
+} /* }}} size_t regex_set_size */
+
+int regex_set_compile (regex_set_t *set) /* {{{ */
+{
+  uint32_t *fail = NULL;
+  uint32_t *queue = NULL;
+  size_t queue_head;
+  size_t queue_tail;
+  size_t states_max;
+  size_t i;
+  size_t j;
+
+  if (set == NULL)
+    return (EINVAL);
+
+  regex_set_free_automaton (set);
+  sfree (set->always);
+  set->always_num = 0;
+
+  set->always = calloc (REGEX_SET_WORDS (set->patterns_num) + 1,
+      sizeof (*set->always));
+  if (set->always == NULL)
+    return (ENOMEM);
+
+  /* Map each byte occurring in a literal, in either case, to a class.
+   * Literals are folded to lower case, so there are at most 230 classes. */
+  set->classes_num = 1;
+  states_max = 1;
+  for (i = 0; i < set->patterns_num; i++)
+  {
+    regex_set_literal_t *lit = set->literals + i;
+
+    states_max += lit->len;
+    for (j = 0; j < lit->len; j++)
+    {
+      unsigned char c = (unsigned char) lit->str[j];
+
+      if (set->classes[c] != 0)
+        continue;
+
+      set->classes[c] = (unsigned char) set->classes_num;
+      set->classes[toupper (c)] = (unsigned char) set->classes_num;
+      set->classes_num++;
+    }
+  }
+
+  set->delta = calloc (states_max * set->classes_num, sizeof (*set->delta));
+  set->dict = calloc (states_max, sizeof (*set->dict));
+  set->out = malloc (states_max * sizeof (*set->out));
+  set->out_next = malloc ((set->patterns_num + 1) * sizeof (*set->out_next));
+  fail = calloc (states_max, sizeof (*fail));
+  queue = malloc (states_max * sizeof (*queue));
+  if ((set->delta == NULL) || (set->dict == NULL) || (set->out == NULL)
+      || (set->out_next == NULL) || (fail == NULL) || (queue == NULL))
+    goto fallback;
+
+  for (i = 0; i < states_max; i++)
+    set->out[i] = -1;
+
+  /* Build the trie. A zero transition means "no edge" here, since no edge
+   * leads back to the start state. */
+  set->states_num = 1;
+  for (i = 0; i < set->patterns_num; i++)
+  {
+    regex_set_literal_t *lit = set->literals + i;
+    uint32_t state = 0;
+
+    set->out_next[i] = -1;
+    if (lit->len == 0)
+    {
+      set->always[i / 64] |= ((uint64_t) 1) << (i % 64);
+      set->always_num++;
+      continue;
+    }
+
+    for (j = 0; j < lit->len; j++)
+    {
+      size_t c = set->classes[(unsigned char) lit->str[j]];
+      uint32_t *next = set->delta + (state * set->classes_num) + c;
+
+      if (*next == 0)
+        *next = (uint32_t) set->states_num++;
+      state = *next;
+    }
+
+    set->out_next[i] = set->out[state];
+    set->out[state] = (int) i;
+  }
+
+  /* Breadth-first traversal computing the failure links and completing the
+   * transition function. */
+  queue_head = 0;
+  queue_tail = 0;
+  for (j = 0; j < set->classes_num; j++)
+  {
+    uint32_t next = set->delta[j];
+
+    if (next != 0)
+    {
+      fail[next] = 0;
+      queue[queue_tail++] = next;
+    }
+  }
+
+  while (queue_head < queue_tail)
+  {
+    uint32_t state = queue[queue_head++];
+    uint32_t *row = set->delta + (state * set->classes_num);
+    uint32_t *fail_row = set->delta + (fail[state] * set->classes_num);
+
+    for (j = 0; j < set->classes_num; j++)
+    {
+      if (row[j] == 0)
+      {
+        row[j] = fail_row[j];
+        continue;
+      }
+
+      fail[row[j]] = fail_row[j];
+      set->dict[row[j]] = (set->out[fail_row[j]] >= 0)
+        ? fail_row[j] : set->dict[fail_row[j]];
+      queue[queue_tail++] = row[j];
+    }
+  }
+
+  sfree (fail);
+  sfree (queue);
+  return (0);
+
+fallback:
+  sfree (fail);
+  sfree (queue);
+  regex_set_free_automaton (set);
+
+  /* Everything is a candidate. */
+  set->always_num = 0;
+  for (i = 0; i < set->patterns_num; i++)
+  {
+    set->always[i / 64] |= ((uint64_t) 1) << (i % 64);
+    set->always_num++;
+  }
+
+  return (ENOMEM);
+} /* }}} int regex_set_compile */
+
+size_t regex_set_candidates (regex_set_t const *set, /* {{{ */
+    char const *str, uint64_t *candidates)
+{
+  unsigned char const *ptr;
+  size_t num;
+  uint32_t state = 0;
+
+  if (set == NULL)
+    return (0);
+
+  memcpy (candidates, set->always,
+      REGEX_SET_WORDS (set->patterns_num) * sizeof (*candidates));
+  num = set->always_num;
+
+  if ((set->delta == NULL) || (num == set->patterns_num))
+    return (num);
+
+  for (ptr = (unsigned char const *) str; *ptr != 0; ptr++)
+  {
+    uint32_t s;
+
+    state = set->delta[(state * set->classes_num) + set->classes[*ptr]];
+
+    s = (set->out[state] >= 0) ? state : set->dict[state];
+    while (s != 0)
+    {
+      int i;
+
+      for (i = set->out[s]; i >= 0; i = set->out_next[i])
+      {
+        uint64_t bit = ((uint64_t) 1) << (i % 64);
+
+        if ((candidates[i / 64] & bit) == 0)
+        {
+          candidates[i / 64] |= bit;
+          num++;
+        }
+      }
+
+      s = set->dict[s];
+    }
+
+    if (num == set->patterns_num)
+      break;
+  }
+
+  return (num);
+} /* }}} size_t regex_set_candidates */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
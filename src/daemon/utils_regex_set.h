@@ -0,0 +1,116 @@
+/**
+ * collectd - src/daemon/utils_regex_set.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_REGEX_SET_H
+#define UTILS_REGEX_SET_H 1
+
+#include "collectd.h"
+
+/*
+ * A regex set is a multi-pattern pre-filter for POSIX regular expressions.
+ *
+ * For each pattern, a literal string that every match must contain is
+ * extracted. All literals of a set are compiled into a single Aho-Corasick
+ * automaton, so one pass over a string determines which patterns can possibly
+ * match it. Only those "candidates" need to be checked with regexec(3).
+ * Patterns without a usable literal (for example ones using alternation at the
+ * top level) are always candidates, i.e. they fall back to plain regexec(3).
+ */
+struct regex_set_s;
+typedef struct regex_set_s regex_set_t;
+
+/* Tests bit "i" of a candidate bitmap filled by `regex_set_candidates'. */
+#define REGEX_SET_IS_CANDIDATE(bits, i) \
+	(((bits)[(i) / 64] & (((uint64_t) 1) << ((i) % 64))) != 0)
+
+/* Number of uint64_t words in the candidate bitmap of a set of "n"
+ * patterns. */
+#define REGEX_SET_WORDS(n) (((n) + 63) / 64)
+
+/*
+ * NAME
+ *   regex_set_create
+ *
+ * RETURN VALUE
+ *   An empty set or NULL if memory could not be allocated.
+ */
+regex_set_t *regex_set_create (void);
+
+void regex_set_destroy (regex_set_t *set);
+
+/*
+ * NAME
+ *   regex_set_add
+ *
+ * DESCRIPTION
+ *   Adds `pattern', a regular expression compiled with `cflags' (see
+ *   regcomp(3)), to the set. Patterns are numbered in the order they are
+ *   added, starting at zero. The set only takes a copy of the required
+ *   literal; the caller keeps compiling and executing the regular expression
+ *   itself. The set must be (re-)compiled with `regex_set_compile' before it
+ *   is used.
+ *
+ * RETURN VALUE
+ *   The index of the pattern or a negative value on failure.
+ */
+int regex_set_add (regex_set_t *set, char const *pattern, int cflags);
+
+/*
+ * NAME
+ *   regex_set_compile
+ *
+ * DESCRIPTION
+ *   Builds the automaton for all patterns added so far.
+ *
+ * RETURN VALUE
+ *   Zero on success, ENOMEM if memory could not be allocated. On failure, all
+ *   patterns are reported as candidates.
+ */
+int regex_set_compile (regex_set_t *set);
+
+/*
+ * NAME
+ *   regex_set_size
+ *
+ * RETURN VALUE
+ *   The number of patterns in the set.
+ */
+size_t regex_set_size (regex_set_t const *set);
+
+/*
+ * NAME
+ *   regex_set_candidates
+ *
+ * DESCRIPTION
+ *   Scans `str' once and sets bit `i' of `candidates', which must have
+ *   `REGEX_SET_WORDS (regex_set_size (set))' elements, for each pattern `i'
+ *   that may match `str'. Patterns whose bit is not set do not match. This
+ *   function is thread-safe as long as the set isn't modified concurrently.
+ *
+ * RETURN VALUE
+ *   The number of candidates.
+ */
+size_t regex_set_candidates (regex_set_t const *set, char const *str,
+		uint64_t *candidates);
+
+#endif /* UTILS_REGEX_SET_H */
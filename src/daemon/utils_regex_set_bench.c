@@ -0,0 +1,147 @@
+/**
+ * collectd - src/daemon/utils_regex_set_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+
+/*
+ * Compares matching log lines against many regular expressions one after
+ * another with matching them through a regex set first.
+ *
+ * Usage: bench_utils_regex_set [patterns [lines]]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_regex_set.h"
+
+#include <regex.h>
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t patterns_num = 300;
+  size_t lines_num = 100000;
+  regex_t *re;
+  char **lines;
+  regex_set_t *set;
+  uint64_t *bits;
+  size_t matches_plain = 0;
+  size_t matches_set = 0;
+  double start;
+  double plain;
+  double with_set;
+  size_t i;
+  size_t j;
+
+  if (argc > 1)
+    patterns_num = (size_t) atoi (argv[1]);
+  if (argc > 2)
+    lines_num = (size_t) atoi (argv[2]);
+  if ((patterns_num < 1) || (lines_num < 1))
+  {
+    fprintf (stderr, "Usage: %s [patterns [lines]]\n", argv[0]);
+    return (1);
+  }
+
+  re = calloc (patterns_num, sizeof (*re));
+  lines = calloc (lines_num, sizeof (*lines));
+  bits = calloc (REGEX_SET_WORDS (patterns_num), sizeof (*bits));
+  set = regex_set_create ();
+  if ((re == NULL) || (lines == NULL) || (bits == NULL) || (set == NULL))
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+
+  for (i = 0; i < patterns_num; i++)
+  {
+    char pattern[128];
+
+    ssnprintf (pattern, sizeof (pattern),
+        "module%zu: request (failed|timed out) after [0-9]+ ms", i);
+    if (regcomp (&re[i], pattern, REG_EXTENDED) != 0)
+    {
+      fprintf (stderr, "regcomp (%s) failed.\n", pattern);
+      return (1);
+    }
+    regex_set_add (set, pattern, REG_EXTENDED);
+  }
+  regex_set_compile (set);
+
+  /* One in 100 lines matches one of the patterns. */
+  for (i = 0; i < lines_num; i++)
+  {
+    char line[256];
+
+    if ((i % 100) == 0)
+      ssnprintf (line, sizeof (line), "2016-01-01 12:00:00 module%zu: "
+          "request failed after %zu ms", i % patterns_num, i % 1000);
+    else
+      ssnprintf (line, sizeof (line), "2016-01-01 12:00:00 module%zu: "
+          "request %zu served in %zu ms", i % patterns_num, i, i % 1000);
+    lines[i] = strdup (line);
+  }
+
+  start = now ();
+  for (i = 0; i < lines_num; i++)
+    for (j = 0; j < patterns_num; j++)
+      if (regexec (&re[j], lines[i], 0, NULL, 0) == 0)
+        matches_plain++;
+  plain = now () - start;
+
+  start = now ();
+  for (i = 0; i < lines_num; i++)
+  {
+    if (regex_set_candidates (set, lines[i], bits) == 0)
+      continue;
+
+    for (j = 0; j < patterns_num; j++)
+      if (REGEX_SET_IS_CANDIDATE (bits, j)
+          && (regexec (&re[j], lines[i], 0, NULL, 0) == 0))
+        matches_set++;
+  }
+  with_set = now () - start;
+
+  printf ("%zu patterns, %zu lines\n", patterns_num, lines_num);
+  printf ("regexec only:       %8.3f s, %zu matches\n", plain, matches_plain);
+  printf ("regex set prefilter: %7.3f s, %zu matches\n", with_set, matches_set);
+
+  for (i = 0; i < patterns_num; i++)
+    regfree (&re[i]);
+  for (i = 0; i < lines_num; i++)
+    sfree (lines[i]);
+  sfree (lines);
+  sfree (re);
+  sfree (bits);
+  regex_set_destroy (set);
+
+  return ((matches_plain == matches_set) ? 0 : 1);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,151 @@
+/**
+ * collectd - src/daemon/utils_regex_set_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+#include "testing.h"
+#include "utils_regex_set.h"
+
+#include <regex.h>
+
+static char const *patterns[] = {
+  "^cpu$",                       /* 0: literal "cpu" */
+  "if_(octets|packets)",         /* 1: literal "if_" */
+  "disk-sd[a-z]+",               /* 2: literal "disk-sd" */
+  "colou?r",                     /* 3: "colo", "r" */
+  "a|b",                         /* 4: alternation, no literal */
+  "^[0-9]+$",                    /* 5: no literal */
+  "foo\\.bar",                   /* 6: escaped dot */
+  "x+yz",                        /* 7: "x", then "yz" */
+  "ERROR{1,2}",                  /* 8: optional repeat */
+  "memory-(used|free)\\.total",  /* 9: "memory-", ".total" */
+};
+
+static char const *strings[] = {
+  "cpu",
+  "CPU",
+  "if_octets",
+  "eth0-if_packets",
+  "disk-sda",
+  "color",
+  "colour",
+  "b",
+  "12345",
+  "foo.bar",
+  "fooxbar",
+  "xxxyz",
+  "ERRORR",
+  "memory-used.total",
+  "nothing to see here",
+  "",
+};
+
+DEF_TEST(equivalence)
+{
+  regex_t re[STATIC_ARRAY_SIZE (patterns)];
+  uint64_t bits[REGEX_SET_WORDS (STATIC_ARRAY_SIZE (patterns))];
+  regex_set_t *set;
+  size_t i;
+  size_t j;
+
+  CHECK_NOT_NULL (set = regex_set_create ());
+  for (i = 0; i < STATIC_ARRAY_SIZE (patterns); i++)
+  {
+    CHECK_ZERO (regcomp (&re[i], patterns[i], REG_EXTENDED | REG_NOSUB));
+    EXPECT_EQ_INT ((int) i, regex_set_add (set, patterns[i], REG_EXTENDED));
+  }
+  CHECK_ZERO (regex_set_compile (set));
+  EXPECT_EQ_INT ((int) STATIC_ARRAY_SIZE (patterns), (int) regex_set_size (set));
+
+  /* Every pattern that matches must be a candidate. */
+  for (i = 0; i < STATIC_ARRAY_SIZE (strings); i++)
+  {
+    size_t num = regex_set_candidates (set, strings[i], bits);
+    size_t count = 0;
+
+    for (j = 0; j < STATIC_ARRAY_SIZE (patterns); j++)
+    {
+      if (REGEX_SET_IS_CANDIDATE (bits, j))
+        count++;
+      if (regexec (&re[j], strings[i], 0, NULL, 0) == 0)
+        OK1 (REGEX_SET_IS_CANDIDATE (bits, j), patterns[j]);
+    }
+    EXPECT_EQ_INT ((int) count, (int) num);
+  }
+
+  /* Patterns without a literal are always candidates, the others only if
+   * their literal occurs. */
+  regex_set_candidates (set, "nothing to see here", bits);
+  OK (REGEX_SET_IS_CANDIDATE (bits, 4));
+  OK (REGEX_SET_IS_CANDIDATE (bits, 5));
+  for (j = 0; j < STATIC_ARRAY_SIZE (patterns); j++)
+    if ((j != 4) && (j != 5))
+      OK1 (!REGEX_SET_IS_CANDIDATE (bits, j), patterns[j]);
+
+  regex_set_candidates (set, "fooxbar", bits);
+  OK (!REGEX_SET_IS_CANDIDATE (bits, 6));
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (patterns); i++)
+    regfree (&re[i]);
+  regex_set_destroy (set);
+  return (0);
+}
+
+DEF_TEST(many_patterns)
+{
+  regex_set_t *set;
+  uint64_t bits[REGEX_SET_WORDS (300)];
+  char pattern[64];
+  size_t i;
+
+  CHECK_NOT_NULL (set = regex_set_create ());
+  for (i = 0; i < 300; i++)
+  {
+    ssnprintf (pattern, sizeof (pattern), "module%zu: error [0-9]+", i);
+    EXPECT_EQ_INT ((int) i, regex_set_add (set, pattern, REG_EXTENDED));
+  }
+  CHECK_ZERO (regex_set_compile (set));
+
+  /* The literals include the colon, so "module1" isn't a candidate. */
+  EXPECT_EQ_INT (1, (int) regex_set_candidates (set,
+        "module17: error 42", bits));
+  OK (REGEX_SET_IS_CANDIDATE (bits, 17));
+  OK (!REGEX_SET_IS_CANDIDATE (bits, 1));
+  OK (!REGEX_SET_IS_CANDIDATE (bits, 170));
+
+  EXPECT_EQ_INT (0, (int) regex_set_candidates (set, "all good", bits));
+
+  regex_set_destroy (set);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(equivalence);
+  RUN_TEST(many_patterns);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,438 @@
+/**
+ * collectd - src/daemon/utils_rollup.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_intern.h"
+#include "utils_rollup.h"
+
+#include <pthread.h>
+
+/* Identifiers are spread over independently locked shards, so that write
+ * threads rarely wait for each other. */
+#define ROLLUP_SHARDS 16
+#define ROLLUP_TABLE_INITIAL_SIZE 64
+
+/* State of one data source within the current bucket. */
+struct rollup_value_s
+{
+  gauge_t min;
+  gauge_t max;
+  gauge_t sum;
+  size_t count; /* number of gauges other than NAN */
+  value_t last;
+  absolute_t absolute_sum;
+};
+typedef struct rollup_value_s rollup_value_t;
+
+struct rollup_entry_s;
+typedef struct rollup_entry_s rollup_entry_t;
+struct rollup_entry_s
+{
+  identifier_t id;
+  rollup_entry_t *next;
+  data_set_t const *ds;
+  uint64_t bucket;
+  cdtime_t time;     /* of the last value */
+  cdtime_t interval; /* of the last value */
+  size_t count;      /* number of value lists in the current bucket */
+  size_t values_num;
+  rollup_value_t values[];
+};
+
+/* A value list completed while a shard was locked, emitted after unlocking
+ * it. */
+struct rollup_output_s;
+typedef struct rollup_output_s rollup_output_t;
+struct rollup_output_s
+{
+  data_set_t const *ds;
+  value_list_t vl;
+  rollup_output_t *next;
+  value_t values[];
+};
+
+struct rollup_shard_s
+{
+  pthread_mutex_t lock;
+  rollup_entry_t **table;
+  size_t table_size; /* a power of two */
+  size_t entries_num;
+  cdtime_t last_scan;
+};
+typedef struct rollup_shard_s rollup_shard_t;
+
+struct rollup_s
+{
+  cdtime_t resolution;
+  int function;
+  rollup_shard_t shards[ROLLUP_SHARDS];
+};
+
+static size_t rollup_index (rollup_shard_t const *s, uint32_t hash) /* {{{ */
+{
+  /* The lower bits select the shard. */
+  return ((hash / ROLLUP_SHARDS) & (s->table_size - 1));
+} /* }}} size_t rollup_index */
+
+static void rollup_entry_reset (rollup_entry_t *e) /* {{{ */
+{
+  size_t i;
+
+  e->count = 0;
+  for (i = 0; i < e->values_num; i++)
+  {
+    e->values[i].min = NAN;
+    e->values[i].max = NAN;
+    e->values[i].sum = 0.0;
+    e->values[i].count = 0;
+    e->values[i].absolute_sum = 0;
+  }
+} /* }}} void rollup_entry_reset */
+
+static void rollup_entry_free (rollup_entry_t *e) /* {{{ */
+{
+  identifier_destroy (&e->id);
+  sfree (e);
+} /* }}} void rollup_entry_free */
+
+static int rollup_shard_grow (rollup_shard_t *s) /* {{{ */
+{
+  rollup_entry_t **table;
+  size_t table_size = 2 * s->table_size;
+  size_t i;
+
+  table = calloc (table_size, sizeof (*table));
+  if (table == NULL)
+    return (ENOMEM);
+
+  for (i = 0; i < s->table_size; i++)
+  {
+    rollup_entry_t *e = s->table[i];
+
+    while (e != NULL)
+    {
+      rollup_entry_t *next = e->next;
+      size_t index = (e->id.hash / ROLLUP_SHARDS) & (table_size - 1);
+
+      e->next = table[index];
+      table[index] = e;
+      e = next;
+    }
+  }
+
+  sfree (s->table);
+  s->table = table;
+  s->table_size = table_size;
+  return (0);
+} /* }}} int rollup_shard_grow */
+
+static rollup_entry_t *rollup_shard_get (rollup_shard_t *s, /* {{{ */
+    data_set_t const *ds, value_list_t const *vl, uint32_t hash)
+{
+  rollup_entry_t *e;
+  size_t index = rollup_index (s, hash);
+
+  for (e = s->table[index]; e != NULL; e = e->next)
+    if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+      return (e);
+
+  if ((s->entries_num >= s->table_size) && (rollup_shard_grow (s) == 0))
+    index = rollup_index (s, hash);
+
+  e = calloc (1, sizeof (*e) + vl->values_len * sizeof (e->values[0]));
+  if (e == NULL)
+    return (NULL);
+  if (identifier_create (&e->id, vl) != 0)
+  {
+    sfree (e);
+    return (NULL);
+  }
+  e->ds = ds;
+  e->values_num = vl->values_len;
+  rollup_entry_reset (e);
+
+  e->next = s->table[index];
+  s->table[index] = e;
+  s->entries_num++;
+  return (e);
+} /* }}} rollup_entry_t *rollup_shard_get */
+
+/* Ends the current bucket of "e" and prepends its value list to "out". */
+static int rollup_entry_emit (rollup_t const *r, rollup_entry_t *e, /* {{{ */
+    rollup_output_t **out)
+{
+  rollup_output_t *o;
+  size_t i;
+
+  if (e->count == 0)
+    return (0);
+
+  o = calloc (1, sizeof (*o) + e->values_num * sizeof (o->values[0]));
+  if (o == NULL)
+  {
+    rollup_entry_reset (e);
+    return (ENOMEM);
+  }
+
+  o->ds = e->ds;
+  identifier_to_vl (&e->id, &o->vl);
+  o->vl.values = o->values;
+  o->vl.values_len = e->values_num;
+  o->vl.time = e->time;
+  o->vl.interval = r->resolution;
+  o->vl.meta = NULL;
+
+  for (i = 0; i < e->values_num; i++)
+  {
+    rollup_value_t const *v = e->values + i;
+
+    switch (e->ds->ds[i].type)
+    {
+      case DS_TYPE_GAUGE:
+        if (r->function == ROLLUP_LAST)
+          o->values[i].gauge = v->last.gauge;
+        else if (v->count == 0)
+          o->values[i].gauge = NAN;
+        else if (r->function == ROLLUP_MINIMUM)
+          o->values[i].gauge = v->min;
+        else if (r->function == ROLLUP_MAXIMUM)
+          o->values[i].gauge = v->max;
+        else
+          o->values[i].gauge = v->sum / ((gauge_t) v->count);
+        break;
+      case DS_TYPE_ABSOLUTE:
+        o->values[i].absolute = v->absolute_sum;
+        break;
+      default: /* DS_TYPE_COUNTER, DS_TYPE_DERIVE */
+        o->values[i] = v->last;
+    }
+  }
+
+  o->next = *out;
+  *out = o;
+  rollup_entry_reset (e);
+  return (0);
+} /* }}} int rollup_entry_emit */
+
+static void rollup_entry_add (rollup_entry_t *e, /* {{{ */
+    value_list_t const *vl)
+{
+  size_t i;
+
+  for (i = 0; i < e->values_num; i++)
+  {
+    rollup_value_t *v = e->values + i;
+    value_t value = vl->values[i];
+
+    v->last = value;
+    if (e->ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      v->absolute_sum += value.absolute;
+    else if ((e->ds->ds[i].type == DS_TYPE_GAUGE) && !isnan (value.gauge))
+    {
+      if ((v->count == 0) || (value.gauge < v->min))
+        v->min = value.gauge;
+      if ((v->count == 0) || (value.gauge > v->max))
+        v->max = value.gauge;
+      v->sum += value.gauge;
+      v->count++;
+    }
+  }
+
+  if ((e->count == 0) || (vl->time > e->time))
+    e->time = vl->time;
+  e->interval = vl->interval;
+  e->count++;
+} /* }}} void rollup_entry_add */
+
+/* Emits the buckets of identifiers which didn't receive their last value and
+ * drops identifiers which haven't been seen for two resolutions. */
+static void rollup_shard_scan (rollup_t const *r, rollup_shard_t *s, /* {{{ */
+    cdtime_t now, rollup_output_t **out)
+{
+  size_t i;
+
+  for (i = 0; i < s->table_size; i++)
+  {
+    rollup_entry_t **prev = s->table + i;
+
+    while (*prev != NULL)
+    {
+      rollup_entry_t *e = *prev;
+      cdtime_t end = (cdtime_t) ((e->bucket + 1) * r->resolution);
+
+      if ((e->count > 0) && (now > end + e->interval))
+        (void) rollup_entry_emit (r, e, out);
+
+      if ((e->count == 0) && (now > e->time + 2 * r->resolution))
+      {
+        *prev = e->next;
+        s->entries_num--;
+        rollup_entry_free (e);
+        continue;
+      }
+
+      prev = &e->next;
+    }
+  }
+
+  s->last_scan = now;
+} /* }}} void rollup_shard_scan */
+
+rollup_t *rollup_create (cdtime_t resolution, int function) /* {{{ */
+{
+  rollup_t *r;
+  size_t i;
+
+  if (resolution == 0)
+    return (NULL);
+
+  r = calloc (1, sizeof (*r));
+  if (r == NULL)
+    return (NULL);
+  r->resolution = resolution;
+  r->function = function;
+
+  for (i = 0; i < ROLLUP_SHARDS; i++)
+  {
+    rollup_shard_t *s = r->shards + i;
+
+    s->table_size = ROLLUP_TABLE_INITIAL_SIZE;
+    s->table = calloc (s->table_size, sizeof (*s->table));
+    if (s->table == NULL)
+    {
+      rollup_destroy (r);
+      return (NULL);
+    }
+    pthread_mutex_init (&s->lock, /* attr = */ NULL);
+  }
+
+  return (r);
+} /* }}} rollup_t *rollup_create */
+
+void rollup_destroy (rollup_t *r) /* {{{ */
+{
+  size_t i;
+  size_t j;
+
+  if (r == NULL)
+    return;
+
+  for (i = 0; i < ROLLUP_SHARDS; i++)
+  {
+    rollup_shard_t *s = r->shards + i;
+
+    if (s->table == NULL)
+      continue;
+
+    for (j = 0; j < s->table_size; j++)
+    {
+      while (s->table[j] != NULL)
+      {
+        rollup_entry_t *e = s->table[j];
+        s->table[j] = e->next;
+        rollup_entry_free (e);
+      }
+    }
+    sfree (s->table);
+    pthread_mutex_destroy (&s->lock);
+  }
+
+  sfree (r);
+} /* }}} void rollup_destroy */
+
+int rollup_add (rollup_t *r, data_set_t const *ds, /* {{{ */
+    value_list_t const *vl, rollup_emit_cb emit, void *arg)
+{
+  rollup_shard_t *s;
+  rollup_entry_t *e;
+  rollup_output_t *out = NULL;
+  uint32_t hash;
+  uint64_t bucket;
+  cdtime_t now;
+  int status = 0;
+
+  if ((r == NULL) || (vl->interval == 0) || (vl->interval >= r->resolution)
+      || (ds == NULL) || (vl->values_len != ds->ds_num))
+    return ((*emit) (ds, vl, arg));
+
+  hash = identifier_hash_vl (vl);
+  s = r->shards + (hash % ROLLUP_SHARDS);
+  bucket = (uint64_t) (vl->time / r->resolution);
+  now = cdtime ();
+
+  pthread_mutex_lock (&s->lock);
+
+  e = rollup_shard_get (s, ds, vl, hash);
+  if ((e == NULL) || (e->ds != ds))
+  {
+    pthread_mutex_unlock (&s->lock);
+    return ((e == NULL) ? ENOMEM : (*emit) (ds, vl, arg));
+  }
+
+  /* Late values are added to the current bucket. */
+  if ((e->count > 0) && (bucket > e->bucket))
+    status = rollup_entry_emit (r, e, &out);
+  if (e->count == 0)
+    e->bucket = bucket;
+
+  rollup_entry_add (e, vl);
+
+  /* The next value belongs to the next bucket. */
+  if (vl->time + vl->interval >= (cdtime_t) ((e->bucket + 1) * r->resolution))
+    status = rollup_entry_emit (r, e, &out);
+
+  if (now - s->last_scan >= r->resolution)
+    rollup_shard_scan (r, s, now, &out);
+
+  pthread_mutex_unlock (&s->lock);
+
+  while (out != NULL)
+  {
+    rollup_output_t *next = out->next;
+    int tmp = (*emit) (out->ds, &out->vl, arg);
+
+    if (tmp != 0)
+      status = tmp;
+    sfree (out);
+    out = next;
+  }
+
+  return (status);
+} /* }}} int rollup_add */
+
+size_t rollup_size (rollup_t *r) /* {{{ */
+{
+  size_t num = 0;
+  size_t i;
+
+  for (i = 0; i < ROLLUP_SHARDS; i++)
+  {
+    pthread_mutex_lock (&r->shards[i].lock);
+    num += r->shards[i].entries_num;
+    pthread_mutex_unlock (&r->shards[i].lock);
+  }
+
+  return (num);
+} /* }}} size_t rollup_size */
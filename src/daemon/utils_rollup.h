@@ -0,0 +1,78 @@
+/**
+ * collectd - src/daemon/utils_rollup.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_ROLLUP_H
+#define UTILS_ROLLUP_H 1
+
+#include "plugin.h"
+
+/*
+ * A rollup reduces value lists to a coarser resolution. For each identifier
+ * it keeps the minimum, maximum, sum, count and last value of the current
+ * bucket, i.e. the current "resolution" long stretch of time, and emits one
+ * value list when the bucket is complete.
+ *
+ * Gauges are reduced with the configured function. Counters and derives are
+ * cumulative, so their last value is emitted; absolute values are summed.
+ * The emitted value list has the time of the last value in the bucket and
+ * "resolution" as its interval. Meta data is not carried over.
+ *
+ * A bucket is complete when the interval of a value reaches the bucket's
+ * end, when a value for a later bucket arrives, or when no value has arrived
+ * for an interval after the bucket's end. Value lists whose interval is at
+ * least the resolution are passed through.
+ */
+#define ROLLUP_AVERAGE 0
+#define ROLLUP_MINIMUM 1
+#define ROLLUP_MAXIMUM 2
+#define ROLLUP_LAST    3
+
+struct rollup_s;
+typedef struct rollup_s rollup_t;
+
+typedef int (*rollup_emit_cb) (data_set_t const *ds, value_list_t const *vl,
+    void *arg);
+
+rollup_t *rollup_create (cdtime_t resolution, int function);
+void rollup_destroy (rollup_t *r);
+
+/*
+ * NAME
+ *   rollup_add
+ *
+ * DESCRIPTION
+ *   Adds `vl' to its bucket and calls `emit' for every value list completed
+ *   by this call, including lists of other identifiers which have stopped
+ *   receiving values. `emit' is called without any of the rollup's locks
+ *   held, so it may block.
+ *
+ * RETURN VALUE
+ *   Zero on success, the status of the last failed `emit' call or ENOMEM.
+ */
+int rollup_add (rollup_t *r, data_set_t const *ds, value_list_t const *vl,
+    rollup_emit_cb emit, void *arg);
+
+/* Returns the number of identifiers currently kept. */
+size_t rollup_size (rollup_t *r);
+
+#endif /* UTILS_ROLLUP_H */
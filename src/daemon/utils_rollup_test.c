@@ -0,0 +1,139 @@
+/**
+ * collectd - src/daemon/utils_rollup_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "testing.h"
+#include "utils_rollup.h"
+
+#define RESOLUTION TIME_T_TO_CDTIME_T (60)
+
+static data_source_t test_sources[] = {
+  { "gauge", DS_TYPE_GAUGE, NAN, NAN },
+  { "derive", DS_TYPE_DERIVE, 0.0, NAN },
+  { "absolute", DS_TYPE_ABSOLUTE, 0.0, NAN }
+};
+static data_set_t test_ds = { "test", 3, test_sources };
+
+static value_list_t emitted[4];
+static value_t emitted_values[4][3];
+static size_t emitted_num;
+
+static int test_emit (data_set_t const *ds, value_list_t const *vl,
+    void *arg)
+{
+  OK (ds == &test_ds);
+  OK (arg == (void *) &emitted_num);
+  if (emitted_num >= STATIC_ARRAY_SIZE (emitted))
+    return (-1);
+
+  emitted[emitted_num] = *vl;
+  memcpy (emitted_values[emitted_num], vl->values,
+      vl->values_len * sizeof (*vl->values));
+  emitted[emitted_num].values = emitted_values[emitted_num];
+  emitted_num++;
+  return (0);
+}
+
+static void test_vl (value_list_t *vl, value_t *values, cdtime_t time,
+    size_t step)
+{
+  memset (vl, 0, sizeof (*vl));
+  sstrncpy (vl->host, "example.com", sizeof (vl->host));
+  sstrncpy (vl->plugin, "test", sizeof (vl->plugin));
+  sstrncpy (vl->type, "test", sizeof (vl->type));
+  vl->time = time;
+  vl->interval = TIME_T_TO_CDTIME_T (1);
+  vl->values = values;
+  vl->values_len = 3;
+
+  values[0].gauge = (step == 10) ? NAN : (gauge_t) step;
+  values[1].derive = (derive_t) (100 * step);
+  values[2].absolute = 2;
+}
+
+DEF_TEST(rollup)
+{
+  /* Start at the beginning of a bucket, so that it isn't considered stale. */
+  cdtime_t start = RESOLUTION * (cdtime () / RESOLUTION);
+  int functions[] = { ROLLUP_AVERAGE, ROLLUP_MINIMUM, ROLLUP_MAXIMUM,
+    ROLLUP_LAST };
+  gauge_t want[] = { 30.0 - 10.0 / 59.0, 0.0, 59.0, 59.0 };
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (functions); i++)
+  {
+    rollup_t *r;
+    value_list_t vl;
+    value_t values[3];
+
+    CHECK_NOT_NULL (r = rollup_create (RESOLUTION, functions[i]));
+    emitted_num = 0;
+
+    for (j = 0; j < 60; j++)
+    {
+      test_vl (&vl, values, start + TIME_T_TO_CDTIME_T (j), j);
+      CHECK_ZERO (rollup_add (r, &test_ds, &vl, test_emit, &emitted_num));
+      EXPECT_EQ_INT ((j == 59) ? 1 : 0, (int) emitted_num);
+    }
+    EXPECT_EQ_INT (1, (int) rollup_size (r));
+
+    EXPECT_EQ_STR ("example.com", emitted[0].host);
+    EXPECT_EQ_STR ("test", emitted[0].type);
+    EXPECT_EQ_UINT64 (start + TIME_T_TO_CDTIME_T (59), emitted[0].time);
+    EXPECT_EQ_UINT64 (RESOLUTION, emitted[0].interval);
+    EXPECT_EQ_DOUBLE (want[i], emitted[0].values[0].gauge);
+    EXPECT_EQ_INT (5900, (int) emitted[0].values[1].derive);
+    EXPECT_EQ_INT (120, (int) emitted[0].values[2].absolute);
+
+    /* A value for a later bucket ends the current one. */
+    test_vl (&vl, values, start + TIME_T_TO_CDTIME_T (60), 1);
+    CHECK_ZERO (rollup_add (r, &test_ds, &vl, test_emit, &emitted_num));
+    EXPECT_EQ_INT (1, (int) emitted_num);
+    test_vl (&vl, values, start + TIME_T_TO_CDTIME_T (125), 2);
+    CHECK_ZERO (rollup_add (r, &test_ds, &vl, test_emit, &emitted_num));
+    EXPECT_EQ_INT (2, (int) emitted_num);
+    EXPECT_EQ_UINT64 (start + TIME_T_TO_CDTIME_T (60), emitted[1].time);
+    EXPECT_EQ_INT (100, (int) emitted[1].values[1].derive);
+
+    /* Values with a coarser interval are passed through. */
+    vl.interval = RESOLUTION;
+    CHECK_ZERO (rollup_add (r, &test_ds, &vl, test_emit, &emitted_num));
+    EXPECT_EQ_INT (3, (int) emitted_num);
+    EXPECT_EQ_DOUBLE (2.0, emitted[2].values[0].gauge);
+
+    rollup_destroy (r);
+  }
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(rollup);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,395 @@
+/**
+ * collectd - src/daemon/utils_series_limit.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_intern.h"
+#include "utils_series_limit.h"
+
+#include <pthread.h>
+
+/* Plugins are spread over independently locked shards, so that plugins
+ * dispatching from different threads rarely wait for each other. */
+#define SL_SHARDS 16
+#define SL_SET_INITIAL_SIZE 64
+
+/* Open addressing set of identifier hashes. Zero marks an empty slot, so a
+ * hash of zero is stored as one. */
+struct sl_set_s
+{
+  uint32_t *hashes;
+  size_t size; /* a power of two */
+  size_t num;
+};
+typedef struct sl_set_s sl_set_t;
+
+struct sl_plugin_s
+{
+  char *name;
+  sl_set_t current;
+  sl_set_t previous;
+  /* Number of series in "previous" which have been seen again and were
+   * added to "current". They are only counted once. */
+  size_t moved_num;
+  cdtime_t window;
+  cdtime_t window_start;
+  _Bool complained;
+  /* Set by series_limit_freeze(): no new series are accepted. */
+  _Bool frozen;
+  derive_t series_new;
+  derive_t dropped;
+};
+typedef struct sl_plugin_s sl_plugin_t;
+
+struct sl_shard_s
+{
+  pthread_mutex_t lock;
+  c_avl_tree_t *plugins;
+};
+typedef struct sl_shard_s sl_shard_t;
+
+struct series_limit_s
+{
+  size_t limit;
+  sl_shard_t shards[SL_SHARDS];
+};
+
+struct sl_stats_s
+{
+  char name[DATA_MAX_NAME_LEN];
+  size_t series_num;
+  derive_t series_new;
+  derive_t dropped;
+};
+typedef struct sl_stats_s sl_stats_t;
+
+static _Bool sl_set_contains (sl_set_t const *set, uint32_t hash) /* {{{ */
+{
+  size_t i;
+
+  if (set->size == 0)
+    return (0);
+
+  for (i = hash & (set->size - 1); set->hashes[i] != 0;
+      i = (i + 1) & (set->size - 1))
+    if (set->hashes[i] == hash)
+      return (1);
+
+  return (0);
+} /* }}} _Bool sl_set_contains */
+
+static void sl_set_put (uint32_t *hashes, size_t size, /* {{{ */
+    uint32_t hash)
+{
+  size_t i;
+
+  for (i = hash & (size - 1); hashes[i] != 0; i = (i + 1) & (size - 1))
+    /* nop */;
+  hashes[i] = hash;
+} /* }}} void sl_set_put */
+
+/* Adds "hash", which must not be in "set" yet. */
+static int sl_set_insert (sl_set_t *set, uint32_t hash) /* {{{ */
+{
+  /* Keep the table at most half full, so that probe sequences stay short. */
+  if (2 * (set->num + 1) > set->size)
+  {
+    size_t size = (set->size == 0) ? SL_SET_INITIAL_SIZE : 2 * set->size;
+    uint32_t *hashes;
+    size_t i;
+
+    hashes = calloc (size, sizeof (*hashes));
+    if (hashes == NULL)
+      return (ENOMEM);
+
+    for (i = 0; i < set->size; i++)
+      if (set->hashes[i] != 0)
+        sl_set_put (hashes, size, set->hashes[i]);
+
+    sfree (set->hashes);
+    set->hashes = hashes;
+    set->size = size;
+  }
+
+  sl_set_put (set->hashes, set->size, hash);
+  set->num++;
+  return (0);
+} /* }}} int sl_set_insert */
+
+static void sl_set_clear (sl_set_t *set) /* {{{ */
+{
+  sfree (set->hashes);
+  set->size = 0;
+  set->num = 0;
+} /* }}} void sl_set_clear */
+
+static size_t sl_plugin_series_num (sl_plugin_t const *p) /* {{{ */
+{
+  return (p->current.num + p->previous.num - p->moved_num);
+} /* }}} size_t sl_plugin_series_num */
+
+static void sl_plugin_free (sl_plugin_t *p) /* {{{ */
+{
+  if (p == NULL)
+    return;
+
+  sl_set_clear (&p->current);
+  sl_set_clear (&p->previous);
+  sfree (p->name);
+  sfree (p);
+} /* }}} void sl_plugin_free */
+
+static sl_plugin_t *sl_plugin_get (sl_shard_t *s, /* {{{ */
+    char const *name, cdtime_t now)
+{
+  sl_plugin_t *p = NULL;
+
+  if (c_avl_get (s->plugins, name, (void *) &p) == 0)
+    return (p);
+
+  p = calloc (1, sizeof (*p));
+  if (p == NULL)
+    return (NULL);
+  p->name = strdup (name);
+  p->window_start = now;
+  if ((p->name == NULL) || (c_avl_insert (s->plugins, p->name, p) != 0))
+  {
+    sl_plugin_free (p);
+    return (NULL);
+  }
+
+  return (p);
+} /* }}} sl_plugin_t *sl_plugin_get */
+
+/* Starts a new generation: the series seen during the current window are
+ * kept, all others are forgotten. */
+static void sl_plugin_rotate (sl_plugin_t *p, cdtime_t now) /* {{{ */
+{
+  sl_set_clear (&p->previous);
+  p->previous = p->current;
+  memset (&p->current, 0, sizeof (p->current));
+  p->moved_num = 0;
+  p->window_start = now;
+  p->complained = 0;
+} /* }}} void sl_plugin_rotate */
+
+series_limit_t *series_limit_create (size_t limit) /* {{{ */
+{
+  series_limit_t *sl;
+  size_t i;
+
+  sl = calloc (1, sizeof (*sl));
+  if (sl == NULL)
+    return (NULL);
+  sl->limit = limit;
+
+  for (i = 0; i < SL_SHARDS; i++)
+  {
+    sl->shards[i].plugins = c_avl_create ((void *) strcmp);
+    if (sl->shards[i].plugins == NULL)
+    {
+      series_limit_destroy (sl);
+      return (NULL);
+    }
+    pthread_mutex_init (&sl->shards[i].lock, /* attr = */ NULL);
+  }
+
+  return (sl);
+} /* }}} series_limit_t *series_limit_create */
+
+void series_limit_destroy (series_limit_t *sl) /* {{{ */
+{
+  size_t i;
+
+  if (sl == NULL)
+    return;
+
+  for (i = 0; i < SL_SHARDS; i++)
+  {
+    sl_shard_t *s = sl->shards + i;
+    char *name;
+    sl_plugin_t *p;
+
+    if (s->plugins == NULL)
+      continue;
+
+    while (c_avl_pick (s->plugins, (void *) &name, (void *) &p) == 0)
+      sl_plugin_free (p);
+    c_avl_destroy (s->plugins);
+    pthread_mutex_destroy (&s->lock);
+  }
+
+  sfree (sl);
+} /* }}} void series_limit_destroy */
+
+_Bool series_limit_check (series_limit_t *sl, /* {{{ */
+    value_list_t const *vl, cdtime_t window, cdtime_t now)
+{
+  sl_shard_t *s;
+  sl_plugin_t *p;
+  uint32_t hash;
+  _Bool known;
+  _Bool ret = 1;
+
+  if (sl == NULL)
+    return (1);
+
+  s = sl->shards + (identifier_hash_name (vl->plugin) % SL_SHARDS);
+  hash = identifier_hash_vl (vl);
+  if (hash == 0)
+    hash = 1;
+
+  pthread_mutex_lock (&s->lock);
+
+  p = sl_plugin_get (s, vl->plugin, now);
+  if (p == NULL)
+  {
+    pthread_mutex_unlock (&s->lock);
+    return (1);
+  }
+
+  if (window > p->window)
+    p->window = window;
+  if (now - p->window_start >= p->window)
+    sl_plugin_rotate (p, now);
+
+  if (sl_set_contains (&p->current, hash))
+  {
+    pthread_mutex_unlock (&s->lock);
+    return (1);
+  }
+
+  known = sl_set_contains (&p->previous, hash);
+  if (!known && p->frozen)
+  {
+    if (!p->complained)
+    {
+      WARNING ("series_limit: Plugin \"%s\" uses more memory than its "
+          "limit. Values of new series are dropped.", p->name);
+      p->complained = 1;
+    }
+    p->dropped++;
+    ret = 0;
+  }
+  else if (!known && (sl->limit > 0)
+      && (sl_plugin_series_num (p) >= sl->limit))
+  {
+    if (!p->complained)
+    {
+      WARNING ("series_limit: Plugin \"%s\" has reached the limit of "
+          "%zu series. Values of new series are dropped.",
+          p->name, sl->limit);
+      p->complained = 1;
+    }
+    p->dropped++;
+    ret = 0;
+  }
+  else if (sl_set_insert (&p->current, hash) == 0)
+  {
+    if (known)
+      p->moved_num++;
+    else
+      p->series_new++;
+  }
+
+  pthread_mutex_unlock (&s->lock);
+  return (ret);
+} /* }}} _Bool series_limit_check */
+
+int series_limit_freeze (series_limit_t *sl, /* {{{ */
+    char const *plugin, _Bool frozen)
+{
+  sl_shard_t *s;
+  sl_plugin_t *p;
+
+  if ((sl == NULL) || (plugin == NULL))
+    return (EINVAL);
+
+  s = sl->shards + (identifier_hash_name (plugin) % SL_SHARDS);
+  pthread_mutex_lock (&s->lock);
+
+  p = sl_plugin_get (s, plugin, cdtime ());
+  if (p == NULL)
+  {
+    pthread_mutex_unlock (&s->lock);
+    return (ENOMEM);
+  }
+
+  if (p->frozen != frozen)
+    p->complained = 0;
+  p->frozen = frozen;
+
+  pthread_mutex_unlock (&s->lock);
+  return (0);
+} /* }}} int series_limit_freeze */
+
+int series_limit_stats (series_limit_t *sl, /* {{{ */
+    series_limit_stats_cb callback, void *arg)
+{
+  size_t i;
+
+  if (sl == NULL)
+    return (EINVAL);
+
+  for (i = 0; i < SL_SHARDS; i++)
+  {
+    sl_shard_t *s = sl->shards + i;
+    c_avl_iterator_t *iter;
+    sl_stats_t *stats;
+    size_t stats_num = 0;
+    char *name;
+    sl_plugin_t *p;
+    size_t j;
+
+    /* Copy the numbers, so that "callback" runs without the lock. */
+    pthread_mutex_lock (&s->lock);
+    stats = calloc ((size_t) c_avl_size (s->plugins) + 1, sizeof (*stats));
+    if (stats == NULL)
+    {
+      pthread_mutex_unlock (&s->lock);
+      return (ENOMEM);
+    }
+
+    iter = c_avl_get_iterator (s->plugins);
+    while (c_avl_iterator_next (iter, (void *) &name, (void *) &p) == 0)
+    {
+      sstrncpy (stats[stats_num].name, p->name,
+          sizeof (stats[stats_num].name));
+      stats[stats_num].series_num = sl_plugin_series_num (p);
+      stats[stats_num].series_new = p->series_new;
+      stats[stats_num].dropped = p->dropped;
+      stats_num++;
+    }
+    c_avl_iterator_destroy (iter);
+    pthread_mutex_unlock (&s->lock);
+
+    for (j = 0; j < stats_num; j++)
+      (*callback) (stats[j].name, stats[j].series_num, stats[j].series_new,
+          stats[j].dropped, arg);
+    sfree (stats);
+  }
+
+  return (0);
+} /* }}} int series_limit_stats */
@@ -0,0 +1,78 @@
+/**
+ * collectd - src/daemon/utils_series_limit.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_SERIES_LIMIT_H
+#define UTILS_SERIES_LIMIT_H 1
+
+#include "plugin.h"
+
+/*
+ * Limits the number of series, i.e. distinct identifiers, each plugin may
+ * dispatch. Series are counted per value of the "plugin" field. Once a
+ * plugin has reached the limit, values of series it hasn't dispatched
+ * recently are dropped, while the known series keep flowing.
+ *
+ * Series are remembered by their identifier_hash_vl() in two generations. A
+ * new generation is started once per window; series not seen during the
+ * previous two windows are forgotten and no longer count against the limit.
+ * A limit of zero only tracks the series, so that plugins can be frozen.
+ */
+struct series_limit_s;
+typedef struct series_limit_s series_limit_t;
+
+series_limit_t *series_limit_create (size_t limit);
+void series_limit_destroy (series_limit_t *sl);
+
+/*
+ * NAME
+ *   series_limit_check
+ *
+ * DESCRIPTION
+ *   Accounts `vl' and decides whether it may be dispatched. `window' is the
+ *   time after which a series that stopped receiving values may be
+ *   forgotten, usually the time after which the value cache expires its
+ *   entry. Each plugin uses the largest window passed for it.
+ *
+ * RETURN VALUE
+ *   True if `vl' belongs to a known series or a new series within the
+ *   limit, false if it should be dropped.
+ */
+_Bool series_limit_check (series_limit_t *sl, value_list_t const *vl,
+    cdtime_t window, cdtime_t now);
+
+/* Freezes or thaws `plugin'. While a plugin is frozen, its known series keep
+ * flowing and values of all new series are dropped, regardless of the limit.
+ * Used when a plugin exceeds its memory limit. */
+int series_limit_freeze (series_limit_t *sl, char const *plugin,
+    _Bool frozen);
+
+typedef void (*series_limit_stats_cb) (char const *plugin,
+    size_t series_num, derive_t series_new, derive_t dropped, void *arg);
+
+/* Calls `callback' with the number of series, the number of series added
+ * and the number of dropped values of each plugin. No locks are held while
+ * `callback' runs, so it may dispatch values. */
+int series_limit_stats (series_limit_t *sl, series_limit_stats_cb callback,
+    void *arg);
+
+#endif /* UTILS_SERIES_LIMIT_H */
@@ -0,0 +1,148 @@
+/**
+ * collectd - src/daemon/utils_series_limit_test.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "testing.h"
+#include "utils_series_limit.h"
+
+#define WINDOW TIME_T_TO_CDTIME_T (20)
+
+static void test_vl (value_list_t *vl, char const *plugin, int series)
+{
+  memset (vl, 0, sizeof (*vl));
+  sstrncpy (vl->host, "example.com", sizeof (vl->host));
+  sstrncpy (vl->plugin, plugin, sizeof (vl->plugin));
+  sstrncpy (vl->type, "gauge", sizeof (vl->type));
+  ssnprintf (vl->type_instance, sizeof (vl->type_instance), "%i", series);
+}
+
+static size_t stats_series_num;
+static derive_t stats_series_new;
+static derive_t stats_dropped;
+
+static void test_stats (char const *plugin, size_t series_num,
+    derive_t series_new, derive_t dropped, void *arg)
+{
+  if ((strcmp ("a", plugin) != 0) || (arg != &stats_series_num))
+    return;
+
+  stats_series_num = series_num;
+  stats_series_new = series_new;
+  stats_dropped = dropped;
+}
+
+DEF_TEST(series_limit)
+{
+  series_limit_t *sl;
+  value_list_t vl;
+  cdtime_t now = TIME_T_TO_CDTIME_T (1000);
+  int i;
+
+  CHECK_NOT_NULL (sl = series_limit_create (3));
+
+  for (i = 0; i < 3; i++)
+  {
+    test_vl (&vl, "a", i);
+    OK (series_limit_check (sl, &vl, WINDOW, now));
+  }
+
+  /* New series are dropped, known series and other plugins keep flowing. */
+  test_vl (&vl, "a", 3);
+  OK (!series_limit_check (sl, &vl, WINDOW, now));
+  test_vl (&vl, "a", 0);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+  test_vl (&vl, "b", 3);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+
+  CHECK_ZERO (series_limit_stats (sl, test_stats, &stats_series_num));
+  EXPECT_EQ_INT (3, (int) stats_series_num);
+  EXPECT_EQ_INT (3, (int) stats_series_new);
+  EXPECT_EQ_INT (1, (int) stats_dropped);
+
+  /* Series 0 stays known during the next window, the others are forgotten
+   * after two windows. */
+  now += WINDOW;
+  test_vl (&vl, "a", 0);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+  test_vl (&vl, "a", 4);
+  OK (!series_limit_check (sl, &vl, WINDOW, now));
+
+  now += WINDOW;
+  test_vl (&vl, "a", 4);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+  test_vl (&vl, "a", 5);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+  test_vl (&vl, "a", 6);
+  OK (!series_limit_check (sl, &vl, WINDOW, now));
+
+  CHECK_ZERO (series_limit_stats (sl, test_stats, &stats_series_num));
+  EXPECT_EQ_INT (3, (int) stats_series_num);
+  EXPECT_EQ_INT (5, (int) stats_series_new);
+  EXPECT_EQ_INT (3, (int) stats_dropped);
+
+  series_limit_destroy (sl);
+  return (0);
+}
+
+DEF_TEST(freeze)
+{
+  series_limit_t *sl;
+  value_list_t vl;
+  cdtime_t now = TIME_T_TO_CDTIME_T (1000);
+
+  /* Without a limit, series are only tracked. */
+  CHECK_NOT_NULL (sl = series_limit_create (0));
+
+  test_vl (&vl, "a", 0);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+
+  /* A frozen plugin keeps its known series, but can't add new ones. */
+  CHECK_ZERO (series_limit_freeze (sl, "a", 1));
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+  test_vl (&vl, "a", 1);
+  OK (!series_limit_check (sl, &vl, WINDOW, now));
+  test_vl (&vl, "b", 1);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+
+  CHECK_ZERO (series_limit_freeze (sl, "a", 0));
+  test_vl (&vl, "a", 1);
+  OK (series_limit_check (sl, &vl, WINDOW, now));
+
+  CHECK_ZERO (series_limit_stats (sl, test_stats, &stats_series_num));
+  EXPECT_EQ_INT (2, (int) stats_series_num);
+  EXPECT_EQ_INT (1, (int) stats_dropped);
+
+  series_limit_destroy (sl);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(series_limit);
+  RUN_TEST(freeze);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -32,19 +32,54 @@
 
 #include "collectd.h"
 #include "common.h"
+#include "plugin.h"
 #include "utils_tail.h"
 
+#include <pthread.h>
+
+#if HAVE_SYS_INOTIFY_H
+# include <poll.h>
+# include <sys/inotify.h>
+#endif
+
+/* Size of the block reads. Longer lines are split. */
+#define CU_TAIL_BUFFER_SIZE 65536
+
 struct cu_tail_s
 {
 	char  *file;
-	FILE  *fh;
+	int    fd;
 	struct stat stat;
+
+	/* Data that has been read from "fd" but not returned yet is kept in
+	 * buffer[pos..fill). The buffer has one more byte, so that a line at
+	 * its end can always be null-terminated in place. */
+	char  *buffer;
+	size_t pos;
+	size_t fill;
+
+	/* Set by cu_tail_follow (), protected by "follow_lock". */
+	_Bool follow;
+	tailfunc_t *callback;
+	void *data;
+	char *line;
+	int line_size;
+	plugin_ctx_t ctx;
+	cdtime_t interval;
+	cdtime_t next_read;
+	_Bool pending;
+	char *dir;
+	char const *base;
+	int wd_file;
+	int wd_dir;
+	ino_t wd_file_ino;
+	cu_tail_t *next;
 };
 
 static int cu_tail_reopen (cu_tail_t *obj)
 {
   int seek_end = 0;
-  FILE *fh;
+  int fd;
   struct stat stat_buf;
   int status;
 
@@ -59,22 +94,27 @@ static int cu_tail_reopen (cu_tail_t *obj)
   }
 
   /* The file is already open.. */
-  if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino))
+  if ((obj->fd >= 0) && (stat_buf.st_ino == obj->stat.st_ino))
   {
     /* Seek to the beginning if file was truncated */
     if (stat_buf.st_size < obj->stat.st_size)
     {
       INFO ("utils_tail: File `%s' was truncated.", obj->file);
-      status = fseek (obj->fh, 0, SEEK_SET);
-      if (status != 0)
+      if (lseek (obj->fd, 0, SEEK_SET) == (off_t) -1)
       {
 	char errbuf[1024];
-	ERROR ("utils_tail: fseek (%s) failed: %s", obj->file,
+	ERROR ("utils_tail: lseek (%s) failed: %s", obj->file,
 	    sstrerror (errno, errbuf, sizeof (errbuf)));
-	fclose (obj->fh);
-	obj->fh = NULL;
+	close (obj->fd);
+	obj->fd = -1;
 	return (-1);
       }
+      /* A partial line from before the truncation doesn't belong to
+       * anything that follows. */
+      obj->pos = obj->fill = 0;
+      memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
+      /* Read the new content right away. */
+      return (0);
     }
     memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
     return (1);
@@ -85,36 +125,138 @@ static int cu_tail_reopen (cu_tail_t *obj)
   if ((obj->stat.st_ino == 0) || (obj->stat.st_ino == stat_buf.st_ino))
     seek_end = 1;
 
-  fh = fopen (obj->file, "r");
-  if (fh == NULL)
+  fd = open (obj->file, O_RDONLY);
+  if (fd < 0)
   {
     char errbuf[1024];
-    ERROR ("utils_tail: fopen (%s) failed: %s", obj->file,
+    ERROR ("utils_tail: open (%s) failed: %s", obj->file,
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
   if (seek_end != 0)
   {
-    status = fseek (fh, 0, SEEK_END);
-    if (status != 0)
+    if (lseek (fd, 0, SEEK_END) == (off_t) -1)
     {
       char errbuf[1024];
-      ERROR ("utils_tail: fseek (%s) failed: %s", obj->file,
+      ERROR ("utils_tail: lseek (%s) failed: %s", obj->file,
 	  sstrerror (errno, errbuf, sizeof (errbuf)));
-      fclose (fh);
+      close (fd);
       return (-1);
     }
   }
 
-  if (obj->fh != NULL)
-    fclose (obj->fh);
-  obj->fh = fh;
+  if (obj->fd >= 0)
+    close (obj->fd);
+  obj->fd = fd;
   memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
 
   return (0);
 } /* int cu_tail_reopen */
 
+/* Returns the next line of at most "max" bytes in "ret_line" and "ret_len",
+ * including the newline if there is one. The line points into the buffer and
+ * is valid until the next call. Only returns a line without newline if it is
+ * longer than "max" or the buffer, or at the end of a file that has been
+ * rotated; otherwise an incomplete last line is kept until the rest of it has
+ * been written. "ret_line" is NULL if there is nothing more to read. */
+static int cu_tail_next (cu_tail_t *obj, size_t max, /* {{{ */
+    char **ret_line, size_t *ret_len)
+{
+  int status;
+
+  if (obj->buffer == NULL)
+  {
+    obj->buffer = malloc (CU_TAIL_BUFFER_SIZE + 1);
+    if (obj->buffer == NULL)
+    {
+      ERROR ("utils_tail: malloc failed.");
+      return (-1);
+    }
+    obj->pos = obj->fill = 0;
+  }
+
+  if (obj->fd < 0)
+  {
+    status = cu_tail_reopen (obj);
+    if (status < 0)
+      return (status);
+  }
+
+  while (42)
+  {
+    char *line = obj->buffer + obj->pos;
+    size_t avail = obj->fill - obj->pos;
+    char *newline;
+    ssize_t len;
+
+    newline = memchr (line, '\n', (avail < max) ? avail : max);
+    if ((newline != NULL) || (avail >= max) || (avail == CU_TAIL_BUFFER_SIZE))
+    {
+      if (newline != NULL)
+	avail = (size_t) (newline - line) + 1;
+      else if (avail > max)
+	avail = max;
+
+      obj->pos += avail;
+      *ret_line = line;
+      *ret_len = avail;
+      return (0);
+    }
+
+    /* Move the incomplete line to the front and fill up the buffer. */
+    if (obj->pos > 0)
+    {
+      memmove (obj->buffer, line, avail);
+      obj->pos = 0;
+      obj->fill = avail;
+    }
+
+    len = read (obj->fd, obj->buffer + obj->fill,
+	CU_TAIL_BUFFER_SIZE - obj->fill);
+    if (len > 0)
+    {
+      obj->fill += (size_t) len;
+      continue;
+    }
+    else if ((len < 0) && (errno == EINTR))
+      continue;
+    else if (len < 0)
+    {
+      /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
+      char errbuf[1024];
+      WARNING ("utils_tail: read (%s) failed: %s", obj->file,
+	  sstrerror (errno, errbuf, sizeof (errbuf)));
+      close (obj->fd);
+      obj->fd = -1;
+    }
+
+    /* eof -> check if the file was moved away and reopen the new file if
+     * so.. */
+    status = cu_tail_reopen (obj);
+    /* error -> return with error */
+    if (status < 0)
+      return (status);
+    /* file end reached and file not reopened -> nothing more to read */
+    else if (status > 0)
+    {
+      *ret_line = NULL;
+      *ret_len = 0;
+      return (0);
+    }
+
+    /* If we get here: file was re-opened. An incomplete last line of the
+     * old file is returned as it is, then the new file is read. */
+    if (obj->fill > obj->pos)
+    {
+      *ret_line = obj->buffer + obj->pos;
+      *ret_len = obj->fill - obj->pos;
+      obj->pos = obj->fill;
+      return (0);
+    }
+  }
+} /* }}} int cu_tail_next */
+
 cu_tail_t *cu_tail_create (const char *file)
 {
 	cu_tail_t *obj;
@@ -130,15 +272,20 @@ cu_tail_t *cu_tail_create (const char *file)
 		return (NULL);
 	}
 
-	obj->fh = NULL;
+	obj->fd = -1;
+	obj->wd_file = -1;
+	obj->wd_dir = -1;
 
 	return (obj);
 } /* cu_tail_t *cu_tail_create */
 
 int cu_tail_destroy (cu_tail_t *obj)
 {
-	if (obj->fh != NULL)
-		fclose (obj->fh);
+	cu_tail_unfollow (obj);
+
+	if (obj->fd >= 0)
+		close (obj->fd);
+	free (obj->buffer);
 	free (obj->file);
 	free (obj);
 
@@ -147,6 +294,8 @@ int cu_tail_destroy (cu_tail_t *obj)
 
 int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
 {
+  char *line;
+  size_t len;
   int status;
 
   if (buflen < 1)
@@ -156,64 +305,19 @@ int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
     return (-1);
   }
 
-  if (obj->fh == NULL)
-  {
-    status = cu_tail_reopen (obj);
-    if (status < 0)
-      return (status);
-  }
-  assert (obj->fh != NULL);
-
-  /* Try to read from the filehandle. If that succeeds, everything appears to
-   * be fine and we can return. */
-  clearerr (obj->fh);
-  if (fgets (buf, buflen, obj->fh) != NULL)
-  {
-    buf[buflen - 1] = 0;
-    return (0);
-  }
-
-  /* Check if we encountered an error */
-  if (ferror (obj->fh) != 0)
-  {
-    /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
-    fclose (obj->fh);
-    obj->fh = NULL;
-  }
-  /* else: eof -> check if the file was moved away and reopen the new file if
-   * so.. */
-
-  status = cu_tail_reopen (obj);
-  /* error -> return with error */
-  if (status < 0)
+  status = cu_tail_next (obj, (size_t) (buflen - 1), &line, &len);
+  if (status != 0)
     return (status);
-  /* file end reached and file not reopened -> nothing more to read */
-  else if (status > 0)
-  {
-    buf[0] = 0;
-    return (0);
-  }
 
-  /* If we get here: file was re-opened and there may be more to read.. Let's
-   * try again. */
-  if (fgets (buf, buflen, obj->fh) != NULL)
+  /* EOF */
+  if (line == NULL)
   {
-    buf[buflen - 1] = 0;
+    buf[0] = 0;
     return (0);
   }
 
-  if (ferror (obj->fh) != 0)
-  {
-    char errbuf[1024];
-    WARNING ("utils_tail: fgets (%s) returned an error: %s", obj->file,
-	sstrerror (errno, errbuf, sizeof (errbuf)));
-    fclose (obj->fh);
-    obj->fh = NULL;
-    return (-1);
-  }
-
-  /* EOf, well, apparently the new file is empty.. */
-  buf[0] = 0;
+  memcpy (buf, line, len);
+  buf[len] = 0;
   return (0);
 } /* int cu_tail_readline */
 
@@ -222,31 +326,45 @@ int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
 {
 	int status;
 
+	if (buflen < 1)
+	{
+		ERROR ("utils_tail: cu_tail_read: buflen too small: %i bytes.",
+				buflen);
+		return (-1);
+	}
+
 	while (42)
 	{
+		char *line;
 		size_t len;
 
-		status = cu_tail_readline (obj, buf, buflen);
+		status = cu_tail_next (obj, (size_t) (buflen - 1), &line, &len);
 		if (status != 0)
 		{
-			ERROR ("utils_tail: cu_tail_read: cu_tail_readline "
+			ERROR ("utils_tail: cu_tail_read: cu_tail_next "
 					"failed.");
 			break;
 		}
 
 		/* check for EOF */
-		if (buf[0] == 0)
+		if (line == NULL)
 			break;
 
-		len = strlen (buf);
-		while (len > 0) {
-			if (buf[len - 1] != '\n')
-				break;
-			buf[len - 1] = '\0';
-			len--;
+		/* Lines are passed to the callback in place. Only lines
+		 * that were split because they are too long need to be
+		 * copied to be null-terminated. */
+		if (line[len - 1] == '\n')
+			line[len - 1] = 0;
+		else if (line + len == obj->buffer + obj->fill)
+			line[len] = 0;
+		else
+		{
+			memcpy (buf, line, len);
+			buf[len] = 0;
+			line = buf;
 		}
 
-		status = callback (data, buf, buflen);
+		status = callback (data, line, buflen);
 		if (status != 0)
 		{
 			ERROR ("utils_tail: cu_tail_read: callback returned "
@@ -257,3 +375,370 @@ int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
 
 	return status;
 } /* int cu_tail_read */
+
+/*
+ * The tail thread: All followed files are read by one thread, which waits
+ * for inotify events of the files and of the directories containing them.
+ * Each file is also read once per interval of the plugin that follows it,
+ * in case an event was missed, e.g. for files on network file systems.
+ */
+#if HAVE_SYS_INOTIFY_H
+struct cu_tail_engine_s
+{
+	int ifd;
+	int pipe[2];
+	_Bool stop;
+	pthread_t thread;
+};
+typedef struct cu_tail_engine_s cu_tail_engine_t;
+
+#define CU_TAIL_FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define CU_TAIL_DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+static pthread_mutex_t follow_lock = PTHREAD_MUTEX_INITIALIZER;
+static cu_tail_engine_t *follow_engine = NULL;
+static cu_tail_t *follow_list = NULL;
+
+/* Removes the watch "wd" unless another followed file still uses it.
+ * Watching the same file or directory twice returns the same descriptor. */
+static void cu_tail_rm_watch (cu_tail_t *obj, int wd) /* {{{ */
+{
+  cu_tail_t *ptr;
+
+  if (wd < 0)
+    return;
+
+  for (ptr = follow_list; ptr != NULL; ptr = ptr->next)
+    if ((ptr != obj) && ((ptr->wd_file == wd) || (ptr->wd_dir == wd)))
+      return;
+
+  inotify_rm_watch (follow_engine->ifd, wd);
+} /* }}} void cu_tail_rm_watch */
+
+/* Reads all lines appended to "obj" and makes sure that the file currently
+ * open is the one being watched. Called with "follow_lock" held. */
+static void cu_tail_follow_read (cu_tail_t *obj) /* {{{ */
+{
+  plugin_ctx_t old_ctx;
+
+  old_ctx = plugin_set_ctx (obj->ctx);
+
+  cu_tail_read (obj, obj->line, obj->line_size, obj->callback, obj->data);
+
+  /* Add the watch after the file has been opened, then read again so that
+   * nothing written in between is missed until the next event. */
+  if ((obj->fd >= 0)
+      && ((obj->wd_file < 0) || (obj->wd_file_ino != obj->stat.st_ino)))
+  {
+    int wd = inotify_add_watch (follow_engine->ifd, obj->file,
+	CU_TAIL_FILE_EVENTS);
+    if (wd != obj->wd_file)
+      cu_tail_rm_watch (obj, obj->wd_file);
+    obj->wd_file = wd;
+    obj->wd_file_ino = obj->stat.st_ino;
+
+    cu_tail_read (obj, obj->line, obj->line_size, obj->callback, obj->data);
+  }
+
+  plugin_set_ctx (old_ctx);
+
+  obj->pending = 0;
+  obj->next_read = cdtime () + obj->interval;
+} /* }}} void cu_tail_follow_read */
+
+static void cu_tail_follow_events (cu_tail_engine_t *e) /* {{{ */
+{
+  char buffer[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read (e->ifd, buffer, sizeof (buffer))) > 0)
+  {
+    char *ptr;
+
+    for (ptr = buffer; ptr < buffer + len;
+	ptr += sizeof (struct inotify_event) + ((struct inotify_event *) ptr)->len)
+    {
+      struct inotify_event *ev = (struct inotify_event *) ptr;
+      cu_tail_t *obj;
+
+      for (obj = follow_list; obj != NULL; obj = obj->next)
+      {
+	if (ev->mask & IN_Q_OVERFLOW)
+	  obj->pending = 1;
+	else if (ev->wd == obj->wd_file)
+	{
+	  obj->pending = 1;
+	  /* The watch is removed when the file is deleted. */
+	  if (ev->mask & IN_IGNORED)
+	    obj->wd_file = -1;
+	}
+	else if ((ev->wd == obj->wd_dir) && (ev->len > 0)
+	    && (strcmp (ev->name, obj->base) == 0))
+	  obj->pending = 1;
+	else if ((ev->wd == obj->wd_dir) && (ev->mask & IN_IGNORED))
+	  obj->wd_dir = -1;
+      }
+    }
+  }
+} /* }}} void cu_tail_follow_events */
+
+static void *cu_tail_follow_thread (void *arg) /* {{{ */
+{
+  cu_tail_engine_t *e = arg;
+
+  pthread_mutex_lock (&follow_lock);
+  while (!e->stop)
+  {
+    struct pollfd fds[2];
+    cdtime_t now = cdtime ();
+    cdtime_t timeout = TIME_T_TO_CDTIME_T (86400);
+    cu_tail_t *obj;
+    char dummy[64];
+
+    for (obj = follow_list; obj != NULL; obj = obj->next)
+    {
+      if (obj->pending || (obj->next_read <= now))
+	cu_tail_follow_read (obj);
+      now = cdtime ();
+      if (obj->next_read <= now)
+	timeout = 0;
+      else if (obj->next_read - now < timeout)
+	timeout = obj->next_read - now;
+    }
+    pthread_mutex_unlock (&follow_lock);
+
+    memset (fds, 0, sizeof (fds));
+    fds[0].fd = e->ifd;
+    fds[0].events = POLLIN;
+    fds[1].fd = e->pipe[0];
+    fds[1].events = POLLIN;
+    poll (fds, STATIC_ARRAY_SIZE (fds),
+	(int) CDTIME_T_TO_MS (timeout) + 1);
+
+    pthread_mutex_lock (&follow_lock);
+    while (read (e->pipe[0], dummy, sizeof (dummy)) > 0)
+      /* empty */;
+    if (!e->stop)
+      cu_tail_follow_events (e);
+  }
+  pthread_mutex_unlock (&follow_lock);
+
+  return ((void *) 0);
+} /* }}} void *cu_tail_follow_thread */
+
+static void cu_tail_engine_free (cu_tail_engine_t *e) /* {{{ */
+{
+  if (e == NULL)
+    return;
+
+  if (e->ifd >= 0)
+    close (e->ifd);
+  if (e->pipe[0] >= 0)
+    close (e->pipe[0]);
+  if (e->pipe[1] >= 0)
+    close (e->pipe[1]);
+  sfree (e);
+} /* }}} void cu_tail_engine_free */
+
+/* Called with "follow_lock" held. */
+static int cu_tail_engine_start (void) /* {{{ */
+{
+  cu_tail_engine_t *e;
+  char errbuf[1024];
+  int status;
+
+  if (follow_engine != NULL)
+    return (0);
+
+  e = calloc (1, sizeof (*e));
+  if (e == NULL)
+    return (ENOMEM);
+  e->pipe[0] = e->pipe[1] = -1;
+
+  e->ifd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (e->ifd < 0)
+  {
+    status = errno;
+    WARNING ("utils_tail: inotify_init1 failed: %s",
+	sstrerror (status, errbuf, sizeof (errbuf)));
+    cu_tail_engine_free (e);
+    return (status);
+  }
+
+  if (pipe (e->pipe) != 0)
+  {
+    status = errno;
+    ERROR ("utils_tail: pipe failed: %s",
+	sstrerror (status, errbuf, sizeof (errbuf)));
+    e->pipe[0] = e->pipe[1] = -1;
+    cu_tail_engine_free (e);
+    return (status);
+  }
+  fcntl (e->pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (e->pipe[1], F_SETFL, O_NONBLOCK);
+  fcntl (e->pipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl (e->pipe[1], F_SETFD, FD_CLOEXEC);
+
+  status = plugin_thread_create (&e->thread, /* attr = */ NULL,
+      cu_tail_follow_thread, e);
+  if (status != 0)
+  {
+    ERROR ("utils_tail: Starting the tail thread failed: %s",
+	sstrerror (status, errbuf, sizeof (errbuf)));
+    cu_tail_engine_free (e);
+    return (status);
+  }
+
+  follow_engine = e;
+  return (0);
+} /* }}} int cu_tail_engine_start */
+
+static void cu_tail_engine_wakeup (cu_tail_engine_t *e) /* {{{ */
+{
+  char c = 0;
+
+  if (write (e->pipe[1], &c, 1) < 0)
+  {
+    /* The pipe is full, so the thread is going to wake up anyway. */
+  }
+} /* }}} void cu_tail_engine_wakeup */
+#endif /* HAVE_SYS_INOTIFY_H */
+
+int cu_tail_follow (cu_tail_t *obj, int buflen, tailfunc_t *callback, /* {{{ */
+    void *data)
+{
+#if HAVE_SYS_INOTIFY_H
+  char *dir;
+  int status;
+
+  if ((obj == NULL) || (buflen < 1) || (callback == NULL))
+    return (EINVAL);
+
+  pthread_mutex_lock (&follow_lock);
+  if (obj->follow)
+  {
+    pthread_mutex_unlock (&follow_lock);
+    return (EEXIST);
+  }
+
+  status = cu_tail_engine_start ();
+  if (status != 0)
+  {
+    pthread_mutex_unlock (&follow_lock);
+    return (status);
+  }
+
+  obj->line = malloc ((size_t) buflen);
+  dir = strdup (obj->file);
+  if ((obj->line == NULL) || (dir == NULL))
+  {
+    sfree (obj->line);
+    sfree (dir);
+    pthread_mutex_unlock (&follow_lock);
+    return (ENOMEM);
+  }
+  obj->line_size = buflen;
+
+  /* Watch the directory to notice when the file is created again after it
+   * has been moved away. */
+  obj->base = strrchr (obj->file, '/');
+  if (obj->base == NULL)
+  {
+    obj->base = obj->file;
+    sstrncpy (dir, ".", 2);
+  }
+  else
+  {
+    obj->base++;
+    dir[obj->base - 1 - obj->file] = 0;
+    if (dir[0] == 0)
+      sstrncpy (dir, "/", 2);
+  }
+  obj->dir = dir;
+  obj->wd_dir = inotify_add_watch (follow_engine->ifd, obj->dir,
+      CU_TAIL_DIR_EVENTS);
+  if (obj->wd_dir < 0)
+  {
+    char errbuf[1024];
+    WARNING ("utils_tail: Watching \"%s\" failed: %s. Changes to `%s' will "
+	"be noticed once per interval only.", obj->dir,
+	sstrerror (errno, errbuf, sizeof (errbuf)), obj->file);
+  }
+
+  obj->callback = callback;
+  obj->data = data;
+  obj->ctx = plugin_get_ctx ();
+  obj->interval = plugin_get_interval ();
+  obj->next_read = 0;
+  obj->pending = 1;
+  obj->follow = 1;
+
+  obj->next = follow_list;
+  follow_list = obj;
+
+  cu_tail_engine_wakeup (follow_engine);
+  pthread_mutex_unlock (&follow_lock);
+
+  return (0);
+#else
+  return (ENOTSUP);
+#endif
+} /* }}} int cu_tail_follow */
+
+void cu_tail_unfollow (cu_tail_t *obj) /* {{{ */
+{
+#if HAVE_SYS_INOTIFY_H
+  cu_tail_engine_t *e = NULL;
+  cu_tail_t *prev;
+
+  if (obj == NULL)
+    return;
+
+  pthread_mutex_lock (&follow_lock);
+  if (!obj->follow)
+  {
+    pthread_mutex_unlock (&follow_lock);
+    return;
+  }
+
+  if (follow_list == obj)
+    follow_list = obj->next;
+  else
+  {
+    for (prev = follow_list; prev->next != obj; prev = prev->next)
+      /* empty */;
+    prev->next = obj->next;
+  }
+  obj->next = NULL;
+
+  cu_tail_rm_watch (obj, obj->wd_file);
+  cu_tail_rm_watch (obj, obj->wd_dir);
+  obj->wd_file = -1;
+  obj->wd_dir = -1;
+
+  sfree (obj->line);
+  obj->line_size = 0;
+  sfree (obj->dir);
+  obj->base = NULL;
+  obj->callback = NULL;
+  obj->data = NULL;
+  obj->follow = 0;
+
+  /* Stop the thread with the last file. */
+  if (follow_list == NULL)
+  {
+    e = follow_engine;
+    follow_engine = NULL;
+    e->stop = 1;
+    cu_tail_engine_wakeup (e);
+  }
+  pthread_mutex_unlock (&follow_lock);
+
+  if (e != NULL)
+  {
+    pthread_join (e->thread, /* retval = */ NULL);
+    cu_tail_engine_free (e);
+  }
+#endif
+} /* }}} void cu_tail_unfollow */
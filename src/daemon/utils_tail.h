@@ -62,14 +62,14 @@ int cu_tail_destroy (cu_tail_t *obj);
 /*
  * cu_tail_readline
  *
- * Reads from the file until `buflen' characters are read, a newline
- * character is read, or an eof condition is encountered. `buf' is
- * always null-terminated on successful return and isn't touched when non-zero
- * is returned.
+ * Returns the next line of the file, including the newline, or the next
+ * `buflen' - 1 characters of a longer line. The file is read in large blocks.
+ * An incomplete last line is only returned once the rest of it has been
+ * written, or when the file has been rotated. `buf' is always null-terminated
+ * on successful return and isn't touched when non-zero is returned.
  *
  * You can check if the EOF condition is reached by looking at the buffer: If
  * the length of the string stored in the buffer is zero, EOF occurred.
- * Otherwise at least the newline character will be in the buffer.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
@@ -85,4 +85,28 @@ int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen);
 int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
 		void *data);
 
+/*
+ * cu_tail_follow
+ *
+ * Reads the file in a separate thread as soon as lines are appended to it,
+ * and calls `callback' for each line like `cu_tail_read' does. Lines are at
+ * most `buflen' - 1 characters long. The callback is called with the plugin
+ * context of the caller; it must not call any other cu_tail function. Don't
+ * read from the object while it is followed.
+ *
+ * Returns 0 when successful, ENOTSUP if files can't be watched on this
+ * system and another errno value otherwise. Callers should fall back to
+ * calling `cu_tail_read' periodically when this fails.
+ */
+int cu_tail_follow (cu_tail_t *obj, int buflen, tailfunc_t *callback,
+		void *data);
+
+/*
+ * cu_tail_unfollow
+ *
+ * Stops following the file. When this returns, the callback is not running
+ * anymore. Called by `cu_tail_destroy'.
+ */
+void cu_tail_unfollow (cu_tail_t *obj);
+
 #endif /* UTILS_TAIL_H */
@@ -33,9 +33,13 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_match.h"
+#include "utils_regex_set.h"
 #include "utils_tail.h"
 #include "utils_tail_match.h"
 
+#include <pthread.h>
+#include <regex.h>
+
 struct cu_tail_match_simple_s
 {
   char plugin[DATA_MAX_NAME_LEN];
@@ -59,10 +63,20 @@ struct cu_tail_match_s
 {
   int flags;
   cu_tail_t *tail;
+  /* Set once the file is read by the tail thread. "lock" then protects the
+   * matches from being applied and submitted at the same time. */
+  _Bool follow;
+  pthread_mutex_t lock;
 
   cdtime_t interval;
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* Pre-filter for the regular expressions of all matches, so that each line
+   * is only run through the matches that can possibly apply to it. NULL if
+   * the set could not be built; all matches are applied then. */
+  regex_set_t *set;
+  uint64_t *candidates;
 };
 
 /*
@@ -113,12 +127,63 @@ static int tail_callback (void *data, char *buf,
   cu_tail_match_t *obj = (cu_tail_match_t *) data;
   size_t i;
 
-  for (i = 0; i < obj->matches_num; i++)
-    match_apply (obj->matches[i].match, buf);
+  pthread_mutex_lock (&obj->lock);
+  if (obj->set == NULL)
+  {
+    for (i = 0; i < obj->matches_num; i++)
+      match_apply (obj->matches[i].match, buf);
+  }
+  else if (regex_set_candidates (obj->set, buf, obj->candidates) != 0)
+  {
+    for (i = 0; i < obj->matches_num; i++)
+      if (REGEX_SET_IS_CANDIDATE (obj->candidates, i))
+	match_apply (obj->matches[i].match, buf);
+  }
+  pthread_mutex_unlock (&obj->lock);
 
   return (0);
 } /* int tail_callback */
 
+static void tail_match_free_set (cu_tail_match_t *obj)
+{
+  regex_set_destroy (obj->set);
+  obj->set = NULL;
+  sfree (obj->candidates);
+} /* void tail_match_free_set */
+
+/* Rebuilds the regex set after a match has been added. On failure the set is
+ * left NULL and every line is passed to all matches. */
+static void tail_match_build_set (cu_tail_match_t *obj)
+{
+  size_t i;
+
+  tail_match_free_set (obj);
+
+  obj->set = regex_set_create ();
+  obj->candidates = calloc (REGEX_SET_WORDS (obj->matches_num),
+      sizeof (*obj->candidates));
+  if ((obj->set == NULL) || (obj->candidates == NULL))
+  {
+    tail_match_free_set (obj);
+    return;
+  }
+
+  for (i = 0; i < obj->matches_num; i++)
+  {
+    const char *regex = match_get_regex (obj->matches[i].match);
+
+    if ((regex == NULL)
+        || (regex_set_add (obj->set, regex, REG_EXTENDED) != (int) i))
+    {
+      tail_match_free_set (obj);
+      return;
+    }
+  }
+
+  if (regex_set_compile (obj->set) != 0)
+    tail_match_free_set (obj);
+} /* void tail_match_build_set */
+
 /*
  * Public functions
  */
@@ -136,6 +201,7 @@ cu_tail_match_t *tail_match_create (const char *filename)
     sfree (obj);
     return (NULL);
   }
+  pthread_mutex_init (&obj->lock, /* attr = */ NULL);
 
   return (obj);
 } /* cu_tail_match_t *tail_match_create */
@@ -168,7 +234,9 @@ void tail_match_destroy (cu_tail_match_t *obj)
     match->user_data = NULL;
   }
 
+  tail_match_free_set (obj);
   sfree (obj->matches);
+  pthread_mutex_destroy (&obj->lock);
   sfree (obj);
 } /* void tail_match_destroy */
 
@@ -195,6 +263,8 @@ int tail_match_add_match (cu_tail_match_t *obj, cu_match_t *match,
   temp->submit = submit_match;
   temp->free = free_user_data;
 
+  tail_match_build_set (obj);
+
   return (0);
 } /* int tail_match_add_match */
 
@@ -248,14 +318,26 @@ int tail_match_read (cu_tail_match_t *obj)
   int status;
   size_t i;
 
-  status = cu_tail_read (obj->tail, buffer, sizeof (buffer), tail_callback,
-      (void *) obj);
-  if (status != 0)
+  /* Let the tail thread apply the matches as lines are appended, so that
+   * bursts are processed as they happen rather than all at once here. If
+   * that isn't possible, read the file here. */
+  if (!obj->follow
+      && (cu_tail_follow (obj->tail, (int) sizeof (buffer), tail_callback,
+	  (void *) obj) == 0))
+    obj->follow = 1;
+
+  if (!obj->follow)
   {
-    ERROR ("tail_match: cu_tail_read failed.");
-    return (status);
+    status = cu_tail_read (obj->tail, buffer, sizeof (buffer), tail_callback,
+	(void *) obj);
+    if (status != 0)
+    {
+      ERROR ("tail_match: cu_tail_read failed.");
+      return (status);
+    }
   }
 
+  pthread_mutex_lock (&obj->lock);
   for (i = 0; i < obj->matches_num; i++)
   {
     cu_tail_match_match_t *lt_match = obj->matches + i;
@@ -265,6 +347,7 @@ int tail_match_read (cu_tail_match_t *obj)
 
     (*lt_match->submit) (lt_match->match, lt_match->user_data);
   }
+  pthread_mutex_unlock (&obj->lock);
 
   return (0);
 } /* int tail_match_read */
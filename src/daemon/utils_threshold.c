@@ -27,10 +27,41 @@
 #include "collectd.h"
 #include "common.h"
 #include "utils_avltree.h"
+#include "utils_intern.h"
 #include "utils_threshold.h"
 
 #include <pthread.h>
 
+/*
+ * Results of threshold_search() by identifier, including negative results.
+ * Protected by threshold_lock.
+ */
+struct threshold_cache_entry_s;
+typedef struct threshold_cache_entry_s threshold_cache_entry_t;
+struct threshold_cache_entry_s
+{
+  identifier_t id;
+  threshold_t *th; /* NULL if no threshold matches */
+  threshold_cache_entry_t *next;
+};
+
+static threshold_cache_entry_t **threshold_cache = NULL;
+static size_t threshold_cache_size = 0; /* number of buckets, a power of 2 */
+static size_t threshold_cache_num = 0;
+
+/*
+ * Number of threshold_acquire() callers that haven't released the thresholds
+ * of "tree" yet. "threshold_tree_ref" belongs to "threshold_tree" and is
+ * created by the first threshold_acquire(). Protected by threshold_lock.
+ */
+struct threshold_tree_ref_s
+{
+  c_avl_tree_t *tree;
+  size_t users;
+};
+
+static threshold_tree_ref_t *threshold_tree_ref = NULL;
+
 /*
  * Exported symbols
  * {{{ */
@@ -65,14 +96,13 @@ threshold_t *threshold_get (const char *hostname,
 } /* }}} threshold_t *threshold_get */
 
 /*
- * threshold_t *threshold_search
+ * threshold_t *threshold_search_uncached
  *
  * Searches for a threshold configuration using all the possible variations of
  * "Host", "Plugin" and "Type" blocks. Returns NULL if no threshold could be
  * found.
- * XXX: This is likely the least efficient function in collectd.
  */
-threshold_t *threshold_search (const value_list_t *vl)
+static threshold_t *threshold_search_uncached (const value_list_t *vl)
 { /* {{{ */
   threshold_t *th;
 
@@ -114,8 +144,231 @@ threshold_t *threshold_search (const value_list_t *vl)
     return (th);
 
   return (NULL);
+} /* }}} threshold_t *threshold_search_uncached */
+
+static threshold_cache_entry_t *threshold_cache_get ( /* {{{ */
+    const value_list_t *vl, uint32_t hash)
+{
+  threshold_cache_entry_t *e;
+
+  if (threshold_cache_size == 0)
+    return (NULL);
+
+  for (e = threshold_cache[hash & (threshold_cache_size - 1)];
+      e != NULL; e = e->next)
+    if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+      return (e);
+
+  return (NULL);
+} /* }}} threshold_cache_entry_t *threshold_cache_get */
+
+static void threshold_cache_grow (void) /* {{{ */
+{
+  size_t new_size = (threshold_cache_size > 0)
+    ? 2 * threshold_cache_size : 256;
+  threshold_cache_entry_t **new_cache;
+  size_t i;
+
+  new_cache = calloc (new_size, sizeof (*new_cache));
+  if (new_cache == NULL)
+    return;
+
+  for (i = 0; i < threshold_cache_size; i++)
+  {
+    threshold_cache_entry_t *e = threshold_cache[i];
+
+    while (e != NULL)
+    {
+      threshold_cache_entry_t *next = e->next;
+
+      e->next = new_cache[e->id.hash & (new_size - 1)];
+      new_cache[e->id.hash & (new_size - 1)] = e;
+      e = next;
+    }
+  }
+
+  sfree (threshold_cache);
+  threshold_cache = new_cache;
+  threshold_cache_size = new_size;
+} /* }}} void threshold_cache_grow */
+
+static void threshold_cache_insert (const value_list_t *vl, /* {{{ */
+    threshold_t *th)
+{
+  threshold_cache_entry_t *e;
+  size_t bucket;
+
+  if (threshold_cache_num >= threshold_cache_size)
+    threshold_cache_grow ();
+  if (threshold_cache_size == 0)
+    return;
+
+  e = malloc (sizeof (*e));
+  if (e == NULL)
+    return;
+
+  if (identifier_create (&e->id, vl) != 0)
+  {
+    sfree (e);
+    return;
+  }
+  e->th = th;
+
+  bucket = e->id.hash & (threshold_cache_size - 1);
+  e->next = threshold_cache[bucket];
+  threshold_cache[bucket] = e;
+  threshold_cache_num++;
+} /* }}} void threshold_cache_insert */
+
+void threshold_cache_clear (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < threshold_cache_size; i++)
+  {
+    while (threshold_cache[i] != NULL)
+    {
+      threshold_cache_entry_t *e = threshold_cache[i];
+
+      threshold_cache[i] = e->next;
+      identifier_destroy (&e->id);
+      sfree (e);
+    }
+  }
+  threshold_cache_num = 0;
+} /* }}} void threshold_cache_clear */
+
+void threshold_cache_remove (const value_list_t *vl) /* {{{ */
+{
+  threshold_cache_entry_t **prev;
+  uint32_t hash;
+
+  if (threshold_cache_size == 0)
+    return;
+
+  hash = identifier_hash_vl (vl);
+  for (prev = threshold_cache + (hash & (threshold_cache_size - 1));
+      *prev != NULL; prev = &(*prev)->next)
+  {
+    threshold_cache_entry_t *e = *prev;
+
+    if ((e->id.hash != hash) || !identifier_equal_vl (&e->id, vl))
+      continue;
+
+    *prev = e->next;
+    identifier_destroy (&e->id);
+    sfree (e);
+    threshold_cache_num--;
+    return;
+  }
+} /* }}} void threshold_cache_remove */
+
+/*
+ * threshold_t *threshold_search
+ *
+ * Like threshold_search_uncached, but remembers the result for each
+ * identifier, so each identifier is only searched for once.
+ */
+threshold_t *threshold_search (const value_list_t *vl)
+{ /* {{{ */
+  threshold_cache_entry_t *e;
+  threshold_t *th;
+
+  if (threshold_tree == NULL)
+    return (NULL);
+
+  e = threshold_cache_get (vl, identifier_hash_vl (vl));
+  if (e != NULL)
+    return (e->th);
+
+  th = threshold_search_uncached (vl);
+  threshold_cache_insert (vl, th);
+  return (th);
 } /* }}} threshold_t *threshold_search */
 
+threshold_t *threshold_acquire (const value_list_t *vl, /* {{{ */
+    threshold_tree_ref_t **ret_ref)
+{
+  threshold_t *th;
+
+  th = threshold_search (vl);
+  if (th == NULL)
+    return (NULL);
+
+  if (threshold_tree_ref == NULL)
+  {
+    threshold_tree_ref = calloc (1, sizeof (*threshold_tree_ref));
+    if (threshold_tree_ref == NULL)
+    {
+      ERROR ("threshold_acquire: calloc failed.");
+      return (NULL);
+    }
+    threshold_tree_ref->tree = threshold_tree;
+  }
+
+  threshold_tree_ref->users++;
+  *ret_ref = threshold_tree_ref;
+  return (th);
+} /* }}} threshold_t *threshold_acquire */
+
+void threshold_release (threshold_tree_ref_t *ref) /* {{{ */
+{
+  if (ref == NULL)
+    return;
+
+  assert (ref->users > 0);
+  ref->users--;
+
+  /* The tree has been replaced and this was its last user. */
+  if ((ref->users == 0) && (ref != threshold_tree_ref))
+  {
+    threshold_tree_free (ref->tree);
+    sfree (ref);
+  }
+} /* }}} void threshold_release */
+
+void threshold_tree_replace (c_avl_tree_t *tree) /* {{{ */
+{
+  threshold_tree_ref_t *ref = threshold_tree_ref;
+  c_avl_tree_t *old = threshold_tree;
+
+  threshold_tree = tree;
+  threshold_tree_ref = NULL;
+  threshold_cache_clear ();
+
+  if (ref == NULL)
+    threshold_tree_free (old);
+  else if (ref->users == 0)
+  {
+    threshold_tree_free (old);
+    sfree (ref);
+  }
+  /* else: freed by the last threshold_release() */
+} /* }}} void threshold_tree_replace */
+
+void threshold_tree_free (c_avl_tree_t *tree) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (tree == NULL)
+    return;
+
+  while (c_avl_pick (tree, &key, &value) == 0)
+  {
+    threshold_t *th = value;
+
+    while (th != NULL)
+    {
+      threshold_t *next = th->next;
+      sfree (th);
+      th = next;
+    }
+    sfree (key);
+  }
+  c_avl_destroy (tree);
+} /* }}} void threshold_tree_free */
+
 int ut_search_threshold (const value_list_t *vl, /* {{{ */
     threshold_t *ret_threshold)
 {
@@ -124,7 +377,6 @@ int ut_search_threshold (const value_list_t *vl, /* {{{ */
   if (vl == NULL)
     return (EINVAL);
 
-	/* Is this lock really necessary? */
 	pthread_mutex_lock (&threshold_lock);
   t = threshold_search (vl);
   if (t == NULL) {
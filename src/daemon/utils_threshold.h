@@ -57,7 +57,36 @@ threshold_t *threshold_get (const char *hostname,
     const char *plugin, const char *plugin_instance,
     const char *type, const char *type_instance);
 
+/*
+ * Returns the first threshold matching "vl" or NULL. Results are remembered
+ * per identifier; after adding thresholds to "threshold_tree",
+ * threshold_cache_clear() must be called. threshold_cache_remove() forgets
+ * the result for one identifier, e.g. when it is removed from the value
+ * cache. threshold_lock must be held when calling any of these functions.
+ */
 threshold_t *threshold_search (const value_list_t *vl);
+void threshold_cache_clear (void);
+void threshold_cache_remove (const value_list_t *vl);
+
+/*
+ * Like threshold_search(), but the returned thresholds may still be used after
+ * releasing threshold_lock, even if the tree is replaced in the meantime.
+ * Unless NULL is returned, "ret_ref" is set and has to be passed to
+ * threshold_release() once the thresholds are no longer used.
+ * threshold_tree_replace() makes "tree" the new "threshold_tree" and frees
+ * the old tree once its last user has released it. threshold_lock must be
+ * held when calling any of these functions.
+ */
+struct threshold_tree_ref_s;
+typedef struct threshold_tree_ref_s threshold_tree_ref_t;
+
+threshold_t *threshold_acquire (const value_list_t *vl,
+    threshold_tree_ref_t **ret_ref);
+void threshold_release (threshold_tree_ref_t *ref);
+void threshold_tree_replace (c_avl_tree_t *tree);
+
+/* Frees "tree" and all thresholds in it. */
+void threshold_tree_free (c_avl_tree_t *tree);
 
 int ut_search_threshold (const value_list_t *vl,
   threshold_t *ret_threshold);
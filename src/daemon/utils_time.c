@@ -40,6 +40,11 @@ cdtime_t cdtime (void)
 {
   return cdtime_mock;
 }
+
+cdtime_t cdtime_coarse (void)
+{
+  return cdtime_mock;
+}
 #else /* !MOCK_TIME */
 # if HAVE_CLOCK_GETTIME
 cdtime_t cdtime (void) /* {{{ */
@@ -77,6 +82,24 @@ cdtime_t cdtime (void) /* {{{ */
   return (TIMEVAL_TO_CDTIME_T (&tv));
 } /* }}} cdtime_t cdtime */
 # endif
+
+# if HAVE_CLOCK_GETTIME && defined(CLOCK_REALTIME_COARSE)
+cdtime_t cdtime_coarse (void) /* {{{ */
+{
+  struct timespec ts = { 0, 0 };
+
+  /* Not supported by kernels before 2.6.32. */
+  if (clock_gettime (CLOCK_REALTIME_COARSE, &ts) != 0)
+    return (cdtime ());
+
+  return (TIMESPEC_TO_CDTIME_T (&ts));
+} /* }}} cdtime_t cdtime_coarse */
+# else
+cdtime_t cdtime_coarse (void) /* {{{ */
+{
+  return (cdtime ());
+} /* }}} cdtime_t cdtime_coarse */
+# endif
 #endif
 
 /* format_zone reads time zone information from "extern long timezone", exported
@@ -82,6 +82,14 @@ extern cdtime_t cdtime_mock;
 
 cdtime_t cdtime (void);
 
+/* cdtime_coarse returns the current time like cdtime(), but only with the
+ * resolution of the kernel's clock tick (typically one to four milliseconds),
+ * which is much cheaper on Linux. The time may lag behind cdtime(), so only
+ * compare it with other coarse times: subtracting a precise time taken
+ * shortly before may wrap around. Falls back to cdtime() where no coarse
+ * clock is available. */
+cdtime_t cdtime_coarse (void);
+
 #define RFC3339_SIZE     26
 #define RFC3339NANO_SIZE 36
 
@@ -0,0 +1,86 @@
+/**
+ * collectd - src/daemon/utils_time_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Compares the cost of cdtime() with cdtime_coarse() and reports how far the
+ * coarse clock lags behind the precise one.
+ *
+ * Usage: bench_utils_time [calls]
+ */
+
+#include "collectd.h"
+#include "utils_time.h"
+
+#include <time.h>
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t calls_num = 10000000;
+  volatile cdtime_t sink = 0;
+  cdtime_t lag_max = 0;
+  double start;
+  size_t i;
+
+  if (argc > 1)
+    calls_num = (size_t) atoi (argv[1]);
+  if (calls_num < 1)
+  {
+    fprintf (stderr, "Usage: %s [calls]\n", argv[0]);
+    return (1);
+  }
+
+  start = now ();
+  for (i = 0; i < calls_num; i++)
+    sink = cdtime ();
+  printf ("%-14s %7.1f ns\n", "cdtime",
+      1e9 * (now () - start) / (double) calls_num);
+
+  start = now ();
+  for (i = 0; i < calls_num; i++)
+    sink = cdtime_coarse ();
+  printf ("%-14s %7.1f ns\n", "cdtime_coarse",
+      1e9 * (now () - start) / (double) calls_num);
+
+  for (i = 0; i < 1000; i++)
+  {
+    cdtime_t precise = cdtime ();
+    cdtime_t coarse = cdtime_coarse ();
+
+    if ((precise > coarse) && ((precise - coarse) > lag_max))
+      lag_max = precise - coarse;
+  }
+  printf ("%-14s %7.3f ms\n", "max. lag", 1e3 * CDTIME_T_TO_DOUBLE (lag_max));
+
+  (void) sink;
+  return (0);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
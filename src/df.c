@@ -28,6 +28,12 @@
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
 
+#include <pthread.h>
+#if KERNEL_LINUX
+# include <fcntl.h>
+# include <poll.h>
+#endif
+
 #if HAVE_STATVFS
 # if HAVE_SYS_STATVFS_H
 #  include <sys/statvfs.h>
@@ -46,6 +52,12 @@
 # error "No applicable input method."
 #endif
 
+#if HAVE_STATVFS
+typedef struct statvfs df_statbuf_t;
+#elif HAVE_STATFS
+typedef struct statfs df_statbuf_t;
+#endif
+
 static const char *config_keys[] =
 {
 	"Device",
@@ -55,7 +67,9 @@ static const char *config_keys[] =
 	"ReportByDevice",
 	"ReportInodes",
 	"ValuesAbsolute",
-	"ValuesPercentage"
+	"ValuesPercentage",
+	"Timeout",
+	"Threads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -68,6 +82,64 @@ static _Bool report_inodes = 0;
 static _Bool values_absolute = 1;
 static _Bool values_percentage = 0;
 
+/*
+ * The mount points are stat'ed by a small pool of threads, so that a hung
+ * file system, such as an unreachable NFS server, doesn't block the read
+ * callback. A mount point whose call takes longer than `df_timeout' is marked
+ * stale and skipped until the call returns.
+ */
+#define DF_IDLE    0
+#define DF_QUEUED  1
+#define DF_RUNNING 2
+#define DF_DONE    3
+
+typedef struct df_mount_s df_mount_t;
+struct df_mount_s
+{
+	char *dir;
+	char *dev;
+	char disk_name[256];
+
+	/* Protected by df_lock */
+	int state;
+	_Bool stale;
+	_Bool cancel;
+	/* Set when the mount point went away while its call was running; the
+	 * thread frees the entry when the call returns. */
+	_Bool orphan;
+	cdtime_t started;
+	int status;
+	df_statbuf_t statbuf;
+	df_mount_t *next_job;
+
+	df_mount_t *next;
+};
+
+typedef struct df_worker_s
+{
+	pthread_t thread;
+	_Bool running;
+	df_mount_t *job;
+} df_worker_t;
+
+static cdtime_t df_timeout = 0;
+static int df_threads_num = 4;
+
+static pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t df_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t df_done_cond = PTHREAD_COND_INITIALIZER;
+static df_mount_t *df_queue_head = NULL;
+static df_mount_t *df_queue_tail = NULL;
+static df_worker_t *df_workers = NULL;
+static _Bool df_shutdown_flag = 0;
+
+/* The filtered mount table, only read again when it has changed. */
+static df_mount_t *df_mounts = NULL;
+static _Bool df_mounts_valid = 0;
+#if KERNEL_LINUX
+static int df_mounts_fd = -1;
+#endif
+
 static int df_init (void)
 {
 	if (il_device == NULL)
@@ -152,6 +224,28 @@ static int df_config (const char *key, const char *value)
 
 		return (0);
 	}
+	else if (strcasecmp (key, "Timeout") == 0)
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			ERROR ("df plugin: Timeout must be a positive number.");
+			return (1);
+		}
+		df_timeout = DOUBLE_TO_CDTIME_T (tmp);
+		return (0);
+	}
+	else if (strcasecmp (key, "Threads") == 0)
+	{
+		int tmp = atoi (value);
+		if ((tmp < 1) || (tmp > 64))
+		{
+			ERROR ("df plugin: Threads must be between 1 and 64.");
+			return (1);
+		}
+		df_threads_num = tmp;
+		return (0);
+	}
 
 	return (-1);
 }
@@ -181,32 +275,91 @@ static void df_submit_one (char *plugin_instance,
 	plugin_dispatch_values (&vl);
 } /* void df_submit_one */
 
-static int df_read (void)
+static void df_mount_free (df_mount_t *m) /* {{{ */
 {
-#if HAVE_STATVFS
-	struct statvfs statbuf;
-#elif HAVE_STATFS
-	struct statfs statbuf;
+	if (m == NULL)
+		return;
+
+	sfree (m->dir);
+	sfree (m->dev);
+	sfree (m);
+} /* }}} void df_mount_free */
+
+/* Frees the filtered mount table. Entries whose call is still running are
+ * left to their thread. Must be called with df_lock held. */
+static void df_mounts_free (df_mount_t *list) /* {{{ */
+{
+	while (list != NULL)
+	{
+		df_mount_t *next = list->next;
+
+		if (list->state == DF_RUNNING)
+			list->orphan = 1;
+		else if (list->state == DF_QUEUED)
+		{
+			/* Dropped by the thread taking it off the queue. */
+			list->cancel = 1;
+			list->orphan = 1;
+		}
+		else
+			df_mount_free (list);
+
+		list = next;
+	}
+} /* }}} void df_mounts_free */
+
+/* Returns true if the mount table has to be read again. On Linux, the
+ * kernel signals changes of the mount table by POLLPRI on
+ * /proc/self/mounts, elsewhere it is read every time. */
+static _Bool df_mounts_changed (void) /* {{{ */
+{
+#if KERNEL_LINUX
+	struct pollfd pfd;
+
+	if (df_mounts_fd < 0)
+	{
+		df_mounts_fd = open ("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+		return (1);
+	}
+
+	pfd.fd = df_mounts_fd;
+	pfd.events = POLLPRI;
+	pfd.revents = 0;
+	if (poll (&pfd, 1, /* timeout = */ 0) < 0)
+		return (1);
+
+	return ((pfd.revents & (POLLPRI | POLLERR | POLLNVAL)) != 0);
+#else
+	return (1);
 #endif
-	/* struct STATANYFS statbuf; */
-	cu_mount_t *mnt_list;
+} /* }}} _Bool df_mounts_changed */
+
+/* Reads the mount table and applies the ignore lists. Entries of mount points
+ * which are still mounted are kept, so a stale mount point stays stale. */
+static int df_mounts_refresh (void) /* {{{ */
+{
+	cu_mount_t *mnt_list = NULL;
 	cu_mount_t *mnt_ptr;
+	df_mount_t *old_list;
+	df_mount_t *new_list = NULL;
+	df_mount_t *new_tail = NULL;
 
-	mnt_list = NULL;
 	if (cu_mount_getlist (&mnt_list) == NULL)
 	{
 		ERROR ("df plugin: cu_mount_getlist failed.");
 		return (-1);
 	}
 
+	pthread_mutex_lock (&df_lock);
+	old_list = df_mounts;
+	df_mounts = NULL;
+
 	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
 	{
-		unsigned long long blocksize;
 		char disk_name[256];
 		cu_mount_t *dup_ptr;
-		uint64_t blk_free;
-		uint64_t blk_reserved;
-		uint64_t blk_used;
+		df_mount_t *m;
+		df_mount_t **prev;
 
 		char const *dev = (mnt_ptr->spec_device != NULL)
 			? mnt_ptr->spec_device
@@ -222,6 +375,8 @@ static int df_read (void)
 		/* search for duplicates *in front of* the current mnt_ptr. */
 		for (dup_ptr = mnt_list; dup_ptr != NULL; dup_ptr = dup_ptr->next)
 		{
+			char const *dup_dev;
+
 			/* No duplicate found: mnt_ptr is the first of its kind. */
 			if (dup_ptr == mnt_ptr)
 			{
@@ -229,8 +384,12 @@ static int df_read (void)
 				break;
 			}
 
+			dup_dev = (dup_ptr->spec_device != NULL)
+				? dup_ptr->spec_device
+				: dup_ptr->device;
+
 			/* Duplicate found: leave non-NULL dup_ptr. */
-			if (by_device && (strcmp (mnt_ptr->spec_device, dup_ptr->spec_device) == 0))
+			if (by_device && (strcmp (dev, dup_dev) == 0))
 				break;
 			else if (!by_device && (strcmp (mnt_ptr->dir, dup_ptr->dir) == 0))
 				break;
@@ -240,19 +399,6 @@ static int df_read (void)
 		if (dup_ptr != NULL)
 			continue;
 
-		if (STATANYFS (mnt_ptr->dir, &statbuf) < 0)
-		{
-			char errbuf[1024];
-			ERROR (STATANYFS_STR"(%s) failed: %s",
-					mnt_ptr->dir,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			continue;
-		}
-
-		if (!statbuf.f_blocks)
-			continue;
-
 		if (by_device)
 		{
 			/* eg, /dev/hda1  -- strip off the "/dev/" */
@@ -284,110 +430,432 @@ static int df_read (void)
 			}
 		}
 
-		blocksize = BLOCKSIZE(statbuf);
+		/* Keep the entry of a known mount point. */
+		for (prev = &old_list; *prev != NULL; prev = &(*prev)->next)
+			if ((strcmp ((*prev)->dir, mnt_ptr->dir) == 0)
+					&& (strcmp ((*prev)->dev, dev) == 0))
+				break;
 
-		/*
-		 * Sanity-check for the values in the struct
-		 */
-		/* Check for negative "available" byes. For example UFS can
-		 * report negative free space for user. Notice. blk_reserved
-		 * will start to diminish after this. */
-#if HAVE_STATVFS
-		/* Cast and temporary variable are needed to avoid
-		 * compiler warnings.
-		 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
-		int64_t signed_bavail = (int64_t) statbuf.f_bavail;
-		if (signed_bavail < 0)
-			statbuf.f_bavail = 0;
-#elif HAVE_STATFS
-		if (statbuf.f_bavail < 0)
-			statbuf.f_bavail = 0;
-#endif
-		/* Make sure that f_blocks >= f_bfree >= f_bavail */
-		if (statbuf.f_bfree < statbuf.f_bavail)
-			statbuf.f_bfree = statbuf.f_bavail;
-		if (statbuf.f_blocks < statbuf.f_bfree)
-			statbuf.f_blocks = statbuf.f_bfree;
+		m = *prev;
+		if (m != NULL)
+		{
+			*prev = m->next;
+		}
+		else
+		{
+			m = calloc (1, sizeof (*m));
+			if (m == NULL)
+				continue;
+			m->dir = strdup (mnt_ptr->dir);
+			m->dev = strdup (dev);
+			if ((m->dir == NULL) || (m->dev == NULL))
+			{
+				df_mount_free (m);
+				continue;
+			}
+		}
+		sstrncpy (m->disk_name, disk_name, sizeof (m->disk_name));
+		m->next = NULL;
 
-		blk_free     = (uint64_t) statbuf.f_bavail;
-		blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
-		blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
+		if (new_tail == NULL)
+			new_list = m;
+		else
+			new_tail->next = m;
+		new_tail = m;
+	}
 
-		if (values_absolute)
+	df_mounts_free (old_list);
+	df_mounts = new_list;
+	pthread_mutex_unlock (&df_lock);
+
+	cu_mount_freelist (mnt_list);
+	df_mounts_valid = 1;
+
+	return (0);
+} /* }}} int df_mounts_refresh */
+
+static void *df_worker (void *arg) /* {{{ */
+{
+	df_worker_t *w = arg;
+
+	pthread_mutex_lock (&df_lock);
+	while (!df_shutdown_flag)
+	{
+		df_mount_t *m;
+		df_statbuf_t statbuf;
+		int status;
+
+		if (df_queue_head == NULL)
 		{
-			df_submit_one (disk_name, "df_complex", "free",
-				(gauge_t) (blk_free * blocksize));
-			df_submit_one (disk_name, "df_complex", "reserved",
-				(gauge_t) (blk_reserved * blocksize));
-			df_submit_one (disk_name, "df_complex", "used",
-				(gauge_t) (blk_used * blocksize));
+			pthread_cond_wait (&df_job_cond, &df_lock);
+			continue;
 		}
 
-		if (values_percentage)
+		m = df_queue_head;
+		df_queue_head = m->next_job;
+		if (df_queue_head == NULL)
+			df_queue_tail = NULL;
+		m->next_job = NULL;
+
+		if (m->cancel)
 		{
-			if (statbuf.f_blocks > 0)
-				{
-				df_submit_one (disk_name, "percent_bytes", "free",
-					(gauge_t) ((float_t)(blk_free) / statbuf.f_blocks * 100));
-				df_submit_one (disk_name, "percent_bytes", "reserved",
-					(gauge_t) ((float_t)(blk_reserved) / statbuf.f_blocks * 100));
-				df_submit_one (disk_name, "percent_bytes", "used",
-					(gauge_t) ((float_t)(blk_used) / statbuf.f_blocks * 100));
-				}
-			else return (-1);
+			m->cancel = 0;
+			m->state = DF_IDLE;
+			if (m->orphan)
+				df_mount_free (m);
+			pthread_cond_broadcast (&df_done_cond);
+			continue;
+		}
+
+		m->state = DF_RUNNING;
+		m->started = cdtime ();
+		w->job = m;
+		pthread_mutex_unlock (&df_lock);
+
+		status = STATANYFS (m->dir, &statbuf);
+		if (status != 0)
+			status = errno;
+
+		pthread_mutex_lock (&df_lock);
+		w->job = NULL;
+		if (m->orphan)
+		{
+			df_mount_free (m);
+			continue;
+		}
+
+		if (m->stale)
+		{
+			INFO ("df plugin: %s responds again.", m->dir);
+			m->stale = 0;
 		}
+		m->status = status;
+		m->statbuf = statbuf;
+		m->state = DF_DONE;
+		pthread_cond_broadcast (&df_done_cond);
+	}
+	pthread_mutex_unlock (&df_lock);
+
+	return (NULL);
+} /* }}} void *df_worker */
+
+static int df_workers_start (void) /* {{{ */
+{
+	int i;
 
-		/* inode handling */
-		if (report_inodes && statbuf.f_files != 0 && statbuf.f_ffree != 0)
+	df_workers = calloc ((size_t) df_threads_num, sizeof (*df_workers));
+	if (df_workers == NULL)
+	{
+		ERROR ("df plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < df_threads_num; i++)
+	{
+		int status = plugin_thread_create (&df_workers[i].thread, NULL,
+				df_worker, &df_workers[i]);
+		if (status != 0)
 		{
-			uint64_t inode_free;
-			uint64_t inode_reserved;
-			uint64_t inode_used;
+			char errbuf[1024];
+			ERROR ("df plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+		df_workers[i].running = 1;
+	}
 
-			/* Sanity-check for the values in the struct */
-			if (statbuf.f_ffree < statbuf.f_favail)
-				statbuf.f_ffree = statbuf.f_favail;
-			if (statbuf.f_files < statbuf.f_ffree)
-				statbuf.f_files = statbuf.f_ffree;
+	if (i == 0)
+	{
+		sfree (df_workers);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int df_workers_start */
+
+/* Hands all mount points which are not stale to the threads and waits until
+ * their calls returned or timed out. Returns the number of mount points that
+ * have a result. */
+static int df_stat_all (void) /* {{{ */
+{
+	cdtime_t timeout = (df_timeout != 0) ? df_timeout : plugin_get_interval () / 2;
+	cdtime_t start = cdtime ();
+	df_mount_t *m;
+	int done = 0;
 
-			inode_free = (uint64_t) statbuf.f_favail;
-			inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
-			inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
+	pthread_mutex_lock (&df_lock);
+	for (m = df_mounts; m != NULL; m = m->next)
+	{
+		/* The call of the last interval is still running. */
+		if ((m->state == DF_RUNNING) || (m->state == DF_QUEUED))
+			continue;
+
+		m->state = DF_QUEUED;
+		m->cancel = 0;
+		if (df_queue_tail == NULL)
+			df_queue_head = m;
+		else
+			df_queue_tail->next_job = m;
+		df_queue_tail = m;
+	}
+	pthread_cond_broadcast (&df_job_cond);
 
-			if (values_percentage)
+	while (42)
+	{
+		cdtime_t now = cdtime ();
+		cdtime_t wakeup = now + timeout;
+		struct timespec ts;
+		_Bool waiting = 0;
+
+		for (m = df_mounts; m != NULL; m = m->next)
+		{
+			if ((m->state == DF_RUNNING) && !m->stale)
 			{
-				if (statbuf.f_files > 0)
+				if ((now - m->started) >= timeout)
 				{
-					df_submit_one (disk_name, "percent_inodes", "free",
-						(gauge_t) ((float_t)(inode_free) / statbuf.f_files * 100));
-					df_submit_one (disk_name, "percent_inodes", "reserved",
-						(gauge_t) ((float_t)(inode_reserved) / statbuf.f_files * 100));
-					df_submit_one (disk_name, "percent_inodes", "used",
-						(gauge_t) ((float_t)(inode_used) / statbuf.f_files * 100));
+					WARNING ("df plugin: " STATANYFS_STR "(%s) didn't return "
+							"within %.3f seconds. Marking the mount point "
+							"stale.", m->dir, CDTIME_T_TO_DOUBLE (timeout));
+					m->stale = 1;
+					continue;
 				}
-				else return (-1);
+				waiting = 1;
+				if (wakeup > m->started + timeout)
+					wakeup = m->started + timeout;
 			}
-			if (values_absolute)
+			else if ((m->state == DF_QUEUED) && !m->cancel)
 			{
-				df_submit_one (disk_name, "df_inodes", "free",
-						(gauge_t) inode_free);
-				df_submit_one (disk_name, "df_inodes", "reserved",
-						(gauge_t) inode_reserved);
-				df_submit_one (disk_name, "df_inodes", "used",
-						(gauge_t) inode_used);
+				/* All threads are busy: give up on this one for now. */
+				if ((now - start) >= timeout)
+				{
+					m->cancel = 1;
+					continue;
+				}
+				waiting = 1;
+				if (wakeup > start + timeout)
+					wakeup = start + timeout;
 			}
 		}
+
+		if (!waiting)
+			break;
+
+		CDTIME_T_TO_TIMESPEC (wakeup, &ts);
+		pthread_cond_timedwait (&df_done_cond, &df_lock, &ts);
 	}
 
-	cu_mount_freelist (mnt_list);
+	for (m = df_mounts; m != NULL; m = m->next)
+		if (m->state == DF_DONE)
+			done++;
+	pthread_mutex_unlock (&df_lock);
+
+	return (done);
+} /* }}} int df_stat_all */
+
+static void df_submit_mount (df_mount_t *m) /* {{{ */
+{
+	df_statbuf_t statbuf;
+	unsigned long long blocksize;
+	char *disk_name = m->disk_name;
+	uint64_t blk_free;
+	uint64_t blk_reserved;
+	uint64_t blk_used;
+
+	if (m->status != 0)
+	{
+		char errbuf[1024];
+		ERROR (STATANYFS_STR"(%s) failed: %s",
+				m->dir,
+				sstrerror (m->status, errbuf,
+					sizeof (errbuf)));
+		return;
+	}
+
+	statbuf = m->statbuf;
+	if (!statbuf.f_blocks)
+		return;
+
+	blocksize = BLOCKSIZE(statbuf);
+
+	/*
+	 * Sanity-check for the values in the struct
+	 */
+	/* Check for negative "available" byes. For example UFS can
+	 * report negative free space for user. Notice. blk_reserved
+	 * will start to diminish after this. */
+#if HAVE_STATVFS
+	/* Cast and temporary variable are needed to avoid
+	 * compiler warnings.
+	 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
+	int64_t signed_bavail = (int64_t) statbuf.f_bavail;
+	if (signed_bavail < 0)
+		statbuf.f_bavail = 0;
+#elif HAVE_STATFS
+	if (statbuf.f_bavail < 0)
+		statbuf.f_bavail = 0;
+#endif
+	/* Make sure that f_blocks >= f_bfree >= f_bavail */
+	if (statbuf.f_bfree < statbuf.f_bavail)
+		statbuf.f_bfree = statbuf.f_bavail;
+	if (statbuf.f_blocks < statbuf.f_bfree)
+		statbuf.f_blocks = statbuf.f_bfree;
+
+	blk_free     = (uint64_t) statbuf.f_bavail;
+	blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
+	blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
+
+	if (values_absolute)
+	{
+		df_submit_one (disk_name, "df_complex", "free",
+			(gauge_t) (blk_free * blocksize));
+		df_submit_one (disk_name, "df_complex", "reserved",
+			(gauge_t) (blk_reserved * blocksize));
+		df_submit_one (disk_name, "df_complex", "used",
+			(gauge_t) (blk_used * blocksize));
+	}
+
+	if (values_percentage)
+	{
+		df_submit_one (disk_name, "percent_bytes", "free",
+			(gauge_t) ((float_t)(blk_free) / statbuf.f_blocks * 100));
+		df_submit_one (disk_name, "percent_bytes", "reserved",
+			(gauge_t) ((float_t)(blk_reserved) / statbuf.f_blocks * 100));
+		df_submit_one (disk_name, "percent_bytes", "used",
+			(gauge_t) ((float_t)(blk_used) / statbuf.f_blocks * 100));
+	}
+
+	/* inode handling */
+	if (report_inodes && statbuf.f_files != 0 && statbuf.f_ffree != 0)
+	{
+		uint64_t inode_free;
+		uint64_t inode_reserved;
+		uint64_t inode_used;
+
+		/* Sanity-check for the values in the struct */
+		if (statbuf.f_ffree < statbuf.f_favail)
+			statbuf.f_ffree = statbuf.f_favail;
+		if (statbuf.f_files < statbuf.f_ffree)
+			statbuf.f_files = statbuf.f_ffree;
+
+		inode_free = (uint64_t) statbuf.f_favail;
+		inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
+		inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
+
+		if (values_percentage)
+		{
+			df_submit_one (disk_name, "percent_inodes", "free",
+				(gauge_t) ((float_t)(inode_free) / statbuf.f_files * 100));
+			df_submit_one (disk_name, "percent_inodes", "reserved",
+				(gauge_t) ((float_t)(inode_reserved) / statbuf.f_files * 100));
+			df_submit_one (disk_name, "percent_inodes", "used",
+				(gauge_t) ((float_t)(inode_used) / statbuf.f_files * 100));
+		}
+		if (values_absolute)
+		{
+			df_submit_one (disk_name, "df_inodes", "free",
+					(gauge_t) inode_free);
+			df_submit_one (disk_name, "df_inodes", "reserved",
+					(gauge_t) inode_reserved);
+			df_submit_one (disk_name, "df_inodes", "used",
+					(gauge_t) inode_used);
+		}
+	}
+} /* }}} void df_submit_mount */
+
+static int df_read (void)
+{
+	df_mount_t *m;
+
+	if (df_workers == NULL)
+	{
+		if (df_workers_start () != 0)
+			return (-1);
+	}
+
+	if (!df_mounts_valid || df_mounts_changed ())
+	{
+		if (df_mounts_refresh () != 0)
+			return (-1);
+	}
+
+	if (df_stat_all () == 0)
+		return (0);
+
+	/* The entries are only changed by this callback and by the threads
+	 * working on them, so the results can be submitted without the lock. */
+	for (m = df_mounts; m != NULL; m = m->next)
+	{
+		if (m->state != DF_DONE)
+			continue;
+
+		df_submit_mount (m);
+		m->state = DF_IDLE;
+	}
 
 	return (0);
 } /* int df_read */
 
+static int df_shutdown (void) /* {{{ */
+{
+	_Bool detached = 0;
+	df_mount_t *m;
+	int i;
+
+	if (df_workers != NULL)
+	{
+		pthread_mutex_lock (&df_lock);
+		df_shutdown_flag = 1;
+		pthread_cond_broadcast (&df_job_cond);
+		pthread_mutex_unlock (&df_lock);
+
+		for (i = 0; i < df_threads_num; i++)
+		{
+			_Bool busy;
+
+			if (!df_workers[i].running)
+				continue;
+
+			pthread_mutex_lock (&df_lock);
+			busy = (df_workers[i].job != NULL);
+			pthread_mutex_unlock (&df_lock);
+
+			/* Don't wait for a hung file system. */
+			if (busy)
+			{
+				pthread_detach (df_workers[i].thread);
+				detached = 1;
+			}
+			else
+				pthread_join (df_workers[i].thread, NULL);
+		}
+	}
+
+	pthread_mutex_lock (&df_lock);
+	for (m = df_queue_head; m != NULL; m = m->next_job)
+		m->state = DF_IDLE;
+	df_queue_head = df_queue_tail = NULL;
+	df_mounts_free (df_mounts);
+	df_mounts = NULL;
+	pthread_mutex_unlock (&df_lock);
+
+	/* Detached threads still refer to their worker. */
+	if (!detached)
+		sfree (df_workers);
+
+#if KERNEL_LINUX
+	if (df_mounts_fd >= 0)
+		close (df_mounts_fd);
+	df_mounts_fd = -1;
+#endif
+
+	return (0);
+} /* }}} int df_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("df", df_config,
 			config_keys, config_keys_num);
 	plugin_register_init ("df", df_init);
 	plugin_register_read ("df", df_read);
+	plugin_register_shutdown ("df", df_shutdown);
 } /* void module_register */
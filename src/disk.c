@@ -25,6 +25,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
 
 #if HAVE_MACH_MACH_TYPES_H
 #  include <mach/mach_types.h>
@@ -647,7 +648,8 @@ static int disk_read (void)
 	geom_stats_snapshot_free(snap);
 
 #elif KERNEL_LINUX
-	FILE *fh;
+	procfs_snapshot_t *snap;
+	size_t offset = 0;
 	char buffer[1024];
 
 	char *fields[32];
@@ -672,12 +674,12 @@ static int disk_read (void)
 
 	diskstats_t *ds, *pre_ds;
 
-	if ((fh = fopen ("/proc/diskstats", "r")) == NULL)
+	if ((snap = procfs_snapshot_get ("/proc/diskstats")) == NULL)
 	{
-		fh = fopen ("/proc/partitions", "r");
-		if (fh == NULL)
+		snap = procfs_snapshot_get ("/proc/partitions");
+		if (snap == NULL)
 		{
-			ERROR ("disk plugin: fopen (/proc/{diskstats,partitions}) failed.");
+			ERROR ("disk plugin: Reading /proc/{diskstats,partitions} failed.");
 			return (-1);
 		}
 
@@ -689,7 +691,7 @@ static int disk_read (void)
 	handle_udev = udev_new();
 #endif
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while (procfs_getline (snap, &offset, buffer, sizeof (buffer)) != NULL)
 	{
 		char *disk_name;
 		char *output_name;
@@ -881,13 +883,13 @@ static int disk_read (void)
 		/* release udev-based alternate name, if allocated */
 		sfree (alt_name);
 #endif
-	} /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
+	} /* while (procfs_getline (snap, &offset, buffer, sizeof (buffer))) */
 
 #if HAVE_LIBUDEV
 	udev_unref(handle_udev);
 #endif
 
-	fclose (fh);
+	procfs_snapshot_put (snap);
 /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
@@ -35,6 +35,23 @@
 
 #include <pcap.h>
 
+/* The ring capture needs the block based TPACKET_V3 ring of Linux 3.2. */
+#if KERNEL_LINUX && HAVE_LINUX_IF_PACKET_H && HAVE_LINUX_FILTER_H
+# include <sys/mman.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# include <net/if.h>
+# include <linux/if_ether.h>
+# include <linux/if_packet.h>
+# include <linux/filter.h>
+# ifdef TPACKET3_HDRLEN
+#  define DNS_HAVE_RING 1
+# endif
+#endif
+#ifndef DNS_HAVE_RING
+# define DNS_HAVE_RING 0
+#endif
+
 /*
  * Private data types
  */
@@ -53,7 +70,9 @@ static const char *config_keys[] =
 {
 	"Interface",
 	"IgnoreSource",
-	"SelectNumericQueryTypes"
+	"SelectNumericQueryTypes",
+	"RingCapture",
+	"CaptureThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 static int select_numeric_qtype = 1;
@@ -75,6 +94,44 @@ static pthread_mutex_t qtype_mutex   = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t opcode_mutex  = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t rcode_mutex   = PTHREAD_MUTEX_INITIALIZER;
 
+static _Bool ring_capture = 0;
+static int   capture_threads = 1;
+
+#if DNS_HAVE_RING
+/* Size and number of the blocks of each ring. A block is handed to the
+ * capture thread when it is full or, at the latest, after DNS_RING_TIMEOUT
+ * milliseconds. */
+# define DNS_RING_BLOCK_SIZE (1 << 20)
+# define DNS_RING_BLOCK_NR   8
+# define DNS_RING_FRAME_SIZE 2048
+# define DNS_RING_TIMEOUT    100
+
+/* A capture thread with its own ring and counters. The counters are folded
+ * into the global ones by the read callback, so that the threads don't
+ * contend for the global locks. */
+struct dns_ring_s
+{
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	pthread_t thread;
+	_Bool thread_running;
+
+	pthread_mutex_t lock;
+	derive_t tr_queries;
+	derive_t tr_responses;
+	counter_list_t *qtype_list;
+	counter_list_t *opcode_list;
+	counter_list_t *rcode_list;
+};
+typedef struct dns_ring_s dns_ring_t;
+
+static dns_ring_t    *rings = NULL;
+static int            rings_num = 0;
+static _Bool          rings_shutdown = 0;
+static pthread_key_t  ring_key;
+#endif /* DNS_HAVE_RING */
+
 /*
  * Private functions
  */
@@ -157,6 +214,28 @@ static int dns_config (const char *key, const char *value)
 		else
 			select_numeric_qtype = 1;
 	}
+	else if (strcasecmp (key, "RingCapture") == 0)
+	{
+		ring_capture = IS_TRUE (value) ? 1 : 0;
+#if !DNS_HAVE_RING
+		if (ring_capture)
+		{
+			WARNING ("dns plugin: RingCapture is only available on "
+					"Linux. Using libpcap instead.");
+			ring_capture = 0;
+		}
+#endif
+	}
+	else if (strcasecmp (key, "CaptureThreads") == 0)
+	{
+		int tmp = atoi (value);
+		if ((tmp < 1) || (tmp > 64))
+		{
+			ERROR ("dns plugin: CaptureThreads must be between 1 and 64.");
+			return (1);
+		}
+		capture_threads = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -165,19 +244,56 @@ static int dns_config (const char *key, const char *value)
 	return (0);
 }
 
+#if DNS_HAVE_RING
+/* Counts a message in the counters of a capture thread. */
+static void dns_ring_count (dns_ring_t *r, const rfc1035_header_t *dns,
+		int skip)
+{
+	pthread_mutex_lock (&r->lock);
+	if (dns->qr == 0)
+	{
+		r->tr_queries += dns->length;
+		if (skip == 0)
+			counter_list_add (&r->qtype_list, dns->qtype, 1);
+	}
+	else
+	{
+		r->tr_responses += dns->length;
+		counter_list_add (&r->rcode_list, dns->rcode, 1);
+	}
+	counter_list_add (&r->opcode_list, dns->opcode, 1);
+	pthread_mutex_unlock (&r->lock);
+}
+#endif /* DNS_HAVE_RING */
+
 static void dns_child_callback (const rfc1035_header_t *dns)
 {
+	int skip = 0;
+#if DNS_HAVE_RING
+	dns_ring_t *r;
+#endif
+
+	if ((dns->qr == 0) && !select_numeric_qtype)
+	{
+		const char *str = qtype_str(dns->qtype);
+		if ((str == NULL) || (str[0] == '#'))
+			skip = 1;
+	}
+
+#if DNS_HAVE_RING
+	/* Capture threads count into their own counters. */
+	r = (ring_capture && (rings_num > 0))
+		? pthread_getspecific (ring_key) : NULL;
+	if (r != NULL)
+	{
+		dns_ring_count (r, dns, skip);
+		return;
+	}
+#endif
+
 	if (dns->qr == 0)
 	{
 		/* This is a query */
-		int skip = 0;
-		if (!select_numeric_qtype)
-		{
-			const char *str = qtype_str(dns->qtype);
-			if ((str == NULL) || (str[0] == '#'))
-				skip = 1;
-		}
-
 		pthread_mutex_lock (&traffic_mutex);
 		tr_queries += dns->length;
 		pthread_mutex_unlock (&traffic_mutex);
@@ -274,6 +390,336 @@ static int dns_run_pcap_loop (void)
 	return (status);
 } /* int dns_run_pcap_loop */
 
+#if DNS_HAVE_RING
+/* Accepts UDP packets from or to port 53. The socket delivers packets
+ * without the link layer header, so the filter starts at the IP header.
+ * IPv4 fragments other than the first one and IPv6 packets with extension
+ * headers are dropped. Accepted packets are truncated to PCAP_SNAPLEN. */
+static struct sock_filter dns_ring_filter[] =
+{
+	/*  0 */ BPF_STMT (BPF_LD  | BPF_B   | BPF_ABS, 0),
+	/*  1 */ BPF_STMT (BPF_ALU | BPF_RSH | BPF_K,   4),
+	/*  2 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   4, 0, 9),
+	/* IPv4 */
+	/*  3 */ BPF_STMT (BPF_LD  | BPF_B   | BPF_ABS, 9),
+	/*  4 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_UDP, 0, 15),
+	/*  5 */ BPF_STMT (BPF_LD  | BPF_H   | BPF_ABS, 6),
+	/*  6 */ BPF_JUMP (BPF_JMP | BPF_JSET | BPF_K,  0x1fff, 13, 0),
+	/*  7 */ BPF_STMT (BPF_LDX | BPF_B   | BPF_MSH, 0),
+	/*  8 */ BPF_STMT (BPF_LD  | BPF_H   | BPF_IND, 0),
+	/*  9 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 9, 0),
+	/* 10 */ BPF_STMT (BPF_LD  | BPF_H   | BPF_IND, 2),
+	/* 11 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 7, 8),
+	/* IPv6 */
+	/* 12 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   6, 0, 7),
+	/* 13 */ BPF_STMT (BPF_LD  | BPF_B   | BPF_ABS, 6),
+	/* 14 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_UDP, 0, 5),
+	/* 15 */ BPF_STMT (BPF_LD  | BPF_H   | BPF_ABS, 40),
+	/* 16 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 2, 0),
+	/* 17 */ BPF_STMT (BPF_LD  | BPF_H   | BPF_ABS, 42),
+	/* 18 */ BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K,   53, 0, 1),
+	/* 19 */ BPF_STMT (BPF_RET | BPF_K, PCAP_SNAPLEN),
+	/* 20 */ BPF_STMT (BPF_RET | BPF_K, 0)
+};
+
+static void dns_ring_close (dns_ring_t *r) /* {{{ */
+{
+	counter_list_t *lists[3];
+	size_t i;
+
+	if (r->map != NULL)
+		munmap (r->map, r->map_size);
+	r->map = NULL;
+	if (r->fd >= 0)
+		close (r->fd);
+	r->fd = -1;
+
+	lists[0] = r->qtype_list;
+	lists[1] = r->opcode_list;
+	lists[2] = r->rcode_list;
+	for (i = 0; i < STATIC_ARRAY_SIZE (lists); i++)
+	{
+		while (lists[i] != NULL)
+		{
+			counter_list_t *next = lists[i]->next;
+			sfree (lists[i]);
+			lists[i] = next;
+		}
+	}
+	r->qtype_list = r->opcode_list = r->rcode_list = NULL;
+
+	pthread_mutex_destroy (&r->lock);
+} /* }}} void dns_ring_close */
+
+/* Sets up the socket and ring of one capture thread. All sockets join the
+ * same fanout group, which distributes the packets between them by flow. */
+static int dns_ring_open (dns_ring_t *r, int fanout_id) /* {{{ */
+{
+	struct sock_fprog prog;
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V3;
+	int fanout;
+	char errbuf[1024];
+
+	memset (r, 0, sizeof (*r));
+	pthread_mutex_init (&r->lock, /* attr = */ NULL);
+
+	r->fd = socket (AF_PACKET, SOCK_DGRAM, htons (ETH_P_ALL));
+	if (r->fd < 0)
+	{
+		ERROR ("dns plugin: socket (AF_PACKET) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (r);
+		return (-1);
+	}
+
+	/* Attach the filter first, so that no other packets end up in the
+	 * ring. */
+	prog.len = STATIC_ARRAY_SIZE (dns_ring_filter);
+	prog.filter = dns_ring_filter;
+	if (setsockopt (r->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+				&prog, sizeof (prog)) != 0)
+	{
+		ERROR ("dns plugin: Attaching the filter failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (r);
+		return (-1);
+	}
+
+	if (setsockopt (r->fd, SOL_PACKET, PACKET_VERSION,
+				&version, sizeof (version)) != 0)
+	{
+		ERROR ("dns plugin: Selecting TPACKET_V3 failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (r);
+		return (-1);
+	}
+
+	memset (&req, 0, sizeof (req));
+	req.tp_block_size = DNS_RING_BLOCK_SIZE;
+	req.tp_block_nr = DNS_RING_BLOCK_NR;
+	req.tp_frame_size = DNS_RING_FRAME_SIZE;
+	req.tp_frame_nr = (DNS_RING_BLOCK_SIZE / DNS_RING_FRAME_SIZE)
+		* DNS_RING_BLOCK_NR;
+	req.tp_retire_blk_tov = DNS_RING_TIMEOUT;
+	if (setsockopt (r->fd, SOL_PACKET, PACKET_RX_RING,
+				&req, sizeof (req)) != 0)
+	{
+		ERROR ("dns plugin: Setting up the ring failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (r);
+		return (-1);
+	}
+
+	r->map_size = (size_t) req.tp_block_size * req.tp_block_nr;
+	r->map = mmap (NULL, r->map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_LOCKED, r->fd, 0);
+	if (r->map == MAP_FAILED)
+	{
+		/* MAP_LOCKED fails without the right to lock memory. */
+		r->map = mmap (NULL, r->map_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, r->fd, 0);
+	}
+	if (r->map == MAP_FAILED)
+	{
+		ERROR ("dns plugin: Mapping the ring failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		r->map = NULL;
+		dns_ring_close (r);
+		return (-1);
+	}
+
+	/* Passing `pcap_device == NULL' is okay and the same as passing "any" */
+	memset (&sll, 0, sizeof (sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons (ETH_P_ALL);
+	if ((pcap_device != NULL) && (strcmp ("any", pcap_device) != 0))
+	{
+		sll.sll_ifindex = (int) if_nametoindex (pcap_device);
+		if (sll.sll_ifindex == 0)
+		{
+			ERROR ("dns plugin: Unknown interface `%s'.", pcap_device);
+			dns_ring_close (r);
+			return (-1);
+		}
+	}
+	if (bind (r->fd, (struct sockaddr *) &sll, sizeof (sll)) != 0)
+	{
+		ERROR ("dns plugin: bind (AF_PACKET) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (r);
+		return (-1);
+	}
+
+	fanout = (fanout_id & 0xffff) | (PACKET_FANOUT_HASH << 16);
+	if (setsockopt (r->fd, SOL_PACKET, PACKET_FANOUT,
+				&fanout, sizeof (fanout)) != 0)
+	{
+		ERROR ("dns plugin: Joining the fanout group failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		dns_ring_close (r);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int dns_ring_open */
+
+static void *dns_ring_loop (void *arg) /* {{{ */
+{
+	dns_ring_t *r = arg;
+	int block_index = 0;
+
+	pthread_setspecific (ring_key, r);
+
+	while (!rings_shutdown)
+	{
+		struct tpacket_block_desc *block;
+		struct tpacket3_hdr *ppd;
+		uint32_t i;
+
+		block = (void *) (r->map
+				+ ((size_t) block_index * DNS_RING_BLOCK_SIZE));
+
+		if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+		{
+			struct pollfd pfd = { r->fd, POLLIN | POLLERR, 0 };
+
+			/* Wake up regularly to notice the shutdown. */
+			poll (&pfd, 1, /* timeout = */ 1000);
+			continue;
+		}
+
+		/* The packets are parsed right in the ring. */
+		ppd = (void *) ((uint8_t *) block
+				+ block->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < block->hdr.bh1.num_pkts; i++)
+		{
+			handle_ip_packet ((u_char *) ppd + ppd->tp_net,
+					(int) ppd->tp_snaplen);
+			ppd = (void *) ((uint8_t *) ppd + ppd->tp_next_offset);
+		}
+
+		/* Hand the block back to the kernel. */
+		__sync_synchronize ();
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		block_index = (block_index + 1) % DNS_RING_BLOCK_NR;
+	}
+
+	return (NULL);
+} /* }}} void *dns_ring_loop */
+
+static int dns_ring_start (void) /* {{{ */
+{
+	int fanout_id = (int) getpid ();
+	int status;
+	int i;
+
+	status = pthread_key_create (&ring_key, /* destructor = */ NULL);
+	if (status != 0)
+	{
+		ERROR ("dns plugin: pthread_key_create failed with status %i.",
+				status);
+		return (-1);
+	}
+
+	dnstop_set_callback (dns_child_callback);
+
+	rings = calloc ((size_t) capture_threads, sizeof (*rings));
+	if (rings == NULL)
+	{
+		ERROR ("dns plugin: calloc failed.");
+		return (-1);
+	}
+
+	rings_shutdown = 0;
+	for (i = 0; i < capture_threads; i++)
+	{
+		dns_ring_t *r = rings + rings_num;
+
+		if (dns_ring_open (r, fanout_id) != 0)
+			break;
+
+		status = plugin_thread_create (&r->thread, NULL,
+				dns_ring_loop, r);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("dns plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			dns_ring_close (r);
+			break;
+		}
+		r->thread_running = 1;
+		rings_num++;
+	}
+
+	if (rings_num == 0)
+	{
+		sfree (rings);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int dns_ring_start */
+
+/* Folds a list of a capture thread into a global list and resets it. */
+static void dns_ring_merge_list (counter_list_t **dst, pthread_mutex_t *lock,
+		counter_list_t *src)
+{
+	pthread_mutex_lock (lock);
+	for (; src != NULL; src = src->next)
+	{
+		if (src->value == 0)
+			continue;
+		counter_list_add (dst, src->key, src->value);
+		src->value = 0;
+	}
+	pthread_mutex_unlock (lock);
+}
+
+static void dns_ring_merge (void) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < rings_num; i++)
+	{
+		dns_ring_t *r = rings + i;
+
+		pthread_mutex_lock (&r->lock);
+
+		pthread_mutex_lock (&traffic_mutex);
+		tr_queries   += r->tr_queries;
+		tr_responses += r->tr_responses;
+		pthread_mutex_unlock (&traffic_mutex);
+		r->tr_queries = r->tr_responses = 0;
+
+		dns_ring_merge_list (&qtype_list,  &qtype_mutex,  r->qtype_list);
+		dns_ring_merge_list (&opcode_list, &opcode_mutex, r->opcode_list);
+		dns_ring_merge_list (&rcode_list,  &rcode_mutex,  r->rcode_list);
+
+		pthread_mutex_unlock (&r->lock);
+	}
+} /* }}} void dns_ring_merge */
+
+static int dns_shutdown (void) /* {{{ */
+{
+	int i;
+
+	rings_shutdown = 1;
+	for (i = 0; i < rings_num; i++)
+	{
+		if (rings[i].thread_running)
+			pthread_join (rings[i].thread, NULL);
+		dns_ring_close (rings + i);
+	}
+	sfree (rings);
+	rings_num = 0;
+
+	return (0);
+} /* }}} int dns_shutdown */
+#endif /* DNS_HAVE_RING */
+
 static int dns_sleep_one_interval (void) /* {{{ */
 {
 	cdtime_t interval;
@@ -333,6 +779,18 @@ static int dns_init (void)
 	tr_responses = 0;
 	pthread_mutex_unlock (&traffic_mutex);
 
+#if DNS_HAVE_RING
+	if (ring_capture)
+	{
+		if (rings_num > 0)
+			return (-1);
+		if (dns_ring_start () == 0)
+			return (0);
+		WARNING ("dns plugin: Setting up the ring capture failed. "
+				"Using libpcap instead.");
+	}
+#endif
+
 	if (listen_thread_init != 0)
 		return (-1);
 
@@ -395,6 +853,10 @@ static int dns_read (void)
 
 	counter_list_t *ptr;
 
+#if DNS_HAVE_RING
+	dns_ring_merge ();
+#endif
+
 	pthread_mutex_lock (&traffic_mutex);
 	values[0] = tr_queries;
 	values[1] = tr_responses;
@@ -459,4 +921,7 @@ void module_register (void)
 	plugin_register_config ("dns", dns_config, config_keys, config_keys_num);
 	plugin_register_init ("dns", dns_init);
 	plugin_register_read ("dns", dns_read);
+#if DNS_HAVE_RING
+	plugin_register_shutdown ("dns", dns_shutdown);
+#endif
 } /* void module_register */
@@ -43,6 +43,7 @@
 #include "plugin.h"
 
 #include "configfile.h"
+#include "utils_intern.h"
 
 #include <stddef.h>
 
@@ -53,6 +54,10 @@
 #include <sys/un.h>
 #include <sys/select.h>
 
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
 /* some systems (e.g. Darwin) seem to not define UNIX_PATH_MAX at all */
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof (((struct sockaddr_un *)0)->sun_path)
@@ -65,6 +70,10 @@
 #define SOCK_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-email"
 #define MAX_CONNS 5
 #define MAX_CONNS_LIMIT 16384
+#define THREADS 4
+
+/* 256 bytes ought to be enough for anybody ;-) */
+#define LINE_LEN 256
 
 #define log_debug(...) DEBUG ("email: "__VA_ARGS__)
 #define log_err(...) ERROR ("email: "__VA_ARGS__)
@@ -73,24 +82,48 @@
 /*
  * Private data structures
  */
-/* linked list of email and check types */
+/* list of email and check types, in the order they have been seen first and
+ * hashed by name */
 typedef struct type {
 	char        *name;
-	int         value;
+	uint32_t    hash;
+	int64_t     value;
 	struct type *next;
+	struct type *hash_next;
 } type_t;
 
 typedef struct {
 	type_t *head;
 	type_t *tail;
+
+	/* a power of two, so the bucket is a mask of the hash */
+	type_t **buckets;
+	size_t buckets_num;
+	size_t types_num;
 } type_list_t;
 
+/* Statistics collected by one thread since the last read. Only the thread
+ * and the read callback use the lock, so it is hardly ever contended. */
+typedef struct {
+	pthread_mutex_t lock;
+
+	type_list_t count;
+	type_list_t size;
+	type_list_t check;
+
+	double score_sum;
+	int    score_count;
+} email_stats_t;
+
+#if !HAVE_SYS_EPOLL_H
 /* collector thread control information */
 typedef struct collector {
 	pthread_t thread;
 
 	/* socket descriptor of the current/last connection */
 	FILE *socket;
+
+	email_stats_t *stats;
 } collector_t;
 
 /* linked list of pending connections */
@@ -106,6 +139,7 @@ typedef struct {
 	conn_t *head;
 	conn_t *tail;
 } conn_list_t;
+#endif /* !HAVE_SYS_EPOLL_H */
 
 /*
  * Private variables
@@ -116,7 +150,8 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"MaxConns"
+	"MaxConns",
+	"Threads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -125,13 +160,66 @@ static char *sock_file  = NULL;
 static char *sock_group = NULL;
 static int  sock_perms  = S_IRWXU | S_IRWXG;
 static int  max_conns   = MAX_CONNS;
+static int  threads_num = THREADS;
 
 /* state of the plugin */
 static int disabled = 0;
 
+static int connector_socket = -1;
+
+/* one set of statistics per thread, merged by email_read () */
+static email_stats_t *stats = NULL;
+static size_t stats_num = 0;
+
+/* totals reported by email_read (); types once seen are reported as zero
+ * later on */
+static type_list_t list_count;
+static type_list_t list_size;
+static type_list_t list_check;
+
+#if HAVE_SYS_EPOLL_H
+/*
+ * All connections are served by a fixed number of worker threads, which wait
+ * on one epoll instance, as in the unixsock plugin. Sockets are registered
+ * with EPOLLONESHOT, so each connection is handled by one worker at a time.
+ * Each worker counts into its own statistics.
+ */
+typedef struct email_conn_s email_conn_t;
+struct email_conn_s {
+	int fd;
+
+	/* holds one line; the last byte is never filled, so that a line can be
+	 * terminated */
+	char   in[LINE_LEN + 1];
+	size_t in_fill;
+	/* set while skipping the rest of a line that was too long */
+	_Bool  in_discard;
+
+	email_conn_t *prev;
+	email_conn_t *next;
+};
+
+static int loop = 0;
+
+/* markers for the listening socket and the wakeup pipe in epoll events */
+static char listen_marker;
+static char wakeup_marker;
+
+static int epoll_fd = -1;
+static int wakeup_pipe[2] = { -1, -1 };
+
+static pthread_t *workers = NULL;
+static size_t workers_num = 0;
+
+/* all connections, so they can be closed on shutdown */
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static email_conn_t *conn_list = NULL;
+static int conns_num = 0;
+/* set while no connections are accepted because MaxConns is reached */
+static _Bool listen_paused = 0;
+#else /* !HAVE_SYS_EPOLL_H */
 /* thread managing "client" connections */
 static pthread_t connector = (pthread_t) 0;
-static int connector_socket = -1;
 
 /* tell the collector threads that a new connection is available */
 static pthread_cond_t conn_available = PTHREAD_COND_INITIALIZER;
@@ -148,22 +236,7 @@ static collector_t **collectors = NULL;
 
 static pthread_mutex_t available_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int available_collectors;
-
-static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_count;
-static type_list_t list_count_copy;
-
-static pthread_mutex_t size_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_size;
-static type_list_t list_size_copy;
-
-static pthread_mutex_t score_mutex = PTHREAD_MUTEX_INITIALIZER;
-static double score;
-static int score_count;
-
-static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_check;
-static type_list_t list_check_copy;
+#endif /* HAVE_SYS_EPOLL_H */
 
 /*
  * Private functions
@@ -209,183 +282,185 @@ static int email_config (const char *key, const char *value)
 			max_conns = (int)tmp;
 		}
 	}
+	else if (0 == strcasecmp (key, "Threads")) {
+		int tmp = atoi (value);
+
+		if (tmp < 1) {
+			log_warn ("`Threads' must be at least one.");
+			return 1;
+		}
+		threads_num = tmp;
+	}
 	else {
 		return -1;
 	}
 	return 0;
 } /* static int email_config (char *, char *) */
 
-/* Increment the value of the given name in the given list by incr. */
-static void type_list_incr (type_list_t *list, char *name, int incr)
+/* Doubles the number of buckets of the list. Returns non-zero if the
+ * memory could not be allocated; the old buckets remain usable. */
+static int type_list_grow (type_list_t *list)
 {
-	if (NULL == list->head) {
-		list->head = smalloc (sizeof (*list->head));
+	size_t num = (0 == list->buckets_num) ? 16 : 2 * list->buckets_num;
+	type_t **buckets;
+	type_t *ptr;
 
-		list->head->name  = sstrdup (name);
-		list->head->value = incr;
-		list->head->next  = NULL;
+	buckets = calloc (num, sizeof (*buckets));
+	if (NULL == buckets)
+		return -1;
 
-		list->tail = list->head;
-	}
-	else {
-		type_t *ptr;
+	for (ptr = list->head; NULL != ptr; ptr = ptr->next) {
+		size_t i = ptr->hash & (num - 1);
 
-		for (ptr = list->head; NULL != ptr; ptr = ptr->next) {
-			if (0 == strcmp (name, ptr->name))
-				break;
-		}
+		ptr->hash_next = buckets[i];
+		buckets[i] = ptr;
+	}
 
-		if (NULL == ptr) {
-			list->tail->next = smalloc (sizeof (*list->tail->next));
-			list->tail = list->tail->next;
+	sfree (list->buckets);
+	list->buckets = buckets;
+	list->buckets_num = num;
+	return 0;
+} /* static int type_list_grow (type_list_t *) */
 
-			list->tail->name  = sstrdup (name);
-			list->tail->value = incr;
-			list->tail->next  = NULL;
-		}
-		else {
-			ptr->value += incr;
+/* Increment the value of the given name in the given list by incr. */
+static void type_list_incr (type_list_t *list, const char *name, int64_t incr)
+{
+	uint32_t hash = identifier_hash_name (name);
+	type_t *ptr;
+	size_t i;
+
+	if (NULL != list->buckets) {
+		for (ptr = list->buckets[hash & (list->buckets_num - 1)];
+				NULL != ptr; ptr = ptr->hash_next) {
+			if ((hash == ptr->hash) && (0 == strcmp (name, ptr->name))) {
+				ptr->value += incr;
+				return;
+			}
 		}
 	}
+
+	if ((list->types_num >= list->buckets_num)
+			&& (0 != type_list_grow (list))
+			&& (NULL == list->buckets)) {
+		log_err ("type_list_incr: calloc failed.");
+		return;
+	}
+
+	ptr = smalloc (sizeof (*ptr));
+	ptr->name  = sstrdup (name);
+	ptr->hash  = hash;
+	ptr->value = incr;
+	ptr->next  = NULL;
+
+	i = hash & (list->buckets_num - 1);
+	ptr->hash_next = list->buckets[i];
+	list->buckets[i] = ptr;
+
+	if (NULL == list->head)
+		list->head = ptr;
+	else
+		list->tail->next = ptr;
+	list->tail = ptr;
+	list->types_num++;
 	return;
 } /* static void type_list_incr (type_list_t *, char *) */
 
-static void *collect (void *arg)
+/* Add the values of src to dst and reset them to zero. */
+static void type_list_merge (type_list_t *dst, type_list_t *src)
 {
-	collector_t *this = (collector_t *)arg;
-
-	while (1) {
-		conn_t *connection;
-
-		pthread_mutex_lock (&conns_mutex);
-
-		while (NULL == conns.head) {
-			pthread_cond_wait (&conn_available, &conns_mutex);
-		}
-
-		connection = conns.head;
-		conns.head = conns.head->next;
-
-		if (NULL == conns.head) {
-			conns.tail = NULL;
-		}
-
-		pthread_mutex_unlock (&conns_mutex);
-
-		/* make the socket available to the global
-		 * thread and connection management */
-		this->socket = connection->socket;
-
-		log_debug ("collect: handling connection on fd #%i",
-				fileno (this->socket));
-
-		while (42) {
-			/* 256 bytes ought to be enough for anybody ;-) */
-			char line[256 + 1]; /* line + '\0' */
-			int  len = 0;
+	type_t *ptr;
 
-			errno = 0;
-			if (NULL == fgets (line, sizeof (line), this->socket)) {
-				if (0 != errno) {
-					char errbuf[1024];
-					log_err ("collect: reading from socket (fd #%i) "
-							"failed: %s", fileno (this->socket),
-							sstrerror (errno, errbuf, sizeof (errbuf)));
-				}
-				break;
-			}
+	for (ptr = src->head; NULL != ptr; ptr = ptr->next) {
+		type_list_incr (dst, ptr->name, ptr->value);
+		ptr->value = 0;
+	}
+	return;
+} /* static void type_list_merge (type_list_t *, type_list_t *) */
 
-			len = strlen (line);
-			if (('\n' != line[len - 1]) && ('\r' != line[len - 1])) {
-				log_warn ("collect: line too long (> %zu characters): "
-						"'%s' (truncated)", sizeof (line) - 1, line);
+static void type_list_reset (type_list_t *list)
+{
+	type_t *ptr;
 
-				while (NULL != fgets (line, sizeof (line), this->socket))
-					if (('\n' == line[len - 1]) || ('\r' == line[len - 1]))
-						break;
-				continue;
-			}
-			if (len < 3) { /* [a-z] ':' '\n' */
-				continue;
-			}
+	for (ptr = list->head; NULL != ptr; ptr = ptr->next)
+		ptr->value = 0;
+	return;
+} /* static void type_list_reset (type_list_t *) */
 
-			line[len - 1] = 0;
+static void type_list_free (type_list_t *t)
+{
+	type_t *this;
 
-			log_debug ("collect: line = '%s'", line);
+	this = t->head;
+	while (this != NULL)
+	{
+		type_t *next = this->next;
 
-			if (':' != line[1]) {
-				log_err ("collect: syntax error in line '%s'", line);
-				continue;
-			}
+		sfree (this->name);
+		sfree (this);
 
-			if ('e' == line[0]) { /* e:<type>:<bytes> */
-				char *ptr  = NULL;
-				char *type = strtok_r (line + 2, ":", &ptr);
-				char *tmp  = strtok_r (NULL, ":", &ptr);
-				int  bytes = 0;
+		this = next;
+	}
 
-				if (NULL == tmp) {
-					log_err ("collect: syntax error in line '%s'", line);
-					continue;
-				}
+	sfree (t->buckets);
+	memset (t, 0, sizeof (*t));
+}
 
-				bytes = atoi (tmp);
+/* Parse one line of the protocol, without the newline, and update the
+ * statistics. The caller must hold the lock of "s". */
+static void email_handle_line (email_stats_t *s, char *line)
+{
+	if (strlen (line) < 2) { /* [a-z] ':' */
+		return;
+	}
 
-				pthread_mutex_lock (&count_mutex);
-				type_list_incr (&list_count, type, /* increment = */ 1);
-				pthread_mutex_unlock (&count_mutex);
+	log_debug ("collect: line = '%s'", line);
 
-				if (bytes > 0) {
-					pthread_mutex_lock (&size_mutex);
-					type_list_incr (&list_size, type, /* increment = */ bytes);
-					pthread_mutex_unlock (&size_mutex);
-				}
-			}
-			else if ('s' == line[0]) { /* s:<value> */
-				pthread_mutex_lock (&score_mutex);
-				score = (score * (double)score_count + atof (line + 2))
-						/ (double)(score_count + 1);
-				++score_count;
-				pthread_mutex_unlock (&score_mutex);
-			}
-			else if ('c' == line[0]) { /* c:<type1>[,<type2>,...] */
-				char *dummy = line + 2;
-				char *endptr = NULL;
-				char *type;
-
-				pthread_mutex_lock (&check_mutex);
-				while ((type = strtok_r (dummy, ",", &endptr)) != NULL)
-				{
-					dummy = NULL;
-					type_list_incr (&list_check, type, /* increment = */ 1);
-				}
-				pthread_mutex_unlock (&check_mutex);
-			}
-			else {
-				log_err ("collect: unknown type '%c'", line[0]);
-			}
-		} /* while (42) */
+	if (':' != line[1]) {
+		log_err ("collect: syntax error in line '%s'", line);
+		return;
+	}
 
-		log_debug ("Shutting down connection on fd #%i",
-				fileno (this->socket));
+	if ('e' == line[0]) { /* e:<type>:<bytes> */
+		char *ptr  = NULL;
+		char *type = strtok_r (line + 2, ":", &ptr);
+		char *tmp  = strtok_r (NULL, ":", &ptr);
+		int  bytes = 0;
 
-		fclose (connection->socket);
-		free (connection);
+		if (NULL == tmp) {
+			log_err ("collect: syntax error in line '%s'", line);
+			return;
+		}
 
-		this->socket = NULL;
+		bytes = atoi (tmp);
 
-		pthread_mutex_lock (&available_mutex);
-		++available_collectors;
-		pthread_mutex_unlock (&available_mutex);
+		type_list_incr (&s->count, type, /* increment = */ 1);
 
-		pthread_cond_signal (&collector_available);
-	} /* while (1) */
+		if (bytes > 0)
+			type_list_incr (&s->size, type, /* increment = */ bytes);
+	}
+	else if ('s' == line[0]) { /* s:<value> */
+		s->score_sum += atof (line + 2);
+		++s->score_count;
+	}
+	else if ('c' == line[0]) { /* c:<type1>[,<type2>,...] */
+		char *dummy = line + 2;
+		char *endptr = NULL;
+		char *type;
 
-	pthread_exit ((void *)0);
-	return ((void *) 0);
-} /* static void *collect (void *) */
+		while ((type = strtok_r (dummy, ",", &endptr)) != NULL)
+		{
+			dummy = NULL;
+			type_list_incr (&s->check, type, /* increment = */ 1);
+		}
+	}
+	else {
+		log_err ("collect: unknown type '%c'", line[0]);
+	}
+} /* static void email_handle_line (email_stats_t *, char *) */
 
-static void *open_connection (void __attribute__((unused)) *arg)
+/* Create, bind and chown the listening socket. Returns non-zero on
+ * failure. */
+static int email_open_socket (void)
 {
 	struct sockaddr_un addr;
 
@@ -399,7 +474,7 @@ static void *open_connection (void __attribute__((unused)) *arg)
 		disabled = 1;
 		log_err ("socket() failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		pthread_exit ((void *)1);
+		return -1;
 	}
 
 	addr.sun_family = AF_UNIX;
@@ -415,7 +490,7 @@ static void *open_connection (void __attribute__((unused)) *arg)
 		connector_socket = -1;
 		log_err ("bind() failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		pthread_exit ((void *)1);
+		return -1;
 	}
 
 	errno = 0;
@@ -426,7 +501,7 @@ static void *open_connection (void __attribute__((unused)) *arg)
 		connector_socket = -1;
 		log_err ("listen() failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		pthread_exit ((void *)1);
+		return -1;
 	}
 
 	{
@@ -467,6 +542,430 @@ static void *open_connection (void __attribute__((unused)) *arg)
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 	}
 
+	return 0;
+} /* static int email_open_socket (void) */
+
+#if HAVE_SYS_EPOLL_H
+static int epoll_arm (int fd, uint32_t events, void *ptr, int op)
+{
+	struct epoll_event ev;
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	return (epoll_ctl (epoll_fd, op, fd, &ev));
+} /* static int epoll_arm (int, uint32_t, void *, int) */
+
+static void conn_close (email_conn_t *conn)
+{
+	_Bool resume = 0;
+
+	pthread_mutex_lock (&conn_lock);
+	if (conn->prev != NULL)
+		conn->prev->next = conn->next;
+	else
+		conn_list = conn->next;
+	if (conn->next != NULL)
+		conn->next->prev = conn->prev;
+	--conns_num;
+	if (listen_paused) {
+		listen_paused = 0;
+		resume = 1;
+	}
+	pthread_mutex_unlock (&conn_lock);
+
+	log_debug ("Shutting down connection on fd #%i", conn->fd);
+
+	/* closing the socket removes it from the epoll set */
+	close (conn->fd);
+	sfree (conn);
+
+	if (resume && (loop != 0))
+		epoll_arm (connector_socket, EPOLLIN | EPOLLONESHOT, &listen_marker,
+				EPOLL_CTL_MOD);
+} /* static void conn_close (email_conn_t *) */
+
+/* Handle all complete lines in the input buffer. With "flush" set, a last
+ * line without newline is handled, too. */
+static void conn_run (email_conn_t *conn, email_stats_t *s, _Bool flush)
+{
+	size_t pos = 0;
+
+	pthread_mutex_lock (&s->lock);
+	while (pos < conn->in_fill) {
+		char *line = conn->in + pos;
+		char *end  = memchr (line, '\n', conn->in_fill - pos);
+		size_t len;
+
+		if (NULL == end) {
+			if (!flush && ((pos > 0)
+						|| (conn->in_fill < sizeof (conn->in) - 1)))
+				break;
+
+			if (!flush && !conn->in_discard) {
+				conn->in[conn->in_fill] = 0;
+				log_warn ("collect: line too long (> %zu characters): "
+						"'%s' (truncated)", sizeof (conn->in) - 1, conn->in);
+				conn->in_discard = 1;
+			}
+			else if (flush && !conn->in_discard) {
+				conn->in[conn->in_fill] = 0;
+				email_handle_line (s, line);
+			}
+			pos = conn->in_fill;
+			break;
+		}
+
+		pos = (size_t) (end - conn->in) + 1;
+		if (conn->in_discard) {
+			conn->in_discard = 0;
+			continue;
+		}
+
+		*end = 0;
+		len = (size_t) (end - line);
+		if ((len > 0) && ('\r' == line[len - 1]))
+			line[len - 1] = 0;
+
+		email_handle_line (s, line);
+	}
+	pthread_mutex_unlock (&s->lock);
+
+	memmove (conn->in, conn->in + pos, conn->in_fill - pos);
+	conn->in_fill -= pos;
+} /* static void conn_run (email_conn_t *, email_stats_t *, _Bool) */
+
+/* Called when the socket is readable. Returns non-zero if the connection
+ * should be closed. */
+static int conn_handle (email_conn_t *conn, email_stats_t *s)
+{
+	int i;
+
+	/* Only read a few times, so that one busy client can't keep a worker to
+	 * itself. The socket is still readable when it's re-armed. */
+	for (i = 0; i < 16; i++) {
+		ssize_t status = read (conn->fd, conn->in + conn->in_fill,
+				sizeof (conn->in) - 1 - conn->in_fill);
+		if (status < 0) {
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			log_err ("collect: reading from socket (fd #%i) failed: %s",
+					conn->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			return -1;
+		}
+
+		conn->in_fill += (size_t) status;
+		conn_run (conn, s, /* flush = */ (status == 0));
+
+		if (status == 0)
+			return -1;
+	}
+
+	return 0;
+} /* static int conn_handle (email_conn_t *, email_stats_t *) */
+
+static void accept_conns (void)
+{
+	while (loop != 0) {
+		email_conn_t *conn;
+		int fd;
+
+		pthread_mutex_lock (&conn_lock);
+		if (conns_num >= max_conns) {
+			/* re-armed by conn_close () */
+			listen_paused = 1;
+			pthread_mutex_unlock (&conn_lock);
+			return;
+		}
+		pthread_mutex_unlock (&conn_lock);
+
+		fd = accept (connector_socket, NULL, NULL);
+		if (fd < 0) {
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				log_err ("accept() failed: %s",
+						sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		if (fcntl (fd, F_SETFL, O_NONBLOCK) != 0) {
+			char errbuf[1024];
+			log_warn ("fcntl() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (fd);
+			continue;
+		}
+
+		conn = calloc (1, sizeof (*conn));
+		if (conn == NULL) {
+			close (fd);
+			continue;
+		}
+		conn->fd = fd;
+
+		pthread_mutex_lock (&conn_lock);
+		conn->next = conn_list;
+		if (conn_list != NULL)
+			conn_list->prev = conn;
+		conn_list = conn;
+		++conns_num;
+		pthread_mutex_unlock (&conn_lock);
+
+		log_debug ("collect: handling connection on fd #%i", fd);
+
+		if (epoll_arm (fd, EPOLLIN | EPOLLONESHOT, conn, EPOLL_CTL_ADD) != 0) {
+			char errbuf[1024];
+			log_warn ("epoll_ctl() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			conn_close (conn);
+		}
+	}
+
+	epoll_arm (connector_socket, EPOLLIN | EPOLLONESHOT, &listen_marker,
+			EPOLL_CTL_MOD);
+} /* static void accept_conns (void) */
+
+static void *worker_thread (void *arg)
+{
+	email_stats_t *s = arg;
+
+	while (loop != 0) {
+		struct epoll_event events[16];
+		int events_num;
+		int i;
+
+		events_num = epoll_wait (epoll_fd, events,
+				STATIC_ARRAY_SIZE (events), /* timeout = */ -1);
+		if (events_num < 0) {
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			log_err ("epoll_wait() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		for (i = 0; i < events_num; i++) {
+			email_conn_t *conn;
+
+			if (events[i].data.ptr == &wakeup_marker)
+				continue;
+			if (events[i].data.ptr == &listen_marker) {
+				accept_conns ();
+				continue;
+			}
+
+			conn = events[i].data.ptr;
+			if ((conn_handle (conn, s) != 0) || (loop == 0)) {
+				conn_close (conn);
+				continue;
+			}
+
+			if (epoll_arm (conn->fd, EPOLLIN | EPOLLONESHOT, conn,
+						EPOLL_CTL_MOD) != 0)
+				conn_close (conn);
+		}
+	} /* while (loop) */
+
+	return ((void *) 0);
+} /* static void *worker_thread (void *) */
+
+static int start_workers (void)
+{
+	char errbuf[1024];
+	size_t i;
+
+	if (email_open_socket () != 0)
+		return (-1);
+
+	if (fcntl (connector_socket, F_SETFL, O_NONBLOCK) != 0) {
+		log_err ("fcntl() failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		log_err ("epoll_create1() failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	/* The wakeup pipe is never read from, so that it wakes all workers on
+	 * shutdown. */
+	if (pipe (wakeup_pipe) != 0) {
+		log_err ("pipe() failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		wakeup_pipe[0] = wakeup_pipe[1] = -1;
+		return (-1);
+	}
+
+	if ((epoll_arm (wakeup_pipe[0], EPOLLIN, &wakeup_marker,
+					EPOLL_CTL_ADD) != 0)
+			|| (epoll_arm (connector_socket, EPOLLIN | EPOLLONESHOT,
+					&listen_marker, EPOLL_CTL_ADD) != 0)) {
+		log_err ("epoll_ctl() failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	workers = calloc (stats_num, sizeof (*workers));
+	if (workers == NULL) {
+		log_err ("calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < stats_num; i++) {
+		int status = plugin_thread_create (&workers[workers_num], NULL,
+				worker_thread, stats + i);
+		if (status != 0) {
+			log_err ("pthread_create() failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			break;
+		}
+		workers_num++;
+	}
+
+	if (workers_num == 0)
+		return (-1);
+
+	return (0);
+} /* static int start_workers (void) */
+
+static void stop_workers (void)
+{
+	size_t i;
+
+	loop = 0;
+
+	if (wakeup_pipe[1] >= 0) {
+		if (write (wakeup_pipe[1], "", 1) < 0) {
+			char errbuf[1024];
+			log_err ("write to wakeup pipe failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+
+	for (i = 0; i < workers_num; i++)
+		pthread_join (workers[i], NULL);
+	sfree (workers);
+	workers_num = 0;
+
+	while (conn_list != NULL)
+		conn_close (conn_list);
+
+	if (epoll_fd >= 0)
+		close (epoll_fd);
+	epoll_fd = -1;
+	for (i = 0; i < STATIC_ARRAY_SIZE (wakeup_pipe); i++) {
+		if (wakeup_pipe[i] >= 0)
+			close (wakeup_pipe[i]);
+		wakeup_pipe[i] = -1;
+	}
+
+	if (connector_socket >= 0) {
+		close (connector_socket);
+		connector_socket = -1;
+	}
+} /* static void stop_workers (void) */
+#else /* !HAVE_SYS_EPOLL_H */
+static void *collect (void *arg)
+{
+	collector_t *this = (collector_t *)arg;
+
+	while (1) {
+		conn_t *connection;
+
+		pthread_mutex_lock (&conns_mutex);
+
+		while (NULL == conns.head) {
+			pthread_cond_wait (&conn_available, &conns_mutex);
+		}
+
+		connection = conns.head;
+		conns.head = conns.head->next;
+
+		if (NULL == conns.head) {
+			conns.tail = NULL;
+		}
+
+		pthread_mutex_unlock (&conns_mutex);
+
+		/* make the socket available to the global
+		 * thread and connection management */
+		this->socket = connection->socket;
+
+		log_debug ("collect: handling connection on fd #%i",
+				fileno (this->socket));
+
+		while (42) {
+			char line[LINE_LEN + 1]; /* line + '\0' */
+			int  len = 0;
+
+			errno = 0;
+			if (NULL == fgets (line, sizeof (line), this->socket)) {
+				if (0 != errno) {
+					char errbuf[1024];
+					log_err ("collect: reading from socket (fd #%i) "
+							"failed: %s", fileno (this->socket),
+							sstrerror (errno, errbuf, sizeof (errbuf)));
+				}
+				break;
+			}
+
+			len = strlen (line);
+			if (('\n' != line[len - 1]) && ('\r' != line[len - 1])) {
+				log_warn ("collect: line too long (> %zu characters): "
+						"'%s' (truncated)", sizeof (line) - 1, line);
+
+				while (NULL != fgets (line, sizeof (line), this->socket))
+					if (('\n' == line[len - 1]) || ('\r' == line[len - 1]))
+						break;
+				continue;
+			}
+
+			line[len - 1] = 0;
+
+			pthread_mutex_lock (&this->stats->lock);
+			email_handle_line (this->stats, line);
+			pthread_mutex_unlock (&this->stats->lock);
+		} /* while (42) */
+
+		log_debug ("Shutting down connection on fd #%i",
+				fileno (this->socket));
+
+		fclose (connection->socket);
+		free (connection);
+
+		this->socket = NULL;
+
+		pthread_mutex_lock (&available_mutex);
+		++available_collectors;
+		pthread_mutex_unlock (&available_mutex);
+
+		pthread_cond_signal (&collector_available);
+	} /* while (1) */
+
+	pthread_exit ((void *)0);
+	return ((void *) 0);
+} /* static void *collect (void *) */
+
+static void *open_connection (void __attribute__((unused)) *arg)
+{
+	if (0 != email_open_socket ())
+		pthread_exit ((void *)1);
+
 	{ /* initialize collector threads */
 		int i   = 0;
 		int err = 0;
@@ -487,6 +986,7 @@ static void *open_connection (void __attribute__((unused)) *arg)
 		for (i = 0; i < max_conns; ++i) {
 			collectors[i] = smalloc (sizeof (*collectors[i]));
 			collectors[i]->socket = NULL;
+			collectors[i]->stats = stats + i;
 
 			if (0 != (err = plugin_thread_create (&collectors[i]->thread,
 							&ptattr, collect, collectors[i]))) {
@@ -572,11 +1072,38 @@ static void *open_connection (void __attribute__((unused)) *arg)
 	pthread_exit ((void *) 0);
 	return ((void *) 0);
 } /* static void *open_connection (void *) */
+#endif /* HAVE_SYS_EPOLL_H */
 
 static int email_init (void)
 {
+	size_t i;
 	int err = 0;
 
+	/* one set of statistics per worker thread or, without epoll, per
+	 * collector thread */
+#if HAVE_SYS_EPOLL_H
+	stats_num = (size_t) threads_num;
+#else
+	stats_num = (size_t) max_conns;
+#endif
+	stats = calloc (stats_num, sizeof (*stats));
+	if (NULL == stats) {
+		disabled = 1;
+		stats_num = 0;
+		log_err ("calloc failed.");
+		return (-1);
+	}
+	for (i = 0; i < stats_num; i++)
+		pthread_mutex_init (&stats[i].lock, /* attr = */ NULL);
+
+#if HAVE_SYS_EPOLL_H
+	loop = 1;
+	if (0 != (err = start_workers ())) {
+		disabled = 1;
+		stop_workers ();
+		return (-1);
+	}
+#else
 	if (0 != (err = plugin_thread_create (&connector, NULL,
 				open_connection, NULL))) {
 		char errbuf[1024];
@@ -585,33 +1112,18 @@ static int email_init (void)
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
+#endif
 
 	return (0);
 } /* int email_init */
 
-static void type_list_free (type_list_t *t)
-{
-	type_t *this;
-
-	this = t->head;
-	while (this != NULL)
-	{
-		type_t *next = this->next;
-
-		sfree (this->name);
-		sfree (this);
-
-		this = next;
-	}
-
-	t->head = NULL;
-	t->tail = NULL;
-}
-
 static int email_shutdown (void)
 {
-	int i = 0;
+	size_t i = 0;
 
+#if HAVE_SYS_EPOLL_H
+	stop_workers ();
+#else
 	if (connector != ((pthread_t) 0)) {
 		pthread_kill (connector, SIGTERM);
 		connector = (pthread_t) 0;
@@ -628,7 +1140,7 @@ static int email_shutdown (void)
 	available_collectors = 0;
 
 	if (collectors != NULL) {
-		for (i = 0; i < max_conns; ++i) {
+		for (i = 0; i < (size_t) max_conns; ++i) {
 			if (collectors[i] == NULL)
 				continue;
 
@@ -648,13 +1160,20 @@ static int email_shutdown (void)
 	} /* if (collectors != NULL) */
 
 	pthread_mutex_unlock (&conns_mutex);
+#endif /* HAVE_SYS_EPOLL_H */
+
+	for (i = 0; i < stats_num; i++) {
+		type_list_free (&stats[i].count);
+		type_list_free (&stats[i].size);
+		type_list_free (&stats[i].check);
+		pthread_mutex_destroy (&stats[i].lock);
+	}
+	sfree (stats);
+	stats_num = 0;
 
 	type_list_free (&list_count);
-	type_list_free (&list_count_copy);
 	type_list_free (&list_size);
-	type_list_free (&list_size_copy);
 	type_list_free (&list_check);
-	type_list_free (&list_check_copy);
 
 	unlink ((NULL == sock_file) ? SOCK_PATH : sock_file);
 
@@ -680,98 +1199,57 @@ static void email_submit (const char *type, const char *type_instance, gauge_t v
 	plugin_dispatch_values (&vl);
 } /* void email_submit */
 
-/* Copy list l1 to list l2. l2 may partly exist already, but it is assumed
- * that neither the order nor the name of any element of either list is
- * changed and no elements are deleted. The values of l1 are reset to zero
- * after they have been copied to l2. */
-static void copy_type_list (type_list_t *l1, type_list_t *l2)
-{
-	type_t *ptr1;
-	type_t *ptr2;
-
-	type_t *last = NULL;
-
-	for (ptr1 = l1->head, ptr2 = l2->head; NULL != ptr1;
-			ptr1 = ptr1->next, last = ptr2, ptr2 = ptr2->next) {
-		if (NULL == ptr2) {
-			ptr2 = smalloc (sizeof (*ptr2));
-			ptr2->name = NULL;
-			ptr2->next = NULL;
-
-			if (NULL == last) {
-				l2->head = ptr2;
-			}
-			else {
-				last->next = ptr2;
-			}
-
-			l2->tail = ptr2;
-		}
-
-		if (NULL == ptr2->name) {
-			ptr2->name = sstrdup (ptr1->name);
-		}
-
-		ptr2->value = ptr1->value;
-		ptr1->value = 0;
-	}
-	return;
-}
-
 static int email_read (void)
 {
 	type_t *ptr;
 
-	double score_old;
-	int score_count_old;
+	double score_sum = 0.0;
+	int score_count = 0;
+	size_t i;
 
 	if (disabled)
 		return (-1);
 
-	/* email count */
-	pthread_mutex_lock (&count_mutex);
+	type_list_reset (&list_count);
+	type_list_reset (&list_size);
+	type_list_reset (&list_check);
 
-	copy_type_list (&list_count, &list_count_copy);
+	/* Merge the statistics of all threads. Each lock is held only while
+	 * its thread's lists are added up. */
+	for (i = 0; i < stats_num; i++) {
+		email_stats_t *s = stats + i;
 
-	pthread_mutex_unlock (&count_mutex);
+		pthread_mutex_lock (&s->lock);
 
-	for (ptr = list_count_copy.head; NULL != ptr; ptr = ptr->next) {
-		email_submit ("email_count", ptr->name, ptr->value);
-	}
+		type_list_merge (&list_count, &s->count);
+		type_list_merge (&list_size, &s->size);
+		type_list_merge (&list_check, &s->check);
 
-	/* email size */
-	pthread_mutex_lock (&size_mutex);
+		score_sum += s->score_sum;
+		score_count += s->score_count;
+		s->score_sum = 0.0;
+		s->score_count = 0;
 
-	copy_type_list (&list_size, &list_size_copy);
+		pthread_mutex_unlock (&s->lock);
+	}
 
-	pthread_mutex_unlock (&size_mutex);
+	/* email count */
+	for (ptr = list_count.head; NULL != ptr; ptr = ptr->next) {
+		email_submit ("email_count", ptr->name, (gauge_t) ptr->value);
+	}
 
-	for (ptr = list_size_copy.head; NULL != ptr; ptr = ptr->next) {
-		email_submit ("email_size", ptr->name, ptr->value);
+	/* email size */
+	for (ptr = list_size.head; NULL != ptr; ptr = ptr->next) {
+		email_submit ("email_size", ptr->name, (gauge_t) ptr->value);
 	}
 
 	/* spam score */
-	pthread_mutex_lock (&score_mutex);
-
-	score_old = score;
-	score_count_old = score_count;
-	score = 0.0;
-	score_count = 0;
-
-	pthread_mutex_unlock (&score_mutex);
-
-	if (score_count_old > 0)
-		email_submit ("spam_score", "", score_old);
+	if (score_count > 0)
+		email_submit ("spam_score", "", score_sum / (double) score_count);
 
 	/* spam checks */
-	pthread_mutex_lock (&check_mutex);
-
-	copy_type_list (&list_check, &list_check_copy);
-
-	pthread_mutex_unlock (&check_mutex);
-
-	for (ptr = list_check_copy.head; NULL != ptr; ptr = ptr->next)
-		email_submit ("spam_check", ptr->name, ptr->value);
+	for (ptr = list_check.head; NULL != ptr; ptr = ptr->next)
+		email_submit ("spam_check", ptr->name, (gauge_t) ptr->value);
 
 	return (0);
 } /* int email_read */
@@ -49,16 +49,43 @@ struct value_map_s
 };
 typedef struct value_map_s value_map_t;
 
-static char **interfaces = NULL;
+/* The type and type instance a statistic is submitted as. If `type' is NULL,
+ * the statistic is ignored. The strings belong to the value map or the
+ * interface's string set. */
+struct ethstat_metric_s
+{
+  const char *type;
+  const char *type_instance;
+};
+typedef struct ethstat_metric_s ethstat_metric_t;
+
+/* The string set of an interface and the metric of each statistic are only
+ * fetched and resolved again when the driver reports a different number of
+ * statistics, e.g. after the interface has been registered again. The
+ * buffers are reused by every read. */
+struct ethstat_interface_s
+{
+  char *name;
+  size_t n_stats;
+  struct ethtool_gstrings *strings;
+  struct ethtool_stats *stats;
+  ethstat_metric_t *metrics;
+};
+typedef struct ethstat_interface_s ethstat_interface_t;
+
+static ethstat_interface_t *interfaces = NULL;
 static size_t interfaces_num = 0;
 
+/* Control socket for the ethtool ioctls, kept open between reads. */
+static int ethstat_fd = -1;
+
 static c_avl_tree_t *value_map = NULL;
 
 static _Bool collect_mapped_only = 0;
 
 static int ethstat_add_interface (const oconfig_item_t *ci) /* {{{ */
 {
-  char **tmp;
+  ethstat_interface_t *tmp;
   int status;
 
   tmp = realloc (interfaces,
@@ -66,15 +93,15 @@ static int ethstat_add_interface (const oconfig_item_t *ci) /* {{{ */
   if (tmp == NULL)
     return (-1);
   interfaces = tmp;
-  interfaces[interfaces_num] = NULL;
+  memset (interfaces + interfaces_num, 0, sizeof (*interfaces));
 
-  status = cf_util_get_string (ci, interfaces + interfaces_num);
+  status = cf_util_get_string (ci, &interfaces[interfaces_num].name);
   if (status != 0)
     return (status);
 
   interfaces_num++;
   INFO("ethstat plugin: Registered interface %s",
-      interfaces[interfaces_num - 1]);
+      interfaces[interfaces_num - 1].name);
 
   return (0);
 } /* }}} int ethstat_add_interface */
@@ -169,17 +196,16 @@ static int ethstat_config (oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} */
 
-static void ethstat_submit_value (const char *device,
-    const char *type_instance, derive_t value)
+/* Looks up the metric of the statistic `stat_name'. */
+static void ethstat_resolve_metric (ethstat_metric_t *metric, /* {{{ */
+    const char *stat_name)
 {
   static c_complain_t complain_no_map = C_COMPLAIN_INIT_STATIC;
 
-  value_t values[1];
-  value_list_t vl = VALUE_LIST_INIT;
   value_map_t *map = NULL;
 
   if (value_map != NULL)
-    c_avl_get (value_map, type_instance, (void *) &map);
+    c_avl_get (value_map, stat_name, (void *) &map);
 
   /* If the "MappedOnly" option is specified, ignore unmapped values. */
   if (collect_mapped_only && (map == NULL))
@@ -188,9 +214,29 @@ static void ethstat_submit_value (const char *device,
       c_complain (LOG_WARNING, &complain_no_map,
           "ethstat plugin: The \"MappedOnly\" option has been set to true, "
           "but no mapping has been configured. All values will be ignored!");
+    metric->type = NULL;
+    metric->type_instance = NULL;
     return;
   }
 
+  if (map != NULL)
+  {
+    metric->type = map->type;
+    metric->type_instance = map->type_instance;
+  }
+  else
+  {
+    metric->type = "derive";
+    metric->type_instance = stat_name;
+  }
+} /* }}} void ethstat_resolve_metric */
+
+static void ethstat_submit_value (const char *device,
+    const ethstat_metric_t *metric, derive_t value)
+{
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+
   values[0].derive = value;
   vl.values = values;
   vl.values_len = 1;
@@ -198,132 +244,179 @@ static void ethstat_submit_value (const char *device,
   sstrncpy (vl.host, hostname_g, sizeof (vl.host));
   sstrncpy (vl.plugin, "ethstat", sizeof (vl.plugin));
   sstrncpy (vl.plugin_instance, device, sizeof (vl.plugin_instance));
-  if (map != NULL)
+  sstrncpy (vl.type, metric->type, sizeof (vl.type));
+  sstrncpy (vl.type_instance, metric->type_instance,
+      sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+}
+
+/* Returns the number of statistics the driver currently reports. */
+static int ethstat_get_n_stats (ethstat_interface_t *iface, /* {{{ */
+    struct ifreq *req, size_t *ret_n_stats)
+{
+#ifdef ETHTOOL_GSSET_INFO
+  struct
+  {
+    struct ethtool_sset_info hdr;
+    uint32_t data[1];
+  } sset_info;
+
+  memset (&sset_info, 0, sizeof (sset_info));
+  sset_info.hdr.cmd = ETHTOOL_GSSET_INFO;
+  sset_info.hdr.sset_mask = ((uint64_t) 1) << ETH_SS_STATS;
+  req->ifr_data = (void *) &sset_info;
+  if (ioctl (ethstat_fd, SIOCETHTOOL, req) == 0)
   {
-    sstrncpy (vl.type, map->type, sizeof (vl.type));
-    sstrncpy (vl.type_instance, map->type_instance,
-        sizeof (vl.type_instance));
+    *ret_n_stats = (sset_info.hdr.sset_mask != 0)
+      ? (size_t) sset_info.hdr.data[0] : 0;
+    return (0);
   }
-  else
+  /* Fall back to the driver information if the kernel doesn't know the
+   * command. */
+  if (errno != EOPNOTSUPP)
   {
-    sstrncpy (vl.type, "derive", sizeof (vl.type));
-    sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+    char errbuf[1024];
+    ERROR ("ethstat plugin: Failed to get the number of statistics "
+        "of %s: %s", iface->name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
   }
+#endif
+  {
+    struct ethtool_drvinfo drvinfo;
 
-  plugin_dispatch_values (&vl);
-}
+    memset (&drvinfo, 0, sizeof (drvinfo));
+    drvinfo.cmd = ETHTOOL_GDRVINFO;
+    req->ifr_data = (void *) &drvinfo;
+    if (ioctl (ethstat_fd, SIOCETHTOOL, req) < 0)
+    {
+      char errbuf[1024];
+      ERROR ("ethstat plugin: Failed to get driver information "
+          "from %s: %s", iface->name,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    *ret_n_stats = (size_t) drvinfo.n_stats;
+  }
 
-static int ethstat_read_interface (char *device)
+  return (0);
+} /* }}} int ethstat_get_n_stats */
+
+/* Fetches the string set of `iface' and resolves the metric of each of its
+ * `n_stats' statistics. */
+static int ethstat_refresh_interface (ethstat_interface_t *iface, /* {{{ */
+    struct ifreq *req, size_t n_stats)
 {
-  int fd;
-  struct ifreq req;
-  struct ethtool_drvinfo drvinfo;
   struct ethtool_gstrings *strings;
   struct ethtool_stats *stats;
-  size_t n_stats;
-  size_t strings_size;
-  size_t stats_size;
+  ethstat_metric_t *metrics;
   size_t i;
-  int status;
 
-  memset (&req, 0, sizeof (req));
-  sstrncpy(req.ifr_name, device, sizeof (req.ifr_name));
-
-  fd = socket(AF_INET, SOCK_DGRAM, /* protocol = */ 0);
-  if (fd < 0)
+  /* Forget the previous string set first, so that a failure below makes the
+   * next read try again. */
+  iface->n_stats = 0;
+
+  strings = realloc (iface->strings, sizeof (struct ethtool_gstrings)
+      + (n_stats * ETH_GSTRING_LEN));
+  if (strings != NULL)
+    iface->strings = strings;
+  stats = realloc (iface->stats, sizeof (struct ethtool_stats)
+      + (n_stats * sizeof (uint64_t)));
+  if (stats != NULL)
+    iface->stats = stats;
+  metrics = realloc (iface->metrics, n_stats * sizeof (*metrics));
+  if (metrics != NULL)
+    iface->metrics = metrics;
+  if ((strings == NULL) || (stats == NULL) || (metrics == NULL))
   {
-    char errbuf[1024];
-    ERROR("ethstat plugin: Failed to open control socket: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
-    return 1;
+    ERROR("ethstat plugin: realloc failed.");
+    return (-1);
   }
 
-  memset (&drvinfo, 0, sizeof (drvinfo));
-  drvinfo.cmd = ETHTOOL_GDRVINFO;
-  req.ifr_data = (void *) &drvinfo;
-  status = ioctl (fd, SIOCETHTOOL, &req);
-  if (status < 0)
+  strings->cmd = ETHTOOL_GSTRINGS;
+  strings->string_set = ETH_SS_STATS;
+  strings->len = n_stats;
+  req->ifr_data = (void *) strings;
+  if (ioctl (ethstat_fd, SIOCETHTOOL, req) < 0)
   {
     char errbuf[1024];
-    close (fd);
-    ERROR ("ethstat plugin: Failed to get driver information "
-        "from %s: %s", device,
+    ERROR ("ethstat plugin: Cannot get strings from %s: %s",
+        iface->name,
         sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  n_stats = (size_t) drvinfo.n_stats;
-  if (n_stats < 1)
+  for (i = 0; i < n_stats; i++)
   {
-    close (fd);
-    ERROR("ethstat plugin: No stats available for %s", device);
-    return (-1);
+    char *stat_name = (char *) &strings->data[i * ETH_GSTRING_LEN];
+
+    /* The names are not null-terminated if they fill the whole field. */
+    stat_name[ETH_GSTRING_LEN - 1] = 0;
+    ethstat_resolve_metric (metrics + i, stat_name);
   }
 
-  strings_size = sizeof (struct ethtool_gstrings)
-    + (n_stats * ETH_GSTRING_LEN);
-  stats_size = sizeof (struct ethtool_stats)
-    + (n_stats * sizeof (uint64_t));
+  iface->n_stats = n_stats;
+  DEBUG ("ethstat plugin: %s has %zu statistics.", iface->name, n_stats);
+  return (0);
+} /* }}} int ethstat_refresh_interface */
+
+static int ethstat_read_interface (ethstat_interface_t *iface) /* {{{ */
+{
+  struct ifreq req;
+  struct ethtool_stats *stats;
+  size_t n_stats;
+  size_t i;
+  int status;
+
+  memset (&req, 0, sizeof (req));
+  sstrncpy(req.ifr_name, iface->name, sizeof (req.ifr_name));
+
+  /* The kernel writes as many statistics as the driver reports at the time,
+   * so the number is checked before each read. */
+  status = ethstat_get_n_stats (iface, &req, &n_stats);
+  if (status != 0)
+    return (-1);
 
-  strings = malloc (strings_size);
-  stats = malloc (stats_size);
-  if ((strings == NULL) || (stats == NULL))
+  if (n_stats < 1)
   {
-    close (fd);
-    sfree (strings);
-    sfree (stats);
-    ERROR("ethstat plugin: malloc failed.");
+    ERROR("ethstat plugin: No stats available for %s", iface->name);
     return (-1);
   }
 
-  strings->cmd = ETHTOOL_GSTRINGS;
-  strings->string_set = ETH_SS_STATS;
-  strings->len = n_stats;
-  req.ifr_data = (void *) strings;
-  status = ioctl (fd, SIOCETHTOOL, &req);
-  if (status < 0)
+  if (n_stats != iface->n_stats)
   {
-    char errbuf[1024];
-    close (fd);
-    free (strings);
-    free (stats);
-    ERROR ("ethstat plugin: Cannot get strings from %s: %s",
-        device,
-        sstrerror (errno, errbuf, sizeof (errbuf)));
-    return (-1);
+    status = ethstat_refresh_interface (iface, &req, n_stats);
+    if (status != 0)
+      return (-1);
   }
 
+  stats = iface->stats;
   stats->cmd = ETHTOOL_GSTATS;
   stats->n_stats = n_stats;
   req.ifr_data = (void *) stats;
-  status = ioctl (fd, SIOCETHTOOL, &req);
+  status = ioctl (ethstat_fd, SIOCETHTOOL, &req);
   if (status < 0)
   {
     char errbuf[1024];
-    close (fd);
-    free(strings);
-    free(stats);
     ERROR("ethstat plugin: Reading statistics from %s failed: %s",
-        device,
+        iface->name,
         sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
   for (i = 0; i < n_stats; i++)
   {
-    const char *stat_name;
+    if (iface->metrics[i].type == NULL)
+      continue;
 
-    stat_name = (void *) &strings->data[i * ETH_GSTRING_LEN];
     DEBUG("ethstat plugin: device = \"%s\": %s = %"PRIu64,
-        device, stat_name, (uint64_t) stats->data[i]);
-    ethstat_submit_value (device,
-        stat_name, (derive_t) stats->data[i]);
+        iface->name, (char *) &iface->strings->data[i * ETH_GSTRING_LEN],
+        (uint64_t) stats->data[i]);
+    ethstat_submit_value (iface->name,
+        iface->metrics + i, (derive_t) stats->data[i]);
   }
 
-  close (fd);
-  sfree (strings);
-  sfree (stats);
-
   return (0);
 } /* }}} ethstat_read_interface */
 
@@ -331,8 +424,20 @@ static int ethstat_read(void)
 {
   size_t i;
 
+  if (ethstat_fd < 0)
+  {
+    ethstat_fd = socket(AF_INET, SOCK_DGRAM, /* protocol = */ 0);
+    if (ethstat_fd < 0)
+    {
+      char errbuf[1024];
+      ERROR("ethstat plugin: Failed to open control socket: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return 1;
+    }
+  }
+
   for (i = 0; i < interfaces_num; i++)
-    ethstat_read_interface (interfaces[i]);
+    ethstat_read_interface (interfaces + i);
 
   return 0;
 }
@@ -341,6 +446,23 @@ static int ethstat_shutdown (void)
 {
   void *key = NULL;
   void *value = NULL;
+  size_t i;
+
+  if (ethstat_fd >= 0)
+  {
+    close (ethstat_fd);
+    ethstat_fd = -1;
+  }
+
+  for (i = 0; i < interfaces_num; i++)
+  {
+    sfree (interfaces[i].name);
+    sfree (interfaces[i].strings);
+    sfree (interfaces[i].stats);
+    sfree (interfaces[i].metrics);
+  }
+  sfree (interfaces);
+  interfaces_num = 0;
 
   if (value_map == NULL)
     return (0);
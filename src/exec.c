@@ -40,10 +40,25 @@
 
 #include <pthread.h>
 
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#else
+# include <poll.h>
+#endif
+
 #define PL_NORMAL        0x01
 #define PL_NOTIF_ACTION  0x02
+#define PL_SIGNAL        0x04
 
 #define PL_RUNNING       0x10
+/* The output has been closed, but the child hasn't been reaped yet. */
+#define PL_EXITING       0x20
+
+/* Programs started with "SignalExec" get this signal every interval. */
+#define EXEC_COLLECT_SIGNAL SIGUSR1
+
+#define EXEC_STDOUT_BUFFER_SIZE 16384
+#define EXEC_STDERR_BUFFER_SIZE 1024
 
 /*
  * Private data types
@@ -58,6 +73,22 @@
  */
 struct program_list_s;
 typedef struct program_list_s program_list_t;
+
+/* The output of a child is read in blocks and split into lines in place. */
+struct exec_stream_s
+{
+  program_list_t *pl;
+  int             fd;
+  _Bool           is_stderr;
+  char           *buffer;
+  size_t          buffer_size;
+  size_t          fill;
+  /* Set while skipping the rest of a line that didn't fit into the
+   * buffer. */
+  _Bool           discard;
+};
+typedef struct exec_stream_s exec_stream_t;
+
 struct program_list_s
 {
   char           *user;
@@ -67,6 +98,17 @@ struct program_list_s
   int             pid;
   int             status;
   int             flags;
+
+  /* Only used by the thread reading the output. */
+  exec_stream_t   out;
+  exec_stream_t   err;
+  putval_batch_t  batch;
+
+  /* Don't signal a "SignalExec" program in the interval it was started in,
+   * so that it has time to install its signal handler. */
+  _Bool           signal_skip;
+  /* Programs waiting to be handed to the I/O thread, see exec_start(). */
+  program_list_t *start_next;
   program_list_t *next;
 };
 
@@ -82,6 +124,25 @@ typedef struct program_list_and_notification_s
 static program_list_t *pl_head = NULL;
 static pthread_mutex_t pl_lock = PTHREAD_MUTEX_INITIALIZER;
 
+#if HAVE_SYS_EPOLL_H
+/*
+ * The output of all "Exec" programs is read by one thread, using epoll. The
+ * read callback forks the children and hands them to the thread through
+ * `start_head' and the wakeup pipe. Only the I/O thread touches the streams
+ * of a running program.
+ */
+static int epoll_fd = -1;
+static int wakeup_pipe[2] = { -1, -1 };
+static char wakeup_marker;
+static pthread_t io_thread;
+static _Bool io_thread_running = 0;
+
+/* Protected by `pl_lock'. */
+static _Bool io_thread_stop = 0;
+static program_list_t *start_head = NULL;
+static int exiting_num = 0;
+#endif
+
 /*
  * Functions
  */
@@ -132,9 +193,13 @@ static int exec_config_exec (oconfig_item_t *ci) /* {{{ */
     ERROR ("exec plugin: calloc failed.");
     return (-1);
   }
+  pl->out.fd = -1;
+  pl->err.fd = -1;
 
   if (strcasecmp ("NotificationExec", ci->key) == 0)
     pl->flags |= PL_NOTIF_ACTION;
+  else if (strcasecmp ("SignalExec", ci->key) == 0)
+    pl->flags |= PL_NORMAL | PL_SIGNAL;
   else
     pl->flags |= PL_NORMAL;
 
@@ -253,6 +318,7 @@ static int exec_config (oconfig_item_t *ci) /* {{{ */
   {
     oconfig_item_t *child = ci->children + i;
     if ((strcasecmp ("Exec", child->key) == 0)
+        || (strcasecmp ("SignalExec", child->key) == 0)
         || (strcasecmp ("NotificationExec", child->key) == 0))
       exec_config_exec (child);
     else
@@ -545,10 +611,31 @@ failed:
   return (-1);
 } /* int fork_child }}} */
 
-static int parse_line (char *buffer) /* {{{ */
+/* Values of one read are dispatched as a batch without replies. Failed lines
+ * are logged when the batch ends. */
+static void exec_batch_end (program_list_t *pl) /* {{{ */
 {
+  char end[] = "END";
+
+  if (pl->batch.active)
+    handle_putval_batch (stdout, end, &pl->batch);
+} /* }}} void exec_batch_end */
+
+static int parse_line (program_list_t *pl, char *buffer) /* {{{ */
+{
+  if ((buffer[0] == 0) || (buffer[0] == '#'))
+    return (0);
+
   if (strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
-    return (handle_putval (stdout, buffer));
+  {
+    if (!pl->batch.active)
+    {
+      putval_batch_reset (&pl->batch);
+      pl->batch.active = 1;
+      pl->batch.reply = 0;
+    }
+    return (handle_putval_batch (stdout, buffer, &pl->batch));
+  }
   else if (strncasecmp ("PUTNOTIF", buffer, strlen ("PUTNOTIF")) == 0)
     return (handle_putnotif (stdout, buffer));
   else
@@ -559,16 +646,105 @@ static int parse_line (char *buffer) /* {{{ */
   }
 } /* int parse_line }}} */
 
+static int exec_stream_open (exec_stream_t *s, program_list_t *pl, /* {{{ */
+    int fd, _Bool is_stderr)
+{
+  s->pl = pl;
+  s->fd = fd;
+  s->is_stderr = is_stderr;
+  s->fill = 0;
+  s->discard = 0;
+
+  /* The buffers are kept until shutdown, most programs are restarted every
+   * interval. */
+  if (s->buffer == NULL)
+  {
+    s->buffer_size = is_stderr
+      ? EXEC_STDERR_BUFFER_SIZE : EXEC_STDOUT_BUFFER_SIZE;
+    s->buffer = malloc (s->buffer_size);
+    if (s->buffer == NULL)
+    {
+      ERROR ("exec plugin: malloc failed.");
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* }}} int exec_stream_open */
+
+static void exec_stream_close (exec_stream_t *s) /* {{{ */
+{
+  if (s->fd >= 0)
+    close (s->fd);
+  s->fd = -1;
+  s->fill = 0;
+  s->discard = 0;
+} /* }}} void exec_stream_close */
+
+/* Returns non-zero on end of file or error. */
+static int exec_stream_read (exec_stream_t *s) /* {{{ */
+{
+  program_list_t *pl = s->pl;
+  ssize_t len;
+  char *line;
+  char *end;
+  size_t remaining;
+
+  len = read (s->fd, s->buffer + s->fill, s->buffer_size - 1 - s->fill);
+  if (len < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EINTR))
+      return (0);
+    return (-1);
+  }
+  else if (len == 0)
+    return (-1);
+
+  s->fill += (size_t) len;
+  s->buffer[s->fill] = 0;
+
+  line = s->buffer;
+  while ((end = memchr (line, '\n', s->fill - (size_t) (line - s->buffer)))
+      != NULL)
+  {
+    *end = 0;
+    if ((end > line) && (end[-1] == '\r'))
+      end[-1] = 0;
+
+    if (s->discard)
+      s->discard = 0;
+    else if (s->is_stderr)
+      ERROR ("exec plugin: exec_read_one: error = %s", line);
+    else
+      parse_line (pl, line);
+
+    line = end + 1;
+  }
+
+  if (!s->is_stderr)
+    exec_batch_end (pl);
+
+  remaining = s->fill - (size_t) (line - s->buffer);
+  if (remaining >= s->buffer_size - 1)
+  {
+    if (!s->discard)
+      WARNING ("exec plugin: `%s' wrote a line longer than %zu bytes, "
+          "ignoring it.", pl->exec, s->buffer_size - 2);
+    s->discard = 1;
+    remaining = 0;
+  }
+
+  memmove (s->buffer, line, remaining);
+  s->fill = remaining;
+  return (0);
+} /* }}} int exec_stream_read */
+
+#if !HAVE_SYS_EPOLL_H
 static void *exec_read_one (void *arg) /* {{{ */
 {
   program_list_t *pl = (program_list_t *) arg;
-  int fd, fd_err, highest_fd;
-  fd_set fdset, copy;
+  int fd, fd_err;
   int status;
-  char buffer[1200];  /* if not completely read */
-  char buffer_err[1024];
-  char *pbuffer = buffer;
-  char *pbuffer_err = buffer_err;
 
   status = fork_child (pl, NULL, &fd, &fd_err);
   if (status < 0)
@@ -583,21 +759,31 @@ static void *exec_read_one (void *arg) /* {{{ */
 
   assert (pl->pid != 0);
 
-  FD_ZERO( &fdset );
-  FD_SET(fd, &fdset);
-  FD_SET(fd_err, &fdset);
-
-  /* Determine the highest file descriptor */
-  highest_fd = (fd > fd_err) ? fd : fd_err;
-
-  /* We use a copy of fdset, as select modifies it */
-  copy = fdset;
-
-  while (1)
+  if ((exec_stream_open (&pl->out, pl, fd, /* is_stderr = */ 0) != 0)
+      || (exec_stream_open (&pl->err, pl, fd_err, /* is_stderr = */ 1) != 0))
   {
-    int len;
+    kill (pl->pid, SIGTERM);
+    pl->out.fd = fd;
+    pl->err.fd = fd_err;
+  }
+  else while (1)
+  {
+    /* poll(2) rather than select(2): with many programs the descriptors
+     * easily exceed FD_SETSIZE. */
+    struct pollfd fds[2];
+    nfds_t fds_num = 1;
+
+    memset (fds, 0, sizeof (fds));
+    fds[0].fd = pl->out.fd;
+    fds[0].events = POLLIN;
+    if (pl->err.fd >= 0)
+    {
+      fds[1].fd = pl->err.fd;
+      fds[1].events = POLLIN;
+      fds_num = 2;
+    }
 
-    status = select (highest_fd + 1, &copy, NULL, NULL, NULL);
+    status = poll (fds, fds_num, /* timeout = */ -1);
     if (status < 0)
     {
       if (errno == EINTR)
@@ -605,119 +791,253 @@ static void *exec_read_one (void *arg) /* {{{ */
       break;
     }
 
-    if (FD_ISSET(fd, &copy))
+    if (fds[0].revents != 0)
     {
-      char *pnl;
-
-      len = read(fd, pbuffer, sizeof(buffer) - 1 - (pbuffer - buffer));
-
-      if (len < 0)
-      {
-        if (errno == EAGAIN || errno == EINTR)  continue;
+      /* EOF or error */
+      if (exec_stream_read (&pl->out) != 0)
         break;
+    }
+    else if ((fds_num > 1) && (fds[1].revents != 0))
+    {
+      if (exec_stream_read (&pl->err) != 0)
+      {
+        NOTICE ("exec plugin: Program `%s' has closed STDERR.", pl->exec);
+        exec_stream_close (&pl->err);
       }
-      else if (len == 0) break;  /* We've reached EOF */
+    }
+  }
 
-      pbuffer[len] = '\0';
+  exec_stream_close (&pl->out);
+  exec_stream_close (&pl->err);
 
-      len += pbuffer - buffer;
-      pbuffer = buffer;
+  DEBUG ("exec plugin: exec_read_one: Waiting for `%s' to exit.", pl->exec);
+  if (waitpid (pl->pid, &status, 0) > 0)
+    pl->status = status;
 
-      while ((pnl = strchr(pbuffer, '\n')))
-      {
-        *pnl = '\0';
-        if (*(pnl-1) == '\r' ) *(pnl-1) = '\0';
+  DEBUG ("exec plugin: Child %i exited with status %i.",
+      (int) pl->pid, pl->status);
 
-        parse_line (pbuffer);
+  pthread_mutex_lock (&pl_lock);
+  pl->pid = 0;
+  pl->flags &= ~PL_RUNNING;
+  pthread_mutex_unlock (&pl_lock);
 
-        pbuffer = ++pnl;
-      }
-      /* not completely read ? */
-      if (pbuffer - buffer < len)
-      {
-        len -= pbuffer - buffer;
-        memmove(buffer, pbuffer, len);
-        pbuffer = buffer + len;
-      }
-      else
-        pbuffer = buffer;
-    }
-    else if (FD_ISSET(fd_err, &copy))
-    {
-      char *pnl;
+  pthread_exit ((void *) 0);
+  return (NULL);
+} /* void *exec_read_one }}} */
+#else /* HAVE_SYS_EPOLL_H */
+/* Reaps the child of a program whose output has been closed. Returns zero if
+ * the child hasn't exited yet. */
+static int exec_reap (program_list_t *pl) /* {{{ */
+{
+  int status = 0;
+  pid_t pid;
 
-      len = read(fd_err, pbuffer_err, sizeof(buffer_err) - 1 - (pbuffer_err - buffer_err));
+  pid = waitpid (pl->pid, &status, WNOHANG);
+  if (pid == 0)
+    return (0);
 
-      if (len < 0)
-      {
-        if (errno == EAGAIN || errno == EINTR)
-          continue;
-        break;
-      }
-      else if (len == 0)
-      {
-        /* We've reached EOF */
-        NOTICE ("exec plugin: Program `%s' has closed STDERR.", pl->exec);
+  /* With ECHILD, the SIGCHLD handler has reaped it already. */
+  if (pid > 0)
+    pl->status = status;
 
-        /* Remove file descriptor form select() set. */
-        FD_CLR (fd_err, &fdset);
-        copy = fdset;
-        highest_fd = fd;
+  DEBUG ("exec plugin: Child %i exited with status %i.",
+      (int) pl->pid, pl->status);
 
-        /* Clean up file descriptor */
-        close (fd_err);
-        fd_err = -1;
-        continue;
-      }
+  pthread_mutex_lock (&pl_lock);
+  if (pl->flags & PL_EXITING)
+    exiting_num--;
+  pl->pid = 0;
+  pl->flags &= ~(PL_RUNNING | PL_EXITING);
+  pthread_mutex_unlock (&pl_lock);
 
-      pbuffer_err[len] = '\0';
+  return (1);
+} /* }}} int exec_reap */
 
-      len += pbuffer_err - buffer_err;
-      pbuffer_err = buffer_err;
+/* Closes the output of a program, e.g. at end of file. The child is reaped
+ * once it has exited. Closing the file descriptors removes them from the
+ * epoll set. */
+static void exec_finish (program_list_t *pl) /* {{{ */
+{
+  exec_stream_close (&pl->out);
+  exec_stream_close (&pl->err);
+  putval_batch_reset (&pl->batch);
 
-      while ((pnl = strchr(pbuffer_err, '\n')))
-      {
-        *pnl = '\0';
-        if (*(pnl-1) == '\r' ) *(pnl-1) = '\0';
+  if (exec_reap (pl))
+    return;
+
+  pthread_mutex_lock (&pl_lock);
+  pl->flags |= PL_EXITING;
+  exiting_num++;
+  pthread_mutex_unlock (&pl_lock);
+} /* }}} void exec_finish */
+
+static int exec_epoll_add (exec_stream_t *s) /* {{{ */
+{
+  struct epoll_event ev;
+  int flags;
+
+  /* Events of a closed stream may still be pending when the descriptor has
+   * been reused by the next child, so never block in read(2). */
+  flags = fcntl (s->fd, F_GETFL);
+  if ((flags < 0) || (fcntl (s->fd, F_SETFL, flags | O_NONBLOCK) != 0))
+    return (-1);
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = s;
+  return (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, s->fd, &ev));
+} /* }}} int exec_epoll_add */
+
+static void exec_io_register (program_list_t *pl) /* {{{ */
+{
+  char errbuf[1024];
+
+  /* See exec_start(). */
+  if (pl->out.fd < 0)
+  {
+    exec_finish (pl);
+    return;
+  }
+
+  if ((exec_epoll_add (&pl->out) != 0)
+      || ((pl->err.fd >= 0) && (exec_epoll_add (&pl->err) != 0)))
+  {
+    ERROR ("exec plugin: Adding the output of `%s' to the epoll set "
+        "failed: %s", pl->exec, sstrerror (errno, errbuf, sizeof (errbuf)));
+    kill (pl->pid, SIGTERM);
+    exec_finish (pl);
+  }
+} /* }}} void exec_io_register */
+
+static void *exec_io_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  while (42)
+  {
+    struct epoll_event events[32];
+    program_list_t *started;
+    program_list_t *pl;
+    int events_num;
+    int timeout;
+    int i;
+
+    pthread_mutex_lock (&pl_lock);
+    /* Children which closed their output without exiting are checked
+     * every second. */
+    timeout = (exiting_num > 0) ? 1000 : -1;
+    pthread_mutex_unlock (&pl_lock);
+
+    events_num = epoll_wait (epoll_fd, events, STATIC_ARRAY_SIZE (events),
+        timeout);
+    if (events_num < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+      ERROR ("exec plugin: epoll_wait failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
 
-        ERROR ("exec plugin: exec_read_one: error = %s", pbuffer_err);
+    for (i = 0; i < events_num; i++)
+    {
+      exec_stream_t *s;
 
-        pbuffer_err = ++pnl;
+      if (events[i].data.ptr == &wakeup_marker)
+      {
+        char buffer[64];
+        while (read (wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+          /* drain */;
+        continue;
       }
-      /* not completely read ? */
-      if (pbuffer_err - buffer_err < len)
+
+      /* Closed by an earlier event of this round. */
+      s = events[i].data.ptr;
+      if (s->fd < 0)
+        continue;
+
+      if (exec_stream_read (s) == 0)
+        continue;
+
+      if (s->is_stderr)
       {
-        len -= pbuffer_err - buffer_err;
-        memmove(buffer_err, pbuffer_err, len);
-        pbuffer_err = buffer_err + len;
+        NOTICE ("exec plugin: Program `%s' has closed STDERR.", s->pl->exec);
+        exec_stream_close (s);
       }
       else
-        pbuffer_err = buffer_err;
+        exec_finish (s->pl);
     }
-    /* reset copy */
-    copy = fdset;
-  }
 
-  DEBUG ("exec plugin: exec_read_one: Waiting for `%s' to exit.", pl->exec);
-  if (waitpid (pl->pid, &status, 0) > 0)
-    pl->status = status;
+    pthread_mutex_lock (&pl_lock);
+    if (io_thread_stop)
+    {
+      pthread_mutex_unlock (&pl_lock);
+      break;
+    }
+    started = start_head;
+    start_head = NULL;
+    pthread_mutex_unlock (&pl_lock);
 
-  DEBUG ("exec plugin: Child %i exited with status %i.",
-      (int) pl->pid, pl->status);
+    while (started != NULL)
+    {
+      pl = started;
+      started = pl->start_next;
+      pl->start_next = NULL;
+      exec_io_register (pl);
+    }
 
-  pl->pid = 0;
+    for (pl = pl_head; pl != NULL; pl = pl->next)
+      if (pl->flags & PL_EXITING)
+        exec_reap (pl);
+  } /* while (42) */
+
+  return ((void *) 0);
+} /* }}} void *exec_io_thread */
+
+/* Forks the program and hands its output to the I/O thread. */
+static int exec_start (program_list_t *pl) /* {{{ */
+{
+  int fd_out;
+  int fd_err;
+  int pid;
+
+  pid = fork_child (pl, NULL, &fd_out, &fd_err);
+  if (pid < 0)
+  {
+    pthread_mutex_lock (&pl_lock);
+    pl->flags &= ~PL_RUNNING;
+    pthread_mutex_unlock (&pl_lock);
+    return (-1);
+  }
+
+  if ((exec_stream_open (&pl->out, pl, fd_out, /* is_stderr = */ 0) != 0)
+      || (exec_stream_open (&pl->err, pl, fd_err, /* is_stderr = */ 1) != 0))
+  {
+    close (fd_out);
+    close (fd_err);
+    pl->out.fd = -1;
+    pl->err.fd = -1;
+    kill (pid, SIGTERM);
+  }
 
   pthread_mutex_lock (&pl_lock);
-  pl->flags &= ~PL_RUNNING;
+  pl->pid = pid;
+  pl->start_next = start_head;
+  start_head = pl;
   pthread_mutex_unlock (&pl_lock);
 
-  close (fd);
-  if (fd_err >= 0)
-    close (fd_err);
+  if (write (wakeup_pipe[1], "", 1) < 0)
+  {
+    char errbuf[1024];
+    if (errno != EAGAIN)
+      ERROR ("exec plugin: write to wakeup pipe failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
 
-  pthread_exit ((void *) 0);
-  return (NULL);
-} /* void *exec_read_one }}} */
+  return (0);
+} /* }}} int exec_start */
+#endif /* HAVE_SYS_EPOLL_H */
 
 static void *exec_notification_one (void *arg) /* {{{ */
 {
@@ -813,6 +1133,59 @@ static int exec_init (void) /* {{{ */
   sa.sa_handler = sigchld_handler;
   sigaction (SIGCHLD, &sa, NULL);
 
+#if HAVE_SYS_EPOLL_H
+  if (!io_thread_running)
+  {
+    char errbuf[1024];
+    struct epoll_event ev;
+    size_t i;
+    int status;
+
+    epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+      ERROR ("exec plugin: epoll_create1 failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+
+    if (pipe (wakeup_pipe) != 0)
+    {
+      ERROR ("exec plugin: pipe failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      wakeup_pipe[0] = wakeup_pipe[1] = -1;
+      close (epoll_fd);
+      epoll_fd = -1;
+      return (-1);
+    }
+    for (i = 0; i < STATIC_ARRAY_SIZE (wakeup_pipe); i++)
+    {
+      fcntl (wakeup_pipe[i], F_SETFL,
+          fcntl (wakeup_pipe[i], F_GETFL) | O_NONBLOCK);
+      fcntl (wakeup_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wakeup_marker;
+    status = epoll_ctl (epoll_fd, EPOLL_CTL_ADD, wakeup_pipe[0], &ev);
+    if (status == 0)
+      status = plugin_thread_create (&io_thread, /* attr = */ NULL,
+          exec_io_thread, /* arg = */ NULL);
+    if (status != 0)
+    {
+      ERROR ("exec plugin: Starting the I/O thread failed.");
+      close (wakeup_pipe[0]);
+      close (wakeup_pipe[1]);
+      wakeup_pipe[0] = wakeup_pipe[1] = -1;
+      close (epoll_fd);
+      epoll_fd = -1;
+      return (-1);
+    }
+    io_thread_running = 1;
+  }
+#endif
+
   return (0);
 } /* int exec_init }}} */
 
@@ -822,27 +1195,43 @@ static int exec_read (void) /* {{{ */
 
   for (pl = pl_head; pl != NULL; pl = pl->next)
   {
+#if !HAVE_SYS_EPOLL_H
     pthread_t t;
     pthread_attr_t attr;
+#endif
 
     /* Only execute `normal' style executables here. */
     if ((pl->flags & PL_NORMAL) == 0)
       continue;
 
     pthread_mutex_lock (&pl_lock);
-    /* Skip if a child is already running. */
+    /* Skip if a child is already running. "SignalExec" programs are asked
+     * to print their values instead. */
     if ((pl->flags & PL_RUNNING) != 0)
     {
+      if (((pl->flags & (PL_SIGNAL | PL_EXITING)) == PL_SIGNAL)
+          && (pl->pid > 0))
+      {
+        if (pl->signal_skip)
+          pl->signal_skip = 0;
+        else
+          kill (pl->pid, EXEC_COLLECT_SIGNAL);
+      }
       pthread_mutex_unlock (&pl_lock);
       continue;
     }
     pl->flags |= PL_RUNNING;
+    pl->signal_skip = 1;
     pthread_mutex_unlock (&pl_lock);
 
+#if HAVE_SYS_EPOLL_H
+    exec_start (pl);
+#else
     pthread_attr_init (&attr);
     pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
     plugin_thread_create (&t, &attr, exec_read_one, (void *) pl);
     pthread_attr_destroy (&attr);
+#endif
   } /* for (pl) */
 
   return (0);
@@ -895,24 +1284,99 @@ static int exec_shutdown (void) /* {{{ */
 {
   program_list_t *pl;
   program_list_t *next;
+#if !HAVE_SYS_EPOLL_H
+  int i;
+#endif
 
-  pl = pl_head;
-  while (pl != NULL)
+#if HAVE_SYS_EPOLL_H
+  if (io_thread_running)
   {
-    next = pl->next;
+    size_t i;
+
+    pthread_mutex_lock (&pl_lock);
+    io_thread_stop = 1;
+    pthread_mutex_unlock (&pl_lock);
 
+    if (write (wakeup_pipe[1], "", 1) < 0)
+    {
+      char errbuf[1024];
+      ERROR ("exec plugin: write to wakeup pipe failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+    pthread_join (io_thread, /* retval = */ NULL);
+    io_thread_running = 0;
+    io_thread_stop = 0;
+    start_head = NULL;
+
+    close (epoll_fd);
+    epoll_fd = -1;
+    for (i = 0; i < STATIC_ARRAY_SIZE (wakeup_pipe); i++)
+    {
+      close (wakeup_pipe[i]);
+      wakeup_pipe[i] = -1;
+    }
+  }
+#endif
+
+  for (pl = pl_head; pl != NULL; pl = pl->next)
+  {
     if (pl->pid > 0)
     {
       kill (pl->pid, SIGTERM);
       INFO ("exec plugin: Sent SIGTERM to %hu", (unsigned short int) pl->pid);
     }
+  }
+
+#if !HAVE_SYS_EPOLL_H
+  /* The threads of running programs use their entry until the program has
+   * exited. Give them a moment and leak the entries of those that don't
+   * finish in time rather than freeing memory that is still in use. */
+  for (i = 0; i < 20; i++)
+  {
+    struct timespec ts = { 0, 100000000 };
+    _Bool running = 0;
+
+    pthread_mutex_lock (&pl_lock);
+    for (pl = pl_head; pl != NULL; pl = pl->next)
+      if (pl->flags & PL_RUNNING)
+        running = 1;
+    pthread_mutex_unlock (&pl_lock);
 
+    if (!running)
+      break;
+    nanosleep (&ts, NULL);
+  }
+#endif
+
+  /* The SIGCHLD handler walks the list, so unlink it first. */
+  pthread_mutex_lock (&pl_lock);
+  pl = pl_head;
+  pl_head = NULL;
+  pthread_mutex_unlock (&pl_lock);
+  while (pl != NULL)
+  {
+    next = pl->next;
+
+#if !HAVE_SYS_EPOLL_H
+    if (pl->flags & PL_RUNNING)
+    {
+      WARNING ("exec plugin: `%s' is still running after shutdown.",
+          pl->exec);
+      pl = next;
+      continue;
+    }
+#endif
+
+    exec_stream_close (&pl->out);
+    exec_stream_close (&pl->err);
+    sfree (pl->out.buffer);
+    sfree (pl->err.buffer);
+    putval_batch_reset (&pl->batch);
     sfree (pl->user);
     sfree (pl);
 
     pl = next;
   } /* while (pl) */
-  pl_head = NULL;
 
   return (0);
 } /* int exec_shutdown }}} */
@@ -0,0 +1,1098 @@
+/**
+ * collectd - src/exposition.c
+ * Copyright (C) 2016  Florian octo Forster
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   Florian octo Forster <octo at collectd.org>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_cache.h"
+
+#include <pthread.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+/*
+ * The exposition plugin serves the rates in the value cache over HTTP, in the
+ * Prometheus text format. Scrapes arriving within "RenderInterval" of each
+ * other share one rendered (and, if requested, compressed) buffer.
+ *
+ * Every series keeps the text of its lines between renders. The metric name
+ * and labels ("prefix") of each line are built once, when the series is first
+ * seen; afterwards only the lines of series whose time changed are
+ * re-rendered. Series are sorted by "<plugin>/<type>/<identifier>", so that
+ * all lines of one metric can be emitted as one group.
+ */
+#define EX_DEFAULT_PORT "9103"
+#define EX_DEFAULT_RENDER_INTERVAL TIME_T_TO_CDTIME_T (1)
+#define EX_DEFAULT_MAX_CONNECTIONS 16
+#define EX_REQUEST_SIZE 8192
+#define EX_SOCKET_TIMEOUT 10
+
+struct ex_line_s
+{
+  size_t start;      /* offset of the line in "text" */
+  size_t prefix_len; /* metric name and labels */
+};
+typedef struct ex_line_s ex_line_t;
+
+struct ex_series_s
+{
+  char *key;          /* "<plugin>/<type>/<identifier>" */
+  char *name;         /* "<identifier>" */
+  size_t group_len;   /* strlen ("<plugin>/<type>/") */
+
+  cdtime_t time;
+  uint64_t generation;
+
+  char *text;
+  size_t text_len;
+  size_t text_size;
+
+  ex_line_t *lines;
+  size_t lines_num;
+};
+typedef struct ex_series_s ex_series_t;
+
+struct ex_buffer_s
+{
+  char *data;
+  size_t len;
+  size_t size;
+};
+typedef struct ex_buffer_s ex_buffer_t;
+
+/* Rendered output, shared by all clients until the next render. */
+struct ex_output_s
+{
+  cdtime_t time;
+  char *data;
+  size_t size;
+
+  char *gz_data;
+  size_t gz_size;
+  pthread_mutex_t gz_lock;
+
+  /* Protected by "output_lock". */
+  int refs;
+};
+typedef struct ex_output_s ex_output_t;
+
+/*
+ * Private variables
+ */
+static char *conf_host = NULL;
+static char *conf_port = NULL;
+static cdtime_t conf_render_interval = EX_DEFAULT_RENDER_INTERVAL;
+#if HAVE_ZLIB
+static _Bool conf_compress = 1;
+#else
+static _Bool conf_compress = 0;
+#endif
+static int conf_max_connections = EX_DEFAULT_MAX_CONNECTIONS;
+
+/* Protected by "render_lock". */
+static c_avl_tree_t *series_by_name = NULL;
+static c_avl_tree_t *series_by_key = NULL;
+static uint64_t generation = 0;
+static ex_buffer_t scratch;
+static size_t last_output_size = 0;
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ex_output_t *output = NULL;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int listen_fd = -1;
+static pthread_t listen_thread;
+static _Bool listen_thread_running = 0;
+
+/* Protected by "clients_lock". */
+static int loop = 0;
+static int clients_num = 0;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clients_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Buffers
+ */
+static int ex_buffer_reserve (ex_buffer_t *b, size_t len) /* {{{ */
+{
+  size_t size;
+  char *tmp;
+
+  if ((b->len + len) <= b->size)
+    return (0);
+
+  size = (b->size > 0) ? b->size : 4096;
+  while (size < (b->len + len))
+    size *= 2;
+
+  tmp = realloc (b->data, size);
+  if (tmp == NULL)
+    return (ENOMEM);
+
+  b->data = tmp;
+  b->size = size;
+  return (0);
+} /* }}} int ex_buffer_reserve */
+
+static int ex_buffer_append (ex_buffer_t *b, /* {{{ */
+    char const *data, size_t len)
+{
+  if (ex_buffer_reserve (b, len) != 0)
+    return (ENOMEM);
+
+  memcpy (b->data + b->len, data, len);
+  b->len += len;
+  return (0);
+} /* }}} int ex_buffer_append */
+
+static int ex_buffer_append_string (ex_buffer_t *b, char const *s) /* {{{ */
+{
+  return (ex_buffer_append (b, s, strlen (s)));
+} /* }}} int ex_buffer_append_string */
+
+/* Appends "s" with all characters not allowed in metric names replaced. */
+static int ex_buffer_append_name (ex_buffer_t *b, char const *s) /* {{{ */
+{
+  size_t len = strlen (s);
+  size_t i;
+
+  if (ex_buffer_reserve (b, len) != 0)
+    return (ENOMEM);
+
+  for (i = 0; i < len; i++)
+  {
+    char c = s[i];
+    if (!(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))
+          || ((c >= '0') && (c <= '9')) || (c == '_') || (c == ':')))
+      c = '_';
+    b->data[b->len++] = c;
+  }
+  return (0);
+} /* }}} int ex_buffer_append_name */
+
+static int ex_buffer_append_label (ex_buffer_t *b, /* {{{ */
+    _Bool first, char const *label, char const *value)
+{
+  size_t i;
+
+  if (ex_buffer_reserve (b, strlen (label) + 2 * strlen (value) + 4) != 0)
+    return (ENOMEM);
+
+  if (!first)
+    b->data[b->len++] = ',';
+  ex_buffer_append_string (b, label);
+  b->data[b->len++] = '=';
+  b->data[b->len++] = '"';
+  for (i = 0; value[i] != 0; i++)
+  {
+    if ((value[i] == '\\') || (value[i] == '"'))
+      b->data[b->len++] = '\\';
+    if (value[i] == '\n')
+    {
+      b->data[b->len++] = '\\';
+      b->data[b->len++] = 'n';
+      continue;
+    }
+    b->data[b->len++] = value[i];
+  }
+  b->data[b->len++] = '"';
+  return (0);
+} /* }}} int ex_buffer_append_label */
+
+/*
+ * Series
+ */
+static void ex_series_destroy (ex_series_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  sfree (s->key);
+  sfree (s->name);
+  sfree (s->text);
+  sfree (s->lines);
+  sfree (s);
+} /* }}} void ex_series_destroy */
+
+/* Builds the metric name and labels of each data source of "name".
+ * XXX: You must hold "render_lock" when calling this function! */
+static ex_series_t *ex_series_create (char const *name, /* {{{ */
+    size_t values_num)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  const data_set_t *ds;
+  ex_series_t *s;
+  size_t i;
+
+  if (parse_identifier_vl (name, &vl) != 0)
+    return (NULL);
+
+  ds = plugin_get_ds (vl.type);
+  if ((ds == NULL) || (ds->ds_num != values_num))
+    return (NULL);
+
+  s = calloc (1, sizeof (*s));
+  if (s == NULL)
+    return (NULL);
+
+  s->name = strdup (name);
+  s->lines = calloc (ds->ds_num, sizeof (*s->lines));
+  s->key = malloc (strlen (vl.plugin) + strlen (vl.type) + strlen (name) + 3);
+  if ((s->name == NULL) || (s->lines == NULL) || (s->key == NULL))
+  {
+    ex_series_destroy (s);
+    return (NULL);
+  }
+  s->lines_num = ds->ds_num;
+  s->group_len = strlen (vl.plugin) + strlen (vl.type) + 2;
+  sprintf (s->key, "%s/%s/%s", vl.plugin, vl.type, name);
+
+  /* The values are added by ex_series_update (). */
+  scratch.len = 0;
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    size_t start = scratch.len;
+
+    ex_buffer_append_string (&scratch, "collectd_");
+    ex_buffer_append_name (&scratch, vl.plugin);
+    if (strcmp (vl.plugin, vl.type) != 0)
+    {
+      ex_buffer_append_string (&scratch, "_");
+      ex_buffer_append_name (&scratch, vl.type);
+    }
+    if (strcmp ("value", ds->ds[i].name) != 0)
+    {
+      ex_buffer_append_string (&scratch, "_");
+      ex_buffer_append_name (&scratch, ds->ds[i].name);
+    }
+
+    ex_buffer_append_string (&scratch, "{");
+    ex_buffer_append_label (&scratch, 1, "instance", vl.host);
+    if (vl.plugin_instance[0] != 0)
+      ex_buffer_append_label (&scratch, 0, "plugin_instance",
+          vl.plugin_instance);
+    if (vl.type_instance[0] != 0)
+      ex_buffer_append_label (&scratch, 0, "type_instance", vl.type_instance);
+    if (ex_buffer_append_string (&scratch, "}\n") != 0)
+    {
+      ex_series_destroy (s);
+      return (NULL);
+    }
+
+    s->lines[i].start = start;
+    s->lines[i].prefix_len = scratch.len - start - 1;
+  }
+
+  s->text = malloc (scratch.len);
+  if (s->text == NULL)
+  {
+    ex_series_destroy (s);
+    return (NULL);
+  }
+  memcpy (s->text, scratch.data, scratch.len);
+  s->text_len = scratch.len;
+  s->text_size = scratch.len;
+
+  return (s);
+} /* }}} ex_series_t *ex_series_create */
+
+/* Re-renders the lines of "s", keeping their prefixes.
+ * XXX: You must hold "render_lock" when calling this function! */
+static int ex_series_update (ex_series_t *s, /* {{{ */
+    gauge_t const *values, cdtime_t t)
+{
+  char suffix[64];
+  uint64_t t_ms = CDTIME_T_TO_MS (t);
+  size_t i;
+
+  scratch.len = 0;
+  for (i = 0; i < s->lines_num; i++)
+  {
+    size_t start = scratch.len;
+
+    if (isnan (values[i]))
+      ssnprintf (suffix, sizeof (suffix), " NaN %"PRIu64"\n", t_ms);
+    else if (isinf (values[i]))
+      ssnprintf (suffix, sizeof (suffix), " %sInf %"PRIu64"\n",
+          (values[i] < 0.0) ? "-" : "+", t_ms);
+    else
+      ssnprintf (suffix, sizeof (suffix), " "GAUGE_FORMAT" %"PRIu64"\n",
+          values[i], t_ms);
+
+    ex_buffer_append (&scratch, s->text + s->lines[i].start,
+        s->lines[i].prefix_len);
+    if (ex_buffer_append_string (&scratch, suffix) != 0)
+      return (ENOMEM);
+
+    s->lines[i].start = start;
+  }
+
+  if (scratch.len > s->text_size)
+  {
+    char *tmp = realloc (s->text, scratch.len);
+    if (tmp == NULL)
+      return (ENOMEM);
+    s->text = tmp;
+    s->text_size = scratch.len;
+  }
+  memcpy (s->text, scratch.data, scratch.len);
+  s->text_len = scratch.len;
+  s->time = t;
+
+  return (0);
+} /* }}} int ex_series_update */
+
+static void ex_series_remove (ex_series_t *s) /* {{{ */
+{
+  c_avl_remove (series_by_name, s->name, NULL, NULL);
+  c_avl_remove (series_by_key, s->key, NULL, NULL);
+  ex_series_destroy (s);
+} /* }}} void ex_series_remove */
+
+/*
+ * Rendering
+ */
+static void ex_output_unref (ex_output_t *out) /* {{{ */
+{
+  int refs;
+
+  if (out == NULL)
+    return;
+
+  pthread_mutex_lock (&output_lock);
+  refs = --out->refs;
+  pthread_mutex_unlock (&output_lock);
+
+  if (refs > 0)
+    return;
+
+  pthread_mutex_destroy (&out->gz_lock);
+  sfree (out->data);
+  sfree (out->gz_data);
+  sfree (out);
+} /* }}} void ex_output_unref */
+
+/* Emits the lines of a group of series with the same plugin and type, one
+ * metric (data source) after the other. */
+static int ex_render_group (ex_buffer_t *b, /* {{{ */
+    ex_series_t **group, size_t group_num)
+{
+  size_t ds_num;
+  size_t i;
+  size_t j;
+
+  if (group_num == 0)
+    return (0);
+
+  ds_num = group[0]->lines_num;
+  for (i = 0; i < ds_num; i++)
+  {
+    char const *prefix = group[0]->text + group[0]->lines[i].start;
+    size_t name_len = strcspn (prefix, "{");
+
+    ex_buffer_append_string (b, "# TYPE ");
+    ex_buffer_append (b, prefix, name_len);
+    ex_buffer_append_string (b, " gauge\n");
+
+    for (j = 0; j < group_num; j++)
+    {
+      ex_series_t *s = group[j];
+      size_t end;
+
+      if ((i >= s->lines_num) || (s->time == 0))
+        continue;
+
+      end = ((i + 1) < s->lines_num) ? s->lines[i + 1].start : s->text_len;
+      if (ex_buffer_append (b, s->text + s->lines[i].start,
+            end - s->lines[i].start) != 0)
+        return (ENOMEM);
+    }
+  }
+
+  return (0);
+} /* }}} int ex_render_group */
+
+/* XXX: You must hold "render_lock" when calling this function! */
+static ex_output_t *ex_render (void) /* {{{ */
+{
+  uc_iter_t *iter;
+  c_avl_iterator_t *avl_iter;
+  char *name;
+  char *key;
+  ex_series_t *s;
+  ex_series_t **group = NULL;
+  size_t group_num = 0;
+  size_t group_size = 0;
+  ex_series_t **stale = NULL;
+  size_t stale_num = 0;
+  size_t stale_size = 0;
+  ex_buffer_t b = { NULL, 0, 0 };
+  ex_output_t *out;
+  size_t i;
+  int status = 0;
+
+  generation++;
+
+  iter = uc_get_iterator (/* prefix = */ NULL);
+  if (iter == NULL)
+    return (NULL);
+
+  while (uc_iterator_next (iter, &name) == 0)
+  {
+    gauge_t *values = NULL;
+    size_t values_num = 0;
+    cdtime_t t = 0;
+
+    uc_iterator_get_time (iter, &t);
+    uc_iterator_get_values (iter, &values, &values_num);
+
+    if (c_avl_get (series_by_name, name, (void *) &s) != 0)
+    {
+      s = ex_series_create (name, values_num);
+      if (s == NULL)
+        continue;
+      if (c_avl_insert (series_by_name, s->name, s) != 0)
+      {
+        ex_series_destroy (s);
+        continue;
+      }
+      if (c_avl_insert (series_by_key, s->key, s) != 0)
+      {
+        c_avl_remove (series_by_name, s->name, NULL, NULL);
+        ex_series_destroy (s);
+        continue;
+      }
+    }
+
+    if ((s->time != t) && (values_num == s->lines_num))
+      ex_series_update (s, values, t);
+    s->generation = generation;
+  }
+  uc_iterator_destroy (iter);
+
+  if (ex_buffer_reserve (&b, last_output_size + last_output_size / 8) != 0)
+    return (NULL);
+
+  avl_iter = c_avl_get_iterator (series_by_key);
+  while ((status == 0)
+      && (c_avl_iterator_next (avl_iter, (void *) &key, (void *) &s) == 0))
+  {
+    ex_series_t **tmp;
+
+    /* Series that have been removed from the cache. */
+    if (s->generation != generation)
+    {
+      if (stale_num >= stale_size)
+      {
+        stale_size = (stale_size > 0) ? 2 * stale_size : 64;
+        tmp = realloc (stale, stale_size * sizeof (*stale));
+        if (tmp == NULL)
+        {
+          status = ENOMEM;
+          break;
+        }
+        stale = tmp;
+      }
+      stale[stale_num++] = s;
+      continue;
+    }
+
+    if ((group_num > 0) && ((group[0]->group_len != s->group_len)
+          || (strncmp (group[0]->key, s->key, s->group_len) != 0)))
+    {
+      status = ex_render_group (&b, group, group_num);
+      group_num = 0;
+    }
+
+    if (group_num >= group_size)
+    {
+      group_size = (group_size > 0) ? 2 * group_size : 64;
+      tmp = realloc (group, group_size * sizeof (*group));
+      if (tmp == NULL)
+      {
+        status = ENOMEM;
+        break;
+      }
+      group = tmp;
+    }
+    group[group_num++] = s;
+  }
+  c_avl_iterator_destroy (avl_iter);
+
+  if (status == 0)
+    status = ex_render_group (&b, group, group_num);
+
+  for (i = 0; i < stale_num; i++)
+    ex_series_remove (stale[i]);
+  sfree (stale);
+  sfree (group);
+
+  if (status != 0)
+  {
+    ERROR ("exposition plugin: Rendering the value cache failed.");
+    sfree (b.data);
+    return (NULL);
+  }
+
+  out = calloc (1, sizeof (*out));
+  if (out == NULL)
+  {
+    sfree (b.data);
+    return (NULL);
+  }
+  out->time = cdtime ();
+  out->data = b.data;
+  out->size = b.len;
+  out->refs = 1;
+  pthread_mutex_init (&out->gz_lock, /* attr = */ NULL);
+
+  last_output_size = b.len;
+  return (out);
+} /* }}} ex_output_t *ex_render */
+
+/* Returns a reference to output that is at most "RenderInterval" old,
+ * rendering it if necessary. Only one thread renders at a time; concurrent
+ * callers wait for it and share the result. */
+static ex_output_t *ex_output_get (void) /* {{{ */
+{
+  ex_output_t *out = NULL;
+  ex_output_t *old;
+
+  pthread_mutex_lock (&render_lock);
+
+  pthread_mutex_lock (&output_lock);
+  if ((output != NULL)
+      && ((cdtime () - output->time) < conf_render_interval))
+  {
+    out = output;
+    out->refs++;
+  }
+  pthread_mutex_unlock (&output_lock);
+
+  if (out != NULL)
+  {
+    pthread_mutex_unlock (&render_lock);
+    return (out);
+  }
+
+  out = ex_render ();
+  if (out == NULL)
+  {
+    pthread_mutex_unlock (&render_lock);
+    return (NULL);
+  }
+
+  pthread_mutex_lock (&output_lock);
+  old = output;
+  output = out;
+  out->refs++;
+  pthread_mutex_unlock (&output_lock);
+
+  pthread_mutex_unlock (&render_lock);
+
+  ex_output_unref (old);
+  return (out);
+} /* }}} ex_output_t *ex_output_get */
+
+#if HAVE_ZLIB
+/* Compresses "out" once. Returns non-zero if compression failed, in which
+ * case the uncompressed data is sent. */
+static int ex_output_gzip (ex_output_t *out) /* {{{ */
+{
+  z_stream z;
+  size_t size;
+  int status;
+
+  pthread_mutex_lock (&out->gz_lock);
+  if (out->gz_data != NULL)
+  {
+    pthread_mutex_unlock (&out->gz_lock);
+    return (0);
+  }
+
+  memset (&z, 0, sizeof (z));
+  /* 16 + MAX_WBITS selects the gzip format. */
+  status = deflateInit2 (&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+      16 + MAX_WBITS, /* memLevel = */ 8, Z_DEFAULT_STRATEGY);
+  if (status != Z_OK)
+  {
+    pthread_mutex_unlock (&out->gz_lock);
+    ERROR ("exposition plugin: deflateInit2 failed with status %i.", status);
+    return (-1);
+  }
+
+  size = (size_t) deflateBound (&z, (uLong) out->size);
+  out->gz_data = malloc (size);
+  if (out->gz_data == NULL)
+  {
+    deflateEnd (&z);
+    pthread_mutex_unlock (&out->gz_lock);
+    return (ENOMEM);
+  }
+
+  z.next_in = (Bytef *) out->data;
+  z.avail_in = (uInt) out->size;
+  z.next_out = (Bytef *) out->gz_data;
+  z.avail_out = (uInt) size;
+
+  status = deflate (&z, Z_FINISH);
+  if (status != Z_STREAM_END)
+  {
+    ERROR ("exposition plugin: deflate failed with status %i.", status);
+    sfree (out->gz_data);
+    deflateEnd (&z);
+    pthread_mutex_unlock (&out->gz_lock);
+    return (-1);
+  }
+  out->gz_size = size - z.avail_out;
+  deflateEnd (&z);
+
+  pthread_mutex_unlock (&out->gz_lock);
+  return (0);
+} /* }}} int ex_output_gzip */
+#endif
+
+/*
+ * HTTP
+ */
+static int ex_send_response (int fd, char const *status_line, /* {{{ */
+    char const *encoding, char const *body, size_t body_size)
+{
+  char header[512];
+
+  ssnprintf (header, sizeof (header),
+      "HTTP/1.1 %s\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %zu\r\n"
+      "%s%s%s"
+      "Connection: close\r\n"
+      "\r\n",
+      status_line, body_size,
+      (encoding != NULL) ? "Content-Encoding: " : "",
+      (encoding != NULL) ? encoding : "",
+      (encoding != NULL) ? "\r\n" : "");
+
+  if (swrite (fd, header, strlen (header)) != 0)
+    return (-1);
+  if ((body_size > 0) && (swrite (fd, body, body_size) != 0))
+    return (-1);
+  return (0);
+} /* }}} int ex_send_response */
+
+/* Returns true if the request headers contain "Accept-Encoding" with
+ * "gzip". */
+static _Bool ex_accepts_gzip (char const *headers) /* {{{ */
+{
+  static char const field[] = "Accept-Encoding:";
+  char const *line = headers;
+
+  while ((line != NULL) && (line[0] != 0))
+  {
+    char const *end = strstr (line, "\r\n");
+    size_t len = (end != NULL) ? (size_t) (end - line) : strlen (line);
+
+    if ((len > sizeof (field)) && (strncasecmp (line, field,
+            sizeof (field) - 1) == 0))
+    {
+      size_t i;
+      for (i = sizeof (field) - 1; (i + 4) <= len; i++)
+        if (strncasecmp (line + i, "gzip", 4) == 0)
+          return (1);
+    }
+
+    line = (end != NULL) ? end + 2 : NULL;
+  }
+
+  return (0);
+} /* }}} _Bool ex_accepts_gzip */
+
+static void ex_handle_client (int fd) /* {{{ */
+{
+  char request[EX_REQUEST_SIZE];
+  size_t request_len = 0;
+  char *path;
+  char *end;
+  ex_output_t *out;
+  char const *encoding = NULL;
+  char const *body;
+  size_t body_size;
+
+  /* Read the request line and headers. The body, if any, is ignored. */
+  while (request_len < (sizeof (request) - 1))
+  {
+    ssize_t status = read (fd, request + request_len,
+        sizeof (request) - 1 - request_len);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (status == 0)
+      return;
+
+    request_len += (size_t) status;
+    request[request_len] = 0;
+    if (strstr (request, "\r\n\r\n") != NULL)
+      break;
+  }
+  request[request_len] = 0;
+
+  if (strncmp (request, "GET ", 4) != 0)
+  {
+    ex_send_response (fd, "405 Method Not Allowed", NULL, NULL, 0);
+    return;
+  }
+
+  path = request + 4;
+  end = path + strcspn (path, " ?\r\n");
+  if (((end - path) != 1 || (path[0] != '/'))
+      && (((end - path) != 8) || (strncmp (path, "/metrics", 8) != 0)))
+  {
+    ex_send_response (fd, "404 Not Found", NULL, NULL, 0);
+    return;
+  }
+
+  out = ex_output_get ();
+  if (out == NULL)
+  {
+    ex_send_response (fd, "500 Internal Server Error", NULL, NULL, 0);
+    return;
+  }
+
+  body = out->data;
+  body_size = out->size;
+#if HAVE_ZLIB
+  if (conf_compress && ex_accepts_gzip (strstr (request, "\r\n"))
+      && (ex_output_gzip (out) == 0))
+  {
+    encoding = "gzip";
+    body = out->gz_data;
+    body_size = out->gz_size;
+  }
+#endif
+
+  ex_send_response (fd, "200 OK", encoding, body, body_size);
+  ex_output_unref (out);
+} /* }}} void ex_handle_client */
+
+static void *ex_client_thread (void *arg) /* {{{ */
+{
+  int fd = *((int *) arg);
+
+  sfree (arg);
+
+  ex_handle_client (fd);
+  close (fd);
+
+  pthread_mutex_lock (&clients_lock);
+  clients_num--;
+  pthread_cond_broadcast (&clients_cond);
+  pthread_mutex_unlock (&clients_lock);
+
+  return (NULL);
+} /* }}} void *ex_client_thread */
+
+static void *ex_listen_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  pthread_attr_t attr;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  while (42)
+  {
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    struct timeval tv = { EX_SOCKET_TIMEOUT, 0 };
+    pthread_t th;
+    int *fd;
+    int status;
+
+    pthread_mutex_lock (&clients_lock);
+    status = loop;
+    pthread_mutex_unlock (&clients_lock);
+    if (status == 0)
+      break;
+
+    /* Wake up periodically to check "loop". */
+    status = poll (&pfd, 1, /* timeout = */ 1000);
+    if (status <= 0)
+      continue;
+
+    status = accept (listen_fd, NULL, NULL);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if ((errno == EINTR) || (errno == EAGAIN) || (errno == ECONNABORTED))
+        continue;
+
+      ERROR ("exposition plugin: accept failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+
+    setsockopt (status, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    setsockopt (status, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+    pthread_mutex_lock (&clients_lock);
+    if (clients_num >= conf_max_connections)
+    {
+      pthread_mutex_unlock (&clients_lock);
+      ex_send_response (status, "503 Service Unavailable", NULL, NULL, 0);
+      close (status);
+      continue;
+    }
+    clients_num++;
+    pthread_mutex_unlock (&clients_lock);
+
+    fd = malloc (sizeof (*fd));
+    if (fd != NULL)
+    {
+      *fd = status;
+      if (plugin_thread_create (&th, &attr, ex_client_thread, fd) == 0)
+        continue;
+      sfree (fd);
+    }
+
+    ERROR ("exposition plugin: Starting a client thread failed.");
+    close (status);
+    pthread_mutex_lock (&clients_lock);
+    clients_num--;
+    pthread_mutex_unlock (&clients_lock);
+  }
+
+  pthread_attr_destroy (&attr);
+  return (NULL);
+} /* }}} void *ex_listen_thread */
+
+static int ex_open_socket (void) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list;
+  struct addrinfo *ai_ptr;
+  int status;
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_flags = AI_PASSIVE;
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+
+  status = getaddrinfo (conf_host,
+      (conf_port != NULL) ? conf_port : EX_DEFAULT_PORT,
+      &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("exposition plugin: getaddrinfo (%s, %s) failed: %s",
+        (conf_host != NULL) ? conf_host : "(any)",
+        (conf_port != NULL) ? conf_port : EX_DEFAULT_PORT,
+        gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    int one = 1;
+
+    listen_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (listen_fd < 0)
+      continue;
+
+    setsockopt (listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+    if ((bind (listen_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+        && (listen (listen_fd, /* backlog = */ 16) == 0))
+      break;
+
+    close (listen_fd);
+    listen_fd = -1;
+  }
+  freeaddrinfo (ai_list);
+
+  if (listen_fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("exposition plugin: Unable to listen on %s:%s: %s",
+        (conf_host != NULL) ? conf_host : "(any)",
+        (conf_port != NULL) ? conf_port : EX_DEFAULT_PORT,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int ex_open_socket */
+
+/*
+ * Callbacks
+ */
+static int ex_config (oconfig_item_t *ci) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("Host", child->key) == 0)
+      cf_util_get_string (child, &conf_host);
+    else if (strcasecmp ("Port", child->key) == 0)
+      cf_util_get_service (child, &conf_port);
+    else if (strcasecmp ("RenderInterval", child->key) == 0)
+      cf_util_get_cdtime (child, &conf_render_interval);
+    else if (strcasecmp ("Compress", child->key) == 0)
+    {
+      cf_util_get_boolean (child, &conf_compress);
+#if !HAVE_ZLIB
+      if (conf_compress)
+      {
+        WARNING ("exposition plugin: Compression is not available, "
+            "because collectd was built without zlib.");
+        conf_compress = 0;
+      }
+#endif
+    }
+    else if (strcasecmp ("MaxConnections", child->key) == 0)
+    {
+      cf_util_get_int (child, &conf_max_connections);
+      if (conf_max_connections < 1)
+        conf_max_connections = 1;
+    }
+    else
+      WARNING ("exposition plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+  }
+
+  return (0);
+} /* }}} int ex_config */
+
+static int ex_init (void) /* {{{ */
+{
+  int status;
+
+  if (loop != 0)
+    return (0);
+
+  series_by_name = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  series_by_key = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  if ((series_by_name == NULL) || (series_by_key == NULL))
+  {
+    ERROR ("exposition plugin: c_avl_create failed.");
+    return (-1);
+  }
+
+  if (ex_open_socket () != 0)
+    return (-1);
+
+  loop = 1;
+  status = plugin_thread_create (&listen_thread, /* attr = */ NULL,
+      ex_listen_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("exposition plugin: Starting the listen thread failed.");
+    loop = 0;
+    close (listen_fd);
+    listen_fd = -1;
+    return (-1);
+  }
+  listen_thread_running = 1;
+
+  return (0);
+} /* }}} int ex_init */
+
+static int ex_shutdown (void) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  pthread_mutex_lock (&clients_lock);
+  loop = 0;
+  pthread_mutex_unlock (&clients_lock);
+  if (listen_thread_running)
+  {
+    pthread_join (listen_thread, /* retval = */ NULL);
+    listen_thread_running = 0;
+  }
+  if (listen_fd >= 0)
+  {
+    close (listen_fd);
+    listen_fd = -1;
+  }
+
+  /* Clients time out after EX_SOCKET_TIMEOUT seconds at the latest. */
+  pthread_mutex_lock (&clients_lock);
+  while (clients_num > 0)
+    pthread_cond_wait (&clients_cond, &clients_lock);
+  pthread_mutex_unlock (&clients_lock);
+
+  pthread_mutex_lock (&output_lock);
+  value = output;
+  output = NULL;
+  pthread_mutex_unlock (&output_lock);
+  ex_output_unref (value);
+
+  pthread_mutex_lock (&render_lock);
+  if (series_by_name != NULL)
+  {
+    /* The keys and values are owned by the series in "series_by_key". */
+    c_avl_destroy (series_by_name);
+    series_by_name = NULL;
+  }
+  if (series_by_key != NULL)
+  {
+    while (c_avl_pick (series_by_key, &key, &value) == 0)
+      ex_series_destroy (value);
+    c_avl_destroy (series_by_key);
+    series_by_key = NULL;
+  }
+  sfree (scratch.data);
+  scratch.len = 0;
+  scratch.size = 0;
+  pthread_mutex_unlock (&render_lock);
+
+  sfree (conf_host);
+  sfree (conf_port);
+  return (0);
+} /* }}} int ex_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("exposition", ex_config);
+  plugin_register_init ("exposition", ex_init);
+  plugin_register_shutdown ("exposition", ex_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
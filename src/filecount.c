@@ -24,6 +24,8 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "configfile.h"
+#include "utils_avltree.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,8 +33,49 @@
 #include <dirent.h>
 #include <fnmatch.h>
 
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
 #define FC_RECURSIVE 1
 #define FC_HIDDEN 2
+#define FC_INOTIFY 4
+
+/* Default of the "RescanInterval" option. */
+#define FC_RESCAN_INTERVAL_DEFAULT TIME_T_TO_CDTIME_T (3600)
+
+struct fc_counts_s
+{
+  uint64_t files_num;
+  uint64_t files_size;
+};
+typedef struct fc_counts_s fc_counts_t;
+
+#if HAVE_SYS_INOTIFY_H
+/*
+ * With the "Inotify" option, every directory below a configured one is
+ * watched and keeps the counts of the files directly in it. A read only
+ * reads the directories again in which files have been created, removed or
+ * written since the previous read. When directories are created, removed or
+ * moved, when events have been lost and every "RescanInterval", the whole
+ * tree is read again.
+ */
+typedef struct fc_node_s fc_node_t;
+struct fc_node_s
+{
+  int wd;
+  char *path;
+  _Bool dirty;
+  fc_counts_t counts;
+};
+
+# define FC_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+    | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#endif /* HAVE_SYS_INOTIFY_H */
 
 struct fc_directory_conf_s
 {
@@ -42,8 +85,15 @@ struct fc_directory_conf_s
   int options;
 
   /* Data counters */
-  uint64_t files_num;
-  uint64_t files_size;
+  fc_counts_t counts;
+
+  cdtime_t rescan_interval;
+#if HAVE_SYS_INOTIFY_H
+  int inotify_fd;
+  /* The watched directories, by watch descriptor. */
+  c_avl_tree_t *nodes;
+  cdtime_t next_rescan;
+#endif
 
   /* Selectors */
   char *name;
@@ -63,7 +113,7 @@ static void fc_submit_dir (const fc_directory_conf_t *dir)
   value_t values[1];
   value_list_t vl = VALUE_LIST_INIT;
 
-  values[0].gauge = (gauge_t) dir->files_num;
+  values[0].gauge = (gauge_t) dir->counts.files_num;
 
   vl.values = values;
   vl.values_len = STATIC_ARRAY_SIZE (values);
@@ -74,7 +124,7 @@ static void fc_submit_dir (const fc_directory_conf_t *dir)
 
   plugin_dispatch_values (&vl);
 
-  values[0].gauge = (gauge_t) dir->files_size;
+  values[0].gauge = (gauge_t) dir->counts.files_size;
   sstrncpy (vl.type, "bytes", sizeof (vl.type));
 
   plugin_dispatch_values (&vl);
@@ -88,6 +138,8 @@ static void fc_submit_dir (const fc_directory_conf_t *dir)
  *     Name "*.conf"
  *     MTime -3600
  *     Size "+10M"
+ *     Inotify true
+ *     RescanInterval 3600
  *   </Directory>
  * </Plugin>
  *
@@ -366,6 +418,10 @@ static int fc_config_add_dir (oconfig_item_t *ci)
   dir->name = NULL;
   dir->mtime = 0;
   dir->size = 0;
+  dir->rescan_interval = FC_RESCAN_INTERVAL_DEFAULT;
+#if HAVE_SYS_INOTIFY_H
+  dir->inotify_fd = -1;
+#endif
 
   status = 0;
   for (i = 0; i < ci->children_num; i++)
@@ -384,6 +440,10 @@ static int fc_config_add_dir (oconfig_item_t *ci)
       status = fc_config_add_dir_option (dir, option, FC_RECURSIVE);
     else if (strcasecmp ("IncludeHidden", option->key) == 0)
       status = fc_config_add_dir_option (dir, option, FC_HIDDEN);
+    else if (strcasecmp ("Inotify", option->key) == 0)
+      status = fc_config_add_dir_option (dir, option, FC_INOTIFY);
+    else if (strcasecmp ("RescanInterval", option->key) == 0)
+      status = cf_util_get_cdtime (option, &dir->rescan_interval);
     else
     {
       WARNING ("filecount plugin: fc_config_add_dir: "
@@ -395,6 +455,23 @@ static int fc_config_add_dir (oconfig_item_t *ci)
       break;
   } /* for (ci->children) */
 
+  if ((status == 0) && (dir->options & FC_INOTIFY))
+  {
+#if HAVE_SYS_INOTIFY_H
+    /* Whether a file matches depends on the time of the read. */
+    if (dir->mtime != 0)
+    {
+      WARNING ("filecount plugin: The `Inotify' option cannot be combined "
+          "with `MTime' and is ignored for `%s'.", dir->path);
+      dir->options &= ~FC_INOTIFY;
+    }
+#else
+    WARNING ("filecount plugin: The `Inotify' option is not supported on "
+        "this system and is ignored for `%s'.", dir->path);
+    dir->options &= ~FC_INOTIFY;
+#endif
+  }
+
   if (status == 0)
   {
     fc_directory_conf_t **temp;
@@ -456,43 +533,12 @@ static int fc_init (void)
   return (0);
 } /* int fc_init */
 
-static int fc_read_dir_callback (const char *dirname, const char *filename,
-    void *user_data)
+/* Adds the file to `counts' if it is selected. */
+static void fc_account_file (fc_directory_conf_t *dir, /* {{{ */
+    const struct stat *statbuf, fc_counts_t *counts)
 {
-  fc_directory_conf_t *dir = user_data;
-  char abs_path[PATH_MAX];
-  struct stat statbuf;
-  int status;
-
-  if (dir == NULL)
-    return (-1);
-
-  ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, filename);
-
-  status = lstat (abs_path, &statbuf);
-  if (status != 0)
-  {
-    ERROR ("filecount plugin: stat (%s) failed.", abs_path);
-    return (-1);
-  }
-
-  if (S_ISDIR (statbuf.st_mode) && (dir->options & FC_RECURSIVE))
-  {
-    status = walk_directory (abs_path, fc_read_dir_callback, dir,
-        /* include hidden = */ (dir->options & FC_HIDDEN) ? 1 : 0);
-    return (status);
-  }
-  else if (!S_ISREG (statbuf.st_mode))
-  {
-    return (0);
-  }
-
-  if (dir->name != NULL)
-  {
-    status = fnmatch (dir->name, filename, /* flags = */ 0);
-    if (status != 0)
-      return (0);
-  }
+  if (!S_ISREG (statbuf->st_mode))
+    return;
 
   if (dir->mtime != 0)
   {
@@ -507,9 +553,9 @@ static int fc_read_dir_callback (const char *dirname, const char *filename,
         (dir->mtime < 0) ? "after" : "before",
         (unsigned int) mtime);
 
-    if (((dir->mtime < 0) && (statbuf.st_mtime < mtime))
-        || ((dir->mtime > 0) && (statbuf.st_mtime > mtime)))
-      return (0);
+    if (((dir->mtime < 0) && (statbuf->st_mtime < mtime))
+        || ((dir->mtime > 0) && (statbuf->st_mtime > mtime)))
+      return;
   }
 
   if (dir->size != 0)
@@ -521,32 +567,373 @@ static int fc_read_dir_callback (const char *dirname, const char *filename,
     else
       size = (off_t) dir->size;
 
-    if (((dir->size < 0) && (statbuf.st_size > size))
-        || ((dir->size > 0) && (statbuf.st_size < size)))
-      return (0);
+    if (((dir->size < 0) && (statbuf->st_size > size))
+        || ((dir->size > 0) && (statbuf->st_size < size)))
+      return;
+  }
+
+  counts->files_num++;
+  counts->files_size += (uint64_t) statbuf->st_size;
+} /* }}} void fc_account_file */
+
+/* Called for each subdirectory of a recursive directory. `fd' is the open
+ * subdirectory and is closed by the callback. */
+typedef int (*fc_subdir_cb) (fc_directory_conf_t *dir, int fd,
+    const char *path, fc_counts_t *counts);
+
+/* Reads the directory open as `fd', which it closes, and adds the selected
+ * files to `counts'. The entries are examined relative to the directory and
+ * only regular files with a matching name are stat'ed. */
+static int fc_scan_dir (fc_directory_conf_t *dir, int fd, /* {{{ */
+    const char *path, fc_counts_t *counts, fc_subdir_cb subdir_cb)
+{
+  struct dirent *ent;
+  DIR *dh;
+  int success = 0;
+  int failure = 0;
+
+  dh = fdopendir (fd);
+  if (dh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("filecount plugin: Cannot open `%s': %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    return (-1);
+  }
+
+  while ((ent = readdir (dh)) != NULL)
+  {
+    struct stat statbuf;
+    _Bool is_dir = 0;
+
+    if (dir->options & FC_HIDDEN)
+    {
+      if ((strcmp (".", ent->d_name) == 0)
+          || (strcmp ("..", ent->d_name) == 0))
+        continue;
+    }
+    else if (ent->d_name[0] == '.')
+      continue;
+
+    /* Only regular files are counted, so directories and everything else
+     * can be told apart without a stat(2) call where the file system reports
+     * the type. */
+    if (ent->d_type == DT_DIR)
+      is_dir = 1;
+    else if ((ent->d_type != DT_REG) && (ent->d_type != DT_UNKNOWN))
+      continue;
+    else if ((ent->d_type == DT_REG) && (dir->name != NULL)
+        && (fnmatch (dir->name, ent->d_name, /* flags = */ 0) != 0))
+      continue;
+
+    if (!is_dir)
+    {
+      if (fstatat (dirfd (dh), ent->d_name, &statbuf,
+            AT_SYMLINK_NOFOLLOW) != 0)
+      {
+        /* Files in spool directories come and go all the time. */
+        if (errno == ENOENT)
+          continue;
+        ERROR ("filecount plugin: stat (%s/%s) failed.", path, ent->d_name);
+        failure++;
+        continue;
+      }
+      is_dir = S_ISDIR (statbuf.st_mode) ? 1 : 0;
+    }
+
+    if (is_dir)
+    {
+      char sub_path[PATH_MAX];
+      int sub_fd;
+
+      if (!(dir->options & FC_RECURSIVE) || (subdir_cb == NULL))
+        continue;
+
+      ssnprintf (sub_path, sizeof (sub_path), "%s/%s", path, ent->d_name);
+      sub_fd = openat (dirfd (dh), ent->d_name,
+          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (sub_fd < 0)
+      {
+        if (errno == ENOENT)
+          continue;
+        ERROR ("filecount plugin: Cannot open `%s'.", sub_path);
+        failure++;
+        continue;
+      }
+
+      if ((*subdir_cb) (dir, sub_fd, sub_path, counts) != 0)
+        failure++;
+      else
+        success++;
+      continue;
+    }
+
+    if ((dir->name != NULL) && (ent->d_type == DT_UNKNOWN)
+        && (fnmatch (dir->name, ent->d_name, /* flags = */ 0) != 0))
+      continue;
+
+    fc_account_file (dir, &statbuf, counts);
+    success++;
   }
 
-  dir->files_num++;
-  dir->files_size += (uint64_t) statbuf.st_size;
+  closedir (dh);
 
+  if ((success == 0) && (failure > 0))
+    return (-1);
   return (0);
-} /* int fc_read_dir_callback */
+} /* }}} int fc_scan_dir */
+
+static int fc_open_dir (const char *path) /* {{{ */
+{
+  int fd;
+
+  fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("filecount plugin: Cannot open `%s': %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+
+  return (fd);
+} /* }}} int fc_open_dir */
+
+/* Without inotify, subdirectories are added to the counts of their parent. */
+static int fc_scan_subdir (fc_directory_conf_t *dir, int fd, /* {{{ */
+    const char *path, fc_counts_t *counts)
+{
+  return (fc_scan_dir (dir, fd, path, counts, fc_scan_subdir));
+} /* }}} int fc_scan_subdir */
+
+#if HAVE_SYS_INOTIFY_H
+static int fc_wd_compare (const int *a, const int *b) /* {{{ */
+{
+  return ((*a > *b) - (*a < *b));
+} /* }}} int fc_wd_compare */
+
+static void fc_inotify_stop (fc_directory_conf_t *dir) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (dir->nodes != NULL)
+  {
+    while (c_avl_pick (dir->nodes, &key, &value) == 0)
+    {
+      fc_node_t *n = value;
+      sfree (n->path);
+      sfree (n);
+    }
+    c_avl_destroy (dir->nodes);
+    dir->nodes = NULL;
+  }
+
+  /* Closing the descriptor removes all watches. */
+  if (dir->inotify_fd >= 0)
+    close (dir->inotify_fd);
+  dir->inotify_fd = -1;
+} /* }}} void fc_inotify_stop */
+
+/* Starts watching the directory `path', open as `fd', and counts its files.
+ * Subdirectories get watches and counts of their own. */
+static int fc_watch_subdir (fc_directory_conf_t *dir, int fd, /* {{{ */
+    const char *path, __attribute__((unused)) fc_counts_t *counts)
+{
+  fc_node_t *n;
+
+  n = calloc (1, sizeof (*n));
+  if (n == NULL)
+  {
+    ERROR ("filecount plugin: calloc failed.");
+    close (fd);
+    return (-1);
+  }
+
+  /* Watched before it is read, so that no change is missed. */
+  n->wd = inotify_add_watch (dir->inotify_fd, path, FC_WATCH_MASK);
+  n->path = strdup (path);
+  if ((n->wd < 0) || (n->path == NULL)
+      || (c_avl_insert (dir->nodes, &n->wd, n) != 0))
+  {
+    char errbuf[1024];
+    WARNING ("filecount plugin: Watching `%s' failed: %s", path,
+        (n->wd < 0) ? sstrerror (errno, errbuf, sizeof (errbuf))
+        : "out of memory");
+    sfree (n->path);
+    sfree (n);
+    close (fd);
+    return (-1);
+  }
+
+  return (fc_scan_dir (dir, fd, path, &n->counts, fc_watch_subdir));
+} /* }}} int fc_watch_subdir */
+
+/* Watches and reads the whole tree again. Returns non-zero if inotify cannot
+ * be used for `dir', which is then read without it from then on. */
+static int fc_inotify_rescan (fc_directory_conf_t *dir) /* {{{ */
+{
+  int fd;
+
+  fc_inotify_stop (dir);
+
+  dir->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  dir->nodes = c_avl_create ((void *) fc_wd_compare);
+  if ((dir->inotify_fd < 0) || (dir->nodes == NULL))
+  {
+    char errbuf[1024];
+    ERROR ("filecount plugin: inotify_init1 failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    fc_inotify_stop (dir);
+    return (-1);
+  }
+
+  fd = fc_open_dir (dir->path);
+  if (fd < 0)
+  {
+    /* Try again next time, the directory may not exist yet. */
+    fc_inotify_stop (dir);
+    return (0);
+  }
+
+  if (fc_watch_subdir (dir, fd, dir->path, NULL) != 0)
+  {
+    /* Most likely, fs.inotify.max_user_watches has been reached. */
+    WARNING ("filecount plugin: Cannot watch all directories below `%s', "
+        "reading it every interval.", dir->path);
+    fc_inotify_stop (dir);
+    return (-1);
+  }
+
+  dir->next_rescan = cdtime () + dir->rescan_interval;
+  return (0);
+} /* }}} int fc_inotify_rescan */
+
+/* Drains the inotify descriptor and marks the directories which changed.
+ * Returns non-zero if the tree has to be read again. */
+static int fc_inotify_handle_events (fc_directory_conf_t *dir) /* {{{ */
+{
+  char buffer[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  int rescan = 0;
+
+  while (42)
+  {
+    ssize_t len;
+    char *ptr;
+
+    len = read (dir->inotify_fd, buffer, sizeof (buffer));
+    if ((len < 0) && (errno == EINTR))
+      continue;
+    if (len <= 0)
+      break;
+
+    for (ptr = buffer; ptr < buffer + len; )
+    {
+      struct inotify_event *ev = (void *) ptr;
+      fc_node_t *n = NULL;
+
+      ptr += sizeof (*ev) + ev->len;
+
+      /* Events were lost, or directories were created, removed or renamed
+       * and the watches have to follow. */
+      if ((ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF
+              | IN_IGNORED))
+          || ((ev->mask & IN_ISDIR) && (dir->options & FC_RECURSIVE)
+            && (ev->mask & (IN_CREATE | IN_DELETE
+                | IN_MOVED_FROM | IN_MOVED_TO))))
+      {
+        rescan = 1;
+        continue;
+      }
+
+      if (c_avl_get (dir->nodes, &ev->wd, (void *) &n) == 0)
+        n->dirty = 1;
+    }
+  }
+
+  return (rescan);
+} /* }}} int fc_inotify_handle_events */
+
+/* Updates the counts of `dir' from the changed directories. Returns non-zero
+ * if inotify cannot be used. */
+static int fc_inotify_read (fc_directory_conf_t *dir) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  void *key;
+  void *value;
+
+  if ((dir->nodes == NULL) || fc_inotify_handle_events (dir)
+      || (cdtime () >= dir->next_rescan))
+  {
+    if (fc_inotify_rescan (dir) != 0)
+      return (-1);
+  }
+
+  dir->counts.files_num = 0;
+  dir->counts.files_size = 0;
+  if (dir->nodes == NULL)
+    return (0);
+
+  iter = c_avl_get_iterator (dir->nodes);
+  while (c_avl_iterator_next (iter, &key, &value) == 0)
+  {
+    fc_node_t *n = value;
+
+    if (n->dirty)
+    {
+      int fd;
+
+      n->dirty = 0;
+      n->counts.files_num = 0;
+      n->counts.files_size = 0;
+
+      /* Its subdirectories have counts of their own. */
+      fd = fc_open_dir (n->path);
+      if (fd >= 0)
+        fc_scan_dir (dir, fd, n->path, &n->counts, /* subdir_cb = */ NULL);
+    }
+
+    dir->counts.files_num += n->counts.files_num;
+    dir->counts.files_size += n->counts.files_size;
+  }
+  c_avl_iterator_destroy (iter);
+
+  return (0);
+} /* }}} int fc_inotify_read */
+#endif /* HAVE_SYS_INOTIFY_H */
 
 static int fc_read_dir (fc_directory_conf_t *dir)
 {
   int status;
+  int fd;
 
-  dir->files_num = 0;
-  dir->files_size = 0;
+#if HAVE_SYS_INOTIFY_H
+  if (dir->options & FC_INOTIFY)
+  {
+    if (fc_inotify_read (dir) == 0)
+    {
+      fc_submit_dir (dir);
+      return (0);
+    }
+    dir->options &= ~FC_INOTIFY;
+  }
+#endif
+
+  dir->counts.files_num = 0;
+  dir->counts.files_size = 0;
 
   if (dir->mtime != 0)
     dir->now = time (NULL);
 
-  status = walk_directory (dir->path, fc_read_dir_callback, dir,
-      /* include hidden */ (dir->options & FC_HIDDEN) ? 1 : 0);
+  fd = fc_open_dir (dir->path);
+  if (fd < 0)
+    return (-1);
+
+  status = fc_scan_dir (dir, fd, dir->path, &dir->counts, fc_scan_subdir);
   if (status != 0)
   {
-    WARNING ("filecount plugin: walk_directory (%s) failed.", dir->path);
+    WARNING ("filecount plugin: Reading `%s' failed.", dir->path);
     return (-1);
   }
 
@@ -565,11 +952,34 @@ static int fc_read (void)
   return (0);
 } /* int fc_read */
 
+static int fc_shutdown (void)
+{
+  size_t i;
+
+  for (i = 0; i < directories_num; i++)
+  {
+    fc_directory_conf_t *dir = directories[i];
+
+#if HAVE_SYS_INOTIFY_H
+    fc_inotify_stop (dir);
+#endif
+    sfree (dir->name);
+    sfree (dir->instance);
+    sfree (dir->path);
+    sfree (dir);
+  }
+  sfree (directories);
+  directories_num = 0;
+
+  return (0);
+} /* int fc_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("filecount", fc_config);
   plugin_register_init ("filecount", fc_init);
   plugin_register_read ("filecount", fc_read);
+  plugin_register_shutdown ("filecount", fc_shutdown);
 } /* void module_register */
 
 /*
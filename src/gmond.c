@@ -29,6 +29,8 @@
 #include "common.h"
 #include "configfile.h"
 #include "utils_avltree.h"
+#include "utils_intern.h"
+#include "utils_recv_batch.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -62,6 +64,14 @@
 # define BUFF_SIZE 1400
 #endif
 
+/* Maximum number of packets read with a single recvmmsg(2) call. */
+#define MC_RECEIVE_BATCH 32
+
+/* Staging entries are spread over this many independently locked trees, so
+ * receive threads merging the values of different hosts rarely wait for each
+ * other. */
+#define STAGING_SHARDS 16
+
 struct socket_entry_s
 {
   int                     fd;
@@ -78,6 +88,26 @@ struct staging_entry_s
 };
 typedef struct staging_entry_s staging_entry_t;
 
+struct staging_shard_s
+{
+  c_avl_tree_t   *tree;
+  pthread_mutex_t lock;
+};
+typedef struct staging_shard_s staging_shard_t;
+
+/* The sockets of a receive thread. With a multicast group, all threads share
+ * the sockets of the first thread, because each socket joined to the group
+ * receives a copy of every packet. */
+struct mc_receiver_s
+{
+  pthread_t      id;
+  _Bool          running;
+  struct pollfd *fds;
+  size_t         fds_num;
+  _Bool          fds_owned;
+};
+typedef struct mc_receiver_s mc_receiver_t;
+
 struct metric_map_s
 {
   char  *ganglia_name;
@@ -94,16 +124,15 @@ static char          *mc_receive_group = NULL;
 #define MC_RECEIVE_PORT_DEFAULT "8649"
 static char          *mc_receive_port = NULL;
 
-static struct pollfd *mc_receive_sockets = NULL;
-static size_t         mc_receive_sockets_num = 0;
+static int            mc_receive_threads = 1;
 
 static socket_entry_t  *mc_send_sockets = NULL;
 static size_t           mc_send_sockets_num = 0;
 static pthread_mutex_t  mc_send_sockets_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int            mc_receive_thread_loop    = 0;
-static int            mc_receive_thread_running = 0;
-static pthread_t      mc_receive_thread_id;
+static mc_receiver_t *mc_receivers = NULL;
+static size_t         mc_receivers_num = 0;
 
 static metric_map_t metric_map_default[] =
 { /*---------------+-------------+-----------+-------------+------+-----*
@@ -132,8 +161,9 @@ static size_t metric_map_len_default = STATIC_ARRAY_SIZE (metric_map_default);
 static metric_map_t *metric_map = NULL;
 static size_t        metric_map_len = 0;
 
-static c_avl_tree_t   *staging_tree;
-static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Entries are assigned to shards by the hash of their key. */
+static staging_shard_t staging_shards[STAGING_SHARDS];
+static _Bool           staging_initialized = 0;
 
 static metric_map_t *metric_lookup (const char *key) /* {{{ */
 {
@@ -296,6 +326,24 @@ static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
         WARNING ("gmond plugin: setsockopt(2) failed: %s",
                  sstrerror (errno, errbuf, sizeof (errbuf)));
       }
+
+#ifdef SO_REUSEPORT
+      /* Let the kernel distribute unicast packets among the sockets of the
+       * receive threads. */
+      if (mc_receive_threads > 1)
+      {
+        status = setsockopt (sockets[sockets_num].fd, SOL_SOCKET, SO_REUSEPORT,
+            (void *) &yes, sizeof (yes));
+        if (status != 0)
+        {
+          char errbuf[1024];
+          ERROR ("gmond plugin: setsockopt (SO_REUSEPORT) failed: %s",
+              sstrerror (errno, errbuf, sizeof (errbuf)));
+          close (sockets[sockets_num].fd);
+          continue;
+        }
+      }
+#endif
     }
 
     status = bind (sockets[sockets_num].fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
@@ -458,23 +506,31 @@ static int request_meta_data (const char *host, const char *name) /* {{{ */
   return (0);
 } /* }}} int request_meta_data */
 
-static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
-    const char *name,
+/* Formats the key of the staging entry into "key" and returns the shard
+ * holding it, or NULL if the shards have not been created. */
+static staging_shard_t *staging_shard_get (char *key, size_t key_size, /* {{{ */
+    const char *host, const char *type, const char *type_instance)
+{
+  if (!staging_initialized)
+    return (NULL);
+
+  ssnprintf (key, key_size, "%s/%s/%s", host, type,
+      (type_instance != NULL) ? type_instance : "");
+
+  return (staging_shards + (identifier_hash_name (key) % STAGING_SHARDS));
+} /* }}} staging_shard_t *staging_shard_get */
+
+/* Must hold the shard's lock when calling this function. */
+static staging_entry_t *staging_entry_get (staging_shard_t *shard, /* {{{ */
+    const char *key, const char *host,
     const char *type, const char *type_instance,
     int values_len)
 {
-  char key[2 * DATA_MAX_NAME_LEN];
   staging_entry_t *se;
   int status;
 
-  if (staging_tree == NULL)
-    return (NULL);
-
-  ssnprintf (key, sizeof (key), "%s/%s/%s", host, type,
-      (type_instance != NULL) ? type_instance : "");
-
   se = NULL;
-  status = c_avl_get (staging_tree, key, (void *) &se);
+  status = c_avl_get (shard->tree, key, (void *) &se);
   if (status == 0)
     return (se);
 
@@ -503,7 +559,7 @@ static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
     sstrncpy (se->vl.type_instance, type_instance,
         sizeof (se->vl.type_instance));
 
-  status = c_avl_insert (staging_tree, se->key, se);
+  status = c_avl_insert (shard->tree, se->key, se);
   if (status != 0)
   {
     ERROR ("gmond plugin: c_avl_insert failed.");
@@ -519,6 +575,8 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
     const char *type, const char *type_instance,
     size_t ds_index, int ds_type, value_t value)
 {
+  char key[2 * DATA_MAX_NAME_LEN];
+  staging_shard_t *shard;
   const data_set_t *ds;
   staging_entry_t *se;
 
@@ -536,18 +594,22 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
     return (-1);
   }
 
-  pthread_mutex_lock (&staging_lock);
+  shard = staging_shard_get (key, sizeof (key), host, type, type_instance);
+  if (shard == NULL)
+    return (-1);
+
+  pthread_mutex_lock (&shard->lock);
 
-  se = staging_entry_get (host, name, type, type_instance, ds->ds_num);
+  se = staging_entry_get (shard, key, host, type, type_instance, ds->ds_num);
   if (se == NULL)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     ERROR ("gmond plugin: staging_entry_get failed.");
     return (-1);
   }
   if (se->vl.values_len != ds->ds_num)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-1);
   }
 
@@ -567,7 +629,7 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   /* Check if all data sources have been set. If not, return here. */
   if (se->flags != ((0x01 << se->vl.values_len) - 1))
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (0);
   }
 
@@ -577,7 +639,7 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   {
     /* No meta data has been received for this metric yet. */
     se->flags = 0;
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
 
     request_meta_data (host, name);
     return (0);
@@ -586,7 +648,7 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   plugin_dispatch_values (&se->vl);
 
   se->flags = 0;
-  pthread_mutex_unlock (&staging_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (0);
 } /* }}} int staging_entry_update */
@@ -711,6 +773,8 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
     case gmetadata_full:
     {
       Ganglia_metadatadef msg_meta;
+      char key[2 * DATA_MAX_NAME_LEN];
+      staging_shard_t *shard;
       staging_entry_t *se;
       const data_set_t *ds;
       metric_map_t *map;
@@ -738,14 +802,18 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
       DEBUG ("gmond plugin: Received meta data for %s/%s.",
           msg_meta.metric_id.host, msg_meta.metric_id.name);
 
-      pthread_mutex_lock (&staging_lock);
-      se = staging_entry_get (msg_meta.metric_id.host,
-          msg_meta.metric_id.name,
+      shard = staging_shard_get (key, sizeof (key), msg_meta.metric_id.host,
+          map->type, map->type_instance);
+      if (shard == NULL)
+        return (-1);
+
+      pthread_mutex_lock (&shard->lock);
+      se = staging_entry_get (shard, key, msg_meta.metric_id.host,
           map->type, map->type_instance,
           ds->ds_num);
       if (se != NULL)
         se->vl.interval = TIME_T_TO_CDTIME_T (msg_meta.metric.tmax);
-      pthread_mutex_unlock (&staging_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       if (se == NULL)
       {
@@ -812,71 +880,74 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
   return (0);
 } /* }}} int mc_handle_metric */
 
-static int mc_handle_socket (struct pollfd *p) /* {{{ */
+/* Reads and handles the packets waiting on "p->fd". "buffers" holds
+ * MC_RECEIVE_BATCH buffers of BUFF_SIZE bytes each. The socket may be shared
+ * with other receive threads, so it is read without blocking. */
+static int mc_handle_socket (struct pollfd *p, char *buffers) /* {{{ */
 {
-  char buffer[BUFF_SIZE];
-  ssize_t buffer_size;
+  char *bufs[MC_RECEIVE_BATCH];
+  size_t lens[MC_RECEIVE_BATCH];
+  int status;
+  int i;
 
   if ((p->revents & (POLLIN | POLLPRI)) == 0)
   {
     p->revents = 0;
     return (-1);
   }
+  p->revents = 0;
+
+  for (i = 0; i < MC_RECEIVE_BATCH; i++)
+    bufs[i] = buffers + i * BUFF_SIZE;
 
-  buffer_size = recv (p->fd, buffer, sizeof (buffer), /* flags = */ 0);
-  if (buffer_size <= 0)
+  /* Returns zero if another receive thread was faster. */
+  status = recv_batch (p->fd, bufs, BUFF_SIZE, lens, /* addrs = */ NULL,
+      MC_RECEIVE_BATCH);
+  if (status < 0)
   {
     char errbuf[1024];
+
     ERROR ("gmond plugin: recv failed: %s",
         sstrerror (errno, errbuf, sizeof (errbuf)));
-    p->revents = 0;
     return (-1);
   }
 
-  mc_handle_metric (buffer, (size_t) buffer_size);
+  for (i = 0; i < status; i++)
+    if (lens[i] > 0)
+      mc_handle_metric (bufs[i], lens[i]);
+
   return (0);
 } /* }}} int mc_handle_socket */
 
 static void *mc_receive_thread (void *arg) /* {{{ */
 {
-  socket_entry_t *mc_receive_socket_entries;
+  mc_receiver_t *r = arg;
+  struct pollfd *fds;
+  char *buffers;
   int status;
   size_t i;
 
-  mc_receive_socket_entries = NULL;
-  status = create_sockets (&mc_receive_socket_entries, &mc_receive_sockets_num,
-      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
-      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
-      /* listen = */ 1);
-  if (status != 0)
+  buffers = malloc (MC_RECEIVE_BATCH * BUFF_SIZE);
+  if (buffers == NULL)
   {
-    ERROR ("gmond plugin: create_sockets failed.");
+    ERROR ("gmond plugin: malloc failed.");
     return ((void *) -1);
   }
 
-  mc_receive_sockets = (struct pollfd *) calloc (mc_receive_sockets_num,
-      sizeof (*mc_receive_sockets));
-  if (mc_receive_sockets == NULL)
+  /* poll(2) writes "revents", so threads sharing the sockets need their own
+   * copy of the array. */
+  fds = calloc (r->fds_num, sizeof (*fds));
+  if (fds == NULL)
   {
     ERROR ("gmond plugin: calloc failed.");
-    for (i = 0; i < mc_receive_sockets_num; i++)
-      close (mc_receive_socket_entries[i].fd);
-    free (mc_receive_socket_entries);
-    mc_receive_socket_entries = NULL;
-    mc_receive_sockets_num = 0;
+    sfree (buffers);
     return ((void *) -1);
   }
-
-  for (i = 0; i < mc_receive_sockets_num; i++)
-  {
-    mc_receive_sockets[i].fd = mc_receive_socket_entries[i].fd;
-    mc_receive_sockets[i].events = POLLIN | POLLPRI;
-    mc_receive_sockets[i].revents = 0;
-  }
+  memcpy (fds, r->fds, r->fds_num * sizeof (*fds));
 
   while (mc_receive_thread_loop != 0)
   {
-    status = poll (mc_receive_sockets, mc_receive_sockets_num, -1);
+    status = poll (fds, r->fds_num, -1);
     if (status <= 0)
     {
       char errbuf[1024];
@@ -887,52 +958,199 @@ static void *mc_receive_thread (void *arg) /* {{{ */
       break;
     }
 
-    for (i = 0; i < mc_receive_sockets_num; i++)
+    for (i = 0; i < r->fds_num; i++)
     {
-      if (mc_receive_sockets[i].revents != 0)
-        mc_handle_socket (mc_receive_sockets + i);
+      if (fds[i].revents != 0)
+        mc_handle_socket (fds + i, buffers);
     }
   } /* while (mc_receive_thread_loop != 0) */
 
-  free (mc_receive_socket_entries);
+  sfree (fds);
+  sfree (buffers);
   return ((void *) 0);
 } /* }}} void *mc_receive_thread */
 
+/* Opens the receive sockets of "r". */
+static int mc_receiver_open (mc_receiver_t *r) /* {{{ */
+{
+  socket_entry_t *entries = NULL;
+  size_t entries_num = 0;
+  int status;
+  size_t i;
+
+  status = create_sockets (&entries, &entries_num,
+      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
+      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
+      /* listen = */ 1);
+  if (status != 0)
+  {
+    ERROR ("gmond plugin: create_sockets failed.");
+    return (-1);
+  }
+
+  r->fds = calloc (entries_num, sizeof (*r->fds));
+  if (r->fds == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    for (i = 0; i < entries_num; i++)
+      close (entries[i].fd);
+    sfree (entries);
+    return (-1);
+  }
+
+  for (i = 0; i < entries_num; i++)
+  {
+    r->fds[i].fd = entries[i].fd;
+    r->fds[i].events = POLLIN | POLLPRI;
+    r->fds[i].revents = 0;
+  }
+  r->fds_num = entries_num;
+  r->fds_owned = 1;
+
+  sfree (entries);
+  return (0);
+} /* }}} int mc_receiver_open */
+
+/* Returns true if one of the sockets of "r" is bound to a multicast group. */
+static _Bool mc_receiver_is_multicast (mc_receiver_t const *r) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < r->fds_num; i++)
+  {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof (addr);
+
+    if (getsockname (r->fds[i].fd, (struct sockaddr *) &addr, &addrlen) != 0)
+      continue;
+
+    if ((addr.ss_family == AF_INET)
+        && IN_MULTICAST (ntohl (((struct sockaddr_in *) &addr)->sin_addr.s_addr)))
+      return (1);
+    if ((addr.ss_family == AF_INET6)
+        && IN6_IS_ADDR_MULTICAST (&((struct sockaddr_in6 *) &addr)->sin6_addr))
+      return (1);
+  }
+
+  return (0);
+} /* }}} _Bool mc_receiver_is_multicast */
+
+static void mc_receivers_free (void) /* {{{ */
+{
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < mc_receivers_num; i++)
+  {
+    mc_receiver_t *r = mc_receivers + i;
+
+    if (r->fds_owned)
+    {
+      for (j = 0; j < r->fds_num; j++)
+        close (r->fds[j].fd);
+      sfree (r->fds);
+    }
+  }
+
+  sfree (mc_receivers);
+  mc_receivers_num = 0;
+} /* }}} void mc_receivers_free */
+
 static int mc_receive_thread_start (void) /* {{{ */
 {
+  _Bool shared;
+  size_t i;
   int status;
 
-  if (mc_receive_thread_running != 0)
+  if (mc_receivers != NULL)
     return (-1);
 
+  mc_receivers = calloc ((size_t) mc_receive_threads, sizeof (*mc_receivers));
+  if (mc_receivers == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    return (-1);
+  }
+  mc_receivers_num = (size_t) mc_receive_threads;
+
+  /* Open the sockets before starting any thread, so that errors are reported
+   * right away. */
+  if (mc_receiver_open (mc_receivers) != 0)
+  {
+    mc_receivers_free ();
+    return (-1);
+  }
+
+  shared = mc_receiver_is_multicast (mc_receivers);
+  if (shared && (mc_receivers_num > 1))
+    INFO ("gmond plugin: %zu receive threads share the sockets of the "
+        "multicast group.", mc_receivers_num);
+
+  for (i = 1; i < mc_receivers_num; i++)
+  {
+    mc_receiver_t *r = mc_receivers + i;
+
+    if (shared)
+    {
+      r->fds = mc_receivers[0].fds;
+      r->fds_num = mc_receivers[0].fds_num;
+      r->fds_owned = 0;
+    }
+    else if (mc_receiver_open (r) != 0)
+    {
+      mc_receivers_free ();
+      return (-1);
+    }
+  }
+
   mc_receive_thread_loop = 1;
 
-  status = plugin_thread_create (&mc_receive_thread_id, /* attr = */ NULL,
-      mc_receive_thread, /* args = */ NULL);
-  if (status != 0)
+  for (i = 0; i < mc_receivers_num; i++)
+  {
+    mc_receiver_t *r = mc_receivers + i;
+
+    status = plugin_thread_create (&r->id, /* attr = */ NULL,
+        mc_receive_thread, r);
+    if (status != 0)
+    {
+      ERROR ("gmond plugin: Starting receive thread failed.");
+      break;
+    }
+    r->running = 1;
+  }
+
+  if (i == 0)
   {
-    ERROR ("gmond plugin: Starting receive thread failed.");
     mc_receive_thread_loop = 0;
+    mc_receivers_free ();
     return (-1);
   }
 
-  mc_receive_thread_running = 1;
   return (0);
 } /* }}} int start_receive_thread */
 
 static int mc_receive_thread_stop (void) /* {{{ */
 {
-  if (mc_receive_thread_running == 0)
+  size_t i;
+
+  if (mc_receivers == NULL)
     return (-1);
 
   mc_receive_thread_loop = 0;
 
-  INFO ("gmond plugin: Stopping receive thread.");
-  pthread_kill (mc_receive_thread_id, SIGTERM);
-  pthread_join (mc_receive_thread_id, /* return value = */ NULL);
-  memset (&mc_receive_thread_id, 0, sizeof (mc_receive_thread_id));
+  INFO ("gmond plugin: Stopping receive threads.");
+  for (i = 0; i < mc_receivers_num; i++)
+    if (mc_receivers[i].running)
+      pthread_kill (mc_receivers[i].id, SIGTERM);
+  for (i = 0; i < mc_receivers_num; i++)
+  {
+    if (!mc_receivers[i].running)
+      continue;
+    pthread_join (mc_receivers[i].id, /* return value = */ NULL);
+    mc_receivers[i].running = 0;
+  }
 
-  mc_receive_thread_running = 0;
+  mc_receivers_free ();
 
   return (0);
 } /* }}} int mc_receive_thread_stop */
@@ -942,6 +1160,7 @@ static int mc_receive_thread_stop (void) /* {{{ */
  *
  * <Plugin gmond>
  *   MCReceiveFrom "239.2.11.71" "8649"
+ *   ReceiveThreads 1
  *   <Metric "load_one">
  *     Type "load"
  *     [TypeInstance "foo"]
@@ -1091,6 +1310,8 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp ("MCReceiveFrom", child->key) == 0)
       gmond_config_set_address (child, &mc_receive_group, &mc_receive_port);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      cf_util_get_int (child, &mc_receive_threads);
     else if (strcasecmp ("Metric", child->key) == 0)
       gmond_config_add_metric (child);
     else
@@ -1100,6 +1321,20 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
     }
   }
 
+  if (mc_receive_threads < 1)
+  {
+    WARNING ("gmond plugin: ReceiveThreads must be at least 1.");
+    mc_receive_threads = 1;
+  }
+#ifndef SO_REUSEPORT
+  if (mc_receive_threads > 1)
+  {
+    WARNING ("gmond plugin: ReceiveThreads requires SO_REUSEPORT, which is "
+        "not available on this system. Using one receive thread.");
+    mc_receive_threads = 1;
+  }
+#endif
+
   return (0);
 } /* }}} int gmond_config */
 
@@ -1110,11 +1345,27 @@ static int gmond_init (void) /* {{{ */
       (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
       /* listen = */ 0);
 
-  staging_tree = c_avl_create ((void *) strcmp);
-  if (staging_tree == NULL)
+  if (!staging_initialized)
   {
-    ERROR ("gmond plugin: c_avl_create failed.");
-    return (-1);
+    size_t i;
+
+    for (i = 0; i < STAGING_SHARDS; i++)
+    {
+      staging_shards[i].tree = c_avl_create ((void *) strcmp);
+      if (staging_shards[i].tree == NULL)
+      {
+        ERROR ("gmond plugin: c_avl_create failed.");
+        while (i > 0)
+        {
+          i--;
+          c_avl_destroy (staging_shards[i].tree);
+          staging_shards[i].tree = NULL;
+        }
+        return (-1);
+      }
+      pthread_mutex_init (&staging_shards[i].lock, /* attr = */ NULL);
+    }
+    staging_initialized = 1;
   }
 
   mc_receive_thread_start ();
@@ -27,6 +27,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
 
 #if HAVE_SYS_TYPES_H
 #  include <sys/types.h>
@@ -55,6 +56,13 @@
 # include <libperfstat.h>
 #endif
 
+#if KERNEL_LINUX && HAVE_LIBMNL
+# include <asm/types.h>
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+# include <libmnl/libmnl.h>
+#endif
+
 /*
  * Various people have reported problems with `getifaddrs' and varying versions
  * of `glibc'. That's why it's disabled by default. Since more statistics are
@@ -67,6 +75,14 @@
 # endif /* !COLLECT_GETIFADDRS */
 #endif /* KERNEL_LINUX */
 
+/* On Linux, the links are dumped over a netlink socket if libmnl is
+ * available. */
+#if KERNEL_LINUX && HAVE_LIBMNL && !HAVE_GETIFADDRS
+# define COLLECT_NETLINK 1
+#else
+# define COLLECT_NETLINK 0
+#endif
+
 #if HAVE_PERFSTAT
 static perfstat_netinterface_t *ifstat;
 static int nif;
@@ -98,6 +114,12 @@ static int numif = 0;
 static _Bool unique_name = 0;
 #endif /* HAVE_LIBKSTAT */
 
+#if COLLECT_NETLINK
+/* Routing socket used to dump the link statistics. NULL if it could not be
+ * opened, in which case /proc/net/dev is read. */
+static struct mnl_socket *nl = NULL;
+#endif
+
 static int interface_config (const char *key, const char *value)
 {
 	if (ignorelist == NULL)
@@ -161,16 +183,15 @@ static int interface_init (void)
 } /* int interface_init */
 #endif /* HAVE_LIBKSTAT */
 
-static void if_submit (const char *dev, const char *type,
+/* Dispatches the values of an interface that already passed the
+ * ignorelist. */
+static void if_submit_values (const char *dev, const char *type,
 		derive_t rx,
 		derive_t tx)
 {
 	value_t values[2];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, dev) != 0)
-		return;
-
 	values[0].derive = rx;
 	values[1].derive = tx;
 
@@ -182,7 +203,177 @@ static void if_submit (const char *dev, const char *type,
 	sstrncpy (vl.type, type, sizeof (vl.type));
 
 	plugin_dispatch_values (&vl);
+} /* void if_submit_values */
+
+/* The Linux code checks the ignorelist before parsing an interface. */
+#if !KERNEL_LINUX || HAVE_GETIFADDRS
+static void if_submit (const char *dev, const char *type,
+		derive_t rx,
+		derive_t tx)
+{
+	if (ignorelist_match (ignorelist, dev) != 0)
+		return;
+
+	if_submit_values (dev, type, rx, tx);
 } /* void if_submit */
+#endif
+
+#if COLLECT_NETLINK
+static int interface_init (void) /* {{{ */
+{
+	nl = mnl_socket_open (NETLINK_ROUTE);
+	if (nl == NULL)
+	{
+		char errbuf[1024];
+		WARNING ("interface plugin: mnl_socket_open failed: %s. "
+				"Reading /proc/net/dev instead.",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (0);
+	}
+
+	if (mnl_socket_bind (nl, 0, MNL_SOCKET_AUTOPID) < 0)
+	{
+		char errbuf[1024];
+		WARNING ("interface plugin: mnl_socket_bind failed: %s. "
+				"Reading /proc/net/dev instead.",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		mnl_socket_close (nl);
+		nl = NULL;
+	}
+
+	return (0);
+} /* }}} int interface_init */
+
+static int interface_shutdown (void) /* {{{ */
+{
+	if (nl != NULL)
+		mnl_socket_close (nl);
+	nl = NULL;
+
+	return (0);
+} /* }}} int interface_shutdown */
+
+/* Handles one RTM_NEWLINK message of the dump. The name is checked against
+ * the ignorelist before anything else is done with the statistics. */
+static int link_filter_cb (const struct nlmsghdr *nlh, /* {{{ */
+		void *args __attribute__((unused)))
+{
+	struct ifinfomsg *ifm = mnl_nlmsg_get_payload (nlh);
+	struct nlattr *attr;
+	const char *dev = NULL;
+	const struct rtnl_link_stats *stats32 = NULL;
+#ifdef HAVE_RTNL_LINK_STATS64
+	const struct rtnl_link_stats64 *stats64 = NULL;
+#endif
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return (MNL_CB_OK);
+
+	mnl_attr_for_each (attr, nlh, sizeof (*ifm))
+	{
+		switch (mnl_attr_get_type (attr))
+		{
+			case IFLA_IFNAME:
+				if (mnl_attr_validate (attr, MNL_TYPE_STRING) < 0)
+					return (MNL_CB_OK);
+				dev = mnl_attr_get_str (attr);
+				break;
+#ifdef HAVE_RTNL_LINK_STATS64
+			case IFLA_STATS64:
+				if (mnl_attr_validate2 (attr, MNL_TYPE_UNSPEC,
+							sizeof (*stats64)) < 0)
+					break;
+				stats64 = mnl_attr_get_payload (attr);
+				break;
+#endif
+			case IFLA_STATS:
+				if (mnl_attr_validate2 (attr, MNL_TYPE_UNSPEC,
+							sizeof (*stats32)) < 0)
+					break;
+				stats32 = mnl_attr_get_payload (attr);
+				break;
+		}
+	}
+
+	if ((dev == NULL) || (ignorelist_match (ignorelist, dev) != 0))
+		return (MNL_CB_OK);
+
+#ifdef HAVE_RTNL_LINK_STATS64
+	if (stats64 != NULL)
+	{
+		if_submit_values (dev, "if_octets",
+				(derive_t) stats64->rx_bytes, (derive_t) stats64->tx_bytes);
+		if_submit_values (dev, "if_packets",
+				(derive_t) stats64->rx_packets, (derive_t) stats64->tx_packets);
+		if_submit_values (dev, "if_errors",
+				(derive_t) stats64->rx_errors, (derive_t) stats64->tx_errors);
+		if_submit_values (dev, "if_dropped",
+				(derive_t) stats64->rx_dropped, (derive_t) stats64->tx_dropped);
+		return (MNL_CB_OK);
+	}
+#endif
+	if (stats32 != NULL)
+	{
+		if_submit_values (dev, "if_octets",
+				(derive_t) stats32->rx_bytes, (derive_t) stats32->tx_bytes);
+		if_submit_values (dev, "if_packets",
+				(derive_t) stats32->rx_packets, (derive_t) stats32->tx_packets);
+		if_submit_values (dev, "if_errors",
+				(derive_t) stats32->rx_errors, (derive_t) stats32->tx_errors);
+		if_submit_values (dev, "if_dropped",
+				(derive_t) stats32->rx_dropped, (derive_t) stats32->tx_dropped);
+	}
+
+	return (MNL_CB_OK);
+} /* }}} int link_filter_cb */
+
+/* Dumps all links with RTM_GETLINK. Returns non-zero if the dump failed, so
+ * that the caller falls back to /proc/net/dev. */
+static int interface_read_netlink (void) /* {{{ */
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	struct rtgenmsg *rt;
+	unsigned int seq;
+	unsigned int portid;
+	int ret;
+
+	portid = mnl_socket_get_portid (nl);
+
+	nlh = mnl_nlmsg_put_header (buf);
+	nlh->nlmsg_type = RTM_GETLINK;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	nlh->nlmsg_seq = seq = (unsigned int) time (NULL);
+	rt = mnl_nlmsg_put_extra_header (nlh, sizeof (*rt));
+	rt->rtgen_family = AF_PACKET;
+
+	if (mnl_socket_sendto (nl, nlh, nlh->nlmsg_len) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("interface plugin: mnl_socket_sendto failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
+	while (ret > 0)
+	{
+		ret = mnl_cb_run (buf, ret, seq, portid, link_filter_cb, NULL);
+		if (ret <= MNL_CB_STOP)
+			break;
+		ret = mnl_socket_recvfrom (nl, buf, sizeof (buf));
+	}
+	if (ret < 0)
+	{
+		char errbuf[1024];
+		ERROR ("interface plugin: Dumping the links failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int interface_read_netlink */
+#endif /* COLLECT_NETLINK */
 
 static int interface_read (void)
 {
@@ -239,7 +430,8 @@ static int interface_read (void)
 /* #endif HAVE_GETIFADDRS */
 
 #elif KERNEL_LINUX
-	FILE *fh;
+	procfs_snapshot_t *snap;
+	size_t offset = 0;
 	char buffer[1024];
 	derive_t incoming, outgoing;
 	char *device;
@@ -248,15 +440,20 @@ static int interface_read (void)
 	char *fields[16];
 	int numfields;
 
-	if ((fh = fopen ("/proc/net/dev", "r")) == NULL)
+#if COLLECT_NETLINK
+	if ((nl != NULL) && (interface_read_netlink () == 0))
+		return (0);
+#endif
+
+	if ((snap = procfs_snapshot_get ("/proc/net/dev")) == NULL)
 	{
 		char errbuf[1024];
-		WARNING ("interface plugin: fopen: %s",
+		WARNING ("interface plugin: Reading /proc/net/dev failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	while (procfs_getline (snap, &offset, buffer, sizeof (buffer)) != NULL)
 	{
 		if (!(dummy = strchr(buffer, ':')))
 			continue;
@@ -270,6 +467,10 @@ static int interface_read (void)
 		if (device[0] == '\0')
 			continue;
 
+		/* Don't split the lines of ignored interfaces. */
+		if (ignorelist_match (ignorelist, device) != 0)
+			continue;
+
 		numfields = strsplit (dummy, fields, 16);
 
 		if (numfields < 11)
@@ -277,22 +478,22 @@ static int interface_read (void)
 
 		incoming = atoll (fields[0]);
 		outgoing = atoll (fields[8]);
-		if_submit (device, "if_octets", incoming, outgoing);
+		if_submit_values (device, "if_octets", incoming, outgoing);
 
 		incoming = atoll (fields[1]);
 		outgoing = atoll (fields[9]);
-		if_submit (device, "if_packets", incoming, outgoing);
+		if_submit_values (device, "if_packets", incoming, outgoing);
 
 		incoming = atoll (fields[2]);
 		outgoing = atoll (fields[10]);
-		if_submit (device, "if_errors", incoming, outgoing);
+		if_submit_values (device, "if_errors", incoming, outgoing);
 
 		incoming = atoll (fields[3]);
 		outgoing = atoll (fields[11]);
-		if_submit (device, "if_dropped", incoming, outgoing);
+		if_submit_values (device, "if_dropped", incoming, outgoing);
 	}
 
-	fclose (fh);
+	procfs_snapshot_put (snap);
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -397,8 +598,11 @@ void module_register (void)
 {
 	plugin_register_config ("interface", interface_config,
 			config_keys, config_keys_num);
-#if HAVE_LIBKSTAT
+#if HAVE_LIBKSTAT || COLLECT_NETLINK
 	plugin_register_init ("interface", interface_init);
+#endif
+#if COLLECT_NETLINK
+	plugin_register_shutdown ("interface", interface_shutdown);
 #endif
 	plugin_register_read ("interface", interface_read);
 } /* void module_register */
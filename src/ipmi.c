@@ -27,6 +27,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_complain.h"
 
 #include <pthread.h>
 
@@ -48,14 +49,32 @@ struct c_ipmi_sensor_list_s
   char sensor_name[DATA_MAX_NAME_LEN];
   char sensor_type[DATA_MAX_NAME_LEN];
   int sensor_not_present;
+
+  /* Zero means the interval of the plugin. */
+  cdtime_t interval;
+  cdtime_t next_read;
+  /* Waiting for a free slot and waiting for the reply, respectively. */
+  _Bool read_queued;
+  _Bool read_pending;
+
   c_ipmi_sensor_list_t *next;
 };
 
+struct c_ipmi_interval_s
+{
+  char name[DATA_MAX_NAME_LEN];
+  cdtime_t interval;
+};
+typedef struct c_ipmi_interval_s c_ipmi_interval_t;
+
 /*
  * Module global variables
  */
 static pthread_mutex_t sensor_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static c_ipmi_sensor_list_t *sensor_list = NULL;
+/* Number of reading requests sent and not answered yet. */
+static int reads_pending = 0;
+static c_complain_t reads_complaint = C_COMPLAIN_INIT_STATIC;
 
 static int c_ipmi_init_in_progress = 0;
 static int c_ipmi_active = 0;
@@ -67,7 +86,10 @@ static const char *config_keys[] =
 	"IgnoreSelected",
 	"NotifySensorAdd",
 	"NotifySensorRemove",
-	"NotifySensorNotPresent"
+	"NotifySensorNotPresent",
+	"SensorInterval",
+	"MaxPendingReads",
+	"SDRCache"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -77,6 +99,11 @@ static int c_ipmi_nofiy_add = 0;
 static int c_ipmi_nofiy_remove = 0;
 static int c_ipmi_nofiy_notpresent = 0;
 
+static c_ipmi_interval_t *c_ipmi_intervals = NULL;
+static size_t c_ipmi_intervals_num = 0;
+static int c_ipmi_max_pending = 16;
+static _Bool c_ipmi_sdr_cache = 1;
+
 /*
  * Misc private functions
  */
@@ -109,6 +136,26 @@ static void c_ipmi_error (const char *func, int status)
  */
 /* Prototype for sensor_list_remove, so sensor_read_handler can call it. */
 static int sensor_list_remove (ipmi_sensor_t *sensor);
+static void sensor_list_read_queued (void);
+
+/* Must be called with sensor_list_lock held. */
+static c_ipmi_sensor_list_t *sensor_list_lookup (ipmi_sensor_t *sensor)
+{
+  ipmi_sensor_id_t sensor_id;
+  c_ipmi_sensor_list_t *list_item;
+
+  sensor_id = ipmi_sensor_convert_to_id (sensor);
+
+  for (list_item = sensor_list;
+      list_item != NULL;
+      list_item = list_item->next)
+  {
+    if (ipmi_cmp_sensor_id (sensor_id, list_item->sensor_id) == 0)
+      return (list_item);
+  }
+
+  return (NULL);
+} /* c_ipmi_sensor_list_t *sensor_list_lookup */
 
 static void sensor_read_handler (ipmi_sensor_t *sensor,
     int err,
@@ -116,23 +163,57 @@ static void sensor_read_handler (ipmi_sensor_t *sensor,
     unsigned int __attribute__((unused)) raw_value,
     double value,
     ipmi_states_t __attribute__((unused)) *states,
-    void *user_data)
+    void __attribute__((unused)) *user_data)
 {
   value_t values[1];
   value_list_t vl = VALUE_LIST_INIT;
 
-  c_ipmi_sensor_list_t *list_item = (c_ipmi_sensor_list_t *)user_data;
+  c_ipmi_sensor_list_t *list_item;
+  char sensor_name[DATA_MAX_NAME_LEN];
+  char sensor_type[DATA_MAX_NAME_LEN];
+  cdtime_t interval;
+  _Bool present_changed = 0;
+
+  /* The sensor is looked up rather than passed as user data, because it may
+   * have been removed while the request was outstanding. */
+  pthread_mutex_lock (&sensor_list_lock);
+
+  list_item = sensor_list_lookup (sensor);
+  if ((list_item == NULL) || !list_item->read_pending)
+  {
+    pthread_mutex_unlock (&sensor_list_lock);
+    return;
+  }
+
+  list_item->read_pending = 0;
+  reads_pending--;
+  sensor_list_read_queued ();
+
+  if ((err != 0) && ((err & 0xff) == IPMI_NOT_PRESENT_CC))
+  {
+    present_changed = (list_item->sensor_not_present == 0);
+    list_item->sensor_not_present = 1;
+  }
+  else if (err == 0)
+  {
+    present_changed = (list_item->sensor_not_present == 1);
+    list_item->sensor_not_present = 0;
+  }
+
+  sstrncpy (sensor_name, list_item->sensor_name, sizeof (sensor_name));
+  sstrncpy (sensor_type, list_item->sensor_type, sizeof (sensor_type));
+  interval = list_item->interval;
+
+  pthread_mutex_unlock (&sensor_list_lock);
 
   if (err != 0)
   {
     if ((err & 0xff) == IPMI_NOT_PRESENT_CC)
     {
-      if (list_item->sensor_not_present == 0)
+      if (present_changed)
       {
-        list_item->sensor_not_present = 1;
-
         INFO ("ipmi plugin: sensor_read_handler: sensor %s "
-            "not present.", list_item->sensor_name);
+            "not present.", sensor_name);
 
         if (c_ipmi_nofiy_notpresent)
         {
@@ -140,11 +221,11 @@ static void sensor_read_handler (ipmi_sensor_t *sensor,
             "", "", "", NULL };
 
           sstrncpy (n.host, hostname_g, sizeof (n.host));
-          sstrncpy (n.type_instance, list_item->sensor_name,
+          sstrncpy (n.type_instance, sensor_name,
               sizeof (n.type_instance));
-          sstrncpy (n.type, list_item->sensor_type, sizeof (n.type));
+          sstrncpy (n.type, sensor_type, sizeof (n.type));
           ssnprintf (n.message, sizeof (n.message),
-              "sensor %s not present", list_item->sensor_name);
+              "sensor %s not present", sensor_name);
 
           plugin_dispatch_notification (&n);
         }
@@ -153,40 +234,38 @@ static void sensor_read_handler (ipmi_sensor_t *sensor,
     else if (IPMI_IS_IPMI_ERR(err) && IPMI_GET_IPMI_ERR(err) == IPMI_NOT_SUPPORTED_IN_PRESENT_STATE_CC)
     {
       INFO ("ipmi plugin: sensor_read_handler: Sensor %s not ready",
-          list_item->sensor_name);
+          sensor_name);
     }
     else
     {
       if (IPMI_IS_IPMI_ERR(err))
         INFO ("ipmi plugin: sensor_read_handler: Removing sensor %s, "
             "because it failed with IPMI error %#x.",
-            list_item->sensor_name, IPMI_GET_IPMI_ERR(err));
+            sensor_name, IPMI_GET_IPMI_ERR(err));
       else if (IPMI_IS_OS_ERR(err))
         INFO ("ipmi plugin: sensor_read_handler: Removing sensor %s, "
             "because it failed with OS error %#x.",
-            list_item->sensor_name, IPMI_GET_OS_ERR(err));
+            sensor_name, IPMI_GET_OS_ERR(err));
       else if (IPMI_IS_RMCPP_ERR(err))
         INFO ("ipmi plugin: sensor_read_handler: Removing sensor %s, "
             "because it failed with RMCPP error %#x.",
-            list_item->sensor_name, IPMI_GET_RMCPP_ERR(err));
+            sensor_name, IPMI_GET_RMCPP_ERR(err));
       else if (IPMI_IS_SOL_ERR(err))
         INFO ("ipmi plugin: sensor_read_handler: Removing sensor %s, "
             "because it failed with RMCPP error %#x.",
-            list_item->sensor_name, IPMI_GET_SOL_ERR(err));
+            sensor_name, IPMI_GET_SOL_ERR(err));
       else
         INFO ("ipmi plugin: sensor_read_handler: Removing sensor %s, "
             "because it failed with error %#x. of class %#x",
-            list_item->sensor_name, err & 0xff, err & 0xffffff00);
+            sensor_name, err & 0xff, err & 0xffffff00);
       sensor_list_remove (sensor);
     }
     return;
   }
-  else if (list_item->sensor_not_present == 1)
+  else if (present_changed)
   {
-    list_item->sensor_not_present = 0;
-
     INFO ("ipmi plugin: sensor_read_handler: sensor %s present.",
-        list_item->sensor_name);
+        sensor_name);
 
     if (c_ipmi_nofiy_notpresent)
     {
@@ -194,11 +273,11 @@ static void sensor_read_handler (ipmi_sensor_t *sensor,
         "", "", "", NULL };
 
       sstrncpy (n.host, hostname_g, sizeof (n.host));
-      sstrncpy (n.type_instance, list_item->sensor_name,
+      sstrncpy (n.type_instance, sensor_name,
           sizeof (n.type_instance));
-      sstrncpy (n.type, list_item->sensor_type, sizeof (n.type));
+      sstrncpy (n.type, sensor_type, sizeof (n.type));
       ssnprintf (n.message, sizeof (n.message),
-          "sensor %s present", list_item->sensor_name);
+          "sensor %s present", sensor_name);
 
       plugin_dispatch_notification (&n);
     }
@@ -209,7 +288,7 @@ static void sensor_read_handler (ipmi_sensor_t *sensor,
     INFO ("ipmi plugin: sensor_read_handler: Removing sensor %s, "
         "because it provides %s. If you need this sensor, "
         "please file a bug report.",
-        list_item->sensor_name,
+        sensor_name,
         (value_present == IPMI_RAW_VALUE_PRESENT)
         ? "only the raw value"
         : "no value");
@@ -221,15 +300,34 @@ static void sensor_read_handler (ipmi_sensor_t *sensor,
 
   vl.values = values;
   vl.values_len = 1;
+  if (interval > 0)
+    vl.interval = interval;
 
   sstrncpy (vl.host, hostname_g, sizeof (vl.host));
   sstrncpy (vl.plugin, "ipmi", sizeof (vl.plugin));
-  sstrncpy (vl.type, list_item->sensor_type, sizeof (vl.type));
-  sstrncpy (vl.type_instance, list_item->sensor_name, sizeof (vl.type_instance));
+  sstrncpy (vl.type, sensor_type, sizeof (vl.type));
+  sstrncpy (vl.type_instance, sensor_name, sizeof (vl.type_instance));
 
   plugin_dispatch_values (&vl);
 } /* void sensor_read_handler */
 
+/* Returns the interval configured for the sensor name or, failing that, for
+ * the type, or zero. */
+static cdtime_t sensor_get_interval (const char *name, const char *type)
+{
+  size_t i;
+
+  for (i = 0; i < c_ipmi_intervals_num; i++)
+    if (strcasecmp (name, c_ipmi_intervals[i].name) == 0)
+      return (c_ipmi_intervals[i].interval);
+
+  for (i = 0; i < c_ipmi_intervals_num; i++)
+    if (strcasecmp (type, c_ipmi_intervals[i].name) == 0)
+      return (c_ipmi_intervals[i].interval);
+
+  return (0);
+} /* cdtime_t sensor_get_interval */
+
 static int sensor_list_add (ipmi_sensor_t *sensor)
 {
   ipmi_sensor_id_t sensor_id;
@@ -358,6 +456,8 @@ static int sensor_list_add (ipmi_sensor_t *sensor)
   sstrncpy (list_item->sensor_name, sensor_name_ptr,
             sizeof (list_item->sensor_name));
   sstrncpy (list_item->sensor_type, type, sizeof (list_item->sensor_type));
+  list_item->interval = sensor_get_interval (list_item->sensor_name,
+      list_item->sensor_type);
 
   pthread_mutex_unlock (&sensor_list_lock);
 
@@ -410,6 +510,13 @@ static int sensor_list_remove (ipmi_sensor_t *sensor)
   else
     list_prev->next = list_item->next;
 
+  /* A reply still outstanding is ignored by sensor_read_handler. */
+  if (list_item->read_pending)
+  {
+    reads_pending--;
+    sensor_list_read_queued ();
+  }
+
   list_prev = NULL;
   list_item->next = NULL;
 
@@ -434,9 +541,45 @@ static int sensor_list_remove (ipmi_sensor_t *sensor)
   return (0);
 } /* int sensor_list_remove */
 
+/* Sends queued reading requests until "MaxPendingReads" requests are
+ * outstanding. Each reply sends the next request, so the BMC is kept busy
+ * without being flooded. Must be called with sensor_list_lock held. */
+static void sensor_list_read_queued (void)
+{
+  c_ipmi_sensor_list_t *list_item;
+  int status;
+
+  for (list_item = sensor_list;
+      list_item != NULL;
+      list_item = list_item->next)
+  {
+    if ((c_ipmi_max_pending > 0) && (reads_pending >= c_ipmi_max_pending))
+      break;
+
+    if (!list_item->read_queued)
+      continue;
+    list_item->read_queued = 0;
+
+    status = ipmi_sensor_id_get_reading (list_item->sensor_id,
+        sensor_read_handler, /* user data = */ NULL);
+    if (status != 0)
+    {
+      DEBUG ("ipmi plugin: ipmi_sensor_id_get_reading (%s) failed "
+          "with status %#x.", list_item->sensor_name, status);
+      continue;
+    }
+
+    list_item->read_pending = 1;
+    reads_pending++;
+  } /* for (list_item) */
+} /* void sensor_list_read_queued */
+
 static int sensor_list_read_all (void)
 {
   c_ipmi_sensor_list_t *list_item;
+  cdtime_t now = cdtime ();
+  cdtime_t interval = plugin_get_interval ();
+  int busy = 0;
 
   pthread_mutex_lock (&sensor_list_lock);
 
@@ -444,12 +587,34 @@ static int sensor_list_read_all (void)
       list_item != NULL;
       list_item = list_item->next)
   {
-    ipmi_sensor_id_get_reading (list_item->sensor_id,
-        sensor_read_handler, /* user data = */ list_item);
+    if (list_item->read_queued || list_item->read_pending)
+    {
+      busy++;
+      continue;
+    }
+
+    /* Allow for the read callback being a little early. */
+    if (list_item->next_read > now + interval / 2)
+      continue;
+
+    list_item->read_queued = 1;
+    list_item->next_read = now
+      + ((list_item->interval > 0) ? list_item->interval : interval);
   } /* for (list_item) */
 
+  sensor_list_read_queued ();
+
   pthread_mutex_unlock (&sensor_list_lock);
 
+  if (busy > 0)
+    c_complain (LOG_WARNING, &reads_complaint,
+        "ipmi plugin: %i sensors have not been read since the last "
+        "interval. Consider raising \"MaxPendingReads\" or the interval of "
+        "these sensors.", busy);
+  else
+    c_release (LOG_INFO, &reads_complaint,
+        "ipmi plugin: All sensors are read in time again.");
+
   return (0);
 } /* int sensor_list_read_all */
 
@@ -461,6 +626,7 @@ static int sensor_list_remove_all (void)
 
   list_item = sensor_list;
   sensor_list = NULL;
+  reads_pending = 0;
 
   pthread_mutex_unlock (&sensor_list_lock);
 
@@ -552,7 +718,8 @@ static void domain_connection_change_handler (ipmi_domain_t *domain,
 static int thread_init (os_handler_t **ret_os_handler)
 {
   os_handler_t *os_handler;
-  ipmi_open_option_t open_option[1];
+  ipmi_open_option_t open_option[2];
+  int open_option_num = 0;
   ipmi_con_t *smi_connection = NULL;
   ipmi_domain_id_t domain_id;
   int status;
@@ -577,13 +744,21 @@ static int thread_init (os_handler_t **ret_os_handler)
   }
 
   memset (open_option, 0, sizeof (open_option));
-  open_option[0].option = IPMI_OPEN_OPTION_ALL;
-  open_option[0].ival = 1;
+  open_option[open_option_num].option = IPMI_OPEN_OPTION_ALL;
+  open_option[open_option_num].ival = 1;
+  open_option_num++;
+#ifdef IPMI_OPEN_OPTION_USE_CACHE
+  /* Read the SDRs from OpenIPMI's local cache if the repository has not
+   * changed since they were stored, instead of fetching them from the BMC. */
+  open_option[open_option_num].option = IPMI_OPEN_OPTION_USE_CACHE;
+  open_option[open_option_num].ival = c_ipmi_sdr_cache ? 1 : 0;
+  open_option_num++;
+#endif
 
   status = ipmi_open_domain ("mydomain", &smi_connection, /* num_con = */ 1,
       domain_connection_change_handler, /* user data = */ NULL,
       /* domain_fully_up_handler = */ NULL, /* user data = */ NULL,
-      open_option, sizeof (open_option) / sizeof (open_option[0]),
+      open_option, open_option_num,
       &domain_id);
   if (status != 0)
   {
@@ -618,6 +793,47 @@ static void *thread_main (void __attribute__((unused)) *user_data)
   return ((void *) 0);
 } /* void *thread_main */
 
+static int c_ipmi_config_interval (const char *value)
+{
+  c_ipmi_interval_t *tmp;
+  const char *number;
+  char *endptr = NULL;
+  double interval;
+
+  /* The sensor name may contain spaces, the interval is the last field. */
+  number = strrchr (value, ' ');
+  if ((number == NULL) || (number == value))
+  {
+    ERROR ("ipmi plugin: SensorInterval needs a sensor name or type "
+        "and an interval.");
+    return (-1);
+  }
+
+  errno = 0;
+  interval = strtod (number + 1, &endptr);
+  if ((errno != 0) || (endptr == number + 1) || (interval <= 0.0))
+  {
+    ERROR ("ipmi plugin: Invalid interval in \"SensorInterval %s\".", value);
+    return (-1);
+  }
+
+  tmp = realloc (c_ipmi_intervals,
+      sizeof (*tmp) * (c_ipmi_intervals_num + 1));
+  if (tmp == NULL)
+    return (-1);
+  c_ipmi_intervals = tmp;
+  tmp = c_ipmi_intervals + c_ipmi_intervals_num;
+
+  memset (tmp, 0, sizeof (*tmp));
+  sstrncpy (tmp->name, value, sizeof (tmp->name));
+  if ((size_t) (number - value) < sizeof (tmp->name))
+    tmp->name[number - value] = 0;
+  tmp->interval = DOUBLE_TO_CDTIME_T (interval);
+  c_ipmi_intervals_num++;
+
+  return (0);
+} /* int c_ipmi_config_interval */
+
 static int c_ipmi_config (const char *key, const char *value)
 {
   if (ignorelist == NULL)
@@ -651,6 +867,20 @@ static int c_ipmi_config (const char *key, const char *value)
     if (IS_TRUE (value))
       c_ipmi_nofiy_notpresent = 1;
   }
+  else if (strcasecmp ("SensorInterval", key) == 0)
+  {
+    return (c_ipmi_config_interval (value));
+  }
+  else if (strcasecmp ("MaxPendingReads", key) == 0)
+  {
+    c_ipmi_max_pending = atoi (value);
+    if (c_ipmi_max_pending < 0)
+      c_ipmi_max_pending = 0;
+  }
+  else if (strcasecmp ("SDRCache", key) == 0)
+  {
+    c_ipmi_sdr_cache = IS_TRUE (value) ? 1 : 0;
+  }
   else
   {
     return (-1);
@@ -712,6 +942,9 @@ static int c_ipmi_shutdown (void)
 
   sensor_list_remove_all ();
 
+  sfree (c_ipmi_intervals);
+  c_ipmi_intervals_num = 0;
+
   return (0);
 } /* int c_ipmi_shutdown */
 
@@ -418,13 +418,37 @@ static void submit_chain (iptc_handle_t *handle, ip_chain_t *chain)
 }
 
 
-static int iptables_read (void)
+static _Bool same_table (const ip_chain_t *a, const ip_chain_t *b)
+{
+    return ((a != NULL) && (b != NULL)
+            && (a->ip_version == b->ip_version)
+            && (strcmp (a->table, b->table) == 0));
+} /* _Bool same_table */
+
+/*
+ * Returns true if the chain at `index' is in the same table as a chain in
+ * front of it, in which case it has been read together with that chain.
+ */
+static _Bool table_seen (int index)
 {
     int i;
+
+    for (i = 0; i < index; i++)
+        if (same_table (chain_list[i], chain_list[index]))
+            return (1);
+
+    return (0);
+} /* _Bool table_seen */
+
+static int iptables_read (void)
+{
+    int i, j;
     int num_failures = 0;
     ip_chain_t *chain;
 
-    /* Init the iptc handle structure and query the correct table */
+    /* Init the iptc handle structure and query the correct table. Every
+     * table is copied from the kernel once and used for all chains
+     * configured in it. */
     for (i = 0; i < chain_num; i++)
     {
         chain = chain_list[i];
@@ -435,6 +459,9 @@ static int iptables_read (void)
             continue;
         }
 
+        if (table_seen (i))
+            continue;
+
         if ( chain->ip_version == IPV4 )
         {
 #ifdef HAVE_IPTC_HANDLE_T
@@ -451,11 +478,15 @@ static int iptables_read (void)
             {
                 ERROR ("iptables plugin: iptc_init (%s) failed: %s",
                         chain->table, iptc_strerror (errno));
-                num_failures++;
+                for (j = i; j < chain_num; j++)
+                    if (same_table (chain_list[j], chain))
+                        num_failures++;
                 continue;
             }
 
-            submit_chain (handle, chain);
+            for (j = i; j < chain_num; j++)
+                if (same_table (chain_list[j], chain))
+                    submit_chain (handle, chain_list[j]);
             iptc_free (handle);
         }
         else if ( chain->ip_version == IPV6 )
@@ -473,11 +504,15 @@ static int iptables_read (void)
             {
                 ERROR ("iptables plugin: ip6tc_init (%s) failed: %s",
                         chain->table, ip6tc_strerror (errno));
-                num_failures++;
+                for (j = i; j < chain_num; j++)
+                    if (same_table (chain_list[j], chain))
+                        num_failures++;
                 continue;
             }
 
-            submit6_chain (handle, chain);
+            for (j = i; j < chain_num; j++)
+                if (same_table (chain_list[j], chain))
+                    submit6_chain (handle, chain_list[j]);
             ip6tc_free (handle);
         }
         else
@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -37,11 +38,19 @@
 static const char *config_keys[] =
 {
 	"Irq",
-	"IgnoreSelected"
+	"IgnoreSelected",
+	"ReportByCpu"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *ignorelist = NULL;
+static _Bool report_by_cpu = 0;
+
+/* The CPU numbers of the columns, from the first line. CPUs which are
+ * offline have no column. */
+static int *irq_cpus = NULL;
+static size_t irq_cpus_num = 0;
+static size_t irq_cpus_size = 0;
 
 /*
  * Private functions
@@ -62,6 +71,10 @@ static int irq_config (const char *key, const char *value)
 			invert = 0;
 		ignorelist_set_invert (ignorelist, invert);
 	}
+	else if (strcasecmp (key, "ReportByCpu") == 0)
+	{
+		report_by_cpu = IS_TRUE (value) ? 1 : 0;
+	}
 	else
 	{
 		return (-1);
@@ -70,32 +83,111 @@ static int irq_config (const char *key, const char *value)
 	return (0);
 }
 
-static void irq_submit (const char *irq_name, derive_t value)
+static void irq_submit (const char *irq_name, int cpu, derive_t value)
 {
 	value_t values[1];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, irq_name) != 0)
-		return;
-
 	values[0].derive = value;
 
 	vl.values = values;
 	vl.values_len = 1;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "irq", sizeof (vl.plugin));
+	if (cpu >= 0)
+		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+				"%i", cpu);
 	sstrncpy (vl.type, "irq", sizeof (vl.type));
 	sstrncpy (vl.type_instance, irq_name, sizeof (vl.type_instance));
 
 	plugin_dispatch_values (&vl);
 } /* void irq_submit */
 
+static const char *irq_skip_blanks (const char *ptr)
+{
+	while ((*ptr == ' ') || (*ptr == '\t'))
+		ptr++;
+	return (ptr);
+}
+
+static const char *irq_next_line (const char *ptr)
+{
+	ptr = strchr (ptr, '\n');
+	return ((ptr == NULL) ? NULL : ptr + 1);
+}
+
+/* Parses the counter at `*ptr', skipping leading blanks, and advances `*ptr'
+ * behind it. The columns are plain decimal numbers, so this avoids the
+ * generality of strtoull(3). Returns false if there is no number. */
+static _Bool irq_parse_counter (const char **ptr, derive_t *ret)
+{
+	const char *p = irq_skip_blanks (*ptr);
+	uint64_t value = 0;
+
+	if ((*p < '0') || (*p > '9'))
+		return (0);
+
+	do
+	{
+		value = 10 * value + (uint64_t) (*p - '0');
+		p++;
+	} while ((*p >= '0') && (*p <= '9'));
+
+	*ptr = p;
+	*ret = (derive_t) value;
+	return (1);
+} /* _Bool irq_parse_counter */
+
+/* Reads the CPU numbers of the columns from the header line. */
+static int irq_parse_header (const char *ptr)
+{
+	irq_cpus_num = 0;
+
+	while (42)
+	{
+		char *end;
+		long cpu;
+
+		ptr = irq_skip_blanks (ptr);
+		if (strncmp (ptr, "CPU", 3) != 0)
+			break;
+
+		cpu = strtol (ptr + 3, &end, 10);
+		if (end == ptr + 3)
+			break;
+		ptr = end;
+
+		if (irq_cpus_num >= irq_cpus_size)
+		{
+			size_t new_size = (irq_cpus_size == 0) ? 64 : 2 * irq_cpus_size;
+			int *tmp;
+
+			tmp = realloc (irq_cpus, new_size * sizeof (*irq_cpus));
+			if (tmp == NULL)
+			{
+				ERROR ("irq plugin: realloc failed.");
+				return (-1);
+			}
+			irq_cpus = tmp;
+			irq_cpus_size = new_size;
+		}
+		irq_cpus[irq_cpus_num++] = (int) cpu;
+	}
+
+	if (irq_cpus_num == 0)
+	{
+		ERROR ("irq plugin: unable to get CPU count from first line "
+				"of /proc/interrupts");
+		return (-1);
+	}
+
+	return (0);
+} /* int irq_parse_header */
+
 static int irq_read (void)
 {
-	FILE *fh;
-	char buffer[1024];
-	int  cpu_count;
-	char *fields[256];
+	procfs_snapshot_t *snap;
+	const char *line;
 
 	/*
 	 * Example content:
@@ -103,95 +195,97 @@ static int irq_read (void)
 	 * 0:       2574          1          3          2   IO-APIC-edge      timer
 	 * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
 	 * 8:          0          0          0          1   IO-APIC-edge      rtc0
+	 *
+	 * With hundreds of CPUs the lines are several kilobytes long, so the
+	 * file is parsed in place rather than split into fields. Only the
+	 * columns of selected interrupts are parsed.
 	 */
-	fh = fopen ("/proc/interrupts", "r");
-	if (fh == NULL)
+	if ((snap = procfs_snapshot_get ("/proc/interrupts")) == NULL)
 	{
 		char errbuf[1024];
-		ERROR ("irq plugin: fopen (/proc/interrupts): %s",
+		ERROR ("irq plugin: Reading /proc/interrupts failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	/* Get CPU count from the first line */
-	if(fgets (buffer, sizeof (buffer), fh) != NULL) {
-		cpu_count = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
-	} else {
-		ERROR ("irq plugin: unable to get CPU count from first line "
-				"of /proc/interrupts");
-		fclose (fh);
+	if (irq_parse_header (snap->data) != 0)
+	{
+		procfs_snapshot_put (snap);
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	for (line = irq_next_line (snap->data);
+			line != NULL;
+			line = irq_next_line (line))
 	{
-		char *irq_name;
-		size_t irq_name_len;
+		char irq_name[DATA_MAX_NAME_LEN];
+		const char *name;
+		size_t name_len;
+		const char *ptr;
 		derive_t irq_value;
-		int i;
-		int fields_num;
-		int irq_values_to_parse;
-
-		fields_num = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
-		if (fields_num < 2)
-			continue;
-
-		/* Parse this many numeric fields, skip the rest
-		 * (+1 because first there is a name of irq in each line) */
-		if (fields_num >= cpu_count + 1)
-			irq_values_to_parse = cpu_count;
-		else
-			irq_values_to_parse = fields_num - 1;
+		size_t i;
 
 		/* First field is irq name and colon */
-		irq_name = fields[0];
-		irq_name_len = strlen (irq_name);
-		if (irq_name_len < 2)
-			continue;
-
-		/* Check if irq name ends with colon.
-		 * Otherwise it's a header. */
-		if (irq_name[irq_name_len - 1] != ':')
+		name = irq_skip_blanks (line);
+		name_len = strcspn (name, " \t\n");
+		if ((name_len < 2) || (name[name_len - 1] != ':'))
 			continue;
+		name_len--;
 
 		/* Is it the the ARM fast interrupt (FIQ)? */
-		if (irq_name_len == 4 && (strncmp(irq_name, "FIQ:", 4) == 0))
+		if ((name_len == 3) && (strncmp (name, "FIQ", 3) == 0))
 			continue;
 
-		irq_name[irq_name_len - 1] = 0;
-		irq_name_len--;
+		if (name_len >= sizeof (irq_name))
+			name_len = sizeof (irq_name) - 1;
+		memcpy (irq_name, name, name_len);
+		irq_name[name_len] = 0;
 
+		if (ignorelist_match (ignorelist, irq_name) != 0)
+			continue;
+
+		/* Lines such as "ERR:" have fewer columns than there are CPUs. */
+		ptr = name + name_len + 1;
 		irq_value = 0;
-		for (i = 1; i <= irq_values_to_parse; i++)
+		for (i = 0; i < irq_cpus_num; i++)
 		{
 			/* Per-CPU value */
-			value_t v;
-			int status;
+			derive_t v;
 
-			status = parse_value (fields[i], &v, DS_TYPE_DERIVE);
-			if (status != 0)
+			if (!irq_parse_counter (&ptr, &v))
 				break;
 
-			irq_value += v.derive;
+			if (report_by_cpu)
+				irq_submit (irq_name, irq_cpus[i], v);
+			else
+				irq_value += v;
 		} /* for (i) */
 
 		/* No valid fields -> do not submit anything. */
-		if (i <= 1)
+		if ((i == 0) || report_by_cpu)
 			continue;
 
-		irq_submit (irq_name, irq_value);
+		irq_submit (irq_name, /* cpu = */ -1, irq_value);
 	}
 
-	fclose (fh);
+	procfs_snapshot_put (snap);
 
 	return (0);
 } /* int irq_read */
 
+static int irq_shutdown (void)
+{
+	sfree (irq_cpus);
+	irq_cpus_num = 0;
+	irq_cpus_size = 0;
+
+	return (0);
+} /* int irq_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("irq", irq_config,
 			config_keys, config_keys_num);
 	plugin_register_read ("irq", irq_read);
+	plugin_register_shutdown ("irq", irq_shutdown);
 } /* void module_register */
@@ -40,6 +40,9 @@ struct cjni_jvm_env_s /* {{{ */
 {
   JNIEnv *jvm_env;
   int reference_counter;
+  /* Set for threads calling write callbacks: they stay attached when the
+   * reference counter drops to zero and are detached when they exit. */
+  _Bool keep_attached;
 };
 typedef struct cjni_jvm_env_s cjni_jvm_env_t;
 /* }}} */
@@ -63,6 +66,7 @@ typedef struct java_plugin_class_s java_plugin_class_t;
 #define CB_TYPE_NOTIFICATION 8
 #define CB_TYPE_MATCH        9
 #define CB_TYPE_TARGET      10
+#define CB_TYPE_WRITE_BATCH 11
 struct cjni_callback_info_s /* {{{ */
 {
   char     *name;
@@ -74,11 +78,51 @@ struct cjni_callback_info_s /* {{{ */
 typedef struct cjni_callback_info_s cjni_callback_info_t;
 /* }}} */
 
+/* Classes and methods used to convert value lists, looked up once when the
+ * JVM is created. The classes are global references. */
+struct cjni_class_cache_s /* {{{ */
+{
+  jclass    c_long;
+  jmethodID m_long_init;
+
+  jclass    c_double;
+  jmethodID m_double_init;
+
+  jclass    c_datasource;
+  jmethodID m_datasource_init;
+  jmethodID m_datasource_set_name;
+  jmethodID m_datasource_set_type;
+  jmethodID m_datasource_set_min;
+  jmethodID m_datasource_set_max;
+
+  jclass    c_dataset;
+  jmethodID m_dataset_init;
+  jmethodID m_dataset_add;
+
+  jclass    c_valuelist;
+  jmethodID m_valuelist_init;
+  jmethodID m_valuelist_set_host;
+  jmethodID m_valuelist_set_plugin;
+  jmethodID m_valuelist_set_plugin_instance;
+  jmethodID m_valuelist_set_type;
+  jmethodID m_valuelist_set_type_instance;
+  jmethodID m_valuelist_set_time;
+  jmethodID m_valuelist_set_interval;
+  jmethodID m_valuelist_set_dataset;
+  jmethodID m_valuelist_add_value;
+};
+typedef struct cjni_class_cache_s cjni_class_cache_t;
+/* }}} */
+
+/* Number of distinct data sets converted once per batch of value lists. */
+#define CJNI_BATCH_DATA_SETS 32
+
 /*
  * Global variables
  */
 static JavaVM *jvm = NULL;
 static pthread_key_t jvm_env_key;
+static cjni_class_cache_t class_cache;
 
 /* Configuration options for the JVM. */
 static char **jvm_argv = NULL;
@@ -109,6 +153,8 @@ static int cjni_callback_register (JNIEnv *jvm_env, jobject o_name,
 static int cjni_read (user_data_t *user_data);
 static int cjni_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t *ud);
+static int cjni_write_batch (const write_batch_entry_t *entries,
+    size_t entries_num, user_data_t *ud);
 static int cjni_flush (cdtime_t timeout, const char *identifier, user_data_t *ud);
 static void cjni_log (int severity, const char *message, user_data_t *ud);
 static int cjni_notification (const notification_t *n, user_data_t *ud);
@@ -239,60 +285,39 @@ static int ctoj_double (JNIEnv *jvm_env, /* {{{ */
   return (0);
 } /* }}} int ctoj_double */
 
-/* Convert a jlong to a java.lang.Number */
-static jobject ctoj_jlong_to_number (JNIEnv *jvm_env, jlong value) /* {{{ */
+/* Call the `void setFoo (String s)' method `m_set' of `object_ptr'. */
+static int ctoj_string_method (JNIEnv *jvm_env, /* {{{ */
+    const char *string, jobject object_ptr, jmethodID m_set)
 {
-  jclass c_long;
-  jmethodID m_long_constructor;
+  jstring o_string;
 
-  /* Look up the java.lang.Long class */
-  c_long = (*jvm_env)->FindClass (jvm_env, "java/lang/Long");
-  if (c_long == NULL)
+  o_string = (*jvm_env)->NewStringUTF (jvm_env,
+      (string != NULL) ? string : "");
+  if (o_string == NULL)
   {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "java.lang.Long class failed.");
-    return (NULL);
+    ERROR ("java plugin: ctoj_string_method: NewStringUTF failed.");
+    return (-1);
   }
 
-  m_long_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_long, "<init>", "(J)V");
-  if (m_long_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "`Long (long)' constructor failed.");
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_set, o_string);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_string);
 
+  return (0);
+} /* }}} int ctoj_string_method */
+
+/* Convert a jlong to a java.lang.Number */
+static jobject ctoj_jlong_to_number (JNIEnv *jvm_env, jlong value) /* {{{ */
+{
   return ((*jvm_env)->NewObject (jvm_env,
-        c_long, m_long_constructor, value));
+        class_cache.c_long, class_cache.m_long_init, value));
 } /* }}} jobject ctoj_jlong_to_number */
 
 /* Convert a jdouble to a java.lang.Number */
 static jobject ctoj_jdouble_to_number (JNIEnv *jvm_env, jdouble value) /* {{{ */
 {
-  jclass c_double;
-  jmethodID m_double_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_double = (*jvm_env)->FindClass (jvm_env, "java/lang/Double");
-  if (c_double == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "java.lang.Double class failed.");
-    return (NULL);
-  }
-
-  m_double_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_double, "<init>", "(D)V");
-  if (m_double_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "`Double (double)' constructor failed.");
-    return (NULL);
-  }
-
   return ((*jvm_env)->NewObject (jvm_env,
-        c_double, m_double_constructor, value));
+        class_cache.c_double, class_cache.m_double_init, value));
 } /* }}} jobject ctoj_jdouble_to_number */
 
 /* Convert a value_t to a java.lang.Number */
@@ -315,34 +340,12 @@ static jobject ctoj_value_to_number (JNIEnv *jvm_env, /* {{{ */
 static jobject ctoj_data_source (JNIEnv *jvm_env, /* {{{ */
     const data_source_t *dsrc)
 {
-  jclass c_datasource;
-  jmethodID m_datasource_constructor;
   jobject o_datasource;
   int status;
 
-  /* Look up the DataSource class */
-  c_datasource = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/DataSource");
-  if (c_datasource == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "FindClass (org/collectd/api/DataSource) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_datasource_constructor = (*jvm_env)->GetMethodID (jvm_env, c_datasource,
-      "<init>", "()V");
-  if (m_datasource_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_source: Cannot find the "
-        "`DataSource ()' constructor.");
-    return (NULL);
-  }
-
   /* Create a new instance. */
-  o_datasource = (*jvm_env)->NewObject (jvm_env, c_datasource,
-      m_datasource_constructor);
+  o_datasource = (*jvm_env)->NewObject (jvm_env, class_cache.c_datasource,
+      class_cache.m_datasource_init);
   if (o_datasource == NULL)
   {
     ERROR ("java plugin: ctoj_data_source: "
@@ -351,48 +354,24 @@ static jobject ctoj_data_source (JNIEnv *jvm_env, /* {{{ */
   }
 
   /* Set name via `void setName (String name)' */
-  status = ctoj_string (jvm_env, dsrc->name,
-      c_datasource, o_datasource, "setName");
+  status = ctoj_string_method (jvm_env, dsrc->name,
+      o_datasource, class_cache.m_datasource_set_name);
   if (status != 0)
   {
     ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_string (setName) failed.");
+        "ctoj_string_method (setName) failed.");
     (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
     return (NULL);
   }
 
-  /* Set type via `void setType (int type)' */
-  status = ctoj_int (jvm_env, dsrc->type,
-      c_datasource, o_datasource, "setType");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_int (setType) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
-
-  /* Set min via `void setMin (double min)' */
-  status = ctoj_double (jvm_env, dsrc->min,
-      c_datasource, o_datasource, "setMin");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_double (setMin) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
-
-  /* Set max via `void setMax (double max)' */
-  status = ctoj_double (jvm_env, dsrc->max,
-      c_datasource, o_datasource, "setMax");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_double (setMax) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
+  /* Set type, min and max via `void setType (int type)',
+   * `void setMin (double min)' and `void setMax (double max)' */
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      class_cache.m_datasource_set_type, (jint) dsrc->type);
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      class_cache.m_datasource_set_min, (jdouble) dsrc->min);
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      class_cache.m_datasource_set_max, (jdouble) dsrc->max);
 
   return (o_datasource);
 } /* }}} jobject ctoj_data_source */
@@ -613,42 +592,10 @@ static jobject ctoj_oconfig_item (JNIEnv *jvm_env, /* {{{ */
 /* Convert a data_set_t to a org/collectd/api/DataSet */
 static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
 {
-  jclass c_dataset;
-  jmethodID m_constructor;
-  jmethodID m_add;
   jobject o_type;
   jobject o_dataset;
   size_t i;
 
-  /* Look up the org/collectd/api/DataSet class */
-  c_dataset = (*jvm_env)->FindClass (jvm_env, "org/collectd/api/DataSet");
-  if (c_dataset == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "org/collectd/api/DataSet class failed.");
-    return (NULL);
-  }
-
-  /* Search for the `DataSet (String type)' constructor. */
-  m_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_dataset, "<init>", "(Ljava/lang/String;)V");
-  if (m_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "`DataSet (String)' constructor failed.");
-    return (NULL);
-  }
-
-  /* Search for the `void addDataSource (DataSource)' method. */
-  m_add = (*jvm_env)->GetMethodID (jvm_env,
-      c_dataset, "addDataSource", "(Lorg/collectd/api/DataSource;)V");
-  if (m_add == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "`addDataSource (DataSource)' method failed.");
-    return (NULL);
-  }
-
   o_type = (*jvm_env)->NewStringUTF (jvm_env, ds->type);
   if (o_type == NULL)
   {
@@ -656,8 +603,9 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
     return (NULL);
   }
 
+  /* Call the `DataSet (String type)' constructor. */
   o_dataset = (*jvm_env)->NewObject (jvm_env,
-      c_dataset, m_constructor, o_type);
+      class_cache.c_dataset, class_cache.m_dataset_init, o_type);
   if (o_dataset == NULL)
   {
     ERROR ("java plugin: ctoj_data_set: Creating a DataSet object failed.");
@@ -681,7 +629,9 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
       return (NULL);
     }
 
-    (*jvm_env)->CallVoidMethod (jvm_env, o_dataset, m_add, o_datasource);
+    /* Call `void addDataSource (DataSource)'. */
+    (*jvm_env)->CallVoidMethod (jvm_env, o_dataset,
+        class_cache.m_dataset_add, o_datasource);
 
     (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
   } /* for (i = 0; i < ds->ds_num; i++) */
@@ -690,21 +640,10 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
 } /* }}} jobject ctoj_data_set */
 
 static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
-    value_t value, int ds_type,
-    jclass class_ptr, jobject object_ptr)
+    value_t value, int ds_type, jobject object_ptr)
 {
-  jmethodID m_addvalue;
   jobject o_number;
 
-  m_addvalue = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      "addValue", "(Ljava/lang/Number;)V");
-  if (m_addvalue == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list_add_value: "
-        "Cannot find method `void addValue (Number)'.");
-    return (-1);
-  }
-
   o_number = ctoj_value_to_number (jvm_env, value, ds_type);
   if (o_number == NULL)
   {
@@ -713,82 +652,27 @@ static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
     return (-1);
   }
 
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_addvalue, o_number);
+  /* Call `void addValue (Number)'. */
+  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr,
+      class_cache.m_valuelist_add_value, o_number);
 
   (*jvm_env)->DeleteLocalRef (jvm_env, o_number);
 
   return (0);
 } /* }}} int ctoj_value_list_add_value */
 
-static int ctoj_value_list_add_data_set (JNIEnv *jvm_env, /* {{{ */
-    jclass c_valuelist, jobject o_valuelist, const data_set_t *ds)
+/* Convert a value_list_t to a org/collectd/api/ValueList, using `o_dataset' as
+ * the converted `ds'. Value lists of a batch share their DataSet objects. */
+static jobject ctoj_value_list_with_data_set (JNIEnv *jvm_env, /* {{{ */
+    const data_set_t *ds, jobject o_dataset, const value_list_t *vl)
 {
-  jmethodID m_setdataset;
-  jobject o_dataset;
-
-  /* Look for the `void setDataSource (List<DataSource> ds)' method. */
-  m_setdataset = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
-  if (m_setdataset == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "Cannot find the `void setDataSet (DataSet)' method.");
-    return (-1);
-  }
-
-  /* Create a DataSet object. */
-  o_dataset = ctoj_data_set (jvm_env, ds);
-  if (o_dataset == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "ctoj_data_set (%s) failed.", ds->type);
-    return (-1);
-  }
-
-  /* Actually call the method. */
-  (*jvm_env)->CallVoidMethod (jvm_env,
-      o_valuelist, m_setdataset, o_dataset);
-
-  /* Decrease reference counter on the List<DataSource> object. */
-  (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
-
-  return (0);
-} /* }}} int ctoj_value_list_add_data_set */
-
-/* Convert a value_list_t (and data_set_t) to a org/collectd/api/ValueList */
-static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
-    const data_set_t *ds, const value_list_t *vl)
-{
-  jclass c_valuelist;
-  jmethodID m_valuelist_constructor;
   jobject o_valuelist;
   int status;
   size_t i;
 
-  /* First, create a new ValueList instance..
-   * Look up the class.. */
-  c_valuelist = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/ValueList");
-  if (c_valuelist == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list: "
-        "FindClass (org/collectd/api/ValueList) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_valuelist_constructor = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "<init>", "()V");
-  if (m_valuelist_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list: Cannot find the "
-        "`ValueList ()' constructor.");
-    return (NULL);
-  }
-
   /* Create a new instance. */
-  o_valuelist = (*jvm_env)->NewObject (jvm_env, c_valuelist,
-      m_valuelist_constructor);
+  o_valuelist = (*jvm_env)->NewObject (jvm_env, class_cache.c_valuelist,
+      class_cache.m_valuelist_init);
   if (o_valuelist == NULL)
   {
     ERROR ("java plugin: ctoj_value_list: Creating a new ValueList instance "
@@ -796,60 +680,41 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     return (NULL);
   }
 
-  status = ctoj_value_list_add_data_set (jvm_env,
-      c_valuelist, o_valuelist, ds);
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: "
-        "ctoj_value_list_add_data_set failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
+  /* Call `void setDataSet (DataSet)'. */
+  (*jvm_env)->CallVoidMethod (jvm_env,
+      o_valuelist, class_cache.m_valuelist_set_dataset, o_dataset);
 
   /* Set the strings.. */
-#define SET_STRING(str,method_name) do { \
-  status = ctoj_string (jvm_env, str, \
-      c_valuelist, o_valuelist, method_name); \
+#define SET_STRING(str,method) do { \
+  status = ctoj_string_method (jvm_env, str, o_valuelist, \
+      class_cache.method); \
   if (status != 0) { \
-    ERROR ("java plugin: ctoj_value_list: ctoj_string (%s) failed.", \
-        method_name); \
+    ERROR ("java plugin: ctoj_value_list: ctoj_string_method (%s) failed.", \
+        #method); \
     (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist); \
     return (NULL); \
   } } while (0)
 
-  SET_STRING (vl->host,            "setHost");
-  SET_STRING (vl->plugin,          "setPlugin");
-  SET_STRING (vl->plugin_instance, "setPluginInstance");
-  SET_STRING (vl->type,            "setType");
-  SET_STRING (vl->type_instance,   "setTypeInstance");
+  SET_STRING (vl->host,            m_valuelist_set_host);
+  SET_STRING (vl->plugin,          m_valuelist_set_plugin);
+  SET_STRING (vl->plugin_instance, m_valuelist_set_plugin_instance);
+  SET_STRING (vl->type,            m_valuelist_set_type);
+  SET_STRING (vl->type_instance,   m_valuelist_set_type_instance);
 
 #undef SET_STRING
 
-  /* Set the `time' member. Java stores time in milliseconds. */
-  status = ctoj_long (jvm_env, (jlong) CDTIME_T_TO_MS (vl->time),
-      c_valuelist, o_valuelist, "setTime");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setTime) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
-
-  /* Set the `interval' member.. */
-  status = ctoj_long (jvm_env,
-      (jlong) CDTIME_T_TO_MS (vl->interval),
-      c_valuelist, o_valuelist, "setInterval");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setInterval) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
+  /* Set the `time' and `interval' members. Java stores time in
+   * milliseconds. */
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      class_cache.m_valuelist_set_time, (jlong) CDTIME_T_TO_MS (vl->time));
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      class_cache.m_valuelist_set_interval,
+      (jlong) CDTIME_T_TO_MS (vl->interval));
 
   for (i = 0; i < vl->values_len; i++)
   {
     status = ctoj_value_list_add_value (jvm_env, vl->values[i], ds->ds[i].type,
-        c_valuelist, o_valuelist);
+        o_valuelist);
     if (status != 0)
     {
       ERROR ("java plugin: ctoj_value_list: "
@@ -859,6 +724,28 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     }
   }
 
+  return (o_valuelist);
+} /* }}} jobject ctoj_value_list_with_data_set */
+
+/* Convert a value_list_t (and data_set_t) to a org/collectd/api/ValueList */
+static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  jobject o_dataset;
+  jobject o_valuelist;
+
+  o_dataset = ctoj_data_set (jvm_env, ds);
+  if (o_dataset == NULL)
+  {
+    ERROR ("java plugin: ctoj_value_list: ctoj_data_set (%s) failed.",
+        ds->type);
+    return (NULL);
+  }
+
+  o_valuelist = ctoj_value_list_with_data_set (jvm_env, ds, o_dataset, vl);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
+
   return (o_valuelist);
 } /* }}} jobject ctoj_value_list */
 
@@ -1468,6 +1355,30 @@ static jint JNICALL cjni_api_register_write (JNIEnv *jvm_env, /* {{{ */
   return (0);
 } /* }}} jint cjni_api_register_write */
 
+static jint JNICALL cjni_api_register_write_batch (JNIEnv *jvm_env, /* {{{ */
+    jobject this, jobject o_name, jobject o_write)
+{
+  user_data_t ud;
+  cjni_callback_info_t *cbi;
+
+  cbi = cjni_callback_info_create (jvm_env, o_name, o_write,
+      CB_TYPE_WRITE_BATCH);
+  if (cbi == NULL)
+    return (-1);
+
+  DEBUG ("java plugin: Registering new write batch callback: %s", cbi->name);
+
+  memset (&ud, 0, sizeof (ud));
+  ud.data = (void *) cbi;
+  ud.free_func = cjni_callback_info_destroy;
+
+  plugin_register_write_batch (cbi->name, cjni_write_batch, &ud);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_write);
+
+  return (0);
+} /* }}} jint cjni_api_register_write_batch */
+
 static jint JNICALL cjni_api_register_flush (JNIEnv *jvm_env, /* {{{ */
     jobject this, jobject o_name, jobject o_flush)
 {
@@ -1683,6 +1594,10 @@ static JNINativeMethod jni_api_functions[] = /* {{{ */
     "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteInterface;)I",
     cjni_api_register_write },
 
+  { "registerWriteBatch",
+    "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteBatchInterface;)I",
+    cjni_api_register_write_batch },
+
   { "registerFlush",
     "(Ljava/lang/String;Lorg/collectd/api/CollectdFlushInterface;)I",
     cjni_api_register_flush },
@@ -1755,6 +1670,11 @@ static cjni_callback_info_t *cjni_callback_info_create (JNIEnv *jvm_env, /* {{{
       method_signature = "(Lorg/collectd/api/ValueList;)I";
       break;
 
+    case CB_TYPE_WRITE_BATCH:
+      method_name = "write";
+      method_signature = "([Lorg/collectd/api/ValueList;)I";
+      break;
+
     case CB_TYPE_FLUSH:
       method_name = "flush";
       method_signature = "(Ljava/lang/Number;Ljava/lang/String;)I";
@@ -1938,6 +1858,15 @@ static void cjni_jvm_env_destroy (void *args) /* {{{ */
 
   cjni_env = (cjni_jvm_env_t *) args;
 
+  /* Threads kept attached by cjni_thread_attach_write are detached when they
+   * exit. */
+  if (cjni_env->keep_attached && (cjni_env->reference_counter == 0))
+  {
+    if ((jvm != NULL) && (cjni_env->jvm_env != NULL))
+      (*jvm)->DetachCurrentThread (jvm);
+    cjni_env->jvm_env = NULL;
+  }
+
   if (cjni_env->reference_counter > 0)
   {
     ERROR ("java plugin: cjni_jvm_env_destroy: "
@@ -1954,6 +1883,98 @@ static void cjni_jvm_env_destroy (void *args) /* {{{ */
   free (cjni_env);
 } /* }}} void cjni_jvm_env_destroy */
 
+/* Look up the classes and methods used by the value list conversion
+ * functions and store them in `class_cache'. */
+static int cjni_class_cache_init (JNIEnv *jvm_env) /* {{{ */
+{
+  memset (&class_cache, 0, sizeof (class_cache));
+
+#define LOOKUP_CLASS(member,name) do { \
+  jclass tmp = (*jvm_env)->FindClass (jvm_env, name); \
+  if (tmp == NULL) { \
+    ERROR ("java plugin: cjni_class_cache_init: FindClass (%s) failed.", \
+        name); \
+    return (-1); \
+  } \
+  class_cache.member = (*jvm_env)->NewGlobalRef (jvm_env, tmp); \
+  (*jvm_env)->DeleteLocalRef (jvm_env, tmp); \
+  if (class_cache.member == NULL) { \
+    ERROR ("java plugin: cjni_class_cache_init: NewGlobalRef (%s) failed.", \
+        name); \
+    return (-1); \
+  } } while (0)
+
+#define LOOKUP_METHOD(member,class_member,name,signature) do { \
+  class_cache.member = (*jvm_env)->GetMethodID (jvm_env, \
+      class_cache.class_member, name, signature); \
+  if (class_cache.member == NULL) { \
+    ERROR ("java plugin: cjni_class_cache_init: Cannot find the " \
+        "`%s' method with signature `%s'.", name, signature); \
+    return (-1); \
+  } } while (0)
+
+  LOOKUP_CLASS (c_long, "java/lang/Long");
+  LOOKUP_METHOD (m_long_init, c_long, "<init>", "(J)V");
+
+  LOOKUP_CLASS (c_double, "java/lang/Double");
+  LOOKUP_METHOD (m_double_init, c_double, "<init>", "(D)V");
+
+  LOOKUP_CLASS (c_datasource, "org/collectd/api/DataSource");
+  LOOKUP_METHOD (m_datasource_init, c_datasource, "<init>", "()V");
+  LOOKUP_METHOD (m_datasource_set_name, c_datasource,
+      "setName", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_datasource_set_type, c_datasource, "setType", "(I)V");
+  LOOKUP_METHOD (m_datasource_set_min, c_datasource, "setMin", "(D)V");
+  LOOKUP_METHOD (m_datasource_set_max, c_datasource, "setMax", "(D)V");
+
+  LOOKUP_CLASS (c_dataset, "org/collectd/api/DataSet");
+  LOOKUP_METHOD (m_dataset_init, c_dataset,
+      "<init>", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_dataset_add, c_dataset,
+      "addDataSource", "(Lorg/collectd/api/DataSource;)V");
+
+  LOOKUP_CLASS (c_valuelist, "org/collectd/api/ValueList");
+  LOOKUP_METHOD (m_valuelist_init, c_valuelist, "<init>", "()V");
+  LOOKUP_METHOD (m_valuelist_set_host, c_valuelist,
+      "setHost", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_plugin, c_valuelist,
+      "setPlugin", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_plugin_instance, c_valuelist,
+      "setPluginInstance", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_type, c_valuelist,
+      "setType", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_type_instance, c_valuelist,
+      "setTypeInstance", "(Ljava/lang/String;)V");
+  LOOKUP_METHOD (m_valuelist_set_time, c_valuelist, "setTime", "(J)V");
+  LOOKUP_METHOD (m_valuelist_set_interval, c_valuelist,
+      "setInterval", "(J)V");
+  LOOKUP_METHOD (m_valuelist_set_dataset, c_valuelist,
+      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
+  LOOKUP_METHOD (m_valuelist_add_value, c_valuelist,
+      "addValue", "(Ljava/lang/Number;)V");
+
+#undef LOOKUP_METHOD
+#undef LOOKUP_CLASS
+
+  return (0);
+} /* }}} int cjni_class_cache_init */
+
+/* Release the global references held by `class_cache'. */
+static void cjni_class_cache_destroy (JNIEnv *jvm_env) /* {{{ */
+{
+  jclass *classes[] = { &class_cache.c_long, &class_cache.c_double,
+    &class_cache.c_datasource, &class_cache.c_dataset,
+    &class_cache.c_valuelist };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (classes); i++)
+  {
+    if (*classes[i] != NULL)
+      (*jvm_env)->DeleteGlobalRef (jvm_env, *classes[i]);
+  }
+  memset (&class_cache, 0, sizeof (class_cache));
+} /* }}} void cjni_class_cache_destroy */
+
 /* Register ``native'' functions with the JVM. Native functions are C-functions
  * that can be called by Java code. */
 static int cjni_init_native (JNIEnv *jvm_env) /* {{{ */
@@ -1978,6 +1999,14 @@ static int cjni_init_native (JNIEnv *jvm_env) /* {{{ */
     return (-1);
   }
 
+  status = cjni_class_cache_init (jvm_env);
+  if (status != 0)
+  {
+    ERROR ("cjni_init_native: cjni_class_cache_init failed.");
+    cjni_class_cache_destroy (jvm_env);
+    return (-1);
+  }
+
   return (0);
 } /* }}} int cjni_init_native */
 
@@ -2041,8 +2070,9 @@ static int cjni_create_jvm (void) /* {{{ */
 } /* }}} int cjni_create_jvm */
 
 /* Increase the reference counter to the JVM for this thread. If it was zero,
- * attach the JVM first. */
-static JNIEnv *cjni_thread_attach (void) /* {{{ */
+ * attach the JVM first. If `keep_attached' is true, the thread stays attached
+ * until it exits, so that write threads don't attach for every value. */
+static JNIEnv *cjni_thread_attach_internal (_Bool keep_attached) /* {{{ */
 {
   cjni_jvm_env_t *cjni_env;
   JNIEnv *jvm_env;
@@ -2078,7 +2108,7 @@ static JNIEnv *cjni_thread_attach (void) /* {{{ */
     pthread_setspecific (jvm_env_key, cjni_env);
   }
 
-  if (cjni_env->reference_counter > 0)
+  if ((cjni_env->reference_counter > 0) || cjni_env->keep_attached)
   {
     cjni_env->reference_counter++;
     jvm_env = cjni_env->jvm_env;
@@ -2093,7 +2123,18 @@ static JNIEnv *cjni_thread_attach (void) /* {{{ */
     memset (&args, 0, sizeof (args));
     args.version = JNI_VERSION_1_2;
 
-    status = (*jvm)->AttachCurrentThread (jvm, (void *) &jvm_env, (void *) &args);
+#ifdef JNI_VERSION_1_4
+    /* Threads which stay attached must be daemon threads, otherwise
+     * DestroyJavaVM would wait for them in cjni_shutdown. */
+    if (keep_attached)
+      status = (*jvm)->AttachCurrentThreadAsDaemon (jvm,
+          (void *) &jvm_env, (void *) &args);
+    else
+#else
+    keep_attached = 0;
+#endif
+      status = (*jvm)->AttachCurrentThread (jvm,
+          (void *) &jvm_env, (void *) &args);
     if (status != 0)
     {
       ERROR ("java plugin: cjni_thread_attach: AttachCurrentThread failed "
@@ -2103,14 +2144,27 @@ static JNIEnv *cjni_thread_attach (void) /* {{{ */
 
     cjni_env->reference_counter = 1;
     cjni_env->jvm_env = jvm_env;
+    cjni_env->keep_attached = keep_attached;
   }
 
   DEBUG ("java plugin: cjni_thread_attach: cjni_env->reference_counter = %i",
       cjni_env->reference_counter);
   assert (jvm_env != NULL);
   return (jvm_env);
+} /* }}} JNIEnv *cjni_thread_attach_internal */
+
+static JNIEnv *cjni_thread_attach (void) /* {{{ */
+{
+  return (cjni_thread_attach_internal (/* keep_attached = */ 0));
 } /* }}} JNIEnv *cjni_thread_attach */
 
+/* Like cjni_thread_attach, but the thread stays attached when the reference
+ * counter drops to zero. Used by the write callbacks. */
+static JNIEnv *cjni_thread_attach_write (void) /* {{{ */
+{
+  return (cjni_thread_attach_internal (/* keep_attached = */ 1));
+} /* }}} JNIEnv *cjni_thread_attach_write */
+
 /* Decrease the reference counter of this thread. If it reaches zero, detach
  * from the JVM. */
 static int cjni_thread_detach (void) /* {{{ */
@@ -2132,7 +2186,7 @@ static int cjni_thread_detach (void) /* {{{ */
   DEBUG ("java plugin: cjni_thread_detach: cjni_env->reference_counter = %i",
       cjni_env->reference_counter);
 
-  if (cjni_env->reference_counter > 0)
+  if ((cjni_env->reference_counter > 0) || cjni_env->keep_attached)
     return (0);
 
   status = (*jvm)->DetachCurrentThread (jvm);
@@ -2547,29 +2601,179 @@ static int cjni_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
     return (-1);
   }
 
-  jvm_env = cjni_thread_attach ();
+  jvm_env = cjni_thread_attach_write ();
   if (jvm_env == NULL)
     return (-1);
 
   cbi = (cjni_callback_info_t *) ud->data;
 
+  /* The thread stays attached, so local references are not released
+   * automatically. */
+  if ((*jvm_env)->PushLocalFrame (jvm_env, 16) != 0)
+  {
+    ERROR ("java plugin: cjni_write: PushLocalFrame failed.");
+    cjni_thread_detach ();
+    return (-1);
+  }
+
   vl_java = ctoj_value_list (jvm_env, ds, vl);
   if (vl_java == NULL)
   {
     ERROR ("java plugin: cjni_write: ctoj_value_list failed.");
+    (*jvm_env)->PopLocalFrame (jvm_env, NULL);
     cjni_thread_detach ();
     return (-1);
   }
 
   ret_status = (*jvm_env)->CallIntMethod (jvm_env,
       cbi->object, cbi->method, vl_java);
+  if ((*jvm_env)->ExceptionCheck (jvm_env))
+  {
+    ERROR ("java plugin: cjni_write: The write method of `%s' "
+        "threw an exception.", cbi->name);
+    (*jvm_env)->ExceptionDescribe (jvm_env);
+    (*jvm_env)->ExceptionClear (jvm_env);
+    ret_status = -1;
+  }
 
-  (*jvm_env)->DeleteLocalRef (jvm_env, vl_java);
+  (*jvm_env)->PopLocalFrame (jvm_env, NULL);
 
   cjni_thread_detach ();
   return (ret_status);
 } /* }}} int cjni_write */
 
+/* Call the CB_TYPE_WRITE_BATCH callback pointed to by the `user_data_t'
+ * pointer with an array of all value lists of the batch. Value lists of the
+ * same data set share one DataSet object. */
+static int cjni_write_batch (const write_batch_entry_t *entries, /* {{{ */
+    size_t entries_num, user_data_t *ud)
+{
+  JNIEnv *jvm_env;
+  cjni_callback_info_t *cbi;
+  jobjectArray o_array;
+  const data_set_t *ds_cache[CJNI_BATCH_DATA_SETS];
+  jobject o_ds_cache[CJNI_BATCH_DATA_SETS];
+  size_t ds_cache_num = 0;
+  int ret_status;
+  size_t i;
+
+  if (jvm == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch: jvm == NULL");
+    return (-1);
+  }
+
+  if ((ud == NULL) || (ud->data == NULL))
+  {
+    ERROR ("java plugin: cjni_write_batch: Invalid user data.");
+    return (-1);
+  }
+
+  if (entries_num == 0)
+    return (0);
+
+  jvm_env = cjni_thread_attach_write ();
+  if (jvm_env == NULL)
+    return (-1);
+
+  cbi = (cjni_callback_info_t *) ud->data;
+
+  if ((*jvm_env)->PushLocalFrame (jvm_env, CJNI_BATCH_DATA_SETS + 16) != 0)
+  {
+    ERROR ("java plugin: cjni_write_batch: PushLocalFrame failed.");
+    cjni_thread_detach ();
+    return (-1);
+  }
+
+  o_array = (*jvm_env)->NewObjectArray (jvm_env, (jsize) entries_num,
+      class_cache.c_valuelist, NULL);
+  if (o_array == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch: NewObjectArray failed.");
+    (*jvm_env)->PopLocalFrame (jvm_env, NULL);
+    cjni_thread_detach ();
+    return (-1);
+  }
+
+  for (i = 0; i < entries_num; i++)
+  {
+    const data_set_t *ds = entries[i].ds;
+    jobject o_dataset = NULL;
+    jobject o_valuelist;
+    _Bool cached = 0;
+    size_t j;
+
+    for (j = 0; j < ds_cache_num; j++)
+    {
+      if (ds_cache[j] == ds)
+      {
+        o_dataset = o_ds_cache[j];
+        cached = 1;
+        break;
+      }
+    }
+
+    if (o_dataset == NULL)
+    {
+      o_dataset = ctoj_data_set (jvm_env, ds);
+      if (o_dataset == NULL)
+      {
+        ERROR ("java plugin: cjni_write_batch: ctoj_data_set (%s) failed.",
+            ds->type);
+        (*jvm_env)->PopLocalFrame (jvm_env, NULL);
+        cjni_thread_detach ();
+        return (-1);
+      }
+
+      /* Data sets that don't fit into the cache are converted again for
+       * each value list. */
+      if (ds_cache_num < CJNI_BATCH_DATA_SETS)
+      {
+        ds_cache[ds_cache_num] = ds;
+        o_ds_cache[ds_cache_num] = o_dataset;
+        ds_cache_num++;
+        cached = 1;
+      }
+    }
+
+    o_valuelist = ctoj_value_list_with_data_set (jvm_env,
+        ds, o_dataset, entries[i].vl);
+
+    if (!cached)
+      (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
+
+    if (o_valuelist == NULL)
+    {
+      ERROR ("java plugin: cjni_write_batch: "
+          "ctoj_value_list_with_data_set failed.");
+      (*jvm_env)->PopLocalFrame (jvm_env, NULL);
+      cjni_thread_detach ();
+      return (-1);
+    }
+
+    (*jvm_env)->SetObjectArrayElement (jvm_env, o_array, (jsize) i,
+        o_valuelist);
+    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
+  }
+
+  ret_status = (*jvm_env)->CallIntMethod (jvm_env,
+      cbi->object, cbi->method, o_array);
+  if ((*jvm_env)->ExceptionCheck (jvm_env))
+  {
+    ERROR ("java plugin: cjni_write_batch: The write method of `%s' "
+        "threw an exception.", cbi->name);
+    (*jvm_env)->ExceptionDescribe (jvm_env);
+    (*jvm_env)->ExceptionClear (jvm_env);
+    ret_status = -1;
+  }
+
+  /* Releases the array, the value lists and the cached data sets. */
+  (*jvm_env)->PopLocalFrame (jvm_env, NULL);
+
+  cjni_thread_detach ();
+  return (ret_status);
+} /* }}} int cjni_write_batch */
+
 /* Call the CB_TYPE_FLUSH callback pointed to by the `user_data_t' pointer. */
 static int cjni_flush (cdtime_t timeout, const char *identifier, /* {{{ */
     user_data_t *ud)
@@ -3050,6 +3254,8 @@ static int cjni_shutdown (void) /* {{{ */
   java_classes_list_len = 0;
   sfree (java_classes_list);
 
+  cjni_class_cache_destroy (jvm_env);
+
   /* Destroy the JVM */
   DEBUG ("java plugin: Destroying the JVM.");
   (*jvm)->DestroyJavaVM (jvm);
@@ -45,8 +45,11 @@
 #include <errno.h>
 #include <math.h>
 #include <netdb.h>
+#include <arpa/inet.h>
+#include <pthread.h>
 
 #include "collectd/client.h"
+#include "collectd/network_buffer.h"
 
 /* NI_MAXHOST has been obsoleted by RFC 3493 which is a reason for SunOS 5.11
  * to no longer define it. We'll use the old, RFC 2553 value here. */
@@ -102,8 +105,17 @@
  */
 struct lcc_connection_s
 {
+  /* Requests are written to "fh" and replies read from "fh_in". A single
+   * "r+" stream can't switch from reading to writing while it holds unread
+   * input, which pipelined requests need. */
   FILE *fh;
+  FILE *fh_in;
   char errbuf[1024];
+  /* Only set in binary mode, see lcc_enable_binary(). */
+  lcc_network_buffer_t *nb;
+  /* GETVAL requests whose replies haven't been read, see
+   * lcc_getval_send(). */
+  size_t pending;
 };
 
 struct lcc_response_s
@@ -274,7 +286,7 @@ static int lcc_receive (lcc_connection_t *c, /* {{{ */
   memset (&res, 0, sizeof (res));
 
   /* Read the first line, containing the status and a message */
-  ptr = fgets (buffer, sizeof (buffer), c->fh);
+  ptr = fgets (buffer, sizeof (buffer), c->fh_in);
   if (ptr == NULL)
   {
     lcc_set_errno (c, errno);
@@ -322,7 +334,7 @@ static int lcc_receive (lcc_connection_t *c, /* {{{ */
   /* Now receive all the lines */
   for (i = 0; i < res.lines_num; i++)
   {
-    ptr = fgets (buffer, sizeof (buffer), c->fh);
+    ptr = fgets (buffer, sizeof (buffer), c->fh_in);
     if (ptr == NULL)
     {
       lcc_set_errno (c, errno);
@@ -367,6 +379,19 @@ static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
     return (-1);
   }
 
+  if (c->nb != NULL)
+  {
+    LCC_SET_ERRSTR (c, "This command is not available in binary mode.");
+    return (-1);
+  }
+
+  if (c->pending > 0)
+  {
+    LCC_SET_ERRSTR (c, "Replies to %zu GETVAL requests are pending.",
+        c->pending);
+    return (-1);
+  }
+
   status = lcc_send (c, command);
   if (status != 0)
     return (status);
@@ -379,6 +404,363 @@ static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
   return (status);
 } /* }}} int lcc_sendreceive */
 
+/*
+ * Binary mode: the commands and replies are parts as used by the network
+ * protocol, see src/utils_cmd_binary.h in the daemon.
+ */
+#define LCC_TYPE_VALUES           0x0006
+#define LCC_TYPE_UNIXSOCK_SYNC    0x0300
+#define LCC_TYPE_UNIXSOCK_STATUS  0x0301
+#define LCC_TYPE_UNIXSOCK_GETVAL  0x0302
+#define LCC_TYPE_UNIXSOCK_DS_NAME 0x0303
+#define LCC_TYPE_UNIXSOCK_RESET   0x0304
+
+#define LCC_PART_HEADER_SIZE 4
+/* The largest part the daemon accepts. */
+#define LCC_PART_MAX 1024
+#define LCC_PART_VALUES_MAX ((LCC_PART_MAX - LCC_PART_HEADER_SIZE - 2) / 9)
+#define LCC_BINARY_BUFFER_SIZE 16384
+
+static int lcc_binary_write_part (lcc_connection_t *c, /* {{{ */
+    uint16_t type, const void *body, size_t body_size)
+{
+  uint16_t header[2];
+
+  header[0] = htons (type);
+  header[1] = htons ((uint16_t) (LCC_PART_HEADER_SIZE + body_size));
+
+  if ((fwrite (header, sizeof (header), 1, c->fh) != 1)
+      || ((body_size > 0) && (fwrite (body, body_size, 1, c->fh) != 1)))
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_binary_write_part */
+
+/* Reads one part into "body", which is null-terminated. */
+static int lcc_binary_read_part (lcc_connection_t *c, /* {{{ */
+    uint16_t *ret_type, char *body, size_t *ret_body_size)
+{
+  uint16_t header[2];
+  size_t length;
+
+  if (fread (header, sizeof (header), 1, c->fh_in) != 1)
+  {
+    lcc_set_errno (c, (errno != 0) ? errno : EPIPE);
+    return (-1);
+  }
+
+  length = (size_t) ntohs (header[1]);
+  if ((length < LCC_PART_HEADER_SIZE) || (length > LCC_PART_MAX))
+  {
+    lcc_set_errno (c, EILSEQ);
+    return (-1);
+  }
+  length -= LCC_PART_HEADER_SIZE;
+
+  if ((length > 0) && (fread (body, length, 1, c->fh_in) != 1))
+  {
+    lcc_set_errno (c, (errno != 0) ? errno : EPIPE);
+    return (-1);
+  }
+  body[length] = 0;
+
+  *ret_type = ntohs (header[0]);
+  *ret_body_size = length;
+  return (0);
+} /* }}} int lcc_binary_read_part */
+
+/* Reads a status part, which holds the same line as a reply in text mode. */
+static int lcc_binary_read_status (lcc_connection_t *c, /* {{{ */
+    lcc_response_t *ret_res)
+{
+  char body[LCC_PART_MAX];
+  size_t body_size;
+  uint16_t type;
+  char *ptr = NULL;
+  int status;
+
+  status = lcc_binary_read_part (c, &type, body, &body_size);
+  if (status != 0)
+    return (status);
+
+  if (type != LCC_TYPE_UNIXSOCK_STATUS)
+  {
+    lcc_set_errno (c, EILSEQ);
+    return (-1);
+  }
+  LCC_DEBUG ("receive: <-- %s\n", body);
+
+  memset (ret_res, 0, sizeof (*ret_res));
+  errno = 0;
+  ret_res->status = (int) strtol (body, &ptr, 0);
+  if ((errno != 0) || (ptr == body))
+  {
+    lcc_set_errno (c, EILSEQ);
+    return (-1);
+  }
+
+  while ((*ptr == ' ') || (*ptr == '\t'))
+    ptr++;
+  strncpy (ret_res->message, ptr, sizeof (ret_res->message));
+  ret_res->message[sizeof (ret_res->message) - 1] = 0;
+
+  return (0);
+} /* }}} int lcc_binary_read_status */
+
+/* Writes the value lists collected in the network buffer and starts a new
+ * buffer. Like a network packet, the buffer only sends the fields that
+ * changed since its start, so the daemon is told to forget the previous
+ * ones. */
+static int lcc_binary_flush (lcc_connection_t *c) /* {{{ */
+{
+  char buffer[LCC_BINARY_BUFFER_SIZE];
+  size_t buffer_size = sizeof (buffer);
+
+  lcc_network_buffer_finalize (c->nb);
+  lcc_network_buffer_get (c->nb, buffer, &buffer_size);
+  lcc_network_buffer_initialize (c->nb);
+
+  if (buffer_size == 0)
+    return (0);
+
+  if ((lcc_binary_write_part (c, LCC_TYPE_UNIXSOCK_RESET, NULL, 0) != 0)
+      || (fwrite (buffer, buffer_size, 1, c->fh) != 1))
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_binary_flush */
+
+static int lcc_binary_putval (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vls, size_t vls_num, int flags)
+{
+  lcc_response_t res;
+  int format_status = 0;
+  int status = 0;
+  size_t i;
+
+  if (c->pending > 0)
+  {
+    LCC_SET_ERRSTR (c, "Replies to %zu GETVAL requests are pending.",
+        c->pending);
+    return (-1);
+  }
+
+  for (i = 0; i < vls_num; i++)
+  {
+    const lcc_value_list_t *vl = vls + i;
+
+    if ((vl->values_len < 1) || (vl->values_len > LCC_PART_VALUES_MAX)
+        || (vl->values == NULL) || (vl->values_types == NULL))
+    {
+      lcc_set_errno (c, EINVAL);
+      format_status = -1;
+      break;
+    }
+
+    /* When the buffer is full, send it and add the value list again. */
+    if (lcc_network_buffer_add_value (c->nb, vl) == 0)
+      continue;
+    status = lcc_binary_flush (c);
+    if (status != 0)
+      return (status);
+    if (lcc_network_buffer_add_value (c->nb, vl) != 0)
+    {
+      lcc_set_errno (c, EINVAL);
+      format_status = -1;
+      break;
+    }
+  }
+
+  /* Still send the value lists before a bad one, so that the reply covers
+   * them. */
+  status = lcc_binary_flush (c);
+  if ((status == 0) && !(flags & LCC_PUTVAL_NOREPLY))
+    status = lcc_binary_write_part (c, LCC_TYPE_UNIXSOCK_SYNC, NULL, 0);
+  if ((status == 0) && (fflush (c->fh) != 0))
+  {
+    lcc_set_errno (c, errno);
+    status = -1;
+  }
+  if (status != 0)
+    return (status);
+
+  if (flags & LCC_PUTVAL_NOREPLY)
+    return (format_status);
+
+  status = lcc_binary_read_status (c, &res);
+  if (status != 0)
+    return (status);
+
+  if (format_status != 0)
+    return (format_status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_binary_putval */
+
+/* Gauges are sent in x86 byte order, see htond() in network_buffer.c. */
+static gauge_t lcc_binary_gauge (const char *buffer) /* {{{ */
+{
+  const unsigned char *bytes = (const unsigned char *) buffer;
+  uint64_t bits = 0;
+  gauge_t value;
+  int i;
+
+  for (i = 7; i >= 0; i--)
+    bits = (bits << 8) | (uint64_t) bytes[i];
+
+  memcpy (&value, &bits, sizeof (value));
+  return (value);
+} /* }}} gauge_t lcc_binary_gauge */
+
+/* Reads the reply to a getval part. Returns zero on success, a positive
+ * value if the daemon returned an error and -1 if the connection failed. */
+static int lcc_binary_getval_receive (lcc_connection_t *c, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  char body[LCC_PART_MAX];
+  size_t body_size;
+  uint16_t type;
+  lcc_response_t res;
+  size_t values_num;
+  gauge_t *values = NULL;
+  char **values_names = NULL;
+  uint16_t tmp16;
+  size_t i;
+  int status;
+
+  status = lcc_binary_read_status (c, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status <= 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    return (1);
+  }
+  values_num = (size_t) res.status;
+
+#define BAIL_OUT(e) do { \
+  lcc_set_errno (c, (e)); \
+  free (values); \
+  if (values_names != NULL) { \
+    for (i = 0; i < values_num; i++) { \
+      free (values_names[i]); \
+    } \
+  } \
+  free (values_names); \
+  return (-1); \
+} while (0)
+
+  /* The names are read even if they're not requested, to get to the
+   * values. */
+  values = malloc (values_num * sizeof (*values));
+  values_names = calloc (values_num, sizeof (*values_names));
+  if ((values == NULL) || (values_names == NULL))
+    BAIL_OUT (ENOMEM);
+
+  for (i = 0; i < values_num; i++)
+  {
+    if (lcc_binary_read_part (c, &type, body, &body_size) != 0)
+      BAIL_OUT (errno);
+    if (type != LCC_TYPE_UNIXSOCK_DS_NAME)
+      BAIL_OUT (EILSEQ);
+
+    values_names[i] = strdup (body);
+    if (values_names[i] == NULL)
+      BAIL_OUT (ENOMEM);
+  }
+
+  if (lcc_binary_read_part (c, &type, body, &body_size) != 0)
+    BAIL_OUT (errno);
+  memcpy (&tmp16, body, sizeof (tmp16));
+  if ((type != LCC_TYPE_VALUES)
+      || (body_size != sizeof (tmp16) + values_num * 9)
+      || (ntohs (tmp16) != values_num))
+    BAIL_OUT (EILSEQ);
+
+  for (i = 0; i < values_num; i++)
+    values[i] = lcc_binary_gauge (body + sizeof (tmp16) + values_num
+        + i * sizeof (gauge_t));
+
+  if (ret_values_num != NULL)
+    *ret_values_num = values_num;
+
+  if (ret_values != NULL)
+    *ret_values = values;
+  else
+    free (values);
+
+  if (ret_values_names != NULL)
+    *ret_values_names = values_names;
+  else
+  {
+    for (i = 0; i < values_num; i++)
+      free (values_names[i]);
+    free (values_names);
+  }
+
+  return (0);
+#undef BAIL_OUT
+} /* }}} int lcc_binary_getval_receive */
+
+/* Takes ownership of "fd". Returns zero or an errno value. */
+static int lcc_open_streams (lcc_connection_t *c, int fd) /* {{{ */
+{
+  int fd_in;
+  int status;
+
+  fd_in = dup (fd);
+  if (fd_in < 0)
+  {
+    status = errno;
+    close (fd);
+    return (status);
+  }
+
+  c->fh = fdopen (fd, "w");
+  if (c->fh == NULL)
+  {
+    status = errno;
+    close (fd);
+    close (fd_in);
+    return (status);
+  }
+
+  c->fh_in = fdopen (fd_in, "r");
+  if (c->fh_in == NULL)
+  {
+    status = errno;
+    fclose (c->fh);
+    c->fh = NULL;
+    close (fd_in);
+    return (status);
+  }
+
+  return (0);
+} /* }}} int lcc_open_streams */
+
+static void lcc_close_streams (lcc_connection_t *c) /* {{{ */
+{
+  if (c->fh != NULL)
+    fclose (c->fh);
+  if (c->fh_in != NULL)
+    fclose (c->fh_in);
+  c->fh = NULL;
+  c->fh_in = NULL;
+} /* }}} void lcc_close_streams */
+
 static int lcc_open_unixsocket (lcc_connection_t *c, const char *path) /* {{{ */
 {
   struct sockaddr_un sa;
@@ -410,11 +792,10 @@ static int lcc_open_unixsocket (lcc_connection_t *c, const char *path) /* {{{ */
     return (-1);
   }
 
-  c->fh = fdopen (fd, "r+");
-  if (c->fh == NULL)
+  status = lcc_open_streams (c, fd);
+  if (status != 0)
   {
-    lcc_set_errno (c, errno);
-    close (fd);
+    lcc_set_errno (c, status);
     return (-1);
   }
 
@@ -511,13 +892,9 @@ static int lcc_open_netsocket (lcc_connection_t *c, /* {{{ */
       continue;
     }
 
-    c->fh = fdopen (fd, "r+");
-    if (c->fh == NULL)
-    {
-      status = errno;
-      close (fd);
+    status = lcc_open_streams (c, fd);
+    if (status != 0)
       continue;
-    }
 
     assert (status == 0);
     break;
@@ -604,51 +981,64 @@ int lcc_disconnect (lcc_connection_t *c) /* {{{ */
   if (c == NULL)
     return (-1);
 
-  if (c->fh != NULL)
-  {
-    fclose (c->fh);
-    c->fh = NULL;
-  }
-
+  lcc_close_streams (c);
+  lcc_network_buffer_destroy (c->nb);
   free (c);
   return (0);
 } /* }}} int lcc_disconnect */
 
-int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
-    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+int lcc_enable_binary (lcc_connection_t *c) /* {{{ */
 {
-  char ident_str[6 * LCC_NAME_LEN];
-  char ident_esc[12 * LCC_NAME_LEN];
-  char command[14 * LCC_NAME_LEN];
-
   lcc_response_t res;
-  size_t   values_num;
-  gauge_t *values = NULL;
-  char   **values_names = NULL;
-
-  size_t i;
   int status;
 
   if (c == NULL)
     return (-1);
 
-  if (ident == NULL)
+  if (c->nb != NULL)
+    return (0);
+
+  status = lcc_sendreceive (c, "BINARY", &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
   {
-    lcc_set_errno (c, EINVAL);
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
     return (-1);
   }
+  lcc_response_free (&res);
 
-  /* Build a commend with an escaped version of the identifier string. */
-  status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str), ident);
-  if (status != 0)
-    return (status);
+  c->nb = lcc_network_buffer_create (LCC_BINARY_BUFFER_SIZE);
+  if (c->nb == NULL)
+  {
+    /* The daemon is in binary mode already, so this connection is lost. */
+    lcc_set_errno (c, ENOMEM);
+    lcc_close_streams (c);
+    return (-1);
+  }
+  lcc_network_buffer_initialize (c->nb);
 
-  snprintf (command, sizeof (command), "GETVAL %s",
-      lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
-  command[sizeof (command) - 1] = 0;
+  return (0);
+} /* }}} int lcc_enable_binary */
 
-  /* Send talk to the daemon.. */
-  status = lcc_sendreceive (c, command, &res);
+/* Reads the reply to a GETVAL command in text mode. Returns zero on success,
+ * a positive value if the daemon returned an error and -1 if the connection
+ * failed. */
+static int lcc_text_getval_receive (lcc_connection_t *c, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  lcc_response_t res;
+  size_t   values_num;
+  gauge_t *values = NULL;
+  char   **values_names = NULL;
+
+  size_t i;
+  int status;
+
+  memset (&res, 0, sizeof (res));
+  status = lcc_receive (c, &res);
   if (status != 0)
     return (status);
 
@@ -656,7 +1046,7 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   {
     LCC_SET_ERRSTR (c, "Server error: %s", res.message);
     lcc_response_free (&res);
-    return (-1);
+    return (1);
   }
 
   values_num = res.lines_num;
@@ -729,6 +1119,7 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
         BAIL_OUT (ENOMEM);
     }
   } /* for (i = 0; i < res.lines_num; i++) */
+#undef BAIL_OUT
 
   if (ret_values_num != NULL)
     *ret_values_num = values_num;
@@ -740,14 +1131,211 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   lcc_response_free (&res);
 
   return (0);
+} /* }}} int lcc_text_getval_receive */
+
+/* Reads the reply to the oldest pending GETVAL request. Returns zero on
+ * success, a positive value if the daemon returned an error and -1 if the
+ * connection failed. */
+static int lcc_getval_read (lcc_connection_t *c, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  if (c->pending == 0)
+  {
+    LCC_SET_ERRSTR (c, "No GETVAL request is pending.");
+    return (-1);
+  }
+
+  /* The requests may still be in the stream buffer. */
+  if (fflush (c->fh) != 0)
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+  c->pending--;
+
+  if (c->nb != NULL)
+    return (lcc_binary_getval_receive (c, ret_values_num,
+          ret_values, ret_values_names));
+  return (lcc_text_getval_receive (c, ret_values_num,
+        ret_values, ret_values_names));
+} /* }}} int lcc_getval_read */
+
+int lcc_getval_send (lcc_connection_t *c, /* {{{ */
+    const lcc_identifier_t *ident)
+{
+  char ident_str[6 * LCC_NAME_LEN];
+  char ident_esc[12 * LCC_NAME_LEN];
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if (ident == NULL)
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str), ident);
+  if (status != 0)
+    return (status);
+
+  /* The request is only written to the stream buffer; it is flushed when the
+   * first reply is read. */
+  if (c->nb != NULL)
+    status = lcc_binary_write_part (c, LCC_TYPE_UNIXSOCK_GETVAL,
+        ident_str, strlen (ident_str) + 1);
+  else
+  {
+    lcc_strescape (ident_esc, ident_str, sizeof (ident_esc));
+    LCC_DEBUG ("send:    --> GETVAL %s\n", ident_esc);
+    if (fprintf (c->fh, "GETVAL %s\r\n", ident_esc) < 0)
+    {
+      lcc_set_errno (c, errno);
+      status = -1;
+    }
+  }
+  if (status != 0)
+    return (status);
+
+  c->pending++;
+  return (0);
+} /* }}} int lcc_getval_send */
+
+int lcc_getval_receive (lcc_connection_t *c, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  status = lcc_getval_read (c, ret_values_num, ret_values, ret_values_names);
+  return ((status == 0) ? 0 : -1);
+} /* }}} int lcc_getval_receive */
+
+int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if (c->pending > 0)
+  {
+    LCC_SET_ERRSTR (c, "Replies to %zu GETVAL requests are pending.",
+        c->pending);
+    return (-1);
+  }
+
+  status = lcc_getval_send (c, ident);
+  if (status != 0)
+    return (status);
+
+  return (lcc_getval_receive (c, ret_values_num,
+        ret_values, ret_values_names));
 } /* }}} int lcc_getval */
 
-int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+/* The daemon stops reading from a connection while it can't write the
+ * replies, so only this many requests are sent ahead of the replies. */
+#define LCC_GETVAL_WINDOW 128
+
+int lcc_getval_multi (lcc_connection_t *c, /* {{{ */
+    const lcc_identifier_t *idents, size_t idents_num,
+    lcc_getval_result_t *results)
+{
+  size_t sent = 0;
+  size_t received = 0;
+  int send_status = 0;
+
+  if (c == NULL)
+    return (-1);
+
+  if ((idents_num > 0) && ((idents == NULL) || (results == NULL)))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if (c->pending > 0)
+  {
+    LCC_SET_ERRSTR (c, "Replies to %zu GETVAL requests are pending.",
+        c->pending);
+    return (-1);
+  }
+
+  memset (results, 0, idents_num * sizeof (*results));
+
+  while (received < idents_num)
+  {
+    lcc_getval_result_t *r = results + received;
+    int status;
+
+    while ((send_status == 0) && (sent < idents_num)
+        && (sent - received < LCC_GETVAL_WINDOW))
+    {
+      send_status = lcc_getval_send (c, idents + sent);
+      if (send_status == 0)
+        sent++;
+    }
+
+    /* After a failed request, only collect the replies that are still due,
+     * so that the connection can be used again. */
+    if (received == sent)
+      break;
+
+    status = lcc_getval_read (c, &r->values_num, &r->values,
+        &r->values_names);
+    if (status < 0)
+      return (-1);
+    r->status = (status == 0) ? 0 : -1;
+    received++;
+  }
+
+  if (send_status != 0)
+  {
+    for (; sent < idents_num; sent++)
+      results[sent].status = -1;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_getval_multi */
+
+void lcc_getval_results_free (lcc_getval_result_t *results, /* {{{ */
+    size_t results_num)
+{
+  size_t i;
+  size_t j;
+
+  if (results == NULL)
+    return;
+
+  for (i = 0; i < results_num; i++)
+  {
+    if (results[i].values_names != NULL)
+      for (j = 0; j < results[i].values_num; j++)
+        free (results[i].values_names[j]);
+    free (results[i].values_names);
+    free (results[i].values);
+    memset (results + i, 0, sizeof (results[i]));
+  }
+} /* }}} void lcc_getval_results_free */
+
+/* Formats the PUTVAL command for "vl" into "ret". */
+static int lcc_putval_command (lcc_connection_t *c, /* {{{ */
+    char *ret, size_t ret_size, const lcc_value_list_t *vl)
 {
   char ident_str[6 * LCC_NAME_LEN];
   char ident_esc[12 * LCC_NAME_LEN];
   char command[1024] = "";
-  lcc_response_t res;
   int status;
   size_t i;
 
@@ -792,6 +1380,24 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 
   } /* for (i = 0; i < vl->values_len; i++) */
 
+  strncpy (ret, command, ret_size);
+  ret[ret_size - 1] = 0;
+  return (0);
+} /* }}} int lcc_putval_command */
+
+int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  int status;
+
+  if ((c != NULL) && (c->nb != NULL) && (vl != NULL))
+    return (lcc_binary_putval (c, vl, 1, /* flags = */ 0));
+
+  status = lcc_putval_command (c, command, sizeof (command), vl);
+  if (status != 0)
+    return (status);
+
   status = lcc_sendreceive (c, command, &res);
   if (status != 0)
     return (status);
@@ -807,6 +1413,90 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
   return (0);
 } /* }}} int lcc_putval */
 
+int lcc_putval_bulk (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vls, size_t vls_num, int flags)
+{
+  char command[1024];
+  lcc_response_t res;
+  int format_status = 0;
+  int status;
+  size_t i;
+
+  if ((c == NULL) || ((vls == NULL) && (vls_num > 0)))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  if (vls_num == 0)
+    return (0);
+
+  if (c->nb != NULL)
+    return (lcc_binary_putval (c, vls, vls_num, flags));
+
+  /* The commands are written to the stream buffer and only flushed with the
+   * end marker, so the whole batch takes a few writes and one reply. */
+  status = fprintf (c->fh, "BATCH%s\r\n",
+      (flags & LCC_PUTVAL_NOREPLY) ? " NOREPLY" : "");
+  for (i = 0; (i < vls_num) && (status >= 0); i++)
+  {
+    /* Still end the batch after a bad value list, the server is waiting for
+     * the end marker. */
+    format_status = lcc_putval_command (c, command, sizeof (command), &vls[i]);
+    if (format_status != 0)
+      break;
+
+    LCC_DEBUG ("send:    --> %s\n", command);
+    status = fprintf (c->fh, "%s\r\n", command);
+  }
+  if (status >= 0)
+    status = fprintf (c->fh, "END\r\n");
+  if ((status < 0) || (fflush (c->fh) != 0))
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+
+  if (flags & LCC_PUTVAL_NOREPLY)
+    return (format_status);
+
+  memset (&res, 0, sizeof (res));
+  status = lcc_receive (c, &res);
+  if (status != 0)
+    return (status);
+
+  if (format_status != 0)
+  {
+    lcc_response_free (&res);
+    return (format_status);
+  }
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  /* The failed lines follow the status line. */
+  if (res.lines_num > 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s First error on line %s",
+        res.message, res.lines[0]);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_putval_bulk */
+
 int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
     lcc_identifier_t *ident, int timeout)
 {
@@ -865,6 +1555,14 @@ int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
 int lcc_listval (lcc_connection_t *c, /* {{{ */
     lcc_identifier_t **ret_ident, size_t *ret_ident_num)
 {
+  return (lcc_listval_filter (c, /* filter = */ NULL,
+        ret_ident, ret_ident_num));
+} /* }}} int lcc_listval */
+
+int lcc_listval_filter (lcc_connection_t *c, /* {{{ */
+    const char *filter, lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  char command[1024] = "LISTVAL";
   lcc_response_t res;
   size_t i;
   int status;
@@ -881,7 +1579,19 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
     return (-1);
   }
 
-  status = lcc_sendreceive (c, "LISTVAL", &res);
+  if ((filter != NULL) && (filter[0] != 0))
+  {
+    char filter_esc[sizeof (command) - sizeof ("LISTVAL ")];
+
+    if (lcc_strescape (filter_esc, filter, sizeof (filter_esc)) == NULL)
+    {
+      lcc_set_errno (c, EINVAL);
+      return (-1);
+    }
+    snprintf (command, sizeof (command), "LISTVAL %s", filter_esc);
+  }
+
+  status = lcc_sendreceive (c, command, &res);
   if (status != 0)
     return (status);
 
@@ -943,7 +1653,7 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
   *ret_ident_num = ident_num;
 
   return (0);
-} /* }}} int lcc_listval */
+} /* }}} int lcc_listval_filter */
 
 const char *lcc_strerror (lcc_connection_t *c) /* {{{ */
 {
@@ -1105,4 +1815,147 @@ int lcc_sort_identifiers (lcc_connection_t *c, /* {{{ */
   return (0);
 } /* }}} int lcc_sort_identifiers */
 
+/*
+ * Connection pool
+ */
+struct lcc_pool_s
+{
+  char *address;
+  int flags;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* Idle connections, at most "connections_max". */
+  lcc_connection_t **idle;
+  size_t idle_num;
+  /* Connections that are idle, in use or being opened. */
+  size_t open_num;
+  size_t connections_max;
+};
+
+lcc_pool_t *lcc_pool_create (const char *address, /* {{{ */
+    size_t connections_max, int flags)
+{
+  lcc_pool_t *pool;
+
+  if ((address == NULL) || (connections_max == 0))
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  pool = calloc (1, sizeof (*pool));
+  if (pool == NULL)
+    return (NULL);
+
+  pool->address = strdup (address);
+  pool->idle = calloc (connections_max, sizeof (*pool->idle));
+  if ((pool->address == NULL) || (pool->idle == NULL))
+  {
+    free (pool->address);
+    free (pool->idle);
+    free (pool);
+    errno = ENOMEM;
+    return (NULL);
+  }
+
+  pool->flags = flags;
+  pool->connections_max = connections_max;
+  pthread_mutex_init (&pool->lock, /* attr = */ NULL);
+  pthread_cond_init (&pool->cond, /* attr = */ NULL);
+
+  return (pool);
+} /* }}} lcc_pool_t *lcc_pool_create */
+
+void lcc_pool_destroy (lcc_pool_t *pool) /* {{{ */
+{
+  size_t i;
+
+  if (pool == NULL)
+    return;
+
+  for (i = 0; i < pool->idle_num; i++)
+    lcc_disconnect (pool->idle[i]);
+
+  pthread_cond_destroy (&pool->cond);
+  pthread_mutex_destroy (&pool->lock);
+  free (pool->idle);
+  free (pool->address);
+  free (pool);
+} /* }}} void lcc_pool_destroy */
+
+int lcc_pool_get (lcc_pool_t *pool, lcc_connection_t **ret_con) /* {{{ */
+{
+  lcc_connection_t *c = NULL;
+  int status;
+
+  if ((pool == NULL) || (ret_con == NULL))
+    return (EINVAL);
+
+  pthread_mutex_lock (&pool->lock);
+  while ((pool->idle_num == 0) && (pool->open_num >= pool->connections_max))
+    pthread_cond_wait (&pool->cond, &pool->lock);
+
+  if (pool->idle_num > 0)
+  {
+    pool->idle_num--;
+    *ret_con = pool->idle[pool->idle_num];
+    pthread_mutex_unlock (&pool->lock);
+    return (0);
+  }
+
+  /* Connect without holding the lock, the slot is reserved. */
+  pool->open_num++;
+  pthread_mutex_unlock (&pool->lock);
+
+  status = lcc_connect (pool->address, &c);
+  if ((status == 0) && (pool->flags & LCC_POOL_BINARY))
+  {
+    status = lcc_enable_binary (c);
+    if (status != 0)
+    {
+      lcc_disconnect (c);
+      c = NULL;
+    }
+  }
+
+  if (status != 0)
+  {
+    pthread_mutex_lock (&pool->lock);
+    pool->open_num--;
+    pthread_cond_signal (&pool->cond);
+    pthread_mutex_unlock (&pool->lock);
+    return ((errno != 0) ? errno : ECONNREFUSED);
+  }
+
+  *ret_con = c;
+  return (0);
+} /* }}} int lcc_pool_get */
+
+void lcc_pool_put (lcc_pool_t *pool, lcc_connection_t *c, /* {{{ */
+    int failed)
+{
+  if ((pool == NULL) || (c == NULL))
+    return;
+
+  /* A connection that failed or still has replies to read can't be given to
+   * the next caller. */
+  if (failed || (c->fh == NULL) || (c->pending > 0))
+  {
+    lcc_disconnect (c);
+    pthread_mutex_lock (&pool->lock);
+    pool->open_num--;
+  }
+  else
+  {
+    pthread_mutex_lock (&pool->lock);
+    pool->idle[pool->idle_num] = c;
+    pool->idle_num++;
+  }
+
+  pthread_cond_signal (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+} /* }}} void lcc_pool_put */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -101,16 +101,62 @@ int lcc_connect (const char *address, lcc_connection_t **ret_con);
 int lcc_disconnect (lcc_connection_t *c);
 #define LCC_DESTROY(c) do { lcc_disconnect (c); (c) = NULL; } while (0)
 
+/* Switches the connection to the binary protocol of the unixsock plugin.
+ * Afterwards, only lcc_putval(), lcc_putval_bulk() and lcc_getval() can be
+ * used. Value lists with more than 112 values can't be sent. */
+int lcc_enable_binary (lcc_connection_t *c);
+
 int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
     size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names);
 
+/* Pipelined GETVAL: lcc_getval_send() queues a request without waiting for
+ * the reply, lcc_getval_receive() reads the reply of the oldest outstanding
+ * request. The daemon stops reading while its replies aren't read, so don't
+ * let more than a few hundred requests pile up. Other commands fail while
+ * replies are outstanding. */
+int lcc_getval_send (lcc_connection_t *c, const lcc_identifier_t *ident);
+int lcc_getval_receive (lcc_connection_t *c,
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names);
+
+struct lcc_getval_result_s
+{
+  /* Zero, or -1 if the daemon returned an error for this identifier. */
+  int status;
+  size_t values_num;
+  gauge_t *values;
+  char **values_names;
+};
+typedef struct lcc_getval_result_s lcc_getval_result_t;
+
+/* Fetches the values of all "idents_num" identifiers, keeping a window of
+ * requests in flight. "results" must have room for "idents_num" results and
+ * has to be freed with lcc_getval_results_free(), even on failure. Returns
+ * -1 if the connection failed or an identifier couldn't be sent; errors for
+ * single identifiers are only reported in their result. */
+int lcc_getval_multi (lcc_connection_t *c,
+    const lcc_identifier_t *idents, size_t idents_num,
+    lcc_getval_result_t *results);
+void lcc_getval_results_free (lcc_getval_result_t *results,
+    size_t results_num);
+
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* Sends all "vls_num" value lists in "vls" as one batch and waits for a single
+ * reply. With LCC_PUTVAL_NOREPLY, the server doesn't reply and only logs
+ * errors, so this returns as soon as the batch has been written. */
+#define LCC_PUTVAL_NOREPLY 0x01
+int lcc_putval_bulk (lcc_connection_t *c,
+    const lcc_value_list_t *vls, size_t vls_num, int flags);
+
 int lcc_flush (lcc_connection_t *c, const char *plugin,
     lcc_identifier_t *ident, int timeout);
 
 int lcc_listval (lcc_connection_t *c,
     lcc_identifier_t **ret_ident, size_t *ret_ident_num);
+/* Only returns the identifiers starting with "filter" or, if it contains
+ * wildcards, matching it as a shell pattern. The server does the filtering. */
+int lcc_listval_filter (lcc_connection_t *c, const char *filter,
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num);
 
 /* TODO: putnotif */
 
@@ -129,6 +175,27 @@ int lcc_identifier_compare (const lcc_identifier_t *i0,
 int lcc_sort_identifiers (lcc_connection_t *c,
     lcc_identifier_t *idents, size_t idents_num);
 
+/*
+ * A thread-safe pool of connections to one daemon. lcc_pool_get() hands out
+ * an idle connection or opens a new one, and blocks while "connections_max"
+ * connections are in use. Each connection must be returned with
+ * lcc_pool_put() before the pool is destroyed; pass a non-zero "failed" if a
+ * call on it failed, so that it's closed instead of being reused.
+ */
+struct lcc_pool_s;
+typedef struct lcc_pool_s lcc_pool_t;
+
+/* Enables binary mode on the connections of the pool. */
+#define LCC_POOL_BINARY 0x01
+
+lcc_pool_t *lcc_pool_create (const char *address, size_t connections_max,
+    int flags);
+void lcc_pool_destroy (lcc_pool_t *pool);
+
+/* Returns zero or an errno value. */
+int lcc_pool_get (lcc_pool_t *pool, lcc_connection_t **ret_con);
+void lcc_pool_put (lcc_pool_t *pool, lcc_connection_t *c, int failed);
+
 LCC_END_DECLS
 
 /* vim: set sw=2 sts=2 et : */
@@ -69,12 +69,31 @@ int lcc_server_set_interface (lcc_server_t *srv, char const *interface);
 int lcc_server_set_security_level (lcc_server_t *srv,
     lcc_security_level_t level,
     const char *username, const char *password);
+/* Only servers with LZ4 support can read compressed packets. */
+int lcc_server_set_compression (lcc_server_t *srv, int compress);
+/* Only servers which understand identifier dictionaries can read these
+ * packets. */
+int lcc_server_set_dictionary (lcc_server_t *srv, int enable, int refresh);
 
 /*
  * Send data
+ *
+ * Values are buffered until a packet is full. The values are encoded once for
+ * all servers without dictionary; each server then compresses, signs or
+ * encrypts the packet on its own. All functions are thread-safe.
  */
 int lcc_network_values_send (lcc_network_t *net,
     const lcc_value_list_t *vl);
+/* Like lcc_network_values_send(), but the packets which are filled up are
+ * sent together, using sendmmsg(2) if available. */
+int lcc_network_values_send_bulk (lcc_network_t *net,
+    const lcc_value_list_t *vls, size_t vls_num);
+/* Sends all buffered values. lcc_network_destroy() does this, too. */
+int lcc_network_flush (lcc_network_t *net);
+/* Starts a thread which sends buffered values at most "linger" seconds after
+ * the oldest of them was added. Zero stops the thread, so that values are only
+ * sent once a packet is full or lcc_network_flush() is called. */
+int lcc_network_set_linger (lcc_network_t *net, double linger);
 #if 0
 int lcc_network_notification_send (lcc_network_t *net,
     const lcc_notification_t *notif);
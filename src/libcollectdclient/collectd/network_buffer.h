@@ -44,12 +44,35 @@ int lcc_network_buffer_set_security_level (lcc_network_buffer_t *nb,
     lcc_security_level_t level,
     const char *user, const char *password);
 
+/* Compresses the data with LZ4 before signing or encrypting it. Returns
+ * ENOTSUP if the library was built without liblz4. */
+int lcc_network_buffer_set_compression (lcc_network_buffer_t *nb,
+    int compress);
+
+/* Sends a numeric id instead of the identifier of each value list. The full
+ * identifier is sent with the first use of an id and again every "refresh"
+ * seconds; zero selects the default of 60 seconds. Only servers which
+ * understand identifier dictionaries can read these packets. */
+int lcc_network_buffer_set_dictionary (lcc_network_buffer_t *nb,
+    int enable, int refresh);
+
 int lcc_network_buffer_initialize (lcc_network_buffer_t *nb);
 int lcc_network_buffer_finalize (lcc_network_buffer_t *nb);
 
 int lcc_network_buffer_add_value (lcc_network_buffer_t *nb,
     const lcc_value_list_t *vl);
 
+/* Returns the number of bytes available for data parts in an empty packet,
+ * i.e. the size without the security headers. */
+size_t lcc_network_buffer_payload_size (lcc_network_buffer_t *nb);
+
+/* Appends data parts encoded by another buffer without security, compression
+ * or dictionary. Only lcc_network_buffer_finalize() may follow, because the
+ * buffer doesn't know which fields the parts have set. Returns ENOMEM if the
+ * parts don't fit. */
+int lcc_network_buffer_add_payload (lcc_network_buffer_t *nb,
+    const void *payload, size_t payload_size);
+
 int lcc_network_buffer_get (lcc_network_buffer_t *nb,
     void *buffer, size_t *buffer_size);
 
@@ -0,0 +1,52 @@
+/**
+ * libcollectdclient - src/libcollectdclient/collectd/shm.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef LIBCOLLECTDCLIENT_SHM_H
+#define LIBCOLLECTDCLIENT_SHM_H 1
+
+#include "client.h"
+
+/*
+ * Reads the values the daemon publishes with the global "CacheSharedMemory"
+ * option. The file is mapped read-only; reading a value takes no system call
+ * and never blocks the daemon. A handle may be used by one thread at a time.
+ */
+struct lcc_shm_s;
+typedef struct lcc_shm_s lcc_shm_t;
+
+/* Maps "file". Returns zero on success or an errno value. */
+int lcc_shm_open (const char *file, lcc_shm_t **ret_shm);
+void lcc_shm_close (lcc_shm_t *shm);
+
+/* Copies the current rates of "ident", the same values "GETVAL" returns, into
+ * "values", which has room for "values_size" values. "ret_values_num" (the
+ * number of data sources), "ret_time" and "ret_interval" (in seconds) may be
+ * NULL. Returns zero on success, ENOENT if the daemon doesn't know "ident",
+ * ENOBUFS if "values" is too small and ESTALE if the daemon has been
+ * restarted or stopped; reopen the file in the latter case. */
+int lcc_shm_getval (lcc_shm_t *shm, const lcc_identifier_t *ident,
+    gauge_t *values, size_t values_size, size_t *ret_values_num,
+    double *ret_time, double *ret_interval);
+
+#endif /* LIBCOLLECTDCLIENT_SHM_H */
+/* vim: set sw=2 sts=2 et : */
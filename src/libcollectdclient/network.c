@@ -26,6 +26,8 @@
  *   Max Henkel <henkel at gmx.at>
  **/
 
+#define _GNU_SOURCE /* For sendmmsg(2) */
+
 #include "collectd.h"
 
 #include <stdlib.h>
@@ -34,9 +36,11 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netdb.h>
 
 #if HAVE_NETINET_IN_H
@@ -50,12 +54,36 @@
 #include "collectd/network.h"
 #include "collectd/network_buffer.h"
 
+/* Maximum number of finished packets queued for one server. They are handed
+ * to sendmmsg(2) in one go if it is available. */
+#define LCC_NETWORK_QUEUE_MAX 32
+
 /*
  * Private data types
  */
 struct lcc_network_s
 {
   lcc_server_t *servers;
+
+  /* Protects everything, including the servers. */
+  pthread_mutex_t lock;
+
+  /* The values are encoded once into "shared" for all servers without
+   * dictionary. Full packets are copied into the buffer of each server, which
+   * compresses, signs or encrypts them. The size is the smallest payload size
+   * of these servers; the buffer is recreated when the servers change. */
+  lcc_network_buffer_t *shared;
+  size_t shared_values;
+
+  /* Time of the oldest buffered value, or zero. */
+  double pending_since;
+
+  /* See lcc_network_set_linger(). */
+  double linger;
+  pthread_t flush_thread;
+  int flush_thread_running;
+  int flush_thread_stop;
+  pthread_cond_t flush_cond;
 };
 
 struct lcc_server_s
@@ -73,10 +101,25 @@ struct lcc_server_s
   socklen_t sa_len;
 
   lcc_network_buffer_t *buffer;
+  /* Number of values in "buffer". Only servers with dictionary use it to
+   * encode values, the others to finalize packets of the shared buffer. */
+  size_t buffer_values;
+  int dictionary;
+
+  /* LCC_NETWORK_QUEUE_MAX packets of LCC_NETWORK_BUFFER_SIZE_DEFAULT bytes. */
+  char *queue;
+  size_t queue_sizes[LCC_NETWORK_QUEUE_MAX];
+  size_t queue_num;
 
+  lcc_network_t *net;
   lcc_server_t *next;
 };
 
+#if HAVE_SENDMMSG
+/* Cleared when sendmmsg(2) returned ENOSYS. */
+static int have_sendmmsg = 1;
+#endif
+
 /*
  * Private functions
  */
@@ -108,6 +151,8 @@ static void int_server_destroy (lcc_server_t *srv) /* {{{ */
 
   next = srv->next;
 
+  lcc_network_buffer_destroy (srv->buffer);
+  free (srv->queue);
   free (srv->node);
   free (srv->service);
   free (srv->username);
@@ -202,21 +247,109 @@ static int server_open_socket (lcc_server_t *srv) /* {{{ */
   return (0);
 } /* }}} int server_open_socket */
 
-static int server_send_buffer (lcc_server_t *srv) /* {{{ */
+static double net_now (void) /* {{{ */
 {
-  char buffer[LCC_NETWORK_BUFFER_SIZE_DEFAULT];
-  size_t buffer_size;
+  struct timeval tv;
+
+  if (gettimeofday (&tv, /* timezone = */ NULL) != 0)
+    return (0.0);
+
+  return (((double) tv.tv_sec) + (((double) tv.tv_usec) / 1e6));
+} /* }}} double net_now */
+
+/* Sends all queued packets. Packets that can't be sent are dropped. */
+static int server_queue_send (lcc_server_t *srv) /* {{{ */
+{
+  size_t sent = 0;
   int status;
 
+  if (srv->queue_num == 0)
+    return (0);
+
   if (srv->fd < 0)
   {
     status = server_open_socket (srv);
     if (status != 0)
+    {
+      srv->queue_num = 0;
       return (status);
+    }
   }
 
-  memset (buffer, 0, sizeof (buffer));
-  buffer_size = sizeof (buffer);
+  assert (srv->fd >= 0);
+  assert (srv->sa != NULL);
+
+#if HAVE_SENDMMSG
+  while (have_sendmmsg && (sent < srv->queue_num))
+  {
+    struct mmsghdr msgs[LCC_NETWORK_QUEUE_MAX];
+    struct iovec iovs[LCC_NETWORK_QUEUE_MAX];
+    size_t msgs_num = srv->queue_num - sent;
+    size_t i;
+
+    memset (msgs, 0, msgs_num * sizeof (*msgs));
+    for (i = 0; i < msgs_num; i++)
+    {
+      iovs[i].iov_base = srv->queue
+        + ((sent + i) * LCC_NETWORK_BUFFER_SIZE_DEFAULT);
+      iovs[i].iov_len = srv->queue_sizes[sent + i];
+
+      msgs[i].msg_hdr.msg_name = srv->sa;
+      msgs[i].msg_hdr.msg_namelen = srv->sa_len;
+      msgs[i].msg_hdr.msg_iov = iovs + i;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    status = sendmmsg (srv->fd, msgs, (unsigned int) msgs_num,
+        /* flags = */ 0);
+    if (status < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      if (errno == ENOSYS)
+      {
+        have_sendmmsg = 0;
+        break;
+      }
+      srv->queue_num = 0;
+      return (-1);
+    }
+
+    sent += (size_t) status;
+  }
+#endif
+
+  while (sent < srv->queue_num)
+  {
+    status = (int) sendto (srv->fd,
+        srv->queue + (sent * LCC_NETWORK_BUFFER_SIZE_DEFAULT),
+        srv->queue_sizes[sent], /* flags = */ 0, srv->sa, srv->sa_len);
+    if ((status < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+      continue;
+
+    if (status < 0)
+    {
+      srv->queue_num = 0;
+      return (-1);
+    }
+
+    sent++;
+  }
+
+  srv->queue_num = 0;
+  return (0);
+} /* }}} int server_queue_send */
+
+/* Finalizes the buffer of the server and moves the packet to the queue. */
+static int server_queue_buffer (lcc_server_t *srv) /* {{{ */
+{
+  size_t buffer_size;
+  int status;
+
+  if (srv->queue_num >= LCC_NETWORK_QUEUE_MAX)
+    server_queue_send (srv);
+
+  srv->buffer_values = 0;
 
   status = lcc_network_buffer_finalize (srv->buffer);
   if (status != 0)
@@ -225,44 +358,233 @@ static int server_send_buffer (lcc_server_t *srv) /* {{{ */
     return (status);
   }
 
-  status = lcc_network_buffer_get (srv->buffer, buffer, &buffer_size);
+  buffer_size = LCC_NETWORK_BUFFER_SIZE_DEFAULT;
+  status = lcc_network_buffer_get (srv->buffer,
+      srv->queue + (srv->queue_num * LCC_NETWORK_BUFFER_SIZE_DEFAULT),
+      &buffer_size);
   lcc_network_buffer_initialize (srv->buffer);
 
   if (status != 0)
     return (status);
 
-  if (buffer_size > sizeof (buffer))
-    buffer_size = sizeof (buffer);
+  if (buffer_size > LCC_NETWORK_BUFFER_SIZE_DEFAULT)
+    buffer_size = LCC_NETWORK_BUFFER_SIZE_DEFAULT;
+
+  srv->queue_sizes[srv->queue_num] = buffer_size;
+  srv->queue_num++;
+  return (0);
+} /* }}} int server_queue_buffer */
 
-  while (42)
+/* Only used for servers with dictionary, the others get the packets of the
+ * shared buffer. */
+static int server_value_add (lcc_server_t *srv, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  int status;
+
+  status = lcc_network_buffer_add_value (srv->buffer, vl);
+  if (status != 0)
   {
-    assert (srv->fd >= 0);
-    assert (srv->sa != NULL);
-    status = (int) sendto (srv->fd, buffer, buffer_size, /* flags = */ 0,
-        srv->sa, srv->sa_len);
-    if ((status < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+    server_queue_buffer (srv);
+    status = lcc_network_buffer_add_value (srv->buffer, vl);
+  }
+
+  if (status == 0)
+    srv->buffer_values++;
+  return (status);
+} /* }}} int server_value_add */
+
+/* Queues the packet in the shared buffer for all servers without
+ * dictionary. */
+static int network_shared_queue (lcc_network_t *net) /* {{{ */
+{
+  char packet[LCC_NETWORK_BUFFER_SIZE_DEFAULT];
+  size_t packet_size = sizeof (packet);
+  lcc_server_t *srv;
+  int status;
+
+  if ((net->shared == NULL) || (net->shared_values == 0))
+    return (0);
+
+  status = lcc_network_buffer_get (net->shared, packet, &packet_size);
+  lcc_network_buffer_initialize (net->shared);
+  net->shared_values = 0;
+  if (status != 0)
+    return (status);
+  /* The shared buffer is never larger than the payload of a server. */
+  assert (packet_size <= sizeof (packet));
+
+  for (srv = net->servers; srv != NULL; srv = srv->next)
+  {
+    if (srv->dictionary)
       continue;
 
-    break;
+    status = lcc_network_buffer_add_payload (srv->buffer, packet, packet_size);
+    if (status != 0)
+    {
+      lcc_network_buffer_initialize (srv->buffer);
+      continue;
+    }
+    server_queue_buffer (srv);
   }
 
-  if (status < 0)
-    return (status);
   return (0);
-} /* }}} int server_send_buffer */
+} /* }}} int network_shared_queue */
 
-static int server_value_add (lcc_server_t *srv, /* {{{ */
+static int network_shared_add (lcc_network_t *net, /* {{{ */
     const lcc_value_list_t *vl)
 {
   int status;
 
-  status = lcc_network_buffer_add_value (srv->buffer, vl);
+  if (net->shared == NULL)
+  {
+    size_t size = 0;
+    lcc_server_t *srv;
+
+    for (srv = net->servers; srv != NULL; srv = srv->next)
+    {
+      size_t payload_size;
+
+      if (srv->dictionary)
+        continue;
+
+      payload_size = lcc_network_buffer_payload_size (srv->buffer);
+      if ((size == 0) || (payload_size < size))
+        size = payload_size;
+    }
+
+    /* No server without dictionary. */
+    if (size == 0)
+      return (0);
+
+    net->shared = lcc_network_buffer_create (size);
+    if (net->shared == NULL)
+      return (ENOMEM);
+    net->shared_values = 0;
+  }
+
+  status = lcc_network_buffer_add_value (net->shared, vl);
+  if (status != 0)
+  {
+    network_shared_queue (net);
+    status = lcc_network_buffer_add_value (net->shared, vl);
+  }
+
   if (status == 0)
-    return (0);
+    net->shared_values++;
+  return (status);
+} /* }}} int network_shared_add */
 
-  server_send_buffer (srv);
-  return (lcc_network_buffer_add_value (srv->buffer, vl));
-} /* }}} int server_value_add */
+static int network_value_add (lcc_network_t *net, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  lcc_server_t *srv;
+  int status;
+
+  status = network_shared_add (net, vl);
+  if (status != 0)
+    return (status);
+
+  for (srv = net->servers; srv != NULL; srv = srv->next)
+    if (srv->dictionary)
+      server_value_add (srv, vl);
+
+  if (net->pending_since == 0.0)
+  {
+    net->pending_since = net_now ();
+    if (net->flush_thread_running)
+      pthread_cond_signal (&net->flush_cond);
+  }
+
+  return (0);
+} /* }}} int network_value_add */
+
+static void network_queues_send (lcc_network_t *net) /* {{{ */
+{
+  lcc_server_t *srv;
+
+  for (srv = net->servers; srv != NULL; srv = srv->next)
+    server_queue_send (srv);
+} /* }}} void network_queues_send */
+
+/* Sends all buffered values. */
+static void network_flush (lcc_network_t *net) /* {{{ */
+{
+  lcc_server_t *srv;
+
+  network_shared_queue (net);
+  for (srv = net->servers; srv != NULL; srv = srv->next)
+    if (srv->dictionary && (srv->buffer_values > 0))
+      server_queue_buffer (srv);
+
+  network_queues_send (net);
+  net->pending_since = 0.0;
+} /* }}} void network_flush */
+
+/* Called before the servers or their settings change. Sends the buffered
+ * values and drops the shared buffer, so that its size is recalculated. */
+static void network_reset (lcc_network_t *net) /* {{{ */
+{
+  network_flush (net);
+  lcc_network_buffer_destroy (net->shared);
+  net->shared = NULL;
+  net->shared_values = 0;
+} /* }}} void network_reset */
+
+static void *network_flush_thread (void *arg) /* {{{ */
+{
+  lcc_network_t *net = arg;
+
+  pthread_mutex_lock (&net->lock);
+  while (!net->flush_thread_stop)
+  {
+    double deadline;
+    double now;
+    struct timespec ts;
+
+    if (net->pending_since == 0.0)
+    {
+      pthread_cond_wait (&net->flush_cond, &net->lock);
+      continue;
+    }
+
+    deadline = net->pending_since + net->linger;
+    now = net_now ();
+    if (now >= deadline)
+    {
+      network_flush (net);
+      continue;
+    }
+
+    ts.tv_sec = (time_t) deadline;
+    ts.tv_nsec = (long) ((deadline - ((double) ts.tv_sec)) * 1e9);
+    pthread_cond_timedwait (&net->flush_cond, &net->lock, &ts);
+  }
+  pthread_mutex_unlock (&net->lock);
+
+  return (NULL);
+} /* }}} void *network_flush_thread */
+
+static void network_flush_thread_stop (lcc_network_t *net) /* {{{ */
+{
+  pthread_mutex_lock (&net->lock);
+  /* Someone else may be stopping it already. */
+  if (!net->flush_thread_running || net->flush_thread_stop)
+  {
+    pthread_mutex_unlock (&net->lock);
+    return;
+  }
+  net->flush_thread_stop = 1;
+  pthread_cond_signal (&net->flush_cond);
+  pthread_mutex_unlock (&net->lock);
+
+  pthread_join (net->flush_thread, /* retval = */ NULL);
+
+  pthread_mutex_lock (&net->lock);
+  net->flush_thread_running = 0;
+  net->flush_thread_stop = 0;
+  pthread_mutex_unlock (&net->lock);
+} /* }}} void network_flush_thread_stop */
 
 /*
  * Public functions
@@ -276,6 +598,8 @@ lcc_network_t *lcc_network_create (void) /* {{{ */
     return (NULL);
 
   net->servers = NULL;
+  pthread_mutex_init (&net->lock, /* attr = */ NULL);
+  pthread_cond_init (&net->flush_cond, /* attr = */ NULL);
 
   return (net);
 } /* }}} lcc_network_t *lcc_network_create */
@@ -284,7 +608,17 @@ void lcc_network_destroy (lcc_network_t *net) /* {{{ */
 {
   if (net == NULL)
     return;
+
+  network_flush_thread_stop (net);
+
+  pthread_mutex_lock (&net->lock);
+  network_flush (net);
+  pthread_mutex_unlock (&net->lock);
+
   int_server_destroy (net->servers);
+  lcc_network_buffer_destroy (net->shared);
+  pthread_cond_destroy (&net->flush_cond);
+  pthread_mutex_destroy (&net->lock);
   free (net);
 } /* }}} void lcc_network_destroy */
 
@@ -324,14 +658,20 @@ lcc_server_t *lcc_server_create (lcc_network_t *net, /* {{{ */
   }
 
   srv->buffer = lcc_network_buffer_create (/* size = */ 0);
-  if (srv->buffer == NULL)
+  srv->queue = malloc (LCC_NETWORK_QUEUE_MAX * LCC_NETWORK_BUFFER_SIZE_DEFAULT);
+  if ((srv->buffer == NULL) || (srv->queue == NULL))
   {
+    lcc_network_buffer_destroy (srv->buffer);
+    free (srv->queue);
     free (srv->service);
     free (srv->node);
     free (srv);
     return (NULL);
   }
+  srv->net = net;
 
+  pthread_mutex_lock (&net->lock);
+  network_reset (net);
   if (net->servers == NULL)
   {
     net->servers = srv;
@@ -345,6 +685,7 @@ lcc_server_t *lcc_server_create (lcc_network_t *net, /* {{{ */
 
     last->next = srv;
   }
+  pthread_mutex_unlock (&net->lock);
 
   return (srv);
 } /* }}} lcc_server_t *lcc_server_create */
@@ -354,6 +695,8 @@ int lcc_server_destroy (lcc_network_t *net, lcc_server_t *srv) /* {{{ */
   if ((net == NULL) || (srv == NULL))
     return (EINVAL);
 
+  pthread_mutex_lock (&net->lock);
+  network_reset (net);
   if (net->servers == srv)
   {
     net->servers = srv->next;
@@ -367,11 +710,15 @@ int lcc_server_destroy (lcc_network_t *net, lcc_server_t *srv) /* {{{ */
       prev = prev->next;
 
     if (prev == NULL)
+    {
+      pthread_mutex_unlock (&net->lock);
       return (ENOENT);
+    }
 
     prev->next = srv->next;
     srv->next = NULL;
   }
+  pthread_mutex_unlock (&net->lock);
 
   int_server_destroy (srv);
 
@@ -383,12 +730,15 @@ int lcc_server_set_ttl (lcc_server_t *srv, uint8_t ttl) /* {{{ */
   if (srv == NULL)
     return (EINVAL);
 
+  pthread_mutex_lock (&srv->net->lock);
   srv->ttl = (int) ttl;
+  pthread_mutex_unlock (&srv->net->lock);
 
   return (0);
 } /* }}} int lcc_server_set_ttl */
 
-int lcc_server_set_interface (lcc_server_t *srv, char const *interface) /* {{{ */
+static int server_set_interface (lcc_server_t *srv, /* {{{ */
+    char const *interface)
 {
   unsigned int if_index;
   int status;
@@ -461,28 +811,157 @@ int lcc_server_set_interface (lcc_server_t *srv, char const *interface) /* {{{ *
 #endif
 
   return (0);
+} /* }}} int server_set_interface */
+
+int lcc_server_set_interface (lcc_server_t *srv, char const *interface) /* {{{ */
+{
+  int status;
+
+  if ((srv == NULL) || (interface == NULL))
+    return (EINVAL);
+
+  pthread_mutex_lock (&srv->net->lock);
+  status = server_set_interface (srv, interface);
+  pthread_mutex_unlock (&srv->net->lock);
+
+  return (status);
 } /* }}} int lcc_server_set_interface */
 
 int lcc_server_set_security_level (lcc_server_t *srv, /* {{{ */
     lcc_security_level_t level,
     const char *username, const char *password)
 {
-  return (lcc_network_buffer_set_security_level (srv->buffer,
-        level, username, password));
+  int status;
+
+  if (srv == NULL)
+    return (EINVAL);
+
+  /* Changes the size of the security headers. */
+  pthread_mutex_lock (&srv->net->lock);
+  network_reset (srv->net);
+  status = lcc_network_buffer_set_security_level (srv->buffer,
+        level, username, password);
+  pthread_mutex_unlock (&srv->net->lock);
+
+  return (status);
 } /* }}} int lcc_server_set_security_level */
 
+int lcc_server_set_compression (lcc_server_t *srv, int compress) /* {{{ */
+{
+  int status;
+
+  if (srv == NULL)
+    return (EINVAL);
+
+  pthread_mutex_lock (&srv->net->lock);
+  status = lcc_network_buffer_set_compression (srv->buffer, compress);
+  pthread_mutex_unlock (&srv->net->lock);
+
+  return (status);
+} /* }}} int lcc_server_set_compression */
+
+int lcc_server_set_dictionary (lcc_server_t *srv, /* {{{ */
+    int enable, int refresh)
+{
+  int status;
+
+  if (srv == NULL)
+    return (EINVAL);
+
+  /* Moves the server from the shared buffer to its own or back. */
+  pthread_mutex_lock (&srv->net->lock);
+  network_reset (srv->net);
+  status = lcc_network_buffer_set_dictionary (srv->buffer, enable, refresh);
+  if (status == 0)
+    srv->dictionary = enable ? 1 : 0;
+  pthread_mutex_unlock (&srv->net->lock);
+
+  return (status);
+} /* }}} int lcc_server_set_dictionary */
+
 int lcc_network_values_send (lcc_network_t *net, /* {{{ */
     const lcc_value_list_t *vl)
 {
-  lcc_server_t *srv;
+  int status;
 
   if ((net == NULL) || (vl == NULL))
     return (EINVAL);
 
-  for (srv = net->servers; srv != NULL; srv = srv->next)
-    server_value_add (srv, vl);
+  pthread_mutex_lock (&net->lock);
+  status = network_value_add (net, vl);
+  network_queues_send (net);
+  pthread_mutex_unlock (&net->lock);
 
-  return (0);
+  return (status);
 } /* }}} int lcc_network_values_send */
 
+int lcc_network_values_send_bulk (lcc_network_t *net, /* {{{ */
+    const lcc_value_list_t *vls, size_t vls_num)
+{
+  size_t i;
+  int status = 0;
+
+  if ((net == NULL) || ((vls == NULL) && (vls_num > 0)))
+    return (EINVAL);
+
+  /* Full packets are queued and sent LCC_NETWORK_QUEUE_MAX at a time. */
+  pthread_mutex_lock (&net->lock);
+  for (i = 0; i < vls_num; i++)
+  {
+    status = network_value_add (net, vls + i);
+    if (status != 0)
+      break;
+  }
+  network_queues_send (net);
+  pthread_mutex_unlock (&net->lock);
+
+  return (status);
+} /* }}} int lcc_network_values_send_bulk */
+
+int lcc_network_flush (lcc_network_t *net) /* {{{ */
+{
+  if (net == NULL)
+    return (EINVAL);
+
+  pthread_mutex_lock (&net->lock);
+  network_flush (net);
+  pthread_mutex_unlock (&net->lock);
+
+  return (0);
+} /* }}} int lcc_network_flush */
+
+int lcc_network_set_linger (lcc_network_t *net, double linger) /* {{{ */
+{
+  int status;
+
+  if ((net == NULL) || (linger < 0.0))
+    return (EINVAL);
+
+  if (linger == 0.0)
+  {
+    network_flush_thread_stop (net);
+    pthread_mutex_lock (&net->lock);
+    net->linger = 0.0;
+    pthread_mutex_unlock (&net->lock);
+    return (0);
+  }
+
+  pthread_mutex_lock (&net->lock);
+  net->linger = linger;
+  if (net->flush_thread_running)
+  {
+    pthread_cond_signal (&net->flush_cond);
+    pthread_mutex_unlock (&net->lock);
+    return (0);
+  }
+
+  status = pthread_create (&net->flush_thread, /* attr = */ NULL,
+      network_flush_thread, net);
+  if (status == 0)
+    net->flush_thread_running = 1;
+  pthread_mutex_unlock (&net->lock);
+
+  return (status);
+} /* }}} int lcc_network_set_linger */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
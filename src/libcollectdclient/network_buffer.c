@@ -31,6 +31,8 @@
 #include <math.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <arpa/inet.h> /* htons */
 
 #include <pthread.h>
@@ -59,6 +61,10 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 # endif
 #endif
 
+#if HAVE_LIBLZ4
+# include <lz4.h>
+#endif
+
 #include "collectd/network_buffer.h"
 
 #define TYPE_HOST            0x0000
@@ -71,6 +77,9 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #define TYPE_VALUES          0x0006
 #define TYPE_INTERVAL        0x0007
 #define TYPE_INTERVAL_HR     0x0009
+#define TYPE_SESSION         0x0020
+#define TYPE_ID_DEFINE       0x0021
+#define TYPE_ID_VALUES       0x0022
 
 /* Types to transmit notifications */
 #define TYPE_MESSAGE         0x0100
@@ -78,9 +87,16 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 
 #define TYPE_SIGN_SHA256     0x0200
 #define TYPE_ENCR_AES256     0x0210
+#define TYPE_COMPR_LZ4       0x0220
 
 #define PART_SIGNATURE_SHA256_SIZE 36
 #define PART_ENCRYPTION_AES256_SIZE 42
+#define PART_COMPRESSION_LZ4_SIZE 6
+
+/* Identifier dictionary, see lcc_network_buffer_set_dictionary(). */
+#define DICT_MAX_ENTRIES 65536
+#define DICT_EXPIRE 900
+#define DICT_REFRESH_DEFAULT 60
 
 #define ADD_GENERIC(nb,srcptr,size) do {         \
   assert ((size) <= (nb)->free);                 \
@@ -95,6 +111,17 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 /*
  * Data types
  */
+struct nb_dict_entry_s
+{
+  lcc_identifier_t identifier;
+  uint32_t hash;
+  uint32_t dict_id;
+  time_t defined;
+  time_t used;
+  struct nb_dict_entry_s *next;
+};
+typedef struct nb_dict_entry_s nb_dict_entry_t;
+
 struct lcc_network_buffer_s
 {
   char *buffer;
@@ -108,6 +135,21 @@ struct lcc_network_buffer_s
   char *username;
   char *password;
 
+  int compress;
+  /* Offset of the first data part, i.e. size of the security headers. */
+  size_t payload_offset;
+
+  int dict_enabled;
+  int dict_refresh;
+  uint64_t dict_session;
+  /* Set once the session part has been added to the current packet. */
+  int dict_session_sent;
+  uint32_t dict_next_id;
+  nb_dict_entry_t **dict_table;
+  size_t dict_table_size;
+  size_t dict_num;
+  time_t dict_last_purge;
+
 #if HAVE_LIBGCRYPT
   gcry_cipher_hd_t encr_cypher;
   size_t encr_header_len;
@@ -258,32 +300,20 @@ static double htond (double val) /* {{{ */
   }
 } /* }}} double htond */
 
-static int nb_add_values (char **ret_buffer, /* {{{ */
-    size_t *ret_buffer_len,
+/* Writes the number of values, their types and the values themselves to
+ * "buffer", which must have room for NB_VALUES_BODY_SIZE (vl->values_len)
+ * bytes. This is the payload of TYPE_VALUES and TYPE_ID_VALUES parts. */
+#define NB_VALUES_BODY_SIZE(n) (sizeof (uint16_t) \
+    + (n) * (sizeof (uint8_t) + sizeof (value_t)))
+static int nb_write_values_body (char *buffer, /* {{{ */
     const lcc_value_list_t *vl)
 {
-  char *packet_ptr;
-  size_t packet_len;
-
-  uint16_t      pkg_type;
-  uint16_t      pkg_length;
   uint16_t      pkg_num_values;
   uint8_t       pkg_values_types[vl->values_len];
   value_t       pkg_values[vl->values_len];
 
-  size_t offset;
   size_t i;
 
-  packet_len = sizeof (pkg_type) + sizeof (pkg_length)
-    + sizeof (pkg_num_values)
-    + sizeof (pkg_values_types)
-    + sizeof (pkg_values);
-
-  if (*ret_buffer_len < packet_len)
-    return (ENOMEM);
-
-  pkg_type = htons (TYPE_VALUES);
-  pkg_length = htons ((uint16_t) packet_len);
   pkg_num_values = htons ((uint16_t) vl->values_len);
 
   for (i = 0; i < vl->values_len; i++)
@@ -317,25 +347,149 @@ static int nb_add_values (char **ret_buffer, /* {{{ */
    * may be unaligned and some architectures, such as SPARC, can't handle
    * that.
    */
+  memcpy (buffer, &pkg_num_values, sizeof (pkg_num_values));
+  buffer += sizeof (pkg_num_values);
+  memcpy (buffer, pkg_values_types, sizeof (pkg_values_types));
+  buffer += sizeof (pkg_values_types);
+  memcpy (buffer, pkg_values, sizeof (pkg_values));
+
+  return (0);
+} /* }}} int nb_write_values_body */
+
+static int nb_add_values (char **ret_buffer, /* {{{ */
+    size_t *ret_buffer_len,
+    const lcc_value_list_t *vl)
+{
+  char *packet_ptr;
+  size_t packet_len;
+
+  uint16_t      pkg_type;
+  uint16_t      pkg_length;
+
+  packet_len = sizeof (pkg_type) + sizeof (pkg_length)
+    + NB_VALUES_BODY_SIZE (vl->values_len);
+
+  if (*ret_buffer_len < packet_len)
+    return (ENOMEM);
+
   packet_ptr = *ret_buffer;
+  if (nb_write_values_body (packet_ptr + sizeof (pkg_type)
+        + sizeof (pkg_length), vl) != 0)
+    return (EINVAL);
+
+  pkg_type = htons (TYPE_VALUES);
+  pkg_length = htons ((uint16_t) packet_len);
+  memcpy (packet_ptr, &pkg_type, sizeof (pkg_type));
+  memcpy (packet_ptr + sizeof (pkg_type), &pkg_length, sizeof (pkg_length));
+
+  *ret_buffer = packet_ptr + packet_len;
+  *ret_buffer_len -= packet_len;
+  return (0);
+} /* }}} int nb_add_values */
+
+/* The values of the identifier "dict_id", at the time of the packet plus
+ * "time_delta". */
+static int nb_add_id_values (char **ret_buffer, /* {{{ */
+    size_t *ret_buffer_len,
+    uint32_t dict_id, int32_t time_delta,
+    const lcc_value_list_t *vl)
+{
+  char *packet_ptr;
+  size_t packet_len;
+
+  uint16_t pkg_type;
+  uint16_t pkg_length;
+  uint32_t pkg_id;
+  uint32_t pkg_delta;
+
+  size_t offset;
+
+  packet_len = sizeof (pkg_type) + sizeof (pkg_length)
+    + sizeof (pkg_id) + sizeof (pkg_delta)
+    + NB_VALUES_BODY_SIZE (vl->values_len);
+
+  if (*ret_buffer_len < packet_len)
+    return (ENOMEM);
+
+  packet_ptr = *ret_buffer;
+  if (nb_write_values_body (packet_ptr + packet_len
+        - NB_VALUES_BODY_SIZE (vl->values_len), vl) != 0)
+    return (EINVAL);
+
+  pkg_type = htons (TYPE_ID_VALUES);
+  pkg_length = htons ((uint16_t) packet_len);
+  pkg_id = htonl (dict_id);
+  pkg_delta = htonl ((uint32_t) time_delta);
+
   offset = 0;
   memcpy (packet_ptr + offset, &pkg_type, sizeof (pkg_type));
   offset += sizeof (pkg_type);
   memcpy (packet_ptr + offset, &pkg_length, sizeof (pkg_length));
   offset += sizeof (pkg_length);
-  memcpy (packet_ptr + offset, &pkg_num_values, sizeof (pkg_num_values));
-  offset += sizeof (pkg_num_values);
-  memcpy (packet_ptr + offset, pkg_values_types, sizeof (pkg_values_types));
-  offset += sizeof (pkg_values_types);
-  memcpy (packet_ptr + offset, pkg_values, sizeof (pkg_values));
-  offset += sizeof (pkg_values);
+  memcpy (packet_ptr + offset, &pkg_id, sizeof (pkg_id));
+  offset += sizeof (pkg_id);
+  memcpy (packet_ptr + offset, &pkg_delta, sizeof (pkg_delta));
+
+  *ret_buffer = packet_ptr + packet_len;
+  *ret_buffer_len -= packet_len;
+  return (0);
+} /* }}} int nb_add_id_values */
+
+/* Defines "dict_id" as "ident": the id followed by the five identifier
+ * fields, each terminated by a null byte. */
+static int nb_add_id_define (char **ret_buffer, /* {{{ */
+    size_t *ret_buffer_len,
+    uint32_t dict_id, const lcc_identifier_t *ident)
+{
+  const char *fields[] = { ident->host, ident->plugin, ident->plugin_instance,
+    ident->type, ident->type_instance };
+  size_t lengths[5];
+  char *packet_ptr;
+  size_t packet_len;
+
+  uint16_t pkg_type;
+  uint16_t pkg_length;
+  uint32_t pkg_id;
+
+  size_t offset;
+  size_t i;
+
+  packet_len = sizeof (pkg_type) + sizeof (pkg_length) + sizeof (pkg_id);
+  for (i = 0; i < 5; i++)
+  {
+    lengths[i] = strlen (fields[i]);
+    packet_len += lengths[i] + 1;
+  }
+
+  if (*ret_buffer_len < packet_len)
+    return (ENOMEM);
+
+  pkg_type = htons (TYPE_ID_DEFINE);
+  pkg_length = htons ((uint16_t) packet_len);
+  pkg_id = htonl (dict_id);
+
+  packet_ptr = *ret_buffer;
+  offset = 0;
+  memcpy (packet_ptr + offset, &pkg_type, sizeof (pkg_type));
+  offset += sizeof (pkg_type);
+  memcpy (packet_ptr + offset, &pkg_length, sizeof (pkg_length));
+  offset += sizeof (pkg_length);
+  memcpy (packet_ptr + offset, &pkg_id, sizeof (pkg_id));
+  offset += sizeof (pkg_id);
+  for (i = 0; i < 5; i++)
+  {
+    memcpy (packet_ptr + offset, fields[i], lengths[i]);
+    offset += lengths[i];
+    memset (packet_ptr + offset, 0, 1);
+    offset += 1;
+  }
 
   assert (offset == packet_len);
 
   *ret_buffer = packet_ptr + packet_len;
   *ret_buffer_len -= packet_len;
   return (0);
-} /* }}} int nb_add_values */
+} /* }}} int nb_add_id_define */
 
 static int nb_add_number (char **ret_buffer, /* {{{ */
     size_t *ret_buffer_len,
@@ -425,6 +579,215 @@ static int nb_add_string (char **ret_buffer, /* {{{ */
   return (0);
 } /* }}} int nb_add_string */
 
+static uint32_t nb_dict_hash (const lcc_identifier_t *ident) /* {{{ */
+{
+  const char *fields[] = { ident->host, ident->plugin, ident->plugin_instance,
+    ident->type, ident->type_instance };
+  uint32_t hash = 5381;
+  size_t i;
+
+  for (i = 0; i < 5; i++)
+  {
+    const unsigned char *ptr;
+
+    for (ptr = (const unsigned char *) fields[i]; *ptr != 0; ptr++)
+      hash = (hash * 33) ^ *ptr;
+    hash = (hash * 33) ^ '/';
+  }
+
+  return (hash);
+} /* }}} uint32_t nb_dict_hash */
+
+static void nb_dict_clear (lcc_network_buffer_t *nb) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < nb->dict_table_size; i++)
+  {
+    while (nb->dict_table[i] != NULL)
+    {
+      nb_dict_entry_t *next = nb->dict_table[i]->next;
+      free (nb->dict_table[i]);
+      nb->dict_table[i] = next;
+    }
+  }
+  free (nb->dict_table);
+  nb->dict_table = NULL;
+  nb->dict_table_size = 0;
+  nb->dict_num = 0;
+} /* }}} void nb_dict_clear */
+
+/* Doubles the size of the hash table. */
+static int nb_dict_grow (lcc_network_buffer_t *nb) /* {{{ */
+{
+  nb_dict_entry_t **table;
+  size_t table_size;
+  size_t i;
+
+  table_size = (nb->dict_table_size == 0) ? 64 : 2 * nb->dict_table_size;
+  table = calloc (table_size, sizeof (*table));
+  if (table == NULL)
+    return (ENOMEM);
+
+  for (i = 0; i < nb->dict_table_size; i++)
+  {
+    while (nb->dict_table[i] != NULL)
+    {
+      nb_dict_entry_t *e = nb->dict_table[i];
+      size_t slot = e->hash & (table_size - 1);
+
+      nb->dict_table[i] = e->next;
+      e->next = table[slot];
+      table[slot] = e;
+    }
+  }
+
+  free (nb->dict_table);
+  nb->dict_table = table;
+  nb->dict_table_size = table_size;
+  return (0);
+} /* }}} int nb_dict_grow */
+
+/* Returns the dictionary entry of "ident", creating it if necessary. Returns
+ * NULL if the dictionary is full. */
+static nb_dict_entry_t *nb_dict_get (lcc_network_buffer_t *nb, /* {{{ */
+    const lcc_identifier_t *ident)
+{
+  nb_dict_entry_t *e;
+  uint32_t hash;
+  size_t slot;
+
+  hash = nb_dict_hash (ident);
+
+  if (nb->dict_table != NULL)
+  {
+    slot = hash & (nb->dict_table_size - 1);
+    for (e = nb->dict_table[slot]; e != NULL; e = e->next)
+      if ((e->hash == hash)
+          && (strcmp (e->identifier.host, ident->host) == 0)
+          && (strcmp (e->identifier.plugin, ident->plugin) == 0)
+          && (strcmp (e->identifier.plugin_instance,
+              ident->plugin_instance) == 0)
+          && (strcmp (e->identifier.type, ident->type) == 0)
+          && (strcmp (e->identifier.type_instance,
+              ident->type_instance) == 0))
+        return (e);
+  }
+
+  if (nb->dict_num >= DICT_MAX_ENTRIES)
+    return (NULL);
+
+  if ((nb->dict_num >= nb->dict_table_size) && (nb_dict_grow (nb) != 0))
+    return (NULL);
+
+  e = calloc (1, sizeof (*e));
+  if (e == NULL)
+    return (NULL);
+
+  memcpy (&e->identifier, ident, sizeof (e->identifier));
+  e->hash = hash;
+  e->dict_id = nb->dict_next_id++;
+
+  slot = hash & (nb->dict_table_size - 1);
+  e->next = nb->dict_table[slot];
+  nb->dict_table[slot] = e;
+  nb->dict_num++;
+
+  return (e);
+} /* }}} nb_dict_entry_t *nb_dict_get */
+
+/* Removes the identifiers which haven't been added for DICT_EXPIRE seconds. */
+static void nb_dict_purge (lcc_network_buffer_t *nb, time_t now) /* {{{ */
+{
+  size_t i;
+
+  if ((nb->dict_last_purge + DICT_EXPIRE) > now)
+    return;
+  nb->dict_last_purge = now;
+
+  for (i = 0; i < nb->dict_table_size; i++)
+  {
+    nb_dict_entry_t **prev = &nb->dict_table[i];
+
+    while (*prev != NULL)
+    {
+      nb_dict_entry_t *e = *prev;
+
+      if ((e->used + DICT_EXPIRE) > now)
+      {
+        prev = &e->next;
+        continue;
+      }
+
+      *prev = e->next;
+      free (e);
+      nb->dict_num--;
+    }
+  }
+} /* }}} void nb_dict_purge */
+
+/* Like nb_add_value_list(), but sends the dictionary id of the identifier.
+ * The receiver clears the identifier after a TYPE_ID_VALUES part, so the
+ * identifier state is cleared here too. */
+static int nb_add_value_list_id (lcc_network_buffer_t *nb, /* {{{ */
+    nb_dict_entry_t *e, const lcc_value_list_t *vl, time_t now)
+{
+  char *buffer = nb->ptr;
+  size_t buffer_size = nb->free;
+  /* Convert to collectd's "cdtime" representation, like nb_add_time(). */
+  int64_t time_new = (int64_t) (uint64_t) (vl->time * 1073741824.0);
+  int64_t time_old = (int64_t) (uint64_t) (nb->state.time * 1073741824.0);
+  int64_t time_delta = 0;
+  int define;
+  int write_time = 0;
+
+  if (!nb->dict_session_sent
+      && (nb_add_number (&buffer, &buffer_size, TYPE_SESSION,
+          nb->dict_session) != 0))
+    return (-1);
+
+  define = (e->defined == 0) || ((e->defined + nb->dict_refresh) <= now);
+  if (define && (nb_add_id_define (&buffer, &buffer_size, e->dict_id,
+          &vl->identifier) != 0))
+    return (-1);
+
+  /* A time of zero tells the receiver to use its own clock, so it can't be
+   * sent as a delta. */
+  if (time_new != time_old)
+  {
+    time_delta = time_new - time_old;
+    write_time = (time_new == 0) || (time_old == 0)
+      || (time_delta < INT32_MIN) || (time_delta > INT32_MAX);
+  }
+  if (write_time)
+  {
+    if (nb_add_time (&buffer, &buffer_size, TYPE_TIME_HR, vl->time))
+      return (-1);
+    time_delta = 0;
+  }
+
+  if ((nb->state.interval != vl->interval)
+      && (nb_add_time (&buffer, &buffer_size, TYPE_INTERVAL_HR,
+          vl->interval)))
+    return (-1);
+
+  if (nb_add_id_values (&buffer, &buffer_size, e->dict_id,
+        (int32_t) time_delta, vl) != 0)
+    return (-1);
+
+  nb->dict_session_sent = 1;
+  if (define)
+    e->defined = now;
+  if (write_time)
+    nb->state.time = vl->time;
+  nb->state.interval = vl->interval;
+  memset (&nb->state.identifier, 0, sizeof (nb->state.identifier));
+
+  nb->ptr = buffer;
+  nb->free = buffer_size;
+  return (0);
+} /* }}} int nb_add_value_list_id */
+
 static int nb_add_value_list (lcc_network_buffer_t *nb, /* {{{ */
     const lcc_value_list_t *vl)
 {
@@ -635,6 +998,49 @@ static int nb_add_encryption (lcc_network_buffer_t *nb) /* {{{ */
 } /* }}} int nb_add_encryption */
 #endif
 
+#if HAVE_LIBLZ4
+/* Replaces the data parts with one LZ4 compressed part, if that makes the
+ * packet smaller. */
+static int nb_add_compression (lcc_network_buffer_t *nb) /* {{{ */
+{
+  char *payload = nb->buffer + nb->payload_offset;
+  size_t payload_size;
+  uint16_t pkg_type = htons (TYPE_COMPR_LZ4);
+  uint16_t pkg_length;
+  uint16_t pkg_orig_length;
+  int compressed_size;
+
+  assert ((nb->payload_offset + nb->free) <= nb->size);
+  payload_size = nb->size - (nb->payload_offset + nb->free);
+  if (payload_size <= PART_COMPRESSION_LZ4_SIZE)
+    return (0);
+
+  {
+    char compressed[payload_size];
+
+    /* Only accept output that is smaller than the input, header included. */
+    compressed_size = LZ4_compress_default (payload, compressed,
+        (int) payload_size, (int) (payload_size - PART_COMPRESSION_LZ4_SIZE - 1));
+    if (compressed_size <= 0)
+      return (0);
+
+    memcpy (payload + PART_COMPRESSION_LZ4_SIZE, compressed,
+        (size_t) compressed_size);
+  }
+
+  pkg_length = htons ((uint16_t) (PART_COMPRESSION_LZ4_SIZE + compressed_size));
+  pkg_orig_length = htons ((uint16_t) payload_size);
+  memcpy (payload, &pkg_type, sizeof (pkg_type));
+  memcpy (payload + 2, &pkg_length, sizeof (pkg_length));
+  memcpy (payload + 4, &pkg_orig_length, sizeof (pkg_orig_length));
+
+  nb->ptr = payload + PART_COMPRESSION_LZ4_SIZE + compressed_size;
+  nb->free = nb->size - (nb->ptr - nb->buffer);
+
+  return (0);
+} /* }}} int nb_add_compression */
+#endif
+
 /*
  * Public functions
  */
@@ -678,6 +1084,13 @@ void lcc_network_buffer_destroy (lcc_network_buffer_t *nb) /* {{{ */
   if (nb == NULL)
     return;
 
+  nb_dict_clear (nb);
+#if HAVE_LIBGCRYPT
+  if (nb->encr_cypher != NULL)
+    gcry_cipher_close (nb->encr_cypher);
+#endif
+  free (nb->username);
+  free (nb->password);
   free (nb->buffer);
   free (nb);
 } /* }}} void lcc_network_buffer_destroy */
@@ -722,6 +1135,50 @@ int lcc_network_buffer_set_security_level (lcc_network_buffer_t *nb, /* {{{ */
   return (0);
 } /* }}} int lcc_network_buffer_set_security_level */
 
+int lcc_network_buffer_set_compression (lcc_network_buffer_t *nb, /* {{{ */
+    int compress)
+{
+  if (nb == NULL)
+    return (EINVAL);
+
+#if HAVE_LIBLZ4
+  nb->compress = compress ? 1 : 0;
+  return (0);
+#else
+  if (!compress)
+    return (0);
+  return (ENOTSUP);
+#endif
+} /* }}} int lcc_network_buffer_set_compression */
+
+int lcc_network_buffer_set_dictionary (lcc_network_buffer_t *nb, /* {{{ */
+    int enable, int refresh)
+{
+  if ((nb == NULL) || (refresh < 0))
+    return (EINVAL);
+
+  if (!enable)
+  {
+    nb->dict_enabled = 0;
+    nb_dict_clear (nb);
+    return (0);
+  }
+
+  if (!nb->dict_enabled)
+  {
+    /* The session tells the receivers which dictionary the ids belong to.
+     * The ids of a new buffer start at zero, so it needs its own session. */
+    nb->dict_session = (((uint64_t) time (NULL)) << 32)
+      ^ (((uint64_t) getpid ()) << 16)
+      ^ (uint64_t) (uintptr_t) nb;
+    nb->dict_next_id = 0;
+    nb->dict_last_purge = time (NULL);
+  }
+  nb->dict_enabled = 1;
+  nb->dict_refresh = (refresh == 0) ? DICT_REFRESH_DEFAULT : refresh;
+  return (0);
+} /* }}} int lcc_network_buffer_set_dictionary */
+
 int lcc_network_buffer_initialize (lcc_network_buffer_t *nb) /* {{{ */
 {
   if (nb == NULL)
@@ -731,6 +1188,7 @@ int lcc_network_buffer_initialize (lcc_network_buffer_t *nb) /* {{{ */
   memset (&nb->state, 0, sizeof (nb->state));
   nb->ptr = nb->buffer;
   nb->free = nb->size;
+  nb->dict_session_sent = 0;
 
 #if HAVE_LIBGCRYPT
   if (nb->seclevel == SIGN)
@@ -780,6 +1238,8 @@ int lcc_network_buffer_initialize (lcc_network_buffer_t *nb) /* {{{ */
   }
 #endif
 
+  nb->payload_offset = nb->size - nb->free;
+
   return (0);
 } /* }}} int lcc_network_buffer_initialize */
 
@@ -788,6 +1248,11 @@ int lcc_network_buffer_finalize (lcc_network_buffer_t *nb) /* {{{ */
   if (nb == NULL)
     return (EINVAL);
 
+#if HAVE_LIBLZ4
+  if (nb->compress)
+    nb_add_compression (nb);
+#endif
+
 #if HAVE_LIBGCRYPT
   if (nb->seclevel == SIGN)
     return nb_add_signature (nb);
@@ -806,10 +1271,49 @@ int lcc_network_buffer_add_value (lcc_network_buffer_t *nb, /* {{{ */
   if ((nb == NULL) || (vl == NULL))
     return (EINVAL);
 
+  if (nb->dict_enabled)
+  {
+    time_t now = time (NULL);
+    nb_dict_entry_t *e;
+
+    nb_dict_purge (nb, now);
+    /* Identifiers which don't fit into the dictionary are sent in full. */
+    e = nb_dict_get (nb, &vl->identifier);
+    if (e != NULL)
+    {
+      e->used = now;
+      return (nb_add_value_list_id (nb, e, vl, now));
+    }
+  }
+
   status = nb_add_value_list (nb, vl);
   return (status);
 } /* }}} int lcc_network_buffer_add_value */
 
+size_t lcc_network_buffer_payload_size (lcc_network_buffer_t *nb) /* {{{ */
+{
+  if (nb == NULL)
+    return (0);
+
+  assert (nb->size >= nb->payload_offset);
+  return (nb->size - nb->payload_offset);
+} /* }}} size_t lcc_network_buffer_payload_size */
+
+int lcc_network_buffer_add_payload (lcc_network_buffer_t *nb, /* {{{ */
+    const void *payload, size_t payload_size)
+{
+  if ((nb == NULL) || ((payload == NULL) && (payload_size > 0)))
+    return (EINVAL);
+
+  if (payload_size > nb->free)
+    return (ENOMEM);
+
+  ADD_GENERIC (nb, payload, payload_size);
+  /* The parts may have changed any field of the state. */
+  memset (&nb->state, 0, sizeof (nb->state));
+  return (0);
+} /* }}} int lcc_network_buffer_add_payload */
+
 int lcc_network_buffer_get (lcc_network_buffer_t *nb, /* {{{ */
     void *buffer, size_t *buffer_size)
 {
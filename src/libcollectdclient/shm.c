@@ -0,0 +1,288 @@
+/**
+ * libcollectdclient - src/libcollectdclient/shm.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "collectd/shm.h"
+
+/* The layout must match src/daemon/utils_cache_shm.h. */
+#define SHM_MAGIC "CDSHMVC"
+#define SHM_VERSION 1
+#define SHM_VALUES_MAX 16
+#define SHM_NAME_SIZE 256
+
+#define SHM_SLOT_EMPTY 0
+#define SHM_SLOT_USED  1
+
+/* Give up if a slot is changed this many times while reading it. */
+#define SHM_READ_RETRIES 1000
+
+#define SHM_BARRIER() __sync_synchronize ()
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+struct shm_header_s
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t slots_num;
+  uint32_t slot_size;
+  uint32_t values_max;
+  uint32_t name_size;
+  volatile uint32_t active;
+  uint64_t created;
+  uint8_t reserved[24];
+};
+typedef struct shm_header_s shm_header_t;
+
+struct shm_slot_s
+{
+  volatile uint32_t seq;
+  uint32_t state;
+  uint32_t hash;
+  uint32_t values_num;
+  uint64_t time;
+  uint64_t interval;
+  double values[SHM_VALUES_MAX];
+  char name[SHM_NAME_SIZE];
+};
+typedef struct shm_slot_s shm_slot_t;
+
+struct lcc_shm_s
+{
+  void *map;
+  size_t map_size;
+  shm_header_t const *header;
+  shm_slot_t const *slots;
+  size_t slots_num;
+};
+
+/* Same as identifier_hash_name() in src/daemon/utils_intern.c. */
+static uint32_t shm_hash (char const *str) /* {{{ */
+{
+  unsigned char const *ptr;
+  uint32_t hash = FNV_OFFSET_BASIS;
+
+  for (ptr = (unsigned char const *) str; *ptr != 0; ptr++)
+  {
+    hash ^= (uint32_t) *ptr;
+    hash *= FNV_PRIME;
+  }
+
+  return (hash);
+} /* }}} uint32_t shm_hash */
+
+/* Result of looking at one slot. */
+struct shm_read_s
+{
+  uint32_t state;
+  int match;
+  uint32_t values_num;
+  uint64_t time;
+  uint64_t interval;
+  double values[SHM_VALUES_MAX];
+};
+typedef struct shm_read_s shm_read_t;
+
+/* Reads "slot" consistently, see the sequence lock in
+ * src/daemon/utils_cache_shm.c. Only the values of a matching slot are
+ * copied, which keeps the window in which the daemon may interfere short. */
+static int shm_slot_read (shm_slot_t const *slot, /* {{{ */
+    char const *name, uint32_t hash, shm_read_t *ret)
+{
+  int i;
+
+  for (i = 0; i < SHM_READ_RETRIES; i++)
+  {
+    uint32_t seq = slot->seq;
+
+    if ((seq & 1) != 0)
+      continue;
+    SHM_BARRIER ();
+
+    ret->state = slot->state;
+    ret->match = (ret->state == SHM_SLOT_USED) && (slot->hash == hash)
+      && (strncmp (slot->name, name, sizeof (slot->name)) == 0);
+    if (ret->match)
+    {
+      ret->values_num = slot->values_num;
+      ret->time = slot->time;
+      ret->interval = slot->interval;
+      if (ret->values_num <= SHM_VALUES_MAX)
+        memcpy (ret->values, slot->values,
+            ret->values_num * sizeof (ret->values[0]));
+    }
+
+    SHM_BARRIER ();
+    if (slot->seq == seq)
+      return (0);
+  }
+
+  return (EAGAIN);
+} /* }}} int shm_slot_read */
+
+int lcc_shm_open (const char *file, lcc_shm_t **ret_shm) /* {{{ */
+{
+  lcc_shm_t *shm;
+  shm_header_t const *header;
+  struct stat statbuf;
+  void *map;
+  int fd;
+
+  if ((file == NULL) || (ret_shm == NULL))
+    return (EINVAL);
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+    return (errno);
+
+  if (fstat (fd, &statbuf) != 0)
+  {
+    int status = errno;
+    close (fd);
+    return (status);
+  }
+
+  if ((size_t) statbuf.st_size < sizeof (*header))
+  {
+    close (fd);
+    return (EINVAL);
+  }
+
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return (errno);
+
+  header = map;
+  if ((memcmp (header->magic, SHM_MAGIC, sizeof (SHM_MAGIC)) != 0)
+      || (header->version != SHM_VERSION)
+      || (header->slot_size != sizeof (shm_slot_t))
+      || (header->values_max != SHM_VALUES_MAX)
+      || (header->name_size != SHM_NAME_SIZE)
+      || (header->slots_num == 0)
+      || ((header->slots_num & (header->slots_num - 1)) != 0)
+      || (((size_t) statbuf.st_size - sizeof (*header)) / sizeof (shm_slot_t)
+        < header->slots_num))
+  {
+    munmap (map, (size_t) statbuf.st_size);
+    return (EINVAL);
+  }
+
+  shm = calloc (1, sizeof (*shm));
+  if (shm == NULL)
+  {
+    munmap (map, (size_t) statbuf.st_size);
+    return (ENOMEM);
+  }
+  shm->map = map;
+  shm->map_size = (size_t) statbuf.st_size;
+  shm->header = header;
+  shm->slots = (shm_slot_t const *) (header + 1);
+  shm->slots_num = (size_t) header->slots_num;
+
+  *ret_shm = shm;
+  return (0);
+} /* }}} int lcc_shm_open */
+
+void lcc_shm_close (lcc_shm_t *shm) /* {{{ */
+{
+  if (shm == NULL)
+    return;
+
+  munmap (shm->map, shm->map_size);
+  free (shm);
+} /* }}} void lcc_shm_close */
+
+int lcc_shm_getval (lcc_shm_t *shm, const lcc_identifier_t *ident, /* {{{ */
+    gauge_t *values, size_t values_size, size_t *ret_values_num,
+    double *ret_time, double *ret_interval)
+{
+  char name[SHM_NAME_SIZE];
+  uint32_t hash;
+  size_t index;
+  size_t i;
+  int status;
+
+  if ((shm == NULL) || (ident == NULL))
+    return (EINVAL);
+
+  if (!shm->header->active)
+    return (ESTALE);
+
+  status = snprintf (name, sizeof (name), "%s/%s%s%s/%s%s%s", ident->host,
+      ident->plugin, (ident->plugin_instance[0] != 0) ? "-" : "",
+      ident->plugin_instance,
+      ident->type, (ident->type_instance[0] != 0) ? "-" : "",
+      ident->type_instance);
+  /* Longer identifiers are not published. */
+  if ((status < 0) || ((size_t) status >= sizeof (name)))
+    return (ENOENT);
+
+  hash = shm_hash (name);
+  index = hash & (shm->slots_num - 1);
+  for (i = 0; i < shm->slots_num; i++)
+  {
+    shm_read_t slot;
+
+    status = shm_slot_read (shm->slots + index, name, hash, &slot);
+    if (status != 0)
+      return (status);
+
+    if (slot.state == SHM_SLOT_EMPTY)
+      break;
+
+    if (slot.match)
+    {
+      if (ret_values_num != NULL)
+        *ret_values_num = (size_t) slot.values_num;
+      if (ret_time != NULL)
+        *ret_time = ((double) slot.time) / 1073741824.0;
+      if (ret_interval != NULL)
+        *ret_interval = ((double) slot.interval) / 1073741824.0;
+
+      if ((slot.values_num > SHM_VALUES_MAX)
+          || ((values != NULL) && (slot.values_num > values_size)))
+        return (ENOBUFS);
+      if (values != NULL)
+        memcpy (values, slot.values, slot.values_num * sizeof (*values));
+      return (0);
+    }
+
+    index = (index + 1) & (shm->slots_num - 1);
+  }
+
+  return (ENOENT);
+} /* }}} int lcc_shm_getval */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
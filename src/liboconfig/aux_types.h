@@ -5,6 +5,7 @@ struct statement_list_s
 {
 	oconfig_item_t *statement;
 	int             statement_num;
+	int             statement_alloc;
 };
 typedef struct statement_list_s statement_list_t;
 
@@ -32,6 +32,9 @@
 
 static char *unquote (const char *orig);
 static int yyerror (const char *s);
+static int argument_list_append (argument_list_t *al, oconfig_value_t *cv);
+static int statement_list_append (statement_list_t *sl, oconfig_item_t *ci);
+static void statement_list_shrink (statement_list_t *sl);
 
 /* Lexer variables */
 extern int yylineno;
@@ -94,15 +97,14 @@ argument_list:
 	argument_list argument
 	{
 	 $$ = $1;
-	 $$.argument_num++;
-	 $$.argument = realloc ($$.argument, $$.argument_num * sizeof (oconfig_value_t));
-	 $$.argument[$$.argument_num-1] = $2;
+	 if (argument_list_append (&$$, &$2) != 0)
+		YYABORT;
 	}
 	| argument
 	{
-	 $$.argument = malloc (sizeof (oconfig_value_t));
-	 $$.argument[0] = $1;
-	 $$.argument_num = 1;
+	 memset (&$$, '\0', sizeof ($$));
+	 if (argument_list_append (&$$, &$1) != 0)
+		YYABORT;
 	}
 	;
 
@@ -153,6 +155,7 @@ block:
 		exit (1);
 	 }
 	 free ($3); $3 = NULL;
+	 statement_list_shrink (&$2);
 	 $$ = $1;
 	 $$.children = $2.statement;
 	 $$.children_num = $2.statement_num;
@@ -175,7 +178,7 @@ block:
 statement:
 	option		{$$ = $1;}
 	| block		{$$ = $1;}
-	| EOL		{$$.values_num = 0;}
+	| EOL		{memset (&$$, '\0', sizeof ($$));}
 	;
 
 statement_list:
@@ -184,23 +187,17 @@ statement_list:
 	 $$ = $1;
 	 if (($2.values_num > 0) || ($2.children_num > 0))
 	 {
-		 $$.statement_num++;
-		 $$.statement = realloc ($$.statement, $$.statement_num * sizeof (oconfig_item_t));
-		 $$.statement[$$.statement_num-1] = $2;
+		 if (statement_list_append (&$$, &$2) != 0)
+			YYABORT;
 	 }
 	}
 	| statement
 	{
+	 memset (&$$, '\0', sizeof ($$));
 	 if (($1.values_num > 0) || ($1.children_num > 0))
 	 {
-		 $$.statement = malloc (sizeof (oconfig_item_t));
-		 $$.statement[0] = $1;
-		 $$.statement_num = 1;
-	 }
-	 else
-	 {
-	 	$$.statement = NULL;
-		$$.statement_num = 0;
+		 if (statement_list_append (&$$, &$1) != 0)
+			YYABORT;
 	 }
 	}
 	;
@@ -208,6 +205,7 @@ statement_list:
 entire_file:
 	statement_list
 	{
+	 statement_list_shrink (&$1);
 	 ci_root = calloc (1, sizeof (*ci_root));
 	 ci_root->children = $1.statement;
 	 ci_root->children_num = $1.statement_num;
@@ -235,32 +233,92 @@ static int yyerror (const char *s)
 	return (-1);
 } /* int yyerror */
 
+/* Returns a copy of "orig" without the surrounding quotes and with escaped
+ * characters resolved, e.g. "\"foo\\\"bar\"" becomes "foo\"bar". */
 static char *unquote (const char *orig)
 {
-	char *ret = strdup (orig);
-	int len;
-	int i;
+	size_t len = strlen (orig);
+	size_t i;
+	size_t j;
+	char *ret;
 
+	if ((len < 2) || (orig[0] != '"') || (orig[len - 1] != '"'))
+		return (strdup (orig));
+
+	ret = malloc (len - 1);
 	if (ret == NULL)
 		return (NULL);
 
-	len = strlen (ret);
+	j = 0;
+	for (i = 1; i < len - 1; i++)
+	{
+		if (orig[i] == '\\')
+		{
+			i++;
+			if (i >= len - 1)
+				break;
+		}
+		ret[j++] = orig[i];
+	}
+	ret[j] = '\0';
+
+	return (ret);
+} /* char *unquote */
+
+/* Argument lists are short and grow one at a time. */
+static int argument_list_append (argument_list_t *al, oconfig_value_t *cv)
+{
+	oconfig_value_t *tmp;
 
-	if ((len < 2) || (ret[0] != '"') || (ret[len - 1] != '"'))
-		return (ret);
+	tmp = realloc (al->argument, (al->argument_num + 1) * sizeof (*tmp));
+	if (tmp == NULL)
+	{
+		yyerror ("realloc failed");
+		return (-1);
+	}
+	al->argument = tmp;
 
-	len -= 2;
-	memmove (ret, ret + 1, len);
-	ret[len] = '\0';
+	al->argument[al->argument_num] = *cv;
+	al->argument_num++;
+	return (0);
+} /* int argument_list_append */
 
-	for (i = 0; i < len; i++)
+/* Statement lists grow by doubling, so that blocks with many children don't
+ * copy the array for every child. */
+static int statement_list_append (statement_list_t *sl, oconfig_item_t *ci)
+{
+	if (sl->statement_num >= sl->statement_alloc)
 	{
-		if (ret[i] == '\\')
+		int alloc = (sl->statement_alloc > 0) ? (2 * sl->statement_alloc) : 4;
+		oconfig_item_t *tmp;
+
+		tmp = realloc (sl->statement, alloc * sizeof (*tmp));
+		if (tmp == NULL)
 		{
-			memmove (ret + i, ret + (i + 1), len - i);
-			len--;
+			yyerror ("realloc failed");
+			return (-1);
 		}
+		sl->statement = tmp;
+		sl->statement_alloc = alloc;
 	}
 
-	return (ret);
-} /* char *unquote */
+	sl->statement[sl->statement_num] = *ci;
+	sl->statement_num++;
+	return (0);
+} /* int statement_list_append */
+
+/* Releases the unused part of the array once the list is complete. */
+static void statement_list_shrink (statement_list_t *sl)
+{
+	oconfig_item_t *tmp;
+
+	if ((sl->statement_num == 0) || (sl->statement_num == sl->statement_alloc))
+		return;
+
+	tmp = realloc (sl->statement, sl->statement_num * sizeof (*tmp));
+	if (tmp != NULL)
+	{
+		sl->statement = tmp;
+		sl->statement_alloc = sl->statement_num;
+	}
+} /* void statement_list_shrink */
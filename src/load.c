@@ -29,6 +29,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #include <unistd.h>
 
@@ -132,35 +133,29 @@ static int load_read (void)
 
 #elif defined(KERNEL_LINUX)
         gauge_t snum, mnum, lnum;
-	FILE *loadavg;
+	procfs_snapshot_t *loadavg;
+	size_t offset = 0;
 	char buffer[16];
 
 	char *fields[8];
 	int numfields;
 
-	if ((loadavg = fopen ("/proc/loadavg", "r")) == NULL)
+	if ((loadavg = procfs_snapshot_get ("/proc/loadavg")) == NULL)
 	{
 		char errbuf[1024];
-		WARNING ("load: fopen: %s",
+		WARNING ("load: Reading /proc/loadavg failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	if (fgets (buffer, 16, loadavg) == NULL)
+	if (procfs_getline (loadavg, &offset, buffer, sizeof (buffer)) == NULL)
 	{
-		char errbuf[1024];
-		WARNING ("load: fgets: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (loadavg);
+		WARNING ("load: /proc/loadavg is empty.");
+		procfs_snapshot_put (loadavg);
 		return (-1);
 	}
 
-	if (fclose (loadavg))
-	{
-		char errbuf[1024];
-		WARNING ("load: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	procfs_snapshot_put (loadavg);
 
 	numfields = strsplit (buffer, fields, 8);
 
@@ -44,6 +44,15 @@ static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static char *log_file = NULL;
 static int print_timestamp = 1;
+
+/* The log file is kept open. It is reopened when it has been moved or
+ * removed, e.g. by logrotate(8), which is checked at most once per
+ * LOGFILE_CHECK_INTERVAL. */
+#define LOGFILE_CHECK_INTERVAL TIME_T_TO_CDTIME_T (1)
+static FILE *log_fh = NULL;
+static dev_t log_dev;
+static ino_t log_ino;
+static cdtime_t log_check_time = 0;
 static int print_severity = 0;
 
 static const char *config_keys[] =
@@ -66,8 +75,14 @@ static int logfile_config (const char *key, const char *value)
 		}
 	}
 	else if (0 == strcasecmp (key, "File")) {
+		pthread_mutex_lock (&file_lock);
+		if (log_fh != NULL) {
+			fclose (log_fh);
+			log_fh = NULL;
+		}
 		sfree (log_file);
 		log_file = strdup (value);
+		pthread_mutex_unlock (&file_lock);
 	}
 	else if (0 == strcasecmp (key, "Timestamp")) {
 		if (IS_FALSE (value))
@@ -86,11 +101,51 @@ static int logfile_config (const char *key, const char *value)
 	return 0;
 } /* int logfile_config (const char *, const char *) */
 
+/* Returns the open log file, opening it if needed. Must be called with
+ * "file_lock" held. */
+static FILE *logfile_open (void)
+{
+	const char *file = (log_file == NULL) ? DEFAULT_LOGFILE : log_file;
+	cdtime_t now = cdtime ();
+	struct stat st;
+
+	if ((log_fh != NULL) && (now - log_check_time >= LOGFILE_CHECK_INTERVAL))
+	{
+		log_check_time = now;
+		if ((stat (file, &st) != 0)
+				|| (st.st_dev != log_dev) || (st.st_ino != log_ino))
+		{
+			fclose (log_fh);
+			log_fh = NULL;
+		}
+	}
+
+	if (log_fh != NULL)
+		return (log_fh);
+
+	log_fh = fopen (file, "a");
+	if (log_fh == NULL)
+	{
+		char errbuf[1024];
+		fprintf (stderr, "logfile plugin: fopen (%s) failed: %s\n",
+				file, sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (NULL);
+	}
+
+	log_check_time = now;
+	if (fstat (fileno (log_fh), &st) == 0)
+	{
+		log_dev = st.st_dev;
+		log_ino = st.st_ino;
+	}
+
+	return (log_fh);
+} /* FILE *logfile_open */
+
 static void logfile_print (const char *msg, int severity,
 	   	cdtime_t timestamp_time)
 {
 	FILE *fh;
-	_Bool do_close = 0;
 	struct tm timestamp_tm;
 	char timestamp_str[64];
 	char level_str[16] = "";
@@ -131,40 +186,21 @@ static void logfile_print (const char *msg, int severity,
 
 	pthread_mutex_lock (&file_lock);
 
-	if (log_file == NULL)
-	{
-		fh = fopen (DEFAULT_LOGFILE, "a");
-		do_close = 1;
-	}
-	else if (strcasecmp (log_file, "stderr") == 0)
+	if ((log_file != NULL) && (strcasecmp (log_file, "stderr") == 0))
 		fh = stderr;
-	else if (strcasecmp (log_file, "stdout") == 0)
+	else if ((log_file != NULL) && (strcasecmp (log_file, "stdout") == 0))
 		fh = stdout;
 	else
-	{
-		fh = fopen (log_file, "a");
-		do_close = 1;
-	}
+		fh = logfile_open ();
 
-	if (fh == NULL)
-	{
-			char errbuf[1024];
-			fprintf (stderr, "logfile plugin: fopen (%s) failed: %s\n",
-					(log_file == NULL) ? DEFAULT_LOGFILE : log_file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
-	else
+	if (fh != NULL)
 	{
 		if (print_timestamp)
 			fprintf (fh, "[%s] %s%s\n", timestamp_str, level_str, msg);
 		else
 			fprintf (fh, "%s%s\n", level_str, msg);
 
-		if (do_close) {
-			fclose (fh);
-		} else {
-			fflush(fh);
-		}
+		fflush (fh);
 	}
 
 	pthread_mutex_unlock (&file_lock);
@@ -222,6 +258,19 @@ static int logfile_notification (const notification_t *n,
 	return (0);
 } /* int logfile_notification */
 
+static int logfile_shutdown (void)
+{
+	pthread_mutex_lock (&file_lock);
+	if (log_fh != NULL)
+	{
+		fclose (log_fh);
+		log_fh = NULL;
+	}
+	pthread_mutex_unlock (&file_lock);
+
+	return (0);
+} /* int logfile_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("logfile", logfile_config,
@@ -229,6 +278,7 @@ void module_register (void)
 	plugin_register_log ("logfile", logfile_log, /* user_data = */ NULL);
 	plugin_register_notification ("logfile", logfile_notification,
 			/* user_data = */ NULL);
+	plugin_register_shutdown ("logfile", logfile_shutdown);
 } /* void module_register (void) */
 
 /* vim: set sw=4 ts=4 tw=78 noexpandtab : */
@@ -27,9 +27,50 @@
 #include "common.h"
 #include "plugin.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+
 #define NO_VALUE UINT64_MAX
 #define PERCENT_SCALE_FACTOR 1e-8
 
+/* The kernel's list of block devices. The devices are only scanned again when
+ * it has changed. */
+#define LVM_PARTITIONS_FILE "/proc/partitions"
+
+struct lvm_value_s
+{
+    char plugin_instance[DATA_MAX_NAME_LEN];
+    char type_instance[DATA_MAX_NAME_LEN];
+    gauge_t value;
+};
+typedef struct lvm_value_s lvm_value_t;
+
+/* The values collected by one scan of all volume groups. */
+struct lvm_snapshot_s
+{
+    lvm_value_t *values;
+    size_t values_num;
+    size_t values_size;
+    cdtime_t time;
+};
+typedef struct lvm_snapshot_s lvm_snapshot_t;
+
+/* Opening the volume groups reads their metadata from the devices, which can
+ * take seconds, so it is done by a thread. Each read dispatches the result of
+ * the latest scan and asks for the next one. The snapshots are swapped, so
+ * their buffers are reused. */
+static pthread_mutex_t lvm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lvm_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t lvm_thread;
+static _Bool lvm_thread_running = 0;
+static _Bool lvm_thread_stop = 0;
+static _Bool lvm_scan_requested = 0;
+/* The latest scan, protected by lvm_lock. */
+static lvm_snapshot_t lvm_result;
+static _Bool lvm_result_new = 0;
+/* Only used by the read callback. */
+static lvm_snapshot_t lvm_dispatched;
+
 static uint64_t get_lv_property_int(lv_t lv, char const *property)
 {
     lvm_property_value_t v;
@@ -51,27 +92,56 @@ static char const *get_lv_property_string(lv_t lv, char const *property)
     return v.value.string;
 }
 
-static void lvm_submit (char const *plugin_instance, char const *type_instance,
-        uint64_t ivalue)
+/* Adds a value to the snapshot being collected. */
+static void lvm_submit (lvm_snapshot_t *snap, char const *plugin_instance,
+        char const *type_instance, uint64_t ivalue)
 {
-    value_t v;
+    lvm_value_t *v;
+
+    if (snap->values_num >= snap->values_size)
+    {
+        size_t size = (snap->values_size == 0) ? 16 : 2 * snap->values_size;
+        lvm_value_t *tmp;
+
+        tmp = realloc(snap->values, size * sizeof (*tmp));
+        if (tmp == NULL)
+        {
+            ERROR("lvm plugin: realloc failed.");
+            return;
+        }
+        snap->values = tmp;
+        snap->values_size = size;
+    }
+
+    v = snap->values + snap->values_num;
+    sstrncpy(v->plugin_instance, plugin_instance, sizeof (v->plugin_instance));
+    sstrncpy(v->type_instance, type_instance, sizeof (v->type_instance));
+    v->value = (gauge_t) ivalue;
+    snap->values_num++;
+}
+
+static void lvm_dispatch (lvm_value_t const *v, cdtime_t t)
+{
+    value_t values[1];
     value_list_t vl = VALUE_LIST_INIT;
 
-    v.gauge = (gauge_t) ivalue;
+    values[0].gauge = v->value;
 
-    vl.values = &v;
+    vl.values = values;
     vl.values_len = 1;
+    vl.time = t;
 
     sstrncpy(vl.host, hostname_g, sizeof (vl.host));
     sstrncpy(vl.plugin, "lvm", sizeof (vl.plugin));
-    sstrncpy(vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
+    sstrncpy(vl.plugin_instance, v->plugin_instance, sizeof (vl.plugin_instance));
     sstrncpy(vl.type, "df_complex", sizeof (vl.type));
-    sstrncpy(vl.type_instance, type_instance, sizeof (vl.type_instance));
+    sstrncpy(vl.type_instance, v->type_instance, sizeof (vl.type_instance));
 
     plugin_dispatch_values (&vl);
 }
 
-static void report_lv_utilization(lv_t lv, char const *vg_name,
+static void report_lv_utilization(lvm_snapshot_t *snap, lv_t lv,
+        char const *vg_name,
         char const *lv_name, uint64_t lv_size,
         char const *used_percent_property)
 {
@@ -86,12 +156,12 @@ static void report_lv_utilization(lv_t lv, char const *vg_name,
 
     ssnprintf(plugin_instance, sizeof(plugin_instance), "%s-%s",
             vg_name, lv_name);
-    lvm_submit(plugin_instance, "used", used_bytes);
-    lvm_submit(plugin_instance, "free", lv_size - used_bytes);
+    lvm_submit(snap, plugin_instance, "used", used_bytes);
+    lvm_submit(snap, plugin_instance, "free", lv_size - used_bytes);
 }
 
-static void report_thin_pool_utilization(lv_t lv, char const *vg_name,
-        uint64_t lv_size)
+static void report_thin_pool_utilization(lvm_snapshot_t *snap, lv_t lv,
+        char const *vg_name, uint64_t lv_size)
 {
     char const *data_lv;
     char const *metadata_lv;
@@ -103,12 +173,12 @@ static void report_thin_pool_utilization(lv_t lv, char const *vg_name,
     if (data_lv == NULL || metadata_lv == NULL || metadata_size == NO_VALUE)
         return;
 
-    report_lv_utilization(lv, vg_name, data_lv, lv_size, "data_percent");
-    report_lv_utilization(lv, vg_name, metadata_lv, metadata_size,
+    report_lv_utilization(snap, lv, vg_name, data_lv, lv_size, "data_percent");
+    report_lv_utilization(snap, lv, vg_name, metadata_lv, metadata_size,
             "metadata_percent");
 }
 
-static void vg_read(vg_t vg, char const *vg_name)
+static void vg_read(lvm_snapshot_t *snap, vg_t vg, char const *vg_name)
 {
     struct dm_list *lvs;
     struct lvm_lv_list *lvl;
@@ -116,7 +186,7 @@ static void vg_read(vg_t vg, char const *vg_name)
     char const *attrs;
     uint64_t size;
 
-    lvm_submit (vg_name, "free", lvm_vg_get_free_size(vg));
+    lvm_submit (snap, vg_name, "free", lvm_vg_get_free_size(vg));
 
     lvs = lvm_vg_list_lvs(vg);
     if (!lvs) {
@@ -138,14 +208,14 @@ static void vg_read(vg_t vg, char const *vg_name)
             case 's':
             case 'S':
                 /* Snapshot.  Also report used/free space. */
-                report_lv_utilization(lvl->lv, vg_name, name, size,
+                report_lv_utilization(snap, lvl->lv, vg_name, name, size,
                         "data_percent");
                 break;
             case 't':
                 /* Thin pool virtual volume.  We report the underlying data
                    and metadata volumes, not this one.  Report used/free
                    space, then ignore. */
-                report_thin_pool_utilization(lvl->lv, vg_name, size);
+                report_thin_pool_utilization(snap, lvl->lv, vg_name, size);
                 continue;
             case 'v':
                 /* Virtual volume.  Ignore. */
@@ -154,26 +224,21 @@ static void vg_read(vg_t vg, char const *vg_name)
                 /* Thin volume or thin snapshot.  Ignore. */
                 continue;
         }
-        lvm_submit(vg_name, name, size);
+        lvm_submit(snap, vg_name, name, size);
     }
 }
 
-static int lvm_read(void)
+static int lvm_scan_vgs(lvm_t lvm, lvm_snapshot_t *snap)
 {
-    lvm_t lvm;
     struct dm_list *vg_names;
     struct lvm_str_list *name_list;
 
-    lvm = lvm_init(NULL);
-    if (!lvm) {
-        ERROR("lvm plugin: lvm_init failed.");
-        return (-1);
-    }
+    snap->values_num = 0;
+    snap->time = cdtime();
 
     vg_names = lvm_list_vg_names(lvm);
     if (!vg_names) {
         ERROR("lvm plugin lvm_list_vg_name failed %s", lvm_errmsg(lvm));
-        lvm_quit(lvm);
         return (-1);
     }
 
@@ -187,15 +252,177 @@ static int lvm_read(void)
             continue;
         }
 
-        vg_read(vg, name_list->str);
+        vg_read(snap, vg, name_list->str);
         lvm_vg_close(vg);
     }
 
-    lvm_quit(lvm);
+    return (0);
+} /* lvm_scan_vgs */
+
+/* Returns true if the list of block devices differs from the one seen by the
+ * previous call. Only a hash of the file is kept. */
+static _Bool lvm_devices_changed(void)
+{
+    static uint64_t last_hash = 0;
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+    char buffer[4096];
+    ssize_t len;
+    int fd;
+
+    fd = open(LVM_PARTITIONS_FILE, O_RDONLY);
+    if (fd < 0)
+        /* Without the file, scan every time. */
+        return (1);
+
+    while ((len = read(fd, buffer, sizeof (buffer))) > 0) {
+        ssize_t i;
+
+        for (i = 0; i < len; i++) {
+            hash ^= (uint64_t) (unsigned char) buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    close(fd);
+
+    if (hash == last_hash)
+        return (0);
+    last_hash = hash;
+    return (1);
+} /* lvm_devices_changed */
+
+static void lvm_snapshot_swap(lvm_snapshot_t *a, lvm_snapshot_t *b)
+{
+    lvm_snapshot_t tmp = *a;
+
+    *a = *b;
+    *b = tmp;
+}
+
+static void *lvm_scan_thread(void __attribute__((unused)) *arg)
+{
+    lvm_t lvm = NULL;
+    lvm_snapshot_t scan;
+
+    memset(&scan, 0, sizeof (scan));
+
+    pthread_mutex_lock(&lvm_lock);
+    while (!lvm_thread_stop) {
+        int status = -1;
+
+        if (!lvm_scan_requested) {
+            pthread_cond_wait(&lvm_cond, &lvm_lock);
+            continue;
+        }
+        lvm_scan_requested = 0;
+        pthread_mutex_unlock(&lvm_lock);
+
+        /* The handle is kept, so the devices are only scanned when they have
+         * changed. */
+        if (lvm == NULL) {
+            lvm = lvm_init(NULL);
+            if (!lvm)
+                ERROR("lvm plugin: lvm_init failed.");
+            else
+                (void) lvm_devices_changed();
+        }
+        else if (lvm_devices_changed()) {
+            DEBUG("lvm plugin: The block devices have changed, rescanning.");
+            if ((lvm_config_reload(lvm) != 0) || (lvm_scan(lvm) != 0))
+                ERROR("lvm plugin: Rescanning the devices failed: %s",
+                        lvm_errmsg(lvm));
+        }
+
+        if (lvm != NULL)
+            status = lvm_scan_vgs(lvm, &scan);
+
+        pthread_mutex_lock(&lvm_lock);
+        if (status == 0) {
+            lvm_snapshot_swap(&scan, &lvm_result);
+            lvm_result_new = 1;
+        }
+    }
+    pthread_mutex_unlock(&lvm_lock);
+
+    if (lvm != NULL)
+        lvm_quit(lvm);
+    sfree(scan.values);
+
+    return (NULL);
+} /* lvm_scan_thread */
+
+static int lvm_plugin_init(void)
+{
+    int status;
+
+    if (lvm_thread_running)
+        return (0);
+
+    status = plugin_thread_create(&lvm_thread, /* attr = */ NULL,
+            lvm_scan_thread, /* arg = */ NULL);
+    if (status != 0) {
+        ERROR("lvm plugin: Starting the scan thread failed.");
+        return (-1);
+    }
+    lvm_thread_running = 1;
+
+    /* Collect the first values right away. */
+    pthread_mutex_lock(&lvm_lock);
+    lvm_scan_requested = 1;
+    pthread_cond_signal(&lvm_cond);
+    pthread_mutex_unlock(&lvm_lock);
+
+    return (0);
+} /* lvm_plugin_init */
+
+static int lvm_read(void)
+{
+    _Bool have_new;
+    size_t i;
+
+    /* Never waits for the devices: the values of the latest scan are
+     * dispatched once and the next scan is started. */
+    pthread_mutex_lock(&lvm_lock);
+    have_new = lvm_result_new;
+    if (have_new) {
+        lvm_snapshot_swap(&lvm_result, &lvm_dispatched);
+        lvm_result_new = 0;
+    }
+    lvm_scan_requested = 1;
+    pthread_cond_signal(&lvm_cond);
+    pthread_mutex_unlock(&lvm_lock);
+
+    if (!have_new)
+        return (0);
+
+    for (i = 0; i < lvm_dispatched.values_num; i++)
+        lvm_dispatch(lvm_dispatched.values + i, lvm_dispatched.time);
+
     return (0);
 } /*lvm_read */
 
+static int lvm_shutdown(void)
+{
+    if (lvm_thread_running) {
+        pthread_mutex_lock(&lvm_lock);
+        lvm_thread_stop = 1;
+        pthread_cond_signal(&lvm_cond);
+        pthread_mutex_unlock(&lvm_lock);
+
+        pthread_join(lvm_thread, /* retval = */ NULL);
+        lvm_thread_running = 0;
+    }
+
+    sfree(lvm_result.values);
+    sfree(lvm_dispatched.values);
+    memset(&lvm_result, 0, sizeof (lvm_result));
+    memset(&lvm_dispatched, 0, sizeof (lvm_dispatched));
+
+    return (0);
+} /* lvm_shutdown */
+
 void module_register(void)
 {
+    plugin_register_init("lvm", lvm_plugin_init);
     plugin_register_read("lvm", lvm_read);
+    plugin_register_shutdown("lvm", lvm_shutdown);
 } /* void module_register */
@@ -182,6 +182,7 @@ void module_register (void)
   mproc.create  = mh_create;
   mproc.destroy = mh_destroy;
   mproc.match   = mh_match;
+  mproc.flags   = FC_MATCH_IDENTIFIER_ONLY;
   fc_register_match ("hashed", mproc);
 } /* module_register */
 
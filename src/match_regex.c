@@ -33,6 +33,7 @@
 
 #include "collectd.h"
 #include "filter_chain.h"
+#include "utils_regex_set.h"
 
 #include <sys/types.h>
 #include <regex.h>
@@ -40,6 +41,10 @@
 #define log_err(...) ERROR ("`regex' match: " __VA_ARGS__)
 #define log_warn(...) WARNING ("`regex' match: " __VA_ARGS__)
 
+/* Fields with more regular expressions than this are matched without the
+ * regex set pre-filter, so the candidate bitmap fits on the stack. */
+#define MR_SET_MAX 256
+
 /*
  * private data types
  */
@@ -63,6 +68,11 @@ struct mr_match_s
 	mr_regex_t *plugin_instance;
 	mr_regex_t *type;
 	mr_regex_t *type_instance;
+	regex_set_t *host_set;
+	regex_set_t *plugin_set;
+	regex_set_t *plugin_instance_set;
+	regex_set_t *type_set;
+	regex_set_t *type_instance_set;
 	_Bool invert;
 };
 
@@ -93,17 +103,71 @@ static void mr_free_match (mr_match_t *m) /* {{{ */
 	mr_free_regex (m->type);
 	mr_free_regex (m->type_instance);
 
+	regex_set_destroy (m->host_set);
+	regex_set_destroy (m->plugin_set);
+	regex_set_destroy (m->plugin_instance_set);
+	regex_set_destroy (m->type_set);
+	regex_set_destroy (m->type_instance_set);
+
 	free (m);
 } /* }}} void mr_free_match */
 
+/* Builds the pre-filter for a list of regular expressions. Returns NULL if
+ * the list is empty, too long or the set could not be built, in which case
+ * all regular expressions are run. */
+static regex_set_t *mr_create_set (mr_regex_t *re_head) /* {{{ */
+{
+	regex_set_t *set;
+	mr_regex_t *re;
+
+	if (re_head == NULL)
+		return (NULL);
+
+	set = regex_set_create ();
+	if (set == NULL)
+		return (NULL);
+
+	for (re = re_head; re != NULL; re = re->next)
+	{
+		if ((regex_set_size (set) >= MR_SET_MAX)
+				|| (regex_set_add (set, re->re_str, REG_EXTENDED) < 0))
+		{
+			regex_set_destroy (set);
+			return (NULL);
+		}
+	}
+
+	if (regex_set_compile (set) != 0)
+	{
+		regex_set_destroy (set);
+		return (NULL);
+	}
+
+	return (set);
+} /* }}} regex_set_t *mr_create_set */
+
 static int mr_match_regexen (mr_regex_t *re_head, /* {{{ */
-		const char *string)
+		regex_set_t const *set, const char *string)
 {
 	mr_regex_t *re;
 
 	if (re_head == NULL)
 		return (FC_MATCH_MATCHES);
 
+	/* All regular expressions have to match, so a single one that is ruled
+	 * out by the pre-filter is enough to reject the string. */
+	if (set != NULL)
+	{
+		uint64_t candidates[REGEX_SET_WORDS (MR_SET_MAX)];
+		size_t re_num = regex_set_size (set);
+
+		if (regex_set_candidates (set, string, candidates) < re_num)
+		{
+			DEBUG ("regex match: `%s' ruled out by the regex set.", string);
+			return (FC_MATCH_NO_MATCH);
+		}
+	}
+
 	for (re = re_head; re != NULL; re = re->next)
 	{
 		int status;
@@ -254,6 +318,12 @@ static int mr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
 		return (status);
 	}
 
+	m->host_set = mr_create_set (m->host);
+	m->plugin_set = mr_create_set (m->plugin);
+	m->plugin_instance_set = mr_create_set (m->plugin_instance);
+	m->type_set = mr_create_set (m->type);
+	m->type_instance_set = mr_create_set (m->type_instance);
+
 	*user_data = m;
 	return (0);
 } /* }}} int mr_create */
@@ -285,16 +355,19 @@ static int mr_match (const data_set_t __attribute__((unused)) *ds, /* {{{ */
 		nomatch_value = FC_MATCH_MATCHES;
 	}
 
-	if (mr_match_regexen (m->host, vl->host) == FC_MATCH_NO_MATCH)
+	if (mr_match_regexen (m->host, m->host_set,
+				vl->host) == FC_MATCH_NO_MATCH)
 		return (nomatch_value);
-	if (mr_match_regexen (m->plugin, vl->plugin) == FC_MATCH_NO_MATCH)
+	if (mr_match_regexen (m->plugin, m->plugin_set,
+				vl->plugin) == FC_MATCH_NO_MATCH)
 		return (nomatch_value);
-	if (mr_match_regexen (m->plugin_instance,
+	if (mr_match_regexen (m->plugin_instance, m->plugin_instance_set,
 				vl->plugin_instance) == FC_MATCH_NO_MATCH)
 		return (nomatch_value);
-	if (mr_match_regexen (m->type, vl->type) == FC_MATCH_NO_MATCH)
+	if (mr_match_regexen (m->type, m->type_set,
+				vl->type) == FC_MATCH_NO_MATCH)
 		return (nomatch_value);
-	if (mr_match_regexen (m->type_instance,
+	if (mr_match_regexen (m->type_instance, m->type_instance_set,
 				vl->type_instance) == FC_MATCH_NO_MATCH)
 		return (nomatch_value);
 
@@ -309,6 +382,7 @@ void module_register (void)
 	mproc.create  = mr_create;
 	mproc.destroy = mr_destroy;
 	mproc.match   = mr_match;
+	mproc.flags   = FC_MATCH_IDENTIFIER_ONLY;
 	fc_register_match ("regex", mproc);
 } /* module_register */
 
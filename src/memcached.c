@@ -34,6 +34,8 @@
 #include "configfile.h"
 
 #include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -41,29 +43,102 @@
 #define MEMCACHED_DEF_HOST "127.0.0.1"
 #define MEMCACHED_DEF_PORT "11211"
 
+/* Initial size of the receive buffer of an instance and the size at which
+ * the reply is considered broken. */
+#define MEMCACHED_BUFFER_SIZE     4096
+#define MEMCACHED_BUFFER_SIZE_MAX (1024 * 1024)
+
+/*
+ * All instances are queried concurrently from the read callback: the
+ * connections are kept open and non-blocking, the "stats" command is sent to
+ * every instance and the replies are collected with poll(2) until all of them
+ * are complete or the interval is over.
+ */
+enum memcached_state_e
+{
+  MC_IDLE = 0,
+  MC_CONNECTING,
+  MC_SENDING,
+  MC_RECEIVING,
+  MC_DONE,
+  MC_FAILED
+};
+
+typedef struct memcached_s memcached_t;
 struct memcached_s
 {
   char *name;
   char *socket;
   char *host;
   char *port;
+
+  int fd;
+  enum memcached_state_e state;
+  /* Set after reconnecting once in the current read. */
+  _Bool reconnected;
+
+  size_t sent;
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_fill;
+
+  memcached_t *next;
 };
-typedef struct memcached_s memcached_t;
 
+static const char memcached_command[] = "stats\r\n";
+
+static memcached_t *memcached_instances = NULL;
 static _Bool memcached_have_instances = 0;
 
+static struct pollfd *memcached_pollfds = NULL;
+static memcached_t **memcached_polled = NULL;
+static size_t memcached_pollfds_size = 0;
+
+static void memcached_close (memcached_t *st)
+{
+  if (st->fd >= 0)
+  {
+    shutdown (st->fd, SHUT_RDWR);
+    close (st->fd);
+  }
+  st->fd = -1;
+}
+
 static void memcached_free (memcached_t *st)
 {
   if (st == NULL)
     return;
 
+  memcached_close (st);
   sfree (st->name);
   sfree (st->socket);
   sfree (st->host);
   sfree (st->port);
+  sfree (st->buffer);
   sfree (st);
 }
 
+/* Starts a non-blocking connect(2) on `fd'. Returns the state of the
+ * connection or MC_FAILED. */
+static enum memcached_state_e memcached_connect_fd (int fd,
+    const struct sockaddr *addr, socklen_t addrlen)
+{
+  int flags;
+  int status;
+
+  flags = fcntl (fd, F_GETFL);
+  if ((flags < 0) || (fcntl (fd, F_SETFL, flags | O_NONBLOCK) != 0))
+    return (MC_FAILED);
+
+  status = connect (fd, addr, addrlen);
+  if (status == 0)
+    return (MC_SENDING);
+  else if ((errno == EINPROGRESS) || (errno == EAGAIN) || (errno == EINTR))
+    return (MC_CONNECTING);
+
+  return (MC_FAILED);
+}
+
 static int memcached_connect_unix (memcached_t *st)
 {
   struct sockaddr_un serv_addr;
@@ -85,15 +160,16 @@ static int memcached_connect_unix (memcached_t *st)
   }
 
   /* connect to the memcached daemon */
-  int status = connect (fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-  if (status != 0)
+  st->state = memcached_connect_fd (fd, (struct sockaddr *) &serv_addr,
+      sizeof (serv_addr));
+  if (st->state == MC_FAILED)
   {
-      shutdown (fd, SHUT_RDWR);
-      close (fd);
-      fd = -1;
+    close (fd);
+    return (-1);
   }
 
-  return (fd);
+  st->fd = fd;
+  return (0);
 } /* int memcached_connect_unix */
 
 static int memcached_connect_inet (memcached_t *st)
@@ -104,7 +180,6 @@ static int memcached_connect_inet (memcached_t *st)
   struct addrinfo  ai_hints;
   struct addrinfo *ai_list, *ai_ptr;
   int status;
-  int fd = -1;
 
   memset (&ai_hints, 0, sizeof (ai_hints));
   ai_hints.ai_flags    = 0;
@@ -134,6 +209,8 @@ static int memcached_connect_inet (memcached_t *st)
 
   for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
   {
+    int fd;
+
     /* create our socket descriptor */
     fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
     if (fd < 0)
@@ -145,103 +222,282 @@ static int memcached_connect_inet (memcached_t *st)
       continue;
     }
 
-    /* connect to the memcached daemon */
-    status = (int) connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
-    if (status != 0)
+    /* connect to the memcached daemon. A connection in progress is not
+     * checked against the other addresses. */
+    st->state = memcached_connect_fd (fd, ai_ptr->ai_addr,
+        ai_ptr->ai_addrlen);
+    if (st->state == MC_FAILED)
     {
-      shutdown (fd, SHUT_RDWR);
       close (fd);
-      fd = -1;
       continue;
     }
 
-    /* A socket could be opened and connecting succeeded. We're done. */
+    st->fd = fd;
     break;
   }
 
   freeaddrinfo (ai_list);
-  return (fd);
+  return ((st->fd >= 0) ? 0 : -1);
 } /* int memcached_connect_inet */
 
 static int memcached_connect (memcached_t *st)
 {
+  memcached_close (st);
+
   if (st->socket != NULL)
     return (memcached_connect_unix (st));
   else
     return (memcached_connect_inet (st));
 }
 
-static int memcached_query_daemon (char *buffer, size_t buffer_size, memcached_t *st)
+static void memcached_fail (memcached_t *st, const char *what, int err)
 {
-  int fd = -1;
-  int status;
-  size_t buffer_fill;
+  char errbuf[1024];
+
+  ERROR ("memcached plugin: Instance \"%s\": %s failed: %s",
+      st->name, what, sstrerror (err, errbuf, sizeof (errbuf)));
+  memcached_close (st);
+  st->state = MC_FAILED;
+}
 
-  fd = memcached_connect (st);
-  if (fd < 0) {
+/* Prepares `st' for a new query, connecting if needed. */
+static void memcached_query_start (memcached_t *st)
+{
+  st->sent = 0;
+  st->buffer_fill = 0;
+  st->reconnected = 0;
+
+  if (st->fd >= 0)
+  {
+    st->state = MC_SENDING;
+    return;
+  }
+
+  if (memcached_connect (st) != 0)
+  {
     ERROR ("memcached plugin: Instance \"%s\" could not connect to daemon.",
         st->name);
-    return -1;
+    st->state = MC_FAILED;
   }
+}
 
-  status = (int) swrite (fd, "stats\r\n", strlen ("stats\r\n"));
-  if (status != 0)
+/* The server may have closed an idle connection. Connect again once before
+ * giving up. */
+static void memcached_query_restart (memcached_t *st)
+{
+  if (st->reconnected || (st->sent < sizeof (memcached_command) - 1)
+      || (st->buffer_fill > 0))
   {
-    char errbuf[1024];
-    ERROR ("memcached plugin: write(2) failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
-    shutdown(fd, SHUT_RDWR);
-    close (fd);
-    return (-1);
+    WARNING ("memcached plugin: Instance \"%s\": Connection closed by the "
+        "daemon.", st->name);
+    memcached_close (st);
+    st->state = MC_FAILED;
+    return;
   }
 
-  /* receive data from the memcached daemon */
-  memset (buffer, 0, buffer_size);
+  memcached_close (st);
+  memcached_query_start (st);
+  st->reconnected = 1;
+}
 
-  buffer_fill = 0;
-  while ((status = (int) recv (fd, buffer + buffer_fill,
-          buffer_size - buffer_fill, /* flags = */ 0)) != 0)
+static void memcached_handle_send (memcached_t *st)
+{
+  while (st->sent < sizeof (memcached_command) - 1)
   {
-    char const end_token[5] = {'E', 'N', 'D', '\r', '\n'};
-    if (status < 0)
+    ssize_t status;
+
+    status = send (st->fd, memcached_command + st->sent,
+        sizeof (memcached_command) - 1 - st->sent, /* flags = */ 0);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    else if ((status < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      return;
+    else if ((status < 0) && ((errno == EPIPE) || (errno == ECONNRESET)))
     {
-      char errbuf[1024];
+      memcached_query_restart (st);
+      return;
+    }
+    else if (status < 0)
+    {
+      memcached_fail (st, "send(2)", errno);
+      return;
+    }
 
-      if ((errno == EAGAIN) || (errno == EINTR))
-          continue;
+    st->sent += (size_t) status;
+  }
 
-      ERROR ("memcached: Error reading from socket: %s",
-          sstrerror (errno, errbuf, sizeof (errbuf)));
-      shutdown(fd, SHUT_RDWR);
-      close (fd);
-      return (-1);
+  st->state = MC_RECEIVING;
+}
+
+static void memcached_handle_recv (memcached_t *st)
+{
+  static const char end_token[5] = {'E', 'N', 'D', '\r', '\n'};
+
+  while (42)
+  {
+    ssize_t status;
+
+    if (st->buffer_fill >= st->buffer_size)
+    {
+      size_t size = (st->buffer_size > 0)
+        ? 2 * st->buffer_size : MEMCACHED_BUFFER_SIZE;
+      char *tmp;
+
+      if (size > MEMCACHED_BUFFER_SIZE_MAX)
+      {
+        WARNING ("memcached plugin: Instance \"%s\": Reply too long.",
+            st->name);
+        memcached_close (st);
+        st->state = MC_FAILED;
+        return;
+      }
+
+      tmp = realloc (st->buffer, size);
+      if (tmp == NULL)
+      {
+        memcached_fail (st, "realloc", ENOMEM);
+        return;
+      }
+      st->buffer = tmp;
+      st->buffer_size = size;
     }
 
-    buffer_fill += (size_t) status;
-    if (buffer_fill > buffer_size)
+    status = recv (st->fd, st->buffer + st->buffer_fill,
+        st->buffer_size - st->buffer_fill, /* flags = */ 0);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    else if ((status < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      return;
+    else if ((status == 0)
+        || ((status < 0) && (errno == ECONNRESET)))
     {
-      buffer_fill = buffer_size;
-      WARNING ("memcached plugin: Message was truncated.");
-      break;
+      memcached_query_restart (st);
+      return;
     }
+    else if (status < 0)
+    {
+      memcached_fail (st, "recv(2)", errno);
+      return;
+    }
+
+    st->buffer_fill += (size_t) status;
 
     /* If buffer ends in end_token, we have all the data. */
-    if (memcmp (buffer + buffer_fill - sizeof (end_token),
-          end_token, sizeof (end_token)) == 0)
-      break;
-  } /* while (recv) */
+    if ((st->buffer_fill >= sizeof (end_token))
+        && (memcmp (st->buffer + st->buffer_fill - sizeof (end_token),
+            end_token, sizeof (end_token)) == 0))
+    {
+      st->state = MC_DONE;
+      return;
+    }
+  }
+}
 
-  status = 0;
-  if (buffer_fill == 0)
+static void memcached_handle_events (memcached_t *st, short revents)
+{
+  if (st->state == MC_CONNECTING)
   {
-    WARNING ("memcached plugin: No data returned by memcached.");
-    status = -1;
+    int err = 0;
+    socklen_t err_len = sizeof (err);
+
+    if (getsockopt (st->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0)
+      err = errno;
+    if (err != 0)
+    {
+      memcached_fail (st, "connect(2)", err);
+      return;
+    }
+    st->state = MC_SENDING;
   }
 
-  shutdown(fd, SHUT_RDWR);
-  close(fd);
-  return (status);
-} /* int memcached_query_daemon */
+  if (st->state == MC_SENDING)
+    memcached_handle_send (st);
+
+  /* The reply may already be there when the command has been sent. */
+  if ((st->state == MC_RECEIVING)
+      && ((revents & (POLLIN | POLLHUP | POLLERR)) != 0))
+    memcached_handle_recv (st);
+}
+
+/* Sends the command to all instances and waits until all replies are in,
+ * at most until `deadline'. */
+static void memcached_query_all (cdtime_t deadline)
+{
+  memcached_t *st;
+
+  for (st = memcached_instances; st != NULL; st = st->next)
+  {
+    memcached_query_start (st);
+    /* Send right away; most connections can take the command. */
+    if (st->state == MC_SENDING)
+      memcached_handle_send (st);
+  }
+
+  while (42)
+  {
+    size_t num = 0;
+    cdtime_t now;
+    int status;
+    size_t i;
+
+    for (st = memcached_instances; st != NULL; st = st->next)
+    {
+      short events;
+
+      if (st->state == MC_RECEIVING)
+        events = POLLIN;
+      else if ((st->state == MC_CONNECTING) || (st->state == MC_SENDING))
+        events = POLLOUT;
+      else
+        continue;
+
+      memcached_pollfds[num].fd = st->fd;
+      memcached_pollfds[num].events = events;
+      memcached_pollfds[num].revents = 0;
+      memcached_polled[num] = st;
+      num++;
+    }
+
+    if (num == 0)
+      break;
+
+    now = cdtime ();
+    if (now >= deadline)
+    {
+      for (i = 0; i < num; i++)
+      {
+        ERROR ("memcached plugin: Instance \"%s\": Timeout waiting for the "
+            "daemon.", memcached_polled[i]->name);
+        /* Don't leave a late reply on the connection. */
+        memcached_close (memcached_polled[i]);
+        memcached_polled[i]->state = MC_FAILED;
+      }
+      break;
+    }
+
+    status = poll (memcached_pollfds, (nfds_t) num,
+        (int) CDTIME_T_TO_MS (deadline - now) + 1);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    else if (status < 0)
+    {
+      char errbuf[1024];
+      ERROR ("memcached plugin: poll(2) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      for (i = 0; i < num; i++)
+      {
+        memcached_close (memcached_polled[i]);
+        memcached_polled[i]->state = MC_FAILED;
+      }
+      break;
+    }
+
+    for (i = 0; i < num; i++)
+      if (memcached_pollfds[i].revents != 0)
+        memcached_handle_events (memcached_polled[i],
+            memcached_pollfds[i].revents);
+  }
+}
 
 static void memcached_init_vl (value_list_t *vl, memcached_t const *st)
 {
@@ -336,14 +592,11 @@ static void submit_gauge2 (const char *type, const char *type_inst,
   plugin_dispatch_values (&vl);
 }
 
-static int memcached_read (user_data_t *user_data)
+/* Parses the "STAT <name> <value>" lines of the reply in place. */
+static void memcached_parse (memcached_t *st)
 {
-  char buf[4096];
-  char *fields[3];
   char *ptr;
-  char *line;
-  char *saveptr;
-  int fields_num;
+  char *end;
 
   gauge_t bytes_used = NAN;
   gauge_t bytes_total = NAN;
@@ -358,30 +611,40 @@ static int memcached_read (user_data_t *user_data)
   derive_t octets_rx = 0;
   derive_t octets_tx = 0;
 
-  memcached_t *st;
-  st = user_data->data;
-
-  /* get data from daemon */
-  if (memcached_query_daemon (buf, sizeof (buf), st) < 0) {
-    return -1;
-  }
-
 #define FIELD_IS(cnst) \
-  (((sizeof(cnst) - 1) == name_len) && (strcmp (cnst, fields[1]) == 0))
+  (((sizeof(cnst) - 1) == name_len) && (memcmp (cnst, name, name_len) == 0))
 
-  ptr = buf;
-  saveptr = NULL;
-  while ((line = strtok_r (ptr, "\n\r", &saveptr)) != NULL)
+  ptr = st->buffer;
+  end = st->buffer + st->buffer_fill;
+  while (ptr < end)
   {
-    int name_len;
+    char *eol;
+    char *name;
+    char *value;
+    size_t name_len;
 
-    ptr = NULL;
+    eol = memchr (ptr, '\n', (size_t) (end - ptr));
+    if (eol == NULL)
+      break;
+
+    *eol = 0;
+    if ((eol > ptr) && (eol[-1] == '\r'))
+      eol[-1] = 0;
+
+    name = ptr;
+    ptr = eol + 1;
 
-    fields_num = strsplit(line, fields, 3);
-    if (fields_num != 3)
+    if (strncmp (name, "STAT ", 5) != 0)
       continue;
+    name += 5;
+
+    value = strchr (name, ' ');
+    if (value == NULL)
+      continue;
+    name_len = (size_t) (value - name);
+    *value = 0;
+    value++;
 
-    name_len = strlen(fields[1]);
     if (name_len == 0)
       continue;
 
@@ -395,11 +658,11 @@ static int memcached_read (user_data_t *user_data)
      */
     if (FIELD_IS ("rusage_user"))
     {
-      rusage_user = atoll (fields[2]);
+      rusage_user = atoll (value);
     }
     else if (FIELD_IS ("rusage_system"))
     {
-      rusage_syst = atoll(fields[2]);
+      rusage_syst = atoll(value);
     }
 
     /*
@@ -407,7 +670,7 @@ static int memcached_read (user_data_t *user_data)
      */
     else if (FIELD_IS ("threads"))
     {
-      submit_gauge2 ("ps_count", NULL, NAN, atof (fields[2]), st);
+      submit_gauge2 ("ps_count", NULL, NAN, atof (value), st);
     }
 
     /*
@@ -415,7 +678,7 @@ static int memcached_read (user_data_t *user_data)
      */
     else if (FIELD_IS ("curr_items"))
     {
-      submit_gauge ("memcached_items", "current", atof (fields[2]), st);
+      submit_gauge ("memcached_items", "current", atof (value), st);
     }
 
     /*
@@ -423,11 +686,11 @@ static int memcached_read (user_data_t *user_data)
      */
     else if (FIELD_IS ("bytes"))
     {
-      bytes_used = atof (fields[2]);
+      bytes_used = atof (value);
     }
     else if (FIELD_IS ("limit_maxbytes"))
     {
-      bytes_total = atof(fields[2]);
+      bytes_total = atof(value);
     }
 
     /*
@@ -435,22 +698,22 @@ static int memcached_read (user_data_t *user_data)
      */
     else if (FIELD_IS ("curr_connections"))
     {
-      submit_gauge ("memcached_connections", "current", atof (fields[2]), st);
+      submit_gauge ("memcached_connections", "current", atof (value), st);
     }
     else if (FIELD_IS ("listen_disabled_num"))
     {
-      submit_derive ("connections", "listen_disabled", atof (fields[2]), st);
+      submit_derive ("connections", "listen_disabled", atof (value), st);
     }
 
     /*
      * Commands
      */
-    else if ((name_len > 4) && (strncmp (fields[1], "cmd_", 4) == 0))
+    else if ((name_len > 4) && (strncmp (name, "cmd_", 4) == 0))
     {
-      const char *name = fields[1] + 4;
-      submit_derive ("memcached_command", name, atoll (fields[2]), st);
-      if (strcmp (name, "get") == 0)
-        gets = atof (fields[2]);
+      const char *cmd = name + 4;
+      submit_derive ("memcached_command", cmd, atoll (value), st);
+      if (strcmp (cmd, "get") == 0)
+        gets = atof (value);
     }
 
     /*
@@ -458,28 +721,28 @@ static int memcached_read (user_data_t *user_data)
      */
     else if (FIELD_IS("incr_misses"))
     {
-      derive_t incr_count = atoll (fields[2]);
+      derive_t incr_count = atoll (value);
       submit_derive ("memcached_ops", "incr_misses", incr_count, st);
       incr += incr_count;
     }
     else if (FIELD_IS ("incr_hits"))
     {
-      derive_t incr_count = atoll (fields[2]);
+      derive_t incr_count = atoll (value);
       submit_derive ("memcached_ops", "incr_hits", incr_count, st);
-      incr_hits = atof (fields[2]);
+      incr_hits = atof (value);
       incr += incr_count;
     }
     else if (FIELD_IS ("decr_misses"))
     {
-      derive_t decr_count = atoll (fields[2]);
+      derive_t decr_count = atoll (value);
       submit_derive ("memcached_ops", "decr_misses", decr_count, st);
       decr += decr_count;
     }
     else if (FIELD_IS ("decr_hits"))
     {
-      derive_t decr_count = atoll (fields[2]);
+      derive_t decr_count = atoll (value);
       submit_derive ("memcached_ops", "decr_hits", decr_count, st);
-      decr_hits = atof (fields[2]);
+      decr_hits = atof (value);
       decr += decr_count;
     }
 
@@ -488,16 +751,16 @@ static int memcached_read (user_data_t *user_data)
      */
     else if (FIELD_IS ("get_hits"))
     {
-      submit_derive ("memcached_ops", "hits", atoll (fields[2]), st);
-      hits = atof (fields[2]);
+      submit_derive ("memcached_ops", "hits", atoll (value), st);
+      hits = atof (value);
     }
     else if (FIELD_IS ("get_misses"))
     {
-      submit_derive ("memcached_ops", "misses", atoll (fields[2]), st);
+      submit_derive ("memcached_ops", "misses", atoll (value), st);
     }
     else if (FIELD_IS ("evictions"))
     {
-      submit_derive ("memcached_ops", "evictions", atoll (fields[2]), st);
+      submit_derive ("memcached_ops", "evictions", atoll (value), st);
     }
 
     /*
@@ -505,13 +768,13 @@ static int memcached_read (user_data_t *user_data)
      */
     else if (FIELD_IS ("bytes_read"))
     {
-      octets_rx = atoll (fields[2]);
+      octets_rx = atoll (value);
     }
     else if (FIELD_IS ("bytes_written"))
     {
-      octets_tx = atoll (fields[2]);
+      octets_tx = atoll (value);
     }
-  } /* while ((line = strtok_r (ptr, "\n\r", &saveptr)) != NULL) */
+  } /* while (ptr < end) */
 
   if (!isnan (bytes_used) && !isnan (bytes_total) && (bytes_used <= bytes_total))
     submit_gauge2 ("df", "cache", bytes_used, bytes_total - bytes_used, st);
@@ -546,29 +809,61 @@ static int memcached_read (user_data_t *user_data)
     submit_derive ("memcached_ops", "decr", decr, st);
   }
 
-  return 0;
-} /* int memcached_read */
+} /* void memcached_parse */
 
-static int memcached_add_read_callback (memcached_t *st)
+static int memcached_read (void)
 {
-  user_data_t ud;
-  char callback_name[3*DATA_MAX_NAME_LEN];
-  int status;
+  memcached_t *st;
+  size_t num = 0;
+  int success = 0;
 
-  memset (&ud, 0, sizeof (ud));
-  ud.data = st;
-  ud.free_func = (void *) memcached_free;
+  for (st = memcached_instances; st != NULL; st = st->next)
+    num++;
 
-  assert (st->name != NULL);
-  ssnprintf (callback_name, sizeof (callback_name), "memcached/%s", st->name);
+  if (num > memcached_pollfds_size)
+  {
+    struct pollfd *tmp_fds;
+    memcached_t **tmp_polled;
 
-  status = plugin_register_complex_read (/* group = */ "memcached",
-      /* name      = */ callback_name,
-      /* callback  = */ memcached_read,
-      /* interval  = */ 0,
-      /* user_data = */ &ud);
-  return (status);
-} /* int memcached_add_read_callback */
+    tmp_fds = realloc (memcached_pollfds, num * sizeof (*tmp_fds));
+    if (tmp_fds == NULL)
+      return (ENOMEM);
+    memcached_pollfds = tmp_fds;
+
+    tmp_polled = realloc (memcached_polled, num * sizeof (*tmp_polled));
+    if (tmp_polled == NULL)
+      return (ENOMEM);
+    memcached_polled = tmp_polled;
+
+    memcached_pollfds_size = num;
+  }
+
+  memcached_query_all (cdtime () + plugin_get_interval ());
+
+  for (st = memcached_instances; st != NULL; st = st->next)
+  {
+    if (st->state != MC_DONE)
+      continue;
+
+    memcached_parse (st);
+    st->state = MC_IDLE;
+    success++;
+  }
+
+  if (success == 0)
+    return (-1);
+  return (0);
+} /* int memcached_read */
+
+static void memcached_add_instance (memcached_t *st)
+{
+  memcached_t **ptr = &memcached_instances;
+
+  /* keep the order of the configuration */
+  while (*ptr != NULL)
+    ptr = &(*ptr)->next;
+  *ptr = st;
+} /* void memcached_add_instance */
 
 /* Configuration handling functiions
  * <Plugin memcached>
@@ -598,6 +893,7 @@ static int config_add_instance(oconfig_item_t *ci)
   st->socket = NULL;
   st->host = NULL;
   st->port = NULL;
+  st->fd = -1;
 
   if (strcasecmp (ci->key, "Plugin") == 0) /* default instance */
     st->name = sstrdup ("__legacy__");
@@ -631,15 +927,13 @@ static int config_add_instance(oconfig_item_t *ci)
       break;
   }
 
-  if (status == 0)
-    status = memcached_add_read_callback (st);
-
   if (status != 0)
   {
     memcached_free(st);
     return (-1);
   }
 
+  memcached_add_instance (st);
   return (0);
 }
 
@@ -674,35 +968,52 @@ static int memcached_config (oconfig_item_t *ci)
 
   return (status);
 }
-
 static int memcached_init (void)
 {
   memcached_t *st;
-  int status;
 
-  if (memcached_have_instances)
-    return (0);
-
-  /* No instances were configured, lets start a default instance. */
-  st = calloc (1, sizeof (*st));
-  if (st == NULL)
-    return (ENOMEM);
-  st->name = sstrdup ("__legacy__");
-  st->socket = NULL;
-  st->host = NULL;
-  st->port = NULL;
+  if (!memcached_have_instances)
+  {
+    /* No instances were configured, lets start a default instance. */
+    st = calloc (1, sizeof (*st));
+    if (st == NULL)
+      return (ENOMEM);
+    st->name = sstrdup ("__legacy__");
+    st->socket = NULL;
+    st->host = NULL;
+    st->port = NULL;
+    st->fd = -1;
 
-  status = memcached_add_read_callback (st);
-  if (status == 0)
+    memcached_add_instance (st);
     memcached_have_instances = 1;
-  else
-    memcached_free (st);
+  }
 
-  return (status);
+  return (plugin_register_read ("memcached", memcached_read));
 } /* int memcached_init */
 
+static int memcached_shutdown (void)
+{
+  memcached_t *st;
+
+  st = memcached_instances;
+  memcached_instances = NULL;
+  while (st != NULL)
+  {
+    memcached_t *next = st->next;
+    memcached_free (st);
+    st = next;
+  }
+
+  sfree (memcached_pollfds);
+  sfree (memcached_polled);
+  memcached_pollfds_size = 0;
+
+  return (0);
+} /* int memcached_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("memcached", memcached_config);
   plugin_register_init ("memcached", memcached_init);
+  plugin_register_shutdown ("memcached", memcached_shutdown);
 }
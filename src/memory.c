@@ -26,6 +26,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #ifdef HAVE_SYS_SYSCTL_H
 # include <sys/sysctl.h>
@@ -282,7 +283,8 @@ static int memory_read_internal (value_list_t *vl)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
+	procfs_snapshot_t *snap;
+	size_t offset = 0;
 	char buffer[1024];
 
 	char *fields[8];
@@ -299,15 +301,15 @@ static int memory_read_internal (value_list_t *vl)
 	gauge_t mem_slab_reclaimable = 0;
 	gauge_t mem_slab_unreclaimable = 0;
 
-	if ((fh = fopen ("/proc/meminfo", "r")) == NULL)
+	if ((snap = procfs_snapshot_get ("/proc/meminfo")) == NULL)
 	{
 		char errbuf[1024];
-		WARNING ("memory: fopen: %s",
+		WARNING ("memory: Reading /proc/meminfo failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while (procfs_getline (snap, &offset, buffer, sizeof (buffer)) != NULL)
 	{
 		gauge_t *val = NULL;
 
@@ -339,12 +341,7 @@ static int memory_read_internal (value_list_t *vl)
 		*val = 1024.0 * atof (fields[1]);
 	}
 
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("memory: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	procfs_snapshot_put (snap);
 
 	if (mem_total < (mem_free + mem_buffered + mem_cached + mem_slab_total))
 		return (-1);
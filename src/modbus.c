@@ -96,6 +96,24 @@ enum mb_conntype_e /* {{{ */
 }; /* }}} */
 typedef enum mb_conntype_e mb_conntype_t;
 
+/* The largest number of registers a single read request may ask for. */
+#define MB_MAX_REGISTERS 125
+
+/* A range of registers of one slave which is read with one request. Data
+ * blocks addressing adjacent or overlapping registers share a block. */
+struct mb_block_s;
+typedef struct mb_block_s mb_block_t;
+struct mb_block_s /* {{{ */
+{
+  mb_mreg_type_t modbus_register_type;
+  int register_base;
+  int registers_num;
+  uint16_t values[MB_MAX_REGISTERS];
+  _Bool valid;
+
+  mb_block_t *next;
+}; /* }}} */
+
 struct mb_data_s;
 typedef struct mb_data_s mb_data_t;
 struct mb_data_s /* {{{ */
@@ -106,6 +124,7 @@ struct mb_data_s /* {{{ */
   mb_mreg_type_t modbus_register_type;
   char type[DATA_MAX_NAME_LEN];
   char instance[DATA_MAX_NAME_LEN];
+  mb_block_t *block;
 
   mb_data_t *next;
 }; /* }}} */
@@ -115,6 +134,7 @@ struct mb_slave_s /* {{{ */
   int id;
   char instance[DATA_MAX_NAME_LEN];
   mb_data_t *collect;
+  mb_block_t *blocks;
 }; /* }}} */
 typedef struct mb_slave_s mb_slave_t;
 
@@ -211,6 +231,7 @@ static int data_copy (mb_data_t **dst, const mb_data_t *src) /* {{{ */
   memcpy (tmp, src, sizeof (*tmp));
   tmp->name = NULL;
   tmp->next = NULL;
+  tmp->block = NULL;
 
   tmp->name = strdup (src->name);
   if (tmp->name == NULL)
@@ -247,6 +268,113 @@ static int data_copy_by_name (mb_data_t **dst, mb_data_t *src, /* {{{ */
   return (data_copy (dst, ptr));
 } /* }}} int data_copy_by_name */
 
+static int data_registers_num (const mb_data_t *data) /* {{{ */
+{
+  if ((data->register_type == REG_TYPE_INT32)
+      || (data->register_type == REG_TYPE_UINT32)
+      || (data->register_type == REG_TYPE_FLOAT))
+    return (2);
+  return (1);
+} /* }}} int data_registers_num */
+
+static int data_compare_registers (const void *a, const void *b) /* {{{ */
+{
+  const mb_data_t *d0 = *((mb_data_t * const *) a);
+  const mb_data_t *d1 = *((mb_data_t * const *) b);
+
+  if (d0->modbus_register_type != d1->modbus_register_type)
+    return ((d0->modbus_register_type < d1->modbus_register_type) ? -1 : 1);
+  if (d0->register_base != d1->register_base)
+    return ((d0->register_base < d1->register_base) ? -1 : 1);
+  return (data_registers_num (d1) - data_registers_num (d0));
+} /* }}} int data_compare_registers */
+
+static void blocks_free_all (mb_block_t *block) /* {{{ */
+{
+  while (block != NULL)
+  {
+    mb_block_t *next = block->next;
+    sfree (block);
+    block = next;
+  }
+} /* }}} void blocks_free_all */
+
+/* Groups the data of a slave into as few read requests as possible: sorted
+ * by address, each data block is added to the previous request if its
+ * registers are adjacent to or overlap with it and the request stays within
+ * MB_MAX_REGISTERS. Registers not used by any data block are never read. */
+static int slave_build_blocks (mb_slave_t *slave) /* {{{ */
+{
+  mb_data_t **sorted;
+  mb_data_t *data;
+  mb_block_t *block = NULL;
+  mb_block_t **tail;
+  size_t sorted_num = 0;
+  size_t blocks_num = 0;
+  size_t i;
+
+  for (data = slave->collect; data != NULL; data = data->next)
+    sorted_num++;
+  if (sorted_num == 0)
+    return (0);
+
+  sorted = calloc (sorted_num, sizeof (*sorted));
+  if (sorted == NULL)
+    return (ENOMEM);
+
+  i = 0;
+  for (data = slave->collect; data != NULL; data = data->next)
+    sorted[i++] = data;
+  qsort (sorted, sorted_num, sizeof (*sorted), data_compare_registers);
+
+  blocks_free_all (slave->blocks);
+  slave->blocks = NULL;
+  tail = &slave->blocks;
+
+  for (i = 0; i < sorted_num; i++)
+  {
+    int begin;
+    int end;
+
+    data = sorted[i];
+    begin = data->register_base;
+    end = begin + data_registers_num (data);
+
+    if ((block != NULL)
+        && (block->modbus_register_type == data->modbus_register_type)
+        && (begin <= block->register_base + block->registers_num)
+        && (end - block->register_base <= MB_MAX_REGISTERS))
+    {
+      if (end > block->register_base + block->registers_num)
+        block->registers_num = end - block->register_base;
+    }
+    else
+    {
+      block = calloc (1, sizeof (*block));
+      if (block == NULL)
+      {
+        sfree (sorted);
+        return (ENOMEM);
+      }
+      block->modbus_register_type = data->modbus_register_type;
+      block->register_base = begin;
+      block->registers_num = end - begin;
+
+      *tail = block;
+      tail = &block->next;
+      blocks_num++;
+    }
+
+    data->block = block;
+  }
+
+  DEBUG ("Modbus plugin: Slave %i: Reading %zu data blocks with %zu requests.",
+      slave->id, sorted_num, blocks_num);
+
+  sfree (sorted);
+  return (0);
+} /* }}} int slave_build_blocks */
+
 /* Read functions */
 
 static int mb_submit (mb_host_t *host, mb_slave_t *slave, /* {{{ */
@@ -424,48 +552,22 @@ static int mb_init_connection (mb_host_t *host) /* {{{ */
     (vt).absolute = (absolute_t) (raw); \
 } while (0)
 
-static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
-    mb_data_t *data)
+static void mb_close_connection (mb_host_t *host) /* {{{ */
 {
-  uint16_t values[2];
-  int values_num;
-  const data_set_t *ds;
-  int status = 0;
-
-  if ((host == NULL) || (slave == NULL) || (data == NULL))
-    return (EINVAL);
-
-  ds = plugin_get_ds (data->type);
-  if (ds == NULL)
-  {
-    ERROR ("Modbus plugin: Type \"%s\" is not defined.", data->type);
-    return (-1);
-  }
-
-  if (ds->ds_num != 1)
-  {
-    ERROR ("Modbus plugin: The type \"%s\" has %zu data sources. "
-        "I can only handle data sets with only one data source.",
-        data->type, ds->ds_num);
-    return (-1);
-  }
-
-  if ((ds->ds[0].type != DS_TYPE_GAUGE)
-      && (data->register_type != REG_TYPE_INT32)
-      && (data->register_type != REG_TYPE_UINT32))
-  {
-    NOTICE ("Modbus plugin: The data source of type \"%s\" is %s, not gauge. "
-        "This will most likely result in problems, because the register type "
-        "is not UINT32.", data->type, DS_TYPE_TO_STRING (ds->ds[0].type));
-  }
+#if LEGACY_LIBMODBUS
+  modbus_close (&host->connection);
+#else
+  modbus_close (host->connection);
+  modbus_free (host->connection);
+#endif
+  host->connection = NULL;
+} /* }}} void mb_close_connection */
 
-  memset (values, 0, sizeof (values));
-  if ((data->register_type == REG_TYPE_INT32)
-      || (data->register_type == REG_TYPE_UINT32)
-      || (data->register_type == REG_TYPE_FLOAT))
-    values_num = 2;
-  else
-    values_num = 1;
+/* Makes sure the host is connected, reconnecting if the connection has been
+ * closed or the TCP peer went away. */
+static int mb_check_connection (mb_host_t *host) /* {{{ */
+{
+  int status = 0;
 
   if (host->connection == NULL)
   {
@@ -482,70 +584,111 @@ static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
       status = errno;
   }
 
-  if ((status == EBADF) || (status == ENOTSOCK) || (status == ENOTCONN))
-  {
-    status = mb_init_connection (host);
-    if (status != 0)
-    {
-      ERROR ("Modbus plugin: mb_init_connection (%s/%s) failed. ",
-          host->host, host->node);
-      host->is_connected = 0;
-      host->connection = NULL;
-      return (-1);
-    }
-  }
-  else if (status != 0)
+  if (status == 0)
+    return (0);
+
+  /* The peer went away: drop the stale context before connecting again. */
+  if (host->connection != NULL)
+    mb_close_connection (host);
+
+  status = mb_init_connection (host);
+  if (status != 0)
   {
-#if LEGACY_LIBMODBUS
-    modbus_close (&host->connection);
-#else
-    modbus_close (host->connection);
-    modbus_free (host->connection);
-#endif
+    ERROR ("Modbus plugin: mb_init_connection (%s/%s) failed. ",
+        host->host, host->node);
+    host->is_connected = 0;
+    host->connection = NULL;
+    return (-1);
   }
 
+  return (0);
+} /* }}} int mb_check_connection */
+
+/* Reads all registers of one block with a single request. */
+static int mb_read_block (mb_host_t *host, mb_slave_t *slave, /* {{{ */
+    mb_block_t *block)
+{
+  int status;
+
+  block->valid = 0;
+
 #if LEGACY_LIBMODBUS
   /* Version 2.0.3: Pass the connection struct as a pointer and pass the slave
    * id to each call of "read_holding_registers". */
 # define modbus_read_registers(ctx, addr, nb, dest) \
   read_holding_registers (&(ctx), slave->id, (addr), (nb), (dest))
-#else /* if !LEGACY_LIBMODBUS */
-  /* Version 2.9.2: Set the slave id once before querying the registers. */
-  status = modbus_set_slave (host->connection, slave->id);
-  if (status != 0)
-  {
-    ERROR ("Modbus plugin: modbus_set_slave (%i) failed with status %i.",
-        slave->id, status);
-    return (-1);
-  }
 #endif
-  if (data->modbus_register_type == MREG_INPUT){
+  if (block->modbus_register_type == MREG_INPUT){
     status = modbus_read_input_registers (host->connection,
-        /* start_addr = */ data->register_base,
-        /* num_registers = */ values_num, /* buffer = */ values);
+        /* start_addr = */ block->register_base,
+        /* num_registers = */ block->registers_num,
+        /* buffer = */ block->values);
   }
   else{
     status = modbus_read_registers (host->connection,
-        /* start_addr = */ data->register_base,
-        /* num_registers = */ values_num, /* buffer = */ values);
+        /* start_addr = */ block->register_base,
+        /* num_registers = */ block->registers_num,
+        /* buffer = */ block->values);
   }
-  if (status != values_num)
-  {
-    ERROR ("Modbus plugin: modbus read function (%s/%s) failed. "
-           " status = %i, values_num = %i. Giving up.",
-           host->host, host->node, status, values_num);
 #if LEGACY_LIBMODBUS
-    modbus_close (&host->connection);
-#else
-    modbus_close (host->connection);
-    modbus_free (host->connection);
+# undef modbus_read_registers
 #endif
-    host->connection = NULL;
+  if (status != block->registers_num)
+  {
+    ERROR ("Modbus plugin: modbus read function (%s/%s) failed. "
+           " status = %i, registers_num = %i. Giving up.",
+           host->host, host->node, status, block->registers_num);
+    mb_close_connection (host);
+    return (-1);
+  }
+
+  DEBUG ("Modbus plugin: mb_read_block: Success! "
+      "Read %i registers starting at %i.",
+      block->registers_num, block->register_base);
+
+  block->valid = 1;
+  return (0);
+} /* }}} int mb_read_block */
+
+/* Decodes a data item from the registers of its block and dispatches it. */
+static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
+    mb_data_t *data)
+{
+  const uint16_t *values;
+  const data_set_t *ds;
+
+  if ((host == NULL) || (slave == NULL) || (data == NULL))
+    return (EINVAL);
+
+  if ((data->block == NULL) || !data->block->valid)
+    return (-1);
+
+  ds = plugin_get_ds (data->type);
+  if (ds == NULL)
+  {
+    ERROR ("Modbus plugin: Type \"%s\" is not defined.", data->type);
+    return (-1);
+  }
+
+  if (ds->ds_num != 1)
+  {
+    ERROR ("Modbus plugin: The type \"%s\" has %zu data sources. "
+        "I can only handle data sets with only one data source.",
+        data->type, ds->ds_num);
     return (-1);
   }
 
-  DEBUG ("Modbus plugin: mb_read_data: Success! "
-      "modbus_read_registers returned with status %i.", status);
+  if ((ds->ds[0].type != DS_TYPE_GAUGE)
+      && (data->register_type != REG_TYPE_INT32)
+      && (data->register_type != REG_TYPE_UINT32))
+  {
+    NOTICE ("Modbus plugin: The data source of type \"%s\" is %s, not gauge. "
+        "This will most likely result in problems, because the register type "
+        "is not UINT32.", data->type, DS_TYPE_TO_STRING (ds->ds[0].type));
+  }
+
+  values = data->block->values
+    + (data->register_base - data->block->register_base);
 
   if (data->register_type == REG_TYPE_FLOAT)
   {
@@ -622,6 +765,7 @@ static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
 
 static int mb_read_slave (mb_host_t *host, mb_slave_t *slave) /* {{{ */
 {
+  mb_block_t *block;
   mb_data_t *data;
   int success;
   int status;
@@ -629,6 +773,33 @@ static int mb_read_slave (mb_host_t *host, mb_slave_t *slave) /* {{{ */
   if ((host == NULL) || (slave == NULL))
     return (EINVAL);
 
+  for (block = slave->blocks; block != NULL; block = block->next)
+    block->valid = 0;
+
+  status = mb_check_connection (host);
+  if (status != 0)
+    return (-1);
+
+#if !LEGACY_LIBMODBUS
+  /* Version 2.9.2: Set the slave id once before querying the registers. */
+  status = modbus_set_slave (host->connection, slave->id);
+  if (status != 0)
+  {
+    ERROR ("Modbus plugin: modbus_set_slave (%i) failed with status %i.",
+        slave->id, status);
+    return (-1);
+  }
+#endif
+
+  /* A failed read closes the connection, so the remaining blocks of this
+   * slave are skipped. The next slave will reconnect. */
+  for (block = slave->blocks; block != NULL; block = block->next)
+  {
+    status = mb_read_block (host, slave, block);
+    if (status != 0)
+      break;
+  }
+
   success = 0;
   for (data = slave->collect; data != NULL; data = data->next)
   {
@@ -701,7 +872,10 @@ static void slaves_free_all (mb_slave_t *slaves, size_t slaves_num) /* {{{ */
     return;
 
   for (i = 0; i < slaves_num; i++)
+  {
     data_free_all (slaves[i].collect);
+    blocks_free_all (slaves[i].blocks);
+  }
   sfree (slaves);
 } /* }}} void slaves_free_all */
 
@@ -888,6 +1062,7 @@ static int mb_config_add_slave (mb_host_t *host, oconfig_item_t *ci) /* {{{ */
   slave = host->slaves + host->slaves_num;
   memset (slave, 0, sizeof (*slave));
   slave->collect = NULL;
+  slave->blocks = NULL;
 
   status = cf_util_get_int (ci, &slave->id);
   if (status != 0)
@@ -924,10 +1099,16 @@ static int mb_config_add_slave (mb_host_t *host, oconfig_item_t *ci) /* {{{ */
   if (slave->id < 0)
     status = EINVAL;
 
+  if (status == 0)
+    status = slave_build_blocks (slave);
+
   if (status == 0)
     host->slaves_num++;
   else /* if (status != 0) */
+  {
     data_free_all (slave->collect);
+    blocks_free_all (slave->blocks);
+  }
 
   return (status);
 } /* }}} int mb_config_add_slave */
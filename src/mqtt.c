@@ -35,6 +35,7 @@
 #include "plugin.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
+#include "utils_intern.h"
 
 #include <pthread.h>
 
@@ -46,6 +47,7 @@
 #define MQTT_DEFAULT_PORT           1883
 #define MQTT_DEFAULT_TOPIC_PREFIX   "collectd"
 #define MQTT_DEFAULT_TOPIC          "collectd/#"
+#define MQTT_DEFAULT_TOPIC_CACHE_SIZE 16384
 #ifndef MQTT_KEEPALIVE
 # define MQTT_KEEPALIVE 60
 #endif
@@ -57,6 +59,36 @@
 /*
  * Data types
  */
+/* Cache of the identifiers parsed from the topics of received messages, so
+ * that each topic is only parsed once. The least recently used topic is
+ * evicted when the cache is full. Each subscriber connection has its own
+ * cache, which is only used by its thread. */
+struct mqtt_topic_entry_s;
+typedef struct mqtt_topic_entry_s mqtt_topic_entry_t;
+struct mqtt_topic_entry_s
+{
+    char               *topic;
+    uint32_t            hash;
+    identifier_t        id;
+
+    mqtt_topic_entry_t *hash_next;
+    mqtt_topic_entry_t *lru_prev;
+    mqtt_topic_entry_t *lru_next;
+};
+
+struct mqtt_topic_cache_s
+{
+    mqtt_topic_entry_t **buckets;
+    size_t              buckets_num;
+    size_t              entries_num;
+    size_t              entries_max;
+
+    /* Most recently used first. */
+    mqtt_topic_entry_t *lru_head;
+    mqtt_topic_entry_t *lru_tail;
+};
+typedef struct mqtt_topic_cache_s mqtt_topic_cache_t;
+
 struct mqtt_client_conf
 {
     _Bool               publish;
@@ -81,12 +113,19 @@ struct mqtt_client_conf
     char               *topic_prefix;
     _Bool               store_rates;
     _Bool               retain;
+    /* Set if the network loop runs in a thread of libmosquitto, which also
+     * reconnects, so that publishing only queues messages. */
+    _Bool               loop_started;
 
     /* For subscribing */
     pthread_t           thread;
     _Bool               loop;
     char               *topic;
     _Bool               clean_session;
+    char               *shared_group;
+    int                 connections;
+    size_t              topic_cache_size;
+    mqtt_topic_cache_t *topic_cache;
 
     c_complain_t        complaint_cantpublish;
     pthread_mutex_t     lock;
@@ -127,21 +166,181 @@ static char const *mosquitto_strerror (int code)
 /* provided by libmosquitto */
 #endif
 
-static void mqtt_free (mqtt_client_conf_t *conf)
+static mqtt_topic_cache_t *topic_cache_create (size_t max_entries)
+{
+    mqtt_topic_cache_t *cache;
+
+    if (max_entries == 0)
+        return (NULL);
+
+    cache = calloc (1, sizeof (*cache));
+    if (cache == NULL)
+        return (NULL);
+
+    /* A power of two, so the bucket is a mask of the hash. */
+    cache->buckets_num = 1;
+    while (cache->buckets_num < max_entries)
+        cache->buckets_num *= 2;
+
+    cache->buckets = calloc (cache->buckets_num, sizeof (*cache->buckets));
+    if (cache->buckets == NULL)
+    {
+        sfree (cache);
+        return (NULL);
+    }
+    cache->entries_max = max_entries;
+
+    return (cache);
+} /* mqtt_topic_cache_t *topic_cache_create */
+
+static void topic_entry_free (mqtt_topic_entry_t *e)
+{
+    if (e == NULL)
+        return;
+
+    identifier_destroy (&e->id);
+    sfree (e->topic);
+    sfree (e);
+} /* void topic_entry_free */
+
+static void topic_cache_unlink (mqtt_topic_cache_t *cache,
+        mqtt_topic_entry_t *e)
+{
+    mqtt_topic_entry_t **ptr;
+
+    for (ptr = cache->buckets + (e->hash & (cache->buckets_num - 1));
+            *ptr != e; ptr = &(*ptr)->hash_next)
+        assert (*ptr != NULL);
+    *ptr = e->hash_next;
+
+    if (e->lru_prev != NULL)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->lru_head = e->lru_next;
+    if (e->lru_next != NULL)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+
+    cache->entries_num--;
+} /* void topic_cache_unlink */
+
+static void topic_cache_destroy (mqtt_topic_cache_t *cache)
+{
+    if (cache == NULL)
+        return;
+
+    while (cache->lru_head != NULL)
+    {
+        mqtt_topic_entry_t *e = cache->lru_head;
+
+        topic_cache_unlink (cache, e);
+        topic_entry_free (e);
+    }
+
+    sfree (cache->buckets);
+    sfree (cache);
+} /* void topic_cache_destroy */
+
+static mqtt_topic_entry_t *topic_cache_get (mqtt_topic_cache_t *cache,
+        char const *topic, uint32_t hash)
+{
+    mqtt_topic_entry_t *e;
+
+    for (e = cache->buckets[hash & (cache->buckets_num - 1)];
+            e != NULL; e = e->hash_next)
+        if ((e->hash == hash) && (strcmp (e->topic, topic) == 0))
+            break;
+
+    if ((e == NULL) || (e->lru_prev == NULL))
+        return (e);
+
+    /* Move to the front of the LRU list. */
+    e->lru_prev->lru_next = e->lru_next;
+    if (e->lru_next != NULL)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    cache->lru_head->lru_prev = e;
+    cache->lru_head = e;
+
+    return (e);
+} /* mqtt_topic_entry_t *topic_cache_get */
+
+/* Remembers the identifier parsed from "topic", evicting the least recently
+ * used topic if the cache is full. Errors are ignored, the topic is simply
+ * parsed again next time. */
+static void topic_cache_add (mqtt_topic_cache_t *cache,
+        char const *topic, uint32_t hash, value_list_t const *vl)
+{
+    mqtt_topic_entry_t *e;
+    size_t bucket = hash & (cache->buckets_num - 1);
+
+    e = calloc (1, sizeof (*e));
+    if (e == NULL)
+        return;
+    e->topic = strdup (topic);
+    if ((e->topic == NULL) || (identifier_create (&e->id, vl) != 0))
+    {
+        sfree (e->topic);
+        sfree (e);
+        return;
+    }
+    e->hash = hash;
+
+    if (cache->entries_num >= cache->entries_max)
+    {
+        mqtt_topic_entry_t *oldest = cache->lru_tail;
+
+        topic_cache_unlink (cache, oldest);
+        topic_entry_free (oldest);
+    }
+
+    e->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = e;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL)
+        cache->lru_head->lru_prev = e;
+    else
+        cache->lru_tail = e;
+    cache->lru_head = e;
+    cache->entries_num++;
+} /* void topic_cache_add */
+
+static void mqtt_free (void *arg)
 {
+    mqtt_client_conf_t *conf = arg;
+
     if (conf == NULL)
         return;
 
-    if (conf->connected)
+    if (conf->connected || conf->loop_started)
         (void) mosquitto_disconnect (conf->mosq);
     conf->connected = 0;
+#if LIBMOSQUITTO_MAJOR != 0
+    if (conf->loop_started)
+        (void) mosquitto_loop_stop (conf->mosq, /* force = */ false);
+    conf->loop_started = 0;
+#endif
     (void) mosquitto_destroy (conf->mosq);
 
+    sfree (conf->name);
     sfree (conf->host);
     sfree (conf->username);
     sfree (conf->password);
     sfree (conf->client_id);
+    sfree (conf->cacertificatefile);
+    sfree (conf->certificatefile);
+    sfree (conf->certificatekeyfile);
+    sfree (conf->tlsprotocol);
+    sfree (conf->ciphersuite);
     sfree (conf->topic_prefix);
+    sfree (conf->topic);
+    sfree (conf->shared_group);
+    topic_cache_destroy (conf->topic_cache);
     sfree (conf);
 }
 
@@ -170,18 +369,59 @@ static char *strip_prefix (char *topic)
     return (topic);
 }
 
+/* Parses the identifier from the last three levels of "topic", taking it
+ * from the topic cache if possible. */
+static int topic_to_vl (mqtt_client_conf_t *conf, char const *topic,
+        value_list_t *vl)
+{
+    char buffer[MQTT_MAX_TOPIC_SIZE];
+    char *name;
+    uint32_t hash = 0;
+    int status;
+
+    if (conf->topic_cache != NULL)
+    {
+        mqtt_topic_entry_t *e;
+
+        hash = identifier_hash_name (topic);
+        e = topic_cache_get (conf->topic_cache, topic, hash);
+        if (e != NULL)
+        {
+            identifier_to_vl (&e->id, vl);
+            return (0);
+        }
+    }
+
+    if (strlen (topic) >= sizeof (buffer))
+        return (ENAMETOOLONG);
+    sstrncpy (buffer, topic, sizeof (buffer));
+
+    name = strip_prefix (buffer);
+    if (name == NULL)
+        return (EINVAL);
+
+    status = parse_identifier_vl (name, vl);
+    if (status != 0)
+        return (status);
+
+    if (conf->topic_cache != NULL)
+        topic_cache_add (conf->topic_cache, topic, hash, vl);
+
+    return (0);
+} /* int topic_to_vl */
+
 static void on_message (
 #if LIBMOSQUITTO_MAJOR == 0
 #else
         __attribute__((unused)) struct mosquitto *m,
 #endif
-        __attribute__((unused)) void *arg,
+        void *arg,
         const struct mosquitto_message *msg)
 {
+    mqtt_client_conf_t *conf = arg;
     value_list_t vl = VALUE_LIST_INIT;
     data_set_t const *ds;
-    char *topic;
-    char *name;
+    char buffer[MQTT_MAX_MESSAGE_SIZE];
     char *payload;
     int status;
 
@@ -190,17 +430,12 @@ static void on_message (
         return;
     }
 
-    topic = strdup (msg->topic);
-    name = strip_prefix (topic);
-
-    status = parse_identifier_vl (name, &vl);
+    status = topic_to_vl (conf, msg->topic, &vl);
     if (status != 0)
     {
-        ERROR ("mqtt plugin: Unable to parse topic \"%s\".", topic);
-        sfree (topic);
+        ERROR ("mqtt plugin: Unable to parse topic \"%s\".", msg->topic);
         return;
     }
-    sfree (topic);
 
     ds = plugin_get_ds (vl.type);
     if (ds == NULL)
@@ -209,20 +444,23 @@ static void on_message (
         return;
     }
 
-    vl.values = calloc (ds->ds_num, sizeof (*vl.values));
-    if (vl.values == NULL)
-    {
-        ERROR ("mqtt plugin: calloc failed.");
-        return;
-    }
+    value_t values[ds->ds_num];
+    memset (values, 0, sizeof (values));
+    vl.values = values;
     vl.values_len = ds->ds_num;
 
-    payload = malloc (msg->payloadlen+1);
-    if (payload == NULL)
+    /* Payloads are short, so they are only copied to the heap if they
+     * don't fit on the stack. */
+    if ((size_t) msg->payloadlen < sizeof (buffer))
+        payload = buffer;
+    else
     {
-        ERROR ("mqtt plugin: malloc for payload buffer failed.");
-        sfree (vl.values);
-        return;
+        payload = malloc (msg->payloadlen+1);
+        if (payload == NULL)
+        {
+            ERROR ("mqtt plugin: malloc for payload buffer failed.");
+            return;
+        }
     }
     memmove (payload, msg->payload, msg->payloadlen);
     payload[msg->payloadlen] = 0;
@@ -230,16 +468,13 @@ static void on_message (
     DEBUG ("mqtt plugin: payload = \"%s\"", payload);
     status = parse_values (payload, &vl, ds);
     if (status != 0)
-    {
         ERROR ("mqtt plugin: Unable to parse payload \"%s\".", payload);
+    if (payload != buffer)
         sfree (payload);
-        sfree (vl.values);
+    if (status != 0)
         return;
-    }
-    sfree (payload);
 
     plugin_dispatch_values (&vl);
-    sfree (vl.values);
 } /* void on_message */
 
 /* must hold conf->lock when calling. */
@@ -277,7 +512,10 @@ static int mqtt_connect (mqtt_client_conf_t *conf)
     char const *client_id;
     int status;
 
-    if (conf->mosq != NULL)
+    /* The network thread reconnects on its own. */
+    if ((conf->mosq != NULL) && conf->loop_started)
+        return (0);
+    else if (conf->mosq != NULL)
         return mqtt_reconnect (conf);
 
     if (conf->client_id)
@@ -381,6 +619,22 @@ static int mqtt_connect (mqtt_client_conf_t *conf)
     }
 
     conf->connected = 1;
+
+#if LIBMOSQUITTO_MAJOR != 0
+    /* Let a thread of libmosquitto send the messages, so that write threads
+     * only queue them and never wait for the broker. */
+    if (conf->publish)
+    {
+        status = mosquitto_loop_start (conf->mosq);
+        if (status == MOSQ_ERR_SUCCESS)
+            conf->loop_started = 1;
+        else
+            WARNING ("mqtt plugin: mosquitto_loop_start failed: %s. "
+                    "Messages will be sent by the write threads.",
+                    mosquitto_strerror (status));
+    }
+#endif
+
     return (0);
 } /* mqtt_connect */
 
@@ -430,16 +684,14 @@ static void *subscribers_thread (void *arg)
     pthread_exit (0);
 } /* void *subscribers_thread */
 
-static int publish (mqtt_client_conf_t *conf, char const *topic,
+/* must hold conf->lock when calling. */
+static int publish_locked (mqtt_client_conf_t *conf, char const *topic,
     void const *payload, size_t payload_len)
 {
     int status;
 
-    pthread_mutex_lock (&conf->lock);
-
     status = mqtt_connect (conf);
     if (status != 0) {
-        pthread_mutex_unlock (&conf->lock);
         ERROR ("mqtt plugin: unable to reconnect to broker");
         return (status);
     }
@@ -462,16 +714,21 @@ static int publish (mqtt_client_conf_t *conf, char const *topic,
             : mosquitto_strerror(status));
         /* Mark our connection "down" regardless of the error as a safety
          * measure; we will try to reconnect the next time we have to publish a
-         * message */
-        conf->connected = 0;
+         * message. With the network thread, it reconnects by itself. */
+        if (!conf->loop_started)
+            conf->connected = 0;
 
-        pthread_mutex_unlock (&conf->lock);
         return (-1);
     }
 
-    pthread_mutex_unlock (&conf->lock);
+    if (conf->loop_started)
+        c_release (LOG_INFO,
+                &conf->complaint_cantpublish,
+                "mqtt plugin: successfully published to broker \"%s:%d\" again",
+                conf->host, conf->port);
+
     return (0);
-} /* int publish */
+} /* int publish_locked */
 
 static int format_topic (char *buf, size_t buf_len,
     data_set_t const *ds, value_list_t const *vl,
@@ -494,41 +751,128 @@ static int format_topic (char *buf, size_t buf_len,
     return (0);
 } /* int format_topic */
 
-static int mqtt_write (const data_set_t *ds, const value_list_t *vl,
+/* A formatted message of a batch: offsets into the buffer of the batch. */
+struct mqtt_message_s
+{
+    size_t topic;
+    size_t payload;
+    size_t payload_len;
+};
+typedef struct mqtt_message_s mqtt_message_t;
+
+/* Appends "str" including its null byte to the buffer of the batch. */
+static int batch_append (char **data, size_t *data_size, size_t *data_fill,
+    char const *str, size_t *ret_offset)
+{
+    size_t len = strlen (str) + 1;
+
+    if ((*data_size - *data_fill) < len)
+    {
+        size_t size = (*data_size > 0) ? *data_size : 4096;
+        char *tmp;
+
+        while ((size - *data_fill) < len)
+            size *= 2;
+
+        tmp = realloc (*data, size);
+        if (tmp == NULL)
+            return (ENOMEM);
+        *data = tmp;
+        *data_size = size;
+    }
+
+    memcpy (*data + *data_fill, str, len);
+    *ret_offset = *data_fill;
+    *data_fill += len;
+    return (0);
+} /* int batch_append */
+
+/* Formats all value lists of the batch first and then publishes them while
+ * holding the lock once. */
+static int mqtt_write (const write_batch_entry_t *entries, size_t entries_num,
     user_data_t *user_data)
 {
     mqtt_client_conf_t *conf;
-    char topic[MQTT_MAX_TOPIC_SIZE];
-    char payload[MQTT_MAX_MESSAGE_SIZE];
-    int status = 0;
+    mqtt_message_t *messages;
+    size_t messages_num = 0;
+    char *data = NULL;
+    size_t data_size = 0;
+    size_t data_fill = 0;
+    size_t failed = 0;
+    size_t i;
 
     if ((user_data == NULL) || (user_data->data == NULL))
         return (EINVAL);
     conf = user_data->data;
 
-    status = format_topic (topic, sizeof (topic), ds, vl, conf);
-    if (status != 0)
+    messages = calloc (entries_num, sizeof (*messages));
+    if (messages == NULL)
     {
-        ERROR ("mqtt plugin: format_topic failed with status %d.", status);
-        return (status);
+        ERROR ("mqtt plugin: calloc failed.");
+        return (ENOMEM);
     }
 
-    status = format_values (payload, sizeof (payload),
-            ds, vl, conf->store_rates);
-    if (status != 0)
+    for (i = 0; i < entries_num; i++)
     {
-        ERROR ("mqtt plugin: format_values failed with status %d.", status);
-        return (status);
+        mqtt_message_t *m = messages + messages_num;
+        char topic[MQTT_MAX_TOPIC_SIZE];
+        char payload[MQTT_MAX_MESSAGE_SIZE];
+        int status;
+
+        status = format_topic (topic, sizeof (topic),
+                entries[i].ds, entries[i].vl, conf);
+        if (status != 0)
+        {
+            ERROR ("mqtt plugin: format_topic failed with status %d.", status);
+            failed++;
+            continue;
+        }
+
+        status = format_values (payload, sizeof (payload),
+                entries[i].ds, entries[i].vl, conf->store_rates);
+        if (status != 0)
+        {
+            ERROR ("mqtt plugin: format_values failed with status %d.", status);
+            failed++;
+            continue;
+        }
+
+        if ((batch_append (&data, &data_size, &data_fill,
+                        topic, &m->topic) != 0)
+                || (batch_append (&data, &data_size, &data_fill,
+                        payload, &m->payload) != 0))
+        {
+            ERROR ("mqtt plugin: realloc failed.");
+            failed++;
+            continue;
+        }
+        m->payload_len = strlen (payload) + 1;
+        messages_num++;
     }
 
-    status = publish (conf, topic, payload, strlen (payload) + 1);
-    if (status != 0)
+    pthread_mutex_lock (&conf->lock);
+    for (i = 0; i < messages_num; i++)
     {
-        ERROR ("mqtt plugin: publish failed: %s", mosquitto_strerror (status));
-        return (status);
+        int status = publish_locked (conf, data + messages[i].topic,
+                data + messages[i].payload, messages[i].payload_len);
+        if (status == 0)
+            continue;
+
+        /* publish_locked() has complained already. Without the network
+         * thread, don't try to reconnect for each remaining message. */
+        failed++;
+        if (!conf->loop_started && !conf->connected)
+        {
+            failed += messages_num - (i + 1);
+            break;
+        }
     }
+    pthread_mutex_unlock (&conf->lock);
 
-    return (status);
+    sfree (data);
+    sfree (messages);
+
+    return ((failed == 0) ? 0 : -1);
 } /* mqtt_write */
 
 /*
@@ -639,8 +983,9 @@ static int mqtt_config_publisher (oconfig_item_t *ci)
     ssnprintf (cb_name, sizeof (cb_name), "mqtt/%s", conf->name);
     memset (&user_data, 0, sizeof (user_data));
     user_data.data = conf;
+    user_data.free_func = mqtt_free;
 
-    plugin_register_write (cb_name, mqtt_write, &user_data);
+    plugin_register_write_batch (cb_name, mqtt_write, &user_data);
     return (0);
 } /* mqtt_config_publisher */
 
@@ -652,11 +997,90 @@ static int mqtt_config_publisher (oconfig_item_t *ci)
  *   User "guest"
  *   Password "secret"
  *   Topic "collectd/#"
+ *   SharedSubscriptionGroup "collectd"
+ *   Connections 4
+ *   TopicCacheSize 16384
  * </Subscribe>
  */
-static int mqtt_config_subscriber (oconfig_item_t *ci)
+static int mqtt_subscriber_add (mqtt_client_conf_t *conf)
 {
     mqtt_client_conf_t **tmp;
+
+    if (conf->topic_cache_size > 0)
+    {
+        conf->topic_cache = topic_cache_create (conf->topic_cache_size);
+        if (conf->topic_cache == NULL)
+        {
+            ERROR ("mqtt plugin: topic_cache_create failed.");
+            mqtt_free (conf);
+            return (-1);
+        }
+    }
+
+    tmp = realloc (subscribers, sizeof (*subscribers) * (subscribers_num + 1) );
+    if (tmp == NULL)
+    {
+        ERROR ("mqtt plugin: realloc failed.");
+        mqtt_free (conf);
+        return (-1);
+    }
+    subscribers = tmp;
+    subscribers[subscribers_num] = conf;
+    subscribers_num++;
+
+    return (0);
+} /* mqtt_subscriber_add */
+
+/* Copies the configuration of a Subscribe block for connection number
+ * "index", which uses "<ClientId>-<index>" as its client ID. */
+static mqtt_client_conf_t *mqtt_subscriber_copy (mqtt_client_conf_t const *src,
+        int index)
+{
+    mqtt_client_conf_t *dst;
+    char client_id[1024];
+    _Bool failed = 0;
+
+    dst = calloc (1, sizeof (*dst));
+    if (dst == NULL)
+        return (NULL);
+
+    dst->publish = 0;
+    dst->port = src->port;
+    dst->qos = src->qos;
+    dst->clean_session = src->clean_session;
+    dst->topic_cache_size = src->topic_cache_size;
+    dst->connections = 1;
+    pthread_mutex_init (&dst->lock, NULL);
+    C_COMPLAIN_INIT (&dst->complaint_cantpublish);
+
+    ssnprintf (client_id, sizeof (client_id), "%s-%i",
+            (src->client_id != NULL) ? src->client_id : hostname_g, index);
+
+#define MQTT_COPY_STRING(f) do { \
+    if ((src->f != NULL) && ((dst->f = strdup (src->f)) == NULL)) \
+        failed = 1; \
+} while (0)
+    MQTT_COPY_STRING (name);
+    MQTT_COPY_STRING (host);
+    MQTT_COPY_STRING (username);
+    MQTT_COPY_STRING (password);
+    MQTT_COPY_STRING (topic);
+    MQTT_COPY_STRING (shared_group);
+#undef MQTT_COPY_STRING
+    if ((dst->client_id = strdup (client_id)) == NULL)
+        failed = 1;
+
+    if (failed)
+    {
+        mqtt_free (dst);
+        return (NULL);
+    }
+
+    return (dst);
+} /* mqtt_client_conf_t *mqtt_subscriber_copy */
+
+static int mqtt_config_subscriber (oconfig_item_t *ci)
+{
     mqtt_client_conf_t *conf;
     int status;
     int i;
@@ -683,6 +1107,8 @@ static int mqtt_config_subscriber (oconfig_item_t *ci)
     conf->qos = 2;
     conf->topic = strdup (MQTT_DEFAULT_TOPIC);
     conf->clean_session = 1;
+    conf->connections = 1;
+    conf->topic_cache_size = MQTT_DEFAULT_TOPIC_CACHE_SIZE;
 
     status = pthread_mutex_init (&conf->lock, NULL);
     if (status != 0)
@@ -725,22 +1151,70 @@ static int mqtt_config_subscriber (oconfig_item_t *ci)
             cf_util_get_string (child, &conf->topic);
         else if (strcasecmp ("CleanSession", child->key) == 0)
             cf_util_get_boolean (child, &conf->clean_session);
+        else if (strcasecmp ("SharedSubscriptionGroup", child->key) == 0)
+            cf_util_get_string (child, &conf->shared_group);
+        else if (strcasecmp ("Connections", child->key) == 0)
+        {
+            int tmp = -1;
+            status = cf_util_get_int (child, &tmp);
+            if ((status != 0) || (tmp < 1))
+                ERROR ("mqtt plugin: Not a valid number of connections.");
+            else
+                conf->connections = tmp;
+        }
+        else if (strcasecmp ("TopicCacheSize", child->key) == 0)
+        {
+            int tmp = -1;
+            status = cf_util_get_int (child, &tmp);
+            if ((status != 0) || (tmp < 0))
+                ERROR ("mqtt plugin: Not a valid topic cache size.");
+            else
+                conf->topic_cache_size = (size_t) tmp;
+        }
         else
             ERROR ("mqtt plugin: Unknown config option: %s", child->key);
     }
 
-    tmp = realloc (subscribers, sizeof (*subscribers) * (subscribers_num + 1) );
-    if (tmp == NULL)
+    /* The broker hands each message of a shared subscription to one client of
+     * the group, so several connections share the load. */
+    if (conf->shared_group != NULL)
     {
-        ERROR ("mqtt plugin: realloc failed.");
-        mqtt_free (conf);
-        return (-1);
+        char topic[MQTT_MAX_TOPIC_SIZE];
+
+        ssnprintf (topic, sizeof (topic), "$share/%s/%s",
+                conf->shared_group, conf->topic);
+        sfree (conf->topic);
+        conf->topic = strdup (topic);
+        if (conf->topic == NULL)
+        {
+            ERROR ("mqtt plugin: strdup failed.");
+            mqtt_free (conf);
+            return (-1);
+        }
+    }
+    else if (conf->connections > 1)
+    {
+        WARNING ("mqtt plugin: The \"Connections\" option requires the "
+                "\"SharedSubscriptionGroup\" option, otherwise each connection "
+                "would receive all messages. Only one connection will be used.");
+        conf->connections = 1;
     }
-    subscribers = tmp;
-    subscribers[subscribers_num] = conf;
-    subscribers_num++;
 
-    return (0);
+    for (i = 1; i < conf->connections; i++)
+    {
+        mqtt_client_conf_t *copy = mqtt_subscriber_copy (conf, i);
+        if (copy == NULL)
+        {
+            ERROR ("mqtt plugin: mqtt_subscriber_copy failed.");
+            break;
+        }
+
+        /* mqtt_subscriber_add() frees "copy" upon failure. */
+        if (mqtt_subscriber_add (copy) != 0)
+            break;
+    }
+
+    return (mqtt_subscriber_add (conf));
 } /* mqtt_config_subscriber */
 
 /*
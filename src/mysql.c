@@ -63,8 +63,283 @@ struct mysql_database_s /* {{{ */
 };
 typedef struct mysql_database_s mysql_database_t; /* }}} */
 
+/* Status variables that are aggregated before they are submitted. */
+enum mysql_slot_e
+{
+	SLOT_NONE = 0,
+	SLOT_QCACHE_HITS,
+	SLOT_QCACHE_INSERTS,
+	SLOT_QCACHE_NOT_CACHED,
+	SLOT_QCACHE_LOWMEM_PRUNES,
+	SLOT_QCACHE_QUERIES_IN_CACHE,
+	SLOT_BYTES_RECEIVED,
+	SLOT_BYTES_SENT,
+	SLOT_THREADS_RUNNING,
+	SLOT_THREADS_CONNECTED,
+	SLOT_THREADS_CACHED,
+	SLOT_THREADS_CREATED
+};
+
+struct mysql_metric_s /* {{{ */
+{
+	const char *name;
+	const char *type;
+	const char *type_instance;
+	int ds_type;
+	/* Only submitted if "InnodbStats" is enabled. */
+	_Bool innodb;
+	enum mysql_slot_e slot;
+};
+typedef struct mysql_metric_s mysql_metric_t; /* }}} */
+
+/* Status variables with a fixed name. Variables with one of the prefixes
+ * handled in mysql_read_status() are submitted without a lookup. */
+static const mysql_metric_t status_metrics[] = { /* {{{ */
+	{ "Qcache_hits",             NULL, NULL, 0, 0, SLOT_QCACHE_HITS },
+	{ "Qcache_inserts",          NULL, NULL, 0, 0, SLOT_QCACHE_INSERTS },
+	{ "Qcache_not_cached",       NULL, NULL, 0, 0, SLOT_QCACHE_NOT_CACHED },
+	{ "Qcache_lowmem_prunes",    NULL, NULL, 0, 0, SLOT_QCACHE_LOWMEM_PRUNES },
+	{ "Qcache_queries_in_cache", NULL, NULL, 0, 0, SLOT_QCACHE_QUERIES_IN_CACHE },
+	{ "Bytes_received",          NULL, NULL, 0, 0, SLOT_BYTES_RECEIVED },
+	{ "Bytes_sent",              NULL, NULL, 0, 0, SLOT_BYTES_SENT },
+	{ "Threads_running",         NULL, NULL, 0, 0, SLOT_THREADS_RUNNING },
+	{ "Threads_connected",       NULL, NULL, 0, 0, SLOT_THREADS_CONNECTED },
+	{ "Threads_cached",          NULL, NULL, 0, 0, SLOT_THREADS_CACHED },
+	{ "Threads_created",         NULL, NULL, 0, 0, SLOT_THREADS_CREATED },
+
+	/* buffer pool */
+	{ "Innodb_buffer_pool_pages_data",         "mysql_bpool_pages",    "data",               DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "Innodb_buffer_pool_pages_dirty",        "mysql_bpool_pages",    "dirty",              DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "Innodb_buffer_pool_pages_flushed",      "mysql_bpool_counters", "pages_flushed",      DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_buffer_pool_pages_free",         "mysql_bpool_pages",    "free",               DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "Innodb_buffer_pool_pages_misc",         "mysql_bpool_pages",    "misc",               DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "Innodb_buffer_pool_pages_total",        "mysql_bpool_pages",    "total",              DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "Innodb_buffer_pool_read_ahead_rnd",     "mysql_bpool_counters", "read_ahead_rnd",     DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_buffer_pool_read_ahead",         "mysql_bpool_counters", "read_ahead",         DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_buffer_pool_read_ahead_evicted", "mysql_bpool_counters", "read_ahead_evicted", DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_buffer_pool_read_requests",      "mysql_bpool_counters", "read_requests",      DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_buffer_pool_reads",              "mysql_bpool_counters", "reads",              DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_buffer_pool_write_requests",     "mysql_bpool_counters", "write_requests",     DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_buffer_pool_bytes_data",         "mysql_bpool_bytes",    "data",               DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "Innodb_buffer_pool_bytes_dirty",        "mysql_bpool_bytes",    "dirty",              DS_TYPE_GAUGE,  1, SLOT_NONE },
+
+	/* data */
+	{ "Innodb_data_fsyncs",                    "mysql_innodb_data",    "fsyncs",             DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_data_read",                      "mysql_innodb_data",    "read",               DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_data_reads",                     "mysql_innodb_data",    "reads",              DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_data_writes",                    "mysql_innodb_data",    "writes",             DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_data_written",                   "mysql_innodb_data",    "written",            DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	/* double write */
+	{ "Innodb_dblwr_writes",                   "mysql_innodb_dblwr",   "writes",             DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_dblwr_pages_written",            "mysql_innodb_dblwr",   "written",            DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	/* log */
+	{ "Innodb_log_waits",                      "mysql_innodb_log",     "waits",              DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_log_write_requests",             "mysql_innodb_log",     "write_requests",     DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_log_writes",                     "mysql_innodb_log",     "writes",             DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_os_log_fsyncs",                  "mysql_innodb_log",     "fsyncs",             DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_os_log_written",                 "mysql_innodb_log",     "written",            DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	/* pages */
+	{ "Innodb_pages_created",                  "mysql_innodb_pages",   "created",            DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_pages_read",                     "mysql_innodb_pages",   "read",               DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_pages_written",                  "mysql_innodb_pages",   "written",            DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	/* row lock */
+	{ "Innodb_row_lock_time",                  "mysql_innodb_row_lock", "time",              DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_row_lock_waits",                 "mysql_innodb_row_lock", "waits",             DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	/* rows */
+	{ "Innodb_rows_deleted",                   "mysql_innodb_rows",    "deleted",            DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_rows_inserted",                  "mysql_innodb_rows",    "inserted",           DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_rows_read",                      "mysql_innodb_rows",    "read",               DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "Innodb_rows_updated",                   "mysql_innodb_rows",    "updated",            DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	/* sort */
+	{ "Sort_merge_passes",                     "mysql_sort_merge_passes", NULL,              DS_TYPE_DERIVE, 0, SLOT_NONE },
+	{ "Sort_rows",                             "mysql_sort_rows",      NULL,                 DS_TYPE_DERIVE, 0, SLOT_NONE },
+	{ "Sort_range",                            "mysql_sort",           "range",              DS_TYPE_DERIVE, 0, SLOT_NONE },
+	{ "Sort_scan",                             "mysql_sort",           "scan",               DS_TYPE_DERIVE, 0, SLOT_NONE }
+}; /* }}} */
+
+/* Rows of information_schema.innodb_metrics. The name of the metric is used
+ * as type instance. */
+static const mysql_metric_t innodb_metrics[] = { /* {{{ */
+	{ "metadata_mem_pool_size",          "bytes",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "lock_deadlocks",                  "mysql_locks",  NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "lock_timeouts",                   "mysql_locks",  NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "lock_row_lock_current_waits",     "mysql_locks",  NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pool_size",                "bytes",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+
+	{ "buffer_pool_reads",               "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pool_read_requests",       "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pool_write_requests",      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pool_wait_free",           "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pool_read_ahead",          "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pool_read_ahead_evicted",  "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	{ "buffer_pool_pages_total",         "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "buffer_pool_pages_misc",          "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "buffer_pool_pages_data",          "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "buffer_pool_bytes_data",          "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "buffer_pool_pages_dirty",         "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "buffer_pool_bytes_dirty",         "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "buffer_pool_pages_free",          "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+
+	{ "buffer_pages_created",            "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pages_written",            "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_pages_read",               "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_data_reads",               "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "buffer_data_written",             "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	{ "os_data_reads",                   "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "os_data_writes",                  "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "os_data_fsyncs",                  "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "os_log_bytes_written",            "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "os_log_fsyncs",                   "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "os_log_pending_fsyncs",           "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "os_log_pending_writes",           "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	{ "trx_rseg_history_len",            "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+
+	{ "log_waits",                       "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "log_write_requests",              "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "log_writes",                      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "adaptive_hash_searches",          "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	{ "file_num_open_files",             "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+
+	{ "ibuf_merges_insert",              "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "ibuf_merges_delete_mark",         "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "ibuf_merges_delete",              "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "ibuf_merges_discard_insert",      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "ibuf_merges_discard_delete_mark", "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "ibuf_merges_discard_delete",      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "ibuf_merges_discard_merges",      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "ibuf_size",                       "bytes",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+
+	{ "innodb_activity_count",           "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+	{ "innodb_dblwr_writes",             "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "innodb_dblwr_pages_written",      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "innodb_dblwr_page_size",          "gauge",        NULL, DS_TYPE_GAUGE,  1, SLOT_NONE },
+
+	{ "innodb_rwlock_s_spin_waits",      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "innodb_rwlock_x_spin_waits",      "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "innodb_rwlock_s_spin_rounds",     "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "innodb_rwlock_x_spin_rounds",     "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "innodb_rwlock_s_os_waits",        "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "innodb_rwlock_x_os_waits",        "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+
+	{ "dml_reads",                       "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "dml_inserts",                     "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "dml_deletes",                     "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE },
+	{ "dml_updates",                     "operations",   NULL, DS_TYPE_DERIVE, 1, SLOT_NONE }
+}; /* }}} */
+
+/* Maps the names of a metric table to its entries. The seed of the hash is
+ * chosen at init so that no two names share a slot, so a lookup costs one
+ * hash and one string comparison. */
+struct mysql_metric_index_s /* {{{ */
+{
+	const mysql_metric_t *metrics;
+	size_t metrics_num;
+
+	uint32_t seed;
+	int *slots;
+	size_t slots_num;
+};
+typedef struct mysql_metric_index_s mysql_metric_index_t; /* }}} */
+
+/* Slots per name, rounded up to a power of two. With this many, one seed in
+ * a few dozen is collision free. */
+#define MYSQL_INDEX_SLOTS_PER_NAME 8
+#define MYSQL_INDEX_MAX_SEED 100000
+
+static mysql_metric_index_t status_index = {
+	status_metrics, STATIC_ARRAY_SIZE (status_metrics), 0, NULL, 0 };
+static mysql_metric_index_t innodb_index = {
+	innodb_metrics, STATIC_ARRAY_SIZE (innodb_metrics), 0, NULL, 0 };
+
 static int mysql_read (user_data_t *ud);
 
+/* 32 bit FNV-1a, followed by the MurmurHash3 finalizer so that different
+ * seeds yield unrelated hashes. */
+static uint32_t mysql_hash (const char *str, uint32_t seed) /* {{{ */
+{
+	uint32_t hash = 2166136261U ^ seed;
+	const unsigned char *ptr;
+
+	for (ptr = (const unsigned char *) str; *ptr != 0; ptr++)
+	{
+		hash ^= (uint32_t) *ptr;
+		hash *= 16777619U;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+
+	return (hash);
+} /* }}} uint32_t mysql_hash */
+
+static int mysql_index_build (mysql_metric_index_t *idx) /* {{{ */
+{
+	uint32_t seed;
+	size_t i;
+
+	idx->slots_num = 1;
+	while (idx->slots_num < MYSQL_INDEX_SLOTS_PER_NAME * idx->metrics_num)
+		idx->slots_num *= 2;
+
+	idx->slots = calloc (idx->slots_num, sizeof (*idx->slots));
+	if (idx->slots == NULL)
+		return (ENOMEM);
+
+	for (seed = 1; seed <= MYSQL_INDEX_MAX_SEED; seed++)
+	{
+		for (i = 0; i < idx->slots_num; i++)
+			idx->slots[i] = -1;
+
+		for (i = 0; i < idx->metrics_num; i++)
+		{
+			size_t slot = mysql_hash (idx->metrics[i].name, seed)
+				& (idx->slots_num - 1);
+
+			if (idx->slots[slot] >= 0)
+				break;
+			idx->slots[slot] = (int) i;
+		}
+
+		if (i == idx->metrics_num)
+		{
+			idx->seed = seed;
+			return (0);
+		}
+	}
+
+	sfree (idx->slots);
+	idx->slots_num = 0;
+	return (-1);
+} /* }}} int mysql_index_build */
+
+static const mysql_metric_t *mysql_index_lookup ( /* {{{ */
+		const mysql_metric_index_t *idx, const char *name)
+{
+	int i;
+
+	if (idx->slots == NULL)
+		return (NULL);
+
+	i = idx->slots[mysql_hash (name, idx->seed) & (idx->slots_num - 1)];
+	if ((i < 0) || (strcmp (idx->metrics[i].name, name) != 0))
+		return (NULL);
+
+	return (idx->metrics + i);
+} /* }}} const mysql_metric_t *mysql_index_lookup */
+
 static void mysql_database_free (void *arg) /* {{{ */
 {
 	mysql_database_t *db;
@@ -274,7 +549,8 @@ static MYSQL *getconnection (mysql_database_t *db)
 	db->con->options.connect_timeout = db->timeout;
 
 	if (mysql_real_connect (db->con, db->host, db->user, db->pass,
-				db->database, db->port, db->socket, 0) == NULL)
+				db->database, db->port, db->socket,
+				CLIENT_MULTI_STATEMENTS) == NULL)
 	{
 		ERROR ("mysql plugin: Failed to connect to database %s "
 				"at server %s: %s",
@@ -368,53 +644,19 @@ static void traffic_submit (derive_t rx, derive_t tx, mysql_database_t *db)
 	submit ("mysql_octets", NULL, values, STATIC_ARRAY_SIZE (values), db);
 } /* void traffic_submit */
 
-static MYSQL_RES *exec_query (MYSQL *con, const char *query)
+static int mysql_read_master_stats (mysql_database_t *db, MYSQL_RES *res,
+		const char *query)
 {
-	MYSQL_RES *res;
-
-	int query_len = strlen (query);
-
-	if (mysql_real_query (con, query, query_len))
-	{
-		ERROR ("mysql plugin: Failed to execute query: %s",
-				mysql_error (con));
-		INFO ("mysql plugin: SQL query was: %s", query);
-		return (NULL);
-	}
-
-	res = mysql_store_result (con);
-	if (res == NULL)
-	{
-		ERROR ("mysql plugin: Failed to store query result: %s",
-				mysql_error (con));
-		INFO ("mysql plugin: SQL query was: %s", query);
-		return (NULL);
-	}
-
-	return (res);
-} /* exec_query */
-
-static int mysql_read_master_stats (mysql_database_t *db, MYSQL *con)
-{
-	MYSQL_RES *res;
 	MYSQL_ROW  row;
 
-	const char *query;
 	int         field_num;
 	unsigned long long position;
 
-	query = "SHOW MASTER STATUS";
-
-	res = exec_query (con, query);
-	if (res == NULL)
-		return (-1);
-
 	row = mysql_fetch_row (res);
 	if (row == NULL)
 	{
 		ERROR ("mysql plugin: Failed to get master statistics: "
 				"`%s' did not return any rows.", query);
-		mysql_free_result (res);
 		return (-1);
 	}
 
@@ -423,7 +665,6 @@ static int mysql_read_master_stats (mysql_database_t *db, MYSQL *con)
 	{
 		ERROR ("mysql plugin: Failed to get master statistics: "
 				"`%s' returned less than two columns.", query);
-		mysql_free_result (res);
 		return (-1);
 	}
 
@@ -435,17 +676,14 @@ static int mysql_read_master_stats (mysql_database_t *db, MYSQL *con)
 		WARNING ("mysql plugin: `%s' returned more than one row - "
 				"ignoring further results.", query);
 
-	mysql_free_result (res);
-
 	return (0);
 } /* mysql_read_master_stats */
 
-static int mysql_read_slave_stats (mysql_database_t *db, MYSQL *con)
+static int mysql_read_slave_stats (mysql_database_t *db, MYSQL_RES *res,
+		const char *query)
 {
-	MYSQL_RES *res;
 	MYSQL_ROW  row;
 
-	const char *query;
 	int         field_num;
 
 	/* WTF? libmysqlclient does not seem to provide any means to
@@ -456,18 +694,11 @@ static int mysql_read_slave_stats (mysql_database_t *db, MYSQL *con)
 	const int EXEC_MASTER_LOG_POS_IDX   = 21;
 	const int SECONDS_BEHIND_MASTER_IDX = 32;
 
-	query = "SHOW SLAVE STATUS";
-
-	res = exec_query (con, query);
-	if (res == NULL)
-		return (-1);
-
 	row = mysql_fetch_row (res);
 	if (row == NULL)
 	{
 		ERROR ("mysql plugin: Failed to get slave statistics: "
 				"`%s' did not return any rows.", query);
-		mysql_free_result (res);
 		return (-1);
 	}
 
@@ -476,7 +707,6 @@ static int mysql_read_slave_stats (mysql_database_t *db, MYSQL *con)
 	{
 		ERROR ("mysql plugin: Failed to get slave statistics: "
 				"`%s' returned less than 33 columns.", query);
-		mysql_free_result (res);
 		return (-1);
 	}
 
@@ -558,140 +788,50 @@ static int mysql_read_slave_stats (mysql_database_t *db, MYSQL *con)
 		WARNING ("mysql plugin: `%s' returned more than one row - "
 				"ignoring further results.", query);
 
-	mysql_free_result (res);
-
 	return (0);
 } /* mysql_read_slave_stats */
 
-static int mysql_read_innodb_stats (mysql_database_t *db, MYSQL *con)
+static void metric_submit (const mysql_metric_t *m, const char *type_instance,
+		unsigned long long val, mysql_database_t *db)
 {
-	MYSQL_RES *res;
-	MYSQL_ROW  row;
+	switch (m->ds_type) {
+		case DS_TYPE_GAUGE:
+			gauge_submit (m->type, type_instance, (gauge_t) val, db);
+			break;
+		case DS_TYPE_DERIVE:
+			derive_submit (m->type, type_instance, (derive_t) val, db);
+			break;
+	}
+} /* void metric_submit */
 
-	const char *query;
-	struct {
-		const char *key;
-		const char *type;
-		int ds_type;
-	} metrics[] = {
-		{ "metadata_mem_pool_size",          "bytes",        DS_TYPE_GAUGE },
-		{ "lock_deadlocks",                  "mysql_locks",  DS_TYPE_DERIVE },
-		{ "lock_timeouts",                   "mysql_locks",  DS_TYPE_DERIVE },
-		{ "lock_row_lock_current_waits",     "mysql_locks",  DS_TYPE_DERIVE },
-		{ "buffer_pool_size",                "bytes",        DS_TYPE_GAUGE },
-
-		{ "buffer_pool_reads",               "operations",   DS_TYPE_DERIVE },
-		{ "buffer_pool_read_requests",       "operations",   DS_TYPE_DERIVE },
-		{ "buffer_pool_write_requests",      "operations",   DS_TYPE_DERIVE },
-		{ "buffer_pool_wait_free",           "operations",   DS_TYPE_DERIVE },
-		{ "buffer_pool_read_ahead",          "operations",   DS_TYPE_DERIVE },
-		{ "buffer_pool_read_ahead_evicted",  "operations",   DS_TYPE_DERIVE },
-
-		{ "buffer_pool_pages_total",         "gauge",        DS_TYPE_GAUGE },
-		{ "buffer_pool_pages_misc",          "gauge",        DS_TYPE_GAUGE },
-		{ "buffer_pool_pages_data",          "gauge",        DS_TYPE_GAUGE },
-		{ "buffer_pool_bytes_data",          "gauge",        DS_TYPE_GAUGE },
-		{ "buffer_pool_pages_dirty",         "gauge",        DS_TYPE_GAUGE },
-		{ "buffer_pool_bytes_dirty",         "gauge",        DS_TYPE_GAUGE },
-		{ "buffer_pool_pages_free",          "gauge",        DS_TYPE_GAUGE },
-
-		{ "buffer_pages_created",            "operations",   DS_TYPE_DERIVE },
-		{ "buffer_pages_written",            "operations",   DS_TYPE_DERIVE },
-		{ "buffer_pages_read",               "operations",   DS_TYPE_DERIVE },
-		{ "buffer_data_reads",               "operations",   DS_TYPE_DERIVE },
-		{ "buffer_data_written",             "operations",   DS_TYPE_DERIVE },
-
-		{ "os_data_reads",                   "operations",   DS_TYPE_DERIVE },
-		{ "os_data_writes",                  "operations",   DS_TYPE_DERIVE },
-		{ "os_data_fsyncs",                  "operations",   DS_TYPE_DERIVE },
-		{ "os_log_bytes_written",            "operations",   DS_TYPE_DERIVE },
-		{ "os_log_fsyncs",                   "operations",   DS_TYPE_DERIVE },
-		{ "os_log_pending_fsyncs",           "operations",   DS_TYPE_DERIVE },
-		{ "os_log_pending_writes",           "operations",   DS_TYPE_DERIVE },
-
-		{ "trx_rseg_history_len",            "gauge",        DS_TYPE_GAUGE },
-
-		{ "log_waits",                       "operations",   DS_TYPE_DERIVE },
-		{ "log_write_requests",              "operations",   DS_TYPE_DERIVE },
-		{ "log_writes",                      "operations",   DS_TYPE_DERIVE },
-		{ "adaptive_hash_searches",          "operations",   DS_TYPE_DERIVE },
-
-		{ "file_num_open_files",             "gauge",        DS_TYPE_GAUGE },
-
-		{ "ibuf_merges_insert",              "operations",   DS_TYPE_DERIVE },
-		{ "ibuf_merges_delete_mark",         "operations",   DS_TYPE_DERIVE },
-		{ "ibuf_merges_delete",              "operations",   DS_TYPE_DERIVE },
-		{ "ibuf_merges_discard_insert",      "operations",   DS_TYPE_DERIVE },
-		{ "ibuf_merges_discard_delete_mark", "operations",   DS_TYPE_DERIVE },
-		{ "ibuf_merges_discard_delete",      "operations",   DS_TYPE_DERIVE },
-		{ "ibuf_merges_discard_merges",      "operations",   DS_TYPE_DERIVE },
-		{ "ibuf_size",                       "bytes",        DS_TYPE_GAUGE },
-
-		{ "innodb_activity_count",           "gauge",        DS_TYPE_GAUGE },
-		{ "innodb_dblwr_writes",             "operations",   DS_TYPE_DERIVE },
-		{ "innodb_dblwr_pages_written",      "operations",   DS_TYPE_DERIVE },
-		{ "innodb_dblwr_page_size",          "gauge",        DS_TYPE_GAUGE },
-
-		{ "innodb_rwlock_s_spin_waits",      "operations",   DS_TYPE_DERIVE },
-		{ "innodb_rwlock_x_spin_waits",      "operations",   DS_TYPE_DERIVE },
-		{ "innodb_rwlock_s_spin_rounds",     "operations",   DS_TYPE_DERIVE },
-		{ "innodb_rwlock_x_spin_rounds",     "operations",   DS_TYPE_DERIVE },
-		{ "innodb_rwlock_s_os_waits",        "operations",   DS_TYPE_DERIVE },
-		{ "innodb_rwlock_x_os_waits",        "operations",   DS_TYPE_DERIVE },
-
-		{ "dml_reads",                       "operations",   DS_TYPE_DERIVE },
-		{ "dml_inserts",                     "operations",   DS_TYPE_DERIVE },
-		{ "dml_deletes",                     "operations",   DS_TYPE_DERIVE },
-		{ "dml_updates",                     "operations",   DS_TYPE_DERIVE },
-
-		{ NULL,                              NULL,           0}
-	};
-
-	query = "SELECT name, count, type FROM information_schema.innodb_metrics WHERE status = 'enabled'";
-
-	res = exec_query (con, query);
-	if (res == NULL)
-		return (-1);
+static int mysql_read_innodb_stats (mysql_database_t *db, MYSQL_RES *res,
+		const char __attribute__((unused)) *query)
+{
+	MYSQL_ROW  row;
 
 	while ((row = mysql_fetch_row (res)))
 	{
-		int i;
+		const mysql_metric_t *m;
 		char *key;
 		unsigned long long val;
 
 		key = row[0];
 		val = atoll (row[1]);
 
-		for (i = 0; metrics[i].key != NULL && strcmp(metrics[i].key, key) != 0; i++)
-			;
-
-		if (metrics[i].key == NULL)
+		m = mysql_index_lookup (&innodb_index, key);
+		if (m == NULL)
 			continue;
 
-		switch (metrics[i].ds_type) {
-			case DS_TYPE_COUNTER:
-				counter_submit(metrics[i].type, key, (counter_t)val, db);
-				break;
-			case DS_TYPE_GAUGE:
-				gauge_submit(metrics[i].type, key, (gauge_t)val, db);
-				break;
-			case DS_TYPE_DERIVE:
-				derive_submit(metrics[i].type, key, (derive_t)val, db);
-				break;
-		}
+		metric_submit (m, key, val, db);
 	}
 
-	mysql_free_result(res);
 	return (0);
-}
+} /* mysql_read_innodb_stats */
 
-static int mysql_read (user_data_t *ud)
+static int mysql_read_status (mysql_database_t *db, MYSQL_RES *res,
+		const char __attribute__((unused)) *query)
 {
-	mysql_database_t *db;
-	MYSQL      *con;
-	MYSQL_RES  *res;
 	MYSQL_ROW   row;
-	const char *query;
 
 	derive_t qcache_hits          = 0;
 	derive_t qcache_inserts       = 0;
@@ -706,39 +846,61 @@ static int mysql_read (user_data_t *ud)
 
 	unsigned long long traffic_incoming = 0ULL;
 	unsigned long long traffic_outgoing = 0ULL;
-	unsigned long mysql_version = 0ULL;
-
-	if ((ud == NULL) || (ud->data == NULL))
-	{
-		ERROR ("mysql plugin: mysql_database_read: Invalid user data.");
-		return (-1);
-	}
-
-	db = (mysql_database_t *) ud->data;
-
-	/* An error message will have been printed in this case */
-	if ((con = getconnection (db)) == NULL)
-		return (-1);
-
-	mysql_version = mysql_get_server_version(con);
-
-	query = "SHOW STATUS";
-	if (mysql_version >= 50002)
-		query = "SHOW GLOBAL STATUS";
-
-	res = exec_query (con, query);
-	if (res == NULL)
-		return (-1);
 
 	while ((row = mysql_fetch_row (res)))
 	{
+		const mysql_metric_t *m;
 		char *key;
 		unsigned long long val;
 
 		key = row[0];
 		val = atoll (row[1]);
 
-		if (strncmp (key, "Com_",
+		m = mysql_index_lookup (&status_index, key);
+		if (m != NULL)
+		{
+			switch (m->slot)
+			{
+				case SLOT_QCACHE_HITS:
+					qcache_hits = (derive_t) val;
+					break;
+				case SLOT_QCACHE_INSERTS:
+					qcache_inserts = (derive_t) val;
+					break;
+				case SLOT_QCACHE_NOT_CACHED:
+					qcache_not_cached = (derive_t) val;
+					break;
+				case SLOT_QCACHE_LOWMEM_PRUNES:
+					qcache_lowmem_prunes = (derive_t) val;
+					break;
+				case SLOT_QCACHE_QUERIES_IN_CACHE:
+					qcache_queries_in_cache = (gauge_t) val;
+					break;
+				case SLOT_BYTES_RECEIVED:
+					traffic_incoming += val;
+					break;
+				case SLOT_BYTES_SENT:
+					traffic_outgoing += val;
+					break;
+				case SLOT_THREADS_RUNNING:
+					threads_running = (gauge_t) val;
+					break;
+				case SLOT_THREADS_CONNECTED:
+					threads_connected = (gauge_t) val;
+					break;
+				case SLOT_THREADS_CACHED:
+					threads_cached = (gauge_t) val;
+					break;
+				case SLOT_THREADS_CREATED:
+					threads_created = (derive_t) val;
+					break;
+				case SLOT_NONE:
+					if (!m->innodb || db->innodb_stats)
+						metric_submit (m, m->type_instance, val, db);
+					break;
+			}
+		}
+		else if (strncmp (key, "Com_",
 			          strlen ("Com_")) == 0)
 		{
 			if (val == 0ULL)
@@ -760,40 +922,6 @@ static int mysql_read (user_data_t *ud)
 					key + strlen ("Handler_"),
 					val, db);
 		}
-		else if (strncmp (key, "Qcache_",
-       				        strlen ("Qcache_")) == 0)
-		{
-			if (strcmp (key, "Qcache_hits") == 0)
-				qcache_hits = (derive_t) val;
-			else if (strcmp (key, "Qcache_inserts") == 0)
-				qcache_inserts = (derive_t) val;
-			else if (strcmp (key, "Qcache_not_cached") == 0)
-				qcache_not_cached = (derive_t) val;
-			else if (strcmp (key, "Qcache_lowmem_prunes") == 0)
-				qcache_lowmem_prunes = (derive_t) val;
-			else if (strcmp (key, "Qcache_queries_in_cache") == 0)
-				qcache_queries_in_cache = (gauge_t) val;
-		}
-		else if (strncmp (key, "Bytes_",
-				        strlen ("Bytes_")) == 0)
-		{
-			if (strcmp (key, "Bytes_received") == 0)
-				traffic_incoming += val;
-			else if (strcmp (key, "Bytes_sent") == 0)
-				traffic_outgoing += val;
-		}
-		else if (strncmp (key, "Threads_",
-       				        strlen ("Threads_")) == 0)
-		{
-			if (strcmp (key, "Threads_running") == 0)
-				threads_running = (gauge_t) val;
-			else if (strcmp (key, "Threads_connected") == 0)
-				threads_connected = (gauge_t) val;
-			else if (strcmp (key, "Threads_cached") == 0)
-				threads_cached = (gauge_t) val;
-			else if (strcmp (key, "Threads_created") == 0)
-				threads_created = (derive_t) val;
-		}
 		else if (strncmp (key, "Table_locks_",
 					strlen ("Table_locks_")) == 0)
 		{
@@ -801,111 +929,12 @@ static int mysql_read (user_data_t *ud)
 					key + strlen ("Table_locks_"),
 					val, db);
 		}
-		else if (db->innodb_stats && strncmp (key, "Innodb_", strlen ("Innodb_")) == 0)
-		{
-			/* buffer pool */
-			if (strcmp (key, "Innodb_buffer_pool_pages_data") == 0)
-				gauge_submit ("mysql_bpool_pages", "data", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_pages_dirty") == 0)
-				gauge_submit ("mysql_bpool_pages", "dirty", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_pages_flushed") == 0)
-				counter_submit ("mysql_bpool_counters", "pages_flushed", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_pages_free") == 0)
-				gauge_submit ("mysql_bpool_pages", "free", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_pages_misc") == 0)
-				gauge_submit ("mysql_bpool_pages", "misc", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_pages_total") == 0)
-				gauge_submit ("mysql_bpool_pages", "total", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_read_ahead_rnd") == 0)
-				counter_submit ("mysql_bpool_counters", "read_ahead_rnd", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_read_ahead") == 0)
-				counter_submit ("mysql_bpool_counters", "read_ahead", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_read_ahead_evicted") == 0)
-				counter_submit ("mysql_bpool_counters", "read_ahead_evicted", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_read_requests") == 0)
-				counter_submit ("mysql_bpool_counters", "read_requests", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_reads") == 0)
-				counter_submit ("mysql_bpool_counters", "reads", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_write_requests") == 0)
-				counter_submit ("mysql_bpool_counters", "write_requests", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_bytes_data") == 0)
-				gauge_submit ("mysql_bpool_bytes", "data", val, db);
-			else if (strcmp (key, "Innodb_buffer_pool_bytes_dirty") == 0)
-				gauge_submit ("mysql_bpool_bytes", "dirty", val, db);
-
-			/* data */
-			if (strcmp (key, "Innodb_data_fsyncs") == 0)
-				counter_submit ("mysql_innodb_data", "fsyncs", val, db);
-			else if (strcmp (key, "Innodb_data_read") == 0)
-				counter_submit ("mysql_innodb_data", "read", val, db);
-			else if (strcmp (key, "Innodb_data_reads") == 0)
-				counter_submit ("mysql_innodb_data", "reads", val, db);
-			else if (strcmp (key, "Innodb_data_writes") == 0)
-				counter_submit ("mysql_innodb_data", "writes", val, db);
-			else if (strcmp (key, "Innodb_data_written") == 0)
-				counter_submit ("mysql_innodb_data", "written", val, db);
-
-			/* double write */
-			else if (strcmp (key, "Innodb_dblwr_writes") == 0)
-				counter_submit ("mysql_innodb_dblwr", "writes", val, db);
-			else if (strcmp (key, "Innodb_dblwr_pages_written") == 0)
-				counter_submit ("mysql_innodb_dblwr", "written", val, db);
-
-			/* log */
-			else if (strcmp (key, "Innodb_log_waits") == 0)
-				counter_submit ("mysql_innodb_log", "waits", val, db);
-			else if (strcmp (key, "Innodb_log_write_requests") == 0)
-				counter_submit ("mysql_innodb_log", "write_requests", val, db);
-			else if (strcmp (key, "Innodb_log_writes") == 0)
-				counter_submit ("mysql_innodb_log", "writes", val, db);
-			else if (strcmp (key, "Innodb_os_log_fsyncs") == 0)
-				counter_submit ("mysql_innodb_log", "fsyncs", val, db);
-			else if (strcmp (key, "Innodb_os_log_written") == 0)
-				counter_submit ("mysql_innodb_log", "written", val, db);
-
-			/* pages */
-			else if (strcmp (key, "Innodb_pages_created") == 0)
-				counter_submit ("mysql_innodb_pages", "created", val, db);
-			else if (strcmp (key, "Innodb_pages_read") == 0)
-				counter_submit ("mysql_innodb_pages", "read", val, db);
-			else if (strcmp (key, "Innodb_pages_written") == 0)
-				counter_submit ("mysql_innodb_pages", "written", val, db);
-
-			/* row lock */
-			else if (strcmp (key, "Innodb_row_lock_time") == 0)
-				counter_submit ("mysql_innodb_row_lock", "time", val, db);
-			else if (strcmp (key, "Innodb_row_lock_waits") == 0)
-				counter_submit ("mysql_innodb_row_lock", "waits", val, db);
-
-			/* rows */
-			else if (strcmp (key, "Innodb_rows_deleted") == 0)
-				counter_submit ("mysql_innodb_rows", "deleted", val, db);
-			else if (strcmp (key, "Innodb_rows_inserted") == 0)
-				counter_submit ("mysql_innodb_rows", "inserted", val, db);
-			else if (strcmp (key, "Innodb_rows_read") == 0)
-				counter_submit ("mysql_innodb_rows", "read", val, db);
-			else if (strcmp (key, "Innodb_rows_updated") == 0)
-				counter_submit ("mysql_innodb_rows", "updated", val, db);
-		}
 		else if (strncmp (key, "Select_", strlen ("Select_")) == 0)
 		{
 			counter_submit ("mysql_select", key + strlen ("Select_"),
 					val, db);
 		}
-		else if (strncmp (key, "Sort_", strlen ("Sort_")) == 0)
-		{
-			if (strcmp (key, "Sort_merge_passes") == 0)
-				counter_submit ("mysql_sort_merge_passes", NULL, val, db);
-			else if (strcmp (key, "Sort_rows") == 0)
-				counter_submit ("mysql_sort_rows", NULL, val, db);
-			else if (strcmp (key, "Sort_range") == 0)
-				counter_submit ("mysql_sort", "range", val, db);
-			else if (strcmp (key, "Sort_scan") == 0)
-				counter_submit ("mysql_sort", "scan", val, db);
-
-		}
 	}
-	mysql_free_result (res); res = NULL;
 
 	if ((qcache_hits != 0)
 			|| (qcache_inserts != 0)
@@ -940,19 +969,207 @@ static int mysql_read (user_data_t *ud)
 
 	traffic_submit  (traffic_incoming, traffic_outgoing, db);
 
+	return (0);
+} /* int mysql_read_status */
+
+typedef int (*mysql_result_handler_t) (mysql_database_t *, MYSQL_RES *,
+		const char *);
+
+struct mysql_statement_s
+{
+	const char *query;
+	mysql_result_handler_t handler;
+};
+typedef struct mysql_statement_s mysql_statement_t;
+
+/* Sends all statements in one round trip, using the multi statement support
+ * of the client library, and passes the result sets to their handlers in
+ * order. If a statement fails, the server doesn't execute the following
+ * ones. "handled" is set to the number of statements whose results have
+ * been passed to their handler. */
+static int exec_statements (mysql_database_t *db, MYSQL *con,
+		const mysql_statement_t *statements, size_t statements_num,
+		size_t *handled)
+{
+	char query[1024];
+	size_t query_len = 0;
+	size_t i;
+	int status = 0;
+
+	*handled = 0;
+
+	for (i = 0; i < statements_num; i++)
+	{
+		int len;
+
+		len = ssnprintf (query + query_len, sizeof (query) - query_len,
+				"%s%s", (i == 0) ? "" : ";", statements[i].query);
+		if ((len < 0) || ((size_t) len >= sizeof (query) - query_len))
+		{
+			ERROR ("mysql plugin: Combined query too long.");
+			return (-1);
+		}
+		query_len += (size_t) len;
+	}
+
+	if (mysql_real_query (con, query, (unsigned long) query_len))
+	{
+		ERROR ("mysql plugin: Failed to execute query: %s",
+				mysql_error (con));
+		INFO ("mysql plugin: SQL query was: %s", statements[0].query);
+		return (-1);
+	}
+
+	for (i = 0; i < statements_num; i++)
+	{
+		MYSQL_RES *res;
+
+		if (i > 0)
+		{
+			status = mysql_next_result (con);
+			if (status != 0)
+			{
+				ERROR ("mysql plugin: Failed to execute query: %s",
+						(status > 0) ? mysql_error (con)
+						: "no more results");
+				INFO ("mysql plugin: SQL query was: %s",
+						statements[i].query);
+				/* mysql_next_result() has consumed the error. */
+				return (-1);
+			}
+		}
+
+		res = mysql_store_result (con);
+		if (res == NULL)
+		{
+			ERROR ("mysql plugin: Failed to store query result: %s",
+					mysql_error (con));
+			INFO ("mysql plugin: SQL query was: %s",
+					statements[i].query);
+			status = -1;
+			break;
+		}
+
+		statements[i].handler (db, res, statements[i].query);
+		mysql_free_result (res);
+		*handled = i + 1;
+	}
+
+	/* Discard the remaining results, if any, so that the connection can be
+	 * used again. */
+	while (mysql_next_result (con) == 0)
+	{
+		MYSQL_RES *res = mysql_store_result (con);
+		if (res != NULL)
+			mysql_free_result (res);
+	}
+
+	return (status);
+} /* int exec_statements */
+
+static int mysql_read (user_data_t *ud)
+{
+	mysql_database_t *db;
+	MYSQL      *con;
+	mysql_statement_t statements[4];
+	size_t statements_num = 0;
+	size_t first = 0;
+	unsigned long mysql_version = 0ULL;
+
+	if ((ud == NULL) || (ud->data == NULL))
+	{
+		ERROR ("mysql plugin: mysql_database_read: Invalid user data.");
+		return (-1);
+	}
+
+	db = (mysql_database_t *) ud->data;
+
+	/* An error message will have been printed in this case */
+	if ((con = getconnection (db)) == NULL)
+		return (-1);
+
+	mysql_version = mysql_get_server_version(con);
+
+	statements[statements_num].query = "SHOW STATUS";
+	if (mysql_version >= 50002)
+		statements[statements_num].query = "SHOW GLOBAL STATUS";
+	statements[statements_num].handler = mysql_read_status;
+	statements_num++;
+
 	if (mysql_version >= 50600 && db->innodb_stats)
-		mysql_read_innodb_stats (db, con);
+	{
+		statements[statements_num].query = "SELECT name, count, type "
+			"FROM information_schema.innodb_metrics "
+			"WHERE status = 'enabled'";
+		statements[statements_num].handler = mysql_read_innodb_stats;
+		statements_num++;
+	}
 
 	if (db->master_stats)
-		mysql_read_master_stats (db, con);
+	{
+		statements[statements_num].query = "SHOW MASTER STATUS";
+		statements[statements_num].handler = mysql_read_master_stats;
+		statements_num++;
+	}
 
 	if ((db->slave_stats) || (db->slave_notif))
-		mysql_read_slave_stats (db, con);
+	{
+		statements[statements_num].query = "SHOW SLAVE STATUS";
+		statements[statements_num].handler = mysql_read_slave_stats;
+		statements_num++;
+	}
+
+	/* Only a failing status query fails the read. The other statements are
+	 * optional, e.g. SHOW SLAVE STATUS needs the REPLICATION CLIENT
+	 * privilege, so the ones following a failed statement are sent again
+	 * without it. */
+	while (first < statements_num)
+	{
+		size_t handled = 0;
+
+		if (exec_statements (db, con, statements + first,
+					statements_num - first, &handled) == 0)
+			break;
+
+		if ((first == 0) && (handled == 0))
+			return (-1);
+
+		first += handled + 1;
+	}
 
 	return (0);
 } /* int mysql_read */
 
+static int mysql_plugin_init (void)
+{
+	if ((status_index.slots == NULL)
+			&& (mysql_index_build (&status_index) != 0))
+	{
+		ERROR ("mysql plugin: Building the status variable index failed.");
+		return (-1);
+	}
+
+	if ((innodb_index.slots == NULL)
+			&& (mysql_index_build (&innodb_index) != 0))
+	{
+		ERROR ("mysql plugin: Building the InnoDB metric index failed.");
+		return (-1);
+	}
+
+	return (0);
+} /* int mysql_plugin_init */
+
+static int mysql_plugin_shutdown (void)
+{
+	sfree (status_index.slots);
+	sfree (innodb_index.slots);
+	return (0);
+} /* int mysql_plugin_shutdown */
+
+
 void module_register (void)
 {
 	plugin_register_complex_config ("mysql", mysql_config);
+	plugin_register_init ("mysql", mysql_plugin_init);
+	plugin_register_shutdown ("mysql", mysql_plugin_shutdown);
 } /* void module_register */
@@ -35,6 +35,10 @@
 
 #define HAS_ALL_FLAGS(has,needs) (((has) & (needs)) == (needs))
 
+/* Number of reads of the selected volume performance instances before the
+ * complete instance list is queried again, e.g. to pick up new volumes. */
+#define CNA_INSTANCES_REFRESH 10
+
 typedef struct host_config_s host_config_t;
 typedef void service_handler_t(host_config_t *host, na_elem_t *result, void *data);
 
@@ -175,6 +179,12 @@ typedef struct {
 	ignorelist_t *il_operations;
 	ignorelist_t *il_latency;
 
+	/* Like "query", but only asks for the instances that are not ignored. It
+	 * is built from the instance list returned by "query" and used for
+	 * CNA_INSTANCES_REFRESH reads before the full list is fetched again. */
+	na_elem_t *query_selected;
+	int query_selected_reads;
+
 	data_volume_perf_t *volumes;
 } cfg_volume_perf_t;
 /* }}} data_volume_perf_t */
@@ -271,7 +281,9 @@ struct host_config_s {
 	char *vfiler;
 	cdtime_t interval;
 
-	na_server_t *srv;
+	/* Number of connections to the host, i.e. of API calls in flight. */
+	int connections;
+	na_server_t **srv;
 	cfg_wafl_t *cfg_wafl;
 	cfg_disk_t *cfg_disk;
 	cfg_volume_perf_t *cfg_volume_perf;
@@ -350,6 +362,8 @@ static void free_cfg_volume_perf (cfg_volume_perf_t *cvp) /* {{{ */
 
 	if (cvp->query != NULL)
 		na_elem_free (cvp->query);
+	if (cvp->query_selected != NULL)
+		na_elem_free (cvp->query_selected);
 
 	sfree (cvp);
 } /* }}} void free_cfg_volume_perf */
@@ -440,7 +454,14 @@ static void free_host_config (host_config_t *hc) /* {{{ */
 	free_cfg_system (hc->cfg_system);
 
 	if (hc->srv != NULL)
-		na_server_close (hc->srv);
+	{
+		int i;
+
+		for (i = 0; i < hc->connections; i++)
+			if (hc->srv[i] != NULL)
+				na_server_close (hc->srv[i]);
+		sfree (hc->srv);
+	}
 
 	sfree (hc);
 
@@ -607,6 +628,143 @@ static data_volume_perf_t *get_volume_perf (cfg_volume_perf_t *cvp, /* {{{ */
 	return (new);
 } /* }}} data_volume_perf_t *get_volume_perf */
 
+/*
+ * Parallel API calls
+ *
+ * Each connection to a host handles one API call at a time. cna_run_jobs()
+ * calls "job" for the indexes 0 to jobs_num - 1, using one thread per
+ * connection: the calling thread with the first connection and one more
+ * thread for each further connection. A thread takes the next index until all
+ * jobs are done or one of them failed; the status of the first failed job is
+ * returned. Jobs running at the same time must not touch the same data.
+ */
+typedef int cna_job_t (host_config_t *host, na_server_t *srv,
+		size_t index, void *arg);
+
+typedef struct {
+	host_config_t *host;
+	cna_job_t *job;
+	void *arg;
+	size_t jobs_num;
+
+	pthread_mutex_t lock;
+	size_t next;
+	int status;
+} cna_jobs_t;
+
+typedef struct {
+	cna_jobs_t *jobs;
+	na_server_t *srv;
+} cna_worker_t;
+
+static void *cna_jobs_worker (void *arg) /* {{{ */
+{
+	cna_worker_t *w = arg;
+	cna_jobs_t *jobs = w->jobs;
+
+	while (42)
+	{
+		size_t index;
+		int status;
+
+		pthread_mutex_lock (&jobs->lock);
+		if ((jobs->status != 0) || (jobs->next >= jobs->jobs_num))
+		{
+			pthread_mutex_unlock (&jobs->lock);
+			break;
+		}
+		index = jobs->next;
+		jobs->next++;
+		pthread_mutex_unlock (&jobs->lock);
+
+		status = jobs->job (jobs->host, w->srv, index, jobs->arg);
+		if (status != 0)
+		{
+			pthread_mutex_lock (&jobs->lock);
+			if (jobs->status == 0)
+				jobs->status = status;
+			pthread_mutex_unlock (&jobs->lock);
+		}
+	}
+
+	return (NULL);
+} /* }}} void *cna_jobs_worker */
+
+static int cna_run_jobs (host_config_t *host, cna_job_t *job, /* {{{ */
+		void *arg, size_t jobs_num)
+{
+	cna_jobs_t jobs;
+	cna_worker_t *workers;
+	pthread_t *threads;
+	_Bool *started;
+	size_t workers_num;
+	size_t i;
+
+	memset (&jobs, 0, sizeof (jobs));
+	jobs.host = host;
+	jobs.job = job;
+	jobs.arg = arg;
+	jobs.jobs_num = jobs_num;
+	pthread_mutex_init (&jobs.lock, /* attr = */ NULL);
+
+	workers_num = (size_t) host->connections;
+	if (workers_num > jobs_num)
+		workers_num = jobs_num;
+	if (workers_num < 1)
+		workers_num = 1;
+
+	workers = calloc (workers_num, sizeof (*workers));
+	threads = calloc (workers_num, sizeof (*threads));
+	started = calloc (workers_num, sizeof (*started));
+	if ((workers == NULL) || (threads == NULL) || (started == NULL))
+	{
+		cna_worker_t w = { &jobs, host->srv[0] };
+
+		sfree (workers);
+		sfree (threads);
+		sfree (started);
+		cna_jobs_worker (&w);
+		pthread_mutex_destroy (&jobs.lock);
+		return (jobs.status);
+	}
+
+	for (i = 0; i < workers_num; i++)
+	{
+		workers[i].jobs = &jobs;
+		workers[i].srv = host->srv[i];
+	}
+
+	/* If a thread cannot be started, the others do its share. */
+	for (i = 1; i < workers_num; i++)
+	{
+		int status;
+
+		status = plugin_thread_create (&threads[i], /* attr = */ NULL,
+				cna_jobs_worker, &workers[i]);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("netapp plugin: plugin_thread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			continue;
+		}
+		started[i] = 1;
+	}
+
+	cna_jobs_worker (&workers[0]);
+
+	for (i = 1; i < workers_num; i++)
+		if (started[i])
+			pthread_join (threads[i], /* retval = */ NULL);
+
+	sfree (workers);
+	sfree (threads);
+	sfree (started);
+	pthread_mutex_destroy (&jobs.lock);
+
+	return (jobs.status);
+} /* }}} int cna_run_jobs */
+
 /*
  * Various submit functions.
  *
@@ -1009,7 +1167,8 @@ static int cna_setup_wafl (cfg_wafl_t *cw) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_wafl */
 
-static int cna_query_wafl (host_config_t *host) /* {{{ */
+static int cna_query_wafl (host_config_t *host, /* {{{ */
+		na_server_t *srv)
 {
 	na_elem_t *data;
 	int status;
@@ -1031,7 +1190,7 @@ static int cna_query_wafl (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_wafl->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_wafl->query);
+	data = na_server_invoke_elem(srv, host->cfg_wafl->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_wafl: na_server_invoke_elem failed for host %s: %s",
@@ -1204,7 +1363,8 @@ static int cna_setup_disk (cfg_disk_t *cd) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_disk */
 
-static int cna_query_disk (host_config_t *host) /* {{{ */
+static int cna_query_disk (host_config_t *host, /* {{{ */
+		na_server_t *srv)
 {
 	na_elem_t *data;
 	int status;
@@ -1227,7 +1387,7 @@ static int cna_query_disk (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_disk->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_disk->query);
+	data = na_server_invoke_elem(srv, host->cfg_disk->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_disk: na_server_invoke_elem failed for host %s: %s",
@@ -1247,14 +1407,23 @@ static int cna_query_disk (host_config_t *host) /* {{{ */
 } /* }}} int cna_query_disk */
 
 /* Data corresponding to <VolumePerf /> */
+static na_elem_t *cna_volume_perf_query_new (void);
+
 static int cna_handle_volume_perf_data (const char *hostname, /* {{{ */
-		cfg_volume_perf_t *cvp, na_elem_t *data, cdtime_t interval)
+		cfg_volume_perf_t *cvp, na_elem_t *data, cdtime_t interval,
+		_Bool all_instances)
 {
 	cdtime_t timestamp;
 	na_elem_t *elem_instances;
 	na_elem_iter_t iter_instances;
 	na_elem_t *elem_instance;
 
+	/* The names of the volumes that are not ignored, if "data" has all
+	 * instances. */
+	na_elem_t *selected = NULL;
+	size_t selected_num = 0;
+	size_t instances_num = 0;
+
 	timestamp = cna_child_get_cdtime (data);
 
 	elem_instances = na_elem_child(data, "instances");
@@ -1266,6 +1435,9 @@ static int cna_handle_volume_perf_data (const char *hostname, /* {{{ */
 		return (-1);
 	}
 
+	if (all_instances)
+		selected = na_elem_new ("instances");
+
 	iter_instances = na_child_iterator (elem_instances);
 	for (elem_instance = na_iterator_next(&iter_instances);
 			elem_instance != NULL;
@@ -1287,11 +1459,19 @@ static int cna_handle_volume_perf_data (const char *hostname, /* {{{ */
 		if (name == NULL)
 			continue;
 
+		instances_num++;
+
 		/* get_volume_perf may return NULL if this volume is to be ignored. */
 		v = get_volume_perf (cvp, name);
 		if (v == NULL)
 			continue;
 
+		if (selected != NULL)
+		{
+			na_child_add_string (selected, "instance", name);
+			selected_num++;
+		}
+
 		elem_counters = na_elem_child (elem_instance, "counters");
 		if (elem_counters == NULL)
 			continue;
@@ -1336,34 +1516,53 @@ static int cna_handle_volume_perf_data (const char *hostname, /* {{{ */
 		submit_volume_perf_data (hostname, v, &perf_data, interval);
 	} /* for (volume) */
 
+	if (selected == NULL)
+		return (0);
+
+	if (cvp->query_selected != NULL)
+	{
+		na_elem_free (cvp->query_selected);
+		cvp->query_selected = NULL;
+	}
+	cvp->query_selected_reads = 0;
+
+	/* Only worth it if some volumes are ignored. */
+	if ((selected_num == 0) || (selected_num == instances_num))
+	{
+		na_elem_free (selected);
+		return (0);
+	}
+
+	cvp->query_selected = cna_volume_perf_query_new ();
+	if (cvp->query_selected == NULL)
+	{
+		na_elem_free (selected);
+		return (0);
+	}
+	na_child_add (cvp->query_selected, selected);
+
 	return (0);
 } /* }}} int cna_handle_volume_perf_data */
 
-static int cna_setup_volume_perf (cfg_volume_perf_t *cd) /* {{{ */
+static na_elem_t *cna_volume_perf_query_new (void) /* {{{ */
 {
+	na_elem_t *query;
 	na_elem_t *e;
 
-	if (cd == NULL)
-		return (EINVAL);
-
-	if (cd->query != NULL)
-		return (0);
-
-	cd->query = na_elem_new ("perf-object-get-instances");
-	if (cd->query == NULL)
+	query = na_elem_new ("perf-object-get-instances");
+	if (query == NULL)
 	{
 		ERROR ("netapp plugin: na_elem_new failed.");
-		return (-1);
+		return (NULL);
 	}
-	na_child_add_string (cd->query, "objectname", "volume");
+	na_child_add_string (query, "objectname", "volume");
 
 	e = na_elem_new("counters");
 	if (e == NULL)
 	{
-		na_elem_free (cd->query);
-		cd->query = NULL;
+		na_elem_free (query);
 		ERROR ("netapp plugin: na_elem_new failed.");
-		return (-1);
+		return (NULL);
 	}
 	na_child_add_string(e, "counter", "read_ops");
 	na_child_add_string(e, "counter", "write_ops");
@@ -1371,13 +1570,30 @@ static int cna_setup_volume_perf (cfg_volume_perf_t *cd) /* {{{ */
 	na_child_add_string(e, "counter", "write_data");
 	na_child_add_string(e, "counter", "read_latency");
 	na_child_add_string(e, "counter", "write_latency");
-	na_child_add(cd->query, e);
+	na_child_add(query, e);
+
+	return (query);
+} /* }}} na_elem_t *cna_volume_perf_query_new */
+
+static int cna_setup_volume_perf (cfg_volume_perf_t *cd) /* {{{ */
+{
+	if (cd == NULL)
+		return (EINVAL);
+
+	if (cd->query != NULL)
+		return (0);
+
+	cd->query = cna_volume_perf_query_new ();
+	if (cd->query == NULL)
+		return (-1);
 
 	return (0);
 } /* }}} int cna_setup_volume_perf */
 
-static int cna_query_volume_perf (host_config_t *host) /* {{{ */
+static int cna_query_volume_perf (host_config_t *host, /* {{{ */
+		na_server_t *srv)
 {
+	na_elem_t *query;
 	na_elem_t *data;
 	int status;
 	cdtime_t now;
@@ -1399,17 +1615,30 @@ static int cna_query_volume_perf (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_volume_perf->query != NULL);
 
-	data = na_server_invoke_elem (host->srv, host->cfg_volume_perf->query);
+	/* Only fetch the volumes we are interested in, unless the list is due
+	 * for a refresh. */
+	query = host->cfg_volume_perf->query;
+	if ((host->cfg_volume_perf->query_selected != NULL)
+			&& (host->cfg_volume_perf->query_selected_reads < CNA_INSTANCES_REFRESH))
+	{
+		query = host->cfg_volume_perf->query_selected;
+		host->cfg_volume_perf->query_selected_reads++;
+	}
+
+	data = na_server_invoke_elem (srv, query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_volume_perf: na_server_invoke_elem failed for host %s: %s",
 				host->name, na_results_reason (data));
 		na_elem_free (data);
+		/* E.g. a selected volume has been deleted. */
+		host->cfg_volume_perf->query_selected_reads = CNA_INSTANCES_REFRESH;
 		return (-1);
 	}
 
 	status = cna_handle_volume_perf_data (host->name, host->cfg_volume_perf, data,
-			host->cfg_volume_perf->interval.interval);
+			host->cfg_volume_perf->interval.interval,
+			/* all instances = */ query == host->cfg_volume_perf->query);
 
 	if (status == 0)
 		host->cfg_volume_perf->interval.last_read = now;
@@ -1543,13 +1772,13 @@ static int cna_change_volume_status (const char *hostname, /* {{{ */
 } /* }}} int cna_change_volume_status */
 
 static void cna_handle_volume_snap_usage(const host_config_t *host, /* {{{ */
-		data_volume_usage_t *v)
+		na_server_t *srv, data_volume_usage_t *v)
 {
 	uint64_t snap_used = 0, value;
 	na_elem_t *data, *elem_snap, *elem_snapshots;
 	na_elem_iter_t iter_snap;
 
-	data = na_server_invoke_elem(host->srv, v->snap_query);
+	data = na_server_invoke_elem(srv, v->snap_query);
 	if (na_results_status(data) != NA_OK)
 	{
 		if (na_results_errno(data) == EVOLUMEOFFLINE) {
@@ -1595,6 +1824,17 @@ static void cna_handle_volume_snap_usage(const host_config_t *host, /* {{{ */
 	v->flags |= HAVE_VOLUME_USAGE_SNAP_USED;
 } /* }}} void cna_handle_volume_snap_usage */
 
+/* cna_job_t querying the snapshots of the volume at "index" of the array
+ * "arg". */
+static int cna_volume_snap_usage_job (host_config_t *host, /* {{{ */
+		na_server_t *srv, size_t index, void *arg)
+{
+	data_volume_usage_t **volumes = arg;
+
+	cna_handle_volume_snap_usage (host, srv, volumes[index]);
+	return (0);
+} /* }}} int cna_volume_snap_usage_job */
+
 static void cna_handle_volume_sis_data (const host_config_t *host, /* {{{ */
 		data_volume_usage_t *v, na_elem_t *sis)
 {
@@ -1690,13 +1930,18 @@ static void cna_handle_volume_sis_saved (const host_config_t *host, /* {{{ */
 	}
 } /* }}} void cna_handle_volume_sis_saved */
 
-static int cna_handle_volume_usage_data (const host_config_t *host, /* {{{ */
+static int cna_handle_volume_usage_data (host_config_t *host, /* {{{ */
 		cfg_volume_usage_t *cfg_volume, na_elem_t *data)
 {
 	na_elem_t *elem_volume;
 	na_elem_t *elem_volumes;
 	na_elem_iter_t iter_volume;
 
+	/* Volumes whose snapshots are queried once all volumes are handled. */
+	data_volume_usage_t **snap_volumes = NULL;
+	size_t snap_volumes_num = 0;
+	size_t snap_volumes_size = 0;
+
 	elem_volumes = na_elem_child (data, "volumes");
 	if (elem_volumes == NULL)
 	{
@@ -1732,7 +1977,25 @@ static int cna_handle_volume_usage_data (const host_config_t *host, /* {{{ */
 			continue;
 
 		if ((v->flags & CFG_VOLUME_USAGE_SNAP) != 0)
-			cna_handle_volume_snap_usage(host, v);
+		{
+			if (snap_volumes_num >= snap_volumes_size)
+			{
+				data_volume_usage_t **tmp;
+				size_t size = (snap_volumes_size == 0) ? 64 : 2 * snap_volumes_size;
+
+				tmp = realloc (snap_volumes, size * sizeof (*snap_volumes));
+				if (tmp != NULL)
+				{
+					snap_volumes = tmp;
+					snap_volumes_size = size;
+				}
+			}
+
+			if (snap_volumes_num < snap_volumes_size)
+				snap_volumes[snap_volumes_num++] = v;
+			else
+				cna_handle_volume_snap_usage (host, host->srv[0], v);
+		}
 
 		if ((v->flags & CFG_VOLUME_USAGE_DF) == 0)
 			continue;
@@ -1764,6 +2027,12 @@ static int cna_handle_volume_usage_data (const host_config_t *host, /* {{{ */
 		}
 	} /* for (elem_volume) */
 
+	/* One API call per volume: spread them over all connections. */
+	if (snap_volumes_num > 0)
+		cna_run_jobs (host, cna_volume_snap_usage_job, snap_volumes,
+				snap_volumes_num);
+	sfree (snap_volumes);
+
 	return (cna_submit_volume_usage_data (host->name, cfg_volume,
 				host->cfg_volume_usage->interval.interval));
 } /* }}} int cna_handle_volume_usage_data */
@@ -1809,7 +2078,7 @@ static int cna_query_volume_usage (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_volume_usage->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_volume_usage->query);
+	data = na_server_invoke_elem(host->srv[0], host->cfg_volume_usage->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_volume_usage: na_server_invoke_elem failed for host %s: %s",
@@ -1912,7 +2181,8 @@ static int cna_setup_quota (cfg_quota_t *cq) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_quota */
 
-static int cna_query_quota (host_config_t *host) /* {{{ */
+static int cna_query_quota (host_config_t *host, /* {{{ */
+		na_server_t *srv)
 {
 	na_elem_t *data;
 	int status;
@@ -1935,7 +2205,7 @@ static int cna_query_quota (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_quota->query != NULL);
 
-	data = na_server_invoke_elem (host->srv, host->cfg_quota->query);
+	data = na_server_invoke_elem (srv, host->cfg_quota->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_quota: na_server_invoke_elem failed for host %s: %s",
@@ -2012,7 +2282,7 @@ static int cna_handle_snapvault_data (const char *hostname, /* {{{ */
 } /* }}} int cna_handle_snapvault_data */
 
 static int cna_handle_snapvault_iter (host_config_t *host, /* {{{ */
-		na_elem_t *data)
+		na_server_t *srv, na_elem_t *data)
 {
 	const char *tag;
 
@@ -2032,7 +2302,7 @@ static int cna_handle_snapvault_iter (host_config_t *host, /* {{{ */
 	for (i = 0; i < records_count; ++i) {
 		na_elem_t *elem;
 
-		elem = na_server_invoke (host->srv,
+		elem = na_server_invoke (srv,
 				"snapvault-secondary-relationship-status-list-iter-next",
 				"maximum", "1", "tag", tag, NULL);
 
@@ -2050,7 +2320,7 @@ static int cna_handle_snapvault_iter (host_config_t *host, /* {{{ */
 		na_elem_free (elem);
 	}
 
-	na_elem_free (na_server_invoke (host->srv,
+	na_elem_free (na_server_invoke (srv,
 			"snapvault-secondary-relationship-status-list-iter-end",
 			"tag", tag, NULL));
 	return (0);
@@ -2074,7 +2344,8 @@ static int cna_setup_snapvault (cfg_snapvault_t *sv) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_snapvault */
 
-static int cna_query_snapvault (host_config_t *host) /* {{{ */
+static int cna_query_snapvault (host_config_t *host, /* {{{ */
+		na_server_t *srv)
 {
 	na_elem_t *data;
 	int status;
@@ -2095,7 +2366,7 @@ static int cna_query_snapvault (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_snapvault->query != NULL);
 
-	data = na_server_invoke_elem (host->srv, host->cfg_snapvault->query);
+	data = na_server_invoke_elem (srv, host->cfg_snapvault->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_snapvault: na_server_invoke_elem failed for host %s: %s",
@@ -2104,7 +2375,7 @@ static int cna_query_snapvault (host_config_t *host) /* {{{ */
 		return (-1);
 	}
 
-	status = cna_handle_snapvault_iter (host, data);
+	status = cna_handle_snapvault_iter (host, srv, data);
 
 	if (status == 0)
 		host->cfg_snapvault->interval.last_read = now;
@@ -2232,7 +2503,8 @@ static int cna_setup_system (cfg_system_t *cs) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_system */
 
-static int cna_query_system (host_config_t *host) /* {{{ */
+static int cna_query_system (host_config_t *host, /* {{{ */
+		na_server_t *srv)
 {
 	na_elem_t *data;
 	int status;
@@ -2254,7 +2526,7 @@ static int cna_query_system (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_system->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_system->query);
+	data = na_server_invoke_elem(srv, host->cfg_system->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_system: na_server_invoke_elem failed for host %s: %s",
@@ -2827,6 +3099,7 @@ static host_config_t *cna_alloc_host (void) /* {{{ */
 	host->username = NULL;
 	host->password = NULL;
 	host->vfiler = NULL;
+	host->connections = 1;
 	host->srv = NULL;
 	host->cfg_wafl = NULL;
 	host->cfg_disk = NULL;
@@ -2886,6 +3159,7 @@ static host_config_t *cna_shallow_clone_host (host_config_t *host) /* {{{ */
 	}
 
 	clone->interval = host->interval;
+	clone->connections = host->connections;
 
 	return (clone);
 } /* }}} host_config_t *cna_shallow_clone_host */
@@ -2961,6 +3235,13 @@ static int cna_config_host (host_config_t *host, /* {{{ */
 			status = cf_util_get_string (item, &host->password);
 		} else if (!strcasecmp(item->key, "Interval")) {
 			status = cf_util_get_cdtime (item, &host->interval);
+		} else if (!strcasecmp(item->key, "Connections")) {
+			status = cf_util_get_int (item, &host->connections);
+			if ((status == 0) && (host->connections < 1)) {
+				WARNING ("netapp plugin: \"Connections\" must be at least 1. "
+						"Ignoring host block \"%s\".", ci->values[0].value.string);
+				status = -1;
+			}
 		} else if (!strcasecmp(item->key, "WAFL")) {
 			cna_config_wafl(host, item);
 		} else if (!strcasecmp(item->key, "Disks")) {
@@ -3030,38 +3311,34 @@ static int cna_config_host (host_config_t *host, /* {{{ */
  *
  * Pretty standard stuff here.
  */
-static int cna_init_host (host_config_t *host) /* {{{ */
+static na_server_t *cna_open_server (host_config_t *host) /* {{{ */
 {
 	/* Request version 1.1 of the ONTAP API */
 	int major_version = 1, minor_version = 1;
-
-	if (host == NULL)
-		return (EINVAL);
-
-	if (host->srv != NULL)
-		return (0);
+	na_server_t *srv;
 
 	if (host->vfiler != NULL) /* Request version 1.7 of the ONTAP API */
 		minor_version = 7;
 
-	host->srv = na_server_open (host->host, major_version, minor_version);
-	if (host->srv == NULL) {
+	srv = na_server_open (host->host, major_version, minor_version);
+	if (srv == NULL) {
 		ERROR ("netapp plugin: na_server_open (%s) failed.", host->host);
-		return (-1);
+		return (NULL);
 	}
 
-	na_server_set_transport_type(host->srv, host->protocol,
+	na_server_set_transport_type(srv, host->protocol,
 			/* transportarg = */ NULL);
-	na_server_set_port(host->srv, host->port);
-	na_server_style(host->srv, NA_STYLE_LOGIN_PASSWORD);
-	na_server_adminuser(host->srv, host->username, host->password);
-	na_server_set_timeout(host->srv, 5 /* seconds */);
+	na_server_set_port(srv, host->port);
+	na_server_style(srv, NA_STYLE_LOGIN_PASSWORD);
+	na_server_adminuser(srv, host->username, host->password);
+	na_server_set_timeout(srv, 5 /* seconds */);
 
 	if (host->vfiler != NULL) {
-		if (! na_server_set_vfiler (host->srv, host->vfiler)) {
+		if (! na_server_set_vfiler (srv, host->vfiler)) {
 			ERROR ("netapp plugin: Failed to connect to VFiler '%s' on host '%s'.",
 					host->vfiler, host->host);
-			return (-1);
+			na_server_close (srv);
+			return (NULL);
 		}
 		else {
 			INFO ("netapp plugin: Connected to VFiler '%s' on host '%s'.",
@@ -3069,6 +3346,50 @@ static int cna_init_host (host_config_t *host) /* {{{ */
 		}
 	}
 
+	return (srv);
+} /* }}} na_server_t *cna_open_server */
+
+static void cna_close_host (host_config_t *host) /* {{{ */
+{
+	int i;
+
+	if (host->srv == NULL)
+		return;
+
+	for (i = 0; i < host->connections; i++)
+	{
+		if (host->srv[i] != NULL)
+			na_server_close (host->srv[i]);
+		host->srv[i] = NULL;
+	}
+} /* }}} void cna_close_host */
+
+static int cna_init_host (host_config_t *host) /* {{{ */
+{
+	int i;
+
+	if (host == NULL)
+		return (EINVAL);
+
+	if (host->srv == NULL)
+	{
+		host->srv = calloc ((size_t) host->connections, sizeof (*host->srv));
+		if (host->srv == NULL) {
+			ERROR ("netapp plugin: calloc failed.");
+			return (-1);
+		}
+	}
+
+	for (i = 0; i < host->connections; i++)
+	{
+		if (host->srv[i] != NULL)
+			continue;
+
+		host->srv[i] = cna_open_server (host);
+		if (host->srv[i] == NULL)
+			return (-1);
+	}
+
 	return (0);
 } /* }}} int cna_init_host */
 
@@ -3086,37 +3407,37 @@ static int cna_init (void) /* {{{ */
 	return (0);
 } /* }}} cna_init */
 
-static int cna_read_internal (host_config_t *host) { /* {{{ */
-	int status;
+/* The query groups that need a single connection each. They use separate
+ * data, so they may run at the same time. */
+static int (*const cna_queries[]) (host_config_t *, na_server_t *) = {
+	cna_query_wafl,
+	cna_query_disk,
+	cna_query_volume_perf,
+	cna_query_quota,
+	cna_query_snapvault,
+	cna_query_system
+};
 
-	status = cna_query_wafl (host);
-	if (status != 0)
-		return (status);
+static int cna_query_job (host_config_t *host, na_server_t *srv, /* {{{ */
+		size_t index, void __attribute__((unused)) *arg)
+{
+	return (cna_queries[index] (host, srv));
+} /* }}} int cna_query_job */
 
-	status = cna_query_disk (host);
-	if (status != 0)
-		return (status);
+static int cna_read_internal (host_config_t *host) { /* {{{ */
+	int status;
 
-	status = cna_query_volume_perf (host);
+	status = cna_run_jobs (host, cna_query_job, /* arg = */ NULL,
+			STATIC_ARRAY_SIZE (cna_queries));
 	if (status != 0)
 		return (status);
 
+	/* Uses all connections for the per-volume snapshot queries, so it runs
+	 * once the other groups are done. */
 	status = cna_query_volume_usage (host);
 	if (status != 0)
 		return (status);
 
-	status = cna_query_quota (host);
-	if (status != 0)
-		return (status);
-
-	status = cna_query_snapvault (host);
-	if (status != 0)
-		return (status);
-
-	status = cna_query_system (host);
-	if (status != 0)
-		return (status);
-
 	return 0;
 } /* }}} int cna_read_internal */
 
@@ -3135,11 +3456,7 @@ static int cna_read (user_data_t *ud) { /* {{{ */
 
 	status = cna_read_internal (host);
 	if (status != 0)
-	{
-		if (host->srv != NULL)
-			na_server_close (host->srv);
-		host->srv = NULL;
-	}
+		cna_close_host (host);
 
 	return 0;
 } /* }}} int cna_read */
@@ -24,6 +24,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For sendmmsg(2) */
 
 #include "collectd.h"
 #include "plugin.h"
@@ -33,6 +34,11 @@
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
+#include "utils_handover.h"
+#include "utils_intern.h"
+#include "utils_probe.h"
+#include "utils_random.h"
+#include "utils_recv_batch.h"
 
 #include "network.h"
 
@@ -55,6 +61,10 @@
 # include <net/if.h>
 #endif
 
+#if HAVE_LIBLZ4
+# include <lz4.h>
+#endif
+
 #if HAVE_LIBGCRYPT
 # include <pthread.h>
 # if defined __APPLE__
@@ -105,6 +115,67 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 # define SECURITY_LEVEL_SIGN    1
 # define SECURITY_LEVEL_ENCRYPT 2
 #endif
+
+/* Maximum number of packets sent to one server with a single system call if
+ * sendmmsg(2) is available. */
+#define SEND_BATCH_SIZE 32
+/* Maximum number of packets queued for one server. If the send thread can't
+ * keep up, further packets for that server are dropped. */
+#define SEND_QUEUE_MAX 1024
+
+/* With "Protocol TCP", packets are written to a connection, each preceded by
+ * its length as a 32 bit integer in network byte order. STREAM_BUFFER_SIZE
+ * bytes of packets are coalesced into one write. */
+#define STREAM_BUFFER_SIZE 65536
+/* Failed connections are retried after STREAM_BACKOFF_MIN, doubling up to
+ * STREAM_BACKOFF_MAX. */
+#define STREAM_BACKOFF_MIN TIME_T_TO_CDTIME_T (1)
+#define STREAM_BACKOFF_MAX TIME_T_TO_CDTIME_T (60)
+/* A connection which can't be established or written to for this long is
+ * closed. */
+#define STREAM_TIMEOUT TIME_T_TO_CDTIME_T (10)
+/* Interval in which a pending connect(2) or a full socket is checked. */
+#define STREAM_POLL_INTERVAL MS_TO_CDTIME_T (100)
+/* Time to write the remaining packets on shutdown. */
+#define STREAM_DRAIN_TIMEOUT TIME_T_TO_CDTIME_T (2)
+/* Maximum number of connections accepted by one receive thread. */
+#define STREAM_MAX_CONNECTIONS 1024
+
+/* The duplicate filter, see network_filter_seen(), has FILTER_SHARDS shards
+ * of FILTER_SHARD_BITS bits per window. Each value sets FILTER_HASHES bits. */
+#define FILTER_SHARDS 16
+#define FILTER_SHARD_BITS (1 << 19)
+#define FILTER_HASHES 3
+
+/* A packet waiting to be sent by the send thread. The data follows the
+ * struct in the same allocation. */
+struct send_packet_s
+{
+	size_t size;
+	struct send_packet_s *next;
+};
+typedef struct send_packet_s send_packet_t;
+
+/* Maximum number of identifiers in the dictionary of one server and of one
+ * dispatch thread. */
+#define DICT_MAX_ENTRIES 1048576
+/* Dictionary entries unused for this long are removed. */
+#define DICT_EXPIRE TIME_T_TO_CDTIME_T (900)
+
+/* An identifier in the dictionary of a server, see add_to_buffer_id(). */
+struct dict_send_entry_s
+{
+	identifier_t id;
+	uint32_t     dict_id;
+	/* Last time the definition was sent, zero if it has to be sent with
+	 * the next use. */
+	cdtime_t     defined;
+	unsigned long generation;
+	cdtime_t     used;
+	struct dict_send_entry_s *next;
+};
+typedef struct dict_send_entry_s dict_send_entry_t;
+
 struct sockent_client
 {
 	int fd;
@@ -119,17 +190,75 @@ struct sockent_client
 #endif
 	cdtime_t next_resolve_reconnect;
 	cdtime_t resolve_interval;
+	/* Compress packets with LZ4 before signing or encrypting them. */
+	_Bool compress;
+
+	/* "Protocol TCP": the packets are written to stream_buffer and from
+	 * there to a non-blocking connection. Only used by the send thread. */
+	_Bool    stream;
+	_Bool    stream_connecting;
+	cdtime_t stream_connect_started;
+	cdtime_t stream_next_connect;
+	cdtime_t stream_backoff;
+	cdtime_t stream_last_write;
+	char    *stream_buffer;
+	size_t   stream_buffer_size;
+	size_t   stream_buffer_fill;
+
+	/* Identifier dictionary: a hash table with dict_table_size slots, a
+	 * power of two. Protected by send_lock. The definitions are sent again
+	 * after dict_refresh and when dict_generation changes, i.e. the socket
+	 * has been re-opened. */
+	_Bool               dict_enabled;
+	cdtime_t            dict_refresh;
+	uint64_t            dict_session;
+	uint32_t            dict_next_id;
+	unsigned long       dict_generation;
+	dict_send_entry_t **dict_table;
+	size_t              dict_table_size;
+	size_t              dict_num;
+	cdtime_t            dict_last_purge;
+
+	/* Buffer in which to-be-sent network packets are constructed and the
+	 * queue of full packets. Both are protected by send_lock; the sockets
+	 * and the cypher above are only used by the send thread. */
+	pthread_mutex_t send_lock;
+	char           *send_buffer;
+	size_t          send_buffer_size;
+	size_t          send_buffer_fill;
+	cdtime_t        send_buffer_first_update;
+	cdtime_t        send_buffer_last_update;
+	value_list_t    send_buffer_vl;
+	/* The session part has been written to send_buffer. */
+	_Bool           send_buffer_session;
+	/* Send partially filled buffers after this time, zero to disable. */
+	cdtime_t        flush_interval;
+
+	send_packet_t  *send_queue_head;
+	send_packet_t  *send_queue_tail;
+	size_t          send_queue_length;
+
+#if HAVE_SENDMMSG
+	/* Packets collected by network_send_buffer_plain(), only used by the
+	 * send thread. Each slot has batch_slot_size bytes. */
+	char          *batch_data;
+	size_t         batch_slot_size;
+	size_t         batch_num;
+	struct mmsghdr batch_msgs[SEND_BATCH_SIZE];
+	struct iovec   batch_iovs[SEND_BATCH_SIZE];
+#endif
 };
 
 struct sockent_server
 {
 	int *fd;
 	size_t fd_num;
+	/* "Protocol TCP": the sockets accept connections. */
+	_Bool stream;
 #if HAVE_LIBGCRYPT
 	int security_level;
 	char *auth_file;
 	fbhash_t *userdb;
-	gcry_cipher_hd_t cypher;
 #endif
 };
 
@@ -265,15 +394,194 @@ struct part_encryption_aes256_s
 };
 typedef struct part_encryption_aes256_s part_encryption_aes256_t;
 
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * ! Original length               ! LZ4 compressed parts ...      !
+ * +-------------------------------+                               +
+ * : :                                                             :
+ * +---------------------------------------------------------------+
+ */
+/* Minimum size */
+#define PART_COMPRESSION_LZ4_SIZE 6
+
+/* TYPE_ID_DEFINE is followed by a 32 bit id and the host, plugin, plugin
+ * instance, type and type instance, each terminated by a null byte.
+ * TYPE_ID_VALUES carries the values of a defined id:
+ *
+ *                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * ! Id                                                            !
+ * +---------------------------------------------------------------+
+ * ! Time delta (signed, relative to the last TIME part)           !
+ * +-------------------------------+-------------------------------+
+ * ! Number of values              ! Types and values ...          !
+ * +-------------------------------+                               +
+ * : :                                                             :
+ * +---------------------------------------------------------------+
+ *
+ * Ids are only valid within the TYPE_SESSION of the packet. */
+
 struct receive_list_entry_s
 {
   char *data;
   int  data_len;
   int  fd;
+  /* Hash of the sender's address, selects the dispatch queue. */
+  uint32_t sender_hash;
   struct receive_list_entry_s *next;
 };
 typedef struct receive_list_entry_s receive_list_entry_t;
 
+/* Packets waiting to be parsed by one dispatch thread. */
+struct receive_queue_s
+{
+  receive_list_entry_t *head;
+  receive_list_entry_t *tail;
+  pthread_mutex_t       lock;
+  pthread_cond_t        cond;
+  uint64_t              length;
+
+  /* Packets received but not yet moved to the list above. Only used by the
+   * receive thread. */
+  receive_list_entry_t *private_head;
+  receive_list_entry_t *private_tail;
+  uint64_t              private_length;
+
+  int       thread_running;
+  pthread_t thread_id;
+};
+typedef struct receive_queue_s receive_queue_t;
+
+/* A TCP connection accepted by a receive thread. */
+struct stream_conn_s
+{
+  int      listen_fd;
+  uint32_t sender_hash;
+  struct sockaddr_storage sender_addr;
+  /* Data read from the connection but not yet forming a complete packet. */
+  char    *buffer;
+  size_t   buffer_size;
+  size_t   buffer_fill;
+};
+typedef struct stream_conn_s stream_conn_t;
+
+/* Token bucket and counters of one sender address, see "SenderRateLimit". */
+struct sender_s
+{
+  uint32_t hash;
+  char     name[INET6_ADDRSTRLEN];
+  double   tokens;
+  cdtime_t last_seen; /* zero if the slot is unused */
+
+  derive_t packets_rx;
+  derive_t packets_dropped;
+  derive_t octets_rx;
+};
+typedef struct sender_s sender_t;
+
+/* A receive thread, reading from some of the listen sockets, and the
+ * dispatch threads parsing the packets it received. Packets from the same
+ * sender always go to the same queue, so they are dispatched in order. */
+struct receiver_s
+{
+  /* The first listen_num entries are listen sockets, the others the TCP
+   * connections described by conns. */
+  struct pollfd *pollfd;
+  size_t         pollfd_num;
+  size_t         listen_num;
+  _Bool         *listen_stream;
+
+  stream_conn_t *conns;
+  size_t         conns_num;
+
+  receive_queue_t *queues;
+  size_t           queues_num;
+
+  /* Written by the receive thread only. */
+  derive_t octets_rx;
+  derive_t packets_rx;
+  derive_t packets_dropped;
+
+  /* Senders of the packets read by this thread, SENDER_TABLE_SIZE slots, if
+   * "SenderRateLimit" is set. Packets are checked before they are queued, so
+   * a sender over its budget costs no parsing. senders_lock is only
+   * contended by network_stats_read(). */
+  sender_t       *senders;
+  pthread_mutex_t senders_lock;
+
+  int       receive_thread_running;
+  pthread_t receive_thread_id;
+};
+typedef struct receiver_s receiver_t;
+
+/* One shard of the Bloom filter of the (identifier, time) pairs received in
+ * the current and in the previous window. */
+struct filter_shard_s
+{
+  pthread_mutex_t lock;
+  uint64_t        bits[2][FILTER_SHARD_BITS / 64];
+  int             current;
+  cdtime_t        window_start;
+};
+typedef struct filter_shard_s filter_shard_t;
+
+/* An identifier received with a TYPE_ID_DEFINE part. Senders are told apart
+ * by their session. */
+struct dict_recv_entry_s
+{
+  uint64_t     session;
+  uint32_t     dict_id;
+  identifier_t id;
+  cdtime_t     used;
+};
+typedef struct dict_recv_entry_s dict_recv_entry_t;
+
+/* Per-thread state of the packet parser. The values array and the meta data
+ * are reused for all value lists parsed by one thread; plugin_dispatch_values()
+ * copies both before the value list is enqueued. */
+struct parse_state_s
+{
+  value_t *values;
+  size_t   values_size;
+
+  /* Holds "network:received" only. */
+  meta_data_t *meta;
+  /* Holds "network:received" and "network:username" = meta_username. */
+  meta_data_t *meta_user;
+  char        *meta_username;
+
+#if HAVE_LIBLZ4
+  /* Decompressed payload of an LZ4 part, UINT16_MAX bytes. */
+  char *lz4_buffer;
+#endif
+
+  /* Identifier dictionary of all senders whose packets are parsed by this
+   * thread. Packets of one sender always go to the same dispatch thread. */
+  c_avl_tree_t *dict;
+  cdtime_t      dict_last_purge;
+};
+typedef struct parse_state_s parse_state_t;
+
+/* Maximum number of datagrams read from one socket with a single system call
+ * if recvmmsg(2) is available. */
+#define RECEIVE_BATCH_SIZE 64
+/* Maximum number of receive list entries kept for re-use. */
+#define RECEIVE_FREE_LIST_MAX 4096
+
+/* Number of slots in the sender table of each receive thread and how many of
+ * them are tried for one sender. Senders not seen for SENDER_IDLE_TIMEOUT may
+ * be replaced. If all tried slots are in use, the sender shares the first
+ * one. */
+#define SENDER_TABLE_SIZE   4096
+#define SENDER_TABLE_PROBES 8
+#define SENDER_IDLE_TIMEOUT TIME_T_TO_CDTIME_T (60)
+
 /*
  * Private variables
  */
@@ -282,51 +590,77 @@ static int network_config_ttl = 0;
 static size_t network_config_packet_size = 1452;
 static _Bool network_config_forward = 0;
 static _Bool network_config_stats = 0;
+static _Bool network_config_filter = 0;
+/* Number of receive threads. With more than one, each listen address is
+ * opened this many times using SO_REUSEPORT. */
+static size_t network_config_receive_threads = 1;
+/* Number of dispatch threads per receive thread. */
+static size_t network_config_dispatch_threads = 1;
+/* Packets per second and bucket size per sender; zero: unlimited. */
+static double network_config_sender_rate = 0.0;
+static double network_config_sender_burst = 0.0;
 
 static sockent_t *sending_sockets = NULL;
 
-static receive_list_entry_t *receive_list_head = NULL;
-static receive_list_entry_t *receive_list_tail = NULL;
-static pthread_mutex_t       receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t        receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t              receive_list_length = 0;
+#if HAVE_LIBGCRYPT
+/* Each dispatch thread has its own cyphers for decrypting received packets,
+ * see network_get_server_cypher(). */
+static pthread_key_t server_cypher_key;
+#endif
+/* Each dispatch thread has its own parse_state_t, see network_parse_state(). */
+static pthread_key_t parse_state_key;
+
+/* Entries whose packets have been dispatched, ready to be filled again by
+ * the receive thread. Each has a buffer of network_config_packet_size bytes. */
+static receive_list_entry_t *receive_free_list = NULL;
+static size_t                receive_free_list_length = 0;
+static pthread_mutex_t       receive_free_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static sockent_t     *listen_sockets = NULL;
 static struct pollfd *listen_sockets_pollfd = NULL;
+/* Set for the listen sockets accepting TCP connections. */
+static _Bool         *listen_sockets_stream = NULL;
 static size_t         listen_sockets_num = 0;
 
 /* The receive and dispatch threads will run as long as `listen_loop' is set to
  * zero. */
-static int       listen_loop = 0;
-static int       receive_thread_running = 0;
-static pthread_t receive_thread_id;
-static int       dispatch_thread_running = 0;
-static pthread_t dispatch_thread_id;
-
-/* Buffer in which to-be-sent network packets are constructed. */
-static char            *send_buffer;
-static char            *send_buffer_ptr;
-static int              send_buffer_fill;
-static cdtime_t         send_buffer_last_update;
-static value_list_t     send_buffer_vl = VALUE_LIST_STATIC;
-static pthread_mutex_t  send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+static int         listen_loop = 0;
+static receiver_t *receivers = NULL;
+static size_t      receivers_num = 0;
+
+/* The send thread encrypts or signs and sends the queued packets of all
+ * servers. It is woken up by setting `send_thread_wakeup'. */
+static pthread_mutex_t send_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  send_thread_cond = PTHREAD_COND_INITIALIZER;
+static _Bool           send_thread_wakeup = 0;
+static _Bool           send_thread_loop = 0;
+static _Bool           send_thread_running = 0;
+static pthread_t       send_thread_id;
+#if HAVE_SENDMMSG
+/* Set when sendmmsg(2) returned ENOSYS. */
+static _Bool           send_no_sendmmsg = 0;
+#endif
 
 /* XXX: These counters are incremented from one place only. The spot in which
- * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
- * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
-static derive_t stats_octets_rx  = 0;
+ * the values are incremented is either locked by some lock or the stats_lock
+ * is acquired. The counters of received octets
+ * and packets are kept per receiver_t. The counters are always read without
+ * holding a lock in the hope that writing 8 bytes to memory is an atomic
+ * operation. */
 static derive_t stats_octets_tx  = 0;
-static derive_t stats_packets_rx = 0;
 static derive_t stats_packets_tx = 0;
 static derive_t stats_values_dispatched = 0;
 static derive_t stats_values_not_dispatched = 0;
+static derive_t stats_values_duplicate = 0;
 static derive_t stats_values_sent = 0;
 static derive_t stats_values_not_sent = 0;
 static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Allocated by network_init() if "DuplicateFilter" is enabled. Values are
+ * remembered for at least one network_filter_window. */
+static filter_shard_t *network_filter = NULL;
+static cdtime_t        network_filter_window = 0;
+
 /*
  * Private functions
  */
@@ -346,6 +680,63 @@ static _Bool check_receive_okay (const value_list_t *vl) /* {{{ */
   return (1);
 } /* }}} _Bool check_receive_okay */
 
+/* Returns true if a value list with the identifier and time of "vl" has been
+ * received within the last filter window, e.g. because it is forwarded in a
+ * loop, and remembers it otherwise. This is much cheaper than the cache
+ * lookup of check_receive_okay(). Like any Bloom filter, it may report a
+ * value which hasn't been seen, with a low probability. */
+static _Bool network_filter_seen (const value_list_t *vl, /* {{{ */
+    cdtime_t now)
+{
+  filter_shard_t *shard;
+  uint64_t hash;
+  size_t pos[FILTER_HASHES];
+  _Bool seen_current = 1;
+  _Bool seen_previous = 1;
+  size_t i;
+
+  /* The finalizer of SplitMix64, spreading the bits of the identifier's hash
+   * and the time over the whole word. */
+  hash = ((uint64_t) identifier_hash_vl (vl) << 32) ^ (uint64_t) vl->time;
+  hash = (hash ^ (hash >> 30)) * UINT64_C (0xbf58476d1ce4e5b9);
+  hash = (hash ^ (hash >> 27)) * UINT64_C (0x94d049bb133111eb);
+  hash = hash ^ (hash >> 31);
+
+  shard = network_filter + (hash >> 60) % FILTER_SHARDS;
+  for (i = 0; i < FILTER_HASHES; i++)
+    pos[i] = (size_t) (hash >> (19 * i)) % FILTER_SHARD_BITS;
+
+  pthread_mutex_lock (&shard->lock);
+
+  if ((shard->window_start + network_filter_window) <= now)
+  {
+    /* After two windows without any value, the current generation is too
+     * old to be kept as the previous one. */
+    if ((shard->window_start + 2 * network_filter_window) <= now)
+      memset (shard->bits[shard->current], 0,
+          sizeof (shard->bits[shard->current]));
+    shard->current = !shard->current;
+    memset (shard->bits[shard->current], 0,
+        sizeof (shard->bits[shard->current]));
+    shard->window_start = now;
+  }
+
+  for (i = 0; i < FILTER_HASHES; i++)
+  {
+    uint64_t mask = UINT64_C (1) << (pos[i] % 64);
+
+    if ((shard->bits[shard->current][pos[i] / 64] & mask) == 0)
+      seen_current = 0;
+    if ((shard->bits[!shard->current][pos[i] / 64] & mask) == 0)
+      seen_previous = 0;
+    shard->bits[shard->current][pos[i] / 64] |= mask;
+  }
+
+  pthread_mutex_unlock (&shard->lock);
+
+  return (seen_current || seen_previous);
+} /* }}} _Bool network_filter_seen */
+
 static _Bool check_send_okay (const value_list_t *vl) /* {{{ */
 {
   _Bool received = 0;
@@ -409,17 +800,141 @@ static _Bool check_send_notify_okay (const notification_t *n) /* {{{ */
   return (!received);
 } /* }}} _Bool check_send_notify_okay */
 
-static int network_dispatch_values (value_list_t *vl, /* {{{ */
+static int dict_recv_compare (const void *a, const void *b) /* {{{ */
+{
+  const dict_recv_entry_t *ea = a;
+  const dict_recv_entry_t *eb = b;
+
+  if (ea->session != eb->session)
+    return ((ea->session < eb->session) ? -1 : 1);
+  if (ea->dict_id != eb->dict_id)
+    return ((ea->dict_id < eb->dict_id) ? -1 : 1);
+  return (0);
+} /* }}} int dict_recv_compare */
+
+/* Destructor of parse_state_key. */
+static void network_free_parse_state (void *arg) /* {{{ */
+{
+  parse_state_t *ps = arg;
+
+  if (ps == NULL)
+    return;
+
+  sfree (ps->values);
+  meta_data_destroy (ps->meta);
+  meta_data_destroy (ps->meta_user);
+  sfree (ps->meta_username);
+#if HAVE_LIBLZ4
+  sfree (ps->lz4_buffer);
+#endif
+  if (ps->dict != NULL)
+  {
+    dict_recv_entry_t *e;
+    void *key;
+
+    while (c_avl_pick (ps->dict, &key, (void *) &e) == 0)
+    {
+      identifier_destroy (&e->id);
+      sfree (e);
+    }
+    c_avl_destroy (ps->dict);
+  }
+  sfree (ps);
+} /* }}} void network_free_parse_state */
+
+static parse_state_t *network_parse_state (void) /* {{{ */
+{
+  parse_state_t *ps;
+
+  ps = pthread_getspecific (parse_state_key);
+  if (ps != NULL)
+    return (ps);
+
+  ps = calloc (1, sizeof (*ps));
+  if (ps == NULL)
+  {
+    ERROR ("network plugin: network_parse_state: calloc failed.");
+    return (NULL);
+  }
+
+  ps->dict = c_avl_create (dict_recv_compare);
+  ps->meta = meta_data_create ();
+  if ((ps->dict == NULL) || (ps->meta == NULL)
+      || (meta_data_add_boolean (ps->meta, "network:received", 1) != 0))
+  {
+    ERROR ("network plugin: network_parse_state: "
+        "Initializing the parser state failed.");
+    network_free_parse_state (ps);
+    return (NULL);
+  }
+
+  pthread_setspecific (parse_state_key, ps);
+  return (ps);
+} /* }}} parse_state_t *network_parse_state */
+
+/* Returns the meta data to attach to value lists received from "username".
+ * The meta data of the last user is kept, so it is only rebuilt when packets
+ * of several users are interleaved. */
+static meta_data_t *network_received_meta (parse_state_t *ps, /* {{{ */
     const char *username)
 {
-  int status;
+  meta_data_t *meta;
+
+  if (username == NULL)
+    return (ps->meta);
+
+  if ((ps->meta_username != NULL)
+      && (strcmp (ps->meta_username, username) == 0))
+    return (ps->meta_user);
+
+  meta_data_destroy (ps->meta_user);
+  ps->meta_user = NULL;
+  sfree (ps->meta_username);
+
+  meta = meta_data_create ();
+  if (meta == NULL)
+  {
+    ERROR ("network plugin: meta_data_create failed.");
+    return (NULL);
+  }
 
+  if ((meta_data_add_boolean (meta, "network:received", 1) != 0)
+      || (meta_data_add_string (meta, "network:username", username) != 0))
+  {
+    ERROR ("network plugin: Adding meta data failed.");
+    meta_data_destroy (meta);
+    return (NULL);
+  }
+
+  ps->meta_username = strdup (username);
+  if (ps->meta_username == NULL)
+  {
+    ERROR ("network plugin: strdup failed.");
+    meta_data_destroy (meta);
+    return (NULL);
+  }
+
+  ps->meta_user = meta;
+  return (meta);
+} /* }}} meta_data_t *network_received_meta */
+
+static int network_dispatch_values (parse_state_t *ps, /* {{{ */
+    value_list_t *vl, const char *username)
+{
   if ((vl->time <= 0)
-      || (strlen (vl->host) <= 0)
-      || (strlen (vl->plugin) <= 0)
-      || (strlen (vl->type) <= 0))
+      || (vl->host[0] == 0)
+      || (vl->plugin[0] == 0)
+      || (vl->type[0] == 0))
     return (-EINVAL);
 
+  if ((network_filter != NULL) && network_filter_seen (vl, cdtime ()))
+  {
+    pthread_mutex_lock (&stats_lock);
+    stats_values_duplicate++;
+    pthread_mutex_unlock (&stats_lock);
+    return (0);
+  }
+
   if (!check_receive_okay (vl))
   {
 #if COLLECT_DEBUG
@@ -429,44 +944,25 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
     DEBUG ("network plugin: network_dispatch_values: "
 	"NOT dispatching %s.", name);
 #endif
+    pthread_mutex_lock (&stats_lock);
     stats_values_not_dispatched++;
+    pthread_mutex_unlock (&stats_lock);
     return (0);
   }
 
   assert (vl->meta == NULL);
 
-  vl->meta = meta_data_create ();
+  /* The meta data is shared by all value lists received by this thread.
+   * plugin_dispatch_values() clones it, so it is never modified. */
+  vl->meta = network_received_meta (ps, username);
   if (vl->meta == NULL)
-  {
-    ERROR ("network plugin: meta_data_create failed.");
     return (-ENOMEM);
-  }
-
-  status = meta_data_add_boolean (vl->meta, "network:received", 1);
-  if (status != 0)
-  {
-    ERROR ("network plugin: meta_data_add_boolean failed.");
-    meta_data_destroy (vl->meta);
-    vl->meta = NULL;
-    return (status);
-  }
-
-  if (username != NULL)
-  {
-    status = meta_data_add_string (vl->meta, "network:username", username);
-    if (status != 0)
-    {
-      ERROR ("network plugin: meta_data_add_string failed.");
-      meta_data_destroy (vl->meta);
-      vl->meta = NULL;
-      return (status);
-    }
-  }
 
   plugin_dispatch_values (vl);
+  pthread_mutex_lock (&stats_lock);
   stats_values_dispatched++;
+  pthread_mutex_unlock (&stats_lock);
 
-  meta_data_destroy (vl->meta);
   vl->meta = NULL;
 
   return (0);
@@ -519,6 +1015,153 @@ static void network_init_gcrypt (void) /* {{{ */
   gcry_control (GCRYCTL_INITIALIZATION_FINISHED);
 } /* }}} void network_init_gcrypt */
 
+/* A cypher with the key derived from the password of one user of one
+ * AuthFile. */
+struct server_cypher_s
+{
+  fbhash_t *userdb;
+  char *username;
+  /* fbh_generation() of userdb when the key was derived. */
+  unsigned long generation;
+  gcry_cipher_hd_t cypher;
+};
+typedef struct server_cypher_s server_cypher_t;
+
+static int server_cypher_compare (const void *a, const void *b) /* {{{ */
+{
+  const server_cypher_t *sa = a;
+  const server_cypher_t *sb = b;
+
+  if (sa->userdb != sb->userdb)
+    return ((sa->userdb < sb->userdb) ? -1 : 1);
+  return (strcmp (sa->username, sb->username));
+} /* }}} int server_cypher_compare */
+
+static void server_cypher_free (server_cypher_t *sc) /* {{{ */
+{
+  if (sc == NULL)
+    return;
+
+  if (sc->cypher != NULL)
+    gcry_cipher_close (sc->cypher);
+  sfree (sc->username);
+  sfree (sc);
+} /* }}} void server_cypher_free */
+
+/* Destructor of server_cypher_key. */
+static void network_free_server_cyphers (void *arg) /* {{{ */
+{
+  c_avl_tree_t *tree = arg;
+  server_cypher_t *sc;
+  void *key;
+
+  while (c_avl_pick (tree, &key, (void *) &sc) == 0)
+    server_cypher_free (sc);
+  c_avl_destroy (tree);
+} /* }}} void network_free_server_cyphers */
+
+/* Returns the cypher for "username" with the IV set. Each dispatch thread
+ * keeps its own cypher per user with the key already set, so the key is only
+ * derived again when the AuthFile changes. */
+static gcry_cipher_hd_t network_get_server_cypher (sockent_t *se, /* {{{ */
+    const void *iv, size_t iv_size, const char *username)
+{
+  fbhash_t *userdb = se->data.server.userdb;
+  c_avl_tree_t *tree;
+  server_cypher_t lookup;
+  server_cypher_t *sc = NULL;
+  unsigned long generation;
+  unsigned char password_hash[32];
+  char *secret;
+  gcry_error_t err;
+
+  tree = pthread_getspecific (server_cypher_key);
+  if (tree == NULL)
+  {
+    tree = c_avl_create (server_cypher_compare);
+    if (tree == NULL)
+      return (NULL);
+    pthread_setspecific (server_cypher_key, tree);
+  }
+
+  generation = fbh_generation (userdb);
+
+  lookup.userdb = userdb;
+  lookup.username = (char *) username;
+  if (c_avl_get (tree, &lookup, (void *) &sc) == 0)
+  {
+    if (sc->generation == generation)
+    {
+      gcry_cipher_reset (sc->cypher);
+      err = gcry_cipher_setiv (sc->cypher, iv, iv_size);
+      if (err == 0)
+        return (sc->cypher);
+
+      ERROR ("network plugin: gcry_cipher_setiv returned: %s",
+          gcry_strerror (err));
+    }
+
+    /* The AuthFile changed or the cypher is unusable. */
+    c_avl_remove (tree, &lookup, NULL, NULL);
+    server_cypher_free (sc);
+    sc = NULL;
+  }
+
+  /* Only users listed in the AuthFile are cached. */
+  secret = fbh_get (userdb, username);
+  if (secret == NULL)
+    return (NULL);
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256,
+      password_hash,
+      secret, strlen (secret));
+  sfree (secret);
+
+  sc = calloc (1, sizeof (*sc));
+  if (sc == NULL)
+    return (NULL);
+  sc->userdb = userdb;
+  sc->generation = generation;
+  sc->username = strdup (username);
+  if (sc->username == NULL)
+  {
+    server_cypher_free (sc);
+    return (NULL);
+  }
+
+  err = gcry_cipher_open (&sc->cypher,
+      GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB, /* flags = */ 0);
+  if (err != 0)
+  {
+    ERROR ("network plugin: gcry_cipher_open returned: %s",
+        gcry_strerror (err));
+    sc->cypher = NULL;
+    server_cypher_free (sc);
+    return (NULL);
+  }
+
+  err = gcry_cipher_setkey (sc->cypher,
+      password_hash, sizeof (password_hash));
+  if (err == 0)
+    err = gcry_cipher_setiv (sc->cypher, iv, iv_size);
+  if (err != 0)
+  {
+    ERROR ("network plugin: Setting the key or IV failed: %s",
+        gcry_strerror (err));
+    server_cypher_free (sc);
+    return (NULL);
+  }
+
+  if (c_avl_insert (tree, sc, sc) != 0)
+  {
+    ERROR ("network plugin: c_avl_insert failed.");
+    server_cypher_free (sc);
+    return (NULL);
+  }
+
+  return (sc->cypher);
+} /* }}} gcry_cipher_hd_t network_get_server_cypher */
+
 static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
     const void *iv, size_t iv_size, const char *username)
 {
@@ -534,22 +1177,10 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
   }
   else
   {
-	  char *secret;
-
-	  cyper_ptr = &se->data.server.cypher;
-
 	  if (username == NULL)
 		  return (NULL);
 
-	  secret = fbh_get (se->data.server.userdb, username);
-	  if (secret == NULL)
-		  return (NULL);
-
-	  gcry_md_hash_buffer (GCRY_MD_SHA256,
-			  password_hash,
-			  secret, strlen (secret));
-
-	  sfree (secret);
+	  return (network_get_server_cypher (se, iv, iv_size, username));
   }
 
   if (*cyper_ptr == NULL)
@@ -595,111 +1226,182 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
 } /* }}} int network_get_aes256_cypher */
 #endif /* HAVE_LIBGCRYPT */
 
-static int write_part_values (char **ret_buffer, int *ret_buffer_len,
+/* Writes the number of values, their types and the values themselves to
+ * "buffer", which must have room for VALUES_BODY_SIZE (vl->values_len) bytes.
+ * This is the payload of TYPE_VALUES and TYPE_ID_VALUES parts. */
+#define VALUES_BODY_SIZE(n) (sizeof (uint16_t) \
+		+ (n) * (sizeof (uint8_t) + sizeof (value_t)))
+static int write_values_body (char *buffer, /* {{{ */
 		const data_set_t *ds, const value_list_t *vl)
 {
-	char *packet_ptr;
-	int packet_len;
-	int num_values;
-
-	part_header_t pkg_ph;
-	uint16_t      pkg_num_values;
-	uint8_t      *pkg_values_types;
-	value_t      *pkg_values;
-
-	int offset;
-	int i;
-
-	num_values = vl->values_len;
-	packet_len = sizeof (part_header_t) + sizeof (uint16_t)
-		+ (num_values * sizeof (uint8_t))
-		+ (num_values * sizeof (value_t));
-
-	if (*ret_buffer_len < packet_len)
-		return (-1);
-
-	pkg_values_types = malloc (num_values * sizeof (*pkg_values_types));
-	if (pkg_values_types == NULL)
-	{
-		ERROR ("network plugin: write_part_values: malloc failed.");
-		return (-1);
-	}
-
-	pkg_values = malloc (num_values * sizeof (*pkg_values));
-	if (pkg_values == NULL)
-	{
-		free (pkg_values_types);
-		ERROR ("network plugin: write_part_values: malloc failed.");
-		return (-1);
-	}
-
-	pkg_ph.type = htons (TYPE_VALUES);
-	pkg_ph.length = htons (packet_len);
+	char *types_ptr;
+	char *values_ptr;
+	uint16_t pkg_num_values;
+	size_t i;
 
 	pkg_num_values = htons ((uint16_t) vl->values_len);
+	memcpy (buffer, &pkg_num_values, sizeof (pkg_num_values));
 
-	for (i = 0; i < num_values; i++)
+	/*
+	 * Use `memcpy' to write everything to the buffer, because the pointer
+	 * may be unaligned and some architectures, such as SPARC, can't handle
+	 * that.
+	 */
+	types_ptr = buffer + sizeof (pkg_num_values);
+	values_ptr = types_ptr + vl->values_len * sizeof (uint8_t);
+	for (i = 0; i < vl->values_len; i++)
 	{
-		pkg_values_types[i] = (uint8_t) ds->ds[i].type;
+		uint8_t pkg_type = (uint8_t) ds->ds[i].type;
+		value_t pkg_value;
+
 		switch (ds->ds[i].type)
 		{
 			case DS_TYPE_COUNTER:
-				pkg_values[i].counter = htonll (vl->values[i].counter);
+				pkg_value.counter = htonll (vl->values[i].counter);
 				break;
 
 			case DS_TYPE_GAUGE:
-				pkg_values[i].gauge = htond (vl->values[i].gauge);
+				pkg_value.gauge = htond (vl->values[i].gauge);
 				break;
 
 			case DS_TYPE_DERIVE:
-				pkg_values[i].derive = htonll (vl->values[i].derive);
+				pkg_value.derive = htonll (vl->values[i].derive);
 				break;
 
 			case DS_TYPE_ABSOLUTE:
-				pkg_values[i].absolute = htonll (vl->values[i].absolute);
+				pkg_value.absolute = htonll (vl->values[i].absolute);
 				break;
 
 			default:
-				free (pkg_values_types);
-				free (pkg_values);
 				ERROR ("network plugin: write_part_values: "
 						"Unknown data source type: %i",
 						ds->ds[i].type);
 				return (-1);
 		} /* switch (ds->ds[i].type) */
-	} /* for (num_values) */
-
-	/*
-	 * Use `memcpy' to write everything to the buffer, because the pointer
-	 * may be unaligned and some architectures, such as SPARC, can't handle
-	 * that.
-	 */
-	packet_ptr = *ret_buffer;
-	offset = 0;
-	memcpy (packet_ptr + offset, &pkg_ph, sizeof (pkg_ph));
-	offset += sizeof (pkg_ph);
-	memcpy (packet_ptr + offset, &pkg_num_values, sizeof (pkg_num_values));
-	offset += sizeof (pkg_num_values);
-	memcpy (packet_ptr + offset, pkg_values_types, num_values * sizeof (uint8_t));
-	offset += num_values * sizeof (uint8_t);
-	memcpy (packet_ptr + offset, pkg_values, num_values * sizeof (value_t));
-	offset += num_values * sizeof (value_t);
-
-	assert (offset == packet_len);
-
-	*ret_buffer = packet_ptr + packet_len;
-	*ret_buffer_len -= packet_len;
 
-	free (pkg_values_types);
-	free (pkg_values);
+		memcpy (types_ptr + i, &pkg_type, sizeof (pkg_type));
+		memcpy (values_ptr + i * sizeof (pkg_value), &pkg_value,
+				sizeof (pkg_value));
+	} /* for (num_values) */
 
 	return (0);
-} /* int write_part_values */
+} /* }}} int write_values_body */
 
-static int write_part_number (char **ret_buffer, int *ret_buffer_len,
-		int type, uint64_t value)
+static int write_part_values (char **ret_buffer, int *ret_buffer_len,
+		const data_set_t *ds, const value_list_t *vl)
 {
-	char *packet_ptr;
+	part_header_t pkg_ph;
+	int packet_len;
+
+	packet_len = sizeof (part_header_t) + VALUES_BODY_SIZE (vl->values_len);
+
+	if (*ret_buffer_len < packet_len)
+		return (-1);
+
+	if (write_values_body (*ret_buffer + sizeof (pkg_ph), ds, vl) != 0)
+		return (-1);
+
+	pkg_ph.type = htons (TYPE_VALUES);
+	pkg_ph.length = htons (packet_len);
+	memcpy (*ret_buffer, &pkg_ph, sizeof (pkg_ph));
+
+	*ret_buffer += packet_len;
+	*ret_buffer_len -= packet_len;
+
+	return (0);
+} /* int write_part_values */
+
+/* Defines "dict_id" as the identifier of "vl": the id followed by the five
+ * identifier fields, each terminated by a null byte. */
+static int write_part_id_define (char **ret_buffer, int *ret_buffer_len, /* {{{ */
+		uint32_t dict_id, const value_list_t *vl)
+{
+	char const *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+		vl->type, vl->type_instance };
+	part_header_t pkg_ph;
+	uint32_t pkg_id;
+	size_t lengths[STATIC_ARRAY_SIZE (fields)];
+	char *ptr;
+	int packet_len;
+	size_t i;
+
+	packet_len = sizeof (pkg_ph) + sizeof (pkg_id);
+	for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+	{
+		lengths[i] = strlen (fields[i]) + 1;
+		packet_len += (int) lengths[i];
+	}
+
+	if (*ret_buffer_len < packet_len)
+		return (-1);
+
+	pkg_ph.type = htons (TYPE_ID_DEFINE);
+	pkg_ph.length = htons (packet_len);
+	pkg_id = htonl (dict_id);
+
+	ptr = *ret_buffer;
+	memcpy (ptr, &pkg_ph, sizeof (pkg_ph));
+	ptr += sizeof (pkg_ph);
+	memcpy (ptr, &pkg_id, sizeof (pkg_id));
+	ptr += sizeof (pkg_id);
+	for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+	{
+		memcpy (ptr, fields[i], lengths[i]);
+		ptr += lengths[i];
+	}
+
+	assert (ptr == *ret_buffer + packet_len);
+
+	*ret_buffer += packet_len;
+	*ret_buffer_len -= packet_len;
+
+	return (0);
+} /* }}} int write_part_id_define */
+
+/* The values of the identifier "dict_id", at the current time plus
+ * "time_delta". */
+static int write_part_id_values (char **ret_buffer, int *ret_buffer_len, /* {{{ */
+		uint32_t dict_id, int32_t time_delta,
+		const data_set_t *ds, const value_list_t *vl)
+{
+	part_header_t pkg_ph;
+	uint32_t pkg_id;
+	uint32_t pkg_delta;
+	int packet_len;
+	char *ptr;
+
+	packet_len = sizeof (pkg_ph) + sizeof (pkg_id) + sizeof (pkg_delta)
+		+ VALUES_BODY_SIZE (vl->values_len);
+
+	if (*ret_buffer_len < packet_len)
+		return (-1);
+
+	ptr = *ret_buffer;
+	if (write_values_body (ptr + sizeof (pkg_ph) + sizeof (pkg_id)
+				+ sizeof (pkg_delta), ds, vl) != 0)
+		return (-1);
+
+	pkg_ph.type = htons (TYPE_ID_VALUES);
+	pkg_ph.length = htons (packet_len);
+	pkg_id = htonl (dict_id);
+	pkg_delta = htonl ((uint32_t) time_delta);
+
+	memcpy (ptr, &pkg_ph, sizeof (pkg_ph));
+	ptr += sizeof (pkg_ph);
+	memcpy (ptr, &pkg_id, sizeof (pkg_id));
+	ptr += sizeof (pkg_id);
+	memcpy (ptr, &pkg_delta, sizeof (pkg_delta));
+
+	*ret_buffer += packet_len;
+	*ret_buffer_len -= packet_len;
+
+	return (0);
+} /* }}} int write_part_id_values */
+
+static int write_part_number (char **ret_buffer, int *ret_buffer_len,
+		int type, uint64_t value)
+{
+	char *packet_ptr;
 	int packet_len;
 
 	part_header_t pkg_head;
@@ -768,23 +1470,82 @@ static int write_part_string (char **ret_buffer, int *ret_buffer_len,
 	return (0);
 } /* int write_part_string */
 
+/* Decodes "pkg_numval" types followed by as many values from "buffer" into
+ * the values array of this thread. */
+static int parse_values_body (const char *buffer, size_t pkg_numval, /* {{{ */
+		parse_state_t *ps)
+{
+	const uint8_t *pkg_types;
+	const char *pkg_values;
+	size_t i;
+
+	/* The types and values are decoded directly from the packet into the
+	 * values array of this thread, which is only ever grown. */
+	if (ps->values_size < pkg_numval)
+	{
+		value_t *tmp;
+
+		tmp = realloc (ps->values, pkg_numval * sizeof (*tmp));
+		if (tmp == NULL)
+		{
+			ERROR ("network plugin: parse_values_body: "
+					"realloc failed.");
+			return (-1);
+		}
+		ps->values = tmp;
+		ps->values_size = pkg_numval;
+	}
+
+	pkg_types = (const uint8_t *) buffer;
+	pkg_values = buffer + pkg_numval * sizeof (*pkg_types);
+
+	for (i = 0; i < pkg_numval; i++)
+	{
+		value_t *v = ps->values + i;
+
+		memcpy (v, pkg_values + i * sizeof (*v), sizeof (*v));
+
+		switch (pkg_types[i])
+		{
+		  case DS_TYPE_COUNTER:
+		    v->counter = (counter_t) ntohll (v->counter);
+		    break;
+
+		  case DS_TYPE_GAUGE:
+		    v->gauge = (gauge_t) ntohd (v->gauge);
+		    break;
+
+		  case DS_TYPE_DERIVE:
+		    v->derive = (derive_t) ntohll (v->derive);
+		    break;
+
+		  case DS_TYPE_ABSOLUTE:
+		    v->absolute = (absolute_t) ntohll (v->absolute);
+		    break;
+
+		  default:
+		    NOTICE ("network plugin: parse_values_body: "
+			"Don't know how to handle data source type %"PRIu8,
+			pkg_types[i]);
+		    return (-1);
+		} /* switch (pkg_types[i]) */
+	}
+	return (0);
+} /* }}} int parse_values_body */
+
 static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
-		value_t **ret_values, size_t *ret_num_values)
+		parse_state_t *ps, value_t **ret_values, size_t *ret_num_values)
 {
 	char *buffer = *ret_buffer;
 	size_t buffer_len = *ret_buffer_len;
 
 	uint16_t tmp16;
 	size_t exp_size;
-	size_t i;
 
 	uint16_t pkg_length;
 	uint16_t pkg_type;
 	size_t pkg_numval;
 
-	uint8_t *pkg_types;
-	value_t *pkg_values;
-
 	if (buffer_len < 15)
 	{
 		NOTICE ("network plugin: packet is too short: "
@@ -827,57 +1588,14 @@ static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 		return (-1);
 	}
 
-	pkg_types = calloc (pkg_numval, sizeof (*pkg_types));
-	pkg_values = calloc (pkg_numval, sizeof (*pkg_values));
-	if ((pkg_types == NULL) || (pkg_values == NULL))
-	{
-		sfree (pkg_types);
-		sfree (pkg_values);
-		ERROR ("network plugin: parse_part_values: calloc failed.");
+	if (parse_values_body (buffer, pkg_numval, ps) != 0)
 		return (-1);
-	}
-
-	memcpy (pkg_types, buffer, pkg_numval * sizeof (*pkg_types));
-	buffer += pkg_numval * sizeof (*pkg_types);
-	memcpy (pkg_values, buffer, pkg_numval * sizeof (*pkg_values));
-	buffer += pkg_numval * sizeof (*pkg_values);
-
-	for (i = 0; i < pkg_numval; i++)
-	{
-		switch (pkg_types[i])
-		{
-		  case DS_TYPE_COUNTER:
-		    pkg_values[i].counter = (counter_t) ntohll (pkg_values[i].counter);
-		    break;
-
-		  case DS_TYPE_GAUGE:
-		    pkg_values[i].gauge = (gauge_t) ntohd (pkg_values[i].gauge);
-		    break;
-
-		  case DS_TYPE_DERIVE:
-		    pkg_values[i].derive = (derive_t) ntohll (pkg_values[i].derive);
-		    break;
-
-		  case DS_TYPE_ABSOLUTE:
-		    pkg_values[i].absolute = (absolute_t) ntohll (pkg_values[i].absolute);
-		    break;
-
-		  default:
-		    NOTICE ("network plugin: parse_part_values: "
-			"Don't know how to handle data source type %"PRIu8,
-			pkg_types[i]);
-		    sfree (pkg_types);
-		    sfree (pkg_values);
-		    return (-1);
-		} /* switch (pkg_types[i]) */
-	}
+	buffer += pkg_numval * (sizeof (uint8_t) + sizeof (value_t));
 
 	*ret_buffer     = buffer;
 	*ret_buffer_len = buffer_len - pkg_length;
 	*ret_num_values = pkg_numval;
-	*ret_values     = pkg_values;
-
-	sfree (pkg_types);
+	*ret_values     = ps->values;
 
 	return (0);
 } /* int parse_part_values */
@@ -1011,10 +1729,267 @@ static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
 	return (0);
 } /* int parse_part_string */
 
+/* Removes the identifiers which haven't been used for DICT_EXPIRE from the
+ * dictionary of this thread. */
+static void network_dict_recv_purge (parse_state_t *ps, cdtime_t now) /* {{{ */
+{
+	c_avl_iterator_t *iter;
+	dict_recv_entry_t *e;
+	void *key;
+	dict_recv_entry_t **expired = NULL;
+	size_t expired_num = 0;
+	size_t i;
+
+	if ((ps->dict_last_purge + DICT_EXPIRE) > now)
+		return;
+	ps->dict_last_purge = now;
+
+	iter = c_avl_get_iterator (ps->dict);
+	while (c_avl_iterator_next (iter, &key, (void *) &e) == 0)
+	{
+		dict_recv_entry_t **tmp;
+
+		if ((e->used + DICT_EXPIRE) > now)
+			continue;
+
+		tmp = realloc (expired, (expired_num + 1) * sizeof (*expired));
+		if (tmp == NULL)
+		{
+			ERROR ("network plugin: network_dict_recv_purge: "
+					"realloc failed.");
+			break;
+		}
+		expired = tmp;
+		expired[expired_num] = e;
+		expired_num++;
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < expired_num; i++)
+	{
+		c_avl_remove (ps->dict, expired[i], NULL, NULL);
+		identifier_destroy (&expired[i]->id);
+		sfree (expired[i]);
+	}
+	sfree (expired);
+} /* }}} void network_dict_recv_purge */
+
+/* Adds the identifier of a TYPE_ID_DEFINE part to the dictionary of this
+ * thread, or replaces the one known by that id. */
+static int parse_part_id_define (void **ret_buffer, /* {{{ */
+		size_t *ret_buffer_len, parse_state_t *ps, uint64_t session)
+{
+	static c_complain_t complain_full = C_COMPLAIN_INIT_STATIC;
+
+	char *buffer = *ret_buffer;
+	size_t buffer_len = *ret_buffer_len;
+	value_list_t vl = VALUE_LIST_INIT;
+	char *fields[] = { vl.host, vl.plugin, vl.plugin_instance,
+		vl.type, vl.type_instance };
+	dict_recv_entry_t key;
+	dict_recv_entry_t *e;
+	part_header_t pkg_ph;
+	uint32_t pkg_id;
+	size_t payload_size;
+	char *ptr;
+	size_t i;
+
+	if (buffer_len < sizeof (pkg_ph) + sizeof (pkg_id))
+	{
+		WARNING ("network plugin: parse_part_id_define: "
+				"Packet too short.");
+		return (-1);
+	}
+
+	memcpy (&pkg_ph, buffer, sizeof (pkg_ph));
+	memcpy (&pkg_id, buffer + sizeof (pkg_ph), sizeof (pkg_id));
+	pkg_ph.length = ntohs (pkg_ph.length);
+
+	if ((pkg_ph.length > buffer_len)
+			|| (pkg_ph.length < sizeof (pkg_ph) + sizeof (pkg_id)))
+	{
+		WARNING ("network plugin: parse_part_id_define: "
+				"Invalid part length %"PRIu16".", pkg_ph.length);
+		return (-1);
+	}
+
+	ptr = buffer + sizeof (pkg_ph) + sizeof (pkg_id);
+	payload_size = pkg_ph.length - (sizeof (pkg_ph) + sizeof (pkg_id));
+
+	/* Five null terminated strings, which have to fill the part exactly. */
+	for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+	{
+		size_t len = strnlen (ptr, payload_size);
+
+		if ((len >= payload_size) || (len >= DATA_MAX_NAME_LEN))
+		{
+			WARNING ("network plugin: parse_part_id_define: "
+					"Invalid identifier.");
+			return (-1);
+		}
+		memcpy (fields[i], ptr, len + 1);
+		ptr += len + 1;
+		payload_size -= len + 1;
+	}
+	if (payload_size != 0)
+	{
+		WARNING ("network plugin: parse_part_id_define: "
+				"Invalid identifier.");
+		return (-1);
+	}
+
+	*ret_buffer = buffer + pkg_ph.length;
+	*ret_buffer_len = buffer_len - pkg_ph.length;
+
+	memset (&key, 0, sizeof (key));
+	key.session = session;
+	key.dict_id = ntohl (pkg_id);
+
+	if (c_avl_get (ps->dict, &key, (void *) &e) == 0)
+	{
+		e->used = cdtime ();
+		if (identifier_equal_vl (&e->id, &vl))
+			return (0);
+
+		/* The sender re-used the id for another identifier. */
+		identifier_destroy (&e->id);
+		if (identifier_create (&e->id, &vl) != 0)
+		{
+			c_avl_remove (ps->dict, &key, NULL, NULL);
+			sfree (e);
+			return (-1);
+		}
+		return (0);
+	}
+
+	if (c_avl_size (ps->dict) >= DICT_MAX_ENTRIES)
+	{
+		c_complain (LOG_WARNING, &complain_full,
+				"network plugin: The identifier dictionary is "
+				"full. Values of new identifiers will be "
+				"dropped.");
+		return (0);
+	}
+
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (-1);
+	e->session = key.session;
+	e->dict_id = key.dict_id;
+	e->used = cdtime ();
+	if (identifier_create (&e->id, &vl) != 0)
+	{
+		sfree (e);
+		return (-1);
+	}
+
+	if (c_avl_insert (ps->dict, e, e) != 0)
+	{
+		identifier_destroy (&e->id);
+		sfree (e);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int parse_part_id_define */
+
+/* Dispatches the values of a TYPE_ID_VALUES part. "vl" holds the time and
+ * interval of the packet; its identifier is set while the values are
+ * dispatched and cleared afterwards. */
+static int parse_part_id_values (void **ret_buffer, /* {{{ */
+		size_t *ret_buffer_len, parse_state_t *ps, uint64_t session,
+		value_list_t *vl, const char *username)
+{
+	char *buffer = *ret_buffer;
+	size_t buffer_len = *ret_buffer_len;
+	part_header_t pkg_ph;
+	uint32_t pkg_id;
+	uint32_t pkg_delta;
+	uint16_t pkg_numval;
+	size_t header_size;
+	dict_recv_entry_t key;
+	dict_recv_entry_t *e;
+	cdtime_t time_orig;
+
+	header_size = sizeof (pkg_ph) + sizeof (pkg_id) + sizeof (pkg_delta)
+		+ sizeof (pkg_numval);
+	if (buffer_len < header_size)
+	{
+		WARNING ("network plugin: parse_part_id_values: "
+				"Packet too short.");
+		return (-1);
+	}
+
+	memcpy (&pkg_ph, buffer, sizeof (pkg_ph));
+	buffer += sizeof (pkg_ph);
+	memcpy (&pkg_id, buffer, sizeof (pkg_id));
+	buffer += sizeof (pkg_id);
+	memcpy (&pkg_delta, buffer, sizeof (pkg_delta));
+	buffer += sizeof (pkg_delta);
+	memcpy (&pkg_numval, buffer, sizeof (pkg_numval));
+	buffer += sizeof (pkg_numval);
+
+	pkg_ph.length = ntohs (pkg_ph.length);
+	pkg_numval = ntohs (pkg_numval);
+
+	if ((pkg_ph.length > buffer_len) || (pkg_ph.length != header_size
+				+ pkg_numval * (sizeof (uint8_t) + sizeof (value_t))))
+	{
+		WARNING ("network plugin: parse_part_id_values: "
+				"Length and number of values "
+				"in the packet don't match.");
+		return (-1);
+	}
+
+	*ret_buffer = ((char *) *ret_buffer) + pkg_ph.length;
+	*ret_buffer_len = buffer_len - pkg_ph.length;
+
+	memset (&key, 0, sizeof (key));
+	key.session = session;
+	key.dict_id = ntohl (pkg_id);
+
+	/* An unknown id means the definition has been lost or this receiver
+	 * has been restarted. The sender repeats it every IdentifierRefresh. */
+	if (c_avl_get (ps->dict, &key, (void *) &e) != 0)
+	{
+		DEBUG ("network plugin: parse_part_id_values: "
+				"Unknown identifier %"PRIu32".", key.dict_id);
+	}
+	else if (parse_values_body (buffer, pkg_numval, ps) != 0)
+	{
+		return (-1);
+	}
+	else
+	{
+		e->used = cdtime ();
+
+		time_orig = vl->time;
+		vl->time = (cdtime_t) ((int64_t) vl->time
+				+ (int32_t) ntohl (pkg_delta));
+		vl->values = ps->values;
+		vl->values_len = (size_t) pkg_numval;
+		identifier_to_vl (&e->id, vl);
+
+		network_dispatch_values (ps, vl, username);
+
+		vl->time = time_orig;
+	}
+
+	/* The sender clears its identifier after each TYPE_ID_VALUES part. */
+	vl->host[0] = 0;
+	vl->plugin[0] = 0;
+	vl->plugin_instance[0] = 0;
+	vl->type[0] = 0;
+	vl->type_instance[0] = 0;
+
+	return (0);
+} /* }}} int parse_part_id_values */
+
 /* Forward declaration: parse_part_sign_sha256 and parse_part_encr_aes256 call
  * parse_packet and vice versa. */
 #define PP_SIGNED    0x01
 #define PP_ENCRYPTED 0x02
+#define PP_COMPRESSED 0x04
 static int parse_packet (sockent_t *se,
 		void *buffer, size_t buffer_size, int flags,
 		const char *username);
@@ -1376,26 +2351,153 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
 } /* }}} int parse_part_encr_aes256 */
 #endif /* !HAVE_LIBGCRYPT */
 
-#undef BUFFER_READ
-
-static int parse_packet (sockent_t *se, /* {{{ */
-		void *buffer, size_t buffer_size, int flags,
-		const char *username)
+#if HAVE_LIBLZ4
+static int parse_part_compr_lz4 (sockent_t *se, /* {{{ */
+    parse_state_t *ps, void **ret_buffer, size_t *ret_buffer_size,
+    int flags, const char *username)
 {
-	int status;
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_offset;
 
-	value_list_t vl = VALUE_LIST_INIT;
-	notification_t n;
+  part_header_t ph;
+  size_t ph_length;
+  uint16_t orig_length;
+  int status;
 
-#if HAVE_LIBGCRYPT
-	int packet_was_signed = (flags & PP_SIGNED);
-        int packet_was_encrypted = (flags & PP_ENCRYPTED);
-	int printed_ignore_warning = 0;
-#endif /* HAVE_LIBGCRYPT */
+  buffer = *ret_buffer;
+  buffer_size = *ret_buffer_size;
+  buffer_offset = 0;
 
+  /* parse_packet assures this minimum size. */
+  assert (buffer_size >= (sizeof (ph.type) + sizeof (ph.length)));
 
-	memset (&vl, '\0', sizeof (vl));
-	memset (&n, '\0', sizeof (n));
+  BUFFER_READ (&ph.type, sizeof (ph.type));
+  BUFFER_READ (&ph.length, sizeof (ph.length));
+  ph_length = ntohs (ph.length);
+
+  if ((ph_length <= PART_COMPRESSION_LZ4_SIZE)
+      || (ph_length > buffer_size))
+  {
+    ERROR ("network plugin: LZ4 compressed part "
+        "with invalid length received.");
+    return (-1);
+  }
+
+  /* The decompressed parts are parsed from ps->lz4_buffer, so they must not
+   * contain another compressed part. */
+  if (flags & PP_COMPRESSED)
+  {
+    ERROR ("network plugin: Nested LZ4 compressed part received.");
+    return (-1);
+  }
+
+  BUFFER_READ (&orig_length, sizeof (orig_length));
+  orig_length = ntohs (orig_length);
+
+  if (ps->lz4_buffer == NULL)
+  {
+    ps->lz4_buffer = malloc (UINT16_MAX);
+    if (ps->lz4_buffer == NULL)
+    {
+      ERROR ("network plugin: parse_part_compr_lz4: malloc failed.");
+      return (-1);
+    }
+  }
+
+  status = LZ4_decompress_safe (buffer + buffer_offset, ps->lz4_buffer,
+      (int) (ph_length - buffer_offset), (int) orig_length);
+  if (status != (int) orig_length)
+  {
+    ERROR ("network plugin: Decompressing LZ4 part failed.");
+    return (-1);
+  }
+
+  parse_packet (se, ps->lz4_buffer, (size_t) orig_length,
+      flags | PP_COMPRESSED, username);
+
+  *ret_buffer = buffer + ph_length;
+  *ret_buffer_size = buffer_size - ph_length;
+
+  return (0);
+} /* }}} int parse_part_compr_lz4 */
+/* #endif HAVE_LIBLZ4 */
+
+#else /* if !HAVE_LIBLZ4 */
+static int parse_part_compr_lz4 (__attribute__((unused)) sockent_t *se, /* {{{ */
+    __attribute__((unused)) parse_state_t *ps,
+    void **ret_buffer, size_t *ret_buffer_size,
+    __attribute__((unused)) int flags,
+    __attribute__((unused)) const char *username)
+{
+  static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_offset;
+
+  part_header_t ph;
+  size_t ph_length;
+
+  buffer = *ret_buffer;
+  buffer_size = *ret_buffer_size;
+  buffer_offset = 0;
+
+  /* parse_packet assures this minimum size. */
+  assert (buffer_size >= (sizeof (ph.type) + sizeof (ph.length)));
+
+  BUFFER_READ (&ph.type, sizeof (ph.type));
+  BUFFER_READ (&ph.length, sizeof (ph.length));
+  ph_length = ntohs (ph.length);
+
+  if ((ph_length <= PART_COMPRESSION_LZ4_SIZE)
+      || (ph_length > buffer_size))
+  {
+    ERROR ("network plugin: LZ4 compressed part "
+        "with invalid length received.");
+    return (-1);
+  }
+
+  c_complain_once (LOG_WARNING, &complaint,
+      "network plugin: Received a compressed packet, but the network "
+      "plugin was not linked with liblz4, so I cannot decompress it. "
+      "The part will be discarded.");
+
+  *ret_buffer = buffer + ph_length;
+  *ret_buffer_size = buffer_size - ph_length;
+
+  return (0);
+} /* }}} int parse_part_compr_lz4 */
+#endif /* !HAVE_LIBLZ4 */
+
+#undef BUFFER_READ
+
+static int parse_packet (sockent_t *se, /* {{{ */
+		void *buffer, size_t buffer_size, int flags,
+		const char *username)
+{
+	int status;
+
+	parse_state_t *ps;
+	value_list_t vl = VALUE_LIST_INIT;
+	notification_t n;
+	uint64_t session = 0;
+	_Bool have_session = 0;
+
+#if HAVE_LIBGCRYPT
+	int packet_was_signed = (flags & PP_SIGNED);
+        int packet_was_encrypted = (flags & PP_ENCRYPTED);
+	int printed_ignore_warning = 0;
+#endif /* HAVE_LIBGCRYPT */
+
+
+	ps = network_parse_state ();
+	if (ps == NULL)
+		return (-1);
+	network_dict_recv_purge (ps, cdtime ());
+
+	memset (&vl, '\0', sizeof (vl));
+	memset (&n, '\0', sizeof (n));
 	status = 0;
 
 	while ((status == 0) && (0 < buffer_size)
@@ -1473,16 +2575,51 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			continue;
 		}
 #endif /* HAVE_LIBGCRYPT */
+		else if (pkg_type == TYPE_COMPR_LZ4)
+		{
+			status = parse_part_compr_lz4 (se, ps,
+					&buffer, &buffer_size, flags, username);
+			if (status != 0)
+				break;
+		}
 		else if (pkg_type == TYPE_VALUES)
 		{
 			status = parse_part_values (&buffer, &buffer_size,
-					&vl.values, &vl.values_len);
+					ps, &vl.values, &vl.values_len);
 			if (status != 0)
 				break;
 
-			network_dispatch_values (&vl, username);
-
-			sfree (vl.values);
+			network_dispatch_values (ps, &vl, username);
+		}
+		else if (pkg_type == TYPE_SESSION)
+		{
+			status = parse_part_number (&buffer, &buffer_size,
+					&session);
+			if (status == 0)
+				have_session = 1;
+		}
+		else if (pkg_type == TYPE_ID_DEFINE)
+		{
+			if (have_session)
+				status = parse_part_id_define (&buffer,
+						&buffer_size, ps, session);
+			else
+			{
+				buffer = ((char *) buffer) + pkg_length;
+				buffer_size -= pkg_length;
+			}
+		}
+		else if (pkg_type == TYPE_ID_VALUES)
+		{
+			if (have_session)
+				status = parse_part_id_values (&buffer,
+						&buffer_size, ps, session,
+						&vl, username);
+			else
+			{
+				buffer = ((char *) buffer) + pkg_length;
+				buffer_size -= pkg_length;
+			}
 		}
 		else if (pkg_type == TYPE_TIME)
 		{
@@ -1526,42 +2663,28 @@ static int parse_packet (sockent_t *se, /* {{{ */
 		{
 			status = parse_part_string (&buffer, &buffer_size,
 					vl.host, sizeof (vl.host));
-			if (status == 0)
-				sstrncpy (n.host, vl.host, sizeof (n.host));
 		}
 		else if (pkg_type == TYPE_PLUGIN)
 		{
 			status = parse_part_string (&buffer, &buffer_size,
 					vl.plugin, sizeof (vl.plugin));
-			if (status == 0)
-				sstrncpy (n.plugin, vl.plugin,
-						sizeof (n.plugin));
 		}
 		else if (pkg_type == TYPE_PLUGIN_INSTANCE)
 		{
 			status = parse_part_string (&buffer, &buffer_size,
 					vl.plugin_instance,
 					sizeof (vl.plugin_instance));
-			if (status == 0)
-				sstrncpy (n.plugin_instance,
-						vl.plugin_instance,
-						sizeof (n.plugin_instance));
 		}
 		else if (pkg_type == TYPE_TYPE)
 		{
 			status = parse_part_string (&buffer, &buffer_size,
 					vl.type, sizeof (vl.type));
-			if (status == 0)
-				sstrncpy (n.type, vl.type, sizeof (n.type));
 		}
 		else if (pkg_type == TYPE_TYPE_INSTANCE)
 		{
 			status = parse_part_string (&buffer, &buffer_size,
 					vl.type_instance,
 					sizeof (vl.type_instance));
-			if (status == 0)
-				sstrncpy (n.type_instance, vl.type_instance,
-						sizeof (n.type_instance));
 		}
 		else if (pkg_type == TYPE_MESSAGE)
 		{
@@ -1595,6 +2718,16 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			}
 			else
 			{
+				/* The identifier is only copied from the value
+				 * list once a notification is complete. */
+				sstrncpy (n.host, vl.host, sizeof (n.host));
+				sstrncpy (n.plugin, vl.plugin,
+						sizeof (n.plugin));
+				sstrncpy (n.plugin_instance, vl.plugin_instance,
+						sizeof (n.plugin_instance));
+				sstrncpy (n.type, vl.type, sizeof (n.type));
+				sstrncpy (n.type_instance, vl.type_instance,
+						sizeof (n.type_instance));
 				network_dispatch_notification (&n);
 			}
 		}
@@ -1621,14 +2754,50 @@ static int parse_packet (sockent_t *se, /* {{{ */
 	return (status);
 } /* }}} int parse_packet */
 
+static void network_dict_free (dict_send_entry_t *e) /* {{{ */
+{
+	identifier_destroy (&e->id);
+	sfree (e);
+} /* }}} void network_dict_free */
+
 static void free_sockent_client (struct sockent_client *sec) /* {{{ */
 {
+  size_t i;
+
   if (sec->fd >= 0)
   {
     close (sec->fd);
     sec->fd = -1;
   }
   sfree (sec->addr);
+
+  while (sec->send_queue_head != NULL)
+  {
+    send_packet_t *next = sec->send_queue_head->next;
+    sfree (sec->send_queue_head);
+    sec->send_queue_head = next;
+  }
+  sec->send_queue_tail = NULL;
+  sec->send_queue_length = 0;
+  sfree (sec->send_buffer);
+  sfree (sec->stream_buffer);
+
+  for (i = 0; i < sec->dict_table_size; i++)
+  {
+    while (sec->dict_table[i] != NULL)
+    {
+      dict_send_entry_t *next = sec->dict_table[i]->next;
+      network_dict_free (sec->dict_table[i]);
+      sec->dict_table[i] = next;
+    }
+  }
+  sfree (sec->dict_table);
+  sec->dict_table_size = 0;
+  sec->dict_num = 0;
+#if HAVE_SENDMMSG
+  sfree (sec->batch_data);
+#endif
+  pthread_mutex_destroy (&sec->send_lock);
 #if HAVE_LIBGCRYPT
   sfree (sec->username);
   sfree (sec->password);
@@ -1645,6 +2814,7 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
   {
     if (ses->fd[i] >= 0)
     {
+      handover_socket_forget (ses->fd[i]);
       close (ses->fd[i]);
       ses->fd[i] = -1;
     }
@@ -1654,8 +2824,6 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
 #if HAVE_LIBGCRYPT
   sfree (ses->auth_file);
   fbh_destroy (ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close (ses->cypher);
 #endif
 } /* }}} void free_sockent_server */
 
@@ -1851,7 +3019,25 @@ static int network_set_interface (const sockent_t *se, const struct addrinfo *ai
 	return (0);
 } /* }}} network_set_interface */
 
-static int network_bind_socket (int fd, const struct addrinfo *ai, const int interface_idx)
+/* Returns true if "ai" is an IPv4 or IPv6 multicast address. */
+static _Bool network_is_multicast (const struct addrinfo *ai) /* {{{ */
+{
+	if (ai->ai_family == AF_INET)
+	{
+		struct sockaddr_in *addr = (struct sockaddr_in *) ai->ai_addr;
+		return (IN_MULTICAST (ntohl (addr->sin_addr.s_addr)) ? 1 : 0);
+	}
+	else if (ai->ai_family == AF_INET6)
+	{
+		struct sockaddr_in6 *addr = (struct sockaddr_in6 *) ai->ai_addr;
+		return (IN6_IS_ADDR_MULTICAST (&addr->sin6_addr) ? 1 : 0);
+	}
+
+	return (0);
+} /* }}} _Bool network_is_multicast */
+
+static int network_bind_socket (int fd, const struct addrinfo *ai,
+		const int interface_idx, _Bool reuse_port)
 {
 #if KERNEL_SOLARIS
 	char loop   = 0;
@@ -1869,6 +3055,21 @@ static int network_bind_socket (int fd, const struct addrinfo *ai, const int int
 		return (-1);
 	}
 
+#ifdef SO_REUSEPORT
+	/* let the kernel distribute datagrams among the sockets bound to the
+	 * same address and port */
+	if (reuse_port && (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT,
+					&yes, sizeof (yes)) == -1))
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: setsockopt (reuseport): %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+#else
+	assert (!reuse_port);
+#endif
+
 	DEBUG ("fd = %i; calling `bind'", fd);
 
 	if (bind (fd, ai->ai_addr, ai->ai_addrlen) == -1)
@@ -2030,7 +3231,6 @@ static sockent_t *sockent_create (int type) /* {{{ */
 		se->data.server.security_level = SECURITY_LEVEL_NONE;
 		se->data.server.auth_file = NULL;
 		se->data.server.userdb = NULL;
-		se->data.server.cypher = NULL;
 #endif
 	}
 	else
@@ -2039,6 +3239,19 @@ static sockent_t *sockent_create (int type) /* {{{ */
 		se->data.client.addr = NULL;
 		se->data.client.resolve_interval = 0;
 		se->data.client.next_resolve_reconnect = 0;
+		pthread_mutex_init (&se->data.client.send_lock, /* attr = */ NULL);
+		se->data.client.send_buffer = NULL;
+		se->data.client.send_buffer_size = 0;
+		se->data.client.flush_interval = 0;
+		se->data.client.compress = 0;
+		se->data.client.dict_enabled = 0;
+		se->data.client.dict_refresh = TIME_T_TO_CDTIME_T (60);
+		se->data.client.dict_table = NULL;
+		se->data.client.dict_table_size = 0;
+		se->data.client.dict_num = 0;
+		se->data.client.send_queue_head = NULL;
+		se->data.client.send_queue_tail = NULL;
+		se->data.client.send_queue_length = 0;
 #if HAVE_LIBGCRYPT
 		se->data.client.security_level = SECURITY_LEVEL_NONE;
 		se->data.client.username = NULL;
@@ -2118,6 +3331,7 @@ static int sockent_client_disconnect (sockent_t *se) /* {{{ */
 		close (client->fd);
 		client->fd = -1;
 	}
+	client->stream_connecting = 0;
 
 	sfree (client->addr);
 	client->addrlen = 0;
@@ -2156,8 +3370,16 @@ static int sockent_client_connect (sockent_t *se) /* {{{ */
 	ai_hints.ai_flags |= AI_ADDRCONFIG;
 #endif
 	ai_hints.ai_family   = AF_UNSPEC;
-	ai_hints.ai_socktype = SOCK_DGRAM;
-	ai_hints.ai_protocol = IPPROTO_UDP;
+	if (client->stream)
+	{
+		ai_hints.ai_socktype = SOCK_STREAM;
+		ai_hints.ai_protocol = IPPROTO_TCP;
+	}
+	else
+	{
+		ai_hints.ai_socktype = SOCK_DGRAM;
+		ai_hints.ai_protocol = IPPROTO_UDP;
+	}
 
 	status = getaddrinfo (se->node,
 			(se->service != NULL) ? se->service : NET_DEFAULT_PORT,
@@ -2211,6 +3433,27 @@ static int sockent_client_connect (sockent_t *se) /* {{{ */
 		network_set_ttl (se, ai_ptr);
 		network_set_interface (se, ai_ptr);
 
+		/* The send thread must not wait for connections, see
+		 * network_stream_connect(). */
+		if (client->stream)
+		{
+			status = fcntl (client->fd, F_SETFL, O_NONBLOCK);
+			if (status == 0)
+				status = connect (client->fd, ai_ptr->ai_addr,
+						ai_ptr->ai_addrlen);
+			if ((status != 0) && (errno != EINPROGRESS))
+			{
+				char errbuf[1024];
+				ERROR ("network plugin: connect(2) failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+				sockent_client_disconnect (se);
+				continue;
+			}
+			client->stream_connecting = (status != 0);
+			client->stream_connect_started = now;
+		}
+
 		/* We don't open more than one write-socket per
 		 * node/service pair.. */
 		break;
@@ -2220,6 +3463,15 @@ static int sockent_client_connect (sockent_t *se) /* {{{ */
 	if (client->fd < 0)
 		return (-1);
 
+	/* Packets from the new socket may end up with another dispatch thread
+	 * of the receiver, which doesn't know our identifiers yet. */
+	if (client->dict_enabled)
+	{
+		pthread_mutex_lock (&client->send_lock);
+		client->dict_generation++;
+		pthread_mutex_unlock (&client->send_lock);
+	}
+
 	if (client->resolve_interval > 0)
 		client->next_resolve_reconnect = now + client->resolve_interval;
 	return (0);
@@ -2259,8 +3511,16 @@ static int sockent_server_listen (sockent_t *se) /* {{{ */
 	ai_hints.ai_flags |= AI_ADDRCONFIG;
 #endif
 	ai_hints.ai_family   = AF_UNSPEC;
-	ai_hints.ai_socktype = SOCK_DGRAM;
-	ai_hints.ai_protocol = IPPROTO_UDP;
+	if (se->data.server.stream)
+	{
+		ai_hints.ai_socktype = SOCK_STREAM;
+		ai_hints.ai_protocol = IPPROTO_TCP;
+	}
+	else
+	{
+		ai_hints.ai_socktype = SOCK_DGRAM;
+		ai_hints.ai_protocol = IPPROTO_UDP;
+	}
 
 	status = getaddrinfo (node, service, &ai_hints, &ai_list);
 	if (status != 0)
@@ -2274,39 +3534,81 @@ static int sockent_server_listen (sockent_t *se) /* {{{ */
 
 	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
 	{
-		int *tmp;
+		size_t sockets_num = network_config_receive_threads;
+		size_t i;
 
-		tmp = realloc (se->data.server.fd,
-				sizeof (*tmp) * (se->data.server.fd_num + 1));
-		if (tmp == NULL)
+		/* Each socket bound to a multicast group receives a copy of every
+		 * datagram, so there is no point in opening more than one. */
+		if (network_is_multicast (ai_ptr))
 		{
-			ERROR ("network plugin: realloc failed.");
-			continue;
+			if (se->data.server.stream)
+			{
+				ERROR ("network plugin: Cannot accept TCP "
+						"connections on a multicast address.");
+				continue;
+			}
+			sockets_num = 1;
 		}
-		se->data.server.fd = tmp;
-		tmp = se->data.server.fd + se->data.server.fd_num;
 
-		*tmp = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
-				ai_ptr->ai_protocol);
-		if (*tmp < 0)
+		for (i = 0; i < sockets_num; i++)
 		{
-			char errbuf[1024];
-			ERROR ("network plugin: socket(2) failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			continue;
-		}
+			int *tmp;
 
-		status = network_bind_socket (*tmp, ai_ptr, se->interface);
-		if (status != 0)
-		{
-			close (*tmp);
-			*tmp = -1;
-			continue;
-		}
+			tmp = realloc (se->data.server.fd,
+					sizeof (*tmp) * (se->data.server.fd_num + 1));
+			if (tmp == NULL)
+			{
+				ERROR ("network plugin: realloc failed.");
+				continue;
+			}
+			se->data.server.fd = tmp;
+			tmp = se->data.server.fd + se->data.server.fd_num;
+
+			/* A socket of the previous instance is already bound and
+			 * has not stopped receiving during the restart. */
+			*tmp = handover_socket_get ("network", ai_ptr, i);
+			if (*tmp >= 0)
+			{
+				handover_socket_put ("network", ai_ptr, i, *tmp);
+				se->data.server.fd_num++;
+				continue;
+			}
+
+			*tmp = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+					ai_ptr->ai_protocol);
+			if (*tmp < 0)
+			{
+				char errbuf[1024];
+				ERROR ("network plugin: socket(2) failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+				continue;
+			}
+
+			status = network_bind_socket (*tmp, ai_ptr, se->interface,
+					/* reuse_port = */ (sockets_num > 1));
+			/* Connections are accepted by the receive thread, which
+			 * must not block if another thread accepted it first. */
+			if ((status == 0) && se->data.server.stream
+					&& ((listen (*tmp, SOMAXCONN) != 0)
+						|| (fcntl (*tmp, F_SETFL, O_NONBLOCK) != 0)))
+			{
+				char errbuf[1024];
+				ERROR ("network plugin: listen(2) failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+				status = -1;
+			}
+			if (status != 0)
+			{
+				close (*tmp);
+				*tmp = -1;
+				continue;
+			}
 
-		se->data.server.fd_num++;
-		continue;
+			handover_socket_put ("network", ai_ptr, i, *tmp);
+			se->data.server.fd_num++;
+		} /* for (i = 0; i < sockets_num; i++) */
 	} /* for (ai_list) */
 
 	freeaddrinfo (ai_list);
@@ -2327,6 +3629,7 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	if (se->type == SOCKENT_TYPE_SERVER)
 	{
 		struct pollfd *tmp;
+		_Bool *stream;
 		size_t i;
 
 		tmp = realloc (listen_sockets_pollfd,
@@ -2340,12 +3643,24 @@ static int sockent_add (sockent_t *se) /* {{{ */
 		listen_sockets_pollfd = tmp;
 		tmp = listen_sockets_pollfd + listen_sockets_num;
 
+		stream = realloc (listen_sockets_stream,
+				sizeof (*stream) * (listen_sockets_num
+					+ se->data.server.fd_num));
+		if (stream == NULL)
+		{
+			ERROR ("network plugin: realloc failed.");
+			return (-1);
+		}
+		listen_sockets_stream = stream;
+		stream = listen_sockets_stream + listen_sockets_num;
+
 		for (i = 0; i < se->data.server.fd_num; i++)
 		{
 			memset (tmp + i, 0, sizeof (*tmp));
 			tmp[i].fd = se->data.server.fd[i];
 			tmp[i].events = POLLIN | POLLPRI;
 			tmp[i].revents = 0;
+			stream[i] = se->data.server.stream;
 		}
 
 		listen_sockets_num += se->data.server.fd_num;
@@ -2374,87 +3689,553 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_add */
 
-static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
+/* Fills "ret" with up to "num" entries, re-using dispatched entries where
+ * possible. Returns the number of entries stored in "ret". */
+static size_t receive_entries_get (receive_list_entry_t **ret, /* {{{ */
+    size_t num)
 {
-  while (42)
-  {
-    receive_list_entry_t *ent;
-    sockent_t *se;
+  size_t i = 0;
 
-    /* Lock and wait for more data to come in */
-    pthread_mutex_lock (&receive_list_lock);
-    while ((listen_loop == 0)
-        && (receive_list_head == NULL))
-      pthread_cond_wait (&receive_list_cond, &receive_list_lock);
+  pthread_mutex_lock (&receive_free_lock);
+  while ((i < num) && (receive_free_list != NULL))
+  {
+    ret[i] = receive_free_list;
+    receive_free_list = receive_free_list->next;
+    receive_free_list_length--;
+    ret[i]->next = NULL;
+    i++;
+  }
+  pthread_mutex_unlock (&receive_free_lock);
 
-    /* Remove the head entry and unlock */
-    ent = receive_list_head;
-    if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock (&receive_list_lock);
+  for (; i < num; i++)
+  {
+    receive_list_entry_t *ent;
 
-    /* Check whether we are supposed to exit. We do NOT check `listen_loop'
-     * because we dispatch all missing packets before shutting down. */
+    ent = calloc (1, sizeof (*ent));
     if (ent == NULL)
-      break;
-
-    /* Look for the correct `sockent_t' */
-    se = listen_sockets;
-    while (se != NULL)
     {
-      size_t i;
-
-      for (i = 0; i < se->data.server.fd_num; i++)
-        if (se->data.server.fd[i] == ent->fd)
-          break;
-
-      if (i < se->data.server.fd_num)
-        break;
-
-      se = se->next;
+      ERROR ("network plugin: calloc failed.");
+      break;
     }
 
-    if (se == NULL)
+    ent->data = malloc (network_config_packet_size);
+    if (ent->data == NULL)
     {
-      ERROR ("network plugin: Got packet from FD %i, but can't "
-          "find an appropriate socket entry.",
-          ent->fd);
-      sfree (ent->data);
+      ERROR ("network plugin: malloc failed.");
       sfree (ent);
-      continue;
+      break;
     }
 
-    parse_packet (se, ent->data, ent->data_len, /* flags = */ 0,
-	/* username = */ NULL);
-    sfree (ent->data);
-    sfree (ent);
-  } /* while (42) */
+    ret[i] = ent;
+  }
 
-  return (NULL);
-} /* }}} void *dispatch_thread */
+  return (i);
+} /* }}} size_t receive_entries_get */
 
-static int network_receive (void) /* {{{ */
+/* Puts the list of entries starting at "head" back on the free list for
+ * re-use. Entries exceeding RECEIVE_FREE_LIST_MAX are freed. */
+static void receive_entries_put (receive_list_entry_t *head) /* {{{ */
 {
-	char buffer[network_config_packet_size];
-	int  buffer_len;
+  receive_list_entry_t *tail = NULL;
+  receive_list_entry_t *rest;
+  size_t num = 0;
 
-	size_t i;
-	int status = 0;
+  if (head == NULL)
+    return;
 
-	receive_list_entry_t *private_list_head;
-	receive_list_entry_t *private_list_tail;
-	uint64_t              private_list_length;
+  pthread_mutex_lock (&receive_free_lock);
+  rest = head;
+  while ((rest != NULL)
+      && ((receive_free_list_length + num) < RECEIVE_FREE_LIST_MAX))
+  {
+    tail = rest;
+    rest = rest->next;
+    num++;
+  }
+  if (tail != NULL)
+  {
+    tail->next = receive_free_list;
+    receive_free_list = head;
+    receive_free_list_length += num;
+  }
+  pthread_mutex_unlock (&receive_free_lock);
 
-	assert (listen_sockets_num > 0);
+  while (rest != NULL)
+  {
+    receive_list_entry_t *next = rest->next;
 
-	private_list_head = NULL;
-	private_list_tail = NULL;
-	private_list_length = 0;
+    sfree (rest->data);
+    sfree (rest);
+    rest = next;
+  }
+} /* }}} void receive_entries_put */
 
-	while (listen_loop == 0)
-	{
-		status = poll (listen_sockets_pollfd, listen_sockets_num, -1);
+static void *dispatch_thread (void *arg) /* {{{ */
+{
+  receive_queue_t *q = arg;
+
+  while (42)
+  {
+    receive_list_entry_t *head;
+    receive_list_entry_t *ent;
+
+    /* Lock and wait for more data to come in */
+    pthread_mutex_lock (&q->lock);
+    while ((listen_loop == 0)
+        && (q->head == NULL))
+      pthread_cond_wait (&q->cond, &q->lock);
+
+    /* Take all entries at once and unlock */
+    head = q->head;
+    q->head = NULL;
+    q->tail = NULL;
+    q->length = 0;
+    pthread_mutex_unlock (&q->lock);
+
+    /* Check whether we are supposed to exit. We do NOT check `listen_loop'
+     * because we dispatch all missing packets before shutting down. */
+    if (head == NULL)
+      break;
+
+    for (ent = head; ent != NULL; ent = ent->next)
+    {
+      sockent_t *se;
+      int status;
+
+      /* Look for the correct `sockent_t' */
+      se = listen_sockets;
+      while (se != NULL)
+      {
+        size_t i;
+
+        for (i = 0; i < se->data.server.fd_num; i++)
+          if (se->data.server.fd[i] == ent->fd)
+            break;
+
+        if (i < se->data.server.fd_num)
+          break;
+
+        se = se->next;
+      }
+
+      if (se == NULL)
+      {
+        ERROR ("network plugin: Got packet from FD %i, but can't "
+            "find an appropriate socket entry.",
+            ent->fd);
+        continue;
+      }
+
+      PROBE2 (network_parse_begin, ent, ent->data_len);
+      status = parse_packet (se, ent->data, ent->data_len,
+          /* flags = */ 0, /* username = */ NULL);
+      PROBE3 (network_parse_end, ent, ent->data_len, status);
+    }
+
+    receive_entries_put (head);
+  } /* while (42) */
+
+  return (NULL);
+} /* }}} void *dispatch_thread */
+
+/* Returns a hash of the sender's IP address. The port is ignored, so all
+ * packets from one host end up in the same queue. */
+static uint32_t network_sender_hash (const struct sockaddr_storage *addr) /* {{{ */
+{
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t hash = 2166136261U; /* FNV-1a */
+	size_t i;
+
+	if (addr->ss_family == AF_INET)
+	{
+		const struct sockaddr_in *sa = (const struct sockaddr_in *) addr;
+		data = (const unsigned char *) &sa->sin_addr;
+		data_len = sizeof (sa->sin_addr);
+	}
+	else if (addr->ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *sa = (const struct sockaddr_in6 *) addr;
+		data = (const unsigned char *) &sa->sin6_addr;
+		data_len = sizeof (sa->sin6_addr);
+	}
+	else
+		return (0);
+
+	for (i = 0; i < data_len; i++)
+	{
+		hash ^= (uint32_t) data[i];
+		hash *= 16777619U;
+	}
+
+	return (hash);
+} /* }}} uint32_t network_sender_hash */
+
+/* Returns the slot of the sender with the address "addr" and its hash
+ * "hash", claiming a free or idle slot for new senders. */
+static sender_t *network_sender_get (receiver_t *r, /* {{{ */
+		const struct sockaddr_storage *addr, uint32_t hash, cdtime_t now)
+{
+	sender_t *victim = NULL;
+	size_t i;
+
+	for (i = 0; i < SENDER_TABLE_PROBES; i++)
+	{
+		sender_t *s = r->senders + ((hash + i) % SENDER_TABLE_SIZE);
+
+		if ((s->last_seen != 0) && (s->hash == hash))
+			return (s);
+
+		if ((victim == NULL) && ((s->last_seen == 0)
+					|| ((now - s->last_seen) > SENDER_IDLE_TIMEOUT)))
+			victim = s;
+	}
+
+	if (victim == NULL)
+		return (r->senders + (hash % SENDER_TABLE_SIZE));
+
+	memset (victim, 0, sizeof (*victim));
+	victim->hash = hash;
+	victim->tokens = network_config_sender_burst;
+	victim->last_seen = now;
+	if (getnameinfo ((const struct sockaddr *) addr,
+				(addr->ss_family == AF_INET6)
+				? sizeof (struct sockaddr_in6) : sizeof (struct sockaddr_in),
+				victim->name, sizeof (victim->name),
+				/* service = */ NULL, /* service_len = */ 0,
+				NI_NUMERICHOST) != 0)
+		sstrncpy (victim->name, "unknown", sizeof (victim->name));
+
+	return (victim);
+} /* }}} sender_t *network_sender_get */
+
+/* Takes a token from the bucket of the sender of "ent". Returns false if the
+ * sender is over its budget and the packet has to be dropped. The caller must
+ * hold r->senders_lock. */
+static _Bool network_sender_admit (receiver_t *r, /* {{{ */
+		const struct sockaddr_storage *addr,
+		const receive_list_entry_t *ent, cdtime_t now)
+{
+	sender_t *s = network_sender_get (r, addr, ent->sender_hash, now);
+
+	if (now > s->last_seen)
+	{
+		s->tokens += network_config_sender_rate
+			* CDTIME_T_TO_DOUBLE (now - s->last_seen);
+		if (s->tokens > network_config_sender_burst)
+			s->tokens = network_config_sender_burst;
+		s->last_seen = now;
+	}
+
+	if (s->tokens < 1.0)
+	{
+		s->packets_dropped++;
+		r->packets_dropped++;
+		return (0);
+	}
+
+	s->tokens -= 1.0;
+	s->packets_rx++;
+	s->octets_rx += (derive_t) ent->data_len;
+	return (1);
+} /* }}} _Bool network_sender_admit */
+
+/* Reads up to "entries_num" datagrams from "fd" into "entries" and their
+ * senders into "addrs". Returns the number of datagrams read, which may be
+ * zero, or -1 with errno set on error. */
+static int network_recv_batch (int fd, /* {{{ */
+    receive_list_entry_t **entries, size_t entries_num,
+    struct sockaddr_storage *addrs)
+{
+	char *bufs[RECEIVE_BATCH_SIZE];
+	size_t lens[RECEIVE_BATCH_SIZE];
+	size_t i;
+	int status;
+
+	if (entries_num > RECEIVE_BATCH_SIZE)
+		entries_num = RECEIVE_BATCH_SIZE;
+
+	for (i = 0; i < entries_num; i++)
+		bufs[i] = entries[i]->data;
+
+	status = recv_batch (fd, bufs, network_config_packet_size, lens,
+			addrs, entries_num);
+
+	for (i = 0; (status > 0) && (i < (size_t) status); i++)
+	{
+		entries[i]->data_len = (int) lens[i];
+		entries[i]->sender_hash = network_sender_hash (addrs + i);
+	}
+
+	return (status);
+} /* }}} int network_recv_batch */
+
+/* Appends the privately collected entries of "q" to its list. If "block" is
+ * false, gives up if the lock is held by the dispatch thread. */
+static void receive_queue_flush (receive_queue_t *q, _Bool block) /* {{{ */
+{
+	if (q->private_head == NULL)
+		return;
+
+	if (block)
+		pthread_mutex_lock (&q->lock);
+	else if (pthread_mutex_trylock (&q->lock) != 0)
+		return;
+
+	assert (((q->head == NULL) && (q->length == 0))
+			|| ((q->head != NULL) && (q->length != 0)));
+
+	if (q->head == NULL)
+		q->head = q->private_head;
+	else
+		q->tail->next = q->private_head;
+	q->tail = q->private_tail;
+	q->length += q->private_length;
+
+	pthread_cond_signal (&q->cond);
+	pthread_mutex_unlock (&q->lock);
+
+	q->private_head = NULL;
+	q->private_tail = NULL;
+	q->private_length = 0;
+} /* }}} void receive_queue_flush */
+
+/* Adds a received packet to the private list of the queue of its sender. */
+static void receive_queue_add (receiver_t *r, /* {{{ */
+		receive_list_entry_t *ent)
+{
+	receive_queue_t *q = r->queues + (ent->sender_hash % r->queues_num);
+
+	r->octets_rx += ((derive_t) ent->data_len);
+	r->packets_rx++;
+	PROBE3 (network_receive, ent, ent->data_len,
+			(size_t) (q - r->queues));
+
+	ent->next = NULL;
+
+	if (q->private_head == NULL)
+		q->private_head = ent;
+	else
+		q->private_tail->next = ent;
+	q->private_tail = ent;
+	q->private_length++;
+} /* }}} void receive_queue_add */
+
+/* Accepts a TCP connection on the listen socket "listen_fd". */
+static void network_stream_accept (receiver_t *r, int listen_fd) /* {{{ */
+{
+	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof (addr);
+	struct pollfd *pollfd;
+	stream_conn_t *conns;
+	stream_conn_t *c;
+	int fd;
+
+	memset (&addr, 0, sizeof (addr));
+	fd = accept (listen_fd, (struct sockaddr *) &addr, &addrlen);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+			ERROR ("network plugin: accept(2) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		return;
+	}
+
+	if (r->conns_num >= STREAM_MAX_CONNECTIONS)
+	{
+		c_complain (LOG_WARNING, &complaint,
+				"network plugin: Too many TCP connections. "
+				"Closing new ones.");
+		close (fd);
+		return;
+	}
+	c_release (LOG_NOTICE, &complaint,
+			"network plugin: Accepting TCP connections again.");
+
+	if (fcntl (fd, F_SETFL, O_NONBLOCK) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: fcntl(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return;
+	}
+
+	pollfd = realloc (r->pollfd, sizeof (*pollfd) * (r->pollfd_num + 1));
+	if (pollfd == NULL)
+	{
+		ERROR ("network plugin: realloc failed.");
+		close (fd);
+		return;
+	}
+	r->pollfd = pollfd;
+
+	conns = realloc (r->conns, sizeof (*conns) * (r->conns_num + 1));
+	if (conns == NULL)
+	{
+		ERROR ("network plugin: realloc failed.");
+		close (fd);
+		return;
+	}
+	r->conns = conns;
+
+	c = r->conns + r->conns_num;
+	memset (c, 0, sizeof (*c));
+	c->listen_fd = listen_fd;
+	c->sender_hash = network_sender_hash (&addr);
+	c->sender_addr = addr;
+	/* One complete packet plus as much data as a single read returns. */
+	c->buffer_size = sizeof (uint32_t) + network_config_packet_size
+		+ STREAM_BUFFER_SIZE;
+	c->buffer = malloc (c->buffer_size);
+	if (c->buffer == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		close (fd);
+		return;
+	}
+
+	memset (r->pollfd + r->pollfd_num, 0, sizeof (*r->pollfd));
+	r->pollfd[r->pollfd_num].fd = fd;
+	r->pollfd[r->pollfd_num].events = POLLIN | POLLPRI;
+	r->pollfd_num++;
+	r->conns_num++;
+} /* }}} void network_stream_accept */
+
+/* Reads from the TCP connection at "index" of r->pollfd and queues the
+ * complete packets. Returns non-zero if the connection has to be closed. */
+static int network_stream_read (receiver_t *r, size_t index) /* {{{ */
+{
+	stream_conn_t *c = r->conns + (index - r->listen_num);
+	size_t offset = 0;
+	cdtime_t now = 0;
+	ssize_t status;
+
+	status = read (r->pollfd[index].fd, c->buffer + c->buffer_fill,
+			c->buffer_size - c->buffer_fill);
+	if (status < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+			return (0);
+		ERROR ("network plugin: read(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	else if (status == 0) /* connection closed */
+		return (-1);
+
+	c->buffer_fill += (size_t) status;
+	status = 0;
+
+	if (r->senders != NULL)
+	{
+		now = cdtime ();
+		pthread_mutex_lock (&r->senders_lock);
+	}
+
+	while ((c->buffer_fill - offset) >= sizeof (uint32_t))
+	{
+		receive_list_entry_t *ent;
+		uint32_t length;
+
+		memcpy (&length, c->buffer + offset, sizeof (length));
+		length = ntohl (length);
+		if ((length == 0) || (length > network_config_packet_size))
+		{
+			WARNING ("network plugin: Received a packet of %"PRIu32" bytes "
+					"over TCP, but MaxPacketSize is %zu. Closing the "
+					"connection.", length, network_config_packet_size);
+			status = -1;
+			break;
+		}
+
+		if ((c->buffer_fill - offset) < (sizeof (length) + length))
+			break;
+
+		if (receive_entries_get (&ent, 1) == 1)
+		{
+			memcpy (ent->data, c->buffer + offset + sizeof (length), length);
+			ent->data_len = (int) length;
+			ent->fd = c->listen_fd;
+			ent->sender_hash = c->sender_hash;
+			if ((r->senders == NULL)
+					|| network_sender_admit (r, &c->sender_addr, ent, now))
+				receive_queue_add (r, ent);
+			else
+				receive_entries_put (ent);
+		}
+		else
+			ERROR ("network plugin: network_stream_read: "
+					"Dropping a packet.");
+
+		offset += sizeof (length) + length;
+	}
+
+	if (r->senders != NULL)
+		pthread_mutex_unlock (&r->senders_lock);
+
+	if (status != 0)
+		return (-1);
+
+	if (offset > 0)
+	{
+		c->buffer_fill -= offset;
+		memmove (c->buffer, c->buffer + offset, c->buffer_fill);
+	}
+
+	return (0);
+} /* }}} int network_stream_read */
+
+/* Removes the TCP connections closed by setting their fd to -1. */
+static void network_stream_compact (receiver_t *r) /* {{{ */
+{
+	size_t i = r->listen_num;
+
+	while (i < r->pollfd_num)
+	{
+		size_t last = r->pollfd_num - 1;
+
+		if (r->pollfd[i].fd >= 0)
+		{
+			i++;
+			continue;
+		}
+
+		sfree (r->conns[i - r->listen_num].buffer);
+		r->pollfd[i] = r->pollfd[last];
+		r->conns[i - r->listen_num] = r->conns[last - r->listen_num];
+		r->pollfd_num--;
+		r->conns_num--;
+	}
+} /* }}} void network_stream_compact */
+
+static int network_receive (receiver_t *r) /* {{{ */
+{
+	receive_list_entry_t *spare[RECEIVE_BATCH_SIZE];
+	struct sockaddr_storage addrs[RECEIVE_BATCH_SIZE];
+	size_t                spare_num = 0;
+	size_t                batch_size = 1;
+	receive_list_entry_t *dropped = NULL;
+	cdtime_t              now = 0;
+	_Bool                 closed = 0;
+
+	size_t i;
+	int status = 0;
+
+	assert (r->pollfd_num > 0);
+	assert (r->queues_num > 0);
+
+#if HAVE_RECVMMSG
+	batch_size = RECEIVE_BATCH_SIZE;
+#endif
+
+	while (listen_loop == 0)
+	{
+		status = poll (r->pollfd, r->pollfd_num, -1);
 		if (status <= 0)
 		{
 			char errbuf[1024];
@@ -2465,19 +4246,51 @@ static int network_receive (void) /* {{{ */
 			break;
 		}
 
-		for (i = 0; (i < listen_sockets_num) && (status > 0); i++)
+		for (i = 0; (i < r->pollfd_num) && (status > 0); i++)
 		{
-			receive_list_entry_t *ent;
-
-			if ((listen_sockets_pollfd[i].revents
-						& (POLLIN | POLLPRI)) == 0)
+			int received;
+			int j;
+			size_t k;
+
+			/* A closed TCP connection may only report POLLHUP. */
+			if ((r->pollfd[i].revents & (POLLIN | POLLPRI
+							| ((i >= r->listen_num) ? (POLLHUP | POLLERR) : 0)))
+					== 0)
 				continue;
 			status--;
 
-			buffer_len = recv (listen_sockets_pollfd[i].fd,
-					buffer, sizeof (buffer),
-					0 /* no flags */);
-			if (buffer_len < 0)
+			if ((i >= r->listen_num) || r->listen_stream[i])
+			{
+				if (i < r->listen_num)
+					network_stream_accept (r, r->pollfd[i].fd);
+				else if (network_stream_read (r, i) != 0)
+				{
+					close (r->pollfd[i].fd);
+					r->pollfd[i].fd = -1;
+					closed = 1;
+				}
+
+				for (k = 0; k < r->queues_num; k++)
+					receive_queue_flush (r->queues + k, /* block = */ 0);
+
+				status = 0;
+				continue;
+			}
+
+			/* Packets are received directly into the buffers of receive
+			 * list entries, which are recycled after dispatching. */
+			if (spare_num < batch_size)
+				spare_num += receive_entries_get (spare + spare_num,
+						batch_size - spare_num);
+			if (spare_num == 0)
+			{
+				status = ENOMEM;
+				break;
+			}
+
+			received = network_recv_batch (r->pollfd[i].fd,
+					spare, spare_num, addrs);
+			if (received < 0)
 			{
 				char errbuf[1024];
 				status = (errno != 0) ? errno : -1;
@@ -2486,135 +4299,395 @@ static int network_receive (void) /* {{{ */
 				break;
 			}
 
-			stats_octets_rx += ((uint64_t) buffer_len);
-			stats_packets_rx++;
-
-			/* TODO: Possible performance enhancement: Do not free
-			 * these entries in the dispatch thread but put them in
-			 * another list, so we don't have to allocate more and
-			 * more of these structures. */
-			ent = calloc (1, sizeof (*ent));
-			if (ent == NULL)
+			if (r->senders != NULL)
 			{
-				ERROR ("network plugin: calloc failed.");
-				status = ENOMEM;
-				break;
+				now = cdtime ();
+				pthread_mutex_lock (&r->senders_lock);
 			}
 
-			ent->data = malloc (network_config_packet_size);
-			if (ent->data == NULL)
+			for (j = 0; j < received; j++)
 			{
-				sfree (ent);
-				ERROR ("network plugin: malloc failed.");
-				status = ENOMEM;
-				break;
+				spare[j]->fd = r->pollfd[i].fd;
+				if ((r->senders != NULL)
+						&& !network_sender_admit (r, addrs + j, spare[j], now))
+				{
+					spare[j]->next = dropped;
+					dropped = spare[j];
+					continue;
+				}
+				receive_queue_add (r, spare[j]);
 			}
-			ent->fd = listen_sockets_pollfd[i].fd;
-			ent->next = NULL;
 
-			memcpy (ent->data, buffer, buffer_len);
-			ent->data_len = buffer_len;
+			if (r->senders != NULL)
+				pthread_mutex_unlock (&r->senders_lock);
+			receive_entries_put (dropped);
+			dropped = NULL;
 
-			if (private_list_head == NULL)
-				private_list_head = ent;
-			else
-				private_list_tail->next = ent;
-			private_list_tail = ent;
-			private_list_length++;
+			spare_num -= (size_t) received;
+			memmove (spare, spare + received, sizeof (spare[0]) * spare_num);
 
 			/* Do not block here. Blocking here has led to
 			 * insufficient performance in the past. */
-			if (pthread_mutex_trylock (&receive_list_lock) == 0)
+			for (k = 0; k < r->queues_num; k++)
+				receive_queue_flush (r->queues + k, /* block = */ 0);
+
+			status = 0;
+		} /* for (r->pollfd) */
+
+		if (closed)
+		{
+			network_stream_compact (r);
+			closed = 0;
+		}
+
+		if (status != 0)
+			break;
+	} /* while (listen_loop == 0) */
+
+	/* Make sure everything is dispatched before exiting. */
+	for (i = 0; i < r->queues_num; i++)
+		receive_queue_flush (r->queues + i, /* block = */ 1);
+
+	for (i = r->listen_num; i < r->pollfd_num; i++)
+	{
+		close (r->pollfd[i].fd);
+		r->pollfd[i].fd = -1;
+	}
+	network_stream_compact (r);
+	sfree (r->conns);
+
+	for (i = 0; i < spare_num; i++)
+	{
+		spare[i]->next = NULL;
+		receive_entries_put (spare[i]);
+	}
+
+	return (status);
+} /* }}} int network_receive */
+
+static void *receive_thread (void *arg)
+{
+	return (network_receive (arg) ? (void *) 1 : (void *) 0);
+} /* void *receive_thread */
+
+static void network_init_buffer (sockent_t *se) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+
+	client->send_buffer_fill = 0;
+	client->send_buffer_first_update = 0;
+	client->send_buffer_last_update = 0;
+	client->send_buffer_session = 0;
+
+	memset (&client->send_buffer_vl, 0, sizeof (client->send_buffer_vl));
+} /* }}} void network_init_buffer */
+
+static void network_send_buffer_sendto (sockent_t *se, /* {{{ */
+		const char *buffer, size_t buffer_size)
+{
+	int status;
+
+	while (42)
+	{
+		status = sockent_client_connect (se);
+		if (status != 0)
+			return;
+
+		status = sendto (se->data.client.fd, buffer, buffer_size,
+				/* flags = */ 0,
+				(struct sockaddr *) se->data.client.addr,
+				se->data.client.addrlen);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+
+			ERROR ("network plugin: sendto failed: %s. Closing sending socket.",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			sockent_client_disconnect (se);
+			return;
+		}
+
+		break;
+	} /* while (42) */
+} /* }}} void network_send_buffer_sendto */
+
+#if HAVE_SENDMMSG
+/* Sends the packets collected by network_send_buffer_plain(). */
+static void network_send_batch (sockent_t *se) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+	size_t sent = 0;
+	size_t i;
+	int status;
+
+	if (client->batch_num == 0)
+		return;
+
+	while (sent < client->batch_num)
+	{
+		status = sockent_client_connect (se);
+		if (status != 0)
+			break;
+
+		for (i = sent; i < client->batch_num; i++)
+		{
+			client->batch_msgs[i].msg_hdr.msg_name = client->addr;
+			client->batch_msgs[i].msg_hdr.msg_namelen = client->addrlen;
+		}
+
+		status = sendmmsg (client->fd, client->batch_msgs + sent,
+				(unsigned int) (client->batch_num - sent),
+				/* flags = */ 0);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+
+			if (errno == ENOSYS)
 			{
-				assert (((receive_list_head == NULL) && (receive_list_length == 0))
-						|| ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-				if (receive_list_head == NULL)
-					receive_list_head = private_list_head;
-				else
-					receive_list_tail->next = private_list_head;
-				receive_list_tail = private_list_tail;
-				receive_list_length += private_list_length;
-
-				pthread_cond_signal (&receive_list_cond);
-				pthread_mutex_unlock (&receive_list_lock);
-
-				private_list_head = NULL;
-				private_list_tail = NULL;
-				private_list_length = 0;
+				send_no_sendmmsg = 1;
+				for (i = sent; i < client->batch_num; i++)
+					network_send_buffer_sendto (se,
+							client->batch_iovs[i].iov_base,
+							client->batch_iovs[i].iov_len);
+				break;
 			}
 
-			status = 0;
-		} /* for (listen_sockets_pollfd) */
+			ERROR ("network plugin: sendmmsg failed: %s. Closing sending socket.",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			sockent_client_disconnect (se);
+			break;
+		}
+
+		sent += (size_t) status;
+	} /* while (sent < batch_num) */
+
+	client->batch_num = 0;
+} /* }}} void network_send_batch */
+#endif /* HAVE_SENDMMSG */
+
+/* Closes the connection of "se" after an error and schedules the next
+ * connection attempt. Packets which have not been written completely are
+ * lost. */
+static void network_stream_failed (sockent_t *se, cdtime_t now) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+
+	sockent_client_disconnect (se);
+
+	if (client->stream_buffer_fill > 0)
+		WARNING ("network plugin: Discarding %zu bytes which could not be "
+				"sent to \"%s\".", client->stream_buffer_fill, se->node);
+	client->stream_buffer_fill = 0;
+
+	if (client->stream_backoff == 0)
+		client->stream_backoff = STREAM_BACKOFF_MIN;
+	else if (client->stream_backoff < STREAM_BACKOFF_MAX)
+	{
+		client->stream_backoff *= 2;
+		if (client->stream_backoff > STREAM_BACKOFF_MAX)
+			client->stream_backoff = STREAM_BACKOFF_MAX;
+	}
+	client->stream_next_connect = now + client->stream_backoff;
+} /* }}} void network_stream_failed */
+
+/* Makes sure "se" is connected. Returns zero if data can be written, or
+ * EAGAIN and the time of the next attempt in "ret_retry". */
+static int network_stream_connect (sockent_t *se, /* {{{ */
+		cdtime_t now, cdtime_t *ret_retry)
+{
+	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+	struct sockent_client *client = &se->data.client;
+	struct pollfd pfd;
+	int error = 0;
+	socklen_t error_len = sizeof (error);
+
+	if ((client->fd < 0) && (client->stream_next_connect > now))
+	{
+		*ret_retry = client->stream_next_connect;
+		return (EAGAIN);
+	}
+
+	/* Re-opening the connection for "ResolveInterval" would cut a
+	 * partially written packet. */
+	if (((client->fd < 0) || (client->stream_buffer_fill == 0))
+			&& (sockent_client_connect (se) != 0))
+	{
+		network_stream_failed (se, now);
+		*ret_retry = client->stream_next_connect;
+		return (EAGAIN);
+	}
+
+	if (!client->stream_connecting)
+		return (0);
+
+	memset (&pfd, 0, sizeof (pfd));
+	pfd.fd = client->fd;
+	pfd.events = POLLOUT;
+	if (poll (&pfd, 1, /* timeout = */ 0) <= 0)
+	{
+		if ((client->stream_connect_started + STREAM_TIMEOUT) > now)
+		{
+			*ret_retry = now + STREAM_POLL_INTERVAL;
+			return (EAGAIN);
+		}
+		error = ETIMEDOUT;
+	}
+	else if (getsockopt (client->fd, SOL_SOCKET, SO_ERROR,
+				&error, &error_len) != 0)
+		error = errno;
+
+	if (error != 0)
+	{
+		char errbuf[1024];
+		c_complain (LOG_ERR, &complaint,
+				"network plugin: Connecting to \"%s\" failed: %s",
+				se->node, sstrerror (error, errbuf, sizeof (errbuf)));
+		network_stream_failed (se, now);
+		*ret_retry = client->stream_next_connect;
+		return (EAGAIN);
+	}
+
+	c_release (LOG_NOTICE, &complaint,
+			"network plugin: Connected to \"%s\".", se->node);
+	client->stream_connecting = 0;
+	client->stream_backoff = 0;
+	return (0);
+} /* }}} int network_stream_connect */
+
+/* Writes as much of the stream buffer as the connection accepts. Returns
+ * zero if everything has been written, EAGAIN if the socket is full and an
+ * error code if the connection failed. */
+static int network_stream_write (sockent_t *se, cdtime_t now) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+	size_t written = 0;
+
+	while (written < client->stream_buffer_fill)
+	{
+		ssize_t status;
+
+		status = write (client->fd, client->stream_buffer + written,
+				client->stream_buffer_fill - written);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
 
-		if (status != 0)
-			break;
-	} /* while (listen_loop == 0) */
+			ERROR ("network plugin: Writing to \"%s\" failed: %s",
+					se->node, sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (errno);
+		}
+		written += (size_t) status;
+	}
 
-	/* Make sure everything is dispatched before exiting. */
-	if (private_list_head != NULL)
+	if (written > 0)
 	{
-		pthread_mutex_lock (&receive_list_lock);
+		client->stream_buffer_fill -= written;
+		memmove (client->stream_buffer, client->stream_buffer + written,
+				client->stream_buffer_fill);
+		client->stream_last_write = now;
+	}
 
-		if (receive_list_head == NULL)
-			receive_list_head = private_list_head;
-		else
-			receive_list_tail->next = private_list_head;
-		receive_list_tail = private_list_tail;
-		receive_list_length += private_list_length;
+	if (client->stream_buffer_fill == 0)
+		return (0);
 
-		pthread_cond_signal (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
+	if ((client->stream_last_write + STREAM_TIMEOUT) <= now)
+	{
+		ERROR ("network plugin: Writing to \"%s\" timed out.", se->node);
+		return (ETIMEDOUT);
 	}
+	return (EAGAIN);
+} /* }}} int network_stream_write */
 
-	return (status);
-} /* }}} int network_receive */
-
-static void *receive_thread (void __attribute__((unused)) *arg)
+/* Appends one length-prefixed packet to the stream buffer. The caller makes
+ * sure there is enough room, see network_send_stream(). */
+static void network_stream_append (sockent_t *se, /* {{{ */
+		const char *buffer, size_t buffer_size)
 {
-	return (network_receive () ? (void *) 1 : (void *) 0);
-} /* void *receive_thread */
+	struct sockent_client *client = &se->data.client;
+	uint32_t length = htonl ((uint32_t) buffer_size);
 
-static void network_init_buffer (void)
-{
-	memset (send_buffer, 0, network_config_packet_size);
-	send_buffer_ptr = send_buffer;
-	send_buffer_fill = 0;
-	send_buffer_last_update = 0;
+	if ((client->stream_buffer_fill + sizeof (length) + buffer_size)
+			> client->stream_buffer_size)
+	{
+		ERROR ("network plugin: network_stream_append: "
+				"Stream buffer too small. Dropping packet.");
+		return;
+	}
+
+	if (client->stream_buffer_fill == 0)
+		client->stream_last_write = cdtime ();
 
-	memset (&send_buffer_vl, 0, sizeof (send_buffer_vl));
-} /* int network_init_buffer */
+	memcpy (client->stream_buffer + client->stream_buffer_fill,
+			&length, sizeof (length));
+	memcpy (client->stream_buffer + client->stream_buffer_fill
+			+ sizeof (length), buffer, buffer_size);
+	client->stream_buffer_fill += sizeof (length) + buffer_size;
+} /* }}} void network_stream_append */
 
+/* Sends a signed, encrypted or plain packet. With sendmmsg(2) the packet is
+ * only copied to the batch of this server, which is sent when it is full or
+ * by network_send_queue(). With "Protocol TCP" it is copied to the stream
+ * buffer. */
 static void network_send_buffer_plain (sockent_t *se, /* {{{ */
 		const char *buffer, size_t buffer_size)
 {
-	int status;
+#if HAVE_SENDMMSG
+	struct sockent_client *client = &se->data.client;
+#endif
 
-	while (42)
+	if (se->data.client.stream)
 	{
-		status = sockent_client_connect (se);
-		if (status != 0)
-			return;
+		network_stream_append (se, buffer, buffer_size);
+		return;
+	}
 
-		status = sendto (se->data.client.fd, buffer, buffer_size,
-				/* flags = */ 0,
-				(struct sockaddr *) se->data.client.addr,
-				se->data.client.addrlen);
-		if (status < 0)
-		{
-			char errbuf[1024];
+#if HAVE_SENDMMSG
+	if (!send_no_sendmmsg && (client->batch_data == NULL))
+	{
+		client->batch_slot_size = client->send_buffer_size + BUFF_SIG_SIZE;
+		client->batch_data = malloc (SEND_BATCH_SIZE
+				* client->batch_slot_size);
+		client->batch_num = 0;
+	}
 
-			if ((errno == EINTR) || (errno == EAGAIN))
-				continue;
+	if (!send_no_sendmmsg && (client->batch_data != NULL)
+			&& (buffer_size <= client->batch_slot_size))
+	{
+		char *slot = client->batch_data
+			+ client->batch_num * client->batch_slot_size;
+
+		memcpy (slot, buffer, buffer_size);
+		client->batch_iovs[client->batch_num].iov_base = slot;
+		client->batch_iovs[client->batch_num].iov_len = buffer_size;
+		memset (&client->batch_msgs[client->batch_num], 0,
+				sizeof (client->batch_msgs[client->batch_num]));
+		client->batch_msgs[client->batch_num].msg_hdr.msg_iov =
+			&client->batch_iovs[client->batch_num];
+		client->batch_msgs[client->batch_num].msg_hdr.msg_iovlen = 1;
+		client->batch_num++;
+
+		if (client->batch_num >= SEND_BATCH_SIZE)
+			network_send_batch (se);
+		return;
+	}
 
-			ERROR ("network plugin: sendto failed: %s. Closing sending socket.",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			sockent_client_disconnect (se);
-			return;
-		}
+	/* Packets that don't fit into a slot are sent right away, after the
+	 * ones collected so far. */
+	network_send_batch (se);
+#endif /* HAVE_SENDMMSG */
 
-		break;
-	} /* while (42) */
+	network_send_buffer_sendto (se, buffer, buffer_size);
 } /* }}} void network_send_buffer_plain */
 
 #if HAVE_LIBGCRYPT
@@ -2782,23 +4855,65 @@ static void network_send_buffer_encrypted (sockent_t *se, /* {{{ */
 #undef BUFFER_ADD
 #endif /* HAVE_LIBGCRYPT */
 
-static void network_send_buffer (char *buffer, size_t buffer_len) /* {{{ */
+#if HAVE_LIBLZ4
+/* Compresses "in_buffer" into a single LZ4 part in "out_buffer", which has
+ * room for "in_buffer_size" bytes. Returns the size of the part or zero if
+ * compressing doesn't make the packet smaller. */
+static size_t network_compress_buffer (const char *in_buffer, /* {{{ */
+    size_t in_buffer_size, char *out_buffer)
 {
-  sockent_t *se;
+  uint16_t pkg_type = htons (TYPE_COMPR_LZ4);
+  uint16_t pkg_length;
+  uint16_t pkg_orig_length;
+  int status;
 
-  DEBUG ("network plugin: network_send_buffer: buffer_len = %zu", buffer_len);
+  if (in_buffer_size <= PART_COMPRESSION_LZ4_SIZE)
+    return (0);
 
-  for (se = sending_sockets; se != NULL; se = se->next)
+  status = LZ4_compress_default (in_buffer,
+      out_buffer + PART_COMPRESSION_LZ4_SIZE, (int) in_buffer_size,
+      (int) (in_buffer_size - PART_COMPRESSION_LZ4_SIZE - 1));
+  if (status <= 0)
+    return (0);
+
+  pkg_length = htons ((uint16_t) (PART_COMPRESSION_LZ4_SIZE + status));
+  pkg_orig_length = htons ((uint16_t) in_buffer_size);
+  memcpy (out_buffer, &pkg_type, sizeof (pkg_type));
+  memcpy (out_buffer + 2, &pkg_length, sizeof (pkg_length));
+  memcpy (out_buffer + 4, &pkg_orig_length, sizeof (pkg_orig_length));
+
+  return (PART_COMPRESSION_LZ4_SIZE + (size_t) status);
+} /* }}} size_t network_compress_buffer */
+#endif /* HAVE_LIBLZ4 */
+
+static void network_send_buffer (sockent_t *se, /* {{{ */
+    const char *buffer, size_t buffer_len)
+{
+#if HAVE_LIBLZ4
+  char compressed[buffer_len];
+
+  if (se->data.client.compress)
   {
+    size_t compressed_len = network_compress_buffer (buffer, buffer_len,
+        compressed);
+    if (compressed_len > 0)
+    {
+      buffer = compressed;
+      buffer_len = compressed_len;
+    }
+  }
+#endif
+
+  DEBUG ("network plugin: network_send_buffer: buffer_len = %zu", buffer_len);
+
 #if HAVE_LIBGCRYPT
-    if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
-      network_send_buffer_encrypted (se, buffer, buffer_len);
-    else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
-      network_send_buffer_signed (se, buffer, buffer_len);
-    else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
+  if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
+    network_send_buffer_encrypted (se, buffer, buffer_len);
+  else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
+    network_send_buffer_signed (se, buffer, buffer_len);
+  else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
 #endif /* HAVE_LIBGCRYPT */
-      network_send_buffer_plain (se, buffer, buffer_len);
-  } /* for (sending_sockets) */
+    network_send_buffer_plain (se, buffer, buffer_len);
 } /* }}} void network_send_buffer */
 
 static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
@@ -2871,23 +4986,329 @@ static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 	return (buffer - buffer_orig);
 } /* }}} int add_to_buffer */
 
-static void flush_buffer (void)
+static void network_wakeup_send_thread (void) /* {{{ */
+{
+	pthread_mutex_lock (&send_thread_lock);
+	send_thread_wakeup = 1;
+	pthread_cond_signal (&send_thread_cond);
+	pthread_mutex_unlock (&send_thread_lock);
+} /* }}} void network_wakeup_send_thread */
+
+/* Appends a copy of "buffer" to the send queue of "se". The caller must hold
+ * the send_lock of "se". */
+static int network_queue_packet (sockent_t *se, /* {{{ */
+		const char *buffer, size_t buffer_size)
+{
+	static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+	struct sockent_client *client = &se->data.client;
+	send_packet_t *p;
+
+	if (client->send_queue_length >= SEND_QUEUE_MAX)
+	{
+		c_complain (LOG_WARNING, &complaint,
+				"network plugin: The send queue of server \"%s\" "
+				"is full. Dropping packets.", se->node);
+		return (-1);
+	}
+
+	p = malloc (sizeof (*p) + buffer_size);
+	if (p == NULL)
+	{
+		ERROR ("network plugin: network_queue_packet: malloc failed.");
+		return (-1);
+	}
+	p->size = buffer_size;
+	p->next = NULL;
+	memcpy (p + 1, buffer, buffer_size);
+
+	if (client->send_queue_tail == NULL)
+		client->send_queue_head = p;
+	else
+		client->send_queue_tail->next = p;
+	client->send_queue_tail = p;
+	client->send_queue_length++;
+
+	c_release (LOG_NOTICE, &complaint,
+			"network plugin: The send queue of server \"%s\" "
+			"accepts packets again.", se->node);
+
+	return (0);
+} /* }}} int network_queue_packet */
+
+/* Moves the contents of the send buffer to the send queue. The caller must
+ * hold the send_lock of "se". */
+static void flush_buffer (sockent_t *se) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+
+	DEBUG ("network plugin: flush_buffer: send_buffer_fill = %zu",
+			client->send_buffer_fill);
+
+	if (client->send_buffer_fill > 0)
+		network_queue_packet (se, client->send_buffer,
+				client->send_buffer_fill);
+
+	network_init_buffer (se);
+} /* }}} void flush_buffer */
+
+static int network_dict_grow (struct sockent_client *client) /* {{{ */
+{
+	dict_send_entry_t **table;
+	size_t table_size;
+	size_t i;
+
+	table_size = (client->dict_table_size == 0)
+		? 64 : 2 * client->dict_table_size;
+	table = calloc (table_size, sizeof (*table));
+	if (table == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < client->dict_table_size; i++)
+	{
+		dict_send_entry_t *e = client->dict_table[i];
+
+		while (e != NULL)
+		{
+			dict_send_entry_t *next = e->next;
+			size_t slot = e->id.hash & (table_size - 1);
+
+			e->next = table[slot];
+			table[slot] = e;
+			e = next;
+		}
+	}
+
+	sfree (client->dict_table);
+	client->dict_table = table;
+	client->dict_table_size = table_size;
+
+	return (0);
+} /* }}} int network_dict_grow */
+
+/* Returns the dictionary entry of "vl", creating it if necessary. Returns NULL
+ * if the dictionary is full. */
+static dict_send_entry_t *network_dict_get (struct sockent_client *client, /* {{{ */
+		const value_list_t *vl)
+{
+	dict_send_entry_t *e;
+	uint32_t hash;
+	size_t slot;
+
+	hash = identifier_hash_vl (vl);
+
+	if (client->dict_table != NULL)
+	{
+		slot = hash & (client->dict_table_size - 1);
+		for (e = client->dict_table[slot]; e != NULL; e = e->next)
+			if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+				return (e);
+	}
+
+	if (client->dict_num >= DICT_MAX_ENTRIES)
+		return (NULL);
+
+	if ((client->dict_num >= client->dict_table_size)
+			&& (network_dict_grow (client) != 0))
+		return (NULL);
+
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (NULL);
+
+	if (identifier_create (&e->id, vl) != 0)
+	{
+		sfree (e);
+		return (NULL);
+	}
+	e->dict_id = client->dict_next_id++;
+
+	slot = e->id.hash & (client->dict_table_size - 1);
+	e->next = client->dict_table[slot];
+	client->dict_table[slot] = e;
+	client->dict_num++;
+
+	return (e);
+} /* }}} dict_send_entry_t *network_dict_get */
+
+/* Removes the identifiers which haven't been written for DICT_EXPIRE. */
+static void network_dict_purge (struct sockent_client *client, /* {{{ */
+		cdtime_t now)
+{
+	size_t i;
+
+	if ((client->dict_last_purge + DICT_EXPIRE) > now)
+		return;
+	client->dict_last_purge = now;
+
+	for (i = 0; i < client->dict_table_size; i++)
+	{
+		dict_send_entry_t **prev = &client->dict_table[i];
+
+		while (*prev != NULL)
+		{
+			dict_send_entry_t *e = *prev;
+
+			if ((e->used + DICT_EXPIRE) > now)
+			{
+				prev = &e->next;
+				continue;
+			}
+
+			*prev = e->next;
+			network_dict_free (e);
+			client->dict_num--;
+		}
+	}
+} /* }}} void network_dict_purge */
+
+/* Like add_to_buffer(), but writes the dictionary id of "vl" instead of its
+ * identifier. The definition of the id is sent with its first use and every
+ * dict_refresh, so each packet can be decoded on its own once the receiver
+ * has seen one definition.
+ *
+ * The receiver clears the identifier after a TYPE_ID_VALUES part and keeps
+ * the time of the packet, so the identifier of the next TYPE_VALUES part is
+ * sent in full. */
+static int add_to_buffer_id (char *buffer, int buffer_size, /* {{{ */
+		struct sockent_client *client, dict_send_entry_t *e,
+		const data_set_t *ds, const value_list_t *vl, cdtime_t now)
+{
+	value_list_t *vl_def = &client->send_buffer_vl;
+	char *buffer_orig = buffer;
+	_Bool define;
+	_Bool write_time;
+	int64_t time_delta;
+
+	if (!client->send_buffer_session
+			&& (write_part_number (&buffer, &buffer_size, TYPE_SESSION,
+					client->dict_session) != 0))
+		return (-1);
+
+	define = (e->defined == 0)
+		|| (e->generation != client->dict_generation)
+		|| ((e->defined + client->dict_refresh) <= now);
+	if (define && (write_part_id_define (&buffer, &buffer_size,
+					e->dict_id, vl) != 0))
+		return (-1);
+
+	time_delta = (int64_t) vl->time - (int64_t) vl_def->time;
+	write_time = (vl_def->time == 0)
+		|| (time_delta < INT32_MIN) || (time_delta > INT32_MAX);
+	if (write_time)
+	{
+		if (write_part_number (&buffer, &buffer_size, TYPE_TIME_HR,
+					(uint64_t) vl->time))
+			return (-1);
+		time_delta = 0;
+	}
+
+	if ((vl_def->interval != vl->interval)
+			&& (write_part_number (&buffer, &buffer_size,
+					TYPE_INTERVAL_HR, (uint64_t) vl->interval)))
+		return (-1);
+
+	if (write_part_id_values (&buffer, &buffer_size, e->dict_id,
+				(int32_t) time_delta, ds, vl) != 0)
+		return (-1);
+
+	client->send_buffer_session = 1;
+	if (define)
+	{
+		e->defined = now;
+		e->generation = client->dict_generation;
+	}
+	if (write_time)
+		vl_def->time = vl->time;
+	vl_def->interval = vl->interval;
+	vl_def->host[0] = 0;
+	vl_def->plugin[0] = 0;
+	vl_def->plugin_instance[0] = 0;
+	vl_def->type[0] = 0;
+	vl_def->type_instance[0] = 0;
+
+	return (buffer - buffer_orig);
+} /* }}} int add_to_buffer_id */
+
+/* Appends "vl" to the send buffer of "client", using the dictionary entry "e"
+ * if it is not NULL. */
+static int network_buffer_append (struct sockent_client *client, /* {{{ */
+		dict_send_entry_t *e,
+		const data_set_t *ds, const value_list_t *vl, cdtime_t now)
+{
+	char *buffer = client->send_buffer + client->send_buffer_fill;
+	int buffer_size = (int) client->send_buffer_size
+		- (int) (client->send_buffer_fill + BUFF_SIG_SIZE);
+
+	if (e != NULL)
+		return (add_to_buffer_id (buffer, buffer_size, client, e,
+					ds, vl, now));
+	return (add_to_buffer (buffer, buffer_size,
+				&client->send_buffer_vl, ds, vl));
+} /* }}} int network_buffer_append */
+
+/* Adds "vl" to the send buffer of "se". The caller must hold the send_lock
+ * of "se". "ret_wakeup" is set if the send thread has work to do, i.e. a
+ * packet has been queued or a FlushInterval has to be scheduled. */
+static int network_buffer_add (sockent_t *se, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl,
+		_Bool *ret_wakeup)
 {
-	DEBUG ("network plugin: flush_buffer: send_buffer_fill = %i",
-			send_buffer_fill);
+	struct sockent_client *client = &se->data.client;
+	dict_send_entry_t *e = NULL;
+	cdtime_t now = cdtime ();
+	int status;
+
+	if (client->dict_enabled)
+	{
+		network_dict_purge (client, now);
+		/* Identifiers which don't fit into the dictionary are sent in
+		 * full. */
+		e = network_dict_get (client, vl);
+		if (e != NULL)
+			e->used = now;
+	}
+
+	status = network_buffer_append (client, e, ds, vl, now);
+	if (status < 0)
+	{
+		flush_buffer (se);
+		*ret_wakeup = 1;
+
+		status = network_buffer_append (client, e, ds, vl, now);
+	}
+
+	if (status < 0)
+	{
+		ERROR ("network plugin: Unable to append to the "
+				"buffer for some weird reason");
+		return (-1);
+	}
 
-	network_send_buffer (send_buffer, (size_t) send_buffer_fill);
+	/* status == bytes added to the buffer */
+	client->send_buffer_last_update = now;
+	if (client->send_buffer_fill == 0)
+	{
+		client->send_buffer_first_update = now;
+		if (client->flush_interval > 0)
+			*ret_wakeup = 1;
+	}
+	client->send_buffer_fill += (size_t) status;
 
-	stats_octets_tx += ((uint64_t) send_buffer_fill);
-	stats_packets_tx++;
+	if ((client->send_buffer_size - client->send_buffer_fill) < 15)
+	{
+		flush_buffer (se);
+		*ret_wakeup = 1;
+	}
 
-	network_init_buffer ();
-}
+	return (0);
+} /* }}} int network_buffer_add */
 
 static int network_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	int status;
+	sockent_t *se;
+	_Bool wakeup = 0;
+	_Bool sent = 0;
 
 	if (!check_send_okay (vl))
 	{
@@ -2909,53 +5330,249 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	uc_meta_data_add_unsigned_int (vl,
 	    "network:time_sent", (uint64_t) vl->time);
 
-	pthread_mutex_lock (&send_buffer_lock);
-
-	status = add_to_buffer (send_buffer_ptr,
-			network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-			&send_buffer_vl,
-			ds, vl);
-	if (status >= 0)
+	/* Each server has its own buffer and lock, so writes to one don't wait
+	 * for the others. Full packets are sent by the send thread. */
+	for (se = sending_sockets; se != NULL; se = se->next)
 	{
-		/* status == bytes added to the buffer */
-		send_buffer_fill += status;
-		send_buffer_ptr  += status;
-		send_buffer_last_update = cdtime();
+		pthread_mutex_lock (&se->data.client.send_lock);
+		if (network_buffer_add (se, ds, vl, &wakeup) == 0)
+			sent = 1;
+		pthread_mutex_unlock (&se->data.client.send_lock);
+	}
 
+	if (wakeup)
+		network_wakeup_send_thread ();
+
+	if (sent)
+	{
+		pthread_mutex_lock (&stats_lock);
 		stats_values_sent++;
+		pthread_mutex_unlock (&stats_lock);
 	}
-	else
+
+	return (sent ? 0 : -1);
+} /* int network_write */
+
+/* Sends the queued packets of a "Protocol TCP" server, as many as fit into
+ * the stream buffer at a time. Packets stay queued while the server is not
+ * connected, so the send queue is the backlog. Returns the time at which to
+ * try again, or zero. */
+static cdtime_t network_send_stream (sockent_t *se, cdtime_t now) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+	cdtime_t retry = 0;
+	int status;
+
+	if (network_stream_connect (se, now, &retry) != 0)
+		return (retry);
+
+	while (42)
 	{
-		flush_buffer ();
+		send_packet_t *head;
+		send_packet_t *last = NULL;
+		send_packet_t *ptr;
+		size_t free_size;
+		derive_t octets = 0;
+		derive_t packets = 0;
+
+		status = network_stream_write (se, now);
+		if (status != 0)
+			break;
+
+		/* Signing and encrypting adds up to BUFF_SIG_SIZE bytes. */
+		free_size = client->stream_buffer_size;
+
+		pthread_mutex_lock (&client->send_lock);
+		head = client->send_queue_head;
+		for (ptr = head; ptr != NULL; ptr = ptr->next)
+		{
+			size_t size = sizeof (uint32_t) + ptr->size + BUFF_SIG_SIZE;
 
-		status = add_to_buffer (send_buffer_ptr,
-				network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-				&send_buffer_vl,
-				ds, vl);
+			if (size > free_size)
+				break;
+			free_size -= size;
+			last = ptr;
+			client->send_queue_length--;
+		}
+		if (last != NULL)
+		{
+			client->send_queue_head = last->next;
+			if (client->send_queue_head == NULL)
+				client->send_queue_tail = NULL;
+			last->next = NULL;
+		}
+		pthread_mutex_unlock (&client->send_lock);
 
-		if (status >= 0)
+		if (last == NULL)
+			break;
+
+		while (head != NULL)
 		{
-			send_buffer_fill += status;
-			send_buffer_ptr  += status;
+			send_packet_t *next = head->next;
 
-			stats_values_sent++;
+			network_send_buffer (se, (char *) (head + 1), head->size);
+			octets += (derive_t) head->size;
+			packets++;
+
+			sfree (head);
+			head = next;
 		}
+
+		pthread_mutex_lock (&stats_lock);
+		stats_octets_tx += octets;
+		stats_packets_tx += packets;
+		pthread_mutex_unlock (&stats_lock);
 	}
 
-	if (status < 0)
+	if (status == EAGAIN)
+		return (now + STREAM_POLL_INTERVAL);
+	if (status != 0)
 	{
-		ERROR ("network plugin: Unable to append to the "
-				"buffer for some weird reason");
+		network_stream_failed (se, now);
+		return (client->stream_next_connect);
+	}
+	return (0);
+} /* }}} cdtime_t network_send_stream */
+
+/* Waits up to STREAM_DRAIN_TIMEOUT for the queued packets of a "Protocol TCP"
+ * server to be written. Used on shutdown, when the send thread is gone. */
+static void network_stream_drain (sockent_t *se) /* {{{ */
+{
+	struct sockent_client *client = &se->data.client;
+	cdtime_t end = cdtime () + STREAM_DRAIN_TIMEOUT;
+
+	while ((client->fd >= 0) && (cdtime () < end))
+	{
+		struct pollfd pfd;
+		_Bool pending;
+
+		pthread_mutex_lock (&client->send_lock);
+		pending = (client->send_queue_head != NULL);
+		pthread_mutex_unlock (&client->send_lock);
+		if (!pending && (client->stream_buffer_fill == 0))
+			break;
+
+		memset (&pfd, 0, sizeof (pfd));
+		pfd.fd = client->fd;
+		pfd.events = POLLOUT;
+		poll (&pfd, 1, (int) CDTIME_T_TO_MS (STREAM_POLL_INTERVAL));
+
+		network_send_stream (se, cdtime ());
+	}
+} /* }}} void network_stream_drain */
+
+/* Sends the queued packets of "se". With "flush_all", the partially filled
+ * send buffer is sent, too; otherwise only if it is older than the
+ * server's FlushInterval. Returns the time at which the send buffer has to
+ * be sent, or zero. */
+static cdtime_t network_send_queue (sockent_t *se, /* {{{ */
+		cdtime_t now, _Bool flush_all)
+{
+	struct sockent_client *client = &se->data.client;
+	send_packet_t *head;
+	cdtime_t deadline = 0;
+	derive_t octets = 0;
+	derive_t packets = 0;
+
+	pthread_mutex_lock (&client->send_lock);
+	if ((client->send_buffer_fill > 0)
+			&& (flush_all
+				|| ((client->flush_interval > 0)
+					&& ((client->send_buffer_first_update
+							+ client->flush_interval) <= now))))
+		flush_buffer (se);
+	else if ((client->send_buffer_fill > 0) && (client->flush_interval > 0))
+		deadline = client->send_buffer_first_update
+			+ client->flush_interval;
+
+	if (client->stream)
+	{
+		cdtime_t retry;
+
+		pthread_mutex_unlock (&client->send_lock);
+		retry = network_send_stream (se, now);
+		if ((retry != 0) && ((deadline == 0) || (retry < deadline)))
+			deadline = retry;
+		return (deadline);
+	}
+
+	head = client->send_queue_head;
+	client->send_queue_head = NULL;
+	client->send_queue_tail = NULL;
+	client->send_queue_length = 0;
+	pthread_mutex_unlock (&client->send_lock);
+
+	while (head != NULL)
+	{
+		send_packet_t *next = head->next;
+
+		network_send_buffer (se, (char *) (head + 1), head->size);
+		octets += (derive_t) head->size;
+		packets++;
+
+		sfree (head);
+		head = next;
 	}
-	else if ((network_config_packet_size - send_buffer_fill) < 15)
+#if HAVE_SENDMMSG
+	network_send_batch (se);
+#endif
+
+	if (packets > 0)
 	{
-		flush_buffer ();
+		pthread_mutex_lock (&stats_lock);
+		stats_octets_tx += octets;
+		stats_packets_tx += packets;
+		pthread_mutex_unlock (&stats_lock);
 	}
 
-	pthread_mutex_unlock (&send_buffer_lock);
+	return (deadline);
+} /* }}} cdtime_t network_send_queue */
+
+static void *send_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	cdtime_t deadline = 0;
+
+	pthread_mutex_lock (&send_thread_lock);
+	while (send_thread_loop)
+	{
+		sockent_t *se;
+		cdtime_t now;
+
+		if (!send_thread_wakeup)
+		{
+			if (deadline == 0)
+				pthread_cond_wait (&send_thread_cond, &send_thread_lock);
+			else
+			{
+				struct timespec ts;
+
+				CDTIME_T_TO_TIMESPEC (deadline, &ts);
+				if (pthread_cond_timedwait (&send_thread_cond,
+							&send_thread_lock, &ts) == ETIMEDOUT)
+					send_thread_wakeup = 1;
+			}
+			continue;
+		}
+		send_thread_wakeup = 0;
+		pthread_mutex_unlock (&send_thread_lock);
+
+		now = cdtime ();
+		deadline = 0;
+		for (se = sending_sockets; se != NULL; se = se->next)
+		{
+			cdtime_t tmp = network_send_queue (se, now,
+					/* flush_all = */ 0);
+			if ((tmp != 0) && ((deadline == 0) || (tmp < deadline)))
+				deadline = tmp;
+		}
+
+		pthread_mutex_lock (&send_thread_lock);
+	}
+	pthread_mutex_unlock (&send_thread_lock);
 
-	return ((status < 0) ? -1 : 0);
-} /* int network_write */
+	INFO ("network plugin: Stopping send thread.");
+	return (NULL);
+} /* }}} void *send_thread */
 
 static int network_config_set_ttl (const oconfig_item_t *ci) /* {{{ */
 {
@@ -2985,14 +5602,15 @@ static int network_config_set_interface (const oconfig_item_t *ci, /* {{{ */
   return (0);
 } /* }}} int network_config_set_interface */
 
-static int network_config_set_buffer_size (const oconfig_item_t *ci) /* {{{ */
+static int network_config_set_buffer_size (const oconfig_item_t *ci, /* {{{ */
+    size_t *ret_size)
 {
   int tmp = 0;
 
   if (cf_util_get_int (ci, &tmp) != 0)
     return (-1);
   else if ((tmp >= 1024) && (tmp <= 65535))
-    network_config_packet_size = tmp;
+    *ret_size = (size_t) tmp;
   else {
     WARNING ("network plugin: The `MaxPacketSize' must be between 1024 and 65535.");
     return (-1);
@@ -3031,6 +5649,31 @@ static int network_config_set_security_level (oconfig_item_t *ci, /* {{{ */
 } /* }}} int network_config_set_security_level */
 #endif /* HAVE_LIBGCRYPT */
 
+/* Sets "ret_stream" for "Protocol TCP". */
+static int network_config_set_protocol (const oconfig_item_t *ci, /* {{{ */
+    _Bool *ret_stream)
+{
+  char *str = NULL;
+
+  if (cf_util_get_string (ci, &str) != 0)
+    return (-1);
+
+  if (strcasecmp ("UDP", str) == 0)
+    *ret_stream = 0;
+  else if (strcasecmp ("TCP", str) == 0)
+    *ret_stream = 1;
+  else
+  {
+    WARNING ("network plugin: Unknown protocol \"%s\". "
+        "Use \"UDP\" or \"TCP\".", str);
+    sfree (str);
+    return (-1);
+  }
+
+  sfree (str);
+  return (0);
+} /* }}} int network_config_set_protocol */
+
 static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
 {
   sockent_t *se;
@@ -3071,6 +5714,8 @@ static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
 #endif /* HAVE_LIBGCRYPT */
     if (strcasecmp ("Interface", child->key) == 0)
       network_config_set_interface (child, &se->interface);
+    else if (strcasecmp ("Protocol", child->key) == 0)
+      network_config_set_protocol (child, &se->data.server.stream);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3161,6 +5806,30 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
       network_config_set_interface (child, &se->interface);
     else if (strcasecmp ("ResolveInterval", child->key) == 0)
       cf_util_get_cdtime(child, &se->data.client.resolve_interval);
+    else if (strcasecmp ("Protocol", child->key) == 0)
+      network_config_set_protocol (child, &se->data.client.stream);
+    else if (strcasecmp ("MaxPacketSize", child->key) == 0)
+      network_config_set_buffer_size (child,
+          &se->data.client.send_buffer_size);
+    else if (strcasecmp ("FlushInterval", child->key) == 0)
+      cf_util_get_cdtime (child, &se->data.client.flush_interval);
+    else if (strcasecmp ("Compress", child->key) == 0)
+    {
+      cf_util_get_boolean (child, &se->data.client.compress);
+#if !HAVE_LIBLZ4
+      if (se->data.client.compress)
+      {
+        WARNING ("network plugin: The `Compress' option requires liblz4, "
+            "which the network plugin was not linked with. "
+            "Packets will be sent uncompressed.");
+        se->data.client.compress = 0;
+      }
+#endif
+    }
+    else if (strcasecmp ("IdentifierDictionary", child->key) == 0)
+      cf_util_get_boolean (child, &se->data.client.dict_enabled);
+    else if (strcasecmp ("IdentifierRefresh", child->key) == 0)
+      cf_util_get_cdtime (child, &se->data.client.dict_refresh);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3168,6 +5837,14 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
     }
   }
 
+  /* The session tells the receivers which dictionary our ids belong to. A
+   * restarted daemon starts a new one. */
+  if (se->data.client.dict_enabled)
+    se->data.client.dict_session =
+      (((uint64_t) cdrand_range (0, INT32_MAX)) << 32)
+      ^ ((uint64_t) cdrand_range (0, INT32_MAX))
+      ^ (((uint64_t) getpid ()) << 16);
+
 #if HAVE_LIBGCRYPT
   if ((se->data.client.security_level > SECURITY_LEVEL_NONE)
       && ((se->data.client.username == NULL)
@@ -3190,7 +5867,8 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
   }
 
   /* No call to sockent_client_connect() here -- it is called from
-   * network_send_buffer_plain(). */
+   * network_send_buffer_plain(). The send buffer is allocated in
+   * network_init(), once the global MaxPacketSize is known. */
 
   status = sockent_add (se);
   if (status != 0)
@@ -3203,6 +5881,73 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int network_config_add_server */
 
+static int network_config_set_receive_threads ( /* {{{ */
+    const oconfig_item_t *ci)
+{
+  int tmp = 0;
+
+  if (cf_util_get_int (ci, &tmp) != 0)
+    return (-1);
+
+  if (tmp < 1)
+  {
+    WARNING ("network plugin: The `ReceiveThreads' option must be at "
+        "least one.");
+    return (-1);
+  }
+
+#ifndef SO_REUSEPORT
+  if (tmp > 1)
+  {
+    WARNING ("network plugin: The `ReceiveThreads' option requires "
+        "SO_REUSEPORT, which is not available on this system. Using one "
+        "receive thread.");
+    tmp = 1;
+  }
+#endif
+
+  network_config_receive_threads = (size_t) tmp;
+  return (0);
+} /* }}} int network_config_set_receive_threads */
+
+static int network_config_set_dispatch_threads ( /* {{{ */
+    const oconfig_item_t *ci)
+{
+  int tmp = 0;
+
+  if (cf_util_get_int (ci, &tmp) != 0)
+    return (-1);
+
+  if (tmp < 1)
+  {
+    WARNING ("network plugin: The `DispatchThreads' option must be at "
+        "least one.");
+    return (-1);
+  }
+
+  network_config_dispatch_threads = (size_t) tmp;
+  return (0);
+} /* }}} int network_config_set_dispatch_threads */
+
+static int network_config_set_sender_rate ( /* {{{ */
+    const oconfig_item_t *ci, double *ret_value)
+{
+  double tmp = 0.0;
+
+  if (cf_util_get_double (ci, &tmp) != 0)
+    return (-1);
+
+  if (!(tmp >= 0.0))
+  {
+    WARNING ("network plugin: The `%s' option must be positive or zero.",
+        ci->key);
+    return (-1);
+  }
+
+  *ret_value = tmp;
+  return (0);
+} /* }}} int network_config_set_sender_rate */
+
 static int network_config (oconfig_item_t *ci) /* {{{ */
 {
   int i;
@@ -3213,6 +5958,8 @@ static int network_config (oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp ("TimeToLive", child->key) == 0)
       network_config_set_ttl (child);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      network_config_set_receive_threads (child);
   }
 
   for (i = 0; i < ci->children_num; i++)
@@ -3223,15 +5970,24 @@ static int network_config (oconfig_item_t *ci) /* {{{ */
       network_config_add_listen (child);
     else if (strcasecmp ("Server", child->key) == 0)
       network_config_add_server (child);
-    else if (strcasecmp ("TimeToLive", child->key) == 0) {
+    else if ((strcasecmp ("TimeToLive", child->key) == 0)
+        || (strcasecmp ("ReceiveThreads", child->key) == 0)) {
       /* Handled earlier */
     }
     else if (strcasecmp ("MaxPacketSize", child->key) == 0)
-      network_config_set_buffer_size (child);
+      network_config_set_buffer_size (child, &network_config_packet_size);
+    else if (strcasecmp ("DispatchThreads", child->key) == 0)
+      network_config_set_dispatch_threads (child);
     else if (strcasecmp ("Forward", child->key) == 0)
       cf_util_get_boolean (child, &network_config_forward);
     else if (strcasecmp ("ReportStats", child->key) == 0)
       cf_util_get_boolean (child, &network_config_stats);
+    else if (strcasecmp ("DuplicateFilter", child->key) == 0)
+      cf_util_get_boolean (child, &network_config_filter);
+    else if (strcasecmp ("SenderRateLimit", child->key) == 0)
+      network_config_set_sender_rate (child, &network_config_sender_rate);
+    else if (strcasecmp ("SenderBurst", child->key) == 0)
+      network_config_set_sender_rate (child, &network_config_sender_burst);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3249,6 +6005,7 @@ static int network_notification (const notification_t *n,
   char *buffer_ptr = buffer;
   int   buffer_free = sizeof (buffer);
   int   status;
+  sockent_t *se;
 
   if (!check_send_notify_okay (n))
     return (0);
@@ -3311,7 +6068,13 @@ static int network_notification (const notification_t *n,
   if (status != 0)
     return (-1);
 
-  network_send_buffer (buffer, sizeof (buffer) - buffer_free);
+  for (se = sending_sockets; se != NULL; se = se->next)
+  {
+    pthread_mutex_lock (&se->data.client.send_lock);
+    network_queue_packet (se, buffer, sizeof (buffer) - buffer_free);
+    pthread_mutex_unlock (&se->data.client.send_lock);
+  }
+  network_wakeup_send_thread ();
 
   return (0);
 } /* int network_notification */
@@ -3319,39 +6082,105 @@ static int network_notification (const notification_t *n,
 static int network_shutdown (void)
 {
 	sockent_t *se;
+	size_t i;
 
 	listen_loop++;
 
-	/* Kill the listening thread */
-	if (receive_thread_running != 0)
+	/* Kill the listening threads */
+	for (i = 0; i < receivers_num; i++)
 	{
+		receiver_t *r = receivers + i;
+
+		if (r->receive_thread_running == 0)
+			continue;
+
 		INFO ("network plugin: Stopping receive thread.");
-		pthread_kill (receive_thread_id, SIGTERM);
-		pthread_join (receive_thread_id, NULL /* no return value */);
-		memset (&receive_thread_id, 0, sizeof (receive_thread_id));
-		receive_thread_running = 0;
+		pthread_kill (r->receive_thread_id, SIGTERM);
+		pthread_join (r->receive_thread_id, NULL /* no return value */);
+		memset (&r->receive_thread_id, 0, sizeof (r->receive_thread_id));
+		r->receive_thread_running = 0;
+	}
+
+	/* Shutdown the dispatching threads */
+	for (i = 0; i < receivers_num; i++)
+	{
+		receiver_t *r = receivers + i;
+		size_t j;
+
+		for (j = 0; j < r->queues_num; j++)
+		{
+			receive_queue_t *q = r->queues + j;
+
+			if (q->thread_running == 0)
+				continue;
+
+			INFO ("network plugin: Stopping dispatch thread.");
+			pthread_mutex_lock (&q->lock);
+			pthread_cond_broadcast (&q->cond);
+			pthread_mutex_unlock (&q->lock);
+			pthread_join (q->thread_id, /* ret = */ NULL);
+			q->thread_running = 0;
+		}
+	}
+
+	for (i = 0; i < receivers_num; i++)
+	{
+		receiver_t *r = receivers + i;
+		size_t j;
+
+		for (j = 0; j < r->queues_num; j++)
+		{
+			pthread_mutex_destroy (&r->queues[j].lock);
+			pthread_cond_destroy (&r->queues[j].cond);
+		}
+		sfree (r->queues);
+		sfree (r->pollfd);
+		sfree (r->listen_stream);
+		sfree (r->senders);
+		pthread_mutex_destroy (&r->senders_lock);
+	}
+	sfree (receivers);
+	receivers_num = 0;
+
+	while (receive_free_list != NULL)
+	{
+		receive_list_entry_t *next = receive_free_list->next;
+
+		sfree (receive_free_list->data);
+		sfree (receive_free_list);
+		receive_free_list = next;
 	}
+	receive_free_list_length = 0;
 
-	/* Shutdown the dispatching thread */
-	if (dispatch_thread_running != 0)
+	if (network_filter != NULL)
 	{
-		INFO ("network plugin: Stopping dispatch thread.");
-		pthread_mutex_lock (&receive_list_lock);
-		pthread_cond_broadcast (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
-		pthread_join (dispatch_thread_id, /* ret = */ NULL);
-		dispatch_thread_running = 0;
+		for (i = 0; i < FILTER_SHARDS; i++)
+			pthread_mutex_destroy (&network_filter[i].lock);
+		sfree (network_filter);
 	}
 
 	sockent_destroy (listen_sockets);
 
-	if (send_buffer_fill > 0)
-		flush_buffer ();
+	if (send_thread_running)
+	{
+		pthread_mutex_lock (&send_thread_lock);
+		send_thread_loop = 0;
+		pthread_cond_signal (&send_thread_cond);
+		pthread_mutex_unlock (&send_thread_lock);
 
-	sfree (send_buffer);
+		pthread_join (send_thread_id, /* retval = */ NULL);
+		send_thread_running = 0;
+	}
 
+	/* Send whatever is left, now that the send thread is gone. */
 	for (se = sending_sockets; se != NULL; se = se->next)
+	{
+		if (se->data.client.send_buffer != NULL)
+			network_send_queue (se, cdtime (), /* flush_all = */ 1);
+		if (se->data.client.stream)
+			network_stream_drain (se);
 		sockent_client_disconnect (se);
+	}
 	sockent_destroy (sending_sockets);
 
 	plugin_unregister_config ("network");
@@ -3362,6 +6191,99 @@ static int network_shutdown (void)
 	return (0);
 } /* int network_shutdown */
 
+/* Dispatches the packets and octets accepted and the packets dropped for each
+ * sender in the sender tables. A sender read by several receive threads is
+ * reported once, with the sum of its counters. */
+static void network_stats_read_senders (void) /* {{{ */
+{
+	c_avl_tree_t *senders;
+	sender_t *copy;
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	void *key;
+	void *value;
+	size_t i;
+
+	senders = c_avl_create ((void *) strcmp);
+	copy = malloc (SENDER_TABLE_SIZE * sizeof (*copy));
+	if ((senders == NULL) || (copy == NULL))
+	{
+		ERROR ("network plugin: network_stats_read_senders: "
+				"Allocating memory failed.");
+		if (senders != NULL)
+			c_avl_destroy (senders);
+		sfree (copy);
+		return;
+	}
+
+	for (i = 0; i < receivers_num; i++)
+	{
+		receiver_t *r = receivers + i;
+		size_t j;
+
+		if (r->senders == NULL)
+			continue;
+
+		/* Copy the table so the receive thread isn't blocked for long. */
+		pthread_mutex_lock (&r->senders_lock);
+		memcpy (copy, r->senders, SENDER_TABLE_SIZE * sizeof (*copy));
+		pthread_mutex_unlock (&r->senders_lock);
+
+		for (j = 0; j < SENDER_TABLE_SIZE; j++)
+		{
+			sender_t *s;
+
+			if (copy[j].last_seen == 0)
+				continue;
+
+			if (c_avl_get (senders, copy[j].name, (void *) &s) == 0)
+			{
+				s->packets_rx += copy[j].packets_rx;
+				s->packets_dropped += copy[j].packets_dropped;
+				s->octets_rx += copy[j].octets_rx;
+				continue;
+			}
+
+			s = malloc (sizeof (*s));
+			if (s == NULL)
+				continue;
+			memcpy (s, copy + j, sizeof (*s));
+			if (c_avl_insert (senders, s->name, s) != 0)
+				sfree (s);
+		}
+	}
+	sfree (copy);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "network", sizeof (vl.plugin));
+
+	while (c_avl_pick (senders, &key, &value) == 0)
+	{
+		sender_t *s = value;
+
+		sstrncpy (vl.plugin_instance, s->name, sizeof (vl.plugin_instance));
+
+		vl.values[0].derive = s->packets_rx;
+		sstrncpy (vl.type, "packets", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "accepted", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+
+		vl.values[0].derive = s->packets_dropped;
+		sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+
+		vl.values[0].derive = s->octets_rx;
+		sstrncpy (vl.type, "if_rx_octets", sizeof (vl.type));
+		vl.type_instance[0] = 0;
+		plugin_dispatch_values (&vl);
+
+		sfree (s);
+	}
+	c_avl_destroy (senders);
+} /* }}} void network_stats_read_senders */
+
 static int network_stats_read (void) /* {{{ */
 {
 	derive_t copy_octets_rx;
@@ -3370,21 +6292,37 @@ static int network_stats_read (void) /* {{{ */
 	derive_t copy_packets_tx;
 	derive_t copy_values_dispatched;
 	derive_t copy_values_not_dispatched;
+	derive_t copy_values_duplicate;
 	derive_t copy_values_sent;
 	derive_t copy_values_not_sent;
 	derive_t copy_receive_list_length;
+	derive_t copy_packets_dropped;
 	value_list_t vl = VALUE_LIST_INIT;
 	value_t values[2];
+	size_t i;
 
-	copy_octets_rx = stats_octets_rx;
+	copy_octets_rx = 0;
+	copy_packets_rx = 0;
+	copy_packets_dropped = 0;
+	copy_receive_list_length = 0;
+	for (i = 0; i < receivers_num; i++)
+	{
+		copy_octets_rx += receivers[i].octets_rx;
+		copy_packets_rx += receivers[i].packets_rx;
+		copy_packets_dropped += receivers[i].packets_dropped;
+		size_t j;
+
+		for (j = 0; j < receivers[i].queues_num; j++)
+			copy_receive_list_length +=
+				(derive_t) receivers[i].queues[j].length;
+	}
 	copy_octets_tx = stats_octets_tx;
-	copy_packets_rx = stats_packets_rx;
 	copy_packets_tx = stats_packets_tx;
 	copy_values_dispatched = stats_values_dispatched;
 	copy_values_not_dispatched = stats_values_not_dispatched;
+	copy_values_duplicate = stats_values_duplicate;
 	copy_values_sent = stats_values_sent;
 	copy_values_not_sent = stats_values_not_sent;
-	copy_receive_list_length = receive_list_length;
 
 	/* Initialize `vl' */
 	vl.values = values;
@@ -3419,6 +6357,14 @@ static int network_stats_read (void) /* {{{ */
 			sizeof (vl.type_instance));
 	plugin_dispatch_values (&vl);
 
+	if (network_filter != NULL)
+	{
+		vl.values[0].derive = (derive_t) copy_values_duplicate;
+		sstrncpy (vl.type_instance, "dispatch-duplicate",
+				sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+	}
+
 	vl.values[0].derive = (derive_t) copy_values_sent;
 	sstrncpy (vl.type_instance, "send-accepted",
 			sizeof (vl.type_instance));
@@ -3435,12 +6381,140 @@ static int network_stats_read (void) /* {{{ */
 	vl.type_instance[0] = 0;
 	plugin_dispatch_values (&vl);
 
+	if (network_config_sender_rate > 0.0)
+	{
+		vl.values_len = 2;
+		vl.values[0].derive = copy_packets_dropped;
+		vl.values[1].derive = 0;
+		sstrncpy (vl.type, "if_dropped", sizeof (vl.type));
+		plugin_dispatch_values (&vl);
+
+		network_stats_read_senders ();
+	}
+
 	return (0);
 } /* }}} int network_stats_read */
 
+/* Distributes the listen sockets among network_config_receive_threads
+ * receivers and starts their threads. */
+static int network_start_receivers (void) /* {{{ */
+{
+	size_t i;
+
+	receivers_num = network_config_receive_threads;
+	if (receivers_num > listen_sockets_num)
+		receivers_num = listen_sockets_num;
+
+	receivers = calloc (receivers_num, sizeof (*receivers));
+	if (receivers == NULL)
+	{
+		ERROR ("network plugin: calloc failed.");
+		receivers_num = 0;
+		return (-1);
+	}
+
+	for (i = 0; i < receivers_num; i++)
+	{
+		receiver_t *r = receivers + i;
+
+		size_t j;
+
+		r->pollfd = calloc ((listen_sockets_num + receivers_num - 1)
+				/ receivers_num, sizeof (*r->pollfd));
+		r->listen_stream = calloc ((listen_sockets_num + receivers_num - 1)
+				/ receivers_num, sizeof (*r->listen_stream));
+		r->queues = calloc (network_config_dispatch_threads,
+				sizeof (*r->queues));
+		if ((r->pollfd == NULL) || (r->listen_stream == NULL)
+				|| (r->queues == NULL))
+		{
+			ERROR ("network plugin: calloc failed.");
+			return (-1);
+		}
+
+		r->queues_num = network_config_dispatch_threads;
+		for (j = 0; j < r->queues_num; j++)
+		{
+			pthread_mutex_init (&r->queues[j].lock, /* attr = */ NULL);
+			pthread_cond_init (&r->queues[j].cond, /* attr = */ NULL);
+		}
+
+		pthread_mutex_init (&r->senders_lock, /* attr = */ NULL);
+		if (network_config_sender_rate > 0.0)
+		{
+			r->senders = calloc (SENDER_TABLE_SIZE, sizeof (*r->senders));
+			if (r->senders == NULL)
+			{
+				ERROR ("network plugin: calloc failed.");
+				return (-1);
+			}
+		}
+	}
+
+	/* sockent_server_listen() opens the sockets of one address one after
+	 * the other, so this assigns each receiver one socket of every address
+	 * opened with SO_REUSEPORT. */
+	for (i = 0; i < listen_sockets_num; i++)
+	{
+		receiver_t *r = receivers + (i % receivers_num);
+
+		r->pollfd[r->pollfd_num] = listen_sockets_pollfd[i];
+		r->listen_stream[r->pollfd_num] = listen_sockets_stream[i];
+		r->pollfd_num++;
+		r->listen_num++;
+	}
+
+	for (i = 0; i < receivers_num; i++)
+	{
+		receiver_t *r = receivers + i;
+		size_t j;
+		int status = 0;
+
+		for (j = 0; j < r->queues_num; j++)
+		{
+			receive_queue_t *q = r->queues + j;
+
+			status = plugin_thread_create (&q->thread_id,
+					NULL /* no attributes */,
+					dispatch_thread,
+					q /* argument */);
+			if (status != 0)
+			{
+				char errbuf[1024];
+				ERROR ("network: pthread_create failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+				break;
+			}
+			q->thread_running = 1;
+		}
+
+		/* Packets for a queue without a thread would never be freed. */
+		if (status != 0)
+			continue;
+
+		status = plugin_thread_create (&r->receive_thread_id,
+				NULL /* no attributes */,
+				receive_thread,
+				r /* argument */);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("network: pthread_create failed: %s",
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			continue;
+		}
+		r->receive_thread_running = 1;
+	}
+
+	return (0);
+} /* }}} int network_start_receivers */
+
 static int network_init (void)
 {
 	static _Bool have_init = 0;
+	sockent_t *se;
 
 	/* Check if we were already initialized. If so, just return - there's
 	 * nothing more to do (for now, that is). */
@@ -3450,77 +6524,98 @@ static int network_init (void)
 
 #if HAVE_LIBGCRYPT
 	network_init_gcrypt ();
+	pthread_key_create (&server_cypher_key, network_free_server_cyphers);
 #endif
+	pthread_key_create (&parse_state_key, network_free_parse_state);
 
 	if (network_config_stats)
 		plugin_register_read ("network", network_stats_read);
 
-	plugin_register_shutdown ("network", network_shutdown);
+	/* By default, a sender may use up one second's budget at once. */
+	if ((network_config_sender_rate > 0.0)
+			&& (network_config_sender_burst < 1.0))
+		network_config_sender_burst = (network_config_sender_rate > 1.0)
+			? network_config_sender_rate : 1.0;
 
-	send_buffer = malloc (network_config_packet_size);
-	if (send_buffer == NULL)
+	if (network_config_filter && (listen_sockets_num > 0))
 	{
-		ERROR ("network plugin: malloc failed.");
-		return (-1);
-	}
-	network_init_buffer ();
+		size_t i;
 
-	/* setup socket(s) and so on */
-	if (sending_sockets != NULL)
-	{
-		plugin_register_write ("network", network_write,
-				/* user_data = */ NULL);
-		plugin_register_notification ("network", network_notification,
-				/* user_data = */ NULL);
+		network_filter = calloc (FILTER_SHARDS, sizeof (*network_filter));
+		if (network_filter == NULL)
+		{
+			ERROR ("network plugin: calloc failed.");
+			return (-1);
+		}
+		for (i = 0; i < FILTER_SHARDS; i++)
+			pthread_mutex_init (&network_filter[i].lock, /* attr = */ NULL);
+		network_filter_window = cf_get_default_interval ();
 	}
 
-	/* If no threads need to be started, return here. */
-	if ((listen_sockets_num == 0)
-			|| ((dispatch_thread_running != 0)
-				&& (receive_thread_running != 0)))
-		return (0);
+	plugin_register_shutdown ("network", network_shutdown);
 
-	if (dispatch_thread_running == 0)
+	for (se = sending_sockets; se != NULL; se = se->next)
 	{
-		int status;
-		status = plugin_thread_create (&dispatch_thread_id,
-				NULL /* no attributes */,
-				dispatch_thread,
-				NULL /* no argument */);
-		if (status != 0)
+		if (se->data.client.send_buffer_size == 0)
+			se->data.client.send_buffer_size = network_config_packet_size;
+
+		se->data.client.send_buffer =
+			malloc (se->data.client.send_buffer_size);
+		if (se->data.client.send_buffer == NULL)
 		{
-			char errbuf[1024];
-			ERROR ("network: pthread_create failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
+			ERROR ("network plugin: malloc failed.");
+			return (-1);
 		}
-		else
+		network_init_buffer (se);
+
+		/* Room for the largest packet, signed or encrypted, in addition
+		 * to the coalesced ones. */
+		if (se->data.client.stream)
 		{
-			dispatch_thread_running = 1;
+			se->data.client.stream_buffer_size = STREAM_BUFFER_SIZE
+				+ sizeof (uint32_t) + se->data.client.send_buffer_size
+				+ BUFF_SIG_SIZE;
+			se->data.client.stream_buffer =
+				malloc (se->data.client.stream_buffer_size);
+			if (se->data.client.stream_buffer == NULL)
+			{
+				ERROR ("network plugin: malloc failed.");
+				return (-1);
+			}
+			se->data.client.stream_buffer_fill = 0;
 		}
 	}
 
-	if (receive_thread_running == 0)
+	/* setup socket(s) and so on */
+	if (sending_sockets != NULL)
 	{
 		int status;
-		status = plugin_thread_create (&receive_thread_id,
-				NULL /* no attributes */,
-				receive_thread,
-				NULL /* no argument */);
+
+		send_thread_loop = 1;
+		status = plugin_thread_create (&send_thread_id,
+				/* attr = */ NULL, send_thread, /* arg = */ NULL);
 		if (status != 0)
 		{
 			char errbuf[1024];
-			ERROR ("network: pthread_create failed: %s",
+			ERROR ("network plugin: pthread_create failed: %s",
 					sstrerror (errno, errbuf,
 						sizeof (errbuf)));
+			send_thread_loop = 0;
+			return (-1);
 		}
-		else
-		{
-			receive_thread_running = 1;
-		}
+		send_thread_running = 1;
+
+		plugin_register_write ("network", network_write,
+				/* user_data = */ NULL);
+		plugin_register_notification ("network", network_notification,
+				/* user_data = */ NULL);
 	}
 
-	return (0);
+	/* If no threads need to be started, return here. */
+	if ((listen_sockets_num == 0) || (receivers != NULL))
+		return (0);
+
+	return (network_start_receivers ());
 } /* int network_init */
 
 /*
@@ -3534,22 +6629,28 @@ static int network_flush (cdtime_t timeout,
 		__attribute__((unused)) const char *identifier,
 		__attribute__((unused)) user_data_t *user_data)
 {
-	pthread_mutex_lock (&send_buffer_lock);
+	sockent_t *se;
+	cdtime_t now = cdtime ();
+	_Bool wakeup = 0;
 
-	if (send_buffer_fill > 0)
+	for (se = sending_sockets; se != NULL; se = se->next)
 	{
-		if (timeout > 0)
+		struct sockent_client *client = &se->data.client;
+
+		pthread_mutex_lock (&client->send_lock);
+		if ((client->send_buffer_fill > 0)
+				&& ((timeout == 0)
+					|| ((client->send_buffer_last_update + timeout)
+						<= now)))
 		{
-			cdtime_t now = cdtime ();
-			if ((send_buffer_last_update + timeout) > now)
-			{
-				pthread_mutex_unlock (&send_buffer_lock);
-				return (0);
-			}
+			flush_buffer (se);
+			wakeup = 1;
 		}
-		flush_buffer ();
+		pthread_mutex_unlock (&client->send_lock);
 	}
-	pthread_mutex_unlock (&send_buffer_lock);
+
+	if (wakeup)
+		network_wakeup_send_thread ();
 
 	return (0);
 } /* int network_flush */
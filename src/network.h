@@ -70,11 +70,24 @@
 #define TYPE_INTERVAL        0x0007
 #define TYPE_INTERVAL_HR     0x0009
 
+/* Types of the optional identifier dictionary */
+#define TYPE_SESSION         0x0020
+#define TYPE_ID_DEFINE       0x0021
+#define TYPE_ID_VALUES       0x0022
+
 /* Types to transmit notifications */
 #define TYPE_MESSAGE         0x0100
 #define TYPE_SEVERITY        0x0101
 
 #define TYPE_SIGN_SHA256     0x0200
 #define TYPE_ENCR_AES256     0x0210
+#define TYPE_COMPR_LZ4       0x0220
+
+/* Types only used by the binary mode of the unixsock plugin */
+#define TYPE_UNIXSOCK_SYNC    0x0300
+#define TYPE_UNIXSOCK_STATUS  0x0301
+#define TYPE_UNIXSOCK_GETVAL  0x0302
+#define TYPE_UNIXSOCK_DS_NAME 0x0303
+#define TYPE_UNIXSOCK_RESET   0x0304
 
 #endif /* NETWORK_H */
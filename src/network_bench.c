@@ -0,0 +1,344 @@
+/**
+ * collectd - src/network_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Measures how fast the network plugin parses packets: plain ones and, when
+ * built with libgcrypt, signed and encrypted ones. The packets are built by
+ * the plugin's own send path from the value lists of a few thousand
+ * interfaces and captured in the buffer of a "Protocol TCP" client instead
+ * of being sent.
+ *
+ * Usage: bench_plugin_network [values [passes]]
+ */
+
+#include "network.c" /* sic */
+
+/* The benchmark neither reads a configuration nor starts threads. */
+int cf_util_get_string (const oconfig_item_t *ci, char **ret_string)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_string_buffer (const oconfig_item_t *ci, char *buffer,
+    size_t buffer_size)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_int (const oconfig_item_t *ci, int *ret_value)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_double (const oconfig_item_t *ci, double *ret_value)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_boolean (const oconfig_item_t *ci, _Bool *ret_bool)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_port_number (const oconfig_item_t *ci)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_cdtime (const oconfig_item_t *ci, cdtime_t *ret_value)
+{
+  return (ENOTSUP);
+}
+
+int plugin_thread_create (pthread_t *thread, const pthread_attr_t *attr,
+    void *(*start_routine) (void *), void *arg)
+{
+  return (ENOTSUP);
+}
+
+int plugin_register_config (const char *name,
+    int (*callback) (const char *key, const char *val),
+    const char **keys, int keys_num)
+{
+  return (ENOTSUP);
+}
+
+int plugin_register_write (const char *name,
+    plugin_write_cb callback, user_data_t *user_data)
+{
+  return (ENOTSUP);
+}
+
+int plugin_register_flush (const char *name,
+    plugin_flush_cb callback, user_data_t *user_data)
+{
+  return (ENOTSUP);
+}
+
+int plugin_register_notification (const char *name,
+    plugin_notification_cb callback, user_data_t *user_data)
+{
+  return (ENOTSUP);
+}
+
+int plugin_unregister_config (const char *name)
+{
+  return (ENOTSUP);
+}
+
+int plugin_unregister_init (const char *name)
+{
+  return (ENOTSUP);
+}
+
+int plugin_unregister_write (const char *name)
+{
+  return (ENOTSUP);
+}
+
+int plugin_unregister_shutdown (const char *name)
+{
+  return (ENOTSUP);
+}
+
+int plugin_dispatch_notification (const notification_t *notif)
+{
+  return (ENOTSUP);
+}
+
+int plugin_notification_meta_add_boolean (notification_t *n,
+    const char *name, _Bool value)
+{
+  return (ENOTSUP);
+}
+
+int plugin_notification_meta_free (notification_meta_t *n)
+{
+  return (0);
+}
+
+/* None of the values has been sent by this instance. This skips the cache
+ * lookup the daemon does for every received value. */
+int uc_meta_data_get_unsigned_int (const value_list_t *vl,
+    const char *key, uint64_t *value)
+{
+  return (-ENOENT);
+}
+
+static data_source_t if_octets_dsrc[] = {
+  {"rx", DS_TYPE_DERIVE, 0, NAN},
+  {"tx", DS_TYPE_DERIVE, 0, NAN},
+};
+static data_set_t if_octets_ds = {"if_octets", 2, if_octets_dsrc};
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+/* Fills the stream buffer of "client" with packets of up to
+ * network_config_packet_size bytes holding "values_num" value lists. */
+static void build_packets (sockent_t *client, size_t values_num, /* {{{ */
+    void (*send) (sockent_t *, const char *, size_t))
+{
+  char buffer[network_config_packet_size];
+  value_list_t vl_def;
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t values[2];
+  size_t fill = 0;
+  size_t i;
+
+  memset (&vl_def, 0, sizeof (vl_def));
+
+  vl.values = values;
+  vl.values_len = 2;
+  vl.interval = TIME_T_TO_CDTIME_T (10);
+  sstrncpy (vl.plugin, "interface", sizeof (vl.plugin));
+  sstrncpy (vl.type, "if_octets", sizeof (vl.type));
+
+  for (i = 0; i < values_num; i++)
+  {
+    int status;
+
+    vl.time = TIME_T_TO_CDTIME_T (1466000000) + (cdtime_t) (i / 100);
+    ssnprintf (vl.host, sizeof (vl.host), "host%zu.example.com",
+        (i / 10) % 100);
+    ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+        "eth%zu", i % 10);
+    values[0].derive = (derive_t) (i * 7919);
+    values[1].derive = (derive_t) (i * 104729);
+
+    status = add_to_buffer (buffer + fill, (int) (sizeof (buffer) - fill),
+        &vl_def, &if_octets_ds, &vl);
+    if (status < 0)
+    {
+      (*send) (client, buffer, fill);
+      memset (&vl_def, 0, sizeof (vl_def));
+      fill = 0;
+      status = add_to_buffer (buffer, (int) sizeof (buffer),
+          &vl_def, &if_octets_ds, &vl);
+      assert (status > 0);
+    }
+    fill += (size_t) status;
+  }
+
+  if (fill > 0)
+    (*send) (client, buffer, fill);
+} /* }}} void build_packets */
+
+static int bench (const char *name, size_t values_num, /* {{{ */
+    size_t passes, sockent_t *client, sockent_t *server,
+    void (*send) (sockent_t *, const char *, size_t))
+{
+  char buffer[network_config_packet_size + BUFF_SIG_SIZE];
+  size_t packets_num = 0;
+  derive_t dispatched;
+  double start;
+  double elapsed;
+  size_t i;
+
+  client->data.client.stream_buffer_fill = 0;
+  build_packets (client, values_num, send);
+
+  dispatched = stats_values_dispatched;
+  start = now ();
+  for (i = 0; i < passes; i++)
+  {
+    size_t offset = 0;
+
+    while (offset < client->data.client.stream_buffer_fill)
+    {
+      uint32_t length;
+
+      memcpy (&length, client->data.client.stream_buffer + offset,
+          sizeof (length));
+      length = ntohl (length);
+      offset += sizeof (length);
+
+      /* Encrypted packets are decrypted in place. */
+      memcpy (buffer, client->data.client.stream_buffer + offset, length);
+      parse_packet (server, buffer, length, /* flags = */ 0,
+          /* username = */ NULL);
+
+      offset += length;
+      packets_num++;
+    }
+  }
+  elapsed = now () - start;
+  dispatched = stats_values_dispatched - dispatched;
+
+  printf ("%-14s %7.1f ns per value %10.0f packets/s\n", name,
+      1e9 * elapsed / (double) dispatched,
+      (double) packets_num / elapsed);
+
+  return (((size_t) dispatched == passes * values_num) ? 0 : 1);
+} /* }}} int bench */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t values_num = 100000;
+  size_t passes = 10;
+  sockent_t *client;
+  sockent_t *server;
+  int status = 0;
+
+  if (argc > 1)
+    values_num = (size_t) atoi (argv[1]);
+  if (argc > 2)
+    passes = (size_t) atoi (argv[2]);
+  if ((argc > 3) || (values_num < 1) || (passes < 1))
+  {
+    fprintf (stderr, "Usage: %s [values [passes]]\n", argv[0]);
+    return (1);
+  }
+
+#if HAVE_LIBGCRYPT
+  pthread_key_create (&server_cypher_key, network_free_server_cyphers);
+#endif
+  pthread_key_create (&parse_state_key, network_free_parse_state);
+
+  client = sockent_create (SOCKENT_TYPE_CLIENT);
+  server = sockent_create (SOCKENT_TYPE_SERVER);
+  if ((client == NULL) || (server == NULL))
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+
+  /* Far more than the packets and their lengths need. */
+  client->data.client.stream = 1;
+  client->data.client.stream_buffer_size = 2 * values_num * 100;
+  client->data.client.stream_buffer =
+    malloc (client->data.client.stream_buffer_size);
+  if (client->data.client.stream_buffer == NULL)
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+
+  status |= bench ("plain", values_num, passes, client, server,
+      network_send_buffer_plain);
+
+#if HAVE_LIBGCRYPT
+  {
+    char auth_file[] = "/tmp/bench_plugin_network.XXXXXX";
+    int fd;
+
+    fd = mkstemp (auth_file);
+    if ((fd < 0) || (write (fd, "bench: secret\n", 14) != 14))
+    {
+      fprintf (stderr, "Unable to write %s.\n", auth_file);
+      return (1);
+    }
+    close (fd);
+
+    client->data.client.security_level = SECURITY_LEVEL_SIGN;
+    client->data.client.username = sstrdup ("bench");
+    client->data.client.password = sstrdup ("secret");
+    server->data.server.auth_file = sstrdup (auth_file);
+    if ((sockent_init_crypto (client) != 0)
+        || (sockent_init_crypto (server) != 0))
+    {
+      fprintf (stderr, "Unable to initialize libgcrypt.\n");
+      unlink (auth_file);
+      return (1);
+    }
+    unlink (auth_file);
+
+    status |= bench ("signed", values_num, passes, client, server,
+        network_send_buffer_signed);
+    status |= bench ("encrypted", values_num, passes, client, server,
+        network_send_buffer_encrypted);
+  }
+#endif
+
+  sockent_destroy (client);
+  sockent_destroy (server);
+
+  return (status);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
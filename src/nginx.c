@@ -30,6 +30,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl_multi.h"
 
 #include <curl/curl.h>
 
@@ -42,6 +43,7 @@ static char *cacert      = NULL;
 static char *timeout     = NULL;
 
 static CURL *curl = NULL;
+static ucm_transfer_t nginx_transfer;
 
 static char   nginx_buffer[16384];
 static size_t nginx_buffer_len = 0;
@@ -115,11 +117,17 @@ static int config (const char *key, const char *value)
     return (-1);
 } /* int config */
 
+static void nginx_curl_done (ucm_transfer_t *t, CURLcode status);
+
 static int init (void)
 {
   if (curl != NULL)
     curl_easy_cleanup (curl);
 
+  /* Call this while collectd is still single-threaded to avoid
+   * initialization issues in libgcrypt. */
+  curl_global_init (CURL_GLOBAL_SSL);
+
   if ((curl = curl_easy_init ()) == NULL)
   {
     ERROR ("nginx plugin: curl_easy_init failed.");
@@ -192,6 +200,10 @@ static int init (void)
   }
 #endif
 
+  nginx_transfer.curl = curl;
+  nginx_transfer.done = nginx_curl_done;
+  nginx_transfer.user_data = NULL;
+
   return (0);
 } /* void init */
 
@@ -222,7 +234,9 @@ static void submit (const char *type, const char *inst, long long value)
   plugin_dispatch_values (&vl);
 } /* void submit */
 
-static int nginx_read (void)
+/* Called by the transfer thread once the status page has been fetched. */
+static void nginx_curl_done (ucm_transfer_t __attribute__((unused)) *t, /* {{{ */
+    CURLcode status)
 {
   int i;
 
@@ -234,16 +248,11 @@ static int nginx_read (void)
   char *fields[16];
   int   fields_num;
 
-  if (curl == NULL)
-    return (-1);
-  if (url == NULL)
-    return (-1);
-
-  nginx_buffer_len = 0;
-  if (curl_easy_perform (curl) != CURLE_OK)
+  if (status != CURLE_OK)
   {
     WARNING ("nginx plugin: curl_easy_perform failed: %s", nginx_curl_error);
-    return (-1);
+    nginx_buffer_len = 0;
+    return;
   }
 
   ptr = nginx_buffer;
@@ -298,15 +307,51 @@ static int nginx_read (void)
   }
 
   nginx_buffer_len = 0;
+} /* }}} void nginx_curl_done */
+
+/* Starts the request. The values are dispatched by nginx_curl_done() once
+ * the page has arrived, so a slow server doesn't block a read thread. */
+static int nginx_read (void)
+{
+  if (curl == NULL)
+    return (-1);
+  if (url == NULL)
+    return (-1);
+
+  if (ucm_busy (&nginx_transfer))
+  {
+    WARNING ("nginx plugin: The previous request has not finished yet. "
+	"Skipping this interval.");
+    return (-1);
+  }
+
+  nginx_buffer_len = 0;
+  if (ucm_submit (&nginx_transfer) != 0)
+  {
+    ERROR ("nginx plugin: Starting the request failed.");
+    return (-1);
+  }
 
   return (0);
 } /* int nginx_read */
 
+static int nginx_shutdown (void)
+{
+  ucm_shutdown ();
+
+  if (curl != NULL)
+    curl_easy_cleanup (curl);
+  curl = NULL;
+
+  return (0);
+} /* int nginx_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("nginx", config, config_keys, config_keys_num);
   plugin_register_init ("nginx", init);
   plugin_register_read ("nginx", nginx_read);
+  plugin_register_shutdown ("nginx", nginx_shutdown);
 } /* void module_register */
 
 /*
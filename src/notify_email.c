@@ -40,7 +40,8 @@ static const char *config_keys[] =
   "SMTPPassword",
   "From",
   "Recipient",
-  "Subject"
+  "Subject",
+  "DigestInterval"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -59,10 +60,25 @@ static char *smtp_password = NULL;
 static char *email_from = NULL;
 static char *email_subject = NULL;
 
+/* With a digest interval, notifications are collected and sent as one email
+ * at most every "digest_interval". */
+static cdtime_t digest_interval = 0;
+static pthread_mutex_t digest_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *digest_text = NULL;
+static size_t digest_len = 0;
+static size_t digest_size = 0;
+static int digest_num = 0;
+static int digest_severity = NOTIF_OKAY;
+static char digest_host[DATA_MAX_NAME_LEN];
+static _Bool digest_hosts_differ = 0;
+
 #define DEFAULT_SMTP_HOST	"localhost"
 #define DEFAULT_SMTP_FROM	"root@localhost"
 #define DEFAULT_SMTP_SUBJECT	"Collectd notify: %s@%s"
 
+static int notify_email_digest_send (void);
+static int notify_email_read (user_data_t *ud);
+
 /* Callback to get username and password */
 static int authinteract (auth_client_request_t request, char **result,
     int fields, void __attribute__((unused)) *arg)
@@ -149,11 +165,18 @@ static int notify_email_init (void)
   }
 
   pthread_mutex_unlock (&session_lock);
+
+  if (digest_interval > 0)
+    plugin_register_complex_read (/* group = */ NULL, "notify_email",
+        notify_email_read, digest_interval, /* user_data = */ NULL);
+
   return (0);
 } /* int notify_email_init */
 
 static int notify_email_shutdown (void)
 {
+  notify_email_digest_send ();
+
   pthread_mutex_lock (&session_lock);
 
   if (session != NULL)
@@ -167,6 +190,9 @@ static int notify_email_shutdown (void)
   auth_client_exit();
 
   pthread_mutex_unlock (&session_lock);
+
+  sfree (digest_text);
+  digest_len = digest_size = 0;
   return (0);
 } /* int notify_email_shutdown */
 
@@ -219,69 +245,100 @@ static int notify_email_config (const char *key, const char *value)
     sfree (email_subject);
     email_subject = strdup (value);
   }
+  else if (0 == strcasecmp (key, "DigestInterval")) {
+    double tmp = atof (value);
+    if (tmp < 0.0)
+    {
+      WARNING ("notify_email plugin: Invalid digest interval: %s", value);
+      return (1);
+    }
+    digest_interval = DOUBLE_TO_CDTIME_T (tmp);
+  }
   else {
     return -1;
   }
   return 0;
 } /* int notify_email_config (const char *, const char *) */
 
-static int notify_email_notification (const notification_t *n,
-    user_data_t __attribute__((unused)) *user_data)
+static const char *severity_to_string (int severity) /* {{{ */
+{
+  if (severity == NOTIF_FAILURE)
+    return ("FAILURE");
+  else if (severity == NOTIF_WARNING)
+    return ("WARNING");
+  else if (severity == NOTIF_OKAY)
+    return ("OKAY");
+  return ("UNKNOWN");
+} /* }}} const char *severity_to_string */
+
+/* Formats the part of the email describing one notification. */
+static void notify_email_format (char *buf, size_t buf_len, /* {{{ */
+    const notification_t *n)
 {
-
   time_t tt;
   struct tm timestamp_tm;
   char timestamp_str[64];
 
-  char severity[32];
-  char subject[MAXSTRING];
-
-  char buf[4096] = "";
-  int  buf_len = sizeof (buf);
-  int i;
-
-  ssnprintf (severity, sizeof (severity), "%s",
-      (n->severity == NOTIF_FAILURE) ? "FAILURE"
-      : ((n->severity == NOTIF_WARNING) ? "WARNING"
-        : ((n->severity == NOTIF_OKAY) ? "OKAY" : "UNKNOWN")));
-
-  ssnprintf (subject, sizeof (subject),
-      (email_subject == NULL) ? DEFAULT_SMTP_SUBJECT : email_subject,
-      severity, n->host);
-
   tt = CDTIME_T_TO_TIME_T (n->time);
   localtime_r (&tt, &timestamp_tm);
   strftime (timestamp_str, sizeof (timestamp_str), "%Y-%m-%d %H:%M:%S",
       &timestamp_tm);
   timestamp_str[sizeof (timestamp_str) - 1] = '\0';
 
+  ssnprintf (buf, buf_len,
+      "%s - %s@%s\r\n"
+      "\r\n"
+      "Message: %s",
+      timestamp_str,
+      severity_to_string (n->severity),
+      n->host,
+      n->message);
+} /* }}} void notify_email_format */
+
+/* Sends one email with all recipients in one SMTP session. */
+static int notify_email_send (int severity, const char *host, /* {{{ */
+    const char *text)
+{
+  char subject[MAXSTRING];
+  char *buf;
+  size_t buf_len;
+  int i;
+
+  ssnprintf (subject, sizeof (subject),
+      (email_subject == NULL) ? DEFAULT_SMTP_SUBJECT : email_subject,
+      severity_to_string (severity), host);
+
   /* Let's make RFC822 message text with \r\n EOLs */
+  buf_len = strlen (subject) + strlen (text) + 256;
+  buf = malloc (buf_len);
+  if (buf == NULL)
+  {
+    ERROR ("notify_email plugin: malloc failed.");
+    return (-1);
+  }
   ssnprintf (buf, buf_len,
       "MIME-Version: 1.0\r\n"
       "Content-Type: text/plain; charset=\"US-ASCII\"\r\n"
       "Content-Transfer-Encoding: 8bit\r\n"
       "Subject: %s\r\n"
       "\r\n"
-      "%s - %s@%s\r\n"
-      "\r\n"
-      "Message: %s",
+      "%s",
       subject,
-      timestamp_str,
-      severity,
-      n->host,
-      n->message);
+      text);
 
   pthread_mutex_lock (&session_lock);
 
   if (session == NULL) {
     /* Initialization failed or we're in the process of shutting down. */
     pthread_mutex_unlock (&session_lock);
+    sfree (buf);
     return (-1);
   }
 
   if (!(message = smtp_add_message (session))) {
     pthread_mutex_unlock (&session_lock);
     ERROR ("notify_email plugin: cannot set SMTP message");
+    sfree (buf);
     return (-1);
   }
   smtp_set_reverse_path (message, email_from);
@@ -293,9 +350,11 @@ static int notify_email_notification (const notification_t *n,
 
   /* Initiate a connection to the SMTP server and transfer the message. */
   if (!smtp_start_session (session)) {
+    char errbuf[256];
     ERROR ("notify_email plugin: SMTP server problem: %s",
-        smtp_strerror (smtp_errno (), buf, sizeof buf));
+        smtp_strerror (smtp_errno (), errbuf, sizeof (errbuf)));
     pthread_mutex_unlock (&session_lock);
+    sfree (buf);
     return (-1);
   } else {
     #if COLLECT_DEBUG
@@ -309,7 +368,112 @@ static int notify_email_notification (const notification_t *n,
   }
 
   pthread_mutex_unlock (&session_lock);
+  sfree (buf);
+  return (0);
+} /* }}} int notify_email_send */
+
+/* Sends the notifications collected since the last digest, if any. The
+ * subject has the most severe severity and the host, or "several hosts". */
+static int notify_email_digest_send (void) /* {{{ */
+{
+  char *text;
+  char host[DATA_MAX_NAME_LEN];
+  int severity;
+  int status;
+
+  pthread_mutex_lock (&digest_lock);
+  if (digest_num == 0)
+  {
+    pthread_mutex_unlock (&digest_lock);
+    return (0);
+  }
+
+  DEBUG ("notify_email plugin: Sending a digest of %i notification%s.",
+      digest_num, (digest_num == 1) ? "" : "s");
+
+  text = digest_text;
+  severity = digest_severity;
+  sstrncpy (host, digest_hosts_differ ? "several hosts" : digest_host,
+      sizeof (host));
+
+  digest_text = NULL;
+  digest_len = digest_size = 0;
+  digest_num = 0;
+  digest_severity = NOTIF_OKAY;
+  digest_hosts_differ = 0;
+  pthread_mutex_unlock (&digest_lock);
+
+  status = notify_email_send (severity, host, text);
+  sfree (text);
+  return (status);
+} /* }}} int notify_email_digest_send */
+
+static int notify_email_read (user_data_t __attribute__((unused)) *ud)
+{
+  return (notify_email_digest_send ());
+} /* int notify_email_read */
+
+/* Appends one notification to the digest. */
+static int notify_email_digest_add (const notification_t *n, /* {{{ */
+    const char *text)
+{
+  size_t text_len = strlen (text);
+  static const char separator[] = "\r\n\r\n";
+  size_t needed;
+
+  pthread_mutex_lock (&digest_lock);
+
+  needed = digest_len + sizeof (separator) + text_len;
+  if (needed > digest_size)
+  {
+    size_t new_size = (digest_size > 0) ? digest_size : 4096;
+    char *tmp;
+
+    while (new_size < needed)
+      new_size *= 2;
+    tmp = realloc (digest_text, new_size);
+    if (tmp == NULL)
+    {
+      pthread_mutex_unlock (&digest_lock);
+      ERROR ("notify_email plugin: realloc failed.");
+      return (-1);
+    }
+    digest_text = tmp;
+    digest_size = new_size;
+  }
+
+  if (digest_num > 0)
+  {
+    memcpy (digest_text + digest_len, separator, sizeof (separator) - 1);
+    digest_len += sizeof (separator) - 1;
+  }
+  memcpy (digest_text + digest_len, text, text_len + 1);
+  digest_len += text_len;
+
+  if (digest_num == 0)
+    sstrncpy (digest_host, n->host, sizeof (digest_host));
+  else if (strcmp (digest_host, n->host) != 0)
+    digest_hosts_differ = 1;
+  /* NOTIF_FAILURE < NOTIF_WARNING < NOTIF_OKAY */
+  if ((digest_num == 0) || (n->severity < digest_severity))
+    digest_severity = n->severity;
+  digest_num++;
+
+  pthread_mutex_unlock (&digest_lock);
   return (0);
+} /* }}} int notify_email_digest_add */
+
+static int notify_email_notification (const notification_t *n,
+    user_data_t __attribute__((unused)) *user_data)
+{
+  char buf[4096] = "";
+
+  notify_email_format (buf, sizeof (buf), n);
+
+  if (digest_interval > 0)
+    return (notify_email_digest_add (n, buf));
+
+  return (notify_email_send (n->severity, n->host, buf));
 } /* int notify_email_notification */
 
 void module_register (void)
@@ -147,13 +147,17 @@ static size_t strtabsplit (char *string, char **fields, size_t size) /* {{{ */
   return (i);
 } /* }}} size_t strtabsplit */
 
-static FILE *olsrd_connect (void) /* {{{ */
+/* The txtinfo plugin closes the connection after each response, so it can't
+ * be kept open. The resolved addresses are kept instead. */
+static struct addrinfo *olsrd_ai_list = NULL;
+
+static int olsrd_resolve (void) /* {{{ */
 {
   struct addrinfo  ai_hints;
-  struct addrinfo *ai_list, *ai_ptr;
   int              ai_return;
 
-  FILE *fh;
+  if (olsrd_ai_list != NULL)
+    return (0);
 
   memset (&ai_hints, 0, sizeof (ai_hints));
   ai_hints.ai_flags    = 0;
@@ -164,19 +168,31 @@ static FILE *olsrd_connect (void) /* {{{ */
   ai_hints.ai_socktype = SOCK_STREAM;
   ai_hints.ai_protocol = IPPROTO_TCP;
 
-  ai_list = NULL;
   ai_return = getaddrinfo (olsrd_get_node (), olsrd_get_service (),
-      &ai_hints, &ai_list);
+      &ai_hints, &olsrd_ai_list);
   if (ai_return != 0)
   {
     ERROR ("olsrd plugin: getaddrinfo (%s, %s) failed: %s",
         olsrd_get_node (), olsrd_get_service (),
         gai_strerror (ai_return));
-    return (NULL);
+    olsrd_ai_list = NULL;
+    return (-1);
   }
 
+  return (0);
+} /* }}} int olsrd_resolve */
+
+static FILE *olsrd_connect (void) /* {{{ */
+{
+  struct addrinfo *ai_ptr;
+
+  FILE *fh;
+
+  if (olsrd_resolve () != 0)
+    return (NULL);
+
   fh = NULL;
-  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  for (ai_ptr = olsrd_ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
   {
     int fd;
     int status;
@@ -210,7 +226,12 @@ static FILE *olsrd_connect (void) /* {{{ */
     break;
   } /* for (ai_ptr) */
 
-  freeaddrinfo (ai_list);
+  /* The node may have moved: look it up again next time. */
+  if (fh == NULL)
+  {
+    freeaddrinfo (olsrd_ai_list);
+    olsrd_ai_list = NULL;
+  }
 
   return (fh);
 } /* }}} FILE *olsrd_connect */
@@ -653,10 +674,23 @@ static int olsrd_read (void) /* {{{ */
   char buffer[1024];
   size_t buffer_len;
 
+  if ((config_want_links == OLSRD_WANT_NOT)
+      && (config_want_routes == OLSRD_WANT_NOT)
+      && (config_want_topology == OLSRD_WANT_NOT))
+    return (0);
+
   fh = olsrd_connect ();
   if (fh == NULL)
     return (-1);
 
+  /* Only ask for the tables that are handled. Versions of txtinfo that don't
+   * know about paths send all tables, which are filtered below. */
+  if (config_want_links != OLSRD_WANT_NOT)
+    fputs ("/links ", fh);
+  if (config_want_routes != OLSRD_WANT_NOT)
+    fputs ("/routes ", fh);
+  if (config_want_topology != OLSRD_WANT_NOT)
+    fputs ("/topology ", fh);
   fputs ("\r\n", fh);
   fflush (fh);
 
@@ -696,6 +730,10 @@ static int olsrd_read (void) /* {{{ */
 
 static int olsrd_shutdown (void) /* {{{ */
 {
+  if (olsrd_ai_list != NULL)
+    freeaddrinfo (olsrd_ai_list);
+  olsrd_ai_list = NULL;
+
   sfree (config_node);
   sfree (config_service);
 
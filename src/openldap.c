@@ -58,6 +58,100 @@ struct cldap_s /* {{{ */
 };
 typedef struct cldap_s cldap_t; /* }}} */
 
+/* Entries below cn=Monitor and the metric each is reported as. The table is
+ * sorted by DN in cldap_init(), so entries are found with bsearch(3). */
+#define CLDAP_ATTR_COUNTER    0 /* monitorCounter */
+#define CLDAP_ATTR_INFO       1 /* monitoredInfo */
+#define CLDAP_ATTR_OPERATIONS 2 /* monitorOpCompleted, monitorOpInitiated */
+
+struct cldap_metric_s /* {{{ */
+{
+	const char *dn;
+	int attr;
+	int ds_type;
+	const char *type;
+	/* For CLDAP_ATTR_OPERATIONS, the prefix of "completed" and "initiated". */
+	const char *type_instance;
+};
+typedef struct cldap_metric_s cldap_metric_t; /* }}} */
+
+static cldap_metric_t cldap_metrics[] = /* {{{ */
+{
+	{ "cn=Total,cn=Connections,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_DERIVE, "total_connections", NULL },
+	{ "cn=Current,cn=Connections,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_GAUGE, "current_connections", NULL },
+	{ "cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "" },
+	{ "cn=Bind,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "bind-" },
+	{ "cn=UnBind,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "unbind-" },
+	{ "cn=Search,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "search-" },
+	{ "cn=Compare,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "compare-" },
+	{ "cn=Modify,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "modify-" },
+	{ "cn=Modrdn,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "modrdn-" },
+	{ "cn=Add,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "add-" },
+	{ "cn=Delete,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "delete-" },
+	{ "cn=Abandon,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "abandon-" },
+	{ "cn=Extended,cn=Operations,cn=Monitor", CLDAP_ATTR_OPERATIONS,
+		DS_TYPE_DERIVE, "operations", "extended-" },
+	{ "cn=Bytes,cn=Statistics,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_DERIVE, "derive", "statistics-bytes" },
+	{ "cn=PDU,cn=Statistics,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_DERIVE, "derive", "statistics-pdu" },
+	{ "cn=Entries,cn=Statistics,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_DERIVE, "derive", "statistics-entries" },
+	{ "cn=Referrals,cn=Statistics,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_DERIVE, "derive", "statistics-referrals" },
+	{ "cn=Open,cn=Threads,cn=Monitor", CLDAP_ATTR_INFO,
+		DS_TYPE_GAUGE, "threads", "threads-open" },
+	{ "cn=Starting,cn=Threads,cn=Monitor", CLDAP_ATTR_INFO,
+		DS_TYPE_GAUGE, "threads", "threads-starting" },
+	{ "cn=Active,cn=Threads,cn=Monitor", CLDAP_ATTR_INFO,
+		DS_TYPE_GAUGE, "threads", "threads-active" },
+	{ "cn=Pending,cn=Threads,cn=Monitor", CLDAP_ATTR_INFO,
+		DS_TYPE_GAUGE, "threads", "threads-pending" },
+	{ "cn=Backload,cn=Threads,cn=Monitor", CLDAP_ATTR_INFO,
+		DS_TYPE_GAUGE, "threads", "threads-backload" },
+	{ "cn=Read,cn=Waiters,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_DERIVE, "derive", "waiters-read" },
+	{ "cn=Write,cn=Waiters,cn=Monitor", CLDAP_ATTR_COUNTER,
+		DS_TYPE_DERIVE, "derive", "waiters-write" }
+}; /* }}} */
+static size_t cldap_metrics_num = STATIC_ARRAY_SIZE (cldap_metrics);
+
+static int cldap_metric_compare (const void *a, const void *b) /* {{{ */
+{
+	return (strcmp (((const cldap_metric_t *) a)->dn,
+				((const cldap_metric_t *) b)->dn));
+} /* }}} int cldap_metric_compare */
+
+static const cldap_metric_t *cldap_metric_get (const char *dn) /* {{{ */
+{
+	cldap_metric_t key = { dn, 0, 0, NULL, NULL };
+
+	return (bsearch (&key, cldap_metrics, cldap_metrics_num,
+				sizeof (*cldap_metrics), cldap_metric_compare));
+} /* }}} cldap_metric_t *cldap_metric_get */
+
+/* The connection is kept bound across reads and only torn down when a search
+ * fails. */
+static void cldap_close (cldap_t *st) /* {{{ */
+{
+	if (st->ld != NULL)
+		ldap_unbind_ext_s (st->ld, NULL, NULL);
+	st->ld = NULL;
+	st->state = 0;
+} /* }}} void cldap_close */
+
 static void cldap_free (cldap_t *st) /* {{{ */
 {
 	if (st == NULL)
@@ -69,8 +163,7 @@ static void cldap_free (cldap_t *st) /* {{{ */
 	sfree (st->host);
 	sfree (st->name);
 	sfree (st->url);
-	if (st->ld)
-		ldap_memfree (st->ld);
+	cldap_close (st);
 	sfree (st);
 } /* }}} void cldap_free */
 
@@ -86,6 +179,7 @@ static int cldap_init_host (cldap_t *st) /* {{{ */
 			ldap_err2string (rc));
 		st->state = 0;
 		ldap_unbind_ext_s (ld, NULL, NULL);
+		st->ld = NULL;
 		return (-1);
 	}
 
@@ -112,8 +206,7 @@ static int cldap_init_host (cldap_t *st) /* {{{ */
 		{
 			ERROR ("openldap plugin: Failed to start tls on %s: %s",
 					st->url, ldap_err2string (rc));
-			st->state = 0;
-			ldap_unbind_ext_s (st->ld, NULL, NULL);
+			cldap_close (st);
 			return (-1);
 		}
 	}
@@ -136,8 +229,7 @@ static int cldap_init_host (cldap_t *st) /* {{{ */
 	{
 		ERROR ("openldap plugin: Failed to bind to %s: %s",
 				st->url, ldap_err2string (rc));
-		st->state = 0;
-		ldap_unbind_ext_s (st->ld, NULL, NULL);
+		cldap_close (st);
 		return (-1);
 	}
 	else
@@ -197,14 +289,76 @@ static void cldap_submit_gauge (const char *type, const char *type_instance, /*
 	cldap_submit_value (type, type_instance, v, st);
 } /* }}} void cldap_submit_gauge */
 
-static int cldap_read_host (user_data_t *ud) /* {{{ */
+/* Returns the first value of "attr", or zero if the entry doesn't have it. */
+static unsigned long long cldap_get_value (cldap_t *st, /* {{{ */
+		LDAPMessage *e, const char *attr)
 {
-	cldap_t *st;
-	LDAPMessage *e, *result;
-	char *dn;
-	int rc;
-	int status;
+	struct berval **list;
+	unsigned long long value = 0;
+
+	list = ldap_get_values_len (st->ld, e, attr);
+	if (list == NULL)
+		return (0);
+
+	if (list[0] != NULL)
+		value = atoll (list[0]->bv_val);
+
+	ldap_value_free_len (list);
+	return (value);
+} /* }}} unsigned long long cldap_get_value */
+
+static void cldap_submit_metric (const cldap_metric_t *m, /* {{{ */
+		const char *type_instance, unsigned long long value, cldap_t *st)
+{
+	if (m->ds_type == DS_TYPE_GAUGE)
+		cldap_submit_gauge (m->type, type_instance, value, st);
+	else
+		cldap_submit_derive (m->type, type_instance, value, st);
+} /* }}} void cldap_submit_metric */
+
+static void cldap_read_database (cldap_t *st, LDAPMessage *e) /* {{{ */
+{
+	struct berval **nc_list;
+	struct berval nc_data;
+	char typeinst[DATA_MAX_NAME_LEN];
+	const char *caches[] = { "olmBDBEntryCache", "bdbentrycache",
+		"olmBDBDNCache", "bdbdncache",
+		"olmBDBIDLCache", "bdbidlcache" };
+	size_t i;
+
+	nc_list = ldap_get_values_len (st->ld, e, "namingContexts");
+	if (nc_list == NULL)
+		return;
+	if (nc_list[0] == NULL)
+	{
+		ldap_value_free_len (nc_list);
+		return;
+	}
+	nc_data = *nc_list[0];
+
+	for (i = 0; i < STATIC_ARRAY_SIZE (caches); i += 2)
+	{
+		struct berval **olmbdb_list;
 
+		if ((olmbdb_list = ldap_get_values_len (st->ld, e,
+			caches[i])) == NULL)
+			continue;
+
+		if (olmbdb_list[0] != NULL)
+		{
+			ssnprintf (typeinst, sizeof (typeinst),
+				"%s-%s", caches[i + 1], nc_data.bv_val);
+			cldap_submit_gauge ("cache_size", typeinst,
+				atoll (olmbdb_list[0]->bv_val), st);
+		}
+		ldap_value_free_len (olmbdb_list);
+	}
+
+	ldap_value_free_len (nc_list);
+} /* }}} void cldap_read_database */
+
+static int cldap_search (cldap_t *st, LDAPMessage **result) /* {{{ */
+{
 	char *attrs[9] = { "monitorCounter",
 				"monitorOpCompleted",
 				"monitorOpInitiated",
@@ -215,6 +369,19 @@ static int cldap_read_host (user_data_t *ud) /* {{{ */
 				"namingContexts",
 				NULL };
 
+	*result = NULL;
+	return (ldap_search_ext_s (st->ld, "cn=Monitor", LDAP_SCOPE_SUBTREE,
+		"(|(!(cn=* *))(cn=Database*))", attrs, 0,
+		NULL, NULL, NULL, 0, result));
+} /* }}} int cldap_search */
+
+static int cldap_read_host (user_data_t *ud) /* {{{ */
+{
+	cldap_t *st;
+	LDAPMessage *e, *result;
+	_Bool reused;
+	int rc;
+
 	if ((ud == NULL) || (ud->data == NULL))
 	{
 		ERROR ("openldap plugin: cldap_read_host: Invalid user data.");
@@ -223,317 +390,76 @@ static int cldap_read_host (user_data_t *ud) /* {{{ */
 
 	st = (cldap_t *) ud->data;
 
-	status = cldap_init_host (st);
-	if (status != 0)
+	reused = (st->state != 0);
+	if (!reused && (cldap_init_host (st) != 0))
 		return (-1);
 
-	rc = ldap_search_ext_s (st->ld, "cn=Monitor", LDAP_SCOPE_SUBTREE,
-		"(|(!(cn=* *))(cn=Database*))", attrs, 0,
-		NULL, NULL, NULL, 0, &result);
+	rc = cldap_search (st, &result);
+
+	/* The server may have closed an idle connection: bind again and
+	 * retry once before giving up. */
+	if ((rc != LDAP_SUCCESS) && reused)
+	{
+		DEBUG ("openldap plugin: Search on %s failed (%s), reconnecting.",
+				st->url, ldap_err2string (rc));
+		ldap_msgfree (result);
+		cldap_close (st);
+		if (cldap_init_host (st) != 0)
+			return (-1);
+		rc = cldap_search (st, &result);
+	}
 
 	if (rc != LDAP_SUCCESS)
 	{
 		ERROR ("openldap plugin: Failed to execute search: %s",
 				ldap_err2string (rc));
 		ldap_msgfree (result);
-		ldap_unbind_ext_s (st->ld, NULL, NULL);
+		cldap_close (st);
 		return (-1);
 	}
 
 	for (e = ldap_first_entry (st->ld, result); e != NULL;
 		e = ldap_next_entry (st->ld, e))
 	{
-		if ((dn = ldap_get_dn (st->ld, e)) != NULL)
+		const cldap_metric_t *m;
+		char *dn;
+
+		if ((dn = ldap_get_dn (st->ld, e)) == NULL)
+			continue;
+
+		m = cldap_metric_get (dn);
+		if (m == NULL)
 		{
-			unsigned long long counter = 0;
-			unsigned long long opc = 0;
-			unsigned long long opi = 0;
-			unsigned long long info = 0;
-
-			struct berval counter_data;
-			struct berval opc_data;
-			struct berval opi_data;
-			struct berval info_data;
-			struct berval olmbdb_data;
-			struct berval nc_data;
-
-			struct berval **counter_list;
-			struct berval **opc_list;
-			struct berval **opi_list;
-			struct berval **info_list;
-			struct berval **olmbdb_list;
-			struct berval **nc_list;
-
-			if ((counter_list = ldap_get_values_len (st->ld, e,
-				"monitorCounter")) != NULL)
-			{
-				counter_data = *counter_list[0];
-				counter = atoll (counter_data.bv_val);
-			}
-
-			if ((opc_list = ldap_get_values_len (st->ld, e,
-				"monitorOpCompleted")) != NULL)
-			{
-				opc_data = *opc_list[0];
-				opc = atoll (opc_data.bv_val);
-			}
-
-			if ((opi_list = ldap_get_values_len (st->ld, e,
-				"monitorOpInitiated")) != NULL)
-			{
-				opi_data = *opi_list[0];
-				opi = atoll (opi_data.bv_val);
-			}
-
-			if ((info_list = ldap_get_values_len (st->ld, e,
-				"monitoredInfo")) != NULL)
-			{
-				info_data = *info_list[0];
-				info = atoll (info_data.bv_val);
-			}
-
-			if (strcmp (dn, "cn=Total,cn=Connections,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("total_connections", NULL,
-					counter, st);
-			}
-			else if (strcmp (dn,
-					"cn=Current,cn=Connections,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_gauge ("current_connections", NULL,
-					counter, st);
-			}
-			else if (strcmp (dn,
-					"cn=Operations,cn=Monitor") == 0)
-			{
-				cldap_submit_derive ("operations",
-					"completed", opc, st);
-				cldap_submit_derive ("operations",
-					"initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Bind,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"bind-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"bind-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=UnBind,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"unbind-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"unbind-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Search,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"search-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"search-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Compare,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"compare-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"compare-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Modify,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"modify-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"modify-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Modrdn,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"modrdn-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"modrdn-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Add,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"add-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"add-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Delete,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"delete-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"delete-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Abandon,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"abandon-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"abandon-initiated", opi, st);
-			}
-			else if (strcmp (dn,
-					"cn=Extended,cn=Operations,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("operations",
-					"extended-completed", opc, st);
-				cldap_submit_derive ("operations",
-					"extended-initiated", opi, st);
-			}
-			else if ((strncmp (dn, "cn=Database", 11) == 0)
-				&& ((nc_list = ldap_get_values_len
-						(st->ld, e, "namingContexts")) != NULL))
-			{
-				nc_data = *nc_list[0];
-				char typeinst[DATA_MAX_NAME_LEN];
-
-				if ((olmbdb_list = ldap_get_values_len (st->ld, e,
-					"olmBDBEntryCache")) != NULL)
-				{
-					olmbdb_data = *olmbdb_list[0];
-					ssnprintf (typeinst, sizeof (typeinst),
-						"bdbentrycache-%s", nc_data.bv_val);
-					cldap_submit_gauge ("cache_size", typeinst,
-						atoll (olmbdb_data.bv_val), st);
-					ldap_value_free_len (olmbdb_list);
-				}
-
-				if ((olmbdb_list = ldap_get_values_len (st->ld, e,
-					"olmBDBDNCache")) != NULL)
-				{
-					olmbdb_data = *olmbdb_list[0];
-					ssnprintf (typeinst, sizeof (typeinst),
-						"bdbdncache-%s", nc_data.bv_val);
-					cldap_submit_gauge ("cache_size", typeinst,
-						atoll (olmbdb_data.bv_val), st);
-					ldap_value_free_len (olmbdb_list);
-				}
-
-				if ((olmbdb_list = ldap_get_values_len (st->ld, e,
-					"olmBDBIDLCache")) != NULL)
-				{
-					olmbdb_data = *olmbdb_list[0];
-					ssnprintf (typeinst, sizeof (typeinst),
-						"bdbidlcache-%s", nc_data.bv_val);
-					cldap_submit_gauge ("cache_size", typeinst,
-						atoll (olmbdb_data.bv_val), st);
-					ldap_value_free_len (olmbdb_list);
-				}
-
-				ldap_value_free_len (nc_list);
-			}
-			else if (strcmp (dn,
-					"cn=Bytes,cn=Statistics,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("derive", "statistics-bytes",
-					counter, st);
-			}
-			else if (strcmp (dn,
-					"cn=PDU,cn=Statistics,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("derive", "statistics-pdu",
-					counter, st);
-			}
-			else if (strcmp (dn,
-					"cn=Entries,cn=Statistics,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("derive", "statistics-entries",
-					counter, st);
-			}
-			else if (strcmp (dn,
-					"cn=Referrals,cn=Statistics,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("derive", "statistics-referrals",
-					counter, st);
-			}
-			else if (strcmp (dn,
-					"cn=Open,cn=Threads,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_gauge ("threads", "threads-open",
-					info, st);
-			}
-			else if (strcmp (dn,
-					"cn=Starting,cn=Threads,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_gauge ("threads", "threads-starting",
-					info, st);
-			}
-			else if (strcmp (dn,
-					"cn=Active,cn=Threads,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_gauge ("threads", "threads-active",
-					info, st);
-			}
-			else if (strcmp (dn,
-					"cn=Pending,cn=Threads,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_gauge ("threads", "threads-pending",
-					info, st);
-			}
-			else if (strcmp (dn,
-					"cn=Backload,cn=Threads,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_gauge ("threads", "threads-backload",
-					info, st);
-			}
-			else if (strcmp (dn,
-					"cn=Read,cn=Waiters,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("derive", "waiters-read",
-					counter, st);
-			}
-			else if (strcmp (dn,
-					"cn=Write,cn=Waiters,cn=Monitor")
-					== 0)
-			{
-				cldap_submit_derive ("derive", "waiters-write",
-					counter, st);
-			}
-
-			ldap_value_free_len (counter_list);
-			ldap_value_free_len (opc_list);
-			ldap_value_free_len (opi_list);
-			ldap_value_free_len (info_list);
+			if (strncmp (dn, "cn=Database", 11) == 0)
+				cldap_read_database (st, e);
+		}
+		else if (m->attr == CLDAP_ATTR_OPERATIONS)
+		{
+			char typeinst[DATA_MAX_NAME_LEN];
+
+			ssnprintf (typeinst, sizeof (typeinst), "%scompleted",
+					m->type_instance);
+			cldap_submit_metric (m, typeinst, cldap_get_value (st, e,
+						"monitorOpCompleted"), st);
+
+			ssnprintf (typeinst, sizeof (typeinst), "%sinitiated",
+					m->type_instance);
+			cldap_submit_metric (m, typeinst, cldap_get_value (st, e,
+						"monitorOpInitiated"), st);
+		}
+		else
+		{
+			cldap_submit_metric (m, m->type_instance,
+					cldap_get_value (st, e,
+						(m->attr == CLDAP_ATTR_INFO)
+						? "monitoredInfo" : "monitorCounter"),
+					st);
 		}
 
 		ldap_memfree (dn);
 	}
 
 	ldap_msgfree (result);
-	ldap_unbind_ext_s (st->ld, NULL, NULL);
 	return (0);
 } /* }}} int cldap_read_host */
 
@@ -694,6 +620,9 @@ static int cldap_init (void) /* {{{ */
 	 * ldap_initialize(3) */
 	int debug_level;
 	ldap_get_option (NULL, LDAP_OPT_DEBUG_LEVEL, &debug_level);
+
+	qsort (cldap_metrics, cldap_metrics_num, sizeof (*cldap_metrics),
+			cldap_metric_compare);
 	return (0);
 } /* }}} int cldap_init */
 
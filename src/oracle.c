@@ -53,9 +53,26 @@
 
 #include <oci.h>
 
+#define O_FETCH_ROWS_DEFAULT 100
+
 /*
  * Data types
  */
+/* Buffers the rows of one query are fetched into, kept across reads. The
+ * values are stored column by column, as required by the array fetch, and
+ * `rows' points to them row by row, as expected by udb_query_handle_results. */
+struct o_fetch_buffers_s
+{
+  size_t column_num;
+  size_t rows_num;
+
+  char **column_names;
+  char  *values;
+  sb2   *indicators;
+  char **rows;
+};
+typedef struct o_fetch_buffers_s o_fetch_buffers_t;
+
 struct o_database_s
 {
   char *name;
@@ -65,9 +82,12 @@ struct o_database_s
   char *password;
 
   udb_query_preparation_area_t **q_prep_areas;
+  o_fetch_buffers_t **q_buffers;
   udb_query_t **queries;
   size_t        queries_num;
 
+  int fetch_rows;
+
   OCISvcCtx *oci_service_context;
 };
 typedef struct o_database_s o_database_t;
@@ -142,6 +162,70 @@ static void o_report_error (const char *where, /* {{{ */
   }
 } /* }}} void o_report_error */
 
+static void o_fetch_buffers_free (o_fetch_buffers_t *b) /* {{{ */
+{
+  if (b == NULL)
+    return;
+
+  if (b->column_names != NULL)
+    sfree (b->column_names[0]);
+  sfree (b->column_names);
+  sfree (b->values);
+  sfree (b->indicators);
+  sfree (b->rows);
+  sfree (b);
+} /* }}} void o_fetch_buffers_free */
+
+/* Allocates the buffers for `column_num' columns and `rows_num' rows:
+ *
+ *  +--------------+-----------------------------------------------+
+ *  ! Name         ! Size                                          !
+ *  +--------------+-----------------------------------------------+
+ *  ! column_names ! column_num x DATA_MAX_NAME_LEN                !
+ *  ! values       ! column_num x rows_num x DATA_MAX_NAME_LEN     !
+ *  ! indicators   ! column_num x rows_num x sizeof (sb2)          !
+ *  ! rows         ! rows_num x column_num x sizeof (char *)       !
+ *  +--------------+-----------------------------------------------+
+ */
+static o_fetch_buffers_t *o_fetch_buffers_create (size_t column_num, /* {{{ */
+    size_t rows_num)
+{
+  o_fetch_buffers_t *b;
+  size_t i;
+  size_t j;
+
+  b = calloc (1, sizeof (*b));
+  if (b == NULL)
+    return (NULL);
+
+  b->column_num = column_num;
+  b->rows_num = rows_num;
+
+  b->column_names = calloc (column_num, sizeof (*b->column_names));
+  if (b->column_names != NULL)
+    b->column_names[0] = calloc (column_num, DATA_MAX_NAME_LEN);
+  b->values = calloc (column_num * rows_num, DATA_MAX_NAME_LEN);
+  b->indicators = calloc (column_num * rows_num, sizeof (*b->indicators));
+  b->rows = calloc (rows_num * column_num, sizeof (*b->rows));
+
+  if ((b->column_names == NULL) || (b->column_names[0] == NULL)
+      || (b->values == NULL) || (b->indicators == NULL) || (b->rows == NULL))
+  {
+    o_fetch_buffers_free (b);
+    return (NULL);
+  }
+
+  for (i = 1; i < column_num; i++)
+    b->column_names[i] = b->column_names[i - 1] + DATA_MAX_NAME_LEN;
+
+  for (i = 0; i < column_num; i++)
+    for (j = 0; j < rows_num; j++)
+      b->rows[j * column_num + i]
+        = b->values + (i * rows_num + j) * DATA_MAX_NAME_LEN;
+
+  return (b);
+} /* }}} o_fetch_buffers_t *o_fetch_buffers_create */
+
 static void o_database_free (o_database_t *db) /* {{{ */
 {
   size_t i;
@@ -160,6 +244,11 @@ static void o_database_free (o_database_t *db) /* {{{ */
       udb_query_delete_preparation_area (db->q_prep_areas[i]);
   free (db->q_prep_areas);
 
+  if (db->q_buffers != NULL)
+    for (i = 0; i < db->queries_num; ++i)
+      o_fetch_buffers_free (db->q_buffers[i]);
+  free (db->q_buffers);
+
   sfree (db);
 } /* }}} void o_database_free */
 
@@ -179,6 +268,7 @@ static void o_database_free (o_database_t *db) /* {{{ */
  *     ConnectID "db01"
  *     Username "oracle"
  *     Password "secret"
+ *     FetchRows 100
  *     Query "plugin_instance0"
  *   </Database>
  * </Plugin>
@@ -209,6 +299,7 @@ static int o_config_add_database (oconfig_item_t *ci) /* {{{ */
   db->connect_id = NULL;
   db->username = NULL;
   db->password = NULL;
+  db->fetch_rows = O_FETCH_ROWS_DEFAULT;
 
   status = cf_util_get_string (ci, &db->name);
   if (status != 0)
@@ -230,6 +321,8 @@ static int o_config_add_database (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_string (child, &db->username);
     else if (strcasecmp ("Password", child->key) == 0)
       status = cf_util_get_string (child, &db->password);
+    else if (strcasecmp ("FetchRows", child->key) == 0)
+      status = cf_util_get_int (child, &db->fetch_rows);
     else if (strcasecmp ("Query", child->key) == 0)
       status = udb_query_pick_from_list (child, queries, queries_num,
           &db->queries, &db->queries_num);
@@ -261,6 +354,12 @@ static int o_config_add_database (oconfig_item_t *ci) /* {{{ */
       WARNING ("oracle plugin: `Password' not given for query `%s'", db->name);
       status = -1;
     }
+    if (db->fetch_rows < 1)
+    {
+      WARNING ("oracle plugin: `FetchRows' must be positive for database `%s'",
+          db->name);
+      status = -1;
+    }
 
     break;
   } /* while (status == 0) */
@@ -269,8 +368,9 @@ static int o_config_add_database (oconfig_item_t *ci) /* {{{ */
   {
     db->q_prep_areas = (udb_query_preparation_area_t **) calloc (
         db->queries_num, sizeof (*db->q_prep_areas));
+    db->q_buffers = calloc (db->queries_num, sizeof (*db->q_buffers));
 
-    if (db->q_prep_areas == NULL)
+    if ((db->q_prep_areas == NULL) || (db->q_buffers == NULL))
     {
       WARNING ("oracle plugin: calloc failed");
       status = -1;
@@ -385,63 +485,199 @@ static int o_init (void) /* {{{ */
   return (0);
 } /* }}} int o_init */
 
-static int o_read_database_query (o_database_t *db, /* {{{ */
-    udb_query_t *q, udb_query_preparation_area_t *prep_area)
+/* Looks up the names of the columns returned by `oci_statement' and defines
+ * the fetch buffers, i. e. binds the columns to `b'. */
+static int o_define_columns (o_database_t *db, udb_query_t *q, /* {{{ */
+    OCIStmt *oci_statement, o_fetch_buffers_t *b, _Bool get_names)
 {
-  char **column_names;
-  char **column_values;
-  size_t column_num;
+  int status;
+  size_t i;
 
-  OCIStmt *oci_statement;
+  for (i = 0; i < b->column_num; i++)
+  {
+    OCIDefine *oci_define;
 
-  /* List of `OCIDefine' pointers. These defines map columns to the buffer
-   * space declared above. */
-  OCIDefine **oci_defines;
+    if (get_names)
+    {
+      char *column_name;
+      ub4 column_name_length;
+      OCIParam *oci_param;
 
-  int status;
-  size_t i;
+      oci_param = NULL;
 
-  oci_statement = udb_query_get_user_data (q);
+      status = OCIParamGet (oci_statement, OCI_HTYPE_STMT, oci_error,
+          (void *) &oci_param, (ub4) (i + 1));
+      if (status != OCI_SUCCESS)
+      {
+        o_report_error ("o_define_columns", db->name,
+            udb_query_get_name (q), "OCIParamGet", oci_error);
+        return (-1);
+      }
 
-  /* Prepare the statement */
-  if (oci_statement == NULL) /* {{{ */
-  {
-    const char *statement;
+      column_name = NULL;
+      column_name_length = 0;
+      status = OCIAttrGet (oci_param, OCI_DTYPE_PARAM,
+          &column_name, &column_name_length, OCI_ATTR_NAME, oci_error);
+      if (status != OCI_SUCCESS)
+      {
+        OCIDescriptorFree (oci_param, OCI_DTYPE_PARAM);
+        o_report_error ("o_define_columns", db->name,
+            udb_query_get_name (q), "OCIAttrGet (OCI_ATTR_NAME)", oci_error);
+        return (-1);
+      }
+
+      /* Copy the name to column_names. Warning: The ``string'' returned by
+       * OCI may not be null terminated and is only valid as long as the
+       * parameter descriptor is! */
+      memset (b->column_names[i], 0, DATA_MAX_NAME_LEN);
+      if (column_name_length >= DATA_MAX_NAME_LEN)
+        column_name_length = DATA_MAX_NAME_LEN - 1;
+      memcpy (b->column_names[i], column_name, column_name_length);
 
-    statement = udb_query_get_statement (q);
-    assert (statement != NULL);
+      OCIDescriptorFree (oci_param, OCI_DTYPE_PARAM);
+      oci_param = NULL;
+
+      DEBUG ("oracle plugin: o_define_columns: column_names[%zu] = %s;",
+          i, b->column_names[i]);
+    }
 
-    status = OCIHandleAlloc (oci_env, (void *) &oci_statement,
-        OCI_HTYPE_STMT, /* user_data_size = */ 0, /* user_data = */ NULL);
+    /* The values of column `i' are contiguous, one per row. The indicators
+     * tell NULL values apart from empty strings. */
+    oci_define = NULL;
+    status = OCIDefineByPos (oci_statement,
+        &oci_define, oci_error, (ub4) (i + 1),
+        b->values + (i * b->rows_num * DATA_MAX_NAME_LEN),
+        DATA_MAX_NAME_LEN, SQLT_STR,
+        b->indicators + (i * b->rows_num), NULL, NULL, OCI_DEFAULT);
     if (status != OCI_SUCCESS)
     {
-      o_report_error ("o_read_database_query", db->name,
-          udb_query_get_name (q), "OCIHandleAlloc", oci_error);
-      oci_statement = NULL;
+      o_report_error ("o_define_columns", db->name,
+          udb_query_get_name (q), "OCIDefineByPos", oci_error);
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* }}} int o_define_columns */
+
+/* Fetches all rows of the executed `oci_statement', `b->rows_num' rows per
+ * round trip, and hands them to udb_query_handle_results. */
+static int o_fetch_rows (o_database_t *db, udb_query_t *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area,
+    OCIStmt *oci_statement, o_fetch_buffers_t *b)
+{
+  while (42)
+  {
+    ub4 rows_fetched;
+    int fetch_status;
+    int status;
+    size_t i;
+
+    fetch_status = OCIStmtFetch2 (oci_statement, oci_error,
+        /* nrows = */ (ub4) b->rows_num, /* orientation = */ OCI_FETCH_NEXT,
+        /* fetch offset = */ 0, /* mode = */ OCI_DEFAULT);
+    if ((fetch_status != OCI_SUCCESS) && (fetch_status != OCI_SUCCESS_WITH_INFO)
+        && (fetch_status != OCI_NO_DATA))
+    {
+      o_report_error ("o_fetch_rows", db->name,
+          udb_query_get_name (q), "OCIStmtFetch2", oci_error);
       return (-1);
     }
 
-    status = OCIStmtPrepare (oci_statement, oci_error,
-        (text *) statement, (ub4) strlen (statement),
-        /* language = */ OCI_NTV_SYNTAX,
-        /* mode     = */ OCI_DEFAULT);
+    /* The last fetch usually returns OCI_NO_DATA together with a partial
+     * batch. */
+    rows_fetched = 0;
+    status = OCIAttrGet (oci_statement, OCI_HTYPE_STMT,
+        &rows_fetched, /* size pointer = */ NULL,
+        OCI_ATTR_ROWS_FETCHED, oci_error);
     if (status != OCI_SUCCESS)
     {
-      o_report_error ("o_read_database_query", db->name,
-          udb_query_get_name (q), "OCIStmtPrepare", oci_error);
-      OCIHandleFree (oci_statement, OCI_HTYPE_STMT);
-      oci_statement = NULL;
+      o_report_error ("o_fetch_rows", db->name,
+          udb_query_get_name (q), "OCIAttrGet (OCI_ATTR_ROWS_FETCHED)",
+          oci_error);
       return (-1);
     }
-    udb_query_set_user_data (q, oci_statement);
+    assert (rows_fetched <= b->rows_num);
 
-    DEBUG ("oracle plugin: o_read_database_query (%s, %s): "
-        "Successfully allocated statement handle.",
-        db->name, udb_query_get_name (q));
+    /* NULL values leave the buffer untouched. Pass them on as empty
+     * strings. */
+    for (i = 0; i < b->column_num * (size_t) rows_fetched; i++)
+    {
+      size_t column = i % b->column_num;
+      size_t row = i / b->column_num;
+
+      if (b->indicators[column * b->rows_num + row] == -1)
+        b->rows[i][0] = 0;
+    }
+
+    if (rows_fetched > 0)
+    {
+      status = udb_query_handle_results (q, prep_area, b->rows,
+          (size_t) rows_fetched);
+      if (status != 0)
+      {
+        WARNING ("oracle plugin: o_fetch_rows (%s, %s): "
+            "udb_query_handle_results failed.",
+            db->name, udb_query_get_name (q));
+      }
+    }
+
+    if (fetch_status == OCI_NO_DATA)
+      break;
+  } /* while (42) */
+
+  return (0);
+} /* }}} int o_fetch_rows */
+
+static int o_read_database_query (o_database_t *db, /* {{{ */
+    udb_query_t *q, udb_query_preparation_area_t *prep_area,
+    o_fetch_buffers_t **buffers)
+{
+  const char *statement;
+  size_t column_num;
+  ub4 prefetch_rows;
+  _Bool get_names;
+
+  OCIStmt *oci_statement;
+
+  int status;
+
+  statement = udb_query_get_statement (q);
+  assert (statement != NULL);
+
+  /* Get the statement from the connection's statement cache. It is only
+   * parsed by the server the first time it is used with this connection. */
+  oci_statement = NULL;
+  status = OCIStmtPrepare2 (db->oci_service_context, &oci_statement, /* {{{ */
+      oci_error, (text *) statement, (ub4) strlen (statement),
+      /* key = */ NULL, /* key length = */ 0,
+      /* language = */ OCI_NTV_SYNTAX,
+      /* mode     = */ OCI_DEFAULT);
+  if ((status != OCI_SUCCESS) && (status != OCI_SUCCESS_WITH_INFO))
+  {
+    o_report_error ("o_read_database_query", db->name,
+        udb_query_get_name (q), "OCIStmtPrepare2", oci_error);
+    return (-1);
   } /* }}} */
 
   assert (oci_statement != NULL);
 
+#define RELEASE_STATEMENT \
+  OCIStmtRelease (oci_statement, oci_error, \
+      /* key = */ NULL, /* key length = */ 0, OCI_DEFAULT)
+
+  /* Let the execute return the first batch of rows, saving one round
+   * trip for small results. */
+  prefetch_rows = (ub4) db->fetch_rows;
+  status = OCIAttrSet (oci_statement, OCI_HTYPE_STMT,
+      &prefetch_rows, /* size = */ 0, OCI_ATTR_PREFETCH_ROWS, oci_error);
+  if (status != OCI_SUCCESS)
+  {
+    o_report_error ("o_read_database_query", db->name,
+        udb_query_get_name (q), "OCIAttrSet (OCI_ATTR_PREFETCH_ROWS)",
+        oci_error);
+  }
+
   /* Execute the statement */
   status = OCIStmtExecute (db->oci_service_context, /* {{{ */
       oci_statement,
@@ -450,10 +686,11 @@ static int o_read_database_query (o_database_t *db, /* {{{ */
       /* rowoff = */ 0,
       /* snap_in = */ NULL, /* snap_out = */ NULL,
       /* mode = */ OCI_DEFAULT);
-  if (status != OCI_SUCCESS)
+  if ((status != OCI_SUCCESS) && (status != OCI_SUCCESS_WITH_INFO))
   {
     o_report_error ("o_read_database_query", db->name, udb_query_get_name (q),
         "OCIStmtExecute", oci_error);
+    RELEASE_STATEMENT;
     return (-1);
   } /* }}} */
 
@@ -468,176 +705,62 @@ static int o_read_database_query (o_database_t *db, /* {{{ */
     {
       o_report_error ("o_read_database_query", db->name,
           udb_query_get_name (q), "OCIAttrGet", oci_error);
+      RELEASE_STATEMENT;
       return (-1);
     } /* }}} */
 
     column_num = (size_t) param_counter;
   } while (0); /* }}} */
 
-  /* Allocate the following buffers:
-   *
-   *  +---------------+-----------------------------------+
-   *  ! Name          ! Size                              !
-   *  +---------------+-----------------------------------+
-   *  ! column_names  ! column_num x DATA_MAX_NAME_LEN    !
-   *  ! column_values ! column_num x DATA_MAX_NAME_LEN    !
-   *  ! oci_defines   ! column_num x sizeof (OCIDefine *) !
-   *  +---------------+-----------------------------------+
-   *
-   * {{{ */
-#define NUMBER_BUFFER_SIZE 64
-
-#define FREE_ALL \
-  if (column_names != NULL) { \
-    sfree (column_names[0]); \
-    sfree (column_names); \
-  } \
-  if (column_values != NULL) { \
-    sfree (column_values[0]); \
-    sfree (column_values); \
-  } \
-  sfree (oci_defines)
-
-#define ALLOC_OR_FAIL(ptr, ptr_size) \
-  do { \
-    size_t alloc_size = (size_t) ((ptr_size)); \
-    (ptr) = calloc (1, alloc_size); \
-    if ((ptr) == NULL) { \
-      FREE_ALL; \
-      ERROR ("oracle plugin: o_read_database_query: calloc failed."); \
-      return (-1); \
-    } \
-  } while (0)
-
-  /* Initialize everything to NULL so the above works. */
-  column_names  = NULL;
-  column_values = NULL;
-  oci_defines   = NULL;
-
-  ALLOC_OR_FAIL (column_names, column_num * sizeof (char *));
-  ALLOC_OR_FAIL (column_names[0], column_num * DATA_MAX_NAME_LEN
-      * sizeof (char));
-  for (i = 1; i < column_num; i++)
-    column_names[i] = column_names[i - 1] + DATA_MAX_NAME_LEN;
-
-  ALLOC_OR_FAIL (column_values, column_num * sizeof (char *));
-  ALLOC_OR_FAIL (column_values[0], column_num * DATA_MAX_NAME_LEN
-      * sizeof (char));
-  for (i = 1; i < column_num; i++)
-    column_values[i] = column_values[i - 1] + DATA_MAX_NAME_LEN;
-
-  ALLOC_OR_FAIL (oci_defines, column_num * sizeof (OCIDefine *));
-  /* }}} End of buffer allocations. */
-
-  /* ``Define'' the returned data, i. e. bind the columns to the buffers
-   * allocated above. */
-  for (i = 0; i < column_num; i++) /* {{{ */
+  /* The buffers are kept across reads. The column names are only looked up
+   * again when the buffers have to be reallocated. */
+  get_names = 0;
+  if ((*buffers == NULL) || ((*buffers)->column_num != column_num))
   {
-    char *column_name;
-    ub4 column_name_length;
-    OCIParam *oci_param;
-
-    oci_param = NULL;
-
-    status = OCIParamGet (oci_statement, OCI_HTYPE_STMT, oci_error,
-        (void *) &oci_param, (ub4) (i + 1));
-    if (status != OCI_SUCCESS)
+    o_fetch_buffers_free (*buffers);
+    *buffers = o_fetch_buffers_create (column_num, (size_t) db->fetch_rows);
+    if (*buffers == NULL)
     {
-      /* This is probably alright */
-      DEBUG ("oracle plugin: o_read_database_query: status = %#x (= %i);",
-          status, status);
-      o_report_error ("o_read_database_query", db->name,
-          udb_query_get_name (q), "OCIParamGet", oci_error);
-      status = OCI_SUCCESS;
-      break;
-    }
-
-    column_name = NULL;
-    column_name_length = 0;
-    status = OCIAttrGet (oci_param, OCI_DTYPE_PARAM,
-        &column_name, &column_name_length, OCI_ATTR_NAME, oci_error);
-    if (status != OCI_SUCCESS)
-    {
-      OCIDescriptorFree (oci_param, OCI_DTYPE_PARAM);
-      o_report_error ("o_read_database_query", db->name,
-          udb_query_get_name (q), "OCIAttrGet (OCI_ATTR_NAME)", oci_error);
-      continue;
+      ERROR ("oracle plugin: o_read_database_query: "
+          "o_fetch_buffers_create failed.");
+      RELEASE_STATEMENT;
+      return (-1);
     }
+    get_names = 1;
+  }
 
-    OCIDescriptorFree (oci_param, OCI_DTYPE_PARAM);
-    oci_param = NULL;
-
-    /* Copy the name to column_names. Warning: The ``string'' returned by OCI
-     * may not be null terminated! */
-    memset (column_names[i], 0, DATA_MAX_NAME_LEN);
-    if (column_name_length >= DATA_MAX_NAME_LEN)
-      column_name_length = DATA_MAX_NAME_LEN - 1;
-    memcpy (column_names[i], column_name, column_name_length);
-    column_names[i][column_name_length] = 0;
-
-    DEBUG ("oracle plugin: o_read_database_query: column_names[%zu] = %s; "
-        "column_name_length = %"PRIu32";",
-        i, column_names[i], (uint32_t) column_name_length);
-
-    status = OCIDefineByPos (oci_statement,
-        &oci_defines[i], oci_error, (ub4) (i + 1),
-        column_values[i], DATA_MAX_NAME_LEN, SQLT_STR,
-        NULL, NULL, NULL, OCI_DEFAULT);
-    if (status != OCI_SUCCESS)
-    {
-      o_report_error ("o_read_database_query", db->name,
-          udb_query_get_name (q), "OCIDefineByPos", oci_error);
-      continue;
-    }
-  } /* for (j = 1; j <= param_counter; j++) */
-  /* }}} End of the ``define'' stuff. */
+  /* Cached statements keep their defines, but they refer to buffers we may
+   * just have reallocated. Defining is a local call, so simply redo it. */
+  status = o_define_columns (db, q, oci_statement, *buffers, get_names);
+  if (status != 0)
+  {
+    /* Look the names up again next time. */
+    o_fetch_buffers_free (*buffers);
+    *buffers = NULL;
+    RELEASE_STATEMENT;
+    return (-1);
+  }
 
   status = udb_query_prepare_result (q, prep_area,
       (db->host != NULL) ? db->host : hostname_g,
-      /* plugin = */ "oracle", db->name, column_names, column_num,
+      /* plugin = */ "oracle", db->name, (*buffers)->column_names, column_num,
       /* interval = */ 0);
   if (status != 0)
   {
     ERROR ("oracle plugin: o_read_database_query (%s, %s): "
         "udb_query_prepare_result failed.",
         db->name, udb_query_get_name (q));
-    FREE_ALL;
+    RELEASE_STATEMENT;
     return (-1);
   }
 
-  /* Fetch and handle all the rows that matched the query. */
-  while (42) /* {{{ */
-  {
-    status = OCIStmtFetch2 (oci_statement, oci_error,
-        /* nrows = */ 1, /* orientation = */ OCI_FETCH_NEXT,
-        /* fetch offset = */ 0, /* mode = */ OCI_DEFAULT);
-    if (status == OCI_NO_DATA)
-    {
-      status = OCI_SUCCESS;
-      break;
-    }
-    else if ((status != OCI_SUCCESS) && (status != OCI_SUCCESS_WITH_INFO))
-    {
-      o_report_error ("o_read_database_query", db->name,
-          udb_query_get_name (q), "OCIStmtFetch2", oci_error);
-      break;
-    }
-
-    status = udb_query_handle_result (q, prep_area, column_values);
-    if (status != 0)
-    {
-      WARNING ("oracle plugin: o_read_database_query (%s, %s): "
-          "udb_query_handle_result failed.",
-          db->name, udb_query_get_name (q));
-    }
-  } /* }}} while (42) */
+  status = o_fetch_rows (db, q, prep_area, oci_statement, *buffers);
 
-  /* DEBUG ("oracle plugin: o_read_database_query: This statement succeeded: %s", q->statement); */
-  FREE_ALL;
+  udb_query_finish_result (q, prep_area);
+  RELEASE_STATEMENT;
 
-  return (0);
-#undef FREE_ALL
-#undef ALLOC_OR_FAIL
+  return (status);
+#undef RELEASE_STATEMENT
 } /* }}} int o_read_database_query */
 
 static int o_read_database (o_database_t *db) /* {{{ */
@@ -690,19 +813,24 @@ static int o_read_database (o_database_t *db) /* {{{ */
 
   if (db->oci_service_context == NULL)
   {
-    status = OCILogon (oci_env, oci_error,
+    ub4 cache_size;
+
+    /* Log on with a statement cache, so that each query is prepared once per
+     * connection rather than on each read. */
+    status = OCILogon2 (oci_env, oci_error,
         &db->oci_service_context,
         (OraText *) db->username, (ub4) strlen (db->username),
         (OraText *) db->password, (ub4) strlen (db->password),
-        (OraText *) db->connect_id, (ub4) strlen (db->connect_id));
+        (OraText *) db->connect_id, (ub4) strlen (db->connect_id),
+        OCI_LOGON2_STMTCACHE);
     if ((status != OCI_SUCCESS) && (status != OCI_SUCCESS_WITH_INFO))
     {
       char errfunc[256];
 
-      ssnprintf (errfunc, sizeof (errfunc), "OCILogon(\"%s\")", db->connect_id);
+      ssnprintf (errfunc, sizeof (errfunc), "OCILogon2(\"%s\")", db->connect_id);
 
       o_report_error ("o_read_database", db->name, NULL, errfunc, oci_error);
-      DEBUG ("oracle plugin: OCILogon (%s): db->oci_service_context = %p;",
+      DEBUG ("oracle plugin: OCILogon2 (%s): db->oci_service_context = %p;",
           db->connect_id, db->oci_service_context);
       db->oci_service_context = NULL;
       return (-1);
@@ -712,13 +840,29 @@ static int o_read_database (o_database_t *db) /* {{{ */
       /* TODO: Print NOTIFY message. */
     }
     assert (db->oci_service_context != NULL);
+
+    /* Make room for all queries of this database. */
+    cache_size = 0;
+    OCIAttrGet ((void *) db->oci_service_context, OCI_HTYPE_SVCCTX,
+        &cache_size, /* size pointer = */ NULL,
+        OCI_ATTR_STMTCACHESIZE, oci_error);
+    if (cache_size < (ub4) db->queries_num)
+    {
+      cache_size = (ub4) db->queries_num;
+      status = OCIAttrSet ((void *) db->oci_service_context, OCI_HTYPE_SVCCTX,
+          &cache_size, /* size = */ 0, OCI_ATTR_STMTCACHESIZE, oci_error);
+      if (status != OCI_SUCCESS)
+        o_report_error ("o_read_database", db->name, NULL,
+            "OCIAttrSet (OCI_ATTR_STMTCACHESIZE)", oci_error);
+    }
   }
 
   DEBUG ("oracle plugin: o_read_database: db->connect_id = %s; db->oci_service_context = %p;",
       db->connect_id, db->oci_service_context);
 
   for (i = 0; i < db->queries_num; i++)
-    o_read_database_query (db, db->queries[i], db->q_prep_areas[i]);
+    o_read_database_query (db, db->queries[i], db->q_prep_areas[i],
+        &db->q_buffers[i]);
 
   return (0);
 } /* }}} int o_read_database */
@@ -737,6 +881,7 @@ static int o_shutdown (void) /* {{{ */
 {
   size_t i;
 
+  /* Freeing the service context also frees its statement cache. */
   for (i = 0; i < databases_num; i++)
     if (databases[i]->oci_service_context != NULL)
     {
@@ -744,18 +889,6 @@ static int o_shutdown (void) /* {{{ */
       databases[i]->oci_service_context = NULL;
     }
 
-  for (i = 0; i < queries_num; i++)
-  {
-    OCIStmt *oci_statement;
-
-    oci_statement = udb_query_get_user_data (queries[i]);
-    if (oci_statement != NULL)
-    {
-      OCIHandleFree (oci_statement, OCI_HTYPE_STMT);
-      udb_query_set_user_data (queries[i], NULL);
-    }
-  }
-
   OCIHandleFree (oci_env, OCI_HTYPE_ENV);
   oci_env = NULL;
 
@@ -174,6 +174,10 @@ static pthread_key_t perl_thr_key;
 static int    perl_argc = 0;
 static char **perl_argv = NULL;
 
+/* number of interpreters serving the write callbacks from their own queue;
+ * zero to call them from the daemon's write threads */
+static int perl_write_interpreters = 0;
+
 static char base_name[DATA_MAX_NAME_LEN] = "";
 
 static struct {
@@ -1144,6 +1148,114 @@ static int pplugin_call_all (pTHX_ int type, ...)
 	return ret;
 } /* static int pplugin_call_all (int, ...) */
 
+/*
+ * Call all write functions for each value list of a batch, using a single
+ * call to Collectd::plugin_call_write_batch:
+ *
+ * $_[0] = [ [ $type, $ds, $vl ], ... ];
+ *
+ * See pplugin_call_all for the layout of the elements. The Perl representation
+ * of each data set is built once per batch and shared by all value lists of
+ * that type, so write callbacks must not modify it.
+ */
+#define PERL_WRITE_BATCH_DS_MAX 32
+
+static int pplugin_write_batch (pTHX_ const write_batch_entry_t *entries,
+		size_t entries_num)
+{
+	const data_set_t *ds_cache[PERL_WRITE_BATCH_DS_MAX];
+	AV *pds_cache[PERL_WRITE_BATCH_DS_MAX];
+	size_t cache_num = 0;
+
+	AV *batch;
+	size_t i, j;
+
+	int retvals = 0;
+	int ret = 0;
+
+	dSP;
+
+	if (0 == entries_num)
+		return 0;
+
+	ENTER;
+	SAVETMPS;
+
+	batch = newAV ();
+	av_extend (batch, entries_num - 1);
+
+	for (i = 0; i < entries_num; ++i) {
+		const data_set_t *ds = entries[i].ds;
+		AV *pds = NULL;
+		AV *args;
+		HV *pvl;
+
+		for (j = 0; j < cache_num; ++j) {
+			if (ds_cache[j] == ds) {
+				pds = pds_cache[j];
+				break;
+			}
+		}
+
+		if (NULL == pds) {
+			pds = newAV ();
+			if (-1 == data_set2av (aTHX_ (data_set_t *)ds, pds)) {
+				SvREFCNT_dec ((SV *)pds);
+				ret = -1;
+				continue;
+			}
+
+			/* the elements of the batch hold their own references */
+			sv_2mortal ((SV *)pds);
+			if (cache_num < PERL_WRITE_BATCH_DS_MAX) {
+				ds_cache[cache_num] = ds;
+				pds_cache[cache_num] = pds;
+				++cache_num;
+			}
+		}
+
+		pvl = newHV ();
+		if (-1 == value_list2hv (aTHX_ (value_list_t *)entries[i].vl,
+					(data_set_t *)ds, pvl)) {
+			hv_clear (pvl);
+			hv_undef (pvl);
+			SvREFCNT_dec ((SV *)pvl);
+			ret = -1;
+			continue;
+		}
+
+		args = newAV ();
+		av_extend (args, 2);
+		av_store (args, 0, newSVpv (ds->type, 0));
+		av_store (args, 1, newRV_inc ((SV *)pds));
+		av_store (args, 2, newRV_noinc ((SV *)pvl));
+
+		av_push (batch, newRV_noinc ((SV *)args));
+	}
+
+	if (0 < av_len (batch) + 1) {
+		PUSHMARK (SP);
+		XPUSHs (sv_2mortal (newRV_noinc ((SV *)batch)));
+		PUTBACK;
+
+		retvals = call_pv ("Collectd::plugin_call_write_batch", G_SCALAR);
+
+		SPAGAIN;
+		if (0 < retvals) {
+			SV *tmp = POPs;
+			if (! SvTRUE (tmp))
+				ret = -1;
+		}
+		PUTBACK;
+	}
+	else
+		SvREFCNT_dec ((SV *)batch);
+
+	FREETMPS;
+	LEAVE;
+	return ret;
+} /* static int pplugin_write_batch (write_batch_entry_t *, size_t) */
+
 /*
  * collectd's perl interpreter based thread implementation.
  *
@@ -1990,6 +2102,68 @@ static int perl_write (const data_set_t *ds, const value_list_t *vl,
 	return status;
 } /* static int perl_write (const data_set_t *, const value_list_t *) */
 
+static int perl_write_batch (const write_batch_entry_t *entries,
+		size_t entries_num, user_data_t __attribute__((unused)) *user_data)
+{
+	int status;
+	dTHX;
+
+	if (NULL == perl_threads)
+		return 0;
+
+	/* Usually called by the threads of the writer's own queue, so the
+	 * number of interpreters running write callbacks is bounded by
+	 * "WriteInterpreters". */
+	if (NULL == aTHX) {
+		c_ithread_t *t = NULL;
+
+		pthread_mutex_lock (&perl_threads->mutex);
+		t = c_ithread_create (perl_threads->head->interp);
+		pthread_mutex_unlock (&perl_threads->mutex);
+
+		aTHX = t->interp;
+	}
+
+	if (aTHX == perl_threads->head->interp)
+		pthread_mutex_lock (&perl_threads->mutex);
+
+	log_debug ("perl_write_batch: c_ithread: interp = %p (active threads: %i)",
+			aTHX, perl_threads->number_of_threads);
+	status = pplugin_write_batch (aTHX_ entries, entries_num);
+
+	if (aTHX == perl_threads->head->interp)
+		pthread_mutex_unlock (&perl_threads->mutex);
+
+	return status;
+} /* static int perl_write_batch (const write_batch_entry_t *, size_t) */
+
+/*
+ * Registers the write callback. With "WriteInterpreters", the callback gets a
+ * queue of its own (see "WriteThreads" in collectd.conf(5)), so that only that
+ * many interpreters run write callbacks and each of them handles batches.
+ */
+static int perl_register_write (void)
+{
+	plugin_ctx_t ctx;
+	plugin_ctx_t old_ctx;
+	int status;
+
+	if (0 >= perl_write_interpreters)
+		return plugin_register_write ("perl", perl_write,
+				/* user_data = */ NULL);
+
+	ctx = plugin_get_ctx ();
+	old_ctx = ctx;
+	ctx.write_threads = perl_write_interpreters;
+	plugin_set_ctx (ctx);
+
+	status = plugin_register_write_batch ("perl", perl_write_batch,
+			/* user_data = */ NULL);
+
+	plugin_set_ctx (old_ctx);
+	return status;
+} /* static int perl_register_write (void) */
+
 static void perl_log (int level, const char *msg,
 		user_data_t __attribute__((unused)) *user_data)
 {
@@ -2300,7 +2474,7 @@ static int init_pi (int argc, char **argv)
 
 	plugin_register_read ("perl", perl_read);
 
-	plugin_register_write ("perl", perl_write, /* user_data = */ NULL);
+	perl_register_write ();
 	plugin_register_flush ("perl", perl_flush, /* user_data = */ NULL);
 	plugin_register_shutdown ("perl", perl_shutdown);
 	return 0;
@@ -2441,6 +2615,39 @@ static int perl_config_includedir (pTHX_ oconfig_item_t *ci)
 	return 0;
 } /* static int perl_config_includedir (oconfig_item_it *) */
 
+/*
+ * WriteInterpreters <Num>
+ */
+static int perl_config_writeinterpreters (pTHX_ oconfig_item_t *ci)
+{
+	int num = 0;
+
+	if ((1 != ci->values_num) || (OCONFIG_TYPE_NUMBER != ci->values[0].type)) {
+		log_err ("WriteInterpreters expects a single number argument.");
+		return 1;
+	}
+
+	num = (int)ci->values[0].value.number;
+	if (0 > num) {
+		log_err ("WriteInterpreters must not be negative.");
+		return 1;
+	}
+
+	perl_write_interpreters = num;
+
+	/* The write callback is registered with the interpreter. */
+	if (NULL != perl_threads) {
+		plugin_unregister_write ("perl");
+		if (0 != perl_register_write ()) {
+			log_err ("perl_config: Registering the write callback failed.");
+			return 1;
+		}
+	}
+
+	log_debug ("perl_config: Using %i write interpreters", num);
+	return 0;
+} /* static int perl_config_writeinterpreters (oconfig_item_it *) */
+
 /*
  * <Plugin> block
  */
@@ -2524,6 +2731,8 @@ static int perl_config (oconfig_item_t *ci)
 			current_status = perl_config_includedir (aTHX_ c);
 		else if (0 == strcasecmp (c->key, "Plugin"))
 			current_status = perl_config_plugin (aTHX_ c);
+		else if (0 == strcasecmp (c->key, "WriteInterpreters"))
+			current_status = perl_config_writeinterpreters (aTHX_ c);
 		else
 		{
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
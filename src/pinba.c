@@ -27,6 +27,8 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_intern.h"
+#include "utils_recv_batch.h"
 
 #include <pthread.h>
 #include <netdb.h>
@@ -58,6 +60,15 @@
 # define PINBA_MAX_SOCKETS 16
 #endif
 
+/* Maximum number of packets read with a single recvmmsg(2) call. */
+#ifndef PINBA_RECEIVE_BATCH
+# define PINBA_RECEIVE_BATCH 16
+#endif
+
+/* Initial and maximum size of the memory used to decode a packet. */
+#define PINBA_ARENA_SIZE 65536
+#define PINBA_ARENA_MAX_SIZE (16 * PINBA_ARENA_SIZE)
+
 /*
  * Private data structures
  */
@@ -87,6 +98,11 @@ struct pinba_statnode_s
   char *server;
   char *script;
 
+  /* hashes of the query data, compared before the strings */
+  uint32_t host_hash;
+  uint32_t server_hash;
+  uint32_t script_hash;
+
   derive_t req_count;
 
   float_counter_t req_time;
@@ -97,6 +113,42 @@ struct pinba_statnode_s
   gauge_t mem_peak;
 };
 typedef struct pinba_statnode_s pinba_statnode_t;
+
+/* Allocations that didn't fit into the block of an arena. The header keeps
+ * the data suitably aligned. */
+struct pinba_chunk_s
+{
+  struct pinba_chunk_s *next;
+  double align;
+};
+typedef struct pinba_chunk_s pinba_chunk_t;
+
+/* Memory for decoding one packet. Allocations are carved out of a block that
+ * is reused for every packet, so decoding doesn't call malloc(3). The block
+ * grows when a packet needed more, up to PINBA_ARENA_MAX_SIZE. */
+struct pinba_arena_s
+{
+  char  *block;
+  size_t block_size;
+  size_t block_used;
+  pinba_chunk_t *chunks;
+  /* bytes allocated for the current packet */
+  size_t wanted;
+};
+typedef struct pinba_arena_s pinba_arena_t;
+
+struct pinba_receiver_s
+{
+  pthread_t id;
+  _Bool running;
+
+  /* Counters of the views, in the order of "stat_nodes", accumulated since
+   * they were last merged by service_statnode_collect(). Only the counter
+   * members are used. */
+  pinba_statnode_t *nodes;
+  pthread_mutex_t lock;
+};
+typedef struct pinba_receiver_s pinba_receiver_t;
 /* }}} */
 
 /*
@@ -105,14 +157,23 @@ typedef struct pinba_statnode_s pinba_statnode_t;
 /* {{{ */
 static pinba_statnode_t *stat_nodes = NULL;
 static unsigned int stat_nodes_num = 0;
-static pthread_mutex_t stat_nodes_lock;
+static pthread_mutex_t stat_nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* set if any view filters by the respective field */
+static _Bool stat_nodes_by_host   = 0;
+static _Bool stat_nodes_by_server = 0;
+static _Bool stat_nodes_by_script = 0;
 
 static char *conf_node = NULL;
 static char *conf_service = NULL;
+/* With more than one receive thread, each opens its own sockets with
+ * SO_REUSEPORT and the kernel distributes the packets. */
+static int conf_receive_threads = 1;
 
-static _Bool collector_thread_running = 0;
 static _Bool collector_thread_do_shutdown = 0;
-static pthread_t collector_thread_id;
+static pinba_receiver_t *receivers = NULL;
+static size_t receivers_num = 0;
+
 /* }}} */
 
 /*
@@ -139,6 +200,20 @@ static void float_counter_add (float_counter_t *fc, float val) /* {{{ */
   }
 } /* }}} void float_counter_add */
 
+static void float_counter_merge (float_counter_t *dst, /* {{{ */
+    const float_counter_t *src)
+{
+  dst->i += src->i;
+  dst->n += src->n;
+
+  if (dst->n >= 1000000000)
+  {
+    dst->i += 1;
+    dst->n -= 1000000000;
+    assert (dst->n < 1000000000);
+  }
+} /* }}} void float_counter_merge */
+
 static derive_t float_counter_get (const float_counter_t *fc, /* {{{ */
     uint64_t factor)
 {
@@ -198,10 +273,50 @@ static void service_statnode_add(const char *name, /* {{{ */
   strset (&node->server, server);
   strset (&node->script, script);
 
+  if (node->host != NULL)
+  {
+    node->host_hash = identifier_hash_name (node->host);
+    stat_nodes_by_host = 1;
+  }
+  if (node->server != NULL)
+  {
+    node->server_hash = identifier_hash_name (node->server);
+    stat_nodes_by_server = 1;
+  }
+  if (node->script != NULL)
+  {
+    node->script_hash = identifier_hash_name (node->script);
+    stat_nodes_by_script = 1;
+  }
+
   /* increment counter */
   stat_nodes_num++;
 } /* }}} void service_statnode_add */
 
+/* Adds the counters of "src" to "dst" and resets "src". */
+static void service_statnode_merge (pinba_statnode_t *dst, /* {{{ */
+    pinba_statnode_t *src)
+{
+  dst->req_count += src->req_count;
+
+  float_counter_merge (&dst->req_time, &src->req_time);
+  float_counter_merge (&dst->ru_utime, &src->ru_utime);
+  float_counter_merge (&dst->ru_stime, &src->ru_stime);
+
+  dst->doc_size += src->doc_size;
+
+  if (!isnan (src->mem_peak)
+      && (isnan (dst->mem_peak) || (dst->mem_peak < src->mem_peak)))
+    dst->mem_peak = src->mem_peak;
+
+  src->req_count = 0;
+  memset (&src->req_time, 0, sizeof (src->req_time));
+  memset (&src->ru_utime, 0, sizeof (src->ru_utime));
+  memset (&src->ru_stime, 0, sizeof (src->ru_stime));
+  src->doc_size = 0;
+  src->mem_peak = NAN;
+} /* }}} void service_statnode_merge */
+
 /* Copy the data from the global "stat_nodes" list into the buffer pointed to
  * by "res", doing the derivation in the process. Returns the next index or
  * zero if the end of the list has been reached. */
@@ -213,10 +328,23 @@ static unsigned int service_statnode_collect (pinba_statnode_t *res, /* {{{ */
   if (stat_nodes_num == 0)
     return 0;
 
-  /* begin collecting */
+  /* begin collecting: add up the counters of the receive threads */
   if (index == 0)
+  {
+    size_t i;
+    unsigned int j;
+
     pthread_mutex_lock (&stat_nodes_lock);
 
+    for (i = 0; i < receivers_num; i++)
+    {
+      pthread_mutex_lock (&receivers[i].lock);
+      for (j = 0; j < stat_nodes_num; j++)
+        service_statnode_merge (stat_nodes + j, receivers[i].nodes + j);
+      pthread_mutex_unlock (&receivers[i].lock);
+    }
+  }
+
   /* end collecting */
   if (index >= stat_nodes_num)
   {
@@ -250,32 +378,113 @@ static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
 
 } /* }}} void service_statnode_process */
 
-static void service_process_request (Pinba__Request *request) /* {{{ */
+/* Adds the request to the counters "nodes" of the matching views. The views
+ * in "stat_nodes" don't change while the receive threads are running. */
+static void service_process_request (pinba_statnode_t *nodes, /* {{{ */
+    Pinba__Request *request)
 {
+  uint32_t host_hash = 0;
+  uint32_t server_hash = 0;
+  uint32_t script_hash = 0;
   unsigned int i;
 
-  pthread_mutex_lock (&stat_nodes_lock);
+  if (stat_nodes_by_host)
+    host_hash = identifier_hash_name (request->hostname);
+  if (stat_nodes_by_server)
+    server_hash = identifier_hash_name (request->server_name);
+  if (stat_nodes_by_script)
+    script_hash = identifier_hash_name (request->script_name);
 
   for (i = 0; i < stat_nodes_num; i++)
   {
     if ((stat_nodes[i].host != NULL)
-        && (strcmp (request->hostname, stat_nodes[i].host) != 0))
+        && ((stat_nodes[i].host_hash != host_hash)
+          || (strcmp (request->hostname, stat_nodes[i].host) != 0)))
       continue;
 
     if ((stat_nodes[i].server != NULL)
-      && (strcmp (request->server_name, stat_nodes[i].server) != 0))
+        && ((stat_nodes[i].server_hash != server_hash)
+          || (strcmp (request->server_name, stat_nodes[i].server) != 0)))
       continue;
 
     if ((stat_nodes[i].script != NULL)
-      && (strcmp (request->script_name, stat_nodes[i].script) != 0))
+        && ((stat_nodes[i].script_hash != script_hash)
+          || (strcmp (request->script_name, stat_nodes[i].script) != 0)))
       continue;
 
-    service_statnode_process(&stat_nodes[i], request);
+    service_statnode_process (nodes + i, request);
   }
-
-  pthread_mutex_unlock(&stat_nodes_lock);
 } /* }}} void service_process_request */
 
+static void *pinba_arena_alloc (void *data, size_t size) /* {{{ */
+{
+  pinba_arena_t *a = data;
+  pinba_chunk_t *c;
+
+  /* Keep every allocation aligned like the block itself. */
+  size = (size + 15) & ~((size_t) 15);
+  a->wanted += size;
+
+  if ((a->block_size - a->block_used) >= size)
+  {
+    void *ptr = a->block + a->block_used;
+    a->block_used += size;
+    return (ptr);
+  }
+
+  c = malloc (sizeof (*c) + size);
+  if (c == NULL)
+    return (NULL);
+  c->next = a->chunks;
+  a->chunks = c;
+
+  return (c + 1);
+} /* }}} void *pinba_arena_alloc */
+
+static void pinba_arena_free (void __attribute__((unused)) *data, /* {{{ */
+    void __attribute__((unused)) *ptr)
+{
+  /* Freed all at once by pinba_arena_reset(). */
+} /* }}} void pinba_arena_free */
+
+/* Releases everything allocated for the last packet. */
+static void pinba_arena_reset (pinba_arena_t *a) /* {{{ */
+{
+  while (a->chunks != NULL)
+  {
+    pinba_chunk_t *next = a->chunks->next;
+    sfree (a->chunks);
+    a->chunks = next;
+  }
+
+  if ((a->wanted > a->block_size) && (a->block_size < PINBA_ARENA_MAX_SIZE))
+  {
+    size_t size = (a->block_size > 0) ? a->block_size : PINBA_ARENA_SIZE;
+    char *tmp;
+
+    while ((size < a->wanted) && (size < PINBA_ARENA_MAX_SIZE))
+      size *= 2;
+
+    tmp = malloc (size);
+    if (tmp != NULL)
+    {
+      sfree (a->block);
+      a->block = tmp;
+      a->block_size = size;
+    }
+  }
+
+  a->block_used = 0;
+  a->wanted = 0;
+} /* }}} void pinba_arena_reset */
+
+static void pinba_arena_destroy (pinba_arena_t *a) /* {{{ */
+{
+  pinba_arena_reset (a);
+  sfree (a->block);
+  a->block_size = 0;
+} /* }}} void pinba_arena_destroy */
+
 static int pb_del_socket (pinba_socket_t *s, /* {{{ */
     nfds_t index)
 {
@@ -329,6 +538,23 @@ static int pb_add_socket (pinba_socket_t *s, /* {{{ */
         sstrerror (errno, errbuf, sizeof (errbuf)));
   }
 
+#ifdef SO_REUSEPORT
+  /* Let the kernel distribute packets among the sockets of the receive
+   * threads. */
+  if (conf_receive_threads > 1)
+  {
+    status = setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &tmp, sizeof (tmp));
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("pinba plugin: setsockopt(SO_REUSEPORT) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      close (fd);
+      return (0);
+    }
+  }
+#endif
+
   status = bind (fd, ai->ai_addr, ai->ai_addrlen);
   if (status != 0)
   {
@@ -426,83 +652,99 @@ static void pinba_socket_free (pinba_socket_t *socket) /* {{{ */
   sfree(socket);
 } /* }}} void pinba_socket_free */
 
-static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
-    size_t buffer_size)
+/* Decodes the packet into the arena and adds it to the counters of "r". The
+ * caller holds the lock of "r". */
+static int pinba_process_stats_packet (pinba_receiver_t *r, /* {{{ */
+    pinba_arena_t *arena, const uint8_t *buffer, size_t buffer_size)
 {
+  ProtobufCAllocator allocator;
   Pinba__Request *request;
 
-  request = pinba__request__unpack (NULL, buffer_size, buffer);
+  memset (&allocator, 0, sizeof (allocator));
+  allocator.alloc = pinba_arena_alloc;
+  allocator.free = pinba_arena_free;
+  allocator.allocator_data = arena;
 
-  if (!request)
-    return (-1);
+  request = pinba__request__unpack (&allocator, buffer_size, buffer);
+  if (request != NULL)
+    service_process_request (r->nodes, request);
 
-  service_process_request(request);
-  pinba__request__free_unpacked (request, NULL);
+  /* Frees "request", too. */
+  pinba_arena_reset (arena);
 
-  return (0);
+  return ((request != NULL) ? 0 : -1);
 } /* }}} int pinba_process_stats_packet */
 
-static int pinba_udp_read_callback_fn (int sock) /* {{{ */
+/* Reads and processes the packets waiting on "sock". "buffers" holds
+ * PINBA_RECEIVE_BATCH buffers of PINBA_UDP_BUFFER_SIZE bytes each. */
+static int pinba_udp_read_callback_fn (pinba_receiver_t *r, /* {{{ */
+    int sock, uint8_t *buffers, pinba_arena_t *arena)
 {
-  uint8_t buffer[PINBA_UDP_BUFFER_SIZE];
-  size_t buffer_size;
+  char *bufs[PINBA_RECEIVE_BATCH];
+  size_t lens[PINBA_RECEIVE_BATCH];
   int status;
+  int i;
+
+  for (i = 0; i < PINBA_RECEIVE_BATCH; i++)
+    bufs[i] = (char *) (buffers + i * PINBA_UDP_BUFFER_SIZE);
 
-  while (42)
+  status = recv_batch (sock, bufs, PINBA_UDP_BUFFER_SIZE, lens,
+      /* addrs = */ NULL, PINBA_RECEIVE_BATCH);
+  if (status < 0)
   {
-    buffer_size = sizeof (buffer);
-    status = recvfrom (sock, buffer, buffer_size - 1, MSG_DONTWAIT, /* from = */ NULL, /* from len = */ 0);
-    if (status < 0)
-    {
-      char errbuf[1024];
+    char errbuf[1024];
 
-      if ((errno == EINTR)
-#ifdef EWOULDBLOCK
-          || (errno == EWOULDBLOCK)
-#endif
-          || (errno == EAGAIN))
-      {
-        continue;
-      }
+    WARNING ("pinba plugin: recvfrom(2) failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
 
-      WARNING("pinba plugin: recvfrom(2) failed: %s",
-          sstrerror (errno, errbuf, sizeof (errbuf)));
-      return (-1);
-    }
-    else if (status == 0)
-    {
-      DEBUG ("pinba plugin: recvfrom(2) returned unexpected status zero.");
-      return (-1);
-    }
-    else /* if (status > 0) */
+  if (status == 0)
+    return (0);
+
+  pthread_mutex_lock (&r->lock);
+  for (i = 0; i < status; i++)
+  {
+    if (lens[i] == 0)
+      continue;
+
+    if (pinba_process_stats_packet (r, arena, (uint8_t *) bufs[i],
+          lens[i]) != 0)
     {
-      assert (((size_t) status) < buffer_size);
-      buffer_size = (size_t) status;
-      buffer[buffer_size] = 0;
-
-      status = pinba_process_stats_packet (buffer, buffer_size);
-      if (status != 0)
-        DEBUG("pinba plugin: Parsing packet failed.");
-      return (status);
+      DEBUG ("pinba plugin: Parsing packet failed.");
     }
-  } /* while (42) */
+  }
+  pthread_mutex_unlock (&r->lock);
 
-  /* not reached */
-  assert (23 == 42);
-  return (-1);
+  return (0);
 } /* }}} void pinba_udp_read_callback_fn */
 
-static int receive_loop (void) /* {{{ */
+static int receive_loop (pinba_receiver_t *r) /* {{{ */
 {
   pinba_socket_t *s;
+  pinba_arena_t arena;
+  uint8_t *buffers;
+
+  buffers = malloc (PINBA_RECEIVE_BATCH * PINBA_UDP_BUFFER_SIZE);
+  if (buffers == NULL)
+  {
+    ERROR ("pinba plugin: malloc failed.");
+    return (-1);
+  }
 
   s = pinba_socket_open (conf_node, conf_service);
   if (s == NULL)
   {
     ERROR ("pinba plugin: Collector thread is exiting prematurely.");
+    sfree (buffers);
     return (-1);
   }
 
+  memset (&arena, 0, sizeof (arena));
+  arena.block = malloc (PINBA_ARENA_SIZE);
+  if (arena.block != NULL)
+    arena.block_size = PINBA_ARENA_SIZE;
+
   while (!collector_thread_do_shutdown)
   {
     int status;
@@ -525,8 +767,7 @@ static int receive_loop (void) /* {{{ */
 
       ERROR ("pinba plugin: poll(2) failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
-      pinba_socket_free (s);
-      return (-1);
+      break;
     }
 
     for (i = 0; i < s->fd_num; i++)
@@ -538,27 +779,38 @@ static int receive_loop (void) /* {{{ */
       }
       else if (s->fd[i].revents & (POLLIN | POLLPRI))
       {
-        pinba_udp_read_callback_fn (s->fd[i].fd);
+        pinba_udp_read_callback_fn (r, s->fd[i].fd, buffers, &arena);
       }
     } /* for (s->fd) */
   } /* while (!collector_thread_do_shutdown) */
 
   pinba_socket_free (s);
   s = NULL;
+  pinba_arena_destroy (&arena);
+  sfree (buffers);
 
   return (0);
 } /* }}} int receive_loop */
 
 static void *collector_thread (void *arg) /* {{{ */
 {
-  receive_loop ();
-
-  memset (&collector_thread_id, 0, sizeof (collector_thread_id));
-  collector_thread_running = 0;
-  pthread_exit (NULL);
+  receive_loop (arg);
   return (NULL);
 } /* }}} void *collector_thread */
 
+static void receivers_free (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < receivers_num; i++)
+  {
+    sfree (receivers[i].nodes);
+    pthread_mutex_destroy (&receivers[i].lock);
+  }
+  sfree (receivers);
+  receivers_num = 0;
+} /* }}} void receivers_free */
+
 /*
  * Plugin declaration section
  */
@@ -622,6 +874,8 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
       cf_util_get_string (child, &conf_node);
     else if (strcasecmp ("Port", child->key) == 0)
       cf_util_get_service (child, &conf_service);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      cf_util_get_int (child, &conf_receive_threads);
     else if (strcasecmp ("View", child->key) == 0)
       pinba_config_view (child);
     else
@@ -630,11 +884,26 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
 
   pthread_mutex_unlock(&stat_nodes_lock);
 
+  if (conf_receive_threads < 1)
+  {
+    WARNING ("pinba plugin: ReceiveThreads must be at least 1.");
+    conf_receive_threads = 1;
+  }
+#ifndef SO_REUSEPORT
+  if (conf_receive_threads > 1)
+  {
+    WARNING ("pinba plugin: ReceiveThreads requires SO_REUSEPORT, which is "
+        "not available on this system. Using one receive thread.");
+    conf_receive_threads = 1;
+  }
+#endif
+
   return (0);
 } /* }}} int pinba_config */
 
 static int plugin_init (void) /* {{{ */
 {
+  size_t i;
   int status;
 
   if (stat_nodes == NULL)
@@ -646,45 +915,82 @@ static int plugin_init (void) /* {{{ */
         /* script = */ NULL);
   }
 
-  if (collector_thread_running)
+  if (receivers != NULL)
     return (0);
 
-  status = plugin_thread_create (&collector_thread_id,
-      /* attrs = */ NULL,
-      collector_thread,
-      /* args = */ NULL);
-  if (status != 0)
+  receivers = calloc ((size_t) conf_receive_threads, sizeof (*receivers));
+  if (receivers == NULL)
   {
-    char errbuf[1024];
-    ERROR ("pinba plugin: pthread_create(3) failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
+    ERROR ("pinba plugin: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < (size_t) conf_receive_threads; i++)
+  {
+    pinba_receiver_t *r = receivers + i;
+    unsigned int j;
+
+    r->nodes = calloc (stat_nodes_num, sizeof (*r->nodes));
+    if (r->nodes == NULL)
+    {
+      ERROR ("pinba plugin: calloc failed.");
+      break;
+    }
+    for (j = 0; j < stat_nodes_num; j++)
+      r->nodes[j].mem_peak = NAN;
+    pthread_mutex_init (&r->lock, /* attr = */ NULL);
+    receivers_num++;
+
+    status = plugin_thread_create (&r->id,
+        /* attrs = */ NULL,
+        collector_thread,
+        /* args = */ r);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("pinba plugin: pthread_create(3) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+    r->running = 1;
+  }
+
+  if ((receivers_num == 0) || !receivers[0].running)
+  {
+    receivers_free ();
     return (-1);
   }
-  collector_thread_running = 1;
 
   return (0);
 } /* }}} */
 
 static int plugin_shutdown (void) /* {{{ */
 {
-  if (collector_thread_running)
+  size_t i;
+
+  DEBUG ("pinba plugin: Shutting down collector threads.");
+  collector_thread_do_shutdown = 1;
+
+  for (i = 0; i < receivers_num; i++)
   {
     int status;
 
-    DEBUG ("pinba plugin: Shutting down collector thread.");
-    collector_thread_do_shutdown = 1;
+    if (!receivers[i].running)
+      continue;
 
-    status = pthread_join (collector_thread_id, /* retval = */ NULL);
+    status = pthread_join (receivers[i].id, /* retval = */ NULL);
     if (status != 0)
     {
       char errbuf[1024];
       ERROR ("pinba plugin: pthread_join(3) failed: %s",
           sstrerror (status, errbuf, sizeof (errbuf)));
     }
+    receivers[i].running = 0;
+  }
 
-    collector_thread_running = 0;
-    collector_thread_do_shutdown = 0;
-  } /* if (collector_thread_running) */
+  /* The read callback isn't called anymore. */
+  receivers_free ();
+  collector_thread_do_shutdown = 0;
 
   return (0);
 } /* }}} int plugin_shutdown */
@@ -29,6 +29,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_complain.h"
+#include "utils_latency.h"
 
 #include <pthread.h>
 #include <netinet/in.h>
@@ -38,6 +39,20 @@
 
 #include <oping.h>
 
+#if KERNEL_LINUX
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/socket.h>
+# include <netinet/ip.h>
+# include <netinet/ip_icmp.h>
+# include <netinet/icmp6.h>
+# define HAVE_PING_SOCKET_ENGINE 1
+#endif
+
+#if defined(HAVE_OPING_1_3) || HAVE_PING_SOCKET_ENGINE
+# define HAVE_PING_DEVICE 1
+#endif
+
 #ifndef NI_MAXHOST
 # define NI_MAXHOST 1025
 #endif
@@ -60,17 +75,29 @@ struct hostlist_s
   double latency_total;
   double latency_squared;
 
+  /* Histogram of the latencies, NULL unless percentiles are configured. */
+  latency_counter_t *latency;
+
+#if HAVE_PING_SOCKET_ENGINE
+  /* Address used by the socket engine. */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+#endif
+
   struct hostlist_s *next;
 };
 typedef struct hostlist_s hostlist_t;
 
+#define PING_ENGINE_LIBOPING 0
+#define PING_ENGINE_SOCKET   1
+
 /*
  * Private variables
  */
 static hostlist_t *hostlist_head = NULL;
 
 static char  *ping_source = NULL;
-#ifdef HAVE_OPING_1_3
+#if HAVE_PING_DEVICE
 static char  *ping_device = NULL;
 #endif
 static char  *ping_data = NULL;
@@ -78,6 +105,10 @@ static int    ping_ttl = PING_DEF_TTL;
 static double ping_interval = 1.0;
 static double ping_timeout = 0.9;
 static int    ping_max_missed = -1;
+static int    ping_engine = PING_ENGINE_LIBOPING;
+
+static double *ping_percentiles = NULL;
+static size_t  ping_percentiles_num = 0;
 
 static int             ping_thread_loop = 0;
 static int             ping_thread_error = 0;
@@ -89,14 +120,16 @@ static const char *config_keys[] =
 {
   "Host",
   "SourceAddress",
-#ifdef HAVE_OPING_1_3
+#if HAVE_PING_DEVICE
   "Device",
 #endif
   "Size",
   "TTL",
   "Interval",
   "Timeout",
-  "MaxMissed"
+  "MaxMissed",
+  "Engine",
+  "Percentile"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -150,6 +183,40 @@ static void time_calc (struct timespec *ts_dest, /* {{{ */
   time_normalize (ts_dest);
 } /* }}} void time_calc */
 
+/* Accounts one probe of `hl', with `latency' in milliseconds or less than
+ * zero if no reply arrived in time. Returns true if the host has to be
+ * resolved again because of MaxMissed. Must be called with ping_lock held. */
+static _Bool ping_host_record (hostlist_t *hl, double latency) /* {{{ */
+{
+  hl->pkg_sent++;
+  if (latency >= 0.0)
+  {
+    hl->pkg_recv++;
+    hl->latency_total += latency;
+    hl->latency_squared += (latency * latency);
+    if (hl->latency != NULL)
+      latency_counter_add (hl->latency, DOUBLE_TO_CDTIME_T (latency / 1000.0));
+
+    /* reset missed packages counter */
+    hl->pkg_missed = 0;
+  } else
+    hl->pkg_missed++;
+
+  /* if the host did not answer our last N packages, trigger a resolv. */
+  if ((ping_max_missed < 0)
+      || (hl->pkg_missed < ((uint32_t) ping_max_missed)))
+    return (0);
+
+  /* we reset the missed package counter here, since we only want to
+   * trigger a resolv every N packages and not every package _AFTER_ N
+   * missed packages */
+  hl->pkg_missed = 0;
+
+  WARNING ("ping plugin: host %s has not answered %d PING requests,"
+      " triggering resolve", hl->host, ping_max_missed);
+  return (1);
+} /* }}} _Bool ping_host_record */
+
 static int ping_dispatch_all (pingobj_t *pingobj) /* {{{ */
 {
   pingobj_iter_t *iter;
@@ -199,44 +266,22 @@ static int ping_dispatch_all (pingobj_t *pingobj) /* {{{ */
       continue;
     }
 
-    hl->pkg_sent++;
-    if (latency >= 0.0)
-    {
-      hl->pkg_recv++;
-      hl->latency_total += latency;
-      hl->latency_squared += (latency * latency);
+    if (!ping_host_record (hl, latency))
+      continue;
 
-      /* reset missed packages counter */
-      hl->pkg_missed = 0;
-    } else
-      hl->pkg_missed++;
-
-    /* if the host did not answer our last N packages, trigger a resolv. */
-    if ((ping_max_missed >= 0)
-        && (hl->pkg_missed >= ((uint32_t) ping_max_missed)))
-    { /* {{{ */
-      /* we reset the missed package counter here, since we only want to
-       * trigger a resolv every N packages and not every package _AFTER_ N
-       * missed packages */
-      hl->pkg_missed = 0;
-
-      WARNING ("ping plugin: host %s has not answered %d PING requests,"
-          " triggering resolve", hl->host, ping_max_missed);
-
-      /* we trigger the resolv simply be removeing and adding the host to our
-       * ping object */
-      status = ping_host_remove (pingobj, hl->host);
+    /* we trigger the resolv simply be removeing and adding the host to our
+     * ping object */
+    status = ping_host_remove (pingobj, hl->host);
+    if (status != 0)
+    {
+      WARNING ("ping plugin: ping_host_remove (%s) failed.", hl->host);
+    }
+    else
+    {
+      status = ping_host_add (pingobj, hl->host);
       if (status != 0)
-      {
-        WARNING ("ping plugin: ping_host_remove (%s) failed.", hl->host);
-      }
-      else
-      {
-        status = ping_host_add (pingobj, hl->host);
-        if (status != 0)
-          ERROR ("ping plugin: ping_host_add (%s) failed.", hl->host);
-      }
-    } /* }}} ping_max_missed */
+        ERROR ("ping plugin: ping_host_add (%s) failed.", hl->host);
+    }
   } /* }}} for (iter) */
 
   return (0);
@@ -376,6 +421,557 @@ static void *ping_thread (void *arg) /* {{{ */
   return ((void *) 0);
 } /* }}} void *ping_thread */
 
+#if HAVE_PING_SOCKET_ENGINE
+/*
+ * The socket engine sends the echo requests itself, one raw socket per
+ * address family. The probes of one interval are spread evenly across the
+ * interval, so large host sets don't send bursts, and every host is probed
+ * once per interval independent of the timeout. All probes share one ICMP
+ * identifier and are numbered consecutively, so the sequence number is the
+ * index of the probe in `slots'; a reply is matched by identifier, sequence
+ * number and source address. Since the probes time out in the order they
+ * were sent, expiring them only needs to look at the oldest one.
+ *
+ * The receive time is taken by the kernel (SO_TIMESTAMPNS), so the latency
+ * does not include the time the reply waited for this thread.
+ */
+#define PING_SLOTS_NUM 65536
+#define PING_DEF_DATA_SIZE 56
+#define PING_RECV_BUFFER_SIZE 65536
+
+struct ping_slot_s
+{
+  hostlist_t *hl;
+  cdtime_t sent;
+  _Bool pending;
+};
+typedef struct ping_slot_s ping_slot_t;
+
+struct ping_socket_engine_s
+{
+  int fd4;
+  int fd6;
+  uint16_t ident;
+
+  ping_slot_t *slots;
+  /* Sequence number of the oldest probe which may still be pending and
+   * number of probes from there to the next one. */
+  uint16_t oldest_seq;
+  uint32_t window;
+
+  char *packet;
+  size_t packet_size;
+
+  c_complain_t complaint;
+};
+typedef struct ping_socket_engine_s ping_socket_engine_t;
+
+static uint16_t ping_checksum (const void *buf, size_t len) /* {{{ */
+{
+  const uint8_t *ptr = buf;
+  uint32_t sum = 0;
+
+  while (len > 1)
+  {
+    sum += (((uint32_t) ptr[0]) << 8) | ((uint32_t) ptr[1]);
+    ptr += 2;
+    len -= 2;
+  }
+  if (len > 0)
+    sum += ((uint32_t) ptr[0]) << 8;
+
+  while ((sum >> 16) != 0)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+  return (htons ((uint16_t) ~sum));
+} /* }}} uint16_t ping_checksum */
+
+/* Resolves the address of `hl'. Returns zero on success. */
+static int ping_socket_resolve (hostlist_t *hl) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  int status;
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_DGRAM;
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+
+  hl->addrlen = 0;
+  status = getaddrinfo (hl->host, /* service = */ NULL, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    WARNING ("ping plugin: Resolving %s failed: %s", hl->host,
+        (status == EAI_SYSTEM) ? "system error" : gai_strerror (status));
+    return (-1);
+  }
+
+  if (ai_list->ai_addrlen <= sizeof (hl->addr))
+  {
+    memcpy (&hl->addr, ai_list->ai_addr, ai_list->ai_addrlen);
+    hl->addrlen = ai_list->ai_addrlen;
+  }
+  freeaddrinfo (ai_list);
+
+  return ((hl->addrlen > 0) ? 0 : -1);
+} /* }}} int ping_socket_resolve */
+
+static int ping_socket_open (int family) /* {{{ */
+{
+  int fd;
+  int tmp;
+
+  fd = socket (family, SOCK_RAW,
+      (family == AF_INET6) ? IPPROTO_ICMPV6 : IPPROTO_ICMP);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("ping plugin: Opening a raw %s socket failed: %s",
+        (family == AF_INET6) ? "IPv6" : "IPv4",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+  /* Large host sets send many probes per interval. */
+  tmp = 1024 * 1024;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &tmp, sizeof (tmp));
+
+#ifdef SO_TIMESTAMPNS
+  tmp = 1;
+  if (setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPNS, &tmp, sizeof (tmp)) != 0)
+    NOTICE ("ping plugin: Kernel receive timestamps are not available. "
+        "Replies will be timed when they are read.");
+#endif
+
+  tmp = ping_ttl;
+  if (family == AF_INET6)
+  {
+    struct icmp6_filter filter;
+
+    ICMP6_FILTER_SETBLOCKALL (&filter);
+    ICMP6_FILTER_SETPASS (ICMP6_ECHO_REPLY, &filter);
+    setsockopt (fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof (filter));
+    setsockopt (fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &tmp, sizeof (tmp));
+  }
+  else
+  {
+    setsockopt (fd, IPPROTO_IP, IP_TTL, &tmp, sizeof (tmp));
+  }
+
+#ifdef SO_BINDTODEVICE
+  if (ping_device != NULL)
+    if (setsockopt (fd, SOL_SOCKET, SO_BINDTODEVICE,
+          ping_device, strlen (ping_device) + 1) != 0)
+    {
+      char errbuf[1024];
+      ERROR ("ping plugin: Failed to set device: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+#endif
+
+  if (ping_source != NULL)
+  {
+    struct addrinfo ai_hints;
+    struct addrinfo *ai_list = NULL;
+
+    memset (&ai_hints, 0, sizeof (ai_hints));
+    ai_hints.ai_family = family;
+    ai_hints.ai_socktype = SOCK_DGRAM;
+
+    /* A source address of the other family is not an error. */
+    if (getaddrinfo (ping_source, NULL, &ai_hints, &ai_list) == 0)
+    {
+      if (bind (fd, ai_list->ai_addr, ai_list->ai_addrlen) != 0)
+      {
+        char errbuf[1024];
+        ERROR ("ping plugin: Failed to set source address: %s",
+            sstrerror (errno, errbuf, sizeof (errbuf)));
+      }
+      freeaddrinfo (ai_list);
+    }
+  }
+
+  return (fd);
+} /* }}} int ping_socket_open */
+
+/* Accounts the probe in `slot' as missed and frees it. Must be called with
+ * ping_lock held. */
+static void ping_socket_expire (ping_slot_t *slot) /* {{{ */
+{
+  if (!slot->pending)
+    return;
+
+  slot->pending = 0;
+  if (ping_host_record (slot->hl, -1.0))
+    ping_socket_resolve (slot->hl);
+} /* }}} void ping_socket_expire */
+
+/* Expires the probes sent before `now' - ping_timeout. Returns the time at
+ * which the oldest pending probe expires or zero if none is pending. */
+static cdtime_t ping_socket_expire_all (ping_socket_engine_t *e, /* {{{ */
+    cdtime_t now)
+{
+  cdtime_t timeout = DOUBLE_TO_CDTIME_T (ping_timeout);
+
+  while (e->window > 0)
+  {
+    ping_slot_t *slot = e->slots + e->oldest_seq;
+
+    if (slot->pending && ((slot->sent + timeout) > now))
+      return (slot->sent + timeout);
+
+    ping_socket_expire (slot);
+    e->oldest_seq++;
+    e->window--;
+  }
+
+  return (0);
+} /* }}} cdtime_t ping_socket_expire_all */
+
+static int ping_socket_send (ping_socket_engine_t *e, /* {{{ */
+    hostlist_t *hl)
+{
+  uint16_t seq;
+  ping_slot_t *slot;
+  ssize_t status;
+  int fd;
+
+  if ((hl->addrlen == 0) && (ping_socket_resolve (hl) != 0))
+  {
+    /* Count the probe as missed, so MaxMissed resolves the host again. */
+    ping_host_record (hl, -1.0);
+    return (-1);
+  }
+
+  fd = (hl->addr.ss_family == AF_INET6) ? e->fd6 : e->fd4;
+  if (fd < 0)
+  {
+    ping_host_record (hl, -1.0);
+    return (-1);
+  }
+
+  /* All sequence numbers are in use: the oldest probe is given up. */
+  if (e->window >= PING_SLOTS_NUM)
+  {
+    ping_socket_expire (e->slots + e->oldest_seq);
+    e->oldest_seq++;
+    e->window--;
+  }
+
+  seq = (uint16_t) (e->oldest_seq + e->window);
+  slot = e->slots + seq;
+
+  if (hl->addr.ss_family == AF_INET6)
+  {
+    struct icmp6_hdr *icmp6 = (struct icmp6_hdr *) e->packet;
+
+    /* The kernel computes the checksum of ICMPv6 packets. */
+    icmp6->icmp6_type = ICMP6_ECHO_REQUEST;
+    icmp6->icmp6_code = 0;
+    icmp6->icmp6_cksum = 0;
+    icmp6->icmp6_id = htons (e->ident);
+    icmp6->icmp6_seq = htons (seq);
+  }
+  else
+  {
+    struct icmphdr *icmp4 = (struct icmphdr *) e->packet;
+
+    icmp4->type = ICMP_ECHO;
+    icmp4->code = 0;
+    icmp4->checksum = 0;
+    icmp4->un.echo.id = htons (e->ident);
+    icmp4->un.echo.sequence = htons (seq);
+    icmp4->checksum = ping_checksum (e->packet, e->packet_size);
+  }
+
+  slot->hl = hl;
+  slot->sent = cdtime ();
+  slot->pending = 1;
+  e->window++;
+
+  status = sendto (fd, e->packet, e->packet_size, /* flags = */ 0,
+      (struct sockaddr *) &hl->addr, hl->addrlen);
+  if (status < 0)
+  {
+    /* The probe is counted as missed when it expires. */
+    char errbuf[1024];
+    c_complain (LOG_WARNING, &e->complaint, "ping plugin: sendto (%s) failed: %s",
+        hl->host, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  c_release (LOG_NOTICE, &e->complaint, "ping plugin: sendto succeeded.");
+  return (0);
+} /* }}} int ping_socket_send */
+
+static _Bool ping_socket_same_addr (const struct sockaddr_storage *a, /* {{{ */
+    const struct sockaddr_storage *b)
+{
+  if (a->ss_family != b->ss_family)
+    return (0);
+
+  if (a->ss_family == AF_INET6)
+    return (memcmp (&((const struct sockaddr_in6 *) a)->sin6_addr,
+          &((const struct sockaddr_in6 *) b)->sin6_addr,
+          sizeof (struct in6_addr)) == 0);
+
+  return (((const struct sockaddr_in *) a)->sin_addr.s_addr
+      == ((const struct sockaddr_in *) b)->sin_addr.s_addr);
+} /* }}} _Bool ping_socket_same_addr */
+
+/* Reads all replies queued on `fd'. Must be called with ping_lock held. */
+static void ping_socket_receive (ping_socket_engine_t *e, int fd, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  while (42)
+  {
+    struct sockaddr_storage from;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[256];
+    cdtime_t received = 0;
+    ssize_t len;
+    uint16_t ident;
+    uint16_t seq;
+    ping_slot_t *slot;
+
+    memset (&msg, 0, sizeof (msg));
+    iov.iov_base = buffer;
+    iov.iov_len = buffer_size;
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof (from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+
+    len = recvmsg (fd, &msg, /* flags = */ 0);
+    if ((len < 0) && (errno == EINTR))
+      continue;
+    else if (len < 0)
+      return;
+
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL;
+        cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+#ifdef SCM_TIMESTAMPNS
+      if ((cmsg->cmsg_level == SOL_SOCKET)
+          && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+      {
+        struct timespec ts;
+        memcpy (&ts, CMSG_DATA (cmsg), sizeof (ts));
+        received = TIMESPEC_TO_CDTIME_T (&ts);
+      }
+#endif
+    }
+    if (received == 0)
+      received = cdtime ();
+
+    if (from.ss_family == AF_INET6)
+    {
+      struct icmp6_hdr *icmp6 = (struct icmp6_hdr *) buffer;
+
+      if ((size_t) len < sizeof (*icmp6)
+          || (icmp6->icmp6_type != ICMP6_ECHO_REPLY))
+        continue;
+      ident = ntohs (icmp6->icmp6_id);
+      seq = ntohs (icmp6->icmp6_seq);
+    }
+    else
+    {
+      struct iphdr *ip = (struct iphdr *) buffer;
+      struct icmphdr *icmp4;
+      size_t ip_len;
+
+      /* Raw IPv4 sockets receive the IP header, too. */
+      if ((size_t) len < sizeof (*ip))
+        continue;
+      ip_len = 4 * ip->ihl;
+      if ((size_t) len < ip_len + sizeof (*icmp4))
+        continue;
+
+      icmp4 = (struct icmphdr *) (buffer + ip_len);
+      if (icmp4->type != ICMP_ECHOREPLY)
+        continue;
+      ident = ntohs (icmp4->un.echo.id);
+      seq = ntohs (icmp4->un.echo.sequence);
+    }
+
+    /* Replies to other processes, late or duplicate replies. */
+    slot = e->slots + seq;
+    if ((ident != e->ident) || !slot->pending
+        || !ping_socket_same_addr (&from, &slot->hl->addr))
+      continue;
+
+    slot->pending = 0;
+    if (received < slot->sent)
+      received = slot->sent;
+    if (ping_host_record (slot->hl,
+          1000.0 * CDTIME_T_TO_DOUBLE (received - slot->sent)))
+      ping_socket_resolve (slot->hl);
+  }
+} /* }}} void ping_socket_receive */
+
+static void ping_socket_engine_destroy (ping_socket_engine_t *e) /* {{{ */
+{
+  if (e->fd4 >= 0)
+    close (e->fd4);
+  if (e->fd6 >= 0)
+    close (e->fd6);
+  sfree (e->slots);
+  sfree (e->packet);
+} /* }}} void ping_socket_engine_destroy */
+
+static void *ping_thread_socket (void __attribute__((unused)) *arg) /* {{{ */
+{
+  ping_socket_engine_t e;
+  hostlist_t *hl;
+  hostlist_t *next_hl;
+  size_t hosts_num = 0;
+  size_t data_size;
+  char *buffer;
+  cdtime_t interval = DOUBLE_TO_CDTIME_T (ping_interval);
+  cdtime_t step;
+  cdtime_t next_send;
+  _Bool want4 = 0;
+  _Bool want6 = 0;
+
+  memset (&e, 0, sizeof (e));
+  C_COMPLAIN_INIT (&e.complaint);
+  e.fd4 = -1;
+  e.fd6 = -1;
+  e.ident = (uint16_t) ((getpid () ^ cdtime ()) & 0xFFFF);
+
+  for (hl = hostlist_head; hl != NULL; hl = hl->next)
+  {
+    hosts_num++;
+    if (ping_socket_resolve (hl) != 0)
+      continue;
+    if (hl->addr.ss_family == AF_INET6)
+      want6 = 1;
+    else
+      want4 = 1;
+  }
+
+  if (want4)
+    e.fd4 = ping_socket_open (AF_INET);
+  if (want6)
+    e.fd6 = ping_socket_open (AF_INET6);
+
+  data_size = (ping_data != NULL) ? strlen (ping_data) : PING_DEF_DATA_SIZE;
+  /* Both headers are eight bytes long. */
+  e.packet_size = sizeof (struct icmphdr) + data_size;
+  e.packet = calloc (1, e.packet_size);
+  e.slots = calloc (PING_SLOTS_NUM, sizeof (*e.slots));
+  buffer = malloc (PING_RECV_BUFFER_SIZE);
+
+  pthread_mutex_lock (&ping_lock);
+
+  if ((e.fd4 < 0) && (e.fd6 < 0))
+  {
+    ERROR ("ping plugin: No host could be added to ping object. Giving up.");
+    ping_thread_error = 1;
+    pthread_mutex_unlock (&ping_lock);
+    ping_socket_engine_destroy (&e);
+    sfree (buffer);
+    return ((void *) -1);
+  }
+
+  if ((e.packet == NULL) || (e.slots == NULL) || (buffer == NULL))
+  {
+    ERROR ("ping plugin: malloc failed.");
+    ping_thread_error = 1;
+    pthread_mutex_unlock (&ping_lock);
+    ping_socket_engine_destroy (&e);
+    sfree (buffer);
+    return ((void *) -1);
+  }
+
+  if (ping_data != NULL)
+    memcpy (e.packet + sizeof (struct icmphdr), ping_data, data_size);
+  else
+  {
+    size_t i;
+    for (i = 0; i < data_size; i++)
+      e.packet[sizeof (struct icmphdr) + i] = (char) ('0' + i % 64);
+  }
+
+  step = interval / hosts_num;
+  next_send = cdtime ();
+  next_hl = hostlist_head;
+
+  while (ping_thread_loop > 0)
+  {
+    struct pollfd fds[2];
+    nfds_t fds_num = 0;
+    cdtime_t now = cdtime ();
+    cdtime_t wakeup;
+    cdtime_t expiry;
+    int timeout_ms;
+
+    /* Don't send a burst of probes to catch up after falling behind. */
+    if ((now > next_send) && ((now - next_send) > interval))
+      next_send = now;
+
+    while (next_send <= now)
+    {
+      ping_socket_send (&e, next_hl);
+      next_hl = (next_hl->next != NULL) ? next_hl->next : hostlist_head;
+      next_send += step;
+    }
+
+    expiry = ping_socket_expire_all (&e, now);
+
+    wakeup = next_send;
+    if ((expiry != 0) && (expiry < wakeup))
+      wakeup = expiry;
+    timeout_ms = (int) CDTIME_T_TO_MS (wakeup - now) + 1;
+    if (timeout_ms > 1000)
+      timeout_ms = 1000;
+
+    if (e.fd4 >= 0)
+    {
+      fds[fds_num].fd = e.fd4;
+      fds[fds_num].events = POLLIN;
+      fds[fds_num].revents = 0;
+      fds_num++;
+    }
+    if (e.fd6 >= 0)
+    {
+      fds[fds_num].fd = e.fd6;
+      fds[fds_num].events = POLLIN;
+      fds[fds_num].revents = 0;
+      fds_num++;
+    }
+
+    pthread_mutex_unlock (&ping_lock);
+    poll (fds, fds_num, timeout_ms);
+    pthread_mutex_lock (&ping_lock);
+
+    if (ping_thread_loop <= 0)
+      break;
+
+    if (e.fd4 >= 0)
+      ping_socket_receive (&e, e.fd4, buffer, PING_RECV_BUFFER_SIZE);
+    if (e.fd6 >= 0)
+      ping_socket_receive (&e, e.fd6, buffer, PING_RECV_BUFFER_SIZE);
+  } /* while (ping_thread_loop > 0) */
+
+  pthread_mutex_unlock (&ping_lock);
+  ping_socket_engine_destroy (&e);
+  sfree (buffer);
+
+  return ((void *) 0);
+} /* }}} void *ping_thread_socket */
+#endif /* HAVE_PING_SOCKET_ENGINE */
+
 static int start_thread (void) /* {{{ */
 {
   int status;
@@ -391,7 +987,12 @@ static int start_thread (void) /* {{{ */
   ping_thread_loop = 1;
   ping_thread_error = 0;
   status = plugin_thread_create (&ping_thread_id, /* attr = */ NULL,
-      ping_thread, /* arg = */ (void *) 0);
+#if HAVE_PING_SOCKET_ENGINE
+      (ping_engine == PING_ENGINE_SOCKET) ? ping_thread_socket : ping_thread,
+#else
+      ping_thread,
+#endif
+      /* arg = */ (void *) 0);
   if (status != 0)
   {
     ping_thread_loop = 0;
@@ -450,6 +1051,24 @@ static int ping_init (void) /* {{{ */
         "Will use a timeout of %gs.", ping_timeout);
   }
 
+  if (ping_percentiles_num > 0)
+  {
+    hostlist_t *hl;
+
+    for (hl = hostlist_head; hl != NULL; hl = hl->next)
+    {
+      if (hl->latency != NULL)
+        continue;
+
+      hl->latency = latency_counter_create ();
+      if (hl->latency == NULL)
+      {
+        ERROR ("ping plugin: latency_counter_create failed.");
+        return (-1);
+      }
+    }
+  }
+
   if (start_thread () != 0)
     return (-1);
 
@@ -508,6 +1127,10 @@ static int ping_config (const char *key, const char *value) /* {{{ */
     hl->pkg_missed = 0;
     hl->latency_total = 0.0;
     hl->latency_squared = 0.0;
+    hl->latency = NULL;
+#if HAVE_PING_SOCKET_ENGINE
+    hl->addrlen = 0;
+#endif
     hl->next = hostlist_head;
     hostlist_head = hl;
   }
@@ -517,7 +1140,7 @@ static int ping_config (const char *key, const char *value) /* {{{ */
     if (status != 0)
       return (status);
   }
-#ifdef HAVE_OPING_1_3
+#if HAVE_PING_DEVICE
   else if (strcasecmp (key, "Device") == 0)
   {
     int status = config_set_string (key, &ping_device, value);
@@ -594,6 +1217,40 @@ static int ping_config (const char *key, const char *value) /* {{{ */
     if (ping_max_missed < 0)
       INFO ("ping plugin: MaxMissed < 0, disabled re-resolving of hosts");
   }
+  else if (strcasecmp (key, "Engine") == 0)
+  {
+    if (strcasecmp (value, "liboping") == 0)
+      ping_engine = PING_ENGINE_LIBOPING;
+#if HAVE_PING_SOCKET_ENGINE
+    else if (strcasecmp (value, "socket") == 0)
+      ping_engine = PING_ENGINE_SOCKET;
+#endif
+    else
+      WARNING ("ping plugin: Ignoring unknown engine \"%s\".", value);
+  }
+  else if (strcasecmp (key, "Percentile") == 0)
+  {
+    double percent = atof (value);
+    double *tmp;
+
+    if ((percent <= 0.0) || (percent >= 100.0))
+    {
+      WARNING ("ping plugin: Ignoring invalid percentile %g (%s)",
+          percent, value);
+      return (0);
+    }
+
+    tmp = realloc (ping_percentiles,
+        sizeof (*ping_percentiles) * (ping_percentiles_num + 1));
+    if (tmp == NULL)
+    {
+      ERROR ("ping plugin: realloc failed.");
+      return (1);
+    }
+    ping_percentiles = tmp;
+    ping_percentiles[ping_percentiles_num] = percent;
+    ping_percentiles_num++;
+  }
   else
   {
     return (-1);
@@ -624,6 +1281,7 @@ static void submit (const char *host, const char *type, /* {{{ */
 static int ping_read (void) /* {{{ */
 {
   hostlist_t *hl;
+  gauge_t *percentile_values = NULL;
 
   if (ping_thread_error != 0)
   {
@@ -637,6 +1295,8 @@ static int ping_read (void) /* {{{ */
       hl->pkg_recv = 0;
       hl->latency_total = 0.0;
       hl->latency_squared = 0.0;
+      if (hl->latency != NULL)
+        latency_counter_reset (hl->latency);
     }
 
     start_thread ();
@@ -644,6 +1304,17 @@ static int ping_read (void) /* {{{ */
     return (-1);
   } /* if (ping_thread_error != 0) */
 
+  if (ping_percentiles_num > 0)
+  {
+    percentile_values = calloc (ping_percentiles_num,
+        sizeof (*percentile_values));
+    if (percentile_values == NULL)
+    {
+      ERROR ("ping plugin: calloc failed.");
+      return (-1);
+    }
+  }
+
   for (hl = hostlist_head; hl != NULL; hl = hl->next) /* {{{ */
   {
     uint32_t pkg_sent;
@@ -670,6 +1341,17 @@ static int ping_read (void) /* {{{ */
     hl->latency_total = 0.0;
     hl->latency_squared = 0.0;
 
+    if ((percentile_values != NULL) && (hl->latency != NULL))
+    {
+      size_t i;
+
+      for (i = 0; i < ping_percentiles_num; i++)
+        percentile_values[i] = (pkg_recv == 0) ? NAN
+          : 1000.0 * CDTIME_T_TO_DOUBLE (latency_counter_get_percentile (
+                hl->latency, ping_percentiles[i]));
+      latency_counter_reset (hl->latency);
+    }
+
     pthread_mutex_unlock (&ping_lock);
 
     /* This e. g. happens when starting up. */
@@ -702,8 +1384,23 @@ static int ping_read (void) /* {{{ */
     submit (hl->host, "ping", latency_average);
     submit (hl->host, "ping_stddev", latency_stddev);
     submit (hl->host, "ping_droprate", droprate);
+
+    if ((percentile_values != NULL) && (hl->latency != NULL))
+    {
+      size_t i;
+
+      for (i = 0; i < ping_percentiles_num; i++)
+      {
+        char type_instance[DATA_MAX_NAME_LEN];
+
+        ssnprintf (type_instance, sizeof (type_instance), "%s-percentile-%g",
+            hl->host, ping_percentiles[i]);
+        submit (type_instance, "ping", percentile_values[i]);
+      }
+    }
   } /* }}} for (hl = hostlist_head; hl != NULL; hl = hl->next) */
 
+  sfree (percentile_values);
   return (0);
 } /* }}} int ping_read */
 
@@ -723,10 +1420,16 @@ static int ping_shutdown (void) /* {{{ */
     hl_next = hl->next;
 
     sfree (hl->host);
+    if (hl->latency != NULL)
+      latency_counter_destroy (hl->latency);
     sfree (hl);
 
     hl = hl_next;
   }
+  hostlist_head = NULL;
+
+  sfree (ping_percentiles);
+  ping_percentiles_num = 0;
 
   if (ping_data != NULL) {
     free (ping_data);
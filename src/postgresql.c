@@ -108,9 +108,25 @@ typedef struct {
 	char *name;
 	char *statement;
 	_Bool store_rates;
+
+	/* If set, values are streamed into this table with COPY instead of
+	 * running `statement' for each value list. */
+	char  *copy_table;
+	size_t copy_buffer_size;
 } c_psql_writer_t;
 
+/* Rows in the binary COPY format waiting to be sent for one writer. */
 typedef struct {
+	char    *data;
+	size_t   len;
+	size_t   size;
+	size_t   rows;
+	/* When the first row has been added. */
+	cdtime_t first;
+} c_psql_copy_t;
+
+typedef struct c_psql_database_s c_psql_database_t;
+struct c_psql_database_s {
 	PGconn      *conn;
 	c_complain_t conn_complaint;
 
@@ -124,8 +140,14 @@ typedef struct {
 	udb_query_t    **queries;
 	size_t           queries_num;
 
+	/* One of the C_PSQL_STMT_* values for each query, describing whether
+	 * it has been prepared on the current connection. */
+	int             *q_stmt_states;
+
 	c_psql_writer_t **writers;
 	size_t            writers_num;
+	/* One buffer for each writer; only used by COPY writers. */
+	c_psql_copy_t    *copies;
 
 	/* make sure we don't access the database object in parallel */
 	pthread_mutex_t   db_lock;
@@ -151,8 +173,42 @@ typedef struct {
 
 	char *service;
 
+	/* Set with "QueryTimeout"; sent as statement_timeout when connecting. */
+	cdtime_t query_timeout;
+	_Bool report_latency;
+
+	/* Additional connections running queries in parallel with the read
+	 * callback, see c_psql_read(). They share the configuration and the
+	 * queries of their parent database. Set with "Connections". */
+	int connections_num;
+	c_psql_database_t  *parent;
+	c_psql_database_t **pool;
+	size_t              pool_num;
+	pthread_t          *pool_threads;
+	size_t              pool_threads_num;
+
+	/* Protects the following members. Queries with an index below
+	 * `pool_jobs' and above or equal to `pool_next' are waiting for a
+	 * connection. */
+	pthread_mutex_t pool_lock;
+	pthread_cond_t  pool_cond;
+	pthread_cond_t  pool_done_cond;
+	size_t          pool_next;
+	size_t          pool_jobs;
+	size_t          pool_busy;
+	_Bool           pool_success;
+	_Bool           pool_shutdown;
+
 	int ref_cnt;
-} c_psql_database_t;
+};
+
+/* The query has not been prepared on this connection yet. */
+#define C_PSQL_STMT_NONE     0
+/* The query is a prepared statement named after its index. */
+#define C_PSQL_STMT_PREPARED 1
+/* Preparing the query failed, e.g. because it holds several commands. It is
+ * sent as text each time. */
+#define C_PSQL_STMT_FAILED   2
 
 static const char *const def_queries[] = {
 	"backends",
@@ -174,6 +230,8 @@ static size_t              queries_num   = 0;
 static c_psql_writer_t    *writers       = NULL;
 static size_t              writers_num   = 0;
 
+static int c_psql_copy_flush_all (c_psql_database_t *db, _Bool force);
+
 static int c_psql_begin (c_psql_database_t *db)
 {
 	PGresult *r = PQexec (db->conn, "BEGIN");
@@ -248,9 +306,11 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 	db->q_prep_areas   = NULL;
 	db->queries        = NULL;
 	db->queries_num    = 0;
+	db->q_stmt_states  = NULL;
 
 	db->writers        = NULL;
 	db->writers_num    = 0;
+	db->copies         = NULL;
 
 	pthread_mutex_init (&db->db_lock, /* attrs = */ NULL);
 
@@ -274,10 +334,106 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 
 	db->service    = NULL;
 
+	db->query_timeout  = 0;
+	db->report_latency = 0;
+
+	db->connections_num  = 1;
+	db->parent           = NULL;
+	db->pool             = NULL;
+	db->pool_num         = 0;
+	db->pool_threads     = NULL;
+	db->pool_threads_num = 0;
+
+	pthread_mutex_init (&db->pool_lock, /* attrs = */ NULL);
+	pthread_cond_init (&db->pool_cond, /* attrs = */ NULL);
+	pthread_cond_init (&db->pool_done_cond, /* attrs = */ NULL);
+	db->pool_next     = 0;
+	db->pool_jobs     = 0;
+	db->pool_busy     = 0;
+	db->pool_success  = 0;
+	db->pool_shutdown = 0;
+
 	db->ref_cnt    = 0;
 	return db;
 } /* c_psql_database_new */
 
+/* Creates an additional connection for the queries of `db'. */
+static c_psql_database_t *c_psql_pool_conn_new (c_psql_database_t *db)
+{
+	c_psql_database_t *conn;
+
+	conn = calloc (1, sizeof (*conn));
+	if (NULL == conn)
+		return NULL;
+
+	conn->conn = NULL;
+	C_COMPLAIN_INIT (&conn->conn_complaint);
+	pthread_mutex_init (&conn->db_lock, /* attrs = */ NULL);
+
+	conn->q_stmt_states = calloc (db->queries_num,
+			sizeof (*conn->q_stmt_states));
+	if (NULL == conn->q_stmt_states) {
+		pthread_mutex_destroy (&conn->db_lock);
+		sfree (conn);
+		return NULL;
+	}
+
+	/* Borrowed from the parent, which outlives its connections. */
+	conn->parent         = db;
+	conn->max_params_num = db->max_params_num;
+	conn->q_prep_areas   = db->q_prep_areas;
+	conn->queries        = db->queries;
+	conn->queries_num    = db->queries_num;
+	conn->interval       = db->interval;
+	conn->database       = db->database;
+	conn->host           = db->host;
+	conn->port           = db->port;
+	conn->user           = db->user;
+	conn->password       = db->password;
+	conn->instance       = db->instance;
+	conn->sslmode        = db->sslmode;
+	conn->krbsrvname     = db->krbsrvname;
+	conn->service        = db->service;
+	conn->query_timeout  = db->query_timeout;
+	conn->report_latency = db->report_latency;
+
+	return conn;
+} /* c_psql_pool_conn_new */
+
+static void c_psql_pool_conn_free (c_psql_database_t *conn)
+{
+	if (NULL == conn)
+		return;
+
+	PQfinish (conn->conn);
+	conn->conn = NULL;
+
+	pthread_mutex_destroy (&conn->db_lock);
+	sfree (conn->q_stmt_states);
+	sfree (conn);
+} /* c_psql_pool_conn_free */
+
+/* Stops the threads of the connection pool and closes its connections. */
+static void c_psql_pool_destroy (c_psql_database_t *db)
+{
+	size_t i;
+
+	pthread_mutex_lock (&db->pool_lock);
+	db->pool_shutdown = 1;
+	pthread_cond_broadcast (&db->pool_cond);
+	pthread_mutex_unlock (&db->pool_lock);
+
+	for (i = 0; i < db->pool_threads_num; ++i)
+		pthread_join (db->pool_threads[i], NULL);
+	sfree (db->pool_threads);
+	db->pool_threads_num = 0;
+
+	for (i = 0; i < db->pool_num; ++i)
+		c_psql_pool_conn_free (db->pool[i]);
+	sfree (db->pool);
+	db->pool_num = 0;
+} /* c_psql_pool_destroy */
+
 static void c_psql_database_delete (void *data)
 {
 	size_t i;
@@ -289,9 +445,13 @@ static void c_psql_database_delete (void *data)
 	if (db->ref_cnt > 0)
 		return;
 
+	c_psql_pool_destroy (db);
+
 	/* wait for the lock to be released by the last writer */
 	pthread_mutex_lock (&db->db_lock);
 
+	c_psql_copy_flush_all (db, /* force = */ 1);
+
 	if (db->next_commit > 0)
 		c_psql_commit (db);
 
@@ -302,10 +462,16 @@ static void c_psql_database_delete (void *data)
 		for (i = 0; i < db->queries_num; ++i)
 			udb_query_delete_preparation_area (db->q_prep_areas[i]);
 	free (db->q_prep_areas);
+	sfree (db->q_stmt_states);
 
 	sfree (db->queries);
 	db->queries_num = 0;
 
+	if (db->copies != NULL)
+		for (i = 0; i < db->writers_num; ++i)
+			sfree (db->copies[i].data);
+	sfree (db->copies);
+
 	sfree (db->writers);
 	db->writers_num = 0;
 
@@ -313,6 +479,10 @@ static void c_psql_database_delete (void *data)
 
 	pthread_mutex_destroy (&db->db_lock);
 
+	pthread_mutex_destroy (&db->pool_lock);
+	pthread_cond_destroy (&db->pool_cond);
+	pthread_cond_destroy (&db->pool_done_cond);
+
 	sfree (db->database);
 	sfree (db->host);
 	sfree (db->port);
@@ -358,11 +528,31 @@ static int c_psql_connect (c_psql_database_t *db)
 	C_PSQL_PAR_APPEND (buf, buf_len, "krbsrvname", db->krbsrvname);
 	C_PSQL_PAR_APPEND (buf, buf_len, "service",    db->service);
 
+	if (db->query_timeout > 0) {
+		char options[64];
+
+		ssnprintf (options, sizeof (options), "-c statement_timeout=%llu",
+				(unsigned long long) CDTIME_T_TO_MS (db->query_timeout));
+		C_PSQL_PAR_APPEND (buf, buf_len, "options", options);
+	}
+
 	db->conn = PQconnectdb (conninfo);
 	db->proto_version = PQprotocolVersion (db->conn);
 	return 0;
 } /* c_psql_connect */
 
+/* Forgets the prepared statements of the connection. */
+static void c_psql_reset_statements (c_psql_database_t *db)
+{
+	size_t i;
+
+	if (db->q_stmt_states == NULL)
+		return;
+
+	for (i = 0; i < db->queries_num; ++i)
+		db->q_stmt_states[i] = C_PSQL_STMT_NONE;
+} /* c_psql_reset_statements */
+
 static int c_psql_check_connection (c_psql_database_t *db)
 {
 	_Bool init = 0;
@@ -375,10 +565,12 @@ static int c_psql_check_connection (c_psql_database_t *db)
 			db->conn_complaint.interval = 1;
 
 		c_psql_connect (db);
+		c_psql_reset_statements (db);
 	}
 
 	if (CONNECTION_OK != PQstatus (db->conn)) {
 		PQreset (db->conn);
+		c_psql_reset_statements (db);
 
 		/* trigger c_release() */
 		if (0 == db->conn_complaint.interval)
@@ -426,14 +618,51 @@ static PGresult *c_psql_exec_query_noparams (c_psql_database_t *db,
 	return PQexec (db->conn, udb_query_get_statement (q));
 } /* c_psql_exec_query_noparams */
 
+/* Prepares the query `q' as statement `stmt_name' unless that has been done
+ * on this connection already. Returns true if the statement can be used. */
+static _Bool c_psql_prepare_query (c_psql_database_t *db, udb_query_t *q,
+		int *stmt_state, const char *stmt_name, int params_num)
+{
+	PGresult *res;
+
+	if (C_PSQL_STMT_NONE != *stmt_state)
+		return (C_PSQL_STMT_PREPARED == *stmt_state);
+
+	res = PQprepare (db->conn, stmt_name, udb_query_get_statement (q),
+			params_num, /* param types = */ NULL);
+	if (PGRES_COMMAND_OK == PQresultStatus (res)) {
+		*stmt_state = C_PSQL_STMT_PREPARED;
+	}
+	else if (CONNECTION_OK == PQstatus (db->conn)) {
+		/* Send the query as text from now on. If the connection failed,
+		 * the state is reset when it is established again. */
+		log_info ("Preparing query \"%s\" failed, sending it as text: %s",
+				udb_query_get_name (q), PQerrorMessage (db->conn));
+		*stmt_state = C_PSQL_STMT_FAILED;
+	}
+	PQclear (res);
+
+	return (C_PSQL_STMT_PREPARED == *stmt_state);
+} /* c_psql_prepare_query */
+
 static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
-		udb_query_t *q, c_psql_user_data_t *data)
+		udb_query_t *q, c_psql_user_data_t *data, int *stmt_state,
+		const char *stmt_name)
 {
-	const char *params[db->max_params_num];
+	const char *params[(db->max_params_num > 0) ? db->max_params_num : 1];
 	char        interval[64];
+	int         params_num;
 	int         i;
 
-	if ((data == NULL) || (data->params_num == 0))
+	params_num = (data != NULL) ? data->params_num : 0;
+
+	/* Queries are parsed and planned once per connection only. */
+	if (c_psql_prepare_query (db, q, stmt_state, stmt_name, params_num)) {
+		if (0 == params_num)
+			return PQexecPrepared (db->conn, stmt_name, 0, NULL,
+					NULL, NULL, /* return text data */ 0);
+	}
+	else if (0 == params_num)
 		return (c_psql_exec_query_noparams (db, q));
 
 	assert (db->max_params_num >= data->params_num);
@@ -465,16 +694,35 @@ static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
 		}
 	}
 
+	if (C_PSQL_STMT_PREPARED == *stmt_state)
+		return PQexecPrepared (db->conn, stmt_name, data->params_num,
+				(const char *const *) params,
+				NULL, NULL, /* return text data */ 0);
+
 	return PQexecParams (db->conn, udb_query_get_statement (q),
 			data->params_num, NULL,
 			(const char *const *) params,
 			NULL, NULL, /* return text data */ 0);
 } /* c_psql_exec_query_params */
 
-/* db->db_lock must be locked when calling this function */
-static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
-		udb_query_preparation_area_t *prep_area)
+/* Returns the host name to report the values of `db' with. */
+static const char *c_psql_value_host (c_psql_database_t *db)
+{
+	if (C_PSQL_IS_UNIX_DOMAIN_SOCKET (db->host)
+			|| (0 == strcmp (db->host, "127.0.0.1"))
+			|| (0 == strcmp (db->host, "localhost")))
+		return hostname_g;
+	return db->host;
+} /* c_psql_value_host */
+
+/* db->db_lock must be locked when calling this function. `idx' is the index
+ * of the query in db->queries. */
+static int c_psql_exec_query (c_psql_database_t *db, size_t idx)
 {
+	udb_query_t *q = db->queries[idx];
+	udb_query_preparation_area_t *prep_area = db->q_prep_areas[idx];
+	char stmt_name[32];
+
 	PGresult *res;
 
 	c_psql_user_data_t *data;
@@ -492,9 +740,13 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 	/* The user data may hold parameter information, but may be NULL. */
 	data = udb_query_get_user_data (q);
 
-	/* Versions up to `3' don't know how to handle parameters. */
+	ssnprintf (stmt_name, sizeof (stmt_name), "collectd_query_%zu", idx);
+
+	/* Versions up to `3' don't know how to handle parameters or prepared
+	 * statements. */
 	if (3 <= db->proto_version)
-		res = c_psql_exec_query_params (db, q, data);
+		res = c_psql_exec_query_params (db, q, data,
+				&db->q_stmt_states[idx], stmt_name);
 	else if ((NULL == data) || (0 == data->params_num))
 		res = c_psql_exec_query_noparams (db, q);
 	else {
@@ -520,9 +772,17 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 		if ((CONNECTION_OK != PQstatus (db->conn))
 				&& (0 == c_psql_check_connection (db))) {
 			PQclear (res);
-			return c_psql_exec_query (db, q, prep_area);
+			return c_psql_exec_query (db, idx);
 		}
 
+		/* The statement has been dropped, e.g. by "DISCARD ALL" of a
+		 * connection pooler; prepare it again next time. */
+		if ((C_PSQL_STMT_PREPARED == db->q_stmt_states[idx])
+				&& (NULL != PQresultErrorField (res, PG_DIAG_SQLSTATE))
+				&& (0 == strcmp ("26000",
+						PQresultErrorField (res, PG_DIAG_SQLSTATE))))
+			db->q_stmt_states[idx] = C_PSQL_STMT_NONE;
+
 		log_err ("Failed to execute SQL query: %s",
 				PQerrorMessage (db->conn));
 		log_info ("SQL query was: %s",
@@ -566,12 +826,7 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 		}
 	}
 
-	if (C_PSQL_IS_UNIX_DOMAIN_SOCKET (db->host)
-			|| (0 == strcmp (db->host, "127.0.0.1"))
-			|| (0 == strcmp (db->host, "localhost")))
-		host = hostname_g;
-	else
-		host = db->host;
+	host = c_psql_value_host (db);
 
 	status = udb_query_prepare_result (q, prep_area, host, "postgresql",
 			db->instance, column_names, (size_t) column_num, db->interval);
@@ -610,6 +865,148 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 #undef BAIL_OUT
 } /* c_psql_exec_query */
 
+static void c_psql_submit_latency (c_psql_database_t *db, udb_query_t *q,
+		cdtime_t latency)
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	values[0].gauge = CDTIME_T_TO_DOUBLE (latency);
+
+	vl.values = values;
+	vl.values_len = 1;
+	if (db->interval > 0)
+		vl.interval = db->interval;
+
+	sstrncpy (vl.host, c_psql_value_host (db), sizeof (vl.host));
+	sstrncpy (vl.plugin, "postgresql", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, db->instance, sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, "response_time", sizeof (vl.type));
+	sstrncpy (vl.type_instance, udb_query_get_name (q),
+			sizeof (vl.type_instance));
+
+	plugin_dispatch_values (&vl);
+} /* c_psql_submit_latency */
+
+/* Runs query `idx' if it is suitable for the server. Returns zero on
+ * success, a positive value if the query has been skipped and a negative
+ * value on error. db->db_lock must be locked when calling this function. */
+static int c_psql_run_query (c_psql_database_t *db, size_t idx)
+{
+	udb_query_t *q = db->queries[idx];
+	cdtime_t start;
+	int status;
+
+	if ((0 != db->server_version)
+			&& (udb_query_check_version (q, db->server_version) <= 0))
+		return 1;
+
+	start = cdtime ();
+	status = c_psql_exec_query (db, idx);
+	if ((0 == status) && db->report_latency)
+		c_psql_submit_latency (db, q, cdtime () - start);
+
+	return status;
+} /* c_psql_run_query */
+
+/* Takes the next query of the current read of `db' and runs it on `conn',
+ * which is `db' itself or one of its pool connections. Returns false if there
+ * is no query left. Must be called with db->pool_lock held, which is released
+ * while the query runs. */
+static _Bool c_psql_pool_run_next (c_psql_database_t *db,
+		c_psql_database_t *conn)
+{
+	size_t idx;
+	int status;
+
+	if (db->pool_next >= db->pool_jobs)
+		return 0;
+
+	idx = db->pool_next;
+	db->pool_next++;
+	db->pool_busy++;
+	pthread_mutex_unlock (&db->pool_lock);
+
+	pthread_mutex_lock (&conn->db_lock);
+	status = c_psql_check_connection (conn);
+	if (0 == status)
+		status = c_psql_run_query (conn, idx);
+	pthread_mutex_unlock (&conn->db_lock);
+
+	pthread_mutex_lock (&db->pool_lock);
+	db->pool_busy--;
+	if (0 == status)
+		db->pool_success = 1;
+	pthread_cond_broadcast (&db->pool_done_cond);
+
+	return 1;
+} /* c_psql_pool_run_next */
+
+static void *c_psql_pool_thread (void *arg)
+{
+	c_psql_database_t *conn = arg;
+	c_psql_database_t *db = conn->parent;
+
+	pthread_mutex_lock (&db->pool_lock);
+	while (! db->pool_shutdown) {
+		if (! c_psql_pool_run_next (db, conn))
+			pthread_cond_wait (&db->pool_cond, &db->pool_lock);
+	}
+	pthread_mutex_unlock (&db->pool_lock);
+
+	return NULL;
+} /* c_psql_pool_thread */
+
+static void c_psql_pool_start (c_psql_database_t *db)
+{
+	size_t i;
+
+	db->pool_threads = calloc (db->pool_num, sizeof (*db->pool_threads));
+	if (NULL == db->pool_threads) {
+		log_err ("Out of memory.");
+		return;
+	}
+
+	for (i = 0; i < db->pool_num; ++i) {
+		if (0 != plugin_thread_create (&db->pool_threads[i], NULL,
+					c_psql_pool_thread, db->pool[i])) {
+			char errbuf[1024];
+			log_err ("pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+	}
+	db->pool_threads_num = i;
+} /* c_psql_pool_start */
+
+/* Hands the queries of `db' to the connection pool, runs queries on the
+ * database's own connection as well and waits until all of them are done. */
+static int c_psql_read_pool (c_psql_database_t *db)
+{
+	_Bool success;
+
+	if (NULL == db->pool_threads)
+		c_psql_pool_start (db);
+
+	pthread_mutex_lock (&db->pool_lock);
+	db->pool_next = 0;
+	db->pool_jobs = db->queries_num;
+	db->pool_success = 0;
+	pthread_cond_broadcast (&db->pool_cond);
+
+	while (c_psql_pool_run_next (db, db))
+		/* nothing */;
+
+	while (db->pool_busy > 0)
+		pthread_cond_wait (&db->pool_done_cond, &db->pool_lock);
+
+	db->pool_jobs = 0;
+	success = db->pool_success;
+	pthread_mutex_unlock (&db->pool_lock);
+
+	return success ? 0 : -1;
+} /* c_psql_read_pool */
+
 static int c_psql_read (user_data_t *ud)
 {
 	c_psql_database_t *db;
@@ -628,6 +1025,9 @@ static int c_psql_read (user_data_t *ud)
 	assert (NULL != db->instance);
 	assert (NULL != db->queries);
 
+	if (db->pool_num > 0)
+		return c_psql_read_pool (db);
+
 	pthread_mutex_lock (&db->db_lock);
 
 	if (0 != c_psql_check_connection (db)) {
@@ -637,17 +1037,7 @@ static int c_psql_read (user_data_t *ud)
 
 	for (i = 0; i < db->queries_num; ++i)
 	{
-		udb_query_preparation_area_t *prep_area;
-		udb_query_t *q;
-
-		prep_area = db->q_prep_areas[i];
-		q = db->queries[i];
-
-		if ((0 != db->server_version)
-				&& (udb_query_check_version (q, db->server_version) <= 0))
-			continue;
-
-		if (0 == c_psql_exec_query (db, q, prep_area))
+		if (0 == c_psql_run_query (db, i))
 			success = 1;
 	}
 
@@ -821,11 +1211,331 @@ static char *values_to_sqlarray (const data_set_t *ds, const value_list_t *vl,
 	return string;
 } /* values_to_sqlarray */
 
-static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
-		user_data_t *ud)
+/*
+ * COPY writers send the value lists of a batch as rows of the binary COPY
+ * format, which the server loads without parsing or planning a statement
+ * for each of them. The table must have the columns
+ *   (time timestamptz, host text, plugin text, plugin_instance text,
+ *    type text, type_instance text, dsnames text[], dstypes text[],
+ *    values float8[])
+ */
+#define C_PSQL_OID_TEXT   25
+#define C_PSQL_OID_FLOAT8 701
+
+/* Microseconds between the UNIX epoch and the PostgreSQL epoch
+ * (2000-01-01 00:00:00 UTC). */
+#define C_PSQL_EPOCH_OFFSET_US INT64_C(946684800000000)
+
+#define C_PSQL_COPY_BUFFER_SIZE (1024 * 1024)
+
+static int c_psql_copy_reserve (c_psql_copy_t *c, size_t n)
 {
-	c_psql_database_t *db;
+	char *tmp;
+	size_t size;
+
+	if (c->len + n <= c->size)
+		return 0;
+
+	size = (c->size > 0) ? 2 * c->size : 4096;
+	while (size < c->len + n)
+		size *= 2;
+
+	tmp = realloc (c->data, size);
+	if (tmp == NULL)
+		return ENOMEM;
+
+	c->data = tmp;
+	c->size = size;
+	return 0;
+} /* c_psql_copy_reserve */
+
+/* The following functions require the space to have been reserved. */
+static void c_psql_copy_put (c_psql_copy_t *c, const void *data, size_t n)
+{
+	memcpy (c->data + c->len, data, n);
+	c->len += n;
+} /* c_psql_copy_put */
+
+static void c_psql_copy_put_int (c_psql_copy_t *c, uint64_t v, size_t n)
+{
+	size_t i;
+
+	/* network byte order */
+	for (i = 0; i < n; ++i)
+		c->data[c->len + i] = (char) ((v >> (8 * (n - i - 1))) & 0xff);
+	c->len += n;
+} /* c_psql_copy_put_int */
+
+#define COPY_PUT_INT16(c, v) c_psql_copy_put_int ((c), (uint64_t) (v), 2)
+#define COPY_PUT_INT32(c, v) c_psql_copy_put_int ((c), (uint64_t) (v), 4)
+#define COPY_PUT_INT64(c, v) c_psql_copy_put_int ((c), (uint64_t) (v), 8)
+
+/* Appends a text field, or NULL if `str' is NULL or empty. */
+static int c_psql_copy_put_text (c_psql_copy_t *c, const char *str)
+{
+	size_t len = ((str == NULL) || (*str == '\0')) ? 0 : strlen (str);
+
+	if (0 != c_psql_copy_reserve (c, 4 + len))
+		return ENOMEM;
+
+	if (len == 0) {
+		COPY_PUT_INT32 (c, -1);
+		return 0;
+	}
+
+	COPY_PUT_INT32 (c, len);
+	c_psql_copy_put (c, str, len);
+	return 0;
+} /* c_psql_copy_put_text */
+
+/* Appends a one-dimensional text array field. */
+static int c_psql_copy_put_text_array (c_psql_copy_t *c,
+		const char **strs, size_t num)
+{
+	size_t len = 20;
+	size_t i;
+
+	for (i = 0; i < num; ++i)
+		len += 4 + strlen (strs[i]);
+
+	if (0 != c_psql_copy_reserve (c, 4 + len))
+		return ENOMEM;
+
+	COPY_PUT_INT32 (c, len);
+	COPY_PUT_INT32 (c, 1); /* dimensions */
+	COPY_PUT_INT32 (c, 0); /* has nulls */
+	COPY_PUT_INT32 (c, C_PSQL_OID_TEXT);
+	COPY_PUT_INT32 (c, num);
+	COPY_PUT_INT32 (c, 1); /* lower bound */
+
+	for (i = 0; i < num; ++i) {
+		size_t n = strlen (strs[i]);
+
+		COPY_PUT_INT32 (c, n);
+		c_psql_copy_put (c, strs[i], n);
+	}
+	return 0;
+} /* c_psql_copy_put_text_array */
+
+/* Appends a one-dimensional float8 array field. NaN becomes NULL. */
+static int c_psql_copy_put_float_array (c_psql_copy_t *c,
+		const gauge_t *values, size_t num)
+{
+	_Bool has_null = 0;
+	size_t len = 20;
+	size_t i;
+
+	for (i = 0; i < num; ++i) {
+		if (isnan (values[i])) {
+			has_null = 1;
+			len += 4;
+		}
+		else
+			len += 4 + 8;
+	}
+
+	if (0 != c_psql_copy_reserve (c, 4 + len))
+		return ENOMEM;
+
+	COPY_PUT_INT32 (c, len);
+	COPY_PUT_INT32 (c, 1);
+	COPY_PUT_INT32 (c, has_null ? 1 : 0);
+	COPY_PUT_INT32 (c, C_PSQL_OID_FLOAT8);
+	COPY_PUT_INT32 (c, num);
+	COPY_PUT_INT32 (c, 1);
+
+	for (i = 0; i < num; ++i) {
+		uint64_t bits;
+
+		if (isnan (values[i])) {
+			COPY_PUT_INT32 (c, -1);
+			continue;
+		}
+
+		memcpy (&bits, values + i, sizeof (bits));
+		COPY_PUT_INT32 (c, 8);
+		COPY_PUT_INT64 (c, bits);
+	}
+	return 0;
+} /* c_psql_copy_put_float_array */
+
+/* Appends `vl' as one row to the buffer. On error, the buffer is left as it
+ * was before. */
+static int c_psql_copy_append (c_psql_copy_t *c, c_psql_writer_t *writer,
+		const data_set_t *ds, const value_list_t *vl)
+{
+	const char *names[ds->ds_num];
+	const char *types[ds->ds_num];
+	gauge_t     values[ds->ds_num];
+	gauge_t    *rates = NULL;
+	size_t      old_len = c->len;
+	int64_t     time_us;
+	size_t      i;
 
+	for (i = 0; i < ds->ds_num; ++i) {
+		names[i] = ds->ds[i].name;
+
+		if (ds->ds[i].type == DS_TYPE_GAUGE) {
+			types[i] = DS_TYPE_TO_STRING (ds->ds[i].type);
+			values[i] = vl->values[i].gauge;
+			continue;
+		}
+
+		if (writer->store_rates) {
+			if (rates == NULL)
+				rates = uc_get_rate (ds, vl);
+			if (rates == NULL) {
+				log_err ("c_psql_write: Failed to determine rate");
+				return -1;
+			}
+			types[i] = "gauge";
+			values[i] = rates[i];
+			continue;
+		}
+
+		types[i] = DS_TYPE_TO_STRING (ds->ds[i].type);
+		if (ds->ds[i].type == DS_TYPE_COUNTER)
+			values[i] = (gauge_t) vl->values[i].counter;
+		else if (ds->ds[i].type == DS_TYPE_DERIVE)
+			values[i] = (gauge_t) vl->values[i].derive;
+		else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+			values[i] = (gauge_t) vl->values[i].absolute;
+		else {
+			log_err ("c_psql_write: Unknown data source type: %i",
+					ds->ds[i].type);
+			sfree (rates);
+			return -1;
+		}
+	}
+	sfree (rates);
+
+	time_us = (int64_t) CDTIME_T_TO_US (vl->time) - C_PSQL_EPOCH_OFFSET_US;
+
+	if (0 != c_psql_copy_reserve (c, 2 + 4 + 8))
+		goto nomem;
+	COPY_PUT_INT16 (c, 9); /* number of fields */
+	COPY_PUT_INT32 (c, 8);
+	COPY_PUT_INT64 (c, time_us);
+
+	if ((0 != c_psql_copy_put_text (c, vl->host))
+			|| (0 != c_psql_copy_put_text (c, vl->plugin))
+			|| (0 != c_psql_copy_put_text (c, vl->plugin_instance))
+			|| (0 != c_psql_copy_put_text (c, vl->type))
+			|| (0 != c_psql_copy_put_text (c, vl->type_instance))
+			|| (0 != c_psql_copy_put_text_array (c, names, ds->ds_num))
+			|| (0 != c_psql_copy_put_text_array (c, types, ds->ds_num))
+			|| (0 != c_psql_copy_put_float_array (c, values, ds->ds_num)))
+		goto nomem;
+
+	if (c->rows == 0)
+		c->first = cdtime ();
+	c->rows++;
+	return 0;
+
+nomem:
+	log_err ("c_psql_write: Out of memory.");
+	c->len = old_len;
+	return -1;
+} /* c_psql_copy_append */
+
+/* Sends the rows in `c' in one COPY command. The rows are dropped if that
+ * fails. db->db_lock must be locked when calling this function. */
+static int c_psql_copy_flush (c_psql_database_t *db, c_psql_writer_t *writer,
+		c_psql_copy_t *c)
+{
+	/* signature, flags and length of the header extension */
+	static const char header[19] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+	static const char trailer[2] = "\377\377";
+
+	char command[1024];
+	PGresult *res;
+	_Bool ok = 0;
+	int attempt;
+
+	if (c->rows == 0)
+		return 0;
+
+	ssnprintf (command, sizeof (command), "COPY %s (time, host, plugin, "
+			"plugin_instance, type, type_instance, dsnames, dstypes, values) "
+			"FROM STDIN (FORMAT binary)", writer->copy_table);
+
+	for (attempt = 0; (attempt < 2) && !ok; ++attempt) {
+		res = PQexec (db->conn, command);
+		if (PGRES_COPY_IN == PQresultStatus (res)) {
+			PQclear (res);
+
+			if ((1 == PQputCopyData (db->conn, header, sizeof (header)))
+					&& (1 == PQputCopyData (db->conn, c->data, (int) c->len))
+					&& (1 == PQputCopyData (db->conn, trailer, sizeof (trailer))))
+				PQputCopyEnd (db->conn, NULL);
+			else
+				PQputCopyEnd (db->conn, "collectd failed to send the data");
+
+			res = PQgetResult (db->conn);
+			ok = (PGRES_COMMAND_OK == PQresultStatus (res));
+		}
+		PQclear (res);
+
+		/* Read the remaining results to make the connection usable. */
+		while ((res = PQgetResult (db->conn)) != NULL)
+			PQclear (res);
+
+		/* try again once if the connection has been lost */
+		if (ok || (CONNECTION_OK == PQstatus (db->conn))
+				|| (0 != c_psql_check_connection (db)))
+			break;
+	}
+
+	if (! ok) {
+		log_err ("Failed to copy %zu rows into %s: %s", c->rows,
+				writer->copy_table, PQerrorMessage (db->conn));
+
+		/* this will abort any current transaction -> restart */
+		if (db->next_commit > 0)
+			c_psql_commit (db);
+	}
+
+	c->len = 0;
+	c->rows = 0;
+	c->first = 0;
+	return ok ? 0 : -1;
+} /* c_psql_copy_flush */
+
+/* Flushes the COPY buffers which are full or older than the commit interval;
+ * with `force', all of them. db->db_lock must be locked when calling this
+ * function. */
+static int c_psql_copy_flush_all (c_psql_database_t *db, _Bool force)
+{
+	cdtime_t now = cdtime ();
+	int status = 0;
+	size_t i;
+
+	if (db->copies == NULL)
+		return 0;
+
+	for (i = 0; i < db->writers_num; ++i) {
+		c_psql_writer_t *writer = db->writers[i];
+		c_psql_copy_t *c = db->copies + i;
+
+		if ((writer->copy_table == NULL) || (c->rows == 0))
+			continue;
+
+		if (! force && (db->commit_interval > 0)
+				&& (c->len < writer->copy_buffer_size)
+				&& ((now - c->first) < db->commit_interval))
+			continue;
+
+		if (0 != c_psql_copy_flush (db, writer, c))
+			status = -1;
+	}
+	return status;
+} /* c_psql_copy_flush_all */
+
+/* Hands `vl' to all writers of `db'. db->db_lock must be locked and the
+ * connection must have been checked when calling this function. */
+static int c_psql_write_locked (c_psql_database_t *db,
+		const data_set_t *ds, const value_list_t *vl)
+{
 	char time_str[RFC3339NANO_SIZE];
 	char values_name_str[1024];
 	char values_type_str[1024];
@@ -836,15 +1546,13 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 	int success = 0;
 	size_t i;
 
-	if ((ud == NULL) || (ud->data == NULL)) {
-		log_err ("c_psql_write: Invalid user data.");
-		return -1;
+	if( db->expire_delay > 0 && vl->time < (cdtime() - vl->interval - db->expire_delay) ) {
+		log_info ("c_psql_write: Skipped expired value @ %.3f - %s/%s-%s/%s-%s",
+			CDTIME_T_TO_DOUBLE (vl->time), vl->host, vl->plugin,
+			vl->plugin_instance, vl->type, vl->type_instance);
+		return 0;
 	}
 
-	db = ud->data;
-	assert (db->database != NULL);
-	assert (db->writers != NULL);
-
 	if (rfc3339nano (time_str, sizeof (time_str), vl->time) != 0) {
 		log_err ("c_psql_write: Failed to convert time to RFC 3339 format");
 		return -1;
@@ -866,42 +1574,34 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 
 #undef VALUE_OR_NULL
 
-	if( db->expire_delay > 0 && vl->time < (cdtime() - vl->interval - db->expire_delay) ) {
-		log_info ("c_psql_write: Skipped expired value @ %s - %s/%s-%s/%s-%s/%s",
-			params[0], params[1], params[2], params[3], params[4], params[5], params[6] );
-		return 0;
-        }
-
-	pthread_mutex_lock (&db->db_lock);
-
-	if (0 != c_psql_check_connection (db)) {
-		pthread_mutex_unlock (&db->db_lock);
-		return -1;
-	}
-
-	if ((db->commit_interval > 0)
-			&& (db->next_commit == 0))
-		c_psql_begin (db);
-
 	for (i = 0; i < db->writers_num; ++i) {
 		c_psql_writer_t *writer;
 		PGresult *res;
 
 		writer = db->writers[i];
 
+		if (writer->copy_table != NULL) {
+			c_psql_copy_t *c = db->copies + i;
+
+			if (0 != c_psql_copy_append (c, writer, ds, vl))
+				return -1;
+			if ((c->len >= writer->copy_buffer_size)
+					&& (0 != c_psql_copy_flush (db, writer, c)))
+				return -1;
+
+			success = 1;
+			continue;
+		}
+
 		if (values_type_to_sqlarray (ds,
 					values_type_str, sizeof (values_type_str),
-					writer->store_rates) == NULL) {
-			pthread_mutex_unlock (&db->db_lock);
+					writer->store_rates) == NULL)
 			return -1;
-		}
 
 		if (values_to_sqlarray (ds, vl,
 					values_str, sizeof (values_str),
-					writer->store_rates) == NULL) {
-			pthread_mutex_unlock (&db->db_lock);
+					writer->store_rates) == NULL)
 			return -1;
-		}
 
 		params[7] = values_type_str;
 		params[8] = values_str;
@@ -943,7 +1643,6 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 			if (db->next_commit > 0)
 				c_psql_commit (db);
 
-			pthread_mutex_unlock (&db->db_lock);
 			return -1;
 		}
 
@@ -951,13 +1650,55 @@ static int c_psql_write (const data_set_t *ds, const value_list_t *vl,
 		success = 1;
 	}
 
+	if (! success)
+		return -1;
+	return 0;
+} /* c_psql_write_locked */
+
+static int c_psql_write (const write_batch_entry_t *entries,
+		size_t entries_num, user_data_t *ud)
+{
+	c_psql_database_t *db;
+
+	size_t failed = 0;
+	size_t i;
+
+	if ((ud == NULL) || (ud->data == NULL)) {
+		log_err ("c_psql_write: Invalid user data.");
+		return -1;
+	}
+
+	db = ud->data;
+	assert (db->database != NULL);
+	assert (db->writers != NULL);
+
+	pthread_mutex_lock (&db->db_lock);
+
+	if (0 != c_psql_check_connection (db)) {
+		pthread_mutex_unlock (&db->db_lock);
+		return -1;
+	}
+
+	if ((db->commit_interval > 0)
+			&& (db->next_commit == 0))
+		c_psql_begin (db);
+
+	for (i = 0; i < entries_num; ++i)
+		if (0 != c_psql_write_locked (db, entries[i].ds, entries[i].vl))
+			failed++;
+
+	if (0 != c_psql_copy_flush_all (db, /* force = */ 0))
+		failed++;
+
 	if ((db->next_commit > 0)
-			&& (cdtime () > db->next_commit))
+			&& (cdtime () > db->next_commit)) {
+		c_psql_copy_flush_all (db, /* force = */ 1);
 		c_psql_commit (db);
+	}
 
 	pthread_mutex_unlock (&db->db_lock);
 
-	if (! success)
+	if (failed > 0)
 		return -1;
 	return 0;
 } /* c_psql_write */
@@ -984,8 +1725,11 @@ static int c_psql_flush (cdtime_t timeout,
 		/* don't commit if the timeout is larger than the regular commit
 		 * interval as in that case all requested data has already been
 		 * committed */
+		pthread_mutex_lock (&db->db_lock);
+		c_psql_copy_flush_all (db, /* force = */ 1);
 		if ((db->next_commit > 0) && (db->commit_interval > timeout))
 			c_psql_commit (db);
+		pthread_mutex_unlock (&db->db_lock);
 	}
 	return 0;
 } /* c_psql_flush */
@@ -1165,6 +1909,8 @@ static int c_psql_config_writer (oconfig_item_t *ci)
 	writer->name = sstrdup (ci->values[0].value.string);
 	writer->statement = NULL;
 	writer->store_rates = 1;
+	writer->copy_table = NULL;
+	writer->copy_buffer_size = C_PSQL_COPY_BUFFER_SIZE;
 
 	for (i = 0; i < ci->children_num; ++i) {
 		oconfig_item_t *c = ci->children + i;
@@ -1173,11 +1919,35 @@ static int c_psql_config_writer (oconfig_item_t *ci)
 			status = cf_util_get_string (c, &writer->statement);
 		else if (strcasecmp ("StoreRates", c->key) == 0)
 			status = cf_util_get_boolean (c, &writer->store_rates);
+		else if (strcasecmp ("Copy", c->key) == 0)
+			status = cf_util_get_string (c, &writer->copy_table);
+		else if (strcasecmp ("CopyBufferSize", c->key) == 0) {
+			int tmp_size = 0;
+
+			status = cf_util_get_int (c, &tmp_size);
+			if ((status == 0) && (tmp_size <= 0)) {
+				log_err ("CopyBufferSize must be positive.");
+				status = -1;
+			}
+			else if (status == 0)
+				writer->copy_buffer_size = (size_t) tmp_size;
+		}
 		else
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
+
+		if (status != 0)
+			break;
+	}
+
+	if ((status == 0) && ((writer->statement == NULL)
+				== (writer->copy_table == NULL))) {
+		log_err ("Writer \"%s\": Exactly one of \"Statement\" and "
+				"\"Copy\" must be given.", writer->name);
+		status = -1;
 	}
 
 	if (status != 0) {
+		sfree (writer->copy_table);
 		sfree (writer->statement);
 		sfree (writer->name);
 		return status;
@@ -1241,6 +2011,12 @@ static int c_psql_config_database (oconfig_item_t *ci)
 			cf_util_get_cdtime (c, &db->commit_interval);
 		else if (strcasecmp ("ExpireDelay", c->key) == 0)
 			cf_util_get_cdtime (c, &db->expire_delay);
+		else if (strcasecmp ("Connections", c->key) == 0)
+			cf_util_get_int (c, &db->connections_num);
+		else if (strcasecmp ("QueryTimeout", c->key) == 0)
+			cf_util_get_cdtime (c, &db->query_timeout);
+		else if (strcasecmp ("ReportQueryLatency", c->key) == 0)
+			cf_util_get_boolean (c, &db->report_latency);
 		else
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
 	}
@@ -1257,7 +2033,10 @@ static int c_psql_config_database (oconfig_item_t *ci)
 		db->q_prep_areas = (udb_query_preparation_area_t **) calloc (
 				db->queries_num, sizeof (*db->q_prep_areas));
 
-		if (db->q_prep_areas == NULL) {
+		db->q_stmt_states = (int *) calloc (db->queries_num,
+				sizeof (*db->q_stmt_states));
+
+		if ((db->q_prep_areas == NULL) || (db->q_stmt_states == NULL)) {
 			log_err ("Out of memory.");
 			c_psql_database_delete (db);
 			return -1;
@@ -1280,6 +2059,45 @@ static int c_psql_config_database (oconfig_item_t *ci)
 		}
 	}
 
+	if (db->connections_num < 1) {
+		log_warn ("Connections must be at least 1, using 1.");
+		db->connections_num = 1;
+	}
+
+	/* The database's own connection runs queries, too. More connections
+	 * than queries would stay idle. */
+	if ((db->connections_num > 1) && (db->queries_num > 1)) {
+		size_t pool_num = (size_t) db->connections_num - 1;
+
+		if (pool_num > db->queries_num - 1)
+			pool_num = db->queries_num - 1;
+
+		db->pool = calloc (pool_num, sizeof (*db->pool));
+		if (db->pool == NULL) {
+			log_err ("Out of memory.");
+			c_psql_database_delete (db);
+			return -1;
+		}
+
+		for (db->pool_num = 0; db->pool_num < pool_num; ++db->pool_num) {
+			db->pool[db->pool_num] = c_psql_pool_conn_new (db);
+			if (db->pool[db->pool_num] == NULL) {
+				log_err ("Out of memory.");
+				c_psql_database_delete (db);
+				return -1;
+			}
+		}
+	}
+
+	if (db->writers_num > 0) {
+		db->copies = calloc (db->writers_num, sizeof (*db->copies));
+		if (db->copies == NULL) {
+			log_err ("Out of memory.");
+			c_psql_database_delete (db);
+			return -1;
+		}
+	}
+
 	ud.data = db;
 	ud.free_func = c_psql_database_delete;
 
@@ -1292,7 +2110,7 @@ static int c_psql_config_database (oconfig_item_t *ci)
 	}
 	if (db->writers_num > 0) {
 		++db->ref_cnt;
-		plugin_register_write (cb_name, c_psql_write, &ud);
+		plugin_register_write_batch (cb_name, c_psql_write, &ud);
 
 		if (! have_flush) {
 			/* flush all */
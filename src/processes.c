@@ -38,6 +38,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_procfs.h"
 
 /* Include header files for the mach system, if they exist.. */
 #if HAVE_THREAD_INFO
@@ -92,6 +93,14 @@
 #  ifndef CONFIG_HZ
 #    define CONFIG_HZ 100
 #  endif
+#  include "utils_avltree.h"
+#  if HAVE_LINUX_CN_PROC_H
+#    include <pthread.h>
+#    include <sys/socket.h>
+#    include <linux/netlink.h>
+#    include <linux/connector.h>
+#    include <linux/cn_proc.h>
+#  endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -235,6 +244,50 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+
+/* The "Process" and "ProcessMatch" blocks a process belongs to, see
+ * ps_match_cache_get (). */
+typedef struct ps_match_cache_s
+{
+	long pid;
+	unsigned long long start_time; /* in jiffies since boot */
+	unsigned long generation;      /* read in which the process was last seen */
+
+	procstat_t **matches;
+	size_t matches_num;
+	size_t matches_size;
+} ps_match_cache_t;
+
+static c_avl_tree_t *match_cache = NULL;
+static unsigned long match_cache_generation = 0;
+
+#if HAVE_LINUX_CN_PROC_H
+/* With "UseProcEvents", a thread receives the kernel's process events and
+ * queues the PIDs of processes which have been created, have exec'ed or have
+ * exited. The read callback only reads these and the processes in a group. */
+#define PS_PROC_EVENTS_MAX 65536
+
+static _Bool use_proc_events = 0;
+static int proc_dir_fd = -1;
+static int proc_events_fd = -1;
+static pthread_t proc_events_thread;
+
+static pthread_mutex_t proc_events_lock = PTHREAD_MUTEX_INITIALIZER;
+static long *proc_events = NULL;
+static size_t proc_events_num = 0;
+static size_t proc_events_size = 0;
+/* Set when events have been lost and all of /proc must be scanned. */
+static _Bool proc_events_lost = 1;
+
+static int ps_proc_events_init (void);
+#endif
+
+static int ps_pid_compare (long const *a, long const *b) /* {{{ */
+{
+	if (*a < *b)
+		return (-1);
+	return (*a > *b);
+} /* }}} int ps_pid_compare */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -385,97 +438,109 @@ static void ps_update_counter (
     *group_counter += *curr_value;
 }
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+/* add process entry to the 'instances' of "ps" (or refresh it) */
+static void ps_list_add_entry (procstat_t *ps, procstat_entry_t *entry)
 {
-	procstat_t *ps;
 	procstat_entry_t *pse;
+	_Bool want_init;
 
 	if (entry->id == 0)
 		return;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	for (pse = ps->instances; pse != NULL; pse = pse->next)
+		if ((pse->id == entry->id) || (pse->next == NULL))
+			break;
+
+	if ((pse == NULL) || (pse->id != entry->id))
 	{
-        _Bool want_init;
+		procstat_entry_t *new;
 
-		if ((ps_list_match (name, cmdline, ps)) == 0)
-			continue;
+		new = calloc (1, sizeof (*new));
+		if (new == NULL)
+			return;
+		new->id = entry->id;
 
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
+		if (pse == NULL)
+			ps->instances = new;
+		else
+			pse->next = new;
 
-		if ((pse == NULL) || (pse->id != entry->id))
-		{
-			procstat_entry_t *new;
+		pse = new;
+	}
 
-			new = calloc (1, sizeof (*new));
-			if (new == NULL)
-				return;
-			new->id = entry->id;
+	pse->age = 0;
+	pse->num_proc   = entry->num_proc;
+	pse->num_lwp    = entry->num_lwp;
+	pse->vmem_size  = entry->vmem_size;
+	pse->vmem_rss   = entry->vmem_rss;
+	pse->vmem_data  = entry->vmem_data;
+	pse->vmem_code  = entry->vmem_code;
+	pse->stack_size = entry->stack_size;
+	pse->io_rchar   = entry->io_rchar;
+	pse->io_wchar   = entry->io_wchar;
+	pse->io_syscr   = entry->io_syscr;
+	pse->io_syscw   = entry->io_syscw;
+	pse->cswitch_vol   = entry->cswitch_vol;
+	pse->cswitch_invol = entry->cswitch_invol;
+
+	ps->num_proc   += pse->num_proc;
+	ps->num_lwp    += pse->num_lwp;
+	ps->vmem_size  += pse->vmem_size;
+	ps->vmem_rss   += pse->vmem_rss;
+	ps->vmem_data  += pse->vmem_data;
+	ps->vmem_code  += pse->vmem_code;
+	ps->stack_size += pse->stack_size;
+
+	ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
+	ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
+	ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
+	ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
+
+	ps->cswitch_vol   += ((pse->cswitch_vol == -1)?0:pse->cswitch_vol);
+	ps->cswitch_invol += ((pse->cswitch_invol == -1)?0:pse->cswitch_invol);
+
+	want_init = (entry->vmem_minflt_counter == 0)
+			&& (entry->vmem_majflt_counter == 0);
+	ps_update_counter (want_init,
+			&ps->vmem_minflt_counter,
+			&pse->vmem_minflt_counter, &pse->vmem_minflt,
+			entry->vmem_minflt_counter, entry->vmem_minflt);
+	ps_update_counter (want_init,
+			&ps->vmem_majflt_counter,
+			&pse->vmem_majflt_counter, &pse->vmem_majflt,
+			entry->vmem_majflt_counter, entry->vmem_majflt);
+
+	want_init = (entry->cpu_user_counter == 0)
+			&& (entry->cpu_system_counter == 0);
+	ps_update_counter (want_init,
+			&ps->cpu_user_counter,
+			&pse->cpu_user_counter, &pse->cpu_user,
+			entry->cpu_user_counter, entry->cpu_user);
+	ps_update_counter (want_init,
+			&ps->cpu_system_counter,
+			&pse->cpu_system_counter, &pse->cpu_system,
+			entry->cpu_system_counter, entry->cpu_system);
+} /* void ps_list_add_entry */
+
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it). On
+ * Linux, the matches are cached, see ps_match_cache_get (). */
+static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+{
+	procstat_t *ps;
 
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
+	if (entry->id == 0)
+		return;
 
-			pse = new;
-		}
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		if ((ps_list_match (name, cmdline, ps)) == 0)
+			continue;
 
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-		pse->cswitch_vol   = entry->cswitch_vol;
-		pse->cswitch_invol = entry->cswitch_invol;
-
-		ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-
-		ps->cswitch_vol   += ((pse->cswitch_vol == -1)?0:pse->cswitch_vol);
-		ps->cswitch_invol += ((pse->cswitch_invol == -1)?0:pse->cswitch_invol);
-
-		want_init = (entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0);
-		ps_update_counter (want_init,
-				&ps->vmem_minflt_counter,
-				&pse->vmem_minflt_counter, &pse->vmem_minflt,
-				entry->vmem_minflt_counter, entry->vmem_minflt);
-		ps_update_counter (want_init,
-				&ps->vmem_majflt_counter,
-				&pse->vmem_majflt_counter, &pse->vmem_majflt,
-				entry->vmem_majflt_counter, entry->vmem_majflt);
-
-		want_init = (entry->cpu_user_counter == 0)
-				&& (entry->cpu_system_counter == 0);
-		ps_update_counter (want_init,
-				&ps->cpu_user_counter,
-				&pse->cpu_user_counter, &pse->cpu_user,
-				entry->cpu_user_counter, entry->cpu_user);
-		ps_update_counter (want_init,
-				&ps->cpu_system_counter,
-				&pse->cpu_system_counter, &pse->cpu_system,
-				entry->cpu_system_counter, entry->cpu_system);
+		ps_list_add_entry (ps, entry);
 	}
-}
+} /* void ps_list_add */
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset (void)
@@ -587,6 +652,15 @@ static int ps_config (oconfig_item_t *ci)
 		{
 			cf_util_get_boolean (c, &report_ctx_switch);
 		}
+		else if (strcasecmp (c->key, "UseProcEvents") == 0)
+		{
+#if KERNEL_LINUX && HAVE_LINUX_CN_PROC_H
+			cf_util_get_boolean (c, &use_proc_events);
+#else
+			WARNING ("processes plugin: The `UseProcEvents' option is "
+					"only available on Linux and will be ignored.");
+#endif
+		}
 		else
 		{
 			ERROR ("processes plugin: The `%s' configuration option is not "
@@ -631,6 +705,28 @@ static int ps_init (void)
 	pagesize_g = sysconf(_SC_PAGESIZE);
 	DEBUG ("pagesize_g = %li; CONFIG_HZ = %i;",
 			pagesize_g, CONFIG_HZ);
+
+	if (match_cache == NULL)
+		match_cache = c_avl_create ((void *) ps_pid_compare);
+	if (match_cache == NULL)
+	{
+		ERROR ("processes plugin: c_avl_create failed.");
+		return (-1);
+	}
+
+#if HAVE_LINUX_CN_PROC_H
+	if (use_proc_events && (proc_events_fd < 0))
+	{
+		if (proc_dir_fd < 0)
+			proc_dir_fd = open ("/proc", O_RDONLY | O_DIRECTORY);
+
+		if ((proc_dir_fd < 0) || (ps_proc_events_init () != 0))
+			WARNING ("processes plugin: Unable to receive process "
+					"events, scanning /proc instead. Receiving "
+					"process events requires the CAP_NET_ADMIN "
+					"capability.");
+	}
+#endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -790,53 +886,121 @@ static void ps_submit_fork_rate (derive_t value)
 
 /* ------- additional functions for KERNEL_LINUX/HAVE_THREAD_INFO ------- */
 #if KERNEL_LINUX
-static procstat_t *ps_read_tasks_status (long pid, procstat_t *ps)
+/* Reads "file" relative to the directory "dir_fd" into "buffer", which is
+ * null terminated. Opening files relative to /proc/<pid> saves the kernel
+ * from resolving the full path each time. Returns the number of bytes read or
+ * -1 on error, with errno set. */
+static ssize_t ps_read_file_at (int dir_fd, char const *file, /* {{{ */
+		char *buffer, size_t buffer_size)
+{
+	size_t buffer_len = 0;
+	int fd;
+
+	fd = openat (dir_fd, file, O_RDONLY);
+	if (fd < 0)
+		return (-1);
+
+	while (buffer_len < buffer_size - 1)
+	{
+		ssize_t status;
+
+		status = read (fd, buffer + buffer_len,
+				buffer_size - 1 - buffer_len);
+		if (status < 0)
+		{
+			int errno_save = errno;
+
+			if ((errno == EAGAIN) || (errno == EINTR))
+				continue;
+
+			close (fd);
+			errno = errno_save;
+			return (-1);
+		}
+		if (status == 0)
+			break;
+
+		buffer_len += (size_t) status;
+	}
+
+	close (fd);
+	buffer[buffer_len] = 0;
+	return ((ssize_t) buffer_len);
+} /* }}} ssize_t ps_read_file_at */
+
+/* Returns the line starting at "*ptr" and advances "*ptr" to the next one. */
+static char *ps_next_line (char **ptr) /* {{{ */
+{
+	char *line = *ptr;
+	char *end;
+
+	if ((line == NULL) || (line[0] == 0))
+		return (NULL);
+
+	end = strchr (line, '\n');
+	if (end != NULL)
+	{
+		*end = 0;
+		*ptr = end + 1;
+	}
+	else
+		*ptr = line + strlen (line);
+
+	return (line);
+} /* }}} char *ps_next_line */
+
+static procstat_t *ps_read_tasks_status (int dir_fd, procstat_t *ps)
 {
-	char           dirname[64];
+	int            task_fd;
 	DIR           *dh;
 	char           filename[64];
-	FILE          *fh;
 	struct dirent *ent;
 	derive_t cswitch_vol = 0;
 	derive_t cswitch_invol = 0;
-	char buffer[1024];
+	char buffer[4096];
 	char *fields[8];
 	int numfields;
 
-	ssnprintf (dirname, sizeof (dirname), "/proc/%li/task", pid);
+	task_fd = openat (dir_fd, "task", O_RDONLY | O_DIRECTORY);
+	if (task_fd < 0)
+	{
+		DEBUG ("Failed to open the task directory");
+		return (NULL);
+	}
 
-	if ((dh = opendir (dirname)) == NULL)
+	if ((dh = fdopendir (task_fd)) == NULL)
 	{
-		DEBUG ("Failed to open directory `%s'", dirname);
+		DEBUG ("Failed to open the task directory");
+		close (task_fd);
 		return (NULL);
 	}
 
 	while ((ent = readdir (dh)) != NULL)
 	{
-		char *tpid;
+		char *ptr;
+		char *line;
 
 		if (!isdigit ((int) ent->d_name[0]))
 			continue;
 
-		tpid = ent->d_name;
-
-		ssnprintf (filename, sizeof (filename), "/proc/%li/task/%s/status", pid, tpid);
-		if ((fh = fopen (filename, "r")) == NULL)
+		ssnprintf (filename, sizeof (filename), "%s/status", ent->d_name);
+		if (ps_read_file_at (task_fd, filename, buffer, sizeof (buffer)) < 0)
 		{
-			DEBUG ("Failed to open file `%s'", filename);
+			DEBUG ("Failed to read file `task/%s'", filename);
 			continue;
 		}
 
-		while (fgets (buffer, sizeof(buffer), fh) != NULL)
+		ptr = buffer;
+		while ((line = ps_next_line (&ptr)) != NULL)
 		{
 			derive_t tmp;
 			char *endptr;
 
-			if (strncmp (buffer, "voluntary_ctxt_switches", 23) != 0
-				&& strncmp (buffer, "nonvoluntary_ctxt_switches", 26) != 0)
+			if (strncmp (line, "voluntary_ctxt_switches", 23) != 0
+				&& strncmp (line, "nonvoluntary_ctxt_switches", 26) != 0)
 				continue;
 
-			numfields = strsplit (buffer, fields,
+			numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 			if (numfields < 2)
@@ -847,24 +1011,18 @@ static procstat_t *ps_read_tasks_status (long pid, procstat_t *ps)
 			tmp = (derive_t) strtoll (fields[1], &endptr, /* base = */ 10);
 			if ((errno == 0) && (endptr != fields[1]))
 			{
-				if (strncmp (buffer, "voluntary_ctxt_switches", 23) == 0)
+				if (strncmp (line, "voluntary_ctxt_switches", 23) == 0)
 				{
 					cswitch_vol += tmp;
 				}
-				else if (strncmp (buffer, "nonvoluntary_ctxt_switches", 26) == 0)
+				else if (strncmp (line, "nonvoluntary_ctxt_switches", 26) == 0)
 				{
 					cswitch_invol += tmp;
 				}
 			}
-		} /* while (fgets) */
-
-		if (fclose (fh))
-		{
-			char errbuf[1024];
-				WARNING ("processes: fclose: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-		}
+		} /* while (line) */
 	}
+	/* Closes task_fd, too. */
 	closedir (dh);
 
 	ps->cswitch_vol = cswitch_vol;
@@ -874,11 +1032,11 @@ static procstat_t *ps_read_tasks_status (long pid, procstat_t *ps)
 } /* int *ps_read_tasks_status */
 
 /* Read data from /proc/pid/status */
-static procstat_t *ps_read_status (long pid, procstat_t *ps)
+static procstat_t *ps_read_status (int dir_fd, procstat_t *ps)
 {
-	FILE *fh;
-	char buffer[1024];
-	char filename[64];
+	char buffer[4096];
+	char *ptr;
+	char *line;
 	unsigned long lib = 0;
 	unsigned long exe = 0;
 	unsigned long data = 0;
@@ -886,20 +1044,20 @@ static procstat_t *ps_read_status (long pid, procstat_t *ps)
 	char *fields[8];
 	int numfields;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%li/status", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	if (ps_read_file_at (dir_fd, "status", buffer, sizeof (buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof(buffer), fh) != NULL)
+	ptr = buffer;
+	while ((line = ps_next_line (&ptr)) != NULL)
 	{
 		unsigned long tmp;
 		char *endptr;
 
-		if (strncmp (buffer, "Vm", 2) != 0
-				&& strncmp (buffer, "Threads", 7) != 0)
+		if (strncmp (line, "Vm", 2) != 0
+				&& strncmp (line, "Threads", 7) != 0)
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -910,31 +1068,24 @@ static procstat_t *ps_read_status (long pid, procstat_t *ps)
 		tmp = strtoul (fields[1], &endptr, /* base = */ 10);
 		if ((errno == 0) && (endptr != fields[1]))
 		{
-			if (strncmp (buffer, "VmData", 6) == 0)
+			if (strncmp (line, "VmData", 6) == 0)
 			{
 				data = tmp;
 			}
-			else if (strncmp (buffer, "VmLib", 5) == 0)
+			else if (strncmp (line, "VmLib", 5) == 0)
 			{
 				lib = tmp;
 			}
-			else if  (strncmp(buffer, "VmExe", 5) == 0)
+			else if  (strncmp(line, "VmExe", 5) == 0)
 			{
 				exe = tmp;
 			}
-			else if  (strncmp(buffer, "Threads", 7) == 0)
+			else if  (strncmp(line, "Threads", 7) == 0)
 			{
 				threads = tmp;
 			}
 		}
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* while (line) */
 
 	ps->vmem_data = data * 1024;
 	ps->vmem_code = (exe + lib) * 1024;
@@ -944,37 +1095,37 @@ static procstat_t *ps_read_status (long pid, procstat_t *ps)
 	return (ps);
 } /* procstat_t *ps_read_vmem */
 
-static procstat_t *ps_read_io (long pid, procstat_t *ps)
+static procstat_t *ps_read_io (int dir_fd, procstat_t *ps)
 {
-	FILE *fh;
 	char buffer[1024];
-	char filename[64];
+	char *ptr;
+	char *line;
 
 	char *fields[8];
 	int numfields;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%li/io", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	if (ps_read_file_at (dir_fd, "io", buffer, sizeof (buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	ptr = buffer;
+	while ((line = ps_next_line (&ptr)) != NULL)
 	{
 		derive_t *val = NULL;
 		long long tmp;
 		char *endptr;
 
-		if (strncasecmp (buffer, "rchar:", 6) == 0)
+		if (strncasecmp (line, "rchar:", 6) == 0)
 			val = &(ps->io_rchar);
-		else if (strncasecmp (buffer, "wchar:", 6) == 0)
+		else if (strncasecmp (line, "wchar:", 6) == 0)
 			val = &(ps->io_wchar);
-		else if (strncasecmp (buffer, "syscr:", 6) == 0)
+		else if (strncasecmp (line, "syscr:", 6) == 0)
 			val = &(ps->io_syscr);
-		else if (strncasecmp (buffer, "syscw:", 6) == 0)
+		else if (strncasecmp (line, "syscw:", 6) == 0)
 			val = &(ps->io_syscw);
 		else
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -987,27 +1138,23 @@ static procstat_t *ps_read_io (long pid, procstat_t *ps)
 			*val = -1;
 		else
 			*val = (derive_t) tmp;
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* while (line) */
 
 	return (ps);
 } /* procstat_t *ps_read_io */
 
-static int ps_read_process (long pid, procstat_t *ps, char *state)
+/* Reads /proc/<pid>/stat, which is all that is needed for processes that
+ * don't match any "Process" or "ProcessMatch". The details of matching
+ * processes are read by ps_read_process_details(). */
+static int ps_read_process (long pid, int dir_fd, procstat_t *ps,
+		char *state, unsigned long long *start_time)
 {
-	char  filename[64];
 	char  buffer[1024];
 
 	char *fields[64];
 	char  fields_len;
 
-	size_t buffer_len;
+	ssize_t buffer_len;
 
 	char  *buffer_ptr;
 	size_t name_start_pos;
@@ -1020,17 +1167,11 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 	long long unsigned vmem_rss;
 	long long unsigned stack_size;
 
-	ssize_t status;
-
 	memset (ps, 0, sizeof (procstat_t));
 
-	ssnprintf (filename, sizeof (filename), "/proc/%li/stat", pid);
-
-	status = read_file_contents (filename, buffer, sizeof(buffer) - 1);
-	if (status <= 0)
+	buffer_len = ps_read_file_at (dir_fd, "stat", buffer, sizeof (buffer));
+	if (buffer_len <= 0)
 		return (-1);
-	buffer_len = (size_t) status;
-	buffer[buffer_len] = 0;
 
 	/* The name of the process is enclosed in parens. Since the name can
 	 * contain parens itself, spaces, numbers and pretty much everything
@@ -1039,10 +1180,10 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 	 * otherwise be required to determine name_len. */
 	name_start_pos = 0;
 	while ((buffer[name_start_pos] != '(')
-			&& (name_start_pos < buffer_len))
+			&& (name_start_pos < (size_t) buffer_len))
 		name_start_pos++;
 
-	name_end_pos = buffer_len;
+	name_end_pos = (size_t) buffer_len;
 	while ((buffer[name_end_pos] != ')')
 			&& (name_end_pos > 0))
 		name_end_pos--;
@@ -1062,7 +1203,7 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 
 	sstrncpy (ps->name, &buffer[name_start_pos + 1], name_len + 1);
 
-	if ((buffer_len - name_end_pos) < 2)
+	if (((size_t) buffer_len - name_end_pos) < 2)
 		return (-1);
 	buffer_ptr = &buffer[name_end_pos + 2];
 
@@ -1070,12 +1211,13 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 	if (fields_len < 22)
 	{
 		DEBUG ("processes plugin: ps_read_process (pid = %li):"
-				" `%s' has only %i fields..",
-				pid, filename, fields_len);
+				" `stat' has only %i fields..",
+				pid, fields_len);
 		return (-1);
 	}
 
 	*state = fields[0][0];
+	*start_time = strtoull (fields[19], /* endptr = */ NULL, /* base = */ 10);
 
 	if (*state == 'Z')
 	{
@@ -1085,13 +1227,6 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 	else
 	{
 		ps->num_lwp = strtoul (fields[17], /* endptr = */ NULL, /* base = */ 10);
-		if ((ps_read_status(pid, ps)) == NULL)
-		{
-			/* No VMem data */
-			ps->vmem_data = -1;
-			ps->vmem_code = -1;
-			DEBUG("ps_read_process: did not get vmem data for pid %li", pid);
-		}
 		if (ps->num_lwp <= 0)
 			ps->num_lwp = 1;
 		ps->num_proc = 1;
@@ -1132,7 +1267,36 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 	ps->vmem_rss = (unsigned long) vmem_rss;
 	ps->stack_size = (unsigned long) stack_size;
 
-	if ( (ps_read_io (pid, ps)) == NULL)
+	/* Filled in by ps_read_process_details(), if needed. */
+	ps->vmem_data = -1;
+	ps->vmem_code = -1;
+	ps->io_rchar = -1;
+	ps->io_wchar = -1;
+	ps->io_syscr = -1;
+	ps->io_syscw = -1;
+	ps->cswitch_vol = -1;
+	ps->cswitch_invol = -1;
+
+	/* success */
+	return (0);
+} /* int ps_read_process (...) */
+
+/* Reads /proc/<pid>/status, io and, if enabled, the context switches of all
+ * tasks. Only called for processes which are reported. */
+static void ps_read_process_details (long pid, int dir_fd, procstat_t *ps)
+{
+	if (ps->num_proc == 0)
+		return;
+
+	if ((ps_read_status (dir_fd, ps)) == NULL)
+	{
+		/* No VMem data */
+		ps->vmem_data = -1;
+		ps->vmem_code = -1;
+		DEBUG("ps_read_process: did not get vmem data for pid %li", pid);
+	}
+
+	if ( (ps_read_io (dir_fd, ps)) == NULL)
 	{
 		/* no io data */
 		ps->io_rchar = -1;
@@ -1145,7 +1309,7 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 
 	if ( report_ctx_switch )
 	{
-		if ( (ps_read_tasks_status(pid, ps)) == NULL)
+		if ( (ps_read_tasks_status(dir_fd, ps)) == NULL)
 		{
 			ps->cswitch_vol = -1;
 			ps->cswitch_invol = -1;
@@ -1154,122 +1318,607 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 					"switch data for pid %li", pid);
 		}
 	}
+} /* void ps_read_process_details */
 
-	/* success */
-	return (0);
-} /* int ps_read_process (...) */
-
-static char *ps_get_cmdline (long pid, char *name, char *buf, size_t buf_len)
+static char *ps_get_cmdline (long pid, int dir_fd, char *name, char *buf,
+		size_t buf_len)
 {
-	char  *buf_ptr;
-	size_t len;
-
-	char file[PATH_MAX];
-	int  fd;
-
+	ssize_t status;
 	size_t n;
 
 	if ((pid < 1) || (NULL == buf) || (buf_len < 2))
 		return NULL;
 
-	ssnprintf (file, sizeof (file), "/proc/%li/cmdline", pid);
-
-	errno = 0;
-	fd = open (file, O_RDONLY);
-	if (fd < 0) {
+	status = ps_read_file_at (dir_fd, "cmdline", buf, buf_len);
+	if (status < 0) {
 		char errbuf[4096];
-		/* ENOENT means the process exited while we were handling it.
-		 * Don't complain about this, it only fills the logs. */
-		if (errno != ENOENT)
-			WARNING ("processes plugin: Failed to open `%s': %s.", file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
+		/* ENOENT and ESRCH mean the process exited while we were
+		 * handling it. Don't complain about this, it only fills the
+		 * logs. */
+		if ((errno != ENOENT) && (errno != ESRCH))
+			WARNING ("processes plugin: Failed to read `/proc/%li/cmdline': %s.",
+					pid, sstrerror (errno, errbuf, sizeof (errbuf)));
 		return NULL;
 	}
+	n = (size_t) status;
 
-	buf_ptr = buf;
-	len     = buf_len;
+	if (0 == n) {
+		/* cmdline not available; e.g. kernel thread, zombie */
+		if (NULL == name)
+			return NULL;
 
-	n = 0;
+		ssnprintf (buf, buf_len, "[%s]", name);
+		return buf;
+	}
 
-	while (42) {
-		ssize_t status;
+	--n;
+	/* remove trailing whitespace */
+	while ((n > 0) && (isspace (buf[n]) || ('\0' == buf[n]))) {
+		buf[n] = '\0';
+		--n;
+	}
+
+	/* arguments are separated by '\0' in /proc/<pid>/cmdline */
+	while (n > 0) {
+		if ('\0' == buf[n])
+			buf[n] = ' ';
+		--n;
+	}
+	return buf;
+} /* char *ps_get_cmdline (...) */
+
+/* Looks up which "Process" and "ProcessMatch" blocks the process "pid"
+ * belongs to. The result is cached for as long as the process exists, i.e.
+ * until the PID is reused by a process with a different start time, so the
+ * cmdline is read and the regular expressions are run once per process.
+ * Renaming a running process doesn't change which blocks it belongs to. */
+static ps_match_cache_t *ps_match_cache_get (long pid, int dir_fd, /* {{{ */
+		procstat_t *ps, unsigned long long start_time)
+{
+	char cmdline[CMDLINE_BUFFER_SIZE];
+	char const *cmdline_ptr;
+	ps_match_cache_t *mc = NULL;
+	procstat_t *ptr;
+
+	if (c_avl_get (match_cache, &pid, (void *) &mc) == 0)
+	{
+		if (mc->start_time == start_time)
+		{
+			mc->generation = match_cache_generation;
+			return (mc);
+		}
+
+		/* The PID has been reused. */
+		mc->matches_num = 0;
+	}
+	else
+	{
+		mc = calloc (1, sizeof (*mc));
+		if (mc == NULL)
+		{
+			ERROR ("processes plugin: calloc failed.");
+			return (NULL);
+		}
+		mc->pid = pid;
+
+		if (c_avl_insert (match_cache, &mc->pid, mc) != 0)
+		{
+			ERROR ("processes plugin: c_avl_insert failed.");
+			sfree (mc);
+			return (NULL);
+		}
+	}
+
+	mc->start_time = start_time;
+	mc->generation = match_cache_generation;
+
+	if (list_head_g == NULL)
+		return (mc);
+
+	cmdline_ptr = ps_get_cmdline (pid, dir_fd, ps->name,
+			cmdline, sizeof (cmdline));
+
+	for (ptr = list_head_g; ptr != NULL; ptr = ptr->next)
+	{
+		if (ps_list_match (ps->name, cmdline_ptr, ptr) == 0)
+			continue;
+
+		if (mc->matches_num >= mc->matches_size)
+		{
+			size_t new_size = mc->matches_size + 4;
+			procstat_t **tmp;
+
+			tmp = realloc (mc->matches, new_size * sizeof (*mc->matches));
+			if (tmp == NULL)
+			{
+				ERROR ("processes plugin: realloc failed.");
+				break;
+			}
+			mc->matches = tmp;
+			mc->matches_size = new_size;
+		}
+
+		mc->matches[mc->matches_num] = ptr;
+		mc->matches_num++;
+	}
+
+	return (mc);
+} /* }}} ps_match_cache_t *ps_match_cache_get */
+
+/* Removes the processes which have not been seen during the last read. */
+static void ps_match_cache_prune (void) /* {{{ */
+{
+	c_avl_iterator_t *iter;
+	long *pid;
+	ps_match_cache_t *mc;
+	long *gone = NULL;
+	size_t gone_num = 0;
+	size_t i;
+
+	gone = calloc ((size_t) c_avl_size (match_cache) + 1, sizeof (*gone));
+	if (gone == NULL)
+		return;
+
+	iter = c_avl_get_iterator (match_cache);
+	while (c_avl_iterator_next (iter, (void *) &pid, (void *) &mc) == 0)
+		if (mc->generation != match_cache_generation)
+			gone[gone_num++] = *pid;
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < gone_num; i++)
+	{
+		if (c_avl_remove (match_cache, &gone[i],
+					(void *) &pid, (void *) &mc) != 0)
+			continue;
+
+		sfree (mc->matches);
+		sfree (mc);
+	}
+
+	sfree (gone);
+} /* }}} void ps_match_cache_prune */
+
+static void ps_match_cache_remove (long pid) /* {{{ */
+{
+	long *key;
+	ps_match_cache_t *mc;
+
+	if (c_avl_remove (match_cache, &pid, (void *) &key, (void *) &mc) != 0)
+		return;
+
+	sfree (mc->matches);
+	sfree (mc);
+} /* }}} void ps_match_cache_remove */
 
-		status = read (fd, (void *)buf_ptr, len);
+/* Reads the process "pid" and adds it to the groups it belongs to. Each
+ * process is read at most once per read. Returns ENOENT if the process has
+ * exited. */
+static int ps_read_pid (int proc_fd, long pid, char *ret_state) /* {{{ */
+{
+	char dirname[32];
+	int dir_fd;
+	int status;
+	procstat_t ps;
+	procstat_entry_t pse;
+	unsigned long long start_time;
+	ps_match_cache_t *mc;
+	size_t i;
+
+	if ((c_avl_get (match_cache, &pid, (void *) &mc) == 0)
+			&& (mc->generation == match_cache_generation))
+		return (EEXIST);
+
+	ssnprintf (dirname, sizeof (dirname), "%li", pid);
+	dir_fd = openat (proc_fd, dirname, O_RDONLY | O_DIRECTORY);
+	if (dir_fd < 0)
+	{
+		ps_match_cache_remove (pid);
+		return (ENOENT);
+	}
+
+	status = ps_read_process (pid, dir_fd, &ps, ret_state, &start_time);
+	if (status != 0)
+	{
+		DEBUG ("ps_read_process failed: %i", status);
+		close (dir_fd);
+		return (-1);
+	}
+
+	/* Only read the details of processes which are reported. */
+	mc = ps_match_cache_get (pid, dir_fd, &ps, start_time);
+	if ((mc == NULL) || (mc->matches_num == 0))
+	{
+		close (dir_fd);
+		return (0);
+	}
+
+	ps_read_process_details (pid, dir_fd, &ps);
+	close (dir_fd);
+
+	memset (&pse, 0, sizeof (pse));
+	pse.id       = pid;
+	pse.age      = 0;
+
+	pse.num_proc   = ps.num_proc;
+	pse.num_lwp    = ps.num_lwp;
+	pse.vmem_size  = ps.vmem_size;
+	pse.vmem_rss   = ps.vmem_rss;
+	pse.vmem_data  = ps.vmem_data;
+	pse.vmem_code  = ps.vmem_code;
+	pse.stack_size = ps.stack_size;
+
+	pse.vmem_minflt = 0;
+	pse.vmem_minflt_counter = ps.vmem_minflt_counter;
+	pse.vmem_majflt = 0;
+	pse.vmem_majflt_counter = ps.vmem_majflt_counter;
+
+	pse.cpu_user = 0;
+	pse.cpu_user_counter = ps.cpu_user_counter;
+	pse.cpu_system = 0;
+	pse.cpu_system_counter = ps.cpu_system_counter;
+
+	pse.io_rchar = ps.io_rchar;
+	pse.io_wchar = ps.io_wchar;
+	pse.io_syscr = ps.io_syscr;
+	pse.io_syscw = ps.io_syscw;
+
+	pse.cswitch_vol = ps.cswitch_vol;
+	pse.cswitch_invol = ps.cswitch_invol;
+
+	for (i = 0; i < mc->matches_num; i++)
+		ps_list_add_entry (mc->matches[i], &pse);
+
+	return (0);
+} /* }}} int ps_read_pid */
+
+#if HAVE_LINUX_CN_PROC_H
+/* Queues a process which has been created, has exec'ed or has exited. */
+static void ps_proc_events_queue (long pid) /* {{{ */
+{
+	pthread_mutex_lock (&proc_events_lock);
+
+	if (proc_events_num >= PS_PROC_EVENTS_MAX)
+	{
+		/* The read callback will scan all of /proc. */
+		proc_events_lost = 1;
+		pthread_mutex_unlock (&proc_events_lock);
+		return;
+	}
 
-		if (status < 0) {
+	if (proc_events_num >= proc_events_size)
+	{
+		size_t new_size = (proc_events_size == 0) ? 256 : 2 * proc_events_size;
+		long *tmp;
+
+		tmp = realloc (proc_events, new_size * sizeof (*proc_events));
+		if (tmp == NULL)
+		{
+			proc_events_lost = 1;
+			pthread_mutex_unlock (&proc_events_lock);
+			return;
+		}
+		proc_events = tmp;
+		proc_events_size = new_size;
+	}
+
+	proc_events[proc_events_num] = pid;
+	proc_events_num++;
+
+	pthread_mutex_unlock (&proc_events_lock);
+} /* }}} void ps_proc_events_queue */
+
+static void ps_proc_events_set_lost (void) /* {{{ */
+{
+	pthread_mutex_lock (&proc_events_lock);
+	proc_events_lost = 1;
+	pthread_mutex_unlock (&proc_events_lock);
+} /* }}} void ps_proc_events_set_lost */
+
+static void *ps_proc_events_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	union {
+		struct nlmsghdr nlh;
+		char buffer[8192];
+	} msg;
+
+	while (42)
+	{
+		struct nlmsghdr *nlh;
+		int len;
+
+		len = (int) recv (proc_events_fd, &msg, sizeof (msg), 0);
+		if (len < 0)
+		{
 			char errbuf[1024];
 
-			if ((EAGAIN == errno) || (EINTR == errno))
+			if (errno == EINTR)
+				continue;
+
+			/* The socket's buffer overflowed, events have been lost. */
+			ps_proc_events_set_lost ();
+			if (errno == ENOBUFS)
 				continue;
 
-			WARNING ("processes plugin: Failed to read from `%s': %s.", file,
+			ERROR ("processes plugin: Receiving process events failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (fd);
-			return NULL;
+			break;
 		}
 
-		n += status;
+		for (nlh = &msg.nlh; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len))
+		{
+			struct cn_msg *cn;
+			struct proc_event *ev;
 
-		if (status == 0)
-			break;
+			if (nlh->nlmsg_type == NLMSG_NOOP)
+				continue;
+			if ((nlh->nlmsg_type == NLMSG_ERROR)
+					|| (nlh->nlmsg_type == NLMSG_OVERRUN))
+			{
+				ps_proc_events_set_lost ();
+				continue;
+			}
 
-		buf_ptr += status;
-		len     -= status;
+			cn = NLMSG_DATA (nlh);
+			if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+				continue;
+			ev = (struct proc_event *) cn->data;
 
-		if (len <= 0)
-			break;
+			/* Only processes are tracked, not the threads within. */
+			switch (ev->what)
+			{
+				case PROC_EVENT_FORK:
+					if (ev->event_data.fork.child_pid
+							== ev->event_data.fork.child_tgid)
+						ps_proc_events_queue ((long) ev->event_data.fork.child_tgid);
+					break;
+				case PROC_EVENT_EXEC:
+					ps_proc_events_queue ((long) ev->event_data.exec.process_tgid);
+					break;
+				case PROC_EVENT_EXIT:
+					if (ev->event_data.exit.process_pid
+							== ev->event_data.exit.process_tgid)
+						ps_proc_events_queue ((long) ev->event_data.exit.process_tgid);
+					break;
+				default:
+					break;
+			}
+		}
 	}
 
-	close (fd);
+	return ((void *) 0);
+} /* }}} void *ps_proc_events_thread */
 
-	if (0 == n) {
-		/* cmdline not available; e.g. kernel thread, zombie */
-		if (NULL == name)
-			return NULL;
+static int ps_proc_events_send (enum proc_cn_mcast_op op) /* {{{ */
+{
+	union {
+		struct nlmsghdr nlh;
+		char buffer[NLMSG_SPACE (sizeof (struct cn_msg)
+				+ sizeof (enum proc_cn_mcast_op))];
+	} msg;
+	struct cn_msg *cn;
+
+	memset (&msg, 0, sizeof (msg));
+	msg.nlh.nlmsg_len = NLMSG_LENGTH (sizeof (struct cn_msg) + sizeof (op));
+	msg.nlh.nlmsg_type = NLMSG_DONE;
+	msg.nlh.nlmsg_pid = (__u32) getpid ();
+
+	cn = NLMSG_DATA (&msg.nlh);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof (op);
+	memcpy (cn->data, &op, sizeof (op));
+
+	if (send (proc_events_fd, &msg, msg.nlh.nlmsg_len, 0) < 0)
+		return (-1);
+	return (0);
+} /* }}} int ps_proc_events_send */
 
-		ssnprintf (buf, buf_len, "[%s]", name);
-		return buf;
+/* Subscribes to the kernel's process events. This requires the
+ * CAP_NET_ADMIN capability. */
+static int ps_proc_events_init (void) /* {{{ */
+{
+	struct sockaddr_nl addr;
+	int rcvbuf = 1024 * 1024;
+	char errbuf[1024];
+	int status;
+
+	proc_events_fd = socket (PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
+	if (proc_events_fd < 0)
+	{
+		ERROR ("processes plugin: socket (NETLINK_CONNECTOR) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
 	}
 
-	assert (n <= buf_len);
+	/* Bursts of forks must not overflow the socket's buffer. */
+	setsockopt (proc_events_fd, SOL_SOCKET, SO_RCVBUF,
+			&rcvbuf, sizeof (rcvbuf));
 
-	if (n == buf_len)
-		--n;
-	buf[n] = '\0';
+	memset (&addr, 0, sizeof (addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = 0;
 
-	--n;
-	/* remove trailing whitespace */
-	while ((n > 0) && (isspace (buf[n]) || ('\0' == buf[n]))) {
-		buf[n] = '\0';
-		--n;
+	if ((bind (proc_events_fd, (struct sockaddr *) &addr, sizeof (addr)) != 0)
+			|| (ps_proc_events_send (PROC_CN_MCAST_LISTEN) != 0))
+	{
+		ERROR ("processes plugin: Subscribing to process events failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (proc_events_fd);
+		proc_events_fd = -1;
+		return (-1);
 	}
 
-	/* arguments are separated by '\0' in /proc/<pid>/cmdline */
-	while (n > 0) {
-		if ('\0' == buf[n])
-			buf[n] = ' ';
-		--n;
+	proc_events_lost = 1;
+	status = plugin_thread_create (&proc_events_thread, /* attr = */ NULL,
+			ps_proc_events_thread, /* arg = */ NULL);
+	if (status != 0)
+	{
+		ERROR ("processes plugin: pthread_create failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (proc_events_fd);
+		proc_events_fd = -1;
+		return (-1);
 	}
-	return buf;
-} /* char *ps_get_cmdline (...) */
+
+	return (0);
+} /* }}} int ps_proc_events_init */
+
+static void ps_proc_events_shutdown (void) /* {{{ */
+{
+	if (proc_events_fd < 0)
+		return;
+
+	pthread_cancel (proc_events_thread);
+	pthread_join (proc_events_thread, /* retval = */ NULL);
+
+	ps_proc_events_send (PROC_CN_MCAST_IGNORE);
+	close (proc_events_fd);
+	proc_events_fd = -1;
+
+	sfree (proc_events);
+	proc_events_num = 0;
+	proc_events_size = 0;
+} /* }}} void ps_proc_events_shutdown */
+
+/* Reads the number of forks and of runnable and blocked tasks from
+ * /proc/stat. */
+static int ps_read_proc_stat (derive_t *forks, gauge_t *running, /* {{{ */
+		gauge_t *blocked)
+{
+	char buffer[8192];
+	char *ptr;
+	char *line;
+
+	if (ps_read_file_at (proc_dir_fd, "stat", buffer, sizeof (buffer)) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("processes plugin: Reading /proc/stat failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	ptr = buffer;
+	while ((line = ps_next_line (&ptr)) != NULL)
+	{
+		char *fields[3];
+		int fields_num;
+
+		fields_num = strsplit (line, fields, STATIC_ARRAY_SIZE (fields));
+		if (fields_num != 2)
+			continue;
+
+		if (strcmp ("processes", fields[0]) == 0)
+			*forks = (derive_t) strtoll (fields[1], NULL, /* base = */ 10);
+		else if (strcmp ("procs_running", fields[0]) == 0)
+			*running = (gauge_t) strtoll (fields[1], NULL, /* base = */ 10);
+		else if (strcmp ("procs_blocked", fields[0]) == 0)
+			*blocked = (gauge_t) strtoll (fields[1], NULL, /* base = */ 10);
+	}
+
+	return (0);
+} /* }}} int ps_read_proc_stat */
+
+/* Reads the processes which belong to a group and the ones which have been
+ * created, have exec'ed or have exited since the last read. Returns EAGAIN if
+ * events have been lost and all of /proc has to be scanned. */
+static int ps_read_proc_events (void) /* {{{ */
+{
+	long *events;
+	size_t events_num;
+	_Bool lost;
+	long *watched;
+	size_t watched_num = 0;
+	c_avl_iterator_t *iter;
+	long *pid;
+	ps_match_cache_t *mc;
+	derive_t forks = 0;
+	gauge_t running = NAN;
+	gauge_t blocked = NAN;
+	gauge_t sleeping;
+	char state;
+	size_t i;
+
+	pthread_mutex_lock (&proc_events_lock);
+	events = proc_events;
+	events_num = proc_events_num;
+	lost = proc_events_lost;
+	proc_events = NULL;
+	proc_events_num = 0;
+	proc_events_size = 0;
+	proc_events_lost = 0;
+	pthread_mutex_unlock (&proc_events_lock);
+
+	if (lost)
+	{
+		sfree (events);
+		return (EAGAIN);
+	}
+
+	/* Changed processes are matched again, exited ones are removed. */
+	for (i = 0; i < events_num; i++)
+		ps_match_cache_remove (events[i]);
+
+	watched = calloc ((size_t) c_avl_size (match_cache) + 1, sizeof (*watched));
+	if (watched == NULL)
+	{
+		ERROR ("processes plugin: calloc failed.");
+		sfree (events);
+		return (ENOMEM);
+	}
+
+	iter = c_avl_get_iterator (match_cache);
+	while (c_avl_iterator_next (iter, (void *) &pid, (void *) &mc) == 0)
+		if (mc->matches_num > 0)
+			watched[watched_num++] = *pid;
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < watched_num; i++)
+		ps_read_pid (proc_dir_fd, watched[i], &state);
+	for (i = 0; i < events_num; i++)
+		ps_read_pid (proc_dir_fd, events[i], &state);
+
+	sfree (watched);
+	sfree (events);
+
+	/* The kernel counts runnable and blocked tasks, i.e. threads. */
+	ps_read_proc_stat (&forks, &running, &blocked);
+	sleeping = (gauge_t) c_avl_size (match_cache);
+	if (!isnan (running))
+		sleeping -= running;
+	if (!isnan (blocked))
+		sleeping -= blocked;
+	if (sleeping < 0.0)
+		sleeping = 0.0;
+
+	ps_submit_state ("running",  running);
+	ps_submit_state ("sleeping", sleeping);
+	ps_submit_state ("blocked",  blocked);
+	if (forks > 0)
+		ps_submit_fork_rate (forks);
+
+	return (0);
+} /* }}} int ps_read_proc_events */
+#endif /* HAVE_LINUX_CN_PROC_H */
 
 static int read_fork_rate (void)
 {
-	FILE *proc_stat;
+	procfs_snapshot_t *proc_stat;
+	size_t offset = 0;
 	char buffer[1024];
 	value_t value;
 	_Bool value_valid = 0;
 
-	proc_stat = fopen ("/proc/stat", "r");
+	proc_stat = procfs_snapshot_get ("/proc/stat");
 	if (proc_stat == NULL)
 	{
 		char errbuf[1024];
-		ERROR ("processes plugin: fopen (/proc/stat) failed: %s",
+		ERROR ("processes plugin: Reading /proc/stat failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), proc_stat) != NULL)
+	while (procfs_getline (proc_stat, &offset, buffer, sizeof (buffer)) != NULL)
 	{
 		int status;
 		char *fields[3];
@@ -1289,7 +1938,7 @@ static int read_fork_rate (void)
 
 		break;
 	}
-	fclose(proc_stat);
+	procfs_snapshot_put (proc_stat);
 
 	if (!value_valid)
 		return (-1);
@@ -1802,17 +2451,23 @@ static int ps_read (void)
 	DIR           *proc;
 	long           pid;
 
-	char cmdline[CMDLINE_BUFFER_SIZE];
-
-	int        status;
-	procstat_t ps;
-	procstat_entry_t pse;
 	char       state;
 
 	procstat_t *ps_ptr;
 
 	running = sleeping = zombies = stopped = paging = blocked = 0;
 	ps_list_reset ();
+	match_cache_generation++;
+
+#if HAVE_LINUX_CN_PROC_H
+	/* Falls back to scanning all of /proc if events have been lost. */
+	if ((proc_events_fd >= 0) && (ps_read_proc_events () == 0))
+	{
+		for (ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
+			ps_submit_proc_list (ps_ptr);
+		return (0);
+	}
+#endif
 
 	if ((proc = opendir ("/proc")) == NULL)
 	{
@@ -1830,42 +2485,8 @@ static int ps_read (void)
 		if ((pid = atol (ent->d_name)) < 1)
 			continue;
 
-		status = ps_read_process (pid, &ps, &state);
-		if (status != 0)
-		{
-			DEBUG ("ps_read_process failed: %i", status);
+		if (ps_read_pid (dirfd (proc), pid, &state) != 0)
 			continue;
-		}
-
-		memset (&pse, 0, sizeof (pse));
-		pse.id       = pid;
-		pse.age      = 0;
-
-		pse.num_proc   = ps.num_proc;
-		pse.num_lwp    = ps.num_lwp;
-		pse.vmem_size  = ps.vmem_size;
-		pse.vmem_rss   = ps.vmem_rss;
-		pse.vmem_data  = ps.vmem_data;
-		pse.vmem_code  = ps.vmem_code;
-		pse.stack_size = ps.stack_size;
-
-		pse.vmem_minflt = 0;
-		pse.vmem_minflt_counter = ps.vmem_minflt_counter;
-		pse.vmem_majflt = 0;
-		pse.vmem_majflt_counter = ps.vmem_majflt_counter;
-
-		pse.cpu_user = 0;
-		pse.cpu_user_counter = ps.cpu_user_counter;
-		pse.cpu_system = 0;
-		pse.cpu_system_counter = ps.cpu_system_counter;
-
-		pse.io_rchar = ps.io_rchar;
-		pse.io_wchar = ps.io_wchar;
-		pse.io_syscr = ps.io_syscr;
-		pse.io_syscw = ps.io_syscw;
-
-		pse.cswitch_vol = ps.cswitch_vol;
-		pse.cswitch_invol = ps.cswitch_invol;
 
 		switch (state)
 		{
@@ -1876,13 +2497,10 @@ static int ps_read (void)
 			case 'T': stopped++;  break;
 			case 'W': paging++;   break;
 		}
-
-		ps_list_add (ps.name,
-				ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
-				&pse);
 	}
 
 	closedir (proc);
+	ps_match_cache_prune ();
 
 	ps_submit_state ("running",  running);
 	ps_submit_state ("sleeping", sleeping);
@@ -2438,9 +3056,26 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+#if KERNEL_LINUX && HAVE_LINUX_CN_PROC_H
+static int ps_shutdown (void)
+{
+	ps_proc_events_shutdown ();
+	if (proc_dir_fd >= 0)
+	{
+		close (proc_dir_fd);
+		proc_dir_fd = -1;
+	}
+
+	return (0);
+} /* int ps_shutdown */
+#endif
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+#if KERNEL_LINUX && HAVE_LINUX_CN_PROC_H
+	plugin_register_shutdown ("processes", ps_shutdown);
+#endif
 } /* void module_register */
@@ -41,6 +41,10 @@ typedef struct cpy_callback_s {
 	char *name;
 	PyObject *callback;
 	PyObject *data;
+	/* Read callbacks only: the worker process running the callback, counting
+	 * from one, or zero, and its index in cpy_worker_reads. */
+	size_t worker;
+	size_t index;
 	struct cpy_callback_s *next;
 } cpy_callback_t;
 
@@ -144,7 +148,14 @@ static char reg_read_doc[] = "register_read(callback[, interval][, data][, name]
 		"The callback function will be called without parameters, except for\n"
 		"data if it was supplied.";
 
-static char reg_write_doc[] = "register_write(callback[, data][, name]) -> identifier\n"
+static char dispatch_many_doc[] = "dispatch_many(values) -> None\n"
+		"\n"
+		"Dispatches a sequence of Values objects at once, as if 'dispatch' was\n"
+		"called on each of them without arguments. The values are converted\n"
+		"before any of them is dispatched, so if one of the objects is invalid,\n"
+		"nothing is dispatched.";
+
+static char reg_write_doc[] = "register_write(callback[, data][, name][, batch]) -> identifier\n"
 		"\n"
 		"Register a callback function to receive values dispatched by other plugins.\n"
 		"'callback' is a callable object that will be called every time a value\n"
@@ -156,10 +167,14 @@ static char reg_write_doc[] = "register_write(callback[, data][, name]) -> ident
 		"    Every callback needs a unique identifier, so if you want to\n"
 		"    register this callback multiple time from the same module you need\n"
 		"    to specify a name here.\n"
+		"'batch' is an optional boolean. If true, the callback receives a list of\n"
+		"    Values objects, i.e. all values handled by a write thread at once,\n"
+		"    instead of a single object.\n"
 		"'identifier' is the full identifier assigned to this callback.\n"
 		"\n"
 		"The callback function will be called with one or two parameters:\n"
-		"values: A Values object which is a copy of the dispatched values.\n"
+		"values: A Values object which is a copy of the dispatched values, or a\n"
+		"    list of such objects if 'batch' is true.\n"
 		"data: The optional data parameter passed to the register function.\n"
 		"    If the parameter was omitted it will be omitted here, too.";
 
@@ -232,12 +247,23 @@ static PyThreadState *state;
 
 static PyObject *sys_path, *cpy_format_exception;
 
+/* Passed to tp_new when creating objects from C. */
+static PyObject *cpy_empty_tuple;
+
 static cpy_callback_t *cpy_config_callbacks;
 static cpy_callback_t *cpy_init_callbacks;
 static cpy_callback_t *cpy_shutdown_callbacks;
 
+/* The read callbacks run by worker processes, see pyworker.c. */
+static size_t cpy_workers_num;
+static _Bool cpy_workers_started;
+static cpy_callback_t **cpy_worker_reads;
+static size_t cpy_worker_reads_num;
+
 static void cpy_destroy_user_data(void *data) {
 	cpy_callback_t *c = data;
+	if ((c->worker > 0) && (c->index < cpy_worker_reads_num))
+		cpy_worker_reads[c->index] = NULL;
 	free(c->name);
 	Py_DECREF(c->callback);
 	Py_XDECREF(c->data);
@@ -291,7 +317,7 @@ void cpy_log_exception(const char *context) {
 	if (message == NULL)
 		message = "N/A";
 	Py_BEGIN_ALLOW_THREADS
-	ERROR("Unhandled python exception in %s: %s: %s", context, typename, message);
+	cpy_log(LOG_ERR, "Unhandled python exception in %s: %s: %s", context, typename, message);
 	Py_END_ALLOW_THREADS
 	Py_XDECREF(tn);
 	Py_XDECREF(m);
@@ -327,7 +353,7 @@ void cpy_log_exception(const char *context) {
 			cpy[strlen(cpy) - 1] = 0;
 
 		Py_BEGIN_ALLOW_THREADS
-		ERROR("%s", cpy);
+		cpy_log(LOG_ERR, "%s", cpy);
 		Py_END_ALLOW_THREADS
 
 		free(cpy);
@@ -337,8 +363,7 @@ void cpy_log_exception(const char *context) {
 	PyErr_Clear();
 }
 
-static int cpy_read_callback(user_data_t *data) {
-	cpy_callback_t *c = data->data;
+static int cpy_read_call(cpy_callback_t *c) {
 	PyObject *ret;
 
 	CPY_LOCK_THREADS
@@ -354,105 +379,154 @@ static int cpy_read_callback(user_data_t *data) {
 	return 0;
 }
 
-static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
-	size_t i;
+static int cpy_read_callback(user_data_t *data) {
 	cpy_callback_t *c = data->data;
-	PyObject *ret, *list, *temp, *dict = NULL;
+
+	/* The python code runs in a worker, no need for the GIL here. */
+	if (c->worker > 0)
+		return cpy_workers_read(c->worker - 1, c->index, plugin_get_interval());
+
+	return cpy_read_call(c);
+}
+
+/* Called in a worker process. */
+static int cpy_worker_read(size_t index) {
+	if ((index >= cpy_worker_reads_num) || (cpy_worker_reads[index] == NULL))
+		return -1;
+	return cpy_read_call(cpy_worker_reads[index]);
+}
+
+static void cpy_run_init_callbacks(void) {
+	cpy_callback_t *c;
+	PyObject *ret;
+
+	for (c = cpy_init_callbacks; c; c = c->next) {
+		ret = PyObject_CallFunctionObjArgs(c->callback, c->data, (void *) 0); /* New reference. */
+		if (ret == NULL)
+			cpy_log_exception("init callback");
+		else
+			Py_DECREF(ret);
+	}
+}
+
+/* You must hold the GIL to call this function! Returns a new reference or NULL
+ * with an exception set. */
+static PyObject *cpy_values_from_list(const data_set_t *ds, const value_list_t *value_list) {
+	size_t i;
+	PyObject *list, *temp, *num, *dict;
 	Values *v;
 
-	CPY_LOCK_THREADS
-		list = PyList_New(value_list->values_len); /* New reference. */
-		if (list == NULL) {
-			cpy_log_exception("write callback");
-			CPY_RETURN_FROM_THREADS 0;
+	list = PyList_New(value_list->values_len); /* New reference. */
+	if (list == NULL)
+		return NULL;
+	for (i = 0; i < value_list->values_len; ++i) {
+		if (ds->ds[i].type == DS_TYPE_COUNTER) {
+			PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].counter));
+		} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
+			PyList_SetItem(list, i, PyFloat_FromDouble(value_list->values[i].gauge));
+		} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
+			PyList_SetItem(list, i, PyLong_FromLongLong(value_list->values[i].derive));
+		} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
+			PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].absolute));
+		} else {
+			PyErr_Format(PyExc_RuntimeError, "unknown value type %d", ds->ds[i].type);
+			Py_DECREF(list);
+			return NULL;
 		}
-		for (i = 0; i < value_list->values_len; ++i) {
-			if (ds->ds[i].type == DS_TYPE_COUNTER) {
-				PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].counter));
-			} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
-				PyList_SetItem(list, i, PyFloat_FromDouble(value_list->values[i].gauge));
-			} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
-				PyList_SetItem(list, i, PyLong_FromLongLong(value_list->values[i].derive));
-			} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
-				PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].absolute));
-			} else {
-				Py_BEGIN_ALLOW_THREADS
-				ERROR("cpy_write_callback: Unknown value type %d.", ds->ds[i].type);
-				Py_END_ALLOW_THREADS
-				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
-			}
-			if (PyErr_Occurred() != NULL) {
-				cpy_log_exception("value building for write callback");
-				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
-			}
+		if (PyErr_Occurred() != NULL) {
+			Py_DECREF(list);
+			return NULL;
 		}
-		dict = PyDict_New();  /* New reference. */
-		if (value_list->meta) {
-			int num;
-			char **table;
-			meta_data_t *meta = value_list->meta;
-
-			num = meta_data_toc(meta, &table);
-			for (i = 0; i < num; ++i) {
-				int type;
-				char *string;
-				int64_t si;
-				uint64_t ui;
-				double d;
-				_Bool b;
-
-				type = meta_data_type(meta, table[i]);
-				if (type == MD_TYPE_STRING) {
-					if (meta_data_get_string(meta, table[i], &string))
-						continue;
+	}
+	dict = PyDict_New();  /* New reference. */
+	if (dict == NULL) {
+		Py_DECREF(list);
+		return NULL;
+	}
+	if (value_list->meta) {
+		int num_keys;
+		char **table;
+		meta_data_t *meta = value_list->meta;
+
+		num_keys = meta_data_toc(meta, &table);
+		for (i = 0; i < num_keys; ++i) {
+			int type;
+			char *string;
+			int64_t si;
+			uint64_t ui;
+			double d;
+			_Bool b;
+
+			type = meta_data_type(meta, table[i]);
+			if (type == MD_TYPE_STRING) {
+				if (meta_data_get_string(meta, table[i], &string) == 0) {
 					temp = cpy_string_to_unicode_or_bytes(string);  /* New reference. */
 					free(string);
 					PyDict_SetItemString(dict, table[i], temp);
 					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_SIGNED_INT) {
-					if (meta_data_get_signed_int(meta, table[i], &si))
-						continue;
-					temp = PyObject_CallFunctionObjArgs((void *) &SignedType, PyLong_FromLongLong(si), (void *) 0);  /* New reference. */
+				}
+			} else if (type == MD_TYPE_SIGNED_INT) {
+				if (meta_data_get_signed_int(meta, table[i], &si) == 0) {
+					num = PyLong_FromLongLong(si); /* New reference. */
+					temp = PyObject_CallFunctionObjArgs((void *) &SignedType, num, (void *) 0);  /* New reference. */
+					Py_XDECREF(num);
 					PyDict_SetItemString(dict, table[i], temp);
 					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_UNSIGNED_INT) {
-					if (meta_data_get_unsigned_int(meta, table[i], &ui))
-						continue;
-					temp = PyObject_CallFunctionObjArgs((void *) &UnsignedType, PyLong_FromUnsignedLongLong(ui), (void *) 0);  /* New reference. */
+				}
+			} else if (type == MD_TYPE_UNSIGNED_INT) {
+				if (meta_data_get_unsigned_int(meta, table[i], &ui) == 0) {
+					num = PyLong_FromUnsignedLongLong(ui); /* New reference. */
+					temp = PyObject_CallFunctionObjArgs((void *) &UnsignedType, num, (void *) 0);  /* New reference. */
+					Py_XDECREF(num);
 					PyDict_SetItemString(dict, table[i], temp);
 					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_DOUBLE) {
-					if (meta_data_get_double(meta, table[i], &d))
-						continue;
+				}
+			} else if (type == MD_TYPE_DOUBLE) {
+				if (meta_data_get_double(meta, table[i], &d) == 0) {
 					temp = PyFloat_FromDouble(d);  /* New reference. */
 					PyDict_SetItemString(dict, table[i], temp);
 					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_BOOLEAN) {
-					if (meta_data_get_boolean(meta, table[i], &b))
-						continue;
-					if (b)
-						PyDict_SetItemString(dict, table[i], Py_True);
-					else
-						PyDict_SetItemString(dict, table[i], Py_False);
 				}
-				free(table[i]);
+			} else if (type == MD_TYPE_BOOLEAN) {
+				if (meta_data_get_boolean(meta, table[i], &b) == 0)
+					PyDict_SetItemString(dict, table[i], b ? Py_True : Py_False);
 			}
-			free(table);
+			free(table[i]);
+		}
+		free(table);
+	}
+	/* Values_New() would go through the type's __init__, only to replace
+	 * the values and meta members again. Allocate the object directly. */
+	v = (Values *) ValuesType.tp_new(&ValuesType, cpy_empty_tuple, NULL); /* New reference. */
+	if (v == NULL) {
+		Py_DECREF(list);
+		Py_DECREF(dict);
+		return NULL;
+	}
+	sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
+	sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
+	sstrncpy(v->data.type_instance, value_list->type_instance, sizeof(v->data.type_instance));
+	sstrncpy(v->data.plugin, value_list->plugin, sizeof(v->data.plugin));
+	sstrncpy(v->data.plugin_instance, value_list->plugin_instance, sizeof(v->data.plugin_instance));
+	v->data.time = CDTIME_T_TO_DOUBLE(value_list->time);
+	v->interval = CDTIME_T_TO_DOUBLE(value_list->interval);
+	Py_CLEAR(v->values);
+	v->values = list;  /* Steals a reference. */
+	Py_CLEAR(v->meta);
+	v->meta = dict;  /* Steals a reference. */
+	return (PyObject *) v;
+}
+
+static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+	cpy_callback_t *c = data->data;
+	PyObject *ret, *v;
+
+	CPY_LOCK_THREADS
+		v = cpy_values_from_list(ds, value_list); /* New reference. */
+		if (v == NULL) {
+			cpy_log_exception("value building for write callback");
+			CPY_RETURN_FROM_THREADS 0;
 		}
-		v = (Values *) Values_New(); /* New reference. */
-		sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
-		sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
-		sstrncpy(v->data.type_instance, value_list->type_instance, sizeof(v->data.type_instance));
-		sstrncpy(v->data.plugin, value_list->plugin, sizeof(v->data.plugin));
-		sstrncpy(v->data.plugin_instance, value_list->plugin_instance, sizeof(v->data.plugin_instance));
-		v->data.time = CDTIME_T_TO_DOUBLE(value_list->time);
-		v->interval = CDTIME_T_TO_DOUBLE(value_list->interval);
-		Py_CLEAR(v->values);
-		v->values = list;
-		Py_CLEAR(v->meta);
-		v->meta = dict;  /* Steals a reference. */
 		ret = PyObject_CallFunctionObjArgs(c->callback, v, c->data, (void *) 0); /* New reference. */
 		Py_XDECREF(v);
 		if (ret == NULL) {
@@ -464,6 +538,43 @@ static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_li
 	return 0;
 }
 
+/* Takes the GIL once for all value lists of the batch and passes them to the
+ * callback as one list. */
+static int cpy_write_batch_callback(const write_batch_entry_t *entries, size_t entries_num, user_data_t *data) {
+	size_t i;
+	cpy_callback_t *c = data->data;
+	PyObject *ret, *list, *v;
+
+	CPY_LOCK_THREADS
+		list = PyList_New(0); /* New reference. */
+		if (list == NULL) {
+			cpy_log_exception("write callback");
+			CPY_RETURN_FROM_THREADS 0;
+		}
+		for (i = 0; i < entries_num; ++i) {
+			v = cpy_values_from_list(entries[i].ds, entries[i].vl); /* New reference. */
+			if (v == NULL) {
+				cpy_log_exception("value building for write callback");
+				continue;
+			}
+			PyList_Append(list, v);
+			Py_DECREF(v);
+		}
+		if (PyList_GET_SIZE(list) == 0) {
+			Py_DECREF(list);
+			CPY_RETURN_FROM_THREADS 0;
+		}
+		ret = PyObject_CallFunctionObjArgs(c->callback, list, c->data, (void *) 0); /* New reference. */
+		Py_DECREF(list);
+		if (ret == NULL) {
+			cpy_log_exception("write callback");
+		} else {
+			Py_DECREF(ret);
+		}
+	CPY_RELEASE_THREADS
+	return 0;
+}
+
 static int cpy_notification_callback(const notification_t *notification, user_data_t *data) {
 	cpy_callback_t *c = data->data;
 	PyObject *ret, *notify;
@@ -690,6 +801,19 @@ static PyObject *cpy_register_read(PyObject *self, PyObject *args, PyObject *kwd
 	c->data = data;
 	c->next = NULL;
 
+	/* Callbacks registered once the workers have been forked stay here. */
+	if ((cpy_workers_num > 0) && !cpy_workers_started) {
+		cpy_callback_t **tmp;
+
+		tmp = realloc(cpy_worker_reads, (cpy_worker_reads_num + 1) * sizeof(*tmp));
+		if (tmp != NULL) {
+			cpy_worker_reads = tmp;
+			c->index = cpy_worker_reads_num;
+			c->worker = 1 + (c->index % cpy_workers_num);
+			cpy_worker_reads[cpy_worker_reads_num++] = c;
+		}
+	}
+
 	memset (&user_data, 0, sizeof (user_data));
 	user_data.free_func = cpy_destroy_user_data;
 	user_data.data = c;
@@ -705,8 +829,51 @@ static PyObject *cpy_register_log(PyObject *self, PyObject *args, PyObject *kwds
 }
 
 static PyObject *cpy_register_write(PyObject *self, PyObject *args, PyObject *kwds) {
-	return cpy_register_generic_userdata((void *) plugin_register_write,
-			(void *) cpy_write_callback, args, kwds);
+	char buf[512];
+	cpy_callback_t *c = NULL;
+	user_data_t user_data;
+	char *name = NULL;
+	PyObject *callback = NULL, *data = NULL, *batch = NULL;
+	int is_batch = 0;
+	static char *kwlist[] = {"callback", "data", "name", "batch", NULL};
+
+	if (PyArg_ParseTupleAndKeywords(args, kwds, "O|OetO", kwlist, &callback, &data, NULL, &name, &batch) == 0) return NULL;
+	if (PyCallable_Check(callback) == 0) {
+		PyMem_Free(name);
+		PyErr_SetString(PyExc_TypeError, "callback needs a be a callable object.");
+		return NULL;
+	}
+	if (batch != NULL) {
+		is_batch = PyObject_IsTrue(batch);
+		if (is_batch < 0) {
+			PyMem_Free(name);
+			return NULL;
+		}
+	}
+	cpy_build_name(buf, sizeof(buf), callback, name);
+	PyMem_Free(name);
+
+	Py_INCREF(callback);
+	Py_XINCREF(data);
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return NULL;
+
+	c->name = strdup(buf);
+	c->callback = callback;
+	c->data = data;
+	c->next = NULL;
+
+	memset (&user_data, 0, sizeof (user_data));
+	user_data.free_func = cpy_destroy_user_data;
+	user_data.data = c;
+
+	if (is_batch)
+		plugin_register_write_batch(buf, cpy_write_batch_callback, &user_data);
+	else
+		plugin_register_write(buf, cpy_write_callback, &user_data);
+	return cpy_string_to_unicode_or_bytes(buf);
 }
 
 static PyObject *cpy_register_notification(PyObject *self, PyObject *args, PyObject *kwds) {
@@ -727,7 +894,7 @@ static PyObject *cpy_error(PyObject *self, PyObject *args) {
 	char *text;
 	if (PyArg_ParseTuple(args, "et", NULL, &text) == 0) return NULL;
 	Py_BEGIN_ALLOW_THREADS
-	plugin_log(LOG_ERR, "%s", text);
+	cpy_log(LOG_ERR, "%s", text);
 	Py_END_ALLOW_THREADS
 	PyMem_Free(text);
 	Py_RETURN_NONE;
@@ -737,7 +904,7 @@ static PyObject *cpy_warning(PyObject *self, PyObject *args) {
 	char *text;
 	if (PyArg_ParseTuple(args, "et", NULL, &text) == 0) return NULL;
 	Py_BEGIN_ALLOW_THREADS
-	plugin_log(LOG_WARNING, "%s", text);
+	cpy_log(LOG_WARNING, "%s", text);
 	Py_END_ALLOW_THREADS
 	PyMem_Free(text);
 	Py_RETURN_NONE;
@@ -747,7 +914,7 @@ static PyObject *cpy_notice(PyObject *self, PyObject *args) {
 	char *text;
 	if (PyArg_ParseTuple(args, "et", NULL, &text) == 0) return NULL;
 	Py_BEGIN_ALLOW_THREADS
-	plugin_log(LOG_NOTICE, "%s", text);
+	cpy_log(LOG_NOTICE, "%s", text);
 	Py_END_ALLOW_THREADS
 	PyMem_Free(text);
 	Py_RETURN_NONE;
@@ -757,7 +924,7 @@ static PyObject *cpy_info(PyObject *self, PyObject *args) {
 	char *text;
 	if (PyArg_ParseTuple(args, "et", NULL, &text) == 0) return NULL;
 	Py_BEGIN_ALLOW_THREADS
-	plugin_log(LOG_INFO, "%s", text);
+	cpy_log(LOG_INFO, "%s", text);
 	Py_END_ALLOW_THREADS
 	PyMem_Free(text);
 	Py_RETURN_NONE;
@@ -768,7 +935,7 @@ static PyObject *cpy_debug(PyObject *self, PyObject *args) {
 	char *text;
 	if (PyArg_ParseTuple(args, "et", NULL, &text) == 0) return NULL;
 	Py_BEGIN_ALLOW_THREADS
-	plugin_log(LOG_DEBUG, "%s", text);
+	cpy_log(LOG_DEBUG, "%s", text);
 	Py_END_ALLOW_THREADS
 	PyMem_Free(text);
 #endif
@@ -878,6 +1045,7 @@ static PyMethodDef cpy_methods[] = {
 	{"error", cpy_error, METH_VARARGS, log_doc},
 	{"get_dataset", (PyCFunction) cpy_get_dataset, METH_VARARGS, get_ds_doc},
 	{"flush", (PyCFunction) cpy_flush, METH_VARARGS | METH_KEYWORDS, flush_doc},
+	{"dispatch_many", cpy_dispatch_many, METH_VARARGS, dispatch_many_doc},
 	{"register_log", (PyCFunction) cpy_register_log, METH_VARARGS | METH_KEYWORDS, reg_log_doc},
 	{"register_init", (PyCFunction) cpy_register_init, METH_VARARGS | METH_KEYWORDS, reg_init_doc},
 	{"register_config", (PyCFunction) cpy_register_config, METH_VARARGS | METH_KEYWORDS, reg_config_doc},
@@ -901,6 +1069,9 @@ static int cpy_shutdown(void) {
 	cpy_callback_t *c;
 	PyObject *ret;
 
+	/* Stop the workers first, read callbacks may still be waiting for them. */
+	cpy_workers_stop();
+
 	/* This can happen if the module was loaded but not configured. */
 	if (state != NULL)
 		PyEval_RestoreThread(state);
@@ -913,6 +1084,7 @@ static int cpy_shutdown(void) {
 			Py_DECREF(ret);
 	}
 	PyErr_Print();
+	Py_CLEAR(cpy_empty_tuple);
 	Py_Finalize();
 	return 0;
 }
@@ -969,8 +1141,6 @@ static void *cpy_interactive(void *data) {
 }
 
 static int cpy_init(void) {
-	cpy_callback_t *c;
-	PyObject *ret;
 	static pthread_t thread;
 	sigset_t sigset;
 
@@ -981,13 +1151,7 @@ static int cpy_init(void) {
 	}
 	PyEval_InitThreads();
 	/* Now it's finally OK to use python threads. */
-	for (c = cpy_init_callbacks; c; c = c->next) {
-		ret = PyObject_CallFunctionObjArgs(c->callback, c->data, (void *) 0); /* New reference. */
-		if (ret == NULL)
-			cpy_log_exception("init callback");
-		else
-			Py_DECREF(ret);
-	}
+	cpy_run_init_callbacks();
 	sigemptyset(&sigset);
 	sigaddset(&sigset, SIGINT);
 	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
@@ -1071,6 +1235,11 @@ static int cpy_init_python(void) {
 	PyType_Ready(&SignedType);
 	UnsignedType.tp_base = &PyLong_Type;
 	PyType_Ready(&UnsignedType);
+	cpy_empty_tuple = PyTuple_New(0); /* New reference. */
+	if (cpy_empty_tuple == NULL) {
+		cpy_log_exception("python initialization");
+		return 1;
+	}
 	sys = PyImport_ImportModule("sys"); /* New reference. */
 	if (sys == NULL) {
 		cpy_log_exception("python initialization");
@@ -1130,6 +1299,18 @@ static int cpy_config(oconfig_item_t *ci) {
 			if (item->values_num != 1 || item->values[0].type != OCONFIG_TYPE_BOOLEAN)
 				continue;
 			do_interactive = item->values[0].value.boolean;
+		} else if (strcasecmp(item->key, "Workers") == 0) {
+			int num = 0;
+
+			if (cpy_workers_started) {
+				WARNING("python plugin: The worker processes have already been started. Ignoring \"Workers\".");
+				continue;
+			}
+			if ((cf_util_get_int(item, &num) != 0) || (num < 0)) {
+				ERROR("python plugin: \"Workers\" needs a non-negative number.");
+				continue;
+			}
+			cpy_workers_num = (size_t) num;
 		} else if (strcasecmp(item->key, "Encoding") == 0) {
 			if (item->values_num != 1 || item->values[0].type != OCONFIG_TYPE_STRING)
 				continue;
@@ -1226,6 +1407,21 @@ static int cpy_config(oconfig_item_t *ci) {
 			WARNING("python plugin: Ignoring unknown config key \"%s\".", item->key);
 		}
 	}
+
+	/* Fork while collectd is single-threaded, i.e. still reading its config. */
+	if ((cpy_worker_reads_num > 0) && !cpy_workers_started) {
+		size_t i;
+
+		cpy_workers_started = 1;
+		if (cpy_workers_start(cpy_workers_num, cpy_run_init_callbacks, cpy_worker_read) != 0) {
+			ERROR("python plugin: Starting the worker processes failed. "
+					"Running all callbacks in the collectd process.");
+			for (i = 0; i < cpy_worker_reads_num; ++i)
+				if (cpy_worker_reads[i] != NULL)
+					cpy_worker_reads[i]->worker = 0;
+			cpy_worker_reads_num = 0;
+		}
+	}
 	return 0;
 }
 
@@ -501,37 +501,23 @@ static meta_data_t *cpy_build_meta(PyObject *meta) {
 	return m;
 }
 
-static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
-	int ret;
+/* Completes "value_list", whose identifier has been set by the caller, with the
+ * values, meta data, time and interval. On success, the caller has to free
+ * "value_list->values" and "value_list->meta". Returns the data set or NULL with
+ * an exception set. */
+static const data_set_t *cpy_build_value_list(value_list_t *value_list, PyObject *values,
+		PyObject *meta, double time, double interval) {
 	const data_set_t *ds;
 	size_t size, i;
 	value_t *value;
-	value_list_t value_list = VALUE_LIST_INIT;
-	PyObject *values = self->values, *meta = self->meta;
-	double time = self->data.time, interval = self->interval;
-	char *host = NULL, *plugin = NULL, *plugin_instance = NULL, *type = NULL, *type_instance = NULL;
-
-	static char *kwlist[] = {"type", "values", "plugin_instance", "type_instance",
-			"plugin", "host", "time", "interval", "meta", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etOetetetetddO", kwlist,
-			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
-			NULL, &plugin, NULL, &host, &time, &interval, &meta))
-		return NULL;
 
-	sstrncpy(value_list.host, host ? host : self->data.host, sizeof(value_list.host));
-	sstrncpy(value_list.plugin, plugin ? plugin : self->data.plugin, sizeof(value_list.plugin));
-	sstrncpy(value_list.plugin_instance, plugin_instance ? plugin_instance : self->data.plugin_instance, sizeof(value_list.plugin_instance));
-	sstrncpy(value_list.type, type ? type : self->data.type, sizeof(value_list.type));
-	sstrncpy(value_list.type_instance, type_instance ? type_instance : self->data.type_instance, sizeof(value_list.type_instance));
-	FreeAll();
-	if (value_list.type[0] == 0) {
+	if (value_list->type[0] == 0) {
 		PyErr_SetString(PyExc_RuntimeError, "type not set");
-		FreeAll();
 		return NULL;
 	}
-	ds = plugin_get_ds(value_list.type);
+	ds = plugin_get_ds(value_list->type);
 	if (ds == NULL) {
-		PyErr_Format(PyExc_TypeError, "Dataset %s not found", value_list.type);
+		PyErr_Format(PyExc_TypeError, "Dataset %s not found", value_list->type);
 		return NULL;
 	}
 	if (values == NULL || (PyTuple_Check(values) == 0 && PyList_Check(values) == 0)) {
@@ -544,26 +530,30 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 	}
 	size = (size_t) PySequence_Length(values);
 	if (size != ds->ds_num) {
-		PyErr_Format(PyExc_RuntimeError, "type %s needs %zu values, got %zu", value_list.type, ds->ds_num, size);
+		PyErr_Format(PyExc_RuntimeError, "type %s needs %zu values, got %zu", value_list->type, ds->ds_num, size);
 		return NULL;
 	}
 	value = calloc(size, sizeof(*value));
+	if (value == NULL) {
+		PyErr_NoMemory();
+		return NULL;
+	}
 	for (i = 0; i < size; ++i) {
 		PyObject *item, *num;
 		item = PySequence_Fast_GET_ITEM(values, (int) i); /* Borrowed reference. */
-		if (ds->ds->type == DS_TYPE_COUNTER) {
+		if (ds->ds[i].type == DS_TYPE_COUNTER) {
 			num = PyNumber_Long(item); /* New reference. */
 			if (num != NULL) {
 				value[i].counter = PyLong_AsUnsignedLongLong(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_GAUGE) {
+		} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
 			num = PyNumber_Float(item); /* New reference. */
 			if (num != NULL) {
 				value[i].gauge = PyFloat_AsDouble(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_DERIVE) {
+		} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
 			/* This might overflow without raising an exception.
 			 * Not much we can do about it */
 			num = PyNumber_Long(item); /* New reference. */
@@ -571,7 +561,7 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 				value[i].derive = PyLong_AsLongLong(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_ABSOLUTE) {
+		} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
 			/* This might overflow without raising an exception.
 			 * Not much we can do about it */
 			num = PyNumber_Long(item); /* New reference. */
@@ -581,7 +571,7 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 			}
 		} else {
 			free(value);
-			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds->type, value_list.type);
+			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds[i].type, value_list->type);
 			return NULL;
 		}
 		if (PyErr_Occurred() != NULL) {
@@ -589,20 +579,47 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 			return NULL;
 		}
 	}
-	value_list.values = value;
-	value_list.meta = cpy_build_meta(meta);
-	value_list.values_len = size;
-	value_list.time = DOUBLE_TO_CDTIME_T(time);
-	value_list.interval = DOUBLE_TO_CDTIME_T(interval);
-	if (value_list.host[0] == 0)
-		sstrncpy(value_list.host, hostname_g, sizeof(value_list.host));
-	if (value_list.plugin[0] == 0)
-		sstrncpy(value_list.plugin, "python", sizeof(value_list.plugin));
+	value_list->values = value;
+	value_list->meta = cpy_build_meta(meta);
+	value_list->values_len = size;
+	value_list->time = DOUBLE_TO_CDTIME_T(time);
+	value_list->interval = DOUBLE_TO_CDTIME_T(interval);
+	if (value_list->host[0] == 0)
+		sstrncpy(value_list->host, hostname_g, sizeof(value_list->host));
+	if (value_list->plugin[0] == 0)
+		sstrncpy(value_list->plugin, "python", sizeof(value_list->plugin));
+	return ds;
+}
+
+static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
+	int ret;
+	const data_set_t *ds;
+	value_list_t value_list = VALUE_LIST_INIT;
+	PyObject *values = self->values, *meta = self->meta;
+	double time = self->data.time, interval = self->interval;
+	char *host = NULL, *plugin = NULL, *plugin_instance = NULL, *type = NULL, *type_instance = NULL;
+
+	static char *kwlist[] = {"type", "values", "plugin_instance", "type_instance",
+			"plugin", "host", "time", "interval", "meta", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etOetetetetddO", kwlist,
+			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
+			NULL, &plugin, NULL, &host, &time, &interval, &meta))
+		return NULL;
+
+	sstrncpy(value_list.host, host ? host : self->data.host, sizeof(value_list.host));
+	sstrncpy(value_list.plugin, plugin ? plugin : self->data.plugin, sizeof(value_list.plugin));
+	sstrncpy(value_list.plugin_instance, plugin_instance ? plugin_instance : self->data.plugin_instance, sizeof(value_list.plugin_instance));
+	sstrncpy(value_list.type, type ? type : self->data.type, sizeof(value_list.type));
+	sstrncpy(value_list.type_instance, type_instance ? type_instance : self->data.type_instance, sizeof(value_list.type_instance));
+	FreeAll();
+	ds = cpy_build_value_list(&value_list, values, meta, time, interval);
+	if (ds == NULL)
+		return NULL;
 	Py_BEGIN_ALLOW_THREADS;
-	ret = plugin_dispatch_values(&value_list);
+	ret = cpy_dispatch_values(ds, &value_list);
 	Py_END_ALLOW_THREADS;
 	meta_data_destroy(value_list.meta);
-	free(value);
+	free(value_list.values);
 	if (ret != 0) {
 		PyErr_SetString(PyExc_RuntimeError, "error dispatching values, read the logs");
 		return NULL;
@@ -610,6 +627,80 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 	Py_RETURN_NONE;
 }
 
+PyObject *cpy_dispatch_many(PyObject *self, PyObject *args) {
+	PyObject *seq, *fast;
+	value_list_t *vls;
+	const data_set_t **dss;
+	Py_ssize_t num, i, built = 0;
+	size_t failed = 0;
+	int status = -1;
+
+	if (!PyArg_ParseTuple(args, "O", &seq))
+		return NULL;
+	fast = PySequence_Fast(seq, "dispatch_many needs a sequence of Values objects"); /* New reference. */
+	if (fast == NULL)
+		return NULL;
+	num = PySequence_Fast_GET_SIZE(fast);
+	if (num == 0) {
+		Py_DECREF(fast);
+		Py_RETURN_NONE;
+	}
+
+	vls = calloc((size_t) num, sizeof(*vls));
+	dss = calloc((size_t) num, sizeof(*dss));
+	if (vls == NULL || dss == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	/* Convert everything first, so that nothing is dispatched if one of the
+	 * objects is invalid, and to release the GIL only once. */
+	for (i = 0; i < num; ++i) {
+		value_list_t vl_init = VALUE_LIST_INIT;
+		PyObject *item = PySequence_Fast_GET_ITEM(fast, i); /* Borrowed reference. */
+		Values *v;
+
+		if (!PyObject_TypeCheck(item, &ValuesType)) {
+			PyErr_Format(PyExc_TypeError, "item %zd is not a Values object", i);
+			goto out;
+		}
+		v = (Values *) item;
+		vls[i] = vl_init;
+		sstrncpy(vls[i].host, v->data.host, sizeof(vls[i].host));
+		sstrncpy(vls[i].plugin, v->data.plugin, sizeof(vls[i].plugin));
+		sstrncpy(vls[i].plugin_instance, v->data.plugin_instance, sizeof(vls[i].plugin_instance));
+		sstrncpy(vls[i].type, v->data.type, sizeof(vls[i].type));
+		sstrncpy(vls[i].type_instance, v->data.type_instance, sizeof(vls[i].type_instance));
+		dss[i] = cpy_build_value_list(vls + i, v->values, v->meta, v->data.time, v->interval);
+		if (dss[i] == NULL)
+			goto out;
+		built++;
+	}
+
+	Py_BEGIN_ALLOW_THREADS;
+	for (i = 0; i < num; ++i)
+		if (cpy_dispatch_values(dss[i], vls + i) != 0)
+			failed++;
+	Py_END_ALLOW_THREADS;
+
+	if (failed > 0)
+		PyErr_Format(PyExc_RuntimeError, "%zu of %zd value lists could not be dispatched, read the logs", failed, num);
+	else
+		status = 0;
+
+out:
+	for (i = 0; i < built; ++i) {
+		meta_data_destroy(vls[i].meta);
+		free(vls[i].values);
+	}
+	free(vls);
+	free(dss);
+	Py_DECREF(fast);
+	if (status != 0)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
 static PyObject *Values_write(Values *self, PyObject *args, PyObject *kwds) {
 	int ret;
 	const data_set_t *ds;
@@ -622,6 +713,11 @@ static PyObject *Values_write(Values *self, PyObject *args, PyObject *kwds) {
 
 	static char *kwlist[] = {"destination", "type", "values", "plugin_instance", "type_instance",
 			"plugin", "host", "time", "interval", "meta", NULL};
+	/* The write callbacks are in the collectd process. */
+	if (cpy_in_worker()) {
+		PyErr_SetString(PyExc_RuntimeError, "write is not available in a worker process");
+		return NULL;
+	}
 	if (!PyArg_ParseTupleAndKeywords(args, kwds, "et|etOetetetetdiO", kwlist, NULL, &dest,
 			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
 			NULL, &plugin, NULL, &host, &time, &interval, &meta))
@@ -916,7 +1012,7 @@ static PyObject *Notification_dispatch(Notification *self, PyObject *args, PyObj
 	if (notification.plugin[0] == 0)
 		sstrncpy(notification.plugin, "python", sizeof(notification.plugin));
 	Py_BEGIN_ALLOW_THREADS;
-	ret = plugin_dispatch_notification(&notification);
+	ret = cpy_dispatch_notification(&notification);
 	Py_END_ALLOW_THREADS;
 	if (ret != 0) {
 		PyErr_SetString(PyExc_RuntimeError, "error dispatching notification, read the logs");
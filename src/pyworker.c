@@ -0,0 +1,649 @@
+/**
+ * collectd - src/pyworker.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Worker processes for the read callbacks of python modules.
+ *
+ * All python callbacks of one process share the GIL. With "Workers", the
+ * read callbacks registered while the configuration is read run in separate
+ * processes instead. At the end of the configuration, while collectd is still
+ * single-threaded, a "zygote" process is forked. It does nothing but fork
+ * workers on request and hand one end of a socket pair to each to collectd,
+ * so that crashed workers can be replaced without forking the (by then
+ * multi-threaded) collectd process.
+ *
+ * collectd sends "R <index>\n" to trigger a read callback. The worker answers
+ * with the values, notifications and log messages of the callback, one per
+ * line with tab separated fields, and a final "D\t<status>\n":
+ *
+ *   V <interval> <identifier> <time>:<value>[:<value>...]
+ *   N <severity> <time> <host> <plugin> <plugin instance> <type>
+ *     <type instance> <message>
+ *   L <severity> <message>
+ *
+ * The lines are buffered and sent in batches. Meta data is not passed on.
+ */
+
+#include <Python.h>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "collectd.h"
+#include "common.h"
+
+#include "cpython.h"
+
+/* The longest line sent by a worker. */
+#define CPY_WORKER_LINE_MAX 8192
+/* Output of a worker is sent once this much is buffered. */
+#define CPY_WORKER_BUFFER_SIZE 65536
+
+typedef struct {
+	pthread_mutex_t lock;
+	pid_t pid;
+	int fd; /* -1 if the worker is not running. */
+
+	char buffer[CPY_WORKER_LINE_MAX];
+	size_t buffer_fill;
+} cpy_worker_t;
+
+/* State of the collectd process. */
+static cpy_worker_t *cpy_workers;
+static size_t cpy_workers_num;
+
+static pthread_mutex_t cpy_zygote_lock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t cpy_zygote_pid = -1;
+static int cpy_zygote_fd = -1;
+
+/* State of a worker process. */
+static int cpy_worker_fd = -1;
+static char *cpy_worker_out;
+static size_t cpy_worker_out_fill;
+
+static cpy_worker_init_t cpy_worker_init_cb;
+static cpy_worker_read_t cpy_worker_read_cb;
+
+static void cpy_after_fork(void) {
+#if PY_VERSION_HEX >= 0x03070000
+	PyOS_AfterFork_Child();
+#else
+	PyOS_AfterFork();
+#endif
+}
+
+/*
+ * Worker process
+ */
+_Bool cpy_in_worker(void) {
+	return (cpy_worker_fd >= 0);
+}
+
+static void cpy_worker_flush(void) {
+	if (cpy_worker_out_fill == 0)
+		return;
+
+	/* collectd has gone away or killed us. */
+	if (swrite(cpy_worker_fd, cpy_worker_out, cpy_worker_out_fill) != 0)
+		_exit(1);
+	cpy_worker_out_fill = 0;
+}
+
+static void cpy_worker_send(const char *line, size_t len) {
+	if ((cpy_worker_out_fill + len) > CPY_WORKER_BUFFER_SIZE)
+		cpy_worker_flush();
+
+	if (len > CPY_WORKER_BUFFER_SIZE) {
+		if (swrite(cpy_worker_fd, line, len) != 0)
+			_exit(1);
+		return;
+	}
+
+	memcpy(cpy_worker_out + cpy_worker_out_fill, line, len);
+	cpy_worker_out_fill += len;
+}
+
+/* Tabs and newlines would break the line format. */
+static void cpy_worker_escape(char *str) {
+	for (; *str != 0; str++)
+		if ((*str == '\t') || (*str == '\n') || (*str == '\r'))
+			*str = ' ';
+}
+
+static int cpy_worker_send_values(const data_set_t *ds, value_list_t *vl) {
+	char line[CPY_WORKER_LINE_MAX];
+	char name[6 * DATA_MAX_NAME_LEN];
+	char values[CPY_WORKER_LINE_MAX - sizeof(name) - 64];
+	char interval[64];
+	int len;
+
+	/* parse_values() takes a zero time as the first value. */
+	if (vl->time == 0)
+		vl->time = cdtime();
+
+	if (FORMAT_VL(name, sizeof(name), vl) != 0)
+		return -1;
+	if (format_values(values, sizeof(values), ds, vl, /* store rates = */ 0) != 0)
+		return -1;
+	format_fixed(interval, sizeof(interval), CDTIME_T_TO_DOUBLE(vl->interval), 3);
+
+	cpy_worker_escape(name);
+	len = ssnprintf(line, sizeof(line), "V\t%s\t%s\t%s\n", interval, name, values);
+	if ((len < 0) || ((size_t) len >= sizeof(line)))
+		return -1;
+
+	cpy_worker_send(line, (size_t) len);
+	return 0;
+}
+
+int cpy_dispatch_values(const data_set_t *ds, value_list_t *vl) {
+	if (!cpy_in_worker())
+		return plugin_dispatch_values_ds(ds, vl);
+	return cpy_worker_send_values(ds, vl);
+}
+
+int cpy_dispatch_notification(notification_t *n) {
+	char line[CPY_WORKER_LINE_MAX];
+	char time[64];
+	int len;
+
+	if (!cpy_in_worker())
+		return plugin_dispatch_notification(n);
+
+	format_fixed(time, sizeof(time), CDTIME_T_TO_DOUBLE(n->time), 3);
+	cpy_worker_escape(n->host);
+	cpy_worker_escape(n->plugin);
+	cpy_worker_escape(n->plugin_instance);
+	cpy_worker_escape(n->type);
+	cpy_worker_escape(n->type_instance);
+	cpy_worker_escape(n->message);
+	len = ssnprintf(line, sizeof(line), "N\t%i\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n",
+			n->severity, time, n->host, n->plugin, n->plugin_instance,
+			n->type, n->type_instance, n->message);
+	if ((len < 0) || ((size_t) len >= sizeof(line)))
+		return -1;
+
+	cpy_worker_send(line, (size_t) len);
+	return 0;
+}
+
+void cpy_log(int severity, const char *format, ...) {
+	char msg[1024];
+	char line[sizeof(msg) + 32];
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	vsnprintf(msg, sizeof(msg), format, ap);
+	msg[sizeof(msg) - 1] = 0;
+	va_end(ap);
+
+	if (!cpy_in_worker()) {
+		plugin_log(severity, "%s", msg);
+		return;
+	}
+
+	cpy_worker_escape(msg);
+	len = ssnprintf(line, sizeof(line), "L\t%i\t%s\n", severity, msg);
+	if (len > 0)
+		cpy_worker_send(line, strlen(line));
+}
+
+/* Reads the next request. Returns the callback index or -1 once collectd
+ * closed the connection. */
+static ssize_t cpy_worker_receive_request(void) {
+	char buffer[64];
+	size_t fill = 0;
+
+	while (fill < sizeof(buffer) - 1) {
+		ssize_t status;
+
+		Py_BEGIN_ALLOW_THREADS
+		status = read(cpy_worker_fd, buffer + fill, 1);
+		Py_END_ALLOW_THREADS
+		if ((status < 0) && (errno == EINTR))
+			continue;
+		if (status <= 0)
+			return -1;
+
+		if (buffer[fill] == '\n') {
+			buffer[fill] = 0;
+			if (buffer[0] != 'R')
+				return -1;
+			return (ssize_t) strtoul(buffer + 1, NULL, 10);
+		}
+		fill++;
+	}
+
+	return -1;
+}
+
+static void cpy_worker_main(int fd) {
+	ssize_t index;
+
+	cpy_worker_fd = fd;
+	cpy_worker_out = malloc(CPY_WORKER_BUFFER_SIZE);
+	if (cpy_worker_out == NULL)
+		_exit(1);
+
+	cpy_worker_init_cb();
+	cpy_worker_flush();
+
+	while ((index = cpy_worker_receive_request()) >= 0) {
+		char line[64];
+		int status;
+
+		status = cpy_worker_read_cb((size_t) index);
+		ssnprintf(line, sizeof(line), "D\t%i\n", status);
+		cpy_worker_send(line, strlen(line));
+		cpy_worker_flush();
+	}
+
+	_exit(0);
+}
+
+/*
+ * Zygote process
+ */
+static int cpy_zygote_send(int fd, pid_t pid, int worker_fd) {
+	struct msghdr msg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(int))];
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &pid;
+	iov.iov_len = sizeof(pid);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (worker_fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &worker_fd, sizeof(int));
+	}
+
+	while (sendmsg(fd, &msg, 0) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+static void cpy_zygote_main(int fd) {
+	/* Workers are reaped automatically. */
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	while (42) {
+		char c;
+		ssize_t status;
+		int sv[2];
+		pid_t pid;
+
+		status = read(fd, &c, 1);
+		if ((status < 0) && (errno == EINTR))
+			continue;
+		if (status <= 0)
+			_exit(0);
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+			cpy_zygote_send(fd, -1, -1);
+			continue;
+		}
+
+		pid = fork();
+		if (pid == 0) {
+			close(fd);
+			close(sv[0]);
+			signal(SIGCHLD, SIG_DFL);
+			cpy_after_fork();
+			cpy_worker_main(sv[1]);
+		}
+
+		close(sv[1]);
+		cpy_zygote_send(fd, pid, (pid > 0) ? sv[0] : -1);
+		close(sv[0]);
+	}
+}
+
+/*
+ * collectd process
+ */
+static int cpy_worker_spawn(cpy_worker_t *w) {
+	struct msghdr msg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	pid_t pid = -1;
+	char c = 'F';
+
+	pthread_mutex_lock(&cpy_zygote_lock);
+	if ((cpy_zygote_fd < 0) || (swrite(cpy_zygote_fd, &c, 1) != 0)) {
+		pthread_mutex_unlock(&cpy_zygote_lock);
+		ERROR("python plugin: Unable to start a worker: "
+				"the zygote process has gone away.");
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = &pid;
+	iov.iov_len = sizeof(pid);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	while (recvmsg(cpy_zygote_fd, &msg, 0) < 0) {
+		if (errno != EINTR) {
+			pthread_mutex_unlock(&cpy_zygote_lock);
+			ERROR("python plugin: recvmsg from the zygote process failed.");
+			return -1;
+		}
+	}
+	pthread_mutex_unlock(&cpy_zygote_lock);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((pid <= 0) || (cmsg == NULL) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+		ERROR("python plugin: The zygote process failed to start a worker.");
+		return -1;
+	}
+
+	memcpy(&w->fd, CMSG_DATA(cmsg), sizeof(int));
+	fcntl(w->fd, F_SETFD, FD_CLOEXEC);
+	w->pid = pid;
+	w->buffer_fill = 0;
+
+	DEBUG("python plugin: Started worker with PID %i.", (int) pid);
+	return 0;
+}
+
+static void cpy_worker_kill(cpy_worker_t *w) {
+	if (w->fd < 0)
+		return;
+
+	kill(w->pid, SIGKILL);
+	close(w->fd);
+	w->fd = -1;
+	w->pid = -1;
+	w->buffer_fill = 0;
+}
+
+static void cpy_worker_handle_values(char **fields, size_t fields_num) {
+	value_list_t vl = VALUE_LIST_INIT;
+	const data_set_t *ds;
+
+	if (fields_num != 4)
+		return;
+	if (parse_identifier_vl(fields[2], &vl) != 0)
+		return;
+
+	ds = plugin_get_ds(vl.type);
+	if (ds == NULL)
+		return;
+
+	vl.values = calloc(ds->ds_num, sizeof(*vl.values));
+	if (vl.values == NULL)
+		return;
+	vl.values_len = ds->ds_num;
+	vl.interval = DOUBLE_TO_CDTIME_T(atof(fields[1]));
+
+	if (parse_values(fields[3], &vl, ds) == 0)
+		plugin_dispatch_values(&vl);
+	else
+		ERROR("python plugin: Invalid values from a worker for \"%s\".", fields[2]);
+
+	sfree(vl.values);
+}
+
+static void cpy_worker_handle_notification(char **fields, size_t fields_num) {
+	notification_t n;
+
+	if (fields_num != 9)
+		return;
+
+	memset(&n, 0, sizeof(n));
+	n.severity = atoi(fields[1]);
+	n.time = DOUBLE_TO_CDTIME_T(atof(fields[2]));
+	sstrncpy(n.host, fields[3], sizeof(n.host));
+	sstrncpy(n.plugin, fields[4], sizeof(n.plugin));
+	sstrncpy(n.plugin_instance, fields[5], sizeof(n.plugin_instance));
+	sstrncpy(n.type, fields[6], sizeof(n.type));
+	sstrncpy(n.type_instance, fields[7], sizeof(n.type_instance));
+	sstrncpy(n.message, fields[8], sizeof(n.message));
+
+	plugin_dispatch_notification(&n);
+}
+
+/* Handles one line from a worker. Returns zero and sets "ret_done" once the
+ * final line was received. */
+static int cpy_worker_handle_line(char *line, _Bool *ret_done, int *ret_status) {
+	char *fields[9];
+	size_t fields_num = 0;
+	char *ptr = line;
+
+	while ((ptr != NULL) && (fields_num < STATIC_ARRAY_SIZE(fields))) {
+		fields[fields_num++] = ptr;
+		ptr = strchr(ptr, '\t');
+		if (ptr != NULL)
+			*(ptr++) = 0;
+	}
+
+	if (strcmp("V", fields[0]) == 0)
+		cpy_worker_handle_values(fields, fields_num);
+	else if (strcmp("N", fields[0]) == 0)
+		cpy_worker_handle_notification(fields, fields_num);
+	else if ((strcmp("L", fields[0]) == 0) && (fields_num == 3))
+		plugin_log(atoi(fields[1]), "%s", fields[2]);
+	else if ((strcmp("D", fields[0]) == 0) && (fields_num == 2)) {
+		*ret_done = 1;
+		*ret_status = atoi(fields[1]);
+	} else {
+		ERROR("python plugin: Invalid line from a worker.");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Handles the output of the worker until the read callback is done. Returns
+ * the status of the callback or -1 if the worker failed. */
+static int cpy_worker_receive(cpy_worker_t *w, cdtime_t timeout) {
+	cdtime_t deadline = cdtime() + timeout;
+
+	while (42) {
+		struct pollfd pfd;
+		cdtime_t now;
+		char *end;
+		ssize_t status;
+
+		/* Handle all complete lines. */
+		while ((end = memchr(w->buffer, '\n', w->buffer_fill)) != NULL) {
+			size_t len = (size_t) (end - w->buffer) + 1;
+			_Bool done = 0;
+			int read_status = 0;
+
+			*end = 0;
+			if (cpy_worker_handle_line(w->buffer, &done, &read_status) != 0)
+				return -1;
+
+			memmove(w->buffer, w->buffer + len, w->buffer_fill - len);
+			w->buffer_fill -= len;
+
+			if (done)
+				return read_status;
+		}
+
+		if (w->buffer_fill >= sizeof(w->buffer)) {
+			ERROR("python plugin: Line from worker %i is too long.", (int) w->pid);
+			return -1;
+		}
+
+		now = cdtime();
+		if (now >= deadline) {
+			ERROR("python plugin: Worker %i did not finish a read callback "
+					"within %.3f seconds.", (int) w->pid, CDTIME_T_TO_DOUBLE(timeout));
+			return -1;
+		}
+
+		pfd.fd = w->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		status = poll(&pfd, 1, (int) CDTIME_T_TO_MS(deadline - now) + 1);
+		if ((status < 0) && (errno == EINTR))
+			continue;
+		if (status <= 0)
+			continue;
+
+		status = read(w->fd, w->buffer + w->buffer_fill,
+				sizeof(w->buffer) - w->buffer_fill);
+		if ((status < 0) && (errno == EINTR))
+			continue;
+		if (status <= 0) {
+			ERROR("python plugin: Worker %i exited.", (int) w->pid);
+			return -1;
+		}
+		w->buffer_fill += (size_t) status;
+	}
+}
+
+int cpy_workers_read(size_t worker, size_t index, cdtime_t timeout) {
+	cpy_worker_t *w;
+	char request[64];
+	int status;
+
+	if (worker >= cpy_workers_num)
+		return -1;
+	w = cpy_workers + worker;
+
+	pthread_mutex_lock(&w->lock);
+
+	if ((w->fd < 0) && (cpy_worker_spawn(w) != 0)) {
+		pthread_mutex_unlock(&w->lock);
+		return -1;
+	}
+
+	ssnprintf(request, sizeof(request), "R %zu\n", index);
+	status = swrite(w->fd, request, strlen(request));
+	if (status == 0)
+		status = cpy_worker_receive(w, timeout);
+	else
+		status = -1;
+
+	/* The next read starts a new worker. */
+	if (status < 0) {
+		WARNING("python plugin: Restarting worker %zu.", worker);
+		cpy_worker_kill(w);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+	return status;
+}
+
+int cpy_workers_start(size_t workers_num, cpy_worker_init_t init, cpy_worker_read_t read) {
+	int sv[2];
+	pid_t pid;
+	size_t i;
+
+	if ((workers_num == 0) || (cpy_workers != NULL))
+		return -1;
+
+	cpy_workers = calloc(workers_num, sizeof(*cpy_workers));
+	if (cpy_workers == NULL)
+		return -1;
+	for (i = 0; i < workers_num; ++i) {
+		pthread_mutex_init(&cpy_workers[i].lock, NULL);
+		cpy_workers[i].fd = -1;
+		cpy_workers[i].pid = -1;
+	}
+	cpy_workers_num = workers_num;
+
+	cpy_worker_init_cb = init;
+	cpy_worker_read_cb = read;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		char errbuf[1024];
+		ERROR("python plugin: socketpair failed: %s",
+				sstrerror(errno, errbuf, sizeof(errbuf)));
+		cpy_workers_stop();
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		char errbuf[1024];
+		ERROR("python plugin: fork failed: %s",
+				sstrerror(errno, errbuf, sizeof(errbuf)));
+		close(sv[0]);
+		close(sv[1]);
+		cpy_workers_stop();
+		return -1;
+	} else if (pid == 0) {
+		close(sv[0]);
+		cpy_after_fork();
+		cpy_zygote_main(sv[1]);
+	}
+
+	close(sv[1]);
+	fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+	cpy_zygote_fd = sv[0];
+	cpy_zygote_pid = pid;
+
+	INFO("python plugin: Running read callbacks in %zu worker processes.", workers_num);
+	return 0;
+}
+
+void cpy_workers_stop(void) {
+	size_t i;
+
+	for (i = 0; i < cpy_workers_num; ++i) {
+		pthread_mutex_lock(&cpy_workers[i].lock);
+		cpy_worker_kill(&cpy_workers[i]);
+		pthread_mutex_unlock(&cpy_workers[i].lock);
+		pthread_mutex_destroy(&cpy_workers[i].lock);
+	}
+	sfree(cpy_workers);
+	cpy_workers_num = 0;
+
+	/* The zygote exits once its socket is closed. */
+	if (cpy_zygote_fd >= 0) {
+		close(cpy_zygote_fd);
+		cpy_zygote_fd = -1;
+		waitpid(cpy_zygote_pid, NULL, 0);
+		cpy_zygote_pid = -1;
+	}
+}
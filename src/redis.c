@@ -25,8 +25,7 @@
 #include "plugin.h"
 #include "configfile.h"
 
-#include <pthread.h>
-#include <sys/time.h>
+#include <poll.h>
 #include <hiredis/hiredis.h>
 
 #ifndef HOST_NAME_MAX
@@ -39,7 +38,6 @@
 #define REDIS_DEF_TIMEOUT 2000
 #define MAX_REDIS_NODE_NAME 64
 #define MAX_REDIS_PASSWD_LENGTH 512
-#define MAX_REDIS_VAL_SIZE 256
 #define MAX_REDIS_QUERY 2048
 
 /* Redis plugin configuration example:
@@ -64,6 +62,21 @@ struct redis_query_s
     redis_query_t *next;
 };
 
+/*
+ * All nodes are queried concurrently from the read callback: the
+ * connections are kept open and non-blocking, the INFO command and the
+ * queries of a node are sent in one go and the replies of all nodes are
+ * collected with poll(2).
+ */
+enum redis_state_e
+{
+  REDIS_STATE_IDLE = 0,
+  REDIS_STATE_CONNECTING,
+  REDIS_STATE_SENDING,
+  REDIS_STATE_RECEIVING,
+  REDIS_STATE_FAILED
+};
+
 struct redis_node_s;
 typedef struct redis_node_s redis_node_t;
 struct redis_node_s
@@ -72,14 +85,59 @@ struct redis_node_s
   char host[HOST_NAME_MAX];
   char passwd[MAX_REDIS_PASSWD_LENGTH];
   int port;
-  struct timeval timeout;
+  cdtime_t timeout;
   redis_query_t *queries;
 
+  redisContext *rh;
+  enum redis_state_e state;
+  cdtime_t deadline;
+  /* Set after reconnecting once in the current read. */
+  _Bool reconnected;
+  /* The replies still expected, in the order the commands were sent. */
+  _Bool auth_pending;
+  _Bool info_pending;
+  redis_query_t *query_pending;
+
   redis_node_t *next;
 };
 
 static redis_node_t *nodes_head = NULL;
 
+static struct pollfd *redis_pollfds = NULL;
+static redis_node_t **redis_polled = NULL;
+static size_t redis_pollfds_size = 0;
+
+/* The fields of the INFO reply which are dispatched. */
+struct redis_info_field_s
+{
+  const char *field_name;
+  const char *type;
+  const char *type_instance;
+  int ds_type;
+};
+
+static const struct redis_info_field_s redis_info_fields[] =
+{
+  { "uptime_in_seconds",          "uptime",              NULL,       DS_TYPE_GAUGE },
+  { "connected_clients",          "current_connections", "clients",  DS_TYPE_GAUGE },
+  { "blocked_clients",            "blocked_clients",     NULL,       DS_TYPE_GAUGE },
+  { "used_memory",                "memory",              NULL,       DS_TYPE_GAUGE },
+  { "used_memory_lua",            "memory_lua",          NULL,       DS_TYPE_GAUGE },
+  /* changes_since_last_save: Deprecated in redis version 2.6 and above */
+  { "changes_since_last_save",    "volatile_changes",    NULL,       DS_TYPE_GAUGE },
+  { "total_connections_received", "total_connections",   NULL,       DS_TYPE_DERIVE },
+  { "total_commands_processed",   "total_operations",    NULL,       DS_TYPE_DERIVE },
+  { "expired_keys",               "expired_keys",        NULL,       DS_TYPE_DERIVE },
+  { "evicted_keys",               "evicted_keys",        NULL,       DS_TYPE_DERIVE },
+  { "pubsub_channels",            "pubsub",              "channels", DS_TYPE_GAUGE },
+  { "pubsub_patterns",            "pubsub",              "patterns", DS_TYPE_GAUGE },
+  { "connected_slaves",           "current_connections", "slaves",   DS_TYPE_GAUGE },
+  { "keyspace_hits",              "cache_result",        "hits",     DS_TYPE_DERIVE },
+  { "keyspace_misses",            "cache_result",        "misses",   DS_TYPE_DERIVE },
+  { "total_net_input_bytes",      "total_bytes",         "input",    DS_TYPE_DERIVE },
+  { "total_net_output_bytes",     "total_bytes",         "output",   DS_TYPE_DERIVE }
+};
+
 static int redis_node_add (const redis_node_t *rn) /* {{{ */
 {
   redis_node_t *rn_copy;
@@ -175,7 +233,7 @@ static int redis_config_node (oconfig_item_t *ci) /* {{{ */
   memset (&rn, 0, sizeof (rn));
   sstrncpy (rn.host, REDIS_DEF_HOST, sizeof (rn.host));
   rn.port = REDIS_DEF_PORT;
-  rn.timeout.tv_usec = REDIS_DEF_TIMEOUT;
+  rn.timeout = MS_TO_CDTIME_T (REDIS_DEF_TIMEOUT);
   rn.queries = NULL;
 
   status = cf_util_get_string_buffer (ci, rn.name, sizeof (rn.name));
@@ -210,7 +268,7 @@ static int redis_config_node (oconfig_item_t *ci) /* {{{ */
     else if (strcasecmp ("Timeout", option->key) == 0)
     {
       status = cf_util_get_int (option, &timeout);
-      if (status == 0) rn.timeout.tv_usec = timeout;
+      if (status == 0) rn.timeout = MS_TO_CDTIME_T (timeout);
     }
     else if (strcasecmp ("Password", option->key) == 0)
       status = cf_util_get_string_buffer (option, rn.passwd, sizeof (rn.passwd));
@@ -283,8 +341,7 @@ static int redis_init (void) /* {{{ */
     .name = "default",
     .host = REDIS_DEF_HOST,
     .port = REDIS_DEF_PORT,
-    .timeout.tv_sec = 0,
-    .timeout.tv_usec = REDIS_DEF_TIMEOUT,
+    .timeout = MS_TO_CDTIME_T (REDIS_DEF_TIMEOUT),
     .next = NULL
 };
 
@@ -294,36 +351,58 @@ static int redis_init (void) /* {{{ */
   return (0);
 } /* }}} int redis_init */
 
-static int redis_handle_info (char *node, char const *info_line, char const *type, char const *type_instance, char const *field_name, int ds_type) /* {{{ */
+/* Dispatches the known fields of an INFO reply. The lines have the form
+ * "<name>:<value>\r\n"; the reply is split up in place. */
+static void redis_handle_info (redis_node_t *rn, char *info) /* {{{ */
 {
-  char *str = strstr (info_line, field_name);
-  static char buf[MAX_REDIS_VAL_SIZE];
-  value_t val;
-  if (str)
-  {
-    int i;
+  char *ptr = info;
 
-    str += strlen (field_name) + 1; /* also skip the ':' */
-    for(i=0;(*str && (isdigit((unsigned char)*str) || *str == '.'));i++,str++)
-      buf[i] = *str;
-    buf[i] ='\0';
+  while ((ptr != NULL) && (*ptr != 0))
+  {
+    char *line = ptr;
+    char *value;
+    size_t name_len;
+    size_t i;
 
-    if(parse_value (buf, &val, ds_type) == -1)
+    ptr = strchr (line, '\n');
+    if (ptr != NULL)
     {
-      WARNING ("redis plugin: Unable to parse field `%s'.", field_name);
-      return (-1);
+      if ((ptr > line) && (ptr[-1] == '\r'))
+        ptr[-1] = 0;
+      *ptr = 0;
+      ptr++;
     }
 
-    redis_submit (node, type, type_instance, val);
-    return (0);
-  }
-  return (-1);
+    value = strchr (line, ':');
+    if ((line[0] == '#') || (value == NULL))
+      continue;
+    name_len = (size_t) (value - line);
+    *value = 0;
+    value++;
 
-} /* }}} int redis_handle_info */
+    for (i = 0; i < STATIC_ARRAY_SIZE (redis_info_fields); i++)
+    {
+      const struct redis_info_field_s *f = redis_info_fields + i;
+      value_t val;
+
+      if ((strncmp (f->field_name, line, name_len) != 0)
+          || (f->field_name[name_len] != 0))
+        continue;
+
+      if (parse_value (value, &val, f->ds_type) == -1)
+      {
+        WARNING ("redis plugin: Unable to parse field `%s'.", f->field_name);
+        break;
+      }
+
+      redis_submit (rn->name, f->type, f->type_instance, val);
+      break;
+    }
+  }
+} /* }}} void redis_handle_info */
 
-static int redis_handle_query (redisContext *rh, redis_node_t *rn, redis_query_t *rq) /* {{{ */
+static int redis_handle_query (redis_node_t *rn, redis_query_t *rq, redisReply *rr) /* {{{ */
 {
-    redisReply *rr;
     const data_set_t *ds;
     value_t val;
 
@@ -338,11 +417,6 @@ static int redis_handle_query (redisContext *rh, redis_node_t *rn, redis_query_t
         return (-1);
     }
 
-    if ((rr = redisCommand(rh, rq->query)) == NULL) {
-        WARNING("redis plugin: unable to carry out query `%s'.", rq->query);
-        return (-1);
-    }
-
     switch (rr->type) {
     case REDIS_REPLY_INTEGER:
         switch (ds->ds[0].type) {
@@ -363,102 +437,335 @@ static int redis_handle_query (redisContext *rh, redis_node_t *rn, redis_query_t
     case REDIS_REPLY_STRING:
         if (parse_value (rr->str, &val, ds->ds[0].type) == -1) {
             WARNING("redis plugin: Unable to parse field `%s'.", rq->type);
-            freeReplyObject (rr);
             return (-1);
         }
         break;
+    case REDIS_REPLY_ERROR:
+        WARNING("redis plugin: unable to carry out query `%s': %s", rq->query, rr->str);
+        return (-1);
     default:
         WARNING("redis plugin: Cannot coerce redis type.");
-        freeReplyObject(rr);
         return (-1);
     }
 
     redis_submit(rn->name, rq->type, (strlen(rq->instance) >0)?rq->instance:NULL, val);
-    freeReplyObject (rr);
     return 0;
 } /* }}} int redis_handle_query */
 
-static int redis_read (void) /* {{{ */
+static void redis_close (redis_node_t *rn) /* {{{ */
+{
+  if (rn->rh != NULL)
+    redisFree (rn->rh);
+  rn->rh = NULL;
+} /* }}} void redis_close */
+
+static void redis_fail (redis_node_t *rn, const char *what) /* {{{ */
+{
+  if ((rn->rh != NULL) && (rn->rh->err != 0))
+    WARNING ("redis plugin: %s on node `%s' failed: %s", what, rn->name,
+        rn->rh->errstr);
+  else
+    WARNING ("redis plugin: %s on node `%s' failed.", what, rn->name);
+
+  redis_close (rn);
+  rn->state = REDIS_STATE_FAILED;
+} /* }}} void redis_fail */
+
+/* Queues the commands of one read, connecting if needed. */
+static void redis_query_start (redis_node_t *rn) /* {{{ */
 {
-  redis_node_t *rn;
   redis_query_t *rq;
 
-  for (rn = nodes_head; rn != NULL; rn = rn->next)
-  {
-    redisContext *rh;
-    redisReply   *rr;
+  rn->deadline = cdtime () + rn->timeout;
+  rn->state = REDIS_STATE_SENDING;
 
-    DEBUG ("redis plugin: querying info from node `%s' (%s:%d).", rn->name, rn->host, rn->port);
+  if (rn->rh == NULL)
+  {
+    DEBUG ("redis plugin: connecting to node `%s' (%s:%d).", rn->name, rn->host, rn->port);
 
-    rh = redisConnectWithTimeout ((char *)rn->host, rn->port, rn->timeout);
-    if (rh == NULL)
+    rn->rh = redisConnectNonBlock ((char *)rn->host, rn->port);
+    if ((rn->rh == NULL) || (rn->rh->err != 0))
     {
       ERROR ("redis plugin: unable to connect to node `%s' (%s:%d).", rn->name, rn->host, rn->port);
-      continue;
+      redis_close (rn);
+      rn->state = REDIS_STATE_FAILED;
+      return;
     }
+    rn->state = REDIS_STATE_CONNECTING;
 
+    rn->auth_pending = 0;
     if (strlen (rn->passwd) > 0)
     {
       DEBUG ("redis plugin: authenticating node `%s' passwd(%s).", rn->name, rn->passwd);
+      redisAppendCommand (rn->rh, "AUTH %s", rn->passwd);
+      rn->auth_pending = 1;
+    }
+  }
 
-      if ((rr = redisCommand (rh, "AUTH %s", rn->passwd)) == NULL)
-      {
-        WARNING ("redis plugin: unable to authenticate on node `%s'.", rn->name);
-        goto redis_fail;
-      }
+  redisAppendCommand (rn->rh, "INFO");
+  rn->info_pending = 1;
+
+  for (rq = rn->queries; rq != NULL; rq = rq->next)
+    redisAppendCommand (rn->rh, rq->query);
+  rn->query_pending = rn->queries;
+} /* }}} void redis_query_start */
+
+/* The server may have closed an idle connection. Connect again once before
+ * giving up. */
+static void redis_query_restart (redis_node_t *rn, const char *what) /* {{{ */
+{
+  if (rn->reconnected || !rn->info_pending || rn->auth_pending
+      || (rn->state == REDIS_STATE_CONNECTING))
+  {
+    redis_fail (rn, what);
+    return;
+  }
+
+  redis_close (rn);
+  redis_query_start (rn);
+  rn->reconnected = 1;
+} /* }}} void redis_query_restart */
 
-      if (rr->type != REDIS_REPLY_STATUS)
+/* Handles the next expected reply. Returns non-zero if the connection can't
+ * be used anymore. */
+static int redis_handle_reply (redis_node_t *rn, redisReply *rr) /* {{{ */
+{
+  if (rn->auth_pending)
+  {
+    rn->auth_pending = 0;
+    if (rr->type != REDIS_REPLY_STATUS)
+    {
+      WARNING ("redis plugin: invalid authentication on node `%s'.", rn->name);
+      return (-1);
+    }
+  }
+  else if (rn->info_pending)
+  {
+    rn->info_pending = 0;
+    if ((rr->type == REDIS_REPLY_STRING) && (rr->str != NULL))
+      redis_handle_info (rn, rr->str);
+    else
+      WARNING ("redis plugin: unable to get info from node `%s'.", rn->name);
+  }
+  else if (rn->query_pending != NULL)
+  {
+    redis_handle_query (rn, rn->query_pending, rr);
+    rn->query_pending = rn->query_pending->next;
+  }
+
+  return (0);
+} /* }}} int redis_handle_reply */
+
+static void redis_handle_events (redis_node_t *rn, short revents) /* {{{ */
+{
+  if (rn->state == REDIS_STATE_CONNECTING)
+  {
+    int err = 0;
+    socklen_t err_len = sizeof (err);
+
+    if (getsockopt (rn->rh->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0)
+      err = errno;
+    if (err != 0)
+    {
+      char errbuf[1024];
+      ERROR ("redis plugin: unable to connect to node `%s' (%s:%d): %s",
+          rn->name, rn->host, rn->port,
+          sstrerror (err, errbuf, sizeof (errbuf)));
+      redis_close (rn);
+      rn->state = REDIS_STATE_FAILED;
+      return;
+    }
+    rn->state = REDIS_STATE_SENDING;
+  }
+
+  if (rn->state == REDIS_STATE_SENDING)
+  {
+    int done = 0;
+
+    if (redisBufferWrite (rn->rh, &done) != REDIS_OK)
+    {
+      redis_query_restart (rn, "sending commands");
+      return;
+    }
+    if (done)
+      rn->state = REDIS_STATE_RECEIVING;
+  }
+
+  if ((rn->state != REDIS_STATE_RECEIVING)
+      || ((revents & (POLLIN | POLLHUP | POLLERR)) == 0))
+    return;
+
+  if (redisBufferRead (rn->rh) != REDIS_OK)
+  {
+    redis_query_restart (rn, "reading replies");
+    return;
+  }
+
+  while (rn->auth_pending || rn->info_pending || (rn->query_pending != NULL))
+  {
+    void *reply = NULL;
+    int status;
+
+    if (redisGetReply (rn->rh, &reply) != REDIS_OK)
+    {
+      redis_fail (rn, "parsing replies");
+      return;
+    }
+    if (reply == NULL)
+      return;
+
+    status = redis_handle_reply (rn, reply);
+    freeReplyObject (reply);
+    if (status != 0)
+    {
+      redis_close (rn);
+      rn->state = REDIS_STATE_FAILED;
+      return;
+    }
+  }
+
+  rn->state = REDIS_STATE_IDLE;
+} /* }}} void redis_handle_events */
+
+static int redis_read (void) /* {{{ */
+{
+  redis_node_t *rn;
+  size_t num = 0;
+
+  for (rn = nodes_head; rn != NULL; rn = rn->next)
+    num++;
+
+  if (num > redis_pollfds_size)
+  {
+    struct pollfd *tmp_fds;
+    redis_node_t **tmp_polled;
+
+    tmp_fds = realloc (redis_pollfds, num * sizeof (*tmp_fds));
+    if (tmp_fds == NULL)
+      return (ENOMEM);
+    redis_pollfds = tmp_fds;
+
+    tmp_polled = realloc (redis_polled, num * sizeof (*tmp_polled));
+    if (tmp_polled == NULL)
+      return (ENOMEM);
+    redis_polled = tmp_polled;
+
+    redis_pollfds_size = num;
+  }
+
+  for (rn = nodes_head; rn != NULL; rn = rn->next)
+  {
+    rn->reconnected = 0;
+    redis_query_start (rn);
+    /* Most connections can take the commands right away. */
+    if (rn->state == REDIS_STATE_SENDING)
+      redis_handle_events (rn, /* revents = */ 0);
+  }
+
+  while (42)
+  {
+    cdtime_t now = cdtime ();
+    cdtime_t deadline = 0;
+    size_t i;
+    int status;
+
+    num = 0;
+    for (rn = nodes_head; rn != NULL; rn = rn->next)
+    {
+      short events;
+
+      if (rn->state == REDIS_STATE_RECEIVING)
+        events = POLLIN;
+      else if ((rn->state == REDIS_STATE_CONNECTING)
+          || (rn->state == REDIS_STATE_SENDING))
+        events = POLLOUT;
+      else
+        continue;
+
+      if (now >= rn->deadline)
       {
-        WARNING ("redis plugin: invalid authentication on node `%s'.", rn->name);
-        goto redis_fail;
+        ERROR ("redis plugin: Timeout waiting for node `%s'.", rn->name);
+        /* Don't leave late replies on the connection. */
+        redis_close (rn);
+        rn->state = REDIS_STATE_FAILED;
+        continue;
       }
 
-      freeReplyObject (rr);
+      if ((deadline == 0) || (rn->deadline < deadline))
+        deadline = rn->deadline;
+
+      redis_pollfds[num].fd = rn->rh->fd;
+      redis_pollfds[num].events = events;
+      redis_pollfds[num].revents = 0;
+      redis_polled[num] = rn;
+      num++;
     }
 
-    if ((rr = redisCommand(rh, "INFO")) == NULL)
+    if (num == 0)
+      break;
+
+    status = poll (redis_pollfds, (nfds_t) num,
+        (int) CDTIME_T_TO_MS (deadline - now) + 1);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    else if (status < 0)
     {
-      WARNING ("redis plugin: unable to get info from node `%s'.", rn->name);
-      goto redis_fail;
+      char errbuf[1024];
+      ERROR ("redis plugin: poll(2) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      for (i = 0; i < num; i++)
+      {
+        redis_close (redis_polled[i]);
+        redis_polled[i]->state = REDIS_STATE_FAILED;
+      }
+      break;
     }
 
-    redis_handle_info (rn->name, rr->str, "uptime", NULL, "uptime_in_seconds", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "current_connections", "clients", "connected_clients", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "blocked_clients", NULL, "blocked_clients", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "memory", NULL, "used_memory", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "memory_lua", NULL, "used_memory_lua", DS_TYPE_GAUGE);
-    /* changes_since_last_save: Deprecated in redis version 2.6 and above */
-    redis_handle_info (rn->name, rr->str, "volatile_changes", NULL, "changes_since_last_save", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "total_connections", NULL, "total_connections_received", DS_TYPE_DERIVE);
-    redis_handle_info (rn->name, rr->str, "total_operations", NULL, "total_commands_processed", DS_TYPE_DERIVE);
-    redis_handle_info (rn->name, rr->str, "expired_keys", NULL, "expired_keys", DS_TYPE_DERIVE);
-    redis_handle_info (rn->name, rr->str, "evicted_keys", NULL, "evicted_keys", DS_TYPE_DERIVE);
-    redis_handle_info (rn->name, rr->str, "pubsub", "channels", "pubsub_channels", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "pubsub", "patterns", "pubsub_patterns", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "current_connections", "slaves", "connected_slaves", DS_TYPE_GAUGE);
-    redis_handle_info (rn->name, rr->str, "cache_result", "hits", "keyspace_hits", DS_TYPE_DERIVE);
-    redis_handle_info (rn->name, rr->str, "cache_result", "misses", "keyspace_misses", DS_TYPE_DERIVE);
-    redis_handle_info (rn->name, rr->str, "total_bytes", "input", "total_net_input_bytes", DS_TYPE_DERIVE);
-    redis_handle_info (rn->name, rr->str, "total_bytes", "output", "total_net_output_bytes", DS_TYPE_DERIVE);
-
-    for (rq = rn->queries; rq != NULL; rq = rq->next)
-        redis_handle_query(rh, rn, rq);
-
-redis_fail:
-    if (rr != NULL)
-      freeReplyObject (rr);
-    redisFree (rh);
+    for (i = 0; i < num; i++)
+      if (redis_pollfds[i].revents != 0)
+        redis_handle_events (redis_polled[i], redis_pollfds[i].revents);
   }
 
   return 0;
 }
 /* }}} */
 
+static int redis_shutdown (void) /* {{{ */
+{
+  redis_node_t *rn;
+
+  rn = nodes_head;
+  nodes_head = NULL;
+  while (rn != NULL)
+  {
+    redis_node_t *next = rn->next;
+    redis_query_t *rq = rn->queries;
+
+    while (rq != NULL)
+    {
+      redis_query_t *rq_next = rq->next;
+      sfree (rq);
+      rq = rq_next;
+    }
+
+    redis_close (rn);
+    sfree (rn);
+    rn = next;
+  }
+
+  sfree (redis_pollfds);
+  sfree (redis_polled);
+  redis_pollfds_size = 0;
+
+  return (0);
+} /* }}} int redis_shutdown */
+
 void module_register (void) /* {{{ */
 {
   plugin_register_complex_config ("redis", redis_config);
   plugin_register_init ("redis", redis_init);
   plugin_register_read ("redis", redis_read);
+  plugin_register_shutdown ("redis", redis_shutdown);
   /* TODO: plugin_register_write: one redis list per value id with
    * X elements */
 }
@@ -33,6 +33,39 @@
 #include <rrd.h>
 #include <rrd_client.h>
 
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define RC_DEFAULT_PORT "42217"
+#define RC_BUFFER_SIZE 65536
+/* Each batch is sent as "BATCH\n" <commands> ".\n". */
+#define RC_BATCH_HEAD "BATCH\n"
+#define RC_BATCH_HEAD_LEN (sizeof (RC_BATCH_HEAD) - 1)
+
+/*
+ * Private types
+ */
+/* A connection speaking the rrdcached protocol directly, so that updates can
+ * be batched and several connections can be used at the same time. librrd's
+ * client only has one, global connection. */
+struct rc_conn_s
+{
+  int fd;
+  FILE *fh; /* Reads the replies from "fd". */
+
+  /* Starts with RC_BATCH_HEAD, followed by one UPDATE command per line. */
+  char buffer[RC_BUFFER_SIZE];
+  size_t fill;
+  /* The files updated by the commands in "buffer", to map errors back. */
+  char **files;
+  int files_num;
+  cdtime_t first;
+
+  pthread_mutex_t lock;
+};
+typedef struct rc_conn_s rc_conn_t;
+
 /*
  * Private variables
  */
@@ -40,6 +73,12 @@ static char *datadir = NULL;
 static char *daemon_address = NULL;
 static _Bool config_create_files = 1;
 static _Bool config_collect_stats = 1;
+static int batch_size = 1;
+static cdtime_t batch_timeout = 0;
+static int conns_num = 1;
+static rc_conn_t *conns = NULL;
+static int conns_next = 0;
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
 static rrdcreate_config_t rrdcreate_config =
 {
 	/* stepsize = */ 0,
@@ -53,7 +92,8 @@ static rrdcreate_config_t rrdcreate_config =
 	/* consolidation_functions = */ NULL,
 	/* consolidation_functions_num = */ 0,
 
-	/* async = */ 0
+	/* async = */ 0,
+	/* async_threads = */ 0
 };
 
 /*
@@ -157,6 +197,391 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
   return (0);
 } /* int value_list_to_filename */
 
+static void rc_disconnect (rc_conn_t *c) /* {{{ */
+{
+  if (c->fh != NULL)
+    fclose (c->fh);
+  else if (c->fd >= 0)
+    close (c->fd);
+  c->fh = NULL;
+  c->fd = -1;
+} /* }}} void rc_disconnect */
+
+static int rc_connect_unix (char const *path) /* {{{ */
+{
+  struct sockaddr_un sa;
+  int fd;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  sstrncpy (sa.sun_path, path, sizeof (sa.sun_path));
+
+  fd = socket (PF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return (-1);
+
+  if (connect (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+  {
+    close (fd);
+    return (-1);
+  }
+
+  return (fd);
+} /* }}} int rc_connect_unix */
+
+static int rc_connect_inet (char const *address) /* {{{ */
+{
+  char host[NI_MAXHOST];
+  char const *port = RC_DEFAULT_PORT;
+  char *ptr;
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list;
+  struct addrinfo *ai_ptr;
+  int fd = -1;
+  int status;
+
+  sstrncpy (host, address, sizeof (host));
+
+  /* "[address]:port", "host:port" or just "host" */
+  if (host[0] == '[')
+  {
+    ptr = strchr (host, ']');
+    if (ptr == NULL)
+      return (-1);
+    *ptr = 0;
+    if (ptr[1] == ':')
+      port = address + (ptr - host) + 2;
+    memmove (host, host + 1, strlen (host));
+  }
+  else if (((ptr = strchr (host, ':')) != NULL) && (strchr (ptr + 1, ':') == NULL))
+  {
+    *ptr = 0;
+    port = address + (ptr - host) + 1;
+  }
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+
+  ai_list = NULL;
+  status = getaddrinfo (host, port, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: getaddrinfo (%s, %s) failed: %s",
+        host, port, gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+      break;
+
+    close (fd);
+    fd = -1;
+  }
+
+  freeaddrinfo (ai_list);
+  return (fd);
+} /* }}} int rc_connect_inet */
+
+static _Bool rc_address_is_unix (void) /* {{{ */
+{
+  return ((strncmp ("unix:", daemon_address, strlen ("unix:")) == 0)
+      || (daemon_address[0] == '/'));
+} /* }}} _Bool rc_address_is_unix */
+
+static int rc_connect (rc_conn_t *c) /* {{{ */
+{
+  if (c->fh != NULL)
+    return (0);
+
+  if (strncmp ("unix:", daemon_address, strlen ("unix:")) == 0)
+    c->fd = rc_connect_unix (daemon_address + strlen ("unix:"));
+  else if (daemon_address[0] == '/')
+    c->fd = rc_connect_unix (daemon_address);
+  else
+    c->fd = rc_connect_inet (daemon_address);
+
+  if (c->fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: Connecting to %s failed: %s",
+        daemon_address, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  c->fh = fdopen (c->fd, "r");
+  if (c->fh == NULL)
+  {
+    ERROR ("rrdcached plugin: fdopen failed.");
+    rc_disconnect (c);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_connect */
+
+/* Reads one reply line and returns the status code at its beginning. The
+ * message following the code is stored in "msg". */
+static int rc_read_reply (rc_conn_t *c, /* {{{ */
+    char *msg, size_t msg_size, int *ret_status)
+{
+  char line[4096];
+  char *endptr = NULL;
+  size_t len;
+
+  if (fgets (line, sizeof (line), c->fh) == NULL)
+    return (-1);
+
+  len = strlen (line);
+  while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+    line[--len] = 0;
+
+  errno = 0;
+  *ret_status = (int) strtol (line, &endptr, 10);
+  if ((errno != 0) || (endptr == line))
+    return (-1);
+
+  while (*endptr == ' ')
+    endptr++;
+  sstrncpy (msg, endptr, msg_size);
+
+  return (0);
+} /* }}} int rc_read_reply */
+
+/* swrite() notices if the daemon has closed the connection in the meantime,
+ * e.g. because it has been restarted. Reconnect once in that case. */
+static int rc_send (rc_conn_t *c, char const *buffer, size_t size) /* {{{ */
+{
+  if (swrite (c->fd, buffer, size) == 0)
+    return (0);
+
+  rc_disconnect (c);
+  if (rc_connect (c) != 0)
+    return (-1);
+
+  return ((swrite (c->fd, buffer, size) == 0) ? 0 : -1);
+} /* }}} int rc_send */
+
+static void rc_batch_reset (rc_conn_t *c) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < c->files_num; i++)
+    sfree (c->files[i]);
+  c->files_num = 0;
+
+  memcpy (c->buffer, RC_BATCH_HEAD, RC_BATCH_HEAD_LEN);
+  c->fill = RC_BATCH_HEAD_LEN;
+  c->first = 0;
+} /* }}} void rc_batch_reset */
+
+/* Sends the buffered updates and reads the replies. A single update is sent
+ * as is, more are sent in one BATCH. Errors reported by the daemon are logged
+ * with the file they belong to. Must be called with "c->lock" held. */
+static int rc_batch_send_nolock (rc_conn_t *c) /* {{{ */
+{
+  char msg[4096];
+  int status = 0;
+  int errors;
+  int i;
+
+  if (c->files_num == 0)
+    return (0);
+
+  if (rc_connect (c) != 0)
+  {
+    ERROR ("rrdcached plugin: Dropping %i update%s.",
+        c->files_num, (c->files_num == 1) ? "" : "s");
+    rc_batch_reset (c);
+    return (-1);
+  }
+
+  if (c->files_num == 1)
+  {
+    status = rc_send (c, c->buffer + RC_BATCH_HEAD_LEN,
+        c->fill - RC_BATCH_HEAD_LEN);
+    if (status == 0)
+      status = rc_read_reply (c, msg, sizeof (msg), &errors);
+    if (status != 0)
+      goto failure;
+
+    if (errors < 0)
+    {
+      ERROR ("rrdcached plugin: Updating %s failed: %s", c->files[0], msg);
+      status = -1;
+    }
+
+    rc_batch_reset (c);
+    return (status);
+  }
+
+  /* Room for the terminating dot is reserved in rc_batch_add_nolock(). */
+  memcpy (c->buffer + c->fill, ".\n", 2);
+  c->fill += 2;
+
+  status = rc_send (c, c->buffer, c->fill);
+  if (status != 0)
+    goto failure;
+
+  /* "0 Go ahead.  End with dot '.' on its own line." */
+  status = rc_read_reply (c, msg, sizeof (msg), &errors);
+  if ((status != 0) || (errors != 0))
+  {
+    if (status == 0)
+      ERROR ("rrdcached plugin: The daemon refused the batch: %s", msg);
+    goto failure;
+  }
+
+  /* "<num> errors", followed by "<command number> <message>" lines. */
+  status = rc_read_reply (c, msg, sizeof (msg), &errors);
+  if (status != 0)
+    goto failure;
+
+  for (i = 0; i < errors; i++)
+  {
+    int command = 0;
+
+    status = rc_read_reply (c, msg, sizeof (msg), &command);
+    if (status != 0)
+      goto failure;
+
+    if ((command >= 1) && (command <= c->files_num))
+      ERROR ("rrdcached plugin: Updating %s failed: %s",
+          c->files[command - 1], msg);
+    else
+      ERROR ("rrdcached plugin: Command %i of a batch failed: %s",
+          command, msg);
+  }
+
+  rc_batch_reset (c);
+  return ((errors > 0) ? -1 : 0);
+
+failure:
+  ERROR ("rrdcached plugin: Sending %i update%s to %s failed.",
+      c->files_num, (c->files_num == 1) ? "" : "s", daemon_address);
+  rc_disconnect (c);
+  rc_batch_reset (c);
+  return (-1);
+} /* }}} int rc_batch_send_nolock */
+
+/* Appends "UPDATE <filename> <values>" to the batch of "c", with spaces and
+ * backslashes in the file name escaped like librrd does. Must be called with
+ * "c->lock" held. */
+static int rc_batch_add_nolock (rc_conn_t *c, /* {{{ */
+    char const *filename, char const *values)
+{
+  char command[2 * PATH_MAX + 512];
+  size_t len = 0;
+  char const *ptr;
+  char *file;
+  char **tmp;
+
+  len = (size_t) ssnprintf (command, sizeof (command), "UPDATE ");
+  for (ptr = filename; (*ptr != 0) && (len < sizeof (command) - 2); ptr++)
+  {
+    if ((*ptr == ' ') || (*ptr == '\\'))
+      command[len++] = '\\';
+    command[len++] = *ptr;
+  }
+  if (len + strlen (values) + 3 > sizeof (command))
+    return (ENOMEM);
+  len += (size_t) ssnprintf (command + len, sizeof (command) - len,
+      " %s\n", values);
+
+  /* Keep two bytes for the terminating ".\n". */
+  if ((c->fill + len + 2) > sizeof (c->buffer))
+    rc_batch_send_nolock (c);
+
+  file = strdup (filename);
+  tmp = realloc (c->files, (c->files_num + 1) * sizeof (*c->files));
+  if ((file == NULL) || (tmp == NULL))
+  {
+    sfree (file);
+    if (tmp != NULL)
+      c->files = tmp;
+    return (ENOMEM);
+  }
+  c->files = tmp;
+  c->files[c->files_num] = file;
+  c->files_num++;
+
+  memcpy (c->buffer + c->fill, command, len);
+  c->fill += len;
+  if (c->first == 0)
+    c->first = cdtime ();
+
+  if (c->files_num >= batch_size)
+    return (rc_batch_send_nolock (c));
+
+  return (0);
+} /* }}} int rc_batch_add_nolock */
+
+/* Returns a locked connection. Starts at a different connection each time
+ * and prefers connections no other thread is using. */
+static rc_conn_t *rc_conn_get (void) /* {{{ */
+{
+  int start;
+  int i;
+
+  pthread_mutex_lock (&conns_lock);
+  start = conns_next;
+  conns_next = (conns_next + 1) % conns_num;
+  pthread_mutex_unlock (&conns_lock);
+
+  for (i = 0; i < conns_num; i++)
+  {
+    rc_conn_t *c = conns + ((start + i) % conns_num);
+    if (pthread_mutex_trylock (&c->lock) == 0)
+      return (c);
+  }
+
+  pthread_mutex_lock (&conns[start].lock);
+  return (conns + start);
+} /* }}} rc_conn_t *rc_conn_get */
+
+/* Sends all batches, or only those older than "timeout" if it is not zero. */
+static int rc_batch_flush (cdtime_t timeout) /* {{{ */
+{
+  cdtime_t now = cdtime ();
+  int status = 0;
+  int i;
+
+  if (conns == NULL)
+    return (0);
+
+  for (i = 0; i < conns_num; i++)
+  {
+    rc_conn_t *c = conns + i;
+
+    pthread_mutex_lock (&c->lock);
+    if ((c->files_num > 0)
+        && ((timeout == 0) || ((now - c->first) >= timeout)))
+    {
+      if (rc_batch_send_nolock (c) != 0)
+        status = -1;
+    }
+    pthread_mutex_unlock (&c->lock);
+  }
+
+  return (status);
+} /* }}} int rc_batch_flush */
+
+static int rc_batch_timeout (__attribute__((unused)) user_data_t *ud) /* {{{ */
+{
+  rc_batch_flush (batch_timeout);
+  return (0);
+} /* }}} int rc_batch_timeout */
+
 static int rc_config_get_int_positive (oconfig_item_t const *ci, int *ret)
 {
   int status;
@@ -248,6 +673,13 @@ static int rc_config (oconfig_item_t *ci)
       status = cf_util_get_boolean (child, &config_create_files);
     else if (strcasecmp ("CreateFilesAsync", key) == 0)
       status = cf_util_get_boolean (child, &rrdcreate_config.async);
+    else if (strcasecmp ("CreateFilesAsyncThreads", key) == 0)
+    {
+      status = rc_config_get_int_positive (child,
+          &rrdcreate_config.async_threads);
+      if ((status == 0) && (rrdcreate_config.async_threads < 1))
+        status = EINVAL;
+    }
     else if (strcasecmp ("CollectStatistics", key) == 0)
       status = cf_util_get_boolean (child, &config_collect_stats);
     else if (strcasecmp ("StepSize", key) == 0)
@@ -271,6 +703,20 @@ static int rc_config (oconfig_item_t *ci)
     }
     else if (strcasecmp ("XFF", key) == 0)
       status = rc_config_get_xff (child, &rrdcreate_config.xff);
+    else if (strcasecmp ("BatchSize", key) == 0)
+    {
+      status = rc_config_get_int_positive (child, &batch_size);
+      if ((status == 0) && (batch_size < 1))
+        batch_size = 1;
+    }
+    else if (strcasecmp ("BatchTimeout", key) == 0)
+      status = cf_util_get_cdtime (child, &batch_timeout);
+    else if (strcasecmp ("Connections", key) == 0)
+    {
+      status = rc_config_get_int_positive (child, &conns_num);
+      if ((status == 0) && (conns_num < 1))
+        conns_num = 1;
+    }
     else
     {
       WARNING ("rrdcached plugin: Ignoring invalid option %s.", key);
@@ -401,9 +847,40 @@ static int rc_read (void)
 
 static int rc_init (void)
 {
+  int i;
+
   if (config_collect_stats)
     plugin_register_read ("rrdcached", rc_read);
 
+  /* Without batching and with a single connection, librrd's client is
+   * used for the updates as well. */
+  if ((daemon_address == NULL) || ((batch_size <= 1) && (conns_num <= 1)))
+    return (0);
+
+  conns = calloc ((size_t) conns_num, sizeof (*conns));
+  if (conns == NULL)
+  {
+    ERROR ("rrdcached plugin: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < conns_num; i++)
+  {
+    conns[i].fd = -1;
+    conns[i].fh = NULL;
+    pthread_mutex_init (&conns[i].lock, /* attr = */ NULL);
+    rc_batch_reset (conns + i);
+  }
+
+  if (batch_size > 1)
+  {
+    if (batch_timeout == 0)
+      batch_timeout = plugin_get_interval ();
+
+    plugin_register_complex_read (/* group = */ NULL, "rrdcached/batch",
+        rc_batch_timeout, batch_timeout, /* user data = */ NULL);
+  }
+
   return (0);
 } /* int rc_init */
 
@@ -440,9 +917,6 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     return (-1);
   }
 
-  values_array[0] = values;
-  values_array[1] = NULL;
-
   if (config_create_files)
   {
     struct stat statbuf;
@@ -470,6 +944,30 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     }
   }
 
+  if (conns != NULL)
+  {
+    char path[PATH_MAX];
+    rc_conn_t *c;
+
+    /* rrdcached resolves relative paths against its own base directory.
+     * librrd's client passes absolute paths over UNIX sockets, so do the
+     * same. */
+    if (rc_address_is_unix () && (filename[0] != '/')
+        && (realpath (filename, path) != NULL))
+      sstrncpy (filename, path, sizeof (filename));
+
+    /* Failed updates are logged with their file by
+     * rc_batch_send_nolock(). */
+    c = rc_conn_get ();
+    status = rc_batch_add_nolock (c, filename, values);
+    pthread_mutex_unlock (&c->lock);
+
+    return (status);
+  }
+
+  values_array[0] = values;
+  values_array[1] = NULL;
+
   status = rrdc_connect (daemon_address);
   if (status != 0)
   {
@@ -497,8 +995,11 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
   char filename[PATH_MAX + 1];
   int status;
 
+  /* The daemon can only flush what it has received. */
+  rc_batch_flush (/* timeout = */ 0);
+
   if (identifier == NULL)
-    return (EINVAL);
+    return ((conns != NULL) ? 0 : EINVAL);
 
   if (datadir != NULL)
     ssnprintf (filename, sizeof (filename), "%s/%s.rrd", datadir, identifier);
@@ -527,6 +1028,18 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  int i;
+
+  rc_batch_flush (/* timeout = */ 0);
+
+  for (i = 0; (conns != NULL) && (i < conns_num); i++)
+  {
+    rc_disconnect (conns + i);
+    sfree (conns[i].files);
+    pthread_mutex_destroy (&conns[i].lock);
+  }
+  sfree (conns);
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
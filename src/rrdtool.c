@@ -27,6 +27,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_avltree.h"
+#include "utils_intern.h"
 #include "utils_random.h"
 #include "utils_rrdcreate.h"
 
@@ -46,6 +47,9 @@ struct rrd_cache_s
 	cdtime_t first_value;
 	cdtime_t last_value;
 	int64_t  random_variation;
+	cdtime_t last_flush;
+	dev_t    dev;
+	ino_t    ino;
 	enum
 	{
 		FLAG_NONE   = 0x00,
@@ -65,10 +69,56 @@ typedef enum rrd_queue_dir_e rrd_queue_dir_t;
 struct rrd_queue_s
 {
 	char *filename;
+	dev_t dev;
 	struct rrd_queue_s *next;
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* Token bucket limiting the updates written to one device, shared by all
+ * queue threads. Protected by "device_lock". */
+struct rrd_device_s
+{
+	dev_t    dev;
+	double   tokens;
+	cdtime_t last_refill;
+	struct rrd_device_s *next;
+};
+typedef struct rrd_device_s rrd_device_t;
+
+/* Files are distributed over the shards by the hash of their identifier. Each
+ * shard has its own cache and queue and a thread writing its files, so that
+ * multiple files can be updated at the same time.
+ *
+ * XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
+ * ALWAYS lock `cache_lock' first! */
+struct rrd_shard_s
+{
+	c_avl_tree_t   *cache;
+	cdtime_t        cache_flush_last;
+	pthread_mutex_t cache_lock;
+	/* Memory used by the cache entries and their values, protected by
+	 * cache_lock. See rrd_memory(). */
+	size_t          cache_memory;
+
+	rrd_queue_t    *queue_head;
+	rrd_queue_t    *queue_tail;
+	rrd_queue_t    *flushq_head;
+	rrd_queue_t    *flushq_tail;
+	pthread_mutex_t queue_lock;
+	pthread_cond_t  queue_cond;
+
+	pthread_t       thread;
+	int             thread_running;
+
+	/* Statistics, protected by queue_lock. "updates_num_interval" and
+	 * "updates_time" are reset by the read callback. */
+	int             queue_length;
+	derive_t        updates_num;
+	derive_t        updates_num_interval;
+	cdtime_t        updates_time;
+};
+typedef struct rrd_shard_s rrd_shard_t;
+
 /*
  * Private variables
  */
@@ -77,6 +127,7 @@ static const char *config_keys[] =
 	"CacheTimeout",
 	"CacheFlush",
 	"CreateFilesAsync",
+	"CreateFilesAsyncThreads",
 	"DataDir",
 	"StepSize",
 	"HeartBeat",
@@ -84,7 +135,11 @@ static const char *config_keys[] =
 	"RRATimespan",
 	"XFF",
 	"WritesPerSecond",
-	"RandomTimeout"
+	"RandomTimeout",
+	"WriteThreads",
+	"ReportStats",
+	"DeviceWritesPerSecond",
+	"DeferQueueLength"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -93,6 +148,8 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
  * being used. */
 static char *datadir   = NULL;
 static double write_rate = 0.0;
+static double device_write_rate = 0.0;
+static int    defer_queue_length = 0;
 static rrdcreate_config_t rrdcreate_config =
 {
 	/* stepsize = */ 0,
@@ -106,26 +163,22 @@ static rrdcreate_config_t rrdcreate_config =
 	/* consolidation_functions = */ NULL,
 	/* consolidation_functions_num = */ 0,
 
-	/* async = */ 0
+	/* async = */ 0,
+	/* async_threads = */ 0
 };
 
-/* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
- * ALWAYS lock `cache_lock' first! */
 static cdtime_t    cache_timeout = 0;
 static cdtime_t    cache_flush_timeout = 0;
 static cdtime_t    random_timeout = TIME_T_TO_CDTIME_T (1);
-static cdtime_t    cache_flush_last;
-static c_avl_tree_t *cache = NULL;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-static rrd_queue_t    *queue_head = NULL;
-static rrd_queue_t    *queue_tail = NULL;
-static rrd_queue_t    *flushq_head = NULL;
-static rrd_queue_t    *flushq_tail = NULL;
-static pthread_t       queue_thread;
-static int             queue_thread_running = 1;
-static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+
+static rrd_shard_t *shards = NULL;
+static int          shards_num = 1;
+static _Bool        report_stats = 0;
+
+/* XXX: If you need to lock both, queue_lock and device_lock, at the same
+ * time, ALWAYS lock `queue_lock' first! */
+static rrd_device_t   *devices = NULL;
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -321,8 +374,132 @@ static int value_list_to_filename (char *buffer, size_t buffer_size,
 	return (0);
 } /* int value_list_to_filename */
 
-static void *rrd_queue_thread (void __attribute__((unused)) *data)
+/* XXX: You must hold "device_lock" when calling this function! */
+static rrd_device_t *rrd_device_get (dev_t dev, cdtime_t now) /* {{{ */
+{
+	rrd_device_t *d;
+	double burst;
+
+	/* Allow the updates of one second to be written at once. */
+	burst = (device_write_rate > 1.0) ? device_write_rate : 1.0;
+
+	for (d = devices; d != NULL; d = d->next)
+		if (d->dev == dev)
+			break;
+
+	if (d == NULL)
+	{
+		d = calloc (1, sizeof (*d));
+		if (d == NULL)
+			return (NULL);
+		d->dev = dev;
+		d->tokens = burst;
+		d->last_refill = now;
+		d->next = devices;
+		devices = d;
+		return (d);
+	}
+
+	if (now > d->last_refill)
+	{
+		d->tokens += CDTIME_T_TO_DOUBLE (now - d->last_refill)
+			* device_write_rate;
+		if (d->tokens > burst)
+			d->tokens = burst;
+		d->last_refill = now;
+	}
+
+	return (d);
+} /* }}} rrd_device_t *rrd_device_get */
+
+static void rrd_device_destroy (void) /* {{{ */
 {
+	pthread_mutex_lock (&device_lock);
+	while (devices != NULL)
+	{
+		rrd_device_t *next = devices->next;
+		sfree (devices);
+		devices = next;
+	}
+	pthread_mutex_unlock (&device_lock);
+} /* }}} void rrd_device_destroy */
+
+/* Returns the first regular queue entry whose device has budget left and
+ * takes one update from that budget. If all devices are exhausted, returns
+ * NULL and sets "ret_wait" to the time until the next update is allowed.
+ * XXX: You must hold "shard->queue_lock" when calling this function! */
+static rrd_queue_t *rrd_queue_pick (rrd_shard_t *shard, /* {{{ */
+		cdtime_t *ret_wait)
+{
+	rrd_queue_t *q;
+	rrd_device_t *d;
+	cdtime_t now = cdtime ();
+	double deficit = 1.0;
+
+	pthread_mutex_lock (&device_lock);
+
+	/* rrd_queue_enqueue() adds the devices of all queued files, so if no
+	 * device has budget left there is no need to walk the queue. */
+	for (d = devices; d != NULL; d = d->next)
+	{
+		rrd_device_get (d->dev, now);
+		if (d->tokens >= 1.0)
+			break;
+		if ((1.0 - d->tokens) < deficit)
+			deficit = 1.0 - d->tokens;
+	}
+
+	for (q = (d != NULL) ? shard->queue_head : NULL; q != NULL; q = q->next)
+	{
+		d = rrd_device_get (q->dev, now);
+		/* Don't stall the queue if we're out of memory. */
+		if (d == NULL)
+			break;
+		if (d->tokens >= 1.0)
+		{
+			d->tokens -= 1.0;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock (&device_lock);
+
+	if (q == NULL)
+		*ret_wait = DOUBLE_TO_CDTIME_T (deficit / device_write_rate);
+	return (q);
+} /* }}} rrd_queue_t *rrd_queue_pick */
+
+/* XXX: You must hold "shard->queue_lock" when calling this function! */
+static void rrd_queue_unlink (rrd_shard_t *shard, /* {{{ */
+		rrd_queue_t *entry)
+{
+	rrd_queue_t *prev = NULL;
+	rrd_queue_t *this;
+
+	for (this = shard->queue_head; this != NULL; this = this->next)
+	{
+		if (this == entry)
+			break;
+		prev = this;
+	}
+
+	if (this == NULL)
+		return;
+
+	if (prev == NULL)
+		shard->queue_head = this->next;
+	else
+		prev->next = this->next;
+
+	if (this->next == NULL)
+		shard->queue_tail = prev;
+	this->next = NULL;
+} /* }}} void rrd_queue_unlink */
+
+static void *rrd_queue_thread (void *data)
+{
+	rrd_shard_t *shard = data;
+	cdtime_t update_start;
         struct timeval tv_next_update;
         struct timeval tv_now;
 
@@ -331,6 +508,7 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 	while (42)
 	{
 		rrd_queue_t *queue_entry;
+		rrd_queue_t *queue_pick = NULL;
 		rrd_cache_t *cache_entry;
 		char **values;
 		int    values_num;
@@ -340,86 +518,105 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 		values = NULL;
 		values_num = 0;
 
-                pthread_mutex_lock (&queue_lock);
+                pthread_mutex_lock (&shard->queue_lock);
                 /* Wait for values to arrive */
                 while (42)
                 {
                   struct timespec ts_wait;
+                  cdtime_t wait = 0;
 
-                  while ((flushq_head == NULL) && (queue_head == NULL)
+                  while ((shard->flushq_head == NULL) && (shard->queue_head == NULL)
                       && (do_shutdown == 0))
-                    pthread_cond_wait (&queue_cond, &queue_lock);
+                    pthread_cond_wait (&shard->queue_cond, &shard->queue_lock);
 
-                  if ((flushq_head == NULL) && (queue_head == NULL))
+                  if ((shard->flushq_head == NULL) && (shard->queue_head == NULL))
                     break;
 
                   /* Don't delay if there's something to flush */
-                  if (flushq_head != NULL)
+                  if (shard->flushq_head != NULL)
                     break;
 
                   /* Don't delay if we're shutting down */
                   if (do_shutdown != 0)
                     break;
 
-                  /* Don't delay if no delay was configured. */
-                  if (write_rate <= 0.0)
-                    break;
+                  if (write_rate > 0.0)
+                  {
+                    gettimeofday (&tv_now, /* timezone = */ NULL);
+                    status = timeval_cmp (tv_next_update, tv_now, NULL);
+
+                    /* We're supposed to wait a bit with this update, so we'll
+                     * wait for the next addition to the queue or to the end of
+                     * the wait period - whichever comes first. */
+                    if (status > 0)
+                    {
+                      ts_wait.tv_sec = tv_next_update.tv_sec;
+                      ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
+
+                      pthread_cond_timedwait (&shard->queue_cond,
+                          &shard->queue_lock, &ts_wait);
+                      continue;
+                    }
+                  }
 
-                  gettimeofday (&tv_now, /* timezone = */ NULL);
-                  status = timeval_cmp (tv_next_update, tv_now, NULL);
-                  /* We're good to go */
-                  if (status <= 0)
+                  /* Don't delay if no per-device budget was configured. */
+                  if (device_write_rate <= 0.0)
                     break;
 
-                  /* We're supposed to wait a bit with this update, so we'll
-                   * wait for the next addition to the queue or to the end of
-                   * the wait period - whichever comes first. */
-                  ts_wait.tv_sec = tv_next_update.tv_sec;
-                  ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
-
-                  status = pthread_cond_timedwait (&queue_cond, &queue_lock,
-                      &ts_wait);
-                  if (status == ETIMEDOUT)
+                  /* Write a file on a device with budget left first. If
+                   * there is none, wait until a device has budget again. */
+                  queue_pick = rrd_queue_pick (shard, &wait);
+                  if (queue_pick != NULL)
                     break;
+
+                  CDTIME_T_TO_TIMESPEC (cdtime () + wait, &ts_wait);
+                  pthread_cond_timedwait (&shard->queue_cond,
+                      &shard->queue_lock, &ts_wait);
                 } /* while (42) */
 
                 /* XXX: If you need to lock both, cache_lock and queue_lock, at
                  * the same time, ALWAYS lock `cache_lock' first! */
 
                 /* We're in the shutdown phase */
-                if ((flushq_head == NULL) && (queue_head == NULL))
+                if ((shard->flushq_head == NULL) && (shard->queue_head == NULL))
                 {
-                  pthread_mutex_unlock (&queue_lock);
+                  pthread_mutex_unlock (&shard->queue_lock);
                   break;
                 }
 
-                if (flushq_head != NULL)
+                if (shard->flushq_head != NULL)
                 {
                   /* Dequeue the first flush entry */
-                  queue_entry = flushq_head;
-                  if (flushq_head == flushq_tail)
-                    flushq_head = flushq_tail = NULL;
+                  queue_entry = shard->flushq_head;
+                  if (shard->flushq_head == shard->flushq_tail)
+                    shard->flushq_head = shard->flushq_tail = NULL;
                   else
-                    flushq_head = flushq_head->next;
+                    shard->flushq_head = shard->flushq_head->next;
+                }
+                else if (queue_pick != NULL)
+                {
+                  queue_entry = queue_pick;
+                  rrd_queue_unlink (shard, queue_entry);
                 }
-                else /* if (queue_head != NULL) */
+                else /* if (shard->queue_head != NULL) */
                 {
                   /* Dequeue the first regular entry */
-                  queue_entry = queue_head;
-                  if (queue_head == queue_tail)
-                    queue_head = queue_tail = NULL;
+                  queue_entry = shard->queue_head;
+                  if (shard->queue_head == shard->queue_tail)
+                    shard->queue_head = shard->queue_tail = NULL;
                   else
-                    queue_head = queue_head->next;
+                    shard->queue_head = shard->queue_head->next;
                 }
+                shard->queue_length--;
 
 		/* Unlock the queue again */
-		pthread_mutex_unlock (&queue_lock);
+		pthread_mutex_unlock (&shard->queue_lock);
 
 		/* We now need the cache lock so the entry isn't updated while
 		 * we make a copy of it's values */
-		pthread_mutex_lock (&cache_lock);
+		pthread_mutex_lock (&shard->cache_lock);
 
-		status = c_avl_get (cache, queue_entry->filename,
+		status = c_avl_get (shard->cache, queue_entry->filename,
 				(void *) &cache_entry);
 
 		if (status == 0)
@@ -430,9 +627,13 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 			cache_entry->values = NULL;
 			cache_entry->values_num = 0;
 			cache_entry->flags = FLAG_NONE;
+
+			for (i = 0; i < values_num; i++)
+				shard->cache_memory -= sizeof (*values)
+					+ strlen (values[i]) + 1;
 		}
 
-		pthread_mutex_unlock (&cache_lock);
+		pthread_mutex_unlock (&shard->cache_lock);
 
 		if (status != 0)
 		{
@@ -441,13 +642,14 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 			continue;
 		}
 
-		/* Update `tv_next_update' */
+		/* Update `tv_next_update'. The configured rate is shared by all
+		 * queue threads. */
 		if (write_rate > 0.0)
                 {
                   gettimeofday (&tv_now, /* timezone = */ NULL);
                   tv_next_update.tv_sec = tv_now.tv_sec;
                   tv_next_update.tv_usec = tv_now.tv_usec
-                    + ((suseconds_t) (1000000 * write_rate));
+                    + ((suseconds_t) (1000000 * write_rate * shards_num));
                   while (tv_next_update.tv_usec > 1000000)
                   {
                     tv_next_update.tv_sec++;
@@ -456,8 +658,15 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                 }
 
 		/* Write the values to the RRD-file */
+		update_start = cdtime ();
 		srrd_update (queue_entry->filename, NULL,
 				values_num, (const char **)values);
+
+		pthread_mutex_lock (&shard->queue_lock);
+		shard->updates_num++;
+		shard->updates_num_interval++;
+		shard->updates_time += cdtime () - update_start;
+		pthread_mutex_unlock (&shard->queue_lock);
 		DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
 				values_num, (values_num == 1) ? "" : "s",
 				queue_entry->filename);
@@ -475,8 +684,8 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 	return ((void *) 0);
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue (const char *filename,
-    rrd_queue_t **head, rrd_queue_t **tail)
+static int rrd_queue_enqueue (rrd_shard_t *shard, const char *filename,
+    dev_t dev, rrd_queue_dir_t dir, rrd_queue_t **head, rrd_queue_t **tail)
 {
   rrd_queue_t *queue_entry;
 
@@ -491,29 +700,48 @@ static int rrd_queue_enqueue (const char *filename,
     return (-1);
   }
 
+  queue_entry->dev = dev;
   queue_entry->next = NULL;
 
-  pthread_mutex_lock (&queue_lock);
+  pthread_mutex_lock (&shard->queue_lock);
+
+  if (device_write_rate > 0.0)
+  {
+    pthread_mutex_lock (&device_lock);
+    rrd_device_get (dev, cdtime ());
+    pthread_mutex_unlock (&device_lock);
+  }
 
   if (*tail == NULL)
+  {
     *head = queue_entry;
+    *tail = queue_entry;
+  }
+  else if (dir == QUEUE_INSERT_FRONT)
+  {
+    queue_entry->next = *head;
+    *head = queue_entry;
+  }
   else
+  {
     (*tail)->next = queue_entry;
-  *tail = queue_entry;
+    *tail = queue_entry;
+  }
+  shard->queue_length++;
 
-  pthread_cond_signal (&queue_cond);
-  pthread_mutex_unlock (&queue_lock);
+  pthread_cond_signal (&shard->queue_cond);
+  pthread_mutex_unlock (&shard->queue_lock);
 
   return (0);
 } /* int rrd_queue_enqueue */
 
-static int rrd_queue_dequeue (const char *filename,
+static int rrd_queue_dequeue (rrd_shard_t *shard, const char *filename,
     rrd_queue_t **head, rrd_queue_t **tail)
 {
   rrd_queue_t *this;
   rrd_queue_t *prev;
 
-  pthread_mutex_lock (&queue_lock);
+  pthread_mutex_lock (&shard->queue_lock);
 
   prev = NULL;
   this = *head;
@@ -529,7 +757,7 @@ static int rrd_queue_dequeue (const char *filename,
 
   if (this == NULL)
   {
-    pthread_mutex_unlock (&queue_lock);
+    pthread_mutex_unlock (&shard->queue_lock);
     return (-1);
   }
 
@@ -540,8 +768,9 @@ static int rrd_queue_dequeue (const char *filename,
 
   if (this->next == NULL)
     *tail = prev;
+  shard->queue_length--;
 
-  pthread_mutex_unlock (&queue_lock);
+  pthread_mutex_unlock (&shard->queue_lock);
 
   sfree (this->filename);
   sfree (this);
@@ -549,8 +778,28 @@ static int rrd_queue_dequeue (const char *filename,
   return (0);
 } /* int rrd_queue_dequeue */
 
-/* XXX: You must hold "cache_lock" when calling this function! */
-static void rrd_cache_flush (cdtime_t timeout)
+struct rrd_flush_entry_s
+{
+	char        *key;
+	rrd_cache_t *rc;
+};
+typedef struct rrd_flush_entry_s rrd_flush_entry_t;
+
+static int rrd_compare_location (const void *a, const void *b) /* {{{ */
+{
+	rrd_cache_t const *rc_a = ((rrd_flush_entry_t const *) a)->rc;
+	rrd_cache_t const *rc_b = ((rrd_flush_entry_t const *) b)->rc;
+
+	if (rc_a->dev != rc_b->dev)
+		return ((rc_a->dev < rc_b->dev) ? -1 : 1);
+	else if (rc_a->ino != rc_b->ino)
+		return ((rc_a->ino < rc_b->ino) ? -1 : 1);
+	else
+		return (0);
+} /* }}} int rrd_compare_location */
+
+/* XXX: You must hold "shard->cache_lock" when calling this function! */
+static void rrd_cache_flush (rrd_shard_t *shard, cdtime_t timeout)
 {
 	rrd_cache_t *rc;
 	cdtime_t     now;
@@ -558,6 +807,11 @@ static void rrd_cache_flush (cdtime_t timeout)
 	char **keys = NULL;
 	int    keys_num = 0;
 
+	/* Expired entries are queued ordered by device and inode, so that
+	 * updates of files close to each other on disk are written together. */
+	rrd_flush_entry_t *queue = NULL;
+	int                queue_num = 0;
+
 	char *key;
 	c_avl_iterator_t *iter;
 	int i;
@@ -569,7 +823,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 	timeout = TIME_T_TO_CDTIME_T (timeout);
 
 	/* Build a list of entries to be flushed */
-	iter = c_avl_get_iterator (cache);
+	iter = c_avl_get_iterator (shard->cache);
 	while (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
 	{
 		if (rc->flags != FLAG_NONE)
@@ -580,11 +834,17 @@ static void rrd_cache_flush (cdtime_t timeout)
 			continue;
 		else if (rc->values_num > 0)
 		{
-			int status;
-
-			status = rrd_queue_enqueue (key, &queue_head,  &queue_tail);
-			if (status == 0)
-				rc->flags = FLAG_QUEUED;
+			rrd_flush_entry_t *tmp = realloc (queue,
+					(queue_num + 1) * sizeof (*queue));
+			if (tmp == NULL)
+			{
+				ERROR ("rrdtool plugin: realloc failed.");
+				break;
+			}
+			queue = tmp;
+			queue[queue_num].key = key;
+			queue[queue_num].rc = rc;
+			queue_num++;
 		}
 		else /* ancient and no values -> waste of memory */
 		{
@@ -599,6 +859,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 							sizeof (errbuf)));
 				c_avl_iterator_destroy (iter);
 				sfree (keys);
+				sfree (queue);
 				return;
 			}
 			keys = tmp;
@@ -608,9 +869,24 @@ static void rrd_cache_flush (cdtime_t timeout)
 	} /* while (c_avl_iterator_next) */
 	c_avl_iterator_destroy (iter);
 
+	if (queue_num > 1)
+		qsort (queue, (size_t) queue_num, sizeof (*queue),
+				rrd_compare_location);
+
+	for (i = 0; i < queue_num; i++)
+	{
+		int status;
+
+		status = rrd_queue_enqueue (shard, queue[i].key, queue[i].rc->dev,
+				QUEUE_INSERT_BACK, &shard->queue_head, &shard->queue_tail);
+		if (status == 0)
+			queue[i].rc->flags = FLAG_QUEUED;
+	}
+	sfree (queue);
+
 	for (i = 0; i < keys_num; i++)
 	{
-		if (c_avl_remove (cache, keys[i], (void *) &key, (void *) &rc) != 0)
+		if (c_avl_remove (shard->cache, keys[i], (void *) &key, (void *) &rc) != 0)
 		{
 			DEBUG ("rrdtool plugin: c_avl_remove (%s) failed.", keys[i]);
 			continue;
@@ -619,6 +895,7 @@ static void rrd_cache_flush (cdtime_t timeout)
 		assert (rc->values == NULL);
 		assert (rc->values_num == 0);
 
+		shard->cache_memory -= sizeof (*rc) + strlen (key) + 1;
 		sfree (rc);
 		sfree (key);
 		keys[i] = NULL;
@@ -626,10 +903,11 @@ static void rrd_cache_flush (cdtime_t timeout)
 
 	sfree (keys);
 
-	cache_flush_last = now;
+	shard->cache_flush_last = cdtime_coarse ();
 } /* void rrd_cache_flush */
 
-static int rrd_cache_flush_identifier (cdtime_t timeout,
+/* XXX: You must hold "shard->cache_lock" when calling this function! */
+static int rrd_cache_flush_identifier (rrd_shard_t *shard, cdtime_t timeout,
     const char *identifier)
 {
   rrd_cache_t *rc;
@@ -637,12 +915,6 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   int status;
   char key[2048];
 
-  if (identifier == NULL)
-  {
-    rrd_cache_flush (timeout);
-    return (0);
-  }
-
   now = cdtime ();
 
   if (datadir == NULL)
@@ -653,7 +925,7 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
         datadir, identifier);
   key[sizeof (key) - 1] = 0;
 
-  status = c_avl_get (cache, key, (void *) &rc);
+  status = c_avl_get (shard->cache, key, (void *) &rc);
   if (status != 0)
   {
     INFO ("rrdtool plugin: rrd_cache_flush_identifier: "
@@ -662,14 +934,19 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
     return (status);
   }
 
+  /* Someone is looking at this file, so it's not deferred when the queue
+   * gets long. */
+  rc->last_flush = now;
+
   if (rc->flags == FLAG_FLUSHQ)
   {
     status = 0;
   }
   else if (rc->flags == FLAG_QUEUED)
   {
-    rrd_queue_dequeue (key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    rrd_queue_dequeue (shard, key, &shard->queue_head, &shard->queue_tail);
+    status = rrd_queue_enqueue (shard, key, rc->dev, QUEUE_INSERT_BACK,
+        &shard->flushq_head, &shard->flushq_tail);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -679,7 +956,8 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   }
   else if (rc->values_num > 0)
   {
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    status = rrd_queue_enqueue (shard, key, rc->dev, QUEUE_INSERT_BACK,
+        &shard->flushq_head, &shard->flushq_tail);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -695,46 +973,81 @@ static int64_t rrd_get_random_variation (void)
   if (random_timeout <= 0)
     return (0);
 
-  /* Assure that "cache_timeout + random_variation" is never negative. */
-  if (random_timeout > cache_timeout)
-  {
-	  INFO ("rrdtool plugin: Adjusting \"RandomTimeout\" to %.3f seconds.",
-			  CDTIME_T_TO_DOUBLE (cache_timeout));
-	  random_timeout = cache_timeout;
-  }
-
   max = (long) (random_timeout / 2);
   min = max - ((long) random_timeout);
 
   return ((int64_t) cdrand_range (min, max));
 } /* int64_t rrd_get_random_variation */
 
-static int rrd_cache_insert (const char *filename,
-		const char *value, cdtime_t value_time)
+/* Returns the time values of "rc" are cached before they are written. When
+ * the queue of "shard" is longer than "DeferQueueLength", files nobody has
+ * flushed recently are kept longer, so that the queue can drain. Sets
+ * "ret_hot" if the file has been flushed recently.
+ * XXX: You must hold "shard->cache_lock" when calling this function! */
+static cdtime_t rrd_cache_timeout (rrd_shard_t *shard, /* {{{ */
+		rrd_cache_t const *rc, _Bool *ret_hot)
+{
+	cdtime_t timeout = cache_timeout + rc->random_variation;
+	cdtime_t hot_period;
+	int queue_length;
+
+	*ret_hot = 0;
+
+	if (defer_queue_length <= 0)
+		return (timeout);
+
+	pthread_mutex_lock (&shard->queue_lock);
+	queue_length = shard->queue_length;
+	pthread_mutex_unlock (&shard->queue_lock);
+
+	if (queue_length <= defer_queue_length)
+		return (timeout);
+
+	hot_period = (cache_flush_timeout > 0) ? cache_flush_timeout
+		: 10 * cache_timeout;
+	if ((rc->last_flush != 0) && ((cdtime () - rc->last_flush) < hot_period))
+	{
+		*ret_hot = 1;
+		return (timeout);
+	}
+
+	timeout = (cdtime_t) (((double) timeout) * ((double) queue_length)
+			/ ((double) defer_queue_length));
+	/* rrd_cache_flush() writes the file after "CacheFlush" in any case. */
+	if ((cache_flush_timeout > 0) && (timeout > cache_flush_timeout))
+		timeout = cache_flush_timeout;
+
+	return (timeout);
+} /* }}} cdtime_t rrd_cache_timeout */
+
+static int rrd_cache_insert (rrd_shard_t *shard, const char *filename,
+		struct stat const *statbuf, const char *value, cdtime_t value_time)
 {
 	rrd_cache_t *rc = NULL;
 	int new_rc = 0;
 	char **values_new;
+	cdtime_t timeout;
+	_Bool hot = 0;
 
-	pthread_mutex_lock (&cache_lock);
+	pthread_mutex_lock (&shard->cache_lock);
 
 	/* This shouldn't happen, but it did happen at least once, so we'll be
 	 * careful. */
-	if (cache == NULL)
+	if (shard->cache == NULL)
 	{
-		pthread_mutex_unlock (&cache_lock);
+		pthread_mutex_unlock (&shard->cache_lock);
 		WARNING ("rrdtool plugin: cache == NULL.");
 		return (-1);
 	}
 
-	c_avl_get (cache, filename, (void *) &rc);
+	c_avl_get (shard->cache, filename, (void *) &rc);
 
 	if (rc == NULL)
 	{
 		rc = malloc (sizeof (*rc));
 		if (rc == NULL)
 		{
-			pthread_mutex_unlock (&cache_lock);
+			pthread_mutex_unlock (&shard->cache_lock);
 			return (-1);
 		}
 		rc->values_num = 0;
@@ -742,14 +1055,19 @@ static int rrd_cache_insert (const char *filename,
 		rc->first_value = 0;
 		rc->last_value = 0;
 		rc->random_variation = rrd_get_random_variation ();
+		rc->last_flush = 0;
 		rc->flags = FLAG_NONE;
 		new_rc = 1;
 	}
 
+	/* The file may have been replaced since the last value. */
+	rc->dev = statbuf->st_dev;
+	rc->ino = statbuf->st_ino;
+
 	assert (value_time > 0); /* plugin_dispatch() ensures this. */
 	if (rc->last_value >= value_time)
 	{
-		pthread_mutex_unlock (&cache_lock);
+		pthread_mutex_unlock (&shard->cache_lock);
 		DEBUG ("rrdtool plugin: (rc->last_value = %"PRIu64") "
 				">= (value_time = %"PRIu64")",
 				rc->last_value, value_time);
@@ -765,8 +1083,16 @@ static int rrd_cache_insert (const char *filename,
 
 		sstrerror (errno, errbuf, sizeof (errbuf));
 
-		c_avl_remove (cache, filename, &cache_key, NULL);
-		pthread_mutex_unlock (&cache_lock);
+		if (c_avl_remove (shard->cache, filename, &cache_key, NULL) == 0)
+		{
+			int i;
+
+			shard->cache_memory -= sizeof (*rc) + strlen (filename) + 1;
+			for (i = 0; i < rc->values_num; i++)
+				shard->cache_memory -= sizeof (*rc->values)
+					+ strlen (rc->values[i]) + 1;
+		}
+		pthread_mutex_unlock (&shard->cache_lock);
 
 		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
 
@@ -779,7 +1105,10 @@ static int rrd_cache_insert (const char *filename,
 
 	rc->values[rc->values_num] = strdup (value);
 	if (rc->values[rc->values_num] != NULL)
+	{
 		rc->values_num++;
+		shard->cache_memory += sizeof (*rc->values) + strlen (value) + 1;
+	}
 
 	if (rc->values_num == 1)
 		rc->first_value = value_time;
@@ -795,7 +1124,8 @@ static int rrd_cache_insert (const char *filename,
 			char errbuf[1024];
 			sstrerror (errno, errbuf, sizeof (errbuf));
 
-			pthread_mutex_unlock (&cache_lock);
+			shard->cache_memory -= sizeof (*rc->values) + strlen (value) + 1;
+			pthread_mutex_unlock (&shard->cache_lock);
 
 			ERROR ("rrdtool plugin: strdup failed: %s", errbuf);
 
@@ -805,7 +1135,8 @@ static int rrd_cache_insert (const char *filename,
 			return (-1);
 		}
 
-		c_avl_insert (cache, cache_key, rc);
+		c_avl_insert (shard->cache, cache_key, rc);
+		shard->cache_memory += sizeof (*rc) + strlen (filename) + 1;
 	}
 
 	DEBUG ("rrdtool plugin: rrd_cache_insert: file = %s; "
@@ -813,7 +1144,8 @@ static int rrd_cache_insert (const char *filename,
 			filename, rc->values_num,
 			CDTIME_T_TO_DOUBLE (rc->last_value - rc->first_value));
 
-	if ((rc->last_value - rc->first_value) >= (cache_timeout + rc->random_variation))
+	timeout = rrd_cache_timeout (shard, rc, &hot);
+	if ((rc->last_value - rc->first_value) >= timeout)
 	{
 		/* XXX: If you need to lock both, cache_lock and queue_lock, at
 		 * the same time, ALWAYS lock `cache_lock' first! */
@@ -821,7 +1153,10 @@ static int rrd_cache_insert (const char *filename,
 		{
 			int status;
 
-			status = rrd_queue_enqueue (filename, &queue_head, &queue_tail);
+			/* Hot files skip ahead of the deferred ones. */
+			status = rrd_queue_enqueue (shard, filename, rc->dev,
+					hot ? QUEUE_INSERT_FRONT : QUEUE_INSERT_BACK,
+					&shard->queue_head, &shard->queue_tail);
 			if (status == 0)
 				rc->flags = FLAG_QUEUED;
 
@@ -834,30 +1169,30 @@ static int rrd_cache_insert (const char *filename,
 	}
 
 	if ((cache_timeout > 0) &&
-			((cdtime () - cache_flush_last) > cache_flush_timeout))
-		rrd_cache_flush (cache_flush_timeout);
+			((cdtime_coarse () - shard->cache_flush_last) > cache_flush_timeout))
+		rrd_cache_flush (shard, cache_flush_timeout);
 
-	pthread_mutex_unlock (&cache_lock);
+	pthread_mutex_unlock (&shard->cache_lock);
 
 	return (0);
 } /* int rrd_cache_insert */
 
-static int rrd_cache_destroy (void) /* {{{ */
+static int rrd_cache_destroy (rrd_shard_t *shard) /* {{{ */
 {
   void *key = NULL;
   void *value = NULL;
 
   int non_empty = 0;
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&shard->cache_lock);
 
-  if (cache == NULL)
+  if (shard->cache == NULL)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&shard->cache_lock);
     return (0);
   }
 
-  while (c_avl_pick (cache, &key, &value) == 0)
+  while (c_avl_pick (shard->cache, &key, &value) == 0)
   {
     rrd_cache_t *rc;
     int i;
@@ -877,8 +1212,9 @@ static int rrd_cache_destroy (void) /* {{{ */
     sfree (rc);
   }
 
-  c_avl_destroy (cache);
-  cache = NULL;
+  c_avl_destroy (shard->cache);
+  shard->cache = NULL;
+  shard->cache_memory = 0;
 
   if (non_empty > 0)
   {
@@ -891,7 +1227,7 @@ static int rrd_cache_destroy (void) /* {{{ */
         "when destroying the cache.");
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->cache_lock);
   return (0);
 } /* }}} int rrd_cache_destroy */
 
@@ -940,6 +1276,10 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 				return (-1);
 			else if (rrdcreate_config.async)
 				return (0);
+
+			/* Device and inode are used to order the updates. */
+			if (stat (filename, &statbuf) != 0)
+				memset (&statbuf, 0, sizeof (statbuf));
 		}
 		else
 		{
@@ -957,7 +1297,11 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 		return (-1);
 	}
 
-	status = rrd_cache_insert (filename, values, vl->time);
+	if (shards == NULL)
+		return (-1);
+
+	status = rrd_cache_insert (&shards[identifier_hash_vl (vl) % shards_num],
+			filename, &statbuf, values, vl->time);
 
 	return (status);
 } /* int rrd_write */
@@ -965,19 +1309,121 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 static int rrd_flush (cdtime_t timeout, const char *identifier,
 		__attribute__((unused)) user_data_t *user_data)
 {
-	pthread_mutex_lock (&cache_lock);
+	rrd_shard_t *shard;
+	int i;
 
-	if (cache == NULL) {
-		pthread_mutex_unlock (&cache_lock);
+	if (shards == NULL)
+		return (0);
+
+	if (identifier != NULL)
+	{
+		shard = &shards[identifier_hash_name (identifier) % shards_num];
+
+		pthread_mutex_lock (&shard->cache_lock);
+		if (shard->cache != NULL)
+			rrd_cache_flush_identifier (shard, timeout, identifier);
+		pthread_mutex_unlock (&shard->cache_lock);
 		return (0);
 	}
 
-	rrd_cache_flush_identifier (timeout, identifier);
+	for (i = 0; i < shards_num; i++)
+	{
+		shard = &shards[i];
+
+		pthread_mutex_lock (&shard->cache_lock);
+		if (shard->cache != NULL)
+			rrd_cache_flush (shard, timeout);
+		pthread_mutex_unlock (&shard->cache_lock);
+	}
 
-	pthread_mutex_unlock (&cache_lock);
 	return (0);
 } /* int rrd_flush */
 
+static void rrd_submit_stats (char const *plugin_instance, /* {{{ */
+		char const *type, char const *type_instance, value_t value)
+{
+	value_list_t vl = VALUE_LIST_INIT;
+
+	vl.values = &value;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "rrdtool", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, plugin_instance,
+			sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, type, sizeof (vl.type));
+	if (type_instance != NULL)
+		sstrncpy (vl.type_instance, type_instance,
+				sizeof (vl.type_instance));
+
+	plugin_dispatch_values (&vl);
+} /* }}} void rrd_submit_stats */
+
+/* Reports the memory used by the caches of all shards. */
+static int rrd_memory (size_t *ret_bytes) /* {{{ */
+{
+	int i;
+
+	*ret_bytes = 0;
+	if (shards == NULL)
+		return (0);
+
+	for (i = 0; i < shards_num; i++)
+	{
+		pthread_mutex_lock (&shards[i].cache_lock);
+		*ret_bytes += shards[i].cache_memory;
+		pthread_mutex_unlock (&shards[i].cache_lock);
+	}
+
+	return (0);
+} /* }}} int rrd_memory */
+
+/* Reports the queue length of each shard, the number of files it updated and
+ * the average time an update took since the last read. */
+static int rrd_read_stats (void) /* {{{ */
+{
+	int i;
+
+	if (shards == NULL)
+		return (0);
+
+	for (i = 0; i < shards_num; i++)
+	{
+		rrd_shard_t *shard = &shards[i];
+		char plugin_instance[DATA_MAX_NAME_LEN];
+		int queue_length;
+		derive_t updates_num;
+		derive_t updates_num_interval;
+		cdtime_t updates_time;
+		value_t v;
+
+		pthread_mutex_lock (&shard->queue_lock);
+		queue_length = shard->queue_length;
+		updates_num = shard->updates_num;
+		updates_num_interval = shard->updates_num_interval;
+		updates_time = shard->updates_time;
+		shard->updates_num_interval = 0;
+		shard->updates_time = 0;
+		pthread_mutex_unlock (&shard->queue_lock);
+
+		ssnprintf (plugin_instance, sizeof (plugin_instance), "%i", i);
+
+		v.gauge = (gauge_t) queue_length;
+		rrd_submit_stats (plugin_instance, "queue_length", NULL, v);
+
+		if (updates_num_interval > 0)
+			v.gauge = CDTIME_T_TO_DOUBLE (updates_time)
+				/ ((gauge_t) updates_num_interval);
+		else
+			v.gauge = NAN;
+		rrd_submit_stats (plugin_instance, "latency", "update", v);
+
+		v.derive = updates_num;
+		rrd_submit_stats (plugin_instance, "derive", "updates", v);
+	}
+
+	return (0);
+} /* }}} int rrd_read_stats */
+
 static int rrd_config (const char *key, const char *value)
 {
 	if (strcasecmp ("CacheTimeout", key) == 0)
@@ -1058,6 +1504,19 @@ static int rrd_config (const char *key, const char *value)
 		else
 			rrdcreate_config.async = 0;
 	}
+	else if (strcasecmp ("CreateFilesAsyncThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp <= 0)
+		{
+			fprintf (stderr, "rrdtool: `CreateFilesAsyncThreads' must "
+					"be greater than 0.\n");
+			ERROR ("rrdtool: `CreateFilesAsyncThreads' must "
+					"be greater than 0.\n");
+			return (1);
+		}
+		rrdcreate_config.async_threads = tmp;
+	}
 	else if (strcasecmp ("RRARows", key) == 0)
 	{
 		int tmp = atoi (value);
@@ -1142,6 +1601,49 @@ static int rrd_config (const char *key, const char *value)
 			write_rate = 1.0 / wps;
 		}
 	}
+	else if (strcasecmp ("WriteThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp <= 0)
+		{
+			fprintf (stderr, "rrdtool: `WriteThreads' must "
+					"be greater than 0.\n");
+			ERROR ("rrdtool: `WriteThreads' must "
+					"be greater than 0.\n");
+			return (1);
+		}
+		shards_num = tmp;
+	}
+	else if (strcasecmp ("DeviceWritesPerSecond", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp < 0.0)
+		{
+			fprintf (stderr, "rrdtool: `DeviceWritesPerSecond' must be "
+					"greater than or equal to zero.\n");
+			ERROR ("rrdtool: `DeviceWritesPerSecond' must be "
+					"greater than or equal to zero.");
+			return (1);
+		}
+		device_write_rate = tmp;
+	}
+	else if (strcasecmp ("DeferQueueLength", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 0)
+		{
+			fprintf (stderr, "rrdtool: `DeferQueueLength' must be "
+					"greater than or equal to zero.\n");
+			ERROR ("rrdtool: `DeferQueueLength' must be "
+					"greater than or equal to zero.");
+			return (1);
+		}
+		defer_queue_length = tmp;
+	}
+	else if (strcasecmp ("ReportStats", key) == 0)
+	{
+		report_stats = IS_TRUE (value) ? 1 : 0;
+	}
 	else if (strcasecmp ("RandomTimeout", key) == 0)
         {
 		double tmp;
@@ -1168,36 +1670,66 @@ static int rrd_config (const char *key, const char *value)
 
 static int rrd_shutdown (void)
 {
-	pthread_mutex_lock (&cache_lock);
-	rrd_cache_flush (0);
-	pthread_mutex_unlock (&cache_lock);
+	_Bool queued = 0;
+	int i;
 
-	pthread_mutex_lock (&queue_lock);
-	do_shutdown = 1;
-	pthread_cond_signal (&queue_cond);
-	pthread_mutex_unlock (&queue_lock);
+	if (shards == NULL)
+		return (0);
 
-	if ((queue_thread_running != 0)
-			&& ((queue_head != NULL) || (flushq_head != NULL)))
+	for (i = 0; i < shards_num; i++)
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread. "
-				"This may take a while.");
+		rrd_shard_t *shard = &shards[i];
+
+		pthread_mutex_lock (&shard->cache_lock);
+		if (shard->cache != NULL)
+			rrd_cache_flush (shard, 0);
+		pthread_mutex_unlock (&shard->cache_lock);
 	}
-	else if (queue_thread_running != 0)
+
+	/* All queue threads read "do_shutdown" under their own queue_lock. */
+	for (i = 0; i < shards_num; i++)
+		pthread_mutex_lock (&shards[i].queue_lock);
+
+	do_shutdown = 1;
+
+	for (i = 0; i < shards_num; i++)
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread.");
+		rrd_shard_t *shard = &shards[i];
+
+		if ((shard->queue_head != NULL) || (shard->flushq_head != NULL))
+			queued = 1;
+		pthread_cond_signal (&shard->queue_cond);
+		pthread_mutex_unlock (&shard->queue_lock);
 	}
 
+	if (queued)
+		INFO ("rrdtool plugin: Shutting down the queue threads. "
+				"This may take a while.");
+	else
+		INFO ("rrdtool plugin: Shutting down the queue threads.");
+
 	/* Wait for all the values to be written to disk before returning. */
-	if (queue_thread_running != 0)
+	for (i = 0; i < shards_num; i++)
 	{
-		pthread_join (queue_thread, NULL);
-		memset (&queue_thread, 0, sizeof (queue_thread));
-		queue_thread_running = 0;
-		DEBUG ("rrdtool plugin: queue_thread exited.");
+		rrd_shard_t *shard = &shards[i];
+
+		if (shard->thread_running != 0)
+		{
+			pthread_join (shard->thread, NULL);
+			memset (&shard->thread, 0, sizeof (shard->thread));
+			shard->thread_running = 0;
+			DEBUG ("rrdtool plugin: queue thread %i exited.", i);
+		}
+
+		rrd_cache_destroy (shard);
+
+		pthread_mutex_destroy (&shard->cache_lock);
+		pthread_mutex_destroy (&shard->queue_lock);
+		pthread_cond_destroy (&shard->queue_cond);
 	}
 
-	rrd_cache_destroy ();
+	sfree (shards);
+	rrd_device_destroy ();
 
 	return (0);
 } /* int rrd_shutdown */
@@ -1206,6 +1738,7 @@ static int rrd_init (void)
 {
 	static int init_once = 0;
 	int status;
+	int i;
 
 	if (init_once != 0)
 		return (0);
@@ -1214,18 +1747,6 @@ static int rrd_init (void)
 	if (rrdcreate_config.heartbeat <= 0)
 		rrdcreate_config.heartbeat = 2 * rrdcreate_config.stepsize;
 
-	/* Set the cache up */
-	pthread_mutex_lock (&cache_lock);
-
-	cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
-	if (cache == NULL)
-	{
-		pthread_mutex_unlock (&cache_lock);
-		ERROR ("rrdtool plugin: c_avl_create failed.");
-		return (-1);
-	}
-
-	cache_flush_last = cdtime ();
 	if (cache_timeout == 0)
 	{
 		cache_flush_timeout = 0;
@@ -1233,24 +1754,64 @@ static int rrd_init (void)
 	else if (cache_flush_timeout < cache_timeout)
 		cache_flush_timeout = 10 * cache_timeout;
 
-	pthread_mutex_unlock (&cache_lock);
+	/* Assure that "cache_timeout + random_variation" is never negative. */
+	if (random_timeout > cache_timeout)
+	{
+		INFO ("rrdtool plugin: Adjusting \"RandomTimeout\" to %.3f seconds.",
+				CDTIME_T_TO_DOUBLE (cache_timeout));
+		random_timeout = cache_timeout;
+	}
 
-	status = plugin_thread_create (&queue_thread, /* attr = */ NULL,
-			rrd_queue_thread, /* args = */ NULL);
-	if (status != 0)
+	/* Set the caches up */
+	shards = calloc ((size_t) shards_num, sizeof (*shards));
+	if (shards == NULL)
 	{
-		ERROR ("rrdtool plugin: Cannot create queue-thread.");
+		ERROR ("rrdtool plugin: calloc failed.");
 		return (-1);
 	}
-	queue_thread_running = 1;
+
+	for (i = 0; i < shards_num; i++)
+	{
+		rrd_shard_t *shard = &shards[i];
+
+		pthread_mutex_init (&shard->cache_lock, /* attr = */ NULL);
+		pthread_mutex_init (&shard->queue_lock, /* attr = */ NULL);
+		pthread_cond_init (&shard->queue_cond, /* attr = */ NULL);
+
+		shard->cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+		if (shard->cache == NULL)
+		{
+			ERROR ("rrdtool plugin: c_avl_create failed.");
+			return (-1);
+		}
+		shard->cache_flush_last = cdtime_coarse ();
+	}
+
+	for (i = 0; i < shards_num; i++)
+	{
+		rrd_shard_t *shard = &shards[i];
+
+		status = plugin_thread_create (&shard->thread, /* attr = */ NULL,
+				rrd_queue_thread, /* args = */ shard);
+		if (status != 0)
+		{
+			ERROR ("rrdtool plugin: Cannot create queue-thread.");
+			return (-1);
+		}
+		shard->thread_running = 1;
+	}
+
+	if (report_stats)
+		plugin_register_read ("rrdtool", rrd_read_stats);
 
 	DEBUG ("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
-			" heartbeat = %i; rrarows = %i; xff = %lf;",
+			" heartbeat = %i; rrarows = %i; xff = %lf; write threads = %i;",
 			(datadir == NULL) ? "(null)" : datadir,
 			rrdcreate_config.stepsize,
 			rrdcreate_config.heartbeat,
 			rrdcreate_config.rrarows,
-			rrdcreate_config.xff);
+			rrdcreate_config.xff,
+			shards_num);
 
 	return (0);
 } /* int rrd_init */
@@ -1263,4 +1824,5 @@ void module_register (void)
 	plugin_register_write ("rrdtool", rrd_write, /* user_data = */ NULL);
 	plugin_register_flush ("rrdtool", rrd_flush, /* user_data = */ NULL);
 	plugin_register_shutdown ("rrdtool", rrd_shutdown);
+	plugin_register_memory ("rrdtool", rrd_memory);
 }
@@ -31,17 +31,95 @@
 
 #include <atasmart.h>
 #include <libudev.h>
+#include <poll.h>
+#include <pthread.h>
 
 static const char *config_keys[] =
 {
   "Disk",
-  "IgnoreSelected"
+  "IgnoreSelected",
+  "RefreshInterval",
+  "Threads"
 };
 
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *ignorelist = NULL;
 
+/*
+ * Reading the SMART data of a disk takes tens of milliseconds, so the disks
+ * are probed by a small pool of threads. The read callback dispatches the
+ * results of the last probe and queues the disks whose results are older than
+ * `smart_refresh'. The list of disks is maintained with udev events.
+ */
+#define SMART_IDLE    0
+#define SMART_QUEUED  1
+#define SMART_RUNNING 2
+
+typedef struct smart_attribute_s
+{
+  char name[DATA_MAX_NAME_LEN];
+  gauge_t current;
+  gauge_t worst;
+  gauge_t threshold;
+  gauge_t pretty;
+  _Bool below_threshold;
+} smart_attribute_t;
+
+typedef struct smart_result_s
+{
+  _Bool have_poweron;
+  _Bool have_powercycles;
+  _Bool have_badsectors;
+  _Bool have_temperature;
+  gauge_t poweron;
+  gauge_t powercycles;
+  gauge_t badsectors;
+  gauge_t temperature;
+
+  smart_attribute_t *attributes;
+  size_t attributes_num;
+} smart_result_t;
+
+typedef struct smart_disk_s smart_disk_t;
+struct smart_disk_s
+{
+  char *devnode;
+  char name[DATA_MAX_NAME_LEN];
+
+  /* Protected by smart_lock */
+  int state;
+  /* Set when the disk went away while it was queued or probed; the thread
+   * frees the entry. */
+  _Bool removed;
+  /* Set by the enumeration for the disks it found. */
+  _Bool seen;
+  cdtime_t last_probe;
+  smart_result_t *result;
+  /* The result has not been checked for notifications yet. */
+  _Bool fresh;
+  smart_disk_t *next_job;
+
+  smart_disk_t *next;
+};
+
+static cdtime_t smart_refresh = 0;
+static int smart_threads_num = 4;
+
+static pthread_mutex_t smart_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smart_job_cond = PTHREAD_COND_INITIALIZER;
+static smart_disk_t *smart_disks = NULL;
+static smart_disk_t *smart_queue_head = NULL;
+static smart_disk_t *smart_queue_tail = NULL;
+static pthread_t *smart_threads = NULL;
+static int smart_threads_running = 0;
+static _Bool smart_shutdown_flag = 0;
+
+static struct udev *smart_udev = NULL;
+/* NULL if udev events are not available; the disks are then enumerated in
+ * each read. */
+static struct udev_monitor *smart_monitor = NULL;
+
 static int smart_config (const char *key, const char *value)
 {
   if (ignorelist == NULL)
@@ -60,6 +138,26 @@ static int smart_config (const char *key, const char *value)
       invert = 0;
     ignorelist_set_invert (ignorelist, invert);
   }
+  else if (strcasecmp ("RefreshInterval", key) == 0)
+  {
+    double tmp = atof (value);
+    if (tmp <= 0.0)
+    {
+      ERROR ("smart plugin: RefreshInterval must be a positive number.");
+      return (1);
+    }
+    smart_refresh = DOUBLE_TO_CDTIME_T (tmp);
+  }
+  else if (strcasecmp ("Threads", key) == 0)
+  {
+    int tmp = atoi (value);
+    if ((tmp < 1) || (tmp > 64))
+    {
+      ERROR ("smart plugin: Threads must be between 1 and 64.");
+      return (1);
+    }
+    smart_threads_num = tmp;
+  }
   else
   {
     return (-1);
@@ -68,6 +166,25 @@ static int smart_config (const char *key, const char *value)
   return (0);
 } /* int smart_config */
 
+static void smart_result_free (smart_result_t *r) /* {{{ */
+{
+  if (r == NULL)
+    return;
+
+  sfree (r->attributes);
+  sfree (r);
+} /* }}} void smart_result_free */
+
+static void smart_disk_free (smart_disk_t *d) /* {{{ */
+{
+  if (d == NULL)
+    return;
+
+  smart_result_free (d->result);
+  sfree (d->devnode);
+  sfree (d);
+} /* }}} void smart_disk_free */
+
 static void smart_submit (const char *dev, const char *type,
 		const char *type_inst, double value)
 {
@@ -87,18 +204,16 @@ static void smart_submit (const char *dev, const char *type,
 	plugin_dispatch_values (&vl);
 }
 
-static void smart_handle_disk_attribute(SkDisk *d, const SkSmartAttributeParsedData *a,
-                                        void* userdata)
+static void smart_submit_attribute (const char *dev,
+    const smart_attribute_t *a, _Bool notify)
 {
-  const char *dev = userdata;
   value_t values[4];
   value_list_t vl = VALUE_LIST_INIT;
 
-  if (!a->current_value_valid || !a->worst_value_valid) return;
-  values[0].gauge = a->current_value;
-  values[1].gauge = a->worst_value;
-  values[2].gauge = a->threshold_valid?a->threshold:0;
-  values[3].gauge = a->pretty_value;
+  values[0].gauge = a->current;
+  values[1].gauge = a->worst;
+  values[2].gauge = a->threshold;
+  values[3].gauge = a->pretty;
 
   vl.values = values;
   vl.values_len = 4;
@@ -110,7 +225,8 @@ static void smart_handle_disk_attribute(SkDisk *d, const SkSmartAttributeParsedD
 
   plugin_dispatch_values (&vl);
 
-  if (a->threshold_valid && a->current_value <= a->threshold)
+  /* Only notify once per probe, not for each dispatch of a cached result. */
+  if (notify && a->below_threshold)
   {
     notification_t notif = { NOTIF_WARNING,
                              cdtime (),
@@ -124,28 +240,68 @@ static void smart_handle_disk_attribute(SkDisk *d, const SkSmartAttributeParsedD
     sstrncpy (notif.plugin_instance, dev, sizeof (notif.plugin_instance));
     sstrncpy (notif.type_instance, a->name, sizeof (notif.type_instance));
     ssnprintf (notif.message, sizeof (notif.message),
-               "attribute %s is below allowed threshold (%d < %d)",
-               a->name, a->current_value, a->threshold);
+               "attribute %s is below allowed threshold (%.0f < %.0f)",
+               a->name, a->current, a->threshold);
     plugin_dispatch_notification (&notif);
   }
 }
 
-static void smart_handle_disk (const char *dev)
+static void smart_submit_result (const char *dev, /* {{{ */
+    const smart_result_t *r, _Bool notify)
+{
+  size_t i;
+
+  if (r->have_poweron)
+    smart_submit (dev, "smart_poweron", "", r->poweron);
+  if (r->have_powercycles)
+    smart_submit (dev, "smart_powercycles", "", r->powercycles);
+  if (r->have_badsectors)
+    smart_submit (dev, "smart_badsectors", "", r->badsectors);
+  if (r->have_temperature)
+    smart_submit (dev, "smart_temperature", "", r->temperature);
+
+  for (i = 0; i < r->attributes_num; i++)
+    smart_submit_attribute (dev, r->attributes + i, notify);
+} /* }}} void smart_submit_result */
+
+static void smart_handle_disk_attribute(SkDisk *d, const SkSmartAttributeParsedData *a,
+                                        void* userdata)
+{
+  smart_result_t *r = userdata;
+  smart_attribute_t *tmp;
+
+  if (!a->current_value_valid || !a->worst_value_valid) return;
+
+  tmp = realloc (r->attributes,
+      (r->attributes_num + 1) * sizeof (*r->attributes));
+  if (tmp == NULL)
+  {
+    ERROR ("smart plugin: realloc failed.");
+    return;
+  }
+  r->attributes = tmp;
+  tmp = r->attributes + r->attributes_num;
+  r->attributes_num++;
+
+  sstrncpy (tmp->name, a->name, sizeof (tmp->name));
+  tmp->current = a->current_value;
+  tmp->worst = a->worst_value;
+  tmp->threshold = a->threshold_valid?a->threshold:0;
+  tmp->pretty = a->pretty_value;
+  tmp->below_threshold = a->threshold_valid
+    && (a->current_value <= a->threshold);
+}
+
+/* Reads the SMART data of `dev'. Returns NULL if the disk has no SMART data
+ * or is sleeping. Called by the probe threads. */
+static smart_result_t *smart_probe_disk (const char *dev) /* {{{ */
 {
   SkDisk *d = NULL;
   SkBool awake = FALSE;
   SkBool available = FALSE;
-  const char *shortname;
   const SkSmartParsedData *spd;
   uint64_t poweron, powercycles, badsectors, temperature;
-
-  shortname = strrchr(dev, '/');
-  if (!shortname) return;
-  shortname++;
-  if (ignorelist_match (ignorelist, shortname) != 0) {
-    DEBUG ("smart plugin: ignoring %s.", dev);
-    return;
-  }
+  smart_result_t *r = NULL;
 
   DEBUG ("smart plugin: checking SMART status of %s.",
          dev);
@@ -153,7 +309,7 @@ static void smart_handle_disk (const char *dev)
   if (sk_disk_open (dev, &d) < 0)
   {
     ERROR ("smart plugin: unable to open %s.", dev);
-    return;
+    return (NULL);
   }
   if (sk_disk_identify_is_available (d, &available) < 0 || !available)
   {
@@ -181,6 +337,13 @@ static void smart_handle_disk (const char *dev)
     goto end;
   }
 
+  r = calloc (1, sizeof (*r));
+  if (r == NULL)
+  {
+    ERROR ("smart plugin: calloc failed.");
+    goto end;
+  }
+
   /* Get some specific values */
   if (sk_disk_smart_get_power_on (d, &poweron) < 0)
   {
@@ -188,7 +351,10 @@ static void smart_handle_disk (const char *dev)
              dev);
   }
   else
-    smart_submit (shortname, "smart_poweron", "", poweron / 1000.);
+  {
+    r->poweron = poweron / 1000.;
+    r->have_poweron = 1;
+  }
 
   if (sk_disk_smart_get_power_cycle (d, &powercycles) < 0)
   {
@@ -196,7 +362,10 @@ static void smart_handle_disk (const char *dev)
              dev);
   }
   else
-    smart_submit (shortname, "smart_powercycles", "", powercycles);
+  {
+    r->powercycles = powercycles;
+    r->have_powercycles = 1;
+  }
 
   if (sk_disk_smart_get_bad (d, &badsectors) < 0)
   {
@@ -204,7 +373,10 @@ static void smart_handle_disk (const char *dev)
              dev);
   }
   else
-    smart_submit (shortname, "smart_badsectors", "", badsectors);
+  {
+    r->badsectors = badsectors;
+    r->have_badsectors = 1;
+  }
 
   if (sk_disk_smart_get_temperature (d, &temperature) < 0)
   {
@@ -212,11 +384,13 @@ static void smart_handle_disk (const char *dev)
              dev);
   }
   else
-    smart_submit (shortname, "smart_temperature", "", temperature / 1000. - 273.15);
+  {
+    r->temperature = temperature / 1000. - 273.15;
+    r->have_temperature = 1;
+  }
 
   /* Grab all attributes */
-  if (sk_disk_smart_parse_attributes(d, smart_handle_disk_attribute,
-                                     (char *)shortname) < 0)
+  if (sk_disk_smart_parse_attributes(d, smart_handle_disk_attribute, r) < 0)
   {
     ERROR ("smart plugin: unable to handle SMART attributes for %s.",
            dev);
@@ -224,48 +398,394 @@ static void smart_handle_disk (const char *dev)
 
 end:
   sk_disk_free(d);
-}
+  return (r);
+} /* }}} smart_result_t *smart_probe_disk */
 
-static int smart_read (void)
+static void *smart_thread (void *arg) /* {{{ */
+{
+  pthread_mutex_lock (&smart_lock);
+  while (!smart_shutdown_flag)
+  {
+    smart_disk_t *d;
+    smart_result_t *r;
+
+    if (smart_queue_head == NULL)
+    {
+      pthread_cond_wait (&smart_job_cond, &smart_lock);
+      continue;
+    }
+
+    d = smart_queue_head;
+    smart_queue_head = d->next_job;
+    if (smart_queue_head == NULL)
+      smart_queue_tail = NULL;
+    d->next_job = NULL;
+
+    if (d->removed)
+    {
+      smart_disk_free (d);
+      continue;
+    }
+
+    d->state = SMART_RUNNING;
+    pthread_mutex_unlock (&smart_lock);
+
+    r = smart_probe_disk (d->devnode);
+
+    pthread_mutex_lock (&smart_lock);
+    if (d->removed)
+    {
+      smart_result_free (r);
+      smart_disk_free (d);
+      continue;
+    }
+
+    smart_result_free (d->result);
+    d->result = r;
+    d->fresh = 1;
+    d->last_probe = cdtime ();
+    d->state = SMART_IDLE;
+  }
+  pthread_mutex_unlock (&smart_lock);
+
+  return ((void *) 0);
+} /* }}} void *smart_thread */
+
+static int smart_threads_start (void) /* {{{ */
+{
+  int i;
+
+  smart_threads = calloc ((size_t) smart_threads_num, sizeof (*smart_threads));
+  if (smart_threads == NULL)
+  {
+    ERROR ("smart plugin: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < smart_threads_num; i++)
+  {
+    int status = plugin_thread_create (&smart_threads[i], NULL,
+        smart_thread, NULL);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("smart plugin: pthread_create failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+  }
+  smart_threads_running = i;
+
+  if (i == 0)
+  {
+    sfree (smart_threads);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int smart_threads_start */
+
+/* Adds the disk `devnode' unless it is known already or ignored. Must be
+ * called with smart_lock held. */
+static void smart_disk_add (const char *devnode) /* {{{ */
+{
+  const char *shortname;
+  smart_disk_t *d;
+
+  if (devnode == NULL)
+    return;
+
+  for (d = smart_disks; d != NULL; d = d->next)
+  {
+    if (strcmp (d->devnode, devnode) == 0)
+    {
+      d->seen = 1;
+      return;
+    }
+  }
+
+  shortname = strrchr (devnode, '/');
+  if (!shortname) return;
+  shortname++;
+  if (ignorelist_match (ignorelist, shortname) != 0) {
+    DEBUG ("smart plugin: ignoring %s.", devnode);
+    return;
+  }
+
+  d = calloc (1, sizeof (*d));
+  if (d == NULL)
+  {
+    ERROR ("smart plugin: calloc failed.");
+    return;
+  }
+  d->devnode = strdup (devnode);
+  if (d->devnode == NULL)
+  {
+    ERROR ("smart plugin: strdup failed.");
+    sfree (d);
+    return;
+  }
+  sstrncpy (d->name, shortname, sizeof (d->name));
+  d->state = SMART_IDLE;
+  d->seen = 1;
+
+  d->next = smart_disks;
+  smart_disks = d;
+} /* }}} void smart_disk_add */
+
+/* Unlinks `d'; `prev' is the preceding disk or NULL. A disk which is being
+ * probed is freed by its thread. Must be called with smart_lock held. */
+static void smart_disk_remove (smart_disk_t *prev, smart_disk_t *d) /* {{{ */
+{
+  if (prev == NULL)
+    smart_disks = d->next;
+  else
+    prev->next = d->next;
+  d->next = NULL;
+
+  if (d->state == SMART_IDLE)
+    smart_disk_free (d);
+  else
+    d->removed = 1;
+} /* }}} void smart_disk_remove */
+
+static void smart_disk_remove_by_devnode (const char *devnode) /* {{{ */
+{
+  smart_disk_t *prev = NULL;
+  smart_disk_t *d;
+
+  if (devnode == NULL)
+    return;
+
+  for (d = smart_disks; d != NULL; prev = d, d = d->next)
+  {
+    if (strcmp (d->devnode, devnode) == 0)
+    {
+      smart_disk_remove (prev, d);
+      return;
+    }
+  }
+} /* }}} void smart_disk_remove_by_devnode */
+
+/* Uses udev to get the list of disks. Disks that are gone are removed.
+ * Must be called with smart_lock held. */
+static int smart_scan (void) /* {{{ */
 {
-  struct udev *handle_udev;
   struct udev_enumerate *enumerate;
   struct udev_list_entry *devices, *dev_list_entry;
-  struct udev_device *dev;
+  smart_disk_t *prev = NULL;
+  smart_disk_t *d;
+
+  for (d = smart_disks; d != NULL; d = d->next)
+    d->seen = 0;
 
-  /* Use udev to get a list of disks */
-  handle_udev = udev_new();
-  if (!handle_udev)
+  enumerate = udev_enumerate_new (smart_udev);
+  if (enumerate == NULL)
   {
-    ERROR ("smart plugin: unable to initialize udev.");
+    ERROR ("smart plugin: udev_enumerate_new failed.");
     return (-1);
   }
-  enumerate = udev_enumerate_new (handle_udev);
   udev_enumerate_add_match_subsystem (enumerate, "block");
   udev_enumerate_add_match_property (enumerate, "DEVTYPE", "disk");
   udev_enumerate_scan_devices (enumerate);
   devices = udev_enumerate_get_list_entry (enumerate);
   udev_list_entry_foreach (dev_list_entry, devices)
   {
-    const char *path, *devpath;
+    const char *path;
+    struct udev_device *dev;
+
     path = udev_list_entry_get_name (dev_list_entry);
-    dev = udev_device_new_from_syspath (handle_udev, path);
-    devpath = udev_device_get_devnode (dev);
+    dev = udev_device_new_from_syspath (smart_udev, path);
+    if (dev == NULL)
+      continue;
 
-    /* Query status with libatasmart */
-    smart_handle_disk (devpath);
+    smart_disk_add (udev_device_get_devnode (dev));
     udev_device_unref (dev);
   }
-
   udev_enumerate_unref (enumerate);
-  udev_unref (handle_udev);
+
+  d = smart_disks;
+  while (d != NULL)
+  {
+    smart_disk_t *next = d->next;
+
+    if (!d->seen)
+      smart_disk_remove (prev, d);
+    else
+      prev = d;
+    d = next;
+  }
+
+  return (0);
+} /* }}} int smart_scan */
+
+/* Applies the pending hotplug events to the list of disks. Must be called
+ * with smart_lock held. */
+static void smart_handle_events (void) /* {{{ */
+{
+  struct pollfd pfd = {
+    .fd = udev_monitor_get_fd (smart_monitor),
+    .events = POLLIN
+  };
+
+  while (poll (&pfd, 1, /* timeout = */ 0) > 0)
+  {
+    struct udev_device *dev;
+    const char *action;
+
+    dev = udev_monitor_receive_device (smart_monitor);
+    if (dev == NULL)
+      break;
+
+    action = udev_device_get_action (dev);
+    if (action == NULL)
+      ;
+    else if (strcmp ("add", action) == 0)
+      smart_disk_add (udev_device_get_devnode (dev));
+    else if (strcmp ("remove", action) == 0)
+      smart_disk_remove_by_devnode (udev_device_get_devnode (dev));
+
+    udev_device_unref (dev);
+  }
+} /* }}} void smart_handle_events */
+
+static int smart_init (void) /* {{{ */
+{
+  int status;
+
+  smart_udev = udev_new ();
+  if (smart_udev == NULL)
+  {
+    ERROR ("smart plugin: unable to initialize udev.");
+    return (-1);
+  }
+
+  /* Listen before enumerating, so that no disk is missed. */
+  smart_monitor = udev_monitor_new_from_netlink (smart_udev, "udev");
+  if ((smart_monitor != NULL)
+      && ((udev_monitor_filter_add_match_subsystem_devtype (smart_monitor,
+            "block", "disk") < 0)
+        || (udev_monitor_enable_receiving (smart_monitor) < 0)))
+  {
+    udev_monitor_unref (smart_monitor);
+    smart_monitor = NULL;
+  }
+  if (smart_monitor == NULL)
+    WARNING ("smart plugin: unable to receive udev events. "
+        "The disks will be enumerated in each read.");
+
+  pthread_mutex_lock (&smart_lock);
+  status = smart_scan ();
+  pthread_mutex_unlock (&smart_lock);
+
+  return (status);
+} /* }}} int smart_init */
+
+static int smart_read (void)
+{
+  cdtime_t refresh = (smart_refresh != 0) ? smart_refresh : plugin_get_interval ();
+  cdtime_t now = cdtime ();
+  smart_disk_t *d;
+
+  if (smart_udev == NULL)
+    return (-1);
+
+  if (smart_threads == NULL)
+  {
+    if (smart_threads_start () != 0)
+      return (-1);
+  }
+
+  pthread_mutex_lock (&smart_lock);
+
+  if (smart_monitor != NULL)
+    smart_handle_events ();
+  else
+    smart_scan ();
+
+  for (d = smart_disks; d != NULL; d = d->next)
+  {
+    if ((d->state != SMART_IDLE)
+        || ((d->last_probe != 0) && ((now - d->last_probe) < refresh)))
+      continue;
+
+    d->state = SMART_QUEUED;
+    if (smart_queue_tail == NULL)
+      smart_queue_head = d;
+    else
+      smart_queue_tail->next_job = d;
+    smart_queue_tail = d;
+  }
+  pthread_cond_broadcast (&smart_job_cond);
+
+  /* Dispatch the results of the last probe. Dispatching only queues the
+   * values, so holding the lock keeps the threads waiting only briefly. */
+  for (d = smart_disks; d != NULL; d = d->next)
+  {
+    if (d->result == NULL)
+      continue;
+
+    smart_submit_result (d->name, d->result, d->fresh);
+    d->fresh = 0;
+  }
+
+  pthread_mutex_unlock (&smart_lock);
 
   return (0);
 } /* int smart_read */
 
+static int smart_shutdown (void) /* {{{ */
+{
+  smart_disk_t *d;
+  int i;
+
+  pthread_mutex_lock (&smart_lock);
+  smart_shutdown_flag = 1;
+  pthread_cond_broadcast (&smart_job_cond);
+  pthread_mutex_unlock (&smart_lock);
+
+  for (i = 0; i < smart_threads_running; i++)
+    pthread_join (smart_threads[i], NULL);
+  smart_threads_running = 0;
+  sfree (smart_threads);
+
+  /* All threads are gone: free the queued disks which have been removed,
+   * then the list. */
+  d = smart_queue_head;
+  while (d != NULL)
+  {
+    smart_disk_t *next = d->next_job;
+
+    if (d->removed)
+      smart_disk_free (d);
+    d = next;
+  }
+  smart_queue_head = smart_queue_tail = NULL;
+
+  d = smart_disks;
+  while (d != NULL)
+  {
+    smart_disk_t *next = d->next;
+    smart_disk_free (d);
+    d = next;
+  }
+  smart_disks = NULL;
+
+  if (smart_monitor != NULL)
+    udev_monitor_unref (smart_monitor);
+  smart_monitor = NULL;
+  if (smart_udev != NULL)
+    udev_unref (smart_udev);
+  smart_udev = NULL;
+
+  return (0);
+} /* }}} int smart_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("smart", smart_config,
                           config_keys, config_keys_num);
+  plugin_register_init ("smart", smart_init);
   plugin_register_read ("smart", smart_read);
+  plugin_register_shutdown ("smart", smart_shutdown);
 } /* void module_register */
@@ -91,31 +91,62 @@ struct host_definition_s
   int security_level;
   char *context;
 
+  /* max-repetitions of GETBULK requests when walking tables. Zero uses
+   * GETNEXT, which is also the only choice with SNMPv1. */
+  int bulk_size;
+  _Bool measure_poll_time;
+
   void *sess_handle;
   c_complain_t complaint;
   cdtime_t interval;
   data_definition_t **data_list;
   int data_list_len;
+  /* The rows of each table in `data_list', kept across reads. Allocated by
+   * the first read. */
+  struct csnmp_table_s **tables;
 };
 typedef struct host_definition_s host_definition_t;
 
-/* These two types are used to cache values in `csnmp_read_table' to handle
- * gaps in tables. */
-struct csnmp_list_instances_s
+/* One row of a table, i.e. the values and the instance sharing an OID
+ * suffix. Rows are kept across reads, so that the instance name and whether
+ * it is ignored are only computed again when the agent returns a different
+ * instance value for the suffix, e.g. after the ifIndex mapping changed. */
+struct csnmp_table_row_s
 {
   oid_t suffix;
+  uint32_t hash;
+
+  /* The instance value as returned by the agent, if it fits, and the name and
+   * ignore verdict derived from it. */
+  u_char instance_type;
+  size_t instance_raw_len;
+  u_char instance_raw[DATA_MAX_NAME_LEN];
+  _Bool instance_cached;
+  _Bool ignored;
   char instance[DATA_MAX_NAME_LEN];
-  struct csnmp_list_instances_s *next;
+
+  /* Set during the current read. */
+  _Bool have_instance;
+  size_t values_num;
+  _Bool *have_value;
+  value_t *values;
+
+  struct csnmp_table_row_s *hash_next;
+  struct csnmp_table_row_s *next;
 };
-typedef struct csnmp_list_instances_s csnmp_list_instances_t;
+typedef struct csnmp_table_row_s csnmp_table_row_t;
 
-struct csnmp_table_values_s
+/* Rows of a table by OID suffix. The rows are also linked in the order they
+ * were first seen, which is the order they are dispatched in. */
+struct csnmp_table_s
 {
-  oid_t suffix;
-  value_t value;
-  struct csnmp_table_values_s *next;
+  csnmp_table_row_t **buckets;
+  size_t buckets_num;
+  size_t rows_num;
+  csnmp_table_row_t *head;
+  csnmp_table_row_t *tail;
 };
-typedef struct csnmp_table_values_s csnmp_table_values_t;
+typedef struct csnmp_table_s csnmp_table_t;
 
 /*
  * Private variables
@@ -178,6 +209,183 @@ static int csnmp_oid_to_string (char *buffer, size_t buffer_size,
         oid_str_ptr, o->oid_len, /* separator = */ "."));
 }
 
+static uint32_t csnmp_oid_hash (oid_t const *o)
+{
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < o->oid_len; i++)
+  {
+    hash ^= (uint32_t) o->oid[i];
+    hash *= 16777619U;
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+
+  return (hash);
+}
+
+static void csnmp_table_row_free (csnmp_table_row_t *row) /* {{{ */
+{
+  if (row == NULL)
+    return;
+
+  sfree (row->have_value);
+  sfree (row->values);
+  sfree (row);
+} /* }}} void csnmp_table_row_free */
+
+static void csnmp_table_destroy (csnmp_table_t *t) /* {{{ */
+{
+  csnmp_table_row_t *row;
+
+  if (t == NULL)
+    return;
+
+  row = t->head;
+  while (row != NULL)
+  {
+    csnmp_table_row_t *next = row->next;
+    csnmp_table_row_free (row);
+    row = next;
+  }
+
+  sfree (t->buckets);
+  sfree (t);
+} /* }}} void csnmp_table_destroy */
+
+static csnmp_table_row_t *csnmp_table_lookup (csnmp_table_t *t, /* {{{ */
+    oid_t const *suffix, uint32_t hash)
+{
+  csnmp_table_row_t *row;
+
+  if (t->buckets_num == 0)
+    return (NULL);
+
+  for (row = t->buckets[hash & (t->buckets_num - 1)];
+      row != NULL;
+      row = row->hash_next)
+    if ((row->hash == hash) && (csnmp_oid_compare (&row->suffix, suffix) == 0))
+      return (row);
+
+  return (NULL);
+} /* }}} csnmp_table_row_t *csnmp_table_lookup */
+
+/* Doubles the number of buckets once there are more rows than buckets. */
+static int csnmp_table_grow (csnmp_table_t *t) /* {{{ */
+{
+  csnmp_table_row_t **buckets;
+  csnmp_table_row_t *row;
+  size_t buckets_num;
+
+  buckets_num = (t->buckets_num == 0) ? 64 : 2 * t->buckets_num;
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+    return (ENOMEM);
+
+  for (row = t->head; row != NULL; row = row->next)
+  {
+    size_t b = row->hash & (buckets_num - 1);
+    row->hash_next = buckets[b];
+    buckets[b] = row;
+  }
+
+  sfree (t->buckets);
+  t->buckets = buckets;
+  t->buckets_num = buckets_num;
+  return (0);
+} /* }}} int csnmp_table_grow */
+
+/* Returns the row with `suffix', adding it if necessary. */
+static csnmp_table_row_t *csnmp_table_get (csnmp_table_t *t, /* {{{ */
+    oid_t const *suffix, size_t values_num)
+{
+  csnmp_table_row_t *row;
+  uint32_t hash;
+  size_t b;
+
+  hash = csnmp_oid_hash (suffix);
+  row = csnmp_table_lookup (t, suffix, hash);
+  if (row != NULL)
+    return (row);
+
+  if ((t->rows_num >= t->buckets_num) && (csnmp_table_grow (t) != 0))
+    return (NULL);
+
+  row = calloc (1, sizeof (*row));
+  if (row == NULL)
+    return (NULL);
+
+  row->have_value = calloc (values_num, sizeof (*row->have_value));
+  row->values = calloc (values_num, sizeof (*row->values));
+  if ((row->have_value == NULL) || (row->values == NULL))
+  {
+    csnmp_table_row_free (row);
+    return (NULL);
+  }
+
+  memcpy (&row->suffix, suffix, sizeof (row->suffix));
+  row->hash = hash;
+
+  b = hash & (t->buckets_num - 1);
+  row->hash_next = t->buckets[b];
+  t->buckets[b] = row;
+
+  if (t->tail == NULL)
+    t->head = row;
+  else
+    t->tail->next = row;
+  t->tail = row;
+  t->rows_num++;
+
+  return (row);
+} /* }}} csnmp_table_row_t *csnmp_table_get */
+
+/* Forgets the values of the last read. */
+static void csnmp_table_reset (csnmp_table_t *t, size_t values_len) /* {{{ */
+{
+  csnmp_table_row_t *row;
+
+  for (row = t->head; row != NULL; row = row->next)
+  {
+    row->have_instance = 0;
+    row->values_num = 0;
+    memset (row->have_value, 0, values_len * sizeof (*row->have_value));
+  }
+} /* }}} void csnmp_table_reset */
+
+/* Removes the rows the agent didn't return during the last read. */
+static void csnmp_table_prune (csnmp_table_t *t) /* {{{ */
+{
+  csnmp_table_row_t **ptr;
+
+  ptr = &t->head;
+  t->tail = NULL;
+  while (*ptr != NULL)
+  {
+    csnmp_table_row_t *row = *ptr;
+    csnmp_table_row_t **bucket_ptr;
+
+    if (row->have_instance || (row->values_num > 0))
+    {
+      t->tail = row;
+      ptr = &row->next;
+      continue;
+    }
+
+    bucket_ptr = &t->buckets[row->hash & (t->buckets_num - 1)];
+    while (*bucket_ptr != row)
+      bucket_ptr = &(*bucket_ptr)->hash_next;
+    *bucket_ptr = row->hash_next;
+
+    *ptr = row->next;
+    t->rows_num--;
+    csnmp_table_row_free (row);
+  }
+} /* }}} void csnmp_table_prune */
+
 static void csnmp_host_close_session (host_definition_t *host) /* {{{ */
 {
   if (host->sess_handle == NULL)
@@ -204,6 +412,15 @@ static void csnmp_host_definition_destroy (void *arg) /* {{{ */
 
   csnmp_host_close_session (hd);
 
+  if (hd->tables != NULL)
+  {
+    int i;
+
+    for (i = 0; i < hd->data_list_len; i++)
+      csnmp_table_destroy (hd->tables[i]);
+    sfree (hd->tables);
+  }
+
   sfree (hd->name);
   sfree (hd->address);
   sfree (hd->community);
@@ -690,6 +907,10 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
       status = csnmp_config_add_host_security_level (hd, option);
     else if (strcasecmp ("Context", option->key) == 0)
       status = cf_util_get_string(option, &hd->context);
+    else if (strcasecmp ("BulkSize", option->key) == 0)
+      status = cf_util_get_int (option, &hd->bulk_size);
+    else if (strcasecmp ("MeasurePollTime", option->key) == 0)
+      status = cf_util_get_boolean (option, &hd->measure_poll_time);
     else
     {
       WARNING ("snmp plugin: csnmp_config_add_host: Option `%s' not allowed here.", option->key);
@@ -702,6 +923,19 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
 
   while (status == 0)
   {
+    if (hd->bulk_size < 0)
+    {
+      WARNING ("snmp plugin: `BulkSize' must not be negative for host `%s'",
+          hd->name);
+      status = -1;
+      break;
+    }
+    if ((hd->bulk_size > 0) && (hd->version == 1))
+    {
+      WARNING ("snmp plugin: host %s: SNMPv1 doesn't support bulk "
+          "transfers, ignoring `BulkSize'.", hd->name);
+      hd->bulk_size = 0;
+    }
     if (hd->address == NULL)
     {
       WARNING ("snmp plugin: `Address' not given for host `%s'", hd->name);
@@ -1138,261 +1372,161 @@ static int csnmp_strvbcopy (char *dst, /* {{{ */
   return 0;
 } /* }}} int csnmp_strvbcopy */
 
-static int csnmp_instance_list_add (csnmp_list_instances_t **head,
-    csnmp_list_instances_t **tail,
-    const struct snmp_pdu *res,
+/* Sets the instance of `row' from `vb'. The name and whether it is ignored
+ * are only computed if the agent returned a different value than during the
+ * last read. */
+static void csnmp_instance_set (csnmp_table_row_t *row,
+    const struct variable_list *vb,
     const host_definition_t *hd, const data_definition_t *dd)
 {
-  csnmp_list_instances_t *il;
-  struct variable_list *vb;
-  oid_t vb_name;
   int status;
   uint32_t i;
   uint32_t is_matched;
 
-  /* Set vb on the last variable */
-  for (vb = res->variables;
-      (vb != NULL) && (vb->next_variable != NULL);
-      vb = vb->next_variable)
-    /* do nothing */;
-  if (vb == NULL)
-    return (-1);
-
-  csnmp_oid_init (&vb_name, vb->name, vb->name_length);
+  row->have_instance = 1;
 
-  il = calloc (1, sizeof (*il));
-  if (il == NULL)
-  {
-    ERROR ("snmp plugin: calloc failed.");
-    return (-1);
-  }
-  il->next = NULL;
+  if (row->instance_cached
+      && (row->instance_type == vb->type)
+      && (row->instance_raw_len == vb->val_len)
+      && ((vb->val_len == 0)
+        || (memcmp (row->instance_raw, vb->val.string, vb->val_len) == 0)))
+    return;
 
-  status = csnmp_oid_suffix (&il->suffix, &vb_name, &dd->instance.oid);
-  if (status != 0)
-  {
-    sfree (il);
-    return (status);
-  }
+  row->ignored = 0;
 
   /* Get instance name */
   if ((vb->type == ASN_OCTET_STR) || (vb->type == ASN_BIT_STR) || (vb->type == ASN_IPADDRESS))
   {
     char *ptr;
 
-    csnmp_strvbcopy (il->instance, vb, sizeof (il->instance));
+    csnmp_strvbcopy (row->instance, vb, sizeof (row->instance));
     is_matched = 0;
     for (i = 0; i < dd->ignores_len; i++)
     {
-      status = fnmatch(dd->ignores[i], il->instance, 0);
+      status = fnmatch(dd->ignores[i], row->instance, 0);
       if (status == 0)
       {
-        if (dd->invert_match == 0)
-        {
-          sfree(il);
-          return 0;
-        }
-	else
-	{
-          is_matched = 1;
-	  break;
-	}
+        is_matched = 1;
+        break;
       }
     }
-    if (dd->invert_match != 0 && is_matched == 0)
-    {
-      sfree(il);
-      return 0;
-    }
-    for (ptr = il->instance; *ptr != '\0'; ptr++)
+    if (dd->invert_match == 0)
+      row->ignored = is_matched;
+    else
+      row->ignored = !is_matched;
+
+    for (ptr = row->instance; *ptr != '\0'; ptr++)
     {
       if ((*ptr > 0) && (*ptr < 32))
         *ptr = ' ';
       else if (*ptr == '/')
         *ptr = '_';
     }
-    DEBUG ("snmp plugin: il->instance = `%s';", il->instance);
+    DEBUG ("snmp plugin: row->instance = `%s';", row->instance);
   }
   else
   {
     value_t val = csnmp_value_list_to_value (vb, DS_TYPE_COUNTER,
         /* scale = */ 1.0, /* shift = */ 0.0, hd->name, dd->name);
-    ssnprintf (il->instance, sizeof (il->instance),
+    ssnprintf (row->instance, sizeof (row->instance),
         "%llu", val.counter);
   }
 
-  /* TODO: Debugging output */
-
-  if (*head == NULL)
-    *head = il;
-  else
-    (*tail)->next = il;
-  *tail = il;
+  /* Values too long to be kept are handled again during each read. */
+  row->instance_cached = (vb->val_len <= sizeof (row->instance_raw));
+  if (row->instance_cached)
+  {
+    row->instance_type = vb->type;
+    row->instance_raw_len = vb->val_len;
+    if (vb->val_len > 0)
+      memcpy (row->instance_raw, vb->val.string, vb->val_len);
+  }
+} /* void csnmp_instance_set */
 
-  return (0);
-} /* int csnmp_instance_list_add */
+/* Number of value lists passed to plugin_dispatch_values_bulk at once. */
+#define CSNMP_DISPATCH_CHUNK 256
 
 static int csnmp_dispatch_table (host_definition_t *host, data_definition_t *data,
-    csnmp_list_instances_t *instance_list,
-    csnmp_table_values_t **value_table)
+    const data_set_t *ds, csnmp_table_t *table)
 {
-  const data_set_t *ds;
-  value_list_t vl = VALUE_LIST_INIT;
-
-  csnmp_list_instances_t *instance_list_ptr;
-  csnmp_table_values_t **value_table_ptr;
+  value_list_t *vl;
+  value_t *values;
+  size_t vl_num;
 
+  csnmp_table_row_t *row;
   size_t i;
-  _Bool have_more;
-  oid_t current_suffix;
 
-  ds = plugin_get_ds (data->type);
-  if (!ds)
-  {
-    ERROR ("snmp plugin: DataSet `%s' not defined.", data->type);
-    return (-1);
-  }
   assert (ds->ds_num == data->values_len);
   assert (data->values_len > 0);
 
-  instance_list_ptr = instance_list;
-
-  value_table_ptr = calloc (data->values_len, sizeof (*value_table_ptr));
-  if (value_table_ptr == NULL)
-    return (-1);
-  for (i = 0; i < data->values_len; i++)
-    value_table_ptr[i] = value_table[i];
-
-  vl.values_len = data->values_len;
-  vl.values = malloc (sizeof (*vl.values) * vl.values_len);
-  if (vl.values == NULL)
+  vl = calloc (CSNMP_DISPATCH_CHUNK, sizeof (*vl));
+  values = calloc (CSNMP_DISPATCH_CHUNK * data->values_len, sizeof (*values));
+  if ((vl == NULL) || (values == NULL))
   {
-    ERROR ("snmp plugin: malloc failed.");
-    sfree (value_table_ptr);
+    ERROR ("snmp plugin: calloc failed.");
+    sfree (vl);
+    sfree (values);
     return (-1);
   }
 
-  sstrncpy (vl.host, host->name, sizeof (vl.host));
-  sstrncpy (vl.plugin, "snmp", sizeof (vl.plugin));
-
-  vl.interval = host->interval;
+  for (i = 0; i < CSNMP_DISPATCH_CHUNK; i++)
+  {
+    vl[i].values = values + (i * data->values_len);
+    vl[i].values_len = data->values_len;
+    vl[i].interval = host->interval;
+    sstrncpy (vl[i].host, host->name, sizeof (vl[i].host));
+    sstrncpy (vl[i].plugin, "snmp", sizeof (vl[i].plugin));
+    sstrncpy (vl[i].type, data->type, sizeof (vl[i].type));
+  }
 
-  have_more = 1;
-  memset (&current_suffix, 0, sizeof (current_suffix));
-  while (have_more)
+  /* Join the columns: only rows with all values and, if configured, an
+   * instance that is not ignored are dispatched. */
+  vl_num = 0;
+  for (row = table->head; row != NULL; row = row->next)
   {
-    _Bool suffix_skipped = 0;
+    char temp[DATA_MAX_NAME_LEN];
+    value_list_t *v;
 
-    /* Determine next suffix to handle. */
-    if (instance_list != NULL)
-    {
-      if (instance_list_ptr == NULL)
-      {
-        have_more = 0;
-        continue;
-      }
+    if (row->values_num != data->values_len)
+      continue;
 
-      memcpy (&current_suffix, &instance_list_ptr->suffix, sizeof (current_suffix));
-    }
-    else /* no instance configured */
+    if (data->instance.oid.oid_len > 0)
     {
-      csnmp_table_values_t *ptr = value_table_ptr[0];
-      if (ptr == NULL)
-      {
-        have_more = 0;
+      if (!row->have_instance || row->ignored)
         continue;
-      }
-
-      memcpy (&current_suffix, &ptr->suffix, sizeof (current_suffix));
-    }
-
-    /* Update all the value_table_ptr to point at the entry with the same
-     * trailing partial OID */
-    for (i = 0; i < data->values_len; i++)
-    {
-      while ((value_table_ptr[i] != NULL)
-          && (csnmp_oid_compare (&value_table_ptr[i]->suffix, &current_suffix) < 0))
-        value_table_ptr[i] = value_table_ptr[i]->next;
-
-      if (value_table_ptr[i] == NULL)
-      {
-        have_more = 0;
-        break;
-      }
-      else if (csnmp_oid_compare (&value_table_ptr[i]->suffix, &current_suffix) > 0)
-      {
-        /* This suffix is missing in the subtree. Indicate this with the
-         * "suffix_skipped" flag and try the next instance / suffix. */
-        suffix_skipped = 1;
-        break;
-      }
-    } /* for (i = 0; i < columns; i++) */
-
-    if (!have_more)
-      break;
-
-    /* Matching the values failed. Start from the beginning again. */
-    if (suffix_skipped)
-    {
-      if (instance_list != NULL)
-        instance_list_ptr = instance_list_ptr->next;
-      else
-        value_table_ptr[0] = value_table_ptr[0]->next;
-
-      continue;
+      sstrncpy (temp, row->instance, sizeof (temp));
     }
+    else
+      csnmp_oid_to_string (temp, sizeof (temp), &row->suffix);
 
-    /* if we reach this line, all value_table_ptr[i] are non-NULL and are set
-     * to the same subid. instance_list_ptr is either NULL or points to the
-     * same subid, too. */
-#if COLLECT_DEBUG
-    for (i = 1; i < data->values_len; i++)
-    {
-      assert (value_table_ptr[i] != NULL);
-      assert (csnmp_oid_compare (&value_table_ptr[i-1]->suffix,
-            &value_table_ptr[i]->suffix) == 0);
-    }
-    assert ((instance_list_ptr == NULL)
-        || (csnmp_oid_compare (&instance_list_ptr->suffix,
-            &value_table_ptr[0]->suffix) == 0));
-#endif
+    v = vl + vl_num;
+    if (data->instance_prefix == NULL)
+      sstrncpy (v->type_instance, temp, sizeof (v->type_instance));
+    else
+      ssnprintf (v->type_instance, sizeof (v->type_instance), "%s%s",
+          data->instance_prefix, temp);
 
-    sstrncpy (vl.type, data->type, sizeof (vl.type));
+    memcpy (v->values, row->values, data->values_len * sizeof (*v->values));
+    vl_num++;
 
+    if (vl_num == CSNMP_DISPATCH_CHUNK)
     {
-      char temp[DATA_MAX_NAME_LEN];
-
-      if (instance_list_ptr == NULL)
-        csnmp_oid_to_string (temp, sizeof (temp), &current_suffix);
-      else
-        sstrncpy (temp, instance_list_ptr->instance, sizeof (temp));
-
-      if (data->instance_prefix == NULL)
-        sstrncpy (vl.type_instance, temp, sizeof (vl.type_instance));
-      else
-        ssnprintf (vl.type_instance, sizeof (vl.type_instance), "%s%s",
-            data->instance_prefix, temp);
+      plugin_dispatch_values_bulk (ds, vl, vl_num);
+      vl_num = 0;
     }
+  }
 
-    for (i = 0; i < data->values_len; i++)
-      vl.values[i] = value_table_ptr[i]->value;
-
-    /* If we get here `vl.type_instance' and all `vl.values' have been set */
-    plugin_dispatch_values (&vl);
-
-    if (instance_list != NULL)
-      instance_list_ptr = instance_list_ptr->next;
-    else
-      value_table_ptr[0] = value_table_ptr[0]->next;
-  } /* while (have_more) */
+  if (vl_num > 0)
+    plugin_dispatch_values_bulk (ds, vl, vl_num);
 
-  sfree (vl.values);
-  sfree (value_table_ptr);
+  sfree (vl);
+  sfree (values);
 
   return (0);
 } /* int csnmp_dispatch_table */
 
-static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
+static int csnmp_read_table (host_definition_t *host, data_definition_t *data,
+    csnmp_table_t *table)
 {
   struct snmp_pdu *req;
   struct snmp_pdu *res = NULL;
@@ -1407,18 +1541,18 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
   /* Set to false when an OID has left its subtree so we don't re-request it
    * again. */
   _Bool oid_list_todo[oid_list_len];
+  /* Maps the variables of a request to their index in `oid_list'. */
+  size_t oid_list_req[oid_list_len];
+  _Bool use_bulk = ((host->version > 1) && (host->bulk_size > 0));
+
+  /* The suffix of the last value of each column, to make sure they are
+   * increasing. */
+  oid_t *last_suffix;
+  _Bool *have_last_suffix;
 
   int status;
   size_t i;
 
-  /* `value_list_head' and `value_list_tail' implement a linked list for each
-   * value. `instance_list_head' and `instance_list_tail' implement a linked list of
-   * instance names. This is used to jump gaps in the table. */
-  csnmp_list_instances_t *instance_list_head;
-  csnmp_list_instances_t *instance_list_tail;
-  csnmp_table_values_t **value_list_head;
-  csnmp_table_values_t **value_list_tail;
-
   DEBUG ("snmp plugin: csnmp_read_table (host = %s, data = %s)",
       host->name, data->name);
 
@@ -1453,28 +1587,27 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
   for (i = 0; i < oid_list_len; i++)
     oid_list_todo[i] = 1;
 
-  /* We're going to construct n linked lists, one for each "value".
-   * value_list_head will contain pointers to the heads of these linked lists,
-   * value_list_tail will contain pointers to the tail of the lists. */
-  value_list_head = calloc (data->values_len, sizeof (*value_list_head));
-  value_list_tail = calloc (data->values_len, sizeof (*value_list_tail));
-  if ((value_list_head == NULL) || (value_list_tail == NULL))
+  last_suffix = calloc (data->values_len, sizeof (*last_suffix));
+  have_last_suffix = calloc (data->values_len, sizeof (*have_last_suffix));
+  if ((last_suffix == NULL) || (have_last_suffix == NULL))
   {
     ERROR ("snmp plugin: csnmp_read_table: calloc failed.");
-    sfree (value_list_head);
-    sfree (value_list_tail);
+    sfree (last_suffix);
+    sfree (have_last_suffix);
     return (-1);
   }
 
-  instance_list_head = NULL;
-  instance_list_tail = NULL;
+  /* The rows are looked up by suffix as the variables arrive, so the columns
+   * don't need to be aligned afterwards. */
+  csnmp_table_reset (table, data->values_len);
 
   status = 0;
   while (status == 0)
   {
-    int oid_list_todo_num;
+    size_t oid_list_todo_num;
+    size_t vb_num;
 
-    req = snmp_pdu_create (SNMP_MSG_GETNEXT);
+    req = snmp_pdu_create (use_bulk ? SNMP_MSG_GETBULK : SNMP_MSG_GETNEXT);
     if (req == NULL)
     {
       ERROR ("snmp plugin: snmp_pdu_create failed.");
@@ -1482,12 +1615,19 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
       break;
     }
 
+    if (use_bulk)
+    {
+      req->non_repeaters = 0;
+      req->max_repetitions = host->bulk_size;
+    }
+
     oid_list_todo_num = 0;
     for (i = 0; i < oid_list_len; i++)
     {
       /* Do not rerequest already finished OIDs */
       if (!oid_list_todo[i])
         continue;
+      oid_list_req[oid_list_todo_num] = i;
       oid_list_todo_num++;
       snmp_add_null_var (req, oid_list[i].oid, oid_list[i].oid_len);
     }
@@ -1525,6 +1665,9 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
       break;
     }
 
+    /* snmp_sess_synch_response freed our PDU */
+    req = NULL;
+
     status = 0;
     assert (res != NULL);
     c_release (LOG_INFO, &host->complaint,
@@ -1538,21 +1681,30 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
       break;
     }
 
-    for (vb = res->variables, i = 0; (vb != NULL); vb = vb->next_variable, i++)
+    /* A GETBULK response repeats the requested variables up to
+     * `bulk_size' times, in the order of the request. Columns which left
+     * their subtree in an earlier repetition are skipped. */
+    for (vb = res->variables, vb_num = 0;
+        (vb != NULL);
+        vb = vb->next_variable, vb_num++)
     {
-      /* Calculate value index from todo list */
-      while ((i < oid_list_len) && !oid_list_todo[i])
-        i++;
+      csnmp_table_row_t *row;
+      oid_t vb_name;
+      oid_t suffix;
+
+      i = oid_list_req[vb_num % oid_list_todo_num];
+      if (!oid_list_todo[i])
+        continue;
+
+      csnmp_oid_init (&vb_name, vb->name, vb->name_length);
 
       /* An instance is configured and the res variable we process is the
        * instance value (last index) */
       if ((data->instance.oid.oid_len > 0) && (i == data->values_len))
       {
         if ((vb->type == SNMP_ENDOFMIBVIEW)
-            || (snmp_oid_ncompare (data->instance.oid.oid,
-                data->instance.oid.oid_len,
-                vb->name, vb->name_length,
-                data->instance.oid.oid_len) != 0))
+            || (csnmp_oid_suffix (&suffix, &vb_name,
+                &data->instance.oid) != 0))
         {
           DEBUG ("snmp plugin: host = %s; data = %s; Instance left its subtree.",
               host->name, data->name);
@@ -1560,30 +1712,22 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
           continue;
         }
 
-        /* Allocate a new `csnmp_list_instances_t', insert the instance name and
-         * add it to the list */
-        if (csnmp_instance_list_add (&instance_list_head, &instance_list_tail,
-              res, host, data) != 0)
+        row = csnmp_table_get (table, &suffix, data->values_len);
+        if (row == NULL)
         {
-          ERROR ("snmp plugin: host %s: csnmp_instance_list_add failed.",
+          ERROR ("snmp plugin: host %s: csnmp_table_get failed.",
               host->name);
           status = -1;
           break;
         }
+
+        csnmp_instance_set (row, vb, host, data);
       }
       else /* The variable we are processing is a normal value */
       {
-        csnmp_table_values_t *vt;
-        oid_t vb_name;
-        oid_t suffix;
-        int ret;
-
-        csnmp_oid_init (&vb_name, vb->name, vb->name_length);
-
         /* Calculate the current suffix. This is later used to check that the
          * suffix is increasing. This also checks if we left the subtree */
-        ret = csnmp_oid_suffix (&suffix, &vb_name, data->values + i);
-        if (ret != 0)
+        if (csnmp_oid_suffix (&suffix, &vb_name, data->values + i) != 0)
         {
           DEBUG ("snmp plugin: host = %s; data = %s; i = %zu; "
               "Value probably left its subtree.",
@@ -1592,10 +1736,10 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
           continue;
         }
 
-        /* Make sure the OIDs returned by the agent are increasing. Otherwise our
-         * table matching algorithm will get confused. */
-        if ((value_list_tail[i] != NULL)
-            && (csnmp_oid_compare (&suffix, &value_list_tail[i]->suffix) <= 0))
+        /* Make sure the OIDs returned by the agent are increasing. Otherwise
+         * we might walk in circles. */
+        if (have_last_suffix[i]
+            && (csnmp_oid_compare (&suffix, &last_suffix[i]) <= 0))
         {
           DEBUG ("snmp plugin: host = %s; data = %s; i = %zu; "
               "Suffix is not increasing.",
@@ -1603,25 +1747,22 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
           oid_list_todo[i] = 0;
           continue;
         }
+        memcpy (&last_suffix[i], &suffix, sizeof (last_suffix[i]));
+        have_last_suffix[i] = 1;
 
-        vt = calloc (1, sizeof (*vt));
-        if (vt == NULL)
+        row = csnmp_table_get (table, &suffix, data->values_len);
+        if (row == NULL)
         {
-          ERROR ("snmp plugin: calloc failed.");
+          ERROR ("snmp plugin: host %s: csnmp_table_get failed.",
+              host->name);
           status = -1;
           break;
         }
 
-        vt->value = csnmp_value_list_to_value (vb, ds->ds[i].type,
+        row->values[i] = csnmp_value_list_to_value (vb, ds->ds[i].type,
             data->scale, data->shift, host->name, data->name);
-        memcpy (&vt->suffix, &suffix, sizeof (vt->suffix));
-        vt->next = NULL;
-
-        if (value_list_tail[i] == NULL)
-          value_list_head[i] = vt;
-        else
-          value_list_tail[i]->next = vt;
-        value_list_tail[i] = vt;
+        row->have_value[i] = 1;
+        row->values_num++;
       }
 
       /* Copy OID to oid_list[i] */
@@ -1643,29 +1784,16 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
     snmp_free_pdu (req);
   req = NULL;
 
+  /* Rows which disappeared are only removed after a complete walk, so that
+   * their instances are still cached if a walk fails half way. */
   if (status == 0)
-    csnmp_dispatch_table (host, data, instance_list_head, value_list_head);
-
-  /* Free all allocated variables here */
-  while (instance_list_head != NULL)
   {
-    csnmp_list_instances_t *next = instance_list_head->next;
-    sfree (instance_list_head);
-    instance_list_head = next;
+    csnmp_dispatch_table (host, data, ds, table);
+    csnmp_table_prune (table);
   }
 
-  for (i = 0; i < data->values_len; i++)
-  {
-    while (value_list_head[i] != NULL)
-    {
-      csnmp_table_values_t *next = value_list_head[i]->next;
-      sfree (value_list_head[i]);
-      value_list_head[i] = next;
-    }
-  }
-
-  sfree (value_list_head);
-  sfree (value_list_tail);
+  sfree (last_suffix);
+  sfree (have_last_suffix);
 
   return (0);
 } /* int csnmp_read_table */
@@ -1785,9 +1913,30 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
   return (0);
 } /* int csnmp_read_value */
 
+static void csnmp_submit_poll_time (host_definition_t const *host, /* {{{ */
+    cdtime_t poll_time)
+{
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+
+  values[0].gauge = CDTIME_T_TO_DOUBLE (poll_time);
+
+  vl.values = values;
+  vl.values_len = 1;
+  vl.interval = host->interval;
+  sstrncpy (vl.host, host->name, sizeof (vl.host));
+  sstrncpy (vl.plugin, "snmp", sizeof (vl.plugin));
+  sstrncpy (vl.type, "response_time", sizeof (vl.type));
+  sstrncpy (vl.type_instance, "poll", sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+} /* }}} void csnmp_submit_poll_time */
+
 static int csnmp_read_host (user_data_t *ud)
 {
   host_definition_t *host;
+  cdtime_t time_start;
+  cdtime_t time_end;
   int status;
   int success;
   int i;
@@ -1803,13 +1952,33 @@ static int csnmp_read_host (user_data_t *ud)
   if (host->sess_handle == NULL)
     return (-1);
 
+  time_start = cdtime ();
+
+  if ((host->tables == NULL) && (host->data_list_len > 0))
+  {
+    host->tables = calloc ((size_t) host->data_list_len,
+        sizeof (*host->tables));
+    if (host->tables == NULL)
+    {
+      ERROR ("snmp plugin: calloc failed.");
+      return (-1);
+    }
+  }
+
   success = 0;
   for (i = 0; i < host->data_list_len; i++)
   {
     data_definition_t *data = host->data_list[i];
 
     if (data->is_table)
-      status = csnmp_read_table (host, data);
+    {
+      if (host->tables[i] == NULL)
+        host->tables[i] = calloc (1, sizeof (*host->tables[i]));
+      if (host->tables[i] != NULL)
+        status = csnmp_read_table (host, data, host->tables[i]);
+      else
+        status = -1;
+    }
     else
       status = csnmp_read_value (host, data);
 
@@ -1817,9 +1986,14 @@ static int csnmp_read_host (user_data_t *ud)
       success++;
   }
 
+  time_end = cdtime ();
+
   if (success == 0)
     return (-1);
 
+  if (host->measure_poll_time)
+    csnmp_submit_poll_time (host, time_end - time_start);
+
   return (0);
 } /* int csnmp_read_host */
 
@@ -30,7 +30,9 @@
 #include "configfile.h"
 #include "utils_avltree.h"
 #include "utils_complain.h"
+#include "utils_handover.h"
 #include "utils_latency.h"
+#include "utils_recv_batch.h"
 
 #include <pthread.h>
 
@@ -56,6 +58,18 @@
 # define STATSD_DEFAULT_SERVICE "8125"
 #endif
 
+/* Metrics are spread over this many independently locked trees, so receive
+ * threads and the read callback rarely wait for each other. */
+#define STATSD_SHARDS 16
+/* Estimated memory of a set member: the node of the set's tree and the copy of
+ * the member, which is usually short. */
+#define STATSD_SET_MEMBER_MEMORY 64
+
+/* Size of the buffer of each datagram. */
+#define STATSD_BUFFER_SIZE 4096
+/* Maximum number of datagrams read with a single recvmmsg(2) call. */
+#define STATSD_RECEIVE_BATCH 32
+
 enum metric_type_e
 {
   STATSD_COUNTER,
@@ -65,8 +79,22 @@ enum metric_type_e
 };
 typedef enum metric_type_e metric_type_t;
 
+/* Metrics are identified by their name and type. "hash" covers both and is
+ * computed once per line by statsd_tokenize(); comparing it first means
+ * names are rarely compared in full. */
+struct statsd_key_s
+{
+  uint32_t hash;
+  metric_type_t type;
+  size_t name_len;
+  char const *name;
+};
+typedef struct statsd_key_s statsd_key_t;
+
 struct statsd_metric_s
 {
+  /* Used as the key of the shard's tree. Owns "key.name". */
+  statsd_key_t key;
   metric_type_t type;
   double value;
   latency_counter_t *latency;
@@ -75,13 +103,26 @@ struct statsd_metric_s
 };
 typedef struct statsd_metric_s statsd_metric_t;
 
+struct statsd_shard_s
+{
+  c_avl_tree_t   *metrics_tree;
+  pthread_mutex_t metrics_lock;
+  /* Memory used by the metrics when they were last read, see
+   * statsd_memory(). */
+  size_t          memory;
+};
+typedef struct statsd_shard_s statsd_shard_t;
+
 struct statsd_config_s {
   char *node_name;
   char *host;
   char *service;
+  /* With more than one receive thread, each opens its own sockets with
+   * SO_REUSEPORT and the kernel distributes the datagrams. */
+  int receive_threads;
 
-  c_avl_tree_t   *metrics_tree;
-  pthread_mutex_t metrics_lock;
+  /* Metrics are assigned to shards by the hash of their key. */
+  statsd_shard_t shards[STATSD_SHARDS];
 
   _Bool delete_counters;
   _Bool delete_timers;
@@ -120,8 +161,23 @@ struct statsd_config_s {
 };
 typedef struct statsd_config_s statsd_config_t;
 
+struct fds_poll_s {
+  struct pollfd *fds;
+  size_t fds_num;
+};
+typedef struct fds_poll_s fds_poll_t;
+
+/* A receive thread and its sockets, which are opened by statsd_init(). */
+struct statsd_receiver_s {
+  pthread_t thread;
+  statsd_config_t *conf;
+  fds_poll_t fds;
+};
+typedef struct statsd_receiver_s statsd_receiver_t;
+
 struct statsd_thread_s {
-  pthread_t thr;
+  statsd_receiver_t *thr;
+  size_t thr_num;
   statsd_config_t *conf;
 };
 typedef struct statsd_thread_s statsd_thread_t;
@@ -129,63 +185,73 @@ typedef struct statsd_thread_s statsd_thread_t;
 static statsd_thread_t *statsd_threads     = NULL;
 static size_t           statsd_threads_num = 0;
 
-struct fds_poll_s {
-  struct pollfd *fds;
-  size_t fds_num;
+/* A line of the form "<name>:<value>|<type>[|@<rate>]", split by
+ * statsd_tokenize(). The pointers point into the receive buffer. */
+struct statsd_line_s
+{
+  statsd_key_t key;
+  char *value;
+  char *value_end;
+  double number; /* "value" parsed, unless type is STATSD_SET */
+  double rate;
 };
-typedef struct fds_poll_s fds_poll_t;
+typedef struct statsd_line_s statsd_line_t;
 
-/* Must hold metrics_lock when calling this function. */
-static statsd_metric_t *statsd_metric_lookup_unsafe (statsd_config_t *conf, char const *name, /* {{{ */
-    metric_type_t type)
+static int statsd_key_compare (statsd_key_t const *a, /* {{{ */
+    statsd_key_t const *b)
 {
-  char key[DATA_MAX_NAME_LEN + 2];
-  char *key_copy;
+  if (a->hash != b->hash)
+    return ((a->hash < b->hash) ? -1 : 1);
+  if (a->type != b->type)
+    return ((a->type < b->type) ? -1 : 1);
+  if (a->name_len != b->name_len)
+    return ((a->name_len < b->name_len) ? -1 : 1);
+  return (memcmp (a->name, b->name, a->name_len));
+} /* }}} int statsd_key_compare */
+
+/* Must hold metrics_lock of "shard" when calling this function. Only
+ * allocates memory when the metric is new. */
+static statsd_metric_t *statsd_metric_lookup_unsafe (statsd_shard_t *shard, /* {{{ */
+    statsd_key_t const *key)
+{
+  char *name_copy;
   statsd_metric_t *metric;
   int status;
-  c_avl_tree_t *metrics_tree = conf->metrics_tree;
-
-  switch (type)
-  {
-    case STATSD_COUNTER: key[0] = 'c'; break;
-    case STATSD_TIMER:   key[0] = 't'; break;
-    case STATSD_GAUGE:   key[0] = 'g'; break;
-    case STATSD_SET:     key[0] = 's'; break;
-    default: return (NULL);
-  }
-
-  key[1] = ':';
-  sstrncpy (&key[2], name, sizeof (key) - 2);
+  c_avl_tree_t *metrics_tree = shard->metrics_tree;
 
   status = c_avl_get (metrics_tree, key, (void *) &metric);
   if (status == 0)
     return (metric);
 
-  key_copy = strdup (key);
-  if (key_copy == NULL)
+  name_copy = malloc (key->name_len + 1);
+  if (name_copy == NULL)
   {
-    ERROR ("statsd plugin: strdup failed.");
+    ERROR ("statsd plugin: malloc failed.");
     return (NULL);
   }
+  memcpy (name_copy, key->name, key->name_len);
+  name_copy[key->name_len] = 0;
 
   metric = malloc (sizeof (*metric));
   if (metric == NULL)
   {
     ERROR ("statsd plugin: malloc failed.");
-    sfree (key_copy);
+    sfree (name_copy);
     return (NULL);
   }
   memset (metric, 0, sizeof (*metric));
 
-  metric->type = type;
+  metric->key = *key;
+  metric->key.name = name_copy;
+  metric->type = key->type;
   metric->latency = NULL;
   metric->set = NULL;
 
-  status = c_avl_insert (metrics_tree, key_copy, metric);
+  status = c_avl_insert (metrics_tree, &metric->key, metric);
   if (status != 0)
   {
     ERROR ("statsd plugin: c_avl_insert failed.");
-    sfree (key_copy);
+    sfree (name_copy);
     sfree (metric);
     return (NULL);
   }
@@ -193,46 +259,60 @@ static statsd_metric_t *statsd_metric_lookup_unsafe (statsd_config_t *conf, char
   return (metric);
 } /* }}} statsd_metric_lookup_unsafe */
 
-static int statsd_metric_set (statsd_config_t *conf,char const *name, double value, /* {{{ */
-    metric_type_t type)
+/* Looks up the metric, creating it if necessary, and returns it with the lock
+ * of its shard held. The caller must unlock "*ret_shard". */
+static statsd_metric_t *statsd_metric_lock (statsd_config_t *conf, /* {{{ */
+    statsd_key_t const *key, statsd_shard_t **ret_shard)
 {
+  statsd_shard_t *shard;
   statsd_metric_t *metric;
 
-  pthread_mutex_lock (&conf->metrics_lock);
+  shard = conf->shards + (key->hash % STATSD_SHARDS);
 
-  metric = statsd_metric_lookup_unsafe (conf, name, type);
+  pthread_mutex_lock (&shard->metrics_lock);
+  metric = statsd_metric_lookup_unsafe (shard, key);
   if (metric == NULL)
   {
-    pthread_mutex_unlock (&conf->metrics_lock);
-    return (-1);
+    pthread_mutex_unlock (&shard->metrics_lock);
+    return (NULL);
   }
 
+  *ret_shard = shard;
+  return (metric);
+} /* }}} statsd_metric_t *statsd_metric_lock */
+
+static int statsd_metric_set (statsd_config_t *conf, /* {{{ */
+    statsd_key_t const *key, double value)
+{
+  statsd_shard_t *shard;
+  statsd_metric_t *metric;
+
+  metric = statsd_metric_lock (conf, key, &shard);
+  if (metric == NULL)
+    return (-1);
+
   metric->value = value;
   metric->updates_num++;
 
-  pthread_mutex_unlock (&conf->metrics_lock);
+  pthread_mutex_unlock (&shard->metrics_lock);
 
   return (0);
 } /* }}} int statsd_metric_set */
 
-static int statsd_metric_add (statsd_config_t *conf, char const *name, double delta, /* {{{ */
-    metric_type_t type)
+static int statsd_metric_add (statsd_config_t *conf, /* {{{ */
+    statsd_key_t const *key, double delta)
 {
+  statsd_shard_t *shard;
   statsd_metric_t *metric;
 
-  pthread_mutex_lock (&conf->metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe (conf, name, type);
+  metric = statsd_metric_lock (conf, key, &shard);
   if (metric == NULL)
-  {
-    pthread_mutex_unlock (&conf->metrics_lock);
     return (-1);
-  }
 
   metric->value += delta;
   metric->updates_num++;
 
-  pthread_mutex_unlock (&conf->metrics_lock);
+  pthread_mutex_unlock (&shard->metrics_lock);
 
   return (0);
 } /* }}} int statsd_metric_add */
@@ -263,139 +343,146 @@ static void statsd_metric_free (statsd_metric_t *metric) /* {{{ */
     metric->set = NULL;
   }
 
+  free ((char *) metric->key.name);
   sfree (metric);
 } /* }}} void statsd_metric_free */
 
-static int statsd_parse_value (char const *str, value_t *ret_value) /* {{{ */
+/* Parses the number in [str, end). strtod(3) stops at the delimiter, so
+ * the number doesn't need to be null terminated. */
+static int statsd_parse_number (char const *str, char const *end, /* {{{ */
+    double *ret_number)
 {
   char *endptr = NULL;
 
-  ret_value->gauge = (gauge_t) strtod (str, &endptr);
-  if ((str == endptr) || ((endptr != NULL) && (*endptr != 0)))
+  if (str == end)
     return (-1);
 
-  return (0);
-} /* }}} int statsd_parse_value */
+  *ret_number = strtod (str, &endptr);
+  if (endptr != end)
+    return (-1);
 
-static int statsd_handle_counter (statsd_config_t *conf, char const *name, /* {{{ */
-    char const *value_str,
-    char const *extra)
+  return (0);
+} /* }}} int statsd_parse_number */
+
+/* Splits the line [line, end) into its fields in a single pass and hashes
+ * the name. The line is not modified, so it can be logged if it is invalid;
+ * statsd_parse_line() terminates the fields once the line is known to be
+ * valid. */
+static int statsd_tokenize (char *line, char const *end, /* {{{ */
+    statsd_line_t *ret_line)
 {
-  value_t value;
-  value_t scale;
-  int status;
+  char *colon = NULL;
+  char *pipe = NULL;
+  char *type;
+  char *type_end;
+  uint32_t hash = 2166136261U; /* FNV-1a */
+  char *ptr;
 
-  if ((extra != NULL) && (extra[0] != '@'))
+  /* The name may contain colons, the value starts after the last one. */
+  for (ptr = line; ptr < end; ptr++)
+  {
+    if (*ptr == '|')
+    {
+      pipe = ptr;
+      break;
+    }
+    if (*ptr == ':')
+      colon = ptr;
+  }
+  if ((colon == NULL) || (pipe == NULL))
     return (-1);
 
-  scale.gauge = 1.0;
-  if (extra != NULL)
+  type = pipe + 1;
+  for (type_end = type; (type_end < end) && (*type_end != '|'); type_end++)
+    /* nop */;
+
+  if ((type_end - type == 1) && (type[0] == 'c'))
+    ret_line->key.type = STATSD_COUNTER;
+  else if ((type_end - type == 2) && (type[0] == 'm') && (type[1] == 's'))
+    ret_line->key.type = STATSD_TIMER;
+  else if ((type_end - type == 1) && (type[0] == 'g'))
+    ret_line->key.type = STATSD_GAUGE;
+  else if ((type_end - type == 1) && (type[0] == 's'))
+    ret_line->key.type = STATSD_SET;
+  else
+    return (-1);
+
+  /* The sample rate is only valid for counters and timers. */
+  ret_line->rate = 1.0;
+  if (type_end < end)
   {
-    status = statsd_parse_value (extra + 1, &scale);
-    if (status != 0)
-      return (status);
+    if (((ret_line->key.type != STATSD_COUNTER)
+          && (ret_line->key.type != STATSD_TIMER))
+        || (type_end[1] != '@')
+        || (statsd_parse_number (type_end + 2, end, &ret_line->rate) != 0))
+      return (-1);
 
-    if (!isfinite (scale.gauge) || (scale.gauge <= 0.0) || (scale.gauge > 1.0))
+    if (!isfinite (ret_line->rate)
+        || (ret_line->rate <= 0.0) || (ret_line->rate > 1.0))
       return (-1);
   }
 
-  value.gauge = 1.0;
-  status = statsd_parse_value (value_str, &value);
-  if (status != 0)
-    return (status);
-
-  return (statsd_metric_add (conf, name, (double) (value.gauge / scale.gauge),
-        STATSD_COUNTER));
-} /* }}} int statsd_handle_counter */
+  ret_line->value = colon + 1;
+  ret_line->value_end = pipe;
+  ret_line->number = 0.0;
+  if ((ret_line->key.type != STATSD_SET)
+      && (statsd_parse_number (colon + 1, pipe, &ret_line->number) != 0))
+    return (-1);
 
-static int statsd_handle_gauge (statsd_config_t *conf, char const *name, /* {{{ */
-    char const *value_str)
-{
-  value_t value;
-  int status;
+  for (ptr = line; ptr < colon; ptr++)
+  {
+    hash ^= (uint32_t) (unsigned char) *ptr;
+    hash *= 16777619U;
+  }
+  hash ^= (uint32_t) ret_line->key.type;
+  hash *= 16777619U;
 
-  value.gauge = 0;
-  status = statsd_parse_value (value_str, &value);
-  if (status != 0)
-    return (status);
+  ret_line->key.hash = hash;
+  ret_line->key.name = line;
+  ret_line->key.name_len = (size_t) (colon - line);
 
-  if ((value_str[0] == '+') || (value_str[0] == '-'))
-    return (statsd_metric_add (conf, name, (double) value.gauge, STATSD_GAUGE));
-  else
-    return (statsd_metric_set (conf, name, (double) value.gauge, STATSD_GAUGE));
-} /* }}} int statsd_handle_gauge */
+  return (0);
+} /* }}} int statsd_tokenize */
 
-static int statsd_handle_timer (statsd_config_t *conf, char const *name, /* {{{ */
-    char const *value_str,
-    char const *extra)
+static int statsd_handle_timer (statsd_config_t *conf, /* {{{ */
+    statsd_line_t const *line)
 {
+  statsd_shard_t *shard;
   statsd_metric_t *metric;
-  value_t value_ms;
-  value_t scale;
   cdtime_t value;
-  int status;
-
-  if ((extra != NULL) && (extra[0] != '@'))
-    return (-1);
-
-  scale.gauge = 1.0;
-  if (extra != NULL)
-  {
-    status = statsd_parse_value (extra + 1, &scale);
-    if (status != 0)
-      return (status);
-
-    if (!isfinite (scale.gauge) || (scale.gauge <= 0.0) || (scale.gauge > 1.0))
-      return (-1);
-  }
-
-  value_ms.derive = 0;
-  status = statsd_parse_value (value_str, &value_ms);
-  if (status != 0)
-    return (status);
-
-  value = DOUBLE_TO_CDTIME_T (value_ms.gauge / scale.gauge);
 
-  pthread_mutex_lock (&conf->metrics_lock);
+  value = DOUBLE_TO_CDTIME_T (line->number / line->rate);
 
-  metric = statsd_metric_lookup_unsafe (conf, name, STATSD_TIMER);
+  metric = statsd_metric_lock (conf, &line->key, &shard);
   if (metric == NULL)
-  {
-    pthread_mutex_unlock (&conf->metrics_lock);
     return (-1);
-  }
 
   if (metric->latency == NULL)
     metric->latency = latency_counter_create ();
   if (metric->latency == NULL)
   {
-    pthread_mutex_unlock (&conf->metrics_lock);
+    pthread_mutex_unlock (&shard->metrics_lock);
     return (-1);
   }
 
   latency_counter_add (metric->latency, value);
   metric->updates_num++;
 
-  pthread_mutex_unlock (&conf->metrics_lock);
+  pthread_mutex_unlock (&shard->metrics_lock);
   return (0);
 } /* }}} int statsd_handle_timer */
 
-static int statsd_handle_set (statsd_config_t *conf, char const *name, /* {{{ */
-    char const *set_key_orig)
+static int statsd_handle_set (statsd_config_t *conf, /* {{{ */
+    statsd_line_t const *line)
 {
+  statsd_shard_t *shard;
   statsd_metric_t *metric = NULL;
   char *set_key;
   int status;
 
-
-  pthread_mutex_lock (&conf->metrics_lock);
-
-  metric = statsd_metric_lookup_unsafe (conf, name, STATSD_SET);
+  metric = statsd_metric_lock (conf, &line->key, &shard);
   if (metric == NULL)
-  {
-    pthread_mutex_unlock (&conf->metrics_lock);
     return (-1);
-  }
 
   /* Make sure metric->set exists. */
   if (metric->set == NULL)
@@ -403,146 +490,211 @@ static int statsd_handle_set (statsd_config_t *conf, char const *name, /* {{{ */
 
   if (metric->set == NULL)
   {
-    pthread_mutex_unlock (&conf->metrics_lock);
+    pthread_mutex_unlock (&shard->metrics_lock);
     ERROR ("statsd plugin: c_avl_create failed.");
     return (-1);
   }
 
-  set_key = strdup (set_key_orig);
+  /* Only copy keys which are not in the set yet. */
+  if (c_avl_get (metric->set, line->value, /* value = */ NULL) == 0)
+  {
+    metric->updates_num++;
+    pthread_mutex_unlock (&shard->metrics_lock);
+    return (0);
+  }
+
+  set_key = strdup (line->value);
   if (set_key == NULL)
   {
-    pthread_mutex_unlock (&conf->metrics_lock);
+    pthread_mutex_unlock (&shard->metrics_lock);
     ERROR ("statsd plugin: strdup failed.");
     return (-1);
   }
 
   status = c_avl_insert (metric->set, set_key, /* value = */ NULL);
-  if (status < 0)
+  if (status != 0)
   {
-    pthread_mutex_unlock (&conf->metrics_lock);
-    if (status < 0)
-      ERROR ("statsd plugin: c_avl_insert (\"%s\") failed with status %i.",
-          set_key, status);
+    pthread_mutex_unlock (&shard->metrics_lock);
+    ERROR ("statsd plugin: c_avl_insert (\"%s\") failed with status %i.",
+        set_key, status);
     sfree (set_key);
     return (-1);
   }
-  else if (status > 0) /* key already exists */
-  {
-    sfree (set_key);
-  }
 
   metric->updates_num++;
 
-  pthread_mutex_unlock (&conf->metrics_lock);
+  pthread_mutex_unlock (&shard->metrics_lock);
   return (0);
 } /* }}} int statsd_handle_set */
 
-static int statsd_parse_line (statsd_config_t *conf, char *buffer) /* {{{ */
+/* Parses the line [line, end). */
+static int statsd_parse_line (statsd_config_t *conf, /* {{{ */
+    char *line, char *end)
 {
-  char *name = buffer;
-  char *value;
-  char *type;
-  char *extra;
+  statsd_line_t parsed;
+  int status;
 
-  type = strchr (name, '|');
-  if (type == NULL)
-    return (-1);
-  *type = 0;
-  type++;
+  status = statsd_tokenize (line, end, &parsed);
+  if (status != 0)
+    return (status);
 
-  value = strrchr (name, ':');
-  if (value == NULL)
-    return (-1);
-  *value = 0;
-  value++;
+  /* The value of a set is used as a key of the set's tree. */
+  *parsed.value_end = 0;
 
-  extra = strchr (type, '|');
-  if (extra != NULL)
+  switch (parsed.key.type)
   {
-    *extra = 0;
-    extra++;
+    case STATSD_COUNTER:
+      return (statsd_metric_add (conf, &parsed.key,
+            parsed.number / parsed.rate));
+    case STATSD_TIMER:
+      return (statsd_handle_timer (conf, &parsed));
+    case STATSD_GAUGE:
+      if ((parsed.value[0] == '+') || (parsed.value[0] == '-'))
+        return (statsd_metric_add (conf, &parsed.key, parsed.number));
+      else
+        return (statsd_metric_set (conf, &parsed.key, parsed.number));
+    case STATSD_SET:
+      return (statsd_handle_set (conf, &parsed));
   }
 
-  if (strcmp ("c", type) == 0)
-    return (statsd_handle_counter (conf, name, value, extra));
-  else if (strcmp ("ms", type) == 0)
-    return (statsd_handle_timer (conf, name, value, extra));
+  return (-1);
+} /* }}} int statsd_parse_line */
 
-  /* extra is only valid for counters and timers */
-  if (extra != NULL)
-    return (-1);
-
-  if (strcmp ("g", type) == 0)
-    return (statsd_handle_gauge (conf, name, value));
-  else if (strcmp ("s", type) == 0)
-    return (statsd_handle_set (conf, name, value));
-  else
-    return (-1);
-} /* }}} void statsd_parse_line */
-
-static void statsd_parse_buffer (statsd_config_t *conf, char *buffer) /* {{{ */
+/* Parses the "buffer_size" bytes in "buffer", which must be followed by a
+ * null byte. Lines are parsed in place, no memory is allocated unless a
+ * metric or set member is new. */
+static void statsd_parse_buffer (statsd_config_t *conf, /* {{{ */
+    char *buffer, size_t buffer_size)
 {
-  DEBUG("statsd plugin: buffer '%s'", buffer);
+  char *end = buffer + buffer_size;
 
-  while (buffer != NULL)
+  DEBUG("statsd plugin: buffer '%.*s'", (int) buffer_size, buffer);
+
+  while (buffer < end)
   {
-    char orig[64];
     char *next;
     int status;
 
-    next = strchr (buffer, '\n');
-    if (next != NULL)
-    {
-      *next = 0;
-      next++;
-    }
+    next = memchr (buffer, '\n', (size_t) (end - buffer));
+    if (next == NULL)
+      next = end;
 
-    if (*buffer == 0)
+    if (next == buffer)
     {
-      buffer = next;
+      buffer = next + 1;
       continue;
     }
 
-    sstrncpy (orig, buffer, sizeof (orig));
-
-    status = statsd_parse_line (conf, buffer);
+    status = statsd_parse_line (conf, buffer, next);
     if (status != 0)
-      ERROR ("statsd plugin: Unable to parse line: \"%s\"", orig);
+      ERROR ("statsd plugin: Unable to parse line: \"%.*s\"",
+          (int) (((next - buffer) < 63) ? (next - buffer) : 63), buffer);
 
-    buffer = next;
+    buffer = next + 1;
   }
 } /* }}} void statsd_parse_buffer */
 
-static void statsd_network_read (statsd_config_t *conf, int fd) /* {{{ */
+static void statsd_network_parse (statsd_config_t *conf, /* {{{ */
+    char *buffer, size_t buffer_size)
 {
-  char buffer[4096] = {0};
-  size_t buffer_size;
-  ssize_t status;
+  if (buffer_size >= STATSD_BUFFER_SIZE)
+    buffer_size = STATSD_BUFFER_SIZE - 1;
+  buffer[buffer_size] = 0;
+
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  statsd_parse_buffer (conf, buffer, buffer_size);
+  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+} /* }}} void statsd_network_parse */
+
+/* Reads and parses the datagrams waiting on "fd". "buffers" holds
+ * STATSD_RECEIVE_BATCH buffers of STATSD_BUFFER_SIZE bytes each. */
+static void statsd_network_read (statsd_config_t *conf, int fd, /* {{{ */
+    char *buffers)
+{
+  char *bufs[STATSD_RECEIVE_BATCH];
+  size_t lens[STATSD_RECEIVE_BATCH];
+  int status;
+  int i;
+
+  for (i = 0; i < STATSD_RECEIVE_BATCH; i++)
+    bufs[i] = buffers + i * STATSD_BUFFER_SIZE;
 
-  status = recv (fd, buffer, sizeof (buffer), /* flags = */ MSG_DONTWAIT);
+  /* Leave room for the terminating null byte. */
+  status = recv_batch (fd, bufs, STATSD_BUFFER_SIZE - 1, lens,
+      /* addrs = */ NULL, STATSD_RECEIVE_BATCH);
   if (status < 0)
   {
     char errbuf[1024];
 
-    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-      return;
-
     ERROR ("statsd plugin: recv(2) failed: %s",
         sstrerror (errno, errbuf, sizeof (errbuf)));
     return;
   }
 
-  buffer_size = (size_t) status;
-  if (buffer_size >= sizeof (buffer))
-    buffer_size = sizeof (buffer) - 1;
-  buffer[buffer_size] = 0;
-
-  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-  statsd_parse_buffer (conf, buffer);
-  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+  for (i = 0; i < status; i++)
+    statsd_network_parse (conf, bufs[i], lens[i]);
 } /* }}} void statsd_network_read */
 
-static int statsd_network_init (statsd_config_t *conf, fds_poll_t *ret_fds) /* {{{ */
+/* Returns a new socket bound to `ai' or -1 on failure. */
+static int statsd_network_bind (statsd_config_t *conf, /* {{{ */
+    const struct addrinfo *ai)
+{
+  int fd;
+  int status;
+
+  char dbg_host[NI_MAXHOST] = {0};
+  char dbg_service[NI_MAXSERV] = {0};
+
+  fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("statsd plugin: socket(2) failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  getnameinfo (ai->ai_addr, ai->ai_addrlen,
+      dbg_host, sizeof (dbg_host), dbg_service, sizeof (dbg_service),
+      NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV);
+  DEBUG ("statsd plugin: Trying to bind to [%s]:%s ...", dbg_host, dbg_service);
+
+#ifdef SO_REUSEPORT
+  /* Let the kernel distribute datagrams among the sockets of the receive
+   * threads. */
+  if (conf->receive_threads > 1)
+  {
+    int yes = 1;
+
+    if (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT,
+          &yes, sizeof (yes)) != 0)
+    {
+      char errbuf[1024];
+      ERROR ("statsd plugin: setsockopt (SO_REUSEPORT) failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      close (fd);
+      return (-1);
+    }
+  }
+#endif
+
+  status = bind (fd, ai->ai_addr, ai->ai_addrlen);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("statsd plugin: bind(2) failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    return (-1);
+  }
+
+  return (fd);
+} /* }}} int statsd_network_bind */
+
+/* Opens the sockets of the receive thread `index'. Sockets handed over by the
+ * previous instance are taken over first. */
+static int statsd_network_init (statsd_config_t *conf, size_t index, /* {{{ */
+    fds_poll_t *ret_fds)
 {
   struct pollfd *fds = NULL;
   size_t fds_num = 0;
@@ -578,32 +730,11 @@ static int statsd_network_init (statsd_config_t *conf, fds_poll_t *ret_fds) /* {
     int fd;
     struct pollfd *tmp;
 
-    char dbg_host[NI_MAXHOST] = {0};
-    char dbg_service[NI_MAXSERV] = {0};
-
-    fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+    fd = handover_socket_get ("statsd", ai_ptr, index);
+    if (fd < 0)
+      fd = statsd_network_bind (conf, ai_ptr);
     if (fd < 0)
-    {
-      char errbuf[1024];
-      ERROR ("statsd plugin: socket(2) failed: %s",
-          sstrerror (errno, errbuf, sizeof (errbuf)));
-      continue;
-    }
-
-    getnameinfo (ai_ptr->ai_addr, ai_ptr->ai_addrlen,
-        dbg_host, sizeof (dbg_host), dbg_service, sizeof (dbg_service),
-        NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV);
-    DEBUG ("statsd plugin: Trying to bind to [%s]:%s ...", dbg_host, dbg_service);
-
-    status = bind (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
-    if (status != 0)
-    {
-      char errbuf[1024];
-      ERROR ("statsd plugin: bind(2) failed: %s",
-          sstrerror (errno, errbuf, sizeof (errbuf)));
-      close (fd);
       continue;
-    }
 
     tmp = realloc (fds, sizeof (*fds) * (fds_num + 1));
     if (tmp == NULL)
@@ -612,6 +743,7 @@ static int statsd_network_init (statsd_config_t *conf, fds_poll_t *ret_fds) /* {
       close (fd);
       continue;
     }
+    handover_socket_put ("statsd", ai_ptr, index, fd);
     fds = tmp;
     tmp = fds + fds_num;
     fds_num++;
@@ -638,6 +770,7 @@ static int statsd_network_init (statsd_config_t *conf, fds_poll_t *ret_fds) /* {
 static statsd_config_t *statsd_config_alloc(void)
 {
   statsd_config_t *conf = NULL;
+  size_t i;
 
   conf = malloc(sizeof(statsd_config_t));
   if (NULL == conf) {
@@ -646,8 +779,11 @@ static statsd_config_t *statsd_config_alloc(void)
   }
 
   memset(conf, 0, sizeof(statsd_config_t));
-  pthread_mutex_init (&conf->metrics_lock, /* attr = */ NULL);
-  conf->metrics_tree = c_avl_create ((void *) strcmp);
+  conf->receive_threads = 1;
+  for (i = 0; i < STATSD_SHARDS; i++) {
+    pthread_mutex_init (&conf->shards[i].metrics_lock, /* attr = */ NULL);
+    conf->shards[i].metrics_tree = c_avl_create ((void *) statsd_key_compare);
+  }
 
   return conf;
 }
@@ -656,16 +792,24 @@ static void statsd_config_free(statsd_config_t *conf)
 {
   void *key = NULL;
   void *value = NULL;
+  size_t i;
 
   if (NULL == conf)
     return;
 
-  while (c_avl_pick (conf->metrics_tree, &key, &value) == 0) {
-    sfree (key);
-    statsd_metric_free (value);
-  }
+  for (i = 0; i < STATSD_SHARDS; i++) {
+    statsd_shard_t *shard = conf->shards + i;
 
-  c_avl_destroy(conf->metrics_tree);
+    if (shard->metrics_tree == NULL)
+      continue;
+
+    /* The keys are part of the metrics. */
+    while (c_avl_pick (shard->metrics_tree, &key, &value) == 0)
+      statsd_metric_free (value);
+
+    c_avl_destroy(shard->metrics_tree);
+    pthread_mutex_destroy (&shard->metrics_lock);
+  }
 
   sfree(conf->node_name);
   sfree(conf->host);
@@ -690,6 +834,7 @@ static void statsd_threads_free(void)
 
   for (thread_num = 0; thread_num < statsd_threads_num; thread_num++) {
     statsd_config_free(statsd_threads[thread_num].conf);
+    sfree(statsd_threads[thread_num].thr);
   }
 
   sfree(statsd_threads);
@@ -699,6 +844,11 @@ static void statsd_threads_free(void)
   return;
 }
 
+static void statsd_network_free_buffers(void *args)
+{
+  sfree (args);
+}
+
 static void statsd_network_release(void *args)
 {
   fds_poll_t *fds = args;
@@ -709,38 +859,44 @@ static void statsd_network_release(void *args)
 
   /* Clean up */
   for (i = 0; i < fds->fds_num; i++)
+  {
+    handover_socket_forget (fds->fds[i].fd);
     close (fds->fds[i].fd);
+  }
 
   sfree (fds->fds);
+  fds->fds_num = 0;
 
   return;
 }
 
 static void *statsd_network_thread (void *args) /* {{{ */
 {
-  statsd_config_t *conf = args;
-  fds_poll_t fds;
+  statsd_receiver_t *r = args;
+  statsd_config_t *conf = r->conf;
+  fds_poll_t *fds = &r->fds;
+  char *buffers;
   int status;
   size_t i;
 
-  memset(&fds, 0, sizeof(fds_poll_t));
-
   pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-  status = statsd_network_init (conf, &fds);
-  if (status != 0)
+  buffers = malloc (STATSD_RECEIVE_BATCH * STATSD_BUFFER_SIZE);
+  if (buffers == NULL)
   {
-    ERROR ("statsd plugin: Unable to open listening sockets.");
+    ERROR ("statsd plugin: malloc failed.");
+    statsd_network_release (fds);
     pthread_exit ((void *) 0);
   }
 
-  pthread_cleanup_push(statsd_network_release, &fds);
+  pthread_cleanup_push(statsd_network_free_buffers, buffers);
+  pthread_cleanup_push(statsd_network_release, fds);
 
   pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
   while (1) {
 
-    status = poll (fds.fds, (nfds_t) fds.fds_num, /* timeout = */ -1);
+    status = poll (fds->fds, (nfds_t) fds->fds_num, /* timeout = */ -1);
 
     if (status < 0) {
       char errbuf[1024] = {0};
@@ -760,16 +916,17 @@ static void *statsd_network_thread (void *args) /* {{{ */
 
     DEBUG("statsd plugin: ohh some moving in the sockets");
 
-    for (i = 0; i < fds.fds_num; i++) {
-      if ((fds.fds[i].revents & (POLLIN | POLLPRI)) == 0)
+    for (i = 0; i < fds->fds_num; i++) {
+      if ((fds->fds[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
 
-      statsd_network_read(conf, fds.fds[i].fd);
-      fds.fds[i].revents = 0;
+      statsd_network_read(conf, fds->fds[i].fd, buffers);
+      fds->fds[i].revents = 0;
     }
     pthread_testcancel();
   } /* wait for pthread_cancel */
 
+  pthread_cleanup_pop(1);
   pthread_cleanup_pop(1);
 
   return ((void *) 0);
@@ -819,6 +976,8 @@ static int statsd_config_node (statsd_config_t *conf, oconfig_item_t *ci)
       cf_util_get_string (child, &conf->host);
     else if (strcasecmp ("Port", child->key) == 0)
       cf_util_get_service (child, &conf->service);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      cf_util_get_int (child, &conf->receive_threads);
     else if (strcasecmp ("DeleteCounters", child->key) == 0)
       cf_util_get_boolean (child, &conf->delete_counters);
     else if (strcasecmp ("DeleteTimers", child->key) == 0)
@@ -856,6 +1015,20 @@ static int statsd_config_node (statsd_config_t *conf, oconfig_item_t *ci)
              child->key);
   }
 
+  if (conf->receive_threads < 1)
+  {
+    WARNING ("statsd plugin: ReceiveThreads must be at least 1.");
+    conf->receive_threads = 1;
+  }
+#ifndef SO_REUSEPORT
+  if (conf->receive_threads > 1)
+  {
+    WARNING ("statsd plugin: ReceiveThreads requires SO_REUSEPORT, which is "
+        "not available on this system. Using one receive thread.");
+    conf->receive_threads = 1;
+  }
+#endif
+
   return (0);
 }
 
@@ -880,7 +1053,7 @@ static int statsd_config (oconfig_item_t *ci) /* {{{ */
       memset(statsd_threads, 0, sizeof(statsd_thread_t));
 
     } else {
-      tmp = realloc(statsd_threads, sizeof (statsd_config_t) * (statsd_threads_num + 1));
+      tmp = realloc(statsd_threads, sizeof (*tmp) * (statsd_threads_num + 1));
 
       if (NULL == tmp) {
         ERROR ("statsd plugin: realloc failed.");
@@ -889,7 +1062,7 @@ static int statsd_config (oconfig_item_t *ci) /* {{{ */
       }
 
       statsd_threads = tmp;
-      memset(statsd_threads + statsd_threads_num, 0, sizeof(statsd_config_t));
+      memset(statsd_threads + statsd_threads_num, 0, sizeof(*tmp));
     }
 
     statsd_threads_num += 1;
@@ -930,24 +1103,48 @@ static int statsd_init (void) /* {{{ */
   int thread_num = 0;
 
   for (thread_num = 0; thread_num < statsd_threads_num; thread_num++) {
-    int status = 0;
+    statsd_thread_t *t = statsd_threads + thread_num;
+    size_t receive_threads = (size_t) t->conf->receive_threads;
+
+    t->thr = calloc (receive_threads, sizeof (*t->thr));
+    if (t->thr == NULL) {
+      ERROR ("statsd plugin: calloc failed.");
+      return (ENOMEM);
+    }
 
-    status = plugin_thread_create (&statsd_threads[thread_num].thr,
-                                   /* attr = */ NULL,
-                                   statsd_network_thread,
-                                   statsd_threads[thread_num].conf);
+    while (t->thr_num < receive_threads) {
+      statsd_receiver_t *r = t->thr + t->thr_num;
+      int status = 0;
+
+      /* Opened here rather than by the thread, so that sockets handed over
+       * by the previous instance are taken before the daemon closes the
+       * unclaimed ones. */
+      r->conf = t->conf;
+      status = statsd_network_init (r->conf, t->thr_num, &r->fds);
+      if (status != 0) {
+        ERROR ("statsd plugin: Unable to open listening sockets.");
+        break;
+      }
 
-    if (status != 0) {
-      char errbuf[1024] = {0};
-      ERROR ("statsd plugin: pthread_create failed: %s",
-             sstrerror (errno, errbuf, sizeof (errbuf)));
-      return (status);
+      status = plugin_thread_create (&r->thread,
+                                     /* attr = */ NULL,
+                                     statsd_network_thread,
+                                     r);
+
+      if (status != 0) {
+        char errbuf[1024] = {0};
+        ERROR ("statsd plugin: pthread_create failed: %s",
+               sstrerror (errno, errbuf, sizeof (errbuf)));
+        statsd_network_release (&r->fds);
+        return (status);
+      }
+      t->thr_num++;
     }
   }
   return (0);
 } /* }}} int statsd_init */
 
-/* Must hold metrics_lock when calling this function. */
+/* Must hold the shard's metrics_lock when calling this function. */
 static int statsd_metric_clear_set_unsafe (statsd_metric_t *metric) /* {{{ */
 {
   void *key;
@@ -968,8 +1165,9 @@ static int statsd_metric_clear_set_unsafe (statsd_metric_t *metric) /* {{{ */
   return (0);
 } /* }}} int statsd_metric_clear_set_unsafe */
 
-/* Must hold metrics_lock when calling this function. */
-static int statsd_metric_submit_unsafe (statsd_config_t *conf, char const *name, /* {{{ */
+/* Dispatches a copy of a metric taken by statsd_read_shard(). The copy owns
+ * its latency counter; for sets, "value" holds the size of the set. */
+static int statsd_metric_submit (statsd_config_t *conf, char const *name, /* {{{ */
     statsd_metric_t const *metric)
 {
   value_t values[1];
@@ -1080,15 +1278,11 @@ static int statsd_metric_submit_unsafe (statsd_config_t *conf, char const *name,
       plugin_dispatch_values (&vl);
     }
 
-    latency_counter_reset (metric->latency);
     return (0);
   }
   else if (metric->type == STATSD_SET)
   {
-    if (metric->set == NULL)
-      values[0].gauge = 0.0;
-    else
-      values[0].gauge = (gauge_t) c_avl_size (metric->set);
+    values[0].gauge = (gauge_t) metric->value;
   }
   else { /* STATSD_COUNTER */
       /*
@@ -1105,82 +1299,171 @@ static int statsd_metric_submit_unsafe (statsd_config_t *conf, char const *name,
   }
 
   return (plugin_dispatch_values (&vl));
-} /* }}} int statsd_metric_submit_unsafe */
+} /* }}} int statsd_metric_submit */
 
-static int statsd_read (void) /* {{{ */
+/* A metric copied by statsd_read_shard(), to be dispatched without holding
+ * the shard's lock. */
+struct statsd_metric_copy_s
+{
+  char const *name;
+  statsd_metric_t metric;
+};
+typedef struct statsd_metric_copy_s statsd_metric_copy_t;
+
+/* Copies and resets the metrics of one shard and removes the ones that
+ * should be deleted. The lock is only held while copying, so receive threads
+ * are not blocked while the values are dispatched. */
+static int statsd_read_shard (statsd_config_t *conf, /* {{{ */
+    statsd_shard_t *shard)
 {
   c_avl_iterator_t *iter;
-  char *name;
+  statsd_key_t *key;
   statsd_metric_t *metric;
 
-  char **to_be_deleted = NULL;
+  statsd_metric_copy_t *copies;
+  size_t copies_num = 0;
+  statsd_metric_t **to_be_deleted;
   size_t to_be_deleted_num = 0;
   size_t i;
+
+  pthread_mutex_lock (&shard->metrics_lock);
+
+  if (shard->metrics_tree == NULL)
+  {
+    pthread_mutex_unlock (&shard->metrics_lock);
+    return (0);
+  }
+
+  copies = calloc ((size_t) c_avl_size (shard->metrics_tree) + 1,
+      sizeof (*copies));
+  to_be_deleted = calloc ((size_t) c_avl_size (shard->metrics_tree) + 1,
+      sizeof (*to_be_deleted));
+  if ((copies == NULL) || (to_be_deleted == NULL))
+  {
+    pthread_mutex_unlock (&shard->metrics_lock);
+    ERROR ("statsd plugin: calloc failed.");
+    sfree (copies);
+    sfree (to_be_deleted);
+    return (ENOMEM);
+  }
+
+  shard->memory = 0;
+  iter = c_avl_get_iterator (shard->metrics_tree);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &metric) == 0)
+  {
+    statsd_metric_copy_t *copy;
+
+    if ((metric->updates_num == 0)
+        && ((conf->delete_counters && (metric->type == STATSD_COUNTER))
+          || (conf->delete_timers && (metric->type == STATSD_TIMER))
+          || (conf->delete_gauges && (metric->type == STATSD_GAUGE))
+          || (conf->delete_sets && (metric->type == STATSD_SET))))
+    {
+      DEBUG ("statsd plugin: Deleting metric \"%s\".", key->name);
+      to_be_deleted[to_be_deleted_num] = metric;
+      to_be_deleted_num++;
+      continue;
+    }
+
+    /* Sets and latency counters are at their largest right before they are
+     * reset. */
+    shard->memory += sizeof (*metric) + key->name_len + 1;
+    if (metric->latency != NULL)
+      shard->memory += latency_counter_memory ();
+    if (metric->set != NULL)
+      shard->memory += STATSD_SET_MEMBER_MEMORY
+        * (size_t) c_avl_size (metric->set);
+
+    /* Metrics are only freed by this function, so the name stays valid after
+     * the lock has been released. */
+    copy = copies + copies_num;
+    copies_num++;
+    copy->name = key->name;
+    copy->metric = *metric;
+    copy->metric.set = NULL;
+
+    /* Reset the metric. The copy takes the timer's latency counter; a new
+     * one is created with the next event. */
+    if (metric->type == STATSD_TIMER)
+      metric->latency = NULL;
+    if (metric->type == STATSD_SET)
+    {
+      copy->metric.value = (metric->set == NULL)
+        ? 0.0 : (double) c_avl_size (metric->set);
+      statsd_metric_clear_set_unsafe (metric);
+    }
+    metric->updates_num = 0;
+  }
+  c_avl_iterator_destroy (iter);
+
+  for (i = 0; i < to_be_deleted_num; i++)
+  {
+    int status;
+
+    status = c_avl_remove (shard->metrics_tree, &to_be_deleted[i]->key,
+        (void *) &key, (void *) &metric);
+    if (status != 0)
+    {
+      ERROR ("stats plugin: c_avl_remove (\"%s\") failed with status %i.",
+          to_be_deleted[i]->key.name, status);
+      continue;
+    }
+
+    statsd_metric_free (metric);
+  }
+
+  pthread_mutex_unlock (&shard->metrics_lock);
+
+  sfree (to_be_deleted);
+
+  for (i = 0; i < copies_num; i++)
+  {
+    statsd_metric_submit (conf, copies[i].name, &copies[i].metric);
+    latency_counter_destroy (copies[i].metric.latency);
+  }
+  sfree (copies);
+
+  return (0);
+} /* }}} int statsd_read_shard */
+
+static int statsd_read (void) /* {{{ */
+{
   int thread_num = 0;
 
   DEBUG("statsd plugin: read: threads %zu", statsd_threads_num);
 
   for (thread_num = 0; thread_num < statsd_threads_num; thread_num++) {
     statsd_config_t *conf = statsd_threads[thread_num].conf;
+    size_t i;
 
-    pthread_mutex_lock (&conf->metrics_lock);
+    for (i = 0; i < STATSD_SHARDS; i++)
+      statsd_read_shard (conf, conf->shards + i);
+  }
 
-    if (conf->metrics_tree == NULL)
-      {
-        DEBUG("statsd plugin: meterics tree is empty");
-        pthread_mutex_unlock (&conf->metrics_lock);
-        return (0);
-      }
+  return (0);
+} /* }}} int statsd_read */
 
-    iter = c_avl_get_iterator (conf->metrics_tree);
-    while (c_avl_iterator_next (iter, (void *) &name, (void *) &metric) == 0)
-      {
-        if ((metric->updates_num == 0)
-            && ((conf->delete_counters && (metric->type == STATSD_COUNTER))
-                || (conf->delete_timers && (metric->type == STATSD_TIMER))
-                || (conf->delete_gauges && (metric->type == STATSD_GAUGE))
-                || (conf->delete_sets && (metric->type == STATSD_SET))))
-          {
-            DEBUG ("statsd plugin: Deleting metric \"%s\".", name);
-            strarray_add (&to_be_deleted, &to_be_deleted_num, name);
-            continue;
-          }
-
-        /* Names have a prefix, e.g. "c:", which determines the (statsd) type.
-         * Remove this here. */
-        statsd_metric_submit_unsafe (conf, name + 2, metric);
-
-        /* Reset the metric. */
-        metric->updates_num = 0;
-        if (metric->type == STATSD_SET)
-          statsd_metric_clear_set_unsafe (metric);
-      }
-    c_avl_iterator_destroy (iter);
-
-    for (i = 0; i < to_be_deleted_num; i++)
-      {
-        int status;
-
-        status = c_avl_remove (conf->metrics_tree, to_be_deleted[i],
-                               (void *) &name, (void *) &metric);
-        if (status != 0)
-          {
-            ERROR ("stats plugin: c_avl_remove (\"%s\") failed with status %i.",
-                   to_be_deleted[i], status);
-            continue;
-          }
-
-        sfree (name);
-        statsd_metric_free (metric);
-      }
+/* Reports the memory used by the metrics of all threads, as of their last
+ * read. */
+static int statsd_memory (size_t *ret_bytes) /* {{{ */
+{
+  size_t thread_num;
 
-    pthread_mutex_unlock (&conf->metrics_lock);
+  *ret_bytes = 0;
+  for (thread_num = 0; thread_num < statsd_threads_num; thread_num++) {
+    statsd_config_t *conf = statsd_threads[thread_num].conf;
+    size_t i;
 
-    strarray_free (to_be_deleted, to_be_deleted_num);
+    for (i = 0; i < STATSD_SHARDS; i++)
+    {
+      pthread_mutex_lock (&conf->shards[i].metrics_lock);
+      *ret_bytes += conf->shards[i].memory;
+      pthread_mutex_unlock (&conf->shards[i].metrics_lock);
+    }
   }
 
   return (0);
-} /* }}} int statsd_read */
+} /* }}} int statsd_memory */
 
 static int statsd_shutdown (void) /* {{{ */
 {
@@ -1190,8 +1473,12 @@ static int statsd_shutdown (void) /* {{{ */
          statsd_threads_num);
 
   for (i = 0; i < statsd_threads_num; i++) {
-    pthread_cancel (statsd_threads[i].thr);
-    pthread_join (statsd_threads[i].thr, /* retval = */ NULL);
+    size_t j;
+
+    for (j = 0; j < statsd_threads[i].thr_num; j++) {
+      pthread_cancel (statsd_threads[i].thr[j].thread);
+      pthread_join (statsd_threads[i].thr[j].thread, /* retval = */ NULL);
+    }
   }
 
   statsd_threads_free();
@@ -1204,6 +1491,7 @@ void module_register (void)
   plugin_register_complex_config ("statsd", statsd_config);
   plugin_register_init ("statsd", statsd_init);
   plugin_register_read ("statsd", statsd_read);
+  plugin_register_memory ("statsd", statsd_memory);
   plugin_register_shutdown ("statsd", statsd_shutdown);
 }
 
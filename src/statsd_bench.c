@@ -0,0 +1,207 @@
+/**
+ * collectd - src/statsd_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+
+/*
+ * Measures how fast the statsd plugin parses lines. The input is a captured
+ * statsd stream, one metric per line, e.g. recorded with
+ *
+ *   nc -u -l 8125 >capture.txt
+ *
+ * It is cut into datagrams of up to STATSD_BUFFER_SIZE bytes at line
+ * boundaries. Without a file, a generated stream is used.
+ *
+ * Usage: bench_plugin_statsd [file [passes]]
+ */
+
+#include "statsd.c" /* sic */
+
+/* The benchmark neither reads a configuration nor starts threads. */
+int cf_util_get_string (const oconfig_item_t *ci, char **ret_string)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_int (const oconfig_item_t *ci, int *ret_value)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_double (const oconfig_item_t *ci, double *ret_value)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_boolean (const oconfig_item_t *ci, _Bool *ret_bool)
+{
+  return (ENOTSUP);
+}
+
+int cf_util_get_service (const oconfig_item_t *ci, char **ret_string)
+{
+  return (ENOTSUP);
+}
+
+int plugin_thread_create (pthread_t *thread, const pthread_attr_t *attr,
+    void *(*start_routine) (void *), void *arg)
+{
+  return (ENOTSUP);
+}
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+static char *generate_stream (size_t *ret_size) /* {{{ */
+{
+  char const *types[] = {"c", "ms", "g", "c|@0.1", "s"};
+  size_t size = 0;
+  char *stream;
+  size_t i;
+
+  stream = malloc (1024 * 1024);
+  if (stream == NULL)
+    return (NULL);
+
+  for (i = 0; size < 1024 * 1024 - 128; i++)
+  {
+    size_t type = i % STATIC_ARRAY_SIZE (types);
+
+    size += (size_t) ssnprintf (stream + size, 1024 * 1024 - size,
+        "app.host%zu.%s.metric%zu:%zu|%s\n", i % 20,
+        (type == 4) ? "users" : "requests", i % 500, i % 97, types[type]);
+  }
+
+  *ret_size = size;
+  return (stream);
+} /* }}} char *generate_stream */
+
+static char *read_stream (char const *file, size_t *ret_size) /* {{{ */
+{
+  char *stream = NULL;
+  size_t size = 0;
+  FILE *fh;
+
+  fh = fopen (file, "r");
+  if (fh == NULL)
+    return (NULL);
+
+  while (!feof (fh) && !ferror (fh))
+  {
+    char *tmp = realloc (stream, size + 65536);
+    if (tmp == NULL)
+    {
+      sfree (stream);
+      fclose (fh);
+      return (NULL);
+    }
+    stream = tmp;
+    size += fread (stream + size, 1, 65536, fh);
+  }
+  fclose (fh);
+
+  *ret_size = size;
+  return (stream);
+} /* }}} char *read_stream */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  char buffer[STATSD_BUFFER_SIZE];
+  statsd_config_t *conf;
+  char *stream;
+  size_t stream_size = 0;
+  size_t passes = 20;
+  size_t lines_num = 0;
+  size_t datagrams_num = 0;
+  double start;
+  double elapsed;
+  size_t i;
+  size_t j;
+
+  if (argc > 2)
+    passes = (size_t) atoi (argv[2]);
+  if ((argc > 3) || (passes < 1))
+  {
+    fprintf (stderr, "Usage: %s [file [passes]]\n", argv[0]);
+    return (1);
+  }
+
+  if (argc > 1)
+    stream = read_stream (argv[1], &stream_size);
+  else
+    stream = generate_stream (&stream_size);
+  conf = statsd_config_alloc ();
+  if ((stream == NULL) || (conf == NULL))
+  {
+    fprintf (stderr, "Unable to read the stream.\n");
+    return (1);
+  }
+
+  for (i = 0; i < stream_size; i++)
+    if (stream[i] == '\n')
+      lines_num++;
+
+  start = now ();
+  for (i = 0; i < passes; i++)
+  {
+    size_t offset = 0;
+
+    while (offset < stream_size)
+    {
+      size_t size = stream_size - offset;
+
+      /* Cut at the last newline that fits, like a client would. */
+      if (size > sizeof (buffer) - 1)
+      {
+        size = sizeof (buffer) - 1;
+        while ((size > 1) && (stream[offset + size - 1] != '\n'))
+          size--;
+      }
+
+      memcpy (buffer, stream + offset, size);
+      buffer[size] = 0;
+      statsd_parse_buffer (conf, buffer, size);
+
+      offset += size;
+      datagrams_num++;
+    }
+  }
+  elapsed = now () - start;
+
+  for (j = 0; j < STATSD_SHARDS; j++)
+    printf ("# shard %2zu: %d metrics\n", j,
+        c_avl_size (conf->shards[j].metrics_tree));
+  printf ("%zu lines in %zu datagrams in %.3f s, %.1f ns per line\n",
+      passes * lines_num, datagrams_num, elapsed,
+      1e9 * elapsed / ((double) (passes * lines_num)));
+
+  statsd_config_free (conf);
+  sfree (stream);
+  return (0);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
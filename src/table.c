@@ -61,6 +61,13 @@ typedef struct {
 	size_t        results_num;
 
 	size_t max_colnum;
+
+	/* Whether a character is one of the separators. */
+	_Bool is_sep[256];
+
+	/* The contents of the file, reused between reads. */
+	char  *buffer;
+	size_t buffer_size;
 } tbl_t;
 
 static void tbl_result_setup (tbl_result_t *res)
@@ -101,6 +108,10 @@ static void tbl_setup (tbl_t *tbl, char *file)
 	tbl->results_num = 0;
 
 	tbl->max_colnum  = 0;
+
+	memset (tbl->is_sep, 0, sizeof (tbl->is_sep));
+	tbl->buffer      = NULL;
+	tbl->buffer_size = 0;
 } /* tbl_setup */
 
 static void tbl_clear (tbl_t *tbl)
@@ -117,6 +128,9 @@ static void tbl_clear (tbl_t *tbl)
 	tbl->results_num = 0;
 
 	tbl->max_colnum  = 0;
+
+	sfree (tbl->buffer);
+	tbl->buffer_size = 0;
 } /* tbl_clear */
 
 static tbl_t *tables;
@@ -286,7 +300,11 @@ static int tbl_config_table (oconfig_item_t *ci)
 		log_err ("Table \"%s\" does not specify any separator.", tbl->file);
 		status = 1;
 	} else {
+		char *ptr;
+
 		strunescape (tbl->sep, strlen (tbl->sep) + 1);
+		for (ptr = tbl->sep; *ptr != '\0'; ++ptr)
+			tbl->is_sep[(unsigned char) *ptr] = 1;
 	}
 
 	if (NULL == tbl->instance) {
@@ -439,22 +457,33 @@ static int tbl_result_dispatch (tbl_t *tbl, tbl_result_t *res,
 	return 0;
 } /* tbl_result_dispatch */
 
-static int tbl_parse_line (tbl_t *tbl, char *line, size_t len)
+/* Splits the line into columns in place, like strtok_r(3) with the separators
+ * as delimiters would, using a lookup table for the separators. Only the
+ * columns up to the highest one used by any result are split off. */
+static int tbl_parse_line (tbl_t *tbl, char *line)
 {
 	char *fields[tbl->max_colnum + 1];
-	char *ptr, *saveptr;
+	char *ptr;
 
 	size_t i;
 
 	i = 0;
 	ptr = line;
-	saveptr = NULL;
-	while (NULL != (fields[i] = strtok_r (ptr, tbl->sep, &saveptr))) {
-		ptr = NULL;
+	while (i <= tbl->max_colnum) {
+		while (('\0' != *ptr) && tbl->is_sep[(unsigned char) *ptr])
+			++ptr;
+		if ('\0' == *ptr)
+			break;
+
+		fields[i] = ptr;
 		++i;
 
-		if (i > tbl->max_colnum)
+		while (('\0' != *ptr) && !tbl->is_sep[(unsigned char) *ptr])
+			++ptr;
+		if ('\0' == *ptr)
 			break;
+		*ptr = '\0';
+		++ptr;
 	}
 
 	if (i <= tbl->max_colnum) {
@@ -473,41 +502,81 @@ static int tbl_parse_line (tbl_t *tbl, char *line, size_t len)
 	return 0;
 } /* tbl_parse_line */
 
-static int tbl_read_table (tbl_t *tbl)
+/* Reads the whole file into the buffer of the table, which grows as needed,
+ * so lines of any length are parsed in one piece. */
+static ssize_t tbl_read_file (tbl_t *tbl)
 {
-	FILE *fh;
-	char  buf[4096];
+	size_t fill = 0;
+	int fd;
 
-	fh = fopen (tbl->file, "r");
-	if (NULL == fh) {
+	fd = open (tbl->file, O_RDONLY);
+	if (fd < 0) {
 		char errbuf[1024];
 		log_err ("Failed to open file \"%s\": %s.", tbl->file,
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return -1;
 	}
 
-	buf[sizeof (buf) - 1] = '\0';
-	while (NULL != fgets (buf, sizeof (buf), fh)) {
-		if ('\0' != buf[sizeof (buf) - 1]) {
-			buf[sizeof (buf) - 1] = '\0';
-			log_warn ("Table %s: Truncated line: %s", tbl->file, buf);
+	while (42) {
+		ssize_t status;
+
+		if (fill + 1 >= tbl->buffer_size) {
+			size_t new_size = (0 == tbl->buffer_size)
+				? 4096 : 2 * tbl->buffer_size;
+			char *tmp;
+
+			tmp = realloc (tbl->buffer, new_size);
+			if (NULL == tmp) {
+				log_err ("realloc failed.");
+				close (fd);
+				return -1;
+			}
+			tbl->buffer = tmp;
+			tbl->buffer_size = new_size;
 		}
 
-		if (0 != tbl_parse_line (tbl, buf, sizeof (buf))) {
-			log_warn ("Table %s: Failed to parse line: %s", tbl->file, buf);
+		status = read (fd, tbl->buffer + fill, tbl->buffer_size - fill - 1);
+		if ((status < 0) && (EINTR == errno))
 			continue;
+		else if (status < 0) {
+			char errbuf[1024];
+			log_err ("Failed to read from file \"%s\": %s.", tbl->file,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (fd);
+			return -1;
 		}
+		else if (0 == status)
+			break;
+
+		fill += (size_t) status;
 	}
 
-	if (0 != ferror (fh)) {
-		char errbuf[1024];
-		log_err ("Failed to read from file \"%s\": %s.", tbl->file,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fh);
+	close (fd);
+	tbl->buffer[fill] = '\0';
+	return (ssize_t) fill;
+} /* tbl_read_file */
+
+static int tbl_read_table (tbl_t *tbl)
+{
+	char *line;
+	char *next;
+
+	if (tbl_read_file (tbl) < 0)
 		return -1;
+
+	for (line = tbl->buffer; '\0' != *line; line = next) {
+		next = strchr (line, '\n');
+		if (NULL == next)
+			next = line + strlen (line);
+		else
+			*next++ = '\0';
+
+		if (0 != tbl_parse_line (tbl, line)) {
+			log_warn ("Table %s: Failed to parse line: %s", tbl->file, line);
+			continue;
+		}
 	}
 
-	fclose (fh);
 	return 0;
 } /* tbl_read_table */
 
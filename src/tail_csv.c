@@ -32,6 +32,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Longest line that is parsed in one piece. Longer lines are split. */
+#define TCSV_LINE_SIZE 16384
+
 struct metric_definition_s {
     char   *name;
     char   *type;
@@ -46,10 +49,15 @@ struct instance_definition_s {
     char                 *instance;
     char                 *path;
     cu_tail_t            *tail;
+    _Bool                 follow;
     metric_definition_t **metric_list;
     size_t                metric_list_len;
     cdtime_t              interval;
     ssize_t               time_from;
+    /* Fields the lines are split into; only as many as the highest
+     * configured column needs. */
+    char                **fields;
+    size_t                fields_size;
     struct instance_definition_s *next;
 };
 typedef struct instance_definition_s instance_definition_t;
@@ -136,13 +144,37 @@ static _Bool tcsv_check_index (ssize_t index, size_t fields_num, char const *nam
     return (0);
 }
 
-static int tcsv_read_buffer (instance_definition_t *id,
+/* Splits `buffer' at commas into `id->fields' in place. Splitting stops after
+ * the last field needed by the configuration, so the remaining columns of
+ * wide lines aren't looked at. Returns the number of fields split off. */
+static size_t tcsv_split (instance_definition_t *id,
         char *buffer, size_t buffer_size)
 {
-    char **metrics;
-    size_t metrics_num;
+    char *ptr = buffer;
+    char *end = buffer + buffer_size;
+    size_t fields_num = 0;
+
+    while (fields_num < id->fields_size) {
+        char *comma;
+
+        id->fields[fields_num] = ptr;
+        fields_num++;
+
+        comma = memchr (ptr, ',', (size_t) (end - ptr));
+        if (comma == NULL)
+            break;
+
+        *comma = 0;
+        ptr = comma + 1;
+    }
+
+    return (fields_num);
+}
 
-    char *ptr;
+static int tcsv_read_buffer (instance_definition_t *id,
+        char *buffer, size_t buffer_size)
+{
+    size_t fields_num;
     size_t i;
 
     /* Remove newlines at the end of line. */
@@ -160,52 +192,33 @@ static int tcsv_read_buffer (instance_definition_t *id,
     if ((buffer_size == 0) || (buffer[0] == '#'))
         return (0);
 
-    /* Count the number of fields. */
-    metrics_num = 1;
-    for (i = 0; i < buffer_size; i++) {
-        if (buffer[i] == ',')
-            metrics_num++;
-    }
+    fields_num = tcsv_split (id, buffer, buffer_size);
 
-    if (metrics_num == 1) {
+    /* A line without any comma. */
+    if ((fields_num == 1) && (strlen (buffer) == buffer_size)) {
         ERROR("tail_csv plugin: last line of `%s' does not contain "
                 "enough values.", id->path);
         return (-1);
     }
 
-    /* Create a list of all values */
-    metrics = calloc (metrics_num, sizeof (*metrics));
-    if (metrics == NULL) {
-        ERROR ("tail_csv plugin: calloc failed.");
-        return (ENOMEM);
-    }
-
-    ptr = buffer;
-    metrics[0] = ptr;
-    i = 1;
-    for (ptr = buffer; *ptr != 0; ptr++) {
-        if (*ptr != ',')
-            continue;
-
-        *ptr = 0;
-        metrics[i] = ptr + 1;
-        i++;
-    }
-    assert (i == metrics_num);
-
     /* Register values */
     for (i = 0; i < id->metric_list_len; ++i){
         metric_definition_t *md = id->metric_list[i];
 
-        if (!tcsv_check_index (md->value_from, metrics_num, md->name)
-                || !tcsv_check_index (id->time_from, metrics_num, md->name))
+        if (!tcsv_check_index (md->value_from, fields_num, md->name)
+                || !tcsv_check_index (id->time_from, fields_num, md->name))
             continue;
 
-        tcsv_read_metric (id, md, metrics, metrics_num);
+        tcsv_read_metric (id, md, id->fields, fields_num);
     }
 
-    /* Free up resources */
-    sfree (metrics);
+    return (0);
+}
+
+static int tcsv_tail_callback (void *data, char *buf,
+        int __attribute__((unused)) buflen)
+{
+    tcsv_read_buffer (data, buf, strlen (buf));
     return (0);
 }
 
@@ -224,25 +237,30 @@ static int tcsv_read (user_data_t *ud) {
         }
     }
 
-    while (42)
+    /* Let the tail thread read the file as lines are appended. If that isn't
+     * possible, read the file here. */
+    if (!id->follow
+            && (cu_tail_follow (id->tail, TCSV_LINE_SIZE,
+                    tcsv_tail_callback, id) == 0))
+        id->follow = 1;
+
+    if (id->follow)
+        return (0);
+
+    /* Lines are handed to the callback in place, the buffer is only needed
+     * for lines longer than it. */
     {
-        char buffer[1024];
-        size_t buffer_len;
+        char buffer[TCSV_LINE_SIZE];
         int status;
 
-        status = cu_tail_readline (id->tail, buffer, (int) sizeof (buffer));
+        status = cu_tail_read (id->tail, buffer, (int) sizeof (buffer),
+                tcsv_tail_callback, id);
         if (status != 0)
         {
-            ERROR ("tail_csv plugin: File \"%s\": cu_tail_readline failed "
+            ERROR ("tail_csv plugin: File \"%s\": cu_tail_read failed "
                     "with status %i.", id->path, status);
             return (-1);
         }
-
-        buffer_len = strlen (buffer);
-        if (buffer_len == 0)
-            break;
-
-        tcsv_read_buffer (id, buffer, buffer_len);
     }
 
     return (0);
@@ -369,6 +387,7 @@ static void tcsv_instance_definition_destroy(void *arg){
     sfree(id->instance);
     sfree(id->path);
     sfree(id->metric_list);
+    sfree(id->fields);
     sfree(id);
 }
 
@@ -478,6 +497,21 @@ static int tcsv_config_add_file(oconfig_item_t *ci)
         status = -1;
    }
 
+    if (status == 0) {
+        ssize_t max_index = id->time_from;
+
+        for (i = 0; i < (int) id->metric_list_len; i++)
+            if (id->metric_list[i]->value_from > max_index)
+                max_index = id->metric_list[i]->value_from;
+
+        id->fields_size = (max_index < 0) ? 1 : (size_t) max_index + 1;
+        id->fields = calloc (id->fields_size, sizeof (*id->fields));
+        if (id->fields == NULL) {
+            ERROR ("tail_csv plugin: calloc failed.");
+            status = -1;
+        }
+    }
+
     if (status != 0){
         tcsv_instance_definition_destroy(id);
         return (-1);
@@ -27,21 +27,50 @@
 #include "collectd.h"
 #include "common.h"
 #include "filter_chain.h"
-#include "utils_subst.h"
+#include "utils_intern.h"
 
+#include <pthread.h>
 #include <regex.h>
 
+#define TR_CACHE_SIZE_DEFAULT 4096
+
+/* Regular expressions that are a plain string, optionally anchored at one or
+ * both ends, are matched with memcmp(3) and strstr(3). */
+#define TR_MATCH_REGEX     0
+#define TR_MATCH_SUBSTRING 1
+#define TR_MATCH_PREFIX    2
+#define TR_MATCH_SUFFIX    3
+#define TR_MATCH_EXACT     4
+
 struct tr_action_s;
 typedef struct tr_action_s tr_action_t;
 struct tr_action_s
 {
   regex_t re;
   char *replacement;
+  size_t replacement_len;
   int may_be_empty;
 
+  int match;
+  char *literal;
+  size_t literal_len;
+
   tr_action_t *next;
 };
 
+/* Remembers the result of the actions for an input identifier. */
+struct tr_cache_entry_s;
+typedef struct tr_cache_entry_s tr_cache_entry_t;
+struct tr_cache_entry_s
+{
+  identifier_t id;
+  identifier_t result;
+
+  tr_cache_entry_t *hash_next;
+  tr_cache_entry_t *lru_prev;
+  tr_cache_entry_t *lru_next;
+};
+
 struct tr_data_s
 {
   tr_action_t *host;
@@ -49,6 +78,15 @@ struct tr_data_s
   tr_action_t *plugin_instance;
   /* tr_action_t *type; */
   tr_action_t *type_instance;
+
+  pthread_mutex_t cache_lock;
+  tr_cache_entry_t **buckets;
+  size_t buckets_num;
+  size_t entries_num;
+  size_t entries_max;
+  /* Most recently used first. */
+  tr_cache_entry_t *lru_head;
+  tr_cache_entry_t *lru_tail;
 };
 typedef struct tr_data_s tr_data_t;
 
@@ -77,6 +115,7 @@ static void tr_action_destroy (tr_action_t *act) /* {{{ */
 
   regfree (&act->re);
   sfree (act->replacement);
+  sfree (act->literal);
 
   if (act->next != NULL)
     tr_action_destroy (act->next);
@@ -84,6 +123,76 @@ static void tr_action_destroy (tr_action_t *act) /* {{{ */
   sfree (act);
 } /* }}} void tr_action_destroy */
 
+/* Sets up the fast path if `regex' only matches one literal string. */
+static int tr_action_set_literal (tr_action_t *act, /* {{{ */
+    const char *regex)
+{
+  const char *metachars = ".[]()*+?{}|^$\\";
+  size_t regex_len = strlen (regex);
+  _Bool anchor_begin = 0;
+  _Bool anchor_end = 0;
+  size_t len = 0;
+  size_t i;
+
+  act->match = TR_MATCH_REGEX;
+
+  if ((regex_len > 0) && (regex[0] == '^'))
+  {
+    anchor_begin = 1;
+    regex++;
+    regex_len--;
+  }
+  /* An escaped dollar sign at the end is a literal. */
+  if ((regex_len > 0) && (regex[regex_len - 1] == '$')
+      && ((regex_len < 2) || (regex[regex_len - 2] != '\\')))
+  {
+    anchor_end = 1;
+    regex_len--;
+  }
+
+  act->literal = malloc (regex_len + 1);
+  if (act->literal == NULL)
+    return (-ENOMEM);
+
+  for (i = 0; i < regex_len; i++)
+  {
+    char c = regex[i];
+
+    /* Other escapes, like "\<" and "\w", are regex operators. */
+    if (c == '\\')
+    {
+      i++;
+      if ((i >= regex_len) || (strchr (metachars, regex[i]) == NULL))
+        break;
+      c = regex[i];
+    }
+    else if (strchr (metachars, c) != NULL)
+      break;
+
+    act->literal[len] = c;
+    len++;
+  }
+
+  if ((i < regex_len) || (len == 0))
+  {
+    sfree (act->literal);
+    return (0);
+  }
+
+  act->literal[len] = 0;
+  act->literal_len = len;
+  if (anchor_begin && anchor_end)
+    act->match = TR_MATCH_EXACT;
+  else if (anchor_begin)
+    act->match = TR_MATCH_PREFIX;
+  else if (anchor_end)
+    act->match = TR_MATCH_SUFFIX;
+  else
+    act->match = TR_MATCH_SUBSTRING;
+
+  return (0);
+} /* }}} int tr_action_set_literal */
+
 static int tr_config_add_action (tr_action_t **dest, /* {{{ */
     const oconfig_item_t *ci, int may_be_empty)
 {
@@ -127,13 +236,16 @@ static int tr_config_add_action (tr_action_t **dest, /* {{{ */
   }
 
   act->replacement = tr_strdup (ci->values[1].value.string);
-  if (act->replacement == NULL)
+  if ((act->replacement == NULL)
+      || (tr_action_set_literal (act, ci->values[0].value.string) != 0))
   {
     ERROR ("tr_config_add_action: tr_strdup failed.");
     regfree (&act->re);
+    sfree (act->replacement);
     sfree (act);
     return (-ENOMEM);
   }
+  act->replacement_len = strlen (act->replacement);
 
   /* Insert action at end of list. */
   if (*dest == NULL)
@@ -152,53 +264,110 @@ static int tr_config_add_action (tr_action_t **dest, /* {{{ */
   return (0);
 } /* }}} int tr_config_add_action */
 
+/* Replaces the bytes from `off1' to `off2' in `buffer' with the replacement
+ * of `act', truncating the result like subst() does. */
+static void tr_action_replace (tr_action_t *act, /* {{{ */
+    char *buffer, size_t buffer_size, size_t off1, size_t off2)
+{
+  size_t replacement_len = act->replacement_len;
+  size_t back_len = strlen (buffer + off2);
+
+  if ((off1 + replacement_len) >= buffer_size)
+  {
+    replacement_len = buffer_size - (off1 + 1);
+    back_len = 0;
+  }
+  else if ((off1 + replacement_len + back_len) >= buffer_size)
+    back_len = buffer_size - (off1 + replacement_len + 1);
+
+  memmove (buffer + off1 + replacement_len, buffer + off2, back_len);
+  memcpy (buffer + off1, act->replacement, replacement_len);
+  buffer[off1 + replacement_len + back_len] = 0;
+} /* }}} void tr_action_replace */
+
+/* Looks for the first match of `act' in `buffer'. Returns zero and the offsets
+ * of the match if found. */
+static int tr_action_match (tr_action_t *act, const char *buffer, /* {{{ */
+    size_t *ret_off1, size_t *ret_off2)
+{
+  size_t buffer_len;
+  const char *pos;
+  regmatch_t matches[1];
+  int status;
+
+  switch (act->match)
+  {
+    case TR_MATCH_SUBSTRING:
+      pos = strstr (buffer, act->literal);
+      if (pos == NULL)
+        return (-1);
+      *ret_off1 = (size_t) (pos - buffer);
+      *ret_off2 = *ret_off1 + act->literal_len;
+      return (0);
+
+    case TR_MATCH_PREFIX:
+      if (strncmp (buffer, act->literal, act->literal_len) != 0)
+        return (-1);
+      *ret_off1 = 0;
+      *ret_off2 = act->literal_len;
+      return (0);
+
+    case TR_MATCH_SUFFIX:
+    case TR_MATCH_EXACT:
+      buffer_len = strlen (buffer);
+      if ((buffer_len < act->literal_len)
+          || ((act->match == TR_MATCH_EXACT)
+            && (buffer_len != act->literal_len))
+          || (memcmp (buffer + buffer_len - act->literal_len, act->literal,
+              act->literal_len) != 0))
+        return (-1);
+      *ret_off1 = buffer_len - act->literal_len;
+      *ret_off2 = buffer_len;
+      return (0);
+  }
+
+  status = regexec (&act->re, buffer,
+      STATIC_ARRAY_SIZE (matches), matches,
+      /* flags = */ 0);
+  if (status == REG_NOMATCH)
+    return (-1);
+  else if (status != 0)
+  {
+    char errbuf[1024] = "";
+
+    regerror (status, &act->re, errbuf, sizeof (errbuf));
+    ERROR ("Target `replace': Executing a regular expression failed: %s.",
+        errbuf);
+    return (-1);
+  }
+
+  *ret_off1 = (size_t) matches[0].rm_so;
+  *ret_off2 = (size_t) matches[0].rm_eo;
+  return (0);
+} /* }}} int tr_action_match */
+
 static int tr_action_invoke (tr_action_t *act_head, /* {{{ */
     char *buffer_in, size_t buffer_in_size, int may_be_empty)
 {
   tr_action_t *act;
-  int status;
   char buffer[DATA_MAX_NAME_LEN];
-  regmatch_t matches[8];
 
   if (act_head == NULL)
     return (-EINVAL);
 
   sstrncpy (buffer, buffer_in, sizeof (buffer));
-  memset (matches, 0, sizeof (matches));
 
   DEBUG ("target_replace plugin: tr_action_invoke: <- buffer = %s;", buffer);
 
   for (act = act_head; act != NULL; act = act->next)
   {
-    char temp[DATA_MAX_NAME_LEN];
-    char *subst_status;
+    size_t off1 = 0;
+    size_t off2 = 0;
 
-    status = regexec (&act->re, buffer,
-        STATIC_ARRAY_SIZE (matches), matches,
-        /* flags = */ 0);
-    if (status == REG_NOMATCH)
+    if (tr_action_match (act, buffer, &off1, &off2) != 0)
       continue;
-    else if (status != 0)
-    {
-      char errbuf[1024] = "";
 
-      regerror (status, &act->re, errbuf, sizeof (errbuf));
-      ERROR ("Target `replace': Executing a regular expression failed: %s.",
-          errbuf);
-      continue;
-    }
-
-    subst_status = subst (temp, sizeof (temp), buffer,
-        (size_t) matches[0].rm_so, (size_t) matches[0].rm_eo, act->replacement);
-    if (subst_status == NULL)
-    {
-      ERROR ("Target `replace': subst (buffer = %s, start = %zu, end = %zu, "
-          "replacement = %s) failed.",
-          buffer, (size_t) matches[0].rm_so, (size_t) matches[0].rm_eo,
-          act->replacement);
-      continue;
-    }
-    sstrncpy (buffer, temp, sizeof (buffer));
+    tr_action_replace (act, buffer, sizeof (buffer), off1, off2);
 
     DEBUG ("target_replace plugin: tr_action_invoke: -- buffer = %s;", buffer);
   } /* for (act = act_head; act != NULL; act = act->next) */
@@ -216,6 +385,148 @@ static int tr_action_invoke (tr_action_t *act_head, /* {{{ */
   return (0);
 } /* }}} int tr_action_invoke */
 
+static void tr_cache_entry_free (tr_cache_entry_t *e) /* {{{ */
+{
+  if (e == NULL)
+    return;
+
+  identifier_destroy (&e->id);
+  identifier_destroy (&e->result);
+  sfree (e);
+} /* }}} void tr_cache_entry_free */
+
+/* NOTE: You must hold data->cache_lock when calling this function! */
+static void tr_cache_unlink (tr_data_t *data, tr_cache_entry_t *e) /* {{{ */
+{
+  tr_cache_entry_t **ptr;
+
+  for (ptr = data->buckets + (e->id.hash & (data->buckets_num - 1));
+      *ptr != e; ptr = &(*ptr)->hash_next)
+    assert (*ptr != NULL);
+  *ptr = e->hash_next;
+
+  if (e->lru_prev != NULL)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    data->lru_head = e->lru_next;
+  if (e->lru_next != NULL)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    data->lru_tail = e->lru_prev;
+
+  data->entries_num--;
+} /* }}} void tr_cache_unlink */
+
+/* Replaces the identifier of `vl' with the cached result, if any. Returns
+ * zero on a cache hit. */
+static int tr_cache_get (tr_data_t *data, value_list_t *vl, /* {{{ */
+    uint32_t hash)
+{
+  tr_cache_entry_t *e;
+
+  if (data->buckets == NULL)
+    return (-1);
+
+  pthread_mutex_lock (&data->cache_lock);
+  for (e = data->buckets[hash & (data->buckets_num - 1)];
+      e != NULL; e = e->hash_next)
+    if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+      break;
+
+  if (e == NULL)
+  {
+    pthread_mutex_unlock (&data->cache_lock);
+    return (-1);
+  }
+
+  /* Move to the front of the LRU list. */
+  if (e->lru_prev != NULL)
+  {
+    e->lru_prev->lru_next = e->lru_next;
+    if (e->lru_next != NULL)
+      e->lru_next->lru_prev = e->lru_prev;
+    else
+      data->lru_tail = e->lru_prev;
+
+    e->lru_prev = NULL;
+    e->lru_next = data->lru_head;
+    data->lru_head->lru_prev = e;
+    data->lru_head = e;
+  }
+
+  identifier_to_vl (&e->result, vl);
+  pthread_mutex_unlock (&data->cache_lock);
+
+  return (0);
+} /* }}} int tr_cache_get */
+
+/* Remembers that the identifier of `orig' is replaced with that of `vl',
+ * evicting the least recently used entry if necessary. */
+static void tr_cache_put (tr_data_t *data, /* {{{ */
+    value_list_t const *orig, value_list_t const *vl, uint32_t hash)
+{
+  tr_cache_entry_t *e;
+  size_t bucket;
+
+  if (data->buckets == NULL)
+    return;
+
+  e = calloc (1, sizeof (*e));
+  if (e == NULL)
+    return;
+  if (identifier_create (&e->id, orig) != 0)
+  {
+    sfree (e);
+    return;
+  }
+  if (identifier_create (&e->result, vl) != 0)
+  {
+    identifier_destroy (&e->id);
+    sfree (e);
+    return;
+  }
+  assert (e->id.hash == hash);
+
+  pthread_mutex_lock (&data->cache_lock);
+
+  /* Another thread may have added the identifier in the meantime. */
+  bucket = hash & (data->buckets_num - 1);
+  {
+    tr_cache_entry_t *other;
+
+    for (other = data->buckets[bucket]; other != NULL;
+        other = other->hash_next)
+      if ((other->id.hash == hash) && identifier_equal_vl (&other->id, orig))
+        break;
+    if (other != NULL)
+    {
+      pthread_mutex_unlock (&data->cache_lock);
+      tr_cache_entry_free (e);
+      return;
+    }
+  }
+
+  if (data->entries_num >= data->entries_max)
+  {
+    tr_cache_entry_t *oldest = data->lru_tail;
+
+    tr_cache_unlink (data, oldest);
+    tr_cache_entry_free (oldest);
+  }
+
+  e->hash_next = data->buckets[bucket];
+  data->buckets[bucket] = e;
+  e->lru_next = data->lru_head;
+  if (data->lru_head != NULL)
+    data->lru_head->lru_prev = e;
+  else
+    data->lru_tail = e;
+  data->lru_head = e;
+  data->entries_num++;
+
+  pthread_mutex_unlock (&data->cache_lock);
+} /* }}} void tr_cache_put */
+
 static int tr_destroy (void **user_data) /* {{{ */
 {
   tr_data_t *data;
@@ -232,6 +543,17 @@ static int tr_destroy (void **user_data) /* {{{ */
   tr_action_destroy (data->plugin_instance);
   /* tr_action_destroy (data->type); */
   tr_action_destroy (data->type_instance);
+
+  while (data->lru_head != NULL)
+  {
+    tr_cache_entry_t *e = data->lru_head;
+
+    tr_cache_unlink (data, e);
+    tr_cache_entry_free (e);
+  }
+  sfree (data->buckets);
+  pthread_mutex_destroy (&data->cache_lock);
+
   sfree (data);
 
   return (0);
@@ -256,6 +578,9 @@ static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
   /* data->type = NULL; */
   data->type_instance = NULL;
 
+  pthread_mutex_init (&data->cache_lock, /* attr = */ NULL);
+  data->entries_max = TR_CACHE_SIZE_DEFAULT;
+
   status = 0;
   for (i = 0; i < ci->children_num; i++)
   {
@@ -279,6 +604,19 @@ static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
     else if (strcasecmp ("TypeInstance", child->key) == 0)
       status = tr_config_add_action (&data->type_instance, child,
           /* may be empty = */ 1);
+    else if (strcasecmp ("CacheSize", child->key) == 0)
+    {
+      int tmp = -1;
+
+      status = cf_util_get_int (child, &tmp);
+      if ((status == 0) && (tmp < 0))
+      {
+        ERROR ("Target `replace': `CacheSize' must not be negative.");
+        status = -1;
+      }
+      else if (status == 0)
+        data->entries_max = (size_t) tmp;
+    }
     else
     {
       ERROR ("Target `replace': The `%s' configuration option is not understood "
@@ -307,6 +645,20 @@ static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
     break;
   }
 
+  if ((status == 0) && (data->entries_max > 0))
+  {
+    data->buckets_num = 1;
+    while (data->buckets_num < data->entries_max)
+      data->buckets_num *= 2;
+
+    data->buckets = calloc (data->buckets_num, sizeof (*data->buckets));
+    if (data->buckets == NULL)
+    {
+      ERROR ("tr_create: calloc failed.");
+      status = -ENOMEM;
+    }
+  }
+
   if (status != 0)
   {
     tr_destroy ((void *) &data);
@@ -321,6 +673,8 @@ static int tr_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
     notification_meta_t __attribute__((unused)) **meta, void **user_data)
 {
   tr_data_t *data;
+  value_list_t orig;
+  uint32_t hash = 0;
 
   if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
     return (-EINVAL);
@@ -332,6 +686,16 @@ static int tr_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
     return (-EINVAL);
   }
 
+  /* The result only depends on the identifier, so identifiers seen before
+   * are rewritten without matching again. */
+  if (data->buckets != NULL)
+  {
+    hash = identifier_hash_vl (vl);
+    if (tr_cache_get (data, vl, hash) == 0)
+      return (FC_TARGET_CONTINUE);
+    memcpy (&orig, vl, sizeof (orig));
+  }
+
 #define HANDLE_FIELD(f,e) \
   if (data->f != NULL) \
     tr_action_invoke (data->f, vl->f, sizeof (vl->f), e)
@@ -341,6 +705,9 @@ static int tr_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
   /* HANDLE_FIELD (type); */
   HANDLE_FIELD (type_instance, 1);
 
+  if (data->buckets != NULL)
+    tr_cache_put (data, &orig, vl, hash);
+
   return (FC_TARGET_CONTINUE);
 } /* }}} int tr_invoke */
 
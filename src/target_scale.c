@@ -44,6 +44,8 @@ static int ts_invoke_counter (const data_set_t *ds, value_list_t *vl, /* {{{ */
 		ts_data_t *data, int dsrc_index)
 {
 	uint64_t curr_counter;
+	uc_entry_t *entry;
+	meta_data_t *meta;
 	int status;
 	int failure;
 
@@ -71,19 +73,22 @@ static int ts_invoke_counter (const data_set_t *ds, value_list_t *vl, /* {{{ */
 	int_counter = 0;
 	int_fraction = 0.0;
 
-	/* Query the meta data */
+	/* Query the meta data, looking up the cache entry only once. The entry
+	 * stays locked until it is updated below. */
+	entry = uc_acquire (ds, vl);
+	meta = uc_entry_meta (entry);
 	failure = 0;
 
-	status = uc_meta_data_get_unsigned_int (vl, key_prev_counter,
+	status = meta_data_get_unsigned_int (meta, key_prev_counter,
 			&prev_counter);
 	if (status != 0)
 		failure++;
 
-	status = uc_meta_data_get_unsigned_int (vl, key_int_counter, &int_counter);
+	status = meta_data_get_unsigned_int (meta, key_int_counter, &int_counter);
 	if (status != 0)
 		failure++;
 
-	status = uc_meta_data_get_double (vl, key_int_fraction, &int_fraction);
+	status = meta_data_get_double (meta, key_int_fraction, &int_fraction);
 	if (status != 0)
 		failure++;
 
@@ -123,10 +128,10 @@ static int ts_invoke_counter (const data_set_t *ds, value_list_t *vl, /* {{{ */
 	vl->values[dsrc_index].counter = (counter_t) int_counter;
 
 	/* Update to the new counter value */
-	uc_meta_data_add_unsigned_int (vl, key_prev_counter, curr_counter);
-	uc_meta_data_add_unsigned_int (vl, key_int_counter, int_counter);
-	uc_meta_data_add_double (vl, key_int_fraction, int_fraction);
-
+	meta_data_add_unsigned_int (meta, key_prev_counter, curr_counter);
+	meta_data_add_unsigned_int (meta, key_int_counter, int_counter);
+	meta_data_add_double (meta, key_int_fraction, int_fraction);
+	uc_release (entry);
 
 	return (0);
 } /* }}} int ts_invoke_counter */
@@ -146,6 +151,8 @@ static int ts_invoke_derive (const data_set_t *ds, value_list_t *vl, /* {{{ */
 		ts_data_t *data, int dsrc_index)
 {
 	int64_t curr_derive;
+	uc_entry_t *entry;
+	meta_data_t *meta;
 	int status;
 	int failure;
 
@@ -174,18 +181,20 @@ static int ts_invoke_derive (const data_set_t *ds, value_list_t *vl, /* {{{ */
 	int_fraction = 0.0;
 
 	/* Query the meta data */
+	entry = uc_acquire (ds, vl);
+	meta = uc_entry_meta (entry);
 	failure = 0;
 
-	status = uc_meta_data_get_signed_int (vl, key_prev_derive,
+	status = meta_data_get_signed_int (meta, key_prev_derive,
 			&prev_derive);
 	if (status != 0)
 		failure++;
 
-	status = uc_meta_data_get_signed_int (vl, key_int_derive, &int_derive);
+	status = meta_data_get_signed_int (meta, key_int_derive, &int_derive);
 	if (status != 0)
 		failure++;
 
-	status = uc_meta_data_get_double (vl, key_int_fraction, &int_fraction);
+	status = meta_data_get_double (meta, key_int_fraction, &int_fraction);
 	if (status != 0)
 		failure++;
 
@@ -229,9 +238,10 @@ static int ts_invoke_derive (const data_set_t *ds, value_list_t *vl, /* {{{ */
 	vl->values[dsrc_index].derive = (derive_t) int_derive;
 
 	/* Update to the new derive value */
-	uc_meta_data_add_signed_int (vl, key_prev_derive, curr_derive);
-	uc_meta_data_add_signed_int (vl, key_int_derive, int_derive);
-	uc_meta_data_add_double (vl, key_int_fraction, int_fraction);
+	meta_data_add_signed_int (meta, key_prev_derive, curr_derive);
+	meta_data_add_signed_int (meta, key_int_derive, int_derive);
+	meta_data_add_double (meta, key_int_fraction, int_fraction);
+	uc_release (entry);
 
 	return (0);
 } /* }}} int ts_invoke_derive */
@@ -241,6 +251,8 @@ static int ts_invoke_absolute (const data_set_t *ds, value_list_t *vl, /* {{{ */
 {
 	uint64_t curr_absolute;
 	double rate;
+	uc_entry_t *entry;
+	meta_data_t *meta;
 	int status;
 
 	/* Required meta data */
@@ -256,7 +268,9 @@ static int ts_invoke_absolute (const data_set_t *ds, value_list_t *vl, /* {{{ */
 	int_fraction = 0.0;
 
 	/* Query the meta data */
-	status = uc_meta_data_get_double (vl, key_int_fraction, &int_fraction);
+	entry = uc_acquire (ds, vl);
+	meta = uc_entry_meta (entry);
+	status = meta_data_get_double (meta, key_int_fraction, &int_fraction);
 	if (status != 0)
 		int_fraction = 0.0;
 
@@ -276,7 +290,8 @@ static int ts_invoke_absolute (const data_set_t *ds, value_list_t *vl, /* {{{ */
 	vl->values[dsrc_index].absolute = (absolute_t) curr_absolute;
 
 	/* Update to the new absolute value */
-	uc_meta_data_add_double (vl, key_int_fraction, int_fraction);
+	meta_data_add_double (meta, key_int_fraction, int_fraction);
+	uc_release (entry);
 
 	return (0);
 } /* }}} int ts_invoke_absolute */
@@ -75,6 +75,9 @@
 #if HAVE_LINUX_INET_DIAG_H
 # include <linux/inet_diag.h>
 #endif
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+# include <linux/sock_diag.h>
+#endif
 # include <arpa/inet.h>
 /* #endif KERNEL_LINUX */
 
@@ -132,7 +135,15 @@
 #endif /* KERNEL_AIX */
 
 #if KERNEL_LINUX
-#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+/* A sock_diag request, optionally followed by an INET_DIAG_REQ_BYTECODE
+ * attribute holding the filter. */
+struct nlreq_v2 {
+  struct nlmsghdr nlh;
+  struct inet_diag_req_v2 r;
+  struct nlattr bc;
+};
+#elif HAVE_STRUCT_LINUX_INET_DIAG_REQ
 struct nlreq {
   struct nlmsghdr nlh;
   struct inet_diag_req r;
@@ -276,13 +287,18 @@ static port_entry_t *port_list_head = NULL;
 static uint32_t count_total[TCP_STATE_MAX + 1];
 
 #if KERNEL_LINUX
-#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ || HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
 /* This depends on linux inet_diag_req because if this structure is missing,
  * sequence_number is useless and we get a compilation warning.
  */
 static uint32_t sequence_number = 0;
 #endif
 
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+/* The netlink socket is kept open between reads. */
+static int diag_fd = -1;
+#endif
+
 static enum
 {
   SRC_DUNNO,
@@ -479,6 +495,290 @@ static int conn_handle_ports (uint16_t port_local, uint16_t port_remote, uint8_t
 } /* int conn_handle_ports */
 
 #if KERNEL_LINUX
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+/* Each port of the kernel side filter is matched by "port >= x && port <= x"
+ * followed by a jump to the end of the program, i.e. five operations. Longer
+ * filters are not worth it, all sockets are dumped instead. */
+#define CONN_BC_TERM_OPS 5
+#define CONN_BC_TERMS_MAX 1024
+
+static _Bool conn_want_local (port_entry_t const *pe) /* {{{ */
+{
+  if (pe->flags & PORT_COLLECT_LOCAL)
+    return (1);
+  return ((port_collect_listening != 0) && (pe->flags & PORT_IS_LISTENING));
+} /* }}} _Bool conn_want_local */
+
+static size_t conn_bc_terms_num (void) /* {{{ */
+{
+  port_entry_t *pe;
+  size_t num = 0;
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if (conn_want_local (pe))
+      num++;
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      num++;
+  }
+
+  return (num);
+} /* }}} size_t conn_bc_terms_num */
+
+/* Writes the term matching "port" at operation "index" of a program with
+ * "ops_num" operations. A term that doesn't match continues with the next
+ * term; the last one jumps past the end of the program, which rejects the
+ * socket. A matching term jumps to the end, which accepts it. */
+static void conn_bc_term (struct inet_diag_bc_op *bc, /* {{{ */
+    size_t index, size_t ops_num, _Bool local, uint16_t port)
+{
+  struct inet_diag_bc_op *op = bc + index;
+  size_t size = sizeof (*op);
+  _Bool last = ((index + CONN_BC_TERM_OPS) == ops_num);
+
+  op[0].code = local ? INET_DIAG_BC_S_GE : INET_DIAG_BC_D_GE;
+  op[0].yes = 2 * size;
+  op[0].no = (CONN_BC_TERM_OPS + (last ? 1 : 0)) * size;
+  op[1].no = port;
+  op[2].code = local ? INET_DIAG_BC_S_LE : INET_DIAG_BC_D_LE;
+  op[2].yes = 2 * size;
+  op[2].no = (CONN_BC_TERM_OPS - 2 + (last ? 1 : 0)) * size;
+  op[3].no = port;
+  /* A jump always takes the "no" branch. "yes" is only used when the kernel
+   * walks the program to validate it. */
+  op[4].code = INET_DIAG_BC_JMP;
+  op[4].yes = size;
+  op[4].no = (ops_num - (index + 4)) * size;
+} /* }}} void conn_bc_term */
+
+/* Builds a program that accepts sockets with one of the ports which are
+ * reported. Returns NULL if there are too many ports for a filter. */
+static struct inet_diag_bc_op *conn_bc_create (size_t terms_num, /* {{{ */
+    size_t *ret_size)
+{
+  struct inet_diag_bc_op *bc;
+  port_entry_t *pe;
+  size_t ops_num;
+  size_t index = 0;
+
+  if ((terms_num == 0) || (terms_num > CONN_BC_TERMS_MAX))
+    return (NULL);
+
+  ops_num = terms_num * CONN_BC_TERM_OPS;
+  bc = calloc (ops_num, sizeof (*bc));
+  if (bc == NULL)
+    return (NULL);
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if (conn_want_local (pe))
+    {
+      conn_bc_term (bc, index, ops_num, /* local = */ 1, pe->port);
+      index += CONN_BC_TERM_OPS;
+    }
+    if (pe->flags & PORT_COLLECT_REMOTE)
+    {
+      conn_bc_term (bc, index, ops_num, /* local = */ 0, pe->port);
+      index += CONN_BC_TERM_OPS;
+    }
+  }
+
+  *ret_size = ops_num * sizeof (*bc);
+  return (bc);
+} /* }}} struct inet_diag_bc_op *conn_bc_create */
+
+/* Dumps the TCP sockets of "family" in one of "states" and passes them to
+ * conn_handle_ports(). If "bc" is not NULL, the kernel only returns sockets
+ * accepted by this program. Returns zero on success, less than zero on socket
+ * error and greater than zero on other errors. */
+static int conn_read_netlink_family (int family, uint32_t states, /* {{{ */
+    struct inet_diag_bc_op const *bc, size_t bc_size)
+{
+  struct sockaddr_nl nladdr;
+  struct nlreq_v2 req;
+  struct msghdr msg;
+  struct iovec iov[2];
+  struct inet_diag_msg *r;
+  /* The kernel fills dump messages up to the size of the buffer we receive
+   * into, up to 32 kByte. */
+  char buf[32768];
+
+  memset (&nladdr, 0, sizeof (nladdr));
+  nladdr.nl_family = AF_NETLINK;
+
+  memset (&req, 0, sizeof (req));
+  req.nlh.nlmsg_len = sizeof (req.nlh) + sizeof (req.r);
+  req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  req.nlh.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST;
+  req.nlh.nlmsg_pid = 0;
+  /* See conn_read_netlink() of the inet_diag_req version. */
+  req.nlh.nlmsg_seq = ++sequence_number;
+  req.r.sdiag_family = (uint8_t) family;
+  req.r.sdiag_protocol = IPPROTO_TCP;
+  req.r.idiag_states = states;
+  req.r.idiag_ext = 0;
+
+  memset (iov, 0, sizeof (iov));
+  iov[0].iov_base = &req;
+  if (bc == NULL)
+    iov[0].iov_len = req.nlh.nlmsg_len;
+  else
+  {
+    req.bc.nla_type = INET_DIAG_REQ_BYTECODE;
+    req.bc.nla_len = (uint16_t) (sizeof (req.bc) + bc_size);
+    req.nlh.nlmsg_len = sizeof (req) + bc_size;
+    iov[0].iov_len = sizeof (req);
+    iov[1].iov_base = (void *) bc;
+    iov[1].iov_len = bc_size;
+  }
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_name = (void*)&nladdr;
+  msg.msg_namelen = sizeof (nladdr);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = (bc == NULL) ? 1 : 2;
+
+  if (sendmsg (diag_fd, &msg, 0) < 0)
+  {
+    ERROR ("tcpconns plugin: conn_read_netlink: sendmsg(2) failed: %s",
+	sstrerror (errno, buf, sizeof (buf)));
+    return (-1);
+  }
+
+  iov[0].iov_base = buf;
+  iov[0].iov_len = sizeof (buf);
+
+  while (1)
+  {
+    int status;
+    struct nlmsghdr *h;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_name = (void*)&nladdr;
+    msg.msg_namelen = sizeof (nladdr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+
+    status = recvmsg (diag_fd, (void *) &msg, /* flags = */ 0);
+    if (status < 0)
+    {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+
+      ERROR ("tcpconns plugin: conn_read_netlink: recvmsg(2) failed: %s",
+	  sstrerror (errno, buf, sizeof (buf)));
+      return (-1);
+    }
+    else if (status == 0)
+    {
+      DEBUG ("tcpconns plugin: conn_read_netlink: Unexpected zero-sized "
+	  "reply from netlink socket.");
+      return (-1);
+    }
+
+    h = (struct nlmsghdr*)buf;
+    while (NLMSG_OK(h, status))
+    {
+      if (h->nlmsg_seq != sequence_number)
+      {
+	h = NLMSG_NEXT(h, status);
+	continue;
+      }
+
+      if (h->nlmsg_type == NLMSG_DONE)
+	return (0);
+      else if (h->nlmsg_type == NLMSG_ERROR)
+      {
+	struct nlmsgerr *msg_error;
+
+	msg_error = NLMSG_DATA(h);
+	WARNING ("tcpconns plugin: conn_read_netlink: Received error %i.",
+	    msg_error->error);
+	return (1);
+      }
+
+      r = NLMSG_DATA(h);
+      conn_handle_ports (ntohs(r->id.idiag_sport),
+	  ntohs(r->id.idiag_dport),
+	  r->idiag_state);
+
+      h = NLMSG_NEXT(h, status);
+    } /* while (NLMSG_OK) */
+  } /* while (1) */
+
+  /* Not reached because the while() loop above handles the exit condition. */
+  return (0);
+} /* }}} int conn_read_netlink_family */
+
+static int conn_read_netlink_states (uint32_t states, /* {{{ */
+    struct inet_diag_bc_op const *bc, size_t bc_size)
+{
+  int status;
+
+  status = conn_read_netlink_family (AF_INET, states, bc, bc_size);
+  if (status == 0)
+    status = conn_read_netlink_family (AF_INET6, states, bc, bc_size);
+
+  /* Don't reuse a socket which may still hold parts of a reply. */
+  if (status < 0)
+  {
+    close (diag_fd);
+    diag_fd = -1;
+  }
+
+  return (status);
+} /* }}} int conn_read_netlink_states */
+
+/* Returns zero on success, less than zero on socket error and greater than
+ * zero on other errors. */
+static int conn_read_netlink (void) /* {{{ */
+{
+  uint32_t states = 0xfff;
+  struct inet_diag_bc_op *bc;
+  size_t bc_size = 0;
+  size_t terms_num;
+  int status;
+
+  if (diag_fd < 0)
+  {
+    /* If this fails, it's likely a permission problem. We'll fall back to
+     * reading this information from files below. */
+    diag_fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
+    if (diag_fd < 0)
+    {
+      char errbuf[1024];
+      ERROR ("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, "
+	  "SOCK_RAW, NETLINK_SOCK_DIAG) failed: %s",
+	  sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+  }
+
+  /* The summary needs every socket. */
+  if (port_collect_total)
+    return (conn_read_netlink_states (states, NULL, 0));
+
+  /* Listening sockets are few. Dump them first, so that the filter for the
+   * other sockets includes the listening ports. */
+  if (port_collect_listening)
+  {
+    status = conn_read_netlink_states (1 << TCP_STATE_LISTEN, NULL, 0);
+    if (status != 0)
+      return (status);
+    states &= ~(1 << TCP_STATE_LISTEN);
+  }
+
+  terms_num = conn_bc_terms_num ();
+  if (terms_num == 0)
+    return (0);
+
+  bc = conn_bc_create (terms_num, &bc_size);
+  status = conn_read_netlink_states (states, bc, bc_size);
+  sfree (bc);
+
+  return (status);
+} /* }}} int conn_read_netlink */
+#else /* !HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2 */
 /* Returns zero on success, less than zero on socket error and greater than
  * zero on other errors. */
 static int conn_read_netlink (void)
@@ -616,6 +916,7 @@ static int conn_read_netlink (void)
   return (1);
 #endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
 } /* int conn_read_netlink */
+#endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2 */
 
 static int conn_handle_line (char *buffer)
 {
@@ -26,6 +26,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "configfile.h"
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_threshold.h"
@@ -40,6 +41,12 @@
  * the underlying AVL trees.
  */
 
+/* While ut_reload() runs, thresholds are added to this tree instead of
+ * "threshold_tree". */
+static c_avl_tree_t *ut_reload_tree = NULL;
+
+static _Bool ut_callbacks_registered = 0;
+
 /*
  * int ut_threshold_add
  *
@@ -53,6 +60,7 @@ static int ut_threshold_add (const threshold_t *th)
   char *name_copy;
   threshold_t *th_copy;
   threshold_t *th_ptr;
+  c_avl_tree_t *tree;
   int status = 0;
 
   if (format_name (name, sizeof (name), th->host,
@@ -84,15 +92,18 @@ static int ut_threshold_add (const threshold_t *th)
 
   pthread_mutex_lock (&threshold_lock);
 
-  th_ptr = threshold_get (th->host, th->plugin, th->plugin_instance,
-      th->type, th->type_instance);
+  tree = (ut_reload_tree != NULL) ? ut_reload_tree : threshold_tree;
+  if (c_avl_get (tree, name, (void *) &th_ptr) != 0)
+    th_ptr = NULL;
 
   while ((th_ptr != NULL) && (th_ptr->next != NULL))
     th_ptr = th_ptr->next;
 
   if (th_ptr == NULL) /* no such threshold yet */
   {
-    status = c_avl_insert (threshold_tree, name_copy, th_copy);
+    status = c_avl_insert (tree, name_copy, th_copy);
+    /* Identifiers may match the new threshold instead of another one. */
+    threshold_cache_clear ();
   }
   else /* th_ptr points to the last threshold in the list */
   {
@@ -408,45 +419,38 @@ static int ut_config_host (const threshold_t *th_orig, oconfig_item_t *ci)
 /* }}} */
 
 /*
- * int ut_report_state
+ * int ut_update_state
  *
- * Checks if the `state' differs from the old state and creates a notification
- * if appropriate.
- * Does not fail.
+ * Updates the hit counter and state kept in the cache entry `e' and returns
+ * the previous state in `ret_state_old'. Returns non-zero if a notification
+ * should be created for `state'. The cache entry must be acquired.
  */
-static int ut_report_state (const data_set_t *ds,
-    const value_list_t *vl,
+static int ut_update_state (uc_entry_t *e,
     const threshold_t *th,
-    const gauge_t *values,
-    int ds_index,
-    int state)
+    int state,
+    int *ret_state_old)
 { /* {{{ */
   int state_old;
-  notification_t n;
-
-  char *buf;
-  size_t bufsize;
-
-  int status;
 
   /* Check if hits matched */
   if ( (th->hits != 0) )
   {
-    int hits = uc_get_hits(ds,vl);
+    int hits = uc_entry_get_hits (e);
     /* STATE_OKAY resets hits unless PERSIST_OK flag is set. Hits resets if
      * threshold is hit. */
     if ( ( (state == STATE_OKAY) && ((th->flags & UT_FLAG_PERSIST_OK) == 0) ) || (hits > th->hits) )
     {
-        DEBUG("ut_report_state: reset uc_get_hits = 0");
-        uc_set_hits(ds,vl,0); /* reset hit counter and notify */
+        DEBUG("ut_update_state: reset hits = 0");
+        uc_entry_set_hits (e, 0); /* reset hit counter and notify */
     } else {
-      DEBUG("ut_report_state: th->hits = %d, uc_get_hits = %d",th->hits,uc_get_hits(ds,vl));
-      (void) uc_inc_hits(ds,vl,1); /* increase hit counter */
+      DEBUG("ut_update_state: th->hits = %d, hits = %d", th->hits, hits);
+      uc_entry_set_hits (e, hits + 1); /* increase hit counter */
       return (0);
     }
   } /* end check hits */
 
-  state_old = uc_get_state (ds, vl);
+  state_old = uc_entry_get_state (e);
+  *ret_state_old = state_old;
 
   /* If the state didn't change, report if `persistent' is specified. If the
    * state is `okay', then only report if `persist_ok` flag is set. */
@@ -459,7 +463,32 @@ static int ut_report_state (const data_set_t *ds,
   }
 
   if (state != state_old)
-    uc_set_state (ds, vl, state);
+    uc_entry_set_state (e, state);
+
+  return (1);
+} /* }}} int ut_update_state */
+
+/*
+ * int ut_report_state
+ *
+ * Creates a notification for the change from `state_old' to `state', see
+ * ut_update_state().
+ * Does not fail.
+ */
+static int ut_report_state (const data_set_t *ds,
+    const value_list_t *vl,
+    const threshold_t *th,
+    const gauge_t *values,
+    int ds_index,
+    int state,
+    int state_old)
+{ /* {{{ */
+  notification_t n;
+
+  char *buf;
+  size_t bufsize;
+
+  int status;
 
   NOTIFICATION_INIT_VL (&n, vl);
 
@@ -604,7 +633,7 @@ static int ut_report_state (const data_set_t *ds,
  * Does not fail.
  */
 static int ut_check_one_data_source (const data_set_t *ds,
-    const value_list_t __attribute__((unused)) *vl,
+    int prev_state,
     const threshold_t *th,
     const gauge_t *values,
     int ds_index)
@@ -612,7 +641,6 @@ static int ut_check_one_data_source (const data_set_t *ds,
   const char *ds_name;
   int is_warning = 0;
   int is_failure = 0;
-  int prev_state = STATE_OKAY;
 
   /* check if this threshold applies to this data source */
   if (ds != NULL)
@@ -633,7 +661,6 @@ static int ut_check_one_data_source (const data_set_t *ds,
    * and probably, do not work as you expect. Enjoy! :D */
   if (th->hysteresis > 0)
   {
-    prev_state = uc_get_state(ds,vl);
     /* The purpose of hysteresis is elliminating flapping state when the value
      * oscilates around the thresholds. In other words, what is important is
      * the previous state; if the new value would trigger a transition, make
@@ -689,28 +716,24 @@ static int ut_check_one_data_source (const data_set_t *ds,
  * int ut_check_one_threshold
  *
  * Checks all data sources of a value list against the given threshold, using
- * the ut_check_one_data_source function above. Returns the worst status,
- * which is `okay' if nothing has failed.
+ * the ut_check_one_data_source function above. `percent' holds the values as
+ * percentages of their sum, for thresholds with the `Percentage' option.
+ * Returns the worst status, which is `okay' if nothing has failed.
  * Returns less than zero if the data set doesn't have any data sources.
  */
 static int ut_check_one_threshold (const data_set_t *ds,
-    const value_list_t *vl,
+    int prev_state,
     const threshold_t *th,
     const gauge_t *values,
+    const gauge_t *percent,
     int *ret_ds_index)
 { /* {{{ */
   int ret = -1;
   int ds_index = -1;
   size_t i;
-  gauge_t values_copy[ds->ds_num];
-
-  memcpy (values_copy, values, sizeof (values_copy));
 
   if ((th->flags & UT_FLAG_PERCENTAGE) != 0)
   {
-    int num = 0;
-    gauge_t sum=0.0;
-
     if (ds->ds_num == 1)
     {
       WARNING ("ut_check_one_threshold: The %s type has only one data "
@@ -719,32 +742,14 @@ static int ut_check_one_threshold (const data_set_t *ds,
           "be 100%%!", ds->type);
     }
 
-    /* Prepare `sum' and `num'. */
-    for (i = 0; i < ds->ds_num; i++)
-      if (!isnan (values[i]))
-      {
-        num++;
-	sum += values[i];
-      }
-
-    if ((num == 0) /* All data sources are undefined. */
-        || (sum == 0.0)) /* Sum is zero, cannot calculate percentage. */
-    {
-      for (i = 0; i < ds->ds_num; i++)
-        values_copy[i] = NAN;
-    }
-    else /* We can actually calculate the percentage. */
-    {
-      for (i = 0; i < ds->ds_num; i++)
-        values_copy[i] = 100.0 * values[i] / sum;
-    }
+    values = percent;
   } /* if (UT_FLAG_PERCENTAGE) */
 
   for (i = 0; i < ds->ds_num; i++)
   {
     int status;
 
-    status = ut_check_one_data_source (ds, vl, th, values_copy, i);
+    status = ut_check_one_data_source (ds, prev_state, th, values, i);
     if (ret < status)
     {
       ret = status;
@@ -758,52 +763,93 @@ static int ut_check_one_threshold (const data_set_t *ds,
   return (ret);
 } /* }}} int ut_check_one_threshold */
 
+/* Converts `values' to percentages of their sum. All percentages are NaN if
+ * all values are undefined or their sum is zero. */
+static void ut_percentages (const data_set_t *ds, /* {{{ */
+    const gauge_t *values, gauge_t *percent)
+{
+  int num = 0;
+  gauge_t sum = 0.0;
+  size_t i;
+
+  for (i = 0; i < ds->ds_num; i++)
+    if (!isnan (values[i]))
+    {
+      num++;
+      sum += values[i];
+    }
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if ((num == 0) /* All data sources are undefined. */
+        || (sum == 0.0)) /* Sum is zero, cannot calculate percentage. */
+      percent[i] = NAN;
+    else /* We can actually calculate the percentage. */
+      percent[i] = 100.0 * values[i] / sum;
+  }
+} /* }}} void ut_percentages */
+
 /*
- * int ut_check_threshold
+ * int ut_check_thresholds
  *
- * Gets a list of matching thresholds and searches for the worst status by one
- * of the thresholds. Then reports that status using the ut_report_state
- * function above.
+ * Searches the thresholds "th" matching "vl" for the worst status by one of
+ * the thresholds. Then reports that status using the ut_report_state
+ * function above. The cache entry is looked up once: rates, state and hit
+ * counter are all read and updated through the same handle, and all
+ * thresholds are checked in one pass.
  * Returns zero on success and if no threshold has been configured. Returns
  * less than zero on failure.
  */
-static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
-    __attribute__((unused)) user_data_t *ud)
+static int ut_check_thresholds (const data_set_t *ds, const value_list_t *vl,
+    threshold_t *th)
 { /* {{{ */
-  threshold_t *th;
-  gauge_t *values;
+  uc_entry_t *e;
+  const gauge_t *rates;
+  gauge_t values[ds->ds_num];
+  gauge_t percent[ds->ds_num];
+  _Bool have_percent = 0;
+  int prev_state;
+  int state_old = STATE_OKAY;
   int status;
 
   int worst_state = -1;
   threshold_t *worst_th = NULL;
   int worst_ds_index = -1;
 
-  if (threshold_tree == NULL)
-    return (0);
+  /* Rates computed by uc_update() for this thread don't need the cache. */
+  rates = uc_get_rate_dispatched (ds, vl);
 
-  /* Is this lock really necessary? So far, thresholds are only inserted at
-   * startup. -octo */
-  pthread_mutex_lock (&threshold_lock);
-  th = threshold_search (vl);
-  pthread_mutex_unlock (&threshold_lock);
-  if (th == NULL)
+  e = uc_acquire (ds, vl);
+  if (e == NULL)
     return (0);
 
-  DEBUG ("ut_check_threshold: Found matching threshold(s)");
-
-  values = uc_get_rate (ds, vl);
-  if (values == NULL)
+  if (rates == NULL)
+    rates = uc_entry_rates (e);
+  if (rates == NULL)
+  {
+    uc_release (e);
     return (0);
+  }
+  memcpy (values, rates, sizeof (values));
+
+  prev_state = uc_entry_get_state (e);
 
   while (th != NULL)
   {
     int ds_index = -1;
 
-    status = ut_check_one_threshold (ds, vl, th, values, &ds_index);
+    if (((th->flags & UT_FLAG_PERCENTAGE) != 0) && !have_percent)
+    {
+      ut_percentages (ds, values, percent);
+      have_percent = 1;
+    }
+
+    status = ut_check_one_threshold (ds, prev_state, th, values, percent,
+        &ds_index);
     if (status < 0)
     {
+      uc_release (e);
       ERROR ("ut_check_threshold: ut_check_one_threshold failed.");
-      sfree (values);
       return (-1);
     }
 
@@ -817,20 +863,262 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     th = th->next;
   } /* while (th) */
 
+  status = ut_update_state (e, worst_th, worst_state, &state_old);
+  uc_release (e);
+
+  /* Notifications are dispatched without holding the cache entry. */
+  if (status == 0)
+    return (0);
+
   status = ut_report_state (ds, vl, worst_th, values,
-      worst_ds_index, worst_state);
+      worst_ds_index, worst_state, state_old);
   if (status != 0)
   {
     ERROR ("ut_check_threshold: ut_report_state failed.");
-    sfree (values);
     return (-1);
   }
 
-  sfree (values);
-
   return (0);
+} /* }}} int ut_check_thresholds */
+
+static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
+    __attribute__((unused)) user_data_t *ud)
+{ /* {{{ */
+  threshold_t *th;
+  threshold_tree_ref_t *ref = NULL;
+  int status;
+
+  if (threshold_tree == NULL)
+    return (0);
+
+  /* ut_reload() may replace the thresholds while they are checked. The
+   * reference keeps them from being freed until we're done. */
+  pthread_mutex_lock (&threshold_lock);
+  th = threshold_acquire (vl, &ref);
+  pthread_mutex_unlock (&threshold_lock);
+  if (th == NULL)
+    return (0);
+
+  DEBUG ("ut_check_threshold: Found matching threshold(s)");
+
+  status = ut_check_thresholds (ds, vl, th);
+
+  pthread_mutex_lock (&threshold_lock);
+  threshold_release (ref);
+  pthread_mutex_unlock (&threshold_lock);
+
+  return (status);
 } /* }}} int ut_check_threshold */
 
+/*
+ * Grouping of missing values
+ * ==========================
+ * When a whole host (or plugin) disappears, all of its values go missing at
+ * once. With "MissingGroupThreshold", ut_missing() only collects missing
+ * values per host or per host and plugin and ut_missing_flush() reports them
+ * once per interval: groups with fewer values than the threshold get one
+ * notification per value, larger groups a single notification for the group.
+ * "MissingNotificationsPerInterval" limits the number of per-value
+ * notifications, remaining groups are aggregated.
+ */
+#define UT_MISSING_GROUP_HOST   0
+#define UT_MISSING_GROUP_PLUGIN 1
+
+static int missing_group_by = UT_MISSING_GROUP_HOST;
+static int missing_group_threshold = 0; /* zero: report values right away */
+static int missing_notifications_max = 0; /* zero: unlimited */
+static _Bool missing_flush_registered = 0;
+
+struct ut_missing_group_s
+{
+  char name[2 * DATA_MAX_NAME_LEN];
+  char host[DATA_MAX_NAME_LEN];
+  char plugin[DATA_MAX_NAME_LEN];
+
+  size_t count;
+  cdtime_t missing_time; /* the shortest of the group's values */
+
+  /* Only kept while count is below missing_group_threshold. */
+  notification_t *pending;
+  size_t pending_num;
+};
+typedef struct ut_missing_group_s ut_missing_group_t;
+
+static c_avl_tree_t *missing_groups = NULL;
+static pthread_mutex_t missing_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ut_missing_group_free (ut_missing_group_t *g) /* {{{ */
+{
+  if (g == NULL)
+    return;
+
+  sfree (g->pending);
+  sfree (g);
+} /* }}} void ut_missing_group_free */
+
+static void ut_missing_groups_free (c_avl_tree_t *tree) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (tree == NULL)
+    return;
+
+  while (c_avl_pick (tree, &key, &value) == 0)
+    ut_missing_group_free (value);
+  c_avl_destroy (tree);
+} /* }}} void ut_missing_groups_free */
+
+/* Adds a missing value to its group. "n" is the notification that would have
+ * been dispatched for the value alone. */
+static int ut_missing_group_add (const value_list_t *vl, /* {{{ */
+    const notification_t *n, cdtime_t missing_time)
+{
+  ut_missing_group_t *g = NULL;
+  char name[2 * DATA_MAX_NAME_LEN];
+
+  if (missing_group_by == UT_MISSING_GROUP_PLUGIN)
+    ssnprintf (name, sizeof (name), "%s/%s", vl->host, vl->plugin);
+  else
+    sstrncpy (name, vl->host, sizeof (name));
+
+  pthread_mutex_lock (&missing_lock);
+
+  if (missing_groups == NULL)
+  {
+    missing_groups = c_avl_create ((void *) strcmp);
+    if (missing_groups == NULL)
+    {
+      pthread_mutex_unlock (&missing_lock);
+      ERROR ("ut_missing: c_avl_create failed.");
+      return (-1);
+    }
+  }
+
+  if (c_avl_get (missing_groups, name, (void *) &g) != 0)
+  {
+    g = calloc (1, sizeof (*g));
+    if (g == NULL)
+    {
+      pthread_mutex_unlock (&missing_lock);
+      ERROR ("ut_missing: calloc failed.");
+      return (-1);
+    }
+    sstrncpy (g->name, name, sizeof (g->name));
+    sstrncpy (g->host, vl->host, sizeof (g->host));
+    if (missing_group_by == UT_MISSING_GROUP_PLUGIN)
+      sstrncpy (g->plugin, vl->plugin, sizeof (g->plugin));
+    g->missing_time = missing_time;
+
+    if (c_avl_insert (missing_groups, g->name, g) != 0)
+    {
+      pthread_mutex_unlock (&missing_lock);
+      ERROR ("ut_missing: c_avl_insert failed.");
+      sfree (g);
+      return (-1);
+    }
+  }
+
+  g->count++;
+  if (g->missing_time > missing_time)
+    g->missing_time = missing_time;
+
+  if (g->count < (size_t) missing_group_threshold)
+  {
+    notification_t *tmp;
+
+    tmp = realloc (g->pending, (g->pending_num + 1) * sizeof (*g->pending));
+    if (tmp != NULL)
+    {
+      g->pending = tmp;
+      g->pending[g->pending_num] = *n;
+      g->pending_num++;
+    }
+  }
+  else
+  {
+    /* The group will be reported as a whole. */
+    sfree (g->pending);
+    g->pending_num = 0;
+  }
+
+  pthread_mutex_unlock (&missing_lock);
+  return (0);
+} /* }}} int ut_missing_group_add */
+
+static void ut_missing_group_dispatch (const ut_missing_group_t *g, /* {{{ */
+    cdtime_t now)
+{
+  notification_t n;
+
+  memset (&n, 0, sizeof (n));
+  n.severity = NOTIF_FAILURE;
+  n.time = now;
+  sstrncpy (n.host, g->host, sizeof (n.host));
+  sstrncpy (n.plugin, g->plugin, sizeof (n.plugin));
+
+  ssnprintf (n.message, sizeof (n.message),
+      "%zu values of %s have not been updated for %.3f seconds or more.",
+      g->count, g->name, CDTIME_T_TO_DOUBLE (g->missing_time));
+
+  plugin_dispatch_notification (&n);
+} /* }}} void ut_missing_group_dispatch */
+
+/* Read callback: reports the groups collected since the last call. */
+static int ut_missing_flush (void) /* {{{ */
+{
+  c_avl_tree_t *tree;
+  void *key;
+  void *value;
+  cdtime_t now;
+  size_t sent = 0;
+
+  pthread_mutex_lock (&missing_lock);
+  tree = missing_groups;
+  missing_groups = NULL;
+  pthread_mutex_unlock (&missing_lock);
+
+  if (tree == NULL)
+    return (0);
+
+  now = cdtime ();
+  while (c_avl_pick (tree, &key, &value) == 0)
+  {
+    ut_missing_group_t *g = value;
+    _Bool aggregate;
+
+    aggregate = (g->pending_num != g->count)
+      || ((missing_notifications_max > 0)
+          && ((sent + g->pending_num) > (size_t) missing_notifications_max));
+
+    if (aggregate)
+      ut_missing_group_dispatch (g, now);
+    else
+    {
+      size_t i;
+
+      for (i = 0; i < g->pending_num; i++)
+        plugin_dispatch_notification (g->pending + i);
+      sent += g->pending_num;
+    }
+
+    ut_missing_group_free (g);
+  }
+  c_avl_destroy (tree);
+
+  return (0);
+} /* }}} int ut_missing_flush */
+
+static int ut_missing_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&missing_lock);
+  ut_missing_groups_free (missing_groups);
+  missing_groups = NULL;
+  pthread_mutex_unlock (&missing_lock);
+
+  return (0);
+} /* }}} int ut_missing_shutdown */
+
 /*
  * int ut_missing
  *
@@ -840,6 +1128,7 @@ static int ut_missing (const value_list_t *vl,
     __attribute__((unused)) user_data_t *ud)
 { /* {{{ */
   threshold_t *th;
+  _Bool interesting;
   cdtime_t missing_time;
   char identifier[6 * DATA_MAX_NAME_LEN];
   notification_t n;
@@ -848,9 +1137,18 @@ static int ut_missing (const value_list_t *vl,
   if (threshold_tree == NULL)
     return (0);
 
+  /* The thresholds may be replaced once the lock is released, so the flags
+   * are checked while holding it. */
+  pthread_mutex_lock (&threshold_lock);
   th = threshold_search (vl);
+  interesting = (th != NULL) && ((th->flags & UT_FLAG_INTERESTING) != 0);
+  /* The identifier is removed from the value cache after this callback
+   * returns. If it shows up again, it is looked up again. */
+  threshold_cache_remove (vl);
+  pthread_mutex_unlock (&threshold_lock);
+
   /* dispatch notifications for "interesting" values only */
-  if ((th == NULL) || ((th->flags & UT_FLAG_INTERESTING) == 0))
+  if (!interesting)
     return (0);
 
   now = cdtime ();
@@ -863,29 +1161,44 @@ static int ut_missing (const value_list_t *vl,
       identifier, CDTIME_T_TO_DOUBLE (missing_time));
   n.time = now;
 
+  if (missing_group_threshold > 0)
+    return (ut_missing_group_add (vl, &n, missing_time));
+
   plugin_dispatch_notification (&n);
 
   return (0);
 } /* }}} int ut_missing */
 
-static int ut_config (oconfig_item_t *ci)
+static int ut_config_missing_group_by (oconfig_item_t *ci) /* {{{ */
+{
+  char buffer[16];
+  int status;
+
+  status = cf_util_get_string_buffer (ci, buffer, sizeof (buffer));
+  if (status != 0)
+    return (status);
+
+  if (strcasecmp ("Host", buffer) == 0)
+    missing_group_by = UT_MISSING_GROUP_HOST;
+  else if (strcasecmp ("Plugin", buffer) == 0)
+    missing_group_by = UT_MISSING_GROUP_PLUGIN;
+  else
+  {
+    WARNING ("threshold values: The `%s' option expects `Host' or "
+        "`Plugin'.", ci->key);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int ut_config_missing_group_by */
+
+static int ut_config_children (oconfig_item_t *ci)
 { /* {{{ */
   int i;
   int status = 0;
-  int old_size = c_avl_size (threshold_tree);
 
   threshold_t th;
 
-  if (threshold_tree == NULL)
-  {
-    threshold_tree = c_avl_create ((void *) strcmp);
-    if (threshold_tree == NULL)
-    {
-      ERROR ("ut_config: c_avl_create failed.");
-      return (-1);
-    }
-  }
-
   memset (&th, '\0', sizeof (th));
   th.warning_min = NAN;
   th.warning_max = NAN;
@@ -906,6 +1219,12 @@ static int ut_config (oconfig_item_t *ci)
       status = ut_config_plugin (&th, option);
     else if (strcasecmp ("Host", option->key) == 0)
       status = ut_config_host (&th, option);
+    else if (strcasecmp ("MissingGroupBy", option->key) == 0)
+      status = ut_config_missing_group_by (option);
+    else if (strcasecmp ("MissingGroupThreshold", option->key) == 0)
+      status = cf_util_get_int (option, &missing_group_threshold);
+    else if (strcasecmp ("MissingNotificationsPerInterval", option->key) == 0)
+      status = cf_util_get_int (option, &missing_notifications_max);
     else
     {
       WARNING ("threshold values: Option `%s' not allowed here.", option->key);
@@ -916,21 +1235,97 @@ static int ut_config (oconfig_item_t *ci)
       break;
   }
 
-  /* register callbacks if this is the first time we see a valid config */
-  if ((old_size == 0) && (c_avl_size (threshold_tree) > 0))
+  return (status);
+} /* }}} int ut_config_children */
+
+static void ut_register_callbacks (void)
+{ /* {{{ */
+  /* register callbacks the first time we see a valid config */
+  if (!ut_callbacks_registered && (c_avl_size (threshold_tree) > 0))
   {
     plugin_register_missing ("threshold", ut_missing,
         /* user data = */ NULL);
     plugin_register_write ("threshold", ut_check_threshold,
         /* user data = */ NULL);
+    ut_callbacks_registered = 1;
+  }
+
+  if ((missing_group_threshold > 0) && !missing_flush_registered)
+  {
+    plugin_register_read ("threshold", ut_missing_flush);
+    plugin_register_shutdown ("threshold", ut_missing_shutdown);
+    missing_flush_registered = 1;
   }
+} /* }}} void ut_register_callbacks */
+
+static int ut_config (oconfig_item_t *ci)
+{ /* {{{ */
+  int status;
+
+  if (threshold_tree == NULL)
+  {
+    threshold_tree = c_avl_create ((void *) strcmp);
+    if (threshold_tree == NULL)
+    {
+      ERROR ("ut_config: c_avl_create failed.");
+      return (-1);
+    }
+  }
+
+  status = ut_config_children (ci);
+  ut_register_callbacks ();
 
   return (status);
-} /* }}} int um_config */
+} /* }}} int ut_config */
+
+/* Replaces all thresholds with the ones configured in "ci". The states of the
+ * values in the cache are kept. */
+static int ut_reload (oconfig_item_t *ci)
+{ /* {{{ */
+  int saved_group_by = missing_group_by;
+  int saved_group_threshold = missing_group_threshold;
+  int saved_notifications_max = missing_notifications_max;
+  c_avl_tree_t *tree;
+  int status;
+
+  tree = c_avl_create ((void *) strcmp);
+  if (tree == NULL)
+  {
+    ERROR ("ut_reload: c_avl_create failed.");
+    return (-1);
+  }
+
+  missing_group_by = UT_MISSING_GROUP_HOST;
+  missing_group_threshold = 0;
+  missing_notifications_max = 0;
+
+  ut_reload_tree = tree;
+  status = ut_config_children (ci);
+  ut_reload_tree = NULL;
+
+  if (status != 0)
+  {
+    missing_group_by = saved_group_by;
+    missing_group_threshold = saved_group_threshold;
+    missing_notifications_max = saved_notifications_max;
+    threshold_tree_free (tree);
+    return (status);
+  }
+
+  /* The old tree is freed once ut_check_threshold() no longer uses it. */
+  pthread_mutex_lock (&threshold_lock);
+  threshold_tree_replace (tree);
+  pthread_mutex_unlock (&threshold_lock);
+
+  ut_register_callbacks ();
+
+  return (0);
+} /* }}} int ut_reload */
 
 void module_register (void)
 {
   plugin_register_complex_config ("threshold", ut_config);
+  plugin_register_complex_reload ("threshold", ut_reload);
 }
 
 /* vim: set sw=2 ts=8 sts=2 tw=78 et fdm=marker : */
@@ -32,6 +32,7 @@
  * - CPU_FREE
  * - CPU_ALLOC
  * - CPU_ALLOC_SIZE
+ * - pthread_setaffinity_np
  */
 #define _GNU_SOURCE
 
@@ -42,6 +43,7 @@
 
 #include <asm/msr-index.h>
 #include <cpuid.h>
+#include <pthread.h>
 #ifdef HAVE_SYS_CAPABILITY_H
 #include <sys/capability.h>
 #endif /* HAVE_SYS_CAPABILITY_H */
@@ -139,8 +141,8 @@ static double rapl_energy_units;
 					/* 0x642 MSR_PP1_POLICY */
 #define	TJMAX_DEFAULT	100
 
-static cpu_set_t *cpu_present_set, *cpu_affinity_set, *cpu_saved_affinity_set;
-static size_t cpu_present_setsize, cpu_affinity_setsize, cpu_saved_affinity_setsize;
+static cpu_set_t *cpu_present_set;
+static size_t cpu_present_setsize;
 
 static struct thread_data {
 	unsigned long long tsc;
@@ -215,6 +217,36 @@ static struct topology {
 
 static cdtime_t time_even, time_odd, time_delta;
 
+/*
+ * Reading a MSR of another CPU interrupts that CPU, so every CPU gets a
+ * sampling thread pinned to it, which keeps the MSR device open. The read
+ * callback hands out one sampling job per CPU and waits until all of them
+ * are done, so the CPUs are sampled at the same time.
+ */
+struct msr_sampler {
+	unsigned int cpu_id;
+	int msr_fd;
+	pthread_t thread;
+	_Bool thread_running;
+
+	/* The current job, protected by sampler_lock */
+	unsigned long generation;
+	struct thread_data *t;
+	struct core_data *c;
+	struct pkg_data *p;
+};
+
+static struct msr_sampler *samplers;
+static unsigned int samplers_num;
+
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sampler_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long sampler_generation;
+static unsigned int sampler_pending;
+static int sampler_status;
+static _Bool sampler_shutdown;
+
 static const char *config_keys[] =
 {
 	"CoreCstates",
@@ -233,30 +265,13 @@ static const int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 /*
  * Open a MSR device for reading
- * Can change the scheduling affinity of the current process if multiple_read is 1
  */
 static int __attribute__((warn_unused_result))
-open_msr(unsigned int cpu, _Bool multiple_read)
+open_msr(unsigned int cpu)
 {
 	char pathname[32];
 	int fd;
 
-	/*
-	 * If we need to do multiple read, let's migrate to the CPU
-	 * Otherwise, we would lose time calling functions on another CPU
-	 *
-	 * If we are not yet initialized (cpu_affinity_setsize = 0),
-	 * we need to skip this optimisation.
-	 */
-	if (multiple_read && cpu_affinity_setsize) {
-		CPU_ZERO_S(cpu_affinity_setsize, cpu_affinity_set);
-		CPU_SET_S(cpu, cpu_affinity_setsize, cpu_affinity_set);
-		if (sched_setaffinity(0, cpu_affinity_setsize, cpu_affinity_set) == -1) {
-			ERROR("turbostat plugin: Could not migrate to CPU %d", cpu);
-			return -1;
-		}
-	}
-
 	ssnprintf(pathname, sizeof(pathname), "/dev/cpu/%d/msr", cpu);
 	fd = open(pathname, O_RDONLY);
 	if (fd < 0) {
@@ -294,7 +309,7 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
 	ssize_t retval;
 	int fd;
 
-	fd = open_msr(cpu, 0);
+	fd = open_msr(cpu);
 	if (fd < 0)
 		return fd;
 	retval = read_msr(fd, offset, msr);
@@ -313,20 +328,14 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
  * Core data is shared for all threads in one core: extracted only for the first thread
  * Package data is shared for all core in one package: extracted only for the first thread of the first core
  *
- * Side effect: migrates to the targeted CPU
+ * Called by the sampling thread of the CPU, with the MSR device of the CPU
  */
 static int __attribute__((warn_unused_result))
-get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p)
+get_counters(int msr_fd, struct thread_data *t, struct core_data *c, struct pkg_data *p)
 {
-	unsigned int cpu = t->cpu_id;
 	unsigned long long msr;
-	int msr_fd;
 	int retval = 0;
 
-	msr_fd = open_msr(cpu, 1);
-	if (msr_fd < 0)
-		return msr_fd;
-
 #define READ_MSR(msr, dst)						\
 do {									\
 	if (read_msr(msr_fd, msr, dst)) {				\
@@ -407,7 +416,6 @@ do {									\
 	}
 
 out:
-	close(msr_fd);
 	return retval;
 }
 
@@ -1169,12 +1177,6 @@ topology_probe(void)
 	}
 
 	ret = allocate_cpu_set(&cpu_present_set, &cpu_present_setsize);
-	if (ret != 0)
-		goto err;
-	ret = allocate_cpu_set(&cpu_affinity_set, &cpu_affinity_setsize);
-	if (ret != 0)
-		goto err;
-	ret = allocate_cpu_set(&cpu_saved_affinity_set, &cpu_saved_affinity_setsize);
 	if (ret != 0)
 		goto err;
 
@@ -1334,9 +1336,182 @@ initialize_counters(void)
 
 
 
+/****************
+ * CPU sampling *
+ ****************/
+
+static void *
+sampler_thread(void *arg)
+{
+	struct msr_sampler *s = arg;
+	cpu_set_t *set;
+	size_t setsize;
+
+	set = CPU_ALLOC(s->cpu_id + 1);
+	if (set != NULL) {
+		setsize = CPU_ALLOC_SIZE(s->cpu_id + 1);
+		CPU_ZERO_S(setsize, set);
+		CPU_SET_S(s->cpu_id, setsize, set);
+		/* Not fatal: the MSRs can still be read from another CPU */
+		if (pthread_setaffinity_np(pthread_self(), setsize, set) != 0)
+			WARNING("turbostat plugin: Could not pin the sampling "
+				"thread to CPU %u", s->cpu_id);
+		CPU_FREE(set);
+	}
+
+	pthread_mutex_lock(&sampler_lock);
+	while (!sampler_shutdown) {
+		struct thread_data *t;
+		struct core_data *c;
+		struct pkg_data *p;
+		int ret;
+
+		if (s->generation == sampler_generation) {
+			pthread_cond_wait(&sampler_start_cond, &sampler_lock);
+			continue;
+		}
+
+		s->generation = sampler_generation;
+		t = s->t;
+		c = s->c;
+		p = s->p;
+		pthread_mutex_unlock(&sampler_lock);
+
+		ret = get_counters(s->msr_fd, t, c, p);
+
+		pthread_mutex_lock(&sampler_lock);
+		if (ret != 0)
+			sampler_status = ret;
+		sampler_pending--;
+		if (sampler_pending == 0)
+			pthread_cond_signal(&sampler_done_cond);
+	}
+	pthread_mutex_unlock(&sampler_lock);
+
+	return NULL;
+}
+
+static void
+stop_samplers(void)
+{
+	unsigned int i;
+
+	if (samplers == NULL)
+		return;
+
+	pthread_mutex_lock(&sampler_lock);
+	sampler_shutdown = 1;
+	pthread_cond_broadcast(&sampler_start_cond);
+	pthread_mutex_unlock(&sampler_lock);
+
+	for (i = 0; i < samplers_num; ++i) {
+		if (samplers[i].thread_running)
+			pthread_join(samplers[i].thread, NULL);
+		if (samplers[i].msr_fd >= 0)
+			close(samplers[i].msr_fd);
+	}
+
+	sfree(samplers);
+	samplers_num = 0;
+	sampler_shutdown = 0;
+}
+
+static int __attribute__((warn_unused_result))
+start_samplers(void)
+{
+	unsigned int cpu_id;
+
+	samplers_num = topology.max_cpu_id + 1;
+	samplers = calloc(samplers_num, sizeof(*samplers));
+	if (samplers == NULL) {
+		ERROR("turbostat plugin: calloc failed");
+		samplers_num = 0;
+		return -1;
+	}
+
+	for (cpu_id = 0; cpu_id < samplers_num; ++cpu_id)
+		samplers[cpu_id].msr_fd = -1;
+
+	for (cpu_id = 0; cpu_id < samplers_num; ++cpu_id) {
+		struct msr_sampler *s = &samplers[cpu_id];
+		int ret;
+
+		if (cpu_is_not_present(cpu_id))
+			continue;
+
+		s->cpu_id = cpu_id;
+		s->msr_fd = open_msr(cpu_id);
+		if (s->msr_fd < 0)
+			goto err;
+
+		s->generation = sampler_generation;
+		ret = plugin_thread_create(&s->thread, NULL, sampler_thread, s);
+		if (ret != 0) {
+			ERROR("turbostat plugin: Unable to start the sampling "
+			      "thread of CPU %u", cpu_id);
+			goto err;
+		}
+		s->thread_running = 1;
+	}
+
+	return 0;
+err:
+	stop_samplers();
+	return -1;
+}
+
+/*
+ * Hand out the job of a single CPU, called with sampler_lock held
+ */
+static int
+queue_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p)
+{
+	struct msr_sampler *s = &samplers[t->cpu_id];
+
+	s->t = t;
+	s->c = c;
+	s->p = p;
+	sampler_pending++;
+	return 0;
+}
+
+/*
+ * Sample all CPUs at once into the given buffers and wait for the result
+ * The time of the snapshot is stored in *time
+ */
+static int __attribute__((warn_unused_result))
+get_all_counters(struct thread_data *thread_base, struct core_data *core_base,
+	struct pkg_data *pkg_base, cdtime_t *time)
+{
+	int ret;
+
+	pthread_mutex_lock(&sampler_lock);
+	sampler_pending = 0;
+	sampler_status = 0;
+	ret = for_all_cpus(queue_counters, thread_base, core_base, pkg_base);
+	if (ret != 0) {
+		pthread_mutex_unlock(&sampler_lock);
+		return ret;
+	}
+
+	*time = cdtime();
+	sampler_generation++;
+	pthread_cond_broadcast(&sampler_start_cond);
+
+	while (sampler_pending > 0)
+		pthread_cond_wait(&sampler_done_cond, &sampler_lock);
+	ret = sampler_status;
+	pthread_mutex_unlock(&sampler_lock);
+
+	return ret;
+}
+
+
 static void
 free_all_buffers(void)
 {
+	stop_samplers();
+
 	allocated = 0;
 	initialized = 0;
 
@@ -1344,14 +1519,6 @@ free_all_buffers(void)
 	cpu_present_set = NULL;
 	cpu_present_setsize = 0;
 
-	CPU_FREE(cpu_affinity_set);
-	cpu_affinity_set = NULL;
-	cpu_affinity_setsize = 0;
-
-	CPU_FREE(cpu_saved_affinity_set);
-	cpu_saved_affinity_set = NULL;
-	cpu_saved_affinity_setsize = 0;
-
 	free(thread_even);
 	free(core_even);
 	free(package_even);
@@ -1400,6 +1567,7 @@ static int setup_all_buffers(void)
 	initialize_counters();
 	DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, EVEN_COUNTERS));
 	DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, ODD_COUNTERS));
+	DO_OR_GOTO_ERR(start_samplers());
 
 	allocated = 1;
 	return 0;
@@ -1429,51 +1597,34 @@ turbostat_read(void)
 		}
 	}
 
-	/* Saving the scheduling affinity, as it will be modified by get_counters */
-	if (sched_getaffinity(0, cpu_saved_affinity_setsize, cpu_saved_affinity_set) != 0) {
-		ERROR("turbostat plugin: Unable to save the CPU affinity");
-		return -1;
-	}
-
 	if (!initialized) {
-		if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
-			goto out;
-		time_even = cdtime();
+		if ((ret = get_all_counters(EVEN_COUNTERS, &time_even)) < 0)
+			return ret;
 		is_even = 1;
 		initialized = 1;
-		ret = 0;
-		goto out;
+		return 0;
 	}
 
 	if (is_even) {
-		if ((ret = for_all_cpus(get_counters, ODD_COUNTERS)) < 0)
-			goto out;
-		time_odd = cdtime();
+		if ((ret = get_all_counters(ODD_COUNTERS, &time_odd)) < 0)
+			return ret;
 		is_even = 0;
 		time_delta = time_odd - time_even;
 		if ((ret = for_all_cpus_delta(ODD_COUNTERS, EVEN_COUNTERS)) < 0)
-			goto out;
+			return ret;
 		if ((ret = for_all_cpus(submit_counters, DELTA_COUNTERS)) < 0)
-			goto out;
+			return ret;
 	} else {
-		if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
-			goto out;
-		time_even = cdtime();
+		if ((ret = get_all_counters(EVEN_COUNTERS, &time_even)) < 0)
+			return ret;
 		is_even = 1;
 		time_delta = time_even - time_odd;
 		if ((ret = for_all_cpus_delta(EVEN_COUNTERS, ODD_COUNTERS)) < 0)
-			goto out;
+			return ret;
 		if ((ret = for_all_cpus(submit_counters, DELTA_COUNTERS)) < 0)
-			goto out;
+			return ret;
 	}
-	ret = 0;
-out:
-	/*
-	 * Let's restore the affinity
-	 * This might fail if the number of CPU changed, but we can't do anything in that case..
-	 */
-	(void)sched_setaffinity(0, cpu_saved_affinity_setsize, cpu_saved_affinity_set);
-	return ret;
+	return 0;
 }
 
 static int
@@ -1618,8 +1769,16 @@ turbostat_config(const char *key, const char *value)
 	return 0;
 }
 
+static int
+turbostat_shutdown(void)
+{
+	free_all_buffers();
+	return 0;
+}
+
 void module_register(void)
 {
 	plugin_register_init(PLUGIN_NAME, turbostat_init);
+	plugin_register_shutdown(PLUGIN_NAME, turbostat_shutdown);
 	plugin_register_config(PLUGIN_NAME, turbostat_config, config_keys, config_keys_num);
 }
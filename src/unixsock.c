@@ -29,6 +29,7 @@
 #include "plugin.h"
 #include "configfile.h"
 
+#include "utils_cmd_binary.h"
 #include "utils_cmd_flush.h"
 #include "utils_cmd_getval.h"
 #include "utils_cmd_getthreshold.h"
@@ -44,11 +45,22 @@
 
 #include <grp.h>
 
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof (((struct sockaddr_un *)0)->sun_path)
 #endif
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
+#define US_DEFAULT_THREADS 4
+
+/* Longest command line, including the newline. */
+#define US_LINE_MAX 1024
 
 /*
  * Private variables
@@ -59,7 +71,8 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"Threads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -71,8 +84,11 @@ static char *sock_file  = NULL;
 static char *sock_group = NULL;
 static int   sock_perms = S_IRWXU | S_IRWXG;
 static _Bool delete_socket = 0;
+static int   threads_num = US_DEFAULT_THREADS;
 
+#if !HAVE_SYS_EPOLL_H
 static pthread_t listen_thread = (pthread_t) 0;
+#endif
 
 /*
  * Functions
@@ -138,7 +154,7 @@ static int us_open_socket (void)
 		return (-1);
 	}
 
-	status = listen (sock_fd, 8);
+	status = listen (sock_fd, SOMAXCONN);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -188,11 +204,616 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
+/* Handles one command line. Returns non-zero if the connection should be
+ * closed. */
+static int us_handle_command (FILE *fhout, char *buffer,
+		putval_batch_t *batch, cmd_binary_t *binary)
+{
+	char buffer_copy[US_LINE_MAX];
+	char *fields[128];
+	int   fields_num;
+
+	/* All lines up to the end of a batch belong to the batch. */
+	if (batch->active)
+		return (handle_putval_batch (fhout, buffer, batch));
+
+	sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+
+	fields_num = strsplit (buffer_copy, fields,
+			sizeof (fields) / sizeof (fields[0]));
+	if (fields_num < 1)
+	{
+		fprintf (fhout, "-1 Internal error\n");
+		return (-1);
+	}
+
+	if (strcasecmp (fields[0], "getval") == 0)
+	{
+		handle_getval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "getthreshold") == 0)
+	{
+		handle_getthreshold (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putval") == 0)
+	{
+		handle_putval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "batch") == 0)
+	{
+		handle_putval_batch (fhout, buffer, batch);
+	}
+	else if (strcasecmp (fields[0], "binary") == 0)
+	{
+		handle_binary_start (fhout, buffer, binary);
+	}
+	else if (strcasecmp (fields[0], "listval") == 0)
+	{
+		handle_listval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putnotif") == 0)
+	{
+		handle_putnotif (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "flush") == 0)
+	{
+		handle_flush (fhout, buffer);
+	}
+	else
+	{
+		if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					fileno (fhout),
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* int us_handle_command */
+
+#if HAVE_SYS_EPOLL_H
+/*
+ * All connections are served by a fixed number of worker threads, which wait
+ * on one epoll instance. Sockets are registered with EPOLLONESHOT, so each
+ * connection is handled by one worker at a time and needs no lock. Replies
+ * are collected in memory and written without blocking; a connection isn't
+ * read from while its replies haven't been written.
+ */
+struct us_conn_s;
+typedef struct us_conn_s us_conn_t;
+struct us_conn_s
+{
+	int fd;
+
+	/* Holds one line or, in binary mode, at least one part. The last byte
+	 * is never filled, so that a line can be terminated. */
+	char in[CMD_BINARY_PART_MAX + 1];
+	size_t in_fill;
+	/* Set while skipping the rest of a line that was too long. */
+	_Bool in_discard;
+	_Bool eof;
+
+	putval_batch_t batch;
+	cmd_binary_t binary;
+
+	char  *out;
+	size_t out_pos;
+	size_t out_fill;
+
+	us_conn_t *prev;
+	us_conn_t *next;
+};
+
+/* Markers for the listening socket and the wakeup pipe in epoll events. */
+static char us_listen_marker;
+static char us_wakeup_marker;
+
+static int epoll_fd = -1;
+static int wakeup_pipe[2] = { -1, -1 };
+
+static pthread_t *workers = NULL;
+static size_t workers_num = 0;
+
+/* All connections, so they can be closed on shutdown. */
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static us_conn_t *conn_list = NULL;
+
+static void us_conn_close (us_conn_t *conn) /* {{{ */
+{
+	pthread_mutex_lock (&conn_lock);
+	if (conn->prev != NULL)
+		conn->prev->next = conn->next;
+	else
+		conn_list = conn->next;
+	if (conn->next != NULL)
+		conn->next->prev = conn->prev;
+	pthread_mutex_unlock (&conn_lock);
+
+	DEBUG ("unixsock plugin: Closing connection on fd #%i", conn->fd);
+
+	/* Closing the socket removes it from the epoll set. */
+	close (conn->fd);
+	putval_batch_reset (&conn->batch);
+	sfree (conn->out);
+	sfree (conn);
+} /* }}} void us_conn_close */
+
+/* Runs all complete lines in the input buffer and appends the replies to the
+ * output buffer. With "flush" set, a last line without newline is run, too.
+ * Returns non-zero if the connection should be closed. */
+static int us_conn_run (us_conn_t *conn, _Bool flush) /* {{{ */
+{
+	FILE *fh;
+	char *reply = NULL;
+	size_t reply_size = 0;
+	size_t pos = 0;
+	int status = 0;
+
+	fh = open_memstream (&reply, &reply_size);
+	if (fh == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: open_memstream failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	while ((pos < conn->in_fill) && (status == 0) && !conn->binary.active)
+	{
+		char *line = conn->in + pos;
+		char *end = memchr (line, '\n', conn->in_fill - pos);
+		size_t len;
+
+		if (end == NULL)
+		{
+			if (!flush && ((pos > 0)
+						|| (conn->in_fill < sizeof (conn->in) - 1)))
+				break;
+
+			/* A line that doesn't fit into the buffer. Skip it up to the
+			 * next newline. */
+			if (!flush && !conn->in_discard)
+			{
+				if (conn->batch.active)
+					putval_batch_error (&conn->batch, "Line too long");
+				else
+					fprintf (fh, "-1 Line too long\n");
+				conn->in_discard = 1;
+			}
+			else if (flush && !conn->in_discard)
+			{
+				conn->in[conn->in_fill] = 0;
+				len = conn->in_fill - pos;
+				while ((len > 0) && (line[len - 1] == '\r'))
+					line[--len] = 0;
+				if (len > 0)
+					status = us_handle_command (fh, line, &conn->batch,
+							&conn->binary);
+			}
+			pos = conn->in_fill;
+			break;
+		}
+
+		pos = (size_t) (end - conn->in) + 1;
+		if (conn->in_discard)
+		{
+			conn->in_discard = 0;
+			continue;
+		}
+
+		*end = 0;
+		len = (size_t) (end - line);
+		while ((len > 0) && (line[len - 1] == '\r'))
+			line[--len] = 0;
+
+		if (len == 0)
+			continue;
+
+		status = us_handle_command (fh, line, &conn->batch, &conn->binary);
+	}
+
+	/* The input buffer holds at least one part of the largest size. */
+	if ((status == 0) && conn->binary.active)
+	{
+		size_t consumed = 0;
+
+		status = handle_binary (fh, &conn->binary, conn->in + pos,
+				conn->in_fill - pos, &consumed);
+		pos += consumed;
+	}
+
+	memmove (conn->in, conn->in + pos, conn->in_fill - pos);
+	conn->in_fill -= pos;
+
+	fclose (fh);
+	if (reply_size > 0)
+	{
+		if (conn->out == NULL)
+		{
+			conn->out = reply;
+			conn->out_pos = 0;
+			conn->out_fill = reply_size;
+			reply = NULL;
+		}
+		else
+		{
+			char *tmp = realloc (conn->out, conn->out_fill + reply_size);
+			if (tmp == NULL)
+			{
+				ERROR ("unixsock plugin: realloc failed.");
+				status = -1;
+			}
+			else
+			{
+				memcpy (tmp + conn->out_fill, reply, reply_size);
+				conn->out = tmp;
+				conn->out_fill += reply_size;
+			}
+		}
+	}
+	sfree (reply);
+
+	return (status);
+} /* }}} int us_conn_run */
+
+/* Writes as much of the output buffer as the socket takes. Returns non-zero
+ * if the connection should be closed. */
+static int us_conn_write (us_conn_t *conn) /* {{{ */
+{
+	while (conn->out_pos < conn->out_fill)
+	{
+		ssize_t status = write (conn->fd, conn->out + conn->out_pos,
+				conn->out_fill - conn->out_pos);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return (0);
+
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					conn->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+		conn->out_pos += (size_t) status;
+	}
+
+	sfree (conn->out);
+	conn->out_pos = conn->out_fill = 0;
+	return (0);
+} /* }}} int us_conn_write */
+
+/* Called when the socket is readable or writable. Returns non-zero if the
+ * connection should be closed. */
+static int us_conn_handle (us_conn_t *conn) /* {{{ */
+{
+	int i;
+
+	if (us_conn_write (conn) != 0)
+		return (-1);
+
+	/* Only read a few times, so that one busy client can't keep a worker to
+	 * itself. The socket is still readable when it's re-armed. */
+	for (i = 0; (i < 16) && (conn->out == NULL) && !conn->eof; i++)
+	{
+		ssize_t status = read (conn->fd, conn->in + conn->in_fill,
+				sizeof (conn->in) - 1 - conn->in_fill);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+					conn->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+
+		if (status == 0)
+			conn->eof = 1;
+		conn->in_fill += (size_t) status;
+
+		if (us_conn_run (conn, /* flush = */ conn->eof) != 0)
+		{
+			us_conn_write (conn);
+			return (-1);
+		}
+
+		if (us_conn_write (conn) != 0)
+			return (-1);
+	}
+
+	if (conn->eof && (conn->out == NULL))
+		return (-1);
+
+	return (0);
+} /* }}} int us_conn_handle */
+
+static int us_epoll_arm (int fd, uint32_t events, void *ptr, int op) /* {{{ */
+{
+	struct epoll_event ev;
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	return (epoll_ctl (epoll_fd, op, fd, &ev));
+} /* }}} int us_epoll_arm */
+
+static void us_accept (void) /* {{{ */
+{
+	while (loop != 0)
+	{
+		us_conn_t *conn;
+		int fd;
+
+		fd = accept (sock_fd, NULL, NULL);
+		if (fd < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				ERROR ("unixsock plugin: accept failed: %s",
+						sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		if (fcntl (fd, F_SETFL, O_NONBLOCK) != 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: fcntl failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (fd);
+			continue;
+		}
+
+		conn = calloc (1, sizeof (*conn));
+		if (conn == NULL)
+		{
+			WARNING ("unixsock plugin: calloc failed.");
+			close (fd);
+			continue;
+		}
+		conn->fd = fd;
+
+		pthread_mutex_lock (&conn_lock);
+		conn->next = conn_list;
+		if (conn_list != NULL)
+			conn_list->prev = conn;
+		conn_list = conn;
+		pthread_mutex_unlock (&conn_lock);
+
+		DEBUG ("unixsock plugin: Accepted connection on fd #%i", fd);
+
+		if (us_epoll_arm (fd, EPOLLIN | EPOLLONESHOT, conn, EPOLL_CTL_ADD)
+				!= 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: epoll_ctl failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			us_conn_close (conn);
+		}
+	}
+
+	us_epoll_arm (sock_fd, EPOLLIN | EPOLLONESHOT, &us_listen_marker,
+			EPOLL_CTL_MOD);
+} /* }}} void us_accept */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	while (loop != 0)
+	{
+		struct epoll_event events[16];
+		int events_num;
+		int i;
+
+		events_num = epoll_wait (epoll_fd, events,
+				STATIC_ARRAY_SIZE (events), /* timeout = */ -1);
+		if (events_num < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("unixsock plugin: epoll_wait failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		for (i = 0; i < events_num; i++)
+		{
+			us_conn_t *conn;
+
+			if (events[i].data.ptr == &us_wakeup_marker)
+				continue;
+			if (events[i].data.ptr == &us_listen_marker)
+			{
+				us_accept ();
+				continue;
+			}
+
+			conn = events[i].data.ptr;
+			if ((us_conn_handle (conn) != 0) || (loop == 0))
+			{
+				us_conn_close (conn);
+				continue;
+			}
+
+			if (us_epoll_arm (conn->fd, EPOLLONESHOT
+						| ((conn->out != NULL) ? EPOLLOUT : EPOLLIN),
+						conn, EPOLL_CTL_MOD) != 0)
+				us_conn_close (conn);
+		}
+	} /* while (loop) */
+
+	return ((void *) 0);
+} /* }}} void *us_worker_thread */
+
+static int us_start_workers (void) /* {{{ */
+{
+	char errbuf[1024];
+	size_t i;
+
+	if (us_open_socket () != 0)
+		return (-1);
+
+	if (fcntl (sock_fd, F_SETFL, O_NONBLOCK) != 0)
+	{
+		ERROR ("unixsock plugin: fcntl failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+	{
+		ERROR ("unixsock plugin: epoll_create1 failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	/* The wakeup pipe is never read from, so that it wakes all workers on
+	 * shutdown. */
+	if (pipe (wakeup_pipe) != 0)
+	{
+		ERROR ("unixsock plugin: pipe failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		wakeup_pipe[0] = wakeup_pipe[1] = -1;
+		return (-1);
+	}
+
+	if ((us_epoll_arm (wakeup_pipe[0], EPOLLIN, &us_wakeup_marker,
+					EPOLL_CTL_ADD) != 0)
+			|| (us_epoll_arm (sock_fd, EPOLLIN | EPOLLONESHOT,
+					&us_listen_marker, EPOLL_CTL_ADD) != 0))
+	{
+		ERROR ("unixsock plugin: epoll_ctl failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	workers = calloc ((size_t) threads_num, sizeof (*workers));
+	if (workers == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < (size_t) threads_num; i++)
+	{
+		int status = plugin_thread_create (&workers[workers_num], NULL,
+				us_worker_thread, NULL);
+		if (status != 0)
+		{
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			break;
+		}
+		workers_num++;
+	}
+
+	if (workers_num == 0)
+		return (-1);
+
+	return (0);
+} /* }}} int us_start_workers */
+
+static void us_stop_workers (void) /* {{{ */
+{
+	size_t i;
+	int status;
+
+	if (wakeup_pipe[1] >= 0)
+	{
+		if (write (wakeup_pipe[1], "", 1) < 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: write to wakeup pipe failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+
+	for (i = 0; i < workers_num; i++)
+		pthread_join (workers[i], NULL);
+	sfree (workers);
+	workers_num = 0;
+
+	while (conn_list != NULL)
+		us_conn_close (conn_list);
+
+	if (epoll_fd >= 0)
+		close (epoll_fd);
+	epoll_fd = -1;
+	for (i = 0; i < STATIC_ARRAY_SIZE (wakeup_pipe); i++)
+	{
+		if (wakeup_pipe[i] >= 0)
+			close (wakeup_pipe[i]);
+		wakeup_pipe[i] = -1;
+	}
+
+	if (sock_fd < 0)
+		return;
+
+	close (sock_fd);
+	sock_fd = -1;
+
+	status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		NOTICE ("unixsock plugin: unlink (%s) failed: %s",
+				(sock_file != NULL) ? sock_file : US_DEFAULT_PATH,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+} /* }}} void us_stop_workers */
+#else /* !HAVE_SYS_EPOLL_H */
+/* Reads one part at a time after the connection switched to binary mode. */
+static void us_handle_client_binary (FILE *fhin, FILE *fhout, /* {{{ */
+		cmd_binary_t *binary)
+{
+	char buffer[CMD_BINARY_PART_MAX];
+	uint16_t pkg_length;
+	size_t size;
+	size_t consumed;
+
+	while (fread (buffer, 2 * sizeof (uint16_t), 1, fhin) == 1)
+	{
+		memcpy (&pkg_length, buffer + sizeof (uint16_t), sizeof (pkg_length));
+		pkg_length = ntohs (pkg_length);
+
+		/* Parts with an invalid length are rejected by handle_binary(). */
+		size = 2 * sizeof (uint16_t);
+		if ((pkg_length > size) && (pkg_length <= sizeof (buffer)))
+		{
+			if (fread (buffer + size, pkg_length - size, 1, fhin) != 1)
+				break;
+			size = pkg_length;
+		}
+
+		if (handle_binary (fhout, binary, buffer, size, &consumed) != 0)
+			break;
+		fflush (fhout);
+	}
+} /* }}} void us_handle_client_binary */
+
 static void *us_handle_client (void *arg)
 {
 	int fdin;
 	int fdout;
 	FILE *fhin, *fhout;
+	putval_batch_t batch = PUTVAL_BATCH_INIT;
+	cmd_binary_t binary = { 0 };
 
 	fdin = *((int *) arg);
 	free (arg);
@@ -248,10 +869,7 @@ static void *us_handle_client (void *arg)
 
 	while (42)
 	{
-		char buffer[1024];
-		char buffer_copy[1024];
-		char *fields[128];
-		int   fields_num;
+		char buffer[US_LINE_MAX];
 		int   len;
 
 		errno = 0;
@@ -278,57 +896,18 @@ static void *us_handle_client (void *arg)
 		if (len == 0)
 			continue;
 
-		sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
-
-		fields_num = strsplit (buffer_copy, fields,
-				sizeof (fields) / sizeof (fields[0]));
-		if (fields_num < 1)
-		{
-			fprintf (fhout, "-1 Internal error\n");
-			fclose (fhin);
-			fclose (fhout);
-			pthread_exit ((void *) 1);
-			return ((void *) 1);
-		}
+		if (us_handle_command (fhout, buffer, &batch, &binary) != 0)
+			break;
 
-		if (strcasecmp (fields[0], "getval") == 0)
-		{
-			handle_getval (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "getthreshold") == 0)
-		{
-			handle_getthreshold (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "putval") == 0)
-		{
-			handle_putval (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "listval") == 0)
-		{
-			handle_listval (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
-		{
-			handle_putnotif (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "flush") == 0)
-		{
-			handle_flush (fhout, buffer);
-		}
-		else
+		if (binary.active)
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
-			}
+			us_handle_client_binary (fhin, fhout, &binary);
+			break;
 		}
 	} /* while (fgets) */
 
 	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
+	putval_batch_reset (&batch);
 	fclose (fhin);
 	fclose (fhout);
 
@@ -409,6 +988,7 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 
 	return ((void *) 0);
 } /* void *us_server_thread */
+#endif /* HAVE_SYS_EPOLL_H */
 
 static int us_config (const char *key, const char *val)
 {
@@ -441,6 +1021,16 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "Threads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			WARNING ("unixsock plugin: `Threads' must be at least one.");
+			return (1);
+		}
+		threads_num = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -462,6 +1052,15 @@ static int us_init (void)
 
 	loop = 1;
 
+#if HAVE_SYS_EPOLL_H
+	status = us_start_workers ();
+	if (status != 0)
+	{
+		loop = 0;
+		us_stop_workers ();
+		return (-1);
+	}
+#else
 	status = plugin_thread_create (&listen_thread, NULL,
 			us_server_thread, NULL);
 	if (status != 0)
@@ -471,22 +1070,27 @@ static int us_init (void)
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
+#endif
 
 	return (0);
 } /* int us_init */
 
 static int us_shutdown (void)
 {
-	void *ret;
-
 	loop = 0;
 
+#if HAVE_SYS_EPOLL_H
+	us_stop_workers ();
+#else
 	if (listen_thread != (pthread_t) 0)
 	{
+		void *ret;
+
 		pthread_kill (listen_thread, SIGTERM);
 		pthread_join (listen_thread, &ret);
 		listen_thread = (pthread_t) 0;
 	}
+#endif
 
 	plugin_unregister_init ("unixsock");
 	plugin_unregister_shutdown ("unixsock");
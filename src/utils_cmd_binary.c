@@ -0,0 +1,432 @@
+/**
+ * collectd - src/utils_cmd_binary.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+
+#include "network.h"
+#include "utils_cache.h"
+#include "utils_cmd_binary.h"
+#include "utils_parse_option.h"
+
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
+#define BINARY_HEADER_SIZE (2 * sizeof (uint16_t))
+/* The most values that fit into a TYPE_VALUES part. */
+#define BINARY_VALUES_MAX ((CMD_BINARY_PART_MAX - BINARY_HEADER_SIZE \
+			- sizeof (uint16_t)) / (sizeof (uint8_t) + sizeof (value_t)))
+
+static int binary_write_part (FILE *fh, uint16_t type, /* {{{ */
+		void const *body, size_t body_size)
+{
+	uint16_t pkg_type = htons (type);
+	uint16_t pkg_length = htons ((uint16_t) (BINARY_HEADER_SIZE + body_size));
+
+	if ((fwrite (&pkg_type, sizeof (pkg_type), 1, fh) != 1)
+			|| (fwrite (&pkg_length, sizeof (pkg_length), 1, fh) != 1)
+			|| ((body_size > 0) && (fwrite (body, body_size, 1, fh) != 1)))
+	{
+		char errbuf[1024];
+		WARNING ("handle_binary: failed to write to socket #%i: %s",
+				fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int binary_write_part */
+
+static int binary_write_status (FILE *fh, char const *format, ...) /* {{{ */
+{
+	char buffer[CMD_BINARY_PART_MAX - BINARY_HEADER_SIZE];
+	va_list ap;
+
+	va_start (ap, format);
+	vsnprintf (buffer, sizeof (buffer), format, ap);
+	buffer[sizeof (buffer) - 1] = 0;
+	va_end (ap);
+
+	return (binary_write_part (fh, TYPE_UNIXSOCK_STATUS,
+				buffer, strlen (buffer) + 1));
+} /* }}} int binary_write_status */
+
+/* Counts a failed value list and keeps the first message. */
+static void binary_error (cmd_binary_t *state, /* {{{ */
+		char const *format, ...)
+{
+	va_list ap;
+
+	state->errors_num++;
+	if (state->errors_num > 1)
+		return;
+
+	va_start (ap, format);
+	vsnprintf (state->error, sizeof (state->error), format, ap);
+	state->error[sizeof (state->error) - 1] = 0;
+	va_end (ap);
+} /* }}} void binary_error */
+
+/* Strings include the terminating null byte. */
+static int binary_parse_string (char const *body, size_t body_size, /* {{{ */
+		char *ret, size_t ret_size)
+{
+	if ((body_size < 1) || (body_size > ret_size)
+			|| (body[body_size - 1] != 0))
+		return (-1);
+
+	memcpy (ret, body, body_size);
+	return (0);
+} /* }}} int binary_parse_string */
+
+static int binary_parse_number (char const *body, size_t body_size, /* {{{ */
+		uint64_t *ret)
+{
+	uint64_t tmp;
+
+	if (body_size != sizeof (tmp))
+		return (-1);
+
+	memcpy (&tmp, body, sizeof (tmp));
+	*ret = ntohll (tmp);
+	return (0);
+} /* }}} int binary_parse_number */
+
+static int binary_putval (cmd_binary_t *state, /* {{{ */
+		char const *body, size_t body_size)
+{
+	value_t values[BINARY_VALUES_MAX];
+	const data_set_t *ds;
+	uint16_t tmp16;
+	size_t values_num;
+	uint8_t const *types;
+	char const *ptr;
+	size_t i;
+
+	if (body_size < sizeof (tmp16))
+		return (-1);
+	memcpy (&tmp16, body, sizeof (tmp16));
+	values_num = (size_t) ntohs (tmp16);
+	if (body_size != sizeof (tmp16)
+			+ values_num * (sizeof (uint8_t) + sizeof (value_t)))
+		return (-1);
+
+	state->lists_num++;
+
+	if ((state->vl.host[0] == 0) || (state->vl.plugin[0] == 0)
+			|| (state->vl.type[0] == 0))
+	{
+		binary_error (state, "Incomplete identifier.");
+		return (0);
+	}
+
+	ds = plugin_get_ds (state->vl.type);
+	if (ds == NULL)
+	{
+		binary_error (state, "Type `%s' isn't defined.", state->vl.type);
+		return (0);
+	}
+
+	if (ds->ds_num != values_num)
+	{
+		binary_error (state, "Type `%s' has %zu values, got %zu.",
+				state->vl.type, ds->ds_num, values_num);
+		return (0);
+	}
+
+	types = (uint8_t const *) (body + sizeof (tmp16));
+	ptr = body + sizeof (tmp16) + values_num * sizeof (uint8_t);
+	for (i = 0; i < values_num; i++)
+	{
+		value_t *v = values + i;
+
+		if (types[i] != ds->ds[i].type)
+		{
+			binary_error (state, "Data source %zu of `%s' has the wrong type.",
+					i, state->vl.type);
+			return (0);
+		}
+
+		/* The values may be unaligned. */
+		memcpy (v, ptr + i * sizeof (*v), sizeof (*v));
+		switch (types[i])
+		{
+			case DS_TYPE_COUNTER:
+				v->counter = (counter_t) ntohll (v->counter);
+				break;
+			case DS_TYPE_GAUGE:
+				v->gauge = (gauge_t) ntohd (v->gauge);
+				break;
+			case DS_TYPE_DERIVE:
+				v->derive = (derive_t) ntohll (v->derive);
+				break;
+			case DS_TYPE_ABSOLUTE:
+				v->absolute = (absolute_t) ntohll (v->absolute);
+				break;
+		}
+	}
+
+	state->vl.values = values;
+	state->vl.values_len = values_num;
+	plugin_dispatch_values (&state->vl);
+	state->vl.values = NULL;
+	state->vl.values_len = 0;
+
+	return (0);
+} /* }}} int binary_putval */
+
+static int binary_getval (FILE *fh, /* {{{ */
+		char const *body, size_t body_size)
+{
+	char identifier[6 * DATA_MAX_NAME_LEN];
+	char identifier_copy[6 * DATA_MAX_NAME_LEN];
+	char *hostname;
+	char *plugin;
+	char *plugin_instance;
+	char *type;
+	char *type_instance;
+	char values_body[CMD_BINARY_PART_MAX];
+	const data_set_t *ds;
+	gauge_t *values = NULL;
+	size_t values_num = 0;
+	uint16_t tmp16;
+	size_t i;
+	int status;
+
+	if (binary_parse_string (body, body_size,
+				identifier, sizeof (identifier)) != 0)
+		return (-1);
+
+	sstrncpy (identifier_copy, identifier, sizeof (identifier_copy));
+	status = parse_identifier (identifier_copy, &hostname,
+			&plugin, &plugin_instance, &type, &type_instance);
+	if (status != 0)
+		return (binary_write_status (fh, "-1 Cannot parse identifier `%s'.",
+					identifier));
+
+	ds = plugin_get_ds (type);
+	if (ds == NULL)
+		return (binary_write_status (fh, "-1 Type `%s' is unknown.", type));
+
+	if (ds->ds_num > BINARY_VALUES_MAX)
+		return (binary_write_status (fh, "-1 Too many values."));
+
+	status = uc_get_rate_by_name (identifier, &values, &values_num);
+	if (status != 0)
+		return (binary_write_status (fh, "-1 No such value"));
+
+	if (ds->ds_num != values_num)
+	{
+		ERROR ("ds[%s]->ds_num = %zu, "
+				"but uc_get_rate_by_name returned %zu values.",
+				ds->type, ds->ds_num, values_num);
+		sfree (values);
+		return (binary_write_status (fh,
+					"-1 Error reading value from cache."));
+	}
+
+	status = binary_write_status (fh, "%zu Value%s found", values_num,
+			(values_num == 1) ? "" : "s");
+	for (i = 0; (i < values_num) && (status == 0); i++)
+		status = binary_write_part (fh, TYPE_UNIXSOCK_DS_NAME,
+				ds->ds[i].name, strlen (ds->ds[i].name) + 1);
+	if (status != 0)
+	{
+		sfree (values);
+		return (status);
+	}
+
+	tmp16 = htons ((uint16_t) values_num);
+	memcpy (values_body, &tmp16, sizeof (tmp16));
+	for (i = 0; i < values_num; i++)
+	{
+		uint8_t type = DS_TYPE_GAUGE;
+		gauge_t value = htond (values[i]);
+
+		memcpy (values_body + sizeof (tmp16) + i, &type, sizeof (type));
+		memcpy (values_body + sizeof (tmp16) + values_num * sizeof (type)
+				+ i * sizeof (value), &value, sizeof (value));
+	}
+	sfree (values);
+
+	return (binary_write_part (fh, TYPE_VALUES, values_body, sizeof (tmp16)
+				+ values_num * (sizeof (uint8_t) + sizeof (value_t))));
+} /* }}} int binary_getval */
+
+static int binary_sync (FILE *fh, cmd_binary_t *state) /* {{{ */
+{
+	int status;
+
+	if (state->errors_num == 0)
+		status = binary_write_status (fh,
+				"0 Success: %i %s been dispatched.",
+				state->lists_num,
+				(state->lists_num == 1) ? "value has" : "values have");
+	else
+		status = binary_write_status (fh,
+				"-1 %i of %i value lists failed, the first error was: %s",
+				state->errors_num, state->lists_num, state->error);
+
+	state->lists_num = 0;
+	state->errors_num = 0;
+	state->error[0] = 0;
+
+	return (status);
+} /* }}} int binary_sync */
+
+static int binary_handle_part (FILE *fh, cmd_binary_t *state, /* {{{ */
+		uint16_t type, char const *body, size_t body_size)
+{
+	value_list_t *vl = &state->vl;
+	uint64_t tmp;
+
+	switch (type)
+	{
+		case TYPE_HOST:
+			return (binary_parse_string (body, body_size,
+						vl->host, sizeof (vl->host)));
+		case TYPE_PLUGIN:
+			return (binary_parse_string (body, body_size,
+						vl->plugin, sizeof (vl->plugin)));
+		case TYPE_PLUGIN_INSTANCE:
+			return (binary_parse_string (body, body_size,
+						vl->plugin_instance, sizeof (vl->plugin_instance)));
+		case TYPE_TYPE:
+			return (binary_parse_string (body, body_size,
+						vl->type, sizeof (vl->type)));
+		case TYPE_TYPE_INSTANCE:
+			return (binary_parse_string (body, body_size,
+						vl->type_instance, sizeof (vl->type_instance)));
+
+		case TYPE_TIME:
+		case TYPE_TIME_HR:
+		case TYPE_INTERVAL:
+		case TYPE_INTERVAL_HR:
+			if (binary_parse_number (body, body_size, &tmp) != 0)
+				return (-1);
+			if ((type == TYPE_TIME) || (type == TYPE_INTERVAL))
+				tmp = TIME_T_TO_CDTIME_T (tmp);
+			if ((type == TYPE_TIME) || (type == TYPE_TIME_HR))
+				vl->time = (cdtime_t) tmp;
+			else
+				vl->interval = (cdtime_t) tmp;
+			return (0);
+
+		case TYPE_VALUES:
+			return (binary_putval (state, body, body_size));
+
+		case TYPE_UNIXSOCK_RESET:
+			memset (vl, 0, sizeof (*vl));
+			return (0);
+
+		case TYPE_UNIXSOCK_SYNC:
+			return (binary_sync (fh, state));
+
+		case TYPE_UNIXSOCK_GETVAL:
+			return (binary_getval (fh, body, body_size));
+	}
+
+	return (0);
+} /* }}} int binary_handle_part */
+
+int handle_binary_start (FILE *fh, char *buffer, /* {{{ */
+		cmd_binary_t *state)
+{
+	char *command = NULL;
+	int status;
+
+	status = parse_string (&buffer, &command);
+	if ((status != 0) || (strcasecmp ("BINARY", command) != 0))
+	{
+		fprintf (fh, "-1 Cannot parse command.\n");
+		return (-1);
+	}
+
+	if (*buffer != 0)
+	{
+		fprintf (fh, "-1 Garbage after end of command: %s\n", buffer);
+		return (-1);
+	}
+
+	memset (state, 0, sizeof (*state));
+	state->active = 1;
+
+	if (fprintf (fh, "0 Binary mode enabled.\n") < 0)
+	{
+		char errbuf[1024];
+		WARNING ("handle_binary: failed to write to socket #%i: %s",
+				fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fflush (fh);
+
+	return (0);
+} /* }}} int handle_binary_start */
+
+int handle_binary (FILE *fh, cmd_binary_t *state, /* {{{ */
+		char const *buffer, size_t buffer_size, size_t *ret_consumed)
+{
+	size_t pos = 0;
+
+	*ret_consumed = 0;
+
+	while (buffer_size - pos >= BINARY_HEADER_SIZE)
+	{
+		uint16_t pkg_type;
+		uint16_t pkg_length;
+		int status;
+
+		memcpy (&pkg_type, buffer + pos, sizeof (pkg_type));
+		memcpy (&pkg_length, buffer + pos + sizeof (pkg_type),
+				sizeof (pkg_length));
+		pkg_type = ntohs (pkg_type);
+		pkg_length = ntohs (pkg_length);
+
+		if ((pkg_length < BINARY_HEADER_SIZE)
+				|| (pkg_length > CMD_BINARY_PART_MAX))
+		{
+			WARNING ("handle_binary: Part of type %#x has an invalid "
+					"length of %"PRIu16" bytes.", pkg_type, pkg_length);
+			return (-1);
+		}
+
+		if (pkg_length > buffer_size - pos)
+			break;
+
+		status = binary_handle_part (fh, state, pkg_type,
+				buffer + pos + BINARY_HEADER_SIZE,
+				pkg_length - BINARY_HEADER_SIZE);
+		if (status != 0)
+		{
+			WARNING ("handle_binary: Handling a part of type %#x failed.",
+					pkg_type);
+			return (-1);
+		}
+
+		pos += pkg_length;
+		*ret_consumed = pos;
+	}
+
+	return (0);
+} /* }}} int handle_binary */
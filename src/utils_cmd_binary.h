@@ -0,0 +1,72 @@
+/**
+ * collectd - src/utils_cmd_binary.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_CMD_BINARY_H
+#define UTILS_CMD_BINARY_H 1
+
+#include <stdio.h>
+
+#include "plugin.h"
+
+/*
+ * Binary mode of the unix socket protocol. After the "BINARY" command, both
+ * directions of the connection carry parts as used by the network plugin, see
+ * network.h. Identifier, time and interval parts set the fields of the
+ * following value lists, and each TYPE_VALUES part dispatches one value list.
+ * A TYPE_UNIXSOCK_RESET part clears these fields, as the start of a network
+ * packet does.
+ * Nothing is sent back for values; a TYPE_UNIXSOCK_SYNC part asks for one
+ * TYPE_UNIXSOCK_STATUS part, which holds a status line as in text mode
+ * covering all value lists since the last one.
+ *
+ * A TYPE_UNIXSOCK_GETVAL part holds an identifier. Its reply is a status part
+ * and, if the value was found, one TYPE_UNIXSOCK_DS_NAME part per data source
+ * followed by a TYPE_VALUES part with the rates as gauges.
+ *
+ * Parts may be at most CMD_BINARY_PART_MAX bytes long. Unknown parts are
+ * ignored. There is no way back to text mode.
+ */
+#define CMD_BINARY_PART_MAX 1024
+
+struct cmd_binary_s
+{
+	_Bool active;
+	/* The identifier, time and interval of the next values. */
+	value_list_t vl;
+	int lists_num;
+	int errors_num;
+	char error[256];
+};
+typedef struct cmd_binary_s cmd_binary_t;
+
+/* Handles the "BINARY" command, which switches the connection to binary mode
+ * after the reply. */
+int handle_binary_start (FILE *fh, char *buffer, cmd_binary_t *state);
+
+/* Handles all complete parts at the start of "buffer" and stores their total
+ * size in "ret_consumed". Returns non-zero if the input is malformed, in which
+ * case the connection should be closed. */
+int handle_binary (FILE *fh, cmd_binary_t *state,
+		char const *buffer, size_t buffer_size, size_t *ret_consumed);
+
+#endif /* UTILS_CMD_BINARY_H */
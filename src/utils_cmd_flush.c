@@ -38,6 +38,8 @@ int handle_flush (FILE *fh, char *buffer)
 	int error   = 0;
 
 	double timeout = 0.0;
+	double deadline = 0.0;
+	plugin_flush_request_t *req;
 	char **plugins = NULL;
 	size_t plugins_num = 0;
 	char **identifiers = NULL;
@@ -113,6 +115,24 @@ int handle_flush (FILE *fh, char *buffer)
 				timeout = 0.0;
 			}
 		}
+		else if (strcasecmp ("deadline", opt_key) == 0)
+		{
+			char *endptr;
+
+			errno = 0;
+			endptr = NULL;
+			deadline = strtod (opt_value, &endptr);
+
+			if ((endptr == opt_value) || (errno != 0) || (!isfinite (deadline))
+					|| (deadline < 0.0))
+			{
+				PRINT_TO_SOCK (fh, "-1 Invalid value for option `deadline': "
+						"%s\n", opt_value);
+				strarray_free (plugins, plugins_num);
+				strarray_free (identifiers, identifiers_num);
+				return (-1);
+			}
+		}
 		else
 		{
 			PRINT_TO_SOCK (fh, "-1 Cannot parse option %s\n", opt_key);
@@ -122,6 +142,19 @@ int handle_flush (FILE *fh, char *buffer)
 		}
 	} /* while (*buffer != 0) */
 
+	/* All flushes are queued before waiting, so that the writers work on them
+	 * concurrently and the deadline covers all of them. */
+	req = plugin_flush_request_create ((deadline > 0.0)
+			? cdtime () + DOUBLE_TO_CDTIME_T (deadline) : 0,
+			/* done = */ NULL, /* arg = */ NULL);
+	if (req == NULL)
+	{
+		PRINT_TO_SOCK (fh, "-1 plugin_flush_request_create failed.\n");
+		strarray_free (plugins, plugins_num);
+		strarray_free (identifiers, identifiers_num);
+		return (-1);
+	}
+
 	for (i = 0; (i == 0) || (i < plugins_num); i++)
 	{
 		char *plugin = NULL;
@@ -133,21 +166,18 @@ int handle_flush (FILE *fh, char *buffer)
 		for (j = 0; (j == 0) || (j < identifiers_num); j++)
 		{
 			char *identifier = NULL;
-			int status;
 
 			if (identifiers_num != 0)
 				identifier = identifiers[j];
 
-			status = plugin_flush (plugin,
+			plugin_flush_request_add (req, plugin,
 					DOUBLE_TO_CDTIME_T (timeout),
 					identifier);
-			if (status == 0)
-				success++;
-			else
-				error++;
 		}
 	}
 
+	plugin_flush_request_wait (req, &success, &error);
+
 	PRINT_TO_SOCK (fh, "0 Done: %i successful, %i errors\n",
 			success, error);
 
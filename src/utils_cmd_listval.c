@@ -32,35 +32,60 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 
-#define free_everything_and_return(status) do { \
-    size_t j; \
-    for (j = 0; j < number; j++) { \
-      sfree(names[j]); \
-      names[j] = NULL; \
-    } \
-    sfree(names); \
-    sfree(times); \
-    return (status); \
-  } while (0)
-
 #define print_to_socket(fh, ...) \
   do { \
     if (fprintf (fh, __VA_ARGS__) < 0) { \
       char errbuf[1024]; \
       WARNING ("handle_listval: failed to write to socket #%i: %s", \
           fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
-      free_everything_and_return (-1); \
+      sfree (lines); \
+      return (-1); \
     } \
     fflush(fh); \
   } while (0)
 
+/* Appends "<time> <name>\n" to the lines, growing them as needed. */
+static int listval_add_line (char **lines, size_t *lines_len, /* {{{ */
+    size_t *lines_size, cdtime_t t, const char *name)
+{
+  char line[32 + 6 * DATA_MAX_NAME_LEN];
+  int len;
+
+  len = ssnprintf (line, sizeof (line), "%.3f %s\n",
+      CDTIME_T_TO_DOUBLE (t), name);
+  if ((len < 0) || ((size_t) len >= sizeof (line)))
+    return (EINVAL);
+
+  if ((*lines_len + (size_t) len) > *lines_size)
+  {
+    size_t new_size = (*lines_size > 0) ? *lines_size : 4096;
+    char *tmp;
+
+    while ((*lines_len + (size_t) len) > new_size)
+      new_size *= 2;
+
+    tmp = realloc (*lines, new_size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    *lines = tmp;
+    *lines_size = new_size;
+  }
+
+  memcpy (*lines + *lines_len, line, (size_t) len);
+  *lines_len += (size_t) len;
+  return (0);
+} /* }}} int listval_add_line */
+
 int handle_listval (FILE *fh, char *buffer)
 {
   char *command;
-  char **names = NULL;
-  cdtime_t *times = NULL;
+  char *filter = NULL;
+  uc_iter_t *iter;
+  char *name;
+  char *lines = NULL;
+  size_t lines_len = 0;
+  size_t lines_size = 0;
   size_t number = 0;
-  size_t i;
   int status;
 
   DEBUG ("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);",
@@ -71,37 +96,80 @@ int handle_listval (FILE *fh, char *buffer)
   if (status != 0)
   {
     print_to_socket (fh, "-1 Cannot parse command.\n");
-    free_everything_and_return (-1);
+    return (-1);
   }
   assert (command != NULL);
 
   if (strcasecmp ("LISTVAL", command) != 0)
   {
     print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
-    free_everything_and_return (-1);
+    return (-1);
+  }
+
+  /* An optional argument restricts the list to identifiers starting with
+   * it, e.g. "LISTVAL myhost/", or matching it if it contains wildcards,
+   * e.g. "LISTVAL myhost/cpu-?/cpu-idle". */
+  if (*buffer != 0)
+  {
+    status = parse_string (&buffer, &filter);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Cannot parse filter.\n");
+      return (-1);
+    }
   }
 
   if (*buffer != 0)
   {
     print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
-    free_everything_and_return (-1);
+    return (-1);
+  }
+
+  /* The filter is applied while the cache shards are copied, so only the
+   * matching lines are kept in memory. They are written in one go once
+   * their number, which the header has to contain, is known. */
+  iter = uc_get_iterator_glob (filter);
+  if (iter == NULL)
+  {
+    print_to_socket (fh, "-1 uc_get_iterator failed.\n");
+    return (-1);
   }
 
-  status = uc_get_names (&names, &times, &number);
+  while (uc_iterator_next (iter, &name) == 0)
+  {
+    cdtime_t t = 0;
+
+    uc_iterator_get_time (iter, &t);
+    status = listval_add_line (&lines, &lines_len, &lines_size, t, name);
+    if (status != 0)
+      break;
+    number++;
+  }
+  uc_iterator_destroy (iter);
+
   if (status != 0)
   {
-    DEBUG ("command listval: uc_get_names failed with status %i", status);
-    print_to_socket (fh, "-1 uc_get_names failed.\n");
-    free_everything_and_return (-1);
+    DEBUG ("command listval: listval_add_line failed with status %i",
+        status);
+    print_to_socket (fh, "-1 Out of memory.\n");
+    sfree (lines);
+    return (-1);
   }
 
   print_to_socket (fh, "%i Value%s found\n",
       (int) number, (number == 1) ? "" : "s");
-  for (i = 0; i < number; i++)
-    print_to_socket (fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE (times[i]),
-       	names[i]);
+  if ((lines_len > 0) && (fwrite (lines, 1, lines_len, fh) != lines_len))
+  {
+    char errbuf[1024];
+    WARNING ("handle_listval: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (lines);
+    return (-1);
+  }
+  fflush (fh);
 
-  free_everything_and_return (0);
+  sfree (lines);
+  return (0);
 } /* int handle_listval */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -37,7 +37,6 @@
             char errbuf[1024]; \
             WARNING ("handle_putval: failed to write to socket #%i: %s", \
                     fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
-            sfree (vl.values); \
             return -1; \
         } \
         fflush(fh); \
@@ -67,39 +66,35 @@ static int set_option (value_list_t *vl, const char *key, const char *value)
 	return (0);
 } /* int parse_option */
 
-int handle_putval (FILE *fh, char *buffer)
+/* Parses and dispatches one PUTVAL command. On error, a message is stored in
+ * "errbuf" and -1 is returned. Values dispatched before the error are not
+ * taken back. */
+static int putval_dispatch (char *buffer, int *ret_values_num, /* {{{ */
+		char *errbuf, size_t errbuf_size)
 {
 	char *command;
 	char *identifier;
-	char *hostname;
-	char *plugin;
-	char *plugin_instance;
-	char *type;
-	char *type_instance;
 	int   status;
-	int   values_submitted;
-
-	char *identifier_copy;
 
 	const data_set_t *ds;
 	value_list_t vl = VALUE_LIST_INIT;
 	vl.values = NULL;
 
-	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
-			(void *) fh, buffer);
+	*ret_values_num = 0;
 
 	command = NULL;
 	status = parse_string (&buffer, &command);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse command.\n");
+		ssnprintf (errbuf, errbuf_size, "Cannot parse command.");
 		return (-1);
 	}
 	assert (command != NULL);
 
 	if (strcasecmp ("PUTVAL", command) != 0)
 	{
-		print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+		ssnprintf (errbuf, errbuf_size, "Unexpected command: `%s'.",
+				command);
 		return (-1);
 	}
 
@@ -107,71 +102,44 @@ int handle_putval (FILE *fh, char *buffer)
 	status = parse_string (&buffer, &identifier);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse identifier.\n");
+		ssnprintf (errbuf, errbuf_size, "Cannot parse identifier.");
 		return (-1);
 	}
 	assert (identifier != NULL);
 
-	/* parse_identifier() modifies its first argument,
-	 * returning pointers into it */
-	identifier_copy = sstrdup (identifier);
-
-	status = parse_identifier (identifier_copy, &hostname,
-			&plugin, &plugin_instance,
-			&type, &type_instance);
-	if (status != 0)
+	/* parse_identifier_vl() copies the fields into "vl", failing if one
+	 * is too long. */
+	status = parse_identifier_vl (identifier, &vl);
+	if (status == ENAMETOOLONG)
 	{
-		DEBUG ("handle_putval: Cannot parse identifier `%s'.",
-				identifier);
-		print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n",
-				identifier);
-		sfree (identifier_copy);
+		ssnprintf (errbuf, errbuf_size, "Identifier too long.");
 		return (-1);
 	}
-
-	if ((strlen (hostname) >= sizeof (vl.host))
-			|| (strlen (plugin) >= sizeof (vl.plugin))
-			|| ((plugin_instance != NULL)
-				&& (strlen (plugin_instance) >= sizeof (vl.plugin_instance)))
-			|| ((type_instance != NULL)
-				&& (strlen (type_instance) >= sizeof (vl.type_instance))))
+	else if (status != 0)
 	{
-		print_to_socket (fh, "-1 Identifier too long.\n");
-		sfree (identifier_copy);
+		DEBUG ("handle_putval: Cannot parse identifier `%s'.",
+				identifier);
+		ssnprintf (errbuf, errbuf_size, "Cannot parse identifier `%s'.",
+				identifier);
 		return (-1);
 	}
 
-	sstrncpy (vl.host, hostname, sizeof (vl.host));
-	sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	if (plugin_instance != NULL)
-		sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
-	if (type_instance != NULL)
-		sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
-
-	ds = plugin_get_ds (type);
+	ds = plugin_get_ds (vl.type);
 	if (ds == NULL) {
-		print_to_socket (fh, "-1 Type `%s' isn't defined.\n", type);
-		sfree (identifier_copy);
+		ssnprintf (errbuf, errbuf_size, "Type `%s' isn't defined.",
+				vl.type);
 		return (-1);
 	}
 
-	/* Free identifier_copy */
-	hostname = NULL;
-	plugin = NULL; plugin_instance = NULL;
-	type = NULL;   type_instance = NULL;
-	sfree (identifier_copy);
-
 	vl.values_len = ds->ds_num;
 	vl.values = malloc (vl.values_len * sizeof (*vl.values));
 	if (vl.values == NULL)
 	{
-		print_to_socket (fh, "-1 malloc failed.\n");
+		ssnprintf (errbuf, errbuf_size, "malloc failed.");
 		return (-1);
 	}
 
 	/* All the remaining fields are part of the optionlist. */
-	values_submitted = 0;
 	while (*buffer != 0)
 	{
 		char *string = NULL;
@@ -182,7 +150,7 @@ int handle_putval (FILE *fh, char *buffer)
 		{
 			/* parse_option failed, buffer has been modified.
 			 * => we need to abort */
-			print_to_socket (fh, "-1 Misformatted option.\n");
+			ssnprintf (errbuf, errbuf_size, "Misformatted option.");
 			sfree (vl.values);
 			return (-1);
 		}
@@ -199,7 +167,7 @@ int handle_putval (FILE *fh, char *buffer)
 		status = parse_string (&buffer, &string);
 		if (status != 0)
 		{
-			print_to_socket (fh, "-1 Misformatted value.\n");
+			ssnprintf (errbuf, errbuf_size, "Misformatted value.");
 			sfree (vl.values);
 			return (-1);
 		}
@@ -208,25 +176,201 @@ int handle_putval (FILE *fh, char *buffer)
 		status = parse_values (string, &vl, ds);
 		if (status != 0)
 		{
-			print_to_socket (fh, "-1 Parsing the values string failed.\n");
+			ssnprintf (errbuf, errbuf_size,
+					"Parsing the values string failed.");
 			sfree (vl.values);
 			return (-1);
 		}
 
 		plugin_dispatch_values (&vl);
-		values_submitted++;
+		(*ret_values_num)++;
 	} /* while (*buffer != 0) */
 	/* Done parsing the options. */
 
+	sfree (vl.values);
+	return (0);
+} /* }}} int putval_dispatch */
+
+int handle_putval (FILE *fh, char *buffer)
+{
+	char errbuf[1024];
+	int values_submitted = 0;
+	int status;
+
+	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
+			(void *) fh, buffer);
+
+	status = putval_dispatch (buffer, &values_submitted,
+			errbuf, sizeof (errbuf));
+	if (status != 0)
+	{
+		print_to_socket (fh, "-1 %s\n", errbuf);
+		return (-1);
+	}
+
     if (fh!=stdout)
 	    print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
 			values_submitted,
 			(values_submitted == 1) ? "value has" : "values have");
 
-	sfree (vl.values);
 	return (0);
 } /* int handle_putval */
 
+/* Returns true if the first word of "buffer" is "command". */
+static _Bool putval_is_command (const char *buffer, /* {{{ */
+		const char *command)
+{
+	size_t len = strlen (command);
+
+	while ((*buffer == ' ') || (*buffer == '\t'))
+		buffer++;
+
+	return ((strncasecmp (buffer, command, len) == 0)
+			&& ((buffer[len] == 0) || (buffer[len] == ' ')
+				|| (buffer[len] == '\t')));
+} /* }}} _Bool putval_is_command */
+
+static void putval_batch_add_error (putval_batch_t *batch, /* {{{ */
+		const char *message)
+{
+	char buffer[1024];
+
+	if (batch->errors_num < PUTVAL_BATCH_ERRORS_MAX)
+	{
+		ssnprintf (buffer, sizeof (buffer), "%i %s",
+				batch->lines_num, message);
+		batch->errors[batch->errors_num] = sstrdup (buffer);
+	}
+	else if (batch->errors_num == PUTVAL_BATCH_ERRORS_MAX)
+	{
+		DEBUG ("utils_cmd_putval: Not reporting more than %i errors.",
+				PUTVAL_BATCH_ERRORS_MAX);
+	}
+
+	batch->errors_num++;
+} /* }}} void putval_batch_add_error */
+
+void putval_batch_error (putval_batch_t *batch, const char *message) /* {{{ */
+{
+	batch->lines_num++;
+	putval_batch_add_error (batch, message);
+} /* }}} void putval_batch_error */
+
+void putval_batch_reset (putval_batch_t *batch) /* {{{ */
+{
+	int i;
+
+	for (i = 0; (i < batch->errors_num) && (i < PUTVAL_BATCH_ERRORS_MAX); i++)
+		sfree (batch->errors[i]);
+
+	memset (batch, 0, sizeof (*batch));
+} /* }}} void putval_batch_reset */
+
+static int putval_batch_end (FILE *fh, putval_batch_t *batch) /* {{{ */
+{
+	int errors_shown;
+	int i;
+
+	batch->active = 0;
+
+	if (!batch->reply)
+	{
+		if (batch->errors_num > 0)
+			WARNING ("utils_cmd_putval: %i of %i lines of a batch failed, "
+					"e.g. line %s", batch->errors_num, batch->lines_num,
+					batch->errors[0]);
+		return (0);
+	}
+
+	if (batch->errors_num == 0)
+	{
+		print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
+				batch->values_num,
+				(batch->values_num == 1) ? "value has" : "values have");
+		return (0);
+	}
+
+	errors_shown = (batch->errors_num < PUTVAL_BATCH_ERRORS_MAX)
+		? batch->errors_num : PUTVAL_BATCH_ERRORS_MAX;
+
+	print_to_socket (fh, "%i %i of %i lines failed, %i %s been dispatched.\n",
+			errors_shown, batch->errors_num, batch->lines_num,
+			batch->values_num,
+			(batch->values_num == 1) ? "value has" : "values have");
+	for (i = 0; i < errors_shown; i++)
+		print_to_socket (fh, "%s\n", batch->errors[i]);
+
+	return (0);
+} /* }}} int putval_batch_end */
+
+int handle_putval_batch (FILE *fh, char *buffer, /* {{{ */
+		putval_batch_t *batch)
+{
+	char errbuf[1024];
+	int values_num = 0;
+	int status;
+
+	if (!batch->active)
+	{
+		char *command = NULL;
+
+		status = parse_string (&buffer, &command);
+		if ((status != 0) || (strcasecmp ("BATCH", command) != 0))
+		{
+			print_to_socket (fh, "-1 Cannot parse command.\n");
+			return (-1);
+		}
+
+		putval_batch_reset (batch);
+		batch->reply = 1;
+
+		while (*buffer != 0)
+		{
+			char *option = NULL;
+
+			status = parse_string (&buffer, &option);
+			if (status != 0)
+			{
+				print_to_socket (fh, "-1 Cannot parse option.\n");
+				return (-1);
+			}
+
+			if (strcasecmp ("NOREPLY", option) == 0)
+				batch->reply = 0;
+			else
+			{
+				print_to_socket (fh, "-1 Unknown option: `%s'.\n", option);
+				return (-1);
+			}
+		}
+
+		batch->active = 1;
+		return (0);
+	}
+
+	if (putval_is_command (buffer, "END"))
+	{
+		status = putval_batch_end (fh, batch);
+		putval_batch_reset (batch);
+		return (status);
+	}
+
+	batch->lines_num++;
+
+	if (!putval_is_command (buffer, "PUTVAL"))
+	{
+		putval_batch_add_error (batch, "Only PUTVAL is allowed in a batch.");
+		return (0);
+	}
+
+	status = putval_dispatch (buffer, &values_num, errbuf, sizeof (errbuf));
+	batch->values_num += values_num;
+	if (status != 0)
+		putval_batch_add_error (batch, errbuf);
+
+	return (0);
+} /* }}} int handle_putval_batch */
+
 int create_putval (char *ret, size_t ret_len, /* {{{ */
 	const data_set_t *ds, const value_list_t *vl)
 {
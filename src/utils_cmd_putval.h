@@ -33,6 +33,45 @@
 
 int handle_putval (FILE *fh, char *buffer);
 
+/*
+ * A batch of PUTVAL commands, sent as
+ *
+ *   BATCH [NOREPLY]
+ *   PUTVAL ...
+ *   PUTVAL ...
+ *   END
+ *
+ * Each PUTVAL line is dispatched right away, but only one reply is sent after
+ * "END". If some lines failed, the status of that reply is the number of
+ * error lines following it, each starting with the number of the failed line
+ * within the batch. Only the first PUTVAL_BATCH_ERRORS_MAX errors are
+ * reported. With NOREPLY, nothing is sent back and failures are logged.
+ */
+#define PUTVAL_BATCH_ERRORS_MAX 100
+
+struct putval_batch_s
+{
+	_Bool active;
+	_Bool reply;
+	int lines_num;
+	int values_num;
+	int errors_num;
+	char *errors[PUTVAL_BATCH_ERRORS_MAX];
+};
+typedef struct putval_batch_s putval_batch_t;
+#define PUTVAL_BATCH_INIT { 0, 0, 0, 0, 0, { NULL } }
+
+/* Handles a "BATCH" line if "batch" isn't active and all lines up to and
+ * including "END" otherwise. */
+int handle_putval_batch (FILE *fh, char *buffer, putval_batch_t *batch);
+
+/* Records a line of the active batch that couldn't be handled at all, for
+ * example because it was too long. */
+void putval_batch_error (putval_batch_t *batch, const char *message);
+
+/* Frees the error messages of a batch that didn't end. */
+void putval_batch_reset (putval_batch_t *batch);
+
 int create_putval (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl);
 
@@ -0,0 +1,477 @@
+/**
+ * collectd - src/utils_curl_multi.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_curl_multi.h"
+
+#include <pthread.h>
+
+/* curl_multi_wait() appeared in libcurl 7.28.0. */
+#if LIBCURL_VERSION_NUM >= 0x071c00
+# define UCM_HAVE_MULTI_WAIT 1
+#else
+# define UCM_HAVE_MULTI_WAIT 0
+#endif
+
+#define UCM_IDLE    0
+#define UCM_PENDING 1
+#define UCM_RUNNING 2
+
+/* Upper bound for the time the transfer thread sleeps in curl_multi_wait(),
+ * in milliseconds. It is woken up earlier by libcurl's timers, socket
+ * activity and new or cancelled transfers. */
+#define UCM_WAIT_MAX 1000
+
+#if UCM_HAVE_MULTI_WAIT
+struct ucm_list_s
+{
+  ucm_transfer_t *head;
+  ucm_transfer_t *tail;
+};
+typedef struct ucm_list_s ucm_list_t;
+
+static pthread_mutex_t ucm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ucm_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t ucm_thread_id;
+static _Bool ucm_thread_running = 0;
+static _Bool ucm_thread_stop = 0;
+
+static CURLM *ucm_multi = NULL;
+/* DNS cache and TLS sessions shared by all transfers. Only used by the
+ * transfer thread, so it needs no lock callbacks. */
+static CURLSH *ucm_share = NULL;
+static int ucm_wake_fd[2] = { -1, -1 };
+
+/* Transfers submitted since the transfer thread last looked, and transfers
+ * added to the multi handle. A transfer is in at most one of them. */
+static ucm_list_t ucm_pending = { NULL, NULL };
+static ucm_list_t ucm_running = { NULL, NULL };
+/* Number of running transfers with "cancel" set. */
+static size_t ucm_cancel_num = 0;
+
+/* Number of transfers ever submitted. The connection cache keeps one
+ * connection per transfer, so servers are not reconnected every interval. */
+static size_t ucm_transfers_num = 0;
+static size_t ucm_maxconnects = 0;
+
+/* The lists are singly linked. Removing a transfer walks the list, which
+ * only happens when it is added to the multi handle, finished or cancelled. */
+static void ucm_list_append (ucm_list_t *l, ucm_transfer_t *t) /* {{{ */
+{
+  t->next = NULL;
+  if (l->tail == NULL)
+    l->head = t;
+  else
+    l->tail->next = t;
+  l->tail = t;
+} /* }}} void ucm_list_append */
+
+static void ucm_list_remove (ucm_list_t *l, ucm_transfer_t *t) /* {{{ */
+{
+  ucm_transfer_t *prev = NULL;
+  ucm_transfer_t *ptr;
+
+  for (ptr = l->head; ptr != NULL; ptr = ptr->next)
+  {
+    if (ptr == t)
+      break;
+    prev = ptr;
+  }
+  if (ptr == NULL)
+    return;
+
+  if (prev == NULL)
+    l->head = t->next;
+  else
+    prev->next = t->next;
+  if (l->tail == t)
+    l->tail = prev;
+  t->next = NULL;
+} /* }}} void ucm_list_remove */
+
+/* Must be called with "ucm_lock" held. */
+static void ucm_wakeup (void) /* {{{ */
+{
+  char c = 0;
+
+  /* If the pipe is full, the thread will wake up anyway. */
+  if (write (ucm_wake_fd[1], &c, 1) < 0)
+  {
+    DEBUG ("utils_curl_multi: write(2) to the wakeup pipe failed.");
+  }
+} /* }}} void ucm_wakeup */
+
+/* Removes the easy handle from the multi handle and the share, so the
+ * plugin can use or free it. */
+static void ucm_detach (CURL *curl) /* {{{ */
+{
+  curl_multi_remove_handle (ucm_multi, curl);
+  if (ucm_share != NULL)
+    curl_easy_setopt (curl, CURLOPT_SHARE, NULL);
+} /* }}} void ucm_detach */
+
+/* Must be called with "ucm_lock" held. */
+static void ucm_add_pending (void) /* {{{ */
+{
+  ucm_transfer_t *t;
+
+  /* By default, libcurl keeps four connections per easy handle in the
+   * multi handle only, so idle connections would be closed between the
+   * intervals. */
+  if (ucm_transfers_num > ucm_maxconnects)
+  {
+    ucm_maxconnects = ucm_transfers_num;
+    curl_multi_setopt (ucm_multi, CURLMOPT_MAXCONNECTS,
+        (long) ucm_maxconnects);
+  }
+
+  while ((t = ucm_pending.head) != NULL)
+  {
+    CURLMcode status;
+
+    ucm_list_remove (&ucm_pending, t);
+
+    curl_easy_setopt (t->curl, CURLOPT_PRIVATE, (char *) t);
+    if (ucm_share != NULL)
+      curl_easy_setopt (t->curl, CURLOPT_SHARE, ucm_share);
+    status = curl_multi_add_handle (ucm_multi, t->curl);
+    if (status != CURLM_OK)
+    {
+      ERROR ("utils_curl_multi: curl_multi_add_handle failed: %s",
+          curl_multi_strerror (status));
+      if (ucm_share != NULL)
+        curl_easy_setopt (t->curl, CURLOPT_SHARE, NULL);
+
+      /* Let the plugin clean up, as if the transfer had failed. */
+      t->state = UCM_RUNNING;
+      pthread_mutex_unlock (&ucm_lock);
+      plugin_set_ctx (t->ctx);
+      (*t->done) (t, CURLE_FAILED_INIT);
+      pthread_mutex_lock (&ucm_lock);
+      t->state = UCM_IDLE;
+      pthread_cond_broadcast (&ucm_cond);
+      continue;
+    }
+
+    t->state = UCM_RUNNING;
+    ucm_list_append (&ucm_running, t);
+  }
+} /* }}} void ucm_add_pending */
+
+/* Must be called with "ucm_lock" held. */
+static void ucm_remove_cancelled (void) /* {{{ */
+{
+  ucm_transfer_t *t;
+  ucm_transfer_t *next;
+
+  if (ucm_cancel_num == 0)
+    return;
+
+  for (t = ucm_running.head; t != NULL; t = next)
+  {
+    next = t->next;
+    if (!t->cancel)
+      continue;
+
+    ucm_detach (t->curl);
+    ucm_list_remove (&ucm_running, t);
+    t->cancel = 0;
+    t->state = UCM_IDLE;
+    ucm_cancel_num--;
+  }
+
+  pthread_cond_broadcast (&ucm_cond);
+} /* }}} void ucm_remove_cancelled */
+
+static void ucm_handle_done (CURL *curl, CURLcode result) /* {{{ */
+{
+  ucm_transfer_t *t = NULL;
+  char *priv = NULL;
+  _Bool cancelled;
+
+  curl_easy_getinfo (curl, CURLINFO_PRIVATE, &priv);
+  t = (ucm_transfer_t *) priv;
+  ucm_detach (curl);
+  if (t == NULL)
+    return;
+
+  pthread_mutex_lock (&ucm_lock);
+  ucm_list_remove (&ucm_running, t);
+  cancelled = t->cancel;
+  pthread_mutex_unlock (&ucm_lock);
+
+  if (!cancelled)
+  {
+    plugin_set_ctx (t->ctx);
+    (*t->done) (t, result);
+  }
+
+  pthread_mutex_lock (&ucm_lock);
+  if (t->cancel)
+  {
+    t->cancel = 0;
+    ucm_cancel_num--;
+  }
+  t->state = UCM_IDLE;
+  pthread_cond_broadcast (&ucm_cond);
+  pthread_mutex_unlock (&ucm_lock);
+} /* }}} void ucm_handle_done */
+
+static void *ucm_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  pthread_mutex_lock (&ucm_lock);
+  while (!ucm_thread_stop)
+  {
+    struct curl_waitfd wait_fd;
+    CURLMsg *msg;
+    int running = 0;
+    int msgs_num = 0;
+    char buffer[64];
+
+    ucm_add_pending ();
+    ucm_remove_cancelled ();
+    pthread_mutex_unlock (&ucm_lock);
+
+    curl_multi_perform (ucm_multi, &running);
+
+    while ((msg = curl_multi_info_read (ucm_multi, &msgs_num)) != NULL)
+    {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      /* "msg" is invalid once the handle has been removed. */
+      ucm_handle_done (msg->easy_handle, msg->data.result);
+    }
+
+    memset (&wait_fd, 0, sizeof (wait_fd));
+    wait_fd.fd = ucm_wake_fd[0];
+    wait_fd.events = CURL_WAIT_POLLIN;
+    curl_multi_wait (ucm_multi, &wait_fd, 1, UCM_WAIT_MAX,
+        /* numfds = */ NULL);
+
+    while (read (ucm_wake_fd[0], buffer, sizeof (buffer)) > 0)
+      /* drain the pipe */;
+
+    pthread_mutex_lock (&ucm_lock);
+  }
+  pthread_mutex_unlock (&ucm_lock);
+
+  return (NULL);
+} /* }}} void *ucm_thread */
+
+/* Must be called with "ucm_lock" held. */
+static int ucm_start (void) /* {{{ */
+{
+  char errbuf[1024];
+  int status;
+  int i;
+
+  ucm_multi = curl_multi_init ();
+  if (ucm_multi == NULL)
+  {
+    ERROR ("utils_curl_multi: curl_multi_init failed.");
+    return (ENOMEM);
+  }
+
+  /* Without the share, transfers still work, just with their own caches. */
+  ucm_share = curl_share_init ();
+  if (ucm_share != NULL)
+  {
+    curl_share_setopt (ucm_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt (ucm_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  }
+  ucm_maxconnects = 0;
+
+  if (pipe (ucm_wake_fd) != 0)
+  {
+    status = errno;
+    ERROR ("utils_curl_multi: pipe(2) failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    curl_multi_cleanup (ucm_multi);
+    ucm_multi = NULL;
+    if (ucm_share != NULL)
+      curl_share_cleanup (ucm_share);
+    ucm_share = NULL;
+    return (status);
+  }
+  for (i = 0; i < 2; i++)
+    fcntl (ucm_wake_fd[i], F_SETFL,
+        fcntl (ucm_wake_fd[i], F_GETFL) | O_NONBLOCK);
+
+  ucm_thread_stop = 0;
+  status = plugin_thread_create (&ucm_thread_id, /* attr = */ NULL,
+      ucm_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("utils_curl_multi: plugin_thread_create failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    close (ucm_wake_fd[0]);
+    close (ucm_wake_fd[1]);
+    ucm_wake_fd[0] = ucm_wake_fd[1] = -1;
+    curl_multi_cleanup (ucm_multi);
+    ucm_multi = NULL;
+    if (ucm_share != NULL)
+      curl_share_cleanup (ucm_share);
+    ucm_share = NULL;
+    return (status);
+  }
+
+  ucm_thread_running = 1;
+  return (0);
+} /* }}} int ucm_start */
+#endif /* UCM_HAVE_MULTI_WAIT */
+
+int ucm_submit (ucm_transfer_t *t) /* {{{ */
+{
+#if UCM_HAVE_MULTI_WAIT
+  int status;
+#endif
+
+  if ((t == NULL) || (t->curl == NULL) || (t->done == NULL))
+    return (EINVAL);
+
+#if UCM_HAVE_MULTI_WAIT
+  pthread_mutex_lock (&ucm_lock);
+  if (t->state != UCM_IDLE)
+  {
+    pthread_mutex_unlock (&ucm_lock);
+    return (EBUSY);
+  }
+
+  if (!ucm_thread_running)
+  {
+    status = ucm_start ();
+    if (status != 0)
+    {
+      pthread_mutex_unlock (&ucm_lock);
+      return (status);
+    }
+  }
+
+  if (!t->counted)
+  {
+    t->counted = 1;
+    ucm_transfers_num++;
+  }
+
+  t->state = UCM_PENDING;
+  t->cancel = 0;
+  t->ctx = plugin_get_ctx ();
+  ucm_list_append (&ucm_pending, t);
+  ucm_wakeup ();
+  pthread_mutex_unlock (&ucm_lock);
+#else
+  (*t->done) (t, curl_easy_perform (t->curl));
+#endif
+
+  return (0);
+} /* }}} int ucm_submit */
+
+_Bool ucm_busy (ucm_transfer_t *t) /* {{{ */
+{
+  _Bool busy = 0;
+
+#if UCM_HAVE_MULTI_WAIT
+  pthread_mutex_lock (&ucm_lock);
+  busy = (t->state != UCM_IDLE);
+  pthread_mutex_unlock (&ucm_lock);
+#endif
+
+  return (busy);
+} /* }}} _Bool ucm_busy */
+
+void ucm_cancel (ucm_transfer_t *t) /* {{{ */
+{
+#if UCM_HAVE_MULTI_WAIT
+  if (t == NULL)
+    return;
+
+  pthread_mutex_lock (&ucm_lock);
+  if (t->state == UCM_PENDING)
+  {
+    ucm_list_remove (&ucm_pending, t);
+    t->state = UCM_IDLE;
+  }
+  else if (t->state == UCM_RUNNING)
+  {
+    if (!t->cancel)
+    {
+      t->cancel = 1;
+      ucm_cancel_num++;
+    }
+    ucm_wakeup ();
+    while (t->state != UCM_IDLE)
+      pthread_cond_wait (&ucm_cond, &ucm_lock);
+  }
+  pthread_mutex_unlock (&ucm_lock);
+#endif
+} /* }}} void ucm_cancel */
+
+void ucm_shutdown (void) /* {{{ */
+{
+#if UCM_HAVE_MULTI_WAIT
+  ucm_transfer_t *t;
+
+  pthread_mutex_lock (&ucm_lock);
+  if (!ucm_thread_running)
+  {
+    pthread_mutex_unlock (&ucm_lock);
+    return;
+  }
+  ucm_thread_stop = 1;
+  ucm_wakeup ();
+  pthread_mutex_unlock (&ucm_lock);
+
+  pthread_join (ucm_thread_id, /* retval = */ NULL);
+
+  pthread_mutex_lock (&ucm_lock);
+  while ((t = ucm_running.head) != NULL)
+  {
+    ucm_detach (t->curl);
+    ucm_list_remove (&ucm_running, t);
+    t->cancel = 0;
+    t->state = UCM_IDLE;
+  }
+  while ((t = ucm_pending.head) != NULL)
+  {
+    ucm_list_remove (&ucm_pending, t);
+    t->state = UCM_IDLE;
+  }
+  ucm_cancel_num = 0;
+
+  curl_multi_cleanup (ucm_multi);
+  ucm_multi = NULL;
+  if (ucm_share != NULL)
+    curl_share_cleanup (ucm_share);
+  ucm_share = NULL;
+  close (ucm_wake_fd[0]);
+  close (ucm_wake_fd[1]);
+  ucm_wake_fd[0] = ucm_wake_fd[1] = -1;
+
+  ucm_thread_running = 0;
+  ucm_thread_stop = 0;
+  pthread_cond_broadcast (&ucm_cond);
+  pthread_mutex_unlock (&ucm_lock);
+#endif
+} /* }}} void ucm_shutdown */
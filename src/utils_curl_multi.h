@@ -0,0 +1,94 @@
+/**
+ * collectd - src/utils_curl_multi.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_CURL_MULTI_H
+#define UTILS_CURL_MULTI_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+#include <curl/curl.h>
+
+/*
+ * Runs the transfers of a plugin concurrently in one thread, using a curl
+ * multi handle. The read callback of the plugin submits the transfer and
+ * returns; the write function of the easy handle and the "done" callback are
+ * called from the transfer thread as data arrives, with the plugin context of
+ * the read callback. Connections, resolved names and TLS sessions are shared
+ * between the transfers of the plugin, and idle connections are kept open
+ * across intervals. Timeouts are those configured on the easy handles.
+ *
+ * A transfer is owned by the plugin and can only be submitted again once its
+ * "done" callback has returned. Its private members must be zero-initialized,
+ * e.g. by allocating it with calloc(3).
+ */
+struct ucm_transfer_s;
+typedef struct ucm_transfer_s ucm_transfer_t;
+
+/* Called when the transfer finished or failed; "status" is the result of the
+ * transfer. Not called for transfers removed by ucm_cancel(). */
+typedef void (*ucm_done_cb) (ucm_transfer_t *t, CURLcode status);
+
+struct ucm_transfer_s
+{
+  CURL *curl;
+  ucm_done_cb done;
+  void *user_data;
+
+  /* Private, protected by the lock of the transfer thread. */
+  int state;
+  _Bool cancel;
+  _Bool counted;
+  plugin_ctx_t ctx;
+  ucm_transfer_t *next;
+};
+
+/*
+ * NAME
+ *   ucm_submit
+ *
+ * DESCRIPTION
+ *   Starts the transfer `t'. `t->curl', `t->done' and `t->user_data' must be
+ *   set. The transfer thread is started when needed. If libcurl is too old
+ *   for the transfer thread, the transfer is done right away.
+ *
+ * RETURN VALUE
+ *   Zero on success, EBUSY if `t' is still in progress and another errno
+ *   value if the transfer could not be started.
+ */
+int ucm_submit (ucm_transfer_t *t);
+
+/* Returns true if `t' has been submitted and its "done" callback has not
+ * returned yet. The plugin must not touch the state used by the callbacks of
+ * a busy transfer, so check this before preparing the next request. */
+_Bool ucm_busy (ucm_transfer_t *t);
+
+/* Removes `t' from the transfer thread and waits until its "done" callback is
+ * not running anymore. Does nothing if `t' is not in progress. */
+void ucm_cancel (ucm_transfer_t *t);
+
+/* Stops the transfer thread. Transfers still in progress are removed without
+ * calling their "done" callbacks. */
+void ucm_shutdown (void);
+
+#endif /* UTILS_CURL_MULTI_H */
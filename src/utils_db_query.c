@@ -70,6 +70,8 @@ struct udb_result_preparation_area_s /* {{{ */
   char  **instances_buffer;
   char  **values_buffer;
   char  **metadata_buffer;
+  /* Values of the value list, reused for each row. */
+  value_t *values;
 
   struct udb_result_preparation_area_s *next;
 }; /* }}} */
@@ -84,6 +86,13 @@ struct udb_query_preparation_area_s /* {{{ */
 
   cdtime_t interval;
 
+  /* The column names the result areas have been prepared for. They are kept
+   * across executions, so that the columns are only looked up again when the
+   * result of the query changes. */
+  char **column_names;
+  size_t column_names_num;
+  _Bool prepared;
+
   udb_result_preparation_area_t *result_prep_areas;
 }; /* }}} */
 
@@ -191,9 +200,13 @@ static int udb_config_set_uint (unsigned int *ret_value, /* {{{ */
 /*
  * Result private functions
  */
-static int udb_result_submit (udb_result_t *r, /* {{{ */
+/* Fills `vl' from the row in the buffers of `r_area'. The values are parsed
+ * into `values', which must hold `r->values_num' elements. The meta data, if
+ * any, must be destroyed by the caller. */
+static int udb_result_fill_vl (udb_result_t *r, /* {{{ */
     udb_result_preparation_area_t *r_area,
-    udb_query_t const *q, udb_query_preparation_area_t *q_area)
+    udb_query_preparation_area_t *q_area,
+    value_list_t *ret_vl, value_t *values)
 {
   value_list_t vl = VALUE_LIST_INIT;
   size_t i;
@@ -203,13 +216,9 @@ static int udb_result_submit (udb_result_t *r, /* {{{ */
   assert (r_area->ds != NULL);
   assert (((size_t) r_area->ds->ds_num) == r->values_num);
   assert (r->values_num > 0);
+  assert (values != NULL);
 
-  vl.values = (value_t *) calloc (r->values_num, sizeof (value_t));
-  if (vl.values == NULL)
-  {
-    ERROR ("db query utils: calloc failed.");
-    return (-1);
-  }
+  vl.values = values;
   vl.values_len = r_area->ds->ds_num;
 
   for (i = 0; i < r->values_num; i++)
@@ -289,14 +298,30 @@ static int udb_result_submit (udb_result_t *r, /* {{{ */
   }
   /* }}} */
 
-  plugin_dispatch_values (&vl);
+  *ret_vl = vl;
+  return (0);
+} /* }}} int udb_result_fill_vl */
+
+static int udb_result_submit (udb_result_t *r, /* {{{ */
+    udb_result_preparation_area_t *r_area,
+    udb_query_t const *q, udb_query_preparation_area_t *q_area)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  int status;
 
-  if (r->metadata_num > 0)
+  assert (r_area->values != NULL);
+
+  status = udb_result_fill_vl (r, r_area, q_area, &vl, r_area->values);
+  if (status != 0)
+    return (status);
+
+  plugin_dispatch_values_ds (r_area->ds, &vl);
+
+  if (vl.meta != NULL)
   {
     meta_data_destroy (vl.meta);
     vl.meta = NULL;
   }
-  sfree (vl.values);
   return (0);
 } /* }}} void udb_result_submit */
 
@@ -313,17 +338,14 @@ static void udb_result_finish_result (udb_result_t const *r, /* {{{ */
   sfree (prep_area->instances_buffer);
   sfree (prep_area->values_buffer);
   sfree (prep_area->metadata_buffer);
+  sfree (prep_area->values);
 } /* }}} void udb_result_finish_result */
 
-static int udb_result_handle_result (udb_result_t *r, /* {{{ */
-    udb_query_preparation_area_t *q_area,
-    udb_result_preparation_area_t *r_area,
-    udb_query_t const *q, char **column_values)
+static void udb_result_set_row (udb_result_t *r, /* {{{ */
+    udb_result_preparation_area_t *r_area, char **column_values)
 {
   size_t i;
 
-  assert (r && q_area && r_area);
-
   for (i = 0; i < r->instances_num; i++)
     r_area->instances_buffer[i] = column_values[r_area->instances_pos[i]];
 
@@ -332,10 +354,61 @@ static int udb_result_handle_result (udb_result_t *r, /* {{{ */
 
   for (i = 0; i < r->metadata_num; i++)
     r_area->metadata_buffer[i] = column_values[r_area->metadata_pos[i]];
+} /* }}} void udb_result_set_row */
+
+static int udb_result_handle_result (udb_result_t *r, /* {{{ */
+    udb_query_preparation_area_t *q_area,
+    udb_result_preparation_area_t *r_area,
+    udb_query_t const *q, char **column_values)
+{
+  assert (r && q_area && r_area);
 
+  udb_result_set_row (r, r_area, column_values);
   return udb_result_submit (r, r_area, q, q_area);
 } /* }}} int udb_result_handle_result */
 
+/* Dispatches the value lists of `rows_num' rows with a single call of
+ * plugin_dispatch_values_bulk(). Rows that can't be parsed are skipped.
+ * Returns the number of rows dispatched. */
+static size_t udb_result_handle_results (udb_result_t *r, /* {{{ */
+    udb_query_preparation_area_t *q_area,
+    udb_result_preparation_area_t *r_area,
+    char **column_values, size_t column_num, size_t rows_num)
+{
+  value_list_t *vl;
+  value_t *values;
+  size_t vl_num = 0;
+  size_t i;
+
+  vl = calloc (rows_num, sizeof (*vl));
+  values = calloc (rows_num * r->values_num, sizeof (*values));
+  if ((vl == NULL) || (values == NULL))
+  {
+    ERROR ("db query utils: udb_result_handle_results: calloc failed.");
+    sfree (vl);
+    sfree (values);
+    return (0);
+  }
+
+  for (i = 0; i < rows_num; i++)
+  {
+    udb_result_set_row (r, r_area, column_values + (i * column_num));
+    if (udb_result_fill_vl (r, r_area, q_area, vl + vl_num,
+          values + (vl_num * r->values_num)) == 0)
+      vl_num++;
+  }
+
+  if (vl_num > 0)
+    plugin_dispatch_values_bulk (r_area->ds, vl, vl_num);
+
+  for (i = 0; i < vl_num; i++)
+    meta_data_destroy (vl[i].meta);
+  sfree (vl);
+  sfree (values);
+
+  return (vl_num);
+} /* }}} size_t udb_result_handle_results */
+
 static int udb_result_prepare_result (udb_result_t const *r, /* {{{ */
     udb_result_preparation_area_t *prep_area,
     char **column_names, size_t column_num)
@@ -353,6 +426,7 @@ static int udb_result_prepare_result (udb_result_t const *r, /* {{{ */
   sfree (prep_area->instances_buffer); \
   sfree (prep_area->values_buffer); \
   sfree (prep_area->metadata_buffer); \
+  sfree (prep_area->values); \
   return (status)
 
   /* Make sure previous preparations are cleaned up. */
@@ -419,6 +493,14 @@ static int udb_result_prepare_result (udb_result_t const *r, /* {{{ */
     BAIL_OUT (-ENOMEM);
   }
 
+  prep_area->values
+    = (value_t *) calloc (r->values_num, sizeof (value_t));
+  if (prep_area->values == NULL)
+  {
+    ERROR ("db query utils: udb_result_prepare_result: calloc failed.");
+    BAIL_OUT (-ENOMEM);
+  }
+
   prep_area->metadata_pos
     = (size_t *) calloc (r->metadata_num, sizeof (size_t));
   if (prep_area->metadata_pos == NULL)
@@ -919,14 +1001,13 @@ int udb_query_check_version (udb_query_t *q, unsigned int version) /* {{{ */
   return (1);
 } /* }}} int udb_query_check_version */
 
-void udb_query_finish_result (udb_query_t const *q, /* {{{ */
+/* Frees everything the preparation area caches for the query. */
+static void udb_query_clear_result (udb_query_t const *q, /* {{{ */
     udb_query_preparation_area_t *prep_area)
 {
   udb_result_preparation_area_t *r_area;
   udb_result_t *r;
-
-  if ((q == NULL) || (prep_area == NULL))
-    return;
+  size_t i;
 
   prep_area->column_num = 0;
   sfree (prep_area->host);
@@ -935,6 +1016,12 @@ void udb_query_finish_result (udb_query_t const *q, /* {{{ */
 
   prep_area->interval = 0;
 
+  for (i = 0; i < prep_area->column_names_num; i++)
+    sfree (prep_area->column_names[i]);
+  sfree (prep_area->column_names);
+  prep_area->column_names_num = 0;
+  prep_area->prepared = 0;
+
   for (r = q->results, r_area = prep_area->result_prep_areas;
       r != NULL; r = r->next, r_area = r_area->next)
   {
@@ -943,6 +1030,48 @@ void udb_query_finish_result (udb_query_t const *q, /* {{{ */
       break;
     udb_result_finish_result (r, r_area);
   }
+} /* }}} void udb_query_clear_result */
+
+/* Returns true if the cached preparation matches the given columns, so that
+ * the column positions can be used again. */
+static _Bool udb_query_is_prepared (udb_query_preparation_area_t *prep_area, /* {{{ */
+    char **column_names, size_t column_num)
+{
+  size_t i;
+
+  if (!prep_area->prepared || (prep_area->column_names_num != column_num))
+    return (0);
+
+  for (i = 0; i < column_num; i++)
+    if (strcasecmp (prep_area->column_names[i], column_names[i]) != 0)
+      return (0);
+
+  return (1);
+} /* }}} _Bool udb_query_is_prepared */
+
+/* Sets `*dst' to a copy of `src' unless it holds that string already. */
+static int udb_query_set_string (char **dst, const char *src) /* {{{ */
+{
+  if ((*dst != NULL) && (strcmp (*dst, src) == 0))
+    return (0);
+
+  sfree (*dst);
+  *dst = strdup (src);
+  if (*dst == NULL)
+    return (-ENOMEM);
+  return (0);
+} /* }}} int udb_query_set_string */
+
+/* Ends the handling of one result. The column positions are kept for the next
+ * execution of the query. */
+void udb_query_finish_result (udb_query_t const *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area)
+{
+  if ((q == NULL) || (prep_area == NULL))
+    return;
+
+  prep_area->column_num = 0;
+  prep_area->interval = 0;
 } /* }}} void udb_query_finish_result */
 
 int udb_query_handle_result (udb_query_t const *q, /* {{{ */
@@ -998,6 +1127,46 @@ int udb_query_handle_result (udb_query_t const *q, /* {{{ */
   return (0);
 } /* }}} int udb_query_handle_result */
 
+int udb_query_handle_results (udb_query_t const *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area, char **column_values,
+    size_t rows_num)
+{
+  udb_result_preparation_area_t *r_area;
+  udb_result_t *r;
+  size_t success;
+
+  if ((q == NULL) || (prep_area == NULL) || (column_values == NULL))
+    return (-EINVAL);
+
+  if (rows_num == 0)
+    return (0);
+
+  if ((prep_area->column_num < 1) || (prep_area->host == NULL)
+      || (prep_area->plugin == NULL) || (prep_area->db_name == NULL))
+  {
+    ERROR ("db query utils: Query `%s': Query is not prepared; "
+        "can't handle result.", q->name);
+    return (-EINVAL);
+  }
+
+  success = 0;
+  for (r = q->results, r_area = prep_area->result_prep_areas;
+      r != NULL; r = r->next, r_area = r_area->next)
+  {
+    success += udb_result_handle_results (r, prep_area, r_area,
+        column_values, prep_area->column_num, rows_num);
+  }
+
+  if (success == 0)
+  {
+    ERROR ("db query utils: udb_query_handle_results (%s, %s): "
+        "All results failed.", prep_area->db_name, q->name);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int udb_query_handle_results */
+
 int udb_query_prepare_result (udb_query_t const *q, /* {{{ */
     udb_query_preparation_area_t *prep_area,
     const char *host, const char *plugin, const char *db_name,
@@ -1005,27 +1174,30 @@ int udb_query_prepare_result (udb_query_t const *q, /* {{{ */
 {
   udb_result_preparation_area_t *r_area;
   udb_result_t *r;
+  size_t i;
   int status;
 
   if ((q == NULL) || (prep_area == NULL))
     return (-EINVAL);
 
-  udb_query_finish_result (q, prep_area);
-
-  prep_area->column_num = column_num;
-  prep_area->host = strdup (host);
-  prep_area->plugin = strdup (plugin);
-  prep_area->db_name = strdup (db_name);
+  if ((udb_query_set_string (&prep_area->host, host) != 0)
+      || (udb_query_set_string (&prep_area->plugin, plugin) != 0)
+      || (udb_query_set_string (&prep_area->db_name, db_name) != 0))
+  {
+    ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.", q->name);
+    udb_query_clear_result (q, prep_area);
+    return (-ENOMEM);
+  }
 
   prep_area->interval = interval;
 
-  if ((prep_area->host == NULL) || (prep_area->plugin == NULL)
-      || (prep_area->db_name == NULL))
+  /* The result has the same columns as last time. */
+  if (udb_query_is_prepared (prep_area, column_names, column_num))
   {
-    ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.", q->name);
-    udb_query_finish_result (q, prep_area);
-    return (-ENOMEM);
+    prep_area->column_num = column_num;
+    return (0);
   }
+  prep_area->prepared = 0;
 
 #if defined(COLLECT_DEBUG) && COLLECT_DEBUG
   do
@@ -1048,18 +1220,46 @@ int udb_query_prepare_result (udb_query_t const *q, /* {{{ */
     {
       ERROR ("db query utils: Query `%s': Invalid number of result "
           "preparation areas.", q->name);
-      udb_query_finish_result (q, prep_area);
+      udb_query_clear_result (q, prep_area);
       return (-EINVAL);
     }
 
     status = udb_result_prepare_result (r, r_area, column_names, column_num);
     if (status != 0)
     {
-      udb_query_finish_result (q, prep_area);
+      udb_query_clear_result (q, prep_area);
       return (status);
     }
   }
 
+  /* Remember the columns for the next execution. */
+  for (i = 0; i < prep_area->column_names_num; i++)
+    sfree (prep_area->column_names[i]);
+  sfree (prep_area->column_names);
+  prep_area->column_names_num = 0;
+
+  prep_area->column_names = calloc (column_num, sizeof (char *));
+  if (prep_area->column_names == NULL)
+  {
+    ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.", q->name);
+    udb_query_clear_result (q, prep_area);
+    return (-ENOMEM);
+  }
+  for (i = 0; i < column_num; i++)
+  {
+    prep_area->column_names[i] = strdup (column_names[i]);
+    if (prep_area->column_names[i] == NULL)
+    {
+      ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.", q->name);
+      prep_area->column_names_num = i;
+      udb_query_clear_result (q, prep_area);
+      return (-ENOMEM);
+    }
+  }
+  prep_area->column_names_num = column_num;
+  prep_area->column_num = column_num;
+  prep_area->prepared = 1;
+
   return (0);
 } /* }}} int udb_query_prepare_result */
 
@@ -1106,6 +1306,7 @@ void
 udb_query_delete_preparation_area (udb_query_preparation_area_t *q_area) /* {{{ */
 {
   udb_result_preparation_area_t *r_area;
+  size_t i;
 
   if (q_area == NULL)
     return;
@@ -1119,8 +1320,11 @@ udb_query_delete_preparation_area (udb_query_preparation_area_t *q_area) /* {{{
 
     sfree (area->instances_pos);
     sfree (area->values_pos);
+    sfree (area->metadata_pos);
     sfree (area->instances_buffer);
     sfree (area->values_buffer);
+    sfree (area->metadata_buffer);
+    sfree (area->values);
     free (area);
   }
 
@@ -1128,6 +1332,10 @@ udb_query_delete_preparation_area (udb_query_preparation_area_t *q_area) /* {{{
   sfree (q_area->plugin);
   sfree (q_area->db_name);
 
+  for (i = 0; i < q_area->column_names_num; i++)
+    sfree (q_area->column_names[i]);
+  sfree (q_area->column_names);
+
   free (q_area);
 } /* }}} void udb_query_delete_preparation_area */
 
@@ -76,6 +76,13 @@ int udb_query_prepare_result (udb_query_t const *q,
     char **column_names, size_t column_num, cdtime_t interval);
 int udb_query_handle_result (udb_query_t const *q,
     udb_query_preparation_area_t *prep_area, char **column_values);
+/* Like calling udb_query_handle_result() for each of `rows_num' rows, but
+ * the value lists of each result are dispatched at once. `column_values'
+ * holds the rows one after another, i.e. `rows_num' times the number of
+ * columns passed to udb_query_prepare_result(). */
+int udb_query_handle_results (udb_query_t const *q,
+    udb_query_preparation_area_t *prep_area, char **column_values,
+    size_t rows_num);
 void udb_query_finish_result (udb_query_t const *q,
     udb_query_preparation_area_t *prep_area);
 
@@ -425,6 +425,8 @@ static int
 handle_udp(const struct udphdr *udp, int len)
 {
     char buf[PCAP_SNAPLEN];
+    if (len < (int) sizeof (*udp))
+	return 0;
     if ((ntohs (udp->UDP_DEST) != 53)
 		    && (ntohs (udp->UDP_SRC) != 53))
 	return 0;
@@ -525,6 +527,9 @@ handle_ip(const struct ip *ip, int len)
     if (ip->ip_v == 6)
 	return (handle_ipv6 ((void *) ip, len));
 
+    if ((offset < (int) sizeof (*ip)) || (offset > len))
+	return (0);
+
     in6_addr_from_buffer (&c_src_addr, &ip->ip_src.s_addr, sizeof (ip->ip_src.s_addr), AF_INET);
     in6_addr_from_buffer (&c_dst_addr, &ip->ip_dst.s_addr, sizeof (ip->ip_dst.s_addr), AF_INET);
     if (ignore_list_match (&c_src_addr))
@@ -711,6 +716,15 @@ void handle_pcap(u_char *udata, const struct pcap_pkthdr *hdr, const u_char *pkt
     query_count_total++;
     last_ts = hdr->ts;
 }
+
+/* public function */
+int handle_ip_packet (const u_char *pkt, int len)
+{
+    if ((len < (int) sizeof (struct ip)) || (len > PCAP_SNAPLEN))
+	return (0);
+
+    return (handle_ip ((const struct ip *) pkt, len));
+}
 #endif /* HAVE_PCAP_H */
 
 const char *qtype_str(int t)
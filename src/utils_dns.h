@@ -81,6 +81,10 @@ void dnstop_set_callback (void (*cb) (const rfc1035_header_t *));
 void ignore_list_add_name (const char *name);
 #if HAVE_PCAP_H
 void handle_pcap (u_char * udata, const struct pcap_pkthdr *hdr, const u_char * pkt);
+/* Handles an IPv4 or IPv6 packet without link layer header, as received
+ * from a SOCK_DGRAM packet socket. Safe to call from several threads.
+ * Returns 1 if a DNS message was found. */
+int handle_ip_packet (const u_char *pkt, int len);
 #endif
 
 const char *qtype_str(int t);
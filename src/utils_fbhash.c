@@ -36,6 +36,11 @@ struct fbhash_s
 {
   char *filename;
   time_t mtime;
+  /* Time of the last check for changes. The file is checked at most once
+   * per second. */
+  time_t last_check;
+  /* Incremented each time the file is (re-)read. */
+  unsigned long generation;
 
   pthread_mutex_t lock;
   c_avl_tree_t *tree;
@@ -173,6 +178,7 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
 
   fbh_free_tree (h->tree);
   h->tree = tree;
+  h->generation++;
 
   return (0);
 } /* }}} int fbh_read_file */
@@ -180,8 +186,14 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
 static int fbh_check_file (fbhash_t *h) /* {{{ */
 {
   struct stat statbuf;
+  time_t now;
   int status;
 
+  now = time (NULL);
+  if ((h->tree != NULL) && (h->last_check == now))
+    return (0);
+  h->last_check = now;
+
   memset (&statbuf, 0, sizeof (statbuf));
 
   status = stat (h->filename, &statbuf);
@@ -258,7 +270,6 @@ char *fbh_get (fbhash_t *h, const char *key) /* {{{ */
 
   pthread_mutex_lock (&h->lock);
 
-  /* TODO: Checking this every time may be a bit much..? */
   fbh_check_file (h);
 
   status = c_avl_get (h->tree, key, (void *) &value);
@@ -273,4 +284,19 @@ char *fbh_get (fbhash_t *h, const char *key) /* {{{ */
   return (value_copy);
 } /* }}} char *fbh_get */
 
+unsigned long fbh_generation (fbhash_t *h) /* {{{ */
+{
+  unsigned long generation;
+
+  if (h == NULL)
+    return (0);
+
+  pthread_mutex_lock (&h->lock);
+  fbh_check_file (h);
+  generation = h->generation;
+  pthread_mutex_unlock (&h->lock);
+
+  return (generation);
+} /* }}} unsigned long fbh_generation */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -34,7 +34,8 @@
  *   key: value
  * into a hash, which can then be queried. The file is given to `fbh_create',
  * the hash is queried using `fbh_get'. If the file is changed during runtime,
- * it will automatically be re-read.
+ * it will automatically be re-read. The file is checked for changes at most
+ * once per second.
  */
 
 struct fbhash_s;
@@ -47,6 +48,10 @@ void fbh_destroy (fbhash_t *h);
  * responsibility to free this memory. */
 char *fbh_get (fbhash_t *h, const char *key);
 
+/* Returns a number which changes whenever the file is re-read. Values derived
+ * from the results of `fbh_get' can be cached as long as it doesn't change. */
+unsigned long fbh_generation (fbhash_t *h);
+
 #endif /* UTILS_FBHASH_H */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,245 @@
+/**
+ * collectd - src/utils_format_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+/*
+ * Measures format_graphite() and format_json_value_list(), with and without
+ * their identifier caches, and format_binary_value_list(), alone and in
+ * batches, on the value lists of a few thousand interfaces and load averages,
+ * written in the same order every interval.
+ *
+ * Usage: bench_utils_format [identifiers [rounds]]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_format_binary.h"
+#include "utils_format_graphite.h"
+#include "utils_format_json.h"
+
+static data_source_t if_octets_dsrc[] = {
+  {"rx", DS_TYPE_DERIVE, 0, NAN},
+  {"tx", DS_TYPE_DERIVE, 0, NAN},
+};
+static data_set_t if_octets_ds = {"if_octets", 2, if_octets_dsrc};
+
+static data_source_t load_dsrc[] = {
+  {"shortterm", DS_TYPE_GAUGE, 0, 5000},
+  {"midterm", DS_TYPE_GAUGE, 0, 5000},
+  {"longterm", DS_TYPE_GAUGE, 0, 5000},
+};
+static data_set_t load_ds = {"load", 3, load_dsrc};
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+static void report (const char *name, double start, /* {{{ */
+    size_t ops_num, size_t bytes)
+{
+  double elapsed = now () - start;
+
+  printf ("%-14s %7.1f ns %12.0f ops/s %6.1f bytes\n", name,
+      1e9 * elapsed / (double) ops_num, (double) ops_num / elapsed,
+      (double) bytes / (double) ops_num);
+} /* }}} void report */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t vl_num = 10000;
+  size_t rounds = 100;
+  value_list_t *vls;
+  value_t *values;
+  graphite_cache_t *gc;
+  format_json_cache_t *jc;
+  format_binary_state_t bs;
+  char buffer[4096];
+  size_t bytes;
+  double start;
+  int status = 0;
+  size_t i;
+  size_t r;
+
+  if (argc > 1)
+    vl_num = (size_t) atoi (argv[1]);
+  if (argc > 2)
+    rounds = (size_t) atoi (argv[2]);
+  if ((argc > 3) || (vl_num < 1) || (rounds < 1))
+  {
+    fprintf (stderr, "Usage: %s [identifiers [rounds]]\n", argv[0]);
+    return (1);
+  }
+
+  vls = calloc (vl_num, sizeof (*vls));
+  values = calloc (3 * vl_num, sizeof (*values));
+  gc = graphite_cache_create (GRAPHITE_CACHE_SIZE);
+  jc = format_json_cache_create (FORMAT_JSON_CACHE_SIZE);
+  if ((vls == NULL) || (values == NULL) || (gc == NULL) || (jc == NULL))
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+
+  /* Every tenth value list is a load average, the others are interfaces. */
+  for (i = 0; i < vl_num; i++)
+  {
+    value_list_t *vl = vls + i;
+
+    vl->values = values + 3 * i;
+    vl->time = TIME_T_TO_CDTIME_T (1466000000) + (cdtime_t) i;
+    vl->interval = TIME_T_TO_CDTIME_T (10);
+    ssnprintf (vl->host, sizeof (vl->host), "host%zu.example.com", i / 100);
+    if ((i % 10) == 0)
+    {
+      vl->values_len = 3;
+      vl->values[0].gauge = 0.01 * (double) (i % 400);
+      vl->values[1].gauge = 0.02 * (double) (i % 300);
+      vl->values[2].gauge = 0.03 * (double) (i % 200);
+      sstrncpy (vl->plugin, "load", sizeof (vl->plugin));
+      sstrncpy (vl->type, "load", sizeof (vl->type));
+    }
+    else
+    {
+      vl->values_len = 2;
+      vl->values[0].derive = (derive_t) (i * 7919);
+      vl->values[1].derive = (derive_t) (i * 104729);
+      sstrncpy (vl->plugin, "interface", sizeof (vl->plugin));
+      ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance),
+          "eth%zu", i % 10);
+      sstrncpy (vl->type, "if_octets", sizeof (vl->type));
+    }
+  }
+
+#define VL_DS(i) (((i) % 10) == 0 ? &load_ds : &if_octets_ds)
+
+  bytes = 0;
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < vl_num; i++)
+    {
+      if (format_graphite (buffer, sizeof (buffer), VL_DS (i), vls + i,
+            "collectd.", NULL, '_', GRAPHITE_SEPARATE_INSTANCES) != 0)
+        status = 1;
+      bytes += strlen (buffer);
+    }
+  report ("graphite", start, rounds * vl_num, bytes);
+
+  bytes = 0;
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < vl_num; i++)
+    {
+      if (format_graphite_cached (gc, buffer, sizeof (buffer), VL_DS (i),
+            vls + i, "collectd.", NULL, '_',
+            GRAPHITE_SEPARATE_INSTANCES) != 0)
+        status = 1;
+      bytes += strlen (buffer);
+    }
+  report ("graphite/cache", start, rounds * vl_num, bytes);
+
+  /* One JSON array per value list, like write_http with a small buffer. */
+#define BENCH_JSON(name, call) do { \
+  bytes = 0; \
+  start = now (); \
+  for (r = 0; r < rounds; r++) \
+    for (i = 0; i < vl_num; i++) \
+    { \
+      size_t fill; \
+      size_t free_; \
+      format_json_initialize (buffer, &fill, &free_); \
+      if ((call) != 0) \
+        status = 1; \
+      format_json_finalize (buffer, &fill, &free_); \
+      bytes += fill; \
+    } \
+  report (name, start, rounds * vl_num, bytes); \
+} while (0)
+
+  BENCH_JSON ("json", format_json_value_list (buffer, &fill, &free_,
+        VL_DS (i), vls + i, /* store rates = */ 0));
+  BENCH_JSON ("json/cache", format_json_value_list_cached (jc,
+        buffer, &fill, &free_, VL_DS (i), vls + i, /* store rates = */ 0,
+        /* ret_needed = */ NULL));
+
+#undef BENCH_JSON
+
+  bytes = 0;
+  start = now ();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < vl_num; i++)
+    {
+      size_t fill = 0;
+      size_t free_ = sizeof (buffer);
+
+      format_binary_initialize (&bs);
+      if (format_binary_value_list (&bs, buffer, &fill, &free_,
+            VL_DS (i), vls + i, /* store rates = */ 0) != 0)
+        status = 1;
+      bytes += fill;
+    }
+  report ("binary", start, rounds * vl_num, bytes);
+
+  /* Value lists of the same host share the parts of their identifier, like
+   * write_http filling its buffer. */
+  bytes = 0;
+  start = now ();
+  for (r = 0; r < rounds; r++)
+  {
+    size_t fill = 0;
+    size_t free_ = sizeof (buffer);
+
+    format_binary_initialize (&bs);
+    for (i = 0; i < vl_num; i++)
+    {
+      int s = format_binary_value_list (&bs, buffer, &fill, &free_,
+          VL_DS (i), vls + i, /* store rates = */ 0);
+      if (s == -ENOMEM)
+      {
+        bytes += fill;
+        fill = 0;
+        free_ = sizeof (buffer);
+        format_binary_initialize (&bs);
+        s = format_binary_value_list (&bs, buffer, &fill, &free_,
+            VL_DS (i), vls + i, /* store rates = */ 0);
+      }
+      if (s != 0)
+        status = 1;
+    }
+    bytes += fill;
+  }
+  report ("binary/batch", start, rounds * vl_num, bytes);
+
+#undef VL_DS
+
+  format_json_cache_destroy (jc);
+  graphite_cache_destroy (gc);
+  sfree (values);
+  sfree (vls);
+
+  return (status);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
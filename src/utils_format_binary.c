@@ -0,0 +1,201 @@
+/**
+ * collectd - src/utils_format_binary.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
+#include "utils_cache.h"
+#include "utils_format_binary.h"
+
+/* Part types of the network protocol, see network.h. */
+#define BINARY_TYPE_HOST            0x0000
+#define BINARY_TYPE_PLUGIN          0x0002
+#define BINARY_TYPE_PLUGIN_INSTANCE 0x0003
+#define BINARY_TYPE_TYPE            0x0004
+#define BINARY_TYPE_TYPE_INSTANCE   0x0005
+#define BINARY_TYPE_VALUES          0x0006
+#define BINARY_TYPE_TIME_HR         0x0008
+#define BINARY_TYPE_INTERVAL_HR     0x0009
+
+#define BINARY_HEADER_SIZE 4
+
+static void binary_add_header (char **ptr, /* {{{ */
+    uint16_t type, size_t length)
+{
+  uint16_t tmp;
+
+  tmp = htons (type);
+  memcpy (*ptr, &tmp, sizeof (tmp));
+  tmp = htons ((uint16_t) length);
+  memcpy (*ptr + sizeof (tmp), &tmp, sizeof (tmp));
+  *ptr += BINARY_HEADER_SIZE;
+} /* }}} void binary_add_header */
+
+static void binary_add_string (char **ptr, /* {{{ */
+    uint16_t type, const char *str)
+{
+  size_t len = strlen (str) + 1;
+
+  binary_add_header (ptr, type, BINARY_HEADER_SIZE + len);
+  memcpy (*ptr, str, len);
+  *ptr += len;
+} /* }}} void binary_add_string */
+
+static void binary_add_number (char **ptr, /* {{{ */
+    uint16_t type, uint64_t value)
+{
+  binary_add_header (ptr, type, BINARY_HEADER_SIZE + sizeof (value));
+  value = htonll (value);
+  memcpy (*ptr, &value, sizeof (value));
+  *ptr += sizeof (value);
+} /* }}} void binary_add_number */
+
+void format_binary_initialize (format_binary_state_t *state) /* {{{ */
+{
+  memset (state, 0, sizeof (*state));
+} /* }}} void format_binary_initialize */
+
+int format_binary_value_list (format_binary_state_t *state, /* {{{ */
+    char *buffer, size_t *ret_buffer_fill, size_t *ret_buffer_free,
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
+{
+  const char *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  char *state_fields[] = { state->host, state->plugin,
+    state->plugin_instance, state->type, state->type_instance };
+  const uint16_t field_types[] = { BINARY_TYPE_HOST, BINARY_TYPE_PLUGIN,
+    BINARY_TYPE_PLUGIN_INSTANCE, BINARY_TYPE_TYPE,
+    BINARY_TYPE_TYPE_INSTANCE };
+  _Bool changed[STATIC_ARRAY_SIZE (fields)];
+  gauge_t const *rates = NULL;
+  gauge_t *rates_copy = NULL;
+  size_t needed;
+  char *ptr;
+  char *values_ptr;
+  size_t i;
+
+  if ((ds == NULL) || (vl->values_len != ds->ds_num))
+    return (-EINVAL);
+
+  /* Work out the size first, so nothing is written if it doesn't fit. */
+  needed = 0;
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+  {
+    changed[i] = (strcmp (fields[i], state_fields[i]) != 0);
+    if (changed[i])
+      needed += BINARY_HEADER_SIZE + strlen (fields[i]) + 1;
+  }
+  if (vl->time != state->time)
+    needed += BINARY_HEADER_SIZE + sizeof (uint64_t);
+  if (vl->interval != state->interval)
+    needed += BINARY_HEADER_SIZE + sizeof (uint64_t);
+  needed += BINARY_HEADER_SIZE + sizeof (uint16_t)
+    + vl->values_len * (sizeof (uint8_t) + sizeof (value_t));
+
+  if (needed > *ret_buffer_free)
+    return (-ENOMEM);
+
+  ptr = buffer + *ret_buffer_fill;
+
+  /* The same order as the network plugin writes the parts in. */
+  if (changed[0])
+    binary_add_string (&ptr, field_types[0], fields[0]);
+  if (vl->time != state->time)
+    binary_add_number (&ptr, BINARY_TYPE_TIME_HR, (uint64_t) vl->time);
+  if (vl->interval != state->interval)
+    binary_add_number (&ptr, BINARY_TYPE_INTERVAL_HR,
+        (uint64_t) vl->interval);
+  for (i = 1; i < STATIC_ARRAY_SIZE (fields); i++)
+    if (changed[i])
+      binary_add_string (&ptr, field_types[i], fields[i]);
+
+  binary_add_header (&ptr, BINARY_TYPE_VALUES, BINARY_HEADER_SIZE
+      + sizeof (uint16_t)
+      + vl->values_len * (sizeof (uint8_t) + sizeof (value_t)));
+  {
+    uint16_t num = htons ((uint16_t) vl->values_len);
+    memcpy (ptr, &num, sizeof (num));
+    ptr += sizeof (num);
+  }
+
+  values_ptr = ptr + vl->values_len;
+  for (i = 0; i < vl->values_len; i++)
+  {
+    uint8_t type = (uint8_t) ds->ds[i].type;
+    value_t value;
+
+    if ((ds->ds[i].type != DS_TYPE_GAUGE) && store_rates)
+    {
+      if (rates == NULL)
+        rates = uc_get_rate_dispatched (ds, vl);
+      if (rates == NULL)
+        rates = rates_copy = uc_get_rate (ds, vl);
+      if (rates == NULL)
+      {
+        WARNING ("utils_format_binary: uc_get_rate failed.");
+        return (-1);
+      }
+      type = DS_TYPE_GAUGE;
+      value.gauge = htond (rates[i]);
+    }
+    else if (ds->ds[i].type == DS_TYPE_GAUGE)
+      value.gauge = htond (vl->values[i].gauge);
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      value.counter = htonll (vl->values[i].counter);
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      value.derive = (derive_t) htonll ((uint64_t) vl->values[i].derive);
+    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      value.absolute = htonll (vl->values[i].absolute);
+    else
+    {
+      ERROR ("format_binary: Unknown data source type: %i",
+          ds->ds[i].type);
+      sfree (rates_copy);
+      return (-1);
+    }
+
+    memcpy (ptr + i, &type, sizeof (type));
+    memcpy (values_ptr + i * sizeof (value), &value, sizeof (value));
+  }
+  ptr = values_ptr + vl->values_len * sizeof (value_t);
+  sfree (rates_copy);
+
+  assert (ptr == buffer + *ret_buffer_fill + needed);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+    if (changed[i])
+      sstrncpy (state_fields[i], fields[i], DATA_MAX_NAME_LEN);
+  state->time = vl->time;
+  state->interval = vl->interval;
+
+  *ret_buffer_fill += needed;
+  *ret_buffer_free -= needed;
+
+  return (0);
+} /* }}} int format_binary_value_list */
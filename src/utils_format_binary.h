@@ -0,0 +1,64 @@
+/**
+ * collectd - src/utils_format_binary.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_FORMAT_BINARY_H
+#define UTILS_FORMAT_BINARY_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/*
+ * Value lists in the binary protocol of the network plugin, see
+ * <https://collectd.org/wiki/index.php/Binary_protocol>. As in network
+ * packets, the parts of the identifier, the time and the interval are only
+ * written when they differ from those of the previous value list in the same
+ * buffer, so a message with many value lists of a host mostly consists of the
+ * values. Messages are neither signed nor encrypted and can be decoded by any
+ * parser of the protocol.
+ *
+ * The state remembers what has been written to the buffer. It has to be reset
+ * with format_binary_initialize() whenever a new buffer is started.
+ */
+struct format_binary_state_s
+{
+  char host[DATA_MAX_NAME_LEN];
+  char plugin[DATA_MAX_NAME_LEN];
+  char plugin_instance[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  char type_instance[DATA_MAX_NAME_LEN];
+  cdtime_t time;
+  cdtime_t interval;
+};
+typedef struct format_binary_state_s format_binary_state_t;
+
+void format_binary_initialize (format_binary_state_t *state);
+
+/* Appends "vl" to the buffer. With "store_rates", counters, derives and
+ * absolutes are converted to rates and written as gauges. If the value list
+ * doesn't fit, -ENOMEM is returned and the buffer and the state are left as
+ * they were. */
+int format_binary_value_list (format_binary_state_t *state,
+    char *buffer, size_t *ret_buffer_fill, size_t *ret_buffer_free,
+    const data_set_t *ds, const value_list_t *vl, int store_rates);
+
+#endif /* UTILS_FORMAT_BINARY_H */
@@ -27,9 +27,51 @@
 
 #include "utils_format_graphite.h"
 #include "utils_cache.h"
+#include "utils_intern.h"
+
+#include <pthread.h>
 
 #define GRAPHITE_FORBIDDEN " \t\"\\:!/()\n\r"
 
+/* The flags which change the metric path. */
+#define GRAPHITE_PATH_FLAGS (GRAPHITE_SEPARATE_INSTANCES \
+        | GRAPHITE_ALWAYS_APPEND_DS | GRAPHITE_FORMAT_ASIS)
+
+struct graphite_cache_entry_s;
+typedef struct graphite_cache_entry_s graphite_cache_entry_t;
+struct graphite_cache_entry_s
+{
+    identifier_t id;
+    /* One escaped metric path per data source. */
+    char **keys;
+    size_t keys_num;
+
+    graphite_cache_entry_t *hash_next;
+    graphite_cache_entry_t *lru_prev;
+    graphite_cache_entry_t *lru_next;
+};
+
+struct graphite_cache_s
+{
+    pthread_mutex_t lock;
+
+    graphite_cache_entry_t **buckets;
+    size_t buckets_num;
+    size_t entries_num;
+    size_t entries_max;
+
+    /* Most recently used first. */
+    graphite_cache_entry_t *lru_head;
+    graphite_cache_entry_t *lru_tail;
+
+    /* The arguments the cached paths were formatted with. */
+    char *prefix;
+    char *postfix;
+    char escape_char;
+    unsigned int flags;
+    _Bool configured;
+};
+
 /* Utils functions to format data sets in graphite format.
  * Largely taken from write_graphite.c as it remains the same formatting */
 
@@ -44,8 +86,8 @@ static int gr_format_values (char *ret, size_t ret_len,
 
     memset (ret, 0, ret_len);
 
-#define BUFFER_ADD(...) do { \
-    status = ssnprintf (ret + offset, ret_len - offset, \
+#define BUFFER_ADD_FUNC(func, ...) do { \
+    status = func (ret + offset, ret_len - offset, \
             __VA_ARGS__); \
     if (status < 1) \
     { \
@@ -60,15 +102,17 @@ static int gr_format_values (char *ret, size_t ret_len,
 } while (0)
 
     if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-        BUFFER_ADD (GAUGE_FORMAT, vl->values[ds_num].gauge);
+        BUFFER_ADD_FUNC (format_gauge, vl->values[ds_num].gauge);
     else if (rates != NULL)
-        BUFFER_ADD ("%f", rates[ds_num]);
+        /* "%f" */
+        BUFFER_ADD_FUNC (format_fixed, rates[ds_num], 6);
     else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-        BUFFER_ADD ("%llu", vl->values[ds_num].counter);
+        BUFFER_ADD_FUNC (format_uint64,
+                (uint64_t) vl->values[ds_num].counter);
     else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-        BUFFER_ADD ("%"PRIi64, vl->values[ds_num].derive);
+        BUFFER_ADD_FUNC (format_int64, vl->values[ds_num].derive);
     else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-        BUFFER_ADD ("%"PRIu64, vl->values[ds_num].absolute);
+        BUFFER_ADD_FUNC (format_uint64, vl->values[ds_num].absolute);
     else
     {
         ERROR ("gr_format_values plugin: Unknown data source type: %i",
@@ -76,7 +120,7 @@ static int gr_format_values (char *ret, size_t ret_len,
         return (-1);
     }
 
-#undef BUFFER_ADD
+#undef BUFFER_ADD_FUNC
 
     return (0);
 }
@@ -84,28 +128,30 @@ static int gr_format_values (char *ret, size_t ret_len,
 static void gr_copy_escape_part (char *dst, const char *src, size_t dst_len,
     char escape_char)
 {
-    size_t i;
-
-    memset (dst, 0, dst_len);
+    size_t pos = 0;
 
+    dst[0] = 0;
     if (src == NULL)
         return;
 
-    for (i = 0; i < dst_len; i++)
+    /* Dots, white space and control characters are replaced, runs of other
+     * characters are copied at once. */
+    while (pos < dst_len - 1)
     {
-        if (src[i] == 0)
-        {
-            dst[i] = 0;
+        size_t len = strscan (src + pos, ". \x7f", STRSCAN_CONTROL);
+
+        if (len > dst_len - 1 - pos)
+            len = dst_len - 1 - pos;
+        memcpy (dst + pos, src + pos, len);
+        pos += len;
+
+        if ((pos >= dst_len - 1) || (src[pos] == 0))
             break;
-        }
 
-        if ((src[i] == '.')
-                || isspace ((int) src[i])
-                || iscntrl ((int) src[i]))
-            dst[i] = escape_char;
-        else
-            dst[i] = src[i];
+        dst[pos] = escape_char;
+        pos++;
     }
+    dst[pos] = 0;
 }
 
 static int gr_format_name_asis (char *ret, int ret_len,
@@ -201,82 +247,349 @@ static void escape_graphite_string (char *buffer, char escape_char)
 		*head = escape_char;
 }
 
-int format_graphite (char *buffer, size_t buffer_size,
+/* Formats the escaped metric path of data source "ds_index" into "key". */
+static int gr_format_key (char *key, size_t key_size,
+    data_set_t const *ds, value_list_t const *vl, size_t ds_index,
+    char const *prefix, char const *postfix, char const escape_char,
+    unsigned int flags)
+{
+    char const *ds_name = NULL;
+    int status;
+
+    if ((flags & GRAPHITE_ALWAYS_APPEND_DS)
+        || (ds->ds_num > 1))
+      ds_name = ds->ds[ds_index].name;
+
+    /* Copy the identifier to `key' and escape it. */
+
+    if ((flags & GRAPHITE_FORMAT_ASIS))
+      status = gr_format_name_asis (key, key_size, vl, ds_name, prefix);
+    else
+      status = gr_format_name (key, key_size, vl, ds_name,
+                               prefix, postfix, escape_char, flags);
+    if (status != 0)
+    {
+        ERROR ("format_graphite: error with gr_format_name");
+        return (status);
+    }
+
+    if (!(flags & GRAPHITE_FORMAT_ASIS))
+      escape_graphite_string (key, escape_char);
+
+    return (0);
+}
+
+static void gr_cache_entry_free (graphite_cache_entry_t *e) /* {{{ */
+{
+    size_t i;
+
+    if (e == NULL)
+        return;
+
+    for (i = 0; i < e->keys_num; i++)
+        sfree (e->keys[i]);
+    sfree (e->keys);
+    identifier_destroy (&e->id);
+    sfree (e);
+} /* }}} void gr_cache_entry_free */
+
+/* NOTE: You must hold cache->lock when calling this function! */
+static void gr_cache_unlink (graphite_cache_t *cache, /* {{{ */
+        graphite_cache_entry_t *e)
+{
+    graphite_cache_entry_t **ptr;
+
+    for (ptr = cache->buckets + (e->id.hash & (cache->buckets_num - 1));
+            *ptr != e; ptr = &(*ptr)->hash_next)
+        assert (*ptr != NULL);
+    *ptr = e->hash_next;
+
+    if (e->lru_prev != NULL)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->lru_head = e->lru_next;
+    if (e->lru_next != NULL)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+
+    cache->entries_num--;
+} /* }}} void gr_cache_unlink */
+
+/* NOTE: You must hold cache->lock when calling this function! */
+static void gr_cache_clear (graphite_cache_t *cache) /* {{{ */
+{
+    while (cache->lru_head != NULL)
+    {
+        graphite_cache_entry_t *e = cache->lru_head;
+
+        gr_cache_unlink (cache, e);
+        gr_cache_entry_free (e);
+    }
+} /* }}} void gr_cache_clear */
+
+/* Clears the cache if the arguments differ from the ones the cached paths
+ * were formatted with.
+ * NOTE: You must hold cache->lock when calling this function! */
+static int gr_cache_configure (graphite_cache_t *cache, /* {{{ */
+        char const *prefix, char const *postfix, char const escape_char,
+        unsigned int flags)
+{
+    flags &= GRAPHITE_PATH_FLAGS;
+
+    if (cache->configured
+            && (cache->escape_char == escape_char)
+            && (cache->flags == flags)
+            && ((prefix == NULL) ? (cache->prefix == NULL)
+                : ((cache->prefix != NULL)
+                    && (strcmp (prefix, cache->prefix) == 0)))
+            && ((postfix == NULL) ? (cache->postfix == NULL)
+                : ((cache->postfix != NULL)
+                    && (strcmp (postfix, cache->postfix) == 0))))
+        return (0);
+
+    gr_cache_clear (cache);
+    sfree (cache->prefix);
+    sfree (cache->postfix);
+    cache->configured = 0;
+
+    if (prefix != NULL)
+    {
+        cache->prefix = strdup (prefix);
+        if (cache->prefix == NULL)
+            return (ENOMEM);
+    }
+    if (postfix != NULL)
+    {
+        cache->postfix = strdup (postfix);
+        if (cache->postfix == NULL)
+            return (ENOMEM);
+    }
+    cache->escape_char = escape_char;
+    cache->flags = flags;
+    cache->configured = 1;
+
+    return (0);
+} /* }}} int gr_cache_configure */
+
+/* Returns the entry of "vl", creating it and evicting the least recently
+ * used entry if necessary.
+ * NOTE: You must hold cache->lock when calling this function! */
+static graphite_cache_entry_t *gr_cache_get (graphite_cache_t *cache, /* {{{ */
+        data_set_t const *ds, value_list_t const *vl,
+        char const *prefix, char const *postfix, char const escape_char,
+        unsigned int flags)
+{
+    graphite_cache_entry_t *e;
+    uint32_t hash = identifier_hash_vl (vl);
+    size_t bucket = hash & (cache->buckets_num - 1);
+    size_t i;
+
+    for (e = cache->buckets[bucket]; e != NULL; e = e->hash_next)
+        if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+            break;
+
+    if ((e != NULL) && (e->keys_num == ds->ds_num))
+    {
+        /* Move to the front of the LRU list. */
+        if (e->lru_prev != NULL)
+        {
+            e->lru_prev->lru_next = e->lru_next;
+            if (e->lru_next != NULL)
+                e->lru_next->lru_prev = e->lru_prev;
+            else
+                cache->lru_tail = e->lru_prev;
+
+            e->lru_prev = NULL;
+            e->lru_next = cache->lru_head;
+            cache->lru_head->lru_prev = e;
+            cache->lru_head = e;
+        }
+        return (e);
+    }
+    else if (e != NULL)
+    {
+        gr_cache_unlink (cache, e);
+        gr_cache_entry_free (e);
+    }
+
+    e = calloc (1, sizeof (*e));
+    if (e == NULL)
+        return (NULL);
+    e->keys = calloc (ds->ds_num, sizeof (*e->keys));
+    if ((e->keys == NULL) || (identifier_create (&e->id, vl) != 0))
+    {
+        sfree (e->keys);
+        sfree (e);
+        return (NULL);
+    }
+    e->keys_num = ds->ds_num;
+
+    for (i = 0; i < ds->ds_num; i++)
+    {
+        char key[10*DATA_MAX_NAME_LEN];
+
+        if ((gr_format_key (key, sizeof (key), ds, vl, i,
+                        prefix, postfix, escape_char, flags) != 0)
+                || ((e->keys[i] = strdup (key)) == NULL))
+        {
+            gr_cache_entry_free (e);
+            return (NULL);
+        }
+    }
+
+    if (cache->entries_num >= cache->entries_max)
+    {
+        graphite_cache_entry_t *oldest = cache->lru_tail;
+
+        gr_cache_unlink (cache, oldest);
+        gr_cache_entry_free (oldest);
+    }
+
+    e->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = e;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL)
+        cache->lru_head->lru_prev = e;
+    else
+        cache->lru_tail = e;
+    cache->lru_head = e;
+    cache->entries_num++;
+
+    return (e);
+} /* }}} graphite_cache_entry_t *gr_cache_get */
+
+graphite_cache_t *graphite_cache_create (size_t max_entries) /* {{{ */
+{
+    graphite_cache_t *cache;
+
+    if (max_entries == 0)
+        return (NULL);
+
+    cache = calloc (1, sizeof (*cache));
+    if (cache == NULL)
+        return (NULL);
+
+    /* A power of two, so the bucket is a mask of the hash. */
+    cache->buckets_num = 1;
+    while (cache->buckets_num < max_entries)
+        cache->buckets_num *= 2;
+
+    cache->buckets = calloc (cache->buckets_num, sizeof (*cache->buckets));
+    if (cache->buckets == NULL)
+    {
+        sfree (cache);
+        return (NULL);
+    }
+    cache->entries_max = max_entries;
+    pthread_mutex_init (&cache->lock, /* attr = */ NULL);
+
+    return (cache);
+} /* }}} graphite_cache_t *graphite_cache_create */
+
+void graphite_cache_destroy (graphite_cache_t *cache) /* {{{ */
+{
+    if (cache == NULL)
+        return;
+
+    gr_cache_clear (cache);
+    sfree (cache->buckets);
+    sfree (cache->prefix);
+    sfree (cache->postfix);
+    pthread_mutex_destroy (&cache->lock);
+    sfree (cache);
+} /* }}} void graphite_cache_destroy */
+
+int format_graphite_cached (graphite_cache_t *cache,
+    char *buffer, size_t buffer_size,
     data_set_t const *ds, value_list_t const *vl,
     char const *prefix, char const *postfix, char const escape_char,
     unsigned int flags)
 {
     int status = 0;
     size_t i;
-    int buffer_pos = 0;
+    size_t buffer_pos = 0;
 
-    gauge_t *rates = NULL;
+    gauge_t const *rates = NULL;
+    gauge_t *rates_copy = NULL;
     if (flags & GRAPHITE_STORE_RATES)
-      rates = uc_get_rate (ds, vl);
+    {
+      rates = uc_get_rate_dispatched (ds, vl);
+      if (rates == NULL)
+        rates = rates_copy = uc_get_rate (ds, vl);
+    }
 
     for (i = 0; i < ds->ds_num; i++)
     {
-        char const *ds_name = NULL;
         char        key[10*DATA_MAX_NAME_LEN];
         char        values[512];
         size_t      message_len;
-        char        message[1024];
 
-        if ((flags & GRAPHITE_ALWAYS_APPEND_DS)
-            || (ds->ds_num > 1))
-          ds_name = ds->ds[i].name;
-
-        /* Copy the identifier to `key' and escape it. */
+        key[0] = 0;
+        if (cache != NULL)
+        {
+            graphite_cache_entry_t *e = NULL;
+
+            pthread_mutex_lock (&cache->lock);
+            if (gr_cache_configure (cache, prefix, postfix, escape_char,
+                        flags) == 0)
+                e = gr_cache_get (cache, ds, vl,
+                        prefix, postfix, escape_char, flags);
+            if (e != NULL)
+                sstrncpy (key, e->keys[i], sizeof (key));
+            pthread_mutex_unlock (&cache->lock);
+        }
 
-        if ((flags & GRAPHITE_FORMAT_ASIS))
-          status = gr_format_name_asis (key, sizeof (key), vl, ds_name, prefix);
-        else
-          status = gr_format_name (key, sizeof (key), vl, ds_name,
-                                   prefix, postfix, escape_char, flags);
-        if (status != 0)
+        /* Without a cache or if memory is short. */
+        if (key[0] == 0)
         {
-            ERROR ("format_graphite: error with gr_format_name");
-            sfree (rates);
-            return (status);
+            status = gr_format_key (key, sizeof (key), ds, vl, i,
+                    prefix, postfix, escape_char, flags);
+            if (status != 0)
+            {
+                sfree (rates_copy);
+                return (status);
+            }
         }
 
-        if (!(flags & GRAPHITE_FORMAT_ASIS))
-          escape_graphite_string (key, escape_char);
         /* Convert the values to an ASCII representation and put that into
          * `values'. */
         status = gr_format_values (values, sizeof (values), i, ds, vl, rates);
         if (status != 0)
         {
             ERROR ("format_graphite: error with gr_format_values");
-            sfree (rates);
+            sfree (rates_copy);
             return (status);
         }
 
-        /* Compute the graphite command */
-        message_len = (size_t) ssnprintf (message, sizeof (message),
+        /* Compute the graphite command and append it in case we got
+         * multiple data sets. */
+        message_len = (size_t) ssnprintf (buffer + buffer_pos,
+                buffer_size - buffer_pos,
                 "%s %s %u\r\n",
                 key,
                 values,
                 (unsigned int) CDTIME_T_TO_TIME_T (vl->time));
-        if (message_len >= sizeof (message)) {
-            ERROR ("format_graphite: message buffer too small: "
-                    "Need %zu bytes.", message_len + 1);
-            sfree (rates);
-            return (-ENOMEM);
-        }
-
-        /* Append it in case we got multiple data set */
         if ((buffer_pos + message_len) >= buffer_size)
         {
             ERROR ("format_graphite: target buffer too small");
-            sfree (rates);
+            buffer[buffer_pos] = 0;
+            sfree (rates_copy);
             return (-ENOMEM);
         }
-        memcpy((void *) (buffer + buffer_pos), message, message_len);
         buffer_pos += message_len;
     }
-    sfree (rates);
+    sfree (rates_copy);
     return (status);
+} /* int format_graphite_cached */
+
+int format_graphite (char *buffer, size_t buffer_size,
+    data_set_t const *ds, value_list_t const *vl,
+    char const *prefix, char const *postfix, char const escape_char,
+    unsigned int flags)
+{
+    return (format_graphite_cached (/* cache = */ NULL, buffer, buffer_size,
+                ds, vl, prefix, postfix, escape_char, flags));
 } /* int format_graphite */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
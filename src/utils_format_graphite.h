@@ -36,4 +36,27 @@ int format_graphite (char *buffer,
     const char *postfix, const char escape_char,
     unsigned int flags);
 
+/* Number of identifiers a plugin's cache remembers by default. */
+#define GRAPHITE_CACHE_SIZE 16384
+
+/*
+ * Cache of the formatted metric paths of recently written identifiers. The
+ * least recently used identifier is evicted when the cache is full. A cache
+ * remembers the prefix, postfix, escape character and flags it was used with
+ * and is cleared when they change. Caches are thread-safe.
+ */
+struct graphite_cache_s;
+typedef struct graphite_cache_s graphite_cache_t;
+
+graphite_cache_t *graphite_cache_create (size_t max_entries);
+void graphite_cache_destroy (graphite_cache_t *cache);
+
+/* Like format_graphite(), but takes the metric paths from "cache" if
+ * possible. "cache" may be NULL. */
+int format_graphite_cached (graphite_cache_t *cache,
+    char *buffer, size_t buffer_size, const data_set_t *ds,
+    const value_list_t *vl, const char *prefix,
+    const char *postfix, const char escape_char,
+    unsigned int flags);
+
 #endif /* UTILS_FORMAT_GRAPHITE_H */
@@ -30,226 +30,253 @@
 
 #include "utils_cache.h"
 #include "utils_format_json.h"
+#include "utils_intern.h"
 
-static int json_escape_string (char *buffer, size_t buffer_size, /* {{{ */
-    const char *string)
+#include <pthread.h>
+
+/* Output buffer which keeps counting when it is full, so the length of the
+ * complete output is known. Only "size - 1" bytes are used, leaving room for
+ * the terminating null byte. */
+struct json_buffer_s
 {
-  size_t src_pos;
-  size_t dst_pos;
+  char *buffer;
+  size_t size;
+  size_t pos;
+};
+typedef struct json_buffer_s json_buffer_t;
 
-  if ((buffer == NULL) || (string == NULL))
-    return (-EINVAL);
+struct format_json_cache_entry_s;
+typedef struct format_json_cache_entry_s format_json_cache_entry_t;
+struct format_json_cache_entry_s
+{
+  identifier_t id;
+  size_t ds_num;
+
+  /* ,"dstypes":[..],"dsnames":[..] */
+  char *ds_info;
+  size_t ds_info_len;
+  /* ,"host":"..",..,"type_instance":".." */
+  char *ident;
+  size_t ident_len;
+
+  format_json_cache_entry_t *hash_next;
+  format_json_cache_entry_t *lru_prev;
+  format_json_cache_entry_t *lru_next;
+};
+
+struct format_json_cache_s
+{
+  pthread_mutex_t lock;
 
-  if (buffer_size < 3)
-    return (-ENOMEM);
+  format_json_cache_entry_t **buckets;
+  size_t buckets_num;
+  size_t entries_num;
+  size_t entries_max;
 
-  dst_pos = 0;
+  /* Most recently used first. */
+  format_json_cache_entry_t *lru_head;
+  format_json_cache_entry_t *lru_tail;
+};
 
-#define BUFFER_ADD(c) do { \
-  if (dst_pos >= (buffer_size - 1)) { \
-    buffer[buffer_size - 1] = 0; \
-    return (-ENOMEM); \
-  } \
-  buffer[dst_pos] = (c); \
-  dst_pos++; \
-} while (0)
+static void json_add (json_buffer_t *b, /* {{{ */
+    const char *str, size_t len)
+{
+  /* Once something didn't fit, "pos" is too large for anything to fit. */
+  if ((b->pos + len) < b->size)
+    memcpy (b->buffer + b->pos, str, len);
+  b->pos += len;
+} /* }}} void json_add */
 
-  /* Escape special characters */
-  BUFFER_ADD ('"');
-  for (src_pos = 0; string[src_pos] != 0; src_pos++)
+#define JSON_ADD_LITERAL(b, str) json_add ((b), (str), sizeof (str) - 1)
+
+static void json_add_string (json_buffer_t *b, const char *str) /* {{{ */
+{
+  json_add (b, str, strlen (str));
+} /* }}} void json_add_string */
+
+/* Where char is signed, the check "*ptr > 0x001F" this replaced has always
+ * caught bytes from 0x80 on, too. */
+#if CHAR_MIN < 0
+# define JSON_ESCAPE_FLAGS (STRSCAN_CONTROL | STRSCAN_HIGH)
+#else
+# define JSON_ESCAPE_FLAGS STRSCAN_CONTROL
+#endif
+
+static void json_add_escaped (json_buffer_t *b, const char *str) /* {{{ */
+{
+  const char *ptr = str;
+
+  JSON_ADD_LITERAL (b, "\"");
+  while (42)
   {
-    if ((string[src_pos] == '"')
-        || (string[src_pos] == '\\'))
+    /* Most strings have nothing to escape and are added at once. */
+    size_t len = strscan (ptr, "\"\\", JSON_ESCAPE_FLAGS);
+
+    json_add (b, ptr, len);
+    ptr += len;
+    if (*ptr == 0)
+      break;
+
+    /* Escape special characters */
+    if ((*ptr == '"') || (*ptr == '\\'))
     {
-      BUFFER_ADD ('\\');
-      BUFFER_ADD (string[src_pos]);
+      char escaped[2] = { '\\', *ptr };
+      json_add (b, escaped, sizeof (escaped));
     }
-    else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD ('?');
     else
-      BUFFER_ADD (string[src_pos]);
-  } /* for */
-  BUFFER_ADD ('"');
-  buffer[dst_pos] = 0;
-
-#undef BUFFER_ADD
-
-  return (0);
-} /* }}} int json_escape_string */
+      JSON_ADD_LITERAL (b, "?");
+    ptr++;
+  }
+  JSON_ADD_LITERAL (b, "\"");
+} /* }}} void json_add_escaped */
+
+/* Adds the number formatted by "func (tmp, sizeof (tmp), ...)", which
+ * returns the length like snprintf(3) does. */
+#define JSON_ADD_FUNC(b, func, ...) do { \
+  char tmp__[64]; \
+  int status__ = func (tmp__, sizeof (tmp__), __VA_ARGS__); \
+  if ((status__ < 1) || ((size_t) status__ >= sizeof (tmp__))) \
+    return (-1); \
+  json_add ((b), tmp__, (size_t) status__); \
+} while (0)
 
-static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
+static int values_to_json (json_buffer_t *b, /* {{{ */
                 const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  size_t offset = 0;
   size_t i;
-  gauge_t *rates = NULL;
+  gauge_t const *rates = NULL;
+  gauge_t *rates_copy = NULL;
 
-  memset (buffer, 0, buffer_size);
+#define JSON_FAIL(status) do { \
+  sfree (rates_copy); \
+  return (status); \
+} while (0)
 
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-  { \
-    sfree(rates); \
-    return (-1); \
-  } \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-  { \
-    sfree(rates); \
-    return (-ENOMEM); \
-  } \
-  else \
-    offset += ((size_t) status); \
+/* Frees "rates_copy" if formatting the number fails. */
+#define JSON_ADD_NUMBER(func, ...) do { \
+  char tmp[64]; \
+  int status = func (tmp, sizeof (tmp), __VA_ARGS__); \
+  if ((status < 1) || ((size_t) status >= sizeof (tmp))) \
+    JSON_FAIL (-1); \
+  json_add (b, tmp, (size_t) status); \
 } while (0)
 
-  BUFFER_ADD ("[");
+/* format_gauge() only implements the default format. */
+#if JSON_GAUGE_FORMAT_DEFAULT
+# define JSON_ADD_VALUE(value) JSON_ADD_NUMBER (format_gauge, value)
+#else
+# define JSON_ADD_VALUE(value) JSON_ADD_NUMBER (ssnprintf, \
+    JSON_GAUGE_FORMAT, value)
+#endif
+
+  JSON_ADD_LITERAL (b, "[");
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
+      JSON_ADD_LITERAL (b, ",");
 
     if (ds->ds[i].type == DS_TYPE_GAUGE)
     {
       if(isfinite (vl->values[i].gauge))
-        BUFFER_ADD (JSON_GAUGE_FORMAT, vl->values[i].gauge);
+        JSON_ADD_VALUE (vl->values[i].gauge);
       else
-        BUFFER_ADD ("null");
+        JSON_ADD_LITERAL (b, "null");
     }
     else if (store_rates)
     {
       if (rates == NULL)
-        rates = uc_get_rate (ds, vl);
+        rates = uc_get_rate_dispatched (ds, vl);
+      if (rates == NULL)
+        rates = rates_copy = uc_get_rate (ds, vl);
       if (rates == NULL)
       {
         WARNING ("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
-        return (-1);
+        JSON_FAIL (-1);
       }
 
       if(isfinite (rates[i]))
-        BUFFER_ADD (JSON_GAUGE_FORMAT, rates[i]);
+        JSON_ADD_VALUE (rates[i]);
       else
-        BUFFER_ADD ("null");
+        JSON_ADD_LITERAL (b, "null");
     }
     else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD ("%llu", vl->values[i].counter);
+      JSON_ADD_NUMBER (format_uint64, (uint64_t) vl->values[i].counter);
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD ("%"PRIi64, vl->values[i].derive);
+      JSON_ADD_NUMBER (format_int64, vl->values[i].derive);
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD ("%"PRIu64, vl->values[i].absolute);
+      JSON_ADD_NUMBER (format_uint64, vl->values[i].absolute);
     else
     {
       ERROR ("format_json: Unknown data source type: %i",
           ds->ds[i].type);
-      sfree (rates);
-      return (-1);
+      JSON_FAIL (-1);
     }
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
+  JSON_ADD_LITERAL (b, "]");
 
-#undef BUFFER_ADD
+#undef JSON_ADD_VALUE
+#undef JSON_ADD_NUMBER
+#undef JSON_FAIL
 
-  DEBUG ("format_json: values_to_json: buffer = %s;", buffer);
-  sfree(rates);
+  sfree (rates_copy);
   return (0);
 } /* }}} int values_to_json */
 
-static int dstypes_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
+/* The parts which only depend on the data set. */
+static void ds_info_to_json (json_buffer_t *b, /* {{{ */
+    const data_set_t *ds)
 {
-  size_t offset = 0;
   size_t i;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  JSON_ADD_LITERAL (b, ",\"dstypes\":[");
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
+      JSON_ADD_LITERAL (b, ",");
 
-    BUFFER_ADD ("\"%s\"", DS_TYPE_TO_STRING (ds->ds[i].type));
+    JSON_ADD_LITERAL (b, "\"");
+    json_add_string (b, DS_TYPE_TO_STRING (ds->ds[i].type));
+    JSON_ADD_LITERAL (b, "\"");
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dstypes_to_json: buffer = %s;", buffer);
-
-  return (0);
-} /* }}} int dstypes_to_json */
 
-static int dsnames_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
-{
-  size_t offset = 0;
-  size_t i;
-
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  JSON_ADD_LITERAL (b, "],\"dsnames\":[");
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
+      JSON_ADD_LITERAL (b, ",");
 
-    BUFFER_ADD ("\"%s\"", ds->ds[i].name);
+    JSON_ADD_LITERAL (b, "\"");
+    json_add_string (b, ds->ds[i].name);
+    JSON_ADD_LITERAL (b, "\"");
   } /* for ds->ds_num */
-  BUFFER_ADD ("]");
+  JSON_ADD_LITERAL (b, "]");
+} /* }}} void ds_info_to_json */
 
-#undef BUFFER_ADD
+/* The parts which only depend on the identifier. */
+static void ident_to_json (json_buffer_t *b, /* {{{ */
+    const value_list_t *vl)
+{
+#define JSON_ADD_KEYVAL(key, value) do { \
+  JSON_ADD_LITERAL (b, ",\"" key "\":"); \
+  json_add_escaped (b, (value)); \
+} while (0)
 
-  DEBUG ("format_json: dsnames_to_json: buffer = %s;", buffer);
+  JSON_ADD_KEYVAL ("host", vl->host);
+  JSON_ADD_KEYVAL ("plugin", vl->plugin);
+  JSON_ADD_KEYVAL ("plugin_instance", vl->plugin_instance);
+  JSON_ADD_KEYVAL ("type", vl->type);
+  JSON_ADD_KEYVAL ("type_instance", vl->type_instance);
 
-  return (0);
-} /* }}} int dsnames_to_json */
+#undef JSON_ADD_KEYVAL
+} /* }}} void ident_to_json */
 
-static int meta_data_keys_to_json (char *buffer, size_t buffer_size, /* {{{ */
+/* Adds the keys which could be read, returning ENOENT if there were none. */
+static int meta_data_keys_to_json (json_buffer_t *b, /* {{{ */
     meta_data_t *meta, char **keys, size_t keys_num)
 {
-  size_t offset = 0;
-  int status;
+  size_t start = b->pos;
   size_t i;
 
-  buffer[0] = 0;
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
   for (i = 0; i < keys_num; ++i)
   {
     int type;
@@ -261,70 +288,94 @@ static int meta_data_keys_to_json (char *buffer, size_t buffer_size, /* {{{ */
       char *value = NULL;
       if (meta_data_get_string (meta, key, &value) == 0)
       {
-        char temp[512] = "";
-
-        status = json_escape_string (temp, sizeof (temp), value);
+        JSON_ADD_LITERAL (b, ",");
+        json_add_escaped (b, key);
+        JSON_ADD_LITERAL (b, ":");
+        json_add_escaped (b, value);
         sfree (value);
-        if (status != 0)
-          return status;
-
-        BUFFER_ADD (",\"%s\":%s", key, temp);
       }
     }
     else if (type == MD_TYPE_SIGNED_INT)
     {
       int64_t value = 0;
       if (meta_data_get_signed_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIi64, key, value);
+      {
+        JSON_ADD_LITERAL (b, ",");
+        json_add_escaped (b, key);
+        JSON_ADD_LITERAL (b, ":");
+        JSON_ADD_FUNC (b, format_int64, value);
+      }
     }
     else if (type == MD_TYPE_UNSIGNED_INT)
     {
       uint64_t value = 0;
       if (meta_data_get_unsigned_int (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%"PRIu64, key, value);
+      {
+        JSON_ADD_LITERAL (b, ",");
+        json_add_escaped (b, key);
+        JSON_ADD_LITERAL (b, ":");
+        JSON_ADD_FUNC (b, format_uint64, value);
+      }
     }
     else if (type == MD_TYPE_DOUBLE)
     {
       double value = 0.0;
       if (meta_data_get_double (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%f", key, value);
+      {
+        JSON_ADD_LITERAL (b, ",");
+        json_add_escaped (b, key);
+        JSON_ADD_LITERAL (b, ":");
+        JSON_ADD_FUNC (b, ssnprintf, "%f", value);
+      }
     }
     else if (type == MD_TYPE_BOOLEAN)
     {
       _Bool value = 0;
       if (meta_data_get_boolean (meta, key, &value) == 0)
-        BUFFER_ADD (",\"%s\":%s", key, value ? "true" : "false");
+      {
+        JSON_ADD_LITERAL (b, ",");
+        json_add_escaped (b, key);
+        if (value)
+          JSON_ADD_LITERAL (b, ":true");
+        else
+          JSON_ADD_LITERAL (b, ":false");
+      }
     }
   } /* for (keys) */
 
-  if (offset <= 0)
+  if (b->pos == start)
     return (ENOENT);
 
-  buffer[0] = '{'; /* replace leading ',' */
-  BUFFER_ADD ("}");
-
-#undef BUFFER_ADD
+  /* replace leading ',' */
+  if (start < b->size)
+    b->buffer[start] = '{';
+  JSON_ADD_LITERAL (b, "}");
 
   return (0);
 } /* }}} int meta_data_keys_to_json */
 
-static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
+static int meta_data_to_json (json_buffer_t *b, /* {{{ */
     meta_data_t *meta)
 {
   char **keys = NULL;
   size_t keys_num;
+  size_t start = b->pos;
   int status;
   size_t i;
 
-  if ((buffer == NULL) || (buffer_size == 0) || (meta == NULL))
-    return (EINVAL);
-
   status = meta_data_toc (meta, &keys);
   if (status <= 0)
     return (status);
   keys_num = (size_t) status;
 
-  status = meta_data_keys_to_json (buffer, buffer_size, meta, keys, keys_num);
+  JSON_ADD_LITERAL (b, ",\"meta\":");
+  status = meta_data_keys_to_json (b, meta, keys, keys_num);
+  /* Leave out "meta" if no key could be read. */
+  if (status == ENOENT)
+  {
+    b->pos = start;
+    status = 0;
+  }
 
   for (i = 0; i < keys_num; ++i)
     sfree (keys[i]);
@@ -333,101 +384,232 @@ static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
   return status;
 } /* }}} int meta_data_to_json */
 
-static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl, int store_rates)
+static void format_json_cache_entry_free ( /* {{{ */
+    format_json_cache_entry_t *e)
 {
-  char temp[512];
-  size_t offset = 0;
-  int status;
+  if (e == NULL)
+    return;
+
+  sfree (e->ds_info);
+  sfree (e->ident);
+  identifier_destroy (&e->id);
+  sfree (e);
+} /* }}} void format_json_cache_entry_free */
+
+/* NOTE: You must hold cache->lock when calling this function! */
+static void format_json_cache_unlink (format_json_cache_t *cache, /* {{{ */
+    format_json_cache_entry_t *e)
+{
+  format_json_cache_entry_t **ptr;
+
+  for (ptr = cache->buckets + (e->id.hash & (cache->buckets_num - 1));
+      *ptr != e; ptr = &(*ptr)->hash_next)
+    assert (*ptr != NULL);
+  *ptr = e->hash_next;
+
+  if (e->lru_prev != NULL)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    cache->lru_head = e->lru_next;
+  if (e->lru_next != NULL)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    cache->lru_tail = e->lru_prev;
+
+  cache->entries_num--;
+} /* }}} void format_json_cache_unlink */
+
+/* Formats the output of "func" into a newly allocated string. */
+#define FORMAT_JSON_ALLOC(ret, ret_len, func, arg) do { \
+  json_buffer_t b__ = { NULL, 0, 0 }; \
+  func (&b__, (arg)); \
+  (ret_len) = b__.pos; \
+  b__.buffer = (ret) = malloc (b__.pos + 1); \
+  b__.size = b__.pos + 1; \
+  b__.pos = 0; \
+  if ((ret) != NULL) { \
+    func (&b__, (arg)); \
+    (ret)[b__.pos] = 0; \
+  } \
+} while (0)
 
-  memset (buffer, 0, buffer_size);
+/* Returns the entry of "vl", creating it and evicting the least recently
+ * used entry if necessary.
+ * NOTE: You must hold cache->lock when calling this function! */
+static format_json_cache_entry_t *format_json_cache_get ( /* {{{ */
+    format_json_cache_t *cache,
+    const data_set_t *ds, const value_list_t *vl)
+{
+  format_json_cache_entry_t *e;
+  uint32_t hash = identifier_hash_vl (vl);
+  size_t bucket = hash & (cache->buckets_num - 1);
 
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
+  for (e = cache->buckets[bucket]; e != NULL; e = e->hash_next)
+    if ((e->id.hash == hash) && identifier_equal_vl (&e->id, vl))
+      break;
 
-  /* All value lists have a leading comma. The first one will be replaced with
-   * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD (",{");
+  if ((e != NULL) && (e->ds_num == ds->ds_num))
+  {
+    /* Move to the front of the LRU list. */
+    if (e->lru_prev != NULL)
+    {
+      e->lru_prev->lru_next = e->lru_next;
+      if (e->lru_next != NULL)
+        e->lru_next->lru_prev = e->lru_prev;
+      else
+        cache->lru_tail = e->lru_prev;
 
-  status = values_to_json (temp, sizeof (temp), ds, vl, store_rates);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD ("\"values\":%s", temp);
+      e->lru_prev = NULL;
+      e->lru_next = cache->lru_head;
+      cache->lru_head->lru_prev = e;
+      cache->lru_head = e;
+    }
+    return (e);
+  }
+  else if (e != NULL)
+  {
+    format_json_cache_unlink (cache, e);
+    format_json_cache_entry_free (e);
+  }
+
+  e = calloc (1, sizeof (*e));
+  if (e == NULL)
+    return (NULL);
+  if (identifier_create (&e->id, vl) != 0)
+  {
+    sfree (e);
+    return (NULL);
+  }
+  e->ds_num = ds->ds_num;
+
+  FORMAT_JSON_ALLOC (e->ds_info, e->ds_info_len, ds_info_to_json, ds);
+  FORMAT_JSON_ALLOC (e->ident, e->ident_len, ident_to_json, vl);
+  if ((e->ds_info == NULL) || (e->ident == NULL))
+  {
+    format_json_cache_entry_free (e);
+    return (NULL);
+  }
 
-  status = dstypes_to_json (temp, sizeof (temp), ds);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dstypes\":%s", temp);
+  if (cache->entries_num >= cache->entries_max)
+  {
+    format_json_cache_entry_t *oldest = cache->lru_tail;
 
-  status = dsnames_to_json (temp, sizeof (temp), ds);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dsnames\":%s", temp);
+    format_json_cache_unlink (cache, oldest);
+    format_json_cache_entry_free (oldest);
+  }
 
-  BUFFER_ADD (",\"time\":%.3f", CDTIME_T_TO_DOUBLE (vl->time));
-  BUFFER_ADD (",\"interval\":%.3f", CDTIME_T_TO_DOUBLE (vl->interval));
+  e->hash_next = cache->buckets[bucket];
+  cache->buckets[bucket] = e;
+  e->lru_next = cache->lru_head;
+  if (cache->lru_head != NULL)
+    cache->lru_head->lru_prev = e;
+  else
+    cache->lru_tail = e;
+  cache->lru_head = e;
+  cache->entries_num++;
 
-#define BUFFER_ADD_KEYVAL(key, value) do { \
-  status = json_escape_string (temp, sizeof (temp), (value)); \
-  if (status != 0) \
-    return (status); \
-  BUFFER_ADD (",\"%s\":%s", (key), temp); \
-} while (0)
+  return (e);
+} /* }}} format_json_cache_entry_t *format_json_cache_get */
 
-  BUFFER_ADD_KEYVAL ("host", vl->host);
-  BUFFER_ADD_KEYVAL ("plugin", vl->plugin);
-  BUFFER_ADD_KEYVAL ("plugin_instance", vl->plugin_instance);
-  BUFFER_ADD_KEYVAL ("type", vl->type);
-  BUFFER_ADD_KEYVAL ("type_instance", vl->type_instance);
+#undef FORMAT_JSON_ALLOC
 
-  if (vl->meta != NULL)
-  {
-    char meta_buffer[buffer_size];
-    memset (meta_buffer, 0, sizeof (meta_buffer));
-    status = meta_data_to_json (meta_buffer, sizeof (meta_buffer), vl->meta);
-    if (status != 0)
-      return (status);
+format_json_cache_t *format_json_cache_create (size_t max_entries) /* {{{ */
+{
+  format_json_cache_t *cache;
 
-    BUFFER_ADD (",\"meta\":%s", meta_buffer);
-  } /* if (vl->meta != NULL) */
+  if (max_entries == 0)
+    return (NULL);
 
-  BUFFER_ADD ("}");
+  cache = calloc (1, sizeof (*cache));
+  if (cache == NULL)
+    return (NULL);
 
-#undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
+  /* A power of two, so the bucket is a mask of the hash. */
+  cache->buckets_num = 1;
+  while (cache->buckets_num < max_entries)
+    cache->buckets_num *= 2;
 
-  DEBUG ("format_json: value_list_to_json: buffer = %s;", buffer);
+  cache->buckets = calloc (cache->buckets_num, sizeof (*cache->buckets));
+  if (cache->buckets == NULL)
+  {
+    sfree (cache);
+    return (NULL);
+  }
+  cache->entries_max = max_entries;
+  pthread_mutex_init (&cache->lock, /* attr = */ NULL);
 
-  return (0);
-} /* }}} int value_list_to_json */
+  return (cache);
+} /* }}} format_json_cache_t *format_json_cache_create */
 
-static int format_json_value_list_nocheck (char *buffer, /* {{{ */
-    size_t *ret_buffer_fill, size_t *ret_buffer_free,
-    const data_set_t *ds, const value_list_t *vl,
-    int store_rates, size_t temp_size)
+void format_json_cache_destroy (format_json_cache_t *cache) /* {{{ */
+{
+  if (cache == NULL)
+    return;
+
+  while (cache->lru_head != NULL)
+  {
+    format_json_cache_entry_t *e = cache->lru_head;
+
+    format_json_cache_unlink (cache, e);
+    format_json_cache_entry_free (e);
+  }
+  sfree (cache->buckets);
+  pthread_mutex_destroy (&cache->lock);
+  sfree (cache);
+} /* }}} void format_json_cache_destroy */
+
+static int value_list_to_json (json_buffer_t *b, /* {{{ */
+    format_json_cache_t *cache,
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  char temp[temp_size];
+  format_json_cache_entry_t *e = NULL;
   int status;
 
-  status = value_list_to_json (temp, sizeof (temp), ds, vl, store_rates);
+  /* All value lists have a leading comma. The first one will be replaced with
+   * a square bracket in `format_json_finalize'. */
+  JSON_ADD_LITERAL (b, ",{\"values\":");
+
+  status = values_to_json (b, ds, vl, store_rates);
   if (status != 0)
     return (status);
-  temp_size = strlen (temp);
 
-  memcpy (buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+  if (cache != NULL)
+  {
+    pthread_mutex_lock (&cache->lock);
+    e = format_json_cache_get (cache, ds, vl);
+    if (e != NULL)
+      json_add (b, e->ds_info, e->ds_info_len);
+    else
+      pthread_mutex_unlock (&cache->lock);
+  }
+  /* Without a cache or if memory is short. */
+  if (e == NULL)
+    ds_info_to_json (b, ds);
+
+  JSON_ADD_LITERAL (b, ",\"time\":");
+  JSON_ADD_FUNC (b, format_fixed, CDTIME_T_TO_DOUBLE (vl->time), 3);
+  JSON_ADD_LITERAL (b, ",\"interval\":");
+  JSON_ADD_FUNC (b, format_fixed, CDTIME_T_TO_DOUBLE (vl->interval), 3);
+
+  if (e != NULL)
+  {
+    json_add (b, e->ident, e->ident_len);
+    pthread_mutex_unlock (&cache->lock);
+  }
+  else
+    ident_to_json (b, vl);
+
+  if (vl->meta != NULL)
+  {
+    status = meta_data_to_json (b, vl->meta);
+    if (status != 0)
+      return (status);
+  }
+
+  JSON_ADD_LITERAL (b, "}");
 
   return (0);
-} /* }}} int format_json_value_list_nocheck */
+} /* }}} int value_list_to_json */
 
 int format_json_initialize (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free)
@@ -447,7 +629,8 @@ int format_json_initialize (char *buffer, /* {{{ */
   if (buffer_free < 3)
     return (-ENOMEM);
 
-  memset (buffer, 0, buffer_free);
+  /* Everything written to the buffer is null-terminated. */
+  buffer[0] = 0;
   *ret_buffer_fill = buffer_fill;
   *ret_buffer_free = buffer_free;
 
@@ -481,21 +664,55 @@ int format_json_finalize (char *buffer, /* {{{ */
   return (0);
 } /* }}} int format_json_finalize */
 
-int format_json_value_list (char *buffer, /* {{{ */
-    size_t *ret_buffer_fill, size_t *ret_buffer_free,
-    const data_set_t *ds, const value_list_t *vl, int store_rates)
+int format_json_value_list_cached (format_json_cache_t *cache, /* {{{ */
+    char *buffer, size_t *ret_buffer_fill, size_t *ret_buffer_free,
+    const data_set_t *ds, const value_list_t *vl, int store_rates,
+    size_t *ret_needed)
 {
+  json_buffer_t b;
+  int status;
+
   if ((buffer == NULL)
       || (ret_buffer_fill == NULL) || (ret_buffer_free == NULL)
       || (ds == NULL) || (vl == NULL))
     return (-EINVAL);
 
-  if (*ret_buffer_free < 3)
-    return (-ENOMEM);
+  /* Two bytes are kept free for `format_json_finalize'. */
+  b.buffer = buffer + (*ret_buffer_fill);
+  b.size = ((*ret_buffer_free) > 2) ? (*ret_buffer_free) - 2 : 0;
+  b.pos = 0;
+
+  status = value_list_to_json (&b, cache, ds, vl, store_rates);
+  if ((status == 0) && (b.pos >= b.size))
+  {
+    if (ret_needed != NULL)
+      *ret_needed = b.pos + 3;
+    status = -ENOMEM;
+  }
+  if (status != 0)
+  {
+    /* Leave the buffer as it was. */
+    if ((*ret_buffer_free) > 0)
+      b.buffer[0] = 0;
+    return (status);
+  }
 
-  return (format_json_value_list_nocheck (buffer,
-        ret_buffer_fill, ret_buffer_free, ds, vl,
-        store_rates, (*ret_buffer_free) - 2));
+  b.buffer[b.pos] = 0;
+  (*ret_buffer_fill) += b.pos;
+  (*ret_buffer_free) -= b.pos;
+
+  DEBUG ("format_json: value_list_to_json: buffer = %s;", b.buffer);
+
+  return (0);
+} /* }}} int format_json_value_list_cached */
+
+int format_json_value_list (char *buffer, /* {{{ */
+    size_t *ret_buffer_fill, size_t *ret_buffer_free,
+    const data_set_t *ds, const value_list_t *vl, int store_rates)
+{
+  return (format_json_value_list_cached (/* cache = */ NULL, buffer,
+        ret_buffer_fill, ret_buffer_free, ds, vl, store_rates,
+        /* ret_needed = */ NULL));
 } /* }}} int format_json_value_list */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -32,6 +32,7 @@
 
 #ifndef JSON_GAUGE_FORMAT
 # define JSON_GAUGE_FORMAT GAUGE_FORMAT
+# define JSON_GAUGE_FORMAT_DEFAULT 1
 #endif
 
 int format_json_initialize (char *buffer,
@@ -42,4 +43,28 @@ int format_json_value_list (char *buffer,
 int format_json_finalize (char *buffer,
     size_t *ret_buffer_fill, size_t *ret_buffer_free);
 
+/* Number of identifiers a plugin's cache remembers by default. */
+#define FORMAT_JSON_CACHE_SIZE 16384
+
+/*
+ * Cache of the escaped identifiers, data source names and data source types
+ * of recently written value lists, which are the same each time. The least
+ * recently used identifier is evicted when the cache is full. Caches are
+ * thread-safe.
+ */
+struct format_json_cache_s;
+typedef struct format_json_cache_s format_json_cache_t;
+
+format_json_cache_t *format_json_cache_create (size_t max_entries);
+void format_json_cache_destroy (format_json_cache_t *cache);
+
+/* Like format_json_value_list(), but takes the constant parts from "cache" if
+ * possible. "cache" may be NULL. If the value list doesn't fit, -ENOMEM is
+ * returned, the buffer is left as it was and the free space the value list
+ * needs is stored in "ret_needed", which may be NULL. */
+int format_json_value_list_cached (format_json_cache_t *cache,
+    char *buffer, size_t *ret_buffer_fill, size_t *ret_buffer_free,
+    const data_set_t *ds, const value_list_t *vl, int store_rates,
+    size_t *ret_needed);
+
 #endif /* UTILS_FORMAT_JSON_H */
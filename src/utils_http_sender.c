@@ -0,0 +1,715 @@
+/**
+ * collectd - src/utils_http_sender.c
+ * Copyright (C) 2009-2014  Florian octo Forster
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   Florian octo Forster <octo at collectd.org>
+ **/
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+#include "utils_complain.h"
+#include "utils_http_sender.h"
+
+#include <pthread.h>
+
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+/* curl_multi_poll() and curl_multi_wakeup() appeared in libcurl 7.68.0. With
+ * older versions the sender thread polls with a short timeout instead. */
+#if LIBCURL_VERSION_NUM >= 0x074400
+# define HS_HAVE_MULTI_POLL 1
+#endif
+#define HS_MULTI_WAIT_MS 100
+
+/* One easy handle of the multi handle. "buffer" is the body being POSTed and
+ * is NULL while the handle is idle. Reusing the handles keeps the connections
+ * to the server alive between requests. */
+struct http_request_s
+{
+        CURL *curl;
+        char *buffer;
+        size_t fill;
+        size_t post_size;
+        _Bool started;
+        char curl_errbuf[CURL_ERROR_SIZE];
+
+#if HAVE_ZLIB
+        /* Compressed copy of "buffer". */
+        z_stream zstream;
+        _Bool zstream_init;
+        Bytef *zbuffer;
+        size_t zbuffer_size;
+#endif
+};
+typedef struct http_request_s http_request_t;
+
+struct http_queue_entry_s
+{
+        char  *data;
+        size_t fill;
+};
+typedef struct http_queue_entry_s http_queue_entry_t;
+
+struct http_sender_s
+{
+        char *plugin;
+        char *location;
+
+        size_t buffer_size;
+        int max_in_flight;
+        int compress;
+        _Bool log_http_error;
+
+        http_sender_setup_cb setup;
+        void *user_data;
+
+        CURLM *multi;
+        http_request_t *requests;
+
+        /* Full buffers waiting for an idle request, oldest first. */
+        http_queue_entry_t *queue;
+        size_t queue_size;
+        size_t queue_head;
+        size_t queue_length;
+        c_complain_t queue_complaint;
+
+        /* Unused buffers, so that handing off a buffer doesn't allocate. */
+        char **spare;
+        size_t spare_size;
+        size_t spare_num;
+
+        /* Request body sizes before and after compression. */
+        derive_t bytes_uncompressed;
+        derive_t bytes_compressed;
+
+        /* Protects everything above except "multi" and "requests", which
+         * belong to the sender thread while it is running. */
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        pthread_t thread;
+        _Bool thread_running;
+        _Bool thread_loop;
+};
+
+static void hs_log_http_error (http_sender_t *s, CURL *curl) /* {{{ */
+{
+        long http_code = 0;
+
+        if (!s->log_http_error)
+                return;
+
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+        if ((http_code < 200) || (http_code >= 300))
+                INFO ("%s plugin: HTTP Error code: %lu", s->plugin, http_code);
+} /* }}} void hs_log_http_error */
+
+/* NOTE: You must hold s->lock when calling this function! */
+static char *hs_buffer_get_nolock (http_sender_t *s) /* {{{ */
+{
+        if (s->spare_num > 0)
+        {
+                s->spare_num--;
+                return (s->spare[s->spare_num]);
+        }
+
+        return (malloc (s->buffer_size));
+} /* }}} char *hs_buffer_get_nolock */
+
+/* NOTE: You must hold s->lock when calling this function! */
+static void hs_buffer_put_nolock (http_sender_t *s, char *buffer) /* {{{ */
+{
+        if (buffer == NULL)
+                return;
+
+        if (s->spare_num < s->spare_size)
+        {
+                s->spare[s->spare_num] = buffer;
+                s->spare_num++;
+        }
+        else
+                sfree (buffer);
+} /* }}} void hs_buffer_put_nolock */
+
+/* Takes the oldest full buffer off the queue.
+ * NOTE: You must hold s->lock when calling this function! */
+static http_queue_entry_t hs_queue_pop_nolock (http_sender_t *s) /* {{{ */
+{
+        http_queue_entry_t entry;
+
+        assert (s->queue_length > 0);
+
+        entry = s->queue[s->queue_head];
+        s->queue[s->queue_head].data = NULL;
+        s->queue[s->queue_head].fill = 0;
+        s->queue_head = (s->queue_head + 1) % s->queue_size;
+        s->queue_length--;
+
+        c_release (LOG_INFO, &s->queue_complaint,
+                        "%s plugin: The send queue of <%s> is no longer full.",
+                        s->plugin, s->location);
+
+        return (entry);
+} /* }}} http_queue_entry_t hs_queue_pop_nolock */
+
+/* Called by the sender thread when "req" has been completed. */
+static void hs_request_done (http_sender_t *s, http_request_t *req, /* {{{ */
+                CURLcode status)
+{
+        hs_log_http_error (s, req->curl);
+
+        if (status != CURLE_OK)
+        {
+                ERROR ("%s plugin: curl_easy_perform failed with "
+                                "status %i: %s",
+                                s->plugin, status, req->curl_errbuf);
+        }
+
+        pthread_mutex_lock (&s->lock);
+        s->bytes_uncompressed += (derive_t) req->fill;
+        s->bytes_compressed += (derive_t) req->post_size;
+        hs_buffer_put_nolock (s, req->buffer);
+        req->buffer = NULL;
+        req->started = 0;
+
+        /* Don't wait for an unreachable server when shutting down. */
+        if ((status != CURLE_OK) && !s->thread_loop && (s->queue_length > 0))
+        {
+                ERROR ("%s plugin: Discarding %zu buffered requests to <%s>.",
+                                s->plugin, s->queue_length, s->location);
+                while (s->queue_length > 0)
+                {
+                        http_queue_entry_t entry = hs_queue_pop_nolock (s);
+                        hs_buffer_put_nolock (s, entry.data);
+                }
+        }
+        pthread_mutex_unlock (&s->lock);
+} /* }}} void hs_request_done */
+
+#if HAVE_ZLIB
+static int hs_request_compress (http_sender_t *s, /* {{{ */
+                http_request_t *req)
+{
+        int status;
+
+        status = deflateReset (&req->zstream);
+        if (status != Z_OK)
+        {
+                ERROR ("%s plugin: deflateReset failed with status %i.",
+                                s->plugin, status);
+                return (-1);
+        }
+
+        req->zstream.next_in = (Bytef *) req->buffer;
+        req->zstream.avail_in = (uInt) req->fill;
+        req->zstream.next_out = req->zbuffer;
+        req->zstream.avail_out = (uInt) req->zbuffer_size;
+
+        /* "zbuffer" is large enough for the whole output, see deflateBound(). */
+        status = deflate (&req->zstream, Z_FINISH);
+        if (status != Z_STREAM_END)
+        {
+                ERROR ("%s plugin: deflate failed with status %i.",
+                                s->plugin, status);
+                return (-1);
+        }
+
+        req->post_size = req->zbuffer_size - req->zstream.avail_out;
+        return (0);
+} /* }}} int hs_request_compress */
+#endif
+
+/* Called by the sender thread to submit the buffer assigned to "req". */
+static int hs_request_start (http_sender_t *s, http_request_t *req) /* {{{ */
+{
+        char const *post = req->buffer;
+        CURLMcode status;
+
+        req->post_size = req->fill;
+#if HAVE_ZLIB
+        if (s->compress != HTTP_COMPRESS_NONE)
+        {
+                if (hs_request_compress (s, req) != 0)
+                        return (-1);
+                post = (char const *) req->zbuffer;
+        }
+#endif
+
+        curl_easy_setopt (req->curl, CURLOPT_POSTFIELDSIZE,
+                        (long) req->post_size);
+        curl_easy_setopt (req->curl, CURLOPT_POSTFIELDS, post);
+
+        status = curl_multi_add_handle (s->multi, req->curl);
+        if (status != CURLM_OK)
+        {
+                ERROR ("%s plugin: curl_multi_add_handle failed "
+                                "with status %i.", s->plugin, (int) status);
+                return (-1);
+        }
+
+        req->started = 1;
+        return (0);
+} /* }}} int hs_request_start */
+
+/* Sends the queued buffers with up to "max_in_flight" concurrent requests
+ * until the sender is destroyed. */
+static void *hs_send_thread (void *arg) /* {{{ */
+{
+        http_sender_t *s = arg;
+        int active = 0;
+
+        pthread_mutex_lock (&s->lock);
+        while (s->thread_loop || (s->queue_length > 0) || (active > 0))
+        {
+                CURLMsg *msg;
+                int msgs_left;
+                int running;
+                int i;
+
+                for (i = 0; (i < s->max_in_flight) && (s->queue_length > 0); i++)
+                {
+                        http_request_t *req = s->requests + i;
+                        http_queue_entry_t entry;
+
+                        if (req->buffer != NULL)
+                                continue;
+
+                        entry = hs_queue_pop_nolock (s);
+                        req->buffer = entry.data;
+                        req->fill = entry.fill;
+                        active++;
+                }
+
+                if (active == 0)
+                {
+                        pthread_cond_wait (&s->cond, &s->lock);
+                        continue;
+                }
+                pthread_mutex_unlock (&s->lock);
+
+                /* Compress the new requests without holding the lock. */
+                for (i = 0; i < s->max_in_flight; i++)
+                {
+                        http_request_t *req = s->requests + i;
+
+                        if ((req->buffer == NULL) || req->started)
+                                continue;
+
+                        if (hs_request_start (s, req) != 0)
+                        {
+                                pthread_mutex_lock (&s->lock);
+                                hs_buffer_put_nolock (s, req->buffer);
+                                req->buffer = NULL;
+                                pthread_mutex_unlock (&s->lock);
+                                active--;
+                        }
+                }
+
+                curl_multi_perform (s->multi, &running);
+
+                while ((msg = curl_multi_info_read (s->multi, &msgs_left)) != NULL)
+                {
+                        CURL *curl = msg->easy_handle;
+                        CURLcode status = msg->data.result;
+                        char *private = NULL;
+
+                        if (msg->msg != CURLMSG_DONE)
+                                continue;
+
+                        curl_multi_remove_handle (s->multi, curl);
+                        curl_easy_getinfo (curl, CURLINFO_PRIVATE, &private);
+                        hs_request_done (s, (http_request_t *) private, status);
+                        active--;
+                }
+
+                /* New buffers wake up curl_multi_poll(), see
+                 * http_sender_submit(). */
+                if (active > 0)
+                {
+#if HS_HAVE_MULTI_POLL
+                        curl_multi_poll (s->multi, NULL, 0, 1000, NULL);
+#else
+                        curl_multi_wait (s->multi, NULL, 0, HS_MULTI_WAIT_MS, NULL);
+#endif
+                }
+
+                pthread_mutex_lock (&s->lock);
+        }
+        pthread_mutex_unlock (&s->lock);
+
+        return ((void *) 0);
+} /* }}} void *hs_send_thread */
+
+static int hs_request_init (http_sender_t *s, http_request_t *req) /* {{{ */
+{
+        CURL *curl;
+
+        curl = curl_easy_init ();
+        if (curl == NULL)
+        {
+                ERROR ("%s plugin: curl_easy_init failed.", s->plugin);
+                return (-1);
+        }
+        req->curl = curl;
+
+#if HAVE_ZLIB
+        if (s->compress != HTTP_COMPRESS_NONE)
+        {
+                /* 16 added to the window bits selects the gzip format. */
+                int window_bits = (s->compress == HTTP_COMPRESS_GZIP)
+                        ? (MAX_WBITS + 16) : MAX_WBITS;
+                int status;
+
+                status = deflateInit2 (&req->zstream, Z_DEFAULT_COMPRESSION,
+                                Z_DEFLATED, window_bits, /* memLevel = */ 8,
+                                Z_DEFAULT_STRATEGY);
+                if (status != Z_OK)
+                {
+                        ERROR ("%s plugin: deflateInit2 failed with "
+                                        "status %i.", s->plugin, status);
+                        return (-1);
+                }
+                req->zstream_init = 1;
+
+                req->zbuffer_size = (size_t) deflateBound (&req->zstream,
+                                (uLong) s->buffer_size);
+                req->zbuffer = malloc (req->zbuffer_size);
+                if (req->zbuffer == NULL)
+                {
+                        ERROR ("%s plugin: malloc(%zu) failed.",
+                                        s->plugin, req->zbuffer_size);
+                        return (-1);
+                }
+        }
+#endif
+
+        if (s->setup (curl, s->user_data) != 0)
+                return (-1);
+
+        curl_easy_setopt (curl, CURLOPT_PRIVATE, (char *) req);
+        curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, req->curl_errbuf);
+
+        return (0);
+} /* }}} int hs_request_init */
+
+static void hs_cleanup (http_sender_t *s) /* {{{ */
+{
+        int i;
+
+        if (s->requests != NULL)
+        {
+                for (i = 0; i < s->max_in_flight; i++)
+                {
+                        if (s->requests[i].curl != NULL)
+                                curl_easy_cleanup (s->requests[i].curl);
+                        sfree (s->requests[i].buffer);
+#if HAVE_ZLIB
+                        if (s->requests[i].zstream_init)
+                                deflateEnd (&s->requests[i].zstream);
+                        sfree (s->requests[i].zbuffer);
+#endif
+                }
+                sfree (s->requests);
+        }
+
+        if (s->multi != NULL)
+        {
+                curl_multi_cleanup (s->multi);
+                s->multi = NULL;
+        }
+} /* }}} void hs_cleanup */
+
+/* NOTE: You must hold s->lock when calling this function! */
+static int hs_init_nolock (http_sender_t *s) /* {{{ */
+{
+        int i;
+
+        if (s->multi != NULL)
+                return (0);
+
+        s->requests = calloc ((size_t) s->max_in_flight, sizeof (*s->requests));
+        if (s->requests == NULL)
+        {
+                ERROR ("%s plugin: calloc failed.", s->plugin);
+                return (-1);
+        }
+
+        for (i = 0; i < s->max_in_flight; i++)
+        {
+                if (hs_request_init (s, s->requests + i) != 0)
+                {
+                        hs_cleanup (s);
+                        return (-1);
+                }
+        }
+
+        s->multi = curl_multi_init ();
+        if (s->multi == NULL)
+        {
+                ERROR ("%s plugin: curl_multi_init failed.", s->plugin);
+                hs_cleanup (s);
+                return (-1);
+        }
+        curl_multi_setopt (s->multi, CURLMOPT_MAXCONNECTS,
+                        (long) s->max_in_flight);
+#if LIBCURL_VERSION_NUM >= 0x071e00
+        curl_multi_setopt (s->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                        (long) s->max_in_flight);
+#endif
+
+        return (0);
+} /* }}} int hs_init_nolock */
+
+http_sender_t *http_sender_create (http_sender_config_t const *conf) /* {{{ */
+{
+        http_sender_t *s;
+
+        if ((conf == NULL) || (conf->setup == NULL)
+                        || (conf->buffer_size == 0) || (conf->queue_length == 0)
+                        || (conf->max_in_flight < 1))
+                return (NULL);
+
+        s = calloc (1, sizeof (*s));
+        if (s == NULL)
+                return (NULL);
+
+        s->plugin = strdup ((conf->plugin != NULL) ? conf->plugin : "http");
+        s->location = strdup ((conf->location != NULL) ? conf->location : "");
+        s->buffer_size = conf->buffer_size;
+        s->max_in_flight = conf->max_in_flight;
+        s->compress = conf->compress;
+        s->log_http_error = conf->log_http_error;
+        s->setup = conf->setup;
+        s->user_data = conf->user_data;
+
+        /* Every buffer is either being filled, queued or in flight. */
+        s->queue_size = conf->queue_length;
+        s->spare_size = s->queue_size + (size_t) s->max_in_flight;
+        s->queue = calloc (s->queue_size, sizeof (*s->queue));
+        s->spare = calloc (s->spare_size, sizeof (*s->spare));
+
+        pthread_mutex_init (&s->lock, /* attr = */ NULL);
+        pthread_cond_init (&s->cond, /* attr = */ NULL);
+        C_COMPLAIN_INIT (&s->queue_complaint);
+
+        if ((s->plugin == NULL) || (s->location == NULL)
+                        || (s->queue == NULL) || (s->spare == NULL))
+        {
+                http_sender_destroy (s);
+                return (NULL);
+        }
+
+        return (s);
+} /* }}} http_sender_t *http_sender_create */
+
+void http_sender_destroy (http_sender_t *s) /* {{{ */
+{
+        size_t i;
+
+        if (s == NULL)
+                return;
+
+        /* Wait for the sender thread to submit everything that has been
+         * queued. */
+        pthread_mutex_lock (&s->lock);
+        s->thread_loop = 0;
+        pthread_cond_broadcast (&s->cond);
+#if HS_HAVE_MULTI_POLL
+        if (s->thread_running)
+                curl_multi_wakeup (s->multi);
+#endif
+        pthread_mutex_unlock (&s->lock);
+
+        if (s->thread_running)
+        {
+                pthread_join (s->thread, /* retval = */ NULL);
+                s->thread_running = 0;
+        }
+
+        hs_cleanup (s);
+
+        if (s->queue != NULL)
+        {
+                for (i = 0; i < s->queue_size; i++)
+                        sfree (s->queue[i].data);
+                sfree (s->queue);
+        }
+        if (s->spare != NULL)
+        {
+                for (i = 0; i < s->spare_num; i++)
+                        sfree (s->spare[i]);
+                sfree (s->spare);
+        }
+
+        sfree (s->plugin);
+        sfree (s->location);
+
+        pthread_cond_destroy (&s->cond);
+        pthread_mutex_destroy (&s->lock);
+
+        sfree (s);
+} /* }}} void http_sender_destroy */
+
+char *http_sender_buffer_get (http_sender_t *s) /* {{{ */
+{
+        char *buffer;
+
+        pthread_mutex_lock (&s->lock);
+        buffer = hs_buffer_get_nolock (s);
+        pthread_mutex_unlock (&s->lock);
+
+        return (buffer);
+} /* }}} char *http_sender_buffer_get */
+
+int http_sender_submit (http_sender_t *s, char **buffer, size_t fill) /* {{{ */
+{
+        http_queue_entry_t *entry;
+        char *empty;
+        int status;
+
+        if ((s == NULL) || (buffer == NULL) || (*buffer == NULL)
+                        || (fill > s->buffer_size))
+                return (-EINVAL);
+
+        pthread_mutex_lock (&s->lock);
+
+        if (hs_init_nolock (s) != 0)
+        {
+                pthread_mutex_unlock (&s->lock);
+                return (-1);
+        }
+
+        if (s->queue_length >= s->queue_size)
+        {
+                c_complain (LOG_WARNING, &s->queue_complaint,
+                                "%s plugin: The send queue of <%s> is full, "
+                                "dropping values.", s->plugin, s->location);
+                pthread_mutex_unlock (&s->lock);
+                return (0);
+        }
+
+        empty = hs_buffer_get_nolock (s);
+        if (empty == NULL)
+        {
+                ERROR ("%s plugin: malloc(%zu) failed.",
+                                s->plugin, s->buffer_size);
+                pthread_mutex_unlock (&s->lock);
+                return (-1);
+        }
+
+        entry = s->queue + ((s->queue_head + s->queue_length) % s->queue_size);
+        entry->data = *buffer;
+        entry->fill = fill;
+        s->queue_length++;
+        *buffer = empty;
+
+        if (s->thread_running)
+        {
+                pthread_cond_signal (&s->cond);
+#if HS_HAVE_MULTI_POLL
+                curl_multi_wakeup (s->multi);
+#endif
+                pthread_mutex_unlock (&s->lock);
+                return (0);
+        }
+
+        s->thread_loop = 1;
+        status = plugin_thread_create (&s->thread, /* attr = */ NULL,
+                        hs_send_thread, s);
+        if (status != 0)
+        {
+                char errbuf[1024];
+                ERROR ("%s plugin: pthread_create failed: %s", s->plugin,
+                                sstrerror (errno, errbuf, sizeof (errbuf)));
+                s->thread_loop = 0;
+                pthread_mutex_unlock (&s->lock);
+                return (-1);
+        }
+        s->thread_running = 1;
+        pthread_mutex_unlock (&s->lock);
+
+        return (0);
+} /* }}} int http_sender_submit */
+
+void http_sender_stats (http_sender_t *s, size_t *ret_queue_length, /* {{{ */
+                derive_t *ret_uncompressed, derive_t *ret_compressed)
+{
+        pthread_mutex_lock (&s->lock);
+        if (ret_queue_length != NULL)
+                *ret_queue_length = s->queue_length;
+        if (ret_uncompressed != NULL)
+                *ret_uncompressed = s->bytes_uncompressed;
+        if (ret_compressed != NULL)
+                *ret_compressed = s->bytes_compressed;
+        pthread_mutex_unlock (&s->lock);
+} /* }}} void http_sender_stats */
+
+int http_sender_config_compress (oconfig_item_t *ci, /* {{{ */
+                char const *plugin, int *ret_compress)
+{
+        char *string;
+        int compress;
+
+        if ((ci->values_num != 1)
+                        || (ci->values[0].type != OCONFIG_TYPE_STRING))
+        {
+                WARNING ("%s plugin: The `%s' config option "
+                                "needs exactly one string argument.",
+                                plugin, ci->key);
+                return (-1);
+        }
+
+        string = ci->values[0].value.string;
+        if (strcasecmp ("None", string) == 0)
+                compress = HTTP_COMPRESS_NONE;
+        else if (strcasecmp ("gzip", string) == 0)
+                compress = HTTP_COMPRESS_GZIP;
+        else if (strcasecmp ("deflate", string) == 0)
+                compress = HTTP_COMPRESS_DEFLATE;
+        else
+        {
+                ERROR ("%s plugin: Invalid compression: %s", plugin, string);
+                return (-1);
+        }
+
+#if !HAVE_ZLIB
+        if (compress != HTTP_COMPRESS_NONE)
+        {
+                ERROR ("%s plugin: Compression is not available, "
+                                "because collectd was built without zlib.",
+                                plugin);
+                return (-1);
+        }
+#endif
+
+        *ret_compress = compress;
+        return (0);
+} /* }}} int http_sender_config_compress */
+
+char const *http_sender_content_encoding (int compress) /* {{{ */
+{
+        if (compress == HTTP_COMPRESS_GZIP)
+                return ("Content-Encoding: gzip");
+        else if (compress == HTTP_COMPRESS_DEFLATE)
+                return ("Content-Encoding: deflate");
+        return (NULL);
+} /* }}} char const *http_sender_content_encoding */
+
+/* vim: set fdm=marker sw=8 ts=8 tw=78 et : */
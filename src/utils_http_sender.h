@@ -0,0 +1,94 @@
+/**
+ * collectd - src/utils_http_sender.h
+ * Copyright (C) 2009-2014  Florian octo Forster
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   Florian octo Forster <octo at collectd.org>
+ **/
+
+#ifndef UTILS_HTTP_SENDER_H
+#define UTILS_HTTP_SENDER_H 1
+
+#include "collectd.h"
+#include "liboconfig/oconfig.h"
+
+#include <curl/curl.h>
+
+#define HTTP_COMPRESS_NONE    0
+#define HTTP_COMPRESS_GZIP    1
+#define HTTP_COMPRESS_DEFLATE 2
+
+/*
+ * Sends buffers with HTTP POST requests from a separate thread, so that the
+ * write threads never wait for the server. Up to "max_in_flight" requests are
+ * in progress concurrently, using a curl multi handle. Full buffers wait in a
+ * queue of at most "queue_length" entries; when it is full, new buffers are
+ * dropped.
+ */
+struct http_sender_s;
+typedef struct http_sender_s http_sender_t;
+
+/* Sets the options of one of the sender's easy handles. The POST body, the
+ * error buffer and CURLOPT_PRIVATE are set by the sender. */
+typedef int (*http_sender_setup_cb) (CURL *curl, void *user_data);
+
+struct http_sender_config_s
+{
+        /* Used in log messages only. */
+        char const *plugin;
+        char const *location;
+
+        size_t buffer_size;
+        size_t queue_length;
+        int max_in_flight;
+        int compress;
+        _Bool log_http_error;
+
+        http_sender_setup_cb setup;
+        void *user_data;
+};
+typedef struct http_sender_config_s http_sender_config_t;
+
+/* The easy handles are only created when the first buffer is submitted, i.e.
+ * after curl_global_init() has been called by the plugin's init callback. */
+http_sender_t *http_sender_create (http_sender_config_t const *conf);
+
+/* Waits until everything submitted has been sent, then frees "s". */
+void http_sender_destroy (http_sender_t *s);
+
+/* Returns an empty buffer of "buffer_size" bytes, or NULL if allocating it
+ * failed. */
+char *http_sender_buffer_get (http_sender_t *s);
+
+/* Hands "*buffer", holding "fill" bytes, to the sender thread and replaces it
+ * with an empty buffer. Does not block on the network. If the queue is full,
+ * the data is dropped and "*buffer" is left alone. */
+int http_sender_submit (http_sender_t *s, char **buffer, size_t fill);
+
+/* Returns the number of queued buffers and the total size of the request
+ * bodies before and after compression. Any pointer may be NULL. */
+void http_sender_stats (http_sender_t *s, size_t *ret_queue_length,
+                derive_t *ret_uncompressed, derive_t *ret_compressed);
+
+/* Parses a "Compress None|gzip|deflate" option into a HTTP_COMPRESS_*
+ * constant. Fails if collectd was built without zlib. */
+int http_sender_config_compress (oconfig_item_t *ci, char const *plugin,
+                int *ret_compress);
+
+/* Returns the "Content-Encoding" header to send with "compress", or NULL. */
+char const *http_sender_content_encoding (int compress);
+
+#endif /* UTILS_HTTP_SENDER_H */
@@ -36,14 +36,27 @@
 # define LLONG_MAX 9223372036854775807LL
 #endif
 
-#ifndef HISTOGRAM_NUM_BINS
-# define HISTOGRAM_NUM_BINS 1000
-#endif
-
-#ifndef HISTOGRAM_DEFAULT_BIN_WIDTH
-/* 1048576 = 2^20 ^= 1/1024 s */
-# define HISTOGRAM_DEFAULT_BIN_WIDTH 1048576
-#endif
+/*
+ * The histogram uses a log-linear ("HDR") bucket layout. Latencies are
+ * counted in units of 2^LATENCY_UNIT_BITS cdtime_t, i.e. about one
+ * microsecond. The first LATENCY_SUB_NUM buckets are one unit wide. After
+ * that, each power of two is split into LATENCY_SUB_NUM buckets of equal
+ * width, so a bucket is never wider than 1/LATENCY_SUB_NUM of the latencies it
+ * holds. With 32 buckets per power of two, percentiles are off by at most
+ * about 3% (plus one unit), however large the spread of the latencies.
+ *
+ * Bucket i holds the latencies in (lower(i), lower(i + 1)], so that e.g.
+ * exactly 1.0 ms is counted with the latencies just below it. Latencies above
+ * the last bucket, about 18 hours, are counted in the last bucket.
+ *
+ * Adding a latency takes constant time and the layout never changes, so
+ * counters can be merged bucket by bucket.
+ */
+#define LATENCY_UNIT_BITS 10
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_NUM (1 << LATENCY_SUB_BITS)
+#define LATENCY_GROUPS_NUM 31
+#define LATENCY_BUCKETS_NUM (LATENCY_SUB_NUM * (LATENCY_GROUPS_NUM + 1))
 
 struct latency_counter_s
 {
@@ -55,67 +68,56 @@ struct latency_counter_s
   cdtime_t min;
   cdtime_t max;
 
-  cdtime_t bin_width;
-  int histogram[HISTOGRAM_NUM_BINS];
+  uint32_t histogram[LATENCY_BUCKETS_NUM];
 };
 
-/*
-* Histogram represents the distribution of data, it has a list of "bins".
-* Each bin represents an interval and has a count (frequency) of
-* number of values fall within its interval.
-*
-* Histogram's range is determined by the number of bins and the bin width,
-* There are 1000 bins and all bins have the same width of default 1 millisecond.
-* When a value above this range is added, Histogram's range is increased by
-* increasing the bin width (note that number of bins remains always at 1000).
-* This operation of increasing bin width is little expensive as each bin need
-* to be visited to update it's count. To reduce frequent change of bin width,
-* new bin width will be the next nearest power of 2. Example: 2, 4, 8, 16, 32,
-* 64, 128, 256, 512, 1024, 2048, 5086, ...
-*
-* So, if the required bin width is 300, then new bin width will be 512 as it is
-* the next nearest power of 2.
-*/
-static void change_bin_width (latency_counter_t *lc, cdtime_t latency) /* {{{ */
+/* Returns the position of the highest bit set in "u", which must not be
+ * zero. */
+static int latency_log2 (uint64_t u) /* {{{ */
 {
-  /* This function is called because the new value is above histogram's range.
-   * First find the required bin width:
-   *           requiredBinWidth = (value + 1) / numBins
-   * then get the next nearest power of 2
-   *           newBinWidth = 2^(ceil(log2(requiredBinWidth)))
-   */
-  double required_bin_width = ((double) (latency + 1)) / ((double) HISTOGRAM_NUM_BINS);
-  double required_bin_width_logbase2 = log (required_bin_width) / log (2.0);
-  cdtime_t new_bin_width = (cdtime_t) (pow (2.0, ceil (required_bin_width_logbase2)) + .5);
-  cdtime_t old_bin_width = lc->bin_width;
-
-  lc->bin_width = new_bin_width;
-
-  /* bin_width has been increased, now iterate through all bins and move the
-   * old bin's count to new bin. */
-  if (lc->num > 0) // if the histogram has data then iterate else skip
-  {
-      double width_change_ratio = ((double) old_bin_width) / ((double) new_bin_width);
-      size_t i;
-
-      for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
-      {
-         size_t new_bin = (size_t) (((double) i) * width_change_ratio);
-         if (i == new_bin)
-             continue;
-         assert (new_bin < i);
-
-         lc->histogram[new_bin] += lc->histogram[i];
-         lc->histogram[i] = 0;
-      }
-  }
+#if defined(__GNUC__)
+  return (63 - __builtin_clzll ((unsigned long long) u));
+#else
+  int e = 0;
+
+  while (u >>= 1)
+    e++;
+  return (e);
+#endif
+} /* }}} int latency_log2 */
 
-  DEBUG("utils_latency: change_bin_width: latency = %.3f; "
-      "old_bin_width = %.3f; new_bin_width = %.3f;",
-      CDTIME_T_TO_DOUBLE (latency),
-      CDTIME_T_TO_DOUBLE (old_bin_width),
-      CDTIME_T_TO_DOUBLE (new_bin_width));
-} /* }}} void change_bin_width */
+static size_t latency_bucket (cdtime_t latency) /* {{{ */
+{
+  uint64_t u = ((uint64_t) (latency - 1)) >> LATENCY_UNIT_BITS;
+  int e;
+
+  if (u < LATENCY_SUB_NUM)
+    return ((size_t) u);
+
+  e = latency_log2 (u);
+  if (e >= LATENCY_SUB_BITS + LATENCY_GROUPS_NUM)
+    return (LATENCY_BUCKETS_NUM - 1);
+
+  /* The bits below the highest one select the bucket within the group. */
+  return ((size_t) (LATENCY_SUB_NUM * (e - LATENCY_SUB_BITS + 1))
+      + (size_t) ((u >> (e - LATENCY_SUB_BITS)) - LATENCY_SUB_NUM));
+} /* }}} size_t latency_bucket */
+
+/* Returns the lower bound of bucket "i". "i" may be LATENCY_BUCKETS_NUM, which
+ * gives the upper bound of the last bucket. */
+static cdtime_t latency_bucket_lower (size_t i) /* {{{ */
+{
+  size_t group = i / LATENCY_SUB_NUM;
+  uint64_t u;
+
+  if (group == 0)
+    u = (uint64_t) i;
+  else
+    u = ((uint64_t) (LATENCY_SUB_NUM + (i % LATENCY_SUB_NUM)))
+      << (group - 1);
+
+  return ((cdtime_t) (u << LATENCY_UNIT_BITS));
+} /* }}} cdtime_t latency_bucket_lower */
 
 latency_counter_t *latency_counter_create (void) /* {{{ */
 {
@@ -126,7 +128,6 @@ latency_counter_t *latency_counter_create (void) /* {{{ */
     return (NULL);
 
   latency_counter_reset (lc);
-  lc->bin_width = HISTOGRAM_DEFAULT_BIN_WIDTH;
   return (lc);
 } /* }}} latency_counter_t *latency_counter_create */
 
@@ -135,10 +136,13 @@ void latency_counter_destroy (latency_counter_t *lc) /* {{{ */
   sfree (lc);
 } /* }}} void latency_counter_destroy */
 
-void latency_counter_add (latency_counter_t *lc, cdtime_t latency) /* {{{ */
+size_t latency_counter_memory (void) /* {{{ */
 {
-  cdtime_t bin;
+  return (sizeof (latency_counter_t));
+} /* }}} size_t latency_counter_memory */
 
+void latency_counter_add (latency_counter_t *lc, cdtime_t latency) /* {{{ */
+{
   if ((lc == NULL) || (latency == 0) || (latency > ((cdtime_t) LLONG_MAX)))
     return;
 
@@ -152,33 +156,39 @@ void latency_counter_add (latency_counter_t *lc, cdtime_t latency) /* {{{ */
   if (lc->max < latency)
     lc->max = latency;
 
-  /* A latency of _exactly_ 1.0 ms should be stored in the buffer 0, so
-   * subtract one from the cdtime_t value so that exactly 1.0 ms get sorted
-   * accordingly. */
-  bin = (latency - 1) / lc->bin_width;
-  if (bin >= HISTOGRAM_NUM_BINS)
-  {
-      change_bin_width (lc, latency);
-      bin = (latency - 1) / lc->bin_width;
-      if (bin >= HISTOGRAM_NUM_BINS)
-      {
-          ERROR ("utils_latency: latency_counter_add: Invalid bin: %"PRIu64, bin);
-          return;
-      }
-  }
-  lc->histogram[bin]++;
+  lc->histogram[latency_bucket (latency)]++;
 } /* }}} void latency_counter_add */
 
+int latency_counter_merge (latency_counter_t *dst, /* {{{ */
+    latency_counter_t const *src)
+{
+  size_t i;
+
+  if ((dst == NULL) || (src == NULL))
+    return (EINVAL);
+
+  if (src->num == 0)
+    return (0);
+
+  if ((dst->num == 0) || (dst->min > src->min))
+    dst->min = src->min;
+  if ((dst->num == 0) || (dst->max < src->max))
+    dst->max = src->max;
+  dst->sum += src->sum;
+  dst->num += src->num;
+
+  for (i = 0; i < LATENCY_BUCKETS_NUM; i++)
+    dst->histogram[i] += src->histogram[i];
+
+  return (0);
+} /* }}} int latency_counter_merge */
+
 void latency_counter_reset (latency_counter_t *lc) /* {{{ */
 {
   if (lc == NULL)
     return;
 
-  cdtime_t bin_width = lc->bin_width;
   memset (lc, 0, sizeof (*lc));
-
-  /* preserve bin width */
-  lc->bin_width = bin_width;
   lc->start_time = cdtime ();
 } /* }}} void latency_counter_reset */
 
@@ -224,48 +234,44 @@ cdtime_t latency_counter_get_average (latency_counter_t *lc) /* {{{ */
 cdtime_t latency_counter_get_percentile (latency_counter_t *lc, /* {{{ */
     double percent)
 {
-  double percent_upper;
-  double percent_lower;
+  double target;
   double p;
   cdtime_t latency_lower;
+  cdtime_t latency_upper;
   cdtime_t latency_interpolated;
-  int sum;
+  uint64_t sum;
   size_t i;
 
   if ((lc == NULL) || (lc->num == 0) || !((percent > 0.0) && (percent < 100.0)))
     return (0);
 
-  /* Find index i so that at least "percent" events are within i+1 ms. */
-  percent_upper = 0.0;
-  percent_lower = 0.0;
+  /* Find the bucket holding the event "percent" percent of all events are
+   * smaller than or equal to. */
+  target = ((double) lc->num) * percent / 100.0;
   sum = 0;
-  for (i = 0; i < HISTOGRAM_NUM_BINS; i++)
+  for (i = 0; i < LATENCY_BUCKETS_NUM; i++)
   {
-    percent_lower = percent_upper;
-    sum += lc->histogram[i];
-    if (sum == 0)
-      percent_upper = 0.0;
-    else
-      percent_upper = 100.0 * ((double) sum) / ((double) lc->num);
-
-    if (percent_upper >= percent)
+    if ((lc->histogram[i] != 0)
+        && (((double) (sum + lc->histogram[i])) >= target))
       break;
+    sum += lc->histogram[i];
   }
 
-  if (i >= HISTOGRAM_NUM_BINS)
+  if (i >= LATENCY_BUCKETS_NUM)
     return (0);
 
-  assert (percent_upper >= percent);
-  assert (percent_lower < percent);
-
-  if (i == 0)
-    return (lc->bin_width);
-
-  latency_lower = ((cdtime_t) i) * lc->bin_width;
-  p = (percent - percent_lower) / (percent_upper - percent_lower);
+  latency_lower = latency_bucket_lower (i);
+  latency_upper = latency_bucket_lower (i + 1);
+  p = (target - ((double) sum)) / ((double) lc->histogram[i]);
 
   latency_interpolated = latency_lower
-    + DOUBLE_TO_CDTIME_T (p * CDTIME_T_TO_DOUBLE (lc->bin_width));
+    + DOUBLE_TO_CDTIME_T (p * CDTIME_T_TO_DOUBLE (latency_upper - latency_lower));
+
+  /* The exact extremes are known, don't report anything beyond them. */
+  if (latency_interpolated < lc->min)
+    latency_interpolated = lc->min;
+  if (latency_interpolated > lc->max)
+    latency_interpolated = lc->max;
 
   DEBUG ("latency_counter_get_percentile: latency_interpolated = %.3f",
       CDTIME_T_TO_DOUBLE (latency_interpolated));
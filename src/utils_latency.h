@@ -32,10 +32,17 @@ typedef struct latency_counter_s latency_counter_t;
 
 latency_counter_t *latency_counter_create (void);
 void latency_counter_destroy (latency_counter_t *lc);
+/* Returns the memory used by one latency counter, in bytes. */
+size_t latency_counter_memory (void);
 
 void latency_counter_add (latency_counter_t *lc, cdtime_t latency);
 void latency_counter_reset (latency_counter_t *lc);
 
+/* Adds the events counted by "src" to "dst", e.g. to combine per-thread
+ * counters. Returns zero on success, EINVAL if either counter is NULL. */
+int latency_counter_merge (latency_counter_t *dst,
+    latency_counter_t const *src);
+
 cdtime_t latency_counter_get_min (latency_counter_t *lc);
 cdtime_t latency_counter_get_max (latency_counter_t *lc);
 cdtime_t latency_counter_get_sum (latency_counter_t *lc);
@@ -0,0 +1,98 @@
+/**
+ * collectd - src/utils_latency_bench.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+
+/*
+ * Measures how fast latencies are added to a latency counter and how long
+ * reading percentiles takes.
+ *
+ * Usage: bench_utils_latency [latencies]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_latency.h"
+
+static double now (void) /* {{{ */
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((double) ts.tv_sec) + ((double) ts.tv_nsec) / 1e9);
+} /* }}} double now */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  size_t latencies_num = 10000000;
+  cdtime_t *latencies;
+  latency_counter_t *lc;
+  cdtime_t p99 = 0;
+  double start;
+  double add;
+  double percentile;
+  size_t i;
+
+  if (argc > 1)
+    latencies_num = (size_t) atoi (argv[1]);
+  if (latencies_num < 1)
+  {
+    fprintf (stderr, "Usage: %s [latencies]\n", argv[0]);
+    return (1);
+  }
+
+  latencies = calloc (latencies_num, sizeof (*latencies));
+  lc = latency_counter_create ();
+  if ((latencies == NULL) || (lc == NULL))
+  {
+    fprintf (stderr, "Out of memory.\n");
+    return (1);
+  }
+
+  /* Between 100 microseconds and 10 seconds. */
+  srand (1);
+  for (i = 0; i < latencies_num; i++)
+    latencies[i] = DOUBLE_TO_CDTIME_T (pow (10.0,
+          5.0 * ((double) rand ()) / ((double) RAND_MAX) - 4.0));
+
+  start = now ();
+  for (i = 0; i < latencies_num; i++)
+    latency_counter_add (lc, latencies[i]);
+  add = now () - start;
+
+  start = now ();
+  for (i = 0; i < 1000; i++)
+    p99 += latency_counter_get_percentile (lc, 99.0);
+  percentile = now () - start;
+
+  printf ("add:        %zu latencies in %.3f s, %.1f ns each\n",
+      latencies_num, add, 1e9 * add / ((double) latencies_num));
+  printf ("percentile: 1000 lookups in %.3f s, %.1f us each (p99 = %.6f s)\n",
+      percentile, 1e6 * percentile / 1000.0,
+      CDTIME_T_TO_DOUBLE (p99 / 1000));
+
+  latency_counter_destroy (lc);
+  sfree (latencies);
+  return (0);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -97,10 +97,99 @@ DEF_TEST(percentile)
   return 0;
 }
 
+static int compare_cdtime (void const *a, void const *b) /* {{{ */
+{
+  cdtime_t ta = *((cdtime_t const *) a);
+  cdtime_t tb = *((cdtime_t const *) b);
+
+  if (ta < tb)
+    return (-1);
+  return (ta > tb);
+} /* }}} int compare_cdtime */
+
+DEF_TEST(accuracy)
+{
+  double percents[] = {1.0, 10.0, 50.0, 90.0, 99.0, 99.9};
+  cdtime_t latencies[10000];
+  size_t i;
+  latency_counter_t *l;
+
+  CHECK_NOT_NULL (l = latency_counter_create ());
+
+  /* Spread latencies from about 10 microseconds to about 1000 seconds over
+   * many powers of two. */
+  srand (1);
+  for (i = 0; i < STATIC_ARRAY_SIZE (latencies); i++) {
+    double r = ((double) rand ()) / ((double) RAND_MAX);
+    latencies[i] = DOUBLE_TO_CDTIME_T (pow (10.0, 8.0 * r - 5.0));
+    latency_counter_add (l, latencies[i]);
+  }
+  qsort (latencies, STATIC_ARRAY_SIZE (latencies), sizeof (latencies[0]),
+      compare_cdtime);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (percents); i++) {
+    size_t rank = (size_t) ceil (percents[i]
+        * ((double) STATIC_ARRAY_SIZE (latencies)) / 100.0);
+    double want = CDTIME_T_TO_DOUBLE (latencies[rank - 1]);
+    double got = CDTIME_T_TO_DOUBLE (latency_counter_get_percentile (l,
+          percents[i]));
+
+    printf ("# percentile %g: want %g, got %g\n", percents[i], want, got);
+    /* One bucket is at most 1/32 of its lower bound wide. */
+    OK (fabs (got - want) <= want / 32.0);
+  }
+
+  latency_counter_destroy (l);
+  return 0;
+}
+
+DEF_TEST(merge)
+{
+  size_t i;
+  latency_counter_t *a;
+  latency_counter_t *b;
+  latency_counter_t *all;
+
+  CHECK_NOT_NULL (a = latency_counter_create ());
+  CHECK_NOT_NULL (b = latency_counter_create ());
+  CHECK_NOT_NULL (all = latency_counter_create ());
+
+  for (i = 0; i < 100; i++) {
+    cdtime_t latency = MS_TO_CDTIME_T (((uint64_t) i) + 1);
+    latency_counter_add ((i % 2) ? a : b, latency);
+    latency_counter_add (all, latency);
+  }
+
+  CHECK_ZERO (latency_counter_merge (a, b));
+  EXPECT_EQ_INT (EINVAL, latency_counter_merge (a, NULL));
+
+  EXPECT_EQ_UINT64 (latency_counter_get_num (all), latency_counter_get_num (a));
+  EXPECT_EQ_UINT64 (latency_counter_get_min (all), latency_counter_get_min (a));
+  EXPECT_EQ_UINT64 (latency_counter_get_max (all), latency_counter_get_max (a));
+  EXPECT_EQ_UINT64 (latency_counter_get_sum (all), latency_counter_get_sum (a));
+  for (i = 1; i < 100; i++)
+    EXPECT_EQ_UINT64 (latency_counter_get_percentile (all, (double) i),
+        latency_counter_get_percentile (a, (double) i));
+
+  /* Merging into an empty counter copies the other one. */
+  latency_counter_reset (b);
+  CHECK_ZERO (latency_counter_merge (b, all));
+  EXPECT_EQ_UINT64 (latency_counter_get_min (all), latency_counter_get_min (b));
+  EXPECT_EQ_UINT64 (latency_counter_get_percentile (all, 50.0),
+      latency_counter_get_percentile (b, 50.0));
+
+  latency_counter_destroy (a);
+  latency_counter_destroy (b);
+  latency_counter_destroy (all);
+  return 0;
+}
+
 int main (void)
 {
   RUN_TEST(simple);
   RUN_TEST(percentile);
+  RUN_TEST(accuracy);
+  RUN_TEST(merge);
 
   END_TEST;
 }
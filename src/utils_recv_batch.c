@@ -0,0 +1,116 @@
+/**
+ * collectd - src/utils_recv_batch.c
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
+#include "collectd.h"
+#include "plugin.h"
+#include "utils_recv_batch.h"
+
+#if HAVE_RECVMMSG
+/* Set when recvmmsg(2) returned ENOSYS, i.e. the C library has the function
+ * but the kernel doesn't. This is the same for all sockets, so it is shared
+ * by all plugins. */
+static _Bool recv_batch_no_recvmmsg = 0;
+#endif
+
+int recv_batch (int fd, char * const *bufs, size_t buf_size, /* {{{ */
+    size_t *lens, struct sockaddr_storage *addrs, size_t num)
+{
+  socklen_t addrlen = 0;
+  ssize_t status;
+
+  if (num < 1)
+    return (0);
+
+#if HAVE_RECVMMSG
+  if (!recv_batch_no_recvmmsg && (num > 1))
+  {
+    struct mmsghdr msgs[RECV_BATCH_MAX];
+    struct iovec   iovs[RECV_BATCH_MAX];
+    size_t i;
+    int n;
+
+    if (num > RECV_BATCH_MAX)
+      num = RECV_BATCH_MAX;
+
+    memset (msgs, 0, sizeof (msgs[0]) * num);
+    for (i = 0; i < num; i++)
+    {
+      iovs[i].iov_base = bufs[i];
+      iovs[i].iov_len = buf_size;
+      msgs[i].msg_hdr.msg_iov = iovs + i;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      if (addrs != NULL)
+      {
+        msgs[i].msg_hdr.msg_name = addrs + i;
+        msgs[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+        addrs[i].ss_family = AF_UNSPEC;
+      }
+    }
+
+    /* poll(2) said there is data, so don't wait for more. */
+    n = recvmmsg (fd, msgs, (unsigned int) num, MSG_DONTWAIT,
+        /* timeout = */ NULL);
+    if (n >= 0)
+    {
+      int j;
+
+      for (j = 0; j < n; j++)
+        lens[j] = (size_t) msgs[j].msg_len;
+      return (n);
+    }
+
+    if (errno != ENOSYS)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        return (0);
+      return (-1);
+    }
+
+    INFO ("recv_batch: recvmmsg(2) is not supported by the kernel. "
+        "Reading one datagram at a time.");
+    recv_batch_no_recvmmsg = 1;
+  }
+#endif
+
+  if (addrs != NULL)
+  {
+    addrlen = sizeof (addrs[0]);
+    addrs[0].ss_family = AF_UNSPEC;
+  }
+
+  status = recvfrom (fd, bufs[0], buf_size, MSG_DONTWAIT,
+      (struct sockaddr *) addrs, (addrs != NULL) ? &addrlen : NULL);
+  if (status < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return (0);
+    return (-1);
+  }
+
+  lens[0] = (size_t) status;
+  return (1);
+} /* }}} int recv_batch */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,50 @@
+/**
+ * collectd - src/utils_recv_batch.h
+ * Copyright (C) 2016       collectd contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef UTILS_RECV_BATCH_H
+#define UTILS_RECV_BATCH_H 1
+
+#include "collectd.h"
+
+#if HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+
+/* Maximum number of datagrams read by one recv_batch() call. */
+#define RECV_BATCH_MAX 64
+
+/*
+ * Reads up to "num" datagrams from "fd" without blocking, with a single
+ * recvmmsg(2) call where available. Datagram "i" is stored in "bufs[i]", which
+ * holds "buf_size" bytes, and its length in "lens[i]". If "addrs" is not NULL,
+ * the sender of datagram "i" is stored in "addrs[i]". If the kernel doesn't
+ * support recvmmsg(2), one datagram at a time is read with recvfrom(2) from
+ * then on.
+ *
+ * Returns the number of datagrams read. Returns zero if no datagram was
+ * waiting or the call was interrupted, and -1 with errno set on error.
+ */
+int recv_batch (int fd, char * const *bufs, size_t buf_size, size_t *lens,
+    struct sockaddr_storage *addrs, size_t num);
+
+#endif /* UTILS_RECV_BATCH_H */
@@ -26,6 +26,7 @@
 
 #include "collectd.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_rrdcreate.h"
 
 #include <pthread.h>
@@ -38,17 +39,11 @@ struct srrd_create_args_s
   time_t last_up;
   int argc;
   char **argv;
+  /* Orders files with the same step size by the time they were requested. */
+  unsigned long seq;
 };
 typedef struct srrd_create_args_s srrd_create_args_t;
 
-struct async_create_file_s;
-typedef struct async_create_file_s async_create_file_t;
-struct async_create_file_s
-{
-  char *filename;
-  async_create_file_t *next;
-};
-
 /*
  * Private variables
  */
@@ -74,9 +69,20 @@ static int rra_types_num = STATIC_ARRAY_SIZE (rra_types);
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
-static async_create_file_t *async_creation_list = NULL;
+/* Files being created or waiting to be created. Maps the file name to NULL. */
+static c_avl_tree_t *async_creation_tree = NULL;
 static pthread_mutex_t async_creation_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Binary heap of files waiting for a creation thread, protected by
+ * "async_creation_lock". Files with a shorter step size lose more values
+ * while they don't exist, so they are created first. */
+static srrd_create_args_t **async_queue = NULL;
+static size_t async_queue_num = 0;
+static size_t async_queue_size = 0;
+static unsigned long async_queue_seq = 0;
+static pthread_cond_t async_queue_cond = PTHREAD_COND_INITIALIZER;
+static int async_threads_num = 0;
+
 /*
  * Private functions
  */
@@ -460,115 +466,152 @@ static int srrd_create (const char *filename, /* {{{ */
 } /* }}} int srrd_create */
 #endif /* !HAVE_THREADSAFE_LIBRRD */
 
-static int lock_file (char const *filename) /* {{{ */
+/* XXX: You must hold "async_creation_lock" when calling this function! */
+static int lock_file_nolock (char const *filename) /* {{{ */
 {
-  async_create_file_t *ptr;
   struct stat sb;
+  char *key;
   int status;
 
-  pthread_mutex_lock (&async_creation_lock);
-
-  for (ptr = async_creation_list; ptr != NULL; ptr = ptr->next)
-    if (strcmp (filename, ptr->filename) == 0)
-      break;
-
-  if (ptr != NULL)
+  if (async_creation_tree == NULL)
   {
-    pthread_mutex_unlock (&async_creation_lock);
-    return (EEXIST);
+    async_creation_tree = c_avl_create (
+        (int (*) (const void *, const void *)) strcmp);
+    if (async_creation_tree == NULL)
+      return (ENOMEM);
   }
 
+  if (c_avl_get (async_creation_tree, filename, /* value = */ NULL) == 0)
+    return (EEXIST);
+
   status = stat (filename, &sb);
   if ((status == 0) || (errno != ENOENT))
-  {
-    pthread_mutex_unlock (&async_creation_lock);
     return (EEXIST);
-  }
 
-  ptr = malloc (sizeof (*ptr));
-  if (ptr == NULL)
-  {
-    pthread_mutex_unlock (&async_creation_lock);
+  key = strdup (filename);
+  if (key == NULL)
     return (ENOMEM);
-  }
 
-  ptr->filename = strdup (filename);
-  if (ptr->filename == NULL)
+  status = c_avl_insert (async_creation_tree, key, /* value = */ NULL);
+  if (status != 0)
   {
-    pthread_mutex_unlock (&async_creation_lock);
-    sfree (ptr);
-    return (ENOMEM);
+    sfree (key);
+    return ((status > 0) ? EEXIST : ENOMEM);
   }
 
-  ptr->next = async_creation_list;
-  async_creation_list = ptr;
+  return (0);
+} /* }}} int lock_file_nolock */
+
+static int lock_file (char const *filename) /* {{{ */
+{
+  int status;
 
+  pthread_mutex_lock (&async_creation_lock);
+  status = lock_file_nolock (filename);
   pthread_mutex_unlock (&async_creation_lock);
 
-  return (0);
+  return (status);
 } /* }}} int lock_file */
 
 static int unlock_file (char const *filename) /* {{{ */
 {
-  async_create_file_t *this;
-  async_create_file_t *prev;
-
+  char *key = NULL;
+  int status;
 
   pthread_mutex_lock (&async_creation_lock);
+  if (async_creation_tree == NULL)
+    status = ENOENT;
+  else
+    status = c_avl_remove (async_creation_tree, filename,
+        (void *) &key, /* value = */ NULL);
+  pthread_mutex_unlock (&async_creation_lock);
 
-  prev = NULL;
-  for (this = async_creation_list; this != NULL; this = this->next)
-  {
-    if (strcmp (filename, this->filename) == 0)
-      break;
-    prev = this;
-  }
+  if (status != 0)
+    return (ENOENT);
+
+  sfree (key);
+  return (0);
+} /* }}} int unlock_file */
 
-  if (this == NULL)
+static _Bool async_queue_before (srrd_create_args_t const *a, /* {{{ */
+    srrd_create_args_t const *b)
+{
+  if (a->pdp_step != b->pdp_step)
+    return (a->pdp_step < b->pdp_step);
+  return (a->seq < b->seq);
+} /* }}} _Bool async_queue_before */
+
+/* XXX: You must hold "async_creation_lock" when calling this function! */
+static int async_queue_push (srrd_create_args_t *args) /* {{{ */
+{
+  size_t i;
+
+  if (async_queue_num >= async_queue_size)
   {
-    pthread_mutex_unlock (&async_creation_lock);
-    return (ENOENT);
+    size_t size = (async_queue_size > 0) ? 2 * async_queue_size : 64;
+    srrd_create_args_t **tmp;
+
+    tmp = realloc (async_queue, size * sizeof (*async_queue));
+    if (tmp == NULL)
+      return (ENOMEM);
+    async_queue = tmp;
+    async_queue_size = size;
   }
 
-  if (prev == NULL)
+  args->seq = async_queue_seq++;
+
+  for (i = async_queue_num; i > 0; i = (i - 1) / 2)
   {
-    assert (this == async_creation_list);
-    async_creation_list = this->next;
+    size_t parent = (i - 1) / 2;
+    if (!async_queue_before (args, async_queue[parent]))
+      break;
+    async_queue[i] = async_queue[parent];
   }
-  else
+  async_queue[i] = args;
+  async_queue_num++;
+
+  return (0);
+} /* }}} int async_queue_push */
+
+/* XXX: You must hold "async_creation_lock" when calling this function! */
+static srrd_create_args_t *async_queue_pop (void) /* {{{ */
+{
+  srrd_create_args_t *ret;
+  srrd_create_args_t *last;
+  size_t i = 0;
+
+  if (async_queue_num == 0)
+    return (NULL);
+
+  ret = async_queue[0];
+  async_queue_num--;
+  last = async_queue[async_queue_num];
+
+  while (2 * i + 1 < async_queue_num)
   {
-    assert (this == prev->next);
-    prev->next = this->next;
-  }
-  this->next = NULL;
+    size_t child = 2 * i + 1;
 
-  pthread_mutex_unlock (&async_creation_lock);
+    if ((child + 1 < async_queue_num)
+        && async_queue_before (async_queue[child + 1], async_queue[child]))
+      child++;
+    if (!async_queue_before (async_queue[child], last))
+      break;
 
-  sfree (this->filename);
-  sfree (this);
+    async_queue[i] = async_queue[child];
+    i = child;
+  }
+  if (async_queue_num > 0)
+    async_queue[i] = last;
 
-  return (0);
-} /* }}} int unlock_file */
+  return (ret);
+} /* }}} srrd_create_args_t *async_queue_pop */
 
-static void *srrd_create_thread (void *targs) /* {{{ */
+/* Creates "args->filename", which must have been locked with lock_file(). */
+static void srrd_create_locked (srrd_create_args_t *args) /* {{{ */
 {
-  srrd_create_args_t *args = targs;
   char tmpfile[PATH_MAX];
   int status;
 
-  status = lock_file (args->filename);
-  if (status != 0)
-  {
-    if (status == EEXIST)
-      NOTICE ("srrd_create_thread: File \"%s\" is already being created.",
-          args->filename);
-    else
-      ERROR ("srrd_create_thread: Unable to lock file \"%s\".",
-          args->filename);
-    srrd_create_args_destroy (args);
-    return (0);
-  }
-
   ssnprintf (tmpfile, sizeof (tmpfile), "%s.async", args->filename);
 
   status = srrd_create (tmpfile, args->pdp_step, args->last_up,
@@ -579,8 +622,7 @@ static void *srrd_create_thread (void *targs) /* {{{ */
         args->filename, status);
     unlink (tmpfile);
     unlock_file (args->filename);
-    srrd_create_args_destroy (args);
-    return (0);
+    return;
   }
 
   status = rename (tmpfile, args->filename);
@@ -592,62 +634,131 @@ static void *srrd_create_thread (void *targs) /* {{{ */
         sstrerror (errno, errbuf, sizeof (errbuf)));
     unlink (tmpfile);
     unlock_file (args->filename);
-    srrd_create_args_destroy (args);
-    return (0);
+    return;
   }
 
   DEBUG ("srrd_create_thread: Successfully created RRD file \"%s\".",
       args->filename);
 
   unlock_file (args->filename);
-  srrd_create_args_destroy (args);
+} /* }}} void srrd_create_locked */
 
-  return (0);
+/* One of the threads creating the queued files. They wait for work until the
+ * process exits. */
+static void *srrd_create_thread (__attribute__((unused)) void *arg) /* {{{ */
+{
+  while (42)
+  {
+    srrd_create_args_t *args;
+
+    pthread_mutex_lock (&async_creation_lock);
+    while (async_queue_num == 0)
+      pthread_cond_wait (&async_queue_cond, &async_creation_lock);
+    args = async_queue_pop ();
+    pthread_mutex_unlock (&async_creation_lock);
+
+    srrd_create_locked (args);
+    srrd_create_args_destroy (args);
+  }
+
+  return (NULL);
 } /* }}} void *srrd_create_thread */
 
+/* XXX: You must hold "async_creation_lock" when calling this function! */
+static int srrd_create_thread_start (void) /* {{{ */
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int status;
+
+  status = pthread_attr_init (&attr);
+  if (status != 0)
+    return (status);
+
+  status = pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  if (status != 0)
+  {
+    pthread_attr_destroy (&attr);
+    return (status);
+  }
+
+  status = pthread_create (&thread, &attr, srrd_create_thread, NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("srrd_create_async: pthread_create failed: %s",
+        sstrerror (status, errbuf, sizeof (errbuf)));
+    pthread_attr_destroy (&attr);
+    return (status);
+  }
+
+  pthread_attr_destroy (&attr);
+  async_threads_num++;
+  return (0);
+} /* }}} int srrd_create_thread_start */
+
 static int srrd_create_async (const char *filename, /* {{{ */
     unsigned long pdp_step, time_t last_up,
-    int argc, const char **argv)
+    int argc, const char **argv, int threads_max)
 {
   srrd_create_args_t *args;
-  pthread_t thread;
-  pthread_attr_t attr;
   int status;
 
+  pthread_mutex_lock (&async_creation_lock);
+  status = lock_file_nolock (filename);
+  pthread_mutex_unlock (&async_creation_lock);
+  if (status == EEXIST)
+  {
+    /* Values keep arriving until the file has been created. */
+    DEBUG ("srrd_create_async: File \"%s\" is already being created.",
+        filename);
+    return (0);
+  }
+  else if (status != 0)
+  {
+    ERROR ("srrd_create_async: Unable to lock file \"%s\".", filename);
+    return (-1);
+  }
+
   DEBUG ("srrd_create_async: Creating \"%s\" in the background.", filename);
 
   args = srrd_create_args_create (filename, pdp_step, last_up, argc, argv);
   if (args == NULL)
-    return (-1);
-
-  status = pthread_attr_init (&attr);
-  if (status != 0)
   {
-    srrd_create_args_destroy (args);
+    unlock_file (filename);
     return (-1);
   }
 
-  status = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_mutex_lock (&async_creation_lock);
+
+  status = async_queue_push (args);
   if (status != 0)
   {
-    pthread_attr_destroy (&attr);
+    pthread_mutex_unlock (&async_creation_lock);
+    ERROR ("srrd_create_async: Queueing \"%s\" failed.", filename);
+    unlock_file (filename);
     srrd_create_args_destroy (args);
     return (-1);
   }
 
-  status = pthread_create (&thread, &attr, srrd_create_thread, args);
-  if (status != 0)
+  /* Threads are started on demand, up to "threads_max". */
+  if (async_threads_num < threads_max)
+    srrd_create_thread_start ();
+
+  if (async_threads_num == 0)
   {
-    char errbuf[1024];
-    ERROR ("srrd_create_async: pthread_create failed: %s",
-        sstrerror (status, errbuf, sizeof (errbuf)));
-    pthread_attr_destroy (&attr);
+    /* Not even one thread could be started. */
+    async_queue_pop ();
+    pthread_mutex_unlock (&async_creation_lock);
+    unlock_file (filename);
     srrd_create_args_destroy (args);
-    return (status);
+    return (-1);
   }
 
-  pthread_attr_destroy (&attr);
-  /* args is freed in srrd_create_thread(). */
+  pthread_cond_signal (&async_queue_cond);
+  pthread_mutex_unlock (&async_creation_lock);
+
+  /* args is freed by srrd_create_thread(). */
   return (0);
 } /* }}} int srrd_create_async */
 
@@ -713,7 +824,9 @@ int cu_rrd_create_file (const char *filename, /* {{{ */
   if (cfg->async)
   {
     status = srrd_create_async (filename, stepsize, last_up,
-        argc, (const char **) argv);
+        argc, (const char **) argv,
+        (cfg->async_threads > 0) ? cfg->async_threads
+        : RRDCREATE_ASYNC_THREADS_DEFAULT);
     if (status != 0)
       WARNING ("cu_rrd_create_file: srrd_create_async (%s) "
           "returned status %i.",
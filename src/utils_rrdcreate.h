@@ -31,6 +31,8 @@
 
 #include <stddef.h>
 
+#define RRDCREATE_ASYNC_THREADS_DEFAULT 4
+
 struct rrdcreate_config_s
 {
   unsigned long stepsize;
@@ -45,6 +47,9 @@ struct rrdcreate_config_s
   size_t consolidation_functions_num;
 
   _Bool async;
+  /* Maximum number of threads creating files if "async" is set. Zero
+   * selects RRDCREATE_ASYNC_THREADS_DEFAULT. */
+  int async_threads;
 };
 typedef struct rrdcreate_config_s rrdcreate_config_t;
 
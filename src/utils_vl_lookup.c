@@ -69,10 +69,19 @@ struct identifier_match_s
 };
 typedef struct identifier_match_s identifier_match_t;
 
+struct lu_cache_entry_s;
+typedef struct lu_cache_entry_s lu_cache_entry_t;
+
 struct lookup_s
 {
   c_avl_tree_t *by_type_tree;
 
+  /* Resolved matches by identifier; see lu_cache_get(). */
+  pthread_mutex_t cache_lock;
+  lu_cache_entry_t **cache;
+  size_t cache_size;
+  size_t cache_num;
+
   lookup_class_callback_t cb_user_class;
   lookup_obj_callback_t cb_user_obj;
   lookup_free_class_callback_t cb_free_class;
@@ -113,6 +122,40 @@ struct by_type_entry_s
 };
 typedef struct by_type_entry_s by_type_entry_t;
 
+/* A user class matching an identifier and the user object the identifier
+ * belongs to. */
+struct lu_match_s
+{
+  user_class_t *user_class;
+  user_obj_t *user_obj;
+};
+typedef struct lu_match_s lu_match_t;
+
+struct lu_result_s
+{
+  lu_match_t *matches;
+  size_t matches_num;
+  size_t matches_size;
+  _Bool failed;
+};
+typedef struct lu_result_s lu_result_t;
+
+/* The identifier's fields, each including its terminating null byte, are
+ * used as key. */
+#define LU_CACHE_KEY_SIZE (5 * DATA_MAX_NAME_LEN)
+
+struct lu_cache_entry_s
+{
+  lu_cache_entry_t *next;
+  uint32_t hash;
+
+  lu_match_t *matches;
+  size_t matches_num;
+
+  size_t key_len;
+  char key[];
+};
+
 /*
  * Private functions
  */
@@ -284,12 +327,59 @@ static user_obj_t *lu_find_user_obj (user_class_t *user_class, /* {{{ */
   return (NULL);
 } /* }}} user_obj_t *lu_find_user_obj */
 
+static int lu_call_user_obj (lookup_t *obj, /* {{{ */
+    data_set_t const *ds, value_list_t const *vl,
+    user_class_t *user_class, user_obj_t *user_obj)
+{
+  int status;
+
+  status = obj->cb_user_obj (ds, vl,
+      user_class->user_class, user_obj->user_obj);
+  if (status != 0)
+  {
+    ERROR ("utils_vl_lookup: The user object callback failed with status %i.",
+        status);
+    /* Returning a negative value means: abort! */
+    if (status < 0)
+      return (status);
+    else
+      return (1);
+  }
+
+  return (0);
+} /* }}} int lu_call_user_obj */
+
+static void lu_result_append (lu_result_t *res, /* {{{ */
+    user_class_t *user_class, user_obj_t *user_obj)
+{
+  if (res->failed)
+    return;
+
+  if (res->matches_num >= res->matches_size)
+  {
+    size_t new_size = (res->matches_size > 0) ? 2 * res->matches_size : 4;
+    lu_match_t *tmp;
+
+    tmp = realloc (res->matches, new_size * sizeof (*res->matches));
+    if (tmp == NULL)
+    {
+      res->failed = 1;
+      return;
+    }
+    res->matches = tmp;
+    res->matches_size = new_size;
+  }
+
+  res->matches[res->matches_num].user_class = user_class;
+  res->matches[res->matches_num].user_obj = user_obj;
+  res->matches_num++;
+} /* }}} void lu_result_append */
+
 static int lu_handle_user_class (lookup_t *obj, /* {{{ */
     data_set_t const *ds, value_list_t const *vl,
-    user_class_t *user_class)
+    user_class_t *user_class, lu_result_t *res)
 {
   user_obj_t *user_obj;
-  int status;
 
   assert (strcmp (vl->type, user_class->match.type.str) == 0);
   assert (user_class->match.plugin.is_regex
@@ -314,25 +404,14 @@ static int lu_handle_user_class (lookup_t *obj, /* {{{ */
   }
   pthread_mutex_unlock (&user_class->lock);
 
-  status = obj->cb_user_obj (ds, vl,
-      user_class->user_class, user_obj->user_obj);
-  if (status != 0)
-  {
-    ERROR ("utils_vl_lookup: The user object callback failed with status %i.",
-        status);
-    /* Returning a negative value means: abort! */
-    if (status < 0)
-      return (status);
-    else
-      return (1);
-  }
+  lu_result_append (res, user_class, user_obj);
 
-  return (0);
+  return (lu_call_user_obj (obj, ds, vl, user_class, user_obj));
 } /* }}} int lu_handle_user_class */
 
 static int lu_handle_user_class_list (lookup_t *obj, /* {{{ */
     data_set_t const *ds, value_list_t const *vl,
-    user_class_list_t *user_class_list)
+    user_class_list_t *user_class_list, lu_result_t *res)
 {
   user_class_list_t *ptr;
   int retval = 0;
@@ -341,7 +420,7 @@ static int lu_handle_user_class_list (lookup_t *obj, /* {{{ */
   {
     int status;
 
-    status = lu_handle_user_class (obj, ds, vl, &ptr->entry);
+    status = lu_handle_user_class (obj, ds, vl, &ptr->entry, res);
     if (status < 0)
       return (status);
     else if (status == 0)
@@ -351,6 +430,159 @@ static int lu_handle_user_class_list (lookup_t *obj, /* {{{ */
   return (retval);
 } /* }}} int lu_handle_user_class_list */
 
+static size_t lu_cache_key (value_list_t const *vl, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  char const *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+    vl->type, vl->type_instance };
+  size_t offset = 0;
+  size_t i;
+
+  assert (buffer_size >= LU_CACHE_KEY_SIZE);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+  {
+    size_t len = strnlen (fields[i], DATA_MAX_NAME_LEN - 1);
+
+    memcpy (buffer + offset, fields[i], len);
+    buffer[offset + len] = 0;
+    offset += len + 1;
+  }
+
+  return (offset);
+} /* }}} size_t lu_cache_key */
+
+/* FNV-1a */
+static uint32_t lu_cache_hash (char const *key, size_t key_len) /* {{{ */
+{
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < key_len; i++)
+  {
+    hash ^= (uint32_t) (unsigned char) key[i];
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} uint32_t lu_cache_hash */
+
+/* obj->cache_lock must be held when calling this function */
+static lu_cache_entry_t *lu_cache_get (lookup_t *obj, /* {{{ */
+    char const *key, size_t key_len, uint32_t hash)
+{
+  lu_cache_entry_t *e;
+
+  if (obj->cache_size == 0)
+    return (NULL);
+
+  for (e = obj->cache[hash & (obj->cache_size - 1)]; e != NULL; e = e->next)
+    if ((e->hash == hash) && (e->key_len == key_len)
+        && (memcmp (e->key, key, key_len) == 0))
+      return (e);
+
+  return (NULL);
+} /* }}} lu_cache_entry_t *lu_cache_get */
+
+/* obj->cache_lock must be held when calling this function */
+static void lu_cache_grow (lookup_t *obj) /* {{{ */
+{
+  size_t new_size = (obj->cache_size > 0) ? 2 * obj->cache_size : 64;
+  lu_cache_entry_t **new_cache;
+  size_t i;
+
+  new_cache = calloc (new_size, sizeof (*new_cache));
+  if (new_cache == NULL)
+    return;
+
+  for (i = 0; i < obj->cache_size; i++)
+  {
+    lu_cache_entry_t *e = obj->cache[i];
+
+    while (e != NULL)
+    {
+      lu_cache_entry_t *next = e->next;
+
+      e->next = new_cache[e->hash & (new_size - 1)];
+      new_cache[e->hash & (new_size - 1)] = e;
+      e = next;
+    }
+  }
+
+  sfree (obj->cache);
+  obj->cache = new_cache;
+  obj->cache_size = new_size;
+} /* }}} void lu_cache_grow */
+
+/* Takes ownership of res->matches in any case. */
+static void lu_cache_insert (lookup_t *obj, /* {{{ */
+    char const *key, size_t key_len, uint32_t hash, lu_result_t *res)
+{
+  lu_cache_entry_t *e;
+
+  e = malloc (sizeof (*e) + key_len);
+  if (e == NULL)
+  {
+    sfree (res->matches);
+    return;
+  }
+
+  e->hash = hash;
+  e->matches = res->matches;
+  e->matches_num = res->matches_num;
+  e->key_len = key_len;
+  memcpy (e->key, key, key_len);
+  res->matches = NULL;
+
+  pthread_mutex_lock (&obj->cache_lock);
+
+  /* Another thread may have resolved the same identifier concurrently. */
+  if (lu_cache_get (obj, key, key_len, hash) != NULL)
+  {
+    pthread_mutex_unlock (&obj->cache_lock);
+    sfree (e->matches);
+    sfree (e);
+    return;
+  }
+
+  if (obj->cache_num >= obj->cache_size)
+    lu_cache_grow (obj);
+
+  if (obj->cache_size == 0)
+  {
+    pthread_mutex_unlock (&obj->cache_lock);
+    sfree (e->matches);
+    sfree (e);
+    return;
+  }
+
+  e->next = obj->cache[hash & (obj->cache_size - 1)];
+  obj->cache[hash & (obj->cache_size - 1)] = e;
+  obj->cache_num++;
+
+  pthread_mutex_unlock (&obj->cache_lock);
+} /* }}} void lu_cache_insert */
+
+static void lu_cache_clear (lookup_t *obj) /* {{{ */
+{
+  size_t i;
+
+  pthread_mutex_lock (&obj->cache_lock);
+  for (i = 0; i < obj->cache_size; i++)
+  {
+    while (obj->cache[i] != NULL)
+    {
+      lu_cache_entry_t *e = obj->cache[i];
+
+      obj->cache[i] = e->next;
+      sfree (e->matches);
+      sfree (e);
+    }
+  }
+  obj->cache_num = 0;
+  pthread_mutex_unlock (&obj->cache_lock);
+} /* }}} void lu_cache_clear */
+
 static by_type_entry_t *lu_search_by_type (lookup_t *obj, /* {{{ */
     char const *type, _Bool allocate_if_missing)
 {
@@ -557,6 +789,8 @@ lookup_t *lookup_create (lookup_class_callback_t cb_user_class, /* {{{ */
     return (NULL);
   }
 
+  pthread_mutex_init (&obj->cache_lock, /* attr = */ NULL);
+
   obj->cb_user_class = cb_user_class;
   obj->cb_user_obj = cb_user_obj;
   obj->cb_free_class = cb_free_class;
@@ -572,6 +806,10 @@ void lookup_destroy (lookup_t *obj) /* {{{ */
   if (obj == NULL)
     return;
 
+  lu_cache_clear (obj);
+  sfree (obj->cache);
+  pthread_mutex_destroy (&obj->cache_lock);
+
   while (42)
   {
     char *type = NULL;
@@ -598,6 +836,9 @@ int lookup_add (lookup_t *obj, /* {{{ */
   by_type_entry_t *by_type = NULL;
   user_class_list_t *user_class_obj;
 
+  /* Resolved identifiers may match the new class, too. */
+  lu_cache_clear (obj);
+
   by_type = lu_search_by_type (obj, ident->type, /* allocate = */ 1);
   if (by_type == NULL)
     return (-1);
@@ -617,39 +858,93 @@ int lookup_add (lookup_t *obj, /* {{{ */
   return (lu_add_by_plugin (by_type, user_class_obj));
 } /* }}} int lookup_add */
 
-/* returns the number of successful calls to the callback function */
-int lookup_search (lookup_t *obj, /* {{{ */
-    data_set_t const *ds, value_list_t const *vl)
+/* Resolves an identifier that has not been seen before by matching it
+ * against all user classes of its type and caches the result, so that
+ * subsequent calls for the same identifier don't have to evaluate any
+ * regular expressions. */
+static int lu_search_uncached (lookup_t *obj, /* {{{ */
+    data_set_t const *ds, value_list_t const *vl,
+    char const *key, size_t key_len, uint32_t hash)
 {
   by_type_entry_t *by_type = NULL;
   user_class_list_t *user_class_list = NULL;
+  lu_result_t res = { NULL, 0, 0, 0 };
   int retval = 0;
   int status;
 
+  by_type = lu_search_by_type (obj, vl->type, /* allocate = */ 0);
+  if (by_type != NULL)
+  {
+    status = c_avl_get (by_type->by_plugin_tree,
+        vl->plugin, (void *) &user_class_list);
+    if (status == 0)
+    {
+      status = lu_handle_user_class_list (obj, ds, vl, user_class_list, &res);
+      if (status < 0)
+      {
+        sfree (res.matches);
+        return (status);
+      }
+      retval += status;
+    }
+
+    if (by_type->wildcard_plugin_list != NULL)
+    {
+      status = lu_handle_user_class_list (obj, ds, vl,
+          by_type->wildcard_plugin_list, &res);
+      if (status < 0)
+      {
+        sfree (res.matches);
+        return (status);
+      }
+      retval += status;
+    }
+  }
+
+  if (res.failed)
+    sfree (res.matches);
+  else
+    lu_cache_insert (obj, key, key_len, hash, &res);
+
+  return (retval);
+} /* }}} int lu_search_uncached */
+
+/* returns the number of successful calls to the callback function */
+int lookup_search (lookup_t *obj, /* {{{ */
+    data_set_t const *ds, value_list_t const *vl)
+{
+  char key[LU_CACHE_KEY_SIZE];
+  size_t key_len;
+  uint32_t hash;
+  lu_cache_entry_t *e;
+  int retval = 0;
+  size_t i;
+
   if ((obj == NULL) || (ds == NULL) || (vl == NULL))
     return (-EINVAL);
 
-  by_type = lu_search_by_type (obj, vl->type, /* allocate = */ 0);
-  if (by_type == NULL)
-    return (0);
+  key_len = lu_cache_key (vl, key, sizeof (key));
+  hash = lu_cache_hash (key, key_len);
 
-  status = c_avl_get (by_type->by_plugin_tree,
-      vl->plugin, (void *) &user_class_list);
-  if (status == 0)
-  {
-    status = lu_handle_user_class_list (obj, ds, vl, user_class_list);
-    if (status < 0)
-      return (status);
-    retval += status;
-  }
+  pthread_mutex_lock (&obj->cache_lock);
+  e = lu_cache_get (obj, key, key_len, hash);
+  pthread_mutex_unlock (&obj->cache_lock);
 
-  if (by_type->wildcard_plugin_list != NULL)
+  if (e == NULL)
+    return (lu_search_uncached (obj, ds, vl, key, key_len, hash));
+
+  /* Cache entries are only removed by lookup_add() and lookup_destroy(),
+   * which must not be called concurrently with lookup_search(). */
+  for (i = 0; i < e->matches_num; i++)
   {
-    status = lu_handle_user_class_list (obj, ds, vl,
-        by_type->wildcard_plugin_list);
+    int status;
+
+    status = lu_call_user_obj (obj, ds, vl,
+        e->matches[i].user_class, e->matches[i].user_obj);
     if (status < 0)
       return (status);
-    retval += status;
+    else if (status == 0)
+      retval++;
   }
 
   return (retval);
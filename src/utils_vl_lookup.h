@@ -79,10 +79,13 @@ lookup_t *lookup_create (lookup_class_callback_t,
     lookup_free_obj_callback_t);
 void lookup_destroy (lookup_t *obj);
 
+/* Must not be called concurrently with lookup_search(). */
 int lookup_add (lookup_t *obj,
     identifier_t const *ident, unsigned int group_by, void *user_class);
 
-/* TODO(octo): Pass lookup_obj_callback_t to lookup_search()? */
+/* The user classes matching an identifier are resolved once and cached, so
+ * only the first lookup of an identifier evaluates regular expressions.
+ * TODO(octo): Pass lookup_obj_callback_t to lookup_search()? */
 int lookup_search (lookup_t *obj,
     data_set_t const *ds, value_list_t const *vl);
 
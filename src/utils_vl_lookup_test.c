@@ -237,12 +237,46 @@ DEF_TEST(regex)
   return (0);
 }
 
+DEF_TEST(cached_lookups)
+{
+  lookup_t *obj;
+  int i;
+
+  CHECK_NOT_NULL (obj = lookup_create (
+        lookup_class_callback, lookup_obj_callback, (void *) free, (void *) free));
+
+  checked_lookup_add (obj, "/.*/", "/^cpu$/", "/.*/", "test", "/.*/", 0);
+
+  /* Repeated lookups of the same identifier are served from the cache and
+   * yield the same result. */
+  EXPECT_EQ_INT (1, checked_lookup_search (obj, "host0", "cpu", "0", "test",
+        "user", /* expect new = */ 1));
+  for (i = 0; i < 3; i++)
+    EXPECT_EQ_INT (1, checked_lookup_search (obj, "host0", "cpu", "0", "test",
+          "user", /* expect new = */ 0));
+  EXPECT_EQ_INT (0, checked_lookup_search (obj, "host0", "memory", "", "test",
+        "used", /* expect new = */ 0));
+  EXPECT_EQ_INT (0, checked_lookup_search (obj, "host0", "memory", "", "test",
+        "used", /* expect new = */ 0));
+
+  /* Adding a class invalidates identifiers resolved before. */
+  checked_lookup_add (obj, "/.*/", "memory", "", "test", "/.*/", 0);
+  EXPECT_EQ_INT (1, checked_lookup_search (obj, "host0", "memory", "", "test",
+        "used", /* expect new = */ 1));
+  EXPECT_EQ_INT (1, checked_lookup_search (obj, "host0", "cpu", "0", "test",
+        "user", /* expect new = */ 0));
+
+  lookup_destroy (obj);
+  return (0);
+}
+
 int main (int argc, char **argv) /* {{{ */
 {
   RUN_TEST(group_by_specific_host);
   RUN_TEST(group_by_any_host);
   RUN_TEST(multiple_lookups);
   RUN_TEST(regex);
+  RUN_TEST(cached_lookups);
 
   END_TEST;
 } /* }}} int main */
@@ -45,6 +45,19 @@ typedef struct VSC_C_main c_varnish_stats_t;
 typedef struct varnish_stats c_varnish_stats_t;
 #endif
 
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
+/* A wanted counter, resolved to its location in the shared memory segment. The
+ * strings are literals and are not freed. */
+struct varnish_counter_s {
+	const volatile uint64_t *ptr;
+	const char *category;
+	const char *type;
+	const char *type_instance;
+	int ds_type;
+};
+typedef struct varnish_counter_s varnish_counter_t;
+#endif
+
 /* {{{ user_config_s */
 struct user_config_s {
 	char *instance;
@@ -81,6 +94,14 @@ struct user_config_s {
 #if HAVE_VARNISH_V4
 	_Bool collect_vsm;
 #endif
+
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
+	/* The VSM mapping is kept open across reads and the wanted counters are
+	 * only looked up again when the segment changes. */
+	struct VSM_data *vd;
+	varnish_counter_t *counters;
+	size_t counters_num;
+#endif
 };
 typedef struct user_config_s user_config_t; /* }}} */
 
@@ -136,10 +157,53 @@ static int varnish_submit_derive (const char *plugin_instance, /* {{{ */
 } /* }}} int varnish_submit_derive */
 
 #if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
+static int varnish_resolve (user_config_t *conf, /* {{{ */
+		const char *category, const char *type, const char *type_instance,
+		int ds_type, const volatile uint64_t *ptr)
+{
+	varnish_counter_t *tmp;
+	varnish_counter_t *c;
+
+	tmp = realloc (conf->counters,
+			(conf->counters_num + 1) * sizeof (*conf->counters));
+	if (tmp == NULL)
+		return (ENOMEM);
+	conf->counters = tmp;
+
+	c = conf->counters + conf->counters_num;
+	c->ptr = ptr;
+	c->category = category;
+	c->type = type;
+	c->type_instance = type_instance;
+	c->ds_type = ds_type;
+	conf->counters_num++;
+
+	return (0);
+} /* }}} int varnish_resolve */
+
+static int varnish_resolve_gauge (user_config_t *conf, /* {{{ */
+		const char *category, const char *type, const char *type_instance,
+		const volatile uint64_t *ptr)
+{
+	return (varnish_resolve (conf, category, type, type_instance,
+				DS_TYPE_GAUGE, ptr));
+} /* }}} int varnish_resolve_gauge */
+
+static int varnish_resolve_derive (user_config_t *conf, /* {{{ */
+		const char *category, const char *type, const char *type_instance,
+		const volatile uint64_t *ptr)
+{
+	return (varnish_resolve (conf, category, type, type_instance,
+				DS_TYPE_DERIVE, ptr));
+} /* }}} int varnish_resolve_derive */
+
+/* Called once for each counter by VSC_Iter() when the shared memory segment
+ * has been (re)opened. Wanted counters are added to conf->counters, which
+ * varnish_read() then reads directly. */
 static int varnish_monitor (void *priv, const struct VSC_point * const pt) /* {{{ */
 {
-	uint64_t val;
-	const user_config_t *conf;
+	const volatile uint64_t *ptr;
+	user_config_t *conf;
 	const char *class;
 	const char *name;
 
@@ -163,362 +227,362 @@ static int varnish_monitor (void *priv, const struct VSC_point * const pt) /* {{
 		return (0);
 #endif
 
-	val = *(const volatile uint64_t*) pt->ptr;
+	ptr = (const volatile uint64_t *) pt->ptr;
 
 	if (conf->collect_cache)
 	{
 		if (strcmp(name, "cache_hit") == 0)
-			return varnish_submit_derive (conf->instance, "cache", "cache_result", "hit",     val);
+			return varnish_resolve_derive (conf, "cache", "cache_result", "hit",     ptr);
 		else if (strcmp(name, "cache_miss") == 0)
-			return varnish_submit_derive (conf->instance, "cache", "cache_result", "miss",    val);
+			return varnish_resolve_derive (conf, "cache", "cache_result", "miss",    ptr);
 		else if (strcmp(name, "cache_hitpass") == 0)
-			return varnish_submit_derive (conf->instance, "cache", "cache_result", "hitpass", val);
+			return varnish_resolve_derive (conf, "cache", "cache_result", "hitpass", ptr);
 	}
 
 	if (conf->collect_connections)
 	{
 		if (strcmp(name, "client_conn") == 0)
-			return varnish_submit_derive (conf->instance, "connections", "connections", "accepted", val);
+			return varnish_resolve_derive (conf, "connections", "connections", "accepted", ptr);
 		else if (strcmp(name, "client_drop") == 0)
-			return varnish_submit_derive (conf->instance, "connections", "connections", "dropped" , val);
+			return varnish_resolve_derive (conf, "connections", "connections", "dropped" , ptr);
 		else if (strcmp(name, "client_req") == 0)
-			return varnish_submit_derive (conf->instance, "connections", "connections", "received", val);
+			return varnish_resolve_derive (conf, "connections", "connections", "received", ptr);
 	}
 
 #ifdef HAVE_VARNISH_V3
 	if (conf->collect_dirdns)
 	{
 		if (strcmp(name, "dir_dns_lookups") == 0)
-			return varnish_submit_derive (conf->instance, "dirdns", "cache_operation", "lookups",    val);
+			return varnish_resolve_derive (conf, "dirdns", "cache_operation", "lookups",    ptr);
 		else if (strcmp(name, "dir_dns_failed") == 0)
-			return varnish_submit_derive (conf->instance, "dirdns", "cache_result",    "failed",     val);
+			return varnish_resolve_derive (conf, "dirdns", "cache_result",    "failed",     ptr);
 		else if (strcmp(name, "dir_dns_hit") == 0)
-			return varnish_submit_derive (conf->instance, "dirdns", "cache_result",    "hits",       val);
+			return varnish_resolve_derive (conf, "dirdns", "cache_result",    "hits",       ptr);
 		else if (strcmp(name, "dir_dns_cache_full") == 0)
-			return varnish_submit_derive (conf->instance, "dirdns", "cache_result",    "cache_full", val);
+			return varnish_resolve_derive (conf, "dirdns", "cache_result",    "cache_full", ptr);
 	}
 #endif
 
 	if (conf->collect_esi)
 	{
 		if (strcmp(name, "esi_errors") == 0)
-			return varnish_submit_derive (conf->instance, "esi", "total_operations", "error",   val);
+			return varnish_resolve_derive (conf, "esi", "total_operations", "error",   ptr);
 		else if (strcmp(name, "esi_parse") == 0)
-			return varnish_submit_derive (conf->instance, "esi", "total_operations", "parsed",  val);
+			return varnish_resolve_derive (conf, "esi", "total_operations", "parsed",  ptr);
 		else if (strcmp(name, "esi_warnings") == 0)
-			return varnish_submit_derive (conf->instance, "esi", "total_operations", "warning", val);
+			return varnish_resolve_derive (conf, "esi", "total_operations", "warning", ptr);
 	}
 
 	if (conf->collect_backend)
 	{
 		if (strcmp(name, "backend_conn") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "success",       val);
+			return varnish_resolve_derive (conf, "backend", "connections", "success",       ptr);
 		else if (strcmp(name, "backend_unhealthy") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "not-attempted", val);
+			return varnish_resolve_derive (conf, "backend", "connections", "not-attempted", ptr);
 		else if (strcmp(name, "backend_busy") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "too-many",      val);
+			return varnish_resolve_derive (conf, "backend", "connections", "too-many",      ptr);
 		else if (strcmp(name, "backend_fail") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "failures",      val);
+			return varnish_resolve_derive (conf, "backend", "connections", "failures",      ptr);
 		else if (strcmp(name, "backend_reuse") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "reuses",        val);
+			return varnish_resolve_derive (conf, "backend", "connections", "reuses",        ptr);
 		else if (strcmp(name, "backend_toolate") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "was-closed",    val);
+			return varnish_resolve_derive (conf, "backend", "connections", "was-closed",    ptr);
 		else if (strcmp(name, "backend_recycle") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "recycled",      val);
+			return varnish_resolve_derive (conf, "backend", "connections", "recycled",      ptr);
 		else if (strcmp(name, "backend_unused") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "unused",        val);
+			return varnish_resolve_derive (conf, "backend", "connections", "unused",        ptr);
 		else if (strcmp(name, "backend_retry") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "connections", "retries",       val);
+			return varnish_resolve_derive (conf, "backend", "connections", "retries",       ptr);
 		else if (strcmp(name, "backend_req") == 0)
-			return varnish_submit_derive (conf->instance, "backend", "http_requests", "requests",    val);
+			return varnish_resolve_derive (conf, "backend", "http_requests", "requests",    ptr);
 		else if (strcmp(name, "n_backend") == 0)
-			return varnish_submit_gauge  (conf->instance, "backend", "backends", "n_backends",       val);
+			return varnish_resolve_gauge (conf, "backend", "backends", "n_backends",       ptr);
 	}
 
 	if (conf->collect_fetch)
 	{
 		if (strcmp(name, "fetch_head") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "head",        val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "head",        ptr);
 		else if (strcmp(name, "fetch_length") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "length",      val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "length",      ptr);
 		else if (strcmp(name, "fetch_chunked") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "chunked",     val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "chunked",     ptr);
 		else if (strcmp(name, "fetch_eof") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "eof",         val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "eof",         ptr);
 		else if (strcmp(name, "fetch_bad") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "bad_headers", val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "bad_headers", ptr);
 		else if (strcmp(name, "fetch_close") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "close",       val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "close",       ptr);
 		else if (strcmp(name, "fetch_oldhttp") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "oldhttp",     val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "oldhttp",     ptr);
 		else if (strcmp(name, "fetch_zero") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "zero",        val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "zero",        ptr);
 		else if (strcmp(name, "fetch_failed") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "failed",      val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "failed",      ptr);
 		else if (strcmp(name, "fetch_1xx") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "no_body_1xx", val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "no_body_1xx", ptr);
 		else if (strcmp(name, "fetch_204") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "no_body_204", val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "no_body_204", ptr);
 		else if (strcmp(name, "fetch_304") == 0)
-			return varnish_submit_derive (conf->instance, "fetch", "http_requests", "no_body_304", val);
+			return varnish_resolve_derive (conf, "fetch", "http_requests", "no_body_304", ptr);
 	}
 
 	if (conf->collect_hcb)
 	{
 		if (strcmp(name, "hcb_nolock") == 0)
-			return varnish_submit_derive (conf->instance, "hcb", "cache_operation", "lookup_nolock", val);
+			return varnish_resolve_derive (conf, "hcb", "cache_operation", "lookup_nolock", ptr);
 		else if (strcmp(name, "hcb_lock") == 0)
-			return varnish_submit_derive (conf->instance, "hcb", "cache_operation", "lookup_lock",   val);
+			return varnish_resolve_derive (conf, "hcb", "cache_operation", "lookup_lock",   ptr);
 		else if (strcmp(name, "hcb_insert") == 0)
-			return varnish_submit_derive (conf->instance, "hcb", "cache_operation", "insert",        val);
+			return varnish_resolve_derive (conf, "hcb", "cache_operation", "insert",        ptr);
 	}
 
 	if (conf->collect_objects)
 	{
 		if (strcmp(name, "n_expired") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "expired",            val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "expired",            ptr);
 		else if (strcmp(name, "n_lru_nuked") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "lru_nuked",          val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "lru_nuked",          ptr);
 		else if (strcmp(name, "n_lru_saved") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "lru_saved",          val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "lru_saved",          ptr);
 		else if (strcmp(name, "n_lru_moved") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "lru_moved",          val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "lru_moved",          ptr);
 		else if (strcmp(name, "n_deathrow") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "deathrow",           val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "deathrow",           ptr);
 		else if (strcmp(name, "losthdr") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "header_overflow",    val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "header_overflow",    ptr);
 		else if (strcmp(name, "n_obj_purged") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "purged",             val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "purged",             ptr);
 		else if (strcmp(name, "n_objsendfile") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "sent_sendfile",      val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "sent_sendfile",      ptr);
 		else if (strcmp(name, "n_objwrite") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "sent_write",         val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "sent_write",         ptr);
 		else if (strcmp(name, "n_objoverflow") == 0)
-			return varnish_submit_derive (conf->instance, "objects", "total_objects", "workspace_overflow", val);
+			return varnish_resolve_derive (conf, "objects", "total_objects", "workspace_overflow", ptr);
 	}
 
 #if HAVE_VARNISH_V3
 	if (conf->collect_ban)
 	{
 		if (strcmp(name, "n_ban") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "total",          val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "total",          ptr);
 		else if (strcmp(name, "n_ban_add") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "added",          val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "added",          ptr);
 		else if (strcmp(name, "n_ban_retire") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "deleted",        val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "deleted",        ptr);
 		else if (strcmp(name, "n_ban_obj_test") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "objects_tested", val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "objects_tested", ptr);
 		else if (strcmp(name, "n_ban_re_test") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "regexps_tested", val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "regexps_tested", ptr);
 		else if (strcmp(name, "n_ban_dups") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "duplicate",      val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "duplicate",      ptr);
 	}
 #endif
 #if HAVE_VARNISH_V4
 	if (conf->collect_ban)
 	{
 		if (strcmp(name, "bans") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "total",     val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "total",     ptr);
 		else if (strcmp(name, "bans_added") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "added",     val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "added",     ptr);
 		else if (strcmp(name, "bans_obj") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "obj",       val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "obj",       ptr);
 		else if (strcmp(name, "bans_req") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "req",       val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "req",       ptr);
 		else if (strcmp(name, "bans_completed") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "completed", val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "completed", ptr);
 		else if (strcmp(name, "bans_deleted") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "deleted",   val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "deleted",   ptr);
 		else if (strcmp(name, "bans_tested") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "tested",    val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "tested",    ptr);
 		else if (strcmp(name, "bans_dups") == 0)
-			return varnish_submit_derive (conf->instance, "ban", "total_operations", "duplicate", val);
+			return varnish_resolve_derive (conf, "ban", "total_operations", "duplicate", ptr);
 	}
 #endif
 
 	if (conf->collect_session)
 	{
 		if (strcmp(name, "sess_closed") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "closed",    val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "closed",    ptr);
 		else if (strcmp(name, "sess_pipeline") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "pipeline",  val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "pipeline",  ptr);
 		else if (strcmp(name, "sess_readahead") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "readahead", val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "readahead", ptr);
 		else if (strcmp(name, "sess_conn") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "accepted",  val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "accepted",  ptr);
 		else if (strcmp(name, "sess_drop") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "dropped",   val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "dropped",   ptr);
 		else if (strcmp(name, "sess_fail") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "failed",    val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "failed",    ptr);
 		else if (strcmp(name, "sess_pipe_overflow") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "overflow",  val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "overflow",  ptr);
 		else if (strcmp(name, "sess_queued") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "queued",    val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "queued",    ptr);
 		else if (strcmp(name, "sess_linger") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "linger",    val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "linger",    ptr);
 		else if (strcmp(name, "sess_herd") == 0)
-			return varnish_submit_derive (conf->instance, "session", "total_operations", "herd",      val);
+			return varnish_resolve_derive (conf, "session", "total_operations", "herd",      ptr);
 	}
 
 	if (conf->collect_shm)
 	{
 		if (strcmp(name, "shm_records") == 0)
-			return varnish_submit_derive (conf->instance, "shm", "total_operations", "records",    val);
+			return varnish_resolve_derive (conf, "shm", "total_operations", "records",    ptr);
 		else if (strcmp(name, "shm_writes") == 0)
-			return varnish_submit_derive (conf->instance, "shm", "total_operations", "writes",     val);
+			return varnish_resolve_derive (conf, "shm", "total_operations", "writes",     ptr);
 		else if (strcmp(name, "shm_flushes") == 0)
-			return varnish_submit_derive (conf->instance, "shm", "total_operations", "flushes",    val);
+			return varnish_resolve_derive (conf, "shm", "total_operations", "flushes",    ptr);
 		else if (strcmp(name, "shm_cont") == 0)
-			return varnish_submit_derive (conf->instance, "shm", "total_operations", "contention", val);
+			return varnish_resolve_derive (conf, "shm", "total_operations", "contention", ptr);
 		else if (strcmp(name, "shm_cycles") == 0)
-			return varnish_submit_derive (conf->instance, "shm", "total_operations", "cycles",     val);
+			return varnish_resolve_derive (conf, "shm", "total_operations", "cycles",     ptr);
 	}
 
 	if (conf->collect_sms)
 	{
 		if (strcmp(name, "sms_nreq") == 0)
-			return varnish_submit_derive (conf->instance, "sms", "total_requests", "allocator", val);
+			return varnish_resolve_derive (conf, "sms", "total_requests", "allocator", ptr);
 		else if (strcmp(name, "sms_nobj") == 0)
-			return varnish_submit_gauge (conf->instance,  "sms", "requests", "outstanding",     val);
+			return varnish_resolve_gauge (conf,  "sms", "requests", "outstanding",     ptr);
 		else if (strcmp(name, "sms_nbytes") == 0)
-			return varnish_submit_gauge (conf->instance,  "sms", "bytes", "outstanding",        val);
+			return varnish_resolve_gauge (conf,  "sms", "bytes", "outstanding",        ptr);
 		else if (strcmp(name, "sms_balloc") == 0)
-			return varnish_submit_derive (conf->instance,  "sms", "total_bytes", "allocated",   val);
+			return varnish_resolve_derive (conf,  "sms", "total_bytes", "allocated",   ptr);
 		else if (strcmp(name, "sms_bfree") == 0)
-			return varnish_submit_derive (conf->instance,  "sms", "total_bytes", "free",        val);
+			return varnish_resolve_derive (conf,  "sms", "total_bytes", "free",        ptr);
 	}
 
 	if (conf->collect_struct)
 	{
 		if (strcmp(name, "n_sess_mem") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "current_sessions", "sess_mem",  val);
+			return varnish_resolve_gauge (conf, "struct", "current_sessions", "sess_mem",  ptr);
 		else if (strcmp(name, "n_sess") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "current_sessions", "sess",      val);
+			return varnish_resolve_gauge (conf, "struct", "current_sessions", "sess",      ptr);
 		else if (strcmp(name, "n_object") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "object",             val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "object",             ptr);
 		else if (strcmp(name, "n_vampireobject") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "vampireobject",      val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "vampireobject",      ptr);
 		else if (strcmp(name, "n_objectcore") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "objectcore",         val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "objectcore",         ptr);
 		else if (strcmp(name, "n_waitinglist") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "waitinglist",        val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "waitinglist",        ptr);
 		else if (strcmp(name, "n_objecthead") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "objecthead",         val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "objecthead",         ptr);
 		else if (strcmp(name, "n_smf") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "smf",                val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "smf",                ptr);
 		else if (strcmp(name, "n_smf_frag") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "smf_frag",           val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "smf_frag",           ptr);
 		else if (strcmp(name, "n_smf_large") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "smf_large",          val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "smf_large",          ptr);
 		else if (strcmp(name, "n_vbe_conn") == 0)
-			return varnish_submit_gauge (conf->instance, "struct", "objects", "vbe_conn",           val);
+			return varnish_resolve_gauge (conf, "struct", "objects", "vbe_conn",           ptr);
 	}
 
 	if (conf->collect_totals)
 	{
 		if (strcmp(name, "s_sess") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_sessions", "sessions",  val);
+			return varnish_resolve_derive (conf, "totals", "total_sessions", "sessions",  ptr);
 		else if (strcmp(name, "s_req") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_requests", "requests",  val);
+			return varnish_resolve_derive (conf, "totals", "total_requests", "requests",  ptr);
 		else if (strcmp(name, "s_pipe") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_operations", "pipe",    val);
+			return varnish_resolve_derive (conf, "totals", "total_operations", "pipe",    ptr);
 		else if (strcmp(name, "s_pass") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_operations", "pass",    val);
+			return varnish_resolve_derive (conf, "totals", "total_operations", "pass",    ptr);
 		else if (strcmp(name, "s_fetch") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_operations", "fetches", val);
+			return varnish_resolve_derive (conf, "totals", "total_operations", "fetches", ptr);
 		else if (strcmp(name, "s_synth") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "synth",        val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "synth",        ptr);
 		else if (strcmp(name, "s_req_hdrbytes") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "req_header",   val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "req_header",   ptr);
 		else if (strcmp(name, "s_req_bodybytes") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "req_body",     val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "req_body",     ptr);
 		else if (strcmp(name, "s_resp_hdrbytes") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "resp_header",  val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "resp_header",  ptr);
 		else if (strcmp(name, "s_resp_bodybytes") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "resp_body",    val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "resp_body",    ptr);
 		else if (strcmp(name, "s_pipe_hdrbytes") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "pipe_header",  val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "pipe_header",  ptr);
 		else if (strcmp(name, "s_pipe_in") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "pipe_in",      val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "pipe_in",      ptr);
 		else if (strcmp(name, "s_pipe_out") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "pipe_out",     val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "pipe_out",     ptr);
 		else if (strcmp(name, "n_purges") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_operations", "purges",  val);
+			return varnish_resolve_derive (conf, "totals", "total_operations", "purges",  ptr);
 		else if (strcmp(name, "s_hdrbytes") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "header-bytes", val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "header-bytes", ptr);
 		else if (strcmp(name, "s_bodybytes") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_bytes", "body-bytes",   val);
+			return varnish_resolve_derive (conf, "totals", "total_bytes", "body-bytes",   ptr);
 		else if (strcmp(name, "n_gzip") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_operations", "gzip",    val);
+			return varnish_resolve_derive (conf, "totals", "total_operations", "gzip",    ptr);
 		else if (strcmp(name, "n_gunzip") == 0)
-			return varnish_submit_derive (conf->instance, "totals", "total_operations", "gunzip",  val);
+			return varnish_resolve_derive (conf, "totals", "total_operations", "gunzip",  ptr);
 	}
 
 	if (conf->collect_uptime)
 	{
 		if (strcmp(name, "uptime") == 0)
-			return varnish_submit_gauge (conf->instance, "uptime", "uptime", "client_uptime", val);
+			return varnish_resolve_gauge (conf, "uptime", "uptime", "client_uptime", ptr);
 	}
 
 	if (conf->collect_vcl)
 	{
 		if (strcmp(name, "n_vcl") == 0)
-			return varnish_submit_gauge (conf->instance, "vcl", "vcl", "total_vcl",     val);
+			return varnish_resolve_gauge (conf, "vcl", "vcl", "total_vcl",     ptr);
 		else if (strcmp(name, "n_vcl_avail") == 0)
-			return varnish_submit_gauge (conf->instance, "vcl", "vcl", "avail_vcl",     val);
+			return varnish_resolve_gauge (conf, "vcl", "vcl", "avail_vcl",     ptr);
 		else if (strcmp(name, "n_vcl_discard") == 0)
-			return varnish_submit_gauge (conf->instance, "vcl", "vcl", "discarded_vcl", val);
+			return varnish_resolve_gauge (conf, "vcl", "vcl", "discarded_vcl", ptr);
 		else if (strcmp(name, "vmods") == 0)
-			return varnish_submit_gauge (conf->instance, "vcl", "objects", "vmod",      val);
+			return varnish_resolve_gauge (conf, "vcl", "objects", "vmod",      ptr);
 	}
 
 	if (conf->collect_workers)
 	{
 		if (strcmp(name, "threads") == 0)
-			return varnish_submit_gauge (conf->instance, "workers", "threads", "worker",               val);
+			return varnish_resolve_gauge (conf, "workers", "threads", "worker",               ptr);
 		else if (strcmp(name, "threads_created") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "created",       val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "created",       ptr);
 		else if (strcmp(name, "threads_failed") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "failed",        val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "failed",        ptr);
 		else if (strcmp(name, "threads_limited") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "limited",       val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "limited",       ptr);
 		else if (strcmp(name, "threads_destroyed") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "dropped",       val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "dropped",       ptr);
 		else if (strcmp(name, "thread_queue_len") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "queue_length",  "threads",       val);
+			return varnish_resolve_derive (conf, "workers", "queue_length",  "threads",       ptr);
 		else if (strcmp(name, "n_wrk") == 0)
-			return varnish_submit_gauge (conf->instance, "workers", "threads", "worker",               val);
+			return varnish_resolve_gauge (conf, "workers", "threads", "worker",               ptr);
 		else if (strcmp(name, "n_wrk_create") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "created",       val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "created",       ptr);
 		else if (strcmp(name, "n_wrk_failed") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "failed",        val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "failed",        ptr);
 		else if (strcmp(name, "n_wrk_max") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "limited",       val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "limited",       ptr);
 		else if (strcmp(name, "n_wrk_drop") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_threads", "dropped",       val);
+			return varnish_resolve_derive (conf, "workers", "total_threads", "dropped",       ptr);
 		else if (strcmp(name, "n_wrk_queue") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_requests", "queued",       val);
+			return varnish_resolve_derive (conf, "workers", "total_requests", "queued",       ptr);
 		else if (strcmp(name, "n_wrk_overflow") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_requests", "overflowed",   val);
+			return varnish_resolve_derive (conf, "workers", "total_requests", "overflowed",   ptr);
 		else if (strcmp(name, "n_wrk_queued") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_requests", "queued",       val);
+			return varnish_resolve_derive (conf, "workers", "total_requests", "queued",       ptr);
 		else if (strcmp(name, "n_wrk_lqueue") == 0)
-			return varnish_submit_derive (conf->instance, "workers", "total_requests", "queue_length", val);
+			return varnish_resolve_derive (conf, "workers", "total_requests", "queue_length", ptr);
 	}
 
 #if HAVE_VARNISH_V4
 	if (conf->collect_vsm)
 	{
 		if (strcmp(name, "vsm_free") == 0)
-			return varnish_submit_gauge (conf->instance, "vsm", "bytes", "free",              val);
+			return varnish_resolve_gauge (conf, "vsm", "bytes", "free",              ptr);
 		else if (strcmp(name, "vsm_used") == 0)
-			return varnish_submit_gauge (conf->instance, "vsm", "bytes", "used",              val);
+			return varnish_resolve_gauge (conf, "vsm", "bytes", "used",              ptr);
 		else if (strcmp(name, "vsm_cooling") == 0)
-			return varnish_submit_gauge (conf->instance, "vsm", "bytes", "cooling",           val);
+			return varnish_resolve_gauge (conf, "vsm", "bytes", "cooling",           ptr);
 		else if (strcmp(name, "vsm_overflow") == 0)
-			return varnish_submit_gauge (conf->instance, "vsm", "bytes", "overflow",          val);
+			return varnish_resolve_gauge (conf, "vsm", "bytes", "overflow",          ptr);
 		else if (strcmp(name, "vsm_overflowed") == 0)
-			return varnish_submit_derive (conf->instance, "vsm", "total_bytes", "overflowed", val);
+			return varnish_resolve_derive (conf, "vsm", "total_bytes", "overflowed", ptr);
 	}
 #endif
 
@@ -789,32 +853,74 @@ static void varnish_monitor (const user_config_t *conf, /* {{{ */
 #endif
 
 #if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
-static int varnish_read (user_data_t *ud) /* {{{ */
+static void varnish_close (user_config_t *conf) /* {{{ */
+{
+	if (conf->vd != NULL)
+		VSM_Delete (conf->vd);
+	conf->vd = NULL;
+
+	sfree (conf->counters);
+	conf->counters_num = 0;
+} /* }}} void varnish_close */
+
+/* Looks up the wanted counters in the current mapping. */
+static int varnish_resolve_all (user_config_t *conf) /* {{{ */
 {
-	struct VSM_data *vd;
 	const c_varnish_stats_t *stats;
-	_Bool ok;
+	int status;
 
-	user_config_t *conf;
+	sfree (conf->counters);
+	conf->counters_num = 0;
 
-	if ((ud == NULL) || (ud->data == NULL))
-		return (EINVAL);
+#if HAVE_VARNISH_V3
+	stats = VSC_Main(conf->vd);
+#else /* if HAVE_VARNISH_V4 */
+	stats = VSC_Main(conf->vd, NULL);
+#endif
+	if (!stats)
+	{
+		ERROR ("varnish plugin: Unable to get statistics.");
+		return (-1);
+	}
 
-	conf = ud->data;
+#if HAVE_VARNISH_V3
+	status = VSC_Iter (conf->vd, varnish_monitor, conf);
+#else /* if HAVE_VARNISH_V4 */
+	status = VSC_Iter (conf->vd, NULL, varnish_monitor, conf);
+#endif
+	if (status != 0)
+	{
+		ERROR ("varnish plugin: Resolving the counters failed.");
+		sfree (conf->counters);
+		conf->counters_num = 0;
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int varnish_resolve_all */
+
+static int varnish_open (user_config_t *conf) /* {{{ */
+{
+	_Bool ok;
 
-	vd = VSM_New();
+	conf->vd = VSM_New();
+	if (conf->vd == NULL)
+	{
+		ERROR ("varnish plugin: VSM_New failed.");
+		return (-1);
+	}
 #if HAVE_VARNISH_V3
-	VSC_Setup(vd);
+	VSC_Setup(conf->vd);
 #endif
 
 	if (conf->instance != NULL)
 	{
 		int status;
 
-		status = VSM_n_Arg (vd, conf->instance);
+		status = VSM_n_Arg (conf->vd, conf->instance);
 		if (status < 0)
 		{
-			VSM_Delete (vd);
+			varnish_close (conf);
 			ERROR ("varnish plugin: VSM_n_Arg (\"%s\") failed "
 					"with status %i.",
 					conf->instance, status);
@@ -823,37 +929,83 @@ static int varnish_read (user_data_t *ud) /* {{{ */
 	}
 
 #if HAVE_VARNISH_V3
-	ok = (VSC_Open (vd, /* diag = */ 1) == 0);
+	ok = (VSC_Open (conf->vd, /* diag = */ 1) == 0);
 #else /* if HAVE_VARNISH_V4 */
-	ok = (VSM_Open (vd) == 0);
+	ok = (VSM_Open (conf->vd) == 0);
 #endif
 	if (!ok)
 	{
-		VSM_Delete (vd);
+		varnish_close (conf);
 		ERROR ("varnish plugin: Unable to open connection.");
 
 		return (-1);
 	}
 
-#if HAVE_VARNISH_V3
-	stats = VSC_Main(vd);
-#else /* if HAVE_VARNISH_V4 */
-	stats = VSC_Main(vd, NULL);
-#endif
-	if (!stats)
+	if (varnish_resolve_all (conf) != 0)
 	{
-		VSM_Delete (vd);
-		ERROR ("varnish plugin: Unable to get statistics.");
-
+		varnish_close (conf);
 		return (-1);
 	}
 
+	return (0);
+} /* }}} int varnish_open */
+
+/* Makes sure the mapping and the resolved counters are still current. When
+ * varnishd restarts, it creates a new segment and abandons the old one. */
+static int varnish_check (user_config_t *conf) /* {{{ */
+{
 #if HAVE_VARNISH_V3
-	VSC_Iter (vd, varnish_monitor, conf);
+	int status;
+
+	/* Returns zero if nothing changed, one if the segment has been
+	 * remapped and less than zero if that failed. */
+	status = VSM_ReOpen (conf->vd, /* diag = */ 0);
+	if (status == 0)
+		return (0);
+	else if (status > 0)
+	{
+		if (varnish_resolve_all (conf) == 0)
+			return (0);
+	}
 #else /* if HAVE_VARNISH_V4 */
-	VSC_Iter (vd, NULL, varnish_monitor, conf);
+	if (!VSM_Abandoned (conf->vd))
+		return (0);
 #endif
-	VSM_Delete (vd);
+
+	varnish_close (conf);
+	return (varnish_open (conf));
+} /* }}} int varnish_check */
+
+static int varnish_read (user_data_t *ud) /* {{{ */
+{
+	user_config_t *conf;
+	size_t i;
+
+	if ((ud == NULL) || (ud->data == NULL))
+		return (EINVAL);
+
+	conf = ud->data;
+
+	if (conf->vd == NULL)
+	{
+		if (varnish_open (conf) != 0)
+			return (-1);
+	}
+	else if (varnish_check (conf) != 0)
+		return (-1);
+
+	for (i = 0; i < conf->counters_num; i++)
+	{
+		varnish_counter_t *c = conf->counters + i;
+		uint64_t val = *c->ptr;
+
+		if (c->ds_type == DS_TYPE_GAUGE)
+			varnish_submit_gauge (conf->instance, c->category,
+					c->type, c->type_instance, val);
+		else
+			varnish_submit_derive (conf->instance, c->category,
+					c->type, c->type_instance, val);
+	}
 
 	return (0);
 } /* }}} */
@@ -890,6 +1042,10 @@ static void varnish_config_free (void *ptr) /* {{{ */
 	if (conf == NULL)
 		return;
 
+#if HAVE_VARNISH_V3 || HAVE_VARNISH_V4
+	varnish_close (conf);
+#endif
+
 	sfree (conf->instance);
 	sfree (conf);
 } /* }}} */
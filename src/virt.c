@@ -26,6 +26,8 @@
 #include "utils_ignorelist.h"
 #include "utils_complain.h"
 
+#include <pthread.h>
+
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include <libxml/parser.h>
@@ -50,18 +52,22 @@ static const char *config_keys[] = {
 
     "PluginInstanceFormat",
 
+    "Instances",
+
     NULL
 };
 #define NR_CONFIG_KEYS ((sizeof config_keys / sizeof config_keys[0]) - 1)
 
 /* Connection. */
-static virConnectPtr conn = 0;
 static char *conn_string = NULL;
-static c_complain_t conn_complain = C_COMPLAIN_INIT_STATIC;
 
 /* Seconds between list refreshes, 0 disables completely. */
 static int interval = 60;
 
+/* Number of read callbacks, each with its own connection. The domains are
+ * distributed between them by name. */
+static int nr_instances = 1;
+
 /* List of domains, if specified. */
 static ignorelist_t *il_domains = NULL;
 /* List of block devices, if specified. */
@@ -72,26 +78,13 @@ static ignorelist_t *il_interface_devices = NULL;
 static int ignore_device_match (ignorelist_t *,
                                 const char *domname, const char *devpath);
 
-/* Actual list of domains found on last refresh. */
-static virDomainPtr *domains = NULL;
-static int nr_domains = 0;
-
-static void free_domains (void);
-static int add_domain (virDomainPtr dom);
-
-/* Actual list of block devices found on last refresh. */
+/* Block device found on last refresh. */
 struct block_device {
     virDomainPtr dom;           /* domain */
     char *path;                 /* name of block device */
 };
 
-static struct block_device *block_devices = NULL;
-static int nr_block_devices = 0;
-
-static void free_block_devices (void);
-static int add_block_device (virDomainPtr dom, const char *path);
-
-/* Actual list of network interfaces found on last refresh. */
+/* Network interface found on last refresh. */
 struct interface_device {
     virDomainPtr dom;           /* domain */
     char *path;                 /* name of interface device */
@@ -99,11 +92,60 @@ struct interface_device {
     char *number;               /* interface device number */
 };
 
-static struct interface_device *interface_devices = NULL;
-static int nr_interface_devices = 0;
+/* A domain which has been started or stopped, reported by the event loop. */
+struct lv_event {
+    char *name;
+    _Bool running;
+    struct lv_event *next;
+};
+
+/* State of one read callback. */
+typedef struct lv_read_state_s {
+    int id;
+
+    virConnectPtr conn;
+    c_complain_t conn_complain;
+
+    /* Lifecycle event callback registered on "conn", or -1. */
+    int event_callback;
+
+    /* Events not applied to the lists yet, protected by "lock". */
+    pthread_mutex_t lock;
+    struct lv_event *events_head;
+    struct lv_event *events_tail;
+
+    /* Actual lists of domains and devices. */
+    virDomainPtr *domains;
+    int nr_domains;
+    struct block_device *block_devices;
+    int nr_block_devices;
+    struct interface_device *interface_devices;
+    int nr_interface_devices;
+
+    /* Time that we last refreshed. */
+    time_t last_refresh;
+
+    /* Cleared if the daemon doesn't support the bulk statistics API. */
+    _Bool use_bulk_stats;
+} lv_read_state_t;
+
+static lv_read_state_t *lv_states = NULL;
+
+/* Event loop dispatching the lifecycle events of all connections. */
+static _Bool event_loop_running = 0;
+static int event_loop_timer = -1;
+static pthread_t event_loop_thread;
+
+static void free_domains (lv_read_state_t *state);
+static int add_domain (lv_read_state_t *state, virDomainPtr dom);
+
+static void free_block_devices (lv_read_state_t *state);
+static int add_block_device (lv_read_state_t *state, virDomainPtr dom,
+        const char *path);
 
-static void free_interface_devices (void);
-static int add_interface_device (virDomainPtr dom, const char *path, const char *address, unsigned int number);
+static void free_interface_devices (lv_read_state_t *state);
+static int add_interface_device (lv_read_state_t *state, virDomainPtr dom,
+        const char *path, const char *address, unsigned int number);
 
 /* HostnameFormat. */
 #define HF_MAX_FIELDS 3
@@ -139,10 +181,7 @@ enum if_field {
 
 static enum if_field interface_format = if_name;
 
-/* Time that we last refreshed. */
-static time_t last_refresh = (time_t) 0;
-
-static int refresh_lists (void);
+static int refresh_lists (lv_read_state_t *state);
 
 /* ERROR(...) macro for virterrors. */
 #define VIRT_ERROR(conn,s) do {                 \
@@ -322,15 +361,6 @@ submit_derive2 (const char *type, derive_t v0, derive_t v1,
     plugin_dispatch_values (&vl);
 } /* void submit_derive2 */
 
-static int
-lv_init (void)
-{
-    if (virInitialize () != 0)
-        return -1;
-    else
-        return 0;
-}
-
 static int
 lv_config (const char *key, const char *value)
 {
@@ -362,6 +392,17 @@ lv_config (const char *key, const char *value)
         return 0;
     }
 
+    if (strcasecmp (key, "Instances") == 0) {
+        char *eptr = NULL;
+        long n = strtol (value, &eptr, 10);
+        if (eptr == NULL || *eptr != '\0' || n < 1 || n > 256) {
+            ERROR (PLUGIN_NAME " plugin: Instances must be between 1 and 256.");
+            return 1;
+        }
+        nr_instances = (int) n;
+        return 0;
+    }
+
     if (strcasecmp (key, "Domain") == 0) {
         if (ignorelist_add (il_domains, value)) return 1;
         return 0;
@@ -488,61 +529,609 @@ lv_config (const char *key, const char *value)
     return -1;
 }
 
+
+/* Returns the read callback responsible for the domain "name". */
 static int
-lv_read (void)
+lv_instance_of (const char *name)
+{
+    unsigned int hash = 0;
+
+    for (; *name != 0; name++)
+        hash = (hash * 31) + (unsigned char) *name;
+
+    return (int) (hash % (unsigned int) nr_instances);
+}
+
+/* Called from the event loop thread. Only queues the event, the lists are
+ * updated by the read callback. */
+static int
+lv_domain_event (virConnectPtr c __attribute__((unused)),
+        virDomainPtr dom, int event, int detail __attribute__((unused)),
+        void *opaque)
+{
+    lv_read_state_t *state = opaque;
+    struct lv_event *ev;
+    const char *name;
+
+    if ((event != VIR_DOMAIN_EVENT_STARTED)
+            && (event != VIR_DOMAIN_EVENT_STOPPED))
+        return 0;
+
+    name = virDomainGetName (dom);
+    if ((name == NULL) || (lv_instance_of (name) != state->id))
+        return 0;
+
+    ev = calloc (1, sizeof (*ev));
+    if (ev == NULL)
+        return 0;
+    ev->name = strdup (name);
+    if (ev->name == NULL) {
+        sfree (ev);
+        return 0;
+    }
+    ev->running = (event == VIR_DOMAIN_EVENT_STARTED);
+
+    pthread_mutex_lock (&state->lock);
+    if (state->events_tail == NULL)
+        state->events_head = ev;
+    else
+        state->events_tail->next = ev;
+    state->events_tail = ev;
+    pthread_mutex_unlock (&state->lock);
+
+    return 0;
+}
+
+static void
+lv_free_events (struct lv_event *ev)
+{
+    while (ev != NULL) {
+        struct lv_event *next = ev->next;
+        sfree (ev->name);
+        sfree (ev);
+        ev = next;
+    }
+}
+
+/* The timer makes virEventRunDefaultImpl() return regularly, so that the
+ * loop notices when it has to stop. */
+static void
+lv_event_loop_timer (int timer __attribute__((unused)),
+        void *opaque __attribute__((unused)))
+{
+}
+
+static void *
+lv_event_loop_worker (void *arg __attribute__((unused)))
+{
+    while (event_loop_running) {
+        if (virEventRunDefaultImpl () < 0) {
+            VIRT_ERROR (NULL, "virEventRunDefaultImpl");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+lv_read (user_data_t *ud);
+
+static int
+lv_init (void)
 {
-    time_t t;
     int i;
 
-    if (conn == NULL) {
-        /* `conn_string == NULL' is acceptable. */
-        conn = virConnectOpenReadOnly (conn_string);
-        if (conn == NULL) {
-            c_complain (LOG_ERR, &conn_complain,
-                    PLUGIN_NAME " plugin: Unable to connect: "
-                    "virConnectOpenReadOnly failed.");
-            return -1;
+    if (virInitialize () != 0)
+        return -1;
+
+    /* The event implementation must be registered before connections are
+     * opened. Without it, the lists are only refreshed periodically. */
+    if (virEventRegisterDefaultImpl () == 0) {
+        event_loop_timer = virEventAddTimeout (/* ms = */ 1000,
+                lv_event_loop_timer, NULL, NULL);
+        event_loop_running = 1;
+        if (plugin_thread_create (&event_loop_thread, /* attr = */ NULL,
+                    lv_event_loop_worker, /* arg = */ NULL) != 0) {
+            WARNING (PLUGIN_NAME " plugin: Starting the event loop failed.");
+            event_loop_running = 0;
         }
+    } else {
+        VIRT_ERROR (NULL, "virEventRegisterDefaultImpl");
+    }
+
+    lv_states = calloc ((size_t) nr_instances, sizeof (*lv_states));
+    if (lv_states == NULL) {
+        ERROR (PLUGIN_NAME " plugin: calloc failed.");
+        return -1;
+    }
+
+    for (i = 0; i < nr_instances; i++) {
+        lv_read_state_t *state = lv_states + i;
+        user_data_t ud = { 0 };
+        char cb_name[DATA_MAX_NAME_LEN];
+
+        state->id = i;
+        state->event_callback = -1;
+        state->use_bulk_stats = 1;
+        C_COMPLAIN_INIT (&state->conn_complain);
+        pthread_mutex_init (&state->lock, /* attr = */ NULL);
+
+        if (nr_instances == 1)
+            sstrncpy (cb_name, PLUGIN_NAME, sizeof (cb_name));
+        else
+            ssnprintf (cb_name, sizeof (cb_name), PLUGIN_NAME "-%i", i);
+
+        /* The states are freed by lv_shutdown. */
+        ud.data = state;
+        ud.free_func = NULL;
+
+        plugin_register_complex_read (/* group = */ NULL, cb_name, lv_read,
+                /* interval = */ 0, &ud);
     }
-    c_release (LOG_NOTICE, &conn_complain,
+
+    return 0;
+}
+
+static void
+lv_disconnect (lv_read_state_t *state)
+{
+    if (state->conn == NULL)
+        return;
+
+    if (state->event_callback >= 0)
+        virConnectDomainEventDeregisterAny (state->conn, state->event_callback);
+    state->event_callback = -1;
+
+    virConnectClose (state->conn);
+    state->conn = NULL;
+
+    /* The lists are refreshed completely after reconnecting. */
+    state->last_refresh = 0;
+}
+
+static int
+lv_connect (lv_read_state_t *state)
+{
+    if (state->conn != NULL)
+        return 0;
+
+    /* `conn_string == NULL' is acceptable. */
+    state->conn = virConnectOpenReadOnly (conn_string);
+    if (state->conn == NULL) {
+        c_complain (LOG_ERR, &state->conn_complain,
+                PLUGIN_NAME " plugin: Unable to connect: "
+                "virConnectOpenReadOnly failed.");
+        return -1;
+    }
+    c_release (LOG_NOTICE, &state->conn_complain,
             PLUGIN_NAME " plugin: Connection established.");
 
-    time (&t);
+    if (event_loop_running) {
+        state->event_callback = virConnectDomainEventRegisterAny (state->conn,
+                /* all domains */ NULL, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                VIR_DOMAIN_EVENT_CALLBACK (lv_domain_event), state,
+                /* free = */ NULL);
+        if (state->event_callback < 0)
+            VIRT_ERROR (state->conn, "virConnectDomainEventRegisterAny");
+    }
 
-    /* Need to refresh domain or device lists? */
-    if ((last_refresh == (time_t) 0) ||
-            ((interval > 0) && ((last_refresh + interval) <= t))) {
-        if (refresh_lists () != 0) {
-            if (conn != NULL)
-                virConnectClose (conn);
-            conn = NULL;
-            return -1;
+    return 0;
+}
+
+/* Returns the index of the domain "name" in the list, or -1. */
+static int
+lv_find_domain (lv_read_state_t *state, const char *name)
+{
+    int i;
+
+    for (i = 0; i < state->nr_domains; ++i) {
+        const char *n = virDomainGetName (state->domains[i]);
+        if ((n != NULL) && (strcmp (n, name) == 0))
+            return i;
+    }
+
+    return -1;
+}
+
+/* Removes a domain and its devices from the lists. */
+static void
+lv_remove_domain (lv_read_state_t *state, int index)
+{
+    virDomainPtr dom = state->domains[index];
+    int i, j;
+
+    for (i = 0, j = 0; i < state->nr_block_devices; ++i) {
+        if (state->block_devices[i].dom == dom) {
+            sfree (state->block_devices[i].path);
+            continue;
         }
-        last_refresh = t;
+        state->block_devices[j++] = state->block_devices[i];
     }
+    state->nr_block_devices = j;
 
-#if 0
-    for (i = 0; i < nr_domains; ++i)
-        fprintf (stderr, "domain %s\n", virDomainGetName (domains[i]));
-    for (i = 0; i < nr_block_devices; ++i)
-        fprintf  (stderr, "block device %d %s:%s\n",
-                  i, virDomainGetName (block_devices[i].dom),
-                  block_devices[i].path);
-    for (i = 0; i < nr_interface_devices; ++i)
-        fprintf (stderr, "interface device %d %s:%s\n",
-                 i, virDomainGetName (interface_devices[i].dom),
-                 interface_devices[i].path);
-#endif
+    for (i = 0, j = 0; i < state->nr_interface_devices; ++i) {
+        if (state->interface_devices[i].dom == dom) {
+            sfree (state->interface_devices[i].path);
+            sfree (state->interface_devices[i].address);
+            sfree (state->interface_devices[i].number);
+            continue;
+        }
+        state->interface_devices[j++] = state->interface_devices[i];
+    }
+    state->nr_interface_devices = j;
+
+    virDomainFree (dom);
+    memmove (state->domains + index, state->domains + index + 1,
+            sizeof (*state->domains) * (state->nr_domains - index - 1));
+    state->nr_domains--;
+}
+
+/* Adds "dom" and its devices to the lists unless it is ignored. Takes
+ * ownership of "dom". */
+static int
+lv_add_domain (lv_read_state_t *state, virDomainPtr dom)
+{
+    const char *name;
+    char *xml = NULL;
+    xmlDocPtr xml_doc = NULL;
+    xmlXPathContextPtr xpath_ctx = NULL;
+    xmlXPathObjectPtr xpath_obj = NULL;
+    int j;
+
+    name = virDomainGetName (dom);
+    if (name == NULL) {
+        VIRT_ERROR (state->conn, "virDomainGetName");
+        virDomainFree (dom);
+        return -1;
+    }
+
+    if ((lv_instance_of (name) != state->id)
+            || (il_domains && ignorelist_match (il_domains, name) != 0)) {
+        virDomainFree (dom);
+        return 0;
+    }
+
+    if (add_domain (state, dom) < 0) {
+        ERROR (PLUGIN_NAME " plugin: malloc failed.");
+        virDomainFree (dom);
+        return -1;
+    }
+
+    /* Get a list of devices for this domain. */
+    xml = virDomainGetXMLDesc (dom, 0);
+    if (!xml) {
+        VIRT_ERROR (state->conn, "virDomainGetXMLDesc");
+        goto cont;
+    }
+
+    /* Yuck, XML.  Parse out the devices. */
+    xml_doc = xmlReadDoc ((xmlChar *) xml, NULL, NULL, XML_PARSE_NONET);
+    if (xml_doc == NULL) {
+        VIRT_ERROR (state->conn, "xmlReadDoc");
+        goto cont;
+    }
+
+    xpath_ctx = xmlXPathNewContext (xml_doc);
+
+    /* Block devices. */
+    xpath_obj = xmlXPathEval
+        ((xmlChar *) "/domain/devices/disk/target[@dev]",
+         xpath_ctx);
+    if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
+        xpath_obj->nodesetval == NULL)
+        goto cont;
+
+    for (j = 0; j < xpath_obj->nodesetval->nodeNr; ++j) {
+        xmlNodePtr node;
+        char *path = NULL;
+
+        node = xpath_obj->nodesetval->nodeTab[j];
+        if (!node) continue;
+        path = (char *) xmlGetProp (node, (xmlChar *) "dev");
+        if (!path) continue;
+
+        if (il_block_devices &&
+            ignore_device_match (il_block_devices, name, path) != 0)
+            goto cont2;
+
+        add_block_device (state, dom, path);
+    cont2:
+        if (path) xmlFree (path);
+    }
+    xmlXPathFreeObject (xpath_obj);
+
+    /* Network interfaces. */
+    xpath_obj = xmlXPathEval
+        ((xmlChar *) "/domain/devices/interface[target[@dev]]",
+         xpath_ctx);
+    if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
+        xpath_obj->nodesetval == NULL)
+        goto cont;
+
+    xmlNodeSetPtr xml_interfaces = xpath_obj->nodesetval;
+
+    for (j = 0; j < xml_interfaces->nodeNr; ++j) {
+        char *path = NULL;
+        char *address = NULL;
+        xmlNodePtr xml_interface;
+
+        xml_interface = xml_interfaces->nodeTab[j];
+        if (!xml_interface) continue;
+        xmlNodePtr child = NULL;
+
+        for (child = xml_interface->children; child; child = child->next) {
+            if (child->type != XML_ELEMENT_NODE) continue;
+
+            if (xmlStrEqual(child->name, (const xmlChar *) "target")) {
+                path = (char *) xmlGetProp (child, (const xmlChar *) "dev");
+                if (!path) continue;
+            } else if (xmlStrEqual(child->name, (const xmlChar *) "mac")) {
+                address = (char *) xmlGetProp (child, (const xmlChar *) "address");
+                if (!address) continue;
+            }
+        }
+
+        if (il_interface_devices &&
+            (ignore_device_match (il_interface_devices, name, path) != 0 ||
+             ignore_device_match (il_interface_devices, name, address) != 0))
+            goto cont3;
+
+        add_interface_device (state, dom, path, address, j+1);
+        cont3:
+            if (path) xmlFree (path);
+            if (address) xmlFree (address);
+    }
+
+cont:
+    if (xpath_obj) xmlXPathFreeObject (xpath_obj);
+    if (xpath_ctx) xmlXPathFreeContext (xpath_ctx);
+    if (xml_doc) xmlFreeDoc (xml_doc);
+    sfree (xml);
+
+    return 0;
+}
+
+/* Applies the queued lifecycle events, so that started and stopped domains
+ * don't require enumerating all domains again. */
+static void
+lv_apply_events (lv_read_state_t *state)
+{
+    struct lv_event *events;
+    struct lv_event *ev;
+
+    pthread_mutex_lock (&state->lock);
+    events = state->events_head;
+    state->events_head = state->events_tail = NULL;
+    pthread_mutex_unlock (&state->lock);
+
+    for (ev = events; ev != NULL; ev = ev->next) {
+        int index = lv_find_domain (state, ev->name);
+
+        if (index >= 0)
+            lv_remove_domain (state, index);
+
+        if (ev->running) {
+            virDomainPtr dom = virDomainLookupByName (state->conn, ev->name);
+            if (dom == NULL) {
+                /* Could be that the domain went away again. */
+                continue;
+            }
+            lv_add_domain (state, dom);
+        }
+    }
+
+    lv_free_events (events);
+}
+
+#if HAVE_LIBVIRT_ALL_DOMAIN_STATS
+/* Returns the display name of an interface found in the domain "name", or
+ * NULL if the interface is not collected. */
+static const char *
+lv_interface_name (lv_read_state_t *state, const char *name,
+        const char *path)
+{
+    int i;
+
+    for (i = 0; i < state->nr_interface_devices; ++i) {
+        struct interface_device *dev = state->interface_devices + i;
+        const char *n;
+
+        /* Device paths are mostly unique on a host, compare them first. */
+        if (strcmp (dev->path, path) != 0)
+            continue;
+        n = virDomainGetName (dev->dom);
+        if ((n == NULL) || (strcmp (n, name) != 0))
+            continue;
+
+        switch (interface_format) {
+            case if_address:
+                return dev->address;
+            case if_number:
+                return dev->number;
+            case if_name:
+            default:
+                return dev->path;
+        }
+    }
+
+    return NULL;
+}
+
+static _Bool
+lv_get_ullong (virDomainStatsRecordPtr rec, const char *prefix,
+        unsigned int index, const char *field, unsigned long long *value)
+{
+    char param[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    ssnprintf (param, sizeof (param), "%s.%u.%s", prefix, index, field);
+    return virTypedParamsGetULLong (rec->params, rec->nparams,
+            param, value) == 1;
+}
+
+static void
+lv_submit_record (lv_read_state_t *state, virDomainStatsRecordPtr rec)
+{
+    static const char *memory_params[] = { "balloon.swap_in",
+        "balloon.swap_out", "balloon.major_fault", "balloon.minor_fault",
+        "balloon.unused", "balloon.available", "balloon.current",
+        "balloon.rss" };
+
+    virDomainPtr dom = rec->dom;
+    const char *name;
+    unsigned long long v0, v1;
+    unsigned int count;
+    unsigned int i;
+    int dom_state;
+
+    name = virDomainGetName (dom);
+    if (name == NULL)
+        return;
+
+    /* only gather stats for running domains */
+    if ((virTypedParamsGetInt (rec->params, rec->nparams,
+                    "state.state", &dom_state) == 1)
+            && (dom_state != VIR_DOMAIN_RUNNING))
+        return;
+
+    if (virTypedParamsGetULLong (rec->params, rec->nparams,
+                "cpu.time", &v0) == 1)
+        cpu_submit (v0, dom, "virt_cpu_total");
+
+    if (virTypedParamsGetULLong (rec->params, rec->nparams,
+                "balloon.current", &v0) == 1)
+        memory_submit ((gauge_t) v0 * 1024, dom);
+
+    for (i = 0; i < STATIC_ARRAY_SIZE (memory_params); i++)
+        if (virTypedParamsGetULLong (rec->params, rec->nparams,
+                    memory_params[i], &v0) == 1)
+            memory_stats_submit ((gauge_t) v0 * 1024, dom, (int) i);
+
+    count = 0;
+    virTypedParamsGetUInt (rec->params, rec->nparams, "vcpu.current", &count);
+    for (i = 0; i < count; i++)
+        if (lv_get_ullong (rec, "vcpu", i, "time", &v0))
+            vcpu_submit ((derive_t) v0, dom, (int) i, "virt_vcpu");
+
+    count = 0;
+    virTypedParamsGetUInt (rec->params, rec->nparams, "block.count", &count);
+    for (i = 0; i < count; i++) {
+        char param[VIR_TYPED_PARAM_FIELD_LENGTH];
+        const char *path = NULL;
+
+        ssnprintf (param, sizeof (param), "block.%u.name", i);
+        if ((virTypedParamsGetString (rec->params, rec->nparams,
+                        param, &path) != 1) || (path == NULL))
+            continue;
+
+        if (il_block_devices &&
+            ignore_device_match (il_block_devices, name, path) != 0)
+            continue;
+
+        if (lv_get_ullong (rec, "block", i, "rd.reqs", &v0)
+                && lv_get_ullong (rec, "block", i, "wr.reqs", &v1))
+            submit_derive2 ("disk_ops", (derive_t) v0, (derive_t) v1,
+                    dom, path);
+
+        if (lv_get_ullong (rec, "block", i, "rd.bytes", &v0)
+                && lv_get_ullong (rec, "block", i, "wr.bytes", &v1))
+            submit_derive2 ("disk_octets", (derive_t) v0, (derive_t) v1,
+                    dom, path);
+    }
+
+    count = 0;
+    virTypedParamsGetUInt (rec->params, rec->nparams, "net.count", &count);
+    for (i = 0; i < count; i++) {
+        char param[VIR_TYPED_PARAM_FIELD_LENGTH];
+        const char *path = NULL;
+        const char *display_name;
+
+        ssnprintf (param, sizeof (param), "net.%u.name", i);
+        if ((virTypedParamsGetString (rec->params, rec->nparams,
+                        param, &path) != 1) || (path == NULL))
+            continue;
+
+        /* The interfaces are filtered when the lists are refreshed. */
+        display_name = lv_interface_name (state, name, path);
+        if (display_name == NULL)
+            continue;
+
+        if (lv_get_ullong (rec, "net", i, "rx.bytes", &v0)
+                && lv_get_ullong (rec, "net", i, "tx.bytes", &v1))
+            submit_derive2 ("if_octets", (derive_t) v0, (derive_t) v1,
+                    dom, display_name);
+
+        if (lv_get_ullong (rec, "net", i, "rx.pkts", &v0)
+                && lv_get_ullong (rec, "net", i, "tx.pkts", &v1))
+            submit_derive2 ("if_packets", (derive_t) v0, (derive_t) v1,
+                    dom, display_name);
+
+        if (lv_get_ullong (rec, "net", i, "rx.errs", &v0)
+                && lv_get_ullong (rec, "net", i, "tx.errs", &v1))
+            submit_derive2 ("if_errors", (derive_t) v0, (derive_t) v1,
+                    dom, display_name);
+
+        if (lv_get_ullong (rec, "net", i, "rx.drop", &v0)
+                && lv_get_ullong (rec, "net", i, "tx.drop", &v1))
+            submit_derive2 ("if_dropped", (derive_t) v0, (derive_t) v1,
+                    dom, display_name);
+    }
+}
+
+/* Gets the statistics of all domains of this read callback with a single
+ * call to the daemon. */
+static int
+lv_read_bulk (lv_read_state_t *state)
+{
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainPtr *doms;
+    unsigned int stats = VIR_DOMAIN_STATS_STATE | VIR_DOMAIN_STATS_CPU_TOTAL
+        | VIR_DOMAIN_STATS_BALLOON | VIR_DOMAIN_STATS_VCPU
+        | VIR_DOMAIN_STATS_INTERFACE | VIR_DOMAIN_STATS_BLOCK;
+    int n, i;
+
+    if (state->nr_domains == 0)
+        return 0;
+
+    /* virDomainListGetStats expects a NULL terminated list. */
+    doms = calloc ((size_t) state->nr_domains + 1, sizeof (*doms));
+    if (doms == NULL) {
+        ERROR (PLUGIN_NAME " plugin: calloc failed.");
+        return -1;
+    }
+    memcpy (doms, state->domains, sizeof (*doms) * state->nr_domains);
+
+    n = virDomainListGetStats (doms, stats, &records, 0);
+    sfree (doms);
+    if (n < 0) {
+        VIRT_ERROR (state->conn, "virDomainListGetStats");
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i)
+        lv_submit_record (state, records[i]);
+
+    virDomainStatsRecordListFree (records);
+    return 0;
+}
+#endif /* HAVE_LIBVIRT_ALL_DOMAIN_STATS */
+
+/* Gets the statistics with one call per domain and device. */
+static int
+lv_read_single (lv_read_state_t *state)
+{
+    int i;
 
     /* Get CPU usage, memory, VCPU usage for each domain. */
-    for (i = 0; i < nr_domains; ++i) {
+    for (i = 0; i < state->nr_domains; ++i) {
+        virDomainPtr dom = state->domains[i];
         virDomainInfo info;
         virVcpuInfoPtr vinfo = NULL;
         virDomainMemoryStatPtr minfo = NULL;
         int status;
         int j;
 
-        status = virDomainGetInfo (domains[i], &info);
+        status = virDomainGetInfo (dom, &info);
         if (status != 0)
         {
             ERROR (PLUGIN_NAME " plugin: virDomainGetInfo failed with status %i.",
@@ -556,8 +1145,8 @@ lv_read (void)
             continue;
         }
 
-        cpu_submit (info.cpuTime, domains[i], "virt_cpu_total");
-        memory_submit ((gauge_t) info.memory * 1024, domains[i]);
+        cpu_submit (info.cpuTime, dom, "virt_cpu_total");
+        memory_submit ((gauge_t) info.memory * 1024, dom);
 
         vinfo = malloc (info.nrVirtCpu * sizeof (vinfo[0]));
         if (vinfo == NULL) {
@@ -565,7 +1154,7 @@ lv_read (void)
             continue;
         }
 
-        status = virDomainGetVcpus (domains[i], vinfo, info.nrVirtCpu,
+        status = virDomainGetVcpus (dom, vinfo, info.nrVirtCpu,
                 /* cpu map = */ NULL, /* cpu map length = */ 0);
         if (status < 0)
         {
@@ -577,7 +1166,7 @@ lv_read (void)
 
         for (j = 0; j < info.nrVirtCpu; ++j)
             vcpu_submit (vinfo[j].cpuTime,
-                    domains[i], vinfo[j].number, "virt_vcpu");
+                    dom, vinfo[j].number, "virt_vcpu");
 
         sfree (vinfo);
 
@@ -587,7 +1176,7 @@ lv_read (void)
             continue;
         }
 
-        status =  virDomainMemoryStats (domains[i], minfo, VIR_DOMAIN_MEMORY_STAT_NR, 0);
+        status =  virDomainMemoryStats (dom, minfo, VIR_DOMAIN_MEMORY_STAT_NR, 0);
 
         if (status < 0) {
             ERROR ("virt plugin: virDomainMemoryStats failed with status %i.",
@@ -597,7 +1186,7 @@ lv_read (void)
         }
 
         for (j = 0; j < status; j++) {
-            memory_stats_submit ((gauge_t) minfo[j].val * 1024, domains[i], minfo[j].tag);
+            memory_stats_submit ((gauge_t) minfo[j].val * 1024, dom, minfo[j].tag);
         }
 
         sfree (minfo);
@@ -605,293 +1194,258 @@ lv_read (void)
 
 
     /* Get block device stats for each domain. */
-    for (i = 0; i < nr_block_devices; ++i) {
+    for (i = 0; i < state->nr_block_devices; ++i) {
+        struct block_device *dev = state->block_devices + i;
         struct _virDomainBlockStats stats;
 
-        if (virDomainBlockStats (block_devices[i].dom, block_devices[i].path,
+        if (virDomainBlockStats (dev->dom, dev->path,
                     &stats, sizeof stats) != 0)
             continue;
 
         if ((stats.rd_req != -1) && (stats.wr_req != -1))
             submit_derive2 ("disk_ops",
                     (derive_t) stats.rd_req, (derive_t) stats.wr_req,
-                    block_devices[i].dom, block_devices[i].path);
+                    dev->dom, dev->path);
 
         if ((stats.rd_bytes != -1) && (stats.wr_bytes != -1))
             submit_derive2 ("disk_octets",
                     (derive_t) stats.rd_bytes, (derive_t) stats.wr_bytes,
-                    block_devices[i].dom, block_devices[i].path);
+                    dev->dom, dev->path);
     } /* for (nr_block_devices) */
 
     /* Get interface stats for each domain. */
-    for (i = 0; i < nr_interface_devices; ++i) {
+    for (i = 0; i < state->nr_interface_devices; ++i) {
+        struct interface_device *dev = state->interface_devices + i;
         struct _virDomainInterfaceStats stats;
         char *display_name = NULL;
 
 
         switch (interface_format) {
             case if_address:
-                display_name = interface_devices[i].address;
+                display_name = dev->address;
                 break;
             case if_number:
-                display_name = interface_devices[i].number;
+                display_name = dev->number;
                 break;
             case if_name:
             default:
-                display_name = interface_devices[i].path;
+                display_name = dev->path;
         }
 
-        if (virDomainInterfaceStats (interface_devices[i].dom,
-                    interface_devices[i].path,
+        if (virDomainInterfaceStats (dev->dom, dev->path,
                     &stats, sizeof stats) != 0)
             continue;
 
 	if ((stats.rx_bytes != -1) && (stats.tx_bytes != -1))
 	    submit_derive2 ("if_octets",
 		    (derive_t) stats.rx_bytes, (derive_t) stats.tx_bytes,
-		    interface_devices[i].dom, display_name);
+		    dev->dom, display_name);
 
 	if ((stats.rx_packets != -1) && (stats.tx_packets != -1))
 	    submit_derive2 ("if_packets",
 		    (derive_t) stats.rx_packets, (derive_t) stats.tx_packets,
-		    interface_devices[i].dom, display_name);
+		    dev->dom, display_name);
 
 	if ((stats.rx_errs != -1) && (stats.tx_errs != -1))
 	    submit_derive2 ("if_errors",
 		    (derive_t) stats.rx_errs, (derive_t) stats.tx_errs,
-		    interface_devices[i].dom, display_name);
+		    dev->dom, display_name);
 
 	if ((stats.rx_drop != -1) && (stats.tx_drop != -1))
 	    submit_derive2 ("if_dropped",
 		    (derive_t) stats.rx_drop, (derive_t) stats.tx_drop,
-		    interface_devices[i].dom, display_name);
+		    dev->dom, display_name);
     } /* for (nr_interface_devices) */
 
     return 0;
 }
 
 static int
-refresh_lists (void)
+lv_read (user_data_t *ud)
 {
-    int n;
+    lv_read_state_t *state = ud->data;
+    time_t t;
 
-    n = virConnectNumOfDomains (conn);
-    if (n < 0) {
-        VIRT_ERROR (conn, "reading number of domains");
+    if (lv_connect (state) != 0)
         return -1;
-    }
-
-    if (n > 0) {
-        int i;
-        int *domids;
 
-        /* Get list of domains. */
-        domids = malloc (sizeof (*domids) * n);
-        if (domids == NULL) {
-            ERROR (PLUGIN_NAME " plugin: malloc failed.");
-            return -1;
-        }
+    time (&t);
 
-        n = virConnectListDomains (conn, domids, n);
-        if (n < 0) {
-            VIRT_ERROR (conn, "reading list of domains");
-            sfree (domids);
+    /* Need to refresh domain or device lists? */
+    if ((state->last_refresh == (time_t) 0) ||
+            ((interval > 0) && ((state->last_refresh + interval) <= t))) {
+        /* Events queued until now are covered by the refresh. */
+        pthread_mutex_lock (&state->lock);
+        lv_free_events (state->events_head);
+        state->events_head = state->events_tail = NULL;
+        pthread_mutex_unlock (&state->lock);
+
+        if (refresh_lists (state) != 0) {
+            lv_disconnect (state);
             return -1;
         }
+        state->last_refresh = t;
+    } else {
+        lv_apply_events (state);
+    }
 
-        free_block_devices ();
-        free_interface_devices ();
-        free_domains ();
+#if HAVE_LIBVIRT_ALL_DOMAIN_STATS
+    if (state->use_bulk_stats) {
+        if (lv_read_bulk (state) == 0)
+            return 0;
 
-        /* Fetch each domain and add it to the list, unless ignore. */
-        for (i = 0; i < n; ++i) {
-            virDomainPtr dom = NULL;
-            const char *name;
-            char *xml = NULL;
-            xmlDocPtr xml_doc = NULL;
-            xmlXPathContextPtr xpath_ctx = NULL;
-            xmlXPathObjectPtr xpath_obj = NULL;
-            int j;
-
-            dom = virDomainLookupByID (conn, domids[i]);
-            if (dom == NULL) {
-                VIRT_ERROR (conn, "virDomainLookupByID");
-                /* Could be that the domain went away -- ignore it anyway. */
-                continue;
-            }
+        NOTICE (PLUGIN_NAME " plugin: Getting the statistics of all domains "
+                "at once failed, getting them one by one from now on.");
+        state->use_bulk_stats = 0;
+    }
+#endif
 
-            name = virDomainGetName (dom);
-            if (name == NULL) {
-                VIRT_ERROR (conn, "virDomainGetName");
-                goto cont;
-            }
+    return lv_read_single (state);
+}
 
-            if (il_domains && ignorelist_match (il_domains, name) != 0)
-                goto cont;
+/* Returns the running domains in "*ret". The caller frees the array and the
+ * domains. */
+static int
+lv_list_domains (virConnectPtr conn, virDomainPtr **ret)
+{
+#if HAVE_LIBVIRT_ALL_DOMAIN_STATS
+    int n;
 
-            if (add_domain (dom) < 0) {
-                ERROR (PLUGIN_NAME " plugin: malloc failed.");
-                goto cont;
-            }
+    n = virConnectListAllDomains (conn, ret, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+    if (n < 0)
+        VIRT_ERROR (conn, "reading list of domains");
+    return n;
+#else
+    virDomainPtr *doms;
+    int *domids;
+    int n, i, j;
 
-            /* Get a list of devices for this domain. */
-            xml = virDomainGetXMLDesc (dom, 0);
-            if (!xml) {
-                VIRT_ERROR (conn, "virDomainGetXMLDesc");
-                goto cont;
-            }
+    *ret = NULL;
 
-            /* Yuck, XML.  Parse out the devices. */
-            xml_doc = xmlReadDoc ((xmlChar *) xml, NULL, NULL, XML_PARSE_NONET);
-            if (xml_doc == NULL) {
-                VIRT_ERROR (conn, "xmlReadDoc");
-                goto cont;
-            }
+    n = virConnectNumOfDomains (conn);
+    if (n < 0) {
+        VIRT_ERROR (conn, "reading number of domains");
+        return -1;
+    }
+    if (n == 0)
+        return 0;
 
-            xpath_ctx = xmlXPathNewContext (xml_doc);
+    /* Get list of domains. */
+    domids = malloc (sizeof (*domids) * n);
+    doms = calloc ((size_t) n, sizeof (*doms));
+    if ((domids == NULL) || (doms == NULL)) {
+        ERROR (PLUGIN_NAME " plugin: malloc failed.");
+        sfree (domids);
+        sfree (doms);
+        return -1;
+    }
 
-            /* Block devices. */
-            xpath_obj = xmlXPathEval
-                ((xmlChar *) "/domain/devices/disk/target[@dev]",
-                 xpath_ctx);
-            if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
-                xpath_obj->nodesetval == NULL)
-                goto cont;
+    n = virConnectListDomains (conn, domids, n);
+    if (n < 0) {
+        VIRT_ERROR (conn, "reading list of domains");
+        sfree (domids);
+        sfree (doms);
+        return -1;
+    }
 
-            for (j = 0; j < xpath_obj->nodesetval->nodeNr; ++j) {
-                xmlNodePtr node;
-                char *path = NULL;
+    for (i = 0, j = 0; i < n; ++i) {
+        doms[j] = virDomainLookupByID (conn, domids[i]);
+        if (doms[j] == NULL) {
+            VIRT_ERROR (conn, "virDomainLookupByID");
+            /* Could be that the domain went away -- ignore it anyway. */
+            continue;
+        }
+        j++;
+    }
 
-                node = xpath_obj->nodesetval->nodeTab[j];
-                if (!node) continue;
-                path = (char *) xmlGetProp (node, (xmlChar *) "dev");
-                if (!path) continue;
+    sfree (domids);
+    *ret = doms;
+    return j;
+#endif
+}
 
-                if (il_block_devices &&
-                    ignore_device_match (il_block_devices, name, path) != 0)
-                    goto cont2;
+static int
+refresh_lists (lv_read_state_t *state)
+{
+    virDomainPtr *doms = NULL;
+    int n, i;
 
-                add_block_device (dom, path);
-            cont2:
-                if (path) xmlFree (path);
-            }
-            xmlXPathFreeObject (xpath_obj);
-
-            /* Network interfaces. */
-            xpath_obj = xmlXPathEval
-                ((xmlChar *) "/domain/devices/interface[target[@dev]]",
-                 xpath_ctx);
-            if (xpath_obj == NULL || xpath_obj->type != XPATH_NODESET ||
-                xpath_obj->nodesetval == NULL)
-                goto cont;
-
-            xmlNodeSetPtr xml_interfaces = xpath_obj->nodesetval;
-
-            for (j = 0; j < xml_interfaces->nodeNr; ++j) {
-                char *path = NULL;
-                char *address = NULL;
-                xmlNodePtr xml_interface;
-
-                xml_interface = xml_interfaces->nodeTab[j];
-                if (!xml_interface) continue;
-                xmlNodePtr child = NULL;
-
-                for (child = xml_interface->children; child; child = child->next) {
-                    if (child->type != XML_ELEMENT_NODE) continue;
-
-                    if (xmlStrEqual(child->name, (const xmlChar *) "target")) {
-                        path = (char *) xmlGetProp (child, (const xmlChar *) "dev");
-                        if (!path) continue;
-                    } else if (xmlStrEqual(child->name, (const xmlChar *) "mac")) {
-                        address = (char *) xmlGetProp (child, (const xmlChar *) "address");
-                        if (!address) continue;
-                    }
-                }
-
-                if (il_interface_devices &&
-                    (ignore_device_match (il_interface_devices, name, path) != 0 ||
-                     ignore_device_match (il_interface_devices, name, address) != 0))
-                    goto cont3;
-
-                add_interface_device (dom, path, address, j+1);
-                cont3:
-                    if (path) xmlFree (path);
-                    if (address) xmlFree (address);
-            }
+    n = lv_list_domains (state->conn, &doms);
+    if (n < 0)
+        return -1;
 
-        cont:
-            if (xpath_obj) xmlXPathFreeObject (xpath_obj);
-            if (xpath_ctx) xmlXPathFreeContext (xpath_ctx);
-            if (xml_doc) xmlFreeDoc (xml_doc);
-            sfree (xml);
-        }
+    free_block_devices (state);
+    free_interface_devices (state);
+    free_domains (state);
 
-        sfree (domids);
-    }
+    /* Add each domain to the list, unless ignored. */
+    for (i = 0; i < n; ++i)
+        lv_add_domain (state, doms[i]);
 
+    sfree (doms);
     return 0;
 }
 
 static void
-free_domains (void)
+free_domains (lv_read_state_t *state)
 {
     int i;
 
-    if (domains) {
-        for (i = 0; i < nr_domains; ++i)
-            virDomainFree (domains[i]);
-        sfree (domains);
+    if (state->domains) {
+        for (i = 0; i < state->nr_domains; ++i)
+            virDomainFree (state->domains[i]);
+        sfree (state->domains);
     }
-    domains = NULL;
-    nr_domains = 0;
+    state->domains = NULL;
+    state->nr_domains = 0;
 }
 
 static int
-add_domain (virDomainPtr dom)
+add_domain (lv_read_state_t *state, virDomainPtr dom)
 {
     virDomainPtr *new_ptr;
-    int new_size = sizeof (domains[0]) * (nr_domains+1);
+    int new_size = sizeof (state->domains[0]) * (state->nr_domains+1);
 
-    if (domains)
-        new_ptr = realloc (domains, new_size);
+    if (state->domains)
+        new_ptr = realloc (state->domains, new_size);
     else
         new_ptr = malloc (new_size);
 
     if (new_ptr == NULL)
         return -1;
 
-    domains = new_ptr;
-    domains[nr_domains] = dom;
-    return nr_domains++;
+    state->domains = new_ptr;
+    state->domains[state->nr_domains] = dom;
+    return state->nr_domains++;
 }
 
 static void
-free_block_devices (void)
+free_block_devices (lv_read_state_t *state)
 {
     int i;
 
-    if (block_devices) {
-        for (i = 0; i < nr_block_devices; ++i)
-            sfree (block_devices[i].path);
-        sfree (block_devices);
+    if (state->block_devices) {
+        for (i = 0; i < state->nr_block_devices; ++i)
+            sfree (state->block_devices[i].path);
+        sfree (state->block_devices);
     }
-    block_devices = NULL;
-    nr_block_devices = 0;
+    state->block_devices = NULL;
+    state->nr_block_devices = 0;
 }
 
 static int
-add_block_device (virDomainPtr dom, const char *path)
+add_block_device (lv_read_state_t *state, virDomainPtr dom, const char *path)
 {
     struct block_device *new_ptr;
-    int new_size = sizeof (block_devices[0]) * (nr_block_devices+1);
+    int new_size = sizeof (state->block_devices[0]) * (state->nr_block_devices+1);
     char *path_copy;
 
     path_copy = strdup (path);
     if (!path_copy)
         return -1;
 
-    if (block_devices)
-        new_ptr = realloc (block_devices, new_size);
+    if (state->block_devices)
+        new_ptr = realloc (state->block_devices, new_size);
     else
         new_ptr = malloc (new_size);
 
@@ -899,34 +1453,35 @@ add_block_device (virDomainPtr dom, const char *path)
         sfree (path_copy);
         return -1;
     }
-    block_devices = new_ptr;
-    block_devices[nr_block_devices].dom = dom;
-    block_devices[nr_block_devices].path = path_copy;
-    return nr_block_devices++;
+    state->block_devices = new_ptr;
+    state->block_devices[state->nr_block_devices].dom = dom;
+    state->block_devices[state->nr_block_devices].path = path_copy;
+    return state->nr_block_devices++;
 }
 
 static void
-free_interface_devices (void)
+free_interface_devices (lv_read_state_t *state)
 {
     int i;
 
-    if (interface_devices) {
-        for (i = 0; i < nr_interface_devices; ++i) {
-            sfree (interface_devices[i].path);
-            sfree (interface_devices[i].address);
-            sfree (interface_devices[i].number);
+    if (state->interface_devices) {
+        for (i = 0; i < state->nr_interface_devices; ++i) {
+            sfree (state->interface_devices[i].path);
+            sfree (state->interface_devices[i].address);
+            sfree (state->interface_devices[i].number);
         }
-        sfree (interface_devices);
+        sfree (state->interface_devices);
     }
-    interface_devices = NULL;
-    nr_interface_devices = 0;
+    state->interface_devices = NULL;
+    state->nr_interface_devices = 0;
 }
 
 static int
-add_interface_device (virDomainPtr dom, const char *path, const char *address, unsigned int number)
+add_interface_device (lv_read_state_t *state, virDomainPtr dom,
+        const char *path, const char *address, unsigned int number)
 {
     struct interface_device *new_ptr;
-    int new_size = sizeof (interface_devices[0]) * (nr_interface_devices+1);
+    int new_size = sizeof (state->interface_devices[0]) * (state->nr_interface_devices+1);
     char *path_copy, *address_copy, number_string[15];
 
     if ((path == NULL) || (address == NULL))
@@ -943,8 +1498,8 @@ add_interface_device (virDomainPtr dom, const char *path, const char *address, u
 
     snprintf(number_string, sizeof (number_string), "interface-%u", number);
 
-    if (interface_devices)
-        new_ptr = realloc (interface_devices, new_size);
+    if (state->interface_devices)
+        new_ptr = realloc (state->interface_devices, new_size);
     else
         new_ptr = malloc (new_size);
 
@@ -953,12 +1508,12 @@ add_interface_device (virDomainPtr dom, const char *path, const char *address, u
         sfree (address_copy);
         return -1;
     }
-    interface_devices = new_ptr;
-    interface_devices[nr_interface_devices].dom = dom;
-    interface_devices[nr_interface_devices].path = path_copy;
-    interface_devices[nr_interface_devices].address = address_copy;
-    interface_devices[nr_interface_devices].number = strdup(number_string);
-    return nr_interface_devices++;
+    state->interface_devices = new_ptr;
+    state->interface_devices[state->nr_interface_devices].dom = dom;
+    state->interface_devices[state->nr_interface_devices].path = path_copy;
+    state->interface_devices[state->nr_interface_devices].address = address_copy;
+    state->interface_devices[state->nr_interface_devices].number = strdup(number_string);
+    return state->nr_interface_devices++;
 }
 
 static int
@@ -985,13 +1540,31 @@ ignore_device_match (ignorelist_t *il, const char *domname, const char *devpath)
 static int
 lv_shutdown (void)
 {
-    free_block_devices ();
-    free_interface_devices ();
-    free_domains ();
+    int i;
 
-    if (conn != NULL)
-        virConnectClose (conn);
-    conn = NULL;
+    /* Stop the event loop first, so that no event callback uses the states
+     * while they are freed. */
+    if (event_loop_running) {
+        event_loop_running = 0;
+        pthread_join (event_loop_thread, NULL);
+    }
+    if (event_loop_timer >= 0)
+        virEventRemoveTimeout (event_loop_timer);
+    event_loop_timer = -1;
+
+    for (i = 0; (lv_states != NULL) && (i < nr_instances); i++) {
+        lv_read_state_t *state = lv_states + i;
+
+        free_block_devices (state);
+        free_interface_devices (state);
+        free_domains (state);
+        lv_disconnect (state);
+
+        lv_free_events (state->events_head);
+        state->events_head = state->events_tail = NULL;
+        pthread_mutex_destroy (&state->lock);
+    }
+    sfree (lv_states);
 
     ignorelist_free (il_domains);
     il_domains = NULL;
@@ -1010,7 +1583,6 @@ module_register (void)
     lv_config,
     config_keys, NR_CONFIG_KEYS);
     plugin_register_init (PLUGIN_NAME, lv_init);
-    plugin_register_read (PLUGIN_NAME, lv_read);
     plugin_register_shutdown (PLUGIN_NAME, lv_shutdown);
 }
 
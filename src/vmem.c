@@ -27,6 +27,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #if KERNEL_LINUX
 static const char *config_keys[] =
@@ -110,19 +111,20 @@ static int vmem_read (void)
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
+  procfs_snapshot_t *snap;
+  size_t offset = 0;
   char buffer[1024];
 
-  fh = fopen ("/proc/vmstat", "r");
-  if (fh == NULL)
+  snap = procfs_snapshot_get ("/proc/vmstat");
+  if (snap == NULL)
   {
     char errbuf[1024];
-    ERROR ("vmem plugin: fopen (/proc/vmstat) failed: %s",
+    ERROR ("vmem plugin: Reading /proc/vmstat failed: %s",
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  while (procfs_getline (snap, &offset, buffer, sizeof (buffer)) != NULL)
   {
     char *fields[4];
     int fields_num;
@@ -280,10 +282,10 @@ static int vmem_read (void)
       value_t value  = { .derive = counter };
       submit_one (NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
+  } /* while (procfs_getline) */
 
-  fclose (fh);
-  fh = NULL;
+  procfs_snapshot_put (snap);
+  snap = NULL;
 
   if (pgfaultvalid == 0x03)
     submit_two (NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
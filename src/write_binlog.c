@@ -0,0 +1,506 @@
+/**
+ * collectd - src/write_binlog.c
+ * Copyright (C) 2016  Florian octo Forster
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   Florian octo Forster <octo at collectd.org>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_intern.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * Segment file layout
+ *
+ * Values are appended to memory mapped segment files of a fixed size. All
+ * numbers are in the byte order of the writing host, which readers can tell
+ * from the "byte_order" field of the header. A segment starts with a
+ * binlog_header_t, followed by records. Every record starts with a
+ * binlog_record_t and is a multiple of eight bytes long.
+ *
+ * BINLOG_RECORD_SERIES defines a series before its first value in this
+ * segment. It is followed by a binlog_series_t, one data source type per
+ * value (as uint8_t) and the identifier, "host/plugin-instance/type-instance",
+ * NUL terminated and padded with zeros.
+ *
+ * BINLOG_RECORD_VALUES holds one value list: the time as cdtime_t (uint64_t)
+ * followed by the values as 64 bit gauge_t, counter_t, derive_t or
+ * absolute_t, depending on the data source type.
+ *
+ * The header's "used" field is updated after each record. Anything behind it
+ * has not been written completely. contrib/binlog_dump.py reads segments.
+ */
+#define BINLOG_MAGIC "CDBINLOG"
+#define BINLOG_VERSION 1
+#define BINLOG_BYTE_ORDER 0x01020304
+
+#define BINLOG_RECORD_VALUES 1
+#define BINLOG_RECORD_SERIES 2
+
+#define BINLOG_DEFAULT_DIR "binlog"
+#define BINLOG_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define BINLOG_DEFAULT_SEGMENT_DURATION TIME_T_TO_CDTIME_T (3600)
+
+struct binlog_header_s
+{
+  char     magic[8];
+  uint32_t byte_order;
+  uint32_t version;
+  uint64_t start;   /* cdtime_t */
+  uint64_t used;    /* bytes, including this header */
+  uint8_t  reserved[32];
+};
+typedef struct binlog_header_s binlog_header_t;
+
+struct binlog_record_s
+{
+  uint32_t series_id;
+  uint16_t type;
+  uint16_t size;    /* bytes, including this header */
+};
+typedef struct binlog_record_s binlog_record_t;
+
+struct binlog_series_s
+{
+  uint64_t interval; /* cdtime_t */
+  uint32_t hash;     /* identifier_hash_vl () */
+  uint16_t values_num;
+  uint16_t identifier_size; /* including the terminating NUL */
+};
+typedef struct binlog_series_s binlog_series_t;
+
+/*
+ * Private variables
+ */
+static char *datadir = NULL;
+static size_t segment_size = BINLOG_DEFAULT_SEGMENT_SIZE;
+static cdtime_t segment_duration = BINLOG_DEFAULT_SEGMENT_DURATION;
+
+/* The current segment, protected by "segment_lock". */
+static int segment_fd = -1;
+static char *segment_map = NULL;
+static binlog_header_t *segment_header = NULL;
+static char segment_name[PATH_MAX];
+/* Maps identifiers to the series IDs of the current segment. */
+static c_avl_tree_t *segment_series = NULL;
+static uint32_t segment_series_num = 0;
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Private functions
+ */
+static void wb_series_free (void) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (segment_series == NULL)
+    return;
+
+  while (c_avl_pick (segment_series, &key, &value) == 0)
+  {
+    sfree (key);
+    sfree (value);
+  }
+  c_avl_destroy (segment_series);
+  segment_series = NULL;
+  segment_series_num = 0;
+} /* }}} void wb_series_free */
+
+/* Unmaps the current segment and truncates it to the used size.
+ * XXX: You must hold "segment_lock" when calling this function! */
+static void wb_segment_close (void) /* {{{ */
+{
+  off_t used;
+
+  if (segment_fd < 0)
+    return;
+
+  used = (off_t) segment_header->used;
+
+  if (munmap (segment_map, segment_size) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_binlog plugin: munmap (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+
+  if (ftruncate (segment_fd, used) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_binlog plugin: ftruncate (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+
+  close (segment_fd);
+  segment_fd = -1;
+  segment_map = NULL;
+  segment_header = NULL;
+
+  wb_series_free ();
+
+  DEBUG ("write_binlog plugin: Closed %s (%lu bytes).", segment_name,
+      (unsigned long) used);
+} /* }}} void wb_segment_close */
+
+/* Creates a new segment named after the current time and maps it.
+ * XXX: You must hold "segment_lock" when calling this function! */
+static int wb_segment_open (void) /* {{{ */
+{
+  cdtime_t now = cdtime ();
+  time_t t = CDTIME_T_TO_TIME_T (now);
+  struct tm tm;
+  char timestr[32];
+  int i;
+
+  localtime_r (&t, &tm);
+  strftime (timestr, sizeof (timestr), "%Y%m%d-%H%M%S", &tm);
+
+  segment_fd = -1;
+  for (i = 0; (segment_fd < 0) && (i < 100); i++)
+  {
+    if (i == 0)
+      ssnprintf (segment_name, sizeof (segment_name), "%s/%s.binlog",
+          datadir, timestr);
+    else
+      ssnprintf (segment_name, sizeof (segment_name), "%s/%s-%i.binlog",
+          datadir, timestr, i);
+
+    segment_fd = open (segment_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if ((segment_fd < 0) && (errno != EEXIST))
+      break;
+  }
+
+  if (segment_fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_binlog plugin: open (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (ftruncate (segment_fd, (off_t) segment_size) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_binlog plugin: ftruncate (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (segment_fd);
+    unlink (segment_name);
+    segment_fd = -1;
+    return (-1);
+  }
+
+  segment_map = mmap (NULL, segment_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, segment_fd, 0);
+  if (segment_map == MAP_FAILED)
+  {
+    char errbuf[1024];
+    ERROR ("write_binlog plugin: mmap (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (segment_fd);
+    unlink (segment_name);
+    segment_fd = -1;
+    segment_map = NULL;
+    return (-1);
+  }
+
+  segment_series = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  if (segment_series == NULL)
+  {
+    ERROR ("write_binlog plugin: c_avl_create failed.");
+    munmap (segment_map, segment_size);
+    close (segment_fd);
+    unlink (segment_name);
+    segment_fd = -1;
+    segment_map = NULL;
+    return (-1);
+  }
+
+  segment_header = (binlog_header_t *) segment_map;
+  memcpy (segment_header->magic, BINLOG_MAGIC, sizeof (segment_header->magic));
+  segment_header->byte_order = BINLOG_BYTE_ORDER;
+  segment_header->version = BINLOG_VERSION;
+  segment_header->start = (uint64_t) now;
+  segment_header->used = sizeof (*segment_header);
+
+  DEBUG ("write_binlog plugin: Opened %s.", segment_name);
+  return (0);
+} /* }}} int wb_segment_open */
+
+/* Returns a pointer to "size" free bytes in the current segment, starting a
+ * new segment if the current one is full or too old.
+ * XXX: You must hold "segment_lock" when calling this function! */
+static char *wb_segment_reserve (size_t size) /* {{{ */
+{
+  if ((segment_fd >= 0)
+      && (((segment_header->used + size) > segment_size)
+        || ((cdtime () - segment_header->start) >= segment_duration)))
+    wb_segment_close ();
+
+  if ((segment_fd < 0) && (wb_segment_open () != 0))
+    return (NULL);
+
+  if ((segment_header->used + size) > segment_size)
+    return (NULL);
+
+  return (segment_map + segment_header->used);
+} /* }}} char *wb_segment_reserve */
+
+/* Makes the record at the end of the segment visible to readers.
+ * XXX: You must hold "segment_lock" when calling this function! */
+static void wb_segment_commit (size_t size) /* {{{ */
+{
+  segment_header->used += size;
+} /* }}} void wb_segment_commit */
+
+/* Returns the series ID of "identifier" in the current segment, writing the
+ * series' definition first if it has not been used in this segment yet.
+ * XXX: You must hold "segment_lock" when calling this function! */
+static int wb_series_get (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl, char const *identifier, uint32_t *ret_id)
+{
+  uint32_t *id = NULL;
+  char *key;
+  size_t identifier_size = strlen (identifier) + 1;
+  size_t size;
+  binlog_record_t *rec;
+  binlog_series_t *series;
+  uint8_t *types;
+  size_t i;
+
+  if (c_avl_get (segment_series, identifier, (void *) &id) == 0)
+  {
+    *ret_id = *id;
+    return (0);
+  }
+
+  size = sizeof (*rec) + sizeof (*series) + ds->ds_num + identifier_size;
+  size = (size + 7) & ~((size_t) 7);
+  if (size > UINT16_MAX)
+    return (-1);
+
+  rec = (binlog_record_t *) wb_segment_reserve (size);
+  if (rec == NULL)
+    return (-1);
+
+  key = strdup (identifier);
+  id = malloc (sizeof (*id));
+  if ((key == NULL) || (id == NULL))
+  {
+    sfree (key);
+    sfree (id);
+    return (-1);
+  }
+  *id = segment_series_num;
+
+  if (c_avl_insert (segment_series, key, id) != 0)
+  {
+    sfree (key);
+    sfree (id);
+    return (-1);
+  }
+  segment_series_num++;
+
+  memset (rec, 0, size);
+  rec->series_id = *id;
+  rec->type = BINLOG_RECORD_SERIES;
+  rec->size = (uint16_t) size;
+
+  series = (binlog_series_t *) (rec + 1);
+  series->interval = (uint64_t) vl->interval;
+  series->hash = identifier_hash_vl (vl);
+  series->values_num = (uint16_t) ds->ds_num;
+  series->identifier_size = (uint16_t) identifier_size;
+
+  types = (uint8_t *) (series + 1);
+  for (i = 0; i < ds->ds_num; i++)
+    types[i] = (uint8_t) ds->ds[i].type;
+  memcpy (types + ds->ds_num, identifier, identifier_size);
+
+  wb_segment_commit (size);
+
+  *ret_id = *id;
+  return (0);
+} /* }}} int wb_series_get */
+
+static int wb_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    __attribute__((unused)) user_data_t *ud)
+{
+  char identifier[6 * DATA_MAX_NAME_LEN];
+  binlog_record_t *rec;
+  uint64_t *values;
+  uint32_t series_id;
+  size_t size;
+  size_t i;
+  int status;
+
+  if (strcmp (ds->type, vl->type) != 0)
+  {
+    ERROR ("write_binlog plugin: DS type does not match value list type");
+    return (-1);
+  }
+
+  status = FORMAT_VL (identifier, sizeof (identifier), vl);
+  if (status != 0)
+    return (status);
+
+  size = sizeof (*rec) + sizeof (uint64_t) * (1 + ds->ds_num);
+  if (size > UINT16_MAX)
+    return (-1);
+
+  pthread_mutex_lock (&segment_lock);
+
+  /* Reserve room for the series definition, too, so that the value list
+   * ends up in the same segment. */
+  rec = (binlog_record_t *) wb_segment_reserve (size + sizeof (*rec)
+      + sizeof (binlog_series_t) + ds->ds_num + sizeof (identifier) + 8);
+  if (rec != NULL)
+    status = wb_series_get (ds, vl, identifier, &series_id);
+  if ((rec == NULL) || (status != 0))
+  {
+    pthread_mutex_unlock (&segment_lock);
+    ERROR ("write_binlog plugin: Writing %s failed.", identifier);
+    return (-1);
+  }
+
+  rec = (binlog_record_t *) (segment_map + segment_header->used);
+  rec->series_id = series_id;
+  rec->type = BINLOG_RECORD_VALUES;
+  rec->size = (uint16_t) size;
+
+  values = (uint64_t *) (rec + 1);
+  values[0] = (uint64_t) vl->time;
+  for (i = 0; i < ds->ds_num; i++)
+    memcpy (values + 1 + i, vl->values + i, sizeof (values[0]));
+
+  wb_segment_commit (size);
+
+  pthread_mutex_unlock (&segment_lock);
+  return (0);
+} /* }}} int wb_write */
+
+static int wb_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
+    __attribute__((unused)) const char *identifier,
+    __attribute__((unused)) user_data_t *ud)
+{
+  int status = 0;
+
+  pthread_mutex_lock (&segment_lock);
+  if ((segment_fd >= 0)
+      && (msync (segment_map, (size_t) segment_header->used, MS_ASYNC) != 0))
+  {
+    char errbuf[1024];
+    ERROR ("write_binlog plugin: msync (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    status = -1;
+  }
+  pthread_mutex_unlock (&segment_lock);
+
+  return (status);
+} /* }}} int wb_flush */
+
+static int wb_config (oconfig_item_t *ci) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("DataDir", child->key) == 0)
+      cf_util_get_string (child, &datadir);
+    else if (strcasecmp ("SegmentSize", child->key) == 0)
+    {
+      int tmp = 0;
+      if (cf_util_get_int (child, &tmp) != 0)
+        continue;
+      /* Room for the header and at least one large value list. */
+      if (tmp < 65536)
+      {
+        WARNING ("write_binlog plugin: SegmentSize must be at least 65536.");
+        continue;
+      }
+      segment_size = (size_t) tmp;
+    }
+    else if (strcasecmp ("SegmentDuration", child->key) == 0)
+      cf_util_get_cdtime (child, &segment_duration);
+    else
+      WARNING ("write_binlog plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+  }
+
+  return (0);
+} /* }}} int wb_config */
+
+static int wb_init (void) /* {{{ */
+{
+  char probe[PATH_MAX];
+  size_t len;
+
+  if (datadir == NULL)
+  {
+    datadir = strdup (BINLOG_DEFAULT_DIR);
+    if (datadir == NULL)
+      return (ENOMEM);
+  }
+
+  len = strlen (datadir);
+  while ((len > 1) && (datadir[len - 1] == '/'))
+    datadir[--len] = 0;
+
+  /* check_create_dir() creates the directories leading to a file. */
+  ssnprintf (probe, sizeof (probe), "%s/segment", datadir);
+  if (check_create_dir (probe) != 0)
+  {
+    ERROR ("write_binlog plugin: Cannot create %s.", datadir);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int wb_init */
+
+static int wb_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&segment_lock);
+  wb_segment_close ();
+  pthread_mutex_unlock (&segment_lock);
+
+  sfree (datadir);
+  return (0);
+} /* }}} int wb_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("write_binlog", wb_config);
+  plugin_register_init ("write_binlog", wb_init);
+  plugin_register_write ("write_binlog", wb_write, /* user_data = */ NULL);
+  plugin_register_flush ("write_binlog", wb_flush, /* user_data = */ NULL);
+  plugin_register_shutdown ("write_binlog", wb_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
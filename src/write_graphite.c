@@ -42,6 +42,8 @@
   * </Plugin>
   */
 
+#define _GNU_SOURCE /* For sendmmsg(2) */
+
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
@@ -50,31 +52,99 @@
 #include "utils_cache.h"
 #include "utils_complain.h"
 #include "utils_format_graphite.h"
+#include "utils_intern.h"
 
 /* Folks without pthread will need to disable this plugin. */
 #include <pthread.h>
 
 #include <netdb.h>
+#include <poll.h>
+#include <sys/mman.h>
 
 #define WG_DEFAULT_NODE "localhost"
 #define WG_DEFAULT_SERVICE "2003"
 #define WG_DEFAULT_PROTOCOL "tcp"
 #define WG_DEFAULT_LOG_SEND_ERRORS 1
 #define WG_DEFAULT_ESCAPE '_'
+#define WG_DEFAULT_QUEUE_LENGTH 1024
 
 /* Ethernet - (IPv6 + TCP) = 1500 - (40 + 32) = 1428 */
 #define WG_SEND_BUF_SIZE 1428
 
 #define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T (1)
+#define WG_MAX_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T (60)
+
+/* How long the sender thread waits for the socket to become writable. */
+#define WG_SEND_TIMEOUT_MS 5000
+
+#define WG_QUEUE_DROP_NEWEST 0
+#define WG_QUEUE_DROP_OLDEST 1
+
+/* Number of full buffers a UDP sender thread hands to sendmmsg(2) at once. */
+#define WG_UDP_BATCH 32
+
+/*
+ * Spill file layout
+ *
+ * Full blocks that don't fit into the send queue are appended to a memory
+ * mapped file of a fixed size and replayed once the server is reachable
+ * again. The file starts with a wg_spill_header_t. "head" is the offset of
+ * the oldest block not sent yet, "tail" the end of the last block written.
+ * Every block is a wg_spill_record_t followed by the data, padded to a
+ * multiple of eight bytes. The header is updated after the block has been
+ * written, so the file survives a restart of the daemon.
+ */
+#define WG_SPILL_MAGIC "WGSPILL1"
+#define WG_SPILL_VERSION 1
+#define WG_DEFAULT_SPILL_SIZE (64 * 1024 * 1024)
+#define WG_DEFAULT_SPILL_REPLAY_RATE 100.0
+
+struct wg_spill_header_s
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t head;
+    uint64_t tail;
+};
+typedef struct wg_spill_header_s wg_spill_header_t;
+
+struct wg_spill_record_s
+{
+    uint64_t time;  /* cdtime_t, when the block was spilled */
+    uint32_t fill;
+    uint32_t lines;
+};
+typedef struct wg_spill_record_s wg_spill_record_t;
+
+#define WG_SPILL_RECORD_SIZE(fill) \
+    ((sizeof (wg_spill_record_t) + (fill) + 7) & ~((size_t) 7))
 
 /*
  * Private variables
  */
+struct wg_buffer
+{
+    char     data[WG_SEND_BUF_SIZE];
+    size_t   fill;
+    size_t   lines;
+};
+
+/* The write threads append to the buffer after the last full one in "queue",
+ * queue[(queue_head + queue_length) % queue_size], and the sender thread
+ * sends the full buffers starting at queue_head. The socket is only used by
+ * the sender thread.
+ *
+ * Each of the "Connections" of a node is a wg_callback of its own, with its
+ * own socket, queue, sender thread and spill file. */
 struct wg_callback
 {
     int      sock_fd;
 
     char    *name;
+    /* Index of the connection within its node, and the number of them. */
+    size_t   conn_index;
+    size_t   conns_num;
 
     char    *node;
     char    *service;
@@ -85,29 +155,74 @@ struct wg_callback
     char     escape_char;
 
     unsigned int format_flags;
-
-    char     send_buf[WG_SEND_BUF_SIZE];
-    size_t   send_buf_free;
-    size_t   send_buf_fill;
+    graphite_cache_t *graphite_cache;
+
+    struct wg_buffer *queue;
+    size_t   queue_size;
+    size_t   queue_head;
+    size_t   queue_length;
+    int      queue_policy;
+    derive_t queue_dropped;
     cdtime_t send_buf_init_time;
 
+    /* Counters of the sender thread, protected by "send_lock". */
+    derive_t sent_values;
+    derive_t sent_bytes;
+    derive_t send_errors;
+
+    /* Full buffers taken from the queue at once by a UDP sender thread.
+     * NULL with TCP, which sends one buffer at a time. */
+    struct wg_buffer *udp_batch;
+
+    /* The spill file, protected by "send_lock". Disabled if "spill_fd" is
+     * negative. Blocks are replayed at most "spill_replay_rate" per second,
+     * zero meaning as fast as possible. */
+    char    *spill_file;
+    size_t   spill_size;
+    double   spill_replay_rate;
+    int      spill_fd;
+    char    *spill_map;
+    wg_spill_header_t *spill_header;
+    cdtime_t spill_next_replay;
+    c_complain_t spill_complaint;
+
     pthread_mutex_t send_lock;
+    pthread_cond_t send_cond;
+    pthread_t send_thread;
+    _Bool send_thread_running;
+    _Bool send_thread_loop;
+
     c_complain_t init_complaint;
-    cdtime_t last_connect_time;
+    c_complain_t queue_complaint;
+    cdtime_t next_connect_time;
+    cdtime_t reconnect_backoff;
 
     /* Force reconnect useful for load balanced environments */
     cdtime_t last_reconnect_time;
     cdtime_t reconnect_interval;
-    _Bool reconnect_interval_reached;
 };
 
+/* The connections of one <Node>. Value lists are assigned to a connection by
+ * the hash of their identifier, so the values of one series are always sent
+ * in order. */
+struct wg_node
+{
+    struct wg_callback **conns;
+    size_t conns_num;
+};
+
+#if HAVE_SENDMMSG
+/* Set when sendmmsg(2) returned ENOSYS. */
+static _Bool wg_no_sendmmsg = 0;
+#endif
+
 /* wg_force_reconnect_check closes cb->sock_fd when it was open for longer
- * than cb->reconnect_interval. Must hold cb->send_lock when calling. */
+ * than cb->reconnect_interval. Only called by the sender thread. */
 static void wg_force_reconnect_check (struct wg_callback *cb)
 {
     cdtime_t now;
 
-    if (cb->reconnect_interval == 0)
+    if ((cb->reconnect_interval == 0) || (cb->sock_fd < 0))
         return;
 
     /* check if address changes if addr_timeout */
@@ -118,37 +233,97 @@ static void wg_force_reconnect_check (struct wg_callback *cb)
     /* here we should close connection on next */
     close (cb->sock_fd);
     cb->sock_fd = -1;
-    cb->last_reconnect_time = now;
-    cb->reconnect_interval_reached = 1;
 
     INFO ("write_graphite plugin: Connection closed after %.3f seconds.",
           CDTIME_T_TO_DOUBLE (now - cb->last_reconnect_time));
+
+    cb->last_reconnect_time = now;
+    /* Reconnect right away, this is not a failure. */
+    cb->next_connect_time = 0;
 }
 
 /*
  * Functions
  */
-static void wg_reset_buffer (struct wg_callback *cb)
+
+/* Waits up to WG_SEND_TIMEOUT_MS for "fd" to become writable. Returns zero
+ * or an errno value. */
+static int wg_wait_writable (int fd)
+{
+    struct pollfd pfd;
+    int status;
+
+    memset (&pfd, 0, sizeof (pfd));
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+
+    do
+        status = poll (&pfd, 1, WG_SEND_TIMEOUT_MS);
+    while ((status < 0) && (errno == EINTR));
+
+    if (status < 0)
+        return (errno);
+    else if (status == 0)
+        return (ETIMEDOUT);
+    return (0);
+}
+
+/* Returns true if the TCP peer has closed the connection. Carbon never sends
+ * anything, so a readable socket means end of file or an error. */
+static _Bool wg_peer_closed (struct wg_callback *cb)
 {
-    memset (cb->send_buf, 0, sizeof (cb->send_buf));
-    cb->send_buf_free = sizeof (cb->send_buf);
-    cb->send_buf_fill = 0;
-    cb->send_buf_init_time = cdtime ();
+    struct pollfd pfd;
+    char buffer[32];
+
+    if (strcasecmp ("tcp", cb->protocol) != 0)
+        return (0);
+
+    memset (&pfd, 0, sizeof (pfd));
+    pfd.fd = cb->sock_fd;
+    pfd.events = POLLIN;
+    if (poll (&pfd, 1, 0) <= 0)
+        return (0);
+
+    return (recv (cb->sock_fd, buffer, sizeof (buffer),
+                MSG_PEEK | MSG_DONTWAIT) <= 0);
 }
 
-static int wg_send_buffer (struct wg_callback *cb)
+static int wg_send_buffer (struct wg_callback *cb,
+        struct wg_buffer const *buf)
 {
-    ssize_t status = 0;
+    char const *ptr = buf->data;
+    size_t left = buf->fill;
+    int status = 0;
+
+    if (wg_peer_closed (cb))
+        status = ECONNRESET;
+
+    while ((status == 0) && (left > 0))
+    {
+        ssize_t n = write (cb->sock_fd, ptr, left);
+
+        if (n < 0)
+        {
+            status = errno;
+            if (status == EINTR)
+                status = 0;
+            else if ((status == EAGAIN) || (status == EWOULDBLOCK))
+                status = wg_wait_writable (cb->sock_fd);
+            continue;
+        }
+
+        ptr += (size_t) n;
+        left -= (size_t) n;
+    }
 
-    status = swrite (cb->sock_fd, cb->send_buf, strlen (cb->send_buf));
     if (status != 0)
     {
         if (cb->log_send_errors)
         {
             char errbuf[1024];
-            ERROR ("write_graphite plugin: send to %s:%s (%s) failed with status %zi (%s)",
+            ERROR ("write_graphite plugin: send to %s:%s (%s) failed: %s",
                     cb->node, cb->service, cb->protocol,
-                    status, sstrerror (errno, errbuf, sizeof (errbuf)));
+                    sstrerror (status, errbuf, sizeof (errbuf)));
         }
 
         close (cb->sock_fd);
@@ -160,38 +335,81 @@ static int wg_send_buffer (struct wg_callback *cb)
     return (0);
 }
 
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
+/* Sends "bufs_num" buffers, as one datagram each with sendmmsg(2) if the
+ * protocol is UDP. Returns the number of buffers sent before an error. */
+static size_t wg_send_buffers (struct wg_callback *cb,
+        struct wg_buffer const *bufs, size_t bufs_num)
 {
-    int status;
+    size_t sent = 0;
 
-    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-            "send_buf_fill = %zu;",
-            (double)timeout,
-            cb->send_buf_fill);
-
-    /* timeout == 0  => flush unconditionally */
-    if (timeout > 0)
+#if HAVE_SENDMMSG
+    if ((bufs_num > 1) && (cb->udp_batch != NULL) && !wg_no_sendmmsg)
     {
-        cdtime_t now;
+        struct mmsghdr msgs[WG_UDP_BATCH];
+        struct iovec   iovs[WG_UDP_BATCH];
+        size_t i;
 
-        now = cdtime ();
-        if ((cb->send_buf_init_time + timeout) > now)
-            return (0);
-    }
+        assert (bufs_num <= WG_UDP_BATCH);
+        memset (msgs, 0, sizeof (msgs));
+        for (i = 0; i < bufs_num; i++)
+        {
+            iovs[i].iov_base = (void *) bufs[i].data;
+            iovs[i].iov_len = bufs[i].fill;
+            msgs[i].msg_hdr.msg_iov = iovs + i;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
 
-    if (cb->send_buf_fill <= 0)
-    {
-        cb->send_buf_init_time = cdtime ();
-        return (0);
+        while (sent < bufs_num)
+        {
+            int status = sendmmsg (cb->sock_fd, msgs + sent,
+                    (unsigned int) (bufs_num - sent), /* flags = */ 0);
+
+            if (status >= 0)
+            {
+                sent += (size_t) status;
+                continue;
+            }
+
+            status = errno;
+            if (status == EINTR)
+                continue;
+            if ((status == EAGAIN) || (status == EWOULDBLOCK))
+                status = wg_wait_writable (cb->sock_fd);
+            if (status == 0)
+                continue;
+
+            if (status == ENOSYS)
+            {
+                INFO ("write_graphite plugin: sendmmsg(2) is not supported "
+                        "by the kernel. Sending one datagram at a time.");
+                wg_no_sendmmsg = 1;
+                break;
+            }
+
+            if (cb->log_send_errors)
+            {
+                char errbuf[1024];
+                ERROR ("write_graphite plugin: send to %s:%s (%s) failed: %s",
+                        cb->node, cb->service, cb->protocol,
+                        sstrerror (status, errbuf, sizeof (errbuf)));
+            }
+            close (cb->sock_fd);
+            cb->sock_fd = -1;
+            return (sent);
+        }
     }
+#endif
 
-    status = wg_send_buffer (cb);
-    wg_reset_buffer (cb);
+    for (; sent < bufs_num; sent++)
+        if (wg_send_buffer (cb, bufs + sent) != 0)
+            break;
 
-    return (status);
+    return (sent);
 }
 
+/* Connects the socket if it isn't connected. Failed attempts are retried
+ * with an exponential backoff, from WG_MIN_RECONNECT_INTERVAL up to
+ * WG_MAX_RECONNECT_INTERVAL. Only called by the sender thread. */
 static int wg_callback_init (struct wg_callback *cb)
 {
     struct addrinfo ai_hints;
@@ -202,15 +420,19 @@ static int wg_callback_init (struct wg_callback *cb)
 
     char connerr[1024] = "";
 
-    if (cb->sock_fd > 0)
+    if (cb->sock_fd >= 0)
         return (0);
 
-    /* Don't try to reconnect too often. By default, one reconnection attempt
-     * is made per second. */
     now = cdtime ();
-    if ((now - cb->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
+    if (now < cb->next_connect_time)
         return (EAGAIN);
-    cb->last_connect_time = now;
+
+    if (cb->reconnect_backoff == 0)
+        cb->reconnect_backoff = WG_MIN_RECONNECT_INTERVAL;
+    cb->next_connect_time = now + cb->reconnect_backoff;
+    cb->reconnect_backoff *= 2;
+    if (cb->reconnect_backoff > WG_MAX_RECONNECT_INTERVAL)
+        cb->reconnect_backoff = WG_MAX_RECONNECT_INTERVAL;
 
     memset (&ai_hints, 0, sizeof (ai_hints));
 #ifdef AI_ADDRCONFIG
@@ -228,7 +450,8 @@ static int wg_callback_init (struct wg_callback *cb)
     status = getaddrinfo (cb->node, cb->service, &ai_hints, &ai_list);
     if (status != 0)
     {
-        ERROR ("write_graphite plugin: getaddrinfo (%s, %s, %s) failed: %s",
+        c_complain (LOG_ERR, &cb->init_complaint,
+                "write_graphite plugin: getaddrinfo (%s, %s, %s) failed: %s",
                 cb->node, cb->service, cb->protocol, gai_strerror (status));
         return (-1);
     }
@@ -245,12 +468,31 @@ static int wg_callback_init (struct wg_callback *cb)
             continue;
         }
 
-        status = connect (cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+        /* Writes must never block the sender thread for longer than
+         * WG_SEND_TIMEOUT_MS, see wg_send_buffer(). */
+        status = fcntl (cb->sock_fd, F_SETFL,
+                fcntl (cb->sock_fd, F_GETFL) | O_NONBLOCK);
+        if (status == 0)
+            status = connect (cb->sock_fd, ai_ptr->ai_addr,
+                    ai_ptr->ai_addrlen);
+        if (status != 0)
+            status = errno;
+
+        if (status == EINPROGRESS)
+        {
+            socklen_t status_len = sizeof (status);
+
+            status = wg_wait_writable (cb->sock_fd);
+            if ((status == 0) && (getsockopt (cb->sock_fd, SOL_SOCKET,
+                            SO_ERROR, &status, &status_len) != 0))
+                status = errno;
+        }
+
         if (status != 0)
         {
             char errbuf[1024];
             snprintf (connerr, sizeof (connerr), "failed to connect to remote "
-                    "host: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+                    "host: %s", sstrerror (status, errbuf, sizeof (errbuf)));
             close (cb->sock_fd);
             cb->sock_fd = -1;
             continue;
@@ -278,17 +520,381 @@ static int wg_callback_init (struct wg_callback *cb)
                 cb->node, cb->service, cb->protocol);
     }
 
-    /* wg_force_reconnect_check does not flush the buffer before closing a
-     * sending socket, so only call wg_reset_buffer() if the socket was closed
-     * for a different reason (tracked in cb->reconnect_interval_reached). */
-    if (!cb->reconnect_interval_reached || (cb->send_buf_free == 0))
-        wg_reset_buffer (cb);
-    else
-        cb->reconnect_interval_reached = 0;
+    cb->reconnect_backoff = WG_MIN_RECONNECT_INTERVAL;
+    cb->last_reconnect_time = cdtime ();
+
+    return (0);
+}
+
+/* Maps the spill file, keeping the blocks of a previous run if its header
+ * is valid. Called while configuring, before the sender thread exists. */
+static int wg_spill_open (struct wg_callback *cb) /* {{{ */
+{
+    wg_spill_header_t *hdr;
+
+    cb->spill_fd = open (cb->spill_file, O_RDWR | O_CREAT, 0600);
+    if (cb->spill_fd < 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: open (%s) failed: %s", cb->spill_file,
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        return (-1);
+    }
+
+    if (ftruncate (cb->spill_fd, (off_t) cb->spill_size) != 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: ftruncate (%s) failed: %s",
+                cb->spill_file, sstrerror (errno, errbuf, sizeof (errbuf)));
+        close (cb->spill_fd);
+        cb->spill_fd = -1;
+        return (-1);
+    }
+
+    cb->spill_map = mmap (NULL, cb->spill_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, cb->spill_fd, 0);
+    if (cb->spill_map == MAP_FAILED)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: mmap (%s) failed: %s", cb->spill_file,
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        close (cb->spill_fd);
+        cb->spill_fd = -1;
+        cb->spill_map = NULL;
+        return (-1);
+    }
+
+    hdr = (wg_spill_header_t *) cb->spill_map;
+    cb->spill_header = hdr;
+
+    if ((memcmp (hdr->magic, WG_SPILL_MAGIC, sizeof (hdr->magic)) == 0)
+            && (hdr->version == WG_SPILL_VERSION)
+            && (hdr->head >= sizeof (*hdr))
+            && (hdr->head <= hdr->tail)
+            && (hdr->tail <= cb->spill_size))
+    {
+        if (hdr->tail > hdr->head)
+            INFO ("write_graphite plugin: %s holds %" PRIu64 " bytes to be "
+                    "replayed.", cb->spill_file, hdr->tail - hdr->head);
+        return (0);
+    }
+
+    memset (hdr, 0, sizeof (*hdr));
+    memcpy (hdr->magic, WG_SPILL_MAGIC, sizeof (hdr->magic));
+    hdr->version = WG_SPILL_VERSION;
+    hdr->head = sizeof (*hdr);
+    hdr->tail = sizeof (*hdr);
+
+    return (0);
+} /* }}} int wg_spill_open */
+
+static void wg_spill_close (struct wg_callback *cb) /* {{{ */
+{
+    if (cb->spill_fd < 0)
+        return;
+
+    if (munmap (cb->spill_map, cb->spill_size) != 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: munmap (%s) failed: %s",
+                cb->spill_file, sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+
+    close (cb->spill_fd);
+    cb->spill_fd = -1;
+    cb->spill_map = NULL;
+    cb->spill_header = NULL;
+} /* }}} void wg_spill_close */
+
+static _Bool wg_spill_pending (struct wg_callback const *cb) /* {{{ */
+{
+    return ((cb->spill_fd >= 0)
+            && (cb->spill_header->tail > cb->spill_header->head));
+} /* }}} _Bool wg_spill_pending */
+
+/* Appends "buf" to the spill file. The blocks not sent yet are moved to the
+ * front of the file if there is no room behind them. Returns zero or -1 if
+ * spilling is disabled or the file is full.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_spill_append_nolock (struct wg_callback *cb, /* {{{ */
+        struct wg_buffer const *buf)
+{
+    wg_spill_header_t *hdr = cb->spill_header;
+    wg_spill_record_t *rec;
+    size_t size = WG_SPILL_RECORD_SIZE (buf->fill);
+
+    if (cb->spill_fd < 0)
+        return (-1);
+
+    if (((hdr->tail + size) > cb->spill_size) && (hdr->head > sizeof (*hdr)))
+    {
+        memmove (cb->spill_map + sizeof (*hdr), cb->spill_map + hdr->head,
+                hdr->tail - hdr->head);
+        hdr->tail -= hdr->head - sizeof (*hdr);
+        hdr->head = sizeof (*hdr);
+    }
+
+    if ((hdr->tail + size) > cb->spill_size)
+    {
+        c_complain (LOG_WARNING, &cb->spill_complaint,
+                "write_graphite plugin: The spill file %s is full, dropping "
+                "values.", cb->spill_file);
+        return (-1);
+    }
+
+    rec = (wg_spill_record_t *) (cb->spill_map + hdr->tail);
+    rec->time = (uint64_t) cdtime_coarse ();
+    rec->fill = (uint32_t) buf->fill;
+    rec->lines = (uint32_t) buf->lines;
+    memcpy (rec + 1, buf->data, buf->fill);
+    hdr->tail += size;
+
+    return (0);
+} /* }}} int wg_spill_append_nolock */
+
+/* Removes the oldest block from the spill file and copies it to "buf".
+ * Returns zero or ENOENT if there is none.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_spill_read_nolock (struct wg_callback *cb, /* {{{ */
+        struct wg_buffer *buf)
+{
+    wg_spill_header_t *hdr = cb->spill_header;
+    wg_spill_record_t const *rec;
+
+    if (!wg_spill_pending (cb))
+        return (ENOENT);
+
+    rec = (wg_spill_record_t const *) (cb->spill_map + hdr->head);
+    if (((hdr->tail - hdr->head) < sizeof (*rec))
+            || (rec->fill > sizeof (buf->data))
+            || ((hdr->tail - hdr->head) < WG_SPILL_RECORD_SIZE (rec->fill)))
+    {
+        ERROR ("write_graphite plugin: The spill file %s is corrupt, "
+                "dropping %" PRIu64 " bytes.", cb->spill_file,
+                hdr->tail - hdr->head);
+        hdr->head = sizeof (*hdr);
+        hdr->tail = sizeof (*hdr);
+        return (ENOENT);
+    }
+
+    memcpy (buf->data, rec + 1, rec->fill);
+    buf->fill = (size_t) rec->fill;
+    buf->lines = (size_t) rec->lines;
+
+    hdr->head += WG_SPILL_RECORD_SIZE (rec->fill);
+    if (hdr->head == hdr->tail)
+    {
+        hdr->head = sizeof (*hdr);
+        hdr->tail = sizeof (*hdr);
+    }
+
+    return (0);
+} /* }}} int wg_spill_read_nolock */
+
+/* Moves the oldest full buffer of the queue to the spill file.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_spill_queue_head_nolock (struct wg_callback *cb) /* {{{ */
+{
+    struct wg_buffer *head = cb->queue + cb->queue_head;
+
+    if (wg_spill_append_nolock (cb, head) != 0)
+        return (-1);
+
+    head->fill = 0;
+    head->lines = 0;
+    cb->queue_head = (cb->queue_head + 1) % cb->queue_size;
+    cb->queue_length--;
+
+    return (0);
+} /* }}} int wg_spill_queue_head_nolock */
+
+/* Sends the full buffers of "cb->queue" until the callback is freed. Blocks
+ * of the spill file are sent in between, at most cb->spill_replay_rate per
+ * second. */
+static void *wg_send_thread (void *arg) /* {{{ */
+{
+    struct wg_callback *cb = arg;
+    struct wg_buffer buf;
+    int status;
+
+    pthread_mutex_lock (&cb->send_lock);
+    while (cb->send_thread_loop || (cb->queue_length > 0))
+    {
+        struct wg_buffer *bufs = &buf;
+        size_t bufs_num = 0;
+        size_t sent;
+        size_t i;
+        _Bool replay = 0;
+
+        if (cb->send_thread_loop && wg_spill_pending (cb))
+            replay = (cdtime () >= cb->spill_next_replay);
+
+        if ((cb->queue_length == 0) && !replay)
+        {
+            if (cb->send_thread_loop && wg_spill_pending (cb))
+            {
+                struct timespec ts;
+
+                CDTIME_T_TO_TIMESPEC (cb->spill_next_replay, &ts);
+                pthread_cond_timedwait (&cb->send_cond, &cb->send_lock, &ts);
+            }
+            else
+                pthread_cond_wait (&cb->send_cond, &cb->send_lock);
+            continue;
+        }
+
+        pthread_mutex_unlock (&cb->send_lock);
+        wg_force_reconnect_check (cb);
+        status = wg_callback_init (cb);
+        pthread_mutex_lock (&cb->send_lock);
+
+        if (status != 0)
+        {
+            struct timespec ts;
+
+            /* Don't wait for an unreachable server when shutting down. */
+            if (!cb->send_thread_loop)
+                break;
+
+            CDTIME_T_TO_TIMESPEC (cb->next_connect_time, &ts);
+            pthread_cond_timedwait (&cb->send_cond, &cb->send_lock, &ts);
+            continue;
+        }
+
+        if (replay)
+        {
+            cdtime_t step = 0;
+
+            if (cb->spill_replay_rate > 0.0)
+                step = DOUBLE_TO_CDTIME_T (1.0 / cb->spill_replay_rate);
+            cb->spill_next_replay = cdtime () + step;
+
+            if (wg_spill_read_nolock (cb, &buf) != 0)
+                continue;
+            bufs_num = 1;
+        }
+        else
+        {
+            size_t bufs_max = 1;
+
+            if (cb->udp_batch != NULL)
+            {
+                bufs = cb->udp_batch;
+                bufs_max = WG_UDP_BATCH;
+            }
+
+            /* Copy the buffers, so that the write threads may reuse their
+             * slots while they are being sent. */
+            while ((bufs_num < bufs_max) && (cb->queue_length > 0))
+            {
+                struct wg_buffer *head = cb->queue + cb->queue_head;
+
+                memcpy (bufs[bufs_num].data, head->data, head->fill);
+                bufs[bufs_num].fill = head->fill;
+                bufs[bufs_num].lines = head->lines;
+                head->fill = 0;
+                head->lines = 0;
+                cb->queue_head = (cb->queue_head + 1) % cb->queue_size;
+                cb->queue_length--;
+                bufs_num++;
+            }
+            c_release (LOG_INFO, &cb->queue_complaint,
+                    "write_graphite plugin: The send queue of %s:%s (%s) is "
+                    "no longer full.", cb->node, cb->service, cb->protocol);
+        }
+        pthread_mutex_unlock (&cb->send_lock);
+
+        sent = wg_send_buffers (cb, bufs, bufs_num);
+
+        pthread_mutex_lock (&cb->send_lock);
+        for (i = 0; i < bufs_num; i++)
+        {
+            if (i < sent)
+            {
+                cb->sent_values += (derive_t) bufs[i].lines;
+                cb->sent_bytes += (derive_t) bufs[i].fill;
+                continue;
+            }
+
+            if (i == sent)
+                cb->send_errors++;
+            if (wg_spill_append_nolock (cb, bufs + i) != 0)
+                cb->queue_dropped += (derive_t) bufs[i].lines;
+        }
+    }
+    pthread_mutex_unlock (&cb->send_lock);
+
+    return ((void *) 0);
+} /* }}} void *wg_send_thread */
+
+/* Hands the buffer being filled to the sender thread, starting the thread if
+ * necessary.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_enqueue_nolock (struct wg_callback *cb)
+{
+    int status;
+
+    assert (cb->queue_length < cb->queue_size);
+
+    cb->queue_length++;
+    cb->send_buf_init_time = cdtime_coarse ();
+
+    if (cb->send_thread_running)
+    {
+        pthread_cond_signal (&cb->send_cond);
+        return (0);
+    }
+
+    cb->send_thread_loop = 1;
+    status = plugin_thread_create (&cb->send_thread, /* attr = */ NULL,
+            wg_send_thread, cb);
+    if (status != 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: pthread_create failed: %s",
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        cb->send_thread_loop = 0;
+        return (-1);
+    }
+    cb->send_thread_running = 1;
 
     return (0);
 }
 
+/* NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
+{
+    struct wg_buffer *buf;
+
+    if (cb->queue_length >= cb->queue_size)
+        return (0);
+    buf = cb->queue
+        + ((cb->queue_head + cb->queue_length) % cb->queue_size);
+
+    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
+            "send_buf_fill = %zu;",
+            (double)timeout,
+            buf->fill);
+
+    /* timeout == 0  => flush unconditionally */
+    if (timeout > 0)
+    {
+        cdtime_t now;
+
+        now = cdtime_coarse ();
+        if ((cb->send_buf_init_time + timeout) > now)
+            return (0);
+    }
+
+    if (buf->fill <= 0)
+    {
+        cb->send_buf_init_time = cdtime_coarse ();
+        return (0);
+    }
+
+    return (wg_enqueue_nolock (cb));
+}
+
 static void wg_callback_free (void *data)
 {
     struct wg_callback *cb;
@@ -299,8 +905,17 @@ static void wg_callback_free (void *data)
     cb = data;
 
     pthread_mutex_lock (&cb->send_lock);
+    if (cb->queue != NULL)
+        wg_flush_nolock (/* timeout = */ 0, cb);
+    cb->send_thread_loop = 0;
+    pthread_cond_broadcast (&cb->send_cond);
+    pthread_mutex_unlock (&cb->send_lock);
 
-    wg_flush_nolock (/* timeout = */ 0, cb);
+    if (cb->send_thread_running)
+    {
+        pthread_join (cb->send_thread, /* retval = */ NULL);
+        cb->send_thread_running = 0;
+    }
 
     if (cb->sock_fd >= 0)
     {
@@ -308,104 +923,241 @@ static void wg_callback_free (void *data)
         cb->sock_fd = -1;
     }
 
+    /* Keep what could not be sent for the next run. */
+    while ((cb->queue_length > 0) && (wg_spill_queue_head_nolock (cb) == 0))
+        /* do nothing */;
+    wg_spill_close (cb);
+
     sfree(cb->name);
     sfree(cb->node);
     sfree(cb->protocol);
     sfree(cb->service);
     sfree(cb->prefix);
     sfree(cb->postfix);
+    sfree(cb->spill_file);
+    sfree(cb->queue);
+    sfree(cb->udp_batch);
+    graphite_cache_destroy (cb->graphite_cache);
 
     pthread_mutex_destroy (&cb->send_lock);
+    pthread_cond_destroy (&cb->send_cond);
 
     sfree(cb);
 }
 
+static void wg_node_free (void *data)
+{
+    struct wg_node *node = data;
+    size_t i;
+
+    if (node == NULL)
+        return;
+
+    for (i = 0; i < node->conns_num; i++)
+        wg_callback_free (node->conns[i]);
+    sfree (node->conns);
+    sfree (node);
+}
+
 static int wg_flush (cdtime_t timeout,
         const char *identifier __attribute__((unused)),
         user_data_t *user_data)
 {
-    struct wg_callback *cb;
-    int status;
+    struct wg_node *node;
+    size_t i;
+    int status = 0;
 
     if (user_data == NULL)
         return (-EINVAL);
 
-    cb = user_data->data;
+    node = user_data->data;
 
-    pthread_mutex_lock (&cb->send_lock);
+    for (i = 0; i < node->conns_num; i++)
+    {
+        struct wg_callback *cb = node->conns[i];
 
-    if (cb->sock_fd < 0)
+        pthread_mutex_lock (&cb->send_lock);
+        if (wg_flush_nolock (timeout, cb) != 0)
+            status = -1;
+        pthread_mutex_unlock (&cb->send_lock);
+    }
+
+    return (status);
+}
+
+/* Dispatches the number of full buffers waiting for the sender thread, the
+ * number of values and bytes sent, the number of failed sends and the number
+ * of values dropped, either because the queue was full or because sending
+ * failed. With a spill file, also dispatches its used size and the age of the
+ * oldest block in it. With several connections, each one gets a plugin
+ * instance of its own. */
+static void wg_read_stats_conn (struct wg_callback *cb)
+{
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t values[1];
+    size_t queue_length;
+    derive_t dropped;
+    derive_t sent_values;
+    derive_t sent_bytes;
+    derive_t send_errors;
+    _Bool spill = 0;
+    uint64_t spill_bytes = 0;
+    cdtime_t spill_lag = 0;
+
+    pthread_mutex_lock (&cb->send_lock);
+    queue_length = cb->queue_length;
+    dropped = cb->queue_dropped;
+    sent_values = cb->sent_values;
+    sent_bytes = cb->sent_bytes;
+    send_errors = cb->send_errors;
+    if (cb->spill_fd >= 0)
     {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
+        spill = 1;
+        spill_bytes = cb->spill_header->tail - cb->spill_header->head;
     }
+    if (wg_spill_pending (cb))
+    {
+        wg_spill_record_t const *rec = (wg_spill_record_t const *)
+            (cb->spill_map + cb->spill_header->head);
+        cdtime_t now = cdtime_coarse ();
 
-    status = wg_flush_nolock (timeout, cb);
+        if (now > (cdtime_t) rec->time)
+            spill_lag = now - (cdtime_t) rec->time;
+    }
     pthread_mutex_unlock (&cb->send_lock);
 
-    return (status);
+    vl.values = values;
+    vl.values_len = 1;
+    sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+    sstrncpy (vl.plugin, "write_graphite", sizeof (vl.plugin));
+    if (cb->conns_num > 1)
+        ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance), "%s-%zu",
+                (cb->name != NULL) ? cb->name : cb->node, cb->conn_index);
+    else
+        sstrncpy (vl.plugin_instance, (cb->name != NULL) ? cb->name : cb->node,
+                sizeof (vl.plugin_instance));
+
+    vl.values[0].gauge = (gauge_t) queue_length;
+    sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+    plugin_dispatch_values (&vl);
+
+    vl.values[0].derive = dropped;
+    sstrncpy (vl.type, "derive", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    vl.values[0].derive = send_errors;
+    sstrncpy (vl.type_instance, "send_errors", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    vl.values[0].derive = sent_values;
+    sstrncpy (vl.type, "total_values", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "sent", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    vl.values[0].derive = sent_bytes;
+    sstrncpy (vl.type, "total_bytes", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "sent", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    if (!spill)
+        return;
+
+    vl.values[0].gauge = (gauge_t) spill_bytes;
+    sstrncpy (vl.type, "bytes", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "spill", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    vl.values[0].gauge = CDTIME_T_TO_DOUBLE (spill_lag);
+    sstrncpy (vl.type, "delay", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "spill", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
 }
 
-static int wg_send_message (char const *message, struct wg_callback *cb)
+static int wg_read_stats (user_data_t *user_data)
 {
-    int status;
-    size_t message_len;
+    struct wg_node *node = user_data->data;
+    size_t i;
 
-    message_len = strlen (message);
+    for (i = 0; i < node->conns_num; i++)
+        wg_read_stats_conn (node->conns[i]);
 
-    pthread_mutex_lock (&cb->send_lock);
+    return (0);
+}
 
-    wg_force_reconnect_check (cb);
+/* Appends "message" to the buffer being filled. Never touches the socket, so
+ * a slow or unreachable server only fills the queue.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_send_message_nolock (char const *message, struct wg_callback *cb)
+{
+    struct wg_buffer *buf;
+    size_t message_len;
 
-    if (cb->sock_fd < 0)
-    {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
-    }
+    message_len = strlen (message);
 
-    if (message_len >= cb->send_buf_free)
+    while (42)
     {
-        status = wg_flush_nolock (/* timeout = */ 0, cb);
-        if (status != 0)
+        if (cb->queue_length >= cb->queue_size)
         {
-            pthread_mutex_unlock (&cb->send_lock);
-            return (status);
+            /* The oldest block goes to the spill file, if there is one and
+             * it has room. */
+            if (wg_spill_queue_head_nolock (cb) == 0)
+                continue;
+
+            if (cb->queue_policy != WG_QUEUE_DROP_OLDEST)
+            {
+                c_complain (LOG_WARNING, &cb->queue_complaint,
+                        "write_graphite plugin: The send queue of %s:%s (%s) "
+                        "is full, dropping values.",
+                        cb->node, cb->service, cb->protocol);
+                cb->queue_dropped++;
+                return (0);
+            }
+
+            c_complain (LOG_WARNING, &cb->queue_complaint,
+                    "write_graphite plugin: The send queue of %s:%s (%s) "
+                    "is full, dropping the oldest values.",
+                    cb->node, cb->service, cb->protocol);
+            cb->queue_dropped += (derive_t) cb->queue[cb->queue_head].lines;
+            cb->queue[cb->queue_head].fill = 0;
+            cb->queue[cb->queue_head].lines = 0;
+            cb->queue_head = (cb->queue_head + 1) % cb->queue_size;
+            cb->queue_length--;
         }
+
+        buf = cb->queue
+            + ((cb->queue_head + cb->queue_length) % cb->queue_size);
+        if (message_len < (sizeof (buf->data) - buf->fill))
+            break;
+
+        /* The buffer is full. An empty buffer always has room, because the
+         * message was formatted into a buffer of the same size. */
+        assert (buf->fill > 0);
+        if (wg_enqueue_nolock (cb) != 0)
+            return (-1);
     }
 
-    /* Assert that we have enough space for this message. */
-    assert (message_len < cb->send_buf_free);
+    if (buf->fill == 0)
+        cb->send_buf_init_time = cdtime_coarse ();
 
     /* `message_len + 1' because `message_len' does not include the
-     * trailing null byte. Neither does `send_buffer_fill'. */
-    memcpy (cb->send_buf + cb->send_buf_fill,
-            message, message_len + 1);
-    cb->send_buf_fill += message_len;
-    cb->send_buf_free -= message_len;
+     * trailing null byte. Neither does `buf->fill'. */
+    memcpy (buf->data + buf->fill, message, message_len + 1);
+    buf->fill += message_len;
+    buf->lines++;
 
     DEBUG ("write_graphite plugin: [%s]:%s (%s) buf %zu/%zu (%.1f %%) \"%s\"",
             cb->node, cb->service, cb->protocol,
-            cb->send_buf_fill, sizeof (cb->send_buf),
-            100.0 * ((double) cb->send_buf_fill) / ((double) sizeof (cb->send_buf)),
+            buf->fill, sizeof (buf->data),
+            100.0 * ((double) buf->fill) / ((double) sizeof (buf->data)),
             message);
 
-    pthread_mutex_unlock (&cb->send_lock);
-
     return (0);
 }
 
-static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
-        struct wg_callback *cb)
+/* NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_write_messages_nolock (const data_set_t *ds,
+        const value_list_t *vl, struct wg_callback *cb)
 {
     char buffer[WG_SEND_BUF_SIZE];
     int status;
@@ -417,34 +1169,82 @@ static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
         return -1;
     }
 
-    memset (buffer, 0, sizeof (buffer));
-    status = format_graphite (buffer, sizeof (buffer), ds, vl,
+    /* format_graphite_cached() terminates the buffer. */
+    buffer[0] = 0;
+    status = format_graphite_cached (cb->graphite_cache,
+            buffer, sizeof (buffer), ds, vl,
             cb->prefix, cb->postfix, cb->escape_char, cb->format_flags);
     if (status != 0) /* error message has been printed already. */
         return (status);
 
     /* Send the message to graphite */
-    status = wg_send_message (buffer, cb);
+    status = wg_send_message_nolock (buffer, cb);
     if (status != 0) /* error message has been printed already. */
         return (status);
 
     return (0);
-} /* int wg_write_messages */
+} /* int wg_write_messages_nolock */
 
-static int wg_write (const data_set_t *ds, const value_list_t *vl,
+/* All value lists of a batch that belong to the same connection are
+ * formatted and appended to its send buffer while holding its lock only
+ * once. */
+static int wg_write (const write_batch_entry_t *entries, size_t entries_num,
         user_data_t *user_data)
 {
-    struct wg_callback *cb;
-    int status;
+    struct wg_node *node;
+    size_t *conn_of = NULL;
+    size_t c;
+    size_t i;
+    int failed = 0;
 
     if (user_data == NULL)
         return (EINVAL);
 
-    cb = user_data->data;
+    node = user_data->data;
+
+    if (node->conns_num > 1)
+    {
+        conn_of = malloc (entries_num * sizeof (*conn_of));
+        if (conn_of == NULL)
+        {
+            ERROR ("write_graphite plugin: malloc failed.");
+            return (ENOMEM);
+        }
+        for (i = 0; i < entries_num; i++)
+            conn_of[i] = (size_t) identifier_hash_vl (entries[i].vl)
+                % node->conns_num;
+    }
+
+    for (c = 0; c < node->conns_num; c++)
+    {
+        struct wg_callback *cb = node->conns[c];
+        _Bool locked = 0;
 
-    status = wg_write_messages (ds, vl, cb);
+        for (i = 0; i < entries_num; i++)
+        {
+            int status;
 
-    return (status);
+            if ((conn_of != NULL) && (conn_of[i] != c))
+                continue;
+
+            if (!locked)
+            {
+                pthread_mutex_lock (&cb->send_lock);
+                locked = 1;
+            }
+
+            status = wg_write_messages_nolock (entries[i].ds,
+                    entries[i].vl, cb);
+            if (status != 0)
+                failed++;
+        }
+
+        if (locked)
+            pthread_mutex_unlock (&cb->send_lock);
+    }
+    sfree (conn_of);
+
+    return ((failed == 0) ? 0 : -1);
 }
 
 static int config_set_char (char *dest,
@@ -478,11 +1278,128 @@ static int config_set_char (char *dest,
     return (0);
 }
 
+static int config_set_queue_policy (int *dest, oconfig_item_t *ci)
+{
+    char buffer[32];
+    int status;
+
+    status = cf_util_get_string_buffer (ci, buffer, sizeof (buffer));
+    if (status != 0)
+        return (status);
+
+    if (strcasecmp ("DropNewest", buffer) == 0)
+        *dest = WG_QUEUE_DROP_NEWEST;
+    else if (strcasecmp ("DropOldest", buffer) == 0)
+        *dest = WG_QUEUE_DROP_OLDEST;
+    else
+    {
+        ERROR ("write_graphite plugin: The \"SendQueuePolicy\" option must "
+                "be either \"DropNewest\" or \"DropOldest\", got \"%s\".",
+                buffer);
+        return (-1);
+    }
+
+    return (0);
+}
+
+/* Allocates the queue and the cache of a connection and opens its spill
+ * file. */
+static int wg_callback_setup (struct wg_callback *cb)
+{
+    cb->queue = calloc (cb->queue_size, sizeof (*cb->queue));
+    if (cb->queue == NULL)
+    {
+        ERROR ("write_graphite plugin: calloc failed.");
+        return (-1);
+    }
+
+    if (strcasecmp ("UDP", cb->protocol) == 0)
+    {
+        cb->udp_batch = calloc (WG_UDP_BATCH, sizeof (*cb->udp_batch));
+        if (cb->udp_batch == NULL)
+        {
+            ERROR ("write_graphite plugin: calloc failed.");
+            return (-1);
+        }
+    }
+
+    /* Without a cache, the metric paths are formatted for every value. */
+    cb->graphite_cache = graphite_cache_create (GRAPHITE_CACHE_SIZE);
+
+    if (cb->spill_file != NULL)
+        return (wg_spill_open (cb));
+
+    return (0);
+}
+
+/* Creates connection number "index" of a node with the configuration of its
+ * first connection. Each one needs a spill file of its own, so the index is
+ * appended to the file name. */
+static struct wg_callback *wg_callback_clone (struct wg_callback const *tmpl,
+        size_t index)
+{
+    struct wg_callback *cb;
+
+    cb = calloc (1, sizeof (*cb));
+    if (cb == NULL)
+        return (NULL);
+
+    memcpy (cb, tmpl, sizeof (*cb));
+    cb->conn_index = index;
+    cb->name = NULL;
+    cb->node = NULL;
+    cb->service = NULL;
+    cb->protocol = NULL;
+    cb->prefix = NULL;
+    cb->postfix = NULL;
+    cb->spill_file = NULL;
+    cb->queue = NULL;
+    cb->udp_batch = NULL;
+    cb->graphite_cache = NULL;
+    pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+    pthread_cond_init (&cb->send_cond, /* attr = */ NULL);
+    C_COMPLAIN_INIT (&cb->init_complaint);
+    C_COMPLAIN_INIT (&cb->queue_complaint);
+    C_COMPLAIN_INIT (&cb->spill_complaint);
+
+    if (((tmpl->name != NULL) && ((cb->name = strdup (tmpl->name)) == NULL))
+            || ((cb->node = strdup (tmpl->node)) == NULL)
+            || ((cb->service = strdup (tmpl->service)) == NULL)
+            || ((cb->protocol = strdup (tmpl->protocol)) == NULL)
+            || ((tmpl->prefix != NULL)
+                && ((cb->prefix = strdup (tmpl->prefix)) == NULL))
+            || ((tmpl->postfix != NULL)
+                && ((cb->postfix = strdup (tmpl->postfix)) == NULL)))
+    {
+        wg_callback_free (cb);
+        return (NULL);
+    }
+
+    if (tmpl->spill_file != NULL)
+    {
+        char spill_file[PATH_MAX];
+
+        ssnprintf (spill_file, sizeof (spill_file), "%s.%zu",
+                tmpl->spill_file, index);
+        cb->spill_file = strdup (spill_file);
+        if (cb->spill_file == NULL)
+        {
+            wg_callback_free (cb);
+            return (NULL);
+        }
+    }
+
+    return (cb);
+}
+
 static int wg_config_node (oconfig_item_t *ci)
 {
     struct wg_callback *cb;
+    struct wg_node *node;
     user_data_t user_data;
     char callback_name[DATA_MAX_NAME_LEN];
+    _Bool report_stats = 0;
+    int conns_num = 1;
     int i;
     int status = 0;
 
@@ -493,13 +1410,22 @@ static int wg_config_node (oconfig_item_t *ci)
         return (-1);
     }
     cb->sock_fd = -1;
+    cb->spill_fd = -1;
+    pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+    pthread_cond_init (&cb->send_cond, /* attr = */ NULL);
+    C_COMPLAIN_INIT (&cb->init_complaint);
+    C_COMPLAIN_INIT (&cb->queue_complaint);
+    C_COMPLAIN_INIT (&cb->spill_complaint);
     cb->name = NULL;
     cb->node = strdup (WG_DEFAULT_NODE);
     cb->service = strdup (WG_DEFAULT_SERVICE);
     cb->protocol = strdup (WG_DEFAULT_PROTOCOL);
     cb->last_reconnect_time = cdtime();
     cb->reconnect_interval = 0;
-    cb->reconnect_interval_reached = 0;
+    cb->queue_size = WG_DEFAULT_QUEUE_LENGTH;
+    cb->queue_policy = WG_QUEUE_DROP_NEWEST;
+    cb->spill_size = WG_DEFAULT_SPILL_SIZE;
+    cb->spill_replay_rate = WG_DEFAULT_SPILL_REPLAY_RATE;
     cb->log_send_errors = WG_DEFAULT_LOG_SEND_ERRORS;
     cb->prefix = NULL;
     cb->postfix = NULL;
@@ -517,9 +1443,6 @@ static int wg_config_node (oconfig_item_t *ci)
         }
     }
 
-    pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
-    C_COMPLAIN_INIT (&cb->init_complaint);
-
     for (i = 0; i < ci->children_num; i++)
     {
         oconfig_item_t *child = ci->children + i;
@@ -559,6 +1482,63 @@ static int wg_config_node (oconfig_item_t *ci)
                     GRAPHITE_ALWAYS_APPEND_DS);
         else if (strcasecmp ("EscapeCharacter", child->key) == 0)
             config_set_char (&cb->escape_char, child);
+        else if (strcasecmp ("SendQueueLength", child->key) == 0)
+        {
+            int tmp = 0;
+
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < 1))
+            {
+                ERROR ("write_graphite plugin: The \"SendQueueLength\" "
+                        "option must be positive.");
+                status = -1;
+            }
+            else if (status == 0)
+                cb->queue_size = (size_t) tmp;
+        }
+        else if (strcasecmp ("SendQueuePolicy", child->key) == 0)
+            status = config_set_queue_policy (&cb->queue_policy, child);
+        else if (strcasecmp ("SpillFile", child->key) == 0)
+            status = cf_util_get_string (child, &cb->spill_file);
+        else if (strcasecmp ("SpillSize", child->key) == 0)
+        {
+            double tmp = 0.0;
+
+            status = cf_util_get_double (child, &tmp);
+            if ((status == 0) && (tmp < (double) (sizeof (wg_spill_header_t)
+                            + WG_SPILL_RECORD_SIZE (WG_SEND_BUF_SIZE))))
+            {
+                ERROR ("write_graphite plugin: The \"SpillSize\" option "
+                        "must be at least %zu bytes.",
+                        sizeof (wg_spill_header_t)
+                        + WG_SPILL_RECORD_SIZE (WG_SEND_BUF_SIZE));
+                status = -1;
+            }
+            else if (status == 0)
+                cb->spill_size = (size_t) tmp;
+        }
+        else if (strcasecmp ("SpillReplayRate", child->key) == 0)
+        {
+            status = cf_util_get_double (child, &cb->spill_replay_rate);
+            if ((status == 0) && !(cb->spill_replay_rate >= 0.0))
+            {
+                ERROR ("write_graphite plugin: The \"SpillReplayRate\" "
+                        "option must not be negative.");
+                status = -1;
+            }
+        }
+        else if (strcasecmp ("Connections", child->key) == 0)
+        {
+            status = cf_util_get_int (child, &conns_num);
+            if ((status == 0) && (conns_num < 1))
+            {
+                ERROR ("write_graphite plugin: The \"Connections\" "
+                        "option must be positive.");
+                status = -1;
+            }
+        }
+        else if (strcasecmp ("ReportStats", child->key) == 0)
+            cf_util_get_boolean (child, &report_stats);
         else
         {
             ERROR ("write_graphite plugin: Invalid configuration "
@@ -576,6 +1556,42 @@ static int wg_config_node (oconfig_item_t *ci)
         return (status);
     }
 
+    node = calloc (1, sizeof (*node));
+    if (node != NULL)
+        node->conns = calloc ((size_t) conns_num, sizeof (*node->conns));
+    if ((node == NULL) || (node->conns == NULL))
+    {
+        ERROR ("write_graphite plugin: calloc failed.");
+        if (node != NULL)
+            sfree (node);
+        wg_callback_free (cb);
+        return (-1);
+    }
+
+    cb->conns_num = (size_t) conns_num;
+    node->conns[0] = cb;
+    node->conns_num = 1;
+    for (i = 1; i < conns_num; i++)
+    {
+        node->conns[i] = wg_callback_clone (cb, (size_t) i);
+        if (node->conns[i] == NULL)
+        {
+            ERROR ("write_graphite plugin: Creating connection %i failed.", i);
+            status = -1;
+            break;
+        }
+        node->conns_num++;
+    }
+
+    for (i = 0; (status == 0) && (i < conns_num); i++)
+        status = wg_callback_setup (node->conns[i]);
+
+    if (status != 0)
+    {
+        wg_node_free (node);
+        return (status);
+    }
+
     /* FIXME: Legacy configuration syntax. */
     if (cb->name == NULL)
         ssnprintf (callback_name, sizeof (callback_name), "write_graphite/%s/%s/%s",
@@ -585,13 +1601,17 @@ static int wg_config_node (oconfig_item_t *ci)
                 cb->name);
 
     memset (&user_data, 0, sizeof (user_data));
-    user_data.data = cb;
-    user_data.free_func = wg_callback_free;
-    plugin_register_write (callback_name, wg_write, &user_data);
+    user_data.data = node;
+    user_data.free_func = wg_node_free;
+    plugin_register_write_batch (callback_name, wg_write, &user_data);
 
     user_data.free_func = NULL;
     plugin_register_flush (callback_name, wg_flush, &user_data);
 
+    if (report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                wg_read_stats, /* interval = */ 0, &user_data);
+
     return (0);
 }
 
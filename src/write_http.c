@@ -27,7 +27,9 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_cache.h"
+#include "utils_format_binary.h"
 #include "utils_format_json.h"
+#include "utils_http_sender.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -39,6 +41,10 @@
 # define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
 #endif
 
+#ifndef WRITE_HTTP_DEFAULT_QUEUE_LENGTH
+# define WRITE_HTTP_DEFAULT_QUEUE_LENGTH 64
+#endif
+
 /*
  * Private variables
  */
@@ -66,11 +72,21 @@ struct wh_callback_s
 
 #define WH_FORMAT_COMMAND 0
 #define WH_FORMAT_JSON    1
+#define WH_FORMAT_BINARY  2
         int format;
-
-        CURL *curl;
+        /* Identifiers formatted as JSON, created with the callback. */
+        format_json_cache_t *json_cache;
+        /* The parts already written to the buffer in the binary format. */
+        format_binary_state_t binary_state;
+
+        int max_in_flight;
+        int queue_length;
+        int compress;
+        _Bool report_stats;
         struct curl_slist *headers;
-        char curl_errbuf[CURL_ERROR_SIZE];
+
+        /* Sends full buffers from its own thread, see utils_http_sender.h. */
+        http_sender_t *sender;
 
         char  *send_buffer;
         size_t send_buffer_size;
@@ -82,25 +98,13 @@ struct wh_callback_s
 };
 typedef struct wh_callback_s wh_callback_t;
 
-static void wh_log_http_error (wh_callback_t *cb)
-{
-        if (!cb->log_http_error)
-                return;
-
-        long http_code = 0;
-
-        curl_easy_getinfo (cb->curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-        if (http_code != 200)
-                INFO ("write_http plugin: HTTP Error code: %lu", http_code);
-}
-
 static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
 {
-        memset (cb->send_buffer, 0, cb->send_buffer_size);
+        /* Everything written to the buffer is null-terminated. */
+        cb->send_buffer[0] = 0;
         cb->send_buffer_free = cb->send_buffer_size;
         cb->send_buffer_fill = 0;
-        cb->send_buffer_init_time = cdtime ();
+        cb->send_buffer_init_time = cdtime_coarse ();
 
         if (cb->format == WH_FORMAT_JSON)
         {
@@ -108,74 +112,78 @@ static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
                                 &cb->send_buffer_fill,
                                 &cb->send_buffer_free);
         }
+        else if (cb->format == WH_FORMAT_BINARY)
+                format_binary_initialize (&cb->binary_state);
 } /* }}} wh_reset_buffer */
 
-static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+/* Sets up one of the sender's easy handles. Called by the sender when the
+ * first buffer is submitted. */
+static int wh_curl_setup (CURL *curl, void *user_data) /* {{{ */
 {
-        int status = 0;
-
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
-        status = curl_easy_perform (cb->curl);
-
-        wh_log_http_error (cb);
-
-        if (status != CURLE_OK)
-        {
-                ERROR ("write_http plugin: curl_easy_perform failed with "
-                                "status %i: %s",
-                                status, cb->curl_errbuf);
-        }
-        return (status);
-} /* }}} wh_send_buffer */
-
-static int wh_callback_init (wh_callback_t *cb) /* {{{ */
-{
-        if (cb->curl != NULL)
-                return (0);
-
-        cb->curl = curl_easy_init ();
-        if (cb->curl == NULL)
-        {
-                ERROR ("curl plugin: curl_easy_init failed.");
-                return (-1);
-        }
+        wh_callback_t *cb = user_data;
 
         if (cb->low_speed_limit > 0 && cb->low_speed_time > 0)
         {
-                curl_easy_setopt (cb->curl, CURLOPT_LOW_SPEED_LIMIT,
+                curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT,
                                   (long) (cb->low_speed_limit * cb->low_speed_time));
-                curl_easy_setopt (cb->curl, CURLOPT_LOW_SPEED_TIME,
+                curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME,
                                   (long) cb->low_speed_time);
         }
 
 #ifdef HAVE_CURLOPT_TIMEOUT_MS
         if (cb->timeout > 0)
-                curl_easy_setopt (cb->curl, CURLOPT_TIMEOUT_MS, (long) cb->timeout);
+                curl_easy_setopt (curl, CURLOPT_TIMEOUT_MS, (long) cb->timeout);
 #endif
 
-        curl_easy_setopt (cb->curl, CURLOPT_NOSIGNAL, 1L);
-        curl_easy_setopt (cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+        curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt (curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, cb->headers);
 
-        cb->headers = curl_slist_append (cb->headers, "Accept:  */*");
-        if (cb->format == WH_FORMAT_JSON)
-                cb->headers = curl_slist_append (cb->headers, "Content-Type: application/json");
-        else
-                cb->headers = curl_slist_append (cb->headers, "Content-Type: text/plain");
-        cb->headers = curl_slist_append (cb->headers, "Expect:");
-        curl_easy_setopt (cb->curl, CURLOPT_HTTPHEADER, cb->headers);
-
-        curl_easy_setopt (cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-        curl_easy_setopt (cb->curl, CURLOPT_URL, cb->location);
-        curl_easy_setopt (cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt (cb->curl, CURLOPT_MAXREDIRS, 50L);
+        curl_easy_setopt (curl, CURLOPT_URL, cb->location);
+        curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt (curl, CURLOPT_MAXREDIRS, 50L);
 
         if (cb->user != NULL)
         {
 #ifdef HAVE_CURLOPT_USERNAME
-                curl_easy_setopt (cb->curl, CURLOPT_USERNAME, cb->user);
-                curl_easy_setopt (cb->curl, CURLOPT_PASSWORD,
+                curl_easy_setopt (curl, CURLOPT_USERNAME, cb->user);
+                curl_easy_setopt (curl, CURLOPT_PASSWORD,
                         (cb->pass == NULL) ? "" : cb->pass);
 #else
+                curl_easy_setopt (curl, CURLOPT_USERPWD, cb->credentials);
+#endif
+                curl_easy_setopt (curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+        }
+
+        curl_easy_setopt (curl, CURLOPT_SSL_VERIFYPEER, (long) cb->verify_peer);
+        curl_easy_setopt (curl, CURLOPT_SSL_VERIFYHOST,
+                        cb->verify_host ? 2L : 0L);
+        curl_easy_setopt (curl, CURLOPT_SSLVERSION, cb->sslversion);
+        if (cb->cacert != NULL)
+                curl_easy_setopt (curl, CURLOPT_CAINFO, cb->cacert);
+        if (cb->capath != NULL)
+                curl_easy_setopt (curl, CURLOPT_CAPATH, cb->capath);
+
+        if (cb->clientkey != NULL && cb->clientcert != NULL)
+        {
+            curl_easy_setopt (curl, CURLOPT_SSLKEY, cb->clientkey);
+            curl_easy_setopt (curl, CURLOPT_SSLCERT, cb->clientcert);
+
+            if (cb->clientkeypass != NULL)
+                curl_easy_setopt (curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+        }
+
+        return (0);
+} /* }}} int wh_curl_setup */
+
+static int wh_callback_init (wh_callback_t *cb) /* {{{ */
+{
+        http_sender_config_t conf;
+        char const *encoding;
+
+#ifndef HAVE_CURLOPT_USERNAME
+        if (cb->user != NULL)
+        {
                 size_t credentials_size;
 
                 credentials_size = strlen (cb->user) + 2;
@@ -191,34 +199,67 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 
                 ssnprintf (cb->credentials, credentials_size, "%s:%s",
                                 cb->user, (cb->pass == NULL) ? "" : cb->pass);
-                curl_easy_setopt (cb->curl, CURLOPT_USERPWD, cb->credentials);
-#endif
-                curl_easy_setopt (cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
         }
+#endif
 
-        curl_easy_setopt (cb->curl, CURLOPT_SSL_VERIFYPEER, (long) cb->verify_peer);
-        curl_easy_setopt (cb->curl, CURLOPT_SSL_VERIFYHOST,
-                        cb->verify_host ? 2L : 0L);
-        curl_easy_setopt (cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
-        if (cb->cacert != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_CAINFO, cb->cacert);
-        if (cb->capath != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_CAPATH, cb->capath);
-
-        if (cb->clientkey != NULL && cb->clientcert != NULL)
+        cb->headers = curl_slist_append (cb->headers, "Accept:  */*");
+        if (cb->format == WH_FORMAT_JSON)
+                cb->headers = curl_slist_append (cb->headers, "Content-Type: application/json");
+        else if (cb->format == WH_FORMAT_BINARY)
+                cb->headers = curl_slist_append (cb->headers, "Content-Type: application/octet-stream");
+        else
+                cb->headers = curl_slist_append (cb->headers, "Content-Type: text/plain");
+        cb->headers = curl_slist_append (cb->headers, "Expect:");
+        encoding = http_sender_content_encoding (cb->compress);
+        if (encoding != NULL)
+                cb->headers = curl_slist_append (cb->headers, encoding);
+
+        memset (&conf, 0, sizeof (conf));
+        conf.plugin = "write_http";
+        conf.location = cb->location;
+        conf.buffer_size = cb->send_buffer_size;
+        conf.queue_length = (size_t) cb->queue_length;
+        conf.max_in_flight = cb->max_in_flight;
+        conf.compress = cb->compress;
+        conf.log_http_error = cb->log_http_error;
+        conf.setup = wh_curl_setup;
+        conf.user_data = cb;
+
+        cb->sender = http_sender_create (&conf);
+        if (cb->sender == NULL)
         {
-            curl_easy_setopt (cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-            curl_easy_setopt (cb->curl, CURLOPT_SSLCERT, cb->clientcert);
-
-            if (cb->clientkeypass != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+                ERROR ("write_http plugin: http_sender_create failed.");
+                return (-1);
         }
 
+        cb->send_buffer = http_sender_buffer_get (cb->sender);
+        if (cb->send_buffer == NULL)
+        {
+                ERROR ("write_http plugin: malloc(%zu) failed.",
+                                cb->send_buffer_size);
+                return (-1);
+        }
+        /* Nulls the buffer and sets ..._free and ..._fill. */
         wh_reset_buffer (cb);
 
         return (0);
 } /* }}} int wh_callback_init */
 
+/* Hands the buffer being filled to the sender, which never blocks on the
+ * HTTP server.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+{
+        int status;
+
+        status = http_sender_submit (cb->sender, &cb->send_buffer,
+                        cb->send_buffer_fill);
+        wh_reset_buffer (cb);
+
+        return (status);
+} /* }}} wh_send_buffer */
+
+/* NOTE: You must hold cb->send_lock when calling this function! */
 static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
 {
         int status;
@@ -233,27 +274,27 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
         {
                 cdtime_t now;
 
-                now = cdtime ();
+                now = cdtime_coarse ();
                 if ((cb->send_buffer_init_time + timeout) > now)
                         return (0);
         }
 
-        if (cb->format == WH_FORMAT_COMMAND)
+        if ((cb->format == WH_FORMAT_COMMAND)
+                        || (cb->format == WH_FORMAT_BINARY))
         {
                 if (cb->send_buffer_fill <= 0)
                 {
-                        cb->send_buffer_init_time = cdtime ();
+                        cb->send_buffer_init_time = cdtime_coarse ();
                         return (0);
                 }
 
                 status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
         }
         else if (cb->format == WH_FORMAT_JSON)
         {
                 if (cb->send_buffer_fill <= 2)
                 {
-                        cb->send_buffer_init_time = cdtime ();
+                        cb->send_buffer_init_time = cdtime_coarse ();
                         return (0);
                 }
 
@@ -269,7 +310,6 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                 }
 
                 status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
         }
         else
         {
@@ -295,18 +335,6 @@ static int wh_flush (cdtime_t timeout, /* {{{ */
         cb = user_data->data;
 
         pthread_mutex_lock (&cb->send_lock);
-
-        if (cb->curl == NULL)
-        {
-                status = wh_callback_init (cb);
-                if (status != 0)
-                {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
-                        pthread_mutex_unlock (&cb->send_lock);
-                        return (-1);
-                }
-        }
-
         status = wh_flush_nolock (timeout, cb);
         pthread_mutex_unlock (&cb->send_lock);
 
@@ -322,13 +350,12 @@ static void wh_callback_free (void *data) /* {{{ */
 
         cb = data;
 
-        wh_flush_nolock (/* timeout = */ 0, cb);
-
-        if (cb->curl != NULL)
-        {
-                curl_easy_cleanup (cb->curl);
-                cb->curl = NULL;
-        }
+        /* Hand off the last buffer, then wait for the sender to submit
+         * everything that has been queued. */
+        if (cb->send_buffer != NULL)
+                wh_flush_nolock (/* timeout = */ 0, cb);
+        http_sender_destroy (cb->sender);
+        cb->sender = NULL;
 
         if (cb->headers != NULL)
         {
@@ -347,10 +374,51 @@ static void wh_callback_free (void *data) /* {{{ */
         sfree (cb->clientcert);
         sfree (cb->clientkeypass);
         sfree (cb->send_buffer);
+        format_json_cache_destroy (cb->json_cache);
+
+        pthread_mutex_destroy (&cb->send_lock);
 
         sfree (cb);
 } /* }}} void wh_callback_free */
 
+/* Dispatches the number of full buffers waiting for the sender thread and,
+ * if compression is enabled, the request body sizes before and after it. */
+static int wh_read_stats (user_data_t *user_data) /* {{{ */
+{
+        wh_callback_t *cb = user_data->data;
+        value_list_t vl = VALUE_LIST_INIT;
+        value_t values[2];
+        size_t queue_length;
+        derive_t uncompressed;
+        derive_t compressed;
+
+        http_sender_stats (cb->sender, &queue_length,
+                        &uncompressed, &compressed);
+
+        vl.values = values;
+        vl.values_len = 1;
+        sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+        sstrncpy (vl.plugin, "write_http", sizeof (vl.plugin));
+        if (cb->name != NULL)
+                sstrncpy (vl.plugin_instance, cb->name,
+                                sizeof (vl.plugin_instance));
+
+        vl.values[0].gauge = (gauge_t) queue_length;
+        sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+        plugin_dispatch_values (&vl);
+
+        if (cb->compress == HTTP_COMPRESS_NONE)
+                return (0);
+
+        vl.values_len = 2;
+        vl.values[0].derive = uncompressed;
+        vl.values[1].derive = compressed;
+        sstrncpy (vl.type, "compression", sizeof (vl.type));
+        plugin_dispatch_values (&vl);
+
+        return (0);
+} /* }}} int wh_read_stats */
+
 static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{{ */
                 wh_callback_t *cb)
 {
@@ -397,17 +465,6 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
 
         pthread_mutex_lock (&cb->send_lock);
 
-        if (cb->curl == NULL)
-        {
-                status = wh_callback_init (cb);
-                if (status != 0)
-                {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
-                        pthread_mutex_unlock (&cb->send_lock);
-                        return (-1);
-                }
-        }
-
         if (command_len >= cb->send_buffer_free)
         {
                 status = wh_flush_nolock (/* timeout = */ 0, cb);
@@ -441,26 +498,73 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
 static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ */
                 wh_callback_t *cb)
 {
+        size_t needed = 0;
         int status;
 
         pthread_mutex_lock (&cb->send_lock);
 
-        if (cb->curl == NULL)
+        status = format_json_value_list_cached (cb->json_cache,
+                        cb->send_buffer,
+                        &cb->send_buffer_fill,
+                        &cb->send_buffer_free,
+                        ds, vl, cb->store_rates, &needed);
+        if ((status == (-ENOMEM)) && (needed > cb->send_buffer_size))
         {
-                status = wh_callback_init (cb);
+                /* Flushing wouldn't make enough room. */
+                ERROR ("write_http plugin: <%s> A value list needs %zu "
+                                "bytes, but the buffer only has %zu. "
+                                "Increase \"BufferSize\".",
+                                cb->location, needed, cb->send_buffer_size);
+                pthread_mutex_unlock (&cb->send_lock);
+                return (status);
+        }
+        else if (status == (-ENOMEM))
+        {
+                status = wh_flush_nolock (/* timeout = */ 0, cb);
                 if (status != 0)
                 {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
+                        wh_reset_buffer (cb);
                         pthread_mutex_unlock (&cb->send_lock);
-                        return (-1);
+                        return (status);
                 }
+
+                status = format_json_value_list_cached (cb->json_cache,
+                                cb->send_buffer,
+                                &cb->send_buffer_fill,
+                                &cb->send_buffer_free,
+                                ds, vl, cb->store_rates,
+                                /* ret_needed = */ NULL);
         }
+        if (status != 0)
+        {
+                pthread_mutex_unlock (&cb->send_lock);
+                return (status);
+        }
+
+        DEBUG ("write_http plugin: <%s> buffer %zu/%zu (%g%%)",
+                        cb->location,
+                        cb->send_buffer_fill, cb->send_buffer_size,
+                        100.0 * ((double) cb->send_buffer_fill) / ((double) cb->send_buffer_size));
 
-        status = format_json_value_list (cb->send_buffer,
+        /* Check if we have enough space for this command. */
+        pthread_mutex_unlock (&cb->send_lock);
+
+        return (0);
+} /* }}} int wh_write_json */
+
+static int wh_write_binary (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+                wh_callback_t *cb)
+{
+        int status;
+
+        pthread_mutex_lock (&cb->send_lock);
+
+        status = format_binary_value_list (&cb->binary_state,
+                        cb->send_buffer,
                         &cb->send_buffer_fill,
                         &cb->send_buffer_free,
                         ds, vl, cb->store_rates);
-        if (status == (-ENOMEM))
+        if ((status == (-ENOMEM)) && (cb->send_buffer_fill > 0))
         {
                 status = wh_flush_nolock (/* timeout = */ 0, cb);
                 if (status != 0)
@@ -470,11 +574,17 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
                         return (status);
                 }
 
-                status = format_json_value_list (cb->send_buffer,
+                status = format_binary_value_list (&cb->binary_state,
+                                cb->send_buffer,
                                 &cb->send_buffer_fill,
                                 &cb->send_buffer_free,
                                 ds, vl, cb->store_rates);
         }
+        if (status == (-ENOMEM))
+                ERROR ("write_http plugin: <%s> A value list doesn't fit "
+                                "into the buffer of %zu bytes. "
+                                "Increase \"BufferSize\".",
+                                cb->location, cb->send_buffer_size);
         if (status != 0)
         {
                 pthread_mutex_unlock (&cb->send_lock);
@@ -486,11 +596,10 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
                         cb->send_buffer_fill, cb->send_buffer_size,
                         100.0 * ((double) cb->send_buffer_fill) / ((double) cb->send_buffer_size));
 
-        /* Check if we have enough space for this command. */
         pthread_mutex_unlock (&cb->send_lock);
 
         return (0);
-} /* }}} int wh_write_json */
+} /* }}} int wh_write_binary */
 
 static int wh_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
                 user_data_t *user_data)
@@ -505,6 +614,8 @@ static int wh_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
 
         if (cb->format == WH_FORMAT_JSON)
                 status = wh_write_json (ds, vl, cb);
+        else if (cb->format == WH_FORMAT_BINARY)
+                status = wh_write_binary (ds, vl, cb);
         else
                 status = wh_write_command (ds, vl, cb);
 
@@ -529,6 +640,8 @@ static int config_set_format (wh_callback_t *cb, /* {{{ */
                 cb->format = WH_FORMAT_COMMAND;
         else if (strcasecmp ("JSON", string) == 0)
                 cb->format = WH_FORMAT_JSON;
+        else if (strcasecmp ("Binary", string) == 0)
+                cb->format = WH_FORMAT_BINARY;
         else
         {
                 ERROR ("write_http plugin: Invalid format string: %s",
@@ -581,7 +694,8 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
         cb->timeout = 0;
         cb->log_http_error = 0;
         cb->headers = NULL;
-
+        cb->max_in_flight = 1;
+        cb->queue_length = WRITE_HTTP_DEFAULT_QUEUE_LENGTH;
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
 
@@ -662,6 +776,31 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                         status = cf_util_get_boolean (child, &cb->log_http_error);
                 else if (strcasecmp ("Header", child->key) == 0)
                         status = wh_config_append_string ("Header", &cb->headers, child);
+                else if (strcasecmp ("MaxInFlight", child->key) == 0)
+                {
+                        status = cf_util_get_int (child, &cb->max_in_flight);
+                        if ((status == 0) && (cb->max_in_flight < 1))
+                        {
+                                ERROR ("write_http plugin: MaxInFlight must be "
+                                                "at least 1.");
+                                status = EINVAL;
+                        }
+                }
+                else if (strcasecmp ("SendQueueLength", child->key) == 0)
+                {
+                        status = cf_util_get_int (child, &cb->queue_length);
+                        if ((status == 0) && (cb->queue_length < 1))
+                        {
+                                ERROR ("write_http plugin: SendQueueLength "
+                                                "must be at least 1.");
+                                status = EINVAL;
+                        }
+                }
+                else if (strcasecmp ("Compress", child->key) == 0)
+                        status = http_sender_config_compress (child,
+                                        "write_http", &cb->compress);
+                else if (strcasecmp ("ReportStats", child->key) == 0)
+                        status = cf_util_get_boolean (child, &cb->report_stats);
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -698,16 +837,16 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                 ERROR ("write_http plugin: Ignoring invalid BufferSize setting (%d).",
                                 buffer_size);
 
-        /* Allocate the buffer. */
-        cb->send_buffer = malloc (cb->send_buffer_size);
-        if (cb->send_buffer == NULL)
+        status = wh_callback_init (cb);
+        if (status != 0)
         {
-                ERROR ("write_http plugin: malloc(%zu) failed.", cb->send_buffer_size);
                 wh_callback_free (cb);
-                return (-1);
+                return (status);
         }
-        /* Nulls the buffer and sets ..._free and ..._fill. */
-        wh_reset_buffer (cb);
+
+        /* Without the cache, the identifiers are formatted each time. */
+        if (cb->format == WH_FORMAT_JSON)
+                cb->json_cache = format_json_cache_create (FORMAT_JSON_CACHE_SIZE);
 
         ssnprintf (callback_name, sizeof (callback_name), "write_http/%s",
                         cb->name);
@@ -719,6 +858,10 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
         user_data.free_func = NULL;
         plugin_register_flush (callback_name, wh_flush, &user_data);
 
+        if (cb->report_stats)
+                plugin_register_complex_read (/* group = */ NULL, callback_name,
+                                wh_read_stats, /* interval = */ 0, &user_data);
+
         user_data.free_func = wh_callback_free;
         plugin_register_write (callback_name, wh_write, &user_data);
 
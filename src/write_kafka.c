@@ -30,9 +30,12 @@
 #include "configfile.h"
 #include "utils_cache.h"
 #include "utils_cmd_putval.h"
+#include "utils_complain.h"
+#include "utils_format_binary.h"
 #include "utils_format_graphite.h"
 #include "utils_format_json.h"
-#include "utils_crc32.h"
+#include "utils_hash.h"
+#include "utils_intern.h"
 
 #include <stdint.h>
 #include <librdkafka/rdkafka.h>
@@ -40,10 +43,25 @@
 #include <zlib.h>
 #include <errno.h>
 
+/* Formatted value lists waiting to be sent as one message. */
+struct kafka_batch_s {
+    char                        *buffer;
+    size_t                       fill;
+    cdtime_t                     first;
+    /* The parts already written to the buffer by format_binary. */
+    format_binary_state_t        binary_state;
+};
+typedef struct kafka_batch_s kafka_batch_t;
+
+#define KAFKA_FORMAT_BUFFER_SIZE 8192
+#define KAFKA_DEFAULT_BATCHES    16
+#define KAFKA_SHUTDOWN_POLLS     50
+
 struct kafka_topic_context {
 #define KAFKA_FORMAT_JSON        0
 #define KAFKA_FORMAT_COMMAND     1
 #define KAFKA_FORMAT_GRAPHITE    2
+#define KAFKA_FORMAT_BINARY      3
     uint8_t                      format;
     unsigned int                 graphite_flags;
     _Bool                        store_rates;
@@ -52,10 +70,27 @@ struct kafka_topic_context {
     rd_kafka_conf_t             *kafka_conf;
     rd_kafka_t                  *kafka;
     char                        *key;
+    _Bool                        random_key;
     char                        *prefix;
     char                        *postfix;
     char                         escape_char;
     char                        *topic_name;
+    graphite_cache_t            *graphite_cache;
+    format_json_cache_t         *json_cache;
+
+    /* If zero, every value list is sent in a message of its own. */
+    size_t                       max_message_size;
+    cdtime_t                     linger;
+    kafka_batch_t               *batches;
+    size_t                       batches_num;
+
+    _Bool                        report_stats;
+    c_complain_t                 produce_complaint;
+    /* Delivery reports received since the statistics were last read. */
+    uint64_t                     delivered_num;
+    uint64_t                     delivered_latency_ms;
+    derive_t                     delivery_failed;
+
     pthread_mutex_t              lock;
 };
 
@@ -78,16 +113,49 @@ static int32_t kafka_partition(const rd_kafka_topic_t *rkt,
                                const void *keydata, size_t keylen,
                                int32_t partition_cnt, void *p, void *m)
 {
-    uint32_t key = *((uint32_t *)keydata );
-    uint32_t target = key % partition_cnt;
+    uint32_t key;
+    uint32_t target;
     int32_t  i = partition_cnt;
 
+    /* The keys set by the plugin itself are 32 bit hashes already. Other keys
+     * are hashed so that all of their bytes are taken into account. */
+    if (keylen == sizeof(key))
+        memcpy(&key, keydata, sizeof(key));
+    else if (keylen > 0)
+        key = hash_crc32(0, keydata, keylen);
+    else
+        key = (uint32_t) rand();
+
+    target = key % partition_cnt;
     while (--i > 0 && !rd_kafka_topic_partition_available(rkt, target)) {
         target = (target + 1) % partition_cnt;
     }
     return target;
 }
 
+#ifdef HAVE_LIBRDKAFKA_DR_MSG_CB
+static void kafka_delivery_report(rd_kafka_t *rk, /* {{{ */
+                                  const rd_kafka_message_t *msg,
+                                  void *opaque)
+{
+    struct kafka_topic_context *ctx = opaque;
+    /* The message's opaque holds the time it was produced at, in
+     * milliseconds. Truncating both times to 32 bits keeps the difference
+     * correct. */
+    uint32_t sent = (uint32_t) (uintptr_t) msg->_private;
+    uint32_t now = (uint32_t) CDTIME_T_TO_MS(cdtime());
+
+    pthread_mutex_lock (&ctx->lock);
+    if (msg->err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        ctx->delivery_failed++;
+    } else {
+        ctx->delivered_num++;
+        ctx->delivered_latency_ms += (uint32_t) (now - sent);
+    }
+    pthread_mutex_unlock (&ctx->lock);
+} /* }}} void kafka_delivery_report */
+#endif
+
 static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 {
     char                         errbuf[1024];
@@ -142,6 +210,238 @@ static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 
 } /* }}} int kafka_handle */
 
+/* Does not need the lock: rd_kafka_produce() is thread-safe. */
+static int kafka_produce(struct kafka_topic_context *ctx, /* {{{ */
+                         char *buffer, size_t buffer_len,
+                         void *key, size_t keylen)
+{
+    uint32_t sent = (uint32_t) CDTIME_T_TO_MS(cdtime());
+
+    if (rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
+                         RD_KAFKA_MSG_F_COPY, buffer, buffer_len,
+                         key, keylen, (void *) (uintptr_t) sent) != 0) {
+        c_complain (LOG_ERR, &ctx->produce_complaint,
+                    "write_kafka plugin: Producing a message to topic \"%s\" "
+                    "failed: %s", ctx->topic_name,
+                    rd_kafka_err2str(rd_kafka_errno2err(errno)));
+        return -1;
+    }
+
+    c_release (LOG_INFO, &ctx->produce_complaint,
+               "write_kafka plugin: Producing messages to topic \"%s\" "
+               "succeeded again.", ctx->topic_name);
+    return 0;
+} /* }}} int kafka_produce */
+
+static int kafka_batch_send_nolock(struct kafka_topic_context *ctx, /* {{{ */
+                                   size_t idx)
+{
+    kafka_batch_t *b = ctx->batches + idx;
+    uint32_t       batch_key = (uint32_t) idx;
+    void          *key = &batch_key;
+    size_t         keylen = sizeof(batch_key);
+    int            status;
+
+    if (b->fill == 0)
+        return 0;
+
+    /* Turn the leading comma added by format_json_value_list() into the
+     * opening bracket of the array. There is always room for the closing
+     * one, see kafka_batch_add_nolock(). */
+    if (ctx->format == KAFKA_FORMAT_JSON) {
+        b->buffer[0] = '[';
+        b->buffer[b->fill] = ']';
+        b->fill++;
+    }
+
+    if (ctx->key != NULL) {
+        key = ctx->key;
+        keylen = strlen(ctx->key);
+    } else if (ctx->random_key) {
+        key = NULL;
+        keylen = 0;
+    }
+
+    status = kafka_produce(ctx, b->buffer, b->fill, key, keylen);
+    b->fill = 0;
+    return status;
+} /* }}} int kafka_batch_send_nolock */
+
+static int kafka_batch_add_nolock(struct kafka_topic_context *ctx, /* {{{ */
+                                  size_t idx, char const *data, size_t len)
+{
+    kafka_batch_t *b = ctx->batches + idx;
+    int            status = 0;
+
+    /* One byte is kept free for the closing bracket of JSON arrays. The
+     * configuration makes sure that a single value list always fits. */
+    if (b->fill + len + 1 > ctx->max_message_size)
+        status = kafka_batch_send_nolock(ctx, idx);
+
+    if (b->buffer == NULL) {
+        if ((b->buffer = malloc(ctx->max_message_size)) == NULL) {
+            ERROR("write_kafka plugin: malloc failed.");
+            return ENOMEM;
+        }
+    }
+
+    if (b->fill == 0)
+        b->first = cdtime();
+
+    memcpy(b->buffer + b->fill, data, len);
+    b->fill += len;
+
+    if ((cdtime() - b->first) >= ctx->linger)
+        status = kafka_batch_send_nolock(ctx, idx);
+
+    return status;
+} /* }}} int kafka_batch_add_nolock */
+
+/* The binary format only repeats the parts of the identifier which changed,
+ * so value lists are formatted right into the batch they are sent with. */
+static int kafka_batch_add_binary_nolock(struct kafka_topic_context *ctx, /* {{{ */
+                                         size_t idx, const data_set_t *ds,
+                                         const value_list_t *vl)
+{
+    kafka_batch_t *b = ctx->batches + idx;
+    size_t         bfree;
+    int            status = 0;
+
+    if (b->buffer == NULL) {
+        if ((b->buffer = malloc(ctx->max_message_size)) == NULL) {
+            ERROR("write_kafka plugin: malloc failed.");
+            return ENOMEM;
+        }
+    }
+
+    if (b->fill == 0) {
+        format_binary_initialize(&b->binary_state);
+        b->first = cdtime();
+    }
+
+    bfree = ctx->max_message_size - b->fill;
+    status = format_binary_value_list(&b->binary_state, b->buffer, &b->fill,
+                                      &bfree, ds, vl, ctx->store_rates);
+    if ((status == -ENOMEM) && (b->fill > 0)) {
+        (void) kafka_batch_send_nolock(ctx, idx);
+
+        format_binary_initialize(&b->binary_state);
+        b->first = cdtime();
+        bfree = ctx->max_message_size;
+        status = format_binary_value_list(&b->binary_state, b->buffer,
+                                          &b->fill, &bfree, ds, vl,
+                                          ctx->store_rates);
+    }
+    if (status != 0) {
+        ERROR("write_kafka plugin: format_binary_value_list failed "
+              "with status %i.", status);
+        return status;
+    }
+
+    if ((cdtime() - b->first) >= ctx->linger)
+        status = kafka_batch_send_nolock(ctx, idx);
+
+    return status;
+} /* }}} int kafka_batch_add_binary_nolock */
+
+/* Sends all batches which have waited for at least "timeout". */
+static int kafka_flush_batches(struct kafka_topic_context *ctx, /* {{{ */
+                               cdtime_t timeout)
+{
+    cdtime_t now = cdtime();
+    rd_kafka_t *kafka;
+    size_t i;
+    int status = 0;
+
+    pthread_mutex_lock (&ctx->lock);
+    for (i = 0; i < ctx->batches_num; i++) {
+        kafka_batch_t *b = ctx->batches + i;
+
+        if ((b->fill > 0) && ((now - b->first) >= timeout)
+            && (kafka_batch_send_nolock(ctx, i) != 0))
+            status = -1;
+    }
+    kafka = ctx->kafka;
+    pthread_mutex_unlock (&ctx->lock);
+
+    /* Serves the delivery reports, which take the lock. */
+    if (kafka != NULL)
+        rd_kafka_poll(kafka, 0);
+
+    return status;
+} /* }}} int kafka_flush_batches */
+
+static int kafka_flush(cdtime_t timeout, /* {{{ */
+                       const char *identifier __attribute__((unused)),
+                       user_data_t *ud)
+{
+    return kafka_flush_batches(ud->data, timeout);
+} /* }}} int kafka_flush */
+
+static int kafka_linger(user_data_t *ud) /* {{{ */
+{
+    struct kafka_topic_context *ctx = ud->data;
+
+    return kafka_flush_batches(ctx, ctx->linger);
+} /* }}} int kafka_linger */
+
+static int kafka_read_stats(user_data_t *ud) /* {{{ */
+{
+    struct kafka_topic_context *ctx = ud->data;
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t      values[1];
+    rd_kafka_t  *kafka;
+#ifdef HAVE_LIBRDKAFKA_DR_MSG_CB
+    uint64_t     delivered_num;
+    uint64_t     delivered_latency_ms;
+    derive_t     delivery_failed;
+#endif
+
+    pthread_mutex_lock (&ctx->lock);
+    kafka = ctx->kafka;
+    pthread_mutex_unlock (&ctx->lock);
+
+    if (kafka != NULL)
+        rd_kafka_poll(kafka, 0);
+
+    vl.values = values;
+    vl.values_len = 1;
+    sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+    sstrncpy (vl.plugin, "write_kafka", sizeof (vl.plugin));
+    sstrncpy (vl.plugin_instance, ctx->topic_name,
+              sizeof (vl.plugin_instance));
+
+    /* Messages not yet acknowledged by the brokers. */
+    vl.values[0].gauge = (kafka != NULL)
+        ? (gauge_t) rd_kafka_outq_len(kafka) : 0.0;
+    sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+    plugin_dispatch_values (&vl);
+
+#ifdef HAVE_LIBRDKAFKA_DR_MSG_CB
+    pthread_mutex_lock (&ctx->lock);
+    delivered_num = ctx->delivered_num;
+    delivered_latency_ms = ctx->delivered_latency_ms;
+    delivery_failed = ctx->delivery_failed;
+    ctx->delivered_num = 0;
+    ctx->delivered_latency_ms = 0;
+    pthread_mutex_unlock (&ctx->lock);
+
+    /* Average time from producing a message to its delivery report. */
+    vl.values[0].gauge = (delivered_num > 0)
+        ? ((gauge_t) delivered_latency_ms) / (1000.0 * delivered_num) : NAN;
+    sstrncpy (vl.type, "latency", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "delivery", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    vl.values[0].derive = delivery_failed;
+    sstrncpy (vl.type, "derive", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "delivery_failed", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+#endif
+
+    return 0;
+} /* }}} int kafka_read_stats */
+
 static int kafka_write(const data_set_t *ds, /* {{{ */
           const value_list_t *vl,
           user_data_t *ud)
@@ -149,7 +449,8 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
     int      status = 0;
     void    *key;
     size_t   keylen = 0;
-    char     buffer[8192];
+    uint32_t hash;
+    char     buffer[KAFKA_FORMAT_BUFFER_SIZE];
     size_t   bfree = sizeof(buffer);
     size_t   bfill = 0;
     size_t   blen = 0;
@@ -164,6 +465,10 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
     if( status != 0 )
         return status;
 
+    /* All values of one identifier end up in the same partition, so that
+     * consumers see them in order. */
+    hash = identifier_hash_vl(vl);
+
     bzero(buffer, sizeof(buffer));
 
     switch (ctx->format) {
@@ -178,15 +483,26 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
         break;
     case KAFKA_FORMAT_JSON:
         format_json_initialize(buffer, &bfill, &bfree);
-        format_json_value_list(buffer, &bfill, &bfree, ds, vl,
-                               ctx->store_rates);
-        format_json_finalize(buffer, &bfill, &bfree);
+        status = format_json_value_list_cached(ctx->json_cache,
+                                               buffer, &bfill, &bfree, ds, vl,
+                                               ctx->store_rates,
+                                               /* ret_needed = */ NULL);
+        if (status != 0) {
+            ERROR("write_kafka plugin: format_json_value_list failed "
+                  "with status %i.", status);
+            return status;
+        }
+        /* Batches are turned into an array when they are sent. */
+        if (ctx->max_message_size == 0)
+            format_json_finalize(buffer, &bfill, &bfree);
         blen = strlen(buffer);
         break;
     case KAFKA_FORMAT_GRAPHITE:
-        status = format_graphite(buffer, sizeof(buffer), ds, vl,
-                                 ctx->prefix, ctx->postfix, ctx->escape_char,
-                                 ctx->graphite_flags);
+        status = format_graphite_cached(ctx->graphite_cache,
+                                        buffer, sizeof(buffer), ds, vl,
+                                        ctx->prefix, ctx->postfix,
+                                        ctx->escape_char,
+                                        ctx->graphite_flags);
         if (status != 0) {
             ERROR("write_kafka plugin: format_graphite failed with status %i.",
                   status);
@@ -194,18 +510,56 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
         }
         blen = strlen(buffer);
         break;
+    case KAFKA_FORMAT_BINARY:
+        if (ctx->max_message_size > 0) {
+            pthread_mutex_lock (&ctx->lock);
+            status = kafka_batch_add_binary_nolock(ctx,
+                                                   hash % ctx->batches_num,
+                                                   ds, vl);
+            pthread_mutex_unlock (&ctx->lock);
+            rd_kafka_poll(ctx->kafka, 0);
+            return status;
+        }
+        {
+            format_binary_state_t state;
+
+            format_binary_initialize(&state);
+            status = format_binary_value_list(&state, buffer, &bfill, &bfree,
+                                              ds, vl, ctx->store_rates);
+        }
+        if (status != 0) {
+            ERROR("write_kafka plugin: format_binary_value_list failed "
+                  "with status %i.", status);
+            return status;
+        }
+        blen = bfill;
+        break;
     default:
         ERROR("write_kafka plugin: invalid format %i.", ctx->format);
         return -1;
     }
 
-    key = ctx->key;
-    if (key != NULL)
-        keylen = strlen (key);
+    if (ctx->max_message_size > 0) {
+        pthread_mutex_lock (&ctx->lock);
+        status = kafka_batch_add_nolock(ctx, hash % ctx->batches_num,
+                                        buffer, blen);
+        pthread_mutex_unlock (&ctx->lock);
+    } else {
+        if (ctx->key != NULL) {
+            key = ctx->key;
+            keylen = strlen(ctx->key);
+        } else if (ctx->random_key) {
+            key = NULL;
+        } else {
+            key = &hash;
+            keylen = sizeof(hash);
+        }
+
+        status = kafka_produce(ctx, buffer, blen, key, keylen);
+    }
 
-    rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
-                     RD_KAFKA_MSG_F_COPY, buffer, blen,
-                     key, keylen, NULL);
+    /* Serves the delivery reports, which take the lock. */
+    rd_kafka_poll(ctx->kafka, 0);
 
     return status;
 } /* }}} int kafka_write */
@@ -213,10 +567,19 @@ static int kafka_write(const data_set_t *ds, /* {{{ */
 static void kafka_topic_context_free(void *p) /* {{{ */
 {
     struct kafka_topic_context *ctx = p;
+    size_t i;
 
     if (ctx == NULL)
         return;
 
+    /* Send what is left and give the brokers some time to acknowledge it. */
+    if (ctx->kafka != NULL && ctx->topic != NULL) {
+        kafka_flush_batches(ctx, 0);
+        for (i = 0; i < KAFKA_SHUTDOWN_POLLS
+                 && rd_kafka_outq_len(ctx->kafka) > 0; i++)
+            rd_kafka_poll(ctx->kafka, 100);
+    }
+
     if (ctx->topic_name != NULL)
         sfree(ctx->topic_name);
     if (ctx->topic != NULL)
@@ -227,15 +590,27 @@ static void kafka_topic_context_free(void *p) /* {{{ */
         rd_kafka_conf_destroy(ctx->kafka_conf);
     if (ctx->kafka != NULL)
         rd_kafka_destroy(ctx->kafka);
+    graphite_cache_destroy(ctx->graphite_cache);
+    format_json_cache_destroy(ctx->json_cache);
 
+    for (i = 0; i < ctx->batches_num; i++)
+        sfree(ctx->batches[i].buffer);
+    sfree(ctx->batches);
+    sfree(ctx->key);
+    sfree(ctx->prefix);
+    sfree(ctx->postfix);
+
+    pthread_mutex_destroy (&ctx->lock);
     sfree(ctx);
 } /* }}} void kafka_topic_context_free */
 
 static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{ */
 {
-    int                          status;
+    int                          status = 0;
     int                          i;
     struct kafka_topic_context  *tctx;
+    int                          max_message_size = 0;
+    int                          batches_num = KAFKA_DEFAULT_BATCHES;
     char                        *key = NULL;
     char                        *val;
     char                         callback_name[DATA_MAX_NAME_LEN];
@@ -252,8 +627,12 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
     tctx->escape_char = '.';
     tctx->store_rates = 1;
     tctx->format = KAFKA_FORMAT_JSON;
+    tctx->linger = TIME_T_TO_CDTIME_T(1);
+    C_COMPLAIN_INIT (&tctx->produce_complaint);
+    pthread_mutex_init (&tctx->lock, /* attr = */ NULL);
 
     if ((tctx->kafka_conf = rd_kafka_conf_dup(conf)) == NULL) {
+        pthread_mutex_destroy (&tctx->lock);
         sfree(tctx);
         ERROR("write_kafka plugin: cannot allocate memory for kafka config");
         return;
@@ -262,9 +641,14 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
 #ifdef HAVE_LIBRDKAFKA_LOG_CB
     rd_kafka_conf_set_log_cb(tctx->kafka_conf, kafka_log);
 #endif
+#ifdef HAVE_LIBRDKAFKA_DR_MSG_CB
+    rd_kafka_conf_set_dr_msg_cb(tctx->kafka_conf, kafka_delivery_report);
+#endif
+    rd_kafka_conf_set_opaque(tctx->kafka_conf, tctx);
 
     if ((tctx->conf = rd_kafka_topic_conf_new()) == NULL) {
         rd_kafka_conf_destroy(tctx->kafka_conf);
+        pthread_mutex_destroy (&tctx->lock);
         sfree(tctx);
         ERROR ("write_kafka plugin: cannot create topic configuration.");
         return;
@@ -314,7 +698,11 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
             }
 
         } else if (strcasecmp ("Key", child->key) == 0)  {
-            cf_util_get_string (child, &tctx->key);
+            status = cf_util_get_string (child, &tctx->key);
+            if ((status == 0) && (strcasecmp (tctx->key, "Random") == 0)) {
+                sfree (tctx->key);
+                tctx->random_key = 1;
+            }
         } else if (strcasecmp ("Format", child->key) == 0) {
             status = cf_util_get_string(child, &key);
             if (status != 0)
@@ -331,6 +719,9 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
             } else if (strcasecmp(key, "Json") == 0) {
                 tctx->format = KAFKA_FORMAT_JSON;
 
+            } else if (strcasecmp(key, "Binary") == 0) {
+                tctx->format = KAFKA_FORMAT_BINARY;
+
             } else {
                 WARNING ("write_kafka plugin: Invalid format string: %s",
                          key);
@@ -363,6 +754,19 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
                         "only one character. Others will be ignored.");
             tctx->escape_char = tmp_buff[0];
             sfree (tmp_buff);
+        } else if (strcasecmp ("MaxMessageSize", child->key) == 0) {
+            status = cf_util_get_int (child, &max_message_size);
+        } else if (strcasecmp ("Linger", child->key) == 0) {
+            status = cf_util_get_cdtime (child, &tctx->linger);
+        } else if (strcasecmp ("Batches", child->key) == 0) {
+            status = cf_util_get_int (child, &batches_num);
+            if ((status == 0) && (batches_num < 1)) {
+                WARNING ("write_kafka plugin: \"Batches\" must be at "
+                        "least 1.");
+                status = -1;
+            }
+        } else if (strcasecmp ("ReportStats", child->key) == 0) {
+            status = cf_util_get_boolean (child, &tctx->report_stats);
         } else {
             WARNING ("write_kafka plugin: Invalid directive: %s.", child->key);
         }
@@ -371,6 +775,38 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
             break;
     }
 
+    if (status != 0)
+        goto errout;
+
+    /* Without a cache, the metric paths and JSON identifiers are formatted
+     * for every value. */
+    if (tctx->format == KAFKA_FORMAT_GRAPHITE)
+        tctx->graphite_cache = graphite_cache_create(GRAPHITE_CACHE_SIZE);
+    else if (tctx->format == KAFKA_FORMAT_JSON)
+        tctx->json_cache = format_json_cache_create(FORMAT_JSON_CACHE_SIZE);
+
+    if (max_message_size > 0) {
+        /* A batch must be able to hold any single value list, plus the
+         * closing bracket of a JSON array. */
+        if (max_message_size <= KAFKA_FORMAT_BUFFER_SIZE) {
+            WARNING ("write_kafka plugin: Raising \"MaxMessageSize\" of "
+                    "topic \"%s\" to %i bytes.", tctx->topic_name,
+                    KAFKA_FORMAT_BUFFER_SIZE + 1);
+            max_message_size = KAFKA_FORMAT_BUFFER_SIZE + 1;
+        }
+        tctx->max_message_size = (size_t) max_message_size;
+
+        /* With a fixed key, all messages go to the same partition anyway. */
+        if ((tctx->key != NULL) || tctx->random_key)
+            batches_num = 1;
+        tctx->batches = calloc((size_t) batches_num, sizeof(*tctx->batches));
+        if (tctx->batches == NULL) {
+            ERROR ("write_kafka plugin: calloc failed.");
+            goto errout;
+        }
+        tctx->batches_num = (size_t) batches_num;
+    }
+
     rd_kafka_topic_conf_set_partitioner_cb(tctx->conf, kafka_partition);
     rd_kafka_topic_conf_set_opaque(tctx->conf, tctx);
 
@@ -388,7 +824,23 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
         goto errout;
     }
 
-    pthread_mutex_init (&tctx->lock, /* attr = */ NULL);
+    /* The write callback owns the context. */
+    ud.free_func = NULL;
+    plugin_register_flush (callback_name, kafka_flush, &ud);
+
+    if (tctx->max_message_size > 0) {
+        char linger_name[DATA_MAX_NAME_LEN];
+
+        ssnprintf(linger_name, sizeof(linger_name),
+                  "write_kafka/%s/linger", tctx->topic_name);
+        plugin_register_complex_read (/* group = */ NULL, linger_name,
+                                      kafka_linger, tctx->linger, &ud);
+    }
+
+    if (tctx->report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                                      kafka_read_stats,
+                                      /* interval = */ 0, &ud);
 
     return;
  errout:
@@ -398,6 +850,13 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
         rd_kafka_topic_conf_destroy(tctx->conf);
     if (tctx->kafka_conf != NULL)
         rd_kafka_conf_destroy(tctx->kafka_conf);
+    sfree(tctx->batches);
+    sfree(tctx->key);
+    sfree(tctx->prefix);
+    sfree(tctx->postfix);
+    graphite_cache_destroy(tctx->graphite_cache);
+    format_json_cache_destroy(tctx->json_cache);
+    pthread_mutex_destroy (&tctx->lock);
     sfree(tctx);
 } /* }}} int kafka_config_topic */
 
@@ -31,6 +31,7 @@
 #include "configfile.h"
 
 #include "utils_format_graphite.h"
+#include "utils_format_json.h"
 
 /* Folks without pthread will need to disable this plugin. */
 #include <pthread.h>
@@ -38,10 +39,56 @@
 #include <netdb.h>
 
 #define WL_BUF_SIZE 8192
+#define WL_DEFAULT_BUFFER_SIZE 65536
 
-static int wl_write_messages (const data_set_t *ds, const value_list_t *vl)
+#define WL_FORMAT_GRAPHITE 0
+#define WL_FORMAT_JSON     1
+
+/*
+ * Without a "File", every value list is logged with INFO(). With one, the
+ * formatted value lists are collected in "wl_buffer" and written with a single
+ * write(2) when it is full or flushed, bypassing the log callbacks.
+ */
+static int wl_format = WL_FORMAT_GRAPHITE;
+static char *wl_file = NULL;
+static size_t wl_buffer_size = WL_DEFAULT_BUFFER_SIZE;
+
+static pthread_mutex_t wl_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wl_fd = -1;
+static char *wl_buffer = NULL;
+static size_t wl_buffer_fill = 0;
+static cdtime_t wl_buffer_init_time = 0;
+
+static graphite_cache_t *wl_graphite_cache = NULL;
+static format_json_cache_t *wl_json_cache = NULL;
+
+/* Writes the buffer to the file.
+ * NOTE: You must hold wl_lock when calling this function! */
+static int wl_flush_nolock (void) /* {{{ */
+{
+    ssize_t status;
+
+    wl_buffer_init_time = cdtime_coarse ();
+    if ((wl_fd < 0) || (wl_buffer_fill == 0))
+        return (0);
+
+    status = swrite (wl_fd, wl_buffer, wl_buffer_fill);
+    wl_buffer_fill = 0;
+    if (status != 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_log plugin: Writing to %s failed: %s", wl_file,
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        return (-1);
+    }
+
+    return (0);
+} /* }}} int wl_flush_nolock */
+
+/* Formats one value list, terminated by a newline with JSON. */
+static int wl_format_value_list (char *buffer, size_t buffer_size, /* {{{ */
+        const data_set_t *ds, const value_list_t *vl)
 {
-    char buffer[WL_BUF_SIZE];
     int status;
 
     if (0 != strcmp (ds->type, vl->type))
@@ -51,30 +98,225 @@ static int wl_write_messages (const data_set_t *ds, const value_list_t *vl)
         return -1;
     }
 
-    memset (buffer, 0, sizeof (buffer));
-    status = format_graphite (buffer, sizeof (buffer), ds, vl,
-                              NULL, NULL, '_', 0);
-    if (status != 0) /* error message has been printed already. */
-        return (status);
+    if (wl_format == WL_FORMAT_JSON)
+    {
+        size_t bfill = 0;
+        size_t bfree = buffer_size - 1;
 
-    INFO ("write_log values:\n%s", buffer);
+        format_json_initialize (buffer, &bfill, &bfree);
+        status = format_json_value_list_cached (wl_json_cache, buffer,
+                &bfill, &bfree, ds, vl, /* store rates = */ 0,
+                /* ret_needed = */ NULL);
+        if (status == 0)
+            status = format_json_finalize (buffer, &bfill, &bfree);
+        if (status != 0)
+        {
+            ERROR ("write_log plugin: format_json_value_list failed "
+                    "with status %i.", status);
+            return (status);
+        }
+        buffer[bfill] = '\n';
+        buffer[bfill + 1] = 0;
+        return (0);
+    }
 
-    return (0);
-} /* int wl_write_messages */
+    /* format_graphite_cached() terminates the buffer. */
+    buffer[0] = 0;
+    return (format_graphite_cached (wl_graphite_cache, buffer, buffer_size,
+                ds, vl, NULL, NULL, '_', 0));
+} /* }}} int wl_format_value_list */
 
-static int wl_write (const data_set_t *ds, const value_list_t *vl,
-        user_data_t *user_data)
+/* Appends one formatted value list to the buffer.
+ * NOTE: You must hold wl_lock when calling this function! */
+static int wl_append_nolock (char const *text) /* {{{ */
 {
-    int status;
+    size_t len = strlen (text);
+    int status = 0;
+
+    if ((wl_buffer_fill + len) > wl_buffer_size)
+        status = wl_flush_nolock ();
 
-    status = wl_write_messages (ds, vl);
+    if (wl_buffer_fill == 0)
+        wl_buffer_init_time = cdtime_coarse ();
+
+    memcpy (wl_buffer + wl_buffer_fill, text, len);
+    wl_buffer_fill += len;
 
     return (status);
-}
+} /* }}} int wl_append_nolock */
+
+static int wl_write (const write_batch_entry_t *entries, /* {{{ */
+        size_t entries_num, user_data_t __attribute__((unused)) *ud)
+{
+    char buffer[WL_BUF_SIZE];
+    size_t i;
+    int failed = 0;
+
+    if (wl_fd < 0)
+    {
+        for (i = 0; i < entries_num; i++)
+        {
+            if (wl_format_value_list (buffer, sizeof (buffer),
+                        entries[i].ds, entries[i].vl) != 0)
+            {
+                failed++;
+                continue;
+            }
+            INFO ("write_log values:\n%s", buffer);
+        }
+        return ((failed == 0) ? 0 : -1);
+    }
+
+    pthread_mutex_lock (&wl_lock);
+    for (i = 0; i < entries_num; i++)
+    {
+        int status = wl_format_value_list (buffer, sizeof (buffer),
+                entries[i].ds, entries[i].vl);
+        if (status == 0)
+            status = wl_append_nolock (buffer);
+        if (status != 0)
+            failed++;
+    }
+    pthread_mutex_unlock (&wl_lock);
+
+    return ((failed == 0) ? 0 : -1);
+} /* }}} int wl_write */
+
+static int wl_flush (cdtime_t timeout, /* {{{ */
+        const char __attribute__((unused)) *identifier,
+        user_data_t __attribute__((unused)) *ud)
+{
+    int status = 0;
+
+    pthread_mutex_lock (&wl_lock);
+    /* timeout == 0  => flush unconditionally */
+    if ((timeout == 0)
+            || ((wl_buffer_init_time + timeout) <= cdtime_coarse ()))
+        status = wl_flush_nolock ();
+    pthread_mutex_unlock (&wl_lock);
+
+    return (status);
+} /* }}} int wl_flush */
+
+static int wl_config (oconfig_item_t *ci) /* {{{ */
+{
+    int i;
+
+    for (i = 0; i < ci->children_num; i++)
+    {
+        oconfig_item_t *child = ci->children + i;
+        int status = 0;
+
+        if (strcasecmp ("File", child->key) == 0)
+            status = cf_util_get_string (child, &wl_file);
+        else if (strcasecmp ("Format", child->key) == 0)
+        {
+            char format[16];
+
+            status = cf_util_get_string_buffer (child, format,
+                    sizeof (format));
+            if (status != 0)
+                ;
+            else if (strcasecmp ("Graphite", format) == 0)
+                wl_format = WL_FORMAT_GRAPHITE;
+            else if (strcasecmp ("JSON", format) == 0)
+                wl_format = WL_FORMAT_JSON;
+            else
+            {
+                ERROR ("write_log plugin: Unknown format: %s", format);
+                status = -1;
+            }
+        }
+        else if (strcasecmp ("BufferSize", child->key) == 0)
+        {
+            int tmp = 0;
+
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp < WL_BUF_SIZE))
+            {
+                ERROR ("write_log plugin: The \"BufferSize\" option must be "
+                        "at least %i bytes.", WL_BUF_SIZE);
+                status = -1;
+            }
+            else if (status == 0)
+                wl_buffer_size = (size_t) tmp;
+        }
+        else
+        {
+            ERROR ("write_log plugin: Invalid configuration option: %s.",
+                    child->key);
+            status = -1;
+        }
+
+        if (status != 0)
+            return (status);
+    }
+
+    return (0);
+} /* }}} int wl_config */
+
+static int wl_init (void) /* {{{ */
+{
+    if (wl_format == WL_FORMAT_JSON)
+        wl_json_cache = format_json_cache_create (FORMAT_JSON_CACHE_SIZE);
+    else
+        wl_graphite_cache = graphite_cache_create (GRAPHITE_CACHE_SIZE);
+
+    if ((wl_file == NULL) || (wl_fd >= 0))
+        return (0);
+
+    wl_buffer = malloc (wl_buffer_size);
+    if (wl_buffer == NULL)
+    {
+        ERROR ("write_log plugin: malloc failed.");
+        return (-1);
+    }
+
+    if (strcasecmp ("stdout", wl_file) == 0)
+        wl_fd = STDOUT_FILENO;
+    else if (strcasecmp ("stderr", wl_file) == 0)
+        wl_fd = STDERR_FILENO;
+    else
+        wl_fd = open (wl_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (wl_fd < 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_log plugin: open (%s) failed: %s", wl_file,
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        sfree (wl_buffer);
+        return (-1);
+    }
+
+    return (0);
+} /* }}} int wl_init */
+
+static int wl_shutdown (void) /* {{{ */
+{
+    pthread_mutex_lock (&wl_lock);
+    wl_flush_nolock ();
+    if (wl_fd > STDERR_FILENO)
+        close (wl_fd);
+    wl_fd = -1;
+    sfree (wl_buffer);
+    pthread_mutex_unlock (&wl_lock);
+
+    graphite_cache_destroy (wl_graphite_cache);
+    wl_graphite_cache = NULL;
+    format_json_cache_destroy (wl_json_cache);
+    wl_json_cache = NULL;
+    sfree (wl_file);
+
+    return (0);
+} /* }}} int wl_shutdown */
 
 void module_register (void)
 {
-    plugin_register_write ("write_log", wl_write, NULL);
+    plugin_register_complex_config ("write_log", wl_config);
+    plugin_register_init ("write_log", wl_init);
+    plugin_register_shutdown ("write_log", wl_shutdown);
+    plugin_register_write_batch ("write_log", wl_write, NULL);
+    plugin_register_flush ("write_log", wl_flush, NULL);
 }
 
 /* vim: set sw=4 ts=4 sts=4 tw=78 et : */
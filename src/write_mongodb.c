@@ -33,6 +33,7 @@
 #include "common.h"
 #include "configfile.h"
 #include "utils_cache.h"
+#include "utils_avltree.h"
 
 #include <pthread.h>
 
@@ -48,6 +49,24 @@
 # define bson_dealloc(b) bson_dispose(b)
 #endif
 
+/* One connection of a node's pool. */
+struct wm_conn_s
+{
+  mongo conn[1];
+  pthread_mutex_t lock;
+};
+typedef struct wm_conn_s wm_conn_t;
+
+/* Records waiting to be inserted into one collection. */
+struct wm_batch_s
+{
+  char *collection;
+  bson **records;
+  int records_num;
+  cdtime_t first;
+};
+typedef struct wm_batch_s wm_batch_t;
+
 struct wm_node_s
 {
   char name[DATA_MAX_NAME_LEN];
@@ -63,8 +82,16 @@ struct wm_node_s
 
   _Bool store_rates;
 
-  mongo conn[1];
+  int batch_size;
+  cdtime_t batch_timeout;
+
+  wm_conn_t *conns;
+  int conns_num;
+
+  /* Protects "batches" and "next_conn". */
   pthread_mutex_t lock;
+  c_avl_tree_t *batches;
+  int next_conn;
 };
 typedef struct wm_node_s wm_node_t;
 
@@ -160,110 +187,342 @@ static bson *wm_create_bson (const data_set_t *ds, /* {{{ */
   return (ret);
 } /* }}} bson *wm_create_bson */
 
-static int wm_write (const data_set_t *ds, /* {{{ */
-    const value_list_t *vl,
-    user_data_t *ud)
+static void wm_records_free (bson **records, int records_num) /* {{{ */
 {
-  wm_node_t *node = ud->data;
-  char collection_name[512];
-  bson *bson_record;
-  int status;
+  int i;
 
-  ssnprintf (collection_name, sizeof (collection_name), "collectd.%s",
-      vl->plugin);
+  for (i = 0; i < records_num; i++)
+  {
+    bson_destroy (records[i]); /* matches bson_init() */
+    bson_dealloc (records[i]); /* matches bson_alloc() */
+  }
+} /* }}} void wm_records_free */
 
-  bson_record = wm_create_bson (ds, vl, node->store_rates);
-  if (bson_record == NULL)
-    return (ENOMEM);
+/* c->lock must be held when calling this function. */
+static int wm_connect (wm_node_t *node, wm_conn_t *c) /* {{{ */
+{
+  int status;
 
-  pthread_mutex_lock (&node->lock);
+  if (mongo_is_connected (c->conn))
+    return (0);
 
-  if (!mongo_is_connected (node->conn))
-  {
-    INFO ("write_mongodb plugin: Connecting to [%s]:%i",
+  INFO ("write_mongodb plugin: Connecting to [%s]:%i",
+      (node->host != NULL) ? node->host : "localhost",
+      (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
+  status = mongo_connect (c->conn, node->host, node->port);
+  if (status != MONGO_OK) {
+    ERROR ("write_mongodb plugin: Connecting to [%s]:%i failed.",
         (node->host != NULL) ? node->host : "localhost",
         (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
-    status = mongo_connect (node->conn, node->host, node->port);
-    if (status != MONGO_OK) {
-      ERROR ("write_mongodb plugin: Connecting to [%s]:%i failed.",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
-      mongo_destroy (node->conn);
-      pthread_mutex_unlock (&node->lock);
-      return (-1);
-    }
+    mongo_destroy (c->conn);
+    return (-1);
+  }
 
-    if ((node->db != NULL) && (node->user != NULL) && (node->passwd != NULL))
+  if ((node->db != NULL) && (node->user != NULL) && (node->passwd != NULL))
+  {
+    status = mongo_cmd_authenticate (c->conn,
+        node->db, node->user, node->passwd);
+    if (status != MONGO_OK)
     {
-      status = mongo_cmd_authenticate (node->conn,
-          node->db, node->user, node->passwd);
-      if (status != MONGO_OK)
-      {
-        ERROR ("write_mongodb plugin: Authenticating to [%s]%i for database "
-            "\"%s\" as user \"%s\" failed.",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : MONGO_DEFAULT_PORT,
-          node->db, node->user);
-        mongo_destroy (node->conn);
-        pthread_mutex_unlock (&node->lock);
-        return (-1);
-      }
+      ERROR ("write_mongodb plugin: Authenticating to [%s]%i for database "
+          "\"%s\" as user \"%s\" failed.",
+        (node->host != NULL) ? node->host : "localhost",
+        (node->port != 0) ? node->port : MONGO_DEFAULT_PORT,
+        node->db, node->user);
+      mongo_destroy (c->conn);
+      return (-1);
     }
+  }
 
-    if (node->timeout > 0) {
-      status = mongo_set_op_timeout (node->conn, node->timeout);
-      if (status != MONGO_OK) {
-        WARNING ("write_mongodb plugin: mongo_set_op_timeout(%i) failed: %s",
-            node->timeout, node->conn->errstr);
-      }
+  if (node->timeout > 0) {
+    status = mongo_set_op_timeout (c->conn, node->timeout);
+    if (status != MONGO_OK) {
+      WARNING ("write_mongodb plugin: mongo_set_op_timeout(%i) failed: %s",
+          node->timeout, c->conn->errstr);
     }
   }
 
+  return (0);
+} /* }}} int wm_connect */
+
+/* Returns a locked connection. Idle connections are preferred, so that write
+ * threads do not wait for each other's inserts. */
+static wm_conn_t *wm_conn_get (wm_node_t *node) /* {{{ */
+{
+  int start;
+  int i;
+
+  pthread_mutex_lock (&node->lock);
+  start = node->next_conn;
+  node->next_conn = (node->next_conn + 1) % node->conns_num;
+  pthread_mutex_unlock (&node->lock);
+
+  for (i = 0; i < node->conns_num; i++)
+  {
+    wm_conn_t *c = node->conns + ((start + i) % node->conns_num);
+    if (pthread_mutex_trylock (&c->lock) == 0)
+      return (c);
+  }
+
+  pthread_mutex_lock (&node->conns[start].lock);
+  return (node->conns + start);
+} /* }}} wm_conn_t *wm_conn_get */
+
+/* Inserts "records" into "collection" and frees them. With more than one
+ * record, an unordered bulk insert is used: the server carries on after a
+ * failing document. */
+static int wm_insert (wm_node_t *node, char const *collection, /* {{{ */
+    bson **records, int records_num)
+{
+  wm_conn_t *c;
+  int status;
+
+  c = wm_conn_get (node);
+
+  if (wm_connect (node, c) != 0)
+  {
+    pthread_mutex_unlock (&c->lock);
+    wm_records_free (records, records_num);
+    return (-1);
+  }
+
   /* Assert if the connection has been established */
-  assert (mongo_is_connected (node->conn));
+  assert (mongo_is_connected (c->conn));
 
   #if MONGO_MINOR >= 6
     /* There was an API change in 0.6.0 as linked below */
     /* https://github.com/mongodb/mongo-c-driver/blob/master/HISTORY.md */
-    status = mongo_insert (node->conn, collection_name, bson_record, NULL);
+    if (records_num == 1)
+      status = mongo_insert (c->conn, collection, records[0], NULL);
+    else
+      status = mongo_insert_batch (c->conn, collection,
+          (const bson **) records, records_num,
+          NULL, MONGO_CONTINUE_ON_ERROR);
   #else
-    status = mongo_insert (node->conn, collection_name, bson_record);
+    if (records_num == 1)
+      status = mongo_insert (c->conn, collection, records[0]);
+    else
+      status = mongo_insert_batch (c->conn, collection,
+          records, records_num);
   #endif
 
   if (status != MONGO_OK)
   {
-    ERROR ( "write_mongodb plugin: error inserting record: %d", node->conn->err);
-    if (node->conn->err != MONGO_BSON_INVALID)
-      ERROR ("write_mongodb plugin: %s", node->conn->errstr);
+    ERROR ( "write_mongodb plugin: error inserting %i record(s): %d",
+        records_num, c->conn->err);
+    if (c->conn->err != MONGO_BSON_INVALID)
+      ERROR ("write_mongodb plugin: %s", c->conn->errstr);
     else
       ERROR ("write_mongodb plugin: Invalid BSON structure, error = %#x",
-          (unsigned int) bson_record->err);
+          (unsigned int) records[0]->err);
 
     /* Disconnect except on data errors. */
-    if ((node->conn->err != MONGO_BSON_INVALID)
-        && (node->conn->err != MONGO_BSON_NOT_FINISHED))
-      mongo_destroy (node->conn);
+    if ((c->conn->err != MONGO_BSON_INVALID)
+        && (c->conn->err != MONGO_BSON_NOT_FINISHED))
+      mongo_destroy (c->conn);
   }
 
-  pthread_mutex_unlock (&node->lock);
+  pthread_mutex_unlock (&c->lock);
 
   /* free our resource as not to leak memory */
-  bson_destroy (bson_record); /* matches bson_init() */
-  bson_dealloc (bson_record); /* matches bson_alloc() */
+  wm_records_free (records, records_num);
 
   return (0);
+} /* }}} int wm_insert */
+
+/* Hands the records of "b" to the caller, who must insert and free them.
+ * node->lock must be held when calling this function. */
+static bson **wm_batch_take (wm_batch_t *b, int *ret_records_num) /* {{{ */
+{
+  bson **records = b->records;
+
+  *ret_records_num = b->records_num;
+  b->records = NULL;
+  b->records_num = 0;
+
+  return (records);
+} /* }}} bson **wm_batch_take */
+
+/* Adds "record" to the batch of "collection". If the batch is due, its
+ * records are returned in "ret_records" and the caller must insert them.
+ * node->lock must be held when calling this function. */
+static int wm_batch_add (wm_node_t *node, /* {{{ */
+    char const *collection, bson *record,
+    bson ***ret_records, int *ret_records_num)
+{
+  wm_batch_t *b = NULL;
+
+  *ret_records = NULL;
+  *ret_records_num = 0;
+
+  if (c_avl_get (node->batches, collection, (void *) &b) != 0)
+  {
+    b = calloc (1, sizeof (*b));
+    if (b == NULL)
+      return (ENOMEM);
+    b->collection = strdup (collection);
+    if ((b->collection == NULL)
+        || (c_avl_insert (node->batches, b->collection, b) != 0))
+    {
+      sfree (b->collection);
+      sfree (b);
+      return (ENOMEM);
+    }
+  }
+
+  if (b->records == NULL)
+  {
+    b->records = calloc ((size_t) node->batch_size, sizeof (*b->records));
+    if (b->records == NULL)
+      return (ENOMEM);
+    b->first = cdtime ();
+  }
+
+  b->records[b->records_num] = record;
+  b->records_num++;
+
+  if ((b->records_num >= node->batch_size)
+      || ((cdtime () - b->first) >= node->batch_timeout))
+    *ret_records = wm_batch_take (b, ret_records_num);
+
+  return (0);
+} /* }}} int wm_batch_add */
+
+static int wm_write (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl,
+    user_data_t *ud)
+{
+  wm_node_t *node = ud->data;
+  char collection_name[512];
+  bson *bson_record;
+  bson **records;
+  int records_num;
+  int status;
+
+  ssnprintf (collection_name, sizeof (collection_name), "collectd.%s",
+      vl->plugin);
+
+  bson_record = wm_create_bson (ds, vl, node->store_rates);
+  if (bson_record == NULL)
+    return (ENOMEM);
+
+  if (node->batch_size <= 1)
+    return (wm_insert (node, collection_name, &bson_record, 1));
+
+  pthread_mutex_lock (&node->lock);
+  status = wm_batch_add (node, collection_name, bson_record,
+      &records, &records_num);
+  pthread_mutex_unlock (&node->lock);
+
+  if (status != 0)
+  {
+    ERROR ("write_mongodb plugin: Adding a record to the batch failed.");
+    wm_records_free (&bson_record, 1);
+    return (status);
+  }
+
+  if (records == NULL)
+    return (0);
+
+  status = wm_insert (node, collection_name, records, records_num);
+  sfree (records);
+  return (status);
 } /* }}} int wm_write */
 
+/* Inserts all batches which have waited for at least "timeout". */
+static int wm_flush_node (wm_node_t *node, cdtime_t timeout) /* {{{ */
+{
+  struct { char const *collection; bson **records; int records_num; } *due;
+  c_avl_iterator_t *iter;
+  wm_batch_t *b;
+  void *key;
+  cdtime_t now = cdtime ();
+  int due_num = 0;
+  int status = 0;
+  int i;
+
+  pthread_mutex_lock (&node->lock);
+
+  due = calloc ((size_t) c_avl_size (node->batches) + 1, sizeof (*due));
+  if (due == NULL)
+  {
+    pthread_mutex_unlock (&node->lock);
+    return (ENOMEM);
+  }
+
+  iter = c_avl_get_iterator (node->batches);
+  while (c_avl_iterator_next (iter, &key, (void *) &b) == 0)
+  {
+    if ((b->records_num == 0) || ((now - b->first) < timeout))
+      continue;
+
+    /* Batches are only freed with the node, so "collection" stays valid. */
+    due[due_num].collection = b->collection;
+    due[due_num].records = wm_batch_take (b, &due[due_num].records_num);
+    due_num++;
+  }
+  c_avl_iterator_destroy (iter);
+
+  pthread_mutex_unlock (&node->lock);
+
+  for (i = 0; i < due_num; i++)
+  {
+    if (wm_insert (node, due[i].collection,
+          due[i].records, due[i].records_num) != 0)
+      status = -1;
+    sfree (due[i].records);
+  }
+  sfree (due);
+
+  return (status);
+} /* }}} int wm_flush_node */
+
+static int wm_flush (cdtime_t timeout, /* {{{ */
+    const char *identifier __attribute__((unused)),
+    user_data_t *ud)
+{
+  return (wm_flush_node (ud->data, timeout));
+} /* }}} int wm_flush */
+
+static int wm_batch_timeout (user_data_t *ud) /* {{{ */
+{
+  wm_node_t *node = ud->data;
+
+  return (wm_flush_node (node, node->batch_timeout));
+} /* }}} int wm_batch_timeout */
+
 static void wm_config_free (void *ptr) /* {{{ */
 {
   wm_node_t *node = ptr;
+  int i;
 
   if (node == NULL)
     return;
 
-  if (mongo_is_connected (node->conn))
-    mongo_destroy (node->conn);
+  if (node->batches != NULL)
+  {
+    void *key;
+    wm_batch_t *b;
+
+    wm_flush_node (node, /* timeout = */ 0);
+    while (c_avl_pick (node->batches, &key, (void *) &b) == 0)
+    {
+      sfree (b->records);
+      sfree (b->collection);
+      sfree (b);
+    }
+    c_avl_destroy (node->batches);
+  }
 
+  for (i = 0; i < node->conns_num; i++)
+  {
+    if (mongo_is_connected (node->conns[i].conn))
+      mongo_destroy (node->conns[i].conn);
+    pthread_mutex_destroy (&node->conns[i].lock);
+  }
+  sfree (node->conns);
+
+  pthread_mutex_destroy (&node->lock);
   sfree (node->host);
   sfree (node);
 } /* }}} void wm_config_free */
@@ -271,15 +530,17 @@ static void wm_config_free (void *ptr) /* {{{ */
 static int wm_config_node (oconfig_item_t *ci) /* {{{ */
 {
   wm_node_t *node;
+  int conns_num = 1;
   int status;
   int i;
 
   node = calloc (1, sizeof (*node));
   if (node == NULL)
     return (ENOMEM);
-  mongo_init (node->conn);
   node->host = NULL;
   node->store_rates = 1;
+  node->batch_size = 1;
+  node->batch_timeout = TIME_T_TO_CDTIME_T (1);
   pthread_mutex_init (&node->lock, /* attr = */ NULL);
 
   status = cf_util_get_string_buffer (ci, node->name, sizeof (node->name));
@@ -315,6 +576,26 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_string (child, &node->user);
     else if (strcasecmp ("Password", child->key) == 0)
       status = cf_util_get_string (child, &node->passwd);
+    else if (strcasecmp ("BatchSize", child->key) == 0)
+    {
+      status = cf_util_get_int (child, &node->batch_size);
+      if ((status == 0) && (node->batch_size < 1))
+      {
+        WARNING ("write_mongodb plugin: \"BatchSize\" must be at least 1.");
+        status = -1;
+      }
+    }
+    else if (strcasecmp ("BatchTimeout", child->key) == 0)
+      status = cf_util_get_cdtime (child, &node->batch_timeout);
+    else if (strcasecmp ("Connections", child->key) == 0)
+    {
+      status = cf_util_get_int (child, &conns_num);
+      if ((status == 0) && (conns_num < 1))
+      {
+        WARNING ("write_mongodb plugin: \"Connections\" must be at least 1.");
+        status = -1;
+      }
+    }
     else
       WARNING ("write_mongodb plugin: Ignoring unknown config option \"%s\".",
           child->key);
@@ -337,6 +618,29 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
     }
   }
 
+  if (status == 0)
+  {
+    node->conns = calloc ((size_t) conns_num, sizeof (*node->conns));
+    if (node->conns == NULL)
+      status = ENOMEM;
+    else
+    {
+      node->conns_num = conns_num;
+      for (i = 0; i < node->conns_num; i++)
+      {
+        mongo_init (node->conns[i].conn);
+        pthread_mutex_init (&node->conns[i].lock, /* attr = */ NULL);
+      }
+    }
+  }
+
+  if ((status == 0) && (node->batch_size > 1))
+  {
+    node->batches = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+    if (node->batches == NULL)
+      status = ENOMEM;
+  }
+
   if (status == 0)
   {
     char cb_name[DATA_MAX_NAME_LEN];
@@ -349,6 +653,18 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
 
     status = plugin_register_write (cb_name, wm_write, &ud);
     INFO ("write_mongodb plugin: registered write plugin %s %d",cb_name,status);
+
+    if ((status == 0) && (node->batch_size > 1))
+    {
+      /* The write callback owns the node. */
+      ud.free_func = NULL;
+      plugin_register_flush (cb_name, wm_flush, &ud);
+
+      ssnprintf (cb_name, sizeof (cb_name), "write_mongodb/%s/batch",
+          node->name);
+      plugin_register_complex_read (/* group = */ NULL, cb_name,
+          wm_batch_timeout, node->batch_timeout, &ud);
+    }
   }
 
   if (status != 0)
@@ -0,0 +1,492 @@
+/**
+ * collectd - src/write_record.c
+ * Copyright (C) 2016  Florian octo Forster
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   Florian octo Forster <octo at collectd.org>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "network.h"
+
+#include <pthread.h>
+
+#if HAVE_ARPA_INET_H
+# include <arpa/inet.h>
+#endif
+
+/*
+ * Recording file layout
+ *
+ * The value lists are recorded as they are dispatched, encoded in unsigned,
+ * unencrypted packets of the network plugin's binary protocol, so that
+ * "collectd-tg -R" can send them to a daemon again. A file starts with a
+ * record_header_t, followed by frames. Each frame is a record_frame_t, the
+ * time the first value of the packet was written and the size of the packet,
+ * followed by the packet. The files are written with stdio and complete up to
+ * the last flush. All numbers are in network byte order.
+ */
+#define RECORD_MAGIC "CDRECORD"
+#define RECORD_VERSION 1
+
+#define RECORD_DEFAULT_DIR "record"
+#define RECORD_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define RECORD_DEFAULT_SEGMENT_DURATION TIME_T_TO_CDTIME_T (3600)
+
+/* Ethernet frame - (IPv6 header + UDP header), like the network plugin. */
+#define RECORD_PACKET_SIZE 1452
+/* Packets are closed after this long, so that replays keep the timing with
+ * this precision even when few values are dispatched. */
+#define RECORD_PACKET_DURATION MS_TO_CDTIME_T (100)
+
+struct record_header_s
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+typedef struct record_header_s record_header_t;
+
+struct record_frame_s
+{
+  uint64_t time;    /* cdtime_t */
+  uint32_t size;
+  uint32_t reserved;
+};
+typedef struct record_frame_s record_frame_t;
+
+struct part_header_s
+{
+  uint16_t type;
+  uint16_t length;
+};
+typedef struct part_header_s part_header_t;
+
+/*
+ * Private variables
+ */
+static char *datadir = NULL;
+static size_t segment_size = RECORD_DEFAULT_SEGMENT_SIZE;
+static cdtime_t segment_duration = RECORD_DEFAULT_SEGMENT_DURATION;
+
+/* The current file and packet, protected by "record_lock". "packet_def"
+ * holds the fields already set in the packet, which are only written again
+ * when they change. */
+static FILE *segment_fh = NULL;
+static char segment_name[PATH_MAX];
+static cdtime_t segment_start = 0;
+static size_t segment_used = 0;
+
+static char packet[RECORD_PACKET_SIZE];
+static size_t packet_fill = 0;
+static cdtime_t packet_start = 0;
+static value_list_t packet_def;
+
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Private functions
+ */
+/* XXX: You must hold "record_lock" when calling this function! */
+static void wr_segment_close (void) /* {{{ */
+{
+  if (segment_fh == NULL)
+    return;
+
+  if (fclose (segment_fh) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_record plugin: fclose (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+  segment_fh = NULL;
+
+  DEBUG ("write_record plugin: Closed %s (%zu bytes).", segment_name,
+      segment_used);
+} /* }}} void wr_segment_close */
+
+/* Creates a new file named after the current time and writes the header.
+ * XXX: You must hold "record_lock" when calling this function! */
+static int wr_segment_open (void) /* {{{ */
+{
+  cdtime_t now = cdtime ();
+  time_t t = CDTIME_T_TO_TIME_T (now);
+  record_header_t hdr;
+  struct tm tm;
+  char timestr[32];
+  int fd = -1;
+  int i;
+
+  localtime_r (&t, &tm);
+  strftime (timestr, sizeof (timestr), "%Y%m%d-%H%M%S", &tm);
+
+  for (i = 0; (fd < 0) && (i < 100); i++)
+  {
+    if (i == 0)
+      ssnprintf (segment_name, sizeof (segment_name), "%s/%s.record",
+          datadir, timestr);
+    else
+      ssnprintf (segment_name, sizeof (segment_name), "%s/%s-%i.record",
+          datadir, timestr, i);
+
+    fd = open (segment_name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if ((fd < 0) && (errno != EEXIST))
+      break;
+  }
+
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_record plugin: open (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  segment_fh = fdopen (fd, "w");
+  if (segment_fh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("write_record plugin: fdopen (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    return (-1);
+  }
+
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.magic, RECORD_MAGIC, sizeof (hdr.magic));
+  hdr.version = htonl (RECORD_VERSION);
+  if (fwrite (&hdr, sizeof (hdr), 1, segment_fh) != 1)
+  {
+    ERROR ("write_record plugin: Writing the header of %s failed.",
+        segment_name);
+    wr_segment_close ();
+    return (-1);
+  }
+
+  segment_start = now;
+  segment_used = sizeof (hdr);
+
+  DEBUG ("write_record plugin: Opened %s.", segment_name);
+  return (0);
+} /* }}} int wr_segment_open */
+
+/* Appends the current packet to the file, starting a new file if the current
+ * one is full or too old.
+ * XXX: You must hold "record_lock" when calling this function! */
+static int wr_packet_flush (void) /* {{{ */
+{
+  record_frame_t frame;
+  int status = 0;
+
+  if (packet_fill == 0)
+    return (0);
+
+  if ((segment_fh != NULL)
+      && (((segment_used + sizeof (frame) + packet_fill) > segment_size)
+        || ((cdtime () - segment_start) >= segment_duration)))
+    wr_segment_close ();
+
+  if ((segment_fh == NULL) && (wr_segment_open () != 0))
+    status = -1;
+
+  if (status == 0)
+  {
+    memset (&frame, 0, sizeof (frame));
+    frame.time = htonll ((uint64_t) packet_start);
+    frame.size = htonl ((uint32_t) packet_fill);
+
+    if ((fwrite (&frame, sizeof (frame), 1, segment_fh) != 1)
+        || (fwrite (packet, packet_fill, 1, segment_fh) != 1))
+    {
+      char errbuf[1024];
+      ERROR ("write_record plugin: Writing to %s failed: %s", segment_name,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      wr_segment_close ();
+      status = -1;
+    }
+    else
+      segment_used += sizeof (frame) + packet_fill;
+  }
+
+  /* The next packet starts from scratch, also if this one was lost. */
+  packet_fill = 0;
+  memset (&packet_def, 0, sizeof (packet_def));
+
+  return (status);
+} /* }}} int wr_packet_flush */
+
+static int wr_part_add (uint16_t type, /* {{{ */
+    void const *body, size_t body_size)
+{
+  part_header_t ph;
+
+  if ((packet_fill + sizeof (ph) + body_size) > sizeof (packet))
+    return (ENOMEM);
+
+  ph.type = htons (type);
+  ph.length = htons ((uint16_t) (sizeof (ph) + body_size));
+  memcpy (packet + packet_fill, &ph, sizeof (ph));
+  memcpy (packet + packet_fill + sizeof (ph), body, body_size);
+  packet_fill += sizeof (ph) + body_size;
+
+  return (0);
+} /* }}} int wr_part_add */
+
+static int wr_part_string (uint16_t type, char *def, /* {{{ */
+    char const *str)
+{
+  int status;
+
+  if (strcmp (def, str) == 0)
+    return (0);
+
+  status = wr_part_add (type, str, strlen (str) + 1);
+  if (status == 0)
+    sstrncpy (def, str, DATA_MAX_NAME_LEN);
+  return (status);
+} /* }}} int wr_part_string */
+
+static int wr_part_number (uint16_t type, cdtime_t *def, /* {{{ */
+    cdtime_t value)
+{
+  uint64_t tmp;
+  int status;
+
+  if (*def == value)
+    return (0);
+
+  tmp = htonll ((uint64_t) value);
+  status = wr_part_add (type, &tmp, sizeof (tmp));
+  if (status == 0)
+    *def = value;
+  return (status);
+} /* }}} int wr_part_number */
+
+static int wr_part_values (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
+{
+  char body[sizeof (uint16_t) + ds->ds_num * (1 + sizeof (value_t))];
+  uint16_t num = htons ((uint16_t) ds->ds_num);
+  size_t i;
+
+  memcpy (body, &num, sizeof (num));
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    uint8_t type = (uint8_t) ds->ds[i].type;
+    value_t v;
+
+    if (type == DS_TYPE_GAUGE)
+      v.gauge = htond (vl->values[i].gauge);
+    else /* the 64 bit integers share the byte order */
+      v.derive = (derive_t) htonll ((uint64_t) vl->values[i].derive);
+
+    body[sizeof (num) + i] = (char) type;
+    memcpy (body + sizeof (num) + ds->ds_num + i * sizeof (v), &v,
+        sizeof (v));
+  }
+
+  return (wr_part_add (TYPE_VALUES, body, sizeof (body)));
+} /* }}} int wr_part_values */
+
+/* Encodes "vl" into the current packet, like the network plugin's
+ * add_to_buffer(). Returns ENOMEM if it doesn't fit.
+ * XXX: You must hold "record_lock" when calling this function! */
+static int wr_packet_add (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
+{
+  int status;
+
+  status = wr_part_string (TYPE_HOST, packet_def.host, vl->host);
+  if (status == 0)
+    status = wr_part_number (TYPE_TIME_HR, &packet_def.time, vl->time);
+  if (status == 0)
+    status = wr_part_number (TYPE_INTERVAL_HR, &packet_def.interval,
+        vl->interval);
+  if (status == 0)
+    status = wr_part_string (TYPE_PLUGIN, packet_def.plugin, vl->plugin);
+  if (status == 0)
+    status = wr_part_string (TYPE_PLUGIN_INSTANCE,
+        packet_def.plugin_instance, vl->plugin_instance);
+  if (status == 0)
+    status = wr_part_string (TYPE_TYPE, packet_def.type, vl->type);
+  if (status == 0)
+    status = wr_part_string (TYPE_TYPE_INSTANCE,
+        packet_def.type_instance, vl->type_instance);
+  if (status == 0)
+    status = wr_part_values (ds, vl);
+
+  return (status);
+} /* }}} int wr_packet_add */
+
+static int wr_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    __attribute__((unused)) user_data_t *ud)
+{
+  size_t fill;
+  cdtime_t now;
+  int status;
+
+  if (strcmp (ds->type, vl->type) != 0)
+  {
+    ERROR ("write_record plugin: DS type does not match value list type");
+    return (-1);
+  }
+
+  now = cdtime ();
+
+  pthread_mutex_lock (&record_lock);
+
+  if ((packet_fill > 0) && ((now - packet_start) >= RECORD_PACKET_DURATION))
+    wr_packet_flush ();
+
+  if (packet_fill == 0)
+    packet_start = now;
+
+  fill = packet_fill;
+  status = wr_packet_add (ds, vl);
+  if ((status != 0) && (fill > 0))
+  {
+    /* Drop the parts of "vl" and retry with an empty packet. */
+    packet_fill = fill;
+    wr_packet_flush ();
+    packet_start = now;
+    status = wr_packet_add (ds, vl);
+  }
+
+  if (status != 0)
+  {
+    char identifier[6 * DATA_MAX_NAME_LEN];
+
+    packet_fill = 0;
+    memset (&packet_def, 0, sizeof (packet_def));
+    pthread_mutex_unlock (&record_lock);
+
+    FORMAT_VL (identifier, sizeof (identifier), vl);
+    ERROR ("write_record plugin: %s does not fit into a packet.", identifier);
+    return (-1);
+  }
+
+  pthread_mutex_unlock (&record_lock);
+  return (0);
+} /* }}} int wr_write */
+
+static int wr_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
+    __attribute__((unused)) const char *identifier,
+    __attribute__((unused)) user_data_t *ud)
+{
+  int status;
+
+  pthread_mutex_lock (&record_lock);
+  status = wr_packet_flush ();
+  if ((segment_fh != NULL) && (fflush (segment_fh) != 0))
+  {
+    char errbuf[1024];
+    ERROR ("write_record plugin: fflush (%s) failed: %s", segment_name,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    status = -1;
+  }
+  pthread_mutex_unlock (&record_lock);
+
+  return (status);
+} /* }}} int wr_flush */
+
+static int wr_config (oconfig_item_t *ci) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("DataDir", child->key) == 0)
+      cf_util_get_string (child, &datadir);
+    else if (strcasecmp ("SegmentSize", child->key) == 0)
+    {
+      int tmp = 0;
+      if (cf_util_get_int (child, &tmp) != 0)
+        continue;
+      if (tmp < 65536)
+      {
+        WARNING ("write_record plugin: SegmentSize must be at least 65536.");
+        continue;
+      }
+      segment_size = (size_t) tmp;
+    }
+    else if (strcasecmp ("SegmentDuration", child->key) == 0)
+      cf_util_get_cdtime (child, &segment_duration);
+    else
+      WARNING ("write_record plugin: Ignoring unknown config option \"%s\".",
+          child->key);
+  }
+
+  return (0);
+} /* }}} int wr_config */
+
+static int wr_init (void) /* {{{ */
+{
+  char probe[PATH_MAX];
+  size_t len;
+
+  if (datadir == NULL)
+  {
+    datadir = strdup (RECORD_DEFAULT_DIR);
+    if (datadir == NULL)
+      return (ENOMEM);
+  }
+
+  len = strlen (datadir);
+  while ((len > 1) && (datadir[len - 1] == '/'))
+    datadir[--len] = 0;
+
+  /* check_create_dir() creates the directories leading to a file. */
+  ssnprintf (probe, sizeof (probe), "%s/segment", datadir);
+  if (check_create_dir (probe) != 0)
+  {
+    ERROR ("write_record plugin: Cannot create %s.", datadir);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int wr_init */
+
+static int wr_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&record_lock);
+  wr_packet_flush ();
+  wr_segment_close ();
+  pthread_mutex_unlock (&record_lock);
+
+  sfree (datadir);
+  return (0);
+} /* }}} int wr_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("write_record", wr_config);
+  plugin_register_init ("write_record", wr_init);
+  plugin_register_write ("write_record", wr_write, /* user_data = */ NULL);
+  plugin_register_flush ("write_record", wr_flush, /* user_data = */ NULL);
+  plugin_register_shutdown ("write_record", wr_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
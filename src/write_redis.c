@@ -37,6 +37,24 @@
 # define REDIS_DEFAULT_PREFIX "collectd/"
 #endif
 
+#ifndef REDIS_DEFAULT_CONNECTIONS
+# define REDIS_DEFAULT_CONNECTIONS 1
+#endif
+
+/* One connection of a node's pool. Commands are appended to the connection's
+ * output buffer and their replies are read in one go, so that a whole
+ * pipeline costs a single round trip. */
+struct wr_conn_s
+{
+  redisContext *conn;
+  /* Commands sent whose replies have not been read yet. */
+  int pending_commands;
+  int pending_values;
+  cdtime_t first_pending;
+  pthread_mutex_t lock;
+};
+typedef struct wr_conn_s wr_conn_t;
+
 struct wr_node_s
 {
   char name[DATA_MAX_NAME_LEN];
@@ -49,7 +67,13 @@ struct wr_node_s
   int max_set_size;
   _Bool store_rates;
 
-  redisContext *conn;
+  int pipeline_size;
+  cdtime_t pipeline_timeout;
+
+  wr_conn_t *conns;
+  int conns_num;
+  /* Protects "next_conn" only. */
+  int next_conn;
   pthread_mutex_t lock;
 };
 typedef struct wr_node_s wr_node_t;
@@ -57,11 +81,111 @@ typedef struct wr_node_s wr_node_t;
 /*
  * Functions
  */
+static int wr_connect (wr_node_t *node, wr_conn_t *c) /* {{{ */
+{
+  redisReply *rr;
+
+  c->conn = redisConnectWithTimeout ((char *)node->host, node->port, node->timeout);
+  if (c->conn == NULL)
+  {
+    ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed: Unkown reason",
+        (node->host != NULL) ? node->host : "localhost",
+        (node->port != 0) ? node->port : 6379);
+    return (-1);
+  }
+  else if (c->conn->err)
+  {
+    ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed: %s",
+        (node->host != NULL) ? node->host : "localhost",
+        (node->port != 0) ? node->port : 6379,
+        c->conn->errstr);
+    redisFree (c->conn);
+    c->conn = NULL;
+    return (-1);
+  }
+
+  rr = redisCommand(c->conn, "SELECT %d", node->database);
+  if (rr == NULL)
+    WARNING("SELECT command error. database:%d message:%s", node->database, c->conn->errstr);
+  else
+    freeReplyObject (rr);
+
+  return (0);
+} /* }}} int wr_connect */
+
+static void wr_disconnect (wr_conn_t *c) /* {{{ */
+{
+  if (c->conn != NULL)
+  {
+    redisFree (c->conn);
+    c->conn = NULL;
+  }
+  c->pending_commands = 0;
+  c->pending_values = 0;
+} /* }}} void wr_disconnect */
+
+/* Sends the pipelined commands and reads all their replies. The caller must
+ * hold "c->lock". */
+static int wr_flush_nolock (wr_node_t *node, wr_conn_t *c) /* {{{ */
+{
+  int status = 0;
+
+  while (c->pending_commands > 0)
+  {
+    redisReply *rr = NULL;
+
+    if (redisGetReply (c->conn, (void **) &rr) != REDIS_OK)
+    {
+      ERROR ("write_redis plugin: Node \"%s\": Reading replies failed, "
+          "dropping %i value list(s): %s", node->name, c->pending_values,
+          c->conn->errstr);
+      wr_disconnect (c);
+      return (-1);
+    }
+
+    if (rr->type == REDIS_REPLY_ERROR)
+    {
+      WARNING ("write_redis plugin: Node \"%s\": Command failed: %s",
+          node->name, rr->str);
+      status = -1;
+    }
+    freeReplyObject (rr);
+    c->pending_commands--;
+  }
+
+  c->pending_values = 0;
+  return (status);
+} /* }}} int wr_flush_nolock */
+
+/* Returns a locked connection. Idle connections are preferred, so that write
+ * threads do not queue up behind each other. */
+static wr_conn_t *wr_conn_get (wr_node_t *node) /* {{{ */
+{
+  int start;
+  int i;
+
+  pthread_mutex_lock (&node->lock);
+  start = node->next_conn;
+  node->next_conn = (node->next_conn + 1) % node->conns_num;
+  pthread_mutex_unlock (&node->lock);
+
+  for (i = 0; i < node->conns_num; i++)
+  {
+    wr_conn_t *c = node->conns + ((start + i) % node->conns_num);
+    if (pthread_mutex_trylock (&c->lock) == 0)
+      return (c);
+  }
+
+  pthread_mutex_lock (&node->conns[start].lock);
+  return (node->conns + start);
+} /* }}} wr_conn_t *wr_conn_get */
+
 static int wr_write (const data_set_t *ds, /* {{{ */
     const value_list_t *vl,
     user_data_t *ud)
 {
   wr_node_t *node = ud->data;
+  wr_conn_t *c;
   char ident[512];
   char key[512];
   char value[512];
@@ -69,7 +193,6 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   size_t value_size;
   char *value_ptr;
   int status;
-  redisReply   *rr;
 
   status = FORMAT_VL (ident, sizeof (ident), vl);
   if (status != 0)
@@ -86,81 +209,110 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   if (status != 0)
     return (status);
 
-  pthread_mutex_lock (&node->lock);
+  c = wr_conn_get (node);
 
-  if (node->conn == NULL)
+  if ((c->conn == NULL) && (wr_connect (node, c) != 0))
   {
-    node->conn = redisConnectWithTimeout ((char *)node->host, node->port, node->timeout);
-    if (node->conn == NULL)
-    {
-      ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed: Unkown reason",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : 6379);
-      pthread_mutex_unlock (&node->lock);
-      return (-1);
-    }
-    else if (node->conn->err)
-    {
-      ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed: %s",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : 6379,
-          node->conn->errstr);
-      pthread_mutex_unlock (&node->lock);
-      return (-1);
-    }
-
-    rr = redisCommand(node->conn, "SELECT %d", node->database);
-    if (rr == NULL)
-      WARNING("SELECT command error. database:%d message:%s", node->database, node->conn->errstr);
-    else
-      freeReplyObject (rr);
+    pthread_mutex_unlock (&c->lock);
+    return (-1);
   }
 
-  rr = redisCommand (node->conn, "ZADD %s %s %s", key, time, value);
-  if (rr == NULL)
-    WARNING("ZADD command error. key:%s message:%s", key, node->conn->errstr);
+  /* Appending only fails if we are out of memory. */
+  if (redisAppendCommand (c->conn, "ZADD %s %s %s", key, time, value) == REDIS_OK)
+    c->pending_commands++;
   else
-    freeReplyObject (rr);
+    WARNING("ZADD command error. key:%s message:%s", key, c->conn->errstr);
 
   if (node->max_set_size >= 0)
   {
-    rr = redisCommand (node->conn, "ZREMRANGEBYRANK %s %d %d", key, 0, (-1 * node->max_set_size) - 1);
-    if (rr == NULL)
-      WARNING("ZREMRANGEBYRANK command error. key:%s message:%s", key, node->conn->errstr);
+    if (redisAppendCommand (c->conn, "ZREMRANGEBYRANK %s %d %d", key, 0, (-1 * node->max_set_size) - 1) == REDIS_OK)
+      c->pending_commands++;
     else
-      freeReplyObject (rr);
+      WARNING("ZREMRANGEBYRANK command error. key:%s message:%s", key, c->conn->errstr);
   }
 
   /* TODO(octo): This is more overhead than necessary. Use the cache and
    * metadata to determine if it is a new metric and call SADD only once for
    * each metric. */
-  rr = redisCommand (node->conn, "SADD %svalues %s",
-      (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX,
-      ident);
-  if (rr==NULL)
-    WARNING("SADD command error. ident:%s message:%s", ident, node->conn->errstr);
+  if (redisAppendCommand (c->conn, "SADD %svalues %s",
+        (node->prefix != NULL) ? node->prefix : REDIS_DEFAULT_PREFIX,
+        ident) == REDIS_OK)
+    c->pending_commands++;
   else
-    freeReplyObject (rr);
+    WARNING("SADD command error. ident:%s message:%s", ident, c->conn->errstr);
 
-  pthread_mutex_unlock (&node->lock);
+  if (c->pending_values == 0)
+    c->first_pending = cdtime ();
+  c->pending_values++;
 
-  return (0);
+  status = 0;
+  if ((c->pending_values >= node->pipeline_size)
+      || ((cdtime () - c->first_pending) >= node->pipeline_timeout))
+    status = wr_flush_nolock (node, c);
+
+  pthread_mutex_unlock (&c->lock);
+
+  return (status);
 } /* }}} int wr_write */
 
+/* Sends the pipelines which have waited for at least "timeout". */
+static int wr_flush_node (wr_node_t *node, cdtime_t timeout) /* {{{ */
+{
+  cdtime_t now = cdtime ();
+  int status = 0;
+  int i;
+
+  for (i = 0; i < node->conns_num; i++)
+  {
+    wr_conn_t *c = node->conns + i;
+
+    pthread_mutex_lock (&c->lock);
+    if ((c->pending_values > 0)
+        && ((now - c->first_pending) >= timeout)
+        && (wr_flush_nolock (node, c) != 0))
+      status = -1;
+    pthread_mutex_unlock (&c->lock);
+  }
+
+  return (status);
+} /* }}} int wr_flush_node */
+
+static int wr_flush (cdtime_t timeout, /* {{{ */
+    const char *identifier __attribute__((unused)),
+    user_data_t *ud)
+{
+  return (wr_flush_node (ud->data, timeout));
+} /* }}} int wr_flush */
+
+static int wr_pipeline_timeout (user_data_t *ud) /* {{{ */
+{
+  wr_node_t *node = ud->data;
+
+  return (wr_flush_node (node, node->pipeline_timeout));
+} /* }}} int wr_pipeline_timeout */
+
 static void wr_config_free (void *ptr) /* {{{ */
 {
   wr_node_t *node = ptr;
+  int i;
 
   if (node == NULL)
     return;
 
-  if (node->conn != NULL)
+  for (i = 0; i < node->conns_num; i++)
   {
-    redisFree (node->conn);
-    node->conn = NULL;
+    wr_conn_t *c = node->conns + i;
+
+    if ((c->conn != NULL) && (c->pending_commands > 0))
+      wr_flush_nolock (node, c);
+    wr_disconnect (c);
+    pthread_mutex_destroy (&c->lock);
   }
+  sfree (node->conns);
 
+  pthread_mutex_destroy (&node->lock);
   sfree (node->host);
+  sfree (node->prefix);
   sfree (node);
 } /* }}} void wr_config_free */
 
@@ -168,6 +320,7 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
 {
   wr_node_t *node;
   int timeout;
+  int conns_num = REDIS_DEFAULT_CONNECTIONS;
   int status;
   int i;
 
@@ -178,11 +331,12 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
   node->port = 0;
   node->timeout.tv_sec = 0;
   node->timeout.tv_usec = 1000;
-  node->conn = NULL;
   node->prefix = NULL;
   node->database = 0;
   node->max_set_size = -1;
   node->store_rates = 1;
+  node->pipeline_size = 1;
+  node->pipeline_timeout = TIME_T_TO_CDTIME_T (1);
   pthread_mutex_init (&node->lock, /* attr = */ NULL);
 
   status = cf_util_get_string_buffer (ci, node->name, sizeof (node->name));
@@ -223,6 +377,25 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
     else if (strcasecmp ("StoreRates", child->key) == 0) {
       status = cf_util_get_boolean (child, &node->store_rates);
     }
+    else if (strcasecmp ("Connections", child->key) == 0) {
+      status = cf_util_get_int (child, &conns_num);
+      if ((status == 0) && (conns_num < 1))
+      {
+        WARNING ("write_redis plugin: \"Connections\" must be at least 1.");
+        status = -1;
+      }
+    }
+    else if (strcasecmp ("PipelineSize", child->key) == 0) {
+      status = cf_util_get_int (child, &node->pipeline_size);
+      if ((status == 0) && (node->pipeline_size < 1))
+      {
+        WARNING ("write_redis plugin: \"PipelineSize\" must be at least 1.");
+        status = -1;
+      }
+    }
+    else if (strcasecmp ("PipelineTimeout", child->key) == 0) {
+      status = cf_util_get_cdtime (child, &node->pipeline_timeout);
+    }
     else
       WARNING ("write_redis plugin: Ignoring unknown config option \"%s\".",
           child->key);
@@ -231,6 +404,19 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (i = 0; i < ci->children_num; i++) */
 
+  if (status == 0)
+  {
+    node->conns = calloc ((size_t) conns_num, sizeof (*node->conns));
+    if (node->conns == NULL)
+      status = ENOMEM;
+    else
+    {
+      node->conns_num = conns_num;
+      for (i = 0; i < node->conns_num; i++)
+        pthread_mutex_init (&node->conns[i].lock, /* attr = */ NULL);
+    }
+  }
+
   if (status == 0)
   {
     char cb_name[DATA_MAX_NAME_LEN];
@@ -242,6 +428,23 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
     ud.free_func = wr_config_free;
 
     status = plugin_register_write (cb_name, wr_write, &ud);
+    if (status == 0)
+    {
+      /* The write callback owns the node. */
+      ud.free_func = NULL;
+      plugin_register_flush (cb_name, wr_flush, &ud);
+
+      if (node->pipeline_size > 1)
+      {
+        ssnprintf (cb_name, sizeof (cb_name), "write_redis/%s/pipeline",
+            node->name);
+        plugin_register_complex_read (/* group = */ NULL, cb_name,
+            wr_pipeline_timeout, node->pipeline_timeout, &ud);
+      }
+    }
+    else
+      /* plugin_register_write() has freed the node already. */
+      return (status);
   }
 
   if (status != 0)
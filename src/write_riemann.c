@@ -61,6 +61,7 @@ struct riemann_host {
 	riemann_client_t	*client;
 	double			 ttl_factor;
     cdtime_t         batch_init;
+    size_t           batch_size;
     int              batch_max;
     int              batch_timeout;
 	int			     reference_count;
@@ -412,7 +413,8 @@ static riemann_message_t *wrr_value_list_to_message(struct riemann_host const *h
 {
 	riemann_message_t *msg;
 	size_t i;
-	gauge_t *rates = NULL;
+	gauge_t const *rates = NULL;
+	gauge_t *rates_copy = NULL;
 
 	/* Initialize the Msg structure. */
 	msg = riemann_message_new();
@@ -424,7 +426,9 @@ static riemann_message_t *wrr_value_list_to_message(struct riemann_host const *h
 
 	if (host->store_rates)
 	{
-		rates = uc_get_rate(ds, vl);
+		rates = uc_get_rate_dispatched(ds, vl);
+		if (rates == NULL)
+			rates = rates_copy = uc_get_rate(ds, vl);
 		if (rates == NULL)
 		{
 			ERROR("write_riemann plugin: uc_get_rate failed.");
@@ -442,13 +446,13 @@ static riemann_message_t *wrr_value_list_to_message(struct riemann_host const *h
 		if (event == NULL)
 		{
 			riemann_message_free(msg);
-			sfree(rates);
+			sfree(rates_copy);
 			return (NULL);
 		}
 		riemann_message_append_events(msg, event, NULL);
 	}
 
-	sfree(rates);
+	sfree(rates_copy);
 	return (msg);
 } /* }}} riemann_message_t *wrr_value_list_to_message */
 
@@ -461,17 +465,20 @@ static int wrr_batch_flush_nolock(cdtime_t timeout,
 	cdtime_t    now;
 	int         status = 0;
 
+	if (host->batch_msg == NULL)
+		return status;
+
     now = cdtime();
 	if (timeout > 0) {
 		if ((host->batch_init + timeout) > now) {
 			return status;
         }
 	}
-	wrr_send_nolock(host, host->batch_msg);
+	status = wrr_send_nolock(host, host->batch_msg);
 	riemann_message_free(host->batch_msg);
 
-	host->batch_init = now;
 	host->batch_msg = NULL;
+	host->batch_size = 0;
 	return status;
 }
 
@@ -499,6 +506,14 @@ static int wrr_batch_flush(cdtime_t timeout,
 	return status;
 }
 
+static int wrr_batch_flush_timeout(user_data_t *user_data) /* {{{ */
+{
+	struct riemann_host *host = user_data->data;
+
+	return wrr_batch_flush(TIME_T_TO_CDTIME_T((time_t)host->batch_timeout),
+			       /* identifier = */ NULL, user_data);
+} /* }}} int wrr_batch_flush_timeout */
+
 static int wrr_batch_add_value_list(struct riemann_host *host, /* {{{ */
 				    data_set_t const *ds,
 				    value_list_t const *vl,
@@ -513,10 +528,17 @@ static int wrr_batch_add_value_list(struct riemann_host *host, /* {{{ */
 	if (msg == NULL)
 		return -1;
 
+	/* The message holds nothing but events, so its packed size is exactly
+	 * what its events add to the batch. Packing the whole batch again for
+	 * every value list would be quadratic in the batch size. */
+	len = riemann_message_get_packed_size(msg);
+
 	pthread_mutex_lock(&host->lock);
 
 	if (host->batch_msg == NULL) {
 		host->batch_msg = msg;
+		host->batch_size = len;
+		host->batch_init = cdtime();
 	} else {
 		int status;
 
@@ -533,11 +555,11 @@ static int wrr_batch_add_value_list(struct riemann_host *host, /* {{{ */
 			ERROR("write_riemann plugin: out of memory");
 			return -1;
 		}
+		host->batch_size += len;
 	}
 
-	len = riemann_message_get_packed_size(host->batch_msg);
 	ret = 0;
-	if ((host->batch_max < 0) || (((size_t) host->batch_max) <= len)) {
+	if ((host->batch_max < 0) || (((size_t) host->batch_max) <= host->batch_size)) {
 		ret = wrr_batch_flush_nolock(0, host);
 	} else {
         if (host->batch_timeout > 0) {
@@ -597,7 +619,7 @@ static int wrr_write(const data_set_t *ds, /* {{{ */
   }
 
   if (host->client_type != RIEMANN_CLIENT_UDP && host->batch_mode) {
-      wrr_batch_add_value_list(host, ds, vl, statuses);
+      status = wrr_batch_add_value_list(host, ds, vl, statuses);
   } else {
     msg = wrr_value_list_to_message(host, ds, vl, statuses);
     if (msg == NULL)
@@ -626,6 +648,8 @@ static void wrr_free(void *p) /* {{{ */
       return;
     }
 
+  /* Send the last batch, if any. */
+  wrr_batch_flush_nolock(0, host);
   wrr_disconnect(host);
 
   pthread_mutex_destroy(&host->lock);
@@ -828,6 +852,19 @@ static int wrr_config_node(oconfig_item_t *ci) /* {{{ */
   if (host->client_type != RIEMANN_CLIENT_UDP && host->batch_mode) {
     ud.free_func = NULL;
     plugin_register_flush(callback_name, wrr_batch_flush, &ud);
+
+    /* Without this, the timeout is only checked when values arrive. */
+    if (host->batch_timeout > 0) {
+      char batch_name[DATA_MAX_NAME_LEN];
+
+      ssnprintf(batch_name, sizeof(batch_name), "write_riemann/%s/batch",
+                host->name);
+      plugin_register_complex_read(/* group = */ NULL, batch_name,
+                                   wrr_batch_flush_timeout,
+                                   TIME_T_TO_CDTIME_T((time_t)host->batch_timeout),
+                                   &ud);
+    }
+    ud.free_func = wrr_free;
   }
   if (status != 0)
     WARNING("write_riemann plugin: plugin_register_write (\"%s\") "
@@ -200,8 +200,9 @@ int write_riemann_threshold_check (const data_set_t *ds, const value_list_t *vl,
 				   int *statuses)
 { /* {{{ */
   threshold_t *th;
+  threshold_tree_ref_t *ref = NULL;
   gauge_t *values;
-  int status;
+  int status = 0;
 
   assert (vl->values_len > 0);
   memset(statuses, 0, vl->values_len * sizeof(*statuses));
@@ -209,10 +210,10 @@ int write_riemann_threshold_check (const data_set_t *ds, const value_list_t *vl,
   if (threshold_tree == NULL)
 	  return 0;
 
-  /* Is this lock really necessary? So far, thresholds are only inserted at
-   * startup. -octo */
+  /* The threshold plugin may replace the thresholds on reload. The
+   * reference keeps them from being freed while they are checked. */
   pthread_mutex_lock (&threshold_lock);
-  th = threshold_search (vl);
+  th = threshold_acquire (vl, &ref);
   pthread_mutex_unlock (&threshold_lock);
   if (th == NULL)
 	  return (0);
@@ -220,17 +221,15 @@ int write_riemann_threshold_check (const data_set_t *ds, const value_list_t *vl,
   DEBUG ("ut_check_threshold: Found matching threshold(s)");
 
   values = uc_get_rate (ds, vl);
-  if (values == NULL)
-	  return (0);
 
-  while (th != NULL)
+  while ((values != NULL) && (th != NULL))
   {
     status = ut_check_one_threshold (ds, vl, th, values, statuses);
     if (status < 0)
     {
       ERROR ("ut_check_threshold: ut_check_one_threshold failed.");
-      sfree (values);
-      return (-1);
+      status = -1;
+      break;
     }
 
     th = th->next;
@@ -238,7 +237,11 @@ int write_riemann_threshold_check (const data_set_t *ds, const value_list_t *vl,
 
   sfree (values);
 
-  return (0);
+  pthread_mutex_lock (&threshold_lock);
+  threshold_release (ref);
+  pthread_mutex_unlock (&threshold_lock);
+
+  return ((status < 0) ? -1 : 0);
 } /* }}} int ut_check_threshold */
 
 
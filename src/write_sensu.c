@@ -59,6 +59,9 @@ struct sensu_host {
 	_Bool            metrics;
 	_Bool			 store_rates;
 	_Bool			 always_append_ds;
+	/* Keep the connection open and send all events of a batch with one
+	 * write, separated by newlines. */
+	_Bool			 persistent;
 	char			*separator;
 	char			*node;
 	char			*service;
@@ -786,19 +789,54 @@ static char *sensu_notification_to_json(struct sensu_host *host, /* {{{ */
 	return ret_str;
 } /* }}} char *sensu_notification_to_json */
 
-static int sensu_send_msg(struct sensu_host *host, const char *msg) /* {{{ */
+/* Discards the replies of the Sensu client to the events sent over a
+ * persistent connection. Closes the socket if the client has closed it, so
+ * that the next write reconnects. */
+static void sensu_drain(struct sensu_host *host) /* {{{ */
+{
+	char buffer[256];
+	ssize_t status;
+
+	while (host->s >= 0) {
+		status = recv(host->s, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (status > 0)
+			continue;
+		if ((status == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)
+					&& (errno != EINTR)))
+			sensu_close_socket(host);
+		break;
+	}
+} /* }}} void sensu_drain */
+
+static int sensu_send_msg(struct sensu_host *host, /* {{{ */
+		const char *msg, size_t msg_len)
 {
 	int status = 0;
-	size_t  buffer_len;
+	_Bool reconnected = 0;
 
-	status = sensu_connect(host);
-	if (status != 0)
-		return status;
+	if (host->s < 0) {
+		status = sensu_connect(host);
+		if (status != 0)
+			return status;
+		reconnected = 1;
+	}
 
-	buffer_len = strlen(msg);
+	status = (int) swrite(host->s, msg, msg_len);
+	/* A persistent connection may have been closed by the client since the
+	 * last write. Retry once with a new one. */
+	if ((status != 0) && host->persistent && !reconnected) {
+		DEBUG("write_sensu plugin: Reconnecting to Sensu.");
+		sensu_close_socket(host);
+		status = sensu_connect(host);
+		if (status != 0)
+			return status;
+		status = (int) swrite(host->s, msg, msg_len);
+	}
 
-	status = (int) swrite(host->s, msg, buffer_len);
-	sensu_close_socket(host);
+	if (host->persistent && (status == 0))
+		sensu_drain(host);
+	else
+		sensu_close_socket(host);
 
 	if (status != 0) {
 		char errbuf[1024];
@@ -813,11 +851,12 @@ static int sensu_send_msg(struct sensu_host *host, const char *msg) /* {{{ */
 } /* }}} int sensu_send_msg */
 
 
-static int sensu_send(struct sensu_host *host, char const *msg) /* {{{ */
+static int sensu_send(struct sensu_host *host, /* {{{ */
+		char const *msg, size_t msg_len)
 {
 	int status = 0;
 
-	status = sensu_send_msg(host, msg);
+	status = sensu_send_msg(host, msg, msg_len);
 	if (status != 0) {
 		host->flags &= ~F_READY;
 		if (host->res != NULL) {
@@ -830,47 +869,95 @@ static int sensu_send(struct sensu_host *host, char const *msg) /* {{{ */
 	return 0;
 } /* }}} int sensu_send */
 
+/* Appends an event and a newline to the events of a batch. */
+static int sensu_batch_append(char **buffer, size_t *len, /* {{{ */
+		size_t *size, char const *msg)
+{
+	size_t msg_len = strlen(msg);
+
+	if ((*len + msg_len + 2) > *size) {
+		size_t new_size = (*size > 0) ? *size : 4096;
+		char *tmp;
 
-static int sensu_write(const data_set_t *ds, /* {{{ */
-	      const value_list_t *vl,
-	      user_data_t *ud)
+		while ((*len + msg_len + 2) > new_size)
+			new_size *= 2;
+		tmp = realloc(*buffer, new_size);
+		if (tmp == NULL) {
+			ERROR("write_sensu plugin: Unable to alloc memory");
+			return -1;
+		}
+		*buffer = tmp;
+		*size = new_size;
+	}
+
+	memcpy(*buffer + *len, msg, msg_len);
+	*len += msg_len;
+	(*buffer)[(*len)++] = '\n';
+	(*buffer)[*len] = 0;
+	return 0;
+} /* }}} int sensu_batch_append */
+
+/* Creates one event per data source. With a persistent connection, the
+ * events of all value lists of a batch are sent with a single write. */
+static int sensu_write(const write_batch_entry_t *entries, /* {{{ */
+		size_t entries_num, user_data_t *ud)
 {
 	int status = 0;
-	int statuses[vl->values_len];
 	struct sensu_host	*host = ud->data;
-	gauge_t *rates = NULL;
+	char *batch = NULL;
+	size_t batch_len = 0;
+	size_t batch_size = 0;
 	size_t i;
-	char *msg;
+	size_t j;
 
 	pthread_mutex_lock(&host->lock);
-	memset(statuses, 0, vl->values_len * sizeof(*statuses));
 
-	if (host->store_rates) {
-		rates = uc_get_rate(ds, vl);
-		if (rates == NULL) {
-			ERROR("write_sensu plugin: uc_get_rate failed.");
-			pthread_mutex_unlock(&host->lock);
-			return -1;
-		}
-	}
-	for (i = 0; i < vl->values_len; i++) {
-		msg = sensu_value_to_json(host, ds, vl, (int) i, rates, statuses[i]);
-		if (msg == NULL) {
-			sfree(rates);
-			pthread_mutex_unlock(&host->lock);
-			return -1;
+	for (j = 0; (j < entries_num) && (status == 0); j++) {
+		const data_set_t *ds = entries[j].ds;
+		const value_list_t *vl = entries[j].vl;
+		int statuses[vl->values_len];
+		gauge_t const *rates = NULL;
+		gauge_t *rates_copy = NULL;
+
+		memset(statuses, 0, vl->values_len * sizeof(*statuses));
+
+		if (host->store_rates) {
+			rates = uc_get_rate_dispatched(ds, vl);
+			if (rates == NULL)
+				rates = rates_copy = uc_get_rate(ds, vl);
+			if (rates == NULL) {
+				ERROR("write_sensu plugin: uc_get_rate failed.");
+				status = -1;
+				break;
+			}
 		}
-		status = sensu_send(host, msg);
-		free(msg);
-		if (status != 0) {
-			ERROR("write_sensu plugin: sensu_send failed with status %i", status);
-			pthread_mutex_unlock(&host->lock);
-			sfree(rates);
-			return status;
+		for (i = 0; i < vl->values_len; i++) {
+			char *msg;
+
+			msg = sensu_value_to_json(host, ds, vl, (int) i, rates, statuses[i]);
+			if (msg == NULL) {
+				status = -1;
+				break;
+			}
+			if (host->persistent)
+				status = sensu_batch_append(&batch, &batch_len,
+						&batch_size, msg);
+			else
+				status = sensu_send(host, msg, strlen(msg));
+			free(msg);
+			if (status != 0)
+				break;
 		}
+		sfree(rates_copy);
 	}
-	sfree(rates);
+
+	if ((status == 0) && (batch_len > 0))
+		status = sensu_send(host, batch, batch_len);
+	if (status != 0)
+		ERROR("write_sensu plugin: sensu_send failed with status %i", status);
+
 	pthread_mutex_unlock(&host->lock);
+	sfree(batch);
 	return status;
 } /* }}} int sensu_write */
 
@@ -888,7 +975,7 @@ static int sensu_notification(const notification_t *n, user_data_t *ud) /* {{{ *
 		return -1;
 	}
 
-	status = sensu_send(host, msg);
+	status = sensu_send(host, msg, strlen(msg));
 	free(msg);
 	if (status != 0)
 		ERROR("write_sensu plugin: sensu_send failed with status %i", status);
@@ -950,6 +1037,8 @@ static int sensu_config_node(oconfig_item_t *ci) /* {{{ */
 	host->metrics = 0;
 	host->store_rates = 1;
 	host->always_append_ds = 0;
+	host->persistent = 0;
+	host->s = -1;
 	host->metric_handlers.nb_strs = 0;
 	host->metric_handlers.strs = NULL;
 	host->notification_handlers.nb_strs = 0;
@@ -1022,6 +1111,10 @@ static int sensu_config_node(oconfig_item_t *ci) /* {{{ */
 			status = cf_util_get_boolean(child, &host->store_rates);
 			if (status != 0)
 				break;
+		} else if (strcasecmp("PersistentConnection", child->key) == 0) {
+			status = cf_util_get_boolean(child, &host->persistent);
+			if (status != 0)
+				break;
 		} else if (strcasecmp("AlwaysAppendDS", child->key) == 0) {
 			status = cf_util_get_boolean(child,
 					&host->always_append_ds);
@@ -1072,9 +1165,9 @@ static int sensu_config_node(oconfig_item_t *ci) /* {{{ */
 	pthread_mutex_lock(&host->lock);
 
 	if (host->metrics) {
-		status = plugin_register_write(callback_name, sensu_write, &ud);
+		status = plugin_register_write_batch(callback_name, sensu_write, &ud);
 		if (status != 0)
-			WARNING("write_sensu plugin: plugin_register_write (\"%s\") "
+			WARNING("write_sensu plugin: plugin_register_write_batch (\"%s\") "
 					"failed with status %i.",
 					callback_name, status);
 		else /* success */
@@ -38,6 +38,11 @@
  *     Port "4242"
  *     HostTags "status=production deviceclass=www"
  *   </Node>
+ *   <Node>
+ *     URL "http://localhost:4242/api/put"
+ *     MaxInFlight 4
+ *     Compress "gzip"
+ *   </Node>
  * </Plugin>
  */
 
@@ -51,6 +56,10 @@
 #include <pthread.h>
 #include <netdb.h>
 
+#if HAVE_LIBCURL
+# include "utils_http_sender.h"
+#endif
+
 #ifndef WT_DEFAULT_NODE
 # define WT_DEFAULT_NODE "localhost"
 #endif
@@ -68,6 +77,15 @@
 # define WT_SEND_BUF_SIZE 1428
 #endif
 
+/* Size of the JSON array POSTed to /api/put, about 3500 data points. */
+#ifndef WT_DEFAULT_HTTP_BUF_SIZE
+# define WT_DEFAULT_HTTP_BUF_SIZE 524288
+#endif
+
+#ifndef WT_DEFAULT_HTTP_QUEUE_LENGTH
+# define WT_DEFAULT_HTTP_QUEUE_LENGTH 16
+#endif
+
 /*
  * Private variables
  */
@@ -87,6 +105,21 @@ struct wt_callback
     size_t   send_buf_fill;
     cdtime_t send_buf_init_time;
 
+    /* If set, data points are POSTed to this URL as JSON arrays instead of
+     * being sent as "put" lines. */
+    char     *url;
+#if HAVE_LIBCURL
+    http_sender_t *sender;
+    struct curl_slist *headers;
+    char     *http_buf;
+    int      http_buf_size;
+    size_t   http_buf_fill;
+    int      max_in_flight;
+    int      queue_length;
+    int      compress;
+    int      timeout;
+#endif
+
     pthread_mutex_t send_lock;
 };
 
@@ -122,6 +155,123 @@ static int wt_send_buffer(struct wt_callback *cb)
     return 0;
 }
 
+#if HAVE_LIBCURL
+/* Closes the JSON array being filled and hands it to the sender.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wt_http_flush_nolock(struct wt_callback *cb)
+{
+    int status;
+
+    if (cb->http_buf_fill <= 0)
+    {
+        cb->send_buf_init_time = cdtime();
+        return 0;
+    }
+
+    /* wt_http_append_nolock() leaves room for the closing bracket. */
+    cb->http_buf[cb->http_buf_fill] = ']';
+    cb->http_buf_fill++;
+
+    status = http_sender_submit(cb->sender, &cb->http_buf, cb->http_buf_fill);
+    cb->http_buf_fill = 0;
+    cb->send_buf_init_time = cdtime();
+
+    return status;
+}
+
+/* Appends one JSON object to the array being filled.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wt_http_append_nolock(struct wt_callback *cb,
+                                 const char *message, size_t message_len)
+{
+    int status;
+
+    /* One byte for the '[' or ',' and one for the closing ']'. */
+    if ((message_len + 2) > (size_t) cb->http_buf_size)
+    {
+        ERROR("write_tsdb plugin: BufferSize is too small for a data point "
+              "of %zu bytes.", message_len);
+        return -1;
+    }
+
+    if ((cb->http_buf_fill + message_len + 2) > (size_t) cb->http_buf_size)
+    {
+        status = wt_http_flush_nolock(cb);
+        if (status != 0)
+            return status;
+    }
+
+    if (cb->http_buf_fill == 0)
+        cb->send_buf_init_time = cdtime();
+
+    cb->http_buf[cb->http_buf_fill] = (cb->http_buf_fill == 0) ? '[' : ',';
+    cb->http_buf_fill++;
+    memcpy(cb->http_buf + cb->http_buf_fill, message, message_len);
+    cb->http_buf_fill += message_len;
+
+    return 0;
+}
+
+/* Sets up one of the sender's easy handles. */
+static int wt_curl_setup(CURL *curl, void *user_data)
+{
+    struct wt_callback *cb = user_data;
+
+#ifdef HAVE_CURLOPT_TIMEOUT_MS
+    if (cb->timeout > 0)
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) cb->timeout);
+#endif
+
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, cb->headers);
+    curl_easy_setopt(curl, CURLOPT_URL, cb->url);
+
+    return 0;
+}
+
+static int wt_http_init(struct wt_callback *cb)
+{
+    http_sender_config_t conf;
+    const char *encoding;
+
+    cb->headers = curl_slist_append(cb->headers,
+                                    "Content-Type: application/json");
+    cb->headers = curl_slist_append(cb->headers, "Expect:");
+    encoding = http_sender_content_encoding(cb->compress);
+    if (encoding != NULL)
+        cb->headers = curl_slist_append(cb->headers, encoding);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.plugin = "write_tsdb";
+    conf.location = cb->url;
+    conf.buffer_size = (size_t) cb->http_buf_size;
+    conf.queue_length = (size_t) cb->queue_length;
+    conf.max_in_flight = cb->max_in_flight;
+    conf.compress = cb->compress;
+    conf.log_http_error = 1;
+    conf.setup = wt_curl_setup;
+    conf.user_data = cb;
+
+    cb->sender = http_sender_create(&conf);
+    if (cb->sender == NULL)
+    {
+        ERROR("write_tsdb plugin: http_sender_create failed.");
+        return -1;
+    }
+
+    cb->http_buf = http_sender_buffer_get(cb->sender);
+    if (cb->http_buf == NULL)
+    {
+        ERROR("write_tsdb plugin: malloc(%d) failed.", cb->http_buf_size);
+        return -1;
+    }
+    cb->http_buf_fill = 0;
+
+    return 0;
+}
+#endif /* HAVE_LIBCURL */
+
 /* NOTE: You must hold cb->send_lock when calling this function! */
 static int wt_flush_nolock(cdtime_t timeout, struct wt_callback *cb)
 {
@@ -142,6 +292,11 @@ static int wt_flush_nolock(cdtime_t timeout, struct wt_callback *cb)
             return 0;
     }
 
+#if HAVE_LIBCURL
+    if (cb->url != NULL)
+        return wt_http_flush_nolock(cb);
+#endif
+
     if (cb->send_buf_fill <= 0)
     {
         cb->send_buf_init_time = cdtime();
@@ -230,7 +385,17 @@ static void wt_callback_free(void *data)
 
     pthread_mutex_lock(&cb->send_lock);
 
+#if HAVE_LIBCURL
+    if ((cb->url == NULL) || (cb->http_buf != NULL))
+        wt_flush_nolock(0, cb);
+    http_sender_destroy(cb->sender);
+    cb->sender = NULL;
+    if (cb->headers != NULL)
+        curl_slist_free_all(cb->headers);
+    sfree(cb->http_buf);
+#else
     wt_flush_nolock(0, cb);
+#endif
 
     close(cb->sock_fd);
     cb->sock_fd = -1;
@@ -238,6 +403,7 @@ static void wt_callback_free(void *data)
     sfree(cb->node);
     sfree(cb->service);
     sfree(cb->host_tags);
+    sfree(cb->url);
 
     pthread_mutex_destroy(&cb->send_lock);
 
@@ -258,7 +424,7 @@ static int wt_flush(cdtime_t timeout,
 
     pthread_mutex_lock(&cb->send_lock);
 
-    if (cb->sock_fd < 0)
+    if ((cb->url == NULL) && (cb->sock_fd < 0))
     {
         status = wt_callback_init(cb);
         if (status != 0)
@@ -282,23 +448,24 @@ static int wt_format_values(char *ret, size_t ret_len,
 {
     size_t offset = 0;
     int status;
-    gauge_t *rates = NULL;
+    gauge_t const *rates = NULL;
+    gauge_t *rates_copy = NULL;
 
     assert(0 == strcmp (ds->type, vl->type));
 
     memset(ret, 0, ret_len);
 
-#define BUFFER_ADD(...) do { \
-        status = ssnprintf (ret + offset, ret_len - offset, \
+#define BUFFER_ADD_FUNC(func, ...) do { \
+        status = func (ret + offset, ret_len - offset, \
                             __VA_ARGS__); \
         if (status < 1) \
         { \
-            sfree(rates); \
+            sfree(rates_copy); \
             return -1; \
         } \
         else if (((size_t) status) >= (ret_len - offset)) \
         { \
-            sfree(rates); \
+            sfree(rates_copy); \
             return -1; \
         } \
         else \
@@ -306,36 +473,38 @@ static int wt_format_values(char *ret, size_t ret_len,
 } while (0)
 
     if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-        BUFFER_ADD(GAUGE_FORMAT, vl->values[ds_num].gauge);
+        BUFFER_ADD_FUNC(format_gauge, vl->values[ds_num].gauge);
     else if (store_rates)
     {
         if (rates == NULL)
-            rates = uc_get_rate (ds, vl);
+            rates = uc_get_rate_dispatched (ds, vl);
+        if (rates == NULL)
+            rates = rates_copy = uc_get_rate (ds, vl);
         if (rates == NULL)
         {
             WARNING("format_values: "
                     "uc_get_rate failed.");
             return -1;
         }
-        BUFFER_ADD(GAUGE_FORMAT, rates[ds_num]);
+        BUFFER_ADD_FUNC(format_gauge, rates[ds_num]);
     }
     else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-        BUFFER_ADD("%llu", vl->values[ds_num].counter);
+        BUFFER_ADD_FUNC(format_uint64, (uint64_t) vl->values[ds_num].counter);
     else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-        BUFFER_ADD("%" PRIi64, vl->values[ds_num].derive);
+        BUFFER_ADD_FUNC(format_int64, vl->values[ds_num].derive);
     else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-        BUFFER_ADD("%" PRIu64, vl->values[ds_num].absolute);
+        BUFFER_ADD_FUNC(format_uint64, vl->values[ds_num].absolute);
     else
     {
         ERROR("format_values plugin: Unknown data source type: %i",
               ds->ds[ds_num].type);
-        sfree(rates);
+        sfree(rates_copy);
         return -1;
     }
 
-#undef BUFFER_ADD
+#undef BUFFER_ADD_FUNC
 
-    sfree(rates);
+    sfree(rates_copy);
     return 0;
 }
 
@@ -404,6 +573,119 @@ static int wt_format_name(char *ret, int ret_len,
     return 0;
 }
 
+#if HAVE_LIBCURL
+/* Appends the first "string_len" bytes of "string" to "buffer" as a quoted
+ * JSON string. */
+static int wt_json_add_string(char *buffer, size_t buffer_size,
+                              size_t *offset, const char *string,
+                              size_t string_len)
+{
+    size_t pos = *offset;
+    size_t i;
+
+    if ((pos + 2) >= buffer_size)
+        return -1;
+    buffer[pos++] = '"';
+
+    for (i = 0; i < string_len; i++)
+    {
+        char c = string[i];
+
+        if ((pos + 3) >= buffer_size)
+            return -1;
+
+        if ((c == '"') || (c == '\\'))
+            buffer[pos++] = '\\';
+        else if ((unsigned char) c <= 0x1F)
+            c = '?';
+        buffer[pos++] = c;
+    }
+
+    buffer[pos++] = '"';
+    buffer[pos] = 0;
+    *offset = pos;
+
+    return 0;
+}
+
+/* Appends the "key=value" pairs of the space separated "tags" as members of
+ * a JSON object. Every member is preceded by a comma. */
+static int wt_json_add_tags(char *buffer, size_t buffer_size,
+                            size_t *offset, const char *tags)
+{
+    while (*tags != 0)
+    {
+        const char *equals;
+        size_t len;
+
+        tags += strspn(tags, " ");
+        len = strcspn(tags, " ");
+        if (len == 0)
+            break;
+
+        equals = memchr(tags, '=', len);
+        if ((equals != NULL) && (equals != tags))
+        {
+            size_t key_len = (size_t) (equals - tags);
+
+            if ((*offset + 1) >= buffer_size)
+                return -1;
+            buffer[(*offset)++] = ',';
+            if (wt_json_add_string(buffer, buffer_size, offset,
+                                   tags, key_len) != 0)
+                return -1;
+            if ((*offset + 1) >= buffer_size)
+                return -1;
+            buffer[(*offset)++] = ':';
+            if (wt_json_add_string(buffer, buffer_size, offset,
+                                   equals + 1, len - key_len - 1) != 0)
+                return -1;
+        }
+
+        tags += len;
+    }
+
+    return 0;
+}
+
+/* Formats one data point the way OpenTSDB's /api/put expects it. Returns the
+ * length of the message or -1 if "buffer" is too small. */
+static int wt_format_json(char *buffer, size_t buffer_size,
+                          const char *key, const char *value, cdtime_t time,
+                          const char *host, const char *tags,
+                          const char *host_tags)
+{
+    size_t offset = 0;
+    int status;
+
+#define BUFFER_ADD(...) do { \
+        status = ssnprintf(buffer + offset, buffer_size - offset, \
+                           __VA_ARGS__); \
+        if ((status < 0) || (((size_t) status) >= (buffer_size - offset))) \
+            return -1; \
+        offset += (size_t) status; \
+} while (0)
+
+    BUFFER_ADD("{\"metric\":");
+    if (wt_json_add_string(buffer, buffer_size, &offset,
+                           key, strlen(key)) != 0)
+        return -1;
+    BUFFER_ADD(",\"timestamp\":%.0f,\"value\":%s,\"tags\":{\"fqdn\":",
+               CDTIME_T_TO_DOUBLE(time), value);
+    if (wt_json_add_string(buffer, buffer_size, &offset,
+                           host, strlen(host)) != 0)
+        return -1;
+    if ((wt_json_add_tags(buffer, buffer_size, &offset, tags) != 0)
+        || (wt_json_add_tags(buffer, buffer_size, &offset, host_tags) != 0))
+        return -1;
+    BUFFER_ADD("}}");
+
+#undef BUFFER_ADD
+
+    return (int) offset;
+}
+#endif /* HAVE_LIBCURL */
+
 static int wt_send_message (const char* key, const char* value,
                             cdtime_t time, struct wt_callback *cb,
                             const char* host, meta_data_t *md)
@@ -434,6 +716,27 @@ static int wt_send_message (const char* key, const char* value,
         }
     }
 
+#if HAVE_LIBCURL
+    if (cb->url != NULL)
+    {
+        status = wt_format_json(message, sizeof(message), key, value, time,
+                                host, tags, host_tags);
+        sfree(temp);
+        if (status < 0)
+        {
+            ERROR("write_tsdb plugin: message buffer too small for %s.", key);
+            return -1;
+        }
+        message_len = (size_t) status;
+
+        pthread_mutex_lock(&cb->send_lock);
+        status = wt_http_append_nolock(cb, message, message_len);
+        pthread_mutex_unlock(&cb->send_lock);
+
+        return status;
+    }
+#endif
+
     status = ssnprintf (message,
                              sizeof(message),
                              "put %s %.0f %s fqdn=%s %s %s\r\n",
@@ -572,6 +875,26 @@ static int wt_write(const data_set_t *ds, const value_list_t *vl,
     return status;
 }
 
+#if HAVE_LIBCURL
+/* Like cf_util_get_int(), but ignores values smaller than "min". */
+static void wt_config_int(oconfig_item_t *ci, int *ret, int min)
+{
+    int tmp = 0;
+
+    if (cf_util_get_int(ci, &tmp) != 0)
+        return;
+
+    if (tmp < min)
+    {
+        ERROR("write_tsdb plugin: Ignoring invalid %s setting (%d).",
+              ci->key, tmp);
+        return;
+    }
+
+    *ret = tmp;
+}
+#endif
+
 static int wt_config_tsd(oconfig_item_t *ci)
 {
     struct wt_callback *cb;
@@ -590,6 +913,12 @@ static int wt_config_tsd(oconfig_item_t *ci)
     cb->service = NULL;
     cb->host_tags = NULL;
     cb->store_rates = 0;
+#if HAVE_LIBCURL
+    cb->http_buf_size = WT_DEFAULT_HTTP_BUF_SIZE;
+    cb->max_in_flight = 1;
+    cb->queue_length = WT_DEFAULT_HTTP_QUEUE_LENGTH;
+    cb->compress = HTTP_COMPRESS_NONE;
+#endif
 
     pthread_mutex_init (&cb->send_lock, NULL);
 
@@ -607,6 +936,24 @@ static int wt_config_tsd(oconfig_item_t *ci)
             cf_util_get_boolean(child, &cb->store_rates);
         else if (strcasecmp("AlwaysAppendDS", child->key) == 0)
             cf_util_get_boolean(child, &cb->always_append_ds);
+#if HAVE_LIBCURL
+        else if (strcasecmp("URL", child->key) == 0)
+            cf_util_get_string(child, &cb->url);
+        else if (strcasecmp("BufferSize", child->key) == 0)
+            wt_config_int(child, &cb->http_buf_size, 1024);
+        else if (strcasecmp("MaxInFlight", child->key) == 0)
+            wt_config_int(child, &cb->max_in_flight, 1);
+        else if (strcasecmp("SendQueueLength", child->key) == 0)
+            wt_config_int(child, &cb->queue_length, 1);
+        else if (strcasecmp("Compress", child->key) == 0)
+            http_sender_config_compress(child, "write_tsdb", &cb->compress);
+        else if (strcasecmp("Timeout", child->key) == 0)
+            cf_util_get_int(child, &cb->timeout);
+#else
+        else if (strcasecmp("URL", child->key) == 0)
+            ERROR("write_tsdb plugin: The URL option is not available, "
+                  "because collectd was built without libcurl.");
+#endif
         else
         {
             ERROR("write_tsdb plugin: Invalid configuration "
@@ -614,6 +961,18 @@ static int wt_config_tsd(oconfig_item_t *ci)
         }
     }
 
+#if HAVE_LIBCURL
+    if ((cb->url != NULL) && (wt_http_init(cb) != 0))
+    {
+        wt_callback_free(cb);
+        return -1;
+    }
+
+    if (cb->url != NULL)
+        ssnprintf(callback_name, sizeof(callback_name), "write_tsdb/%s",
+                  cb->url);
+    else
+#endif
     ssnprintf(callback_name, sizeof(callback_name), "write_tsdb/%s/%s",
               cb->node != NULL ? cb->node : WT_DEFAULT_NODE,
               cb->service != NULL ? cb->service : WT_DEFAULT_SERVICE);
@@ -649,9 +1008,22 @@ static int wt_config(oconfig_item_t *ci)
     return 0;
 }
 
+#if HAVE_LIBCURL
+static int wt_init(void)
+{
+    /* Call this while collectd is still single-threaded to avoid
+     * initialization issues in libgcrypt. */
+    curl_global_init(CURL_GLOBAL_SSL);
+    return 0;
+}
+#endif
+
 void module_register(void)
 {
     plugin_register_complex_config("write_tsdb", wt_config);
+#if HAVE_LIBCURL
+    plugin_register_init("write_tsdb", wt_init);
+#endif
 }
 
 /* vim: set sw=4 ts=4 sts=4 tw=78 et : */
@@ -232,10 +232,10 @@ static int za_read (void)
 		return (-1);
 	}
 
-	ksp = llist_create ();
+	ksp = llist_create_indexed ();
 	if (ksp == NULL)
 	{
-		ERROR ("zfs_arc plugin: `llist_create' failed.");
+		ERROR ("zfs_arc plugin: `llist_create_indexed' failed.");
 		fclose (fh);
 		return (-1);
 	}
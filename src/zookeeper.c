@@ -39,6 +39,11 @@
 static char *zk_host = NULL;
 static char *zk_port = NULL;
 
+/* The four letter word commands are answered on a connection of their own:
+ * the server closes it after the response. The resolved addresses are kept
+ * instead, so only connecting is left per read. */
+static struct addrinfo *zk_ai_list = NULL;
+
 static const char *config_keys[] =
 {
 	"Host",
@@ -62,6 +67,12 @@ static int zookeeper_config(const char *key, const char *value)
 	{
 		return -1;
 	}
+
+	if (zk_ai_list != NULL)
+	{
+		freeaddrinfo (zk_ai_list);
+		zk_ai_list = NULL;
+	}
 	return 0;
 }
 
@@ -101,23 +112,23 @@ static void zookeeper_submit_derive (const char * type, const char * type_inst,
 	plugin_dispatch_values (&vl);
 } /* zookeeper_submit_derive */
 
-static int zookeeper_connect (void)
+static int zookeeper_resolve (void)
 {
-	int sk = -1;
 	int status;
 	struct addrinfo ai_hints;
-	struct addrinfo *ai;
-	struct addrinfo *ai_list;
 	const char *host;
 	const char *port;
 
+	if (zk_ai_list != NULL)
+		return (0);
+
 	memset ((void *) &ai_hints, '\0', sizeof (ai_hints));
 	ai_hints.ai_family   = AF_UNSPEC;
 	ai_hints.ai_socktype = SOCK_STREAM;
 
 	host = (zk_host != NULL) ? zk_host : ZOOKEEPER_DEF_HOST;
 	port = (zk_port != NULL) ? zk_port : ZOOKEEPER_DEF_PORT;
-	status = getaddrinfo (host, port, &ai_hints, &ai_list);
+	status = getaddrinfo (host, port, &ai_hints, &zk_ai_list);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -125,10 +136,23 @@ static int zookeeper_connect (void)
 			  (status == EAI_SYSTEM)
 			  ? sstrerror (errno, errbuf, sizeof (errbuf))
 			  : gai_strerror (status));
+		zk_ai_list = NULL;
 		return (-1);
 	}
 
-	for (ai = ai_list; ai != NULL; ai = ai->ai_next)
+	return (0);
+} /* int zookeeper_resolve */
+
+static int zookeeper_connect (void)
+{
+	int sk = -1;
+	int status;
+	struct addrinfo *ai;
+
+	if (zookeeper_resolve () != 0)
+		return (-1);
+
+	for (ai = zk_ai_list; ai != NULL; ai = ai->ai_next)
 	{
 		sk = socket (ai->ai_family, SOCK_STREAM, 0);
 		if (sk < 0)
@@ -153,7 +177,13 @@ static int zookeeper_connect (void)
 		break;
 	}
 
-	freeaddrinfo(ai_list);
+	/* The server may have moved: look the name up again next time. */
+	if (sk < 0)
+	{
+		freeaddrinfo (zk_ai_list);
+		zk_ai_list = NULL;
+	}
+
 	return (sk);
 } /* int zookeeper_connect */
 
@@ -309,8 +339,21 @@ static int zookeeper_read (void) {
 	return (0);
 } /* zookeeper_read */
 
+static int zookeeper_shutdown (void)
+{
+	if (zk_ai_list != NULL)
+		freeaddrinfo (zk_ai_list);
+	zk_ai_list = NULL;
+
+	sfree (zk_host);
+	sfree (zk_port);
+
+	return (0);
+} /* zookeeper_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("zookeeper", zookeeper_config, config_keys, config_keys_num);
 	plugin_register_read ("zookeeper", zookeeper_read);
+	plugin_register_shutdown ("zookeeper", zookeeper_shutdown);
 } /* void module_register */